@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Address Filters
+ * ===============
+ *
+ * The parts of a program that are of interest when it's traced, as address ranges and function names
+ * given on the command line. Ranges are lo-hi (inclusive) or lo+len. Names can only be turned into
+ * ranges once there are symbols, so they're kept as they were given until then, and each tool looks
+ * them up in its own symbols with addrFilterResolve. With no filter everything is of interest.
+ *
+ */
+
+#ifndef _ADDR_FILTER_H_
+#define _ADDR_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct addrRange
+{
+    uint32_t lo;
+    uint32_t hi;                                   /* ...inclusive */
+};
+
+struct addrFilter
+{
+    char **spec;                                   /* The filter as it was given, one entry per range or function */
+    unsigned int nspec;
+
+    struct addrRange *range;                       /* The ranges they came to, sorted and merged */
+    unsigned int nrange;
+    unsigned int alloc;
+    unsigned int last;                             /* The range the last address was found in */
+};
+
+/* Look up a function name, calling addrFilterAddRange for everything that has it. Returns how many did */
+typedef int ( *addrFilterLookup )( struct addrFilter *f, const char *name, void *ctx );
+
+bool addrFilterAdd( struct addrFilter *f, const char *spec );              /* False if a range can't be read */
+void addrFilterAddRange( struct addrFilter *f, uint32_t lo, uint32_t hi );
+bool addrFilterResolve( struct addrFilter *f, addrFilterLookup lookup, void *ctx ); /* False if a name's not found */
+bool addrFilterHas( struct addrFilter *f, uint32_t addr );
+void addrFilterFree( struct addrFilter *f );
+
+static inline bool addrFilterActive( const struct addrFilter *f )
+{
+    return f->nspec != 0;
+}
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
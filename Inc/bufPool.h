@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Buffer Pool
+ * ===========
+ *
+ * Allocation of the large, long lived buffers that data passes through on its way (USB transfer
+ * blocks, post-mortem rings and the like). Every buffer starts on a cache line, so nothing else
+ * shares the line it starts on, and can be asked to start on a page instead (e.g. for O_DIRECT).
+ * Buffers can also be asked for in huge pages, which cuts the TLB misses from walking through
+ * many megabytes of them. That's a request, not a demand...if the system hasn't any huge pages
+ * set aside then transparent huge pages are asked for, and failing those it's normal pages.
+ *
+ */
+
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define BUFPOOL_CACHE_LINE (64)                    /* Line size to keep things apart by (true of anything we'd run on) */
+
+#define BUFPOOL_PAGE_ALIGN (1<<0)                  /* Start the buffer on a page rather than just a cache line */
+#define BUFPOOL_HUGE       (1<<1)                  /* ...and back it with huge pages if there are any to be had */
+
+void *bufPoolAlloc( size_t len, uint32_t flags );  /* Zeroed buffer of len bytes, or NULL */
+void bufPoolFree( void *p );                       /* Give back a buffer from bufPoolAlloc (NULL is fine) */
+const char *bufPoolBacking( const void *p );       /* What the buffer ended up in, for reporting */
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Raw Capture File Writer
+ * =======================
+ *
+ * Writes the raw stream into a file, or into a numbered series of files that rotate once they
+ * reach a size or an age. Space is allocated on disk ahead of the writes and, on Linux, pages
+ * are pushed out and dropped from the page cache as they're completed, so a long capture
+ * doesn't depend on how much memory the machine has to spare. Files can be indexed by time (see
+ * captureIndex.h) so readers can start part way through them, and compressed as they're written
+ * for keeping (see captureArchive.h).
+ *
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct captureFile;
+
+/* One piece of a gathered write */
+struct captureSeg
+{
+    const void *d;
+    size_t len;
+};
+
+/* If either of rotateBytes or rotateSecs is set then files are named <name>.0000, <name>.0001 ... */
+struct captureFile *captureOpen( const char *name, uint64_t rotateBytes, uint32_t rotateSecs );
+struct captureFile *captureOpenAt( const char *name, uint64_t rotateBytes, uint32_t rotateSecs, unsigned int seq );
+bool captureSetHeader( struct captureFile *c, const void *d, size_t len ); /* Header to start this and subsequent files */
+void captureSetIndex( struct captureFile *c, uint32_t intervalmS, int syncChar ); /* Index files, syncChar -1 for any write */
+bool captureSetArchive( struct captureFile *c, int level ); /* Compress files at zlib level, 0 for the default (see captureArchive.h) */
+bool captureWrite( struct captureFile *c, const struct captureSeg *s, int nsegs ); /* Write segments, in order */
+
+/* Change when files rotate (turning a single file into a series from the next one on), or start the */
+/* next file in the series before the next write. Only whoever is writing may call these.          */
+void captureSetRotation( struct captureFile *c, uint64_t rotateBytes, uint32_t rotateSecs );
+bool captureRotate( struct captureFile *c );
+unsigned int captureNextSeq( struct captureFile *c ); /* Number the next file in the series will have */
+void captureClose( struct captureFile *c );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Compressed Capture Archive
+ * ==========================
+ *
+ * A capture file can be written compressed, for keeping rather than for working on. The file starts
+ * with a magic number, then the capture is in blocks of up to CAPTURE_ARCHIVE_BLOCK bytes, each one
+ * compressed (as a zlib stream) on its own and preceded by a header saying where in the capture it
+ * goes. Any block can be decompressed without the ones before it, so a reader can start anywhere
+ * by skipping from header to header, and a file that was cut short is good up to its last whole
+ * block. Values in the header are stored little endian;
+ *
+ *   uint32_t stored  Length of the compressed block that follows
+ *   uint32_t len     ...and of what it decompresses to
+ *   uint64_t ofs     Where in the capture the block goes
+ *   uint64_t tsuS    Host time its first byte arrived, uS since the epoch
+ *
+ * Offsets in the capture's index (see captureIndex.h) are into the decompressed capture, so they
+ * mean the same whether it's been archived or not. Opening an archive as a file stream (see
+ * stream.h) decompresses it on the fly.
+ *
+ */
+
+#ifndef _CAPTURE_ARCHIVE_H_
+#define _CAPTURE_ARCHIVE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define CAPTURE_ARCHIVE_MAGIC     "ORBARC01"
+#define CAPTURE_ARCHIVE_MAGIC_LEN (8)
+#define CAPTURE_ARCHIVE_HDR_LEN   (24)
+#define CAPTURE_ARCHIVE_BLOCK     (1024*1024)  /* Most a block holds before it's compressed */
+#define CAPTURE_ARCHIVE_LEVEL     (1)          /* zlib level to compress at, unless told otherwise */
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Capture File Index
+ * ==================
+ *
+ * A sidecar to a raw capture file, named <file>.idx, that maps host time onto places in the capture
+ * where a decoder can start. It's a magic number followed by fixed size records, in time order,
+ * written a record at a time as the capture proceeds...so it's usable even if the capture was cut
+ * short. Values are stored little endian.
+ *
+ */
+
+#ifndef _CAPTURE_INDEX_H_
+#define _CAPTURE_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define CAPTURE_INDEX_SUFFIX    ".idx"
+#define CAPTURE_INDEX_MAGIC     "ORBIDX01"
+#define CAPTURE_INDEX_MAGIC_LEN (8)
+
+/* One entry in the index */
+struct captureIndexEntry
+{
+    uint64_t tsuS;                                 /* Host time the data at ofs arrived, uS since the epoch */
+    uint64_t ofs;                                  /* Offset in the capture file of a sync point */
+};
+
+struct captureIndex;
+
+/* Writing */
+struct captureIndex *captureIndexCreate( const char *file );  /* Create index for capture file */
+bool captureIndexAdd( struct captureIndex *i, uint64_t tsuS, uint64_t ofs );
+void captureIndexClose( struct captureIndex *i );
+
+/* Reading...find the last sync point at or before startmS into the capture. False if there's no usable index */
+bool captureIndexFind( const char *file, uint64_t startmS, uint64_t *ofs );
+uint64_t captureIndexStart( const char *file, uint64_t startmS ); /* As above, but 0 (and a warning) if there's no index */
+struct captureIndexEntry *captureIndexLoad( const char *file, size_t *n ); /* Whole index, to be freed, or NULL if there's no usable one */
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include "statsRegistry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,7 +43,7 @@ struct COBS
     enum COBSPumpState s;
     int intervalCount;
     bool maxCount;
-    int error;
+    orbStat error;
     struct Frame partf;                    /* Partial frame that is being collected */
     bool selfAllocated;                    /* Flag indicating that memory was allocated by the library */
 };
@@ -50,6 +51,16 @@ struct COBS
 #define COBS_EOP_LEN (1)
 extern const uint8_t cobs_eop[COBS_EOP_LEN];
 
+/* A frame being encoded a piece at a time, straight into the caller's buffer */
+struct COBSEnc
+{
+    uint8_t *start;                         /* Start of the output */
+    uint8_t *wp;                            /* Write pointer into it */
+    uint8_t *cp;                            /* Position of the code byte for the current segment */
+    int seglen;                             /* Length of the current segment, including code byte */
+    bool maxEnded;                          /* Flag that the last segment was closed by reaching max length */
+};
+
 // ====================================================================================================
 
 const uint8_t *COBSgetFrameExtent( const uint8_t *inputEnc, int len );
@@ -57,15 +68,21 @@ bool COBSSimpleDecode( const uint8_t *inputEnc, int len, struct Frame *o );
 bool COBSisEOFRAME( const uint8_t *inputEnc );
 
 void COBSEncode( const uint8_t *frontMsg, int lfront, const uint8_t *backMsg, int lback, const uint8_t *inputMsg, int lmsg, struct Frame *o );
+void COBSEncStart( struct COBSEnc *e, uint8_t *out );
+void COBSEncAdd( struct COBSEnc *e, const uint8_t *d, int len );
+int COBSEncEnd( struct COBSEnc *e );
 
 /* Context free functions */
 void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
                void ( *packetRxed )( struct Frame *p, void *param ),
                void *param );
+void COBSPumpInPlace( struct COBS *t, uint8_t *incoming, int len,
+                      void ( *packetRxed )( uint8_t *d, int len, void *param ),
+                      void *param );
 void COBSDelete( struct COBS *t );
-static inline int COBSGetErrors( struct COBS *t )
+static inline uint64_t COBSGetErrors( struct COBS *t )
 {
-    return t ? t->error : 0;
+    return t ? STAT_READ( t->error ) : 0;
 }
 struct COBS *COBSInit( struct COBS *t );
 // ====================================================================================================
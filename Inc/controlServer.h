@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Control Server
+ * ==============
+ *
+ * A line at a time command interface over TCP, for changing how a tool is running without restarting
+ * it. It only listens on the loopback interface, since anyone who can reach it can reconfigure what it
+ * controls. Each line that arrives is handed to the tool, which answers with as many lines as it likes
+ * and finishes with one starting "OK" or "ERR", so a script knows when it has the whole answer. It
+ * runs on a thread of its own and takes one connection at a time.
+ *
+ */
+
+#ifndef _CONTROL_SERVER_H_
+#define _CONTROL_SERVER_H_
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct controlConn;
+
+/* Called for each line received, with the line ending taken off */
+typedef void ( *controlCommandCB )( char *line, struct controlConn *c, void *param );
+
+/* Send a line (or part of one) back to whoever sent the command */
+void controlPrintf( struct controlConn *c, const char *fmt, ... );
+
+bool controlServerStart( int port, controlCommandCB cb, void *param );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -31,6 +31,7 @@ struct execEntryHash
     /* Counter at assembly and source line levels */
     uint64_t count;                      /* Instruction level count */
     uint64_t scount;                     /* Source level count (applied to first instruction of a new source line) */
+    uint64_t cycles;                     /* Processor cycles spent on this instruction, when the trace says */
 
     /* Details about this instruction */
     bool     isJump;                     /* Flag if this is a jump instruction */
@@ -82,10 +83,52 @@ struct subcall
 };
 
 
+/* One calling context, a function as called through all the contexts above it. These make a tree, */
+/* built up as calls and returns are seen, which the stack formats are written out from.           */
+struct stackNode
+{
+    uint32_t addr;                      /* Function called */
+    uint32_t context;                   /* ...or for the root of a thread's calls, its context ID (with addr, the key) */
+    uint64_t self;                      /* Cost in this context, not counting anything it called */
+    struct stackNode *parent;
+    struct stackNode *children;         /* ...hashed by their addr */
+    UT_hash_handle hh;                  /* In the parent's children */
+};
+
+struct stackTree
+{
+    struct stackNode root;              /* Top of everything, with no function of its own */
+    struct stackNode *at;               /* Context currently executing */
+    uint64_t lastTicks;                 /* Time its cost has been counted up to */
+};
+
+/* Coverage of each instruction in the symbol set (indexed as its insns), as seen in the trace */
+#define COV_EXECUTED  (1<<0)                    /* Instruction was executed */
+#define COV_TAKEN     (1<<1)                    /* ...and if it's a branch, it was taken */
+#define COV_NOT_TAKEN (1<<2)                    /* ...or it wasn't */
+
+
 // ====================================================================================================
 bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct SymbolSet *ss );
-bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
+bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, bool includeCycles, uint64_t timelen,
                            struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss );
+void ext_ff_zeroCounts( struct execEntryHash *insthead, struct subcall *subcallList );
+void ext_ff_scaleCounts( struct execEntryHash *insthead, struct subcall *subcallList, double scale );
+void ext_ff_stackInit( struct stackTree *t );
+void ext_ff_stackCall( struct stackTree *t, uint32_t addr, uint64_t ticks );
+void ext_ff_stackReturn( struct stackTree *t, uint64_t ticks );
+struct stackNode *ext_ff_stackThread( struct stackTree *t, uint32_t context ); /* Root of a thread's calls (the tree's own for 0) */
+void ext_ff_stackSwitch( struct stackTree *t, struct stackNode *to, uint64_t ticks );
+void ext_ff_stackMerge( struct stackTree *t, struct stackTree *from );
+void ext_ff_stackZero( struct stackTree *t );
+void ext_ff_stackScale( struct stackTree *t, double scale );
+void ext_ff_stackDelete( struct stackTree *t );
+bool ext_ff_outputFolded( char *stackfile, struct stackTree *t, struct SymbolSet *ss );
+bool ext_ff_outputPprof( char *pproffile, const char *type, const char *unit, struct stackTree *t, struct SymbolSet *ss );
+
+bool ext_ff_mergeCoverage( char *covfile, uint8_t *cov, struct SymbolSet *ss );
+bool ext_ff_outputCoverage( char *covfile, uint8_t *cov, struct SymbolSet *ss );
+bool ext_ff_outputLcov( char *lcovfile, char *deleteMaterial, uint8_t *cov, struct SymbolSet *ss );
 // ====================================================================================================
 
 #ifdef __cplusplus
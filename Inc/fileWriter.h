@@ -21,8 +21,24 @@ extern "C" {
 #include "msgDecoder.h"
 
 // ====================================================================================================
+/* When files are pushed out to disk */
+enum fwSync
+{
+    FW_SYNC_NONE,                           /* Whenever the system gets to it */
+    FW_SYNC_CLOSE,                          /* ...and for certain when each file is closed */
+    FW_SYNC_WRITE                           /* ...and after every buffer full */
+};
+
+struct fwOptions
+{
+    enum fwSync sync;
+    bool direct;                            /* Write past the page cache (O_DIRECT), where that's possible */
+    bool prealloc;                          /* Reserve disk space ahead of the writes */
+};
+
 bool filewriterProcess( struct swMsg *m );
-bool filewriterInit( char *basedir );
+bool filewriterInit( char *basedir, const struct fwOptions *o );
+void filewriterShutdown( void );           /* Finish off any open files, waiting for them to be written */
 // ====================================================================================================
 
 #ifdef __cplusplus
@@ -21,11 +21,19 @@ extern "C" {
 // CCC - Command
 // FFF - File Number
 //
+// FW_CMD_BULK is different. The three bytes after the command byte are a length (least significant
+// byte first), and that many bytes of the file follow as plain ITM writes on FW_BULK_CHANNEL, four
+// at a time, least significant byte first. The last write can be 1, 2 or 4 bytes, anything past the
+// length is padding. Nothing else is to be sent to the filewriter until all of it has been sent.
+//
 
 #define FW_CHANNEL    (29)   // ITM Channel to be used
+#define FW_BULK_CHANNEL (30) // ...and for the data of bulk writes
 #define FW_MAX_FILES  (8)    // Number of files we support
 
 #define FW_MAX_SEND   (3)    // Maximum number of bytes in a single ITM frame
+#define FW_BULK_MIN   (16)   // Shortest write worth sending in bulk
+#define FW_BULK_MAX   ((1<<24)-1) // Longest single bulk write
 
 /* Masks and shifts to get the correct bits out of the command word */
 #define FW_FILEID(x)  ((x)&7)
@@ -44,6 +52,7 @@ extern "C" {
 #define FW_CMD_CLOSE  FW_COMMAND(3)
 #define FW_CMD_ERASE  FW_COMMAND(4)
 #define FW_CMD_WRITE  FW_COMMAND(5)
+#define FW_CMD_BULK   FW_COMMAND(6)
 
 #ifdef __cplusplus
 }
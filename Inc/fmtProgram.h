@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Channel Format Programs
+ * =======================
+ *
+ * The presentation format of a software channel (e.g. "-c 0,%08x\n") is parsed once into a short
+ * list of steps - literal text and integer conversions - which are then run for each message
+ * without going near printf. The way the format is applied is the same as it always was: if it
+ * contains %f the value is a float, if it contains %c the format is applied to each byte of the
+ * message in turn, and otherwise the value is an integer. Anything that isn't worth specialising
+ * is handed to snprintf a conversion at a time, and a format that can't be taken apart safely is
+ * given to snprintf whole, so the output is always what it would have been.
+ *
+ */
+
+#ifndef _FMT_PROGRAM_H_
+#define _FMT_PROGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct fmtProgram;
+
+struct fmtProgram *fmtProgramCompile( const char *fmt );
+
+/* Format value (len bytes of it) into o, which is max long. Returns the length, which is at most max-1 */
+size_t fmtProgramRun( const struct fmtProgram *p, uint32_t value, int len, char *o, size_t max );
+void fmtProgramFree( struct fmtProgram *p );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
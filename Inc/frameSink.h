@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Frame Sink
+ * ==========
+ *
+ * Somewhere for frames of pixels to go when there's nobody to show them to, which is either a
+ * double buffer in shared memory that another process follows, or a sequence of numbered PNG or
+ * raw image files. A sink is made from a spec of the form;
+ *
+ *   shm:<name>        e.g. shm:/orblcd
+ *   png:<pattern>     e.g. png:frames/lcd%05d.png
+ *   raw:<pattern>     ...where the pattern has one %d (with optional width) for the frame number
+ *
+ * Pixels are ARGB8888, one uint32_t apiece. Raw files are just those, a line at a time with no
+ * header, in the byte order of the host.
+ *
+ * In shared memory there's a struct frameSinkShm, then two buffers each big enough for a frame at
+ * its size. The writer fills the one that isn't in front, then makes it the front one and counts
+ * it in seq. A reader takes seq, copies the front buffer, and if seq has moved on by more than
+ * one meanwhile does it again (the buffer it was copying may have been written over). If the frame
+ * size changes the object is made afresh, and stale is set in the old one so readers know to open
+ * it again.
+ *
+ */
+
+#ifndef _FRAME_SINK_H_
+#define _FRAME_SINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define FRAMESINK_SHM_MAGIC   (0x4c43424f)         /* "OBCL" */
+#define FRAMESINK_SHM_VERSION (1)
+
+struct frameSinkShm
+{
+    _Atomic uint32_t magic;                        /* FRAMESINK_SHM_MAGIC once it's ready */
+    uint32_t version;                              /* FRAMESINK_SHM_VERSION */
+    uint32_t width;                                /* Frame size in pixels */
+    uint32_t height;
+    uint32_t pitch;                                /* Bytes from one line to the next */
+    _Atomic uint32_t front;                        /* Buffer (0 or 1) with the latest complete frame */
+    _Atomic uint32_t stale;                        /* Set when this object has been replaced */
+    uint32_t spare;
+    _Atomic uint64_t seq;                          /* Frames written */
+};
+
+/* First buffer starts on a cache line of its own, the second straight after it */
+#define FRAMESINK_SHM_HDR_LEN ((sizeof(struct frameSinkShm)+63)&~63)
+
+struct frameSink;
+
+// ====================================================================================================
+struct frameSink *frameSinkCreate( const char *spec );
+
+/* Put out a frame of w x h pixels. False if it couldn't be, which has been reported */
+bool frameSinkWrite( struct frameSink *s, const uint32_t *pixels, int w, int h );
+
+uint64_t frameSinkFrames( struct frameSink *s );   /* Frames written so far */
+void frameSinkDelete( struct frameSink *s );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
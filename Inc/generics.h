@@ -92,18 +92,63 @@ enum verbLevel {V_ERROR, V_WARN, V_INFO, V_DEBUG, V_MAX_VERBLEVEL};
 
 typedef void ( *genericsReportCB )( enum verbLevel l, const char *fmt, ... );
 
+/* State for one rate limited report site */
+struct genericsRateLimit
+{
+    uint32_t windowmS;                             /* When the current window started */
+    uint32_t count;                                /* Reports made in it */
+    uint32_t suppressed;                           /* Reports not made since the last one that was */
+};
+
+#define REPORT_RATE_WINDOW_MS (1000)
+#define REPORT_RATE_BURST     (10)                 /* Reports allowed per window from any one site */
+
+extern enum verbLevel genericsVerbLevel;
+
 char *genericsEscape( char *str );
 char *genericsUnescape( char *str );
 uint64_t genericsTimestampuS( void );
 uint32_t genericsTimestampmS( void );
+uint64_t genericsMonotonicnS( void );
 bool genericsSetReportLevel( enum verbLevel lset );
 void genericsPrintf( const char *fmt, ... );
 char *genericsGetBaseDirectory( void );
 const char *genericsBasename( const char *n );
 const char *genericsBasenameN( const char *n, int c );
 void genericsReport( enum verbLevel l, const char *fmt, ... );
+bool genericsRateLimit( struct genericsRateLimit *r, uint32_t *suppressed );
 void genericsExit( int status, const char *fmt, ... );
 
+/* Reports are queued and written out in the background. The level is checked before any arguments */
+/* are evaluated, so a report that isn't going to be seen costs next to nothing.                   */
+#define genericsReport( l, ... )                                                \
+    do                                                                          \
+    {                                                                           \
+        if ( ( l ) <= genericsVerbLevel )                                       \
+        {                                                                       \
+            ( genericsReport )( l, __VA_ARGS__ );                               \
+        }                                                                       \
+    } while ( 0 )
+
+/* For reports from the data path, which can come in floods. At most REPORT_RATE_BURST reports are */
+/* made from each place this is used in any REPORT_RATE_WINDOW_MS, and the rest are counted.      */
+#define genericsReportRateLimited( l, ... )                                     \
+    do                                                                          \
+    {                                                                           \
+        static struct genericsRateLimit _rl;                                    \
+        uint32_t _suppressed;                                                   \
+                                                                                \
+        if ( ( ( l ) <= genericsVerbLevel ) && ( genericsRateLimit( &_rl, &_suppressed ) ) ) \
+        {                                                                       \
+            if ( _suppressed )                                                  \
+            {                                                                   \
+                ( genericsReport )( l, "(%u similar reports suppressed)" EOL, _suppressed ); \
+            }                                                                   \
+                                                                                \
+            ( genericsReport )( l, __VA_ARGS__ );                               \
+        }                                                                       \
+    } while ( 0 )
+
 void genericsScreenHandling( bool screenHandling );
 
 // ====================================================================================================
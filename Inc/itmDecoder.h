@@ -11,6 +11,8 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "statsRegistry.h"
 
 #define ITM_MAX_PACKET  (14) // This length can only happen for a timestamp or some SYNC packets
 #define ITM_DATA_PACKET (4)  // This is the maximum length of everything else
@@ -52,7 +54,9 @@ enum ITMPacketType
     ITM_PT_HW,
     ITM_PT_XTN,
     ITM_PT_RSRVD,
-    ITM_PT_NISYNC
+    ITM_PT_NISYNC,
+    ITM_PT_GTS1,
+    ITM_PT_GTS2
 };
 
 /* Events from the process of pumping bytes through the ITM decoder */
@@ -102,17 +106,28 @@ enum timeDelay {TIME_CURRENT, TIME_DELAYED, EVENT_DELAYED, EVENT_AND_TIME_DELAYE
 struct ITMDecoderStats
 
 {
-    uint32_t lostSyncCount;              /* Number of times sync has been lost */
-    uint32_t syncCount;                  /* Number of times a sync event has been received */
-    uint32_t tpiuSyncCount;              /* Number of times a tpiu sync event has been received (shouldn't happen) */
-    uint32_t overflow;                   /* Number of times an overflow occured */
-    uint32_t SWPkt;                      /* Number of SW Packets received */
-    uint32_t TSPkt;                      /* Number of TS Packets received */
-    uint32_t HWPkt;                      /* Number of HW Packets received */
-    uint32_t XTNPkt;                     /* Number of XTN Packets received */
-    uint32_t ReservedPkt;                /* Number of Reserved Packets received */
-    uint32_t ErrorPkt;                   /* Number of Packets received we don't know how to handle */
-    uint32_t PagePkt;                    /* Number of Packets received containing page sets */
+    orbStat  lostSyncCount;              /* Number of times sync has been lost */
+    orbStat  syncCount;                  /* Number of times a sync event has been received */
+    orbStat  tpiuSyncCount;              /* Number of times a tpiu sync event has been received (shouldn't happen) */
+    orbStat  overflow;                   /* Number of times an overflow occured */
+    orbStat  SWPkt;                      /* Number of SW Packets received */
+    orbStat  TSPkt;                      /* Number of TS Packets received */
+    orbStat  HWPkt;                      /* Number of HW Packets received */
+    orbStat  XTNPkt;                     /* Number of XTN Packets received */
+    orbStat  ReservedPkt;                /* Number of Reserved Packets received */
+    orbStat  ErrorPkt;                   /* Number of Packets received we don't know how to handle */
+    orbStat  PagePkt;                    /* Number of Packets received containing page sets */
+    orbStat  GTSPkt;                     /* Number of Global Timestamp Packets received */
+};
+
+/* What ITMPumpBlock is specialised for. The answers are the same whichever is used, it's only a */
+/* matter of which packets take the short cut around the octet decoder.                          */
+enum ITMDecoderProfile
+{
+    ITM_PROFILE_GENERIC,                 /* Everything a byte at a time, with context IDs of any length */
+    ITM_PROFILE_SW,                      /* No context IDs, SW packets short cut (the default) */
+    ITM_PROFILE_SW_HW,                   /* ...and HW ones too, for PC sampling and DWT events */
+    ITM_PROFILE_NUM
 };
 
 /* The ITM decoder state */
@@ -127,6 +142,7 @@ struct ITMDecoder
     struct ITMPacket pk;                 /* Packet under construction */
     struct ITMDecoderStats stats;        /* Record of the statistics */
     enum _protoState p;                  /* Current state of the receiver */
+    enum ITMDecoderProfile profile;      /* Which block decoder to use */
 };
 
 /* A fully decoded message (expanded in msgDecoder.h) */
@@ -135,12 +151,16 @@ struct msg;
 // ====================================================================================================
 void ITMDecoderForceSync( struct ITMDecoder *i, bool isSynced );
 void ITMDecoderZeroStats( struct ITMDecoder *i );
+void ITMDecoderSetProfile( struct ITMDecoder *i, enum ITMDecoderProfile profile );  /* Init sets ITM_PROFILE_SW */
+void ITMDecoderSetContextIDlen( struct ITMDecoder *i, uint8_t len );              /* ...non-zero makes it generic */
 bool ITMDecoderIsSynced( struct ITMDecoder *i );
 struct ITMDecoderStats *ITMDecoderGetStats( struct ITMDecoder *i );
+void ITMDecoderRegisterStats( struct ITMDecoder *i, struct statsRegistry *r, const char *prefix, const char *labels );
 bool ITMGetPacket( struct ITMDecoder *i, struct ITMPacket *p );
 bool ITMGetDecodedPacket( struct ITMDecoder *i, struct msg *decoded );
 
 enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c );
+size_t ITMPumpBlock( struct ITMDecoder *i, const uint8_t *d, size_t len, struct msg *out, size_t maxOut, size_t *used );
 
 struct ITMDecoder *ITMDecoderCreate( void );
 void ITMDecoderInit( struct ITMDecoder *i, bool startSynced );
@@ -11,6 +11,7 @@
 
 #include "itmDecoder.h"
 #include "oflow.h"
+#include "fileWriter.h"
 
 #include "generics.h"
 
@@ -22,9 +23,31 @@ extern "C" {
 #define NUM_CHANNELS  32                     /* Number of channels defined */
 #define HW_CHANNEL    (NUM_CHANNELS)         /* Make the hardware fifo on the end of the software ones */
 #define HWFIFO_NAME "hwevent"                /* Name for the hardware channel */
+#define ITMFIFO_MAX_TAGS (8)                 /* Most OFLOW tags one handle can decode */
+
+/* When it's asked for, the hardware fifo carries these fixed size records, in host byte order, rather */
+/* than lines of text. Which fields are used, and what for, depends on the type;                       */
+/*   HWEVENT_TS        flags=time status, ts=time increment                                           */
+/*   HWEVENT_EXCEPTION flags=event (1 enter, 2 exit, 3 resume), comp=exception number                 */
+/*   HWEVENT_PCSample  flags=1 if asleep, data=PC                                                     */
+/*   HWEVENT_DWT       data=event bits (CPI, Exc, Sleep, LSU, Fold, Cyc from bit 0)                   */
+/*   HWEVENT_RWWT      flags=1 if a write, comp=comparator, data=value                                */
+/*   HWEVENT_AWP       comp=comparator, data=address                                                  */
+/*   HWEVENT_OFS       comp=comparator, data=offset                                                   */
+/*   HWEVENT_NISYNC    flags=type, data=address                                                       */
+/* Except for HWEVENT_TS, ts is the time since the previous event that carried one.                   */
+struct hwRecord
+{
+    uint8_t type;                            /* One of HWEVENT_* */
+    uint8_t flags;
+    uint16_t comp;
+    uint32_t data;
+    uint64_t ts;
+};
 
 struct Channel;
 struct itmfifosHandle;
+struct tokenLog;
 
 enum Prot { PROT_OFLOW,  PROT_ITM, PROT_UNKNOWN };
 
@@ -34,6 +57,7 @@ void itmfifoProtocolPump( struct itmfifosHandle *f, uint8_t *c, int len );
 
 /* Getters and setters */
 void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s );
+void itmfifoSetTokens( struct itmfifosHandle *f, int chan, struct tokenLog *t ); /* Channel carries tokenised records */
 void itmfifoSetChanPath( struct itmfifosHandle *f, char *s );
 void itmfifoSetProtocol( struct itmfifosHandle *f, enum Prot p );
 void itmfifoSetForceITMSync( struct itmfifosHandle *f, bool s );
@@ -47,14 +71,22 @@ struct ITMDecoderStats *itmfifoGetITMDecoderStats( struct itmfifosHandle *f );
 bool itmfifoGetForceITMSync( struct itmfifosHandle *f );
 int itmfifoGettag( struct itmfifosHandle *f );
 void itmfifoUsePermafiles( struct itmfifosHandle *f, bool usePermafilesSet );
+void itmfifoUseReactor( struct itmfifosHandle *f, bool useReactorSet );         /* Serve all channels from one thread */
+void itmfifoUseShm( struct itmfifosHandle *f, bool useShmSet );                 /* Publish channels as /orbfifo.<name> shared memory too */
+void itmfifoUseBinaryHW( struct itmfifosHandle *f, bool useBinaryHWSet );       /* Hardware fifo as struct hwRecord rather than text */
 
 /* Filewriting */
-void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath );
+void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath, const struct fwOptions *o );
 
 /* Fifos management */
 bool itmfifoCreate( struct itmfifosHandle *f );                                  /* Create the fifo set */
 void itmfifoShutdown( struct itmfifosHandle *f );                                /* Destroy the fifo set */
 struct itmfifosHandle *itmfifoInit( bool forceITMSyncSet, enum Prot p, int tag );
+
+/* Decode another OFLOW tag alongside the first, on its own thread. When f is created the new tag gets    */
+/* the same channels, and each tag's channels go in a directory (and shared memory prefix) tag<N>. Only   */
+/* its tokens are its own to set. The filewriter only takes from f's tag. NULL if tag can't be added.     */
+struct itmfifosHandle *itmfifoAddTag( struct itmfifosHandle *f, int tag );
 // ====================================================================================================
 #ifdef __cplusplus
 }
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Latency Histograms
+ * ==================
+ *
+ * Log-linear histograms of latencies in nS, in the style of HDR histograms: each power of two is split
+ * into 2^LATENCY_SUB_BITS equal buckets, so any value is recorded to within 1/2^LATENCY_SUB_BITS of
+ * itself. Recording is lock free, so it can be done from any number of threads. The counts are never
+ * reset, so they can be exported as they are, and taking the results summarises what's been recorded
+ * since they were last taken. Nothing depends on the values really being nS, and they're used for
+ * counts of target ticks too.
+ *
+ */
+
+#ifndef _LATENCY_HIST_H_
+#define _LATENCY_HIST_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define LATENCY_SUB_BITS  (3)                                  /* 8 buckets per power of two, within 12.5% */
+#define LATENCY_MAX_BITS  (40)                                 /* Anything over 2^40nS (~18 minutes) is clamped */
+#define LATENCY_BUCKETS   ((LATENCY_MAX_BITS-LATENCY_SUB_BITS+1)<<LATENCY_SUB_BITS)
+
+struct latencyHist
+{
+    atomic_uint_fast64_t b[LATENCY_BUCKETS];                   /* Count of values in each bucket */
+    atomic_uint_fast64_t max;                                  /* Largest value since it was last taken */
+    atomic_uint_fast64_t sum;                                  /* Total of all values ever recorded */
+    uint64_t taken[LATENCY_BUCKETS];                           /* Counts as they were last taken, owned by the taker */
+};
+
+/* Summary of what was recorded, all values in nS */
+struct latencyStats
+{
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+void latencyRecord( struct latencyHist *h, uint64_t ns );
+void latencyTake( struct latencyHist *h, struct latencyStats *s );  /* Summarise what's arrived since the last take */
+
+/* For exporting: below[k] is set to how many values have ever been under 2^k nS, and the total is returned */
+uint64_t latencyCumulative( struct latencyHist *h, uint64_t below[LATENCY_MAX_BITS + 1], uint64_t *sum );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include <capstone.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "generics.h"
 
 #ifdef __cplusplus
@@ -15,6 +18,18 @@ extern "C" {
 #define NO_FILE        (-1)
 #define NO_DESTADDRESS (-1)
 #define NO_ADDRESS     (-1)
+#define SYMBOL_DISASM_LEN (255)  /* Space needed for a line of disassembly */
+#define SYMBOL_SOURCE_OPEN (32)  /* Most source files kept loaded at once */
+#define SYMBOL_INSN_PAGE (4096)  /* Bytes of code classified at a time by symbolInsnAt, as each is first needed */
+#define SYMBOL_MAX_IMAGES (16)  /* Most elf files that can be brought together into one symbol set */
+
+/* What's known about the instruction starting at one halfword */
+struct symbolInsnEntry
+{
+    symbolMemaddr   dest;                  /* Immediate destination, or NO_ADDRESS */
+    uint8_t         ic;                    /* Its instructionClass */
+    uint16_t        toBranch;              /* Halfwords on to the next jump or call, or to the end of the page */
+};
 
 /* Structure for a memory segment */
 struct symbolMemoryStore
@@ -23,6 +38,7 @@ struct symbolMemoryStore
     symbolMemaddr   len;                   /* Length of the memory segment */
     char           *name;                  /* Name of the segment as defined by the linker */
     symbolMemptr    data;                  /* Contents of the segment */
+    struct symbolInsnEntry *_Atomic *insnPage; /* Instructions in it, a page at a time, once they're needed */
 };
 
 
@@ -54,22 +70,63 @@ struct symbolFunctionStore
     unsigned int               nlines;     /* Number of lines in line number storage */
 };
 
-struct symbolSourcecodeStore
+/* One level of an inline stack. The names are indexes into the inlined function names (see */
+/* symbolGetInlineName), and the call is where the function was inlined in the one it's in. */
+struct symbolInlineFrame
 {
-    char                     **linetext;   /* Table of text lines in this file */
+    uint32_t                   funcname;   /* Name of the function that was inlined */
+    uint32_t                   manglename; /* ...and its linkage name, or 0 if it hasn't got one */
+    uint32_t                   callfile;   /* Filename index of the call it took the place of */
+    uint32_t                   callline;   /* ...and the line it was on */
+};
 
+/* Addresses that are inside the same inlined calls all the way through. Ranges that are in no */
+/* inlined call at all aren't in the table.                                                    */
+struct symbolInlineRange
+{
+    symbolMemaddr              lowaddr;    /* Minimum address of the range */
+    symbolMemaddr              highaddr;   /* ...and the max */
+    uint32_t                   chain;      /* Index of its innermost frame in the frame pool, the rest follow it */
+    uint32_t                   depth;      /* ...and how many frames there are */
+};
 
+/* Source is only loaded when a line of it is first asked for, and let go again when it's been the */
+/* longest unused of SYMBOL_SOURCE_OPEN loaded files.                                               */
+struct symbolSourcecodeStore
+{
+    char                      *text;       /* Text of the file, or NULL if it's not loaded */
+    size_t                     len;        /* ...and its length, not counting the 0 after it */
+    bool                       mapped;     /* Set if text is mapped, rather than read in */
+    bool                       missing;    /* Set if there's no source to be had, so don't look again */
+    uint32_t                  *linestart;  /* Offset into text of each line */
     unsigned int               nlines;     /* Number of text lines in this file */
+    uint64_t                   lastUsed;   /* When this file was last looked at */
+};
+
+/* How the value of a variable is to be read */
+enum symbolVarType { SV_UNSIGNED, SV_SIGNED, SV_FLOAT };
+
+/* Structure for a variable at a fixed address, as data trace can watch */
+struct symbolVariableStore
+{
+    char                      *varname;    /* What is the name of the variable */
+    unsigned int               filename;   /* What filename + path off the source root? */
+    symbolMemaddr              addr;       /* Where it lives */
+    unsigned int               size;       /* How many bytes it takes */
+    enum symbolVarType         type;       /* ...and how to read them */
 };
 
-enum symbolTables { PT_PRODUCER, PT_FILENAME, PT_NUMTABLES };
+enum symbolTables { PT_PRODUCER, PT_FILENAME, PT_INLINENAME, PT_NUMTABLES };
 
 struct symbol
 {
     char **stringTable[PT_NUMTABLES];      /* Strings that we don't want to duplicate, so we give them an index */
     unsigned int tableLen[PT_NUMTABLES];   /* Number of strings for each of the deduplication tables */
 
-    struct symbolSourcecodeStore **source; /* Table for source code lines, indexed by file number */
+    struct symbolSourcecodeStore *source;  /* Table for source code lines, indexed by file number */
+    pthread_mutex_t sourceLock;            /* ...which is loaded as it's used, maybe from several threads */
+    unsigned int sourceOpen;               /* Number of source files loaded */
+    uint64_t sourceClock;                  /* Count of source lookups, to tell which file was used longest ago */
 
     struct symbolMemoryStore *mem;         /* Table of memory regions, sorted according to start address */
     unsigned int nsect_mem;                /* Number of entries in memory region table */
@@ -80,23 +137,53 @@ struct symbol
     struct symbolLineStore **line;         /* Table of source code address indexes, sorted by start address */
     unsigned int nlines;                   /* Number of lines in source code line table */
 
-    unsigned int cachedSearchIndex;        /* Cached memory search region, to speed up memory fetches */
+    struct symbolVariableStore **var;      /* Table of variables at fixed addresses, sorted by address */
+    unsigned int nvar;                     /* Number of entries in variable table */
+
+    struct symbolInlineRange *inlineRange; /* Inline stack for each range of addresses, sorted by address */
+    unsigned int ninline;                  /* Number of entries in the inline range table */
+    struct symbolInlineFrame *inlineFrame; /* Pool of the inline stacks they refer to, each one only once */
+    unsigned int ninlineFrame;             /* Number of frames in the pool */
 
     int fd;                                /* Handle that we read elf from */
 
+    void *cache;                           /* If loaded from the symbol cache, the block everything points into */
+    size_t cacheLen;                       /* ...and how long it is */
+    struct symbolFunctionStore *cacheFunc; /* ...and the function and line records built from it */
+    struct symbolLineStore *cacheLine;
+    struct symbolVariableStore *cacheVar;
+
+    struct symbol **image;                 /* For a set made from several elf files, the sets it's an index over */
+    unsigned int nimage;                   /* ...and how many of them there are, or 0 for a single file */
+
     csh caphandle;
+
+    pthread_mutex_t insnLock;              /* For classifying instructions into the memory regions' tables */
+    csh insnhandle;                        /* ...and the disassembler that's done with */
 };
 
 enum instructionClass { LE_IC_NONE, LE_IC_JUMP = ( 1 << 0 ), LE_IC_4BYTE = ( 1 << 1 ), LE_IC_CALL = ( 1 << 2 ),  LE_IC_IMMEDIATE = ( 1 << 3 ), LE_IC_IRET = ( 1 << 4 ) };
 
 // ====================================================================================================
 
-/* Return pointer to source code for specified line in file index */
+/* Return pointer to source code for specified line in file index. This stays valid until lines */
+/* from SYMBOL_SOURCE_OPEN other files have been asked for.                                      */
 const char *symbolSource( struct symbol *p, unsigned int fileNumber, unsigned int lineNumber );
 
+/* Number of lines in a source file and the length of its text, loading it if need be. False if there's no source */
+bool symbolSourceSize( struct symbol *p, unsigned int fileNumber, unsigned int *nlines, size_t *len );
+
 /* Return function that encloses specified address, or NULL */
 struct symbolFunctionStore *symbolFunctionAt( struct symbol *p, symbolMemaddr addr );
 
+/* Full C++ name for a mangled linkage name, or NULL if it isn't one or can't be demangled. Names are */
+/* demangled when they're first asked for and remembered, for all symbol sets, from then on.         */
+const char *symbolDemangle( const char *mangled );
+bool symbolCanDemangle( void );                                  /* ...false if there's no demangler */
+
+/* Name to show for function, the demangled one if demangle is set and there is one */
+const char *symbolFunctionName( struct symbolFunctionStore *f, bool demangle );
+
 /* Get indexed function, or NULL if out of range */
 struct symbolFunctionStore *symbolFunctionIndex( struct symbol *p, unsigned int index );
 
@@ -109,24 +196,66 @@ struct symbolLineStore *symbolFunctionLineIndex( struct symbolFunctionStore *f,
 /* Return line covered by specified memory address, or NULL */
 struct symbolLineStore *symbolLineAt( struct symbol *p, symbolMemaddr addr );
 
+/* Return variable that covers specified address, or NULL */
+struct symbolVariableStore *symbolVariableAt( struct symbol *p, symbolMemaddr addr );
+
+/* Return variable with specified name, or NULL. This is a search through them all, so look once and keep it */
+struct symbolVariableStore *symbolVariableByName( struct symbol *p, const char *name );
+
 /* Get command line that produced this file (compilation unit) */
 const char *symbolGetProducer( struct symbol *p, unsigned int index );
 
 /* Get filename string for specified index */
 const char *symbolGetFilename( struct symbol *p, unsigned int index );
 
+/* Get the name of an inlined function, from its index in a symbolInlineFrame */
+const char *symbolGetInlineName( struct symbol *p, unsigned int index );
+
+/* Inline stack at an address, from the function inlined deepest outwards to the one inlined straight */
+/* into the function the address is in. Returns how deep it is, setting *stack to its innermost frame */
+/* (the rest follow it), or 0 if the address isn't in any inlined code. This is a single lookup.     */
+unsigned int symbolInlineStackAt( struct symbol *p, symbolMemaddr addr, const struct symbolInlineFrame **stack );
+
 /* Get pointer to memory at specified address...can move backwards and forwards through the region */
 symbolMemptr symbolCodeAt( struct symbol *p, symbolMemaddr addr, unsigned int *len );
 
+/* Get the memory over [a,b) in one piece. That's straight from the image if it's all in one region, */
+/* or gathered into buf (b-a long) if it runs across regions that follow on from each other. len is  */
+/* how much of it there is, which is short if there's a gap (or at the end of the region, if buf is  */
+/* NULL). Returns NULL if there's no memory at a.                                                     */
+symbolMemptr symbolCodeRange( struct symbol *p, symbolMemaddr a, symbolMemaddr b, uint8_t *buf, unsigned int *len );
+
 /* Return assembly code representing this line, with annotations */
 char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr );
 
+/* Classify the instruction at addr, as symbolDisassembleLine does but without the text, returning false */
+/* if there's no memory there. This is a table lookup once the page it's in has been seen, and is safe  */
+/* to call from several threads at once.                                                                */
+bool symbolInsnAt( struct symbol *p, symbolMemaddr addr, enum instructionClass *ic, symbolMemaddr *newaddr );
+
+/* Address of the first jump or call at or after addr, following on instruction by instruction, or */
+/* NO_ADDRESS if the code runs out first. Mostly a single lookup, so a basic block can be skipped. */
+symbolMemaddr symbolNextBranch( struct symbol *p, symbolMemaddr addr );
+
+/* Open a disassembler of your own, for use with symbolDisassembleLineTo...close it with cs_close */
+bool symbolDisassemblerOpen( csh *h );
+
+/* As symbolDisassembleLine, but into op (which is SYMBOL_DISASM_LEN long) using disassembler h. This */
+/* doesn't change p, so it can be called from several threads at once as long as each has its own h.  */
+char *symbolDisassembleLineTo( struct symbol *p, csh h, char *op, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr );
+
 /* Delete symbol set */
 void symbolDelete( struct symbol *p );
 
-/* Collect symbol set with specified components */
+/* Collect symbol set with specified components. filename can be a list of elf files, separated by */
+/* commas, each with an @offset after it if it's loaded that far from where it's linked. They are   */
+/* brought together into one set, with a single index over the addresses of all of them.           */
 struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource );
 
+/* Go through the images in such a list. Each call puts the next filename into name (len long) and its */
+/* offset into *offset, then returns where to carry on from, or NULL when there are none left.       */
+const char *symbolNextImage( const char *spec, char *name, size_t len, symbolMemaddr *offset );
+
 /* Check if current symbols are valid */
 bool symbolSetValid( struct symbol *p );
 
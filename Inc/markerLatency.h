@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Marker Latency
+ * ==============
+ *
+ * Times how long it is from one ITM software write (the start marker) to another (the stop marker),
+ * by the ITM local timestamps, for any number of pairs. A pair is given as;
+ *
+ *   [<name>=]<channel>[:<value>],<channel>[:<value>]
+ *
+ * ...where a marker without a value matches any write to its channel. Timing starts at a start
+ * marker and ends at the next stop marker. A start that comes while one is already open is counted
+ * as an overrun and the first one stands, so what's measured is from the earliest event that wasn't
+ * yet answered. A stop with nothing open is counted as a stray. The same marker can be both start
+ * and stop, which times from one of it to the next.
+ *
+ * Timestamp packets follow what they time, so markers are held until the next one arrives and then
+ * all given its time. Latencies are in timestamp ticks, into the same log-linear histograms as
+ * orbuculum uses for its own latencies, so recording a marker costs a few instructions however many
+ * pairs there are.
+ *
+ */
+
+#ifndef _MARKER_LATENCY_H_
+#define _MARKER_LATENCY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define MARKERLATENCY_MAX_PAIRS (32)                 /* Most pairs that can be timed at once */
+#define MARKERLATENCY_MAX_NAME  (32)                 /* Longest pair name kept */
+
+struct markerLatency;
+
+struct markerLatencyStats
+{
+    uint64_t count;                                  /* Latencies recorded since last taken */
+    uint64_t p50;                                    /* ...and their percentiles, in ticks */
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+    uint64_t total;                                  /* Latencies ever recorded */
+    uint64_t worst;                                  /* ...and the largest of them */
+    uint64_t overruns;                               /* Starts while one was already open */
+    uint64_t strays;                                 /* Stops with nothing open */
+};
+
+// ====================================================================================================
+struct markerLatency *markerLatencyCreate( void );
+
+/* Add a pair from its spec, as above. False if it can't be, which has been reported */
+bool markerLatencyAdd( struct markerLatency *m, const char *spec );
+unsigned int markerLatencyNumPairs( struct markerLatency *m );
+const char *markerLatencyName( struct markerLatency *m, unsigned int pair );
+
+/* Feed the ITM software writes and the timestamp increments, as they're decoded */
+void markerLatencySW( struct markerLatency *m, uint8_t chan, uint32_t value );
+void markerLatencyTS( struct markerLatency *m, uint32_t timeInc );
+
+/* Forget anything open or held, after an overflow or loss of sync when markers may be missing */
+void markerLatencyReset( struct markerLatency *m );
+bool markerLatencyTimed( struct markerLatency *m );  /* Has any timestamp been seen */
+
+/* Summarise what's been recorded for pair since it was last taken */
+void markerLatencyTake( struct markerLatency *m, unsigned int pair, struct markerLatencyStats *s );
+void markerLatencyDelete( struct markerLatency *m );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Multicast Distribution of OFLOW
+ * ===============================
+ *
+ * The OFLOW byte stream is cut into UDP datagrams and sent once to a multicast group, whoever
+ * and however many are listening. Each datagram carries a small header with a sequence number,
+ * then a run of the stream, which is broken at frame boundaries wherever that can be done.
+ *
+ * Nothing is resent. A receiver counts the datagrams that went missing (or came too late to be of
+ * use) and puts a COBS sync in their place, so the frames they took part of are thrown out by the
+ * OFLOW decoder and it picks up again with the next one.
+ *
+ * Each sender picks a session number when it starts, so a receiver can tell a sender that has been
+ * restarted (with its sequence starting again somewhere else) from datagrams arriving late, and
+ * follows the new one from wherever it's got to.
+ *
+ */
+
+#ifndef _MCAST_H_
+#define _MCAST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define MCAST_DEFAULT_GROUP   "239.255.34.2"      /* Administratively scoped, so it stays on site */
+#define MCAST_DEFAULT_PORT    (3405)
+#define MCAST_DEFAULT_TTL     (1)                 /* ...and by default doesn't get past the first router */
+#define MCAST_DEFAULT_SPEC    MCAST_DEFAULT_GROUP ":3405"
+
+#define MCAST_MAGIC           "OM"
+#define MCAST_MAGIC_LEN       (2)
+#define MCAST_VERSION         (1)
+#define MCAST_HDR_LEN         (8)                 /* Magic, version, session, then 32 bit sequence (network order) */
+#define MCAST_RESTART_JUMP    (1024)              /* A sequence going back further than this is a sender that's started again */
+#define MCAST_PAYLOAD         (1400)              /* Stream carried per datagram, keeping the whole thing inside an Ethernet MTU */
+
+struct mcast;
+
+struct mcastStats
+{
+    uint64_t datagrams;                           /* Datagrams sent or accepted */
+    uint64_t bytes;                               /* ...and the stream they carried */
+    uint64_t lost;                                /* Receiver - datagrams missing from the sequence */
+    uint64_t late;                                /* Receiver - datagrams that turned up after we'd moved on */
+    uint64_t bad;                                 /* Receiver - datagrams that weren't ours */
+    uint64_t restarts;                            /* Receiver - times the sender started again */
+};
+
+/* Sending. Spec is [group][:port][,ttl] with anything left out taking its default, and port is offset by portOfs */
+struct mcast *mcastCreate( const char *spec, int portOfs );
+void mcastWrite( struct mcast *m, const void *d, size_t len );             /* Queue stream, sending any datagrams it fills */
+void mcastFlush( struct mcast *m );                                        /* Send whatever is queued */
+
+/* Receiving. Spec is [group][:port] */
+struct mcast *mcastOpen( const char *spec );
+size_t mcastRead( struct mcast *m, void *d, size_t len, int timeoutMs );   /* Read stream, waiting up to timeoutMs (-1 for ever) for it */
+
+/* Either */
+const struct mcastStats *mcastGetStats( struct mcast *m );
+void mcastClose( struct mcast *m );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Memory Accounting
+ * =================
+ *
+ * Allocations made through these wrappers are counted against the subsystem they're for, keeping the
+ * bytes live and the most there have ever been at once, so when a tool grows over a long run it can
+ * say whether it's the symbols, the per address tables, the call graph or whatever that's doing it.
+ * A subsystem can also be given a limit, past which its allocations fail just as malloc would.
+ *
+ * Memory has to go back through memFree (or memRealloc) for the subsystem it came from. Sizes are
+ * the ones the allocator really handed out, where the platform will say, otherwise what was asked
+ * for.
+ *
+ */
+
+#ifndef _MEM_ACCOUNT_H_
+#define _MEM_ACCOUNT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+enum memSubsystem
+{
+    MEM_SYMBOLS,                                   /* Symbol tables, source and disassembly */
+    MEM_ADDRESSES,                                 /* Per address records (visitedAddr, execEntryHash) */
+    MEM_CALLS,                                     /* Call graph (subcall) */
+    MEM_HASH,                                      /* uthash's own bucket tables */
+    MEM_LINES,                                     /* Output line buffers */
+    MEM_SEQUENCER,                                 /* Message sequencer pages */
+    MEM_INDEX,                                     /* Indexes of where things are in output buffers */
+    MEM_NUM_SUBSYSTEMS
+};
+
+struct memUse
+{
+    uint64_t live;                                 /* Bytes allocated now */
+    uint64_t peak;                                 /* ...most there have been */
+    uint64_t limit;                                /* ...most there can be, 0 for no limit */
+};
+
+// ====================================================================================================
+void *memAlloc( enum memSubsystem s, size_t size );
+void *memCalloc( enum memSubsystem s, size_t n, size_t size );
+void *memRealloc( enum memSubsystem s, void *p, size_t size );
+char *memStrdup( enum memSubsystem s, const char *str );
+void memFree( enum memSubsystem s, void *p );
+
+/* Allocations that would take s past bytes fail (return NULL). 0 takes the limit off */
+void memSetLimit( enum memSubsystem s, uint64_t bytes );
+
+/* Set limits from the likes of "symbols=512M,addresses=2G" (K, M and G suffixes allowed). False if it can't be read */
+bool memSetLimits( const char *spec );
+
+void memGetUse( enum memSubsystem s, struct memUse *u );
+uint64_t memLiveTotal( void );
+const char *memSubsystemName( enum memSubsystem s );
+
+/* Write live/peak for each subsystem that has been used, e.g. "symbols=12.1M/12.1M lines=40K/1.2M" */
+int memReport( char *buf, size_t len );
+// ====================================================================================================
+
+/* Define MEM_ACCOUNT_UTHASH before including uthash.h for its tables to be counted under MEM_HASH */
+#ifdef MEM_ACCOUNT_UTHASH
+#undef uthash_malloc
+#undef uthash_free
+#define uthash_malloc(sz) memAlloc( MEM_HASH, sz )
+#define uthash_free(ptr, sz) memFree( MEM_HASH, ptr )
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
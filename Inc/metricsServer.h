@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Metrics Server
+ * ==============
+ *
+ * A minimal HTTP server that answers GET /metrics with text in the Prometheus/OpenMetrics exposition
+ * format. It runs on a thread of its own and only renders anything when a scrape arrives, so whatever
+ * is being measured doesn't know it's there. A tool can answer other paths of its own on the same port.
+ *
+ */
+
+#ifndef _METRICS_SERVER_H_
+#define _METRICS_SERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "latencyHist.h"
+#include "statsRegistry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+/* Body of a response, being built up */
+struct metricsBuf
+{
+    char *d;
+    size_t len;
+    size_t size;
+};
+
+/* Called for each scrape to fill in the body */
+typedef void ( *metricsRenderCB )( struct metricsBuf *b, void *param );
+
+/* Called for a GET of any other path (e.g. "/series?n=10") to fill in the body. Returns its content type, */
+/* or NULL if there's nothing at that path.                                                                */
+typedef const char *( *metricsPathCB )( const char *path, struct metricsBuf *b, void *param );
+
+void metricsPrintf( struct metricsBuf *b, const char *fmt, ... );
+void metricsType( struct metricsBuf *b, const char *name, const char *type, const char *help );
+
+/* Latency histogram as name_bucket/name_sum/name_count, in seconds, with labels (e.g. probe="x") */
+void metricsLatency( struct metricsBuf *b, const char *name, const char *labels, struct latencyHist *h );
+
+/* Everything in a statistics registry, as it is now */
+void metricsStats( struct metricsBuf *b, struct statsRegistry *r );
+
+bool metricsServerStart( int port, metricsRenderCB render, void *param );
+bool metricsServerStartPaths( int port, metricsRenderCB render, metricsPathCB path, void *param );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
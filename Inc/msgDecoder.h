@@ -26,6 +26,7 @@ enum MSGType
     MSG_DWT_EVENT,
     MSG_EXCEPTION,
     MSG_TS,
+    MSG_GTS,
 
     /* Add new message types here */
 
@@ -48,6 +49,19 @@ struct TSMsg
     uint32_t timeInc;
 };
 
+/* Global timestamp, one half of it. GTS1 carries the low 26 bits, or as many of them as changed, */
+/* and GTS2 the bits above those (22 of them for a 48 bit timestamp, 38 for a 64 bit one).         */
+struct GTSMsg
+{
+    enum MSGType msgtype;
+    uint64_t ts;
+    bool high;                                     /* This is GTS2 */
+    bool wrap;                                     /* GTS1: the high bits have changed, a GTS2 follows */
+    bool clkch;                                    /* GTS1: the timestamp clock ratio has changed */
+    uint8_t len;                                   /* Payload bytes there were */
+    uint64_t bits;                                 /* The timestamp bits, not shifted into place */
+};
+
 /* Software message */
 struct swMsg
 {
@@ -136,14 +150,37 @@ struct msg
         struct dwtMsg dwtMsg;
         struct excMsg excMsg;
         struct pcSampleMsg pcSampleMsg;
+        struct GTSMsg gtsMsg;
     };
 };
 
+/* The same messages packed into 16 bytes, for when a lot of them are being held or passed around.   */
+/* Every field of every message type has a home in here, so converting back and forth loses nothing. */
+struct msgPacked
+{
+    uint8_t msgtype;                               /* enum MSGType */
+    uint8_t chan;                                  /* srcAddr, comp, type, event, eventType or GTS bits 37:32 */
+    uint8_t len;                                   /* Software message or GTS payload length */
+    uint8_t flags;                                 /* MSG_PACKED_xxx flags, or timeStatus for MSG_TS */
+    uint32_t value;                                /* value, addr, pc, offset, data, exceptionNumber, timeInc or GTS bits */
+    uint64_t ts;
+};
+
+#define MSG_PACKED_SLEEP (1<<0)                    /* PC sample was a sleep */
+#define MSG_PACKED_WRITE (1<<1)                    /* Watch was on a write */
+#define MSG_PACKED_GTS2  (1<<2)                    /* Global timestamp is GTS2... */
+#define MSG_PACKED_WRAP  (1<<3)                    /* ...or GTS1 with wrap set */
+#define MSG_PACKED_CLKCH (1<<4)                    /* ...and/or clock change */
+
 struct ITMPacket;
 
 // ====================================================================================================
 
 bool msgDecoder( struct ITMPacket *packet, struct msg *decoded );
+bool msgDecoderStamped( struct ITMPacket *packet, struct msg *decoded, uint64_t ts );
+
+void msgPack( const struct msg *m, struct msgPacked *p );
+void msgUnpack( const struct msgPacked *p, struct msg *m );
 
 // ====================================================================================================
 #ifdef __cplusplus
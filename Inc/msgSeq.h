@@ -19,31 +19,64 @@
 #include "generics.h"
 #include "itmDecoder.h"
 #include "msgDecoder.h"
+#include "timebase.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Messages are held packed in pages, sized to fit into 4K alongside their link */
+#define MSGSEQ_PAGE_SIZE    (4096)
+#define MSGSEQ_PAGE_ENTRIES ((MSGSEQ_PAGE_SIZE-sizeof(void *))/sizeof(struct msgPacked))
+
+/* Backstop, if nothing has released the queue by this point then it is emptied regardless */
+#define MSGSEQ_MAX_ENTRIES  (1024*1024)
+
+struct MSGSeqPage
+
+{
+    struct MSGSeqPage *next;                       /* Next page in the queue (or free list) */
+    struct msgPacked m[MSGSEQ_PAGE_ENTRIES];       /* Messages held in this page */
+};
+
 struct MSGSeq
 
 {
     struct ITMDecoder *i;
 
-    uint32_t wp;             /* Write pointer */
-    uint32_t rp;             /* Read pointer */
-    uint32_t pbl;            /* Buffer length */
-    bool releaseTimeMsg;     /* Indicator to release msg at head of queue */
+    struct MSGSeqPage *head;                       /* Page being read from */
+    struct MSGSeqPage *tail;                       /* Page being written to */
+    struct MSGSeqPage *free;                       /* Pages available for re-use */
+    uint32_t rp;                                   /* Read index into head page */
+    uint32_t wp;                                   /* Write index into tail page */
 
-    struct msg *pbuffer;     /* The buffer */
+    uint32_t count;                                /* Number of messages waiting */
+    uint32_t hwm;                                  /* Highest number of messages that have been waiting */
+    uint32_t pages;                                /* Number of pages allocated in total */
+
+    bool releaseTimeMsg;                           /* Indicator to release timestamp msg before the queue */
+    struct msg timeMsg;                            /* ...and the message itself */
+    struct msg out;                                /* Last message unpacked from the queue */
+
+    struct timebase *tb;                           /* If set, what messages are stamped from */
 };
 
 // ====================================================================================================
 
-void MSGSeqInit( struct MSGSeq *d, struct ITMDecoder *i, uint32_t maxEntries );
+bool MSGSeqInit( struct MSGSeq *d, struct ITMDecoder *i, uint32_t maxEntries );
 struct msg *MSGSeqGetPacket( struct MSGSeq *d );
 
 bool MSGSeqPump( struct MSGSeq *d, uint8_t c );
 
+/* Stamp each message with target time from t (in nS, or cycles if it has no core clock) as it's */
+/* released, instead of when it got to the host. t is fed with the timestamps as they go by.       */
+void MSGSeqSetTimebase( struct MSGSeq *d, struct timebase *t );
+
+static inline uint32_t MSGSeqGetHighWater( struct MSGSeq *d )
+{
+    return d->hwm;
+}
+
 // ====================================================================================================
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Message Stream Module
+ * =====================
+ *
+ * Compact binary framing for already decoded ITM messages, so that a server can do the
+ * decoding once and hand the results to any number of clients.
+ *
+ * A frame is a sync byte, a 16 bit little endian length of what follows the header, and
+ * the 64 bit little endian timestamp everything in the frame is relative to. After that
+ * come records, each of which is
+ *
+ *     tag, length of the rest of the record, zigzag varint timestamp offset, fields
+ *
+ * with the fields being little endian and depending on the tag. Software messages are
+ * tagged with their channel (0..31) and everything else with MSGSTREAM_TAG_MSG(type), which
+ * are the tags a client subscribes to with nwSubscribe. Because every record carries its
+ * own length, unknown tags can be stepped over and records can be filtered out of a frame
+ * without understanding them.
+ *
+ * The server can also count the PC samples by address itself, and send just the counts at the
+ * end of each interval, tagged MSGSTREAM_TAG_PCHIST. One interval takes as many of these as it
+ * needs, each of them being a 16 bit interval number, a flags byte (MSGSTREAM_HIST_LAST on the
+ * last one of the interval), a varint count of samples taken while asleep, and then varint pairs
+ * of how far the address is on from the one before it (from 0 for the first) and its count.
+ */
+
+#ifndef _MSG_STREAM_
+#define _MSG_STREAM_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "msgDecoder.h"
+#include "nw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MSGSTREAM_SYNC        (0xA5)
+#define MSGSTREAM_HDR_LEN     (1+2+8)
+#define MSGSTREAM_MAX_BODY    (16384)
+#define MSGSTREAM_MAX_FRAME   (MSGSTREAM_HDR_LEN+MSGSTREAM_MAX_BODY)
+#define MSGSTREAM_MAX_RECORD  (2+10+6)            /* tag, length, worst case varint, biggest fields */
+
+#define MSGSTREAM_TAG_SW(chan)  (chan)
+#define MSGSTREAM_TAG_MSG(type) (32+(type))
+#define MSGSTREAM_TAG_PCHIST    (128)
+
+#define MSGSTREAM_HIST_LAST     (1<<0)        /* Flag on the last histogram record of an interval */
+#define MSGSTREAM_MAX_HIST      (128)         /* Most entries there can be in one histogram record */
+
+/* Some or all of a PC sample histogram */
+struct msgStreamHistEntry
+{
+    uint32_t pc;
+    uint32_t count;
+};
+
+struct msgStreamHist
+{
+    uint64_t ts;                                  /* Timestamp at the end of the interval */
+    uint16_t seq;                                 /* Which interval it is, so missing ones can be spotted */
+    bool last;                                    /* This is the last of the interval */
+    uint32_t sleeps;                              /* Samples taken while asleep */
+    uint32_t n;                                   /* Entries in e... */
+    const struct msgStreamHistEntry *e;           /* ...in ascending address order */
+};
+
+typedef void ( *msgStreamHistCB )( const struct msgStreamHist *h, void *param );
+
+/* A frame being built up for sending */
+struct msgStreamFrame
+{
+    uint8_t d[MSGSTREAM_MAX_FRAME];               /* The frame, header first */
+    uint32_t len;                                 /* Total length so far, 0 when nothing is in it */
+    uint64_t base;                                /* Timestamp record offsets are from */
+};
+
+/* Received data being pulled apart into messages */
+struct msgStreamDecoder
+{
+    uint8_t d[MSGSTREAM_MAX_FRAME];               /* Partial frame being collected */
+    uint32_t fill;                                /* ...and how much of it there is */
+    uint64_t badFrames;                           /* Frames that were discarded as corrupt */
+    msgStreamHistCB hist;                         /* Called for histograms, if anyone wants them */
+    void *histParam;
+};
+
+// ====================================================================================================
+
+static inline bool msgStreamFrameEmpty( const struct msgStreamFrame *f )
+{
+    return !f->len;
+}
+
+bool msgStreamAdd( struct msgStreamFrame *f, const struct msg *m );
+bool msgStreamAddHist( struct msgStreamFrame *f, struct msgStreamHist *h );
+uint32_t msgStreamFinish( struct msgStreamFrame *f );
+uint32_t msgStreamFilter( const struct nwSubscription *sub, const uint8_t *in, uint32_t len, uint8_t *out, void *param );
+
+void msgStreamDecoderInit( struct msgStreamDecoder *s );
+void msgStreamDecoderSetHist( struct msgStreamDecoder *s, msgStreamHistCB cb, void *param );
+void msgStreamPump( struct msgStreamDecoder *s, const uint8_t *d, size_t len, void ( *cb )( struct msg *m, void *param ), void *param );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -9,7 +9,9 @@
 #ifndef _NW_
 #define _NW_
 
+#include <string.h>
 #include "generics.h"
+#include "stream.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,12 +21,96 @@ extern "C" {
 
 #define OFCLIENT_SERVER_PORT (3402)           /* orbflow server port definition */
 #define NWCLIENT_SERVER_PORT (3443)           /* legacy server port definition */
+#define NWMSG_SERVER_PORT    (3404)           /* decoded message server port definition */
 #define LEGACY_SERVER_PORT_OFS (NWCLIENT_SERVER_PORT-OFCLIENT_SERVER_PORT)
 
 #define TRANSFER_SIZE (65536*4)
 
 #define DEFAULT_ITM_STREAM 1
 #define DEFAULT_ETM_STREAM 2
+
+/* A client on an OFLOW port may send this straight after connecting, to only be sent the tags it */
+/* names. Clients that don't send it get everything, and a server that doesn't understand it     */
+/* never reads it, so either side can be older than the other.                                   */
+#define NW_SUBSCRIBE_MAGIC     "OSB1"
+#define NW_SUBSCRIBE_MAGIC_LEN (4)
+#define NW_NUM_TAGS            (256)
+
+/* A client may also ask for everything it's sent to be deflated, as long as that's its first request. */
+/* A server that agrees sends the same magic back, and everything after that is compressed.       */
+#define NW_COMPRESS_MAGIC      "OCZ1"
+#define NW_COMPRESS_MAGIC_LEN  (4)
+
+/* ...and say what matters more to it, seeing its data promptly or seeing all of it. This goes after */
+/* any subscription, so that a server which doesn't understand it has already taken the subscription */
+/* on board and just throws it away.                                                                 */
+#define NW_QOS_MAGIC           "OQS1"
+#define NW_QOS_MAGIC_LEN       (4)
+
+enum nwQoS
+{
+    NW_QOS_DEFAULT,                            /* No preference, as for a client that never asks */
+    NW_QOS_LATENCY,                            /* Interactive, wants each piece as soon as it's available */
+    NW_QOS_BULK,                               /* Recording, would rather data was late than lost */
+    NW_QOS_NUM
+};
+
+struct nwQoSRequest
+{
+    uint8_t magic[NW_QOS_MAGIC_LEN];           /* NW_QOS_MAGIC */
+    uint8_t qos;                               /* One of enum nwQoS */
+};
+
+struct nwSubscription
+{
+    uint8_t magic[NW_SUBSCRIBE_MAGIC_LEN];     /* NW_SUBSCRIBE_MAGIC */
+    uint8_t tags[NW_NUM_TAGS / 8];             /* Bitmap of wanted tags, lsb of first byte is tag 0 */
+};
+// ====================================================================================================
+
+static inline bool nwSubscriptionHas( const struct nwSubscription *sub, uint8_t tag )
+{
+    return sub->tags[tag / 8] & ( 1 << ( tag % 8 ) );
+}
+static inline bool nwSubscribe( struct Stream *stream, int ntags, const uint8_t *tags )
+
+/* Ask the server on the other end of stream to only send us these tags */
+
+{
+    struct nwSubscription sub;
+
+    if ( !stream->send )
+    {
+        return false;
+    }
+
+    memcpy( sub.magic, NW_SUBSCRIBE_MAGIC, NW_SUBSCRIBE_MAGIC_LEN );
+    memset( sub.tags, 0, sizeof( sub.tags ) );
+
+    while ( ntags-- )
+    {
+        sub.tags[*tags / 8] |= 1 << ( *tags % 8 );
+        tags++;
+    }
+
+    return stream->send( stream, &sub, sizeof( sub ) );
+}
+static inline bool nwRequestQoS( struct Stream *stream, enum nwQoS qos )
+
+/* Tell the server on the other end of stream how we'd like to be treated */
+
+{
+    struct nwQoSRequest req;
+
+    if ( !stream->send )
+    {
+        return false;
+    }
+
+    memcpy( req.magic, NW_QOS_MAGIC, NW_QOS_MAGIC_LEN );
+    req.qos = qos;
+    return stream->send( stream, &req, sizeof( req ) );
+}
 // ====================================================================================================
 
 #ifdef __cplusplus
@@ -16,15 +16,143 @@ extern "C" {
 #endif
 
 #include <semaphore.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "nw.h"
+#include "latencyHist.h"
 // ====================================================================================================
 
 struct nwclientsHandle;
 
+/* A refcounted, immutable block of data that can be handed to clients without copying it. */
+/* The release callback is made (from whichever thread drops the last reference) once      */
+/* nobody needs the data any more, and the owner may then re-use the buffer.               */
+struct nwclientBlock
+{
+    atomic_int     refs;                           /* Number of holders of this block */
+    const uint8_t *data;                           /* The data itself */
+    uint32_t       len;                            /* ...and its length */
+    void ( *release )( struct nwclientBlock *b, void *param ); /* Called when last holder is done */
+    void          *param;                          /* Parameter for release callback */
+};
+
+/* What's going on with one connected client */
+struct nwclientStats
+{
+    int            fd;                             /* Socket the client is on */
+    size_t         queuedItems;                    /* Items waiting to go to it */
+    size_t         queuedBytes;                    /* ...bytes of those that were copied (as opposed to borrowed) */
+    int            borrowed;                       /* ...and how many blocks it's holding */
+    uint64_t       dropped;                        /* Bytes dropped because it wasn't keeping up */
+    uint64_t       sentBytes;                      /* Bytes sent to it */
+    bool           compressed;                     /* Is its output being compressed */
+    bool           subscribed;                     /* Has it subscribed to specific tags */
+    int            qos;                            /* Class of service it asked for (enum nwQoS) */
+    uint64_t       spilledBytes;                   /* Bytes it has waiting in its spill file */
+    uint64_t       memBytes;                       /* Memory held on its behalf */
+    bool           narrowed;                       /* Has it been cut down to one tag because memory was short */
+};
+
+/* What's done when what's held for clients gets near the memory budget */
+enum nwShed
+{
+    NW_SHED_DROP,                                  /* Drop the oldest of what bulk clients have spilled into memory */
+    NW_SHED_DISCONNECT,                            /* Disconnect whoever has the most waiting */
+    NW_SHED_FILTER,                                /* Cut whoever has the most waiting down to one of its tags */
+    NW_SHED_NUM
+};
+
+/* Memory held on behalf of the clients of every port, as last counted */
+struct nwclientMemory
+{
+    uint64_t       budget;                         /* Most that may be held, 0 for no limit */
+    uint64_t       total;                          /* What's held */
+    uint64_t       rings;                          /* ...in the clients' queues */
+    uint64_t       spills;                         /* ...in spills kept in memory */
+    uint64_t       compression;                    /* ...compressing output */
+    uint64_t       replays;                        /* ...in history waiting to go out */
+    uint64_t       history;                        /* ...and in history kept for clients that subscribe */
+    uint64_t       shedBytes;                      /* Spilled data dropped to keep to the budget */
+    uint64_t       disconnected;                   /* Clients disconnected to keep to it */
+    uint64_t       narrowed;                       /* Clients cut down to one tag to keep to it */
+    uint64_t       refused;                        /* Clients, compression and replays there wasn't room for */
+    int            lent;                           /* Blocks lent to clients right now */
+};
+
+/* A client as it was when it was handed over, for another process to carry on with */
+struct nwclientHandover
+{
+    int            fd;                             /* Socket the client is on */
+    bool           settled;                        /* Have its requests all arrived */
+    bool           subscribed;                     /* ...has it subscribed to specific tags */
+    struct nwSubscription sub;                     /* ...which are these */
+    int            qos;                            /* Class of service it asked for (enum nwQoS) */
+    uint64_t       sentBytes;                      /* Bytes sent to it so far */
+    uint32_t       reqLen;                         /* Part of a request that has arrived */
+    uint8_t        req[sizeof( struct nwSubscription )];
+};
+
+/* Called for each client of a port that's being handed over */
+typedef void ( *nwclientHandoverCB )( const struct nwclientHandover *c, void *param );
+
+/* Pulls out of len bytes at in the parts that sub wants, writing them to out (which is at least */
+/* len long) and returning how many that came to.                                              */
+typedef uint32_t ( *nwclientFilter )( const struct nwSubscription *sub, const uint8_t *in, uint32_t len, uint8_t *out, void *param );
+
 // ====================================================================================================
 
+static inline void nwclientBlockInit( struct nwclientBlock *b, const uint8_t *data, uint32_t len,
+                                      void ( *release )( struct nwclientBlock *b, void *param ), void *param )
+{
+    /* The creator holds the first reference */
+    atomic_init( &b->refs, 1 );
+    b->data = data;
+    b->len = len;
+    b->release = release;
+    b->param = param;
+}
+static inline void nwclientBlockRetain( struct nwclientBlock *b )
+{
+    atomic_fetch_add_explicit( &b->refs, 1, memory_order_relaxed );
+}
+static inline void nwclientBlockRelease( struct nwclientBlock *b )
+{
+    if ( ( 1 == atomic_fetch_sub_explicit( &b->refs, 1, memory_order_acq_rel ) ) && ( b->release ) )
+    {
+        b->release( b, b->param );
+    }
+}
+
 void nwclientSend( struct nwclientsHandle *h, uint32_t len, const uint8_t *ipbuffer );
+void nwclientSendBlock( struct nwclientsHandle *h, struct nwclientBlock *b );
+void nwclientSendTag( struct nwclientsHandle *h, uint8_t tag, uint32_t len, const uint8_t *ipbuffer );
+void nwclientSendFiltered( struct nwclientsHandle *h, uint32_t len, const uint8_t *ipbuffer, nwclientFilter filter, void *param );
+int nwclientSubscribers( struct nwclientsHandle *h );
+int nwclientConnected( struct nwclientsHandle *h );
+uint64_t nwclientDroppedBytes( struct nwclientsHandle *h );
+struct latencyHist *nwclientSendLatency( struct nwclientsHandle *h );
+int nwclientClientStats( struct nwclientsHandle *h, struct nwclientStats *s, int max );
+void nwclientSetSpill( struct nwclientsHandle *h, const char *dir, uint64_t maxBytes );
+void nwclientSetHistory( struct nwclientsHandle *h, size_t maxBytes, uint32_t maxmS );
+void nwclientMarkTag( struct nwclientsHandle *h, uint8_t tag );
+void nwclientReplayHistory( struct nwclientsHandle *h );
+void nwclientSetBudget( uint64_t maxBytes, enum nwShed policy );
+void nwclientSetLendLimit( int maxBlocks );
+void nwclientMemoryStats( struct nwclientMemory *m );
 void nwclientShutdown( struct nwclientsHandle *h );
+
+/* Let go of a port for another process to carry on with. Everything queued has up to waitmS to go out, */
+/* then each client that can carry on is given to cb and the rest are closed (a compressed stream can't */
+/* be picked up part way through). Returns the listening socket, which like those of the clients given  */
+/* to cb is left open. Nothing may be sent to the port while this is going on, or after.               */
+int nwclientHandover( struct nwclientsHandle *h, uint32_t waitmS, nwclientHandoverCB cb, void *param );
+
+/* Use fd as the listening socket when port is next started, rather than making one */
+void nwclientInheritListener( int port, int fd );
+
+/* Carry on with a client another process handed over */
+bool nwclientAdopt( struct nwclientsHandle *h, const struct nwclientHandover *c );
+bool nwclientSenderThread( pthread_t *t );
 struct nwclientsHandle *nwclientStart( int port );
 
 // ====================================================================================================
@@ -24,6 +24,7 @@ struct OFLOWFrame
     uint8_t      tag;                       /* Tag (packet type) */
     uint8_t      sum;                       /* Checksum byte */
     bool         good;                      /* Is the checksum valid? */
+    bool         stamped;                   /* tstamp came from whoever made the frame, not made up on receipt */
     uint64_t     tstamp;                    /* Timestamp for the packet */
 
     uint8_t *d;                             /* ...pointer to the data itself */
@@ -34,7 +35,9 @@ struct OFLOW
     bool selfAllocated;                    /* Flag indicating that memory was allocated by the library */
     struct COBS c;
     struct OFLOWFrame f;
-    uint64_t perror;
+    orbStat perror;
+    bool stamped;                          /* A time frame has been seen... */
+    uint64_t stamp;                        /* ...and this is what it said */
 
     /* Materials for callback */
     void ( *cb )( struct OFLOWFrame *p, void *param );
@@ -46,6 +49,32 @@ struct OFLOW
 #define OFLOW_EOP_LEN            (COBS_EOP_LEN)
 #define OFLOW_TS_RESOLUTION      (1000000000L)
 
+/* Frames on this tag carry the time (in OFLOW_TS_RESOLUTION units, little endian) that the frames */
+/* after them, up to the next one, were stamped with. Clients only look at the tags they want, so  */
+/* they pass unnoticed by anything that doesn't care about time.                                   */
+#define OFLOW_TIME_TAG           (0xfe)
+#define OFLOW_TIME_LEN           (8)
+#define OFLOW_TIME_ENC_LEN       (OFLOW_TIME_LEN+4)
+
+/* A frame being encoded a piece at a time, straight into the caller's buffer */
+struct OFLOWEnc
+{
+    struct COBSEnc c;
+    uint8_t sum;                            /* Running sum of what's gone in, tag included */
+};
+
+/* Gathers up payload for one tag, so that data arriving in small pieces goes out in few frames */
+struct OFLOWCoalesce
+{
+    uint8_t tag;                            /* Tag the frames are sent with */
+    unsigned int len;                       /* Payload held so far */
+    uint64_t heldSince;                     /* Time (in caller's units) the oldest of it arrived */
+    struct OFLOWEnc e;                      /* ...already encoded into the frame it'll go in */
+    uint8_t d[OFLOW_MAX_ENC_PACKET_LEN];
+};
+
+typedef void ( *OFLOWFrameCB )( uint8_t tag, uint64_t heldSince, const uint8_t *d, unsigned int len, void *param );
+
 // ====================================================================================================
 
 static inline uint64_t OFLOWResolution( struct OFLOW *t )
@@ -57,19 +86,35 @@ const uint8_t *OFLOWgetFrameExtent( const uint8_t *inputEnc, int len );
 bool OFLOWisEOFRAME( const uint8_t *inputEnc );
 
 void OFLOWEncode( const uint8_t channel, const uint64_t tstamp, const uint8_t *inputMsg, int len, struct Frame *o );
+void OFLOWEncStart( struct OFLOWEnc *e, uint8_t tag, uint8_t *out );
+void OFLOWEncAdd( struct OFLOWEnc *e, const uint8_t *d, int len );
+int OFLOWEncEnd( struct OFLOWEnc *e );
+int OFLOWEncodeTime( uint64_t tstamp, uint8_t *out );
+
+void OFLOWCoalesceInit( struct OFLOWCoalesce *c, uint8_t tag );
+void OFLOWCoalesceAdd( struct OFLOWCoalesce *c, const uint8_t *d, int len, uint64_t now, OFLOWFrameCB frameOut, void *param );
+void OFLOWCoalesceFlush( struct OFLOWCoalesce *c, OFLOWFrameCB frameOut, void *param );
+static inline bool OFLOWCoalesceHeld( struct OFLOWCoalesce *c )
+{
+    return c->len != 0;
+}
 
 /* Context free functions */
 void OFLOWPump( struct OFLOW *t, const uint8_t *incoming, int len,
                 void ( *packetRxed )( struct OFLOWFrame *p, void *param ),
                 void *param );
+void OFLOWPumpInPlace( struct OFLOW *t, uint8_t *incoming, int len,
+                       void ( *packetRxed )( struct OFLOWFrame *p, void *param ),
+                       void *param );
 static inline uint64_t OFLOWGetErrors( struct OFLOW *t )
 {
-    return t ? t->perror : ( uint64_t ) -1;
+    return t ? STAT_READ( t->perror ) : ( uint64_t ) -1;
 }
 static inline uint64_t OFLOWGetCOBSErrors( struct OFLOW *t )
 {
     return t ? COBSGetErrors( &t->c ) : -1;
 }
+void OFLOWRegisterStats( struct OFLOW *t, struct statsRegistry *r, const char *prefix, const char *labels );
 void OFLOWDelete( struct OFLOW *t );
 struct OFLOW *OFLOWInit( struct OFLOW *t );
 // ====================================================================================================
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * ORBFLOW Merge Module
+ * ====================
+ *
+ * Puts the frames from several ORBFLOW streams (one per probe, say) into a single flow in
+ * timestamp order, using the time frames that orbuculum stamps its output with. A frame is
+ * only released once every stream has got past its time, so the streams need to be stamped
+ * against the same clock (e.g. from the one orbuculum, or hosts that keep time together).
+ * A stream that goes quiet holds the others up until OFLOWMergeRelease is used to say how
+ * long is long enough to wait, or one of the queues fills.
+ *
+ * Not thread safe...pump all of the streams from the one thread.
+ */
+
+#ifndef _ORBFLOW_MERGE_
+#define _ORBFLOW_MERGE_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "oflow.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct OFLOWMerge;
+
+/* Called with each good frame, in order, along with which stream it came from. Time frames */
+/* aren't passed on, but each frame carries its time in tstamp.                              */
+typedef void ( *OFLOWMergeCB )( int stream, struct OFLOWFrame *f, void *param );
+
+// ====================================================================================================
+
+struct OFLOWMerge *OFLOWMergeCreate( int nstreams, size_t queueBytes, OFLOWMergeCB cb, void *param );
+void OFLOWMergePump( struct OFLOWMerge *m, int stream, const uint8_t *d, int len );
+void OFLOWMergeRelease( struct OFLOWMerge *m, uint64_t before );
+void OFLOWMergeFlush( struct OFLOWMerge *m );
+uint64_t OFLOWMergeForced( struct OFLOWMerge *m );
+uint64_t OFLOWMergeErrors( struct OFLOWMerge *m );
+void OFLOWMergeDelete( struct OFLOWMerge *m );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * ORBFLOW Split Module
+ * ====================
+ *
+ * Decodes an ORBFLOW capture file on several threads at once. A zero can only ever be the end of
+ * a frame, so the file is cut into chunks at zeros and each chunk is decoded on its own, into
+ * spans holding the frames it found for each tag that's wanted. Spans are handed out a chunk at a
+ * time in file order, so the frames for any one tag come out in the order they were captured.
+ * Frames for different tags are only in order to the extent that the chunks are.
+ *
+ * Each chunk's frames carry the time from the time frames before them, in that chunk or the ones
+ * before it, just as if the whole file had been decoded in one go.
+ */
+
+#ifndef _ORBFLOW_SPLIT_
+#define _ORBFLOW_SPLIT_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "oflow.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OFLOW_SPLIT_DEFAULT_CHUNK (8*1024*1024)    /* Big enough that starting a chunk costs nothing much */
+
+struct OFLOWSplit;
+
+/* One of the frames in a span */
+struct OFLOWSpanFrame
+{
+    uint32_t len;                                  /* Length of its payload */
+    bool stamped;                                  /* tstamp came from a time frame */
+    uint64_t tstamp;                               /* ...and is when it was stamped, 0 if not */
+};
+
+/* Every frame found for one tag in one chunk, with their payloads back to back in d */
+struct OFLOWSpan
+{
+    uint8_t tag;
+    uint64_t fileOfs;                              /* Where in the file the chunk starts */
+    const uint8_t *d;
+    size_t len;
+    const struct OFLOWSpanFrame *f;                /* Each frame, in order */
+    uint32_t nframes;
+};
+
+/* Called with each span in turn, from the thread running OFLOWSplitRun. Return false to stop */
+typedef bool ( *OFLOWSplitCB )( const struct OFLOWSpan *s, void *param );
+
+// ====================================================================================================
+
+/* Decode file from start, in chunks of about chunkBytes (0 for the default) across threads threads.  */
+/* Only frames for the ntags tags are kept, or for every tag if ntags is 0 (time frames included).    */
+struct OFLOWSplit *OFLOWSplitCreate( const char *file, uint64_t start, int threads, size_t chunkBytes, int ntags, const uint8_t *tags );
+bool OFLOWSplitRun( struct OFLOWSplit *s, OFLOWSplitCB cb, void *param ); /* False if it couldn't read all of the file, or cb stopped it */
+uint64_t OFLOWSplitErrors( struct OFLOWSplit *s );                         /* Bad frames found */
+void OFLOWSplitDelete( struct OFLOWSplit *s );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
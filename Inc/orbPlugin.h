@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Orbuculum Plugin API
+ * ====================
+ *
+ * What a shared object loaded into orbuculum with -L sees. The object exports ORBPLUGIN_ENTRY,
+ * returning a description of itself, and orbuculum then creates an instance of it for each
+ * probe it's serving. Everything the plugin is given comes to it on a worker thread of its
+ * probe's own, so nothing it does can hold up capture or the network clients...but if it
+ * can't keep up then the data it misses is counted and lost.
+ *
+ * Data handed to the callbacks is only valid for the duration of the call.
+ */
+
+#ifndef _ORB_PLUGIN_
+#define _ORB_PLUGIN_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "generics.h"
+#include "msgDecoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever either of the structures below changes incompatibly */
+#define ORBPLUGIN_API_VERSION (1)
+
+/* Symbol looked up in the shared object, of type orbPluginEntryFn */
+#define ORBPLUGIN_ENTRY       "orbPluginEntry"
+
+/* What orbuculum provides to each plugin instance */
+struct orbPluginHost
+{
+    int apiVersion;                                /* ORBPLUGIN_API_VERSION orbuculum was built with */
+    const char *probe;                             /* Serial number of the probe, "" if there's only one */
+    genericsReportCB report;                       /* Report through orbuculum's logging */
+
+    /* Results are published as named values, which appear in orbuculum's metrics. addMetric */
+    /* returns the id to set it with, or -1 if there are too many. setMetric is cheap enough */
+    /* to be called for every message.                                                      */
+    int ( *addMetric )( struct orbPluginHost *h, const char *name );
+    void ( *setMetric )( struct orbPluginHost *h, int id, int64_t v );
+
+    void *priv;                                    /* orbuculum's own, don't touch */
+};
+
+/* What the plugin provides. Any of the callbacks may be NULL if it doesn't want that sort of */
+/* data, and orbuculum won't do the work of producing it if nobody does.                      */
+struct orbPlugin
+{
+    int apiVersion;                                /* ORBPLUGIN_API_VERSION the plugin was built with */
+    const char *name;                              /* Used in metrics and reports */
+
+    /* Create an instance, with whatever followed the filename on the command line (or ""). */
+    /* The returned context is passed to every other call, NULL means the instance failed.  */
+    void *( *init )( struct orbPluginHost *h, const char *args );
+
+    /* Data exactly as it arrived from the probe, in whatever framing it had */
+    void ( *rawData )( void *ctx, const uint8_t *d, size_t len );
+
+    /* Payload of each ORBFLOW frame (or TPIU stream), for every tag */
+    void ( *tagData )( void *ctx, uint8_t tag, const uint8_t *d, size_t len );
+
+    /* Batches of messages decoded from the ITM in stream 1, stamped with host time */
+    void ( *msgs )( void *ctx, const struct msg *m, size_t n );
+
+    /* The instance is finished with, as orbuculum exits */
+    void ( *close )( void *ctx );
+};
+
+typedef const struct orbPlugin *( *orbPluginEntryFn )( void );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Static Probes
+ * =============
+ *
+ * USDT probes at the points that matter when working out what a live capture is doing...transfers
+ * completing, blocks being handled, sync being lost and found, overflows, and network clients
+ * coming, going and being dropped. They can be attached to with bpftrace, perf or systemtap
+ * without rebuilding or restarting anything, e.g.
+ *
+ *   bpftrace -e 'usdt:./orbuculum:orbuculum:usb_transfer { @len = hist(arg0); }'
+ *
+ * Until something attaches a probe is a single nop. The library's probes are under the liborb
+ * provider and orbuculum's own under orbuculum. Without sys/sdt.h (which comes with systemtap)
+ * they all compile away to nothing.
+ *
+ *   orbuculum:usb_transfer     (length, libusb status)         A USB transfer has come back
+ *   orbuculum:block            (length, nS monotonic arrival)  A block is being decoded and dispatched
+ *   orbuculum:block_done       (length, nS since arrival)      ...and has been handed to the clients
+ *   liborb:client_connect      (fd, address)                   A network client has connected
+ *   liborb:client_drop         (fd, bytes)                     ...has had data dropped as it isn't keeping up
+ *   liborb:client_kill         (fd, total bytes dropped)       ...and has gone
+ *   liborb:tpiu_sync           (syncs)                         TPIU has been synced from unsynced
+ *   liborb:tpiu_lost_sync      (uS since the last frame)       ...and has lost it through a gap in the data
+ *   liborb:oflow_bad_frame     (tag, length)                   An ORBFLOW frame failed its checksum or was short
+ *   liborb:itm_sync            (syncs)                         An ITM sync packet
+ *   liborb:itm_lost_sync       (times lost)                    ITM sync was forced off
+ *   liborb:itm_overflow        (overflows)                     An ITM overflow packet
+ *   liborb:itm_error           (header)                        An ITM header that means nothing
+ *   liborb:trace_sync          (protocol, synced)              A trace decoder has found or lost sync
+ *   liborb:trace_force_sync    (protocol, synced)              ...or been told to
+ *
+ */
+
+#ifndef _ORB_PROBES_H_
+#define _ORB_PROBES_H_
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define ORB_PROBES_BUILT (1)
+#define ORB_PROBE(provider, name, ...) STAP_PROBEV(provider, name, ##__VA_ARGS__)
+#else
+#define ORB_PROBES_BUILT (0)
+#define ORB_PROBE(provider, name, ...) do { } while (0)
+#endif
+
+#endif
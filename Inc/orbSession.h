@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Orbuculum Session
+ * =================
+ *
+ * Everything needed to consume trace from inside another program, without having to put together
+ * the streams, framing and decoders for yourself. A session is given where to read from (an
+ * orbuculum, or a capture file) and then subscribed to the tags it wants, saying for each one
+ * whether it wants the data as it arrives, decoded into ITM messages, or decoded into trace events.
+ * Once started it connects, reconnecting whenever the connection drops, and decodes until stopped.
+ *
+ * The callbacks are all made from the session's own thread, in the order the data arrived, with
+ * as much as could be decoded from one block at a time. What they're given is only good for the
+ * duration of the call. Sockets are drained on a thread of their own too, so a callback that
+ * takes a while doesn't leave orbuculum thinking we've gone away.
+ *
+ * With ORBFLOW each tag is its own stream. Without it there's just the one, tagged
+ * DEFAULT_ITM_STREAM, unless it's TPIU framed, when the TPIU stream numbers are the tags.
+ *
+ */
+
+#ifndef _ORB_SESSION_H_
+#define _ORB_SESSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "msgDecoder.h"
+#include "traceDecoder.h"
+#include "nw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define ORBSESSION_MAX_SUBS   (8)                  /* Most subscriptions one session can have */
+#define ORBSESSION_MSG_BATCH  (256)                /* Most ITM messages handed over in one call */
+#define ORBSESSION_EV_BATCH   (256)                /* ...and trace events */
+
+struct orbSession;
+
+/* Where the session gets its data from */
+struct orbSessionSource
+{
+    const char *server;                            /* Host to connect to, NULL for localhost */
+    int port;                                      /* ...0 for the default for the framing */
+    const char *file;                              /* Read this capture file instead */
+    bool fileTerminate;                            /* ...finishing at its end rather than waiting for more */
+    bool oflow;                                    /* Data is ORBFLOW framed (true for current orbuculums) */
+    bool useTPIU;                                  /* ITM (or the DEFAULT_ITM_STREAM tag) is TPIU framed */
+    enum nwQoS qos;                                /* What to ask orbuculum for */
+};
+
+/* Subscriber callbacks */
+typedef void ( *orbSessionDataCB )( uint8_t tag, const uint8_t *d, size_t len, void *param );
+typedef void ( *orbSessionMsgCB )( uint8_t tag, const struct msg *m, size_t n, void *param );
+typedef void ( *orbSessionTraceCB )( uint8_t tag, const struct TRACEEvent *ev, size_t n,
+                                     const struct TRACECPUState *cpu, void *param );
+
+/* Running totals, which can be read at any time */
+struct orbSessionStats
+{
+    uint64_t bytes;                                /* Received from the source */
+    uint64_t badFrames;                            /* ORBFLOW frames that failed their checksum */
+    uint32_t connects;                             /* Times the source was opened */
+};
+
+// ====================================================================================================
+struct orbSession *orbSessionCreate( const struct orbSessionSource *src );
+
+/* Subscriptions can only be made before the session is started. A tag may be subscribed more than once */
+bool orbSessionSubscribeData( struct orbSession *s, uint8_t tag, orbSessionDataCB cb, void *param );
+bool orbSessionSubscribeITM( struct orbSession *s, uint8_t tag, orbSessionMsgCB cb, void *param );
+bool orbSessionSubscribeTrace( struct orbSession *s, uint8_t tag, enum TRACEprotocol protocol, bool altAddr,
+                               orbSessionTraceCB cb, void *param );
+
+bool orbSessionStart( struct orbSession *s );
+bool orbSessionRunning( struct orbSession *s );    /* False once a file it was told to finish has finished */
+void orbSessionGetStats( struct orbSession *s, struct orbSessionStats *st );
+void orbSessionStop( struct orbSession *s );       /* Waits for the last callback to return */
+void orbSessionDelete( struct orbSession *s );     /* ...stopping it first, if it's still going */
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
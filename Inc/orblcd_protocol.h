@@ -13,6 +13,9 @@
 #define ORBLCD_CMD_CLOSE_SCREEN (2)
 #define ORBLCD_CMD_CLEAR        (3)
 #define ORBLCD_CMD_GOTOXY       (4)
+#define ORBLCD_CMD_WINDOW_XY    (5)
+#define ORBLCD_CMD_WINDOW_WH    (6)
+#define ORBLCD_CMD_REPEAT       (7)
 
 #define ORBLCD_ENCODE_X(x) ((x&0xfff)<<0)
 #define ORBLCD_ENCODE_Y(x) ((x&0xfff)<<12)
@@ -22,6 +25,8 @@
 #define ORBLCD_DECODE_Y(x) ((x>>12)&0xfff)
 #define ORBLCD_DECODE_D(x) ((x>>24)&0x03)
 #define ORBLCD_DECODE_C(x) ((x>>26)&0x3f)
+#define ORBLCD_ENCODE_N(x) ((x&0xffffff)<<0)
+#define ORBLCD_DECODE_N(x) ((x>>0)&0xffffff)
 
 #define ORBLCD_GET_DEPTH(x)        (((int[]){1,8,16,24})[ORBLCD_DECODE_D(x)])
 #define ORBLCD_PIXELS_PER_WORD(x)  (((int[]){32,4,2,1})[ORBLCD_DECODE_D(x)])
@@ -29,5 +34,15 @@
 #define ORBLCD_OPEN_SCREEN(x,y,d) (ORBLCD_ENCODE_C(ORBLCD_CMD_INIT_LCD)|ORBLCD_ENCODE_D(d)|ORBLCD_ENCODE_X(x)|ORBLCD_ENCODE_Y(y))
 #define ORBLCD_CLOSE_SCREEN       (ORBLCD_ENCODE_C(ORBLCD_CMD_CLOSE_SCREEN))
 #define ORBLCD_CLEAR              (ORBLCD_ENCODE_C(ORBLCD_CMD_CLEAR))
+#define ORBLCD_GOTOXY(x,y)        (ORBLCD_ENCODE_C(ORBLCD_CMD_GOTOXY)|ORBLCD_ENCODE_X(x)|ORBLCD_ENCODE_Y(y))
+
+/* Restrict drawing to a rectangle of the screen, so only it needs to be sent. Data then fills the rectangle */
+/* and wraps within it. XY sets its top left and moves there, and WH its size. OPEN_SCREEN and GOTOXY      */
+/* return to the whole screen.                                                                            */
+#define ORBLCD_WINDOW_XY(x,y)     (ORBLCD_ENCODE_C(ORBLCD_CMD_WINDOW_XY)|ORBLCD_ENCODE_X(x)|ORBLCD_ENCODE_Y(y))
+#define ORBLCD_WINDOW_WH(w,h)     (ORBLCD_ENCODE_C(ORBLCD_CMD_WINDOW_WH)|ORBLCD_ENCODE_X(w)|ORBLCD_ENCODE_Y(h))
+
+/* The next data word is used n times over, for runs and fills */
+#define ORBLCD_REPEAT(n)          (ORBLCD_ENCODE_C(ORBLCD_CMD_REPEAT)|ORBLCD_ENCODE_N(n))
 
 #endif
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "bufPool.h"
 
 #if defined OSX
     #include <sys/ioctl.h>
@@ -31,11 +32,12 @@ extern "C" {
 #endif
 
 #define USB_TRANSFER_SIZE (65536)
+#define GDB_RX_LEN        (64)                   /* Most taken at once from the BMP's GDB server */
 
 #define NO_INTERFACE ((uint8_t)(-1))
 #define NO_DEVICE    (-1)
 
-enum ORBTraceDevice { DEVICE_NULL, DEVICE_ORBTRACE_MINI, DEVICE_BMP, DEVICE_NUM_DEVICES };
+enum ORBTraceDevice { DEVICE_NULL, DEVICE_ORBTRACE_MINI, DEVICE_BMP, DEVICE_CMSIS_DAP, DEVICE_FTDI, DEVICE_NUM_DEVICES };
 
 #define DEVTYPE_ALL 0xffffffff
 #define DEVTYPE(x) (1<<x)
@@ -70,11 +72,13 @@ struct OrbtraceIfDevice
     const struct OrbtraceInterfaceType *type;
 };
 
-struct __attribute__( ( packed ) ) dataBlock
+/* The buffer comes first, and on a cache line of its own, so an array of these (from bufPoolAlloc) */
+/* has every buffer cache aligned and nothing else written sharing a line with any of them.         */
+struct dataBlock
 {
-            long unsigned int fillLevel;                         /* How full this block is */
-            uint8_t buffer[USB_TRANSFER_SIZE];                   /* Block buffer */
-            struct libusb_transfer *usbtfr;                      /* USB Transfer handle */
+    uint8_t buffer[USB_TRANSFER_SIZE] __attribute__( ( aligned( BUFPOOL_CACHE_LINE ) ) ); /* Block buffer */
+    long unsigned int fillLevel;                                                         /* How full this block is */
+    struct libusb_transfer *usbtfr;                                                      /* USB Transfer handle */
 };
 
 struct OrbtraceIf
@@ -84,6 +88,10 @@ struct OrbtraceIf
     libusb_device *dev;                          /* usb handle for currently active device (or NULL for non active) */
     libusb_device **list;                        /* List of available usbdevices */
     libusb_context *context;                     /* Any active context */
+    bool sharedContext;                          /* ...which belongs to someone else, so isn't ours to close */
+    libusb_hotplug_callback_handle hotplug;      /* Registration for news of devices arriving */
+    bool hotplugging;                            /* ...which is in place */
+    int arrived;                                 /* A device we might want has turned up since we last looked */
 
     /* Data transfer specific structures */
     struct dataBlock *d;                         /* Transfer datablocks */
@@ -92,9 +100,29 @@ struct OrbtraceIf
     uint8_t iface;                               /* ...and the interface */
     bool isOrbtrace;                             /* Is this an orbtrace device? */
     bool supportsOFLOW;                          /* ...and does it support OFLOW for transfer? */
+    uint8_t dapOut;                              /* CMSIS-DAP command endpoint, when ep is its SWO one */
+    uint8_t dapIn;                               /* ...and the one responses come back on */
+    bool dapSWO;                                 /* ...and its SWO capture has been started */
+    uint8_t dapIface;                            /* Interface the CMSIS-DAP commands go to */
+    bool dapClaimed;                             /* ...which had to be claimed just for them */
+    bool dapAttached;                            /* ...and is connected to the target over SWD */
+    uint16_t dapPacket;                          /* ...with commands and responses up to this long */
+    uint8_t gdbComm;                             /* BMP GDB server interface, for target memory on a BMP */
+    uint8_t gdbData;                             /* ...and the data interface that goes with it */
+    uint8_t gdbOut;                              /* ...with packets sent out on this endpoint */
+    uint8_t gdbIn;                               /* ...and coming back on this one */
+    bool gdbClaimed;                             /* ...which have been taken from the tty driver */
+    bool gdbAttached;                            /* ...and the GDB server is attached to the target */
+    uint8_t gdbRx[GDB_RX_LEN];                   /* What's come back from it and not been used yet */
+    int gdbRxAt;                                 /* ...from here */
+    int gdbRxLen;                                /* ...to here */
+    uint16_t ftdiPacket;                         /* FTDI packet size, each starting with two status bytes, 0 if not FTDI */
 
     int numDevices;                              /* Number of matching devices found */
     struct OrbtraceIfDevice *devices;            /* List of matching devices found */
+
+    int inheritedFd;                             /* Device handed over from another process, already claimed */
+    bool inherited;                              /* ...which is waiting to be opened */
 };
 // ====================================================================================================
 
@@ -133,6 +161,10 @@ static inline int OrbtraceIfGetActiveDevnum( struct OrbtraceIf *o )
 {
     return o->activeDevice;
 }
+static inline int OrbtraceIfGetNumDevices( struct OrbtraceIf *o )
+{
+    return o->numDevices;
+}
 static inline libusb_device *OrbtraceIfGetDev( struct OrbtraceIf *o )
 {
     return o->dev;
@@ -154,6 +186,12 @@ int OrbtraceIfSelectDevice( struct OrbtraceIf *o );
 bool OrbtraceIfOpenDevice( struct OrbtraceIf *o, int entry );
 bool OrbtraceGetIfandEP( struct OrbtraceIf *o );
 void OrbtraceIfCloseDevice( struct OrbtraceIf *o );
+
+/* Handing an open device on to another process, where the platform lets us. The descriptor for it */
+/* (or -1 if there isn't one), and in the other process that descriptor to open it through, rather */
+/* than opening it afresh. Nothing may be in flight on it when it's handed over.                  */
+int OrbtraceIfDeviceFd( struct OrbtraceIf *o );
+void OrbtraceIfInheritDevice( struct OrbtraceIf *o, int fd );
 enum Channel OrbtraceIfNameToChannel( char *x );
 bool OrbtraceIsOrbtrace( struct OrbtraceIf *o );
 bool OrbtraceSupportsOFLOW( struct OrbtraceIf *o );
@@ -162,18 +200,41 @@ bool OrbtraceSupportsOFLOW( struct OrbtraceIf *o );
 bool OrbtraceIfSetTraceWidth( struct OrbtraceIf *o, int width );
 bool OrbtraceIfSetTraceSWO( struct OrbtraceIf *o, bool isMANCH, bool useTPIU );
 bool OrbtraceIfSetSWOBaudrate( struct OrbtraceIf *o, uint32_t speed );
+bool OrbtraceIfStartDapSWO( struct OrbtraceIf *o, uint32_t speed );  /* Stream UART SWO from a CMSIS-DAP v2 probe */
+bool OrbtraceIfStartFTDI( struct OrbtraceIf *o, uint32_t speed );    /* FTDI as a UART at speed, or a sync FIFO if 0 */
+size_t OrbtraceIfFTDIPayload( struct OrbtraceIf *o, uint8_t *d, size_t len ); /* Strip FTDI status from a transfer */
+
+/* Target memory over SWD, through a CMSIS-DAP interface (which ORBTrace has too) */
+bool OrbtraceIfOpenDap( struct OrbtraceIf *o );
+bool OrbtraceIfDapAttach( struct OrbtraceIf *o, uint32_t clockHz );
+bool OrbtraceIfDapRead( struct OrbtraceIf *o, uint32_t addr, uint8_t *d, uint32_t len );
+bool OrbtraceIfDapWrite32( struct OrbtraceIf *o, uint32_t addr, uint32_t v );
+
+/* Target memory over SWD through whatever the open probe has for it; the GDB server on a BMP, */
+/* otherwise a CMSIS-DAP interface. The target keeps running while it's got at.                */
+bool OrbtraceIfTargetAttach( struct OrbtraceIf *o, uint32_t clockHz );
+bool OrbtraceIfTargetRead( struct OrbtraceIf *o, uint32_t addr, uint8_t *d, uint32_t len );
+bool OrbtraceIfTargetWrite32( struct OrbtraceIf *o, uint32_t addr, uint32_t v );
+void OrbtraceIfTargetDetach( struct OrbtraceIf *o );
 
 bool OrbtraceIfVoltage( struct OrbtraceIf *o, enum Channel ch, int voltage );
 bool OrbtraceIfSetVoltageEn( struct OrbtraceIf *o, enum Channel ch, bool isOn );
 
 /* Data transfer specifics */
-bool OrbtraceIfSetupTransfers( struct OrbtraceIf *o, bool hiresTime, struct dataBlock *d, int numBlocks, libusb_transfer_cb_fn callback );
+bool OrbtraceIfSetupTransfers( struct OrbtraceIf *o, bool hiresTime, struct dataBlock *d, int numBlocks, libusb_transfer_cb_fn callback, void *userData );
 int OrbtraceIfHandleEvents( struct OrbtraceIf *o );
+int OrbtraceIfHandleEventsTimeout( struct OrbtraceIf *o, unsigned int uS );
 void OrbtraceIfCloseTransfers( struct OrbtraceIf *o );
+void OrbtraceIfFreeTransfers( struct dataBlock *d, int numBlocks );
+int OrbtraceIfRead( struct OrbtraceIf *o, uint8_t *d, int len, unsigned int timeoutmS ); /* Data got without transfers, <0 on error */
 
 /* Device context control */
 struct OrbtraceIf *OrbtraceIfCreateContext( void );
+struct OrbtraceIf *OrbtraceIfCreateSharedContext( libusb_context *context );
+struct OrbtraceIf *OrbtraceIfCreateDeviceContext( struct OrbtraceIf *o, int entry ); /* One found device, opened on its own */
 void OrbtraceIfDestroyContext( struct OrbtraceIf *o );
+bool OrbtraceIfWatchArrivals( struct OrbtraceIf *o );
+bool OrbtraceIfWaitForArrival( struct OrbtraceIf *o, unsigned int uS );
 
 // ====================================================================================================
 #ifdef __cplusplus
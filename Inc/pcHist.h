@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * PC Sample Histograms
+ * ====================
+ *
+ * Counts PC samples by address over an interval, so that a server can send just the counts to
+ * clients that only want to know where the time is going (orbtop, for example) rather than every
+ * sample. At the end of each interval the counts are taken, in address order, and it all starts
+ * again from nothing.
+ *
+ */
+
+#ifndef _PC_HIST_H_
+#define _PC_HIST_H_
+
+#include <stdint.h>
+#include "msgDecoder.h"
+#include "msgStream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct pcHist;
+
+struct pcHist *pcHistCreate( void );
+void pcHistAdd( struct pcHist *h, const struct pcSampleMsg *m );
+uint32_t pcHistSamples( struct pcHist *h );                     /* How many have been added this interval */
+
+/* Fill in o with the interval's counts, which stay valid until the next take, and start the next one */
+void pcHistTake( struct pcHist *h, struct msgStreamHist *o );
+void pcHistDelete( struct pcHist *h );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Perfetto Timeline Writer
+ * ========================
+ *
+ * Writes a timeline of slices and counters as a Perfetto protobuf trace, which ui.perfetto.dev
+ * will open directly. Each event is written out as it happens, so a trace can run for as long as
+ * needed and what's in the file so far is always readable. Event names are interned, sent once
+ * and referred to by number after that, so a slice costs a few bytes however long its name is.
+ *
+ * All of the tracks belong to one process, named when the trace is made. Times are given in the
+ * caller's ticks and are converted to nanoseconds with the scale set then.
+ *
+ * Only one thread should use a trace.
+ */
+
+#ifndef _PERFETTO_H_
+#define _PERFETTO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct perfettoTrace;
+
+struct perfettoTrace *perfettoCreate( const char *filename, const char *process, double nsPerTick );
+uint64_t perfettoTrack( struct perfettoTrace *p, const char *name );                        /* A track for slices, which nest */
+uint64_t perfettoCounterTrack( struct perfettoTrace *p, const char *name );                 /* ...or for a counter */
+uint64_t perfettoName( struct perfettoTrace *p, const char *name );                         /* Intern name for slices to use */
+void perfettoBegin( struct perfettoTrace *p, uint64_t track, uint64_t ticks, uint64_t name ); /* Start a slice... */
+void perfettoEnd( struct perfettoTrace *p, uint64_t track, uint64_t ticks );                 /* ...and end the innermost one */
+void perfettoCounter( struct perfettoTrace *p, uint64_t track, uint64_t ticks, int64_t v );
+bool perfettoClose( struct perfettoTrace *p );                                              /* False if any of it didn't get written */
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
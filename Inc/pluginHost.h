@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Plugin Host
+ * ===========
+ *
+ * orbuculum's side of orbPlugin.h. Each probe gets a host, which runs the plugins loaded into
+ * it on a worker thread of its own. Incoming blocks are queued for the worker, borrowing the
+ * block when there is one to borrow, and are decoded there as far as the plugins need.
+ *
+ */
+
+#ifndef _PLUGIN_HOST_H_
+#define _PLUGIN_HOST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nwclient.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+struct pluginHost;
+
+/* One published result */
+struct pluginValue
+{
+    const char *plugin;                            /* Name of the plugin that published it */
+    const char *name;                              /* ...what it called it */
+    int64_t value;                                 /* ...and its current value */
+};
+
+// ====================================================================================================
+
+struct pluginHost *pluginHostCreate( const char *probe, bool useTPIU );
+bool pluginHostLoad( struct pluginHost *p, const char *spec );
+bool pluginHostStart( struct pluginHost *p );
+void pluginHostFeed( struct pluginHost *p, const uint8_t *d, uint32_t len, struct nwclientBlock *b, bool oflow );
+uint64_t pluginHostDroppedBytes( struct pluginHost *p );
+int pluginHostValues( struct pluginHost *p, struct pluginValue *v, int max );
+void pluginHostStop( struct pluginHost *p );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
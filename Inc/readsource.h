@@ -9,6 +9,12 @@ extern "C" {
 
 char *readsourcefile( char *path, size_t *l );
 
+/* As readsourcefile, but mapped rather than read, and not including the 0 on the end in l.  */
+/* Returns NULL if that can't be done (e.g. because the source is being pretty printed), in */
+/* which case readsourcefile will still work. Give it back with readsourceunmap.            */
+char *readsourcemap( char *path, size_t *l );
+void readsourceunmap( char *d, size_t l );
+
 // ====================================================================================================
 
 #ifdef __cplusplus
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Real Time Transfer
+ * ==================
+ *
+ * Takes what a target has written into the up-buffers of a SEGGER RTT control block, by reading its
+ * memory while it runs. How the memory is got at is up to the caller, via the read and write
+ * routines it gives; all that's needed is to read bytes and to write a 32 bit word.
+ *
+ * The control block is found by looking for its ID in a range of target memory (or at exactly
+ * the address given, if the range is empty). The buffer descriptors are read again each poll, so
+ * a target that sets up its buffers after starting, or resets and starts again, is followed. If
+ * the ID goes away the control block has to be found again.
+ *
+ */
+
+#ifndef _RTT_H_
+#define _RTT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define RTT_MAX_UP_BUFFERS (32)                  /* Most up-buffers that are followed */
+#define RTT_MAX_NAME_LEN   (32)                  /* Longest buffer name kept */
+
+typedef bool ( *rttReadFn )( void *param, uint32_t addr, uint8_t *d, uint32_t len );
+typedef bool ( *rttWriteFn )( void *param, uint32_t addr, uint32_t v );
+
+/* Data taken from up-buffer buf */
+typedef void ( *rttDataCB )( unsigned int buf, const uint8_t *d, uint32_t len, void *param );
+
+struct rtt;
+
+// ====================================================================================================
+struct rtt *rttCreate( rttReadFn read, rttWriteFn write, void *param );
+
+/* Look for the control block in len bytes from addr. 1 if it was found, 0 if not (yet), <0 if memory couldn't be read */
+int rttFind( struct rtt *r, uint32_t addr, uint32_t len );
+bool rttFound( struct rtt *r );
+uint32_t rttAddress( struct rtt *r );            /* Where the control block is */
+unsigned int rttNumUp( struct rtt *r );
+const char *rttUpName( struct rtt *r, unsigned int buf ); /* As it was when the control block was found */
+
+/* Take up to max bytes from the up-buffers, giving them to cb. Returns how many, or <0 if memory */
+/* couldn't be read or written. If the control block has gone, it's 0 and rttFound is false.     */
+int rttPoll( struct rtt *r, uint32_t max, rttDataCB cb, void *param );
+
+void rttDelete( struct rtt *r );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Shared Memory Broadcast Ring
+ * ============================
+ *
+ * One writer publishes a byte stream into a named shared memory object, and any number of readers
+ * on the same host follow it, each with its own cursor. The writer never waits for readers...one
+ * that falls more than a ring's worth behind loses the oldest data, and is told how much it lost.
+ * Readers don't need to make any system calls while there's data waiting for them.
+ *
+ */
+
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define SHMRING_DEFAULT_SIZE (1024*1024)           /* Default size of ring, if you've no better idea */
+
+struct shmRing;
+
+/* Writing */
+struct shmRing *shmRingCreate( const char *name, size_t size );             /* Create named ring, size rounded up to a power of two */
+void shmRingWrite( struct shmRing *r, const void *d, size_t len );         /* Publish data to all readers */
+
+/* Reading */
+struct shmRing *shmRingOpen( const char *name );                           /* Attach to named ring, starting with what's written next */
+size_t shmRingRead( struct shmRing *r, void *d, size_t len, int timeoutMs, uint64_t *lost ); /* Read what's there, waiting up to timeoutMs for it */
+size_t shmRingPeek( struct shmRing *r, const void **d, size_t len, int timeoutMs, uint64_t *lost ); /* As shmRingRead, pointing into the ring itself */
+size_t shmRingConsume( struct shmRing *r, size_t len );                    /* Move past what was peeked at, returning how much was overwritten meanwhile */
+size_t shmRingHeadroom( struct shmRing *r );                               /* How much can be written before what's to be read next is overwritten */
+bool shmRingWriterGone( struct shmRing *r );                               /* Check if the writer has gone away */
+
+/* Either */
+void shmRingClose( struct shmRing *r );                                    /* Detach from ring, removing it if we created it */
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * SIMD Kernel Dispatch
+ * ====================
+ *
+ * The inner loops that gain from vector instructions have a kernel for each instruction set level
+ * here. The best level the CPU supports is picked the first time the kernels are asked for, so
+ * liborb can be built for a baseline target and still make use of AVX2 where it's there. The
+ * meson 'simd' option sets the level to use instead, if the CPU has it.
+ *
+ */
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum SIMDLevel { SIMD_SCALAR, SIMD_SSE42, SIMD_AVX2, SIMD_NEON, SIMD_NUM_LEVELS };
+
+struct SIMDKernels
+{
+    /* Count the 16 byte frames from p, up to n of them, before the first one containing c */
+    int ( *cleanFrames )( const uint8_t *p, int n, uint8_t c );
+
+    /* Pack bit b of each of the n*64 bytes from p into n words, with the first byte in the bottom bit of the first word */
+    void ( *packBits )( const uint8_t *p, int n, unsigned int b, uint64_t *w );
+
+    /* Sum of the n bytes from p, modulo 256 */
+    uint8_t ( *sumBytes )( const uint8_t *p, int n );
+};
+
+// ====================================================================================================
+const struct SIMDKernels *SIMDKernels( void );
+enum SIMDLevel SIMDGetLevel( void );
+const char *SIMDLevelName( enum SIMDLevel l );
+bool SIMDSupported( enum SIMDLevel l );
+
+/* Use a specific level from now on, returns false (leaving things alone) if the CPU doesn't have it */
+bool SIMDSetLevel( enum SIMDLevel l );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Statistics Registry
+ * ===================
+ *
+ * The decoders keep their statistics as 64 bit values, so they don't wrap, each one written only by
+ * the thread doing the decoding, with relaxed atomic stores so any other thread can read it without
+ * tearing. A registry holds a name, help text and labels (e.g. probe="x") for each of them, so
+ * whatever wants to show statistics can ask for a snapshot of all of them rather than knowing the
+ * layout of every decoder's stats.
+ *
+ * Entries refer to the statistics where they are, so they need removing (statsRegistryRemove) before
+ * what they belong to goes away. The names and labels are copied in.
+ *
+ */
+
+#ifndef _STATS_REGISTRY_H_
+#define _STATS_REGISTRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+typedef uint64_t orbStat;
+
+/* Updating a statistic is only for the thread that owns it, reading it is for anyone */
+#define STAT_ADD( s, n ) __atomic_store_n( &( s ), ( s ) + ( n ), __ATOMIC_RELAXED )
+#define STAT_INC( s )    STAT_ADD( s, 1 )
+#define STAT_SET( s, v ) __atomic_store_n( &( s ), ( v ), __ATOMIC_RELAXED )
+#define STAT_READ( s )   __atomic_load_n( &( s ), __ATOMIC_RELAXED )
+
+enum statType { STAT_COUNTER, STAT_GAUGE };
+
+/* One statistic as it was when the snapshot was taken */
+struct statValue
+{
+    const char *name;                              /* Strings are good until the statistic is removed */
+    const char *help;
+    const char *labels;                            /* ...empty for none */
+    enum statType type;
+    uint64_t v;
+};
+
+/* One of a set of statistics in a structure, so all of them can be added at once */
+struct statDef
+{
+    const char *name;
+    const char *help;
+    enum statType type;
+    size_t ofs;                                    /* ...offsetof the orbStat in the structure */
+};
+
+struct statsRegistry;
+
+// ====================================================================================================
+struct statsRegistry *statsRegistryCreate( void );
+void statsRegistryDelete( struct statsRegistry *r );
+
+/* The name is prefix_name. Labels (which may be NULL) are as they'd be written between {} */
+bool statsRegistryAdd( struct statsRegistry *r, const char *prefix, const char *name, const char *help,
+                       const char *labels, enum statType type, const orbStat *s );
+
+/* Add each of the n statistics in d from the structure at base. Returns false if any couldn't be */
+bool statsRegistryAddSet( struct statsRegistry *r, const char *prefix, const char *labels, const void *base,
+                          const struct statDef *d, int n );
+
+/* Remove every statistic held in the len bytes at from, e.g. a decoder's stats */
+void statsRegistryRemove( struct statsRegistry *r, const void *from, size_t len );
+
+/* Fill in up to max values, grouped by name and otherwise in the order they were added. Returns how */
+/* many statistics there are, which may be more than max.                                           */
+int statsRegistrySnapshot( struct statsRegistry *r, struct statValue *v, int max );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #define _STREAM_H_
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
 
 #ifdef __cplusplus
@@ -21,10 +23,77 @@ struct Stream
     enum ReceiveResult ( *receive )( struct Stream *stream, void *buffer, size_t bufferSize,
                                      struct timeval *timeout, size_t *receivedSize );
     void ( *close )( struct Stream *stream );
+
+    /* Optional zero-copy receive, lending out up to maxSize of the stream's own memory rather than copying */
+    /* it. That stays put until release (or the next acquire), and release says if it stayed good all that */
+    /* while...a ring the writer can lap can't promise that up front. NULL if unsupported, release may be  */
+    /* NULL too if there's nothing to give back. Use streamAcquire/streamRelease to have either handled.   */
+    enum ReceiveResult ( *acquire )( struct Stream *stream, const void **data, size_t maxSize,
+                                     struct timeval *timeout, size_t *receivedSize );
+    bool ( *release )( struct Stream *stream );
+
+    /* Optional send of data back to the source, for streams that have a back channel. NULL if unsupported. */
+    bool ( *send )( struct Stream *stream, const void *buffer, size_t size );
 };
 
+/* Borrow from the stream if it lends, otherwise receive into buffer. Either way data ends up pointing at it */
+static inline enum ReceiveResult streamAcquire( struct Stream *stream, void *buffer, size_t bufferSize, const void **data,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    if ( stream->acquire )
+    {
+        return stream->acquire( stream, data, bufferSize, timeout, receivedSize );
+    }
+
+    *data = buffer;
+    return stream->receive( stream, buffer, bufferSize, timeout, receivedSize );
+}
+
+/* Finished with what streamAcquire gave, false if the stream's own copy was overwritten while in use */
+static inline bool streamRelease( struct Stream *stream )
+{
+    return ( stream->release ) ? stream->release( stream ) : true;
+}
+
 struct Stream *streamCreateSocket( const char *server, int port );
 struct Stream *streamCreateFile( const char *file );
+struct Stream *streamCreateMappedFile( const char *file );
+struct Stream *streamCreateMappedFileAt( const char *file, uint64_t ofs );
+
+/* Capture compressed into an archive (see captureArchive.h), starting ofs into the capture. The mapped */
+/* file streams above notice an archive and hand it to this themselves.                               */
+bool streamIsArchive( const char *file );
+struct Stream *streamCreateArchiveAt( const char *file, uint64_t ofs );
+
+/* Socket to an orbuculum, asking it to compress what it sends (falling back to plain if it won't) */
+struct Stream *streamCreateCompressedSocket( const char *server, int port );
+
+/* Shared memory that orbuculum publishes its OFLOW output into, for clients on the same host */
+#define ORBUCULUM_SHM_NAME "/orbuculum.oflow"
+
+struct Stream *streamCreateShm( const char *name );
+
+/* Multicast group that orbuculum publishes its OFLOW output to, given as [group][:port] (see mcast.h) */
+struct Stream *streamCreateMulticast( const char *spec );
+
+/* Logic analyser capture of the SWO pin, as just the samples one after another, decoded into the bytes */
+/* that were sent on it. The bit time is found from the samples if it isn't given.                     */
+enum SWOSampleEncoding { SWO_SAMPLES_NRZ, SWO_SAMPLES_MANCHESTER };
+
+struct SWOSampleConfig
+{
+    unsigned int channel;              /* Bit of each sample the pin is on */
+    unsigned int unitSize;             /* Bytes in each sample */
+    enum SWOSampleEncoding encoding;
+    double samplesPerBit;              /* ...or 0 to find it */
+};
+
+struct Stream *streamCreateSWOSamples( const char *file, const struct SWOSampleConfig *c );
+
+/* Receives from inner on a thread of its own into bufs buffers of bufLen, so the source is drained even */
+/* while whoever reads from this is busy. It owns inner from then on, and passes NULL straight through.  */
+#define STREAM_READER_BUFS (8)
+struct Stream *streamCreateReader( struct Stream *inner, unsigned int bufs, size_t bufLen );
 
 #ifdef __cplusplus
 }
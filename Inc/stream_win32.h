@@ -10,15 +10,35 @@
 extern "C" {
 #endif
 
+#define WIN32_STREAM_READS    (4)            /* Reads kept in flight at once */
+#define WIN32_STREAM_READ_LEN (64*1024)      /* ...and how much each one asks for */
+
+struct Win32Read
+{
+    OVERLAPPED o;
+    uint8_t *d;
+    DWORD len;                               /* How much came back */
+    bool done;                               /* Set once it's finished, len and result are good from then */
+    enum ReceiveResult result;
+};
+
 struct Win32Stream
 {
     struct Stream base;
     HANDLE source;
-    HANDLE readDoneEvent;
-    uint64_t readOffset;
+    uint64_t readOffset;                     /* Where the next read starts, for things with an offset */
+    bool seekable;                           /* ...which is only files on a disk */
+
+    struct Win32Read r[WIN32_STREAM_READS];
+    unsigned int wp;                         /* Next read to be issued */
+    unsigned int rp;                         /* ...and to be handed out, wp-rp of them are in flight */
+    size_t ofs;                              /* How far into the one at rp has been used */
+    size_t lent;                             /* ...and how much more was lent out by the last acquire */
+    bool stalled;                            /* End or error seen, nothing more goes out until it's reported */
 };
 
 bool streamWin32Initialize( struct Win32Stream *stream, HANDLE sourceHandle );
+void streamWin32Stop( struct Win32Stream *stream );
 void streamWin32Close( struct Win32Stream *stream );
 
 #ifdef __cplusplus
@@ -25,6 +25,7 @@ extern "C" {
 #define NO_FILE           0xffffffff        /* No file defined */
 #define NO_FUNCTION       0xffffffff        /* No function defined */
 #define NO_DESTADDRESS    0xffffffe0        /* No address defined */
+#define SYMBOLS_MAX_ELF   16                /* Most elf files in one set, as SYMBOL_MAX_IMAGES in loadelf */
 
 #define SPECIALS_MASK     0xfffffff0
 #define FN_SLEEPING       (SPECIALS_MASK|0xb)         /* Marker for sleeping case */
@@ -52,6 +53,17 @@ struct assyLineEntry
     uint32_t jumpdest;                      /* If this is an absolute jump, the destination */
 };
 
+/* One instruction in the program, in address order, with its basic block precomputed for flow tracing */
+struct symbolInsn
+
+{
+    const struct assyLineEntry *assy;       /* The instruction itself */
+    uint32_t sourceIdx;                     /* Source line it belongs to */
+    uint32_t blockEnd;                      /* Index of the instruction which ends its basic block */
+};
+
+#define NO_INSN           0xffffffff        /* No instruction at this address */
+
 /* Full string name for a file */
 struct fileEntry
 
@@ -63,12 +75,22 @@ struct fileEntry
 struct functionEntry
 
 {
-    char *name;                             /* Name of function */
+    char *name;                             /* Name of function, NULL if it's to be demangled from... */
+    char *mangled;                          /* ...its linkage name, when it's first shown */
     uint32_t startAddr;                     /* Start address */
     uint32_t endAddr;                       /* End address */
     uint32_t fileEntryIdx;                  /* Link back to containing file */
 };
 
+/* Index from a name to its entry in the files or functions table */
+struct symbolName
+
+{
+    const char *name;                       /* Name, as held in the table */
+    uint32_t index;                         /* ...and where it is there */
+    UT_hash_handle hh;
+};
+
 /* Details for a source line */
 struct sourceLineEntry
 
@@ -91,8 +113,9 @@ struct SymbolSet
 {
     char *elfFile;                         /* File containing structure info */
     char *deleteMaterial;                  /* Material to strip off filenames */
-    char *odoptions;                       /* Any options to pass directly to objdump */
-    struct stat st;
+    char *odoptions;                       /* Options that used to be passed to objdump (retained, unused) */
+    struct stat st[SYMBOLS_MAX_ELF];       /* How each of the elf files was when the set was made from them */
+    unsigned int nimages;                  /* ...and how many there are */
 
     /* For memory saving and speedup... */
     bool recordSource;                     /* Keep a record of source code */
@@ -108,6 +131,21 @@ struct SymbolSet
     uint32_t functionCount;                /* Number of functions we have loaded */
     struct functionEntry *functions;       /* Table of functions */
     struct sourceLineEntry *sources;       /* Table of sources */
+    struct symbolName *fileIndex;          /* Files by name */
+    struct symbolName *functionIndex;      /* ...and functions, for those that were looked up by name */
+
+    /* For address lookup, one or other of these is populated */
+    uint32_t mapBase;                      /* Lowest address in the direct map */
+    uint32_t mapLen;                       /* Number of halfword entries in the direct map */
+    uint32_t *mapSource;                   /* Direct map from halfword to sources index */
+    uint16_t *mapAssy;                     /* ...and to assembly line within that source */
+    uint32_t eytCount;                     /* Number of entries in the Eytzinger search */
+    uint32_t *eytEnd;                      /* End addresses of sources, in Eytzinger order (1 based) */
+    uint32_t *eytSource;                   /* ...and the sources index for each */
+
+    /* For instruction by instruction flow tracing, when assembly is recorded */
+    uint32_t insnCount;                    /* Number of distinct instructions */
+    struct symbolInsn *insns;              /* ...and the instructions themselves, in address order */
 };
 
 /* An entry in the names table ... what we return to our caller */
@@ -129,9 +167,17 @@ enum symbolErr SymbolSetCreate( struct SymbolSet **ss, const char *filename, con
                                 bool demanglecpp, bool recordSource, bool recordAssy, const char *objdumpOptions );
 void SymbolSetDelete( struct SymbolSet **s );
 bool SymbolSetValid( struct SymbolSet **s, char *filename );
+bool SymbolSetChanged( struct SymbolSet *s, const char *filename );
+
+/* Loading a symbol set on a thread of its own, so whatever is using the old one can carry on meanwhile */
+struct SymbolReload;
+struct SymbolReload *SymbolReloadStart( const char *filename, const char *deleteMaterial,
+                                        bool demanglecpp, bool recordSource, bool recordAssy, const char *objdumpOptions );
+bool SymbolReloadPoll( struct SymbolReload **r, struct SymbolSet **ss, enum symbolErr *err );
 const char *SymbolFilename( struct SymbolSet *s, uint32_t index );
 const char *SymbolFunction( struct SymbolSet *s, uint32_t index );
 bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n );
+uint32_t SymbolInsnIndex( struct SymbolSet *s, uint32_t addr );
 // ====================================================================================================
 
 #ifdef __cplusplus
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Tagged Frame History
+ * ====================
+ *
+ * Keeps the most recent OFLOW frames sent for each tag, up to so much data or so much time, so a
+ * client that arrives late can be given some history straight away rather than waiting for more.
+ * Whoever is adding frames can mark the point where a decoder could start cleanly on a tag (an ITM
+ * or ETM sync, say) and replay then starts each tag at the oldest such point still held. A tag
+ * that has no mark held starts at its oldest frame. Time frames are replayed from where the
+ * earliest of the other tags starts, so there's always something to stamp them with.
+ *
+ * Only one thread should use a history.
+ *
+ */
+
+#ifndef _TAG_HISTORY_H_
+#define _TAG_HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "nw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct tagHistory;
+
+struct tagHistory *tagHistoryCreate( size_t maxBytes, uint32_t maxmS );               /* Hold up to maxBytes, and no more than maxmS old (0 for any age) */
+void tagHistoryAdd( struct tagHistory *t, uint8_t tag, const uint8_t *d, uint32_t len ); /* Complete frame(s) that were sent for tag */
+void tagHistoryMark( struct tagHistory *t, uint8_t tag );                            /* ...the next of which is somewhere to start from */
+size_t tagHistoryReplay( struct tagHistory *t, const struct nwSubscription *sub, uint8_t *o, size_t max ); /* Frames for sub, as many as fit */
+size_t tagHistoryLen( struct tagHistory *t );                                        /* Most that a replay could come to */
+size_t tagHistoryFootprint( struct tagHistory *t );                                  /* Memory it's holding, entries and all */
+void tagHistoryDelete( struct tagHistory *t );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
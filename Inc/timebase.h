@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Target Timebase
+ * ===============
+ *
+ * Target time, rebuilt from the ITM's own timestamps rather than from when things got to the host.
+ * Local timestamps give the core cycles from one to the next (divided by the prescaler set in
+ * ITM_TCR.TSPrescale), so added up they're cycle accurate but only relative, and any lost to an
+ * overflow are lost for good. Global timestamps give the absolute time, but arrive in two halves
+ * and only every so often. So the local ones are counted up and the global ones are a floor that
+ * the count is brought up to if it falls behind, which keeps it monotonic and puts it on the same
+ * clock as anything else stamped from the global timestamp.
+ *
+ * A GTS1 with only some of its bytes leaves the others as they were. One with wrap set means the
+ * high bits have changed too, so the timestamp isn't used until the GTS2 after it gives them.
+ *
+ */
+
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "msgDecoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+struct timebase
+{
+    uint32_t prescale;                             /* Local timestamp clock, as a divider of the core clock */
+    uint64_t coreHz;                               /* Core clock, 0 if it isn't known */
+    uint64_t gtsHz;                                /* Global timestamp clock, 0 if it counts core cycles */
+
+    uint64_t cycles;                               /* Core cycles, as the local timestamps add up */
+    uint64_t floor;                                /* ...which they can't be behind, from the global ones */
+    bool timed;                                    /* Any timestamp has been seen */
+    bool anchored;                                 /* A global timestamp has been used */
+
+    uint64_t gts;                                  /* Global timestamp, as it's put together */
+    bool gtsLow;                                   /* A full GTS1 has been seen */
+    bool gtsHigh;                                  /* ...and a GTS2 */
+    bool gtsWait;                                  /* Low bits have wrapped, so wait for the high ones */
+
+    int64_t drift;                                 /* Local count less global, at the last global timestamp */
+    uint64_t corrections;                          /* Times the local count was brought up to the global one */
+    uint64_t clockChanges;                         /* Global timestamp clock changes reported by the target */
+};
+
+// ====================================================================================================
+/* prescale of 0 is taken as 1. Without coreHz there are only cycles, not times */
+void timebaseInit( struct timebase *t, uint32_t prescale, uint64_t coreHz, uint64_t gtsHz );
+
+/* Feed the timestamps in as they're decoded. timebaseMsg takes any message, ignoring what isn't one */
+void timebaseLTS( struct timebase *t, uint32_t timeInc );
+void timebaseGTS( struct timebase *t, const struct GTSMsg *m );
+void timebaseMsg( struct timebase *t, const struct msg *m );
+
+/* Target time now, in core cycles or in nS (which is cycles if coreHz isn't known) */
+uint64_t timebaseCycles( struct timebase *t );
+uint64_t timebaseNs( struct timebase *t );
+bool timebaseTimed( struct timebase *t );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Tokenised Logging
+ * =================
+ *
+ * Rather than sending formatted text, the target sends just the address of its printf format
+ * string, followed by the raw arguments, on a software channel. The format is looked up in the
+ * target's ELF, parsed once, and the text is made on the host.
+ *
+ * Every record is a run of 32 bit writes to the channel. The first is the address of the format,
+ * then come the arguments, as the format asks for them. Each * width or precision takes a word,
+ * ints, chars, pointers and strings (the address of the string) take a word, and long longs and
+ * doubles (floats are sent as doubles, as printf would have them) take two, low word first. A
+ * write that isn't 32 bits wide can't be part of a record, so it starts things over.
+ *
+ */
+
+#ifndef _TOKEN_LOG_H_
+#define _TOKEN_LOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define TOKENLOG_MAX_OUTPUT (512)            /* Longest text that comes out of a single record */
+
+struct tokenLog;
+
+struct tokenLogStats
+{
+    uint64_t records;                        /* Records turned into text */
+    uint64_t unknown;                        /* Words that should have been a format, but weren't */
+    uint64_t restarts;                       /* Records cut short by a write that wasn't a word */
+    uint32_t formats;                        /* Different formats seen */
+};
+
+struct tokenLog *tokenLogCreate( void );
+bool tokenLogLoadElf( struct tokenLog *t, const char *filename );                  /* Formats are looked for in its loaded sections */
+bool tokenLogAddImage( struct tokenLog *t, uint32_t addr, const void *d, size_t len ); /* ...or in this copy of target memory */
+struct tokenLog *tokenLogFromOption( const char *opt, unsigned int *chan, unsigned int numChans ); /* From <channel>,<elf file> */
+
+/* Take the next write to the channel. Once a record is complete its text is put in o (max long, */
+/* and always terminated) and its length returned, otherwise it's 0.                              */
+size_t tokenLogPump( struct tokenLog *t, uint32_t w, int len, char *o, size_t max );
+void tokenLogReset( struct tokenLog *t );                                          /* Forget any part record */
+const struct tokenLogStats *tokenLogGetStats( struct tokenLog *t );
+void tokenLogDelete( struct tokenLog *t );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
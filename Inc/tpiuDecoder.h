@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include "statsRegistry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,19 +42,19 @@ enum TPIUPumpState
 struct TPIUCommsStats
 
 {
-    uint16_t pendingCount;                   /* Number of frames pending at the start of this stat report */
-    uint8_t leds;                            /* LED status bitfield */
-    uint16_t lostFrames;                     /* Number of frames lost to overflow */
-    uint32_t totalFrames;                    /* Total frames received */
+    orbStat pendingCount;                    /* Number of frames pending at the start of this stat report */
+    orbStat leds;                            /* LED status bitfield */
+    orbStat lostFrames;                      /* Number of frames lost to overflow */
+    orbStat totalFrames;                     /* Total frames received */
 };
 
 struct TPIUDecoderStats
 {
-    uint32_t lostSync;                     /* Number of times sync has been lost */
-    uint32_t syncCount;                    /* Number of times a sync event has been received */
-    uint32_t halfSyncCount;                /* Number of times a half sync event has been received */
-    uint32_t packets;                      /* Number of packets received */
-    uint32_t error;                        /* Number of times an error has been received */
+    orbStat lostSync;                      /* Number of times sync has been lost */
+    orbStat syncCount;                     /* Number of times a sync event has been received */
+    orbStat halfSyncCount;                 /* Number of times a half sync event has been received */
+    orbStat packets;                       /* Number of packets received */
+    orbStat error;                         /* Number of times an error has been received */
 };
 
 struct TPIUDecoder
@@ -81,17 +82,34 @@ struct TPIUPacket
     } packet[TPIU_PACKET_LEN];
 };
 
+/* A run of bytes, all for the same stream, from the block decoder */
+struct TPIUSpan
+{
+    uint8_t stream;                        /* Stream to which these bytes relate */
+    uint16_t len;                          /* Number of bytes */
+    const uint8_t *d;                      /* ...the bytes themselves */
+};
+
+/* Most decoded bytes delivered in a single span callback */
+#define TPIU_SPAN_BUFLEN (1024)
+
+typedef void ( *TPIUSpansCB )( enum TPIUPumpEvent e, const struct TPIUSpan *s, int nspans, void *param );
+
 // ====================================================================================================
 void TPIUDecoderForceSync( struct TPIUDecoder *t, uint8_t offset );
+void TPIUDecoderUnsync( struct TPIUDecoder *t );
 void TPIUDecoderZeroStats( struct TPIUDecoder *t );
 bool TPIUDecoderSynced( struct TPIUDecoder *t );
 struct TPIUDecoderStats *TPIUDecoderGetStats( struct TPIUDecoder *t );
 struct TPIUCommsStats *TPIUGetCommsStats( struct TPIUDecoder *t );
+void TPIUDecoderRegisterStats( struct TPIUDecoder *t, struct statsRegistry *r, const char *prefix, const char *labels );
 
 void TPIUPump( struct TPIUDecoder *t, uint8_t *frame, int len,
                void ( *packetRxed )( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param ),
                void *param );
 
+void TPIUPumpSpans( struct TPIUDecoder *t, const uint8_t *frame, int len, TPIUSpansCB spansRxed, void *param );
+
 struct TPIUDecoder *TPIUDecoderCreate( void );
 void TPIUDecoderInit( struct TPIUDecoder *t );
 // ====================================================================================================
@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "generics.h"
+#include "statsRegistry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -95,8 +96,8 @@ enum Reason { TRACE_REASON_PERIODIC, TRACE_REASON_TRACEON, TRACE_REASON_TRACEOVF
 /* TRACE Decoder statistics */
 struct TRACEDecoderStats
 {
-    uint32_t lostSyncCount;              /* Number of times sync has been lost */
-    uint32_t syncCount;                  /* Number of times a sync event has been received */
+    orbStat lostSyncCount;               /* Number of times sync has been lost */
+    orbStat syncCount;                   /* Number of times a sync event has been received */
 };
 
 struct TRACECPUState
@@ -145,6 +146,80 @@ struct TRACECPUState
     genericsReportCB report;
 };
 
+// ============================================================================
+// Batched events out of the decoder
+// ============================================================================
+
+/* Snapshot of what changed, and the state that goes with it, each time the decoder */
+/* has something to report. These are collected into an array across a whole pump. */
+struct TRACEEvent
+{
+    uint32_t changes;                    /* Changes since the previous event, as a changeRecord */
+    symbolMemaddr addr;                  /* Latest fully computed address */
+    symbolMemaddr toAddr;                /* Address to run to in linear mode (MTB) */
+    uint32_t disposition;                /* What happened to condition codes for each instruction? */
+    uint8_t eatoms;                      /* Number of E (executed) atoms in this step */
+    uint8_t natoms;                      /* Number of N (non-executed) atoms in this step */
+    uint16_t exception;                  /* Exception type being executed */
+    uint64_t instCount;                  /* Number of instructions executed */
+    uint64_t ts;                         /* Latest timestamp */
+    uint64_t cycleCount;                 /* Cycle Count for exact mode */
+    uint32_t contextID;                  /* Currently executing context */
+};
+
+// ============================================================================
+// Checkpoints of the decoder
+// ============================================================================
+/* A checkpoint is the whole of a decoder's state as a flat, pointer free run of    */
+/* little endian values. It can be kept (alongside a capture, say) and a decoder of */
+/* the same protocol restored from it later, or in another process, to carry on     */
+/* decoding from the point in the stream where it was taken.                       */
+#define TRACE_CKPT_VERSION (1)
+#define TRACE_CKPT_MAX_LEN (256)           /* Longest checkpoint any of the engines makes */
+
+/* Cursor for writing or reading a checkpoint. Running off the end sets bad, but ofs */
+/* still moves on, so after writing it says how long the checkpoint needs to be.    */
+struct TRACECkpt
+{
+    uint8_t *d;
+    size_t len;
+    size_t ofs;
+    bool bad;
+};
+
+static inline void TRACECkptPut( struct TRACECkpt *k, uint64_t v, int bytes )
+{
+    for ( int b = 0; b < bytes; b++, v >>= 8, k->ofs++ )
+    {
+        if ( k->ofs < k->len )
+        {
+            k->d[k->ofs] = ( uint8_t )v;
+        }
+        else
+        {
+            k->bad = true;
+        }
+    }
+}
+static inline uint64_t TRACECkptGet( struct TRACECkpt *k, int bytes )
+{
+    uint64_t v = 0;
+
+    for ( int b = 0; b < bytes; b++, k->ofs++ )
+    {
+        if ( k->ofs < k->len )
+        {
+            v |= ( uint64_t )k->d[k->ofs] << ( 8 * b );
+        }
+        else
+        {
+            k->bad = true;
+        }
+    }
+
+    return v;
+}
+
 // ============================================================================
 // The TRACE decoder state
 // ============================================================================
@@ -157,11 +232,17 @@ struct TRACEDecoderEngine
 {
     bool ( *action )        ( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint8_t c  );
     bool ( *actionPair )    ( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint32_t source, uint32_t dest );
+    /* Optional: as action, but for a run of bytes up to the first one with something to report */
+    int ( *actionRun )      ( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, const uint8_t *buf, int len, bool *reported );
     void ( *destroy )       ( struct TRACEDecoderEngine *e );
     bool ( *synced )        ( struct TRACEDecoderEngine *e );
     void ( *forceSync )     ( struct TRACEDecoderEngine *e, bool isSynced );
+    int ( *findSync )       ( struct TRACEDecoderEngine *e, const uint8_t *buf, int len, int from );
     const char ( *name )    ( void );
 
+    /* Optional: write the engine's internal state into a checkpoint, and read it back */
+    void ( *snapshot )      ( struct TRACEDecoderEngine *e, struct TRACECkpt *k );
+    void ( *restore )       ( struct TRACEDecoderEngine *e, struct TRACECkpt *k );
     /* Config specific to ETM3.5 */
     void ( *altAddrEncode ) ( struct TRACEDecoderEngine *e, bool using );
 };
@@ -181,10 +262,12 @@ struct TRACEDecoder
 // ====================================================================================================
 
 void TRACEDecoderForceSync( struct TRACEDecoder *i, bool isSynced );
+int TRACEDecoderFindSync( struct TRACEDecoder *i, const uint8_t *buf, int len, int from );
 bool TRACEDecoderIsSynced( struct TRACEDecoder *i );
 
 void TRACEDecoderZeroStats( struct TRACEDecoder *i );
 struct TRACEDecoderStats *TRACEDecoderGetStats( struct TRACEDecoder *i );
+void TRACEDecoderRegisterStats( struct TRACEDecoder *i, struct statsRegistry *r, const char *prefix, const char *labels );
 
 struct TRACECPUState *TRACECPUState( struct TRACEDecoder *i );
 bool TRACEStateChanged( struct TRACEDecoder *i, enum TRACEchanges c );
@@ -194,8 +277,15 @@ const char *TRACEExceptionName( int exceptionNumber );
 const char *TRACEDecodeGetProtocolName( enum TRACEprotocol protocol );
 
 void TRACEDecoderPump( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecodeCB cb, void *d );
+int TRACEDecoderPumpEvents( struct TRACEDecoder *i, const uint8_t *buf, int len, struct TRACEEvent *ev, int maxEvents, int *consumed );
 
 void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool usingAltAddrEncodeSet, genericsReportCB report );
+
+/* Checkpoints */
+void TRACECPUStateSave( const struct TRACECPUState *cpu, struct TRACECkpt *k );
+void TRACECPUStateLoad( struct TRACECPUState *cpu, struct TRACECkpt *k );
+size_t TRACEDecoderSnapshot( struct TRACEDecoder *i, uint8_t *d, size_t len );
+bool TRACEDecoderRestore( struct TRACEDecoder *i, const uint8_t *d, size_t len );
 // ====================================================================================================
 #ifdef __cplusplus
 }
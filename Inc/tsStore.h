@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Time Series Store
+ * =================
+ *
+ * Keeps counts by name (orbtop's samples per function) over long runs, at three resolutions: seconds
+ * for the last hour, minutes for the last day and hours for the last month. Each resolution is a ring
+ * file in the store's directory, laid out in full the first time it's made, so however long the store
+ * is written it never takes any more disk than that. Names are numbered in a names file alongside them.
+ *
+ * What's added goes into the slot for the current second, minute and hour all at once, so the coarser
+ * resolutions are rolled up from everything that went into the finer ones, not just what was kept of it.
+ * A slot holds the TSSTORE_SLOT_ENTRIES busiest names in its time, with the rest counted as other. All
+ * three slots are written at each commit, so the store is always current (and a writer that stops and
+ * starts again carries on with the slots it left). Reading any window back is a few reads of fixed size
+ * slots.
+ *
+ * The files are in the byte order of the machine that made them.
+ *
+ */
+
+#ifndef _TSSTORE_H_
+#define _TSSTORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+#define TSSTORE_SLOT_ENTRIES (64)                   /* Names kept in each slot, the rest are other */
+
+enum tsLevel { TS_SECONDS, TS_MINUTES, TS_HOURS, TS_NUM_LEVELS, TS_AUTO = TS_NUM_LEVELS };
+
+struct tsStore;
+
+/* Called for each count in a query, name is NULL for other */
+typedef void ( *tsStoreCb )( int64_t start, uint32_t seconds, const char *name, uint64_t count, void *param );
+
+struct tsStore *tsStoreOpen( const char *dir, bool writing );
+void tsStoreClose( struct tsStore *t );
+
+void tsStoreAdd( struct tsStore *t, const char *name, uint64_t count );      /* Count towards the next commit */
+bool tsStoreCommit( struct tsStore *t, int64_t when );                       /* ...which is at when, in unix seconds */
+
+/* Everything from from up to to, at the level asked for. TS_AUTO picks the finest one still holding from. */
+/* The level that was used is returned, or -1 if the store couldn't be read.                                */
+int tsStoreQuery( struct tsStore *t, int64_t from, int64_t to, enum tsLevel level, tsStoreCb cb, void *param );
+
+uint32_t tsStoreResolution( enum tsLevel level );                            /* Seconds in each slot of a level */
+uint32_t tsStoreRetention( enum tsLevel level );                             /* ...and how far back it goes */
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Address Filters
+ * ===============
+ *
+ * Anything that starts with a digit is taken to be a range, everything else is a function name.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "generics.h"
+#include "addrFilter.h"
+
+#define RANGES_INITIAL (16)
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _parseRange( const char *s, uint32_t *lo, uint32_t *hi )
+
+{
+    unsigned long a, b;
+    char *e;
+
+    a = strtoul( s, &e, 0 );
+
+    if ( ( e == s ) || ( ( *e != '-' ) && ( *e != '+' ) ) )
+    {
+        return false;
+    }
+
+    s = e + 1;
+    b = strtoul( s, &e, 0 );
+
+    if ( ( e == s ) || ( *e ) )
+    {
+        return false;
+    }
+
+    *lo = a;
+    *hi = ( s[-1] == '+' ) ? a + b - 1 : b;
+    return ( ( s[-1] != '+' ) || ( b ) ) && ( *hi >= *lo );
+}
+// ====================================================================================================
+static int _compareRanges( const void *a, const void *b )
+
+{
+    const struct addrRange *ra = ( const struct addrRange * )a;
+    const struct addrRange *rb = ( const struct addrRange * )b;
+
+    return ( ra->lo > rb->lo ) - ( ra->lo < rb->lo );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool addrFilterAdd( struct addrFilter *f, const char *spec )
+
+{
+    uint32_t lo, hi;
+
+    if ( ( isdigit( ( unsigned char )*spec ) ) && ( !_parseRange( spec, &lo, &hi ) ) )
+    {
+        return false;
+    }
+
+    f->spec = ( char ** )realloc( f->spec, ( f->nspec + 1 ) * sizeof( char * ) );
+    MEMCHECK( f->spec, false );
+    f->spec[f->nspec] = strdup( spec );
+    MEMCHECK( f->spec[f->nspec], false );
+    f->nspec++;
+    return true;
+}
+// ====================================================================================================
+void addrFilterAddRange( struct addrFilter *f, uint32_t lo, uint32_t hi )
+
+{
+    if ( f->nrange == f->alloc )
+    {
+        f->alloc = ( f->alloc ) ? f->alloc * 2 : RANGES_INITIAL;
+        f->range = ( struct addrRange * )realloc( f->range, f->alloc * sizeof( struct addrRange ) );
+        MEMCHECKV( f->range );
+    }
+
+    f->range[f->nrange].lo = lo;
+    f->range[f->nrange].hi = hi;
+    f->nrange++;
+}
+// ====================================================================================================
+bool addrFilterResolve( struct addrFilter *f, addrFilterLookup lookup, void *ctx )
+
+/* Turn what was given into ranges, for the symbols that lookup finds names in */
+
+{
+    uint32_t lo, hi;
+    unsigned int n = 0;
+    bool ok = true;
+
+    f->nrange = f->last = 0;
+
+    for ( unsigned int i = 0; i < f->nspec; i++ )
+    {
+        if ( _parseRange( f->spec[i], &lo, &hi ) )
+        {
+            addrFilterAddRange( f, lo, hi );
+        }
+        else if ( ( !lookup ) || ( !lookup( f, f->spec[i], ctx ) ) )
+        {
+            genericsReport( V_ERROR, "No function %s to filter on" EOL, f->spec[i] );
+            ok = false;
+        }
+    }
+
+    /* Sorted, with any that touch or overlap made into one, so an address is in one range at most */
+    qsort( f->range, f->nrange, sizeof( struct addrRange ), _compareRanges );
+
+    for ( unsigned int i = 0; i < f->nrange; i++ )
+    {
+        if ( ( n ) && ( ( uint64_t )f->range[n - 1].hi + 1 >= f->range[i].lo ) )
+        {
+            f->range[n - 1].hi = ( f->range[i].hi > f->range[n - 1].hi ) ? f->range[i].hi : f->range[n - 1].hi;
+        }
+        else
+        {
+            f->range[n++] = f->range[i];
+        }
+    }
+
+    f->nrange = n;
+    return ok;
+}
+// ====================================================================================================
+bool addrFilterHas( struct addrFilter *f, uint32_t addr )
+
+/* Is addr of interest? Most of the time it's in the same range as the last one was */
+
+{
+    unsigned int lo = 0, hi = f->nrange;
+
+    if ( !f->nspec )
+    {
+        return true;
+    }
+
+    if ( ( f->last < f->nrange ) && ( addr >= f->range[f->last].lo ) && ( addr <= f->range[f->last].hi ) )
+    {
+        return true;
+    }
+
+    while ( lo < hi )
+    {
+        unsigned int m = ( lo + hi ) / 2;
+
+        if ( addr < f->range[m].lo )
+        {
+            hi = m;
+        }
+        else if ( addr > f->range[m].hi )
+        {
+            lo = m + 1;
+        }
+        else
+        {
+            f->last = m;
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+void addrFilterFree( struct addrFilter *f )
+
+{
+    for ( unsigned int i = 0; i < f->nspec; i++ )
+    {
+        free( f->spec[i] );
+    }
+
+    free( f->spec );
+    free( f->range );
+    memset( f, 0, sizeof( struct addrFilter ) );
+}
+// ====================================================================================================
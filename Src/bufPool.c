@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Buffer Pool
+ * ===========
+ *
+ * Each buffer has a small record of how it was got just in front of it, in the space that's left
+ * over from aligning it, so bufPoolFree knows how to give it back. Huge page buffers come straight
+ * from mmap, everything else from the aligned heap.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#if defined( WIN32 )
+    #include <malloc.h>
+#else
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include "generics.h"
+#include "bufPool.h"
+
+#define HUGE_PAGE_SIZE (2*1024*1024)               /* Default huge page size on x86_64 and aarch64 */
+
+enum backing { BACKING_HEAP, BACKING_HUGETLB, BACKING_THP };
+
+/* What's just in front of each buffer */
+struct bufHdr
+{
+    void *base;                                    /* Start of what was actually allocated */
+    size_t len;                                    /* ...and how long it was */
+    enum backing backing;
+};
+
+#define HDR(p) ( ( struct bufHdr * )( ( uint8_t * )( p ) - sizeof( struct bufHdr ) ) )
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static size_t _pageSize( void )
+
+{
+#if defined( WIN32 )
+    return 4096;
+#else
+    return ( size_t )sysconf( _SC_PAGESIZE );
+#endif
+}
+// ====================================================================================================
+static void *_place( void *base, size_t len, size_t align, enum backing backing )
+
+/* The buffer goes align bytes into what was allocated, with its header just before it */
+
+{
+    void *p = ( uint8_t * )base + align;
+
+    HDR( p )->base = base;
+    HDR( p )->len = len;
+    HDR( p )->backing = backing;
+    return p;
+}
+// ====================================================================================================
+static void *_allocHuge( size_t len, size_t align )
+
+/* Try for huge pages set aside for the purpose, then for transparent ones, returning NULL if neither */
+
+{
+#if defined( LINUX )
+    size_t mapLen = ( align + len + HUGE_PAGE_SIZE - 1 ) & ~( size_t )( HUGE_PAGE_SIZE - 1 );
+    void *m;
+
+#if defined( MAP_HUGETLB )
+    m = mmap( NULL, mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+
+    if ( m != MAP_FAILED )
+    {
+        return _place( m, mapLen, align, BACKING_HUGETLB );
+    }
+
+#endif
+#if defined( MADV_HUGEPAGE )
+    m = mmap( NULL, mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if ( m != MAP_FAILED )
+    {
+        if ( !madvise( m, mapLen, MADV_HUGEPAGE ) )
+        {
+            return _place( m, mapLen, align, BACKING_THP );
+        }
+
+        munmap( m, mapLen );
+    }
+
+#endif
+#endif
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void *bufPoolAlloc( size_t len, uint32_t flags )
+
+{
+    size_t align = ( flags & BUFPOOL_PAGE_ALIGN ) ? _pageSize() : BUFPOOL_CACHE_LINE;
+    void *base, *p;
+
+    /* Anything less than a huge page would just waste most of one */
+    if ( ( flags & BUFPOOL_HUGE ) && ( len >= HUGE_PAGE_SIZE ) && ( ( p = _allocHuge( len, align ) ) ) )
+    {
+        genericsReport( V_DEBUG, "%zu KBytes of buffers in %s" EOL, len / 1024, bufPoolBacking( p ) );
+        return p;
+    }
+
+#if defined( WIN32 )
+
+    if ( !( base = _aligned_malloc( align + len, align ) ) )
+    {
+        return NULL;
+    }
+
+#else
+
+    if ( posix_memalign( &base, align, align + len ) )
+    {
+        return NULL;
+    }
+
+#endif
+
+    p = _place( base, align + len, align, BACKING_HEAP );
+    memset( p, 0, len );
+    return p;
+}
+// ====================================================================================================
+void bufPoolFree( void *p )
+
+{
+    if ( !p )
+    {
+        return;
+    }
+
+    switch ( HDR( p )->backing )
+    {
+#if !defined( WIN32 )
+
+        case BACKING_HUGETLB:
+        case BACKING_THP:
+            munmap( HDR( p )->base, HDR( p )->len );
+            break;
+#endif
+
+        default:
+#if defined( WIN32 )
+            _aligned_free( HDR( p )->base );
+#else
+            free( HDR( p )->base );
+#endif
+            break;
+    }
+}
+// ====================================================================================================
+const char *bufPoolBacking( const void *p )
+
+{
+    switch ( HDR( p )->backing )
+    {
+        case BACKING_HUGETLB:
+            return "huge pages";
+
+        case BACKING_THP:
+            return "transparent huge pages";
+
+        default:
+            return "normal pages";
+    }
+}
+// ====================================================================================================
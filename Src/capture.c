@@ -0,0 +1,645 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Raw Capture File Writer
+ * =======================
+ *
+ * Every file gets the header (if one has been set) followed by whole writes...a write is never
+ * split across two files. Disk space is reserved a chunk at a time ahead of the data (all at once
+ * when rotating by size) without changing the file size, and the unused tail is given back when
+ * the file is closed. Completed data is handed to the disk a chunk at a time, and once a chunk is
+ * known to be on the disk it's dropped from the page cache.
+ *
+ * If indexing is on then each file in a regular filesystem gets an index alongside it, with an entry
+ * at the first sync point after each interval.
+ *
+ * A file can be written as an archive instead (see captureArchive.h), in which case what's written
+ * is gathered up into blocks and each one is compressed before it goes to the file. Sizes and
+ * offsets for the index and for rotation are of the capture, not of the file it's compressed into.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined( WIN32 )
+    #include <sys/uio.h>
+#endif
+
+#include <zlib.h>
+
+#include "generics.h"
+#include "capture.h"
+#include "captureIndex.h"
+#include "captureArchive.h"
+
+#define PREALLOC_CHUNK      (64*1024*1024)         /* Space reserved each time, when not rotating by size */
+#define WRITEBACK_CHUNK     (8*1024*1024)          /* How often data is pushed to disk and dropped from cache */
+#define MAX_GATHER          (64)                   /* Most segments passed to a single write */
+
+struct captureFile
+{
+    char *name;                                    /* Base name of the file(s) */
+    char *fname;                                   /* Name of the current file */
+    uint64_t rotateBytes;                          /* Size to start a new file at, or 0 */
+    uint32_t rotateSecs;                           /* Age to start a new file at, or 0 */
+    uint32_t seq;                                  /* Sequence number of the current file */
+    uint32_t openedmS;                             /* When the current file was opened */
+
+    int fd;                                        /* Current file, or -1 */
+    uint64_t written;                              /* Bytes of capture written to current file */
+    uint64_t stored;                               /* ...and how big the file is, fewer if it's an archive */
+    uint64_t allocated;                            /* Bytes of disk reserved for it */
+    uint64_t flushed;                              /* Bytes that writeback has been started for */
+    uint64_t dropped;                              /* Bytes that are on disk and out of the cache */
+    bool noPrealloc;                               /* The filesystem can't reserve space */
+    bool rotateDue;                                /* Start the next file at the next write */
+
+    uint8_t *hdr;                                  /* Header to start each file with */
+    size_t hdrLen;                                 /* ...and its length */
+
+    struct captureIndex *idx;                      /* Index for current file, if there is one */
+    uint32_t indexmS;                              /* Interval between index entries, 0 if not indexing */
+    int syncChar;                                  /* Byte that ends a frame, or -1 if any write starts one */
+    uint32_t lastIndexmS;                          /* When the last entry was made */
+    bool indexDue;                                 /* An entry is to be made at the next sync point */
+
+    int archiveLevel;                              /* zlib level files are compressed at, 0 if they're not archives */
+    uint8_t *blk;                                  /* Capture gathered for the next block */
+    size_t blkLen;                                 /* ...how much of it there is */
+    uint64_t blkOfs;                               /* ...where it goes in the capture */
+    uint64_t blkuS;                                /* ...and when it started arriving */
+    uint8_t *packed;                               /* The block once it's been compressed, with its header */
+    size_t packedMax;                              /* ...and the most that can be */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _rotating( struct captureFile *c )
+
+{
+    return ( c->rotateBytes ) || ( c->rotateSecs );
+}
+// ====================================================================================================
+static void _reserve( struct captureFile *c, uint64_t upto )
+
+/* Reserve disk space up to upto, without changing the size of the file */
+
+{
+#if defined( LINUX )
+
+    if ( ( c->noPrealloc ) || ( upto <= c->allocated ) )
+    {
+        return;
+    }
+
+    if ( fallocate( c->fd, FALLOC_FL_KEEP_SIZE, c->allocated, upto - c->allocated ) < 0 )
+    {
+        genericsReport( V_INFO, "Cannot preallocate space for %s (%s), continuing without" EOL, c->fname, strerror( errno ) );
+        c->noPrealloc = true;
+        return;
+    }
+
+    c->allocated = upto;
+#else
+    ( void )c;
+    ( void )upto;
+#endif
+}
+// ====================================================================================================
+static void _writeback( struct captureFile *c, bool all )
+
+/* Start writeback of what's been written since last time, and drop the chunk before that from the */
+/* cache once it's safely on disk. If all is set then everything goes, whatever its size.          */
+
+{
+#if defined( LINUX )
+
+    if ( ( !all ) && ( c->stored - c->flushed < WRITEBACK_CHUNK ) )
+    {
+        return;
+    }
+
+    sync_file_range( c->fd, c->flushed, c->stored - c->flushed, SYNC_FILE_RANGE_WRITE );
+
+    if ( all )
+    {
+        c->flushed = c->stored;
+    }
+
+    if ( c->flushed > c->dropped )
+    {
+        sync_file_range( c->fd, c->dropped, c->flushed - c->dropped,
+                         SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+        posix_fadvise( c->fd, c->dropped, c->flushed - c->dropped, POSIX_FADV_DONTNEED );
+        c->dropped = c->flushed;
+    }
+
+    c->flushed = c->stored;
+#else
+    ( void )c;
+    ( void )all;
+#endif
+}
+// ====================================================================================================
+static bool _store( struct captureFile *c, const struct captureSeg *s, int nsegs )
+
+/* Write all the segments to the current file, carrying on after any short writes */
+
+{
+    size_t total = 0;
+
+    for ( int i = 0; i < nsegs; i++ )
+    {
+        total += s[i].len;
+    }
+
+    /* Keep the reservation ahead of the data. An archive won't get anywhere near the rotation size */
+    if ( c->stored + total > c->allocated )
+    {
+        _reserve( c, ( ( c->rotateBytes ) && ( !c->archiveLevel ) ) ? c->rotateBytes : c->stored + total + PREALLOC_CHUNK );
+    }
+
+#if defined( WIN32 )
+
+    for ( int i = 0; i < nsegs; i++ )
+    {
+        const uint8_t *p = ( const uint8_t * )s[i].d;
+
+        for ( size_t l = s[i].len; l; )
+        {
+            int w = write( c->fd, p, l );
+
+            if ( w <= 0 )
+            {
+                return false;
+            }
+
+            p += w;
+            l -= w;
+        }
+    }
+
+#else
+
+    while ( nsegs )
+    {
+        struct iovec iov[MAX_GATHER];
+        int n = ( nsegs < MAX_GATHER ) ? nsegs : MAX_GATHER;
+        int iovcnt = n;
+        struct iovec *v = iov;
+
+        for ( int i = 0; i < n; i++ )
+        {
+            iov[i].iov_base = ( void * )s[i].d;
+            iov[i].iov_len  = s[i].len;
+        }
+
+        while ( iovcnt )
+        {
+            ssize_t w = writev( c->fd, v, iovcnt );
+
+            if ( w < 0 )
+            {
+                return false;
+            }
+
+            while ( ( iovcnt ) && ( ( size_t )w >= v->iov_len ) )
+            {
+                w -= v->iov_len;
+                v++;
+                iovcnt--;
+            }
+
+            if ( iovcnt )
+            {
+                v->iov_base = ( uint8_t * )v->iov_base + w;
+                v->iov_len -= w;
+            }
+        }
+
+        s += n;
+        nsegs -= n;
+    }
+
+#endif
+
+    c->stored += total;
+    _writeback( c, false );
+    return true;
+}
+// ====================================================================================================
+static void _putLE( uint8_t *d, uint64_t v, int len )
+
+{
+    for ( int i = 0; i < len; i++ )
+    {
+        d[i] = v >> ( 8 * i );
+    }
+}
+// ====================================================================================================
+static bool _archiveFlush( struct captureFile *c )
+
+/* Compress whatever has been gathered into a block of its own, and write it out */
+
+{
+    uLongf n = c->packedMax - CAPTURE_ARCHIVE_HDR_LEN;
+    struct captureSeg p = { .d = c->packed };
+
+    if ( !c->blkLen )
+    {
+        return true;
+    }
+
+    if ( compress2( &c->packed[CAPTURE_ARCHIVE_HDR_LEN], &n, c->blk, c->blkLen, c->archiveLevel ) != Z_OK )
+    {
+        genericsReport( V_ERROR, "Could not compress block for %s" EOL, c->fname );
+        return false;
+    }
+
+    _putLE( c->packed, n, 4 );
+    _putLE( &c->packed[4], c->blkLen, 4 );
+    _putLE( &c->packed[8], c->blkOfs, 8 );
+    _putLE( &c->packed[16], c->blkuS, 8 );
+    p.len = CAPTURE_ARCHIVE_HDR_LEN + n;
+    c->blkLen = 0;
+    return _store( c, &p, 1 );
+}
+// ====================================================================================================
+static bool _archiveAdd( struct captureFile *c, const struct captureSeg *s, int nsegs )
+
+/* Gather the segments into blocks, compressing and writing out each one as it fills */
+
+{
+    uint64_t ofs = c->written;
+
+    for ( int i = 0; i < nsegs; i++ )
+    {
+        const uint8_t *d = ( const uint8_t * )s[i].d;
+        size_t len = s[i].len;
+
+        while ( len )
+        {
+            size_t n = ( len < CAPTURE_ARCHIVE_BLOCK - c->blkLen ) ? len : CAPTURE_ARCHIVE_BLOCK - c->blkLen;
+
+            if ( !c->blkLen )
+            {
+                c->blkOfs = ofs;
+                c->blkuS  = genericsTimestampuS();
+            }
+
+            memcpy( &c->blk[c->blkLen], d, n );
+            c->blkLen += n;
+            ofs += n;
+            d += n;
+            len -= n;
+
+            if ( ( c->blkLen == CAPTURE_ARCHIVE_BLOCK ) && ( !_archiveFlush( c ) ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _put( struct captureFile *c, const struct captureSeg *s, int nsegs )
+
+/* Add the segments to the capture in the current file, which may be compressing them */
+
+{
+    bool ok = ( c->archiveLevel ) ? _archiveAdd( c, s, nsegs ) : _store( c, s, nsegs );
+
+    for ( int i = 0; i < nsegs; i++ )
+    {
+        c->written += s[i].len;
+    }
+
+    return ok;
+}
+// ====================================================================================================
+static bool _startFile( struct captureFile *c )
+
+/* Whatever goes at the start of every file, before any of the capture */
+
+{
+    struct captureSeg m = { .d = CAPTURE_ARCHIVE_MAGIC, .len = CAPTURE_ARCHIVE_MAGIC_LEN };
+    struct captureSeg h = { .d = c->hdr, .len = c->hdrLen };
+
+    if ( ( c->archiveLevel ) && ( !_store( c, &m, 1 ) ) )
+    {
+        return false;
+    }
+
+    return ( !c->hdrLen ) || ( _put( c, &h, 1 ) );
+}
+// ====================================================================================================
+static void _openIndex( struct captureFile *c )
+
+/* Start an index for the current file, as long as it's something that can be seeked in */
+
+{
+    struct stat st;
+
+    if ( ( !c->indexmS ) || ( c->idx ) || ( fstat( c->fd, &st ) < 0 ) || ( !S_ISREG( st.st_mode ) ) )
+    {
+        return;
+    }
+
+    c->idx = captureIndexCreate( c->fname );
+    c->indexDue = true;
+}
+// ====================================================================================================
+static void _index( struct captureFile *c, const struct captureSeg *s, int nsegs )
+
+/* Make an index entry, if one is due and there's a sync point in what's about to be written */
+
+{
+    uint64_t ofs = c->written;
+    uint32_t now = genericsTimestampmS();
+
+    if ( ( !c->idx ) || ( ( !c->indexDue ) && ( now - c->lastIndexmS < c->indexmS ) ) )
+    {
+        return;
+    }
+
+    c->indexDue = true;
+
+    if ( c->syncChar >= 0 )
+    {
+        const uint8_t *p = NULL;
+
+        for ( int i = 0; ( i < nsegs ) && ( !p ); i++ )
+        {
+            if ( !( p = ( const uint8_t * )memchr( s[i].d, c->syncChar, s[i].len ) ) )
+            {
+                ofs += s[i].len;
+            }
+            else
+            {
+                /* The next frame starts just after the end of this one */
+                ofs += p - ( const uint8_t * )s[i].d + 1;
+            }
+        }
+
+        if ( !p )
+        {
+            return;
+        }
+    }
+
+    if ( !captureIndexAdd( c->idx, genericsTimestampuS(), ofs ) )
+    {
+        genericsReport( V_WARN, "Could not write index for %s, no more entries will be made" EOL, c->fname );
+        captureIndexClose( c->idx );
+        c->idx = NULL;
+    }
+
+    c->lastIndexmS = now;
+    c->indexDue = false;
+}
+// ====================================================================================================
+static void _closeCurrent( struct captureFile *c )
+
+{
+    captureIndexClose( c->idx );
+    c->idx = NULL;
+
+    if ( c->fd < 0 )
+    {
+        return;
+    }
+
+    if ( !_archiveFlush( c ) )
+    {
+        genericsReport( V_WARN, "Could not write the end of %s" EOL, c->fname );
+    }
+
+    _writeback( c, true );
+#if defined( LINUX )
+
+    /* Give back whatever was reserved and not used */
+    if ( c->allocated > c->stored )
+    {
+        if ( ftruncate( c->fd, c->stored ) < 0 )
+        {
+            genericsReport( V_WARN, "Could not release unused space in %s (%s)" EOL, c->fname, strerror( errno ) );
+        }
+    }
+
+#endif
+    close( c->fd );
+    c->fd = -1;
+}
+// ====================================================================================================
+static bool _openNext( struct captureFile *c )
+
+/* Close any current file and start the next one in the series */
+
+{
+    _closeCurrent( c );
+    free( c->fname );
+
+    if ( _rotating( c ) )
+    {
+        int l = snprintf( NULL, 0, "%s.%04u", c->name, c->seq ) + 1;
+        c->fname = ( char * )malloc( l );
+        MEMCHECK( c->fname, false );
+        snprintf( c->fname, l, "%s.%04u", c->name, c->seq++ );
+    }
+    else
+    {
+        c->fname = strdup( c->name );
+        MEMCHECK( c->fname, false );
+    }
+
+    c->fd = open( c->fname, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH );
+
+    if ( c->fd < 0 )
+    {
+        genericsReport( V_ERROR, "Could not open output file %s for writing (%s)" EOL, c->fname, strerror( errno ) );
+        return false;
+    }
+
+    c->written = c->stored = c->allocated = c->flushed = c->dropped = 0;
+    c->openedmS = genericsTimestampmS();
+    genericsReport( V_INFO, "Writing %s output to %s" EOL, ( c->archiveLevel ) ? "archived" : "raw", c->fname );
+    _openIndex( c );
+
+    return _startFile( c );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct captureFile *captureOpen( const char *name, uint64_t rotateBytes, uint32_t rotateSecs )
+
+/* Create capture writer and open its first file */
+
+{
+    return captureOpenAt( name, rotateBytes, rotateSecs, 0 );
+}
+// ====================================================================================================
+struct captureFile *captureOpenAt( const char *name, uint64_t rotateBytes, uint32_t rotateSecs, unsigned int seq )
+
+/* Create capture writer with its series starting at seq, as when carrying on from where another left off */
+
+{
+    struct captureFile *c = ( struct captureFile * )calloc( 1, sizeof( struct captureFile ) );
+    MEMCHECK( c, NULL );
+
+    c->name = strdup( name );
+    MEMCHECK( c->name, NULL );
+    c->rotateBytes = rotateBytes;
+    c->rotateSecs  = rotateSecs;
+    c->seq = seq;
+    c->syncChar = -1;
+    c->fd = -1;
+
+    if ( !_openNext( c ) )
+    {
+        captureClose( c );
+        return NULL;
+    }
+
+    return c;
+}
+// ====================================================================================================
+bool captureSetHeader( struct captureFile *c, const void *d, size_t len )
+
+/* Set header for this and following files. It's written now if nothing has gone into this one yet */
+
+{
+    free( c->hdr );
+    c->hdr = ( uint8_t * )malloc( len );
+    MEMCHECK( c->hdr, false );
+    memcpy( c->hdr, d, len );
+    c->hdrLen = len;
+
+    if ( !c->written )
+    {
+        struct captureSeg h = { .d = c->hdr, .len = c->hdrLen };
+        return _put( c, &h, 1 );
+    }
+
+    return true;
+}
+// ====================================================================================================
+bool captureSetArchive( struct captureFile *c, int level )
+
+/* Compress this and following files at level. It can only be done before anything's gone in this one */
+
+{
+    if ( ( c->written ) || ( c->stored ) || ( c->archiveLevel ) )
+    {
+        genericsReport( V_ERROR, "Archiving must be set before anything is written to %s" EOL, c->fname );
+        return false;
+    }
+
+    c->packedMax = CAPTURE_ARCHIVE_HDR_LEN + compressBound( CAPTURE_ARCHIVE_BLOCK );
+    c->blk = ( uint8_t * )malloc( CAPTURE_ARCHIVE_BLOCK );
+    MEMCHECK( c->blk, false );
+    c->packed = ( uint8_t * )malloc( c->packedMax );
+    MEMCHECK( c->packed, false );
+    c->archiveLevel = ( level > 0 ) ? level : CAPTURE_ARCHIVE_LEVEL;
+
+    return _startFile( c );
+}
+// ====================================================================================================
+void captureSetIndex( struct captureFile *c, uint32_t intervalmS, int syncChar )
+
+/* Index this and following files every intervalmS, at frame boundaries if there's a syncChar */
+
+{
+    c->indexmS  = intervalmS;
+    c->syncChar = syncChar;
+    _openIndex( c );
+}
+// ====================================================================================================
+bool captureWrite( struct captureFile *c, const struct captureSeg *s, int nsegs )
+
+/* Write segments, moving on to the next file first if this one is full or old enough */
+
+{
+    size_t total = 0;
+
+    for ( int i = 0; i < nsegs; i++ )
+    {
+        total += s[i].len;
+    }
+
+    /* Don't start a new file if there's nothing but the header in this one */
+    if ( ( c->written > c->hdrLen ) && ( ( c->rotateDue ) ||
+            ( ( c->rotateBytes ) && ( c->written + total > c->rotateBytes ) ) ||
+              ( ( c->rotateSecs ) && ( genericsTimestampmS() - c->openedmS >= ( uint64_t )c->rotateSecs * 1000 ) ) ) )
+    {
+        c->rotateDue = false;
+
+        if ( !_openNext( c ) )
+        {
+            return false;
+        }
+    }
+
+    _index( c, s, nsegs );
+    return _put( c, s, nsegs );
+}
+// ====================================================================================================
+void captureSetRotation( struct captureFile *c, uint64_t rotateBytes, uint32_t rotateSecs )
+
+{
+    c->rotateBytes = rotateBytes;
+    c->rotateSecs  = rotateSecs;
+}
+// ====================================================================================================
+bool captureRotate( struct captureFile *c )
+
+/* Start the next file with the next write. A single file can't be, since it would be written over */
+
+{
+    if ( !_rotating( c ) )
+    {
+        return false;
+    }
+
+    c->rotateDue = true;
+    return true;
+}
+// ====================================================================================================
+unsigned int captureNextSeq( struct captureFile *c )
+
+{
+    return c->seq;
+}
+// ====================================================================================================
+void captureClose( struct captureFile *c )
+
+{
+    if ( !c )
+    {
+        return;
+    }
+
+    _closeCurrent( c );
+    free( c->fname );
+    free( c->name );
+    free( c->hdr );
+    free( c->blk );
+    free( c->packed );
+    free( c );
+}
+// ====================================================================================================
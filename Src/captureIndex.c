@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Capture File Index
+ * ==================
+ *
+ * Records are flushed as they're written so that a reader (or a capture that was killed) always
+ * sees whole records. A reader that finds a partial record at the end just ignores it.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "generics.h"
+#include "captureIndex.h"
+
+#define RECORD_LEN (16)
+
+struct captureIndex
+{
+    FILE *f;                                       /* Index file being written */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _put64( uint8_t *d, uint64_t v )
+
+{
+    for ( int i = 0; i < 8; i++ )
+    {
+        d[i] = v >> ( 8 * i );
+    }
+}
+// ====================================================================================================
+static uint64_t _get64( const uint8_t *d )
+
+{
+    uint64_t v = 0;
+
+    for ( int i = 7; i >= 0; i-- )
+    {
+        v = ( v << 8 ) | d[i];
+    }
+
+    return v;
+}
+// ====================================================================================================
+static char *_indexName( const char *file )
+
+{
+    char *n = ( char * )malloc( strlen( file ) + strlen( CAPTURE_INDEX_SUFFIX ) + 1 );
+    MEMCHECK( n, NULL );
+    strcpy( n, file );
+    strcat( n, CAPTURE_INDEX_SUFFIX );
+    return n;
+}
+// ====================================================================================================
+static bool _readEntry( FILE *f, struct captureIndexEntry *e )
+
+{
+    uint8_t r[RECORD_LEN];
+
+    if ( fread( r, RECORD_LEN, 1, f ) != 1 )
+    {
+        return false;
+    }
+
+    e->tsuS = _get64( r );
+    e->ofs  = _get64( &r[8] );
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct captureIndex *captureIndexCreate( const char *file )
+
+/* Create (or replace) the index for capture file */
+
+{
+    struct captureIndex *i;
+    char *n = _indexName( file );
+    FILE *f = fopen( n, "wb" );
+
+    if ( !f )
+    {
+        genericsReport( V_WARN, "Could not create index %s (%s)" EOL, n, strerror( errno ) );
+        free( n );
+        return NULL;
+    }
+
+    free( n );
+
+    if ( fwrite( CAPTURE_INDEX_MAGIC, CAPTURE_INDEX_MAGIC_LEN, 1, f ) != 1 )
+    {
+        fclose( f );
+        return NULL;
+    }
+
+    i = ( struct captureIndex * )calloc( 1, sizeof( struct captureIndex ) );
+    MEMCHECK( i, NULL );
+    i->f = f;
+    return i;
+}
+// ====================================================================================================
+bool captureIndexAdd( struct captureIndex *i, uint64_t tsuS, uint64_t ofs )
+
+/* Add a sync point to the index */
+
+{
+    uint8_t r[RECORD_LEN];
+
+    _put64( r, tsuS );
+    _put64( &r[8], ofs );
+    return ( fwrite( r, RECORD_LEN, 1, i->f ) == 1 ) && ( !fflush( i->f ) );
+}
+// ====================================================================================================
+void captureIndexClose( struct captureIndex *i )
+
+{
+    if ( i )
+    {
+        fclose( i->f );
+        free( i );
+    }
+}
+// ====================================================================================================
+bool captureIndexFind( const char *file, uint64_t startmS, uint64_t *ofs )
+
+/* Find where to start reading to get to startmS after the start of the capture */
+
+{
+    struct captureIndexEntry first, e;
+    char magic[CAPTURE_INDEX_MAGIC_LEN];
+    char *n = _indexName( file );
+    FILE *f = fopen( n, "rb" );
+
+    free( n );
+
+    if ( !f )
+    {
+        return false;
+    }
+
+    if ( ( fread( magic, CAPTURE_INDEX_MAGIC_LEN, 1, f ) != 1 ) ||
+            ( memcmp( magic, CAPTURE_INDEX_MAGIC, CAPTURE_INDEX_MAGIC_LEN ) ) ||
+            ( !_readEntry( f, &first ) ) )
+    {
+        fclose( f );
+        return false;
+    }
+
+    /* Records are in time order, so search for the record just before the target */
+    long lo = 0, hi;
+    uint64_t target = first.tsuS + startmS * 1000;
+
+    fseek( f, 0, SEEK_END );
+    hi = ( ftell( f ) - CAPTURE_INDEX_MAGIC_LEN ) / RECORD_LEN - 1;
+    *ofs = first.ofs;
+
+    while ( lo < hi )
+    {
+        long mid = lo + ( hi - lo + 1 ) / 2;
+
+        fseek( f, CAPTURE_INDEX_MAGIC_LEN + mid * RECORD_LEN, SEEK_SET );
+
+        if ( !_readEntry( f, &e ) )
+        {
+            break;
+        }
+
+        if ( e.tsuS <= target )
+        {
+            lo = mid;
+            *ofs = e.ofs;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    fclose( f );
+    return true;
+}
+// ====================================================================================================
+struct captureIndexEntry *captureIndexLoad( const char *file, size_t *n )
+
+/* Read in all of the index for file, for when something needs more than a single lookup */
+
+{
+    struct captureIndexEntry *e = NULL;
+    char magic[CAPTURE_INDEX_MAGIC_LEN];
+    char *name = _indexName( file );
+    FILE *f = fopen( name, "rb" );
+    size_t max = 0;
+
+    free( name );
+    *n = 0;
+
+    if ( !f )
+    {
+        return NULL;
+    }
+
+    if ( ( fread( magic, CAPTURE_INDEX_MAGIC_LEN, 1, f ) == 1 ) &&
+            ( !memcmp( magic, CAPTURE_INDEX_MAGIC, CAPTURE_INDEX_MAGIC_LEN ) ) )
+    {
+        while ( true )
+        {
+            if ( *n == max )
+            {
+                max = ( max ) ? max * 2 : 1024;
+                e = ( struct captureIndexEntry * )realloc( e, max * sizeof( struct captureIndexEntry ) );
+                MEMCHECK( e, NULL );
+            }
+
+            if ( !_readEntry( f, &e[*n] ) )
+            {
+                break;
+            }
+
+            ( *n )++;
+        }
+    }
+
+    fclose( f );
+
+    if ( !*n )
+    {
+        free( e );
+        return NULL;
+    }
+
+    return e;
+}
+// ====================================================================================================
+uint64_t captureIndexStart( const char *file, uint64_t startmS )
+
+/* Offset to start reading file from to get to startmS, or 0 (with a warning) if that can't be found */
+
+{
+    uint64_t ofs = 0;
+
+    if ( !startmS )
+    {
+        return 0;
+    }
+
+    if ( !captureIndexFind( file, startmS, &ofs ) )
+    {
+        genericsReport( V_WARN, "No usable index for %s, starting from the beginning" EOL, file );
+        return 0;
+    }
+
+    genericsReport( V_INFO, "Starting %" PRIu64 "mS into %s, at offset %" PRIu64 EOL, startmS, file, ofs );
+    return ofs;
+}
+// ====================================================================================================
@@ -45,56 +45,114 @@ void COBSDelete( struct COBS *t )
 }
 
 // ====================================================================================================
+static inline int _syncFreeLen( const uint8_t *p, int len )
 
-void COBSEncode( const uint8_t *frontMsg, int lfront, const uint8_t *backMsg, int lback, const uint8_t *inputMsg, int lmsg, struct Frame *o )
-
-/* Encode frame and write into provided output Frame buffer */
+/* Return how many bytes from p can be taken before hitting a sync char. memchr is vectorised in */
+/* any libc worth the name, so this is the fast path for all of the encode and decode loops.     */
 
 {
-    uint8_t *wp = o->d;
-    o->len = 0;
-
-    /* Get overall message length */
-    int len = lfront + lmsg + lback;
+    const uint8_t *z = memchr( p, COBS_SYNC_CHAR, len );
+    return z ? ( z - p ) : len;
+}
+// ====================================================================================================
+static void _encodeRun( struct COBSEnc *e, const uint8_t *rp, int len )
 
-    assert( len <= COBS_OVERALL_MAX_PACKET_LEN );
+/* Encode len bytes from rp into the frame under construction, a run at a time */
 
-    if ( len )
+{
+    while ( len )
     {
-        uint8_t *cp = wp++;
-        int seglen = 1;
+        int room = 0xff - e->seglen;
+        int n = _syncFreeLen( rp, ( len < room ) ? len : room );
+
+        memcpy( e->wp, rp, n );
+        e->wp += n;
+        e->seglen += n;
+        rp += n;
+        len -= n;
 
-        for ( int i = 0; len--; i++ )
+        if ( 0xff == e->seglen )
         {
-            /* Take byte from frontMatter, main message or backMatter depending on where we are in transmission */
-            const uint8_t *rp = ( i < lfront ) ? &frontMsg[i] : ( i < ( lfront + lmsg ) ) ? &inputMsg[i - lfront] : &backMsg[i - ( lfront + lmsg )];
+            /* Segment is full, close it without an implicit sync */
+            *e->cp = e->seglen;
+            e->cp = e->wp++;
+            e->seglen = 1;
+            e->maxEnded = true;
+        }
+        else if ( len )
+        {
+            /* Stopped on a sync char in the data, so close this segment and skip over it */
+            *e->cp = e->seglen;
+            e->cp = e->wp++;
+            e->seglen = 1;
+            e->maxEnded = false;
+            rp++;
+            len--;
+        }
+    }
+}
+// ====================================================================================================
 
-            if ( COBS_SYNC_CHAR != *rp )
-            {
-                *wp++ = *rp;
-                seglen++;
-            }
+void COBSEncStart( struct COBSEnc *e, uint8_t *out )
 
-            if ( ( COBS_SYNC_CHAR == *rp ) || ( 0xff == seglen ) )
-            {
-                *cp = seglen;
-                seglen = 1;
-                cp = wp;
+/* Start encoding a frame straight into out, which needs room for COBS_MAX_ENC_PACKET_LEN */
 
-                if ( ( COBS_SYNC_CHAR == *rp )  || len )
-                {
-                    wp++;
-                }
-            }
-        }
+{
+    e->start = out;
+    e->cp = out;
+    e->wp = out + 1;
+    e->seglen = 1;
+    e->maxEnded = false;
+}
+// ====================================================================================================
+void COBSEncAdd( struct COBSEnc *e, const uint8_t *d, int len )
 
-        *cp = seglen;
+/* Add to the frame under construction. No more than COBS_OVERALL_MAX_PACKET_LEN may go in altogether */
 
-        /* Packet must end with a sync to define EOP */
-        *wp++ = COBS_SYNC_CHAR;
+{
+    _encodeRun( e, d, len );
+    assert( e->wp - e->start <= COBS_MAX_ENC_PACKET_LEN - COBS_EOP_LEN );
+}
+// ====================================================================================================
+int COBSEncEnd( struct COBSEnc *e )
+
+/* Finish off the frame, returning how long it came to when encoded */
+
+{
+    if ( ( e->maxEnded ) && ( 1 == e->seglen ) )
+    {
+        /* Finished exactly on a full segment, so there's no need for another code byte */
+        e->wp = e->cp;
+    }
+    else
+    {
+        *e->cp = e->seglen;
     }
 
-    o->len = ( wp - o->d );
+    /* Packet must end with a sync to define EOP */
+    *e->wp++ = COBS_SYNC_CHAR;
+
+    return e->wp - e->start;
+}
+// ====================================================================================================
+void COBSEncode( const uint8_t *frontMsg, int lfront, const uint8_t *backMsg, int lback, const uint8_t *inputMsg, int lmsg, struct Frame *o )
+
+/* Encode frame and write into provided output Frame buffer */
+
+{
+    struct COBSEnc e;
+    o->len = 0;
+
+    assert( lfront + lmsg + lback <= COBS_OVERALL_MAX_PACKET_LEN );
+
+    if ( lfront + lmsg + lback )
+    {
+        COBSEncStart( &e, o->d );
+        _encodeRun( &e, frontMsg, lfront );
+        _encodeRun( &e, inputMsg, lmsg );
+        _encodeRun( &e, backMsg, lback );
+        o->len = COBSEncEnd( &e );
+    }
 }
 
 // ====================================================================================================
@@ -116,8 +174,11 @@ void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
 
 {
     const uint8_t *fp = incoming;
+    const uint8_t *efp = incoming + len;
+    const uint8_t *z;
+    int n, room;
 
-    for ( unsigned int rlen = 0; rlen < len; rlen++, fp++ )
+    while ( fp < efp )
     {
         switch ( t->s )
         {
@@ -130,10 +191,15 @@ void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
                     t->s = COBS_RXING;
                 }
 
+                fp++;
                 break;
 
             case COBS_DRAINING:  // ---------------------------------------------------------------
-                if ( COBS_SYNC_CHAR == *fp )
+                /* Skip straight to the next sync */
+                z = memchr( fp, COBS_SYNC_CHAR, efp - fp );
+                fp = z ? z + 1 : efp;
+
+                if ( z )
                 {
                     t->s = COBS_IDLE;
                 }
@@ -141,9 +207,28 @@ void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
                 break;
 
             case COBS_RXING: // -------------------------------------------------------------------
-                t->intervalCount--;
-
-                if ( !t->intervalCount )
+                if ( t->intervalCount > 1 )
+                {
+                    /* In the body of a segment, so take as much of it as we can in one go */
+                    n = ( t->intervalCount - 1 < efp - fp ) ? t->intervalCount - 1 : efp - fp;
+                    n = _syncFreeLen( fp, n );
+                    room = ( t->f.len > COBS_MAX_PACKET_LEN ) ? 0 : COBS_MAX_PACKET_LEN + 1 - t->f.len;
+                    n = ( n < room ) ? n : room;
+
+                    memcpy( &t->f.d[t->f.len], fp, n );
+                    t->f.len += n;
+                    t->intervalCount -= n;
+                    fp += n;
+
+                    if ( ( fp != efp ) && ( t->intervalCount > 1 ) )
+                    {
+                        /* Stopped early, so that's either an illegal sync or a frame overflow */
+                        STAT_INC( t->error );
+                        t->s = COBS_DRAINING;
+                        fp++;
+                    }
+                }
+                else
                 {
                     if ( COBS_SYNC_CHAR == *fp )
                     {
@@ -151,6 +236,12 @@ void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
                         packetRxed( &t->f, param );
                         t->s = COBS_IDLE;
                     }
+                    else if ( ( !t->maxCount ) && ( t->f.len > COBS_MAX_PACKET_LEN ) )
+                    {
+                        /* No room for the implicit sync char, so that's an overflow too */
+                        STAT_INC( t->error );
+                        t->s = COBS_DRAINING;
+                    }
                     else
                     {
                         if ( !t->maxCount )
@@ -161,19 +252,8 @@ void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
                         t->intervalCount = *fp;
                         t->maxCount = ( *fp == 255 );
                     }
-                }
-                else
-                {
-                    /* Check for frame overflow ... if it's max then error */
-                    if ( ( t->f.len > COBS_MAX_PACKET_LEN  ) || ( COBS_SYNC_CHAR == *fp ) )
-                    {
-                        t->error++;
-                        t->s = COBS_DRAINING;
-                    }
-                    else
-                    {
-                        t->f.d[t->f.len++] = *fp;
-                    }
+
+                    fp++;
                 }
 
                 break;
@@ -181,6 +261,139 @@ void COBSPump( struct COBS *t, const uint8_t *incoming, int len,
     }
 }
 
+// ====================================================================================================
+struct inPlaceCB
+{
+    void ( *packetRxed )( uint8_t *d, int len, void *param );
+    void *param;
+};
+
+static void _frameRxed( struct Frame *p, void *param )
+
+/* Adapter for frames that had to be assembled in the COBS instance */
+
+{
+    struct inPlaceCB *c = ( struct inPlaceCB * )param;
+    ( c->packetRxed )( p->d, p->len, c->param );
+}
+// ====================================================================================================
+static int _inPlaceLen( const uint8_t *fp, const uint8_t *efp )
+
+/* Check a frame running from fp up to the sync at efp will decode cleanly, and return its decoded */
+/* length, or -1 if it won't. The checks match those done by COBSPump for the same frame.         */
+
+{
+    int len = 0;
+
+    while ( true )
+    {
+        int interval = *fp;
+
+        if ( fp + interval > efp )
+        {
+            /* Sync char in the middle of a segment */
+            return -1;
+        }
+
+        if ( ( interval > 1 ) && ( len + interval - 2 > COBS_MAX_PACKET_LEN ) )
+        {
+            /* Frame overflow */
+            return -1;
+        }
+
+        len += interval - 1;
+        fp += interval;
+
+        if ( fp == efp )
+        {
+            return len;
+        }
+
+        if ( interval != 0xff )
+        {
+            if ( len > COBS_MAX_PACKET_LEN )
+            {
+                /* No room for the implicit sync char */
+                return -1;
+            }
+
+            len++;
+        }
+    }
+}
+// ====================================================================================================
+void COBSPumpInPlace( struct COBS *t, uint8_t *incoming, int len,
+                      void ( *packetRxed )( uint8_t *d, int len, void *param ),
+                      void *param )
+
+/* As COBSPump, but any frame lying entirely within incoming is decoded in place there and handed */
+/* straight back, without being copied. Frames that straddle calls are assembled as normal. The   */
+/* content of incoming is destroyed.                                                             */
+
+{
+    struct inPlaceCB c = { .packetRxed = packetRxed, .param = param };
+    uint8_t *fp = incoming;
+    uint8_t *efp = incoming + len;
+    uint8_t *z, *rp, *wp;
+    int flen;
+
+    while ( fp < efp )
+    {
+        if ( COBS_IDLE != t->s )
+        {
+            /* Finish off whatever was already in progress, up to and including the next sync */
+            z = memchr( fp, COBS_SYNC_CHAR, efp - fp );
+            z = z ? z + 1 : efp;
+            COBSPump( t, fp, z - fp, _frameRxed, &c );
+            fp = z;
+            continue;
+        }
+
+        if ( COBS_SYNC_CHAR == *fp )
+        {
+            fp++;
+            continue;
+        }
+
+        z = memchr( fp, COBS_SYNC_CHAR, efp - fp );
+
+        if ( ( !z ) || ( ( flen = _inPlaceLen( fp, z ) ) < 0 ) )
+        {
+            /* Either this frame straddles the end of the buffer or it's bad, so let COBSPump deal with it */
+            z = z ? z + 1 : efp;
+            COBSPump( t, fp, z - fp, _frameRxed, &c );
+            fp = z;
+            continue;
+        }
+
+        /* Decode the frame down over itself, the output can never overtake the input */
+        rp = fp;
+        wp = fp;
+
+        while ( true )
+        {
+            int interval = *rp++;
+
+            memmove( wp, rp, interval - 1 );
+            wp += interval - 1;
+            rp += interval - 1;
+
+            if ( rp == z )
+            {
+                break;
+            }
+
+            if ( interval != 0xff )
+            {
+                *wp++ = COBS_SYNC_CHAR;
+            }
+        }
+
+        packetRxed( fp, flen, param );
+        fp = z + 1;
+    }
+}
+
 // ====================================================================================================
 bool COBSSimpleDecode( const uint8_t *inputEnc, int len, struct Frame *o )
 
@@ -195,9 +408,10 @@ bool COBSSimpleDecode( const uint8_t *inputEnc, int len, struct Frame *o )
     uint8_t *op = o->d;
 
     uint8_t interval;
+    int seg, n;
 
     /* Deal with possibility of sync chars on the front */
-    while  ( ( COBS_SYNC_CHAR == *fp ) && ( fp < efp ) )
+    while  ( ( fp < efp ) && ( COBS_SYNC_CHAR == *fp ) )
     {
         fp++;
     }
@@ -212,20 +426,21 @@ bool COBSSimpleDecode( const uint8_t *inputEnc, int len, struct Frame *o )
             break;
         }
 
-        for ( int i = 1; i < interval; i++ )
-        {
-            /* Deal with possibility of illegal sync chars in the flow */
-            if ( *fp == COBS_SYNC_CHAR )
-            {
-                /* return false...no good packet here */
-                o->len = 0;
-                return false;
-            }
+        seg = ( interval - 1 < efp - fp ) ? interval - 1 : efp - fp;
+        n = _syncFreeLen( fp, seg );
 
-            *op++ = *fp++;
+        if ( n != seg )
+        {
+            /* Illegal sync char in the flow...return false, no good packet here */
+            o->len = 0;
+            return false;
         }
 
-        if ( ( interval != 0xff ) && ( *fp != COBS_SYNC_CHAR ) )
+        memcpy( op, fp, n );
+        op += n;
+        fp += n;
+
+        if ( ( interval != 0xff ) && ( fp < efp ) && ( *fp != COBS_SYNC_CHAR ) )
         {
             *op++ = COBS_SYNC_CHAR;
         }
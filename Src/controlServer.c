@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Control Server
+ * ==============
+ *
+ * Lines longer than LINE_MAX_LEN are thrown away whole rather than being split into commands that
+ * nobody meant to send. A connection stays open until the other end closes it, so a script can send
+ * a series of commands and read the answers as it goes.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
+#include "generics.h"
+#include "controlServer.h"
+
+#ifdef WIN32
+    #define MSG_NOSIGNAL 0
+#endif
+
+#if defined OSX || defined FREEBSD
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
+#endif
+
+#define LINE_MAX_LEN   (1024)                      /* Longest command we'll look at */
+#define REPLY_MAX_LEN  (4096)                      /* Longest piece of an answer sent at once */
+
+struct controlServer
+{
+    int sockfd;                                    /* Listening socket */
+    controlCommandCB cb;                           /* Who deals with the commands */
+    void *param;                                   /* ...and what they want to be told */
+    pthread_t thread;                              /* Thread taking the commands */
+};
+
+struct controlConn
+{
+    int fd;                                        /* Who we're talking to */
+    bool gone;                                     /* ...and if they've stopped listening */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _serve( struct controlServer *s, int fd )
+
+/* Take commands from one connection until it closes */
+
+{
+    struct controlConn c = { .fd = fd };
+    char line[LINE_MAX_LEN + 1];
+    size_t len = 0;
+    bool discarding = false;
+    char rx[LINE_MAX_LEN];
+    ssize_t n;
+
+    while ( ( !c.gone ) && ( ( n = recv( fd, rx, sizeof( rx ), 0 ) ) > 0 ) )
+    {
+        for ( ssize_t i = 0; i < n; i++ )
+        {
+            if ( ( rx[i] == '\n' ) || ( rx[i] == '\r' ) )
+            {
+                if ( ( len ) && ( !discarding ) )
+                {
+                    line[len] = 0;
+                    s->cb( line, &c, s->param );
+                }
+                else if ( discarding )
+                {
+                    controlPrintf( &c, "ERR line too long" EOL );
+                }
+
+                len = 0;
+                discarding = false;
+            }
+            else if ( len == LINE_MAX_LEN )
+            {
+                discarding = true;
+            }
+            else if ( !discarding )
+            {
+                line[len++] = rx[i];
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void *_serverTask( void *arg )
+
+{
+    struct controlServer *s = ( struct controlServer * )arg;
+    int fd;
+
+    listen( s->sockfd, 2 );
+
+    while ( ( fd = accept( s->sockfd, NULL, NULL ) ) >= 0 )
+    {
+        _serve( s, fd );
+        close( fd );
+    }
+
+    genericsReport( V_WARN, "Control server stopped" EOL );
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void controlPrintf( struct controlConn *c, const char *fmt, ... )
+
+{
+    char d[REPLY_MAX_LEN];
+    va_list va;
+    int n;
+
+    if ( c->gone )
+    {
+        return;
+    }
+
+    va_start( va, fmt );
+    n = vsnprintf( d, sizeof( d ), fmt, va );
+    va_end( va );
+
+    n = ( n >= ( int )sizeof( d ) ) ? ( int )sizeof( d ) - 1 : n;
+
+    for ( int sent = 0; sent < n; )
+    {
+        ssize_t w = send( c->fd, &d[sent], n - sent, MSG_NOSIGNAL );
+
+        if ( w <= 0 )
+        {
+            c->gone = true;
+            return;
+        }
+
+        sent += w;
+    }
+}
+// ====================================================================================================
+bool controlServerStart( int port, controlCommandCB cb, void *param )
+
+/* Start taking commands on port, on the loopback interface only */
+
+{
+    struct sockaddr_in serv_addr;
+    int flag = 1;
+    struct controlServer *s = ( struct controlServer * )calloc( 1, sizeof( struct controlServer ) );
+    MEMCHECK( s, false );
+
+    s->cb = cb;
+    s->param = param;
+
+    if ( ( s->sockfd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Error opening control socket" EOL );
+        goto free_and_return;
+    }
+
+    setsockopt( s->sockfd, SOL_SOCKET, SO_REUSEADDR, ( const void * ) &flag, sizeof( flag ) );
+
+    memset( ( char * ) &serv_addr, 0, sizeof( serv_addr ) );
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    serv_addr.sin_port = htons( port );
+
+    if ( bind( s->sockfd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Error binding control port %d" EOL, port );
+        close( s->sockfd );
+        goto free_and_return;
+    }
+
+    if ( pthread_create( &s->thread, NULL, &_serverTask, s ) )
+    {
+        genericsReport( V_ERROR, "Failed to create control thread" EOL );
+        close( s->sockfd );
+        goto free_and_return;
+    }
+
+    return true;
+
+free_and_return:
+    free( s );
+    return false;
+}
+// ====================================================================================================
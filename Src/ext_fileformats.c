@@ -7,10 +7,45 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "generics.h"
 #include "ext_fileformats.h"
 
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
 
+#define STACK_PATH_DEPTH    (256)        /* Initial depth of call path assembled for output, it's grown if needed */
+#define PBUF_INITIAL        (256)        /* Initial size of a protobuf message being built */
+#define OBUF_SIZE           (1024*1024)  /* Text built up before it's written, for the formats that can be huge */
+#define OBUF_ROOM           (256)        /* ...which is written when there's less than a line of numbers free */
+
+/* pprof message fields used, from profile.proto */
+#define PPROF_SAMPLE_TYPE   (1)
+#define PPROF_SAMPLE        (2)
+#define PPROF_LOCATION      (4)
+#define PPROF_FUNCTION      (5)
+#define PPROF_STRING_TABLE  (6)
+
+#define COV_MAGIC           (0x564f434f) /* 'OCOV' at the start of a coverage map */
+
+/* What's at the start of a coverage map, enough to tell if it's from the same program */
+struct covHeader
+{
+    uint32_t magic;
+    uint32_t insnCount;                  /* Instructions in the program, and so entries in the map */
+    uint32_t firstAddr;                  /* ...and where the first and last of them are */
+    uint32_t lastAddr;
+};
+
+/* An instruction's place in the source, for putting them in the order lcov wants them */
+struct covLine
+{
+    uint32_t fileIdx;
+    uint32_t lineNo;
+    uint32_t insn;
+};
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -18,12 +53,66 @@
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static int _inst_sort_fn( const void *a, const void *b )
+static struct execEntryHash **_instSort( struct execEntryHash *insthead, uint32_t *count )
 
-/* Sort instructions by address */
+/* The instructions in address order (as signed numbers, so an interrupt entry comes first). There */
+/* can be millions of them, so they're radix sorted a byte at a time rather than compared.        */
 
 {
-    return ( int )( ( ( struct execEntryHash * )a )->addr ) - ( int )( ( ( struct execEntryHash * )b )->addr );
+    uint32_t n = HASH_COUNT( insthead );
+    struct execEntryHash **a = ( struct execEntryHash ** )malloc( ( n + 1 ) * sizeof( struct execEntryHash * ) );
+    struct execEntryHash **t = ( struct execEntryHash ** )malloc( ( n + 1 ) * sizeof( struct execEntryHash * ) );
+    struct execEntryHash **x;
+    uint32_t pos[256];
+    uint32_t i = 0;
+
+    MEMCHECK( a, NULL );
+    MEMCHECK( t, NULL );
+
+    for ( struct execEntryHash *f = insthead; f; f = f->hh.next )
+    {
+        a[i++] = f;
+    }
+
+#define SORT_KEY(f) ( ( f )->addr ^ 0x80000000 )
+
+    for ( int shift = 0; ( n ) && ( shift < 32 ); shift += 8 )
+    {
+        memset( pos, 0, sizeof( pos ) );
+
+        for ( i = 0; i < n; i++ )
+        {
+            pos[( SORT_KEY( a[i] ) >> shift ) & 0xff]++;
+        }
+
+        /* Code is usually all in one place, so the top bytes are often the same for everything */
+        if ( pos[( SORT_KEY( a[0] ) >> shift ) & 0xff] == n )
+        {
+            continue;
+        }
+
+        for ( uint32_t b = 0, sum = 0; b < 256; b++ )
+        {
+            uint32_t c = pos[b];
+            pos[b] = sum;
+            sum += c;
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            t[pos[( SORT_KEY( a[i] ) >> shift ) & 0xff]++] = a[i];
+        }
+
+        x = a;
+        a = t;
+        t = x;
+    }
+
+#undef SORT_KEY
+
+    free( t );
+    *count = n;
+    return a;
 }
 // ====================================================================================================
 static int _calls_src_sort_fn( const void *a, const void *b )
@@ -41,6 +130,379 @@ static int _calls_src_sort_fn( const void *a, const void *b )
     return ( int )( ( ( struct subcall * )a )->dsth->functionindex ) - ( int )( ( ( struct subcall * )b )->dsth->functionindex );
 }
 // ====================================================================================================
+static FILE *_openAtomic( const char *filename, char **tmpname )
+
+/* Open a temporary file alongside filename, to be renamed over it when complete. That way anything */
+/* watching the file (e.g. kcachegrind) never sees a partial one, even when it's rewritten often.   */
+
+{
+    FILE *c;
+
+    *tmpname = ( char * )malloc( strlen( filename ) + 5 );
+
+    if ( !*tmpname )
+    {
+        return NULL;
+    }
+
+    strcpy( *tmpname, filename );
+    strcat( *tmpname, ".tmp" );
+
+    if ( !( c = fopen( *tmpname, "w" ) ) )
+    {
+        free( *tmpname );
+    }
+
+    return c;
+}
+// ====================================================================================================
+static bool _closeAtomic( FILE *c, const char *filename, char *tmpname )
+
+{
+    bool ok = ( !ferror( c ) );
+
+    ok = ( 0 == fclose( c ) ) && ok;
+    ok = ok && ( 0 == rename( tmpname, filename ) );
+
+    if ( !ok )
+    {
+        remove( tmpname );
+    }
+
+    free( tmpname );
+    return ok;
+}
+// ====================================================================================================
+static struct stackNode *_stackNext( struct stackNode *n )
+
+/* Next node after n in a depth first walk of the tree, or NULL at the end. This is done without */
+/* recursion since a tree from a trace that lost track of its returns can be very deep.          */
+
+{
+    if ( n->children )
+    {
+        return n->children;
+    }
+
+    for ( ; n->parent; n = n->parent )
+    {
+        if ( n->hh.next )
+        {
+            return ( struct stackNode * )n->hh.next;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static struct stackNode *_stackChild( struct stackNode *n, uint32_t addr, uint32_t context )
+
+/* Find the context for a call to addr from n (or a thread's root, if context is set), creating it */
+/* if this is the first time. Nodes are keyed on addr and context together, which sit side by side. */
+
+{
+    struct stackNode k = { .addr = addr, .context = context };
+    struct stackNode *c;
+
+    HASH_FIND( hh, n->children, &k.addr, 2 * sizeof( uint32_t ), c );
+
+    if ( !c )
+    {
+        c = ( struct stackNode * )calloc( 1, sizeof( struct stackNode ) );
+        MEMCHECK( c, n );
+        c->addr = addr;
+        c->context = context;
+        c->parent = n;
+        HASH_ADD( hh, n->children, addr, 2 * sizeof( uint32_t ), c );
+    }
+
+    return c;
+}
+// ====================================================================================================
+static void _stackCharge( struct stackTree *t, uint64_t ticks )
+
+/* Everything since the last change of context was spent in the current one */
+
+{
+    t->at->self += ticks - t->lastTicks;
+    t->lastTicks = ticks;
+}
+// ====================================================================================================
+static uint32_t _stackPath( struct stackNode *n, struct stackNode ***path, uint32_t *alloc )
+
+/* Put the contexts from n up to (but not including) the root into path, returning how many there are */
+
+{
+    uint32_t depth = 0;
+
+    for ( ; n->parent; n = n->parent )
+    {
+        if ( depth == *alloc )
+        {
+            *alloc = ( *alloc ) ? *alloc * 2 : STACK_PATH_DEPTH;
+            *path = ( struct stackNode ** )realloc( *path, *alloc * sizeof( struct stackNode * ) );
+            MEMCHECK( *path, 0 );
+        }
+
+        ( *path )[depth++] = n;
+    }
+
+    return depth;
+}
+// ====================================================================================================
+static const char *_stackName( struct SymbolSet *ss, uint32_t addr, struct nameEntry *n )
+
+{
+    if ( SymbolLookup( ss, addr, n ) )
+    {
+        return SymbolFunction( ss, n->functionindex );
+    }
+
+    n->fileindex = NO_FILE;
+    n->line = 0;
+    return NULL;
+}
+// ====================================================================================================
+// Minimal protobuf encoding, enough for pprof
+// ====================================================================================================
+struct pbuf
+{
+    uint8_t *d;
+    size_t len;
+    size_t alloc;
+};
+
+static void _pbRaw( struct pbuf *b, const void *d, size_t len )
+
+{
+    if ( b->len + len > b->alloc )
+    {
+        while ( b->len + len > b->alloc )
+        {
+            b->alloc = ( b->alloc ) ? b->alloc * 2 : PBUF_INITIAL;
+        }
+
+        b->d = ( uint8_t * )realloc( b->d, b->alloc );
+        MEMCHECKV( b->d );
+    }
+
+    memcpy( &b->d[b->len], d, len );
+    b->len += len;
+}
+
+static void _pbVarint( struct pbuf *b, uint64_t v )
+
+{
+    uint8_t o[10];
+    int n = 0;
+
+    do
+    {
+        o[n++] = ( v & 0x7f ) | ( ( v > 0x7f ) ? 0x80 : 0 );
+        v >>= 7;
+    }
+    while ( v );
+
+    _pbRaw( b, o, n );
+}
+
+static void _pbUint( struct pbuf *b, uint32_t field, uint64_t v )
+
+{
+    _pbVarint( b, field << 3 );
+    _pbVarint( b, v );
+}
+
+static void _pbBytes( struct pbuf *b, uint32_t field, const void *d, size_t len )
+
+{
+    _pbVarint( b, ( field << 3 ) | 2 );
+    _pbVarint( b, len );
+    _pbRaw( b, d, len );
+}
+
+static bool _pbEmit( gzFile z, uint32_t field, struct pbuf *b, struct pbuf *hdr )
+
+/* Write b to z as a field of the outer message, and empty it for the next one. Since repeated  */
+/* fields can be spread through a message, each is written as soon as it's made.               */
+
+{
+    bool ok;
+
+    hdr->len = 0;
+    _pbVarint( hdr, ( field << 3 ) | 2 );
+    _pbVarint( hdr, b->len );
+    ok = ( gzwrite( z, hdr->d, hdr->len ) == ( int )hdr->len ) && ( ( !b->len ) || ( gzwrite( z, b->d, b->len ) == ( int )b->len ) );
+    b->len = 0;
+    return ok;
+}
+// ====================================================================================================
+// Buffered text output, since a line at a time through fprintf is slow for millions of them
+// ====================================================================================================
+struct obuf
+{
+    FILE *c;
+    char *d;
+    size_t len;
+    bool ok;                             /* Everything flushed so far was written */
+};
+
+static void _obFlush( struct obuf *b )
+
+{
+    if ( b->len )
+    {
+        b->ok = ( fwrite( b->d, 1, b->len, b->c ) == b->len ) && ( b->ok );
+        b->len = 0;
+    }
+}
+
+static inline void _obRoom( struct obuf *b )
+
+/* Make sure there's room for a line of numbers, anything else checks for itself */
+
+{
+    if ( b->len > OBUF_SIZE - OBUF_ROOM )
+    {
+        _obFlush( b );
+    }
+}
+
+static void _obStr( struct obuf *b, const char *s )
+
+{
+    size_t l = strlen( s );
+
+    if ( b->len + l > OBUF_SIZE - OBUF_ROOM )
+    {
+        _obFlush( b );
+
+        if ( l > OBUF_SIZE - OBUF_ROOM )
+        {
+            b->ok = ( fwrite( s, 1, l, b->c ) == l ) && ( b->ok );
+            return;
+        }
+    }
+
+    memcpy( &b->d[b->len], s, l );
+    b->len += l;
+}
+
+static inline void _obChar( struct obuf *b, char c )
+
+{
+    b->d[b->len++] = c;
+}
+
+static void _obU64( struct obuf *b, uint64_t v )
+
+{
+    char t[20];
+    int n = 0;
+
+    do
+    {
+        t[n++] = '0' + v % 10;
+        v /= 10;
+    }
+    while ( v );
+
+    while ( n )
+    {
+        b->d[b->len++] = t[--n];
+    }
+}
+
+static void _obInt( struct obuf *b, int64_t v, bool plus )
+
+/* Signed number, with a + in front of a positive one if plus is set */
+
+{
+    if ( v < 0 )
+    {
+        _obChar( b, '-' );
+        _obU64( b, -( uint64_t )v );
+    }
+    else
+    {
+        if ( plus && v )
+        {
+            _obChar( b, '+' );
+        }
+
+        _obU64( b, v );
+    }
+}
+
+static void _obHex( struct obuf *b, uint32_t v )
+
+{
+    static const char hex[] = "0123456789abcdef";
+
+    _obChar( b, '0' );
+    _obChar( b, 'x' );
+
+    for ( int i = 28; i >= 0; i -= 4 )
+    {
+        _obChar( b, hex[( v >> i ) & 0xf] );
+    }
+}
+// ====================================================================================================
+static int _cov_line_sort_fn( const void *a, const void *b )
+
+/* Sort instructions by file, then line, then address (which is their order in the symbol set) */
+
+{
+    const struct covLine *x = ( const struct covLine * )a;
+    const struct covLine *y = ( const struct covLine * )b;
+
+    if ( x->fileIdx != y->fileIdx )
+    {
+        return ( x->fileIdx < y->fileIdx ) ? -1 : 1;
+    }
+
+    if ( x->lineNo != y->lineNo )
+    {
+        return ( x->lineNo < y->lineNo ) ? -1 : 1;
+    }
+
+    return ( x->insn < y->insn ) ? -1 : ( x->insn > y->insn );
+}
+// ====================================================================================================
+static bool _isConditional( const struct assyLineEntry *a )
+
+/* Is this a branch that could go either way? Those are what lcov counts as branches */
+
+{
+    static const char *const cc[] = { "eq", "ne", "cs", "hs", "cc", "lo", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le", NULL };
+    const char *m = a->assy;
+
+    if ( ( !a->isJump ) || ( a->isSubCall ) || ( a->isReturn ) || ( !m ) )
+    {
+        return false;
+    }
+
+    if ( ( !strncmp( m, "cbz", 3 ) ) || ( !strncmp( m, "cbnz", 4 ) ) )
+    {
+        return true;
+    }
+
+    if ( *m++ != 'b' )
+    {
+        return false;
+    }
+
+    for ( int i = 0; cc[i]; i++ )
+    {
+        if ( ( !strncmp( m, cc[i], 2 ) ) && ( ( m[2] == '.' ) || ( m[2] == '\t' ) || ( m[2] == ' ' ) || ( !m[2] ) ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
 #if 0 // Not used for now, but left here in case its useful later...
 static int _calls_dst_sort_fn( const void *a, const void *b )
 
@@ -76,6 +538,7 @@ bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct Symbol
 
 {
     FILE *c;
+    char *tmpname;
     uint32_t functionidx, dfunctionidx, fileidx;
     uint64_t cnt;
     struct subcall *s;
@@ -92,7 +555,11 @@ bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct Symbol
 
     /* Sort according to addresses visited. */
 
-    c = fopen( dotfile, "w" );
+    if ( !( c = _openAtomic( dotfile, &tmpname ) ) )
+    {
+        return false;
+    }
+
     fprintf( c, "graph calls\n{\n  overlap=true; splines=true; size=\"7.75,10.25\"; orientation=portrait; sep=0.1; nodesep=1;\n" );
 
     HASH_SORT( subcallList, _calls_src_sort_fn );
@@ -122,21 +589,20 @@ bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct Symbol
     }
 
     fprintf( c, "}\n" );
-    fclose( c );
-    return true;
+    return _closeAtomic( c, dotfile, tmpname );
 }
 // ====================================================================================================
 // ====================================================================================================
 // KCacheGrind support
 // ====================================================================================================
 // ====================================================================================================
-bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
+bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, bool includeCycles, uint64_t timelen,
                            struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss )
 
-/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in subcallList */
+/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in subcallList. */
+/* Cycles, when they're included, come after the other events so calls can leave them off.             */
 
 {
-    struct nameEntry n;
     uint32_t prevfile = NO_FILE;
     uint32_t prevfn   = NO_FUNCTION;
     uint32_t prevaddr = NO_FUNCTION;
@@ -144,24 +610,34 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
     char *e = elffile;
     char *d = deleteMaterial;
     FILE *c;
+    char *tmpname;
 
     if ( !profile )
     {
         return false;
     }
 
-    c = fopen( profile, "w" );
+    if ( !( c = _openAtomic( profile, &tmpname ) ) )
+    {
+        return false;
+    }
+
     fprintf( c, "# callgrind format\n" );
 
+    fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\n" );
+
     if ( includeVisits )
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevent: Visits : Visits to source line\nevents: Inst Visits\n" );
+        fprintf( c, "event: Visits : Visits to source line\n" );
     }
-    else
+
+    if ( includeCycles )
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevents: Inst\n" );
+        fprintf( c, "event: Cycles : CPU Cycles\n" );
     }
 
+    fprintf( c, "events: Inst%s%s\n", includeVisits ? " Visits" : "", includeCycles ? " Cycles" : "" );
+
     /* Samples are in time order, so we can determine the extent of time.... */
     fprintf( c, "summary: %" PRIu64 "\n", timelen );
 
@@ -184,101 +660,714 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
     /* ...and record whatever elffilename we ended up with */
     fprintf( c, "ob=%s\n", e );
 
-    HASH_SORT( insthead, _inst_sort_fn );
-    struct execEntryHash *f = insthead;
+    uint32_t count;
+    struct execEntryHash **sorted = _instSort( insthead, &count );
+    struct obuf b = { .c = c, .d = ( char * )malloc( OBUF_SIZE ), .ok = true };
+    MEMCHECK( b.d, false );
 
-    while ( f )
+    /* Each entry already knows where it is in the source, there's no need to look it up again */
+    for ( uint32_t i = 0; i < count; i++ )
     {
-        SymbolLookup( ss, f->addr, &n );
+        struct execEntryHash *f = sorted[i];
+        uint32_t line = ( f->line == NO_LINE ) ? 0 : f->line;
 
-        if ( prevfile != n.fileindex )
+        _obRoom( &b );
+
+        if ( prevfile != f->fileindex )
         {
-            fprintf( c, "fl=(%u) %s%s\n", n.fileindex & HANDLE_MASK, deleteMaterial  ? deleteMaterial : "", SymbolFilename( ss, n.fileindex ) );
+            _obStr( &b, "fl=(" );
+            _obU64( &b, f->fileindex & HANDLE_MASK );
+            _obStr( &b, ") " );
+            _obStr( &b, deleteMaterial ? deleteMaterial : "" );
+            _obStr( &b, SymbolFilename( ss, f->fileindex ) );
+            _obChar( &b, '\n' );
         }
 
-        if ( prevfn != n.functionindex )
+        if ( prevfn != f->functionindex )
         {
-            fprintf( c, "fn=(%u) %s\n", n.functionindex & HANDLE_MASK, SymbolFunction( ss, n.functionindex ) );
+            _obStr( &b, "fn=(" );
+            _obU64( &b, f->functionindex & HANDLE_MASK );
+            _obStr( &b, ") " );
+            _obStr( &b, SymbolFunction( ss, f->functionindex ) );
+            _obChar( &b, '\n' );
         }
 
+        _obRoom( &b );
+
         if ( ( prevline == NO_LINE ) || ( prevaddr == NO_FUNCTION ) )
         {
-            fprintf( c, "0x%08x %d ", f->addr, n.line );
+            _obHex( &b, f->addr );
+            _obChar( &b, ' ' );
+            _obInt( &b, ( int32_t )line, false );
+            _obChar( &b, ' ' );
         }
         else
         {
             if ( prevaddr == f->addr )
             {
-                fprintf( c, "* " );
+                _obStr( &b, "* " );
             }
             else
             {
-                fprintf( c, "%s%d ", f->addr > prevaddr ? "+" : "", ( int )f->addr - prevaddr );
+                _obInt( &b, ( int32_t )( f->addr - prevaddr ), f->addr > prevaddr );
+                _obChar( &b, ' ' );
             }
 
-            if ( prevline == n.line )
+            if ( prevline == line )
             {
-                fprintf( c, "* " );
+                _obStr( &b, "* " );
             }
             else
             {
-                fprintf( c, "%s%d ", n.line > prevline ? "+" : "", ( int )n.line - prevline );
+                _obInt( &b, ( int32_t )( line - prevline ), line > prevline );
+                _obChar( &b, ' ' );
             }
         }
 
+        _obU64( &b, f->count );
+
         if ( includeVisits )
         {
-            fprintf( c, "%" PRIu64 " %" PRIu64 "\n", f->count, f->scount );
+            _obChar( &b, ' ' );
+            _obU64( &b, f->scount );
         }
-        else
+
+        if ( includeCycles )
         {
-            fprintf( c, "%" PRIu64 "\n", f->count );
+            _obChar( &b, ' ' );
+            _obU64( &b, f->cycles );
         }
 
+        _obChar( &b, '\n' );
 
-        prevline = n.line;
+        prevline = line;
         prevaddr = f->addr;
-        prevfile = n.fileindex;
-        prevfn = n.functionindex;
-        f = f->hh.next;
+        prevfile = f->fileindex;
+        prevfn = f->functionindex;
     }
 
-    fprintf( c, "\n\n## ------------------- Calls Follow ------------------------\n" );
+    free( sorted );
+    _obStr( &b, "\n\n## ------------------- Calls Follow ------------------------\n" );
     HASH_SORT( subcallList, _calls_src_sort_fn );
-    struct subcall *s = subcallList;
 
-    while ( s )
+    for ( struct subcall *s = subcallList; s; s = s->hh.next )
     {
+        _obRoom( &b );
+
         /* Now publish the call destination. By definition is is known, so can be shortformed */
         if ( prevfile != s->srch->fileindex )
         {
-            fprintf( c, "fl=(%u)\n", s->srch->fileindex & HANDLE_MASK );
+            _obStr( &b, "fl=(" );
+            _obU64( &b, s->srch->fileindex & HANDLE_MASK );
+            _obStr( &b, ")\n" );
             prevfile = s->srch->fileindex;
         }
 
         if ( prevfn != s->srch->functionindex )
         {
-            fprintf( c, "fn=(%u)\n", s->srch->functionindex & HANDLE_MASK );
+            _obStr( &b, "fn=(" );
+            _obU64( &b, s->srch->functionindex & HANDLE_MASK );
+            _obStr( &b, ")\n" );
             prevfn = s->srch->functionindex;
         }
 
-        fprintf( c, "cfl=(%d)\ncfn=(%d)\n", s->dsth->fileindex, s->dsth->functionindex );
-        fprintf( c, "calls=%" PRIu64 " 0x%08x %d\n", s->count, s->sig.dst, s->dsth->line );
+        _obStr( &b, "cfl=(" );
+        _obInt( &b, ( int32_t )s->dsth->fileindex, false );
+        _obStr( &b, ")\ncfn=(" );
+        _obInt( &b, ( int32_t )s->dsth->functionindex, false );
+        _obStr( &b, ")\ncalls=" );
+        _obU64( &b, s->count );
+        _obChar( &b, ' ' );
+        _obHex( &b, s->sig.dst );
+        _obChar( &b, ' ' );
+        _obInt( &b, ( int32_t )s->dsth->line, false );
+        _obChar( &b, '\n' );
+
+        _obHex( &b, s->sig.src );
+        _obChar( &b, ' ' );
+        _obInt( &b, ( int32_t )s->srch->line, false );
+        _obChar( &b, ' ' );
+        _obU64( &b, s->myCost );
 
         if ( includeVisits )
         {
-            fprintf( c, "0x%08x %d %" PRIu64 " %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost, s->count );
+            _obChar( &b, ' ' );
+            _obU64( &b, s->count );
         }
-        else
-        {
-            fprintf( c, "0x%08x %d %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost );
+
+        _obChar( &b, '\n' );
+    }
+
+    _obFlush( &b );
+    free( b.d );
+
+    if ( !b.ok )
+    {
+        fclose( c );
+        remove( tmpname );
+        free( tmpname );
+        return false;
+    }
+
+    return _closeAtomic( c, profile, tmpname );
+}
+// ====================================================================================================
+// ====================================================================================================
+// Continuous output support
+// ====================================================================================================
+// ====================================================================================================
+void ext_ff_zeroCounts( struct execEntryHash *insthead, struct subcall *subcallList )
+
+/* Reset the counts after output, so the next output carries only what happened since this one */
+
+{
+    for ( struct execEntryHash *f = insthead; f; f = f->hh.next )
+    {
+        /* The interrupt entry's count is a marker, not a count */
+        if ( f->addr != INTERRUPT )
+        {
+            f->count = f->scount = f->cycles = 0;
         }
+    }
 
-        s = s->hh.next;
+    for ( struct subcall *s = subcallList; s; s = s->hh.next )
+    {
+        s->myCost = s->count = 0;
+    }
+}
+// ====================================================================================================
+void ext_ff_scaleCounts( struct execEntryHash *insthead, struct subcall *subcallList, double scale )
+
+/* Scale the counts up, for when they were only taken over part of what happened */
+
+#define SCALE(x) ( x ) = ( uint64_t )( ( x ) * scale + 0.5 )
+
+{
+    for ( struct execEntryHash *f = insthead; f; f = f->hh.next )
+    {
+        if ( f->addr != INTERRUPT )
+        {
+            SCALE( f->count );
+            SCALE( f->scount );
+            SCALE( f->cycles );
+        }
     }
 
+    for ( struct subcall *s = subcallList; s; s = s->hh.next )
+    {
+        SCALE( s->myCost );
+        SCALE( s->count );
+    }
+}
+
+#undef SCALE
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Coverage support
+// ====================================================================================================
+// ====================================================================================================
+static void _covHeader( struct SymbolSet *ss, struct covHeader *h )
+
+{
+    h->magic     = COV_MAGIC;
+    h->insnCount = ss->insnCount;
+    h->firstAddr = ( ss->insnCount ) ? ss->insns[0].assy->addr : 0;
+    h->lastAddr  = ( ss->insnCount ) ? ss->insns[ss->insnCount - 1].assy->addr : 0;
+}
+// ====================================================================================================
+bool ext_ff_mergeCoverage( char *covfile, uint8_t *cov, struct SymbolSet *ss )
+
+/* Add in the coverage from earlier runs, if covfile has any for this same program */
+
+{
+    struct covHeader h, want;
+    uint8_t *prev;
+    bool ok;
+    FILE *c;
+
+    if ( ( !covfile ) || ( !( c = fopen( covfile, "rb" ) ) ) )
+    {
+        return false;
+    }
+
+    _covHeader( ss, &want );
+    prev = ( uint8_t * )malloc( ss->insnCount + 1 );
+    ok = ( prev ) && ( 1 == fread( &h, sizeof( h ), 1, c ) ) && ( !memcmp( &h, &want, sizeof( h ) ) ) &&
+         ( ss->insnCount == fread( prev, 1, ss->insnCount, c ) );
     fclose( c );
 
-    return true;
+    if ( ok )
+    {
+        for ( uint32_t i = 0; i < ss->insnCount; i++ )
+        {
+            cov[i] |= prev[i];
+        }
+    }
+
+    free( prev );
+    return ok;
+}
+// ====================================================================================================
+bool ext_ff_outputCoverage( char *covfile, uint8_t *cov, struct SymbolSet *ss )
+
+/* Write the coverage map, so later runs can add to it */
+
+{
+    struct covHeader h;
+    char *tmpname;
+    FILE *c;
+
+    if ( ( !covfile ) || ( !( c = _openAtomic( covfile, &tmpname ) ) ) )
+    {
+        return false;
+    }
+
+    _covHeader( ss, &h );
+    fwrite( &h, sizeof( h ), 1, c );
+    fwrite( cov, 1, ss->insnCount, c );
+    return _closeAtomic( c, covfile, tmpname );
+}
+// ====================================================================================================
+bool ext_ff_outputLcov( char *lcovfile, char *deleteMaterial, uint8_t *cov, struct SymbolSet *ss )
+
+/* Output coverage in lcov tracefile format, a line being hit if any of its instructions were. Each */
+/* conditional branch is a pair of lcov branches, taken and not taken.                              */
+
+{
+    struct covLine *l;
+    uint32_t n = 0, lf = 0, lh = 0, brf = 0, brh = 0;
+    char *tmpname;
+    FILE *c;
+
+    if ( !lcovfile )
+    {
+        return false;
+    }
+
+    l = ( struct covLine * )malloc( ( ss->insnCount + 1 ) * sizeof( struct covLine ) );
+    MEMCHECK( l, false );
+
+    for ( uint32_t i = 0; i < ss->insnCount; i++ )
+    {
+        const struct sourceLineEntry *src = &ss->sources[ss->insns[i].sourceIdx];
+
+        if ( ( src->fileIdx != NO_FILE ) && ( src->lineNo != NO_LINE ) )
+        {
+            l[n].fileIdx = src->fileIdx;
+            l[n].lineNo  = src->lineNo;
+            l[n++].insn  = i;
+        }
+    }
+
+    qsort( l, n, sizeof( struct covLine ), _cov_line_sort_fn );
+
+    if ( !( c = _openAtomic( lcovfile, &tmpname ) ) )
+    {
+        free( l );
+        return false;
+    }
+
+    fprintf( c, "TN:\n" );
+
+    for ( uint32_t i = 0; i < n; )
+    {
+        /* Everything on this line, and whether any of it ran */
+        uint32_t j, b = 0;
+        bool hit = false;
+
+        for ( j = i; ( j < n ) && ( l[j].fileIdx == l[i].fileIdx ) && ( l[j].lineNo == l[i].lineNo ); j++ )
+        {
+            hit |= ( cov[l[j].insn] & COV_EXECUTED ) != 0;
+        }
+
+        if ( ( !i ) || ( l[i].fileIdx != l[i - 1].fileIdx ) )
+        {
+            fprintf( c, "SF:%s%s\n", deleteMaterial ? deleteMaterial : "", SymbolFilename( ss, l[i].fileIdx ) );
+        }
+
+        fprintf( c, "DA:%" PRIu32 ",%d\n", l[i].lineNo, hit ? 1 : 0 );
+        lf++;
+        lh += hit;
+
+        for ( ; i < j; i++ )
+        {
+            uint8_t f = cov[l[i].insn];
+
+            if ( !_isConditional( ss->insns[l[i].insn].assy ) )
+            {
+                continue;
+            }
+
+            if ( f & COV_EXECUTED )
+            {
+                fprintf( c, "BRDA:%" PRIu32 ",0,%" PRIu32 ",%d\n", l[i].lineNo, b, ( f & COV_TAKEN ) ? 1 : 0 );
+                fprintf( c, "BRDA:%" PRIu32 ",0,%" PRIu32 ",%d\n", l[i].lineNo, b + 1, ( f & COV_NOT_TAKEN ) ? 1 : 0 );
+                brh += ( ( f & COV_TAKEN ) != 0 ) + ( ( f & COV_NOT_TAKEN ) != 0 );
+            }
+            else
+            {
+                fprintf( c, "BRDA:%" PRIu32 ",0,%" PRIu32 ",-\nBRDA:%" PRIu32 ",0,%" PRIu32 ",-\n", l[i].lineNo, b, l[i].lineNo, b + 1 );
+            }
+
+            b += 2;
+            brf += 2;
+        }
+
+        /* ...and the totals at the end of each file */
+        if ( ( i == n ) || ( l[i].fileIdx != l[i - 1].fileIdx ) )
+        {
+            fprintf( c, "BRF:%" PRIu32 "\nBRH:%" PRIu32 "\nLF:%" PRIu32 "\nLH:%" PRIu32 "\nend_of_record\n", brf, brh, lf, lh );
+            lf = lh = brf = brh = 0;
+        }
+    }
+
+    free( l );
+    return _closeAtomic( c, lcovfile, tmpname );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Call stack support
+// ====================================================================================================
+// ====================================================================================================
+void ext_ff_stackInit( struct stackTree *t )
+
+{
+    memset( t, 0, sizeof( struct stackTree ) );
+    t->at = &t->root;
+}
+// ====================================================================================================
+void ext_ff_stackCall( struct stackTree *t, uint32_t addr, uint64_t ticks )
+
+/* A call to addr, at time ticks */
+
+{
+    _stackCharge( t, ticks );
+    t->at = _stackChild( t->at, addr, 0 );
+}
+// ====================================================================================================
+void ext_ff_stackReturn( struct stackTree *t, uint64_t ticks )
+
+/* ...and a return from the current context, if there's one to return from */
+
+{
+    _stackCharge( t, ticks );
+
+    /* A thread can't return out of its own root, any more than the tree can */
+    if ( ( t->at->parent ) && ( !t->at->context ) )
+    {
+        t->at = t->at->parent;
+    }
+}
+// ====================================================================================================
+struct stackNode *ext_ff_stackThread( struct stackTree *t, uint32_t context )
+
+{
+    return ( context ) ? _stackChild( &t->root, 0, context ) : &t->root;
+}
+// ====================================================================================================
+void ext_ff_stackSwitch( struct stackTree *t, struct stackNode *to, uint64_t ticks )
+
+/* Another thread is running, from the context it was in (from ext_ff_stackThread, if it's new) */
+
+{
+    _stackCharge( t, ticks );
+    t->at = to;
+}
+// ====================================================================================================
+void ext_ff_stackMerge( struct stackTree *t, struct stackTree *from )
+
+/* Add in the costs from another tree, leaving it as it was. Its current context goes nowhere. */
+
+{
+    struct stackNode **path = NULL;
+    uint32_t alloc = 0;
+    uint32_t depth;
+
+    for ( struct stackNode *n = _stackNext( &from->root ); n; n = _stackNext( n ) )
+    {
+        if ( n->self )
+        {
+            struct stackNode *m = &t->root;
+
+            depth = _stackPath( n, &path, &alloc );
+
+            while ( depth-- )
+            {
+                m = _stackChild( m, path[depth]->addr, path[depth]->context );
+            }
+
+            m->self += n->self;
+        }
+    }
+
+    free( path );
+}
+// ====================================================================================================
+void ext_ff_stackZero( struct stackTree *t )
+
+/* Clear the costs, keeping the contexts and where we are in them */
+
+{
+    for ( struct stackNode *n = &t->root; n; n = _stackNext( n ) )
+    {
+        n->self = 0;
+    }
+}
+// ====================================================================================================
+void ext_ff_stackScale( struct stackTree *t, double scale )
+
+{
+    for ( struct stackNode *n = &t->root; n; n = _stackNext( n ) )
+    {
+        n->self = ( uint64_t )( n->self * scale + 0.5 );
+    }
+}
+// ====================================================================================================
+void ext_ff_stackDelete( struct stackTree *t )
+
+{
+    struct stackNode *n = t->root.children, *p;
+
+    /* Free from the leaves up, taking each out of its parent as it goes */
+    while ( n )
+    {
+        if ( n->children )
+        {
+            n = n->children;
+            continue;
+        }
+
+        p = n->parent;
+        HASH_DEL( p->children, n );
+        free( n );
+        n = ( p->parent ) ? p : p->children;
+    }
+
+    ext_ff_stackInit( t );
+}
+// ====================================================================================================
+bool ext_ff_outputFolded( char *stackfile, struct stackTree *t, struct SymbolSet *ss )
+
+/* Output the tree as folded stacks, a line per context with its callers before it (flamegraph.pl, speedscope) */
+
+{
+    struct stackNode **path = NULL;
+    struct nameEntry ne;
+    const char *name;
+    uint32_t alloc = 0;
+    uint32_t depth;
+    char *tmpname;
+    FILE *c;
+
+    if ( !stackfile )
+    {
+        return false;
+    }
+
+    if ( !( c = _openAtomic( stackfile, &tmpname ) ) )
+    {
+        return false;
+    }
+
+    for ( struct stackNode *n = _stackNext( &t->root ); n; n = _stackNext( n ) )
+    {
+        if ( !n->self )
+        {
+            continue;
+        }
+
+        depth = _stackPath( n, &path, &alloc );
+
+        while ( depth-- )
+        {
+            if ( path[depth]->context )
+            {
+                fprintf( c, "context:0x%08x%c", path[depth]->context, depth ? ';' : ' ' );
+            }
+            else if ( ( name = _stackName( ss, path[depth]->addr, &ne ) ) )
+            {
+                fprintf( c, "%s%c", name, depth ? ';' : ' ' );
+            }
+            else
+            {
+                fprintf( c, "0x%08x%c", path[depth]->addr, depth ? ';' : ' ' );
+            }
+        }
+
+        fprintf( c, "%" PRIu64 "\n", n->self );
+    }
+
+    free( path );
+    return _closeAtomic( c, stackfile, tmpname );
+}
+// ====================================================================================================
+bool ext_ff_outputPprof( char *pproffile, const char *type, const char *unit, struct stackTree *t, struct SymbolSet *ss )
+
+/* Output the tree as a gzipped pprof profile, with a sample per context. Each function gets a location */
+/* (and the strings it needs) the first time it turns up, so everything is written as the tree is walked. */
+
+{
+    struct pbufID
+    {
+        uint32_t key;                    /* Function address, or string's index in the symbol set */
+        uint64_t id;
+        UT_hash_handle hh;
+    } *locs = NULL, *files = NULL, *l, *lt;
+
+    struct pbuf msg = { 0 }, sub = { 0 }, hdr = { 0 };
+    struct stackNode **path = NULL;
+    struct nameEntry ne;
+    const char *name;
+    uint32_t alloc = 0, depth;
+    uint64_t nextString = 0, nextLoc = 1;
+    int64_t fnString, contextString;
+    uint32_t context;
+    char *tmpname, addrName[16];
+    bool ok = true;
+    gzFile z;
+
+    if ( !pproffile )
+    {
+        return false;
+    }
+
+    tmpname = ( char * )malloc( strlen( pproffile ) + 5 );
+    MEMCHECK( tmpname, false );
+    strcpy( tmpname, pproffile );
+    strcat( tmpname, ".tmp" );
+
+    if ( !( z = gzopen( tmpname, "wb" ) ) )
+    {
+        free( tmpname );
+        return false;
+    }
+
+#define STRING(x) ( _pbRaw( &msg, ( x ), strlen( x ) ), ok = ok && _pbEmit( z, PPROF_STRING_TABLE, &msg, &hdr ), nextString++ )
+
+    /* String 0 is always empty, then what the samples are */
+    STRING( "" );
+    _pbUint( &sub, 1, STRING( type ) );
+    _pbUint( &sub, 2, STRING( unit ) );
+    ok = ok && _pbEmit( z, PPROF_SAMPLE_TYPE, &sub, &hdr );
+    contextString = STRING( "context" );
+
+    for ( struct stackNode *n = _stackNext( &t->root ); ( ok ) && ( n ); n = _stackNext( n ) )
+    {
+        if ( !n->self )
+        {
+            continue;
+        }
+
+        depth = _stackPath( n, &path, &alloc );
+
+        /* A thread isn't a location, it's a label on the samples from it */
+        context = ( ( depth ) && ( path[depth - 1]->context ) ) ? path[--depth]->context : 0;
+
+        /* Make sure there's a location for everything on the path, leaf first as pprof wants them */
+        for ( uint32_t i = 0; i < depth; i++ )
+        {
+            HASH_FIND_INT( locs, &path[i]->addr, l );
+
+            if ( l )
+            {
+                continue;
+            }
+
+            if ( !( name = _stackName( ss, path[i]->addr, &ne ) ) )
+            {
+                snprintf( addrName, sizeof( addrName ), "0x%08x", path[i]->addr );
+                name = addrName;
+            }
+
+            fnString = STRING( name );
+
+            /* Filenames are shared by lots of functions, so they're only written once */
+            HASH_FIND_INT( files, &ne.fileindex, lt );
+
+            if ( !lt )
+            {
+                lt = ( struct pbufID * )calloc( 1, sizeof( struct pbufID ) );
+                MEMCHECK( lt, false );
+                lt->key = ne.fileindex;
+                lt->id = ( ne.fileindex == NO_FILE ) ? 0 : STRING( SymbolFilename( ss, ne.fileindex ) );
+                HASH_ADD_INT( files, key, lt );
+            }
+
+            l = ( struct pbufID * )calloc( 1, sizeof( struct pbufID ) );
+            MEMCHECK( l, false );
+            l->key = path[i]->addr;
+            l->id = nextLoc++;
+            HASH_ADD_INT( locs, key, l );
+
+            /* Function and location share an id, since there's one location per function */
+            _pbUint( &sub, 1, l->id );
+            _pbUint( &sub, 2, fnString );
+            _pbUint( &sub, 4, lt->id );
+            _pbUint( &sub, 5, ne.line );
+            ok = ok && _pbEmit( z, PPROF_FUNCTION, &sub, &hdr );
+
+            _pbUint( &msg, 1, l->id );
+            _pbUint( &msg, 3, path[i]->addr );
+            _pbUint( &sub, 1, l->id );
+            _pbUint( &sub, 2, ne.line );
+            _pbBytes( &msg, 4, sub.d, sub.len );
+            sub.len = 0;
+            ok = ok && _pbEmit( z, PPROF_LOCATION, &msg, &hdr );
+        }
+
+        /* ...then the sample itself, with its location ids and value packed */
+        for ( uint32_t i = 0; i < depth; i++ )
+        {
+            HASH_FIND_INT( locs, &path[i]->addr, l );
+            _pbVarint( &sub, l->id );
+        }
+
+        _pbBytes( &msg, 1, sub.d, sub.len );
+        sub.len = 0;
+        _pbVarint( &sub, n->self );
+        _pbBytes( &msg, 2, sub.d, sub.len );
+        sub.len = 0;
+
+        if ( context )
+        {
+            _pbUint( &sub, 1, contextString );
+            _pbUint( &sub, 3, context );
+            _pbBytes( &msg, 3, sub.d, sub.len );
+            sub.len = 0;
+        }
+
+        ok = ok && _pbEmit( z, PPROF_SAMPLE, &msg, &hdr );
+    }
+
+#undef STRING
+
+    ok = ( Z_OK == gzclose( z ) ) && ok;
+    ok = ok && ( 0 == rename( tmpname, pproffile ) );
+
+    if ( !ok )
+    {
+        remove( tmpname );
+    }
+
+    HASH_ITER( hh, locs, l, lt )
+    {
+        HASH_DEL( locs, l );
+        free( l );
+    }
+
+    HASH_ITER( hh, files, l, lt )
+    {
+        HASH_DEL( files, l );
+        free( l );
+    }
+
+    free( tmpname );
+    free( path );
+    free( msg.d );
+    free( sub.d );
+    free( hdr.d );
+    return ok;
 }
 // ====================================================================================================
@@ -4,6 +4,12 @@
  * Filewriter for ITM channels
  * ===========================
  *
+ * What the target writes is collected into a buffer per file, and each buffer is handed to a worker
+ * thread once it's full (or the file is closed), which does the actual write. Anything slow on the
+ * host side (a busy disk, fsyncs) then holds up the worker rather than the decode. The worker likes
+ * to run ahead of the data, but if it can't so much as get a buffer back then data is dropped, and
+ * said so, rather than stalling the decode.
+ *
  */
 
 #include <stdio.h>
@@ -11,9 +17,15 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <libgen.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "itmDecoder.h"
 #include "generics.h"
+#include "bufPool.h"
 #include "fileWriter.h"
 
 enum fwState { FW_STATE_CLOSED, FW_STATE_GETNAMEA, FW_STATE_GETNAMEE, FW_STATE_UNLINK, FW_STATE_OPEN };
@@ -22,17 +34,63 @@ enum fwState { FW_STATE_CLOSED, FW_STATE_GETNAMEA, FW_STATE_GETNAMEE, FW_STATE_U
 #define MAX_STRLEN 4096
 #define MAX_CONCAT_FILENAMELEN (MAX_STRLEN)
 
+#define FW_BUF_LEN      (256*1024)          /* Size of each write-behind buffer */
+#define FW_MAX_BUFS     (64)                /* Most buffers there can be between all of the files */
+#define FW_PREALLOC     (16*1024*1024)      /* How much disk is reserved at a time, if it's asked for */
+#define FW_DIRECT_ALIGN (4096)              /* Alignment that O_DIRECT writes are kept to */
+
+/* An open file, as the worker sees it. It belongs to the worker once it's been told to close it */
+struct fwSink
+{
+    int fd;
+    char *name;                             /* For reporting */
+    uint64_t size;                          /* How big the file is */
+    uint64_t allocated;                     /* ...and how much disk is reserved for it */
+    bool direct;                            /* Writes are still going direct */
+    bool failed;                            /* A write has failed, which has already been reported */
+};
+
+enum fwJobType { FW_JOB_WRITE, FW_JOB_CLOSE };
+
+struct fwJob
+{
+    struct fwJob *next;
+    enum fwJobType t;
+    struct fwSink *k;
+    uint8_t *d;                             /* Buffer to write, if it's a write */
+    size_t len;
+};
+
 static struct
 {
     struct
     {
         enum fwState s;                     /* Current state of the handle */
-        FILE        *f;                     /* Handle for the handle */
-        char         name[MAX_FILENAMELEN]; /* Filename */
+        struct fwSink *k;                   /* Where its data goes */
+        uint8_t      *b;                    /* Buffer being filled for it */
+        size_t        fill;                 /* ...and how much is in it */
+        char          name[MAX_FILENAMELEN]; /* Filename */
     } file[FW_MAX_FILES];
 
     char            *basedir;     /* Where we are going to put everything */
+    struct fwOptions o;           /* How the files are to be written */
     bool             initialised; /* Have we been initialised? */
+
+    /* Shared with the worker */
+    pthread_t        worker;
+    pthread_mutex_t  l;
+    pthread_cond_t   work;        /* Signalled when there's a job for the worker */
+    struct fwJob    *head;        /* Jobs for it, in the order they're to be done */
+    struct fwJob    *tail;
+    uint8_t         *freeBufs[FW_MAX_BUFS]; /* Buffers that are ready to be filled */
+    int              nfree;
+    int              nbufs;       /* ...and how many there are altogether */
+    bool             stop;
+
+    uint64_t         dropped;     /* Bytes the target wrote that couldn't be kept */
+
+    int              bulkFile;    /* File a bulk write is going to, -1 if it's being thrown away */
+    uint32_t         bulkLeft;    /* ...and how much more of it there is to come */
 } _f;
 
 // ====================================================================================================
@@ -42,6 +100,283 @@ static struct
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static void _sinkWrite( struct fwSink *k, const uint8_t *d, size_t len )
+
+/* On the worker, write the whole of d to the end of the file */
+
+{
+    ssize_t w;
+
+#if defined( O_DIRECT )
+
+    /* Direct writes have to stay aligned, so anything that isn't (i.e. the tail) goes without */
+    if ( ( k->direct ) && ( ( len % FW_DIRECT_ALIGN ) || ( k->size % FW_DIRECT_ALIGN ) ) )
+    {
+        fcntl( k->fd, F_SETFL, fcntl( k->fd, F_GETFL ) & ~O_DIRECT );
+        k->direct = false;
+    }
+
+#endif
+#if defined( LINUX )
+
+    if ( ( _f.o.prealloc ) && ( k->size + len > k->allocated ) )
+    {
+        if ( fallocate( k->fd, FALLOC_FL_KEEP_SIZE, k->size, len + FW_PREALLOC ) == 0 )
+        {
+            k->allocated = k->size + len + FW_PREALLOC;
+        }
+    }
+
+#endif
+
+    while ( len )
+    {
+        if ( ( w = write( k->fd, d, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            if ( !k->failed )
+            {
+                genericsReport( V_WARN, "Failed to write to [%s] (%s)" EOL, k->name, strerror( errno ) );
+                k->failed = true;
+            }
+
+            return;
+        }
+
+        d += w;
+        len -= w;
+        k->size += w;
+    }
+
+    if ( _f.o.sync == FW_SYNC_WRITE )
+    {
+#if defined( LINUX )
+        fdatasync( k->fd );
+#else
+        fsync( k->fd );
+#endif
+    }
+}
+// ====================================================================================================
+static void _sinkClose( struct fwSink *k )
+
+/* On the worker, finish off the file and let it go */
+
+{
+    if ( _f.o.sync != FW_SYNC_NONE )
+    {
+        fsync( k->fd );
+    }
+
+#if defined( LINUX )
+
+    /* Give back whatever was reserved and not used */
+    if ( ( k->allocated > k->size ) && ( ftruncate( k->fd, k->size ) < 0 ) )
+    {
+        genericsReport( V_WARN, "Could not release unused space in [%s] (%s)" EOL, k->name, strerror( errno ) );
+    }
+
+#endif
+    close( k->fd );
+    free( k->name );
+    free( k );
+}
+// ====================================================================================================
+static void *_workerTask( void *arg )
+
+/* Do whatever has been handed over, in order, until told to stop with nothing left to do */
+
+{
+    struct fwJob *j;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &_f.l );
+
+        while ( ( !_f.head ) && ( !_f.stop ) )
+        {
+            pthread_cond_wait( &_f.work, &_f.l );
+        }
+
+        if ( !( j = _f.head ) )
+        {
+            pthread_mutex_unlock( &_f.l );
+            break;
+        }
+
+        if ( !( _f.head = j->next ) )
+        {
+            _f.tail = NULL;
+        }
+
+        pthread_mutex_unlock( &_f.l );
+
+        if ( j->t == FW_JOB_WRITE )
+        {
+            _sinkWrite( j->k, j->d, j->len );
+
+            pthread_mutex_lock( &_f.l );
+            _f.freeBufs[_f.nfree++] = j->d;
+            pthread_mutex_unlock( &_f.l );
+        }
+        else
+        {
+            _sinkClose( j->k );
+        }
+
+        free( j );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _submit( enum fwJobType t, struct fwSink *k, uint8_t *d, size_t len )
+
+/* Hand a job over to the worker */
+
+{
+    struct fwJob *j = ( struct fwJob * )calloc( 1, sizeof( struct fwJob ) );
+    MEMCHECKV( j );
+
+    j->t = t;
+    j->k = k;
+    j->d = d;
+    j->len = len;
+
+    pthread_mutex_lock( &_f.l );
+
+    if ( _f.tail )
+    {
+        _f.tail->next = j;
+    }
+    else
+    {
+        _f.head = j;
+    }
+
+    _f.tail = j;
+    pthread_cond_signal( &_f.work );
+    pthread_mutex_unlock( &_f.l );
+}
+// ====================================================================================================
+static uint8_t *_getBuf( void )
+
+/* Get a buffer to fill, if there's one to be had */
+
+{
+    uint8_t *b = NULL;
+
+    pthread_mutex_lock( &_f.l );
+
+    if ( _f.nfree )
+    {
+        b = _f.freeBufs[--_f.nfree];
+    }
+    else if ( ( _f.nbufs < FW_MAX_BUFS ) && ( ( b = ( uint8_t * )bufPoolAlloc( FW_BUF_LEN, BUFPOOL_PAGE_ALIGN ) ) ) )
+    {
+        _f.nbufs++;
+    }
+
+    pthread_mutex_unlock( &_f.l );
+    return b;
+}
+// ====================================================================================================
+static void _put( uint32_t n, const uint8_t *d, size_t len )
+
+/* Add what the target wrote to the file's buffer, passing it on to be written once it's full */
+
+{
+    while ( len )
+    {
+        if ( ( !_f.file[n].b ) && ( !( _f.file[n].b = _getBuf() ) ) )
+        {
+            /* Only reported the first time, but all of it is counted */
+            if ( !_f.dropped )
+            {
+                genericsReport( V_WARN, "Filewriter can't keep up, data for [%s] is being lost" EOL, _f.file[n].name );
+            }
+
+            _f.dropped += len;
+            return;
+        }
+
+        size_t l = ( len < FW_BUF_LEN - _f.file[n].fill ) ? len : FW_BUF_LEN - _f.file[n].fill;
+        memcpy( &_f.file[n].b[_f.file[n].fill], d, l );
+        _f.file[n].fill += l;
+        d += l;
+        len -= l;
+
+        if ( _f.file[n].fill == FW_BUF_LEN )
+        {
+            _submit( FW_JOB_WRITE, _f.file[n].k, _f.file[n].b, FW_BUF_LEN );
+            _f.file[n].b = NULL;
+            _f.file[n].fill = 0;
+        }
+    }
+}
+// ====================================================================================================
+static void _closeFile( uint32_t n )
+
+/* Send off whatever is left for the file, and then have it closed */
+
+{
+    if ( _f.file[n].fill )
+    {
+        _submit( FW_JOB_WRITE, _f.file[n].k, _f.file[n].b, _f.file[n].fill );
+    }
+    else if ( _f.file[n].b )
+    {
+        pthread_mutex_lock( &_f.l );
+        _f.freeBufs[_f.nfree++] = _f.file[n].b;
+        pthread_mutex_unlock( &_f.l );
+    }
+
+    _submit( FW_JOB_CLOSE, _f.file[n].k, NULL, 0 );
+    _f.file[n].k = NULL;
+    _f.file[n].b = NULL;
+    _f.file[n].fill = 0;
+}
+// ====================================================================================================
+static struct fwSink *_openFile( const char *name, bool append )
+
+/* Open the file, returning NULL if it can't be */
+
+{
+    int flags = O_WRONLY | O_CREAT | ( ( append ) ? O_APPEND : O_TRUNC );
+    struct fwSink *k;
+    struct stat st;
+    int fd = -1;
+
+#if defined( O_DIRECT )
+
+    if ( ( _f.o.direct ) && ( ( fd = open( name, flags | O_DIRECT, 0666 ) ) < 0 ) )
+    {
+        genericsReport( V_INFO, "Cannot write [%s] directly (%s), continuing without" EOL, name, strerror( errno ) );
+    }
+
+#endif
+
+    if ( ( fd < 0 ) && ( ( fd = open( name, flags, 0666 ) ) < 0 ) )
+    {
+        return NULL;
+    }
+
+    k = ( struct fwSink * )calloc( 1, sizeof( struct fwSink ) );
+    MEMCHECK( k, NULL );
+    k->fd = fd;
+    k->name = strdup( name );
+#if defined( O_DIRECT )
+    k->direct = ( fcntl( fd, F_GETFL ) & O_DIRECT ) != 0;
+#endif
+    k->size = ( fstat( fd, &st ) == 0 ) ? st.st_size : 0;
+    k->allocated = k->size;
+    return k;
+}
+// ====================================================================================================
 void _processCompleteName( uint32_t n )
 
 /* We got the whole name from the remote end, so process it */
@@ -66,7 +401,10 @@ void _processCompleteName( uint32_t n )
     /* Make sure we haven't broken out of the current directory          */
     /* Start by getting both the real path of the requested file and the */
     /* real path of the current directory.                               */
-    resolvedName = realpath( dirname( workingName ), NULL );
+    /* ...dirname is allowed to change what it's given, so it gets a copy */
+    char dirName[MAX_CONCAT_FILENAMELEN];
+    strcpy( dirName, workingName );
+    resolvedName = realpath( dirname( dirName ), NULL );
 
     if ( _f.basedir )
     {
@@ -78,7 +416,7 @@ void _processCompleteName( uint32_t n )
     }
 
     /* Now check that the first part matches, up to the length of the comparison Name */
-    bool goodDirectory = ( ( compareName != NULL ) && ( 0 == strncmp( resolvedName, compareName, strlen( compareName ) ) ) );
+    bool goodDirectory = ( ( compareName != NULL ) && ( resolvedName != NULL ) && ( 0 == strncmp( resolvedName, compareName, strlen( compareName ) ) ) );
     free( resolvedName );
     free( compareName );
 
@@ -95,9 +433,9 @@ void _processCompleteName( uint32_t n )
     {
         // -----------------------
         case FW_STATE_GETNAMEA:     // This is a file append operation
-            _f.file[n].f = fopen( workingName, "ab+" );
+            _f.file[n].k = _openFile( workingName, true );
 
-            if ( _f.file[n].f )
+            if ( _f.file[n].k )
             {
                 genericsReport( V_INFO, "File [%s] opened for append" EOL, workingName, n );
                 _f.file[n].s = FW_STATE_OPEN;
@@ -113,9 +451,9 @@ void _processCompleteName( uint32_t n )
 
         // -----------------------
         case FW_STATE_GETNAMEE:     // This is a file replacement operation
-            _f.file[n].f = fopen( workingName, "wb+" );
+            _f.file[n].k = _openFile( workingName, false );
 
-            if ( _f.file[n].f )
+            if ( _f.file[n].k )
             {
                 genericsReport( V_INFO, "File [%s] opened for write" EOL, workingName, n );
                 _f.file[n].s = FW_STATE_OPEN;
@@ -182,6 +520,28 @@ void _handleNameBytes( uint32_t n, uint8_t h, uint8_t *d )
     }
 }
 // ====================================================================================================
+static void _bulkData( struct swMsg *m )
+
+/* Another part of a bulk write has arrived on the bulk channel */
+
+{
+    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value >> 24 ) & 0xff};
+    uint32_t l = ( m->len < _f.bulkLeft ) ? m->len : _f.bulkLeft;
+
+    if ( !_f.bulkLeft )
+    {
+        genericsReport( V_DEBUG, "Bulk data with no bulk write to go with it" EOL );
+        return;
+    }
+
+    if ( _f.bulkFile >= 0 )
+    {
+        _put( _f.bulkFile, d, l );
+    }
+
+    _f.bulkLeft -= l;
+}
+// ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
 // Externally available routines
@@ -195,10 +555,23 @@ bool filewriterProcess( struct swMsg *m )
 {
     /* Split 32-bit word back into its compoenent parts without punning issues */
 
-    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value > 24 ) & 0xff};
+    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value >> 24 ) & 0xff};
 
     uint8_t c = d[0]; /* Extract the control word for convinience */
 
+    if ( m->srcAddr == FW_BULK_CHANNEL )
+    {
+        _bulkData( m );
+        return true;
+    }
+
+    if ( _f.bulkLeft )
+    {
+        /* The target has given up on the bulk write, or some of it was lost on the way */
+        genericsReport( V_WARN, "Bulk write on descriptor %d cut short by %u bytes" EOL, _f.bulkFile, _f.bulkLeft );
+        _f.bulkLeft = 0;
+    }
+
     switch ( FW_MASK_COMMAND( c ) )
     {
         // -----------------------
@@ -206,14 +579,12 @@ bool filewriterProcess( struct swMsg *m )
         case FW_CMD_OPENE:     // Open file for empty write (i.e. flush and write)
             genericsReport( V_DEBUG, "Attempt to open or create file" EOL );
 
-            if ( _f.file[FW_GET_FILEID( c )].f )
+            if ( _f.file[FW_GET_FILEID( c )].k )
             {
                 /* There was a file open, close it */
                 genericsReport( V_WARN, "Attempt to write to descriptor %d while open writing %s" EOL, FW_GET_FILEID( c ),
                                 _f.file[FW_GET_FILEID( c )].name );
-                fclose( _f.file[FW_GET_FILEID( c )].f );
-                _f.file[FW_GET_FILEID( c )].f = NULL;
-                _f.file[FW_GET_FILEID( c )].f = NULL;
+                _closeFile( FW_GET_FILEID( c ) );
             }
 
             memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
@@ -234,7 +605,7 @@ bool filewriterProcess( struct swMsg *m )
         // -----------------------
 
         case FW_CMD_CLOSE:     // Close file
-            if ( !_f.file[FW_GET_FILEID( c )].f )
+            if ( !_f.file[FW_GET_FILEID( c )].k )
             {
                 /* There was no file open, complain */
                 genericsReport( V_DEBUG, "Attempt to close descriptor %d while not open" EOL, FW_GET_FILEID( c ) );
@@ -242,8 +613,7 @@ bool filewriterProcess( struct swMsg *m )
             else
             {
                 genericsReport( V_INFO, "Close %s" EOL,  _f.file[FW_GET_FILEID( c )].name );
-                fclose( _f.file[FW_GET_FILEID( c )].f );
-                _f.file[FW_GET_FILEID( c )].f = NULL;
+                _closeFile( FW_GET_FILEID( c ) );
                 memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
                 _f.file[FW_GET_FILEID( c )].s = FW_STATE_CLOSED;
             }
@@ -282,7 +652,7 @@ bool filewriterProcess( struct swMsg *m )
                 else
                 {
                     genericsReport( V_DEBUG, "Wrote %d bytes on descriptor %d" EOL, FW_GET_BYTES( c ), FW_GET_FILEID( c ) );
-                    fwrite( &d[1], 1, FW_GET_BYTES( c ), _f.file[FW_GET_FILEID( c )].f );
+                    _put( FW_GET_FILEID( c ), &d[1], FW_GET_BYTES( c ) );
                 }
             }
 
@@ -290,6 +660,25 @@ bool filewriterProcess( struct swMsg *m )
 
         // -----------------------
 
+        case FW_CMD_BULK:     // Start of a bulk write to file
+            _f.bulkLeft = d[1] | ( d[2] << 8 ) | ( d[3] << 16 );
+            _f.bulkFile = FW_GET_FILEID( c );
+
+            if ( _f.file[FW_GET_FILEID( c )].s != FW_STATE_OPEN )
+            {
+                /* It still has to be taken, so it can be thrown away */
+                genericsReport( V_WARN, "Request for bulk write on descriptor %d while file closed" EOL, FW_GET_FILEID( c ) );
+                _f.bulkFile = -1;
+            }
+            else
+            {
+                genericsReport( V_DEBUG, "Bulk write of %u bytes on descriptor %d" EOL, _f.bulkLeft, FW_GET_FILEID( c ) );
+            }
+
+            break;
+
+        // -----------------------
+
         default:
         case FW_CMD_NULL:
             break;
@@ -298,14 +687,61 @@ bool filewriterProcess( struct swMsg *m )
     return true;
 }
 // ====================================================================================================
-bool filewriterInit( char *basedir )
+bool filewriterInit( char *basedir, const struct fwOptions *o )
 
 /* Initialise the filewriter */
 
 {
-    _f.initialised = true;
     _f.basedir     = basedir;
+    _f.o           = *o;
+    pthread_mutex_init( &_f.l, NULL );
+    pthread_cond_init( &_f.work, NULL );
+
+    if ( pthread_create( &_f.worker, NULL, _workerTask, NULL ) )
+    {
+        genericsReport( V_ERROR, "Failed to create filewriter thread" EOL );
+        return false;
+    }
+
+    _f.initialised = true;
     genericsReport( V_DEBUG, "Filewriter initialised" EOL );
     return true;
 }
 // ====================================================================================================
+void filewriterShutdown( void )
+
+/* Close anything still open, and wait until it's all written */
+
+{
+    if ( !_f.initialised )
+    {
+        return;
+    }
+
+    for ( uint32_t n = 0; n < FW_MAX_FILES; n++ )
+    {
+        if ( _f.file[n].k )
+        {
+            _closeFile( n );
+        }
+    }
+
+    pthread_mutex_lock( &_f.l );
+    _f.stop = true;
+    pthread_cond_signal( &_f.work );
+    pthread_mutex_unlock( &_f.l );
+    pthread_join( _f.worker, NULL );
+
+    while ( _f.nfree )
+    {
+        bufPoolFree( _f.freeBufs[--_f.nfree] );
+    }
+
+    if ( _f.dropped )
+    {
+        genericsReport( V_WARN, "Filewriter lost %" PRIu64 " bytes in all" EOL, _f.dropped );
+    }
+
+    _f.initialised = false;
+}
+// ====================================================================================================
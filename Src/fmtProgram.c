@@ -0,0 +1,490 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Channel Format Programs
+ * =======================
+ *
+ * Integer conversions with no more than a width and a '0' or '-' flag are done here, everything
+ * else goes to snprintf with just its own conversion spec. Lengths are always clipped the way
+ * snprintf would have clipped them.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "generics.h"
+#include "fmtProgram.h"
+
+#define MAX_ARGS  (4)                              /* The whole format only ever had this many arguments */
+#define MAX_WIDTH (64)                             /* Widest field that's done here */
+#define MAX_DIGITS (11)                            /* Longest integer, sign included */
+
+enum fmtMode { FMT_MODE_INT, FMT_MODE_FLOAT, FMT_MODE_CHAR };
+
+enum fmtOp
+{
+    FMT_LIT,                                       /* Literal text */
+    FMT_DEC,                                       /* %d or %i */
+    FMT_UDEC,                                      /* %u */
+    FMT_HEX,                                       /* %x */
+    FMT_HEXU,                                      /* %X */
+    FMT_CHAR,                                      /* %c */
+    FMT_SPEC                                       /* Anything else, done by snprintf */
+};
+
+struct fmtStep
+{
+    enum fmtOp op;
+    const char *s;                                 /* Literal text, or the conversion spec for FMT_SPEC */
+    size_t len;                                    /* ...and its length */
+    int width;                                     /* Field width */
+    bool zero;                                     /* Pad with zeros rather than spaces */
+    bool left;                                     /* Left justify in the field */
+};
+
+struct fmtProgram
+{
+    enum fmtMode mode;
+    bool whole;                                    /* Format is given to snprintf whole, as it always was */
+    char *fmt;                                     /* The original format */
+    char *text;                                    /* Literals and specs the steps point into */
+    int numSteps;
+    struct fmtStep step[];
+};
+
+static const char _digitPairs[] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static int _dec( uint32_t v, char *e )
+
+/* Write v in decimal backwards from just before e, returning how many digits that was */
+
+{
+    char *p = e;
+
+    while ( v >= 100 )
+    {
+        p -= 2;
+        memcpy( p, &_digitPairs[( v % 100 ) * 2], 2 );
+        v /= 100;
+    }
+
+    if ( v >= 10 )
+    {
+        p -= 2;
+        memcpy( p, &_digitPairs[v * 2], 2 );
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+
+    return e - p;
+}
+// ====================================================================================================
+static int _hex( uint32_t v, char *e, const char *digits )
+
+{
+    char *p = e;
+
+    do
+    {
+        *--p = digits[v & 0xf];
+        v >>= 4;
+    }
+    while ( v );
+
+    return e - p;
+}
+// ====================================================================================================
+static void _put( char *o, size_t *n, size_t max, const char *s, size_t len )
+
+/* Add len of s to the output, as much as will fit */
+
+{
+    if ( *n + len >= max )
+    {
+        len = ( *n + 1 < max ) ? max - 1 - *n : 0;
+    }
+
+    memcpy( &o[*n], s, len );
+    *n += len;
+}
+// ====================================================================================================
+static void _pad( char *o, size_t *n, size_t max, char c, int count )
+
+{
+    while ( ( count-- > 0 ) && ( *n + 1 < max ) )
+    {
+        o[( *n )++] = c;
+    }
+}
+// ====================================================================================================
+static void _field( const struct fmtStep *s, char *o, size_t *n, size_t max, const char *d, int len )
+
+/* Put a converted value into its field. A leading '-' stays in front of any zero padding */
+
+{
+    int pad = s->width - len;
+
+    if ( s->left )
+    {
+        _put( o, n, max, d, len );
+        _pad( o, n, max, ' ', pad );
+    }
+    else if ( s->zero )
+    {
+        if ( *d == '-' )
+        {
+            _put( o, n, max, d++, 1 );
+            len--;
+        }
+
+        _pad( o, n, max, '0', pad );
+        _put( o, n, max, d, len );
+    }
+    else
+    {
+        _pad( o, n, max, ' ', pad );
+        _put( o, n, max, d, len );
+    }
+}
+// ====================================================================================================
+static void _runSteps( const struct fmtProgram *p, uint32_t v, float f, char *o, size_t *n, size_t max )
+
+/* One pass through the program, with v (or f) as the argument to every conversion */
+
+{
+    char d[MAX_DIGITS];
+    char *e = &d[MAX_DIGITS];
+    int len, r;
+
+    for ( const struct fmtStep *s = p->step; s < &p->step[p->numSteps]; s++ )
+    {
+        switch ( s->op )
+        {
+            case FMT_LIT:
+                _put( o, n, max, s->s, s->len );
+                continue;
+
+            case FMT_DEC:
+                if ( ( int32_t )v < 0 )
+                {
+                    len = _dec( -( uint32_t )v, e );
+                    e[-++len] = '-';
+                }
+                else
+                {
+                    len = _dec( v, e );
+                }
+
+                break;
+
+            case FMT_UDEC:
+                len = _dec( v, e );
+                break;
+
+            case FMT_HEX:
+                len = _hex( v, e, "0123456789abcdef" );
+                break;
+
+            case FMT_HEXU:
+                len = _hex( v, e, "0123456789ABCDEF" );
+                break;
+
+            case FMT_CHAR:
+                e[-1] = ( char )v;
+                len = 1;
+                break;
+
+            default:
+                r = ( p->mode == FMT_MODE_FLOAT ) ? snprintf( &o[*n], max - *n, s->s, f ) : snprintf( &o[*n], max - *n, s->s, v );
+                *n += ( r < 0 ) ? 0 : ( ( size_t )r < max - *n ) ? ( size_t )r : max - 1 - *n;
+                continue;
+        }
+
+        _field( s, o, n, max, e - len, len );
+    }
+}
+// ====================================================================================================
+static size_t _runWhole( const struct fmtProgram *p, uint32_t value, int len, char *o, size_t max )
+
+/* The format couldn't be taken apart, so it's done in one go */
+
+{
+    size_t n = 0;
+    int r;
+
+    if ( p->mode == FMT_MODE_FLOAT )
+    {
+        /* type punning on same host, after correctly building 32bit val
+         * only unsafe on systems where u32/float have diff byte order */
+        float *nastycast = ( float * )&value;
+        r = snprintf( o, max, p->fmt, *nastycast, *nastycast, *nastycast, *nastycast );
+        n = ( r < 0 ) ? 0 : r;
+    }
+    else if ( p->mode == FMT_MODE_CHAR )
+    {
+        int l = 0;
+
+        do
+        {
+            uint8_t c = value >> ( 8 * l );
+            r = snprintf( &o[n], max - n, p->fmt, c, c, c, c );
+            n += ( r < 0 ) ? 0 : r;
+        }
+        while ( ( ++l < len ) && ( n < max ) );
+    }
+    else
+    {
+        r = snprintf( o, max, p->fmt, value, value, value, value );
+        n = ( r < 0 ) ? 0 : r;
+    }
+
+    return ( n < max ) ? n : max - 1;
+}
+// ====================================================================================================
+static bool _parseSpec( struct fmtProgram *p, const char *f, size_t *used, struct fmtStep *s, char **t )
+
+/* Parse the conversion spec at f into s, returning false if it isn't something we can take apart */
+
+{
+    const char *c = f + 1;
+    bool other = false;
+
+    memset( s, 0, sizeof( struct fmtStep ) );
+
+    for ( ; ( *c ) && ( strchr( "-+ #0", *c ) ); c++ )
+    {
+        s->left  |= ( *c == '-' );
+        s->zero  |= ( *c == '0' );
+        other    |= ( ( *c != '-' ) && ( *c != '0' ) );
+    }
+
+    for ( ; ( *c >= '0' ) && ( *c <= '9' ); c++ )
+    {
+        s->width = s->width * 10 + ( *c - '0' );
+
+        if ( s->width > MAX_WIDTH )
+        {
+            return false;
+        }
+    }
+
+    if ( *c == '.' )
+    {
+        for ( other = true, c++; ( *c >= '0' ) && ( *c <= '9' ); c++ );
+    }
+
+    /* Argument positions, * widths and length modifiers change what the arguments are taken to be */
+    if ( ( !*c ) || ( strchr( "*$hlLqjzt", *c ) ) )
+    {
+        return false;
+    }
+
+    switch ( *c )
+    {
+        case 'd':
+        case 'i':
+            s->op = FMT_DEC;
+            break;
+
+        case 'u':
+            s->op = FMT_UDEC;
+            break;
+
+        case 'x':
+            s->op = FMT_HEX;
+            break;
+
+        case 'X':
+            s->op = FMT_HEXU;
+            break;
+
+        case 'c':
+            s->op = FMT_CHAR;
+            other |= s->zero;
+            break;
+
+        case 'o':
+            s->op = FMT_SPEC;
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+
+            /* Only a float if it was going to be passed one */
+            if ( p->mode != FMT_MODE_FLOAT )
+            {
+                return false;
+            }
+
+            s->op = FMT_SPEC;
+            break;
+
+        default:
+            /* Strings, pointers and %n don't go anywhere good with an integer */
+            return false;
+    }
+
+    s->zero &= !s->left;
+    *used = c + 1 - f;
+
+    if ( ( other ) || ( p->mode == FMT_MODE_FLOAT ) )
+    {
+        s->op = FMT_SPEC;
+    }
+
+    if ( s->op == FMT_SPEC )
+    {
+        /* snprintf gets a copy of just this conversion */
+        memcpy( *t, f, *used );
+        s->s = *t;
+        s->len = *used;
+        ( *t )[*used] = 0;
+        *t += *used + 1;
+    }
+
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct fmtProgram *fmtProgramCompile( const char *fmt )
+
+/* Turn a format into a program for fmtProgramRun */
+
+{
+    size_t l = strlen( fmt ), used;
+    struct fmtProgram *p = ( struct fmtProgram * )calloc( 1, sizeof( struct fmtProgram ) + ( l + 1 ) * sizeof( struct fmtStep ) );
+    struct fmtStep *s;
+    int args = 0;
+    char *t;
+
+    MEMCHECK( p, NULL );
+    p->fmt  = strdup( fmt );
+    p->text = t = ( char * )malloc( 2 * l + 2 );
+    MEMCHECK( p->fmt, NULL );
+    MEMCHECK( p->text, NULL );
+
+    /* This is the same test that has always decided how the value is passed */
+    p->mode = ( strstr( fmt, "%f" ) ) ? FMT_MODE_FLOAT : ( strstr( fmt, "%c" ) ) ? FMT_MODE_CHAR : FMT_MODE_INT;
+
+    while ( *fmt )
+    {
+        s = &p->step[p->numSteps];
+
+        if ( ( *fmt != '%' ) || ( fmt[1] == '%' ) )
+        {
+            /* Literal text, which can go on the end of the previous literal */
+            if ( ( !p->numSteps ) || ( s[-1].op != FMT_LIT ) )
+            {
+                memset( s, 0, sizeof( struct fmtStep ) );
+                s->op = FMT_LIT;
+                s->s = t;
+                p->numSteps++;
+            }
+            else
+            {
+                s--;
+            }
+
+            *t++ = *fmt;
+            s->len++;
+            fmt += ( *fmt == '%' ) ? 2 : 1;
+            continue;
+        }
+
+        if ( ( ++args > MAX_ARGS ) || ( !_parseSpec( p, fmt, &used, s, &t ) ) )
+        {
+            p->whole = true;
+            break;
+        }
+
+        p->numSteps++;
+        fmt += used;
+    }
+
+    return p;
+}
+// ====================================================================================================
+size_t fmtProgramRun( const struct fmtProgram *p, uint32_t value, int len, char *o, size_t max )
+
+{
+    size_t n = 0;
+    int l = 0;
+
+    if ( !max )
+    {
+        return 0;
+    }
+
+    if ( p->whole )
+    {
+        return _runWhole( p, value, len, o, max );
+    }
+
+    switch ( p->mode )
+    {
+        case FMT_MODE_FLOAT:
+        {
+            /* type punning on same host, after correctly building 32bit val
+             * only unsafe on systems where u32/float have diff byte order */
+            float *nastycast = ( float * )&value;
+            _runSteps( p, value, *nastycast, o, &n, max );
+            break;
+        }
+
+        case FMT_MODE_CHAR:
+
+            /* The whole format is applied to each byte in turn */
+            do
+            {
+                _runSteps( p, ( uint8_t )( value >> ( 8 * l ) ), 0, o, &n, max );
+            }
+            while ( ( ++l < len ) && ( n + 1 < max ) );
+
+            break;
+
+        default:
+            _runSteps( p, value, 0, o, &n, max );
+            break;
+    }
+
+    o[n] = 0;
+    return n;
+}
+// ====================================================================================================
+void fmtProgramFree( struct fmtProgram *p )
+
+{
+    if ( p )
+    {
+        free( p->fmt );
+        free( p->text );
+        free( p );
+    }
+}
+// ====================================================================================================
@@ -0,0 +1,381 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Frame Sink
+ * ==========
+ *
+ * PNGs are written as 8 bit RGB, deflated at the fastest level since frames can't be allowed to
+ * back up behind the compression, with zlib providing the deflate and the CRCs.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#ifndef WIN32
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "generics.h"
+#include "frameSink.h"
+
+#define MAX_PATH_LEN (1024)                /* Longest filename made from a pattern */
+
+enum frameSinkKind { FS_SHM, FS_PNG, FS_RAW };
+
+struct frameSink
+{
+    enum frameSinkKind kind;
+    char *where;                           /* Shared memory name, or filename pattern */
+    uint64_t frames;                       /* Frames written */
+
+    struct frameSinkShm *h;                /* The shared memory, if that's where frames go */
+    size_t mapLen;                         /* ...and how much of it is mapped */
+
+    uint8_t *rows;                         /* Lines being put together for a PNG */
+    size_t rowsLen;
+    uint8_t *z;                            /* ...and what they deflate to */
+    size_t zLen;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _patternOK( const char *p )
+
+/* A pattern has to have exactly one conversion, and that has to be a %d with an optional width */
+
+{
+    int n = 0;
+
+    while ( ( p = strchr( p, '%' ) ) )
+    {
+        p++;
+
+        if ( *p == '%' )
+        {
+            p++;
+            continue;
+        }
+
+        while ( ( *p == '0' ) || ( ( *p >= '1' ) && ( *p <= '9' ) ) )
+        {
+            p++;
+        }
+
+        if ( *p != 'd' )
+        {
+            return false;
+        }
+
+        n++;
+    }
+
+    return ( n == 1 );
+}
+// ====================================================================================================
+#ifndef WIN32
+static void _shmClose( struct frameSink *s )
+
+{
+    if ( s->h )
+    {
+        atomic_store( &s->h->stale, 1 );
+        munmap( s->h, s->mapLen );
+        shm_unlink( s->where );
+        s->h = NULL;
+    }
+}
+// ====================================================================================================
+static bool _shmOpen( struct frameSink *s, int w, int h )
+
+/* Make the shared memory for frames of this size, replacing any there was for another size */
+
+{
+    size_t frameLen = ( size_t )w * h * sizeof( uint32_t );
+    int fd;
+
+    _shmClose( s );
+    s->mapLen = FRAMESINK_SHM_HDR_LEN + 2 * frameLen;
+
+    /* Anything left from a previous run is of no use to anyone */
+    shm_unlink( s->where );
+
+    if ( ( ( fd = shm_open( s->where, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) ) < 0 ) ||
+            ( ftruncate( fd, s->mapLen ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Could not create shared memory %s (%s)" EOL, s->where, strerror( errno ) );
+
+        if ( fd >= 0 )
+        {
+            close( fd );
+            shm_unlink( s->where );
+        }
+
+        return false;
+    }
+
+    s->h = ( struct frameSinkShm * )mmap( NULL, s->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if ( s->h == MAP_FAILED )
+    {
+        genericsReport( V_ERROR, "Could not map shared memory %s (%s)" EOL, s->where, strerror( errno ) );
+        shm_unlink( s->where );
+        s->h = NULL;
+        return false;
+    }
+
+    s->h->version = FRAMESINK_SHM_VERSION;
+    s->h->width   = w;
+    s->h->height  = h;
+    s->h->pitch   = w * sizeof( uint32_t );
+    atomic_store( &s->h->front, 0 );
+    atomic_store( &s->h->seq, 0 );
+    atomic_store( &s->h->magic, FRAMESINK_SHM_MAGIC );
+    return true;
+}
+// ====================================================================================================
+static bool _shmWrite( struct frameSink *s, const uint32_t *pixels, int w, int h )
+
+{
+    size_t frameLen = ( size_t )w * h * sizeof( uint32_t );
+    uint32_t back;
+
+    if ( ( ( !s->h ) || ( s->h->width != ( uint32_t )w ) || ( s->h->height != ( uint32_t )h ) ) && ( !_shmOpen( s, w, h ) ) )
+    {
+        return false;
+    }
+
+    back = atomic_load_explicit( &s->h->front, memory_order_relaxed ) ^ 1;
+    memcpy( ( uint8_t * )s->h + FRAMESINK_SHM_HDR_LEN + back * frameLen, pixels, frameLen );
+    atomic_store_explicit( &s->h->front, back, memory_order_release );
+    atomic_fetch_add_explicit( &s->h->seq, 1, memory_order_release );
+    return true;
+}
+#endif
+// ====================================================================================================
+static bool _chunk( FILE *f, const char *type, const uint8_t *d, uint32_t len )
+
+/* Write one PNG chunk, which is its length, type, data and the CRC of the type and data */
+
+{
+    uint8_t be[4] = { len >> 24, len >> 16, len >> 8, len };
+    uLong crc = crc32( 0, ( const Bytef * )type, 4 );
+
+    /* zlib takes a NULL buffer as asking for the initial value, so an empty chunk mustn't pass one */
+    if ( len )
+    {
+        crc = crc32( crc, d, len );
+    }
+
+    if ( ( fwrite( be, 4, 1, f ) != 1 ) || ( fwrite( type, 4, 1, f ) != 1 ) || ( ( len ) && ( fwrite( d, len, 1, f ) != 1 ) ) )
+    {
+        return false;
+    }
+
+    be[0] = crc >> 24;
+    be[1] = crc >> 16;
+    be[2] = crc >> 8;
+    be[3] = crc;
+    return ( fwrite( be, 4, 1, f ) == 1 );
+}
+// ====================================================================================================
+static bool _pngWrite( struct frameSink *s, FILE *f, const uint32_t *pixels, int w, int h )
+
+{
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    uint8_t ihdr[13] = { w >> 24, w >> 16, w >> 8, w, h >> 24, h >> 16, h >> 8, h, 8, 2, 0, 0, 0 };
+    size_t rowsLen = ( size_t )h * ( 1 + w * 3 );
+    uLongf zLen = compressBound( rowsLen );
+    uint8_t *r;
+
+    if ( rowsLen > s->rowsLen )
+    {
+        free( s->rows );
+        s->rows = ( uint8_t * )malloc( s->rowsLen = rowsLen );
+        MEMCHECK( s->rows, false );
+    }
+
+    if ( zLen > s->zLen )
+    {
+        free( s->z );
+        s->z = ( uint8_t * )malloc( s->zLen = zLen );
+        MEMCHECK( s->z, false );
+    }
+
+    /* Each line starts with its filter type, which is always none */
+    for ( int y = 0; y < h; y++ )
+    {
+        r = &s->rows[y * ( 1 + w * 3 )];
+        *r++ = 0;
+
+        for ( int x = 0; x < w; x++ )
+        {
+            uint32_t p = *pixels++;
+            *r++ = p >> 16;
+            *r++ = p >> 8;
+            *r++ = p;
+        }
+    }
+
+    if ( Z_OK != compress2( s->z, &zLen, s->rows, rowsLen, Z_BEST_SPEED ) )
+    {
+        return false;
+    }
+
+    return ( fwrite( sig, sizeof( sig ), 1, f ) == 1 ) &&
+           _chunk( f, "IHDR", ihdr, sizeof( ihdr ) ) &&
+           _chunk( f, "IDAT", s->z, zLen ) &&
+           _chunk( f, "IEND", NULL, 0 );
+}
+// ====================================================================================================
+static bool _fileWrite( struct frameSink *s, const uint32_t *pixels, int w, int h )
+
+{
+    char n[MAX_PATH_LEN];
+    bool ok;
+    FILE *f;
+
+    snprintf( n, sizeof( n ), s->where, ( int )s->frames );
+
+    if ( !( f = fopen( n, "wb" ) ) )
+    {
+        genericsReport( V_ERROR, "Could not open %s (%s)" EOL, n, strerror( errno ) );
+        return false;
+    }
+
+    if ( s->kind == FS_PNG )
+    {
+        ok = _pngWrite( s, f, pixels, w, h );
+    }
+    else
+    {
+        ok = ( fwrite( pixels, sizeof( uint32_t ), ( size_t )w * h, f ) == ( size_t )w * h );
+    }
+
+    if ( ( fclose( f ) ) || ( !ok ) )
+    {
+        genericsReport( V_ERROR, "Could not write %s" EOL, n );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct frameSink *frameSinkCreate( const char *spec )
+
+{
+    struct frameSink *s;
+    const char *c = strchr( spec, ':' );
+    enum frameSinkKind kind;
+
+    if ( ( c ) && ( c - spec == 3 ) && ( !strncmp( spec, "shm", 3 ) ) )
+    {
+        kind = FS_SHM;
+    }
+    else if ( ( c ) && ( c - spec == 3 ) && ( !strncmp( spec, "png", 3 ) ) )
+    {
+        kind = FS_PNG;
+    }
+    else if ( ( c ) && ( c - spec == 3 ) && ( !strncmp( spec, "raw", 3 ) ) )
+    {
+        kind = FS_RAW;
+    }
+    else
+    {
+        genericsReport( V_ERROR, "Frame output should be shm:<name>, png:<pattern> or raw:<pattern>" EOL );
+        return NULL;
+    }
+
+    if ( !c[1] )
+    {
+        genericsReport( V_ERROR, "Nowhere given for frame output" EOL );
+        return NULL;
+    }
+
+#ifdef WIN32
+
+    if ( kind == FS_SHM )
+    {
+        genericsReport( V_ERROR, "Frames can't be put in shared memory on this platform" EOL );
+        return NULL;
+    }
+
+#endif
+
+    if ( ( kind != FS_SHM ) && ( !_patternOK( c + 1 ) ) )
+    {
+        genericsReport( V_ERROR, "Filename pattern needs one %%d for the frame number, e.g. lcd%%05d.png" EOL );
+        return NULL;
+    }
+
+    s = ( struct frameSink * )calloc( 1, sizeof( struct frameSink ) );
+    MEMCHECK( s, NULL );
+    s->kind = kind;
+    s->where = strdup( c + 1 );
+    MEMCHECK( s->where, NULL );
+    return s;
+}
+// ====================================================================================================
+bool frameSinkWrite( struct frameSink *s, const uint32_t *pixels, int w, int h )
+
+{
+    bool ok;
+
+#ifndef WIN32
+
+    if ( s->kind == FS_SHM )
+    {
+        ok = _shmWrite( s, pixels, w, h );
+    }
+    else
+#endif
+    {
+        ok = _fileWrite( s, pixels, w, h );
+    }
+
+    if ( ok )
+    {
+        s->frames++;
+    }
+
+    return ok;
+}
+// ====================================================================================================
+uint64_t frameSinkFrames( struct frameSink *s )
+
+{
+    return s->frames;
+}
+// ====================================================================================================
+void frameSinkDelete( struct frameSink *s )
+
+{
+    if ( s )
+    {
+#ifndef WIN32
+        _shmClose( s );
+#endif
+        free( s->rows );
+        free( s->z );
+        free( s->where );
+        free( s );
+    }
+}
+// ====================================================================================================
@@ -4,6 +4,12 @@
  * Generic Routines
  * ================
  *
+ * Reports don't go straight out. Each thread formats its own into a buffer of its own and puts the
+ * result on a lock-free queue, and a background thread writes them out. That way a thread in the
+ * data path never waits for a terminal. genericsPrintf output is written directly, after whatever
+ * reports are still queued, so the two stay in order. If the queue is full reports are counted and
+ * dropped, except errors, which are written directly.
+ *
  */
 
 #include <stdarg.h>
@@ -11,6 +17,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #ifdef WIN32
     #include <Windows.h>
@@ -27,9 +36,35 @@
 
 #define MAX_STRLEN (_POSIX_ARG_MAX) // Maximum length of debug string
 
+#define REPORT_SLOTS        (256)                  /* Reports that can be queued, a power of 2 */
+#define REPORT_SLOT_LEN     (240)                  /* Longest report that can be queued, longer ones are written directly */
+#define REPORT_FLUSH_MS     (50)                   /* Longest the flusher sleeps if it misses being woken */
+
 /* Flag indicating if active screen handling is in use */
 bool _screenHandling;
 
+/* One queued report, ready to write */
+struct reportSlot
+{
+    atomic_size_t seq;                             /* Which pass round the queue this slot is ready for */
+    uint16_t len;
+    char d[REPORT_SLOT_LEN];
+};
+
+static struct
+{
+    struct reportSlot s[REPORT_SLOTS];
+    atomic_size_t wp;                              /* Next slot to be claimed by a writer */
+    atomic_size_t rp;                              /* Next slot to be written out, only changed under drain */
+    atomic_uint lost;                              /* Reports dropped because the queue was full */
+
+    pthread_once_t once;
+    pthread_mutex_t drain;                         /* Held by whoever is writing reports out */
+    pthread_mutex_t wakeLock;
+    pthread_cond_t wake;
+    atomic_bool flusherIdle;                       /* The flusher is (about to be) waiting to be woken */
+} _report = { .once = PTHREAD_ONCE_INIT, .drain = PTHREAD_MUTEX_INITIALIZER, .wakeLock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
 // ====================================================================================================
 char *genericsEscape( char *str )
 
@@ -163,13 +198,13 @@ char *genericsUnescape( char *str )
     return workingBuffer;
 }
 // ====================================================================================================
-static enum verbLevel lstore = V_WARN;
+enum verbLevel genericsVerbLevel = V_WARN;
 
 bool genericsSetReportLevel( enum verbLevel lset )
 
 {
     /* Set is respected to maintain historic behaviour, even if out of range */
-    lstore = lset;
+    genericsVerbLevel = lset;
 
     if ( ( lset < V_ERROR ) || ( lset > V_MAX_VERBLEVEL ) )
     {
@@ -182,7 +217,7 @@ bool genericsSetReportLevel( enum verbLevel lset )
 enum verbLevel genericsGetReportLevel( void )
 
 {
-    return lstore;
+    return genericsVerbLevel;
 }
 // ====================================================================================================
 uint64_t genericsTimestampuS( void )
@@ -201,6 +236,14 @@ uint32_t genericsTimestampmS( void )
     return ( te.tv_sec * 1000LL + ( te.tv_usec / 1000 ) );
 }
 // ====================================================================================================
+uint64_t genericsMonotonicnS( void )
+
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+// ====================================================================================================
 static int _htoi( char c )
 
 {
@@ -338,109 +381,316 @@ char *genericsGetBaseDirectory( void )
 #endif
 }
 // ====================================================================================================
-void genericsPrintf( const char *fmt, ... )
+static size_t _render( char *o, size_t max, const char *p )
 
-/* Print to output stream */
+/* Turn the embedded colour and cursor commands in p into control codes (or nothing, if there's */
+/* no screen handling), leaving the result in o.                                                */
 
 {
-    static char op[MAX_STRLEN];
-    char *p = op;
-
-    va_list va;
-    va_start( va, fmt );
-    vsnprintf( op, MAX_STRLEN, fmt, va );
-    va_end( va );
+    size_t n = 0;
+    int l;
 
-    while ( *p )
+    while ( ( *p ) && ( n < max - 1 ) )
     {
         if ( *p != CMD_ALERT[0] )
         {
-            putc( *p++, stderr );
+            o[n++] = *p++;
+            continue;
         }
-        else
+
+        p++;
+        l = 0;
+
+        switch ( *p )
         {
-            p++;
+            case '0'...'9':
+            case 'a'...'f':
+                if ( _screenHandling )
+                {
+                    l = snprintf( &o[n], max - n, CC_COLOUR, _htoi( *p ) > 7, _htoi( *p ) & 7 );
+                }
+
+                p++;
+                break;
 
-            switch ( *p )
-            {
-                case '0'...'9':
-                case 'a'...'f':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stderr, CC_COLOUR, _htoi( *p ) > 7, _htoi( *p ) & 7 );
-                    }
+            case 'u':
+                l = ( _screenHandling ) ? snprintf( &o[n], max - n, CC_PREV_LN ) : 0;
+                p++;
+                break;
 
-                    p++;
-                    break;
+            case 'U':
+                l = ( _screenHandling ) ? snprintf( &o[n], max - n, CC_CLR_LN ) : 0;
+                p++;
+                break;
 
-                case 'u':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stderr, CC_PREV_LN );
-                    }
+            case 'r':
+                l = ( _screenHandling ) ? snprintf( &o[n], max - n, CC_RES ) : 0;
+                p++;
+                break;
 
-                    p++;
-                    break;
+            case 'z':
+                /* We'll take a flyer on it being vt100 compatible */
+                l = snprintf( &o[n], max - n, CC_CLEAR_SCREEN );
+                p++;
+                break;
 
-                case 'U':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stderr, CC_CLR_LN );
-                    }
+            default:
+                break;
+        }
 
-                    p++;
-                    break;
+        n = ( n + l < max - 1 ) ? n + l : max - 1;
+    }
 
-                case 'r':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stderr, CC_RES );
-                    }
+    o[n] = 0;
+    return n;
+}
+// ====================================================================================================
+static void _drain( void )
 
-                    p++;
-                    break;
+/* Write out everything that's been queued, in order. Only one thread does this at a time */
 
-                case 'z':
-                    /* We'll take a flyer on it being vt100 compatible */
-                    fprintf( stderr, CC_CLEAR_SCREEN );
-                    p++;
-                    break;
+{
+    unsigned int lost;
+    bool wrote = false;
+    size_t rp;
 
-                default:
-                    break;
+    pthread_mutex_lock( &_report.drain );
+    rp = atomic_load_explicit( &_report.rp, memory_order_relaxed );
+
+    while ( true )
+    {
+        struct reportSlot *r = &_report.s[rp & ( REPORT_SLOTS - 1 )];
+
+        if ( atomic_load_explicit( &r->seq, memory_order_acquire ) != rp + 1 )
+        {
+            /* Either nothing there, or a writer hasn't finished with it yet */
+            break;
+        }
+
+        fwrite( r->d, 1, r->len, stderr );
+        atomic_store_explicit( &r->seq, rp + REPORT_SLOTS, memory_order_release );
+        atomic_store_explicit( &_report.rp, ++rp, memory_order_relaxed );
+        wrote = true;
+    }
+
+    if ( ( lost = atomic_exchange( &_report.lost, 0 ) ) )
+    {
+        fprintf( stderr, "(%u reports lost)" EOL, lost );
+        wrote = true;
+    }
+
+    if ( wrote )
+    {
+        fflush( stderr );
+    }
+
+    pthread_mutex_unlock( &_report.drain );
+}
+// ====================================================================================================
+static bool _pending( void )
+
+{
+    return ( atomic_load_explicit( &_report.wp, memory_order_relaxed ) != atomic_load_explicit( &_report.rp, memory_order_relaxed ) ) ||
+           ( atomic_load( &_report.lost ) );
+}
+// ====================================================================================================
+static void *_flusher( void *arg )
+
+/* Write out reports as they arrive */
+
+{
+    struct timespec ts;
+
+    while ( true )
+    {
+        _drain();
+
+        pthread_mutex_lock( &_report.wakeLock );
+        atomic_store( &_report.flusherIdle, true );
+
+        if ( !_pending() )
+        {
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_nsec += REPORT_FLUSH_MS * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait( &_report.wake, &_report.wakeLock, &ts );
+        }
+
+        atomic_store( &_report.flusherIdle, false );
+        pthread_mutex_unlock( &_report.wakeLock );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _reportInit( void )
+
+{
+    pthread_t t;
+
+    for ( size_t i = 0; i < REPORT_SLOTS; i++ )
+    {
+        atomic_init( &_report.s[i].seq, i );
+    }
+
+    if ( pthread_create( &t, NULL, _flusher, NULL ) )
+    {
+        /* Without a flusher everything gets written directly */
+        atomic_store( &_report.wp, ( size_t ) -1 );
+        return;
+    }
+
+    pthread_detach( t );
+    atexit( _drain );
+}
+// ====================================================================================================
+static bool _enqueue( const char *d, size_t len )
+
+/* Put a finished report on the queue, if there's room for it */
+
+{
+    struct reportSlot *r;
+    size_t pos;
+
+    pthread_once( &_report.once, _reportInit );
+    pos = atomic_load_explicit( &_report.wp, memory_order_relaxed );
+
+    if ( ( len > REPORT_SLOT_LEN ) || ( pos == ( size_t ) -1 ) )
+    {
+        return false;
+    }
+
+    while ( true )
+    {
+        r = &_report.s[pos & ( REPORT_SLOTS - 1 )];
+        intptr_t dif = ( intptr_t )atomic_load_explicit( &r->seq, memory_order_acquire ) - ( intptr_t )pos;
+
+        if ( !dif )
+        {
+            if ( atomic_compare_exchange_weak_explicit( &_report.wp, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) )
+            {
+                break;
             }
         }
+        else if ( dif < 0 )
+        {
+            /* Full */
+            atomic_fetch_add( &_report.lost, 1 );
+            return true;
+        }
+        else
+        {
+            pos = atomic_load_explicit( &_report.wp, memory_order_relaxed );
+        }
     }
 
+    memcpy( r->d, d, len );
+    r->len = len;
+    atomic_store_explicit( &r->seq, pos + 1, memory_order_release );
+
+    /* A wakeup missed here only costs REPORT_FLUSH_MS */
+    if ( atomic_load( &_report.flusherIdle ) )
+    {
+        pthread_cond_signal( &_report.wake );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _writeDirect( const char *d, size_t len )
+
+/* Write straight out, after anything that's already queued */
+
+{
+    if ( _pending() )
+    {
+        _drain();
+    }
+
+    fwrite( d, 1, len, stderr );
+}
+// ====================================================================================================
+void genericsPrintf( const char *fmt, ... )
+
+/* Print to output stream */
+
+{
+    static _Thread_local char op[MAX_STRLEN];
+    static _Thread_local char rendered[MAX_STRLEN];
+
+    va_list va;
+    va_start( va, fmt );
+    vsnprintf( op, MAX_STRLEN, fmt, va );
+    va_end( va );
+
+    _writeDirect( rendered, _render( rendered, MAX_STRLEN, op ) );
     fflush( stdout );
 }
 // ====================================================================================================
-void genericsReport( enum verbLevel l, const char *fmt, ... )
+bool genericsRateLimit( struct genericsRateLimit *r, uint32_t *suppressed )
+
+/* Decide if a report from a rate limited site can go. If it can, return how many were held back */
+/* before it. It doesn't matter that this isn't exact when several threads arrive at once.       */
+
+{
+    uint32_t now = genericsTimestampmS();
+    uint32_t start = __atomic_load_n( &r->windowmS, __ATOMIC_RELAXED );
+
+    *suppressed = 0;
+
+    if ( ( now - start >= REPORT_RATE_WINDOW_MS ) &&
+            ( __atomic_compare_exchange_n( &r->windowmS, &start, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) )
+    {
+        /* New window, so start counting again */
+        __atomic_store_n( &r->count, 0, __ATOMIC_RELAXED );
+    }
+
+    if ( __atomic_add_fetch( &r->count, 1, __ATOMIC_RELAXED ) > REPORT_RATE_BURST )
+    {
+        __atomic_add_fetch( &r->suppressed, 1, __ATOMIC_RELAXED );
+        return false;
+    }
+
+    *suppressed = __atomic_exchange_n( &r->suppressed, 0, __ATOMIC_RELAXED );
+    return true;
+}
+// ====================================================================================================
+void ( genericsReport )( enum verbLevel l, const char *fmt, ... )
 
 /* Debug reporting stream */
 
 {
-    static char op[MAX_STRLEN];
-    static char *colours[V_MAX_VERBLEVEL] = {C_VERB_ERROR, C_VERB_WARN, C_VERB_INFO, C_VERB_DEBUG};
+    static _Thread_local char op[MAX_STRLEN];
+    static _Thread_local char rendered[MAX_STRLEN];
+    static const char *colours[V_MAX_VERBLEVEL] = {C_VERB_ERROR, C_VERB_WARN, C_VERB_INFO, C_VERB_DEBUG};
+    size_t n;
 
-    if ( l <= lstore )
+    if ( l <= genericsVerbLevel )
     {
-        fflush( stdout );
-        genericsPrintf( colours[l] );
         va_list va;
+        n = strlen( colours[l] );
+        memcpy( op, colours[l], n );
         va_start( va, fmt );
-        vsnprintf( op, MAX_STRLEN, fmt, va );
+        vsnprintf( &op[n], MAX_STRLEN - n - sizeof( C_RESET ), fmt, va );
         va_end( va );
-        genericsPrintf( "%s", op );
-        genericsPrintf( C_RESET );
-        fflush( stderr );
+        strcat( op, C_RESET );
+        n = _render( rendered, MAX_STRLEN, op );
+
+        /* Errors matter too much to be dropped, and don't happen often enough to be worth queueing */
+        if ( ( l == V_ERROR ) || ( !_enqueue( rendered, n ) ) )
+        {
+            fflush( stdout );
+            _writeDirect( rendered, n );
+            fflush( stderr );
+        }
     }
 }
 // ====================================================================================================
 void genericsExit( int status, const char *fmt, ... )
 
 {
-    static char op[MAX_STRLEN];
+    static _Thread_local char op[MAX_STRLEN];
 
     fflush( stdout );
     va_list va;
@@ -448,7 +698,7 @@ void genericsExit( int status, const char *fmt, ... )
     vsnprintf( op, MAX_STRLEN, fmt, va );
     va_end( va );
     genericsPrintf( C_VERB_ERROR );
-    genericsPrintf( op );
+    genericsPrintf( "%s", op );
     genericsPrintf( C_RESET );
     fflush( stderr );
 
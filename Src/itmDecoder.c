@@ -13,11 +13,13 @@
 #include <stdlib.h>
 #include "itmDecoder.h"
 #include "msgDecoder.h"
+#include "generics.h"
+#include "orbProbes.h"
 
 #ifdef DEBUG
     #include <stdio.h>
-    #include "generics.h"
 #else
+    #undef genericsReport
     #define genericsReport(x...)
 #endif
 
@@ -26,6 +28,7 @@
 #define TPIU_SYNCMASK         0xFFFFFFFF
 #define TPIU_SYNCPATTERN      0xFFFFFF7F      /* This should not be seen in ITM data */
 #define MAX_PACKET            (5)
+#define MAX_GTS_PACKET        (7)    /* Header and up to 6 bytes, for GTS2 with a 64 bit timestamp */
 #define DEFAULT_PAGE_REGISTER (0x07)
 
 // Define this to get transitions printed out
@@ -47,10 +50,30 @@ void ITMDecoderInit( struct ITMDecoder *i, bool startSynced )
     i->pk.len = 0;
     i->contextIDlen = 0;
     i->pk.pageRegister = DEFAULT_PAGE_REGISTER;
+    i->profile = ITM_PROFILE_SW;
     ITMDecoderForceSync( i, startSynced );
     ITMDecoderZeroStats( i );
 }
 // ====================================================================================================
+void ITMDecoderSetProfile( struct ITMDecoder *i, enum ITMDecoderProfile profile )
+
+/* The specialised profiles all assume there are no context IDs, so with them it has to be generic */
+
+{
+    i->profile = ( i->contextIDlen ) ? ITM_PROFILE_GENERIC : profile;
+}
+// ====================================================================================================
+void ITMDecoderSetContextIDlen( struct ITMDecoder *i, uint8_t len )
+
+{
+    i->contextIDlen = len;
+
+    if ( len )
+    {
+        i->profile = ITM_PROFILE_GENERIC;
+    }
+}
+// ====================================================================================================
 void ITMDecoderZeroStats( struct ITMDecoder *i )
 
 {
@@ -68,6 +91,30 @@ struct ITMDecoderStats *ITMDecoderGetStats( struct ITMDecoder *i )
     return &i->stats;
 }
 // ====================================================================================================
+void ITMDecoderRegisterStats( struct ITMDecoder *i, struct statsRegistry *r, const char *prefix, const char *labels )
+
+{
+#define ITMSTAT(f) offsetof( struct ITMDecoderStats, f )
+    static const struct statDef _stats[] =
+    {
+        { "itm_lost_sync_total",   "Times ITM sync was lost",                  STAT_COUNTER, ITMSTAT( lostSyncCount ) },
+        { "itm_syncs_total",       "ITM sync packets",                         STAT_COUNTER, ITMSTAT( syncCount ) },
+        { "itm_tpiu_syncs_total",  "TPIU syncs seen in ITM (TPIU is off)",     STAT_COUNTER, ITMSTAT( tpiuSyncCount ) },
+        { "itm_overflows_total",   "ITM overflow packets",                     STAT_COUNTER, ITMSTAT( overflow ) },
+        { "itm_sw_packets_total",  "ITM software packets",                     STAT_COUNTER, ITMSTAT( SWPkt ) },
+        { "itm_ts_packets_total",  "ITM timestamp packets",                    STAT_COUNTER, ITMSTAT( TSPkt ) },
+        { "itm_gts_packets_total", "ITM global timestamp packets",             STAT_COUNTER, ITMSTAT( GTSPkt ) },
+        { "itm_hw_packets_total",  "ITM hardware packets",                     STAT_COUNTER, ITMSTAT( HWPkt ) },
+        { "itm_xtn_packets_total", "ITM extension packets",                    STAT_COUNTER, ITMSTAT( XTNPkt ) },
+        { "itm_reserved_total",    "ITM packets with reserved encodings",      STAT_COUNTER, ITMSTAT( ReservedPkt ) },
+        { "itm_errors_total",      "ITM headers that mean nothing",            STAT_COUNTER, ITMSTAT( ErrorPkt ) },
+        { "itm_page_packets_total", "ITM stimulus page packets",               STAT_COUNTER, ITMSTAT( PagePkt ) },
+    };
+#undef ITMSTAT
+
+    statsRegistryAddSet( r, prefix, labels, &i->stats, _stats, sizeof( _stats ) / sizeof( _stats[0] ) );
+}
+// ====================================================================================================
 void ITMDecoderForceSync( struct ITMDecoder *i, bool isSynced )
 
 /* Force the decoder into a specific sync state */
@@ -78,7 +125,7 @@ void ITMDecoderForceSync( struct ITMDecoder *i, bool isSynced )
         if ( isSynced )
         {
             i->p = ITM_IDLE;
-            i->stats.syncCount++;
+            STAT_INC( i->stats.syncCount );
             i->pk.len = 0;
         }
     }
@@ -86,7 +133,8 @@ void ITMDecoderForceSync( struct ITMDecoder *i, bool isSynced )
     {
         if ( !isSynced )
         {
-            i->stats.lostSyncCount++;
+            STAT_INC( i->stats.lostSyncCount );
+            ORB_PROBE( liborb, itm_lost_sync, i->stats.lostSyncCount );
             i->p = ITM_UNSYNCED;
         }
     }
@@ -119,9 +167,10 @@ bool ITMGetDecodedPacket( struct ITMDecoder *i, struct msg *decoded )
 static char *_protoNames[] = {PROTO_NAME_LIST};
 #endif
 
-enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
+static ALWAYS_INLINE enum ITMPumpEvent _pumpOctet( struct ITMDecoder *i, uint8_t c, const uint8_t contextIDlen )
 
-/* Pump next byte into the protocol decoder */
+/* Pump next byte into the protocol decoder. This is expanded for each profile, so where contextIDlen */
+/* is a constant the compiler can fold it in.                                                          */
 
 {
     enum _protoState newState = i->p;
@@ -134,12 +183,13 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
 
     if ( ( ( i->syncStat )&TPIU_SYNCMASK ) == TPIU_SYNCPATTERN )
     {
-        i->stats.tpiuSyncCount++;
+        STAT_INC( i->stats.tpiuSyncCount );
     }
 
     if ( ( ( i->syncStat )&SYNCMASK ) == SYNCPATTERN )
     {
-        i->stats.syncCount++;
+        STAT_INC( i->stats.syncCount );
+        ORB_PROBE( liborb, itm_sync, i->stats.syncCount );
 
         /* Page register is reset on a sync */
         i->pk.pageRegister = 0;
@@ -187,13 +237,13 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                     if ( !( c & 0x04 ) )
                     {
                         /* This is a Instrumentation (SW) packet */
-                        i->stats.SWPkt++;
+                        STAT_INC( i->stats.SWPkt );
                         newState = ITM_SW;
                     }
                     else
                     {
                         /* This is a HW packet */
-                        i->stats.HWPkt++;
+                        STAT_INC( i->stats.HWPkt );
                         newState = ITM_HW;
                     }
 
@@ -207,7 +257,8 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                 if ( c == 0b01110000 )
                 {
                     /* This is an overflow packet */
-                    i->stats.overflow++;
+                    STAT_INC( i->stats.overflow );
+                    ORB_PROBE( liborb, itm_overflow, i->stats.overflow );
                     retVal = ITM_EV_OVERFLOW;
                     break;
                 }
@@ -218,7 +269,7 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                     i->pk.len = 1; /* The '1' is deliberate. */
                     /* This is a timestamp packet */
                     i->pk.d[0] = c;
-                    i->stats.TSPkt++;
+                    STAT_INC( i->stats.TSPkt );
 
                     if ( c & 0x80 )
                     {
@@ -239,6 +290,10 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                 if ( ( c & 0b11011111 ) == 0b10010100 )
                 {
                     /* This is a global timestamp packet */
+                    i->pk.len = 1; /* The '1' is deliberate. */
+                    i->pk.d[0] = c;
+                    STAT_INC( i->stats.GTSPkt );
+
                     if ( ( c & 0b00100000 ) == 0 )
                     {
                         newState = ITM_GTS1;
@@ -257,7 +312,7 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                     /* This is a normal I-sync packet */
                     newState = ITM_NISYNC;
                     i->pk.len = 0;
-                    i->targetCount = MAX_PACKET + i->contextIDlen;
+                    i->targetCount = MAX_PACKET + contextIDlen;
                     break;
                 }
 
@@ -266,14 +321,14 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                 {
                     /* Extension Packet */
                     i->pk.len = 1; /* The '1' is deliberate. */
-                    i->stats.XTNPkt++;
+                    STAT_INC( i->stats.XTNPkt );
 
                     i->pk.d[0] = c;
 
                     if ( !( c & 0x84 ) )
                     {
                         /* This is the Stimulus Port Page Register setting ... deal with it here */
-                        i->stats.PagePkt++;
+                        STAT_INC( i->stats.PagePkt );
                         i->pk.pageRegister = ( c >> 4 ) & 0x07;
                     }
                     else
@@ -292,7 +347,7 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                 {
                     /* Reserved packets - we have no idea what these are */
                     i->pk.len = 1;
-                    i->stats.ReservedPkt++;
+                    STAT_INC( i->stats.ReservedPkt );
                     i->pk.d[0] = c;
 
                     if ( !( c & 0x80 ) )
@@ -317,7 +372,8 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
                 // *************************************************
                 /* This is a reserved encoding we don't know how to handle */
                 /* ...assume it's line noise and wait for sync again */
-                i->stats.ErrorPkt++;
+                STAT_INC( i->stats.ErrorPkt );
+                ORB_PROBE( liborb, itm_error, c );
 #ifdef DEBUG
                 fprintf( stderr, EOL "%02X " EOL, c );
 #endif
@@ -327,18 +383,26 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
 
             // -----------------------------------------------------
             case ITM_GTS1:  // Collecting GTS1 timestamp - wait for a zero continuation bit
-                if ( ( c & 0x80 ) == 0 )
+                i->pk.d[i->pk.len++] = c;
+
+                if ( ( !( c & 0x80 ) ) || ( i->pk.len >= MAX_GTS_PACKET ) )
                 {
                     newState = ITM_IDLE;
+                    i->pk.type = ITM_PT_GTS1;
+                    retVal = ITM_EV_PACKET_RXED;
                 }
 
                 break;
 
             // -----------------------------------------------------
             case ITM_GTS2: // Collecting GTS2 timestamp - wait for a zero continuation bit
-                if ( ( c & 0x80 ) == 0 )
+                i->pk.d[i->pk.len++] = c;
+
+                if ( ( !( c & 0x80 ) ) || ( i->pk.len >= MAX_GTS_PACKET ) )
                 {
                     newState = ITM_IDLE;
+                    i->pk.type = ITM_PT_GTS2;
+                    retVal = ITM_EV_PACKET_RXED;
                 }
 
                 break;
@@ -436,3 +500,128 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
     return retVal;
 }
 // ====================================================================================================
+enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
+
+/* Byte at a time is always generic */
+
+{
+    return _pumpOctet( i, c, i->contextIDlen );
+}
+// ====================================================================================================
+static inline bool _isSWHeader( uint8_t c )
+
+{
+    return ( c & 0b00000011 ) && !( c & 0b00000100 );
+}
+// ====================================================================================================
+static inline bool _isSourceHeader( uint8_t c )
+
+/* SW or HW, but not 0x7F, which would be the end of a TPIU sync */
+
+{
+    return ( c & 0b00000011 ) && ( c != 0x7F );
+}
+// ====================================================================================================
+static ALWAYS_INLINE size_t _pumpBlock( struct ITMDecoder *i, const uint8_t *d, size_t len, struct msg *out, size_t maxOut, size_t *used,
+                                        const enum ITMDecoderProfile profile )
+
+/* The block decoder, expanded for each profile. Complete source packets that can't contain any sort */
+/* of sync skip the octet decoder, leaving it just as it would have been had they been through it.    */
+
+{
+    const uint8_t *p = d;
+    const uint8_t *e = d + len;
+    uint64_t ts = genericsTimestampuS();
+    size_t n = 0;
+
+    while ( ( p < e ) && ( n < maxOut ) )
+    {
+        if ( ( profile != ITM_PROFILE_GENERIC ) && ( ITM_IDLE == i->p ) &&
+                ( ( profile == ITM_PROFILE_SW_HW ) ? _isSourceHeader( *p ) : _isSWHeader( *p ) ) )
+        {
+            int count = ( ( *p & 0x03 ) == 3 ) ? 4 : ( *p & 0x03 );
+
+            if ( ( e - p > count ) &&
+                    ( p[1] != 0x80 ) && ( p[1] != 0x7F ) &&
+                    ( ( count < 2 ) || ( ( p[2] != 0x80 ) && ( p[2] != 0x7F ) ) ) &&
+                    ( ( count < 4 ) || ( ( p[3] != 0x80 ) && ( p[3] != 0x7F ) && ( p[4] != 0x80 ) && ( p[4] != 0x7F ) ) ) )
+            {
+                memset( i->pk.d, 0, ITM_MAX_PACKET );
+                memcpy( i->pk.d, &p[1], count );
+                i->pk.srcAddr = ( *p & 0xF8 ) >> 3;
+                i->pk.len = count;
+                i->targetCount = count;
+
+                for ( int k = 0; k <= count; k++ )
+                {
+                    i->syncStat = ( i->syncStat << 8 ) | p[k];
+                }
+
+                if ( !( *p & 0x04 ) )
+                {
+                    /* printf over ITM, which is simple enough to do here */
+                    struct swMsg *m = &out[n++].swMsg;
+
+                    i->pk.type = ITM_PT_SW;
+                    STAT_INC( i->stats.SWPkt );
+
+                    m->msgtype = MSG_SOFTWARE;
+                    m->ts = ts;
+                    m->srcAddr = i->pk.srcAddr;
+                    m->len = count;
+                    m->value = ( i->pk.d[3] << 24 ) | ( i->pk.d[2] << 16 ) | ( i->pk.d[1] << 8 ) | i->pk.d[0];
+                }
+                else
+                {
+                    /* PC samples and DWT events are left to the message decoder */
+                    i->pk.type = ITM_PT_HW;
+                    STAT_INC( i->stats.HWPkt );
+
+                    if ( msgDecoderStamped( &i->pk, &out[n], ts ) )
+                    {
+                        n++;
+                    }
+                }
+
+                p += count + 1;
+                continue;
+            }
+        }
+
+        /* Anything else goes through the octet decoder */
+        if ( ( ITM_EV_PACKET_RXED == _pumpOctet( i, *p++, ( profile == ITM_PROFILE_GENERIC ) ? i->contextIDlen : 0 ) ) &&
+                msgDecoderStamped( &i->pk, &out[n], ts ) )
+        {
+            n++;
+        }
+    }
+
+    if ( used )
+    {
+        *used = p - d;
+    }
+
+    return n;
+}
+// ====================================================================================================
+size_t ITMPumpBlock( struct ITMDecoder *i, const uint8_t *d, size_t len, struct msg *out, size_t maxOut, size_t *used )
+
+/* Pump a whole block into the protocol decoder, writing up to maxOut decoded messages into out.   */
+/* Returns the number of messages written, and the number of bytes consumed into used...which will */
+/* only be less than len if out filled up. Events other than messages are only reflected in stats, */
+/* and all of the messages from one block carry the same host timestamp.                           */
+
+{
+    switch ( i->profile )
+    {
+        case ITM_PROFILE_SW:
+            return _pumpBlock( i, d, len, out, maxOut, used, ITM_PROFILE_SW );
+
+        case ITM_PROFILE_SW_HW:
+            return _pumpBlock( i, d, len, out, maxOut, used, ITM_PROFILE_SW_HW );
+
+        default:
+            return _pumpBlock( i, d, len, out, maxOut, used, ITM_PROFILE_GENERIC );
+    }
+}
+// ====================================================================================================
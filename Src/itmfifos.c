@@ -15,7 +15,16 @@
 #include <assert.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#if defined( LINUX )
+    #include <sys/epoll.h>
+#else
+    #include <poll.h>
+#endif
 
 #include "git_version_info.h"
 #include "generics.h"
@@ -24,17 +33,55 @@
 #include "fileWriter.h"
 #include "itmfifos.h"
 #include "msgDecoder.h"
+#include "shmRing.h"
+#include "fmtProgram.h"
+#include "tokenLog.h"
 
 #ifndef O_BINARY
     #define O_BINARY 0
 #endif
 
 #define MAX_STRING_LENGTH (100)              /* Maximum length that will be output from a fifo for a single event */
+#define MAX_MSG_OUTPUT    (TOKENLOG_MAX_OUTPUT) /* ...except a software message, which may end a tokenised record */
+
+/* Software channels take messages from their pipe in batches, and only write once enough output has built up */
+#define FIFO_BATCH_MSGS   (64)               /* Most messages to take from the pipe at once */
+#define FIFO_FLUSH_LEN    (4096)             /* Write out formatted data once there's this much of it... */
+#define FIFO_FLUSH_MS     (20)               /* ...or the oldest of it has been waiting this long */
+
+/* The hardware channel moves whole binary records, and each write of them has to go completely or not at all */
+#define HWFIFO_READ_LEN   (8*sizeof(struct hwRecord))
+#define HWFIFO_WRITE_MAX  ((PIPE_BUF/sizeof(struct hwRecord))*sizeof(struct hwRecord))
+
+/* The decoder hands data to each channel thread through an in-process queue */
+#define CHAN_QUEUE_SIZE   (65536)            /* Size of each channel's queue, about what a pipe would have held */
+#define CHAN_QUEUE_MASK   (CHAN_QUEUE_SIZE-1)
+#define CHAN_FULL_WAIT_US (1000)             /* How long to wait for room in a permanent file's queue */
+
+/* Channel output can also be published into shared memory, for consumers on the same host */
+#define CHAN_SHM_PREFIX   "/orbfifo."        /* Name of shared memory, followed by the channel name */
+#define CHAN_SHM_SIZE     (SHMRING_DEFAULT_SIZE)
+
+/* Other tags can be decoded alongside the first, each on a thread of its own fed with that tag's frames */
+#define TAG_DIR_PREFIX    "tag"              /* With more than one, each tag's channels go in a directory named this and the tag */
+#define TAG_READ_LEN      (4096)             /* Most of a tag's frames its decoder takes at once */
+
+/* ...or a single reactor thread can serve all of them, keeping output for each until its reader takes it */
+#define REACTOR_OUT_LEN   (65536)            /* Output each channel can have waiting on its reader */
+
+struct Reactor
+{
+    pthread_t thread;
+    int kick[2];                             /* Pipe the decoder pokes to wake the reactor */
+    atomic_bool waiting;                     /* ...set while the reactor is waiting for something to do */
+#if defined( LINUX )
+    int ep;                                  /* epoll set of the kick and any channels that are full */
+#endif
+};
 
 struct runThreadParams                       /* Structure for parameters passed to a software task thread */
 {
     int portNo;
-    int listenHandle;
     bool permafile;
     struct Channel *c;
 };
@@ -43,13 +90,31 @@ struct Channel                               /* Information for an individual ch
 {
     char *chanName;                          /* Filename to be used for the fifo */
     char *presFormat;                        /* Format of data presentation to be used */
+    struct fmtProgram *presProgram;          /* ...and what it compiles to */
+    struct tokenLog *tokens;                 /* Formats for tokenised records, if that's what the channel carries */
 
     /* Runtime state */
-    int handle;                              /* Handle to the fifo */
+    uint8_t *q;                              /* Queue of data for the channel thread, NULL if channel isn't in use */
+    atomic_size_t wp;                        /* ...write position, only changed by decoder */
+    atomic_size_t rp;                        /* ...read position, only changed by channel thread */
+    atomic_bool waiting;                     /* ...set while the channel thread is waiting for data */
+    pthread_mutex_t kickLock;                /* Lock for waking the channel thread */
+    pthread_cond_t kick;                     /* ...and the signal to do it */
+    struct shmRing *shm;                     /* Shared memory copy of the output, if it's being published */
     pthread_t thread;                        /* Thread on which it's running */
     struct runThreadParams params;           /* Parameters for running thread */
     char *fifoName;                          /* Constructed fifo name (from chanPath and name) */
     bool ending;                             /* Flag indicating its time to disappear */
+
+    /* State kept when the reactor is serving the channel, rather than a thread of its own */
+    struct Reactor *r;                       /* Reactor serving this channel, NULL if it has its own thread */
+    int fd;                                  /* ...descriptor being written to */
+    uint8_t *ob;                             /* ...output waiting to go to it */
+    size_t obLen;
+    uint32_t obSince;                        /* ...when the oldest of that was made */
+    bool blocked;                            /* ...the descriptor is full, so waiting until it has room */
+    uint8_t part[sizeof( struct swMsg )];    /* ...and any part of a message read from the queue */
+    size_t partLen;
 };
 
 struct itmfifosHandle
@@ -70,12 +135,25 @@ struct itmfifosHandle
     bool filewriter;                              /* Is the filewriter in use? */
     bool forceITMSync;                            /* Is ITM to be forced into sync? */
     bool permafile;                               /* Use permanent files rather than fifos */
+    bool useShm;                                  /* Publish channels into shared memory too */
+    bool useReactor;                              /* Serve all channels from a single thread */
+    bool binaryHW;                                /* Hardware fifo gets records rather than text */
     int tag;                                      /* Which OFLOW stream are we decoding? */
     bool amEnding;                                /* Flag indicating end is in progress */
 
     enum Prot protocol;                           /* What protocol to communicate (default to OFLOW (== orbuculum)) */
 
     struct Channel c[NUM_CHANNELS + 1];           /* Output for each channel */
+    struct Reactor r;                             /* Thread serving them, if there's just the one */
+
+    /* Other tags decoded along with this one, which it hands their frames to */
+    struct itmfifosHandle *sub[ITMFIFO_MAX_TAGS - 1];
+    int nsub;
+    bool tagDirs;                                 /* Channels go in a directory for the tag, as there's more than one */
+
+    /* ...and on one of those, the frames it's been handed and the thread decoding them */
+    struct Channel feed;
+    pthread_t feedThread;
 };
 
 
@@ -87,165 +165,746 @@ struct itmfifosHandle
 // ====================================================================================================
 // ====================================================================================================
 
+// ====================================================================================================
+// Queues between the decoder and the channel threads
+// ====================================================================================================
+static void _chanKick( struct Channel *c )
+
+/* Wake the channel thread, or the reactor if that's what's serving it */
+
+{
+    if ( c->r )
+    {
+        if ( write( c->r->kick[1], "", 1 ) < 0 )
+        {
+            /* The pipe is full, so it's going to wake anyway */
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock( &c->kickLock );
+    pthread_cond_signal( &c->kick );
+    pthread_mutex_unlock( &c->kickLock );
+}
+// ====================================================================================================
+static void _chanWrite( struct Channel *c, bool permafile, const void *d, size_t len )
+
+/* Queue data for the channel thread. A fifo is allowed to lose it if the queue's full, a file isn't */
+
+{
+    size_t wp = atomic_load_explicit( &c->wp, memory_order_relaxed );
+    size_t ofs = wp & CHAN_QUEUE_MASK;
+    size_t first = ( len < CHAN_QUEUE_SIZE - ofs ) ? len : CHAN_QUEUE_SIZE - ofs;
+
+    while ( CHAN_QUEUE_SIZE - ( wp - atomic_load_explicit( &c->rp, memory_order_acquire ) ) < len )
+    {
+        if ( ( !permafile ) || ( c->ending ) )
+        {
+            return;
+        }
+
+        usleep( CHAN_FULL_WAIT_US );
+    }
+
+    memcpy( &c->q[ofs], d, first );
+    memcpy( c->q, ( const uint8_t * )d + first, len - first );
+
+    /* This pairs with the channel thread setting waiting then checking wp, so one of us sees the other */
+    atomic_store( &c->wp, wp + len );
+
+    if ( atomic_load( ( c->r ) ? &c->r->waiting : &c->waiting ) )
+    {
+        _chanKick( c );
+    }
+}
+// ====================================================================================================
+static ssize_t _chanRead( struct Channel *c, void *d, size_t len, int timeoutMs )
+
+/* Take up to len of whatever's been queued for this channel, waiting up to timeoutMs (or forever if */
+/* it's negative) for some. Returns 0 on timeout, or -1 once the channel is ending and drained.      */
+
+{
+    size_t rp = atomic_load_explicit( &c->rp, memory_order_relaxed );
+    size_t wp = atomic_load_explicit( &c->wp, memory_order_acquire );
+    size_t n, ofs, first;
+    struct timespec ts;
+    bool timedOut = false;
+
+    if ( wp == rp )
+    {
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_sec  += timeoutMs / 1000;
+        ts.tv_nsec += ( timeoutMs % 1000 ) * 1000000L;
+
+        if ( ts.tv_nsec >= 1000000000L )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock( &c->kickLock );
+        atomic_store( &c->waiting, true );
+
+        while ( ( atomic_load( &c->wp ) == rp ) && ( !c->ending ) && ( !timedOut ) )
+        {
+            if ( timeoutMs < 0 )
+            {
+                pthread_cond_wait( &c->kick, &c->kickLock );
+            }
+            else
+            {
+                timedOut = ( pthread_cond_timedwait( &c->kick, &c->kickLock, &ts ) == ETIMEDOUT );
+            }
+        }
+
+        atomic_store( &c->waiting, false );
+        pthread_mutex_unlock( &c->kickLock );
+
+        if ( ( wp = atomic_load_explicit( &c->wp, memory_order_acquire ) ) == rp )
+        {
+            return ( c->ending ) ? -1 : 0;
+        }
+    }
+
+    n     = ( wp - rp < len ) ? wp - rp : len;
+    ofs   = rp & CHAN_QUEUE_MASK;
+    first = ( n < CHAN_QUEUE_SIZE - ofs ) ? n : CHAN_QUEUE_SIZE - ofs;
+    memcpy( d, &c->q[ofs], first );
+    memcpy( ( uint8_t * )d + first, c->q, n - first );
+    atomic_store_explicit( &c->rp, rp + n, memory_order_release );
+    return n;
+}
+// ====================================================================================================
+static bool _chanQueueCreate( struct Channel *c )
+
+{
+    c->q = ( uint8_t * )malloc( CHAN_QUEUE_SIZE );
+    MEMCHECK( c->q, false );
+
+    atomic_init( &c->wp, 0 );
+    atomic_init( &c->rp, 0 );
+    atomic_init( &c->waiting, false );
+    pthread_mutex_init( &c->kickLock, NULL );
+    pthread_cond_init( &c->kick, NULL );
+
+    c->ending = false;
+    return true;
+}
+// ====================================================================================================
+static bool _chanCreate( struct itmfifosHandle *f, struct Channel *c, const char *name )
+
+/* Set up the queue for a channel, and its shared memory if that's wanted */
+
+{
+    char *shmName;
+
+    if ( !_chanQueueCreate( c ) )
+    {
+        return false;
+    }
+
+    if ( f->useShm )
+    {
+        /* Each tag's channels have a name prefix of their own, just as they have a directory */
+        shmName = ( char * )calloc( strlen( CHAN_SHM_PREFIX ) + strlen( TAG_DIR_PREFIX ) + 5 + strlen( name ), 1 );
+        MEMCHECK( shmName, false );
+
+        if ( f->tagDirs )
+        {
+            sprintf( shmName, CHAN_SHM_PREFIX TAG_DIR_PREFIX "%d.%s", f->tag, name );
+        }
+        else
+        {
+            sprintf( shmName, CHAN_SHM_PREFIX "%s", name );
+        }
+
+        /* Not having it isn't fatal, the fifo is still there */
+        if ( !( c->shm = shmRingCreate( shmName, CHAN_SHM_SIZE ) ) )
+        {
+            genericsReport( V_WARN, "No shared memory for %s" EOL, name );
+        }
+
+        free( shmName );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static char *_chanFileName( struct itmfifosHandle *f, const char *name )
+
+/* Where the channel called name goes, under chanPath and in the tag's own directory if it has one */
+
+{
+    char *n = ( char * )calloc( strlen( name ) + strlen( TAG_DIR_PREFIX ) + 7 + ( f->chanPath ? strlen( f->chanPath ) : 0 ), 1 );
+    MEMCHECK( n, NULL );
+
+    if ( f->chanPath )
+    {
+        strcpy( n, f->chanPath );
+        strcat( n, "/" );
+    }
+
+    if ( f->tagDirs )
+    {
+        sprintf( &n[strlen( n )], TAG_DIR_PREFIX "%d/", f->tag );
+    }
+
+    strcat( n, name );
+    return n;
+}
+// ====================================================================================================
+static size_t _chanPending( struct Channel *c )
+
+/* How much is queued for the channel, only for whoever is reading from it */
+
+{
+    return atomic_load_explicit( &c->wp, memory_order_acquire ) - atomic_load_explicit( &c->rp, memory_order_relaxed );
+}
+// ====================================================================================================
+static bool _chanPrepare( struct Channel *c, bool permafile )
+
+/* Clear away whatever was there before, and make the fifo if that's what this channel is */
+
+{
+    unlink( c->fifoName );
+
+    return ( permafile ) || ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) >= 0 );
+}
+// ====================================================================================================
+static int _chanOpen( struct Channel *c, bool permafile )
+
+/* A fifo is opened RDWR so the open can proceed without a remote end, and so it never blocks */
+
+{
+    if ( !permafile )
+    {
+        return open( c->fifoName, O_RDWR | O_BINARY | O_NONBLOCK );
+    }
+
+    return open( c->fifoName, O_WRONLY | O_CREAT | O_BINARY  | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+}
 // ====================================================================================================
 // Handlers for the fifos
 // ====================================================================================================
+static int _formatMsg( struct Channel *c, struct swMsg *m, char *constructString )
+
+/* Turn a message into its output in constructString, which is MAX_MSG_OUTPUT long, returning its length */
+
+{
+    if ( c->tokens )
+    {
+        /* Only the last word of a record makes anything */
+        return tokenLogPump( c->tokens, m->value, m->len, constructString, MAX_MSG_OUTPUT );
+    }
+
+    if ( !c->presProgram )
+    {
+        // raw output.
+        memcpy( constructString, &m->value, sizeof( m->value ) );
+        return sizeof( m->value );
+    }
+
+    return fmtProgramRun( c->presProgram, m->value, m->len, constructString, MAX_STRING_LENGTH );
+}
+// ====================================================================================================
+static bool _flushOutput( struct Channel *c, int opfile, char *op, size_t *opLen )
+
+/* Write out whatever output has been built up, returning false if it couldn't be */
+
+{
+    ssize_t written = ( *opLen ) ? write( opfile, op, *opLen ) : 1;
+
+    if ( ( c->shm ) && ( *opLen ) )
+    {
+        shmRingWrite( c->shm, op, *opLen );
+    }
+
+    /* Anything that didn't make it is lost, as it always has been when the fifo is full */
+    *opLen = 0;
+    return ( written > 0 );
+}
+// ====================================================================================================
 static void *_runFifo( void *arg )
 
 /* This is the control loop for the channel fifos (for each software port) */
 
-{
-    struct runThreadParams *params = ( struct runThreadParams * )arg;
-    struct Channel *c = params->c;
-    struct swMsg m;
-    uint32_t w;
+{
+    struct runThreadParams *params = ( struct runThreadParams * )arg;
+    struct Channel *c = params->c;
+    struct swMsg m[FIFO_BATCH_MSGS];
+
+    char op[FIFO_FLUSH_LEN + MAX_MSG_OUTPUT];
+    size_t opLen = 0;
+    uint32_t opSince = 0;
+    size_t inLen = 0;
+    int opfile;
+    int timeout;
+    ssize_t readDataLen;
+    int n;
+    bool ok;
+
+    assert( &params->c->params == params );
+
+    if ( !_chanPrepare( c, params->permafile ) )
+    {
+        pthread_exit( NULL );
+    }
+
+    do
+    {
+        /* Keep on opening the file (in case the fifo is opened/closed multiple times) */
+        opfile = _chanOpen( c, params->permafile );
+        ok = true;
+
+        do
+        {
+            /* Wait for messages, but not for so long that output that's already built up is held too long */
+            timeout = -1;
+
+            if ( opLen )
+            {
+                timeout = FIFO_FLUSH_MS - ( int )( genericsTimestampmS() - opSince );
+                timeout = ( timeout < 0 ) ? 0 : timeout;
+            }
+
+            /* ....get as many messages as are waiting */
+            readDataLen = _chanRead( c, ( uint8_t * )m + inLen, sizeof( m ) - inLen, timeout );
+
+            if ( readDataLen < 0 )
+            {
+                /* We're done */
+                break;
+            }
+
+            if ( !readDataLen )
+            {
+                ok = _flushOutput( c, opfile, op, &opLen );
+                continue;
+            }
+
+            inLen += readDataLen;
+            n = inLen / sizeof( struct swMsg );
+
+            for ( int i = 0; ( ok ) && ( i < n ); i++ )
+            {
+                if ( !opLen )
+                {
+                    opSince = genericsTimestampmS();
+                }
+
+                opLen += _formatMsg( c, &m[i], &op[opLen] );
+
+                if ( opLen >= FIFO_FLUSH_LEN )
+                {
+                    ok = _flushOutput( c, opfile, op, &opLen );
+                }
+            }
+
+            /* Keep any part of a message for next time round */
+            inLen -= n * sizeof( struct swMsg );
+            memmove( m, &m[n], inLen );
+        }
+        while ( ok );
+
+        /* Falling out on writen fail means we can re-open the fifo if it overflowed, unless we're on the way out */
+        _flushOutput( c, opfile, op, &opLen );
+        close( opfile );
+    }
+    while ( ( readDataLen >= 0 ) && ( !c->ending ) );
+
+    pthread_exit( NULL );
+}
+// ====================================================================================================
+static void *_runHWFifo( void *arg )
+
+/* This is the control loop for the hardware fifo */
+
+{
+    struct runThreadParams *params = ( struct runThreadParams * )arg;
+    struct Channel *c = params->c;
+    int opfile;
+    ssize_t readDataLen = 0, writeDataLen = 0;
+    uint8_t p[HWFIFO_READ_LEN];
+
+    if ( !_chanPrepare( c, params->permafile ) )
+    {
+        pthread_exit( NULL );
+    }
+
+    do
+    {
+        opfile = _chanOpen( c, params->permafile );
+
+        do
+        {
+            /* ....get the packet. We will hang here until a packet arrives, or we're ending and it's all gone */
+            if ( ( readDataLen = _chanRead( c, p, HWFIFO_READ_LEN, -1 ) ) < 0 )
+            {
+                break;
+            }
+
+            writeDataLen = write( opfile, p, readDataLen );
+
+            if ( c->shm )
+            {
+                shmRingWrite( c->shm, p, readDataLen );
+            }
+        }
+        while ( writeDataLen > 0 );
+
+        /* Falling out on writeDataLen fail means we can re-open the fifo if it overflowed, unless we're on the way out */
+        close( opfile );
+    }
+    while ( ( readDataLen >= 0 ) && ( !c->ending ) );
+
+    pthread_exit( NULL );
+}
+// ====================================================================================================
+// The reactor, serving every channel from one thread
+// ====================================================================================================
+static void _reactorBlock( struct Reactor *r, struct Channel *c, bool blocked )
+
+/* Note whether the channel's descriptor is full, and so whether it's to be watched for room */
+
+{
+    if ( c->blocked == blocked )
+    {
+        return;
+    }
+
+    c->blocked = blocked;
+#if defined( LINUX )
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+
+    epoll_ctl( r->ep, ( blocked ) ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, c->fd, &ev );
+#endif
+}
+// ====================================================================================================
+static void _reactorReopen( struct itmfifosHandle *f, struct Channel *c )
+
+/* Start again with a fresh descriptor. If the fifo has no reader then whatever it held goes with the old one */
+
+{
+    _reactorBlock( &f->r, c, false );
+
+    if ( c->fd >= 0 )
+    {
+        close( c->fd );
+    }
+
+    c->fd = _chanOpen( c, f->permafile );
+}
+// ====================================================================================================
+static void _reactorFill( struct Channel *c, bool raw )
+
+/* Move what the decoder has queued for a channel into its output, formatting it on the way. Only */
+/* as much is taken as there's room for, anything else is left in the queue.                      */
+
+{
+    struct swMsg m[FIFO_BATCH_MSGS];
+    size_t want, inLen, start;
+    ssize_t got;
+    int n;
+
+    while ( _chanPending( c ) )
+    {
+        start = c->obLen;
+
+        if ( raw )
+        {
+            if ( !( want = REACTOR_OUT_LEN - c->obLen ) )
+            {
+                break;
+            }
+
+            got = _chanRead( c, &c->ob[c->obLen], want, 0 );
+            c->obLen += ( got > 0 ) ? got : 0;
+        }
+        else
+        {
+            /* Every message is allowed its longest output, so nothing is cut short */
+            n = ( REACTOR_OUT_LEN - c->obLen ) / MAX_MSG_OUTPUT;
+            n = ( n > FIFO_BATCH_MSGS ) ? FIFO_BATCH_MSGS : n;
+
+            if ( !n )
+            {
+                break;
+            }
+
+            memcpy( m, c->part, c->partLen );
+            inLen = c->partLen;
+            got = _chanRead( c, ( uint8_t * )m + inLen, n * sizeof( struct swMsg ) - inLen, 0 );
+            inLen += ( got > 0 ) ? got : 0;
+            n = inLen / sizeof( struct swMsg );
+
+            for ( int i = 0; i < n; i++ )
+            {
+                c->obLen += _formatMsg( c, &m[i], ( char * )&c->ob[c->obLen] );
+            }
+
+            c->partLen = inLen - n * sizeof( struct swMsg );
+            memcpy( c->part, &m[n], c->partLen );
+        }
+
+        if ( c->obLen != start )
+        {
+            if ( !start )
+            {
+                c->obSince = genericsTimestampmS();
+            }
+
+            /* Shared memory doesn't wait on anyone, so it gets the output as soon as it's made */
+            if ( c->shm )
+            {
+                shmRingWrite( c->shm, &c->ob[start], c->obLen - start );
+            }
+        }
+
+        if ( got <= 0 )
+        {
+            break;
+        }
+    }
+}
+// ====================================================================================================
+static void _reactorFlush( struct itmfifosHandle *f, struct Channel *c, bool raw, bool now )
+
+/* Write out as much of a channel's output as its descriptor will take, once enough has built up or */
+/* it has waited long enough. Whatever it won't take stays for when it has room. Raw output goes in */
+/* pieces small enough that each is written whole, so records never get split by a drop.           */
+
+{
+    size_t len, done = 0;
+    ssize_t written;
+
+    if ( ( !c->obLen ) || ( c->blocked ) ||
+            ( ( !now ) && ( c->obLen < FIFO_FLUSH_LEN ) && ( genericsTimestampmS() - c->obSince < FIFO_FLUSH_MS ) ) )
+    {
+        return;
+    }
+
+    if ( c->fd < 0 )
+    {
+        _reactorReopen( f, c );
+    }
+
+    do
+    {
+        len = ( ( raw ) && ( c->obLen - done > HWFIFO_WRITE_MAX ) ) ? HWFIFO_WRITE_MAX : c->obLen - done;
+        written = write( c->fd, &c->ob[done], len );
+        done += ( written > 0 ) ? written : 0;
+    }
+    while ( ( written == ( ssize_t )len ) && ( done != c->obLen ) );
+
+    if ( ( written < 0 ) && ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+    {
+        /* Something's wrong with it, so the output is lost and it's opened again */
+        c->obLen = 0;
+        _reactorReopen( f, c );
+        return;
+    }
+
+    memmove( c->ob, &c->ob[done], c->obLen - done );
+    c->obLen -= done;
+    _reactorBlock( &f->r, c, ( c->obLen != 0 ) );
+}
+// ====================================================================================================
+static void _reactorWait( struct itmfifosHandle *f, int timeoutMs )
+
+/* Wait until the decoder queues something, a full descriptor has room again, or it's time to flush */
+
+{
+    char k[64];
+    int n;
+#if defined( LINUX )
+    struct epoll_event ev[NUM_CHANNELS + 2];
+
+    n = epoll_wait( f->r.ep, ev, NUM_CHANNELS + 2, timeoutMs );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( ev[i].data.ptr )
+        {
+            _reactorBlock( &f->r, ( struct Channel * )ev[i].data.ptr, false );
+        }
+    }
+
+#else
+    struct pollfd p[NUM_CHANNELS + 2];
+    struct Channel *pc[NUM_CHANNELS + 2];
+
+    p[0].fd = f->r.kick[0];
+    p[0].events = POLLIN;
+    pc[0] = NULL;
+    n = 1;
+
+    for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+    {
+        if ( ( f->c[t].q ) && ( f->c[t].blocked ) )
+        {
+            p[n].fd = f->c[t].fd;
+            p[n].events = POLLOUT;
+            pc[n++] = &f->c[t];
+        }
+    }
+
+    if ( poll( p, n, timeoutMs ) > 0 )
+    {
+        for ( int i = 1; i < n; i++ )
+        {
+            if ( p[i].revents )
+            {
+                _reactorBlock( &f->r, pc[i], false );
+            }
+        }
+    }
+
+#endif
 
-    char constructString[MAX_STRING_LENGTH];
-    int opfile;
-    size_t readDataLen, writeDataLen, written = 0;
+    /* However many kicks there were, they've all been answered now */
+    while ( read( f->r.kick[0], k, sizeof( k ) ) > 0 );
+}
+// ====================================================================================================
+static void *_runReactor( void *arg )
 
-    assert( &params->c->params == params );
+/* This is the control loop when one thread serves every channel. Each channel writes without blocking */
+/* from output of its own, so a reader that isn't keeping up only holds back, and loses, its own data. */
 
-    /* Remove the file if it exists */
-    unlink( c->fifoName );
+{
+    struct itmfifosHandle *f = ( struct itmfifosHandle * )arg;
+    struct Channel *c;
+    int timeout, left;
+    bool ending, busy;
 
-    if ( !params->permafile )
+    for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
     {
-        /* This is a 'conventional' fifo, so it must be created */
-        if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
+        if ( f->c[t].q )
         {
-            pthread_exit( NULL );
+            /* A channel that can't be made just drops its output */
+            f->c[t].fd = ( _chanPrepare( &f->c[t], f->permafile ) ) ? _chanOpen( &f->c[t], f->permafile ) : -1;
         }
     }
 
-    do
+    while ( true )
     {
-        /* Keep on opening the file (in case the fifo is opened/closed multiple times) */
-        /* We use RDWR to allow the open to proceed without a remote end */
-
-        if ( !params->permafile )
-        {
-            opfile = open( c->fifoName, O_RDWR | O_BINARY | O_NONBLOCK );
-        }
-        else
-        {
-            opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_BINARY  | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
-        }
+        ending = true;
+        busy = false;
+        timeout = -1;
 
-        do
+        for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
         {
-            /* ....get the packet. This will hang here until a packet arrives or the link closes */
-            readDataLen = read( params->listenHandle, &m, sizeof( struct swMsg ) );
-
-            if ( readDataLen < 0 )
+            if ( !( c = &f->c[t] )->q )
             {
                 continue;
             }
 
-            if ( c->presFormat )
-            {
-                // formatted output....start with specials
-                if ( strstr( c->presFormat, "%f" ) )
-                {
-                    /* type punning on same host, after correctly building 32bit val
-                     * only unsafe on systems where u32/float have diff byte order */
-                    float *nastycast = ( float * )&m.value;
-                    writeDataLen = snprintf( constructString, MAX_STRING_LENGTH, c->presFormat, *nastycast, *nastycast, *nastycast, *nastycast );
-                }
-                else if ( strstr( c->presFormat, "%c" ) )
-                {
-                    /* Format contains %c, so execute repeatedly for all characters in sent data */
-                    writeDataLen = 0;
-                    uint8_t op[4] = {m.value & 0xff, ( m.value >> 8 ) & 0xff, ( m.value >> 16 ) & 0xff, ( m.value >> 24 ) & 0xff};
+            ending &= c->ending;
+            _reactorFill( c, ( t == HW_CHANNEL ) );
 
-                    uint32_t l = 0;
+            if ( ( c->blocked ) && ( !f->permafile ) && ( _chanPending( c ) ) &&
+                    ( REACTOR_OUT_LEN - c->obLen < MAX_MSG_OUTPUT ) )
+            {
+                /* The reader has stopped taking it, so it goes, as it would from a full fifo on its own thread */
+                c->obLen = 0;
+                _reactorReopen( f, c );
+                _reactorFill( c, ( t == HW_CHANNEL ) );
+            }
 
-                    do
-                    {
-                        writeDataLen += snprintf( &constructString[writeDataLen], MAX_STRING_LENGTH - writeDataLen, c->presFormat, op[l], op[l], op[l], op[l] );
-                    }
-                    while ( ++l < m.len );
-                }
-                else
-                {
-                    writeDataLen = snprintf( constructString, MAX_STRING_LENGTH, c->presFormat, m.value, m.value, m.value, m.value );
-                }
+            /* Hardware events have always gone out as soon as they arrive */
+            _reactorFlush( f, c, ( t == HW_CHANNEL ), ( t == HW_CHANNEL ) || ( c->ending ) );
 
-                written = write( opfile, constructString, ( writeDataLen < MAX_STRING_LENGTH ) ? writeDataLen : MAX_STRING_LENGTH );
-            }
-            else
+            if ( ( c->obLen ) && ( !c->blocked ) )
             {
-                // raw output.
-                written = write( opfile, &w, sizeof ( w ) );
+                left = FIFO_FLUSH_MS - ( int )( genericsTimestampmS() - c->obSince );
+                left = ( left < 0 ) ? 0 : left;
+                timeout = ( ( timeout < 0 ) || ( left < timeout ) ) ? left : timeout;
             }
         }
-        while ( ( written > 0 ) && ( !c->ending ) );
 
-        /* Falling out on writen fail means we can re-open the fifo if it overflowed */
-        close( opfile );
+        /* This pairs with the decoder writing wp then checking waiting, so one of us sees the other */
+        atomic_store( &f->r.waiting, true );
+
+        for ( int t = 0; ( !busy ) && ( t < NUM_CHANNELS + 1 ); t++ )
+        {
+            busy = ( f->c[t].q ) && ( _chanPending( &f->c[t] ) );
+        }
+
+        if ( ending && !busy )
+        {
+            /* We're done, anything a reader isn't taking is left behind */
+            break;
+        }
+
+        if ( !busy )
+        {
+            _reactorWait( f, timeout );
+        }
+
+        atomic_store( &f->r.waiting, false );
+    }
+
+    for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+    {
+        if ( ( f->c[t].q ) && ( f->c[t].fd >= 0 ) )
+        {
+            _reactorBlock( &f->r, &f->c[t], false );
+            close( f->c[t].fd );
+        }
     }
-    while ( !c->ending );
 
     pthread_exit( NULL );
 }
 // ====================================================================================================
-static void *_runHWFifo( void *arg )
+static bool _reactorCreate( struct itmfifosHandle *f )
 
-/* This is the control loop for the hardware fifo */
+/* Get the reactor going, once all of the channels it's to serve have been set up */
 
 {
-    struct runThreadParams *params = ( struct runThreadParams * )arg;
-    struct Channel *c = params->c;
-    int opfile;
-    size_t readDataLen = 0, writeDataLen = 0;
-    uint8_t p[MAX_STRING_LENGTH];
+    if ( pipe( f->r.kick ) < 0 )
+    {
+        return false;
+    }
 
-    /* Remove the file if it exists */
-    unlink( c->fifoName );
+    fcntl( f->r.kick[0], F_SETFL, O_NONBLOCK );
+    fcntl( f->r.kick[1], F_SETFL, O_NONBLOCK );
+    atomic_init( &f->r.waiting, false );
 
-    if ( !params->permafile )
+#if defined( LINUX )
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if ( ( ( f->r.ep = epoll_create1( 0 ) ) < 0 ) || ( epoll_ctl( f->r.ep, EPOLL_CTL_ADD, f->r.kick[0], &ev ) < 0 ) )
     {
-        /* This is a 'conventional' fifo, so it must be created */
-        if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
-        {
-            pthread_exit( NULL );
-        }
+        return false;
     }
 
-    do
-    {
-        if ( !params->permafile )
-        {
-            /* We use RDWR to allow the open to proceed without a remote end */
-            opfile = open( c->fifoName, O_RDWR | O_BINARY | O_NONBLOCK );
-        }
-        else
-        {
-            opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_BINARY  | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
-        }
+#endif
 
-        do
+    for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+    {
+        if ( f->c[t].q )
         {
-            /* ....get the packet. We will hang here until a packet arrives or the link closes */
-            readDataLen = read( params->listenHandle, p, MAX_STRING_LENGTH );
-
-            if ( readDataLen > 0 )
-            {
-                writeDataLen = write( opfile, p, readDataLen );
-            }
+            f->c[t].ob = ( uint8_t * )malloc( REACTOR_OUT_LEN );
+            MEMCHECK( f->c[t].ob, false );
+            f->c[t].r = &f->r;
         }
-        while ( ( writeDataLen > 0 ) && ( !c->ending ) );
-
-        /* Falling out on writeDataLen fail means we can re-open the fifo if it overflowed */
-        close( opfile );
     }
-    while ( !c->ending );
 
-    pthread_exit( NULL );
+    return ( pthread_create( &f->r.thread, NULL, &_runReactor, f ) == 0 );
 }
 // ====================================================================================================
 // Decoders for each message
 // ====================================================================================================
+static void _hwRecord( struct itmfifosHandle *f, uint8_t type, uint8_t flags, uint16_t comp, uint32_t data, uint64_t ts )
+
+/* Send a hardware event as a record rather than text (see struct hwRecord for what's in it) */
+
+{
+    struct hwRecord r = { .type = type, .flags = flags, .comp = comp, .data = data, .ts = ts };
+
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, &r, sizeof( r ) );
+}
+// ====================================================================================================
 void _handleException( struct excMsg *m, struct itmfifosHandle *f )
 
 {
@@ -260,6 +919,12 @@ void _handleException( struct excMsg *m, struct itmfifosHandle *f )
 
     f->lastHWExceptionTS = m->ts;
 
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_EXCEPTION, m->eventType & 0x03, m->exceptionNumber, 0, eventdifftS );
+        return;
+    }
+
     if ( m->exceptionNumber < 16 )
     {
         /* This is a system based exception */
@@ -271,7 +936,7 @@ void _handleException( struct excMsg *m, struct itmfifosHandle *f )
         opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%s,External,%d" EOL, HWEVENT_EXCEPTION, eventdifftS, exEvent[m->eventType & 0x03], m->exceptionNumber - 16 );
     }
 
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDWTEvent( struct dwtMsg *m, struct itmfifosHandle *f )
@@ -285,6 +950,13 @@ void _handleDWTEvent( struct dwtMsg *m, struct itmfifosHandle *f )
     uint64_t eventdifftS = m->ts - f->lastHWExceptionTS;
 
     f->lastHWExceptionTS = m->ts;
+
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_DWT, 0, 0, m->event, eventdifftS );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64, HWEVENT_DWT, eventdifftS );
 
     for ( uint32_t i = 0; i < NUM_EVENTS; i++ )
@@ -303,8 +975,8 @@ void _handleDWTEvent( struct dwtMsg *m, struct itmfifosHandle *f )
         }
     }
 
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
-    write( f->c[HW_CHANNEL].handle, EOL, strlen( EOL ) );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, EOL, strlen( EOL ) );
 }
 // ====================================================================================================
 void _handlePCSample( struct pcSampleMsg *m, struct itmfifosHandle *f )
@@ -318,6 +990,12 @@ void _handlePCSample( struct pcSampleMsg *m, struct itmfifosHandle *f )
 
     f->lastHWExceptionTS = m->ts;
 
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_PCSample, m->sleep, 0, m->pc, eventdifftS );
+        return;
+    }
+
     if ( m->sleep )
     {
         /* This is a sleep packet */
@@ -329,7 +1007,7 @@ void _handlePCSample( struct pcSampleMsg *m, struct itmfifosHandle *f )
     }
 
     /* We don't need to worry if this write does not succeed, it just means there is no other side of the fifo */
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataRWWP( struct watchMsg *m, struct itmfifosHandle *f )
@@ -343,8 +1021,14 @@ void _handleDataRWWP( struct watchMsg *m, struct itmfifosHandle *f )
 
     f->lastHWExceptionTS = m->ts;
 
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_RWWT, m->isWrite, m->comp, m->data, eventdifftS );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%d,%s,0x%x" EOL, HWEVENT_RWWT, eventdifftS, m->comp, m->isWrite ? "Write" : "Read", m->data );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataAccessWP( struct wptMsg *m, struct itmfifosHandle *f )
@@ -358,8 +1042,15 @@ void _handleDataAccessWP( struct wptMsg *m, struct itmfifosHandle *f )
     uint64_t eventdifftS = m->ts - f->lastHWExceptionTS;
 
     f->lastHWExceptionTS = m->ts;
+
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_AWP, 0, m->comp, m->data, eventdifftS );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%d,0x%08x" EOL, HWEVENT_AWP, eventdifftS, m->comp, m->data );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataOffsetWP( struct oswMsg *m, struct itmfifosHandle *f )
@@ -372,23 +1063,30 @@ void _handleDataOffsetWP( struct oswMsg *m, struct itmfifosHandle *f )
     uint64_t eventdifftS = m->ts - f->lastHWExceptionTS;
 
     f->lastHWExceptionTS = m->ts;
+
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_OFS, 0, m->comp, m->offset, eventdifftS );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%d,0x%04x" EOL, HWEVENT_OFS, eventdifftS, m->comp, m->offset );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 // ====================================================================================================
 void _handleSW( struct swMsg *m, struct itmfifosHandle *f )
 
 {
     /* Filter off filewriter packets and let the filewriter module deal with those */
-    if ( ( m->srcAddr == FW_CHANNEL ) && ( f->filewriter ) )
+    if ( ( ( m->srcAddr == FW_CHANNEL ) || ( m->srcAddr == FW_BULK_CHANNEL ) ) && ( f->filewriter ) )
     {
         filewriterProcess( m );
     }
     else
     {
-        if ( ( m->srcAddr < NUM_CHANNELS ) && ( f->c[m->srcAddr].handle ) )
+        if ( ( m->srcAddr < NUM_CHANNELS ) && ( f->c[m->srcAddr].q ) )
         {
-            write( f->c[m->srcAddr].handle, m, sizeof( struct swMsg ) );
+            _chanWrite( &f->c[m->srcAddr], f->permafile, m, sizeof( struct swMsg ) );
         }
     }
 }
@@ -399,8 +1097,14 @@ void _handleNISYNC( struct nisyncMsg *m, struct itmfifosHandle *f )
     char outputString[MAX_STRING_LENGTH];
     int opLen;
 
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_NISYNC, m->type, 0, m->addr, 0 );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%02x,0x%08x" EOL, HWEVENT_NISYNC, m->type, m->addr );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 
 // ====================================================================================================
@@ -416,8 +1120,14 @@ void _handleTS( struct TSMsg *m, struct itmfifosHandle *f )
     f->timeStamp += m->timeInc;
     f->timeStatus = m->timeStatus;
 
+    if ( f->binaryHW )
+    {
+        _hwRecord( f, HWEVENT_TS, m->timeStatus, 0, 0, m->timeInc );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%d,%" PRIu32 EOL, HWEVENT_TS, m->timeStatus, m->timeInc );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _chanWrite( &f->c[HW_CHANNEL], f->permafile, outputString, opLen );
 }
 // ====================================================================================================
 void _itmPumpProcess( struct itmfifosHandle *f, char c )
@@ -455,22 +1165,22 @@ void _itmPumpProcess( struct itmfifosHandle *f, char c )
 
         // ------------------------------------
         case ITM_EV_UNSYNCED:
-            genericsReport( V_WARN, "ITM Lost Sync (%d)" EOL, ITMDecoderGetStats( &f->i )->lostSyncCount );
+            genericsReport( V_WARN, "ITM Lost Sync (%" PRIu64 ")" EOL, ITMDecoderGetStats( &f->i )->lostSyncCount );
             break;
 
         // ------------------------------------
         case ITM_EV_SYNCED:
-            genericsReport( V_INFO, "ITM In Sync (%d)" EOL, ITMDecoderGetStats( &f->i )->syncCount );
+            genericsReport( V_INFO, "ITM In Sync (%" PRIu64 ")" EOL, ITMDecoderGetStats( &f->i )->syncCount );
             break;
 
         // ------------------------------------
         case ITM_EV_OVERFLOW:
-            genericsReport( V_WARN, "ITM Overflow (%d)" EOL, ITMDecoderGetStats( &f->i )->overflow );
+            genericsReportRateLimited( V_WARN, "ITM Overflow (%" PRIu64 ")" EOL, ITMDecoderGetStats( &f->i )->overflow );
             break;
 
         // ------------------------------------
         case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
+            genericsReportRateLimited( V_WARN, "ITM Error" EOL );
             break;
 
         // ------------------------------------
@@ -498,7 +1208,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
@@ -509,8 +1219,94 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
                 _itmPumpProcess( f, p->d[i] );
             }
         }
+        else
+        {
+            /* Frames for any of the other tags go to the thread decoding it */
+            for ( int i = 0; i < f->nsub; i++ )
+            {
+                if ( p->tag == f->sub[i]->tag )
+                {
+                    _chanWrite( &f->sub[i]->feed, f->sub[i]->permafile, p->d, p->len );
+                    break;
+                }
+            }
+        }
     }
 }
+// ====================================================================================================
+static void *_runTag( void *arg )
+
+/* Decode the frames for one of the other tags, as they are handed over */
+
+{
+    struct itmfifosHandle *f = ( struct itmfifosHandle * )arg;
+    uint8_t d[TAG_READ_LEN];
+    ssize_t n;
+
+    while ( ( n = _chanRead( &f->feed, d, TAG_READ_LEN, -1 ) ) >= 0 )
+    {
+        for ( int i = 0; i < n; i++ )
+        {
+            _itmPumpProcess( f, d[i] );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _tagCreate( struct itmfifosHandle *f, struct itmfifosHandle *s )
+
+/* Set up another tag to be decoded the same way as f is, into its own set of channels */
+
+{
+    s->forceITMSync = f->forceITMSync;
+    s->permafile    = f->permafile;
+    s->useShm       = f->useShm;
+    s->useReactor   = f->useReactor;
+    s->binaryHW     = f->binaryHW;
+    s->tagDirs      = true;
+    s->protocol     = PROT_ITM;
+    itmfifoSetChanPath( s, f->chanPath );
+
+    for ( int t = 0; t < NUM_CHANNELS; t++ )
+    {
+        if ( f->c[t].chanName )
+        {
+            itmfifoSetChannel( s, t, f->c[t].chanName, f->c[t].presFormat );
+        }
+    }
+
+    if ( ( !_chanQueueCreate( &s->feed ) ) || ( !itmfifoCreate( s ) ) )
+    {
+        return false;
+    }
+
+    return ( pthread_create( &s->feedThread, NULL, &_runTag, s ) == 0 );
+}
+// ====================================================================================================
+static bool _tagDir( struct itmfifosHandle *f )
+
+/* Make the directory this tag's channels go in, if it's not already there */
+
+{
+    char *n = _chanFileName( f, "" );
+    bool ok;
+
+    if ( !n )
+    {
+        return false;
+    }
+
+    ok = ( mkdir( n, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH ) == 0 ) || ( errno == EEXIST );
+
+    if ( !ok )
+    {
+        genericsReport( V_ERROR, "Couldn't make directory %s (%s)" EOL, n, strerror( errno ) );
+    }
+
+    free( n );
+    return ok;
+}
 
 // ====================================================================================================
 
@@ -564,9 +1360,22 @@ void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s )
     f->c[chan].presFormat = s ? strdup( s ) : NULL;
 
     MEMCHECKV( f->c[chan].presFormat );
+    fmtProgramFree( f->c[chan].presProgram );
+    f->c[chan].presProgram = ( s ) ? fmtProgramCompile( s ) : NULL;
 }
 #pragma GCC diagnostic pop
 // ====================================================================================================
+void itmfifoSetTokens( struct itmfifosHandle *f, int chan, struct tokenLog *t )
+
+/* Have the channel carry tokenised records, which are turned into text using t. It's ours from now on */
+
+{
+    assert( chan < NUM_CHANNELS );
+
+    tokenLogDelete( f->c[chan].tokens );
+    f->c[chan].tokens = t;
+}
+// ====================================================================================================
 void itmfifoSetProtocol( struct itmfifosHandle *f, enum Prot p )
 
 {
@@ -639,7 +1448,7 @@ void itmfifoProtocolPump( struct itmfifosHandle *f, uint8_t *c, int len )
 
     if ( PROT_OFLOW == f->protocol )
     {
-        OFLOWPump( &f->ot, c, len, _OFLOWpacketRxed, f );
+        OFLOWPumpInPlace( &f->ot, c, len, _OFLOWpacketRxed, f );
     }
     else
         while ( len-- )
@@ -662,8 +1471,6 @@ bool itmfifoCreate( struct itmfifosHandle *f )
 /* Create each sub-process that will handle a port */
 
 {
-    int fd[2];
-
     /* Make sure there's an initial timestamp to work with */
     f->lastHWExceptionTS = genericsTimestampuS();
 
@@ -671,6 +1478,25 @@ bool itmfifoCreate( struct itmfifosHandle *f )
     OFLOWInit( &f->ot );
     ITMDecoderInit( &f->i, f->forceITMSync );
 
+    /* With other tags to decode, each one's channels go in a directory of their own */
+    if ( f->nsub )
+    {
+        f->tagDirs = true;
+    }
+
+    if ( ( f->tagDirs ) && ( !_tagDir( f ) ) )
+    {
+        return false;
+    }
+
+    for ( int i = 0; i < f->nsub; i++ )
+    {
+        if ( !_tagCreate( f, f->sub[i] ) )
+        {
+            return false;
+        }
+    }
+
     /* Cycle through channels and create a fifo for each one that is enabled */
     for ( int t = 0; t < ( NUM_CHANNELS + 1 ); t++ )
     {
@@ -679,36 +1505,18 @@ bool itmfifoCreate( struct itmfifosHandle *f )
             if ( f->c[t].chanName )
             {
                 /* This is a live software channel fifo */
-                if ( pipe( fd ) < 0 )
+                if ( !_chanCreate( f, &f->c[t], f->c[t].chanName ) )
                 {
                     return false;
                 }
 
-                if ( !f->permafile )
-                {
-                    /* If this is not a permanent file then some data is allowed to get lost */
-                    fcntl( fd[1], F_SETFL, O_NONBLOCK );
-                }
-
-                f->c[t].handle = fd[1];
-                f->c[t].ending = false;
-
-                f->c[t].params.listenHandle = fd[0];
                 f->c[t].params.portNo = t;
                 f->c[t].params.permafile = f->permafile;
                 f->c[t].params.c = &f->c[t];
 
-                f->c[t].fifoName = ( char * )calloc( strlen( f->c[t].chanName ) + 2 + ( f->chanPath ? strlen( f->chanPath ) : 0 ), 1 );
-
-                if ( f->chanPath )
-                {
-                    strcpy( f->c[t].fifoName, f->chanPath );
-                    strcat( f->c[t].fifoName, "/" );
-                }
+                f->c[t].fifoName = _chanFileName( f, f->c[t].chanName );
 
-                strcat( f->c[t].fifoName, f->c[t].chanName );
-
-                if ( pthread_create( &( f->c[t].thread ), NULL, &_runFifo, &( f->c[t].params ) ) )
+                if ( ( !f->useReactor ) && ( pthread_create( &( f->c[t].thread ), NULL, &_runFifo, &( f->c[t].params ) ) ) )
                 {
                     return false;
                 }
@@ -717,47 +1525,30 @@ bool itmfifoCreate( struct itmfifosHandle *f )
         else
         {
             /* This is the hardware fifo channel */
-            if ( pipe( fd ) < 0 )
+            if ( !_chanCreate( f, &f->c[t], HWFIFO_NAME ) )
             {
                 return false;
             }
 
-            if ( !f->permafile )
-            {
-                /* If this is not a permanent file then some data is allowed to get lost */
-                fcntl( fd[1], F_SETFL, O_NONBLOCK );
-            }
-
-            f->c[t].handle = fd[1];
-
-            f->c[t].params.listenHandle = fd[0];
             f->c[t].params.portNo = t;
             f->c[t].params.permafile = f->permafile;
             f->c[t].params.c = &f->c[t];
 
-            f->c[t].fifoName = ( char * )calloc( strlen( HWFIFO_NAME ) + 2 + ( ( f->chanPath ) ? strlen( f->chanPath ) : 0 ), 1 );
-
-            if ( f->chanPath )
-            {
-                strcpy( f->c[t].fifoName, f->chanPath );
-                strcat( f->c[t].fifoName, "/" );
-            }
+            f->c[t].fifoName = _chanFileName( f, HWFIFO_NAME );
 
-            strcat( f->c[t].fifoName, HWFIFO_NAME );
-
-            if ( pthread_create( &( f->c[t].thread ), NULL, &_runHWFifo, &( f->c[t].params ) ) )
+            if ( ( !f->useReactor ) && ( pthread_create( &( f->c[t].thread ), NULL, &_runHWFifo, &( f->c[t].params ) ) ) )
             {
                 return false;
             }
         }
     }
 
-    return true;
+    return ( f->useReactor ) ? _reactorCreate( f ) : true;
 }
 // ====================================================================================================
 void itmfifoShutdown( struct itmfifosHandle *f )
 
-/* Destroy the per-port sub-processes. These will terminate when the fifos close */
+/* Destroy the per-port sub-processes. These will terminate once they've drained their queues */
 
 {
     if ( f->amEnding )
@@ -767,29 +1558,69 @@ void itmfifoShutdown( struct itmfifosHandle *f )
 
     f->amEnding = true;
 
+    /* Other tags finish decoding whatever they've been handed, then go the same way as this one */
+    for ( int i = 0; i < f->nsub; i++ )
+    {
+        if ( f->sub[i]->feed.q )
+        {
+            f->sub[i]->feed.ending = true;
+            _chanKick( &f->sub[i]->feed );
+            pthread_join( f->sub[i]->feedThread, NULL );
+            free( f->sub[i]->feed.q );
+            f->sub[i]->feed.q = NULL;
+        }
+
+        itmfifoShutdown( f->sub[i] );
+    }
+
     /* Firstly go tell everything they're doomed */
     for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
     {
         f->c[t].ending = true;
 
-        if ( f->c[t].handle > 0 )
+        if ( f->c[t].q )
         {
-            /* This will cause the read to end, thus terminating the pthread */
-            close( f->c[t].handle );
+            /* This will cause the wait for data to end, thus terminating the pthread */
+            _chanKick( &f->c[t] );
         }
     }
 
+    /* Whatever the target was writing to files goes out too */
+    if ( f->filewriter )
+    {
+        filewriterShutdown();
+    }
+
     /* ...now clean up */
+    if ( f->useReactor )
+    {
+        pthread_join( f->r.thread, NULL );
+        close( f->r.kick[0] );
+        close( f->r.kick[1] );
+#if defined( LINUX )
+        close( f->r.ep );
+#endif
+    }
+
     for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
     {
-        if ( f->c[t].handle > 0 )
+        if ( f->c[t].q )
         {
-            pthread_join( f->c[t].thread, NULL );
+            if ( !f->useReactor )
+            {
+                pthread_join( f->c[t].thread, NULL );
+            }
 
             if ( ! f->permafile )
             {
                 unlink( f->c[t].fifoName );
             }
+
+            shmRingClose( f->c[t].shm );
+            free( f->c[t].q );
+            f->c[t].q = NULL;
+            free( f->c[t].ob );
+            f->c[t].ob = NULL;
         }
 
         /* Remove the name string too */
@@ -797,18 +1628,35 @@ void itmfifoShutdown( struct itmfifosHandle *f )
         {
             free( f->c[t].presFormat );
         }
+
+        fmtProgramFree( f->c[t].presProgram );
+        f->c[t].presProgram = NULL;
+        tokenLogDelete( f->c[t].tokens );
+        f->c[t].tokens = NULL;
+    }
+
+    /* The tag's directory only goes if it's empty, which it won't be if there are files in it */
+    if ( ( f->tagDirs ) && ( !f->permafile ) )
+    {
+        char *n = _chanFileName( f, "" );
+
+        if ( n )
+        {
+            rmdir( n );
+            free( n );
+        }
     }
 }
 // ====================================================================================================
 
-void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath )
+void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath, const struct fwOptions *o )
 
 {
     f->filewriter = useFilewriter;
 
     if ( f->filewriter )
     {
-        filewriterInit( workingPath );
+        f->filewriter = filewriterInit( workingPath, o );
     }
 }
 
@@ -819,6 +1667,57 @@ void itmfifoUsePermafiles( struct itmfifosHandle *f, bool usePermafilesSet )
     f->permafile = usePermafilesSet;
 }
 // ====================================================================================================
+void itmfifoUseReactor( struct itmfifosHandle *f, bool useReactorSet )
+
+{
+    f->useReactor = useReactorSet;
+}
+// ====================================================================================================
+void itmfifoUseBinaryHW( struct itmfifosHandle *f, bool useBinaryHWSet )
+
+{
+    f->binaryHW = useBinaryHWSet;
+}
+// ====================================================================================================
+void itmfifoUseShm( struct itmfifosHandle *f, bool useShmSet )
+
+{
+    f->useShm = useShmSet;
+}
+// ====================================================================================================
+struct itmfifosHandle *itmfifoAddTag( struct itmfifosHandle *f, int tag )
+
+/* Decode tag too, on a thread of its own. It gets f's channels when f is created, in a directory of its own */
+
+{
+    struct itmfifosHandle *s;
+
+    if ( tag == f->tag )
+    {
+        return NULL;
+    }
+
+    for ( int i = 0; i < f->nsub; i++ )
+    {
+        if ( f->sub[i]->tag == tag )
+        {
+            return NULL;
+        }
+    }
+
+    if ( f->nsub == ITMFIFO_MAX_TAGS - 1 )
+    {
+        return NULL;
+    }
+
+    if ( ( s = itmfifoInit( f->forceITMSync, PROT_ITM, tag ) ) )
+    {
+        f->sub[f->nsub++] = s;
+    }
+
+    return s;
+}
+// ====================================================================================================
 struct itmfifosHandle *itmfifoInit( bool forceITMSyncSet, enum Prot p, int tag )
 
 {
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Latency Histograms
+ * ==================
+ *
+ * Values below 2^LATENCY_SUB_BITS get a bucket each. Above that a value with its top bit at e goes
+ * into row e-LATENCY_SUB_BITS+1, at the column given by the LATENCY_SUB_BITS bits below the top one.
+ *
+ */
+
+#include <string.h>
+#include "latencyHist.h"
+
+#define SUB_COUNT (1<<LATENCY_SUB_BITS)
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static int _bucket( uint64_t ns )
+
+{
+    int e;
+
+    if ( ns < SUB_COUNT )
+    {
+        return ns;
+    }
+
+    e = 63 - __builtin_clzll( ns );
+
+    if ( e >= LATENCY_MAX_BITS )
+    {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    return ( ( e - LATENCY_SUB_BITS + 1 ) << LATENCY_SUB_BITS ) + ( ( ns >> ( e - LATENCY_SUB_BITS ) ) & ( SUB_COUNT - 1 ) );
+}
+// ====================================================================================================
+static uint64_t _bucketTop( int i )
+
+/* Highest value that would be recorded in bucket i */
+
+{
+    int e;
+
+    if ( i < SUB_COUNT )
+    {
+        return i;
+    }
+
+    e = ( i >> LATENCY_SUB_BITS ) + LATENCY_SUB_BITS - 1;
+    return ( ( ( uint64_t )( SUB_COUNT + ( i & ( SUB_COUNT - 1 ) ) ) + 1 ) << ( e - LATENCY_SUB_BITS ) ) - 1;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void latencyRecord( struct latencyHist *h, uint64_t ns )
+
+{
+    uint64_t m = atomic_load_explicit( &h->max, memory_order_relaxed );
+
+    atomic_fetch_add_explicit( &h->b[_bucket( ns )], 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &h->sum, ns, memory_order_relaxed );
+
+    while ( ( ns > m ) && ( !atomic_compare_exchange_weak_explicit( &h->max, &m, ns, memory_order_relaxed, memory_order_relaxed ) ) );
+}
+// ====================================================================================================
+void latencyTake( struct latencyHist *h, struct latencyStats *s )
+
+/* Find the percentiles of whatever has been recorded since the last time this was called */
+
+{
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t seen = 0;
+
+    memset( s, 0, sizeof( struct latencyStats ) );
+
+    for ( int i = 0; i < LATENCY_BUCKETS; i++ )
+    {
+        counts[i] = atomic_load_explicit( &h->b[i], memory_order_relaxed ) - h->taken[i];
+        h->taken[i] += counts[i];
+        s->count += counts[i];
+    }
+
+    s->max = atomic_exchange_explicit( &h->max, 0, memory_order_relaxed );
+
+    for ( int i = 0; ( i < LATENCY_BUCKETS ) && ( s->count ); i++ )
+    {
+        seen += counts[i];
+
+        /* Each percentile is the top of the bucket that takes the count past it */
+        if ( ( !s->p50 ) && ( seen * 2 >= s->count ) )
+        {
+            s->p50 = _bucketTop( i );
+        }
+
+        if ( ( !s->p99 ) && ( seen * 100 >= s->count * 99 ) )
+        {
+            s->p99 = _bucketTop( i );
+        }
+
+        if ( ( !s->p999 ) && ( seen * 1000 >= s->count * 999 ) )
+        {
+            s->p999 = _bucketTop( i );
+            break;
+        }
+    }
+
+    /* A bucket top can be above anything actually seen */
+    s->p50  = ( s->p50 < s->max ) ? s->p50 : s->max;
+    s->p99  = ( s->p99 < s->max ) ? s->p99 : s->max;
+    s->p999 = ( s->p999 < s->max ) ? s->p999 : s->max;
+}
+// ====================================================================================================
+uint64_t latencyCumulative( struct latencyHist *h, uint64_t below[LATENCY_MAX_BITS + 1], uint64_t *sum )
+
+/* Everything ever recorded, summed up to each power of two */
+
+{
+    uint64_t total = 0;
+    int k = 0;
+
+    *sum = atomic_load_explicit( &h->sum, memory_order_relaxed );
+
+    for ( int i = 0; i < LATENCY_BUCKETS; i++ )
+    {
+        /* Buckets are in order, so each power of two has everything before the first bucket that reaches it */
+        while ( ( k <= LATENCY_MAX_BITS ) && ( _bucketTop( i ) >= ( 1ULL << k ) ) )
+        {
+            below[k++] = total;
+        }
+
+        total += atomic_load_explicit( &h->b[i], memory_order_relaxed );
+    }
+
+    while ( k <= LATENCY_MAX_BITS )
+    {
+        below[k++] = total;
+    }
+
+    return total;
+}
+// ====================================================================================================
@@ -4,6 +4,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if !defined(WIN32)
+    #include <sys/mman.h>
+#endif
 #include <gelf.h>
 #include <ctype.h>
 #include <dwarf.h>
@@ -12,12 +19,32 @@
 #include "loadelf.h"
 #include "generics.h"
 #include "readsource.h"
+#define MEM_ACCOUNT_UTHASH
+#include "uthash.h"
+#include "memAccount.h"
 
 #define DP_MAX_LINE_LEN (4095)
 #define IS_INFO (true)
 
 static char _print_buffer[DP_MAX_LINE_LEN];
 
+#if defined( HAVE_CXA_DEMANGLE )
+/* The C++ runtime's demangler, which any of the toolchains we're built with will have */
+char *__cxa_demangle( const char *mangled, char *buf, size_t *len, int *status );
+#endif
+
+/* C++ names demangled so far, for every symbol set there's been. Most symbols never get shown, so */
+/* a name is only demangled the first time it is, and a reloaded image finds its names ready.      */
+struct demangled
+{
+    char *mangled;                         /* Linkage name */
+    char *name;                            /* ...and what it demangles to, or NULL if it doesn't */
+    UT_hash_handle hh;
+};
+
+static struct demangled *_demangled;
+static pthread_mutex_t _demangledLock = PTHREAD_MUTEX_INITIALIZER;
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -126,6 +153,89 @@ static int _matchLine( const void *a, const void *b )
 
     return 0;
 }
+
+// ====================================================================================================
+
+static int _matchInline( const void *a, const void *b )
+{
+    const symbolMemaddr key = *( const symbolMemaddr * )a;
+    const struct symbolInlineRange *r = ( const struct symbolInlineRange * )b;
+
+    if ( key < r->lowaddr )
+    {
+        return -1;
+    }
+
+    if ( key > r->highaddr )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// ====================================================================================================
+
+static int _compareInlineRange( const void *a, const void *b )
+
+{
+    const symbolMemaddr as = ( ( const struct symbolInlineRange * )a )->lowaddr;
+    const symbolMemaddr bs = ( ( const struct symbolInlineRange * )b )->lowaddr;
+
+    if ( as < bs )
+    {
+        return -1;
+    }
+
+    if ( as > bs )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// ====================================================================================================
+
+static int _compareVar( const void *a, const void *b )
+
+{
+    const symbolMemaddr as = ( *( struct symbolVariableStore ** )a )->addr;
+    const symbolMemaddr bs = ( *( struct symbolVariableStore ** )b )->addr;
+
+    if ( as < bs )
+    {
+        return -1;
+    }
+
+    if ( as > bs )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// ====================================================================================================
+
+static int _matchVar( const void *a, const void *b )
+{
+    const symbolMemaddr key = *( symbolMemaddr * )a;
+    const symbolMemaddr as = ( *( struct symbolVariableStore ** )b )->addr;
+    const unsigned int size = ( *( struct symbolVariableStore ** )b )->size;
+
+    if ( key < as )
+    {
+        return -1;
+    }
+
+    if ( key >= as + ( size ? size : 1 ) )
+    {
+        return 1;
+    }
+
+    return 0;
+}
 // ====================================================================================================
 
 static bool _readProg( struct symbol *p )
@@ -178,14 +288,15 @@ static bool _readProg( struct symbol *p )
             /* This is program code or data; Allocate a new section */
             if ( ( data = elf_rawdata ( scn, data ) ) != NULL )
             {
-                p->mem = ( struct symbolMemoryStore * )realloc( p->mem, ( p->nsect_mem + 1 ) * sizeof( struct symbolMemoryStore ) );
+                p->mem = ( struct symbolMemoryStore * )memRealloc( MEM_SYMBOLS, p->mem, ( p->nsect_mem + 1 ) * sizeof( struct symbolMemoryStore ) );
                 struct symbolMemoryStore *n = p->mem + p->nsect_mem;
                 p->nsect_mem++;
 
                 n->start = shdr.sh_addr;
                 n->len   = shdr.sh_size;
-                n->name  = strdup( name );
-                n->data  = ( uint8_t * )malloc( n->len );
+                n->name  = memStrdup( MEM_SYMBOLS, name );
+                n->data  = ( uint8_t * )memAlloc( MEM_SYMBOLS, n->len );
+                n->insnPage = NULL;
                 memmove( n->data, data->d_buf, n->len );
             }
         }
@@ -193,31 +304,173 @@ static bool _readProg( struct symbol *p )
 
     /* Sort mem sections into order so it's straightforward to find matches */
     qsort( p->mem, p->nsect_mem, sizeof( struct symbolMemoryStore ), _compareMem );
-    p->cachedSearchIndex = -1;
     elf_end( e );
     return p;
 }
 
 // ====================================================================================================
 
-int _findOrAddString( const char *stringToFindorAdd, char ***table, unsigned int *elementCount )
+/* DWARF is read by several workers at once, each with its own handle on the file, which take the */
+/* compilation units between them as they get to them. Each keeps its own functions, lines and     */
+/* strings, which are merged into the symbol set once they're all done.                           */
+#define DWARF_MAX_THREADS   (16)           /* Most workers reading the DWARF */
+#define DWARF_CU_PER_THREAD (8)            /* ...and fewest compilation units it's worth having one for */
+#define DWARF_TABLE_INITIAL (64)           /* Entries allocated in a table to start with */
+#define DWARF_TYPE_DEPTH    (8)            /* Most typedefs and qualifiers followed to get to a variable's type */
+#define DWARF_ORIGIN_DEPTH  (4)            /* Most origins and specifications followed to get to an inlined function's name */
+#define NO_STRING           (0xffffffff)   /* No string table entry, for whatever hasn't got one */
+
+struct stringEntry                         /* Index entry into a string table */
+{
+    const char *str;
+    unsigned int index;
+    UT_hash_handle hh;
+};
+
+struct stringTable                         /* Strings without duplicates, each known by an index */
+{
+    char **table;
+    unsigned int len;
+    unsigned int alloc;
+    struct stringEntry *hash;
+};
+
+struct inlineCall                         /* An inlined call, as it's found in the DWARF */
+{
+    uint32_t name;                         /* Worker's string table index of the function, or NO_STRING */
+    uint32_t mangle;                       /* ...its linkage name */
+    uint32_t callfile;                     /* ...and the file the call was in */
+    uint32_t callline;
+    int32_t parent;                        /* Call this was inlined into, or -1 if it's straight into a function */
+    uint32_t node;                         /* Where it went in the shared pool, when the workers are merged */
+};
+
+struct inlineSpan                          /* Addresses covered by an inlined call */
+{
+    symbolMemaddr lowaddr;
+    symbolMemaddr highaddr;
+    uint32_t call;                         /* The inlined call, in a worker's calls and then the shared pool */
+    uint32_t depth;                        /* ...and how deep it is */
+};
+
+struct inlineCU                            /* What's needed to make sense of the inlined calls in a compilation unit */
+{
+    Dwarf_Debug dbg;
+    Dwarf_Addr base;                       /* Base address for its DWARF 4 range lists */
+    Dwarf_Half version;
+    char **files;                          /* Files that its call_file attributes are indexes into */
+    Dwarf_Signed nfiles;
+};
+
+struct inlineNode                          /* An inline stack in the shared pool, as its innermost call and the stack that's in */
+{
+    struct inlineKey
+    {
+        uint32_t name;                     /* Shared string table indexes, 0 if there's none */
+        uint32_t mangle;
+        uint32_t callfile;
+        uint32_t callline;
+        uint32_t parent;                   /* Node of the stack it's in, or NO_STRING */
+    } k;
+    uint32_t index;                        /* Where it is in the pool */
+    uint32_t depth;                        /* ...how deep it is */
+    uint32_t chain;                        /* ...and where its frames are, once they're laid out */
+    UT_hash_handle hh;
+};
+
+struct inlinePool                          /* The inline stacks from all the workers, each one only once */
+{
+    struct inlineNode **node;
+    unsigned int nnode;
+    unsigned int alloc;
+    struct inlineNode *hash;
+};
+
+struct dwarfJob                            /* What the workers share */
+{
+    atomic_uint nextCU;                    /* Next compilation unit for the taking */
+};
+
+struct dwarfWorker
+{
+    struct dwarfJob *job;
+    pthread_t thread;
+    int fd;                                /* Handle this worker reads the elf through */
+    char printBuffer[DP_MAX_LINE_LEN];
+
+    struct symbolFunctionStore **func;     /* Functions found, in address order once done */
+    unsigned int nfunc;
+    unsigned int funcAlloc;
+
+    struct symbolLineStore **line;         /* ...and lines */
+    unsigned int nlines;
+    unsigned int lineAlloc;
+
+    struct symbolVariableStore **var;      /* ...and variables */
+    unsigned int nvar;
+    unsigned int varAlloc;
+
+    struct inlineCall *call;               /* ...and inlined calls */
+    unsigned int ncall;
+    unsigned int callAlloc;
+    struct inlineSpan *span;               /* ...with the addresses each of them covers */
+    unsigned int nspan;
+    unsigned int spanAlloc;
+
+    struct stringTable strings[PT_NUMTABLES]; /* Strings these refer to, by index into these tables */
+};
+
+// ====================================================================================================
+
+static unsigned int _stringAdd( struct stringTable *t, const char *str, bool take )
+
+/* Find the string in the table (and return its index) or add it and return that. If take is set */
+/* then str is heap allocated and the table takes it, or frees it if there's already a copy.    */
 
 {
-    /* Find the string in the specified table (and return its index) or create a new string record and return that index */
-    for ( int i = 0; i < *elementCount; i++ )
+    struct stringEntry *e;
+
+    HASH_FIND_STR( t->hash, str, e );
+
+    if ( e )
     {
-        if ( !strcmp( ( *table )[i], stringToFindorAdd ) )
+        if ( take )
         {
-            return i;
+            memFree( MEM_SYMBOLS, ( char * )str );
         }
+
+        return e->index;
+    }
+
+    if ( t->len == t->alloc )
+    {
+        t->alloc = ( t->alloc ) ? t->alloc * 2 : DWARF_TABLE_INITIAL;
+        t->table = ( char ** )memRealloc( MEM_SYMBOLS, t->table, sizeof( char * ) * t->alloc );
+        MEMCHECK( t->table, 0 );
     }
 
-    /* This string doesn't exist...add it and then return the index */
-    *table = ( char ** )realloc( *table, sizeof( char * ) * ( ( *elementCount ) + 1 ) );
-    ( *table )[*elementCount] = strdup( stringToFindorAdd );
+    e = ( struct stringEntry * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct stringEntry ) );
+    MEMCHECK( e, 0 );
+    e->str = t->table[t->len] = ( take ) ? ( char * )str : memStrdup( MEM_SYMBOLS, str );
+    e->index = t->len++;
+    HASH_ADD_KEYPTR( hh, t->hash, e->str, strlen( e->str ), e );
+    return e->index;
+}
+
+// ====================================================================================================
+
+static void _stringIndexFree( struct stringTable *t )
+
+/* Lose the index of the table, once nothing more will be added to it */
+
+{
+    struct stringEntry *e, *te;
 
-    ( *elementCount )++;
-    return ( *elementCount ) - 1;
+    HASH_ITER( hh, t->hash, e, te )
+    {
+        HASH_DEL( t->hash, e );
+        memFree( MEM_SYMBOLS, e );
+    }
 }
 
 // ====================================================================================================
@@ -260,7 +513,58 @@ terminate:
 
 // ====================================================================================================
 
-static void _getSourceLines( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die die )
+static struct symbolLineStore *_newLine( struct dwarfWorker *w )
+
+{
+    if ( w->nlines == w->lineAlloc )
+    {
+        w->lineAlloc = ( w->lineAlloc ) ? w->lineAlloc * 2 : DWARF_TABLE_INITIAL;
+        w->line = ( struct symbolLineStore ** )memRealloc( MEM_SYMBOLS, w->line, sizeof( struct symbolLineStore * ) * w->lineAlloc );
+        MEMCHECK( w->line, NULL );
+    }
+
+    w->line[w->nlines] = ( struct symbolLineStore * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct symbolLineStore ) );
+    MEMCHECK( w->line[w->nlines], NULL );
+    return w->line[w->nlines++];
+}
+
+// ====================================================================================================
+
+static struct symbolFunctionStore *_newFunc( struct dwarfWorker *w )
+
+{
+    if ( w->nfunc == w->funcAlloc )
+    {
+        w->funcAlloc = ( w->funcAlloc ) ? w->funcAlloc * 2 : DWARF_TABLE_INITIAL;
+        w->func = ( struct symbolFunctionStore ** )memRealloc( MEM_SYMBOLS, w->func, sizeof( struct symbolFunctionStore * ) * w->funcAlloc );
+        MEMCHECK( w->func, NULL );
+    }
+
+    w->func[w->nfunc] = ( struct symbolFunctionStore * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct symbolFunctionStore ) );
+    MEMCHECK( w->func[w->nfunc], NULL );
+    return w->func[w->nfunc++];
+}
+
+// ====================================================================================================
+
+static struct symbolVariableStore *_newVar( struct dwarfWorker *w )
+
+{
+    if ( w->nvar == w->varAlloc )
+    {
+        w->varAlloc = ( w->varAlloc ) ? w->varAlloc * 2 : DWARF_TABLE_INITIAL;
+        w->var = ( struct symbolVariableStore ** )memRealloc( MEM_SYMBOLS, w->var, sizeof( struct symbolVariableStore * ) * w->varAlloc );
+        MEMCHECK( w->var, NULL );
+    }
+
+    w->var[w->nvar] = ( struct symbolVariableStore * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct symbolVariableStore ) );
+    MEMCHECK( w->var[w->nvar], NULL );
+    return w->var[w->nvar++];
+}
+
+// ====================================================================================================
+
+static void _getSourceLines( struct dwarfWorker *w, Dwarf_Debug dbg, Dwarf_Die die )
 
 
 {
@@ -307,13 +611,11 @@ static void _getSourceLines( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die die )
                 dwarf_lineno( linebuf[i], &line_num, 0 );
                 dwarf_linesrc( linebuf[i], &file_name, 0 );
 
-                p->line = ( struct symbolLineStore ** )realloc( p->line, sizeof( struct symbolLineStore * ) * ( p->nlines + 1 ) );
-                struct symbolLineStore *newLine = p->line[p->nlines] = ( struct symbolLineStore * )calloc( 1, sizeof( struct symbolLineStore ) );
-                p->nlines++;
+                struct symbolLineStore *newLine = _newLine( w );
                 newLine->startline = line_num;
                 newLine->lowaddr = line_addr;
                 newLine->isinline = true;
-                newLine->filename = _findOrAddString( file_name, &p->stringTable[PT_FILENAME],  &p->tableLen[PT_FILENAME] );
+                newLine->filename = _stringAdd( &w->strings[PT_FILENAME], file_name, false );
             }
 
             tracked_addr = line_addr;
@@ -341,7 +643,7 @@ void _dwarf_print( void *p, const char *line )
 
 // ====================================================================================================
 
-static void _processFunctionDie( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die die, int filenameN, int producerN, Dwarf_Addr cu_base_addr )
+static void _processFunctionDie( struct dwarfWorker *w, Dwarf_Debug dbg, Dwarf_Die die, int filenameN, int producerN, Dwarf_Addr cu_base_addr )
 
 {
     char *name = NULL;
@@ -410,12 +712,10 @@ static void _processFunctionDie( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die di
 
     if ( name && l && h )
     {
-        p->func = ( struct symbolFunctionStore ** )realloc( p->func, sizeof( struct symbolFunctionStore * ) * ( p->nfunc + 1 ) );
-        newFunc = p->func[p->nfunc] = ( struct symbolFunctionStore * )calloc( 1, sizeof( struct symbolFunctionStore ) );
+        newFunc = _newFunc( w );
         newFunc->isinline = isinline;
-        p->nfunc++;
 
-        newFunc->funcname  = strdup( name );
+        newFunc->funcname  = memStrdup( MEM_SYMBOLS, name );
         newFunc->producer  = producerN;
         newFunc->filename  = filenameN;
         newFunc->lowaddr   = l;
@@ -423,7 +723,7 @@ static void _processFunctionDie( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die di
 
         if ( manglename )
         {
-            newFunc->manglename = strdup( manglename );
+            newFunc->manglename = memStrdup( MEM_SYMBOLS, manglename );
         }
 
         /* Collect start of function line and column */
@@ -449,286 +749,2229 @@ static void _processFunctionDie( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die di
 
 // ====================================================================================================
 
-static void _processDie( struct symbol *p, Dwarf_Debug dbg, Dwarf_Die die, int level, int filenameN, int producerN, Dwarf_Addr cu_base_addr )
+static bool _varAddress( Dwarf_Attribute attr, symbolMemaddr *addr )
 
-{
-    Dwarf_Half tag;
-    Dwarf_Die child;
+/* Get the address from a location that is nothing but DW_OP_addr, which is what a variable at a fixed */
+/* address has. Anything else (registers, stack, TLS) isn't somewhere a comparator can watch.         */
 
-    Dwarf_Die sib = die;
+{
+    Dwarf_Unsigned len = 0;
+    Dwarf_Ptr d = NULL;
+    Dwarf_Block *b;
+    uint8_t *e;
 
-    while ( DW_DLV_OK == dwarf_siblingof_b( dbg, sib, IS_INFO, &sib, 0 ) )
+    if ( DW_DLV_OK != dwarf_formexprloc( attr, &len, &d, 0 ) )
     {
-        dwarf_tag( sib, &tag, 0 );
-        const char *n;
-        dwarf_get_TAG_name( tag, &n );
-
-        if ( ( tag == DW_TAG_subprogram ) || ( tag == DW_TAG_inlined_subroutine ) )
+        /* DWARF before version 4 has it as a block */
+        if ( DW_DLV_OK != dwarf_formblock( attr, &b, 0 ) )
         {
-            _processFunctionDie( p, dbg, sib, filenameN, producerN, cu_base_addr );
+            return false;
         }
+
+        len = b->bl_len;
+        d = b->bl_data;
     }
 
-    if ( DW_DLV_OK == dwarf_child( die, &child, 0 ) )
+    e = ( uint8_t * )d;
+
+    if ( ( !e ) || ( e[0] != DW_OP_addr ) || ( ( len != 5 ) && ( len != 9 ) ) )
     {
-        _processDie( p, dbg, child, level + 1, filenameN, producerN, cu_base_addr );
-        dwarf_dealloc( dbg, child, DW_DLA_DIE );
+        return false;
     }
+
+    /* Targets are 32 bit, so only the bottom of an 8 byte address is of interest */
+    *addr = e[1] | ( e[2] << 8 ) | ( e[3] << 16 ) | ( ( symbolMemaddr )e[4] << 24 );
+    return true;
 }
 
 // ====================================================================================================
 
-static bool _isAbsPath( const char *p )
+static void _varType( Dwarf_Debug dbg, Dwarf_Die die, struct symbolVariableStore *v )
+
+/* Follow the type of the variable through typedefs and qualifiers until it says how big it is */
 
 {
-    /* Path is absolute if it starts with / or x: where x is in the range A..Z. */
-    return (
-                       ( p[0] == '/' ) ||
-                       ( ( toupper( p[0] ) >= 'A' ) && ( toupper( p[0] ) <= 'Z' ) && ( p[1] == ':' ) )
-           );
-}
+    Dwarf_Attribute attr_data;
+    Dwarf_Unsigned size;
+    Dwarf_Unsigned encoding;
+    Dwarf_Off type_offset;
+    Dwarf_Die type_die;
 
-// ====================================================================================================
+    for ( int depth = 0; depth < DWARF_TYPE_DEPTH; depth++ )
+    {
+        if ( ( DW_DLV_OK != dwarf_attr( die, DW_AT_type, &attr_data, 0 ) ) ||
+                ( DW_DLV_OK != dwarf_global_formref( attr_data, &type_offset, 0 ) ) ||
+                ( DW_DLV_OK != dwarf_offdie_b( dbg, type_offset, IS_INFO, &type_die, 0 ) ) )
+        {
+            return;
+        }
 
-static char *_joinPaths( const char *p1, const char *p2 )
+        die = type_die;
 
-{
-    if ( _isAbsPath( p2 ) )
-    {
-        return strdup( p2 );
-    }
-    else
-    {
-        char *res = ( char * )malloc( strlen( p1 ) + strlen( p2 ) + 2 );
-        strcpy( res, p1 );
-        strcat( res, "/" );
-        strcat( res, p2 );
-        return res;
+        if ( DW_DLV_OK == dwarf_bytesize( die, &size, 0 ) )
+        {
+            encoding = 0;
+            v->size = size;
+
+            if ( DW_DLV_OK == dwarf_attr( die, DW_AT_encoding, &attr_data, 0 ) )
+            {
+                dwarf_formudata( attr_data, &encoding, 0 );
+            }
+
+            v->type = ( encoding == DW_ATE_float ) ? SV_FLOAT :
+                      ( ( encoding == DW_ATE_signed ) || ( encoding == DW_ATE_signed_char ) ) ? SV_SIGNED : SV_UNSIGNED;
+            return;
+        }
     }
 }
 
 // ====================================================================================================
 
-static bool _readLines( struct symbol *p )
-{
-    Dwarf_Debug dbg;
-    Dwarf_Error err;
-    Dwarf_Unsigned cu_header_length = 0;
-    Dwarf_Half     version_stamp = 0;
-    Dwarf_Off      abbrev_offset = 0;
-    Dwarf_Addr     cu_low_addr;
-    Dwarf_Half     address_size = 0;
-    Dwarf_Unsigned next_cu_header = 0;
-    Dwarf_Die      cu_die = NULL;
-
-    bool retval = false;
-    Dwarf_Half dw_length_size = 0;
-    Dwarf_Half dw_extension_size = 0;
-    Dwarf_Sig8 dw_type_signature;
-    Dwarf_Unsigned dw_typeoffset = 0;
-    Dwarf_Half dw_header_cu_type = DW_UT_compile;
-
-    char *name;
-    char *producer;
-    char *compdir;
+static void _processVariableDie( struct dwarfWorker *w, Dwarf_Debug dbg, Dwarf_Die die, int filenameN )
 
-    unsigned int filenameN;
-    unsigned int producerN;
+{
+    char *name = NULL;
+    Dwarf_Attribute attr_data;
+    Dwarf_Off specification_offset;
+    Dwarf_Die specification_die = NULL;
+    symbolMemaddr addr;
+    struct symbolVariableStore *newVar;
 
-    if ( 0 != dwarf_init_b( p->fd, DW_GROUPNUMBER_ANY, NULL, NULL, &dbg, &err ) )
+    /* Only variables with a fixed address are any use to us */
+    if ( ( DW_DLV_OK != dwarf_attr( die, DW_AT_location, &attr_data, 0 ) ) || ( !_varAddress( attr_data, &addr ) ) )
     {
-        return false;
+        return;
     }
 
-    struct Dwarf_Printf_Callback_Info_s print_setup =
+    /* The definition of something declared elsewhere has its name and type with the declaration */
+    if ( ( DW_DLV_OK == dwarf_attr( die, DW_AT_specification, &attr_data, 0 ) ) &&
+            ( DW_DLV_OK == dwarf_global_formref( attr_data, &specification_offset, 0 ) ) )
     {
-        .dp_user_pointer = p,
-        .dp_fptr = &_dwarf_print,
-        .dp_buffer = _print_buffer,
-        .dp_buffer_len = DP_MAX_LINE_LEN,
-        .dp_buffer_user_provided = true,
-        .dp_reserved = NULL
-
-    };
-
-    dwarf_register_printf_callback( dbg, &print_setup );
+        dwarf_offdie_b( dbg, specification_offset, IS_INFO, &specification_die, 0 );
+    }
 
-    /* Add an empty string to each string table, so the 0th element is the empty string in all cases */
-    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    if ( ( DW_DLV_OK != dwarf_diename( die, &name, 0 ) ) && ( specification_die ) )
     {
-        _findOrAddString( "", &p->stringTable[pt],  &p->tableLen[pt] );
+        dwarf_diename( specification_die, &name, 0 );
     }
 
-    /* 1: Collect the functions and lines */
-    /* ---------------------------------- */
-    while ( true )
+    if ( name )
     {
-        memset( &dw_type_signature, 0, sizeof( dw_type_signature ) );
+        newVar = _newVar( w );
+        newVar->varname  = memStrdup( MEM_SYMBOLS, name );
+        newVar->filename = filenameN;
+        newVar->addr     = addr;
+        _varType( dbg, die, newVar );
 
-        if ( DW_DLV_OK != dwarf_next_cu_header_d( dbg, true, &cu_header_length,
-                &version_stamp, &abbrev_offset, &address_size,
-                &dw_length_size, &dw_extension_size, &dw_type_signature,
-                &dw_typeoffset, &next_cu_header, &dw_header_cu_type, 0 ) )
+        if ( ( !newVar->size ) && ( specification_die ) )
         {
-            break;
+            _varType( dbg, specification_die, newVar );
         }
+    }
+}
 
-        dwarf_siblingof_b( dbg, NULL, IS_INFO, &cu_die, 0 );
-
-        dwarf_diename( cu_die, &name, 0 );
-        dwarf_die_text( cu_die, DW_AT_producer, &producer, 0 );
-        dwarf_die_text( cu_die, DW_AT_comp_dir, &compdir, 0 );
-
-        /* Need to construct the fully qualified filename from the directory + filename */
-        char *s = _joinPaths( compdir, name );
-        filenameN  = _findOrAddString( s, &p->stringTable[PT_FILENAME],  &p->tableLen[PT_FILENAME] );
-        free( s );
-        producerN =  _findOrAddString( producer, &p->stringTable[PT_PRODUCER],  &p->tableLen[PT_PRODUCER] );
+// ====================================================================================================
 
-        /* Kickoff the process for the DIE and its children to get the functions in this cu */
+static void _processOneDie( struct dwarfWorker *w, Dwarf_Debug dbg, Dwarf_Die die, int filenameN, int producerN, Dwarf_Addr cu_base_addr )
 
-        dwarf_lowpc( cu_die, &cu_low_addr, 0 );
-        _processDie( p, dbg, cu_die, 0, filenameN, producerN, cu_low_addr );
+{
+    Dwarf_Half tag;
 
-        /* ...and the source lines */
-        _getSourceLines( p, dbg, cu_die );
+    dwarf_tag( die, &tag, 0 );
 
-        dwarf_dealloc( dbg, cu_die, DW_DLA_DIE );
+    if ( ( tag == DW_TAG_subprogram ) || ( tag == DW_TAG_inlined_subroutine ) )
+    {
+        _processFunctionDie( w, dbg, die, filenameN, producerN, cu_base_addr );
     }
-
-    if ( p->nlines && p->nfunc )
+    else if ( tag == DW_TAG_variable )
     {
-        /* 2: We have the lines and functions. Clean them up and interlink them so they're useful to applications */
-        /* ------------------------------------------------------------------------------------------------------ */
-        /* Sort tables into address order, just in case they're not ... no gaurantees from the DWARF */
-        qsort( p->line, p->nlines, sizeof( struct symbolLineStore * ), _compareLineMem );
-        qsort( p->func, p->nfunc, sizeof( struct symbolFunctionStore * ), _compareFunc );
+        _processVariableDie( w, dbg, die, filenameN );
+    }
+}
 
-        /* Combine addresses in the lines table which have the same memory location...those aren't too useful for us      */
-        int nlines = 0;
-        struct symbolLineStore **nls = NULL;
+// ====================================================================================================
 
-        for ( int i = 0; i < p->nlines - 1; i++ )
+static void _processDie( struct dwarfWorker *w, Dwarf_Debug dbg, Dwarf_Die die, int level, int filenameN, int producerN, Dwarf_Addr cu_base_addr )
+
+{
+    Dwarf_Die child;
+
+    Dwarf_Die sib = die;
+
+    /* The die we're given is the first of its siblings, each of which is looked at below. The CU has none */
+    if ( level )
+    {
+        _processOneDie( w, dbg, die, filenameN, producerN, cu_base_addr );
+    }
+
+    while ( DW_DLV_OK == dwarf_siblingof_b( dbg, sib, IS_INFO, &sib, 0 ) )
+    {
+        _processOneDie( w, dbg, sib, filenameN, producerN, cu_base_addr );
+    }
+
+    if ( DW_DLV_OK == dwarf_child( die, &child, 0 ) )
+    {
+        _processDie( w, dbg, child, level + 1, filenameN, producerN, cu_base_addr );
+        dwarf_dealloc( dbg, child, DW_DLA_DIE );
+    }
+}
+
+// ====================================================================================================
+
+static void _newInlineSpan( struct dwarfWorker *w, Dwarf_Addr l, Dwarf_Addr h, uint32_t call )
+
+/* Note the addresses [l,h) as being in the inlined call */
+
+{
+    if ( ( !l ) || ( h <= l ) )
+    {
+        /* As with the lines, anything at zero was discarded by the linker */
+        return;
+    }
+
+    if ( w->nspan == w->spanAlloc )
+    {
+        w->spanAlloc = ( w->spanAlloc ) ? w->spanAlloc * 2 : DWARF_TABLE_INITIAL;
+        w->span = ( struct inlineSpan * )memRealloc( MEM_SYMBOLS, w->span, sizeof( struct inlineSpan ) * w->spanAlloc );
+        MEMCHECKV( w->span );
+    }
+
+    w->span[w->nspan++] = ( struct inlineSpan )
+    {
+        .lowaddr = l, .highaddr = h - 1, .call = call
+    };
+}
+
+// ====================================================================================================
+
+static void _inlineRanges( struct dwarfWorker *w, struct inlineCU *cu, Dwarf_Die die, uint32_t call )
+
+/* Collect the addresses covered by an inlined call, which are a pc range or a list of ranges */
+
+{
+    Dwarf_Addr l = 0;
+    Dwarf_Addr h = 0;
+    enum Dwarf_Form_Class formclass = DW_FORM_CLASS_UNKNOWN;
+    Dwarf_Attribute attr_data;
+    Dwarf_Unsigned offset;
+    Dwarf_Half form = 0;
+
+    if ( ( DW_DLV_OK == dwarf_lowpc( die, &l, 0 ) ) && ( DW_DLV_OK == dwarf_highpc_b( die, &h, 0, &formclass, 0 ) ) )
+    {
+        _newInlineSpan( w, l, ( formclass == DW_FORM_CLASS_CONSTANT ) ? l + h : h, call );
+        return;
+    }
+
+    if ( ( DW_DLV_OK != dwarf_attr( die, DW_AT_ranges, &attr_data, 0 ) ) || ( DW_DLV_OK != dwarf_whatform( attr_data, &form, 0 ) ) )
+    {
+        return;
+    }
+
+    if ( cu->version >= 5 )
+    {
+        /* DWARF 5 range lists, where libdwarf gives the addresses with any base already added */
+        Dwarf_Rnglists_Head head;
+        Dwarf_Unsigned count;
+        Dwarf_Unsigned global;
+
+        if ( ( DW_DLV_OK != ( ( form == DW_FORM_rnglistx ) ? dwarf_formudata( attr_data, &offset, 0 ) : dwarf_global_formref( attr_data, &offset, 0 ) ) ) ||
+                ( DW_DLV_OK != dwarf_rnglists_get_rle_head( attr_data, form, offset, &head, &count, &global, 0 ) ) )
+        {
+            return;
+        }
+
+        for ( Dwarf_Unsigned i = 0; i < count; i++ )
+        {
+            unsigned int entrylen;
+            unsigned int code;
+            Dwarf_Unsigned raw1, raw2, cooked1, cooked2;
+            Dwarf_Bool unavailable = false;
+
+            if ( ( DW_DLV_OK == dwarf_get_rnglists_entry_fields_a( head, i, &entrylen, &code, &raw1, &raw2, &unavailable, &cooked1, &cooked2, 0 ) ) &&
+                    ( !unavailable ) && ( code != DW_RLE_end_of_list ) && ( code != DW_RLE_base_address ) && ( code != DW_RLE_base_addressx ) )
+            {
+                _newInlineSpan( w, cooked1, cooked2, call );
+            }
+        }
+
+        dwarf_dealloc_rnglists_head( head );
+    }
+    else
+    {
+        /* Earlier ones are from the base address of the compilation unit, unless they say otherwise */
+        Dwarf_Ranges *r;
+        Dwarf_Signed count;
+        Dwarf_Unsigned bytes;
+        Dwarf_Off real;
+        Dwarf_Addr base = cu->base;
+
+        if ( ( DW_DLV_OK != dwarf_global_formref( attr_data, &offset, 0 ) ) ||
+                ( DW_DLV_OK != dwarf_get_ranges_b( cu->dbg, offset, die, &real, &r, &count, &bytes, 0 ) ) )
+        {
+            return;
+        }
+
+        for ( Dwarf_Signed i = 0; i < count; i++ )
+        {
+            if ( r[i].dwr_type == DW_RANGES_ENTRY )
+            {
+                _newInlineSpan( w, base + r[i].dwr_addr1, base + r[i].dwr_addr2, call );
+            }
+            else if ( r[i].dwr_type == DW_RANGES_ADDRESS_SELECTION )
+            {
+                base = r[i].dwr_addr2;
+            }
+        }
+
+        dwarf_dealloc_ranges( cu->dbg, r, count );
+    }
+}
+
+// ====================================================================================================
+
+static uint32_t _newInlineCall( struct dwarfWorker *w, struct inlineCU *cu, Dwarf_Die die, int32_t parent )
+
+/* Record an inlined call. Its name is with its abstract origin, or whatever that's a specification of */
+
+{
+    struct inlineCall *c;
+    Dwarf_Attribute attr_data;
+    Dwarf_Unsigned v;
+    Dwarf_Off off;
+    Dwarf_Die d = die;
+    Dwarf_Die next;
+    char *name = NULL;
+    char *mangle = NULL;
+
+    if ( w->ncall == w->callAlloc )
+    {
+        w->callAlloc = ( w->callAlloc ) ? w->callAlloc * 2 : DWARF_TABLE_INITIAL;
+        w->call = ( struct inlineCall * )memRealloc( MEM_SYMBOLS, w->call, sizeof( struct inlineCall ) * w->callAlloc );
+        MEMCHECK( w->call, 0 );
+    }
+
+    c = &w->call[w->ncall];
+    *c = ( struct inlineCall )
+    {
+        .name = NO_STRING, .mangle = NO_STRING, .callfile = NO_STRING, .parent = parent
+    };
+
+    for ( int depth = 0; ( depth < DWARF_ORIGIN_DEPTH ) && ( c->name == NO_STRING ); depth++ )
+    {
+        if ( ( c->mangle == NO_STRING ) && ( DW_DLV_OK == dwarf_attr( d, DW_AT_linkage_name, &attr_data, 0 ) ) &&
+                ( DW_DLV_OK == dwarf_formstring( attr_data, &mangle, 0 ) ) )
+        {
+            c->mangle = _stringAdd( &w->strings[PT_INLINENAME], mangle, false );
+        }
+
+        if ( ( d != die ) && ( DW_DLV_OK == dwarf_diename( d, &name, 0 ) ) )
+        {
+            c->name = _stringAdd( &w->strings[PT_INLINENAME], name, false );
+        }
+        else if ( ( ( DW_DLV_OK == dwarf_attr( d, DW_AT_abstract_origin, &attr_data, 0 ) ) ||
+                    ( DW_DLV_OK == dwarf_attr( d, DW_AT_specification, &attr_data, 0 ) ) ) &&
+                  ( DW_DLV_OK == dwarf_global_formref( attr_data, &off, 0 ) ) &&
+                  ( DW_DLV_OK == dwarf_offdie_b( cu->dbg, off, IS_INFO, &next, 0 ) ) )
+        {
+            if ( d != die )
+            {
+                dwarf_dealloc( cu->dbg, d, DW_DLA_DIE );
+            }
+
+            d = next;
+            continue;
+        }
+
+        break;
+    }
+
+    if ( d != die )
+    {
+        dwarf_dealloc( cu->dbg, d, DW_DLA_DIE );
+    }
+
+    /* The file is an index into the line table's files, which counts from 1 before DWARF 5 */
+    if ( ( DW_DLV_OK == dwarf_attr( die, DW_AT_call_file, &attr_data, 0 ) ) && ( DW_DLV_OK == dwarf_formudata( attr_data, &v, 0 ) ) )
+    {
+        v -= ( cu->version < 5 ) ? 1 : 0;
+
+        if ( v < ( Dwarf_Unsigned )cu->nfiles )
+        {
+            c->callfile = _stringAdd( &w->strings[PT_FILENAME], cu->files[v], false );
+        }
+    }
+
+    if ( ( DW_DLV_OK == dwarf_attr( die, DW_AT_call_line, &attr_data, 0 ) ) && ( DW_DLV_OK == dwarf_formudata( attr_data, &v, 0 ) ) )
+    {
+        c->callline = v;
+    }
+
+    return w->ncall++;
+}
+
+// ====================================================================================================
+
+static void _inlineWalk( struct dwarfWorker *w, struct inlineCU *cu, Dwarf_Die die, int32_t parent )
+
+/* Go through everything under die that can have code in it, collecting the inlined calls and which */
+/* ones they're inside. A function starts again from nothing, even if it's inside an inlined call.  */
+
+{
+    Dwarf_Die child;
+    Dwarf_Die sib;
+    Dwarf_Half tag;
+    uint32_t call;
+    int res;
+
+    if ( DW_DLV_OK != dwarf_child( die, &child, 0 ) )
+    {
+        return;
+    }
+
+    while ( child )
+    {
+        dwarf_tag( child, &tag, 0 );
+
+        if ( tag == DW_TAG_inlined_subroutine )
+        {
+            call = _newInlineCall( w, cu, child, parent );
+            _inlineRanges( w, cu, child, call );
+            _inlineWalk( w, cu, child, call );
+        }
+        else if ( ( tag == DW_TAG_subprogram ) || ( tag == DW_TAG_namespace ) )
+        {
+            _inlineWalk( w, cu, child, -1 );
+        }
+        else if ( tag == DW_TAG_lexical_block )
+        {
+            _inlineWalk( w, cu, child, parent );
+        }
+
+        res = dwarf_siblingof_b( cu->dbg, child, IS_INFO, &sib, 0 );
+        dwarf_dealloc( cu->dbg, child, DW_DLA_DIE );
+        child = ( DW_DLV_OK == res ) ? sib : NULL;
+    }
+}
+
+// ====================================================================================================
+
+static void _getInlines( struct dwarfWorker *w, Dwarf_Debug dbg, Dwarf_Die cu_die, Dwarf_Addr cu_base_addr )
+
+/* Collect the inlined calls in a compilation unit */
+
+{
+    Dwarf_Half offset_size;
+    struct inlineCU cu =
+    {
+        .dbg = dbg, .base = cu_base_addr
+    };
+
+    dwarf_get_version_of_die( cu_die, &cu.version, &offset_size );
+
+    if ( DW_DLV_OK != dwarf_srcfiles( cu_die, &cu.files, &cu.nfiles, 0 ) )
+    {
+        cu.files = NULL;
+        cu.nfiles = 0;
+    }
+
+    _inlineWalk( w, &cu, cu_die, -1 );
+
+    for ( Dwarf_Signed i = 0; i < cu.nfiles; i++ )
+    {
+        dwarf_dealloc( dbg, cu.files[i], DW_DLA_STRING );
+    }
+
+    if ( cu.files )
+    {
+        dwarf_dealloc( dbg, cu.files, DW_DLA_LIST );
+    }
+}
+
+// ====================================================================================================
+
+static bool _isAbsPath( const char *p )
+
+{
+    /* Path is absolute if it starts with / or x: where x is in the range A..Z. */
+    return (
+                       ( p[0] == '/' ) ||
+                       ( ( toupper( p[0] ) >= 'A' ) && ( toupper( p[0] ) <= 'Z' ) && ( p[1] == ':' ) )
+           );
+}
+
+// ====================================================================================================
+
+static char *_joinPaths( const char *p1, const char *p2 )
+
+{
+    if ( _isAbsPath( p2 ) )
+    {
+        return memStrdup( MEM_SYMBOLS, p2 );
+    }
+    else
+    {
+        char *res = ( char * )memAlloc( MEM_SYMBOLS, strlen( p1 ) + strlen( p2 ) + 2 );
+        strcpy( res, p1 );
+        strcat( res, "/" );
+        strcat( res, p2 );
+        return res;
+    }
+}
+
+// ====================================================================================================
+
+static bool _nextCU( Dwarf_Debug dbg )
+
+/* Move on to the next compilation unit, returning false when there are no more */
+
+{
+    Dwarf_Unsigned cu_header_length = 0;
+    Dwarf_Half     version_stamp = 0;
+    Dwarf_Off      abbrev_offset = 0;
+    Dwarf_Half     address_size = 0;
+    Dwarf_Unsigned next_cu_header = 0;
+    Dwarf_Half dw_length_size = 0;
+    Dwarf_Half dw_extension_size = 0;
+    Dwarf_Sig8 dw_type_signature;
+    Dwarf_Unsigned dw_typeoffset = 0;
+    Dwarf_Half dw_header_cu_type = DW_UT_compile;
+
+    memset( &dw_type_signature, 0, sizeof( dw_type_signature ) );
+
+    return ( DW_DLV_OK == dwarf_next_cu_header_d( dbg, true, &cu_header_length,
+             &version_stamp, &abbrev_offset, &address_size,
+             &dw_length_size, &dw_extension_size, &dw_type_signature,
+             &dw_typeoffset, &next_cu_header, &dw_header_cu_type, 0 ) );
+}
+
+// ====================================================================================================
+
+static void *_dwarfTask( void *arg )
+
+/* Collect the functions and lines from whichever compilation units this worker gets to first */
+
+{
+    struct dwarfWorker *w = ( struct dwarfWorker * )arg;
+    Dwarf_Debug dbg;
+    Dwarf_Error err;
+    Dwarf_Addr cu_low_addr;
+    Dwarf_Die cu_die = NULL;
+
+    char *name;
+    char *producer;
+    char *compdir;
+
+    unsigned int filenameN;
+    unsigned int producerN;
+
+    if ( 0 != dwarf_init_b( w->fd, DW_GROUPNUMBER_ANY, NULL, NULL, &dbg, &err ) )
+    {
+        return NULL;
+    }
+
+    struct Dwarf_Printf_Callback_Info_s print_setup =
+    {
+        .dp_user_pointer = w,
+        .dp_fptr = &_dwarf_print,
+        .dp_buffer = w->printBuffer,
+        .dp_buffer_len = DP_MAX_LINE_LEN,
+        .dp_buffer_user_provided = true,
+        .dp_reserved = NULL
+
+    };
+
+    dwarf_register_printf_callback( dbg, &print_setup );
+
+    unsigned int want = atomic_fetch_add( &w->job->nextCU, 1 );
+
+    for ( unsigned int cu = 0; _nextCU( dbg ); cu++ )
+    {
+        if ( cu != want )
+        {
+            /* Someone else has this one */
+            continue;
+        }
+
+        want = atomic_fetch_add( &w->job->nextCU, 1 );
+
+        dwarf_siblingof_b( dbg, NULL, IS_INFO, &cu_die, 0 );
+
+        dwarf_diename( cu_die, &name, 0 );
+        dwarf_die_text( cu_die, DW_AT_producer, &producer, 0 );
+        dwarf_die_text( cu_die, DW_AT_comp_dir, &compdir, 0 );
+
+        /* Need to construct the fully qualified filename from the directory + filename */
+        filenameN = _stringAdd( &w->strings[PT_FILENAME], _joinPaths( compdir, name ), true );
+        producerN = _stringAdd( &w->strings[PT_PRODUCER], producer, false );
+
+        /* Kickoff the process for the DIE and its children to get the functions in this cu */
+        dwarf_lowpc( cu_die, &cu_low_addr, 0 );
+        _processDie( w, dbg, cu_die, 0, filenameN, producerN, cu_low_addr );
+
+        /* ...and the source lines */
+        _getSourceLines( w, dbg, cu_die );
+
+        /* ...and what was inlined where */
+        _getInlines( w, dbg, cu_die, cu_low_addr );
+
+        dwarf_dealloc( dbg, cu_die, DW_DLA_DIE );
+    }
+
+    dwarf_finish( dbg );
+
+    /* Sort into address order here, so all that's left is to merge what each worker has */
+    qsort( w->line, w->nlines, sizeof( struct symbolLineStore * ), _compareLineMem );
+    qsort( w->func, w->nfunc, sizeof( struct symbolFunctionStore * ), _compareFunc );
+    qsort( w->var, w->nvar, sizeof( struct symbolVariableStore * ), _compareVar );
+    return NULL;
+}
+
+// ====================================================================================================
+
+static void _mergeSorted( void **out, void ***run, unsigned int *len, int nruns, int ( *compare )( const void *, const void * ) )
+
+/* Merge the sorted runs into out, which is big enough for all of them */
+
+{
+    unsigned int at[DWARF_MAX_THREADS] = { 0 };
+
+    while ( true )
+    {
+        int best = -1;
+
+        for ( int r = 0; r < nruns; r++ )
+        {
+            if ( ( at[r] < len[r] ) && ( ( best < 0 ) || ( compare( &run[r][at[r]], &run[best][at[best]] ) < 0 ) ) )
+            {
+                best = r;
+            }
+        }
+
+        if ( best < 0 )
+        {
+            break;
+        }
+
+        *out++ = run[best][at[best]++];
+    }
+}
+
+// ====================================================================================================
+
+static void _inlinePoolAdd( struct inlinePool *pool, struct dwarfWorker *w, unsigned int **map )
+
+/* Put a worker's inlined calls into the shared pool, as stacks. A call is always found before the */
+/* ones inlined into it, so the stack it's in is already in the pool when it gets there.        */
+
+{
+    struct inlineNode *n;
+    struct inlineKey k;
+
+    for ( unsigned int i = 0; i < w->ncall; i++ )
+    {
+        struct inlineCall *c = &w->call[i];
+
+        memset( &k, 0, sizeof( k ) );
+        k.name     = ( c->name == NO_STRING ) ? 0 : map[PT_INLINENAME][c->name];
+        k.mangle   = ( c->mangle == NO_STRING ) ? 0 : map[PT_INLINENAME][c->mangle];
+        k.callfile = ( c->callfile == NO_STRING ) ? 0 : map[PT_FILENAME][c->callfile];
+        k.callline = c->callline;
+        k.parent   = ( c->parent < 0 ) ? NO_STRING : w->call[c->parent].node;
+
+        HASH_FIND( hh, pool->hash, &k, sizeof( k ), n );
+
+        if ( !n )
+        {
+            if ( pool->nnode == pool->alloc )
+            {
+                pool->alloc = ( pool->alloc ) ? pool->alloc * 2 : DWARF_TABLE_INITIAL;
+                pool->node = ( struct inlineNode ** )memRealloc( MEM_SYMBOLS, pool->node, sizeof( struct inlineNode * ) * pool->alloc );
+                MEMCHECKV( pool->node );
+            }
+
+            n = pool->node[pool->nnode] = ( struct inlineNode * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct inlineNode ) );
+            MEMCHECKV( n );
+            n->k     = k;
+            n->index = pool->nnode++;
+            n->depth = ( k.parent == NO_STRING ) ? 1 : pool->node[k.parent]->depth + 1;
+            n->chain = NO_STRING;
+            HASH_ADD( hh, pool->hash, k, sizeof( k ), n );
+        }
+
+        c->node = n->index;
+    }
+
+    for ( unsigned int i = 0; i < w->nspan; i++ )
+    {
+        w->span[i].call  = w->call[w->span[i].call].node;
+        w->span[i].depth = pool->node[w->span[i].call]->depth;
+    }
+}
+
+// ====================================================================================================
+
+static int _compareSpan( const void *a, const void *b )
+
+/* Sort spans by start address, with the ones that enclose others before them */
+
+{
+    const struct inlineSpan *sa = ( const struct inlineSpan * )a;
+    const struct inlineSpan *sb = ( const struct inlineSpan * )b;
+
+    if ( sa->lowaddr != sb->lowaddr )
+    {
+        return ( sa->lowaddr < sb->lowaddr ) ? -1 : 1;
+    }
+
+    if ( sa->highaddr != sb->highaddr )
+    {
+        return ( sa->highaddr > sb->highaddr ) ? -1 : 1;
+    }
+
+    return ( sa->depth < sb->depth ) ? -1 : ( sa->depth > sb->depth ) ? 1 : 0;
+}
+
+// ====================================================================================================
+
+static void _inlineEmit( struct symbol *p, struct inlinePool *pool, symbolMemaddr l, symbolMemaddr h, uint32_t node, unsigned int *frameAlloc )
+
+/* Add [l,h] to the inline range table, laying out the stack it's in if this is the first time it's been used */
+
+{
+    struct inlineNode *n = pool->node[node];
+    struct symbolInlineRange *r = ( p->ninline ) ? &p->inlineRange[p->ninline - 1] : NULL;
+
+    if ( n->chain == NO_STRING )
+    {
+        if ( p->ninlineFrame + n->depth > *frameAlloc )
+        {
+            *frameAlloc = ( *frameAlloc ) ? *frameAlloc * 2 + n->depth : DWARF_TABLE_INITIAL + n->depth;
+            p->inlineFrame = ( struct symbolInlineFrame * )memRealloc( MEM_SYMBOLS, p->inlineFrame, sizeof( struct symbolInlineFrame ) * *frameAlloc );
+            MEMCHECKV( p->inlineFrame );
+        }
+
+        n->chain = p->ninlineFrame;
+
+        for ( struct inlineNode *f = n; f; f = ( f->k.parent == NO_STRING ) ? NULL : pool->node[f->k.parent] )
+        {
+            p->inlineFrame[p->ninlineFrame++] = ( struct symbolInlineFrame )
+            {
+                .funcname = f->k.name, .manglename = f->k.mangle, .callfile = f->k.callfile, .callline = f->k.callline
+            };
+        }
+    }
+
+    if ( ( r ) && ( r->chain == n->chain ) && ( r->highaddr + 1 == l ) )
+    {
+        r->highaddr = h;
+        return;
+    }
+
+    p->inlineRange[p->ninline++] = ( struct symbolInlineRange )
+    {
+        .lowaddr = l, .highaddr = h, .chain = n->chain, .depth = n->depth
+    };
+}
+
+// ====================================================================================================
+
+static void _inlineTable( struct symbol *p, struct inlinePool *pool, struct dwarfWorker *w, int nworkers )
+
+/* Turn the spans of the inlined calls, which nest, into ranges that don't overlap, each with the */
+/* stack of its innermost call. That's a single lookup for whoever wants the stack at an address. */
+
+{
+    struct inlineSpan *span;
+    struct inlineSpan **stack;
+    unsigned int nspan = 0;
+    unsigned int sp = 0;
+    unsigned int frameAlloc = 0;
+    symbolMemaddr at = 0;
+
+    for ( int i = 0; i < nworkers; i++ )
+    {
+        nspan += w[i].nspan;
+    }
+
+    if ( !nspan )
+    {
+        return;
+    }
+
+    span = ( struct inlineSpan * )memAlloc( MEM_SYMBOLS, sizeof( struct inlineSpan ) * nspan );
+    stack = ( struct inlineSpan ** )memAlloc( MEM_SYMBOLS, sizeof( struct inlineSpan * ) * nspan );
+
+    /* Each span can split the one it's in, so there are never more than twice as many ranges */
+    p->inlineRange = ( struct symbolInlineRange * )memAlloc( MEM_SYMBOLS, sizeof( struct symbolInlineRange ) * ( 2 * nspan + 1 ) );
+
+    if ( ( !span ) || ( !stack ) || ( !p->inlineRange ) )
+    {
+        genericsExit( -1, "Memory allocation failure" EOL );
+    }
+
+    for ( int i = 0, k = 0; i < nworkers; k += w[i++].nspan )
+    {
+        memcpy( &span[k], w[i].span, sizeof( struct inlineSpan ) * w[i].nspan );
+    }
+
+    qsort( span, nspan, sizeof( struct inlineSpan ), _compareSpan );
+
+    for ( unsigned int i = 0; i <= nspan; i++ )
+    {
+        struct inlineSpan *s = ( i < nspan ) ? &span[i] : NULL;
+
+        /* Finish off whatever ends before this starts (or everything, at the end) */
+        while ( ( sp ) && ( ( !s ) || ( stack[sp - 1]->highaddr < s->lowaddr ) ) )
+        {
+            struct inlineSpan *t = stack[--sp];
+
+            if ( at <= t->highaddr )
+            {
+                _inlineEmit( p, pool, at, t->highaddr, t->call, &frameAlloc );
+                at = t->highaddr + 1;
+            }
+        }
+
+        if ( !s )
+        {
+            break;
+        }
+
+        if ( sp )
+        {
+            /* The one this is in goes up to where it starts. Calls should nest, but keep it inside if it doesn't */
+            if ( at < s->lowaddr )
+            {
+                _inlineEmit( p, pool, at, s->lowaddr - 1, stack[sp - 1]->call, &frameAlloc );
+            }
+
+            s->highaddr = ( s->highaddr > stack[sp - 1]->highaddr ) ? stack[sp - 1]->highaddr : s->highaddr;
+        }
+
+        at = ( at > s->lowaddr ) ? at : s->lowaddr;
+        stack[sp++] = s;
+    }
+
+    memFree( MEM_SYMBOLS, span );
+    memFree( MEM_SYMBOLS, stack );
+
+    /* ...and there are usually a good few less than that */
+    p->inlineRange = ( struct symbolInlineRange * )memRealloc( MEM_SYMBOLS, p->inlineRange, sizeof( struct symbolInlineRange ) * ( p->ninline + 1 ) );
+    MEMCHECKV( p->inlineRange );
+
+    genericsReport( V_DEBUG, "%u inline ranges, with %u frames for %u inline stacks" EOL, p->ninline, p->ninlineFrame, pool->nnode );
+}
+
+// ====================================================================================================
+
+static void _mergeWorkers( struct symbol *p, struct dwarfWorker *w, int nworkers )
+
+/* Bring what the workers found together into the symbol set, with one copy of each string */
+
+{
+    struct stringTable strings[PT_NUMTABLES] = { 0 };
+    void **lineRun[DWARF_MAX_THREADS];
+    void **funcRun[DWARF_MAX_THREADS];
+    unsigned int lineLen[DWARF_MAX_THREADS];
+    unsigned int funcLen[DWARF_MAX_THREADS];
+    void **varRun[DWARF_MAX_THREADS];
+    unsigned int varLen[DWARF_MAX_THREADS];
+    struct inlinePool pool = { 0 };
+    struct inlineNode *n, *tn;
+
+    /* Add an empty string to each string table, so the 0th element is the empty string in all cases */
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        _stringAdd( &strings[pt], "", false );
+    }
+
+    for ( int i = 0; i < nworkers; i++ )
+    {
+        unsigned int *map[PT_NUMTABLES];
+
+        /* Each worker's strings go into the shared tables, leaving a note of where they went */
+        for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+        {
+            map[pt] = ( unsigned int * )memAlloc( MEM_SYMBOLS, sizeof( unsigned int ) * ( w[i].strings[pt].len + 1 ) );
+            MEMCHECKV( map[pt] );
+
+            for ( unsigned int j = 0; j < w[i].strings[pt].len; j++ )
+            {
+                map[pt][j] = _stringAdd( &strings[pt], w[i].strings[pt].table[j], true );
+            }
+
+            /* ...its strings belong to the shared tables now */
+            _stringIndexFree( &w[i].strings[pt] );
+            memFree( MEM_SYMBOLS, w[i].strings[pt].table );
+        }
+
+        for ( unsigned int j = 0; j < w[i].nlines; j++ )
+        {
+            w[i].line[j]->filename = map[PT_FILENAME][w[i].line[j]->filename];
+        }
+
+        for ( unsigned int j = 0; j < w[i].nfunc; j++ )
+        {
+            w[i].func[j]->filename = map[PT_FILENAME][w[i].func[j]->filename];
+            w[i].func[j]->producer = map[PT_PRODUCER][w[i].func[j]->producer];
+        }
+
+        for ( unsigned int j = 0; j < w[i].nvar; j++ )
+        {
+            w[i].var[j]->filename = map[PT_FILENAME][w[i].var[j]->filename];
+        }
+
+        _inlinePoolAdd( &pool, &w[i], map );
+
+        for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+        {
+            memFree( MEM_SYMBOLS, map[pt] );
+        }
+
+        lineRun[i] = ( void ** )w[i].line;
+        lineLen[i] = w[i].nlines;
+        funcRun[i] = ( void ** )w[i].func;
+        funcLen[i] = w[i].nfunc;
+        varRun[i] = ( void ** )w[i].var;
+        varLen[i] = w[i].nvar;
+        p->nlines += w[i].nlines;
+        p->nfunc += w[i].nfunc;
+        p->nvar += w[i].nvar;
+    }
+
+    p->line = ( struct symbolLineStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolLineStore * ) * ( p->nlines + 1 ) );
+    MEMCHECKV( p->line );
+    p->func = ( struct symbolFunctionStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolFunctionStore * ) * ( p->nfunc + 1 ) );
+    MEMCHECKV( p->func );
+    p->var = ( struct symbolVariableStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolVariableStore * ) * ( p->nvar + 1 ) );
+    MEMCHECKV( p->var );
+    _mergeSorted( ( void ** )p->line, lineRun, lineLen, nworkers, _compareLineMem );
+    _mergeSorted( ( void ** )p->func, funcRun, funcLen, nworkers, _compareFunc );
+    _mergeSorted( ( void ** )p->var, varRun, varLen, nworkers, _compareVar );
+
+    _inlineTable( p, &pool, w, nworkers );
+
+    HASH_ITER( hh, pool.hash, n, tn )
+    {
+        HASH_DEL( pool.hash, n );
+        memFree( MEM_SYMBOLS, n );
+    }
+
+    memFree( MEM_SYMBOLS, pool.node );
+
+    for ( int i = 0; i < nworkers; i++ )
+    {
+        memFree( MEM_SYMBOLS, w[i].line );
+        memFree( MEM_SYMBOLS, w[i].func );
+        memFree( MEM_SYMBOLS, w[i].var );
+        memFree( MEM_SYMBOLS, w[i].call );
+        memFree( MEM_SYMBOLS, w[i].span );
+    }
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        p->stringTable[pt] = strings[pt].table;
+        p->tableLen[pt] = strings[pt].len;
+        _stringIndexFree( &strings[pt] );
+    }
+}
+
+// ====================================================================================================
+
+/* Images are merged in the same way as the workers' results are */
+#if ( SYMBOL_MAX_IMAGES > DWARF_MAX_THREADS )
+    #error "SYMBOL_MAX_IMAGES can't be more than DWARF_MAX_THREADS"
+#endif
+
+static void _offsetImage( struct symbol *p, symbolMemaddr offset )
+
+/* Move everything in the image up by offset, for an image that's loaded somewhere other than it's linked for */
+
+{
+    if ( !offset )
+    {
+        return;
+    }
+
+    for ( unsigned int i = 0; i < p->nsect_mem; i++ )
+    {
+        p->mem[i].start += offset;
+    }
+
+    for ( unsigned int i = 0; i < p->nfunc; i++ )
+    {
+        p->func[i]->lowaddr += offset;
+        p->func[i]->highaddr += offset;
+    }
+
+    /* ...the functions' lines are these same records, so they move with them */
+    for ( unsigned int i = 0; i < p->nlines; i++ )
+    {
+        p->line[i]->lowaddr += offset;
+        p->line[i]->highaddr += offset;
+    }
+
+    for ( unsigned int i = 0; i < p->nvar; i++ )
+    {
+        p->var[i]->addr += offset;
+    }
+
+    for ( unsigned int i = 0; i < p->ninline; i++ )
+    {
+        p->inlineRange[i].lowaddr += offset;
+        p->inlineRange[i].highaddr += offset;
+    }
+}
+
+// ====================================================================================================
+
+static void _mergeImages( struct symbol *p, struct symbol **image, unsigned int nimage )
+
+/* Bring the images together into p, with one address index over all of them and one copy of each */
+/* string. The records stay with the images they came from, p only has the tables that index them. */
+
+{
+    struct stringTable strings[PT_NUMTABLES] = { 0 };
+    void **lineRun[SYMBOL_MAX_IMAGES];
+    void **funcRun[SYMBOL_MAX_IMAGES];
+    void **varRun[SYMBOL_MAX_IMAGES];
+    unsigned int lineLen[SYMBOL_MAX_IMAGES];
+    unsigned int funcLen[SYMBOL_MAX_IMAGES];
+    unsigned int varLen[SYMBOL_MAX_IMAGES];
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        _stringAdd( &strings[pt], "", false );
+    }
+
+    for ( unsigned int i = 0; i < nimage; i++ )
+    {
+        struct symbol *q = image[i];
+        unsigned int *map[PT_NUMTABLES];
+
+        for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+        {
+            map[pt] = ( unsigned int * )memAlloc( MEM_SYMBOLS, sizeof( unsigned int ) * ( q->tableLen[pt] + 1 ) );
+            MEMCHECKV( map[pt] );
+
+            for ( unsigned int j = 0; j < q->tableLen[pt]; j++ )
+            {
+                map[pt][j] = _stringAdd( &strings[pt], q->stringTable[pt][j], false );
+            }
+        }
+
+        for ( unsigned int j = 0; j < q->nlines; j++ )
+        {
+            q->line[j]->filename = map[PT_FILENAME][q->line[j]->filename];
+        }
+
+        for ( unsigned int j = 0; j < q->nfunc; j++ )
+        {
+            q->func[j]->filename = map[PT_FILENAME][q->func[j]->filename];
+            q->func[j]->producer = map[PT_PRODUCER][q->func[j]->producer];
+        }
+
+        for ( unsigned int j = 0; j < q->nvar; j++ )
+        {
+            q->var[j]->filename = map[PT_FILENAME][q->var[j]->filename];
+        }
+
+        /* Memory regions and inline stacks are copied across, the stacks with their frames after any already there */
+        if ( q->nsect_mem )
+        {
+            p->mem = ( struct symbolMemoryStore * )memRealloc( MEM_SYMBOLS, p->mem, sizeof( struct symbolMemoryStore ) * ( p->nsect_mem + q->nsect_mem ) );
+            MEMCHECKV( p->mem );
+            memcpy( &p->mem[p->nsect_mem], q->mem, sizeof( struct symbolMemoryStore ) * q->nsect_mem );
+            p->nsect_mem += q->nsect_mem;
+        }
+
+        if ( q->ninline )
+        {
+            p->inlineRange = ( struct symbolInlineRange * )memRealloc( MEM_SYMBOLS, p->inlineRange, sizeof( struct symbolInlineRange ) * ( p->ninline + q->ninline ) );
+            MEMCHECKV( p->inlineRange );
+            p->inlineFrame = ( struct symbolInlineFrame * )memRealloc( MEM_SYMBOLS, p->inlineFrame, sizeof( struct symbolInlineFrame ) * ( p->ninlineFrame + q->ninlineFrame ) );
+            MEMCHECKV( p->inlineFrame );
+
+            for ( unsigned int j = 0; j < q->ninline; j++ )
+            {
+                p->inlineRange[p->ninline + j] = q->inlineRange[j];
+                p->inlineRange[p->ninline + j].chain += p->ninlineFrame;
+            }
+
+            for ( unsigned int j = 0; j < q->ninlineFrame; j++ )
+            {
+                struct symbolInlineFrame *f = &p->inlineFrame[p->ninlineFrame + j];
+
+                f->funcname = map[PT_INLINENAME][q->inlineFrame[j].funcname];
+                f->manglename = map[PT_INLINENAME][q->inlineFrame[j].manglename];
+                f->callfile = map[PT_FILENAME][q->inlineFrame[j].callfile];
+                f->callline = q->inlineFrame[j].callline;
+            }
+
+            p->ninline += q->ninline;
+            p->ninlineFrame += q->ninlineFrame;
+        }
+
+        for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+        {
+            memFree( MEM_SYMBOLS, map[pt] );
+        }
+
+        lineRun[i] = ( void ** )q->line;
+        lineLen[i] = q->nlines;
+        funcRun[i] = ( void ** )q->func;
+        funcLen[i] = q->nfunc;
+        varRun[i] = ( void ** )q->var;
+        varLen[i] = q->nvar;
+        p->nlines += q->nlines;
+        p->nfunc += q->nfunc;
+        p->nvar += q->nvar;
+    }
+
+    /* Each image's tables are already in order, so they only need merging */
+    p->line = ( struct symbolLineStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolLineStore * ) * ( p->nlines + 1 ) );
+    MEMCHECKV( p->line );
+    p->func = ( struct symbolFunctionStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolFunctionStore * ) * ( p->nfunc + 1 ) );
+    MEMCHECKV( p->func );
+    p->var = ( struct symbolVariableStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolVariableStore * ) * ( p->nvar + 1 ) );
+    MEMCHECKV( p->var );
+    _mergeSorted( ( void ** )p->line, lineRun, lineLen, nimage, _compareLineMem );
+    _mergeSorted( ( void ** )p->func, funcRun, funcLen, nimage, _compareFunc );
+    _mergeSorted( ( void ** )p->var, varRun, varLen, nimage, _compareVar );
+    qsort( p->mem, p->nsect_mem, sizeof( struct symbolMemoryStore ), _compareMem );
+    qsort( p->inlineRange, p->ninline, sizeof( struct symbolInlineRange ), _compareInlineRange );
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        p->stringTable[pt] = strings[pt].table;
+        p->tableLen[pt] = strings[pt].len;
+        _stringIndexFree( &strings[pt] );
+    }
+}
+
+// ====================================================================================================
+
+static bool _readLines( struct symbol *p, const char *filename )
+{
+    Dwarf_Debug dbg;
+    Dwarf_Error err;
+    struct dwarfJob job = { 0 };
+    struct dwarfWorker *w;
+    unsigned int ncu = 0;
+    int nworkers = 1;
+    int maxWorkers = 1;
+    bool retval = false;
+
+    /* 1: Count the compilation units, to see how many workers are worth starting */
+    /* -------------------------------------------------------------------------- */
+    if ( 0 != dwarf_init_b( p->fd, DW_GROUPNUMBER_ANY, NULL, NULL, &dbg, &err ) )
+    {
+        return false;
+    }
+
+    while ( _nextCU( dbg ) )
+    {
+        ncu++;
+    }
+
+    dwarf_finish( dbg );
+
+#if defined( _SC_NPROCESSORS_ONLN )
+    maxWorkers = sysconf( _SC_NPROCESSORS_ONLN );
+    maxWorkers = ( maxWorkers < 1 ) ? 1 : ( maxWorkers > DWARF_MAX_THREADS ) ? DWARF_MAX_THREADS : maxWorkers;
+#endif
+
+    w = ( struct dwarfWorker * )memCalloc( MEM_SYMBOLS, maxWorkers, sizeof( struct dwarfWorker ) );
+    MEMCHECK( w, false );
+
+    /* 2: Collect the functions and lines */
+    /* ---------------------------------- */
+    /* The first worker reads through our own handle, the others each need one of their own */
+    w[0].fd = p->fd;
+    w[0].job = &job;
+
+    while ( ( nworkers < maxWorkers ) && ( ncu / ( nworkers + 1 ) >= DWARF_CU_PER_THREAD ) )
+    {
+#ifndef O_BINARY
+
+        if ( ( w[nworkers].fd = open( filename, O_RDONLY, 0 ) ) < 0 )
+#else
+        if ( ( w[nworkers].fd = open( filename, O_RDONLY | O_BINARY, 0 ) ) < 0 )
+#endif
+        {
+            break;
+        }
+
+        w[nworkers].job = &job;
+
+        if ( pthread_create( &w[nworkers].thread, NULL, _dwarfTask, &w[nworkers] ) )
+        {
+            close( w[nworkers].fd );
+            break;
+        }
+
+        nworkers++;
+    }
+
+    _dwarfTask( &w[0] );
+
+    for ( int i = 1; i < nworkers; i++ )
+    {
+        pthread_join( w[i].thread, NULL );
+        close( w[i].fd );
+    }
+
+    genericsReport( V_DEBUG, "%u compilation units read by %d thread%s" EOL, ncu, nworkers, ( nworkers == 1 ) ? "" : "s" );
+
+    /* ...any worker that couldn't read the DWARF won't have taken any compilation units from the others */
+    _mergeWorkers( p, w, nworkers );
+    memFree( MEM_SYMBOLS, w );
+
+    if ( p->nlines && p->nfunc )
+    {
+        /* 3: We have the lines and functions. Clean them up and interlink them so they're useful to applications */
+        /* ------------------------------------------------------------------------------------------------------ */
+        /* Combine addresses in the lines table which have the same memory location...those aren't too useful for us      */
+        int nlines = 0;
+        struct symbolLineStore **nls = ( struct symbolLineStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolLineStore * ) * p->nlines );
+
+        if ( !nls )
+        {
+            genericsExit( -1, "Memory allocation failure" EOL );
+        }
+
+        for ( int i = 0; i < p->nlines - 1; i++ )
+        {
+            nls[nlines] = p->line[i];
+
+            /* Roll forward through all lines which have the same start address */
+            while ( ( ++i < p->nlines - 1 ) &&
+                    ( ( nls[nlines]->filename == p->line[i]->filename ) ) &&
+                    ( ( nls[nlines]->lowaddr == p->line[i]->lowaddr ) ) )
+            {
+                /* This line needs to be freed in memory 'cos otherwise there is no reference to it anywhere */
+                memFree( MEM_SYMBOLS, p->line[i] );
+            }
+
+            nlines++;
+        }
+
+        memFree( MEM_SYMBOLS, p->line );
+        p->line = nls;
+        p->nlines = nlines;
+
+        nlines = 0;
+        nls = ( struct symbolLineStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolLineStore * ) * ( p->nlines + 1 ) );
+
+        if ( !nls )
+        {
+            genericsExit( -1, "Memory allocation failure" EOL );
+        }
+
+        /* Now do the same for lines with the same line number and file */
+        /* We can also set the high memory extent for each line here */
+        for ( int i = 0; i < p->nlines - 1; i++ )
+        {
+            nls[nlines] = p->line[i];
+
+            while ( ( ++i < p->nlines - 1 ) &&
+                    ( nls[nlines]->startline == p->line[i]->startline ) &&
+                    ( nls[nlines]->filename == p->line[i]->filename ) )
+            {
+                memFree( MEM_SYMBOLS, p->line[i] );
+            }
+
+            nls[nlines]->highaddr = p->line[i]->lowaddr - 1;
+            nlines++;
+        }
+
+        memFree( MEM_SYMBOLS, p->line );
+        p->line = nls;
+        p->nlines = nlines;
+
+        if ( !p->nlines )
+        {
+            fprintf( stderr, "No lines found in file\n" );
+        }
+        else
+        {
+            p->line[p->nlines - 1]->highaddr = p->line[p->nlines - 1]->lowaddr + 2;
+            p->line[0]->lowaddr = p->line[0]->highaddr - 2;
+
+            /* Allocate lines to functions ... these will be in address order 'cos the lines already are */
+            for ( int i = 0; i < p->nlines; i++ )
+            {
+                struct symbolFunctionStore *f = symbolFunctionAt( p, p->line[i]->lowaddr );
+                p->line[i]->function = f;
+                p->line[i]->isinline = false;
+
+                if ( f )
+                {
+                    f->line = ( struct symbolLineStore ** )memRealloc( MEM_SYMBOLS, f->line, sizeof( struct symbolLineStore * ) * ( f->nlines + 1 ) );
+                    f->line[f->nlines] = p->line[i];
+                    f->nlines++;
+                }
+            }
+
+            retval = true;
+        }
+    }
+
+    return retval;
+}
+
+// ====================================================================================================
+
+#define SOURCE_LINES_INITIAL (256)         /* Line starts allocated for a source file to begin with */
+
+static bool _loadSource( struct symbol *p )
+
+/* Make room to keep the source for every file we have an entry for in the string table, as it's asked for */
+
+{
+    p->source = ( struct symbolSourcecodeStore * )memCalloc( MEM_SYMBOLS, p->tableLen[PT_FILENAME] + 1, sizeof( struct symbolSourcecodeStore ) );
+    MEMCHECK( p->source, false );
+    return true;
+}
+
+// ====================================================================================================
+
+static void _sourceClose( struct symbol *p, struct symbolSourcecodeStore *f )
+
+{
+    if ( f->mapped )
+    {
+        readsourceunmap( f->text, f->len );
+    }
+    else
+    {
+        memFree( MEM_SYMBOLS, f->text );
+    }
+
+    memFree( MEM_SYMBOLS, f->linestart );
+    f->text = NULL;
+    f->linestart = NULL;
+    f->len = f->nlines = 0;
+    p->sourceOpen--;
+}
+
+// ====================================================================================================
+
+static bool _sourceOpen( struct symbol *p, unsigned int fileNumber )
+
+/* Get the source for this file in (under sourceLock), returning false if there isn't any */
+
+{
+    struct symbolSourcecodeStore *f = &p->source[fileNumber];
+    struct symbolSourcecodeStore *oldest = NULL;
+    unsigned int alloc = 0;
+    size_t l;
+
+    if ( f->missing )
+    {
+        return false;
+    }
+
+    /* Make room by letting go of the one that's gone unused longest */
+    for ( unsigned int i = 0; ( p->sourceOpen >= SYMBOL_SOURCE_OPEN ) && ( i < p->tableLen[PT_FILENAME] ); i++ )
+    {
+        if ( ( p->source[i].text ) && ( ( !oldest ) || ( p->source[i].lastUsed < oldest->lastUsed ) ) )
+        {
+            oldest = &p->source[i];
+        }
+    }
+
+    if ( oldest )
+    {
+        _sourceClose( p, oldest );
+    }
+
+    /* Map it if it can be used as it is, otherwise it gets read in (and maybe pretty printed on the way) */
+    if ( ( f->text = readsourcemap( p->stringTable[PT_FILENAME][fileNumber], &f->len ) ) )
+    {
+        f->mapped = true;
+    }
+    else
+    {
+        f->mapped = false;
+        f->text = readsourcefile( p->stringTable[PT_FILENAME][fileNumber], &l );
+        f->len = ( l ) ? l - 1 : 0;
+    }
+
+    p->sourceOpen++;
+
+    /* Lines are demarked by \n, so we just need to find the indicies to one after each of those */
+    for ( size_t o = 0; o < f->len; )
+    {
+        const char *nl = ( const char * )memchr( &f->text[o], '\n', f->len - o );
+
+        if ( f->nlines == alloc )
+        {
+            alloc = ( alloc ) ? alloc * 2 : SOURCE_LINES_INITIAL;
+            f->linestart = ( uint32_t * )memRealloc( MEM_SYMBOLS, f->linestart, sizeof( uint32_t ) * alloc );
+            MEMCHECK( f->linestart, false );
+        }
+
+        f->linestart[f->nlines++] = o;
+        o = ( nl ) ? nl - f->text + 1 : f->len;
+    }
+
+    if ( !f->nlines )
+    {
+        _sourceClose( p, f );
+        f->missing = true;
+        return false;
+    }
+
+    return true;
+}
+
+static void _classify( const cs_insn *insn, enum instructionClass *ic, symbolMemaddr *newaddr )
+
+/* Characterise the instruction using rules from F1.3 of ARM IHI0064H.a */
+
+{
+    /* Check instruction size */
+    *ic |= ( insn->size == 4 ) ? LE_IC_4BYTE : 0;
+
+    /* Was it a subroutine call? */
+    *ic |= ( ( insn->id == ARM_INS_BL ) || ( insn->id == ARM_INS_BLX ) ) ? LE_IC_JUMP | LE_IC_CALL : 0;
+
+    /* Was it a regular call? */
+    *ic |= ( ( insn->id == ARM_INS_B )    || ( insn->id == ARM_INS_BX )  || ( insn->id == ARM_INS_ISB ) ||
+             ( insn->id == ARM_INS_WFI )  || ( insn->id == ARM_INS_WFE ) || ( insn->id == ARM_INS_TBB ) ||
+             ( insn->id == ARM_INS_TBH )  || ( insn->id == ARM_INS_BXJ ) || ( insn->id == ARM_INS_CBZ ) ||
+             ( insn->id == ARM_INS_CBNZ ) || ( insn->id == ARM_INS_WFI ) || ( insn->id == ARM_INS_WFE )
+           ) ? LE_IC_JUMP : 0;
+
+    *ic |=  (
+                        ( ( ( insn->id == ARM_INS_SUB ) || ( insn->id == ARM_INS_MOV ) ||
+                            ( insn->id == ARM_INS_LDM ) || ( insn->id == ARM_INS_POP ) )
+                          && strstr( insn->op_str, "pc" ) )
+            ) ? LE_IC_JUMP : 0;
+
+    /* Was it an exception return? */
+    *ic |=  ( ( insn->id == ARM_INS_ERET ) ) ? LE_IC_JUMP | LE_IC_IRET : 0;
+
+    /* Check to see if operands are immediate */
+    cs_detail *detail = insn->detail;
+
+    for ( int n = 0; n < detail->arm.op_count; n++ )
+    {
+        if ( detail->arm.operands[n].type == ARM_OP_IMM )
+        {
+            *ic |= LE_IC_IMMEDIATE;
+
+            if ( newaddr )
+            {
+                *newaddr = detail->arm.operands[n].imm;
+            }
+
+            break;
+        }
+    }
+}
+
+// ====================================================================================================
+
+/* Each thread remembers the last few regions it found, most recent first, since trace tends to move */
+/* between just a few (flash and RAM resident code, say). They're only hints, checked against p as  */
+/* they're used, so they don't need to belong to any particular symbol set.                         */
+#define MEM_REGION_CACHE (4)
+static _Thread_local unsigned int _regionCache[MEM_REGION_CACHE];
+
+static int _memRegion( struct symbol *p, symbolMemaddr addr )
+
+/* Return index of the memory region addr is in, or -1 if there isn't one */
+
+{
+    unsigned int c, i, l = 0, h = p->nsect_mem;
+
+    for ( c = 0; c < MEM_REGION_CACHE; c++ )
+    {
+        i = _regionCache[c];
+
+        if ( ( i < p->nsect_mem ) && ( addr - p->mem[i].start < p->mem[i].len ) )
+        {
+            goto found;
+        }
+    }
+
+    /* Regions are sorted by start address, so look for the last one starting at or before addr */
+    while ( l < h )
+    {
+        unsigned int m = ( l + h ) / 2;
+
+        if ( p->mem[m].start <= addr )
+        {
+            l = m + 1;
+        }
+        else
+        {
+            h = m;
+        }
+    }
+
+    if ( ( !l ) || ( addr - p->mem[l - 1].start >= p->mem[l - 1].len ) )
+    {
+        return -1;
+    }
+
+    i = l - 1;
+    c = MEM_REGION_CACHE - 1;
+
+found:
+    /* ...and move it to the front */
+    memmove( &_regionCache[1], &_regionCache[0], c * sizeof( _regionCache[0] ) );
+    _regionCache[0] = i;
+    return i;
+}
+
+// ====================================================================================================
+
+static struct symbolInsnEntry *_insnPage( struct symbol *p, struct symbolMemoryStore *m, unsigned int page )
+
+/* Classify every halfword of this page of m, unless someone else got there first */
+
+{
+    struct symbolInsnEntry *e;
+    cs_insn *insn;
+
+    pthread_mutex_lock( &p->insnLock );
+
+    if ( ( !p->insnhandle ) && ( !symbolDisassemblerOpen( &p->insnhandle ) ) )
+    {
+        pthread_mutex_unlock( &p->insnLock );
+        return NULL;
+    }
+
+    if ( !( e = atomic_load( &m->insnPage[page] ) ) )
+    {
+        e = ( struct symbolInsnEntry * )memAlloc( MEM_SYMBOLS, sizeof( struct symbolInsnEntry ) * ( SYMBOL_INSN_PAGE / 2 ) );
+        insn = cs_malloc( p->insnhandle );
+
+        for ( unsigned int i = 0; ( e ) && ( insn ) && ( i < SYMBOL_INSN_PAGE / 2 ); i++ )
+        {
+            symbolMemaddr ofs = page * SYMBOL_INSN_PAGE + i * 2;
+
+            e[i].ic = LE_IC_NONE;
+            e[i].dest = NO_ADDRESS;
+
+            /* The last page will generally run off the end of the region */
+            if ( ofs >= m->len )
+            {
+                continue;
+            }
+
+            const uint8_t *code = &m->data[ofs];
+            size_t size = ( m->len - ofs < 4 ) ? m->len - ofs : 4;
+            uint64_t a = m->start + ofs;
+
+            if ( cs_disasm_iter( p->insnhandle, &code, &size, &a, insn ) )
+            {
+                enum instructionClass ic = LE_IC_NONE;
+                _classify( insn, &ic, &e[i].dest );
+                e[i].ic = ic;
+            }
+        }
+
+        /* ...then, from the end back, how far each is from the next branch that follows on from it */
+        for ( int i = SYMBOL_INSN_PAGE / 2 - 1; ( e ) && ( insn ) && ( i >= 0 ); i-- )
+        {
+            unsigned int n = ( e[i].ic & LE_IC_4BYTE ) ? 2 : 1;
+
+            if ( e[i].ic & ( LE_IC_JUMP | LE_IC_CALL ) )
+            {
+                e[i].toBranch = 0;
+            }
+            else
+            {
+                e[i].toBranch = ( i + n < SYMBOL_INSN_PAGE / 2 ) ? n + e[i + n].toBranch : n;
+            }
+        }
+
+        if ( insn )
+        {
+            cs_free( insn, 1 );
+        }
+
+        /* ...only published once it's complete, so it can be read without the lock */
+        if ( e )
+        {
+            atomic_store( &m->insnPage[page], e );
+        }
+    }
+
+    pthread_mutex_unlock( &p->insnLock );
+    return e;
+}
+
+// ====================================================================================================
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Symbol cache
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// The tables are written out flat, with every pointer replaced by an offset, so a restart against an
+// unchanged image only has to read one block and point back into it. The cache is keyed by a hash of
+// the elf content, so a rebuilt image always misses. Where it can be the block is mapped read-only
+// rather than read, so every tool working on the same image shares the one copy of its strings and
+// memory contents. Setting ORB_SYMBOLCACHE to a directory they can all reach gives a store shared
+// between users too.
+
+#define CACHE_MAGIC     "ORBSYMC"
+#define CACHE_VERSION   (3)
+#define CACHE_DIR       "orbcode"
+#define CACHE_NOENTRY   (0xffffffff)
+#define CACHE_HAS_MEM   (1 << 0)
+
+struct cacheHeader
+{
+    char       magic[8];                   /* CACHE_MAGIC */
+    uint32_t   version;                    /* CACHE_VERSION */
+    uint32_t   flags;                      /* What was loaded when the cache was made */
+    uint64_t   hash;                       /* Hash of the elf this was made from */
+    uint32_t   tableLen[PT_NUMTABLES];     /* Number of strings in each deduplication table */
+    uint32_t   nfunc;                      /* Number of function records */
+    uint32_t   nlines;                     /* Number of line records */
+    uint32_t   nsect_mem;                  /* Number of memory region records */
+    uint32_t   nvar;                       /* Number of variable records */
+    uint32_t   ninline;                    /* Number of inline range records */
+    uint32_t   ninlineFrame;               /* Number of inline frame records */
+    uint32_t   stringsLen;                 /* Length of the string blob */
+    uint32_t   memLen;                     /* Length of the memory contents blob */
+};
+
+struct cacheFunc
+{
+    uint32_t   funcname;                   /* Offsets into string blob */
+    uint32_t   manglename;
+    uint32_t   producer;
+    uint32_t   filename;
+    uint32_t   startline;
+    uint32_t   startcol;
+    uint32_t   endline;
+    uint32_t   lowaddr;
+    uint32_t   highaddr;
+    uint32_t   isinline;
+};
+
+struct cacheLine
+{
+    uint32_t   filename;
+    uint32_t   startline;
+    uint32_t   isinline;
+    uint32_t   lowaddr;
+    uint32_t   highaddr;
+    uint32_t   function;                   /* Index into function records, or CACHE_NOENTRY */
+};
+
+struct cacheVar
+{
+    uint32_t   varname;                    /* Offset into string blob */
+    uint32_t   filename;
+    uint32_t   addr;
+    uint32_t   size;
+    uint32_t   type;
+};
+
+struct cacheMem
+{
+    uint32_t   start;
+    uint32_t   len;
+    uint32_t   name;                       /* Offset into string blob */
+    uint32_t   data;                       /* Offset into memory contents blob */
+};
+
+/* A growable blob used while the cache is written */
+struct cacheBlob
+{
+    char      *d;
+    uint32_t   len;
+};
+
+// ====================================================================================================
+static uint64_t _hashFile( int fd )
+
+/* FNV-1a hash of the whole elf file, leaves the file positioned at the start */
+
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint8_t b[65536];
+    ssize_t r;
+
+    lseek( fd, 0, SEEK_SET );
+
+    while ( ( r = read( fd, b, sizeof( b ) ) ) > 0 )
+    {
+        for ( ssize_t i = 0; i < r; i++ )
+        {
+            h = ( h ^ b[i] ) * 0x100000001b3ULL;
+        }
+    }
+
+    lseek( fd, 0, SEEK_SET );
+    return h;
+}
+// ====================================================================================================
+static char *_cacheFilename( uint64_t hash, bool create )
+
+/* Return malloced name of the cache file for this hash, or NULL if there is nowhere to put it */
+
+{
+    const char *shared = getenv( "ORB_SYMBOLCACHE" );
+    const char *base = getenv( "XDG_CACHE_HOME" );
+    const char *home = getenv( "HOME" );
+    char *dir;
+    char *n;
+
+    if ( getenv( "ORB_NOSYMBOLCACHE" ) )
+    {
+        /* User doesn't want the cache */
+        return NULL;
+    }
+
+    if ( shared && *shared )
+    {
+        dir = memStrdup( MEM_SYMBOLS, shared );
+    }
+    else if ( base && *base )
+    {
+        dir = _joinPaths( base, CACHE_DIR );
+    }
+    else if ( home && *home )
+    {
+        dir = _joinPaths( home, ".cache/" CACHE_DIR );
+    }
+    else
+    {
+        return NULL;
+    }
+
+    if ( create )
+    {
+        /* Make the path, we don't care if any of it already exists */
+        for ( char *c = dir + 1; *c; c++ )
+        {
+            if ( *c == '/' )
+            {
+                *c = 0;
+#if defined(WIN32)
+                mkdir( dir );
+#else
+                mkdir( dir, 0755 );
+#endif
+                *c = '/';
+            }
+        }
+
+#if defined(WIN32)
+        mkdir( dir );
+#else
+        mkdir( dir, 0755 );
+#endif
+    }
+
+    n = ( char * )memAlloc( MEM_SYMBOLS, strlen( dir ) + 22 );
+
+    if ( n )
+    {
+        sprintf( n, "%s/%016" PRIx64 ".sym", dir, hash );
+    }
+
+    memFree( MEM_SYMBOLS, dir );
+    return n;
+}
+// ====================================================================================================
+static uint32_t _blobAdd( struct cacheBlob *b, const void *d, uint32_t len )
+
+/* Add material to the blob, returning its offset */
+
+{
+    uint32_t o = b->len;
+
+    b->d = ( char * )memRealloc( MEM_SYMBOLS, b->d, b->len + len );
+
+    if ( !b->d )
+    {
+        genericsExit( -1, "Memory allocation failure" EOL );
+    }
+
+    memcpy( &b->d[b->len], d, len );
+    b->len += len;
+    return o;
+}
+// ====================================================================================================
+static uint32_t _blobAddString( struct cacheBlob *b, const char *s )
+
+{
+    return s ? _blobAdd( b, s, strlen( s ) + 1 ) : CACHE_NOENTRY;
+}
+// ====================================================================================================
+static bool _writeAll( int fd, const void *d, size_t len )
+
+{
+    const uint8_t *c = ( const uint8_t * )d;
+    ssize_t w;
+
+    while ( len )
+    {
+        if ( ( w = write( fd, c, len ) ) <= 0 )
+        {
+            return false;
+        }
+
+        c += w;
+        len -= w;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static uint32_t _funcIndex( struct symbol *p, struct symbolFunctionStore *f )
+
+/* Return index of function in the (address sorted) function table, or CACHE_NOENTRY */
+
+{
+    unsigned int l = 0;
+    unsigned int h = p->nfunc;
+
+    if ( !f )
+    {
+        return CACHE_NOENTRY;
+    }
+
+    while ( l < h )
+    {
+        unsigned int m = ( l + h ) / 2;
+
+        if ( p->func[m]->lowaddr < f->lowaddr )
+        {
+            l = m + 1;
+        }
+        else
+        {
+            h = m;
+        }
+    }
+
+    /* Functions can share a start address, so make sure we've got the right one */
+    while ( ( l < p->nfunc ) && ( p->func[l]->lowaddr == f->lowaddr ) )
+    {
+        if ( p->func[l] == f )
+        {
+            return l;
+        }
+
+        l++;
+    }
+
+    return CACHE_NOENTRY;
+}
+// ====================================================================================================
+static void _writeCache( struct symbol *p, uint64_t hash )
+
+/* Write the symbol tables out to the cache. Failure is not an error, we just won't be quicker next time */
+
+{
+    struct cacheHeader h = { .magic = CACHE_MAGIC, .version = CACHE_VERSION, .hash = hash };
+    struct cacheBlob strings = { 0 };
+    struct cacheBlob mem = { 0 };
+    uint32_t stringsCount = 0;
+    uint32_t *so;
+    struct cacheFunc *cf;
+    struct cacheLine *cl;
+    struct cacheVar *cv;
+    struct cacheMem *cm;
+    char *n = _cacheFilename( hash, true );
+    char *tn;
+    bool ok;
+    int fd;
+
+    if ( !n )
+    {
+        return;
+    }
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        h.tableLen[pt] = p->tableLen[pt];
+        stringsCount += p->tableLen[pt];
+    }
+
+    h.flags     = p->nsect_mem ? CACHE_HAS_MEM : 0;
+    h.nfunc     = p->nfunc;
+    h.nlines    = p->nlines;
+    h.nsect_mem = p->nsect_mem;
+    h.nvar      = p->nvar;
+    h.ninline      = p->ninline;
+    h.ninlineFrame = p->ninlineFrame;
+
+    so = ( uint32_t * )memCalloc( MEM_SYMBOLS, stringsCount + 1, sizeof( uint32_t ) );
+    cf = ( struct cacheFunc * )memCalloc( MEM_SYMBOLS, p->nfunc + 1, sizeof( struct cacheFunc ) );
+    cl = ( struct cacheLine * )memCalloc( MEM_SYMBOLS, p->nlines + 1, sizeof( struct cacheLine ) );
+    cv = ( struct cacheVar * )memCalloc( MEM_SYMBOLS, p->nvar + 1, sizeof( struct cacheVar ) );
+    cm = ( struct cacheMem * )memCalloc( MEM_SYMBOLS, p->nsect_mem + 1, sizeof( struct cacheMem ) );
+
+    if ( !so || !cf || !cl || !cv || !cm )
+    {
+        genericsExit( -1, "Memory allocation failure" EOL );
+    }
+
+    for ( uint32_t pt = 0, k = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        for ( unsigned int i = 0; i < p->tableLen[pt]; i++ )
+        {
+            so[k++] = _blobAddString( &strings, p->stringTable[pt][i] );
+        }
+    }
+
+    for ( unsigned int i = 0; i < p->nfunc; i++ )
+    {
+        struct symbolFunctionStore *f = p->func[i];
+        cf[i] = ( struct cacheFunc )
+        {
+            .funcname = _blobAddString( &strings, f->funcname ), .manglename = _blobAddString( &strings, f->manglename ),
+            .producer = f->producer, .filename = f->filename, .startline = f->startline, .startcol = f->startcol,
+            .endline = f->endline, .lowaddr = f->lowaddr, .highaddr = f->highaddr, .isinline = f->isinline
+        };
+    }
+
+    for ( unsigned int i = 0; i < p->nlines; i++ )
+    {
+        struct symbolLineStore *l = p->line[i];
+        cl[i] = ( struct cacheLine )
+        {
+            .filename = l->filename, .startline = l->startline, .isinline = l->isinline,
+            .lowaddr = l->lowaddr, .highaddr = l->highaddr, .function = _funcIndex( p, l->function )
+        };
+    }
+
+    for ( unsigned int i = 0; i < p->nvar; i++ )
+    {
+        struct symbolVariableStore *v = p->var[i];
+        cv[i] = ( struct cacheVar )
+        {
+            .varname = _blobAddString( &strings, v->varname ), .filename = v->filename, .addr = v->addr,
+            .size = v->size, .type = v->type
+        };
+    }
+
+    for ( unsigned int i = 0; i < p->nsect_mem; i++ )
+    {
+        cm[i] = ( struct cacheMem )
+        {
+            .start = p->mem[i].start, .len = p->mem[i].len, .name = _blobAddString( &strings, p->mem[i].name ),
+            .data = _blobAdd( &mem, p->mem[i].data, p->mem[i].len )
+        };
+    }
+
+    h.stringsLen = strings.len;
+    h.memLen     = mem.len;
+
+    /* Write to a temporary and rename it into place, so a concurrent reader never sees it half done */
+    tn = ( char * )memAlloc( MEM_SYMBOLS, strlen( n ) + 16 );
+
+    if ( !tn )
+    {
+        genericsExit( -1, "Memory allocation failure" EOL );
+    }
+
+    sprintf( tn, "%s.%d", n, ( int )getpid() );
+
+#ifndef O_BINARY
+    fd = open( tn, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+#else
+    fd = open( tn, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644 );
+#endif
+
+    if ( fd >= 0 )
+    {
+        ok = _writeAll( fd, &h, sizeof( h ) ) &&
+             _writeAll( fd, so, stringsCount * sizeof( uint32_t ) ) &&
+             _writeAll( fd, cf, p->nfunc * sizeof( struct cacheFunc ) ) &&
+             _writeAll( fd, cl, p->nlines * sizeof( struct cacheLine ) ) &&
+             _writeAll( fd, cv, p->nvar * sizeof( struct cacheVar ) ) &&
+             _writeAll( fd, cm, p->nsect_mem * sizeof( struct cacheMem ) ) &&
+             _writeAll( fd, p->inlineRange, p->ninline * sizeof( struct symbolInlineRange ) ) &&
+             _writeAll( fd, p->inlineFrame, p->ninlineFrame * sizeof( struct symbolInlineFrame ) ) &&
+             _writeAll( fd, strings.d, strings.len ) &&
+             _writeAll( fd, mem.d, mem.len );
+        close( fd );
+
+        if ( ( !ok ) || ( 0 != rename( tn, n ) ) )
         {
-            nls = ( struct symbolLineStore ** )realloc( nls, sizeof( struct symbolLineStore * ) * ( nlines + 1 ) );
+            unlink( tn );
+        }
+    }
 
-            if ( !nls )
-            {
-                genericsExit( -1, "Memory allocation failure" EOL );
-            }
+    memFree( MEM_SYMBOLS, tn );
+    memFree( MEM_SYMBOLS, n );
+    memFree( MEM_SYMBOLS, so );
+    memFree( MEM_SYMBOLS, cf );
+    memFree( MEM_SYMBOLS, cl );
+    memFree( MEM_SYMBOLS, cv );
+    memFree( MEM_SYMBOLS, cm );
+    memFree( MEM_SYMBOLS, strings.d );
+    memFree( MEM_SYMBOLS, mem.d );
+}
+// ====================================================================================================
+static char *_cacheMap( int fd, off_t len )
 
-            nls[nlines] = p->line[i];
+/* Get the whole of the cache file into memory, shared with anyone else who has it if we can */
 
-            /* Roll forward through all lines which have the same start address */
-            while ( ( ++i < p->nlines - 1 ) &&
-                    ( ( nls[nlines]->filename == p->line[i]->filename ) ) &&
-                    ( ( nls[nlines]->lowaddr == p->line[i]->lowaddr ) ) )
-            {
-                /* This line needs to be freed in memory 'cos otherwise there is no reference to it anywhere */
-                free( p->line[i] );
-            }
+{
+#if defined(WIN32)
+    char *c = ( char * )memAlloc( MEM_SYMBOLS, len );
 
-            nlines++;
+    for ( off_t got = 0; ( c ) && ( got < len ); )
+    {
+        ssize_t r = read( fd, &c[got], len - got );
+
+        if ( r <= 0 )
+        {
+            memFree( MEM_SYMBOLS, c );
+            return NULL;
         }
 
-        free( p->line );
-        p->line = nls;
-        p->nlines = nlines;
+        got += r;
+    }
 
-        nlines = 0;
-        nls = NULL;
+    return c;
+#else
+    void *c = mmap( NULL, len, PROT_READ, MAP_SHARED, fd, 0 );
 
-        /* Now do the same for lines with the same line number and file */
-        /* We can also set the high memory extent for each line here */
-        for ( int i = 0; i < p->nlines - 1; i++ )
-        {
-            nls = ( struct symbolLineStore ** )realloc( nls, sizeof( struct symbolLineStore * ) * ( nlines + 1 ) );
-            nls[nlines] = p->line[i];
+    return ( c == MAP_FAILED ) ? NULL : ( char * )c;
+#endif
+}
+// ====================================================================================================
+static void _cacheUnmap( void *c, size_t len )
 
-            while ( ( ++i < p->nlines - 1 ) &&
-                    ( nls[nlines]->startline == p->line[i]->startline ) &&
-                    ( nls[nlines]->filename == p->line[i]->filename ) )
-            {
-                free( p->line[i] );
-            }
+{
+#if defined(WIN32)
+    memFree( MEM_SYMBOLS, c );
+#else
 
-            nls[nlines]->highaddr = p->line[i]->lowaddr - 1;
-            nlines++;
-        }
+    if ( c )
+    {
+        munmap( c, len );
+    }
 
-        free( p->line );
-        p->line = nls;
-        p->nlines = nlines;
+#endif
+}
+// ====================================================================================================
+static bool _readCache( struct symbol *p, uint64_t hash, bool loadmem )
 
-        if ( !p->nlines )
-        {
-            fprintf( stderr, "No lines found in file\n" );
-        }
-        else
-        {
-            p->line[p->nlines - 1]->highaddr = p->line[p->nlines - 1]->lowaddr + 2;
-            p->line[0]->lowaddr = p->line[0]->highaddr - 2;
+/* Populate the symbol tables from the cache, if there is a usable entry for this hash */
 
-            /* Allocate lines to functions ... these will be in address order 'cos the lines already are */
-            for ( int i = 0; i < p->nlines; i++ )
-            {
-                struct symbolFunctionStore *f = symbolFunctionAt( p, p->line[i]->lowaddr );
-                p->line[i]->function = f;
-                p->line[i]->isinline = false;
+{
+    char *n = _cacheFilename( hash, false );
+    struct cacheHeader *h;
+    uint32_t stringsCount = 0;
+    off_t len;
+    char *c;
+    int fd;
+
+    if ( !n )
+    {
+        return false;
+    }
 
-                if ( f )
-                {
-                    f->line = ( struct symbolLineStore ** )realloc( f->line, sizeof( struct symbolLineStore * ) * ( f->nlines + 1 ) );
-                    f->line[f->nlines] = p->line[i];
-                    f->nlines++;
-                }
-            }
+#ifndef O_BINARY
+    fd = open( n, O_RDONLY, 0 );
+#else
+    fd = open( n, O_RDONLY | O_BINARY, 0 );
+#endif
+    memFree( MEM_SYMBOLS, n );
 
-            retval = true;
+    if ( fd < 0 )
+    {
+        return false;
+    }
+
+    len = lseek( fd, 0, SEEK_END );
+    lseek( fd, 0, SEEK_SET );
+
+    if ( ( len < ( off_t )sizeof( struct cacheHeader ) ) || ( !( c = _cacheMap( fd, len ) ) ) )
+    {
+        close( fd );
+        return false;
+    }
+
+    /* A mapping stays good after the file is closed (and even if it's replaced, since that's by rename) */
+    close( fd );
+
+    /* Make sure this is the right cache, and that it's the size it claims to be */
+    h = ( struct cacheHeader * )c;
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        stringsCount += h->tableLen[pt];
+    }
+
+    if ( ( memcmp( h->magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) ) || ( h->version != CACHE_VERSION ) || ( h->hash != hash ) ||
+            ( loadmem && !( h->flags & CACHE_HAS_MEM ) ) ||
+            ( sizeof( struct cacheHeader ) + ( uint64_t )stringsCount * sizeof( uint32_t ) +
+              ( uint64_t )h->nfunc * sizeof( struct cacheFunc ) + ( uint64_t )h->nlines * sizeof( struct cacheLine ) +
+              ( uint64_t )h->nvar * sizeof( struct cacheVar ) +
+              ( uint64_t )h->nsect_mem * sizeof( struct cacheMem ) +
+              ( uint64_t )h->ninline * sizeof( struct symbolInlineRange ) + ( uint64_t )h->ninlineFrame * sizeof( struct symbolInlineFrame ) +
+              h->stringsLen + h->memLen != ( uint64_t )len ) )
+    {
+        _cacheUnmap( c, len );
+        return false;
+    }
+
+    uint32_t *so          = ( uint32_t * )&c[sizeof( struct cacheHeader )];
+    struct cacheFunc *cf  = ( struct cacheFunc * )&so[stringsCount];
+    struct cacheLine *cl  = ( struct cacheLine * )&cf[h->nfunc];
+    struct cacheVar *cv   = ( struct cacheVar * )&cl[h->nlines];
+    struct cacheMem *cm   = ( struct cacheMem * )&cv[h->nvar];
+    struct symbolInlineRange *ir = ( struct symbolInlineRange * )&cm[h->nsect_mem];
+    struct symbolInlineFrame *iframe = ( struct symbolInlineFrame * )&ir[h->ninline];
+    char *strings         = ( char * )&iframe[h->ninlineFrame];
+    uint8_t *mem          = ( uint8_t * )&strings[h->stringsLen];
+
+    if ( ( h->stringsLen ) && ( strings[h->stringsLen - 1] ) )
+    {
+        /* Strings aren't terminated, so can't be trusted */
+        _cacheUnmap( c, len );
+        return false;
+    }
+
+#define CACHE_STRING(x) ((x)<h->stringsLen?&strings[x]:NULL)
+
+    /* It's good, so now point everything back into it */
+    p->cache = c;
+    p->cacheLen = len;
+
+    for ( uint32_t pt = 0, k = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        p->tableLen[pt] = h->tableLen[pt];
+        p->stringTable[pt] = ( char ** )memAlloc( MEM_SYMBOLS, sizeof( char * ) * ( h->tableLen[pt] + 1 ) );
+        MEMCHECK( p->stringTable[pt], false );
+
+        for ( unsigned int i = 0; i < h->tableLen[pt]; i++, k++ )
+        {
+            p->stringTable[pt][i] = CACHE_STRING( so[k] );
         }
     }
 
-    dwarf_finish( dbg );
+    p->nfunc     = h->nfunc;
+    p->func      = ( struct symbolFunctionStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolFunctionStore * ) * ( h->nfunc + 1 ) );
+    p->cacheFunc = ( struct symbolFunctionStore * )memCalloc( MEM_SYMBOLS, h->nfunc + 1, sizeof( struct symbolFunctionStore ) );
+    MEMCHECK( p->func, false );
+    MEMCHECK( p->cacheFunc, false );
 
-    return retval;
-}
+    for ( unsigned int i = 0; i < h->nfunc; i++ )
+    {
+        struct symbolFunctionStore *f = p->func[i] = &p->cacheFunc[i];
+        f->funcname   = CACHE_STRING( cf[i].funcname );
+        f->manglename = CACHE_STRING( cf[i].manglename );
+        f->producer   = cf[i].producer;
+        f->filename   = cf[i].filename;
+        f->startline  = cf[i].startline;
+        f->startcol   = cf[i].startcol;
+        f->endline    = cf[i].endline;
+        f->lowaddr    = cf[i].lowaddr;
+        f->highaddr   = cf[i].highaddr;
+        f->isinline   = cf[i].isinline;
+    }
 
-// ====================================================================================================
+    p->nlines    = h->nlines;
+    p->line      = ( struct symbolLineStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolLineStore * ) * ( h->nlines + 1 ) );
+    p->cacheLine = ( struct symbolLineStore * )memCalloc( MEM_SYMBOLS, h->nlines + 1, sizeof( struct symbolLineStore ) );
+    MEMCHECK( p->line, false );
+    MEMCHECK( p->cacheLine, false );
 
-static bool _loadSource( struct symbol *p )
+    /* Lines are in address order, so they're also in order for each function. Count first, then fill */
+    for ( unsigned int i = 0; i < h->nlines; i++ )
+    {
+        struct symbolLineStore *l = p->line[i] = &p->cacheLine[i];
+        l->filename  = cl[i].filename;
+        l->startline = cl[i].startline;
+        l->isinline  = cl[i].isinline;
+        l->lowaddr   = cl[i].lowaddr;
+        l->highaddr  = cl[i].highaddr;
+        l->function  = ( cl[i].function < h->nfunc ) ? p->func[cl[i].function] : NULL;
+
+        if ( l->function )
+        {
+            l->function->nlines++;
+        }
+    }
 
-{
-    char *r;
-    size_t l;
+    for ( unsigned int i = 0; i < h->nfunc; i++ )
+    {
+        if ( p->func[i]->nlines )
+        {
+            p->func[i]->line = ( struct symbolLineStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolLineStore * ) * p->func[i]->nlines );
+            MEMCHECK( p->func[i]->line, false );
+            p->func[i]->nlines = 0;
+        }
+    }
+
+    for ( unsigned int i = 0; i < h->nlines; i++ )
+    {
+        struct symbolFunctionStore *f = p->line[i]->function;
+
+        if ( f )
+        {
+            f->line[f->nlines++] = p->line[i];
+        }
+    }
 
-    /* We need to aqquire source code for all of the files that we have an entry in the stringtable, so let's start by making room */
-    p->source = ( struct symbolSourcecodeStore ** )calloc( 1, sizeof( struct symbolSourcecodeStore * )*p->tableLen[PT_FILENAME] );
+    p->nvar     = h->nvar;
+    p->var      = ( struct symbolVariableStore ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbolVariableStore * ) * ( h->nvar + 1 ) );
+    p->cacheVar = ( struct symbolVariableStore * )memCalloc( MEM_SYMBOLS, h->nvar + 1, sizeof( struct symbolVariableStore ) );
+    MEMCHECK( p->var, false );
+    MEMCHECK( p->cacheVar, false );
 
-    for ( int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
+    for ( unsigned int i = 0; i < h->nvar; i++ )
     {
-        r = readsourcefile( p->stringTable[PT_FILENAME][i], &l );
+        struct symbolVariableStore *v = p->var[i] = &p->cacheVar[i];
+        v->varname  = CACHE_STRING( cv[i].varname );
+        v->filename = cv[i].filename;
+        v->addr     = cv[i].addr;
+        v->size     = cv[i].size;
+        v->type     = ( cv[i].type <= SV_FLOAT ) ? cv[i].type : SV_UNSIGNED;
+    }
 
-        /* Create an entry for this file. It will remain zero (NULL) if there are no lines in it, because r was NULL */
-        struct symbolSourcecodeStore *store = p->source[i] = ( struct symbolSourcecodeStore * )calloc( 1, sizeof( struct symbolSourcecodeStore ) );
+    /* The inline tables have nothing that needs pointing anywhere, so they're used where they are */
+    p->ninline      = h->ninline;
+    p->inlineRange  = ir;
+    p->ninlineFrame = h->ninlineFrame;
+    p->inlineFrame  = iframe;
 
-        /* Lines in sio.c are demarked by \n, \r or \0 ... so we just need to find the indicies to one after each of those */
-        while ( l )
+    for ( unsigned int i = 0; i < h->ninline; i++ )
+    {
+        if ( ( uint64_t )ir[i].chain + ir[i].depth > h->ninlineFrame )
         {
-            /* Add this line to the storage. */
-            store->linetext = ( char ** )realloc( store->linetext, sizeof( char * ) * ( store->nlines + 1 ) );
-            store->linetext[store->nlines++] = r;
+            p->ninline = 0;
+            break;
+        }
+    }
 
-            /* Spin forwards for next newline or eof */
-            while ( ( --l > 0 ) && ( *r++ != '\n' ) ) {};
+    p->nsect_mem = h->nsect_mem;
+    p->mem = ( struct symbolMemoryStore * )memCalloc( MEM_SYMBOLS, h->nsect_mem + 1, sizeof( struct symbolMemoryStore ) );
+    MEMCHECK( p->mem, false );
 
-            if ( l )
-            {
-                *r++ = 0;
-                l--;
-            }
+    for ( unsigned int i = 0; i < h->nsect_mem; i++ )
+    {
+        p->mem[i].start = cm[i].start;
+        p->mem[i].name  = CACHE_STRING( cm[i].name );
+
+        if ( cm[i].data + ( uint64_t )cm[i].len <= h->memLen )
+        {
+            p->mem[i].len   = cm[i].len;
+            p->mem[i].data  = &mem[cm[i].data];
         }
     }
 
+#undef CACHE_STRING
     return true;
 }
 
@@ -745,16 +2988,131 @@ const char *symbolSource( struct symbol *p, unsigned int fileNumber, unsigned in
 /* Return pointer to source code for specified line in file index */
 
 {
+    struct symbolSourcecodeStore *f;
+    char *r = NULL;
+    char *e;
+
     assert( p );
 
-    if ( ( fileNumber < p->tableLen[PT_FILENAME] ) && p->source && ( lineNumber < p->source[fileNumber]->nlines ) )
+    if ( ( fileNumber >= p->tableLen[PT_FILENAME] ) || ( !p->source ) )
     {
-        return ( const char * )p->source[fileNumber]->linetext[lineNumber];
+        return NULL;
     }
-    else
+
+    pthread_mutex_lock( &p->sourceLock );
+    f = &p->source[fileNumber];
+
+    if ( ( f->text ) || ( _sourceOpen( p, fileNumber ) ) )
+    {
+        f->lastUsed = ++p->sourceClock;
+
+        if ( lineNumber < f->nlines )
+        {
+            /* Lines are only terminated as they're asked for, so the rest of the file is left untouched */
+            r = &f->text[f->linestart[lineNumber]];
+            e = ( lineNumber + 1 < f->nlines ) ? &f->text[f->linestart[lineNumber + 1] - 1] : ( char * )memchr( r, '\n', &f->text[f->len] - r );
+
+            if ( e )
+            {
+                *e = 0;
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &p->sourceLock );
+    return r;
+}
+// ====================================================================================================
+bool symbolSourceSize( struct symbol *p, unsigned int fileNumber, unsigned int *nlines, size_t *len )
+
+/* Return the size of the source for file index, so the caller can make room for all of it at once */
+
+{
+    struct symbolSourcecodeStore *f;
+    bool ok;
+
+    assert( p );
+
+    if ( ( fileNumber >= p->tableLen[PT_FILENAME] ) || ( !p->source ) )
+    {
+        return false;
+    }
+
+    pthread_mutex_lock( &p->sourceLock );
+    f = &p->source[fileNumber];
+
+    if ( ( ok = ( ( f->text ) || ( _sourceOpen( p, fileNumber ) ) ) ) )
+    {
+        f->lastUsed = ++p->sourceClock;
+        *nlines = f->nlines;
+        *len = f->len;
+    }
+
+    pthread_mutex_unlock( &p->sourceLock );
+    return ok;
+}
+// ====================================================================================================
+bool symbolCanDemangle( void )
+
+{
+#if defined( HAVE_CXA_DEMANGLE )
+    return true;
+#else
+    return false;
+#endif
+}
+// ====================================================================================================
+const char *symbolDemangle( const char *mangled )
+
+/* Full C++ name for a linkage name, demangled the first time it's asked for, or NULL if it can't be */
+
+{
+    struct demangled *d;
+
+    if ( ( !mangled ) || ( strncmp( mangled, "_Z", 2 ) ) || ( !symbolCanDemangle() ) )
     {
         return NULL;
     }
+
+    pthread_mutex_lock( &_demangledLock );
+    HASH_FIND_STR( _demangled, mangled, d );
+
+    if ( !d )
+    {
+        d = ( struct demangled * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct demangled ) );
+        MEMCHECK( d, NULL );
+        d->mangled = memStrdup( MEM_SYMBOLS, mangled );
+        MEMCHECK( d->mangled, NULL );
+#if defined( HAVE_CXA_DEMANGLE )
+        int status;
+        d->name = __cxa_demangle( mangled, NULL, NULL, &status );
+#endif
+        HASH_ADD_KEYPTR( hh, _demangled, d->mangled, strlen( d->mangled ), d );
+    }
+
+    pthread_mutex_unlock( &_demangledLock );
+    return d->name;
+}
+// ====================================================================================================
+const char *symbolFunctionName( struct symbolFunctionStore *f, bool demangle )
+
+/* Name to show for f...the full C++ name if that's wanted and can be had, the linkage name if */
+/* it isn't wanted, otherwise the plain name.                                                   */
+
+{
+    const char *n;
+
+    if ( !f->manglename )
+    {
+        return f->funcname;
+    }
+
+    if ( !demangle )
+    {
+        return f->manglename;
+    }
+
+    return ( n = symbolDemangle( f->manglename ) ) ? n : f->funcname;
 }
 // ====================================================================================================
 
@@ -813,6 +3171,38 @@ struct symbolLineStore *symbolLineAt( struct symbol *p, symbolMemaddr addr )
 
 // ====================================================================================================
 
+struct symbolVariableStore *symbolVariableAt( struct symbol *p, symbolMemaddr addr )
+
+/* Return variable that covers specified address, or NULL */
+
+{
+    assert( p );
+    struct symbolVariableStore **v = ( struct symbolVariableStore ** )bsearch( &addr, p->var, p->nvar, sizeof( struct symbolVariableStore * ), _matchVar );
+    return v ? *v : NULL;
+}
+
+
+
+struct symbolVariableStore *symbolVariableByName( struct symbol *p, const char *name )
+
+/* Return variable with specified name, or NULL */
+
+{
+    assert( p );
+
+    for ( unsigned int i = 0; i < p->nvar; i++ )
+    {
+        if ( ( p->var[i]->varname ) && ( !strcmp( p->var[i]->varname, name ) ) )
+        {
+            return p->var[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+
 const char *symbolGetProducer( struct symbol *p, unsigned int index )
 
 /* Get command line that produced this code */
@@ -835,48 +3225,89 @@ const char *symbolGetFilename( struct symbol *p, unsigned int index )
 
 // ====================================================================================================
 
+const char *symbolGetInlineName( struct symbol *p, unsigned int index )
+
+/* Get the name of an inlined function */
+
+{
+    assert( p );
+    return ( index < p->tableLen[PT_INLINENAME] ) ? p->stringTable[PT_INLINENAME][index] : NULL;
+}
+
+// ====================================================================================================
+
+unsigned int symbolInlineStackAt( struct symbol *p, symbolMemaddr addr, const struct symbolInlineFrame **stack )
+
+/* Return the inline stack at the address, innermost first, and how deep it is */
+
+{
+    assert( p );
+    struct symbolInlineRange *r = ( struct symbolInlineRange * )bsearch( &addr, p->inlineRange, p->ninline, sizeof( struct symbolInlineRange ), _matchInline );
+
+    if ( !r )
+    {
+        return 0;
+    }
+
+    *stack = &p->inlineFrame[r->chain];
+    return r->depth;
+}
+
+// ====================================================================================================
+
 symbolMemptr symbolCodeAt( struct symbol *p, symbolMemaddr addr, unsigned int *len )
 
 /* Get pointer to memory at specified address...can move backwards and forwards through the region */
 
 {
     assert( p );
-    int i;
+    int i = _memRegion( p, addr );
 
-    /* A speedup in case we're looking in the same region as previously */
-    if ( ( p->cachedSearchIndex != -1 ) &&
-            ( p->mem[p->cachedSearchIndex].start < addr ) &&
-            ( addr - p->mem[p->cachedSearchIndex].start < p->mem[p->cachedSearchIndex].len ) )
+    if ( i < 0 )
     {
-        if ( len )
-        {
-            *len = p->mem[p->cachedSearchIndex].len - ( addr - p->mem[p->cachedSearchIndex].start );
-        }
+        return NULL;
+    }
 
-        return &( p->mem[p->cachedSearchIndex].data[addr - p->mem[p->cachedSearchIndex].start] );
+    if ( len )
+    {
+        *len = p->mem[i].len - ( addr - p->mem[i].start );
     }
 
-    /* Search backwards for candidate section for memory to be in. This could be       */
-    /* slightly more efficient as a binary search, but setup would offset any benefits */
-    for ( i = p->nsect_mem - 1; i && p->mem[i].start > addr; i-- );
+    return &( p->mem[i].data[addr - p->mem[i].start] );
+}
+
+// ====================================================================================================
+
+symbolMemptr symbolCodeRange( struct symbol *p, symbolMemaddr a, symbolMemaddr b, uint8_t *buf, unsigned int *len )
+
+{
+    unsigned int have;
+    symbolMemptr m = symbolCodeAt( p, a, &have );
+
+    *len = 0;
 
-    /* Are we within this code? */
-    if ( addr - p->mem[i].start < p->mem[i].len )
+    if ( !m )
     {
-        p->cachedSearchIndex = i;
-
-        if ( len )
-        {
-            *len = p->mem[i].len - ( addr - p->mem[i].start );
-        }
+        return NULL;
+    }
 
-        return &( p->mem[i].data[addr - p->mem[i].start] );
+    if ( ( have >= b - a ) || ( !buf ) )
+    {
+        *len = ( have < b - a ) ? have : b - a;
+        return m;
     }
-    else
+
+    /* This runs off the end of the region, so gather it up from the ones after it */
+    while ( m )
     {
-        p->cachedSearchIndex = -1;
-        return NULL;
+        unsigned int n = ( have < b - a - *len ) ? have : b - a - *len;
+
+        memcpy( &buf[*len], m, n );
+        *len += n;
+        m = ( *len < b - a ) ? symbolCodeAt( p, a + *len, &have ) : NULL;
     }
+
+    return buf;
 }
 
 // ====================================================================================================
@@ -895,86 +3326,143 @@ void symbolDelete( struct symbol *p )
             close( p->fd );
         }
 
-        /* Close the disassembler if it's in use */
-        if ( !p->caphandle )
+        /* Close the disassemblers if they're in use */
+        if ( p->caphandle )
         {
             cs_close( &p->caphandle );
         }
 
-        if ( p->nsect_mem )
+        if ( p->insnhandle )
+        {
+            cs_close( &p->insnhandle );
+        }
+
+        /* ...and lose what they classified */
+        for ( int i = 0; i < p->nsect_mem; i++ )
         {
-            for ( int i = p->nsect_mem - 1; i; i-- )
+            for ( unsigned int j = 0; ( p->mem[i].insnPage ) && ( j < ( p->mem[i].len + SYMBOL_INSN_PAGE - 1 ) / SYMBOL_INSN_PAGE ); j++ )
             {
-                if ( p->mem[i].name )
-                {
-                    free( p->mem[i].name );
+                memFree( MEM_SYMBOLS, p->mem[i].insnPage[j] );
+            }
 
-                    if ( p->mem[i].data )
-                    {
-                        free( p->mem[i].data );
-                    }
-                }
+            memFree( MEM_SYMBOLS, p->mem[i].insnPage );
+        }
+
+        pthread_mutex_destroy( &p->insnLock );
+
+        /* When we were loaded from the cache the names, memory and records all live in the cache */
+        /* block, so only the tables of pointers to them need to be released individually.        */
+        if ( p->nsect_mem )
+        {
+            for ( int i = 0; ( !p->cache ) && ( !p->nimage ) && ( i < p->nsect_mem ); i++ )
+            {
+                memFree( MEM_SYMBOLS, p->mem[i].name );
+                memFree( MEM_SYMBOLS, p->mem[i].data );
             }
 
-            free( p->mem );
+            memFree( MEM_SYMBOLS, p->mem );
         }
 
         while ( p->nfunc )
         {
             struct symbolFunctionStore *f = p->func[--p->nfunc];
 
-            if ( f->funcname )
+            /* A merged set's records all belong to the images it was made from */
+            if ( p->nimage )
             {
-                /* Remove the functionName, assuming we have one */
-                free( f->funcname );
+                continue;
             }
 
-            if ( f->manglename )
+            if ( f->line )
             {
-                /* Remove the mangled name, assuming we have one */
-                free( f->manglename );
+                /* ...and any source code cross-references */
+                memFree( MEM_SYMBOLS, f->line );
             }
 
-            if ( f->line )
+            if ( p->cache )
             {
-                /* ...and any source code cross-references */
-                free( f->line );
+                continue;
             }
 
-            free( f );
-        }
+            if ( f->funcname )
+            {
+                /* Remove the functionName, assuming we have one */
+                memFree( MEM_SYMBOLS, f->funcname );
+            }
 
-        /* Flush the string tables */
-        for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
-        {
-            while ( p->tableLen[pt] )
+            if ( f->manglename )
             {
-                free( p->stringTable[pt][--p->tableLen[pt]] );
+                /* Remove the mangled name, assuming we have one */
+                memFree( MEM_SYMBOLS, f->manglename );
             }
+
+            memFree( MEM_SYMBOLS, f );
         }
 
+        memFree( MEM_SYMBOLS, p->func );
+
         /* Flush the source code line records */
-        for ( int i = 0; i < p->nlines; i++ )
+        for ( int i = 0; ( !p->cache ) && ( !p->nimage ) && ( i < p->nlines ); i++ )
         {
-            free( p->line[i] );
+            memFree( MEM_SYMBOLS, p->line[i] );
         }
 
         if ( p->line )
         {
-            free( p->line );
+            memFree( MEM_SYMBOLS, p->line );
+        }
+
+        /* Flush the variable records */
+        for ( int i = 0; ( !p->cache ) && ( !p->nimage ) && ( i < p->nvar ); i++ )
+        {
+            memFree( MEM_SYMBOLS, p->var[i]->varname );
+            memFree( MEM_SYMBOLS, p->var[i] );
+        }
+
+        memFree( MEM_SYMBOLS, p->var );
+
+        if ( !p->cache )
+        {
+            memFree( MEM_SYMBOLS, p->inlineRange );
+            memFree( MEM_SYMBOLS, p->inlineFrame );
         }
 
         /* Remove any source code we might be holding */
-        for ( int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
+        for ( int i = 0; ( p->source ) && ( i < p->tableLen[PT_FILENAME] ); i++ )
+        {
+            if ( p->source[i].text )
+            {
+                _sourceClose( p, &p->source[i] );
+            }
+        }
+
+        memFree( MEM_SYMBOLS, p->source );
+        pthread_mutex_destroy( &p->sourceLock );
+
+        /* Flush the string tables. This has to come after the source, which is indexed by filename */
+        for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
         {
-            /* Text is all allocated in one block by readsource, so just deleting the firt element is enough */
-            free( p->source[i]->linetext[0] );
+            while ( ( !p->cache ) && ( p->tableLen[pt] ) )
+            {
+                memFree( MEM_SYMBOLS, p->stringTable[pt][--p->tableLen[pt]] );
+            }
 
-            /* ...and the block of pointers to lines in that text */
-            free( p->source[i] );
+            memFree( MEM_SYMBOLS, p->stringTable[pt] );
+        }
+
+        memFree( MEM_SYMBOLS, p->cacheFunc );
+        memFree( MEM_SYMBOLS, p->cacheLine );
+        memFree( MEM_SYMBOLS, p->cacheVar );
+        _cacheUnmap( p->cache, p->cacheLen );
+
+        /* ...and now the images it was an index over can go too */
+        while ( p->nimage )
+        {
+            symbolDelete( p->image[--p->nimage] );
         }
 
-        free( p );
+        memFree( MEM_SYMBOLS, p->image );
+        memFree( MEM_SYMBOLS, p );
     }
 
     p = NULL;
@@ -982,33 +3470,141 @@ void symbolDelete( struct symbol *p )
 
 // ====================================================================================================
 
-char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr )
+bool symbolDisassemblerOpen( csh *h )
 
-/* Return assembly code representing this line */
+/* Open a disassembler to be used with symbolDisassembleLineTo */
 
 {
-    cs_insn *insn;
-    size_t count;
-    static char op[255];
+    if ( cs_open( CS_ARCH_ARM, CS_MODE_THUMB + CS_MODE_LITTLE_ENDIAN, h ) != CS_ERR_OK )
+    {
+        return false;
+    }
+
+    cs_option( *h, CS_OPT_DETAIL, CS_OPT_ON );
+    return true;
+}
+// ====================================================================================================
+
+static struct symbolInsnEntry *_insnEntry( struct symbol *p, symbolMemaddr addr )
+
+/* The classification of the instruction at addr, or NULL if there isn't one to be had */
+
+{
+    struct symbolInsnEntry *e;
+    struct symbolMemoryStore *m;
+    int r = _memRegion( p, addr );
+
+    if ( r < 0 )
+    {
+        return NULL;
+    }
+
+    m = &p->mem[r];
+    addr -= m->start;
+
+    if ( ( !m->insnPage ) ||
+            ( ( !( e = atomic_load( &m->insnPage[addr / SYMBOL_INSN_PAGE] ) ) ) && ( !( e = _insnPage( p, m, addr / SYMBOL_INSN_PAGE ) ) ) ) )
+    {
+        /* No disassembler to be had */
+        return NULL;
+    }
+
+    return &e[( addr % SYMBOL_INSN_PAGE ) / 2];
+}
+// ====================================================================================================
+
+bool symbolInsnAt( struct symbol *p, symbolMemaddr addr, enum instructionClass *ic, symbolMemaddr *newaddr )
+
+{
+    struct symbolInsnEntry *e = _insnEntry( p, addr );
+
+    *ic = LE_IC_NONE;
 
     if ( newaddr )
     {
         *newaddr = NO_ADDRESS;
     }
 
-    *ic = 0;
+    if ( !e )
+    {
+        return false;
+    }
+
+    *ic = e->ic;
+
+    if ( newaddr )
+    {
+        *newaddr = e->dest;
+    }
+
+    return true;
+}
+// ====================================================================================================
+
+symbolMemaddr symbolNextBranch( struct symbol *p, symbolMemaddr addr )
+
+/* Each step is either to a branch or off the end of a page, so this is one lookup per page crossed */
+
+{
+    struct symbolInsnEntry *e;
+
+    while ( ( e = _insnEntry( p, addr ) ) )
+    {
+        if ( e->ic & ( LE_IC_JUMP | LE_IC_CALL ) )
+        {
+            return addr;
+        }
+
+        addr += e->toBranch * 2;
+    }
+
+    return NO_ADDRESS;
+}
+// ====================================================================================================
+
+char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr )
+
+/* Return assembly code representing this line */
+
+{
+    static char op[SYMBOL_DISASM_LEN];
 
     if ( !p->caphandle )
     {
         /* Disassembler isn't initialised yet */
-        if ( cs_open( CS_ARCH_ARM, CS_MODE_THUMB + CS_MODE_LITTLE_ENDIAN, &p->caphandle ) != CS_ERR_OK )
+        if ( !symbolDisassemblerOpen( &p->caphandle ) )
         {
+            if ( newaddr )
+            {
+                *newaddr = NO_ADDRESS;
+            }
+
+            *ic = 0;
             return NULL;
         }
+    }
+
+    return symbolDisassembleLineTo( p, p->caphandle, op, ic, addr, newaddr );
+}
+// ====================================================================================================
+
+char *symbolDisassembleLineTo( struct symbol *p, csh h, char *op, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr )
 
-        cs_option( p->caphandle, CS_OPT_DETAIL, CS_OPT_ON );
+/* Return assembly code representing this line in op, which is SYMBOL_DISASM_LEN long. Other than */
+/* the memory search hint, which is safe to share, nothing in p is changed, so this can be used    */
+/* from several threads at once, each with its own h.                                              */
+
+{
+    cs_insn *insn;
+    size_t count;
+
+    if ( newaddr )
+    {
+        *newaddr = NO_ADDRESS;
     }
 
+    *ic = 0;
+
     symbolMemptr m = symbolCodeAt( p, addr, NULL );
 
     if ( !m )
@@ -1017,70 +3613,24 @@ char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbol
         return NULL;
     }
 
-    count = cs_disasm( p->caphandle, m, 4, addr, 0, &insn );
+    count = cs_disasm( h, m, 4, addr, 0, &insn );
     *ic = LE_IC_NONE;
 
 
     if ( count > 0 )
     {
-        /* Characterise the instruction using rules from F1.3 of ARM IHI0064H.a */
-
-        /* Check instruction size */
-        *ic |= ( insn->size == 4 ) ? LE_IC_4BYTE : 0;
-
-        /* Was it a subroutine call? */
-        *ic |= ( ( insn->id == ARM_INS_BL ) || ( insn->id == ARM_INS_BLX ) ) ? LE_IC_JUMP | LE_IC_CALL : 0;
-
-        /* Was it a regular call? */
-        *ic |= ( ( insn->id == ARM_INS_B )    || ( insn->id == ARM_INS_BX )  || ( insn->id == ARM_INS_ISB ) ||
-                 ( insn->id == ARM_INS_WFI )  || ( insn->id == ARM_INS_WFE ) || ( insn->id == ARM_INS_TBB ) ||
-                 ( insn->id == ARM_INS_TBH )  || ( insn->id == ARM_INS_BXJ ) || ( insn->id == ARM_INS_CBZ ) ||
-                 ( insn->id == ARM_INS_CBNZ ) || ( insn->id == ARM_INS_WFI ) || ( insn->id == ARM_INS_WFE )
-               ) ? LE_IC_JUMP : 0;
-
-        *ic |=  (
-                            ( ( ( insn->id == ARM_INS_SUB ) || ( insn->id == ARM_INS_MOV ) ||
-                                ( insn->id == ARM_INS_LDM ) || ( insn->id == ARM_INS_POP ) )
-                              && strstr( insn->op_str, "pc" ) )
-                ) ? LE_IC_JUMP : 0;
-
-        /* Was it an exception return? */
-        *ic |=  ( ( insn->id == ARM_INS_ERET ) ) ? LE_IC_JUMP | LE_IC_IRET : 0;
-
+        _classify( insn, ic, newaddr );
 
         /* Add text describing instruction */
         if ( *ic & LE_IC_4BYTE )
         {
-            sprintf( op, "%8"PRIx64":   %02x%02x %02x%02x   %s %s", insn->address, insn->bytes[1], insn->bytes[0], insn->bytes[3], insn->bytes[2], insn->mnemonic, insn->op_str );
+            snprintf( op, SYMBOL_DISASM_LEN, "%8"PRIx64":   %02x%02x %02x%02x   %s %s", insn->address, insn->bytes[1], insn->bytes[0], insn->bytes[3], insn->bytes[2], insn->mnemonic, insn->op_str );
         }
         else
         {
-            sprintf( op, "%8"PRIx64":   %02x%02x        %s  %s", insn->address, insn->bytes[1], insn->bytes[0], insn->mnemonic, insn->op_str  );
-        }
-
-        /* Check to see if operands are immediate */
-        cs_detail *detail = insn->detail;
-
-        if ( detail->arm.op_count )
-        {
-
-            for ( int n = 0; n <  insn->detail->arm.op_count; n++ )
-            {
-                if ( insn->detail->arm.operands[n].type == ARM_OP_IMM )
-                {
-                    *ic |= LE_IC_IMMEDIATE;
-
-                    if ( newaddr )
-                    {
-                        *newaddr = detail->arm.operands[0].imm;
-                    }
-
-                    break;
-                }
-            }
+            snprintf( op, SYMBOL_DISASM_LEN, "%8"PRIx64":   %02x%02x        %s  %s", insn->address, insn->bytes[1], insn->bytes[0], insn->mnemonic, insn->op_str  );
         }
 
-
         /* Add classifications ( for debug ) */
         //if ( *ic )
         //            {
@@ -1089,7 +3639,7 @@ char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbol
     }
     else
     {
-        sprintf( op, "No disassembly" );
+        snprintf( op, SYMBOL_DISASM_LEN, "No disassembly" );
     }
 
     cs_free( insn, count );
@@ -1108,6 +3658,20 @@ bool symbolSetValid( struct symbol *p )
 #define ELF_MAGIC (0x464c457f)
     uint32_t magicMatch;
 
+    if ( ( p ) && ( p->nimage ) )
+    {
+        /* A merged set is only as good as all of the images in it */
+        for ( unsigned int i = 0; i < p->nimage; i++ )
+        {
+            if ( !symbolSetValid( p->image[i] ) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     if ( ( p ) && ( p->fd >= 0 ) )
     {
         /* See if we can read from this file */
@@ -1127,12 +3691,60 @@ bool symbolSetValid( struct symbol *p )
 
 // ====================================================================================================
 
-struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource )
+const char *symbolNextImage( const char *spec, char *name, size_t len, symbolMemaddr *offset )
 
-/* Collect symbol set with specified components */
+/* Pick the next image off an elf file list, returning where the one after it starts */
+
+{
+    const char *end, *next, *at;
+    char *numend;
+
+    if ( ( !spec ) || ( !*spec ) )
+    {
+        return NULL;
+    }
+
+    *offset = 0;
+
+    /* Something that's a file as it stands is just the one image, even if it has a , or @ in its name */
+    if ( !access( spec, F_OK ) )
+    {
+        snprintf( name, len, "%s", spec );
+        return spec + strlen( spec );
+    }
+
+    end = ( strchr( spec, ',' ) ) ? strchr( spec, ',' ) : spec + strlen( spec );
+    next = ( *end ) ? end + 1 : end;
+
+    /* The offset is whatever follows the last @, if that's a number and nothing else */
+    for ( at = end; ( at > spec ) && ( at[-1] != '@' ); at-- );
+
+    if ( ( at > spec ) && ( at < end ) )
+    {
+        symbolMemaddr o = strtoull( at, &numend, 0 );
+
+        if ( numend == end )
+        {
+            *offset = o;
+            end = at - 1;
+        }
+    }
+
+    snprintf( name, len, "%.*s", ( int )( end - spec ), spec );
+    return next;
+}
+
+// ====================================================================================================
+
+static struct symbol *_acquireImage( const char *filename, bool loadmem )
+
+/* Read one elf file, from the symbol cache if it's in there */
 
 {
-    struct symbol *p = ( struct symbol * )calloc( 1, sizeof( struct symbol ) );
+    struct symbol *p = ( struct symbol * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct symbol ) );
+    MEMCHECK( p, NULL );
+    pthread_mutex_init( &p->sourceLock, NULL );
+    pthread_mutex_init( &p->insnLock, NULL );
 
     /* O_BINARY Only needed on platforms that differentiate between binary and text files */
 #ifndef O_BINARY
@@ -1142,24 +3754,105 @@ struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource )
     if ( ( p->fd = open( filename, O_RDONLY | O_BINARY, 0 ) ) < 0 )
 #endif
     {
-        free( p );
+        pthread_mutex_destroy( &p->sourceLock );
+        pthread_mutex_destroy( &p->insnLock );
+        memFree( MEM_SYMBOLS, p );
         return NULL;
     }
 
-    /* Load the memory image if this was requested...if it fails then we fail */
-    if ( loadmem && ( !_readProg( p ) ) )
+    uint64_t hash = _hashFile( p->fd );
+
+    if ( !_readCache( p, hash, loadmem ) )
     {
-        symbolDelete( p );
-        return NULL;
+        /* Load the memory image if this was requested...if it fails then we fail */
+        if ( loadmem && ( !_readProg( p ) ) )
+        {
+            symbolDelete( p );
+            return NULL;
+        }
+
+        /* Load the functions and source code line mappings if requested */
+        if ( !_readLines( p, filename ) )
+        {
+            symbolDelete( p );
+            return NULL;
+        }
+
+        /* ...and keep them for next time */
+        _writeCache( p, hash );
     }
 
-    /* Load the functions and source code line mappings if requested */
-    if ( !_readLines( p ) )
+    return p;
+}
+
+// ====================================================================================================
+
+struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource )
+
+/* Collect symbol set with specified components */
+
+{
+    struct symbol *image[SYMBOL_MAX_IMAGES];
+    unsigned int nimage = 0;
+    char name[PATH_MAX];
+    symbolMemaddr offset;
+    const char *spec = filename;
+    struct symbol *p;
+
+    /* Each image is read (or found in the cache) as it would be on its own, then moved to where it's loaded */
+    while ( ( spec = symbolNextImage( spec, name, sizeof( name ), &offset ) ) )
     {
-        symbolDelete( p );
+        if ( nimage == SYMBOL_MAX_IMAGES )
+        {
+            genericsReport( V_ERROR, "No more than %d elf files can be used together" EOL, SYMBOL_MAX_IMAGES );
+            break;
+        }
+
+        if ( !( image[nimage] = _acquireImage( name, loadmem ) ) )
+        {
+            break;
+        }
+
+        _offsetImage( image[nimage++], offset );
+    }
+
+    if ( ( spec ) || ( !nimage ) )
+    {
+        /* Didn't get all of them, so there's nothing */
+        while ( nimage )
+        {
+            symbolDelete( image[--nimage] );
+        }
+
         return NULL;
     }
 
+    if ( nimage == 1 )
+    {
+        p = image[0];
+    }
+    else
+    {
+        /* Several, so this set is an index over them all */
+        p = ( struct symbol * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct symbol ) );
+        MEMCHECK( p, NULL );
+        pthread_mutex_init( &p->sourceLock, NULL );
+        pthread_mutex_init( &p->insnLock, NULL );
+        p->fd = -1;
+        p->image = ( struct symbol ** )memAlloc( MEM_SYMBOLS, sizeof( struct symbol * ) * nimage );
+        MEMCHECK( p->image, NULL );
+        memcpy( p->image, image, sizeof( struct symbol * ) * nimage );
+        p->nimage = nimage;
+        _mergeImages( p, image, nimage );
+    }
+
+    /* Room for the instruction tables, which are filled in as they're used */
+    for ( int i = 0; i < p->nsect_mem; i++ )
+    {
+        p->mem[i].insnPage = ( struct symbolInsnEntry * _Atomic * )memCalloc( MEM_SYMBOLS, ( p->mem[i].len + SYMBOL_INSN_PAGE - 1 ) / SYMBOL_INSN_PAGE + 1, sizeof( *p->mem[i].insnPage ) );
+        MEMCHECK( p->mem[i].insnPage, NULL );
+    }
+
     /* ...finally, the source code if requested. This can only be done if mem or functions we requested */
     if ( ( loadsource && loadmem )  && !_loadSource( p ) )
     {
@@ -1178,7 +3871,7 @@ struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource )
 // ====================================================================================================
 
 /* Test routines can be built with;
- * gcc -DTESTING_LOADELF loadelf.c readsource.c -I../Inc -I../subprojects/libdwarf-0.7.0/src/lib/libdwarf -ggdb -lcapstone -lelf ../build/subprojects/libdwarf-0.7.0/src/lib/libdwarf/libdwarf.so.0
+ * gcc -DTESTING_LOADELF loadelf.c readsource.c memAccount.c generics.c -I../Inc -I../subprojects/libdwarf-0.7.0/src/lib/libdwarf -ggdb -lcapstone -lelf ../build/subprojects/libdwarf-0.7.0/src/lib/libdwarf/libdwarf.so.0
  */
 
 #ifdef TESTING_LOADELF
@@ -1228,6 +3921,25 @@ bool _listFunctions( struct symbol *p, bool includeLines )
 
 // ====================================================================================================
 
+void _listInlines( struct symbol *p )
+
+{
+    const struct symbolInlineFrame *f;
+
+    for ( unsigned int i = 0; i < p->ninline; i++ )
+    {
+        struct symbolInlineRange *r = &p->inlineRange[i];
+        fprintf( stderr, MEMADDRF "..." MEMADDRF EOL, r->lowaddr, r->highaddr );
+
+        for ( unsigned int d = symbolInlineStackAt( p, r->lowaddr, &f ); d--; f++ )
+        {
+            fprintf( stderr, "   %s called at %s:%u" EOL, symbolGetInlineName( p, f->funcname ), symbolGetFilename( p, f->callfile ), f->callline );
+        }
+    }
+}
+
+// ====================================================================================================
+
 bool _listFile( struct symbol *p, int fileNo )
 
 {
@@ -1287,6 +3999,8 @@ void main( int argc, char *argv[] )
                 b += ic & LE_IC_4BYTE ? 4 : 2;
             }
     }
+
+    _listInlines( p );
 }
 // ====================================================================================================
 #endif
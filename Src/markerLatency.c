@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Marker Latency
+ * ==============
+ *
+ * Each channel has a mask of the pairs it starts and one of the pairs it stops, so a write to a
+ * channel nobody is timing costs a single load. Held markers are in a short queue; if it fills
+ * before a timestamp turns up (timestamps are off, say) they're taken at the time there is.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generics.h"
+#include "latencyHist.h"
+#include "markerLatency.h"
+
+#define MAX_CHANNELS (256)                        /* Stimulus ports, across all the pages */
+#define MAX_HELD     (64)                         /* Markers waiting for their timestamp */
+
+struct marker
+{
+    uint8_t chan;
+    bool anyValue;                                /* Any write to the channel will do */
+    uint32_t value;
+};
+
+struct pair
+{
+    char name[MARKERLATENCY_MAX_NAME];
+    struct marker start;
+    struct marker stop;
+
+    bool open;                                    /* A start is waiting for its stop */
+    uint64_t startedAt;                           /* ...and when it was */
+
+    struct latencyHist h;
+    uint64_t total;
+    uint64_t worst;
+    uint64_t overruns;
+    uint64_t strays;
+};
+
+struct markerLatency
+{
+    uint32_t startMask[MAX_CHANNELS];             /* Pairs started by a write to each channel */
+    uint32_t stopMask[MAX_CHANNELS];              /* ...and stopped by one */
+
+    unsigned int numPairs;
+    struct pair *p[MARKERLATENCY_MAX_PAIRS];
+
+    uint64_t now;                                 /* Timestamp, as the increments add up */
+    bool timed;                                   /* Any timestamp has been seen */
+    unsigned int numHeld;
+    struct
+    {
+        uint8_t chan;
+        uint32_t value;
+    } held[MAX_HELD];
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _parseMarker( const char *c, const char **end, struct marker *k )
+
+{
+    char *e;
+    unsigned long v = strtoul( c, &e, 0 );
+
+    if ( ( e == c ) || ( v >= MAX_CHANNELS ) )
+    {
+        return false;
+    }
+
+    k->chan = v;
+    k->anyValue = ( *e != ':' );
+
+    if ( *e == ':' )
+    {
+        c = e + 1;
+        k->value = strtoul( c, &e, 0 );
+
+        if ( e == c )
+        {
+            return false;
+        }
+    }
+
+    *end = e;
+    return true;
+}
+// ====================================================================================================
+static inline bool _matches( const struct marker *k, uint32_t value )
+
+{
+    return ( k->anyValue ) || ( k->value == value );
+}
+// ====================================================================================================
+static void _marker( struct markerLatency *m, uint8_t chan, uint32_t value, uint64_t t )
+
+/* A marker at time t. Stops are done first, so a marker that's both ends times from one to the next */
+
+{
+    uint32_t pend;
+
+    for ( pend = m->stopMask[chan]; pend; pend &= pend - 1 )
+    {
+        struct pair *p = m->p[__builtin_ctz( pend )];
+
+        if ( _matches( &p->stop, value ) )
+        {
+            if ( !p->open )
+            {
+                p->strays++;
+            }
+            else
+            {
+                uint64_t l = t - p->startedAt;
+
+                latencyRecord( &p->h, l );
+                p->total++;
+                p->worst = ( l > p->worst ) ? l : p->worst;
+                p->open = false;
+            }
+        }
+    }
+
+    for ( pend = m->startMask[chan]; pend; pend &= pend - 1 )
+    {
+        struct pair *p = m->p[__builtin_ctz( pend )];
+
+        if ( _matches( &p->start, value ) )
+        {
+            if ( p->open )
+            {
+                p->overruns++;
+            }
+            else
+            {
+                p->open = true;
+                p->startedAt = t;
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _release( struct markerLatency *m )
+
+/* Everything held gets the time there is now */
+
+{
+    for ( unsigned int i = 0; i < m->numHeld; i++ )
+    {
+        _marker( m, m->held[i].chan, m->held[i].value, m->now );
+    }
+
+    m->numHeld = 0;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct markerLatency *markerLatencyCreate( void )
+
+{
+    struct markerLatency *m = ( struct markerLatency * )calloc( 1, sizeof( struct markerLatency ) );
+    MEMCHECK( m, NULL );
+    return m;
+}
+// ====================================================================================================
+bool markerLatencyAdd( struct markerLatency *m, const char *spec )
+
+{
+    const char *c = spec;
+    const char *eq = strchr( spec, '=' );
+    struct pair *p;
+
+    if ( m->numPairs == MARKERLATENCY_MAX_PAIRS )
+    {
+        genericsReport( V_ERROR, "No more than %d latency pairs" EOL, MARKERLATENCY_MAX_PAIRS );
+        return false;
+    }
+
+    p = ( struct pair * )calloc( 1, sizeof( struct pair ) );
+    MEMCHECK( p, false );
+
+    if ( eq )
+    {
+        snprintf( p->name, sizeof( p->name ), "%.*s", ( int )( eq - spec ), spec );
+        c = eq + 1;
+    }
+
+    if ( ( !_parseMarker( c, &c, &p->start ) ) || ( *c++ != ',' ) || ( !_parseMarker( c, &c, &p->stop ) ) || ( *c ) )
+    {
+        genericsReport( V_ERROR, "Latency pair should be [<name>=]<channel>[:<value>],<channel>[:<value>], not %s" EOL, spec );
+        free( p );
+        return false;
+    }
+
+    if ( !p->name[0] )
+    {
+        snprintf( p->name, sizeof( p->name ), "%.*s", ( int )( sizeof( p->name ) - 1 ), spec );
+    }
+
+    m->startMask[p->start.chan] |= 1U << m->numPairs;
+    m->stopMask[p->stop.chan]   |= 1U << m->numPairs;
+    m->p[m->numPairs++] = p;
+    return true;
+}
+// ====================================================================================================
+unsigned int markerLatencyNumPairs( struct markerLatency *m )
+
+{
+    return m->numPairs;
+}
+// ====================================================================================================
+const char *markerLatencyName( struct markerLatency *m, unsigned int pair )
+
+{
+    return ( pair < m->numPairs ) ? m->p[pair]->name : "";
+}
+// ====================================================================================================
+void markerLatencySW( struct markerLatency *m, uint8_t chan, uint32_t value )
+
+{
+    if ( !( m->startMask[chan] | m->stopMask[chan] ) )
+    {
+        return;
+    }
+
+    if ( m->numHeld == MAX_HELD )
+    {
+        _release( m );
+    }
+
+    m->held[m->numHeld].chan  = chan;
+    m->held[m->numHeld].value = value;
+    m->numHeld++;
+}
+// ====================================================================================================
+void markerLatencyTS( struct markerLatency *m, uint32_t timeInc )
+
+{
+    m->now += timeInc;
+    m->timed = true;
+    _release( m );
+}
+// ====================================================================================================
+void markerLatencyReset( struct markerLatency *m )
+
+{
+    m->numHeld = 0;
+
+    for ( unsigned int i = 0; i < m->numPairs; i++ )
+    {
+        m->p[i]->open = false;
+    }
+}
+// ====================================================================================================
+bool markerLatencyTimed( struct markerLatency *m )
+
+{
+    return m->timed;
+}
+// ====================================================================================================
+void markerLatencyTake( struct markerLatency *m, unsigned int pair, struct markerLatencyStats *s )
+
+{
+    struct latencyStats l;
+    struct pair *p;
+
+    memset( s, 0, sizeof( struct markerLatencyStats ) );
+
+    if ( pair >= m->numPairs )
+    {
+        return;
+    }
+
+    p = m->p[pair];
+    latencyTake( &p->h, &l );
+    s->count    = l.count;
+    s->p50      = l.p50;
+    s->p99      = l.p99;
+    s->p999     = l.p999;
+    s->max      = l.max;
+    s->total    = p->total;
+    s->worst    = p->worst;
+    s->overruns = p->overruns;
+    s->strays   = p->strays;
+}
+// ====================================================================================================
+void markerLatencyDelete( struct markerLatency *m )
+
+{
+    if ( m )
+    {
+        for ( unsigned int i = 0; i < m->numPairs; i++ )
+        {
+            free( m->p[i] );
+        }
+
+        free( m );
+    }
+}
+// ====================================================================================================
@@ -0,0 +1,408 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Multicast Distribution of OFLOW
+ * ===============================
+ *
+ * The sender gathers what it's given into a datagram, sending it when the next write won't fit
+ * (so datagrams mostly end where a frame does) or when it's flushed. Anything bigger than a
+ * datagram is cut up as it comes. The receiver checks each sequence number against the one it
+ * expected, and hands the stream on from a datagram at a time.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "generics.h"
+#include "cobs.h"
+#include "mcast.h"
+
+/* Kernel buffering for a receiver, since nothing is going to resend what overflows it */
+#define MCAST_RCVBUF (4*1024*1024)
+
+/* Largest datagram we'll take, whatever a sender thinks it's doing */
+#define MCAST_MAX_DATAGRAM (65536)
+
+struct mcast
+{
+    int sockfd;
+    struct sockaddr_in group;              /* Where we send to, or what we joined */
+    bool sender;
+    uint32_t seq;                          /* Sequence number of the next datagram sent or expected */
+    bool started;                          /* Receiver - we've had one, so seq means something */
+    uint8_t session;                       /* Session of the sender, picked when it starts */
+    bool gap;                              /* Receiver - something went missing before what's pending */
+    size_t fill;                           /* Sender - what's gathered, receiver - end of what's pending */
+    size_t rp;                             /* Receiver - how far through what's pending we are */
+    struct mcastStats stats;
+    uint8_t *dg;                           /* Datagram being gathered or handed on, header included */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _parseSpec( const char *spec, int portOfs, struct sockaddr_in *a, int *ttl )
+
+/* Decode [group][:port][,ttl], leaving out anything that isn't there */
+
+{
+    char g[64];
+    const char *c = strchr( spec, ':' );
+    const char *t = strchr( spec, ',' );
+    size_t glen = ( c ) ? ( size_t )( c - spec ) : ( t ) ? ( size_t )( t - spec ) : strlen( spec );
+    int port = MCAST_DEFAULT_PORT;
+
+    if ( glen >= sizeof( g ) )
+    {
+        return false;
+    }
+
+    memcpy( g, spec, glen );
+    g[glen] = 0;
+
+    if ( c )
+    {
+        port = atoi( c + 1 );
+    }
+
+    if ( ( t ) && ( ttl ) )
+    {
+        *ttl = atoi( t + 1 );
+    }
+
+    memset( a, 0, sizeof( *a ) );
+    a->sin_family = AF_INET;
+    a->sin_port = htons( port + portOfs );
+
+    if ( !inet_pton( AF_INET, ( glen ) ? g : MCAST_DEFAULT_GROUP, &a->sin_addr ) )
+    {
+        return false;
+    }
+
+    /* Only a multicast group will do, anything else would be a different thing altogether */
+    return ( ( port > 0 ) && ( port + portOfs < 65536 ) && IN_MULTICAST( ntohl( a->sin_addr.s_addr ) ) );
+}
+// ====================================================================================================
+static struct mcast *_new( size_t dgLen )
+
+{
+    struct mcast *m = ( struct mcast * )calloc( 1, sizeof( struct mcast ) );
+    MEMCHECK( m, NULL );
+    m->dg = ( uint8_t * )malloc( dgLen );
+    MEMCHECK( m->dg, NULL );
+    return m;
+}
+// ====================================================================================================
+static void _send( struct mcast *m, const uint8_t *d, size_t len )
+
+/* Send one datagram of d, or of what is gathered if d is NULL */
+
+{
+    uint32_t s = htonl( m->seq++ );
+    struct iovec iov[2];
+    struct msghdr h = { .msg_name = &m->group, .msg_namelen = sizeof( m->group ), .msg_iov = iov, .msg_iovlen = 1 };
+
+    memcpy( &m->dg[MCAST_MAGIC_LEN + 2], &s, sizeof( s ) );
+    iov[0].iov_base = m->dg;
+    iov[0].iov_len = MCAST_HDR_LEN + ( ( d ) ? 0 : len );
+
+    if ( d )
+    {
+        iov[1].iov_base = ( void * )d;
+        iov[1].iov_len = len;
+        h.msg_iovlen = 2;
+    }
+
+    /* A datagram we can't send now is lost like any other, and the receivers will see the gap */
+    if ( sendmsg( m->sockfd, &h, MSG_DONTWAIT ) < 0 )
+    {
+        m->stats.lost++;
+        return;
+    }
+
+    m->stats.datagrams++;
+    m->stats.bytes += len;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct mcast *mcastCreate( const char *spec, int portOfs )
+
+/* Create a sender to the group in spec */
+
+{
+    struct mcast *m;
+    int ttl = MCAST_DEFAULT_TTL;
+    unsigned char v;
+    struct timespec ts;
+    uint64_t r;
+
+    assert( spec );
+    m = _new( MCAST_HDR_LEN + MCAST_PAYLOAD );
+
+    if ( !_parseSpec( spec, portOfs, &m->group, &ttl ) )
+    {
+        genericsReport( V_ERROR, "Multicast destination %s isn't [group][:port][,ttl] for a multicast group" EOL, spec );
+        mcastClose( m );
+        return NULL;
+    }
+
+    if ( ( m->sockfd = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Could not create multicast socket (%s)" EOL, strerror( errno ) );
+        mcastClose( m );
+        return NULL;
+    }
+
+    /* Readers on this host are as welcome as anyone else */
+    v = ttl;
+    setsockopt( m->sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &v, sizeof( v ) );
+    v = 1;
+    setsockopt( m->sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &v, sizeof( v ) );
+
+    /* A restart (even an exec in the same process) gets a different session and somewhere else to start the sequence */
+    clock_gettime( CLOCK_REALTIME, &ts );
+    r = ( ( uint64_t )ts.tv_sec * 1000000000ULL + ts.tv_nsec ) ^ ( ( uint64_t )getpid() << 40 );
+    r *= 0x9e3779b97f4a7c15ULL;
+    m->session = r >> 56;
+    m->seq = r >> 16;
+
+    m->sender = true;
+    memcpy( m->dg, MCAST_MAGIC, MCAST_MAGIC_LEN );
+    m->dg[MCAST_MAGIC_LEN] = MCAST_VERSION;
+    m->dg[MCAST_MAGIC_LEN + 1] = m->session;
+    return m;
+}
+// ====================================================================================================
+void mcastWrite( struct mcast *m, const void *d, size_t len )
+
+/* Gather the stream into datagrams. What's already gathered goes first if this won't fit with it, so */
+/* a datagram only splits a frame when what was written was bigger than a datagram to start with.      */
+
+{
+    const uint8_t *s = ( const uint8_t * )d;
+
+    assert( m->sender );
+
+    if ( ( m->fill ) && ( m->fill + len > MCAST_PAYLOAD ) )
+    {
+        mcastFlush( m );
+    }
+
+    /* Whole datagrams can go straight from where they are */
+    while ( len > MCAST_PAYLOAD )
+    {
+        _send( m, s, MCAST_PAYLOAD );
+        s += MCAST_PAYLOAD;
+        len -= MCAST_PAYLOAD;
+    }
+
+    memcpy( &m->dg[MCAST_HDR_LEN + m->fill], s, len );
+    m->fill += len;
+}
+// ====================================================================================================
+void mcastFlush( struct mcast *m )
+
+/* Send whatever is gathered */
+
+{
+    if ( m->fill )
+    {
+        _send( m, NULL, m->fill );
+        m->fill = 0;
+    }
+}
+// ====================================================================================================
+struct mcast *mcastOpen( const char *spec )
+
+/* Join the group in spec, ready to receive from it */
+
+{
+    struct mcast *m;
+    struct sockaddr_in a;
+    struct ip_mreq mreq;
+    int flag = 1;
+    int rcvbuf = MCAST_RCVBUF;
+
+    assert( spec );
+    m = _new( MCAST_MAX_DATAGRAM );
+
+    if ( !_parseSpec( spec, 0, &m->group, NULL ) )
+    {
+        genericsReport( V_ERROR, "Multicast source %s isn't [group][:port] for a multicast group" EOL, spec );
+        mcastClose( m );
+        return NULL;
+    }
+
+    if ( ( m->sockfd = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Could not create multicast socket (%s)" EOL, strerror( errno ) );
+        mcastClose( m );
+        return NULL;
+    }
+
+    /* Any number of us can listen to the same group on the same host */
+    setsockopt( m->sockfd, SOL_SOCKET, SO_REUSEADDR, ( const void * )&flag, sizeof( flag ) );
+#if defined( SO_REUSEPORT )
+    setsockopt( m->sockfd, SOL_SOCKET, SO_REUSEPORT, ( const void * )&flag, sizeof( flag ) );
+#endif
+    setsockopt( m->sockfd, SOL_SOCKET, SO_RCVBUF, ( const void * )&rcvbuf, sizeof( rcvbuf ) );
+
+    memset( &a, 0, sizeof( a ) );
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl( INADDR_ANY );
+    a.sin_port = m->group.sin_port;
+    mreq.imr_multiaddr = m->group.sin_addr;
+    mreq.imr_interface.s_addr = htonl( INADDR_ANY );
+
+    if ( ( bind( m->sockfd, ( struct sockaddr * )&a, sizeof( a ) ) < 0 ) ||
+            ( setsockopt( m->sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof( mreq ) ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Could not join multicast group %s (%s)" EOL, spec, strerror( errno ) );
+        mcastClose( m );
+        return NULL;
+    }
+
+    return m;
+}
+// ====================================================================================================
+size_t mcastRead( struct mcast *m, void *d, size_t len, int timeoutMs )
+
+/* Read what's pending from the last datagram, or wait up to timeoutMs for the next one. A sync is */
+/* put in wherever datagrams went missing, so the decoder doesn't join up the frames either side.  */
+
+{
+    uint8_t *o = ( uint8_t * )d;
+    struct pollfd pfd = { .fd = m->sockfd, .events = POLLIN };
+    uint32_t s;
+    int32_t diff;
+    ssize_t n;
+    size_t got;
+
+    assert( !m->sender );
+
+    while ( m->rp == m->fill )
+    {
+        if ( ( n = recv( m->sockfd, m->dg, MCAST_MAX_DATAGRAM, MSG_DONTWAIT ) ) < 0 )
+        {
+            if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) )
+            {
+                return 0;
+            }
+
+            if ( poll( &pfd, 1, timeoutMs ) == 0 )
+            {
+                return 0;
+            }
+
+            continue;
+        }
+
+        if ( ( n < MCAST_HDR_LEN ) || ( memcmp( m->dg, MCAST_MAGIC, MCAST_MAGIC_LEN ) ) || ( m->dg[MCAST_MAGIC_LEN] != MCAST_VERSION ) )
+        {
+            m->stats.bad++;
+            continue;
+        }
+
+        memcpy( &s, &m->dg[MCAST_MAGIC_LEN + 2], sizeof( s ) );
+        s = ntohl( s );
+        diff = ( int32_t )( s - m->seq );
+
+        if ( ( m->started ) && ( ( m->dg[MCAST_MAGIC_LEN + 1] != m->session ) || ( diff < -MCAST_RESTART_JUMP ) ) )
+        {
+            /* The sender has started again, so follow it from here, with whatever was part way through thrown out */
+            m->stats.restarts++;
+            m->gap = true;
+            m->started = false;
+        }
+
+        if ( m->started )
+        {
+            if ( diff < 0 )
+            {
+                /* We've already carried on without it, and it can't go in the middle of what came after */
+                m->stats.late++;
+                continue;
+            }
+
+            if ( diff > 0 )
+            {
+                m->stats.lost += diff;
+                m->gap = true;
+            }
+        }
+
+        m->started = true;
+        m->session = m->dg[MCAST_MAGIC_LEN + 1];
+        m->seq = s + 1;
+        m->stats.datagrams++;
+        m->stats.bytes += n - MCAST_HDR_LEN;
+        m->rp = MCAST_HDR_LEN;
+        m->fill = n;
+    }
+
+    got = 0;
+
+    if ( ( m->gap ) && ( len ) )
+    {
+        o[got++] = COBS_SYNC_CHAR;
+        m->gap = false;
+    }
+
+    if ( len - got > m->fill - m->rp )
+    {
+        len = got + m->fill - m->rp;
+    }
+
+    memcpy( &o[got], &m->dg[m->rp], len - got );
+    m->rp += len - got;
+    return len;
+}
+// ====================================================================================================
+const struct mcastStats *mcastGetStats( struct mcast *m )
+
+{
+    return &m->stats;
+}
+// ====================================================================================================
+void mcastClose( struct mcast *m )
+
+/* Finish with sender or receiver, sending anything gathered on the way */
+
+{
+    if ( !m )
+    {
+        return;
+    }
+
+    if ( m->sockfd > 0 )
+    {
+        if ( m->sender )
+        {
+            mcastFlush( m );
+        }
+
+        close( m->sockfd );
+    }
+
+    free( m->dg );
+    free( m );
+}
+// ====================================================================================================
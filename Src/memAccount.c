@@ -0,0 +1,340 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Memory Accounting
+ * =================
+ *
+ * The counts are atomics so any thread can allocate and any can report. Live counts are kept
+ * signed, so memory freed against the wrong subsystem (or that didn't come through here) only
+ * skews what's reported, it's never taken below zero.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#if defined(OSX)
+#include <malloc/malloc.h>
+#define _USABLE(p) malloc_size(p)
+#elif defined(WIN32)
+#include <malloc.h>
+#define _USABLE(p) _msize(p)
+#elif defined(FREEBSD)
+#include <malloc_np.h>
+#define _USABLE(p) malloc_usable_size(p)
+#elif defined(LINUX)
+#include <malloc.h>
+#define _USABLE(p) malloc_usable_size(p)
+#endif
+
+#include "generics.h"
+#include "memAccount.h"
+
+struct memAccount
+{
+    int64_t live;
+    uint64_t peak;
+    uint64_t limit;
+};
+
+static struct memAccount _acct[MEM_NUM_SUBSYSTEMS];
+static const char *_names[MEM_NUM_SUBSYSTEMS] = { "symbols", "addresses", "calls", "hash", "lines", "sequencer", "index" };
+
+#ifndef _USABLE
+/* Without the allocator telling us sizes, they're kept in a header in front of each block */
+#define _SIZE_HEADER
+#define _HDR (sizeof( max_align_t ))
+#define _USABLE(p) ( *( size_t * )( ( uint8_t * )( p ) - _HDR ) )
+#define _TOUSER(p) ( ( void * )( ( uint8_t * )( p ) + _HDR ) )
+#define _TOBLOCK(p) ( ( void * )( ( uint8_t * )( p ) - _HDR ) )
+#else
+#define _HDR (0)
+#define _TOUSER(p) ( p )
+#define _TOBLOCK(p) ( p )
+#endif
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _wouldExceed( enum memSubsystem s, size_t size )
+
+{
+    uint64_t limit = __atomic_load_n( &_acct[s].limit, __ATOMIC_RELAXED );
+    int64_t live = __atomic_load_n( &_acct[s].live, __ATOMIC_RELAXED );
+
+    if ( ( limit ) && ( ( live < 0 ? 0 : ( uint64_t )live ) + size > limit ) )
+    {
+        genericsReport( V_WARN, "Memory for %s is at its limit of %" PRIu64 " bytes" EOL, _names[s], limit );
+        return true;
+    }
+
+    return false;
+}
+// ====================================================================================================
+static void _account( enum memSubsystem s, int64_t delta )
+
+{
+    int64_t live = __atomic_add_fetch( &_acct[s].live, delta, __ATOMIC_RELAXED );
+    uint64_t peak = __atomic_load_n( &_acct[s].peak, __ATOMIC_RELAXED );
+
+    while ( ( live > 0 ) && ( ( uint64_t )live > peak ) &&
+            ( !__atomic_compare_exchange_n( &_acct[s].peak, &peak, ( uint64_t )live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) );
+}
+// ====================================================================================================
+static void *_placed( enum memSubsystem s, void *b, size_t size )
+
+/* A block has come back from the allocator, note it and hand back what the caller sees */
+
+{
+    if ( !b )
+    {
+        return NULL;
+    }
+
+#ifdef _SIZE_HEADER
+    *( size_t * )b = size;
+#endif
+    ( void )size;
+    _account( s, ( int64_t )_USABLE( _TOUSER( b ) ) );
+    return _TOUSER( b );
+}
+// ====================================================================================================
+static const char *_scaled( char *buf, size_t len, uint64_t v )
+
+{
+    if ( v >= 1024 * 1024 * 1024 )
+    {
+        snprintf( buf, len, "%.1fG", v / ( 1024.0 * 1024.0 * 1024.0 ) );
+    }
+    else if ( v >= 1024 * 1024 )
+    {
+        snprintf( buf, len, "%.1fM", v / ( 1024.0 * 1024.0 ) );
+    }
+    else if ( v >= 1024 )
+    {
+        snprintf( buf, len, "%" PRIu64 "K", v / 1024 );
+    }
+    else
+    {
+        snprintf( buf, len, "%" PRIu64, v );
+    }
+
+    return buf;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void *memAlloc( enum memSubsystem s, size_t size )
+
+{
+    if ( _wouldExceed( s, size ) )
+    {
+        return NULL;
+    }
+
+    return _placed( s, malloc( size + _HDR ), size );
+}
+// ====================================================================================================
+void *memCalloc( enum memSubsystem s, size_t n, size_t size )
+
+{
+    void *p;
+
+    if ( ( size ) && ( n > SIZE_MAX / size ) )
+    {
+        return NULL;
+    }
+
+    if ( ( p = memAlloc( s, n * size ) ) )
+    {
+        memset( p, 0, n * size );
+    }
+
+    return p;
+}
+// ====================================================================================================
+void *memRealloc( enum memSubsystem s, void *p, size_t size )
+
+{
+    size_t was;
+    void *b;
+
+    if ( !p )
+    {
+        return memAlloc( s, size );
+    }
+
+    was = _USABLE( p );
+
+    if ( ( size > was ) && ( _wouldExceed( s, size - was ) ) )
+    {
+        return NULL;
+    }
+
+    if ( !( b = realloc( _TOBLOCK( p ), size + _HDR ) ) )
+    {
+        return NULL;
+    }
+
+    _account( s, -( int64_t )was );
+    return _placed( s, b, size );
+}
+// ====================================================================================================
+char *memStrdup( enum memSubsystem s, const char *str )
+
+{
+    size_t len = strlen( str ) + 1;
+    char *p = ( char * )memAlloc( s, len );
+
+    if ( p )
+    {
+        memcpy( p, str, len );
+    }
+
+    return p;
+}
+// ====================================================================================================
+void memFree( enum memSubsystem s, void *p )
+
+{
+    if ( p )
+    {
+        _account( s, -( int64_t )_USABLE( p ) );
+        free( _TOBLOCK( p ) );
+    }
+}
+// ====================================================================================================
+void memSetLimit( enum memSubsystem s, uint64_t bytes )
+
+{
+    __atomic_store_n( &_acct[s].limit, bytes, __ATOMIC_RELAXED );
+}
+// ====================================================================================================
+bool memSetLimits( const char *spec )
+
+{
+    const char *p = spec;
+
+    while ( ( p ) && ( *p ) )
+    {
+        const char *eq = strchr( p, '=' );
+        uint64_t bytes;
+        char *e;
+        int s;
+
+        if ( !eq )
+        {
+            return false;
+        }
+
+        for ( s = 0; ( s < MEM_NUM_SUBSYSTEMS ) &&
+                ( ( strlen( _names[s] ) != ( size_t )( eq - p ) ) || ( strncmp( _names[s], p, eq - p ) ) ); s++ );
+
+        bytes = strtoull( eq + 1, &e, 0 );
+
+        if ( ( s == MEM_NUM_SUBSYSTEMS ) || ( e == eq + 1 ) )
+        {
+            return false;
+        }
+
+        switch ( *e )
+        {
+            case 'G':
+            case 'g':
+                bytes <<= 10;
+            // fall through
+
+            case 'M':
+            case 'm':
+                bytes <<= 10;
+            // fall through
+
+            case 'K':
+            case 'k':
+                bytes <<= 10;
+                e++;
+                break;
+
+            default:
+                break;
+        }
+
+        if ( ( *e ) && ( *e != ',' ) )
+        {
+            return false;
+        }
+
+        memSetLimit( s, bytes );
+        p = ( *e ) ? e + 1 : e;
+    }
+
+    return true;
+}
+// ====================================================================================================
+void memGetUse( enum memSubsystem s, struct memUse *u )
+
+{
+    int64_t live = __atomic_load_n( &_acct[s].live, __ATOMIC_RELAXED );
+
+    u->live  = ( live < 0 ) ? 0 : ( uint64_t )live;
+    u->peak  = __atomic_load_n( &_acct[s].peak, __ATOMIC_RELAXED );
+    u->limit = __atomic_load_n( &_acct[s].limit, __ATOMIC_RELAXED );
+}
+// ====================================================================================================
+uint64_t memLiveTotal( void )
+
+{
+    struct memUse u;
+    uint64_t t = 0;
+
+    for ( int s = 0; s < MEM_NUM_SUBSYSTEMS; s++ )
+    {
+        memGetUse( s, &u );
+        t += u.live;
+    }
+
+    return t;
+}
+// ====================================================================================================
+const char *memSubsystemName( enum memSubsystem s )
+
+{
+    return ( ( unsigned )s < MEM_NUM_SUBSYSTEMS ) ? _names[s] : "unknown";
+}
+// ====================================================================================================
+int memReport( char *buf, size_t len )
+
+{
+    char l[16], p[16];
+    struct memUse u;
+    size_t at = 0;
+
+    if ( len )
+    {
+        *buf = 0;
+    }
+
+    for ( int s = 0; s < MEM_NUM_SUBSYSTEMS; s++ )
+    {
+        memGetUse( s, &u );
+
+        if ( ( u.peak ) && ( at < len ) )
+        {
+            at += snprintf( &buf[at], len - at, "%s%s=%s/%s", ( at ) ? " " : "", _names[s],
+                            _scaled( l, sizeof( l ), u.live ), _scaled( p, sizeof( p ), u.peak ) );
+        }
+    }
+
+    return ( at < len ) ? at : ( len ? len - 1 : 0 );
+}
+// ====================================================================================================
@@ -0,0 +1,328 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Metrics Server
+ * ==============
+ *
+ * Connections are dealt with one at a time, and each is closed once its response has gone, which is
+ * all a scraper needs.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
+#include "generics.h"
+#include "metricsServer.h"
+
+#ifdef WIN32
+    #define MSG_NOSIGNAL 0
+#endif
+
+#if defined OSX || defined FREEBSD
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
+#endif
+
+#define REQUEST_MAX_LEN   (2048)                   /* Longest request we'll look at */
+#define REQUEST_WAIT_S    (2)                      /* ...and how long we'll wait for it */
+#define BODY_INITIAL_SIZE (16384)
+
+/* Latencies are exported at each power of two nS from about 1uS to about 68s */
+#define LATENCY_LOW_BIT   (10)
+#define LATENCY_HIGH_BIT  (36)
+
+struct metricsServer
+{
+    int sockfd;                                    /* Listening socket */
+    metricsRenderCB render;                        /* Who fills in the body */
+    metricsPathCB path;                            /* ...and the body for any other path, if anyone */
+    void *param;                                   /* ...and what they want to be told */
+    pthread_t thread;                              /* Thread answering requests */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _sendAll( int fd, const char *d, size_t len )
+
+{
+    while ( len )
+    {
+        ssize_t sent = send( fd, d, len, MSG_NOSIGNAL );
+
+        if ( sent <= 0 )
+        {
+            return false;
+        }
+
+        d += sent;
+        len -= sent;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _respond( struct metricsServer *m, int fd )
+
+/* Read the request (we only care about its first line) and answer it */
+
+{
+    char req[REQUEST_MAX_LEN + 1];
+    char hdr[256];
+    size_t rlen = 0;
+    ssize_t n;
+    struct metricsBuf b = { 0 };
+    const char *type = "text/plain; version=0.0.4";
+
+    /* Wait until there's a whole header, or as much of one as we're prepared to look at */
+    while ( ( rlen < REQUEST_MAX_LEN ) && ( ( n = recv( fd, &req[rlen], REQUEST_MAX_LEN - rlen, 0 ) ) > 0 ) )
+    {
+        rlen += n;
+        req[rlen] = 0;
+
+        if ( strstr( req, "\r\n\r\n" ) || strstr( req, "\n\n" ) )
+        {
+            break;
+        }
+    }
+
+    req[rlen] = 0;
+
+    if ( ( !strncmp( req, "GET /metrics", 12 ) ) || ( !strncmp( req, "GET / ", 6 ) ) )
+    {
+        m->render( &b, m->param );
+    }
+    else
+    {
+        /* Anything else is for whoever asked for other paths, if they recognise it...the path ends at the first space */
+        char *path = ( !strncmp( req, "GET /", 5 ) ) ? &req[4] : NULL;
+        char *e = ( path ) ? strpbrk( path, " \r\n" ) : NULL;
+
+        if ( e )
+        {
+            *e = 0;
+        }
+
+        if ( ( !e ) || ( !m->path ) || ( !( type = m->path( path, &b, m->param ) ) ) )
+        {
+            const char *nf = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            _sendAll( fd, nf, strlen( nf ) );
+            free( b.d );
+            return;
+        }
+    }
+
+    n = snprintf( hdr, sizeof( hdr ), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", type, b.len );
+
+    if ( _sendAll( fd, hdr, n ) && b.len )
+    {
+        _sendAll( fd, b.d, b.len );
+    }
+
+    free( b.d );
+}
+// ====================================================================================================
+static void *_serverTask( void *arg )
+
+{
+    struct metricsServer *m = ( struct metricsServer * )arg;
+    int fd;
+
+    listen( m->sockfd, 5 );
+
+    while ( ( fd = accept( m->sockfd, NULL, NULL ) ) >= 0 )
+    {
+        /* Don't let a client that never finishes its request hold up the next scrape */
+#ifdef WIN32
+        DWORD tv = REQUEST_WAIT_S * 1000;
+#else
+        struct timeval tv = { .tv_sec = REQUEST_WAIT_S, .tv_usec = 0 };
+#endif
+        setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, ( const void * )&tv, sizeof( tv ) );
+        _respond( m, fd );
+        close( fd );
+    }
+
+    genericsReport( V_WARN, "Metrics server stopped" EOL );
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void metricsPrintf( struct metricsBuf *b, const char *fmt, ... )
+
+/* Add to the body, growing it if need be */
+
+{
+    va_list va;
+    int n;
+
+    while ( true )
+    {
+        if ( b->size - b->len < 2 )
+        {
+            b->size = ( b->size ) ? b->size * 2 : BODY_INITIAL_SIZE;
+            b->d = ( char * )realloc( b->d, b->size );
+            MEMCHECK( b->d, );
+        }
+
+        va_start( va, fmt );
+        n = vsnprintf( &b->d[b->len], b->size - b->len, fmt, va );
+        va_end( va );
+
+        if ( ( n >= 0 ) && ( ( size_t )n < b->size - b->len ) )
+        {
+            b->len += n;
+            return;
+        }
+
+        /* Didn't fit, so make space for it */
+        b->size = b->len + ( ( n > 0 ) ? n : 0 ) + BODY_INITIAL_SIZE;
+        b->d = ( char * )realloc( b->d, b->size );
+        MEMCHECK( b->d, );
+    }
+}
+// ====================================================================================================
+void metricsType( struct metricsBuf *b, const char *name, const char *type, const char *help )
+
+/* The descriptive lines that go before the first sample of a metric */
+
+{
+    metricsPrintf( b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+// ====================================================================================================
+void metricsLatency( struct metricsBuf *b, const char *name, const char *labels, struct latencyHist *h )
+
+{
+    uint64_t below[LATENCY_MAX_BITS + 1];
+    uint64_t sum;
+    uint64_t total = latencyCumulative( h, below, &sum );
+    const char *sep = ( labels && *labels ) ? "," : "";
+
+    labels = ( labels ) ? labels : "";
+
+    for ( int k = LATENCY_LOW_BIT; k <= LATENCY_HIGH_BIT; k++ )
+    {
+        metricsPrintf( b, "%s_bucket{%s%sle=\"%.9g\"} %" PRIu64 "\n", name, labels, sep, ( double )( 1ULL << k ) / 1e9, below[k] );
+    }
+
+    metricsPrintf( b, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, total );
+    metricsPrintf( b, "%s_sum{%s} %.9f\n", name, labels, ( double )sum / 1e9 );
+    metricsPrintf( b, "%s_count{%s} %" PRIu64 "\n", name, labels, total );
+}
+// ====================================================================================================
+void metricsStats( struct metricsBuf *b, struct statsRegistry *r )
+
+{
+    struct statValue *v = NULL;
+    int max = 0;
+    int n;
+
+    /* Statistics could be added while we're looking, so go until there's room for all of them */
+    while ( ( n = statsRegistrySnapshot( r, v, max ) ) > max )
+    {
+        max = n + 16;
+        free( v );
+        v = ( struct statValue * )malloc( max * sizeof( struct statValue ) );
+        MEMCHECKV( v );
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( ( !i ) || ( strcmp( v[i].name, v[i - 1].name ) ) )
+        {
+            metricsType( b, v[i].name, ( v[i].type == STAT_GAUGE ) ? "gauge" : "counter", v[i].help );
+        }
+
+        if ( *v[i].labels )
+        {
+            metricsPrintf( b, "%s{%s} %" PRIu64 "\n", v[i].name, v[i].labels, v[i].v );
+        }
+        else
+        {
+            metricsPrintf( b, "%s %" PRIu64 "\n", v[i].name, v[i].v );
+        }
+    }
+
+    free( v );
+}
+// ====================================================================================================
+bool metricsServerStart( int port, metricsRenderCB render, void *param )
+
+/* Start serving metrics on port */
+
+{
+    return metricsServerStartPaths( port, render, NULL, param );
+}
+// ====================================================================================================
+bool metricsServerStartPaths( int port, metricsRenderCB render, metricsPathCB path, void *param )
+
+/* Start serving metrics on port, with whatever else path has to offer */
+
+{
+    struct sockaddr_in serv_addr;
+    int flag = 1;
+    struct metricsServer *m = ( struct metricsServer * )calloc( 1, sizeof( struct metricsServer ) );
+    MEMCHECK( m, false );
+
+    m->render = render;
+    m->path = path;
+    m->param = param;
+
+    if ( ( m->sockfd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Error opening metrics socket" EOL );
+        goto free_and_return;
+    }
+
+    setsockopt( m->sockfd, SOL_SOCKET, SO_REUSEADDR, ( const void * ) &flag, sizeof( flag ) );
+
+    memset( ( char * ) &serv_addr, 0, sizeof( serv_addr ) );
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons( port );
+
+    if ( bind( m->sockfd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Error binding metrics port %d" EOL, port );
+        close( m->sockfd );
+        goto free_and_return;
+    }
+
+    if ( pthread_create( &m->thread, NULL, &_serverTask, m ) )
+    {
+        genericsReport( V_ERROR, "Failed to create metrics thread" EOL );
+        close( m->sockfd );
+        goto free_and_return;
+    }
+
+    return true;
+
+free_and_return:
+    free( m );
+    return false;
+}
+// ====================================================================================================
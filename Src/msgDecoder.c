@@ -207,7 +207,7 @@ static bool _handleTS( struct ITMPacket *packet, struct TSMsg *decoded )
 
         if ( packet->len > 2 )
         {
-            stamp |= ( packet->d[2] ) << 7;
+            stamp |= ( packet->d[2] & 0x7f ) << 7;
 
             if ( packet->len > 3 )
             {
@@ -225,6 +225,32 @@ static bool _handleTS( struct ITMPacket *packet, struct TSMsg *decoded )
     return true;
 }
 // ====================================================================================================
+static bool _handleGTS( struct ITMPacket *packet, struct GTSMsg *decoded )
+
+/* ...a global timestamp, 7 bits a byte with only the low bits of the last byte of a GTS1 in it */
+
+{
+    decoded->msgtype = MSG_GTS;
+    decoded->high = ( packet->type == ITM_PT_GTS2 );
+    decoded->len = packet->len - 1;
+    decoded->bits = 0;
+
+    for ( int i = 1; i < packet->len; i++ )
+    {
+        decoded->bits |= ( uint64_t )( packet->d[i] & 0x7f ) << ( 7 * ( i - 1 ) );
+    }
+
+    if ( ( !decoded->high ) && ( decoded->len == 4 ) )
+    {
+        /* The last byte of a full GTS1 has the clock change and wrap flags above bits 25:21 */
+        decoded->clkch = ( packet->d[4] & 0x20 ) != 0;
+        decoded->wrap  = ( packet->d[4] & 0x40 ) != 0;
+        decoded->bits &= 0x3ffffff;
+    }
+
+    return decoded->len != 0;
+}
+// ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
 // Publically available routines
@@ -233,10 +259,19 @@ static bool _handleTS( struct ITMPacket *packet, struct TSMsg *decoded )
 // ====================================================================================================
 bool msgDecoder( struct ITMPacket *packet, struct msg *decoded )
 
+{
+    /* Stamp as early as possible, even if its not real */
+    return msgDecoderStamped( packet, decoded, genericsTimestampuS() );
+}
+// ====================================================================================================
+bool msgDecoderStamped( struct ITMPacket *packet, struct msg *decoded, uint64_t ts )
+
+/* As msgDecoder, but with the host timestamp provided by the caller */
+
 {
     bool wasDecoded = false;
     decoded->genericMsg.msgtype = MSG_NONE;
-    decoded->genericMsg.ts = genericsTimestampuS(); /* Stamp as early as possible, even if its not real */
+    decoded->genericMsg.ts = ts;
 
     switch ( packet->type )
     {
@@ -260,6 +295,11 @@ bool msgDecoder( struct ITMPacket *packet, struct msg *decoded )
             wasDecoded = _handleNISYNC( packet, ( struct nisyncMsg * )decoded );
             break;
 
+        case ITM_PT_GTS1:
+        case ITM_PT_GTS2:
+            wasDecoded = _handleGTS( packet, &decoded->gtsMsg );
+            break;
+
         case ITM_PT_XTN:
             genericsReport( V_INFO, "Unknown Extension Packet Received" EOL );
             decoded->genericMsg.msgtype = MSG_UNKNOWN;
@@ -278,3 +318,144 @@ bool msgDecoder( struct ITMPacket *packet, struct msg *decoded )
     return wasDecoded;
 }
 // ====================================================================================================
+void msgPack( const struct msg *m, struct msgPacked *p )
+
+/* Pack a decoded message down for holding */
+
+{
+    memset( p, 0, sizeof( struct msgPacked ) );
+    p->msgtype = m->genericMsg.msgtype;
+    p->ts = m->genericMsg.ts;
+
+    switch ( m->genericMsg.msgtype )
+    {
+        case MSG_SOFTWARE:
+            p->chan  = m->swMsg.srcAddr;
+            p->len   = m->swMsg.len;
+            p->value = m->swMsg.value;
+            break;
+
+        case MSG_NISYNC:
+            p->chan  = m->nisyncMsg.type;
+            p->value = m->nisyncMsg.addr;
+            break;
+
+        case MSG_OSW:
+            p->chan  = m->oswMsg.comp;
+            p->value = m->oswMsg.offset;
+            break;
+
+        case MSG_DATA_ACCESS_WP:
+            p->chan  = m->wptMsg.comp;
+            p->value = m->wptMsg.data;
+            break;
+
+        case MSG_DATA_RWWP:
+            p->chan  = m->watchMsg.comp;
+            p->flags = ( m->watchMsg.isWrite ) ? MSG_PACKED_WRITE : 0;
+            p->value = m->watchMsg.data;
+            break;
+
+        case MSG_PC_SAMPLE:
+            p->flags = ( m->pcSampleMsg.sleep ) ? MSG_PACKED_SLEEP : 0;
+            p->value = m->pcSampleMsg.pc;
+            break;
+
+        case MSG_DWT_EVENT:
+            p->chan  = m->dwtMsg.event;
+            break;
+
+        case MSG_EXCEPTION:
+            p->chan  = m->excMsg.eventType;
+            p->value = m->excMsg.exceptionNumber;
+            break;
+
+        case MSG_TS:
+            /* There's no union member for these, they're just laid over the message */
+            p->flags = ( ( const struct TSMsg * )m )->timeStatus;
+            p->value = ( ( const struct TSMsg * )m )->timeInc;
+            break;
+
+        case MSG_GTS:
+            p->flags = ( m->gtsMsg.high ? MSG_PACKED_GTS2 : 0 ) | ( m->gtsMsg.wrap ? MSG_PACKED_WRAP : 0 ) |
+                       ( m->gtsMsg.clkch ? MSG_PACKED_CLKCH : 0 );
+            p->len   = m->gtsMsg.len;
+            p->chan  = m->gtsMsg.bits >> 32;
+            p->value = m->gtsMsg.bits;
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+void msgUnpack( const struct msgPacked *p, struct msg *m )
+
+/* ...and put it back the way it was */
+
+{
+    memset( m, 0, sizeof( struct msg ) );
+    m->genericMsg.msgtype = ( enum MSGType )p->msgtype;
+    m->genericMsg.ts = p->ts;
+
+    switch ( p->msgtype )
+    {
+        case MSG_SOFTWARE:
+            m->swMsg.srcAddr = p->chan;
+            m->swMsg.len     = p->len;
+            m->swMsg.value   = p->value;
+            break;
+
+        case MSG_NISYNC:
+            m->nisyncMsg.type = p->chan;
+            m->nisyncMsg.addr = p->value;
+            break;
+
+        case MSG_OSW:
+            m->oswMsg.comp   = p->chan;
+            m->oswMsg.offset = p->value;
+            break;
+
+        case MSG_DATA_ACCESS_WP:
+            m->wptMsg.comp = p->chan;
+            m->wptMsg.data = p->value;
+            break;
+
+        case MSG_DATA_RWWP:
+            m->watchMsg.comp    = p->chan;
+            m->watchMsg.isWrite = ( p->flags & MSG_PACKED_WRITE ) != 0;
+            m->watchMsg.data    = p->value;
+            break;
+
+        case MSG_PC_SAMPLE:
+            m->pcSampleMsg.sleep = ( p->flags & MSG_PACKED_SLEEP ) != 0;
+            m->pcSampleMsg.pc    = p->value;
+            break;
+
+        case MSG_DWT_EVENT:
+            m->dwtMsg.event = p->chan;
+            break;
+
+        case MSG_EXCEPTION:
+            m->excMsg.eventType       = p->chan;
+            m->excMsg.exceptionNumber = p->value;
+            break;
+
+        case MSG_TS:
+            ( ( struct TSMsg * )m )->timeStatus = p->flags;
+            ( ( struct TSMsg * )m )->timeInc    = p->value;
+            break;
+
+        case MSG_GTS:
+            m->gtsMsg.high  = ( p->flags & MSG_PACKED_GTS2 ) != 0;
+            m->gtsMsg.wrap  = ( p->flags & MSG_PACKED_WRAP ) != 0;
+            m->gtsMsg.clkch = ( p->flags & MSG_PACKED_CLKCH ) != 0;
+            m->gtsMsg.len   = p->len;
+            m->gtsMsg.bits  = ( ( uint64_t )p->chan << 32 ) | p->value;
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
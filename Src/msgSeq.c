@@ -13,9 +13,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "generics.h"
 #include "msgSeq.h"
 #include "msgDecoder.h"
+#include "memAccount.h"
 
 // ====================================================================================================
 // ====================================================================================================
@@ -24,36 +26,88 @@
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static bool _addPage( struct MSGSeq *d )
+
+/* Add a page onto the end of the queue, re-using one if we can */
+
+{
+    struct MSGSeqPage *p = d->free;
+
+    if ( p )
+    {
+        d->free = p->next;
+    }
+    else
+    {
+        if ( !( p = ( struct MSGSeqPage * )memAlloc( MEM_SEQUENCER, sizeof( struct MSGSeqPage ) ) ) )
+        {
+            return false;
+        }
+
+        d->pages++;
+    }
+
+    p->next = NULL;
+
+    if ( d->tail )
+    {
+        d->tail->next = p;
+    }
+    else
+    {
+        d->head = p;
+        d->rp = 0;
+    }
+
+    d->tail = p;
+    d->wp = 0;
+    return true;
+}
+// ====================================================================================================
 static bool _bufferPacket( struct MSGSeq *d )
 
 {
     struct msg p;
 
-
     if ( !ITMGetDecodedPacket( d->i, &p )  )
     {
         /* There wasn't a decodable message in there */
         return false;
     }
 
-    /* Make a copy of it for later dispatch */
-    memcpy( &d->pbuffer[d->wp], &p, sizeof( struct msg ) );
+    if ( d->tb )
+    {
+        timebaseMsg( d->tb, &p );
+    }
 
-    /* If this is a timestamp then we put it on the front to be released first */
-    if ( d->pbuffer[d->wp].genericMsg.msgtype == MSG_TS )
+    /* If this is a timestamp then we keep it aside to be released first */
+    if ( p.genericMsg.msgtype == MSG_TS )
     {
+        memcpy( &d->timeMsg, &p, sizeof( struct msg ) );
         d->releaseTimeMsg = true;
         return true;
     }
-    else
+
+    if ( ( !d->tail ) || ( d->wp == MSGSEQ_PAGE_ENTRIES ) )
     {
-        d->wp = ( d->wp + 1 ) % d->pbl;
+        if ( !_addPage( d ) )
+        {
+            /* Can't grow so this one is lost...but let what we have out */
+            genericsReport( V_ERROR, "No memory for message sequencer" EOL );
+            return true;
+        }
+    }
 
-        assert( d->wp != d->rp );
+    /* Make a copy of it for later dispatch */
+    msgPack( &p, &d->tail->m[d->wp++] );
 
-        /* If the next message would cause overflow, then empty regardless */
-        return ( ( ( d->wp + 1 ) % d->pbl ) == d->rp );
+    if ( ++d->count > d->hwm )
+    {
+        d->hwm = d->count;
     }
+
+    /* If we've been holding things for far too long then empty regardless */
+    return ( d->count >= MSGSEQ_MAX_ENTRIES );
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -62,38 +116,91 @@ static bool _bufferPacket( struct MSGSeq *d )
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-void MSGSeqInit( struct MSGSeq *d, struct ITMDecoder *i, uint32_t maxEntries )
+bool MSGSeqInit( struct MSGSeq *d, struct ITMDecoder *i, uint32_t maxEntries )
 
-/* Reset and initialise an Message Sequencer instance */
+/* Reset and initialise an Message Sequencer instance. maxEntries is only a hint for how much */
+/* to allocate up front, the sequencer grows as needed. Returns false if there wasn't memory. */
 
 {
+    bool ok;
+
     memset( d, 0, sizeof( struct MSGSeq ) );
     d->i = i;
-    d->pbl = maxEntries;
-    d->pbuffer = calloc( maxEntries, sizeof( struct msg ) );
+
+    /* Pre-allocate enough to cover the hint, then put it all on the free list */
+    do
+    {
+        ok = _addPage( d );
+    }
+    while ( ( ok ) && ( d->pages * MSGSEQ_PAGE_ENTRIES < maxEntries ) );
+
+    if ( d->tail )
+    {
+        d->tail->next = d->free;
+        d->free = d->head;
+        d->head = d->tail = NULL;
+    }
+
+    return ok;
 }
 // ====================================================================================================
 struct msg *MSGSeqGetPacket( struct MSGSeq *d )
 
+/* Next message out, which remains valid until the next call */
+
 {
-    uint32_t trp = d->rp;
+    struct MSGSeqPage *p;
 
     /* Roll the timestamp off the front if it's present */
     if ( d->releaseTimeMsg )
     {
         d->releaseTimeMsg = false;
-        return &d->pbuffer[d->wp];
+
+        if ( d->tb )
+        {
+            d->timeMsg.genericMsg.ts = timebaseNs( d->tb );
+        }
+
+        return &d->timeMsg;
     }
 
-    if ( d->wp == d->rp )
+    if ( !d->count )
     {
         return NULL;
     }
 
-    /* Roll to next entry */
-    d->rp = ( d->rp + 1 ) % d->pbl;
+    msgUnpack( &d->head->m[d->rp++], &d->out );
+    d->count--;
+
+    if ( d->tb )
+    {
+        /* Everything held came before the timestamp that let it out, so that's its time */
+        d->out.genericMsg.ts = timebaseNs( d->tb );
+    }
+
+    if ( ( d->rp == MSGSEQ_PAGE_ENTRIES ) || ( !d->count ) )
+    {
+        /* Finished with this page (or everything), so hand it back */
+        p = d->head;
+        d->head = p->next;
+        d->rp = 0;
+
+        if ( !d->head )
+        {
+            d->tail = NULL;
+        }
+
+        p->next = d->free;
+        d->free = p;
+    }
+
+    return &d->out;
+}
+// ====================================================================================================
+void MSGSeqSetTimebase( struct MSGSeq *d, struct timebase *t )
 
-    return &d->pbuffer[trp];
+{
+    d->tb = t;
 }
 // ====================================================================================================
 bool MSGSeqPump( struct MSGSeq *d, uint8_t c )
@@ -111,22 +218,22 @@ bool MSGSeqPump( struct MSGSeq *d, uint8_t c )
 
         // ------------------------------------
         case ITM_EV_UNSYNCED:
-            genericsReport( V_WARN, "ITM Lost Sync (%d)" EOL, ITMDecoderGetStats( d->i )->lostSyncCount );
+            genericsReport( V_WARN, "ITM Lost Sync (%" PRIu64 ")" EOL, ITMDecoderGetStats( d->i )->lostSyncCount );
             break;
 
         // ------------------------------------
         case ITM_EV_SYNCED:
-            genericsReport( V_INFO, "ITM In Sync (%d)" EOL, ITMDecoderGetStats( d->i )->syncCount );
+            genericsReport( V_INFO, "ITM In Sync (%" PRIu64 ")" EOL, ITMDecoderGetStats( d->i )->syncCount );
             break;
 
         // ------------------------------------
         case ITM_EV_OVERFLOW:
-            genericsReport( V_DEBUG, "ITM Overflow (%d)" EOL, ITMDecoderGetStats( d->i )->overflow );
+            genericsReportRateLimited( V_DEBUG, "ITM Overflow (%" PRIu64 ")" EOL, ITMDecoderGetStats( d->i )->overflow );
             break;
 
         // ------------------------------------
         case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
+            genericsReportRateLimited( V_WARN, "ITM Error" EOL );
             break;
 
         // ------------------------------------
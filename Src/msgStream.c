@@ -0,0 +1,573 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Message Stream Module
+ * =====================
+ *
+ * Encoding, filtering and decoding of framed, pre-decoded ITM messages. See msgStream.h
+ * for the layout.
+ */
+
+#include <string.h>
+#include "msgStream.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline void _put16( uint8_t *p, uint16_t v )
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+static inline void _put32( uint8_t *p, uint32_t v )
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+static inline void _put64( uint8_t *p, uint64_t v )
+{
+    _put32( p, ( uint32_t )v );
+    _put32( p + 4, ( uint32_t )( v >> 32 ) );
+}
+static inline uint16_t _get16( const uint8_t *p )
+{
+    return p[0] | ( p[1] << 8 );
+}
+static inline uint32_t _get32( const uint8_t *p )
+{
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( ( uint32_t )p[3] << 24 );
+}
+static inline uint64_t _get64( const uint8_t *p )
+{
+    return _get32( p ) | ( ( uint64_t )_get32( p + 4 ) << 32 );
+}
+// ====================================================================================================
+static uint32_t _putVarint( uint8_t *p, int64_t v )
+
+/* Zigzag encode v so small offsets either side of the base stay short, then write 7 bits at a time */
+
+{
+    uint64_t z = ( ( uint64_t )v << 1 ) ^ ( uint64_t )( v >> 63 );
+    uint32_t n = 0;
+
+    while ( z >= 0x80 )
+    {
+        p[n++] = ( z & 0x7f ) | 0x80;
+        z >>= 7;
+    }
+
+    p[n++] = z;
+    return n;
+}
+// ====================================================================================================
+static bool _getVarint( const uint8_t **p, const uint8_t *end, int64_t *v )
+
+/* Read back what _putVarint wrote, without running off end */
+
+{
+    uint64_t z = 0;
+
+    for ( int shift = 0; ( *p < end ) && ( shift < 64 ); shift += 7 )
+    {
+        uint8_t c = *( *p )++;
+        z |= ( uint64_t )( c & 0x7f ) << shift;
+
+        if ( !( c & 0x80 ) )
+        {
+            *v = ( int64_t )( z >> 1 ) ^ -( int64_t )( z & 1 );
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static uint32_t _encodeFields( const struct msg *m, uint8_t *tag, uint8_t *p )
+
+/* Write the type specific part of a record, returning its length, or 0 for messages we don't carry */
+
+{
+    switch ( m->genericMsg.msgtype )
+    {
+        case MSG_SOFTWARE:
+            *tag = MSGSTREAM_TAG_SW( m->swMsg.srcAddr & 0x1f );
+            _put32( p, m->swMsg.value );
+            return ( ( m->swMsg.len >= 1 ) && ( m->swMsg.len <= 4 ) ) ? m->swMsg.len : 4;
+
+        case MSG_NISYNC:
+            p[0] = m->nisyncMsg.type;
+            _put32( &p[1], m->nisyncMsg.addr );
+            break;
+
+        case MSG_OSW:
+            p[0] = m->oswMsg.comp;
+            _put32( &p[1], m->oswMsg.offset );
+            break;
+
+        case MSG_DATA_ACCESS_WP:
+            p[0] = m->wptMsg.comp;
+            _put32( &p[1], m->wptMsg.data );
+            break;
+
+        case MSG_DATA_RWWP:
+            p[0] = m->watchMsg.comp;
+            p[1] = m->watchMsg.isWrite;
+            _put32( &p[2], m->watchMsg.data );
+            *tag = MSGSTREAM_TAG_MSG( MSG_DATA_RWWP );
+            return 6;
+
+        case MSG_PC_SAMPLE:
+            p[0] = m->pcSampleMsg.sleep;
+            _put32( &p[1], m->pcSampleMsg.pc );
+            break;
+
+        case MSG_DWT_EVENT:
+            p[0] = m->dwtMsg.event;
+            *tag = MSGSTREAM_TAG_MSG( MSG_DWT_EVENT );
+            return 1;
+
+        case MSG_EXCEPTION:
+            _put16( p, m->excMsg.exceptionNumber );
+            p[2] = m->excMsg.eventType;
+            *tag = MSGSTREAM_TAG_MSG( MSG_EXCEPTION );
+            return 3;
+
+        case MSG_TS:
+            /* There's no union member for timestamps, though the decoder makes them in a struct msg */
+            p[0] = ( ( const struct TSMsg * )m )->timeStatus;
+            _put32( &p[1], ( ( const struct TSMsg * )m )->timeInc );
+            break;
+
+        default:
+            return 0;
+    }
+
+    /* Everything that got here is a byte followed by a word */
+    *tag = MSGSTREAM_TAG_MSG( m->genericMsg.msgtype );
+    return 5;
+}
+// ====================================================================================================
+static bool _decodeFields( uint8_t tag, const uint8_t *p, uint32_t len, struct msg *m )
+
+/* Fill in m from the type specific part of a record. Anything beyond what we expect is ignored, */
+/* so fields can be added to the end of a record later.                                          */
+
+{
+    if ( tag < 32 )
+    {
+        if ( ( len < 1 ) || ( len > 4 ) )
+        {
+            return false;
+        }
+
+        m->swMsg.msgtype = MSG_SOFTWARE;
+        m->swMsg.srcAddr = tag;
+        m->swMsg.len = len;
+        m->swMsg.value = 0;
+
+        for ( uint32_t i = 0; i < len; i++ )
+        {
+            m->swMsg.value |= ( uint32_t )p[i] << ( 8 * i );
+        }
+
+        return true;
+    }
+
+    m->genericMsg.msgtype = tag - 32;
+
+    switch ( m->genericMsg.msgtype )
+    {
+        case MSG_NISYNC:
+            m->nisyncMsg.type = p[0];
+            m->nisyncMsg.addr = _get32( &p[1] );
+            return len >= 5;
+
+        case MSG_OSW:
+            m->oswMsg.comp = p[0];
+            m->oswMsg.offset = _get32( &p[1] );
+            return len >= 5;
+
+        case MSG_DATA_ACCESS_WP:
+            m->wptMsg.comp = p[0];
+            m->wptMsg.data = _get32( &p[1] );
+            return len >= 5;
+
+        case MSG_DATA_RWWP:
+            m->watchMsg.comp = p[0];
+            m->watchMsg.isWrite = p[1];
+            m->watchMsg.data = _get32( &p[2] );
+            return len >= 6;
+
+        case MSG_PC_SAMPLE:
+            m->pcSampleMsg.sleep = p[0];
+            m->pcSampleMsg.pc = _get32( &p[1] );
+            return len >= 5;
+
+        case MSG_DWT_EVENT:
+            m->dwtMsg.event = p[0];
+            return len >= 1;
+
+        case MSG_EXCEPTION:
+            m->excMsg.exceptionNumber = _get16( p );
+            m->excMsg.eventType = p[2];
+            return len >= 3;
+
+        case MSG_TS:
+            ( ( struct TSMsg * )m )->timeStatus = p[0];
+            ( ( struct TSMsg * )m )->timeInc = _get32( &p[1] );
+            return len >= 5;
+
+        default:
+            return false;
+    }
+}
+// ====================================================================================================
+static bool _frameValid( const uint8_t *p, uint32_t len )
+
+/* Check the records in a frame body exactly fill it, which is what tells a real frame from a */
+/* sync byte that happened to turn up in the middle of one we joined late.                    */
+
+{
+    uint32_t o = 0;
+
+    while ( o + 2 <= len )
+    {
+        o += 2 + p[o + 1];
+    }
+
+    return o == len;
+}
+// ====================================================================================================
+static void _histDispatch( struct msgStreamDecoder *s, uint64_t ts, const uint8_t *q, const uint8_t *end )
+
+/* Pull apart a histogram record and hand it over. Anything that doesn't add up is dropped */
+
+{
+    struct msgStreamHistEntry e[MSGSTREAM_MAX_HIST];
+    struct msgStreamHist h = { .ts = ts, .e = e };
+    int64_t sleeps, delta, count;
+    uint32_t pc = 0;
+
+    if ( ( !s->hist ) || ( end - q < 3 ) )
+    {
+        return;
+    }
+
+    h.seq = _get16( q );
+    h.last = ( q[2] & MSGSTREAM_HIST_LAST ) != 0;
+    q += 3;
+
+    if ( !_getVarint( &q, end, &sleeps ) )
+    {
+        return;
+    }
+
+    h.sleeps = sleeps;
+
+    while ( ( q < end ) && ( h.n < MSGSTREAM_MAX_HIST ) )
+    {
+        if ( ( !_getVarint( &q, end, &delta ) ) || ( !_getVarint( &q, end, &count ) ) )
+        {
+            return;
+        }
+
+        pc += delta;
+        e[h.n].pc = pc;
+        e[h.n++].count = count;
+    }
+
+    s->hist( &h, s->histParam );
+}
+// ====================================================================================================
+static void _frameDispatch( struct msgStreamDecoder *s, const uint8_t *f, void ( *cb )( struct msg *m, void *param ), void *param )
+
+/* Hand each record of a validated frame to the callback */
+
+{
+    uint32_t len = _get16( &f[1] );
+    uint64_t base = _get64( &f[3] );
+    const uint8_t *p = &f[MSGSTREAM_HDR_LEN];
+    const uint8_t *fend = p + len;
+    struct msg m;
+    int64_t ofs;
+
+    while ( p < fend )
+    {
+        uint8_t tag = p[0];
+        const uint8_t *q = &p[2];
+        const uint8_t *end = q + p[1];
+        /* Fields are decoded from a copy so short records can't read past the frame */
+        uint8_t fields[MSGSTREAM_MAX_RECORD] = { 0 };
+
+        p = end;
+
+        if ( !_getVarint( &q, end, &ofs ) )
+        {
+            continue;
+        }
+
+        if ( tag == MSGSTREAM_TAG_PCHIST )
+        {
+            _histDispatch( s, base + ofs, q, end );
+            continue;
+        }
+
+        memcpy( fields, q, ( end - q < ( int )sizeof( fields ) ) ? end - q : sizeof( fields ) );
+
+        if ( _decodeFields( tag, fields, end - q, &m ) )
+        {
+            m.genericMsg.ts = base + ofs;
+            cb( &m, param );
+        }
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool msgStreamAdd( struct msgStreamFrame *f, const struct msg *m )
+
+/* Add a message to the frame being built. Returns false only if it won't fit, in which case the */
+/* frame should be finished and sent, and the message added again. Messages that have no stream */
+/* representation are quietly ignored.                                                         */
+
+{
+    uint8_t rec[MSGSTREAM_MAX_RECORD];
+    uint32_t flen, rlen;
+    uint8_t fields[8];
+    uint8_t tag;
+
+    if ( !( flen = _encodeFields( m, &tag, fields ) ) )
+    {
+        return true;
+    }
+
+    if ( !f->len )
+    {
+        f->base = m->genericMsg.ts;
+    }
+
+    rec[0] = tag;
+    rlen = 2 + _putVarint( &rec[2], ( int64_t )( m->genericMsg.ts - f->base ) );
+    memcpy( &rec[rlen], fields, flen );
+    rlen += flen;
+    rec[1] = rlen - 2;
+
+    if ( ( f->len ? f->len : MSGSTREAM_HDR_LEN ) + rlen > MSGSTREAM_MAX_FRAME )
+    {
+        return false;
+    }
+
+    if ( !f->len )
+    {
+        f->d[0] = MSGSTREAM_SYNC;
+        f->len = MSGSTREAM_HDR_LEN;
+    }
+
+    memcpy( &f->d[f->len], rec, rlen );
+    f->len += rlen;
+    return true;
+}
+// ====================================================================================================
+bool msgStreamAddHist( struct msgStreamFrame *f, struct msgStreamHist *h )
+
+/* Add as much of the histogram as fits in a record to the frame, moving h on past it. Returns false */
+/* if there's no room for a record at all, in which case the frame should be finished and sent, and  */
+/* this called again. Once it's returned true with nothing left in h, all of it is in the frame.     */
+
+{
+    uint8_t rec[2 + 255];
+    uint32_t rlen, flags, pc = 0, taken = 0;
+    uint64_t base = ( f->len ) ? f->base : h->ts;
+
+    rec[0] = MSGSTREAM_TAG_PCHIST;
+    rlen = 2 + _putVarint( &rec[2], ( int64_t )( h->ts - base ) );
+    _put16( &rec[rlen], h->seq );
+    flags = rlen + 2;
+    rlen += 3;
+    rlen += _putVarint( &rec[rlen], h->sleeps );
+
+    /* Each pair is two varints of 33 bits at worst, so 5 bytes apiece */
+    while ( ( taken < h->n ) && ( taken < MSGSTREAM_MAX_HIST ) && ( rlen + 10 <= sizeof( rec ) ) )
+    {
+        rlen += _putVarint( &rec[rlen], ( int64_t )h->e[taken].pc - pc );
+        rlen += _putVarint( &rec[rlen], h->e[taken].count );
+        pc = h->e[taken++].pc;
+    }
+
+    rec[1] = rlen - 2;
+    rec[flags] = ( taken == h->n ) ? MSGSTREAM_HIST_LAST : 0;
+
+    if ( ( f->len ? f->len : MSGSTREAM_HDR_LEN ) + rlen > MSGSTREAM_MAX_FRAME )
+    {
+        return false;
+    }
+
+    if ( !f->len )
+    {
+        f->d[0] = MSGSTREAM_SYNC;
+        f->len = MSGSTREAM_HDR_LEN;
+        f->base = base;
+    }
+
+    memcpy( &f->d[f->len], rec, rlen );
+    f->len += rlen;
+
+    /* The sleeps went with the first part, so they aren't counted again */
+    h->e += taken;
+    h->n -= taken;
+    h->sleeps = 0;
+    return true;
+}
+// ====================================================================================================
+uint32_t msgStreamFinish( struct msgStreamFrame *f )
+
+/* Complete the header of the frame, returning its length. The frame stays valid in f->d until  */
+/* the next msgStreamAdd, which starts a new one.                                             */
+
+{
+    uint32_t len = f->len;
+
+    if ( len )
+    {
+        _put16( &f->d[1], len - MSGSTREAM_HDR_LEN );
+        _put64( &f->d[3], f->base );
+        f->len = 0;
+    }
+
+    return len;
+}
+// ====================================================================================================
+uint32_t msgStreamFilter( const struct nwSubscription *sub, const uint8_t *in, uint32_t len, uint8_t *out, void *param )
+
+/* Copy the records in the frames in 'in' that sub asked for to out, which must be at least as    */
+/* long. Frames left with nothing in them are dropped entirely. Returns the length written to out. */
+
+{
+    uint32_t olen = 0;
+
+    ( void )param;
+
+    while ( len >= MSGSTREAM_HDR_LEN )
+    {
+        uint32_t body = _get16( &in[1] );
+        uint32_t start = olen;
+
+        if ( ( in[0] != MSGSTREAM_SYNC ) || ( body + MSGSTREAM_HDR_LEN > len ) )
+        {
+            /* We only ever filter what we built, so this is a bug rather than line noise */
+            break;
+        }
+
+        memcpy( &out[olen], in, MSGSTREAM_HDR_LEN );
+        olen += MSGSTREAM_HDR_LEN;
+
+        for ( uint32_t o = MSGSTREAM_HDR_LEN; o + 2 <= body + MSGSTREAM_HDR_LEN; o += 2 + in[o + 1] )
+        {
+            if ( nwSubscriptionHas( sub, in[o] ) )
+            {
+                memcpy( &out[olen], &in[o], 2 + in[o + 1] );
+                olen += 2 + in[o + 1];
+            }
+        }
+
+        if ( olen == start + MSGSTREAM_HDR_LEN )
+        {
+            /* Nothing wanted out of this one */
+            olen = start;
+        }
+        else
+        {
+            _put16( &out[start + 1], olen - start - MSGSTREAM_HDR_LEN );
+        }
+
+        in += MSGSTREAM_HDR_LEN + body;
+        len -= MSGSTREAM_HDR_LEN + body;
+    }
+
+    return olen;
+}
+// ====================================================================================================
+void msgStreamDecoderInit( struct msgStreamDecoder *s )
+
+/* Reset a decoder, for a new connection */
+
+{
+    s->fill = 0;
+    s->badFrames = 0;
+    s->hist = NULL;
+    s->histParam = NULL;
+}
+// ====================================================================================================
+void msgStreamDecoderSetHist( struct msgStreamDecoder *s, msgStreamHistCB cb, void *param )
+
+/* Have histogram records handed to cb, they're ignored otherwise. Set it again after each init */
+
+{
+    s->hist = cb;
+    s->histParam = param;
+}
+// ====================================================================================================
+void msgStreamPump( struct msgStreamDecoder *s, const uint8_t *d, size_t len, void ( *cb )( struct msg *m, void *param ), void *param )
+
+/* Take received data and call cb for every message in each complete frame in it */
+
+{
+    while ( len )
+    {
+        size_t n = ( len < MSGSTREAM_MAX_FRAME - s->fill ) ? len : MSGSTREAM_MAX_FRAME - s->fill;
+        uint32_t p = 0;
+
+        memcpy( &s->d[s->fill], d, n );
+        s->fill += n;
+        d += n;
+        len -= n;
+
+        while ( true )
+        {
+            uint32_t body;
+
+            while ( ( p < s->fill ) && ( s->d[p] != MSGSTREAM_SYNC ) )
+            {
+                p++;
+            }
+
+            if ( s->fill - p < MSGSTREAM_HDR_LEN )
+            {
+                break;
+            }
+
+            body = _get16( &s->d[p + 1] );
+
+            if ( ( body > MSGSTREAM_MAX_BODY ) || ( ( s->fill - p >= MSGSTREAM_HDR_LEN + body ) && !_frameValid( &s->d[p + MSGSTREAM_HDR_LEN], body ) ) )
+            {
+                /* Not a real frame start, look for the next one */
+                s->badFrames++;
+                p++;
+                continue;
+            }
+
+            if ( s->fill - p < MSGSTREAM_HDR_LEN + body )
+            {
+                break;
+            }
+
+            _frameDispatch( s, &s->d[p], cb, param );
+            p += MSGSTREAM_HDR_LEN + body;
+        }
+
+        /* Keep whatever is left of a frame that's still arriving */
+        memmove( s->d, &s->d[p], s->fill - p );
+        s->fill -= p;
+    }
+}
+// ====================================================================================================
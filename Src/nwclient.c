@@ -20,19 +20,32 @@
     #include <arpa/inet.h>
     #include <string.h>
     #include <poll.h>
+    #include <sys/uio.h>
+    #include <sys/mman.h>
 #endif
 #ifdef FREEBSD
     #include <sys/types.h>
     #include <sys/socket.h>
 #endif
+#if defined OSX || defined FREEBSD
+    #include <netinet/tcp.h>
+#endif
 #ifdef LINUX
     #include <linux/tcp.h>
 #endif
 #include <assert.h>
 #include <strings.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <time.h>
+#include <zlib.h>
 #include "generics.h"
 #include "nwclient.h"
+#include "latencyHist.h"
+#include "tagHistory.h"
+#include "oflow.h"
+#include "orbProbes.h"
 
 
 #ifdef WIN32
@@ -42,306 +55,2654 @@
     #define MSG_DONTWAIT 0
 #endif
 
+#ifdef WIN32
+    #define poll WSAPoll
+#endif
+
+/* A piece of data for a gathered send, as each platform has it */
+#ifdef WIN32
+    #define IOV_T WSABUF
+    #define IOV_SET(v,p,l) do { (v).buf = ( char * )( p ); (v).len = ( ULONG )( l ); } while ( 0 )
+#else
+    #define IOV_T struct iovec
+    #define IOV_SET(v,p,l) do { (v).iov_base = ( void * )( p ); (v).iov_len = ( l ); } while ( 0 )
+#endif
+
 #if defined OSX || defined FREEBSD
     #ifndef MSG_NOSIGNAL
         #define MSG_NOSIGNAL 0
     #endif
 #endif
 
+/* Size of the per-client ring buffer ... must be a power of two */
+#define CLIENT_RING_SIZE  (4*TRANSFER_SIZE)
+#define CLIENT_RING_MASK  (CLIENT_RING_SIZE-1)
+
+/* Number of queued items per client (copied or borrowed) ... must be a power of two */
+#define CLIENT_QUEUE_LEN  (1024)
+#define CLIENT_QUEUE_MASK (CLIENT_QUEUE_LEN-1)
+
+/* Most borrowed blocks a single client may hold before it's given copies instead */
+#define CLIENT_MAX_BORROWED (4)
+
+/* Most pieces of queued data gathered into a single send to a client */
+#define CLIENT_IOV_MAX      (64)
+
+/* How long the reactor waits for something to happen, and how long it naps while old client sets drain */
+#define REACTOR_IDLE_WAIT_MS    (100)
+#define REACTOR_NAP_MS          (1)
+
+/* How often the reactor looks at clients whose requests are still being waited for */
+#define REQUEST_POLL_MS         (50)
+
+/* Minimum interval between drop reports for any single client */
+#define DROP_REPORT_INTERVAL_MS (1000)
+
+/* How long after connecting a client has to send its requests, before it's assumed to want everything as it is */
+#define REQUEST_WAIT_MS         (2000)
+
+/* How long output to a new client is held back, in case its first request is for compression */
+#define REQUEST_HOLD_MS         (250)
+
+/* Size of the buffer for compressed output to a client, and how hard we try to compress */
+#define CLIENT_ZBUF_SIZE        (64*1024)
+#define CLIENT_ZLEVEL           (1)
+
+/* Socket buffer asked for on behalf of bulk clients, and how much output (or for how long) they're */
+/* held back for, so what they're sent goes in fewer and bigger writes.                            */
+#define BULK_SNDBUF             (4*1024*1024)
+#define BULK_COALESCE_BYTES     (64*1024)
+#define BULK_COALESCE_MS        (20)
+
+/* Most of a bulk client's spill that goes out each time the reactor visits it, so it can't hog the reactor */
+#define SPILL_PER_VISIT         (4*TRANSFER_SIZE)
+
+/* Spill held in memory is given back to the system in pieces this big once it's been sent */
+#define SPILL_RELEASE_GRAIN     (256*1024)
+
+/* What zlib reckons a deflater needs for its default window and memory level, beyond our output buffer */
+#define CLIENT_ZSTATE_SIZE      (256*1024)
+
+/* How often the reactor counts up what the clients are holding. If there's a memory budget, data is shed */
+/* once that passes BUDGET_SHED_AT of it, until it's down to BUDGET_SHED_TO. Nothing shed gets anything    */
+/* past the budget itself, the rest is headroom.                                                         */
+#define BUDGET_CHECK_MS         (50)
+#define BUDGET_SHED_AT(m)       ((m)-(m)/8)
+#define BUDGET_SHED_TO(m)       ((m)-(m)/4)
+
+/* How long after one client is cut down to a single tag before another may be, so it can have an effect */
+#define BUDGET_SETTLE_MS        (1000)
+
+/* The connected clients, as published to everyone sending to them. A set is never changed once */
+/* published, it's replaced as a whole by the reactor whenever a client arrives or leaves.      */
+struct clientSet
+
+{
+    int                       n;              /* Number of clients in the set */
+    struct nwClient          *c[];            /* ...and the clients themselves */
+};
+
 /* Master structure for the set of nwclients */
 struct nwclientsHandle
 
 {
-    volatile struct nwClient *firstClient;    /* Head of linked list of network clients */
-    pthread_mutex_t           clientList;     /* Lock for list of network clients */
+    /* The client list is read without locks. Readers hold an epoch while they look at it, and */
+    /* nothing replaced is freed until every reader from the epoch before it was swapped is out. */
+    _Atomic( struct clientSet * ) clients;    /* Current set of network clients, NULL for none */
+    atomic_uint               epoch;          /* Incremented each time the set is replaced */
+    atomic_int                readers[2];     /* Readers in even and odd epochs */
+    _Atomic( struct nwClient * ) pending;     /* New clients waiting to be added, linked by nextClient */
+    struct clientSet         *retiredSet;     /* Replaced set waiting to be freed (reactor only) */
+    struct nwClient          *retiredClients; /* ...and the removed clients, linked by nextClient */
+    unsigned int              retiredEpoch;   /* ...which readers from this epoch may still be using */
+
+    int                       sockfd;         /* The listening socket */
+    struct nwclientsHandle   *nextHandle;     /* Next port served by the reactor */
+
+    atomic_uint_fast64_t      droppedBytes;   /* Total bytes dropped across all clients */
+    atomic_int                subscribers;    /* Number of clients that have subscribed to specific tags */
+    atomic_int                connected;      /* Number of clients there are, subscribed or not */
+    struct latencyHist        sendLatency;    /* Time from data being queued to it being written out */
+
+    char                     *spillDir;       /* Where bulk clients spill what won't fit in their ring, NULL for memory */
+    uint64_t                  spillMax;       /* ...and most each of them may spill, 0 for no spilling */
+
+    uint8_t                  *filterBuf;      /* Where nwclientSendFiltered builds each subscriber's copy */
+    uint32_t                  filterLen;      /* ...and how big it is */
+
+    struct tagHistory        *history;        /* Recent tagged frames for subscribers that arrive late, NULL if none kept */
+};
+
+/* History replayed to a client, handed over as a borrowed block that goes when it's been sent */
+struct replayBlock
+
+{
+    struct nwclientBlock      b;
+    uint8_t                   d[];
+};
+
+/* An item waiting to go out to a client...either borrowed (b set) or copied into the client ring */
+struct clientQueueEntry
+
+{
+    struct nwclientBlock     *b;                /* Borrowed block, or NULL if data is in the ring */
+    bool                      lent;             /* ...which counts against the blocks that may be lent at once */
+    uint32_t                  len;              /* Length of this item */
+    uint64_t                  queued;           /* Monotonic time the item was queued */
+};
 
-    int                       sockfd;         /* The socket for the inferior */
-    pthread_t                 ipThread;       /* The listening thread for n/w clients */
+/* One thread serves every port in the process. It accepts new clients, reads their requests, notices */
+/* when they go, and drains their queues to the network, all driven by a single poll.                 */
+struct pollTarget
+
+{
+    struct nwclientsHandle   *h;                /* Port this descriptor belongs to, NULL for the wake socket */
+    struct nwClient          *c;                /* Client this descriptor belongs to, NULL for the listener */
 };
 
+static struct
+{
+    pthread_mutex_t           lock;             /* Protects the list of ports...only taken as they come and go */
+    struct nwclientsHandle   *handles;          /* The ports being served */
+    unsigned int              generation;       /* Changes whenever the list of ports does */
+    pthread_t                 thread;           /* The reactor thread itself */
+    bool                      running;          /* ...and if it's running */
+    atomic_bool               ending;           /* Flag that the reactor should terminate */
+
+    int                       wakefd;           /* Loopback datagram socket used to wake the reactor */
+    atomic_uint               queued;           /* Count of items queued, so the reactor can tell if it missed any */
+    atomic_bool               waiting;          /* Set while the reactor is (about to be) waiting in poll */
+
+    struct pollfd            *pfd;              /* Descriptors being polled (reactor only) */
+    struct pollTarget        *pt;               /* ...what each of them is */
+    int                       pmax;             /* ...and how many there is room for */
+} _reactor = { .lock = PTHREAD_MUTEX_INITIALIZER, .wakefd = -1 };
+
+/* Memory held on behalf of clients of every port, and what's done when there's too much of it. The */
+/* count is only changed by the reactor, with the lock held.                                        */
+static struct
+{
+    uint64_t                  max;              /* Most that may be held, 0 for no limit */
+    enum nwShed               policy;           /* ...and what's done about it */
+    atomic_uint_fast64_t      used;             /* Held when last counted, plus whatever has been taken since */
+    atomic_uint_fast64_t      replays;          /* History waiting to go out, which is in nobody's ring or spill */
+    atomic_uint_fast64_t      refused;          /* Clients, compression and replays there wasn't room for */
+    int                       maxLent;          /* Most blocks that may be lent to clients at once, 0 for no limit */
+    atomic_int                lent;             /* ...and how many are */
+    struct nwclientMemory     count;            /* The last count */
+    uint32_t                  lastCheck;        /* When that was */
+    uint32_t                  lastNarrow;       /* When a client was last cut down to a single tag */
+} _budget;
+
+/* Listening sockets handed over from another process, waiting for their ports to be started */
+static struct
+{
+    int                       n;
+    struct
+    {
+        int                   port;
+        int                   fd;
+    } *l;
+} _inherited;
+
 /* Descriptor for individual connected network clients */
 struct nwClient
 
 {
     int                       handle;            /* Handle to client */
     struct nwclientsHandle   *parent;            /* Who owns this list */
-    volatile struct nwClient *nextClient;
-    volatile struct nwClient *prevClient;
+    struct nwClient          *nextClient;        /* Link while pending addition or retired, not while in a set */
+    atomic_bool               dead;              /* Set when the client has gone, so nobody queues for it */
 
     /* Parameters used to run the client */
     int                       fdNo;             /* file descriptor of incoming connection */
+
+    /* Single producer (nwclientSend) single consumer (the reactor) queue of data waiting to go out */
+    struct clientQueueEntry   q[CLIENT_QUEUE_LEN]; /* The queue of items to send */
+    atomic_size_t             qwp;              /* Queue write position, only changed by producer */
+    atomic_size_t             qrp;              /* Queue read position, only changed by sender */
+    uint32_t                  sendOfs;          /* How far through the item at qrp the sender is */
+    atomic_int                borrowed;         /* Number of borrowed blocks on the queue */
+
+    uint8_t                  *ring;             /* Storage for copied items */
+    atomic_size_t             wp;               /* Write position, only changed by producer */
+    atomic_size_t             rp;               /* Read position, only changed by sender */
+
+    atomic_uint_fast64_t      dropped;          /* Bytes dropped because this client was too slow */
+    uint64_t                  reportedDropped;  /* ...and how many of those we've told the user about */
+    uint32_t                  lastDropReport;   /* Time of last drop report for this client */
+
+    /* Requests from the client, if it sends any. Only the reactor reads from the client */
+    uint8_t                   req[sizeof( struct nwSubscription )]; /* Requests that have arrived so far */
+    uint32_t                  reqLen;           /* ...and how much of that there is */
+    bool                      reqSettled;       /* Set once we've stopped looking for requests */
+    bool                      rxClosed;         /* Set once the client has closed its side, so there's nothing to read */
+    bool                      holding;          /* Set while output is held back for a compression request */
+    uint32_t                  connectTime;      /* When the client arrived, for timing out requests */
+    uint64_t                  sentBytes;        /* Number of bytes sent to the client so far */
+
+    /* Tag subscription */
+    struct nwSubscription     sub;              /* Subscription, valid once subscribed is set */
+    atomic_bool               subscribed;       /* Set when the client only wants the tags in sub */
+    atomic_bool               replay;           /* Set until the producer has given it the history for sub */
+    struct nwSubscription     narrow;           /* What it's cut down to when memory is short, valid once narrowed is set */
+    atomic_bool               narrowed;         /* Set when it only gets the tag in narrow */
+
+    /* Compression, all handled by the reactor */
+    z_stream                 *z;                /* Deflater, set if this client's output is compressed */
+    uint8_t                  *zbuf;             /* Compressed output waiting to go */
+    size_t                    zlen;             /* ...how much there is */
+    size_t                    zofs;             /* ...and how much of that has gone */
+    bool                      zflushed;         /* Set when everything given to the deflater has been flushed out */
+
+    /* Class of service, and the spill a bulk client overflows into rather than losing data. The spill */
+    /* is a mapped file (or just memory) used as a ring, written by the producer and sent straight out  */
+    /* of by the reactor.                                                                               */
+    int                       qos;              /* enum nwQoS the client asked for */
+    _Atomic( uint8_t * )      spillMap;         /* The spill, or NULL if there isn't one */
+    uint64_t                  spillMax;         /* ...how big it is */
+    bool                      spillMem;         /* ...and if it's only memory, so counts against the budget */
+    bool                      spilling;         /* Set while the producer is sending everything to the spill */
+    atomic_bool               overflowed;       /* Set once the spill filled, after which nothing more is queued */
+    atomic_uint_fast64_t      spillWp;          /* Spill write position, only changed by producer */
+    atomic_uint_fast64_t      spillRp;          /* Spill read position, only changed by the reactor */
+    atomic_uint_fast64_t      spillFree;        /* Where the producer may write up to (less spillMax), only changed by the reactor */
 };
 
 // ====================================================================================================
-static int _lock_with_timeout( pthread_mutex_t *mutex, const struct timespec *ts )
-{
-    int ret;
-    int left, step;
+static unsigned int _readEnter( struct nwclientsHandle *h )
 
-    left = ts->tv_sec * 1000;       /* how much waiting is left, in msec */
-    step = 10;                      /* msec to sleep at each trywait() failure */
+/* Start looking at the client set. Doesn't lock and never waits for anyone, returns the epoch to */
+/* hand back to _readExit.                                                                       */
 
-    do
-    {
-        if ( ( ret = pthread_mutex_trylock( mutex ) ) != 0 )
-        {
-            struct timespec dly;
+{
+    unsigned int e;
 
-            dly.tv_sec = 0;
-            dly.tv_nsec = step * 1000000;
-            nanosleep( &dly, NULL );
+    while ( true )
+    {
+        e = atomic_load( &h->epoch );
+        atomic_fetch_add( &h->readers[e & 1], 1 );
 
-            left -= step;
+        /* If the set was replaced while we were signing in, sign in again for the new epoch */
+        if ( atomic_load( &h->epoch ) == e )
+        {
+            return e;
         }
-    }
-    while ( ret != 0 && left > 0 );
 
-    return ret;
+        atomic_fetch_sub( &h->readers[e & 1], 1 );
+    }
 }
+// ====================================================================================================
+static inline void _readExit( struct nwclientsHandle *h, unsigned int e )
 
+{
+    atomic_fetch_sub( &h->readers[e & 1], 1 );
+}
 // ====================================================================================================
 // Network server implementation for raw SWO feed
 // ====================================================================================================
-static void _clientRemoveNoLock( volatile struct nwClient *c )
+static void _clientKill( volatile struct nwClient *c )
+
+/* Stop a client, although it may be in a set for a while yet */
 
 {
+    /* Only whoever gets here first closes it, since once it's closed the fd may be someone else's */
+    if ( atomic_exchange( &c->dead, true ) )
+    {
+        /* Already gone, and already counted out */
+        return;
+    }
+
+    ORB_PROBE( liborb, client_kill, c->fdNo, atomic_load_explicit( &c->dropped, memory_order_relaxed ) );
     close( c->fdNo );
 
-    if ( c->prevClient )
+    atomic_fetch_sub_explicit( &c->parent->connected, 1, memory_order_relaxed );
+
+    if ( atomic_load_explicit( &c->subscribed, memory_order_relaxed ) )
     {
-        c->prevClient->nextClient = c->nextClient;
+        atomic_fetch_sub_explicit( &c->parent->subscribers, 1, memory_order_relaxed );
     }
-    else
+}
+// ====================================================================================================
+static void _clientFree( volatile struct nwClient *c )
+
+/* Release a dead client, once nothing can be looking at it any more */
+
+{
+    /* Give back anything this client was still holding */
+    size_t qwp = atomic_load_explicit( &c->qwp, memory_order_acquire );
+
+    for ( size_t i = atomic_load_explicit( &c->qrp, memory_order_relaxed ); i != qwp; i++ )
     {
-        c->parent->firstClient = c->nextClient;
+        if ( c->q[i & CLIENT_QUEUE_MASK].b )
+        {
+            if ( c->q[i & CLIENT_QUEUE_MASK].lent )
+            {
+                atomic_fetch_sub_explicit( &_budget.lent, 1, memory_order_relaxed );
+            }
+
+            nwclientBlockRelease( c->q[i & CLIENT_QUEUE_MASK].b );
+        }
     }
 
-    if ( c->nextClient )
+    /* Remove the memory that was allocated for this client */
+    if ( c->z )
     {
-        c->nextClient->prevClient = c->prevClient;
+        deflateEnd( c->z );
+        free( c->z );
+        free( c->zbuf );
     }
 
-    /* Remove the memory that was allocated for this client */
+#if !defined( WIN32 )
+
+    if ( atomic_load( &c->spillMap ) )
+    {
+        munmap( atomic_load( &c->spillMap ), c->spillMax );
+    }
+
+#endif
+    free( c->ring );
     free( ( void * )c );
 }
 // ====================================================================================================
-static void *_listenTask( void *arg )
+static bool _updateClients( struct nwclientsHandle *h )
 
-{
-    struct nwclientsHandle *h = ( struct nwclientsHandle * )arg;
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
-    int newsockfd;
-#ifdef WIN32
-    int clilen;
-#else
-    socklen_t clilen;
-#endif
-    struct sockaddr_in cli_addr;
-    struct nwClient *client;
-    char s[100];
+/* Called by the reactor, the only thread that changes the set. Frees whatever was retired last time */
+/* once it's safe, then publishes a new set if clients have arrived or died. Returns true if there's */
+/* still something to be done.                                                                      */
 
-    clilen = sizeof( cli_addr );
-    listen( h->sockfd, 5 );
+{
+    struct clientSet *old, *new;
+    struct nwClient *add, *c;
+    int dead = 0, nadd = 0;
 
-    while ( true )
+    if ( h->retiredSet || h->retiredClients )
     {
-        newsockfd = accept( h->sockfd, ( struct sockaddr * ) &cli_addr, &clilen );
+        if ( atomic_load( &h->readers[h->retiredEpoch & 1] ) )
+        {
+            /* Somebody from before the swap is still looking, they won't be for long */
+            return true;
+        }
 
-        if ( newsockfd < 0 )
+        free( h->retiredSet );
+
+        while ( ( c = h->retiredClients ) )
         {
-            close( newsockfd );
-            break;
+            h->retiredClients = c->nextClient;
+            _clientFree( c );
         }
 
-        inet_ntop( AF_INET, &cli_addr.sin_addr, s, 99 );
-        genericsReport( V_INFO, "New connection from %s index %d" EOL, s, newsockfd );
+        h->retiredSet = NULL;
+    }
 
-        /* We got a new connection - spawn a record to handle it */
-        client = ( struct nwClient * )calloc( 1, sizeof( struct nwClient ) );
-        MEMCHECK( client, NULL );
+    old = atomic_load( &h->clients );
+    add = atomic_exchange( &h->pending, NULL );
 
-        client->parent = h;
-        client->fdNo = newsockfd;
+    for ( c = add; c; c = c->nextClient )
+    {
+        nadd++;
+    }
 
-        /* Make port non-blocking */
-#ifdef WIN32
-        unsigned long mode = 0;
-        ioctlsocket( newsockfd, FIONBIO, &mode );
-#else
-        int flags = fcntl( newsockfd, F_GETFL, 0 );
+    for ( int i = 0; old && ( i < old->n ); i++ )
+    {
+        dead += atomic_load_explicit( &old->c[i]->dead, memory_order_relaxed );
+    }
 
-        if ( flags == -1 )
-        {
-            return false;
-        }
+    if ( ( !nadd ) && ( !dead ) )
+    {
+        return false;
+    }
 
-        flags |= O_NONBLOCK;
-        fcntl( newsockfd, F_SETFL, flags );
-#endif
+    /* Newcomers go at the front, the survivors follow in the order they were in */
+    int n = nadd + ( old ? old->n : 0 ) - dead;
+    new = NULL;
+
+    if ( n )
+    {
+        new = ( struct clientSet * )malloc( sizeof( struct clientSet ) + n * sizeof( struct nwClient * ) );
+        MEMCHECK( new, false );
+        new->n = 0;
 
-        /* Hook into linked list */
-        if ( _lock_with_timeout( &h->clientList, &ts ) < 0 )
+        for ( c = add; c; c = c->nextClient )
         {
-            genericsExit( -1, "Failed to acquire mutex" EOL );
+            new->c[new->n++] = c;
         }
+    }
 
-        client->nextClient = h->firstClient;
-        client->prevClient = NULL;
+    for ( int i = 0; old && ( i < old->n ); i++ )
+    {
+        c = old->c[i];
 
-        if ( client->nextClient )
+        if ( atomic_load_explicit( &c->dead, memory_order_relaxed ) )
+        {
+            c->nextClient = h->retiredClients;
+            h->retiredClients = c;
+        }
+        else
         {
-            client->nextClient->prevClient = client;
+            new->c[new->n++] = c;
         }
+    }
 
-        h->firstClient = client;
+    /* Publish, then move on the epoch. Anyone reading from here on gets the new set */
+    atomic_store( &h->clients, new );
+    h->retiredSet = old;
+    h->retiredEpoch = atomic_fetch_add( &h->epoch, 1 );
+    return true;
+}
+// ====================================================================================================
+static bool _wouldBlock( void )
 
-        pthread_mutex_unlock( &h->clientList );
-    }
+/* Did the last socket call fail only because it would have had to wait? Winsock doesn't use errno for that */
 
-    if ( h->sockfd )
-    {
-        close( h->sockfd );
-    }
+{
+#ifdef WIN32
+    int e = WSAGetLastError();
 
-    return NULL;
+    return ( e == WSAEWOULDBLOCK ) || ( e == WSAEINTR );
+#else
+    return ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR );
+#endif
 }
 // ====================================================================================================
+static bool _setNonBlocking( int fd )
+
+{
+#ifdef WIN32
+    unsigned long mode = 1;
+    return ( ioctlsocket( fd, FIONBIO, &mode ) == 0 );
+#else
+    int flags = fcntl( fd, F_GETFL, 0 );
+
+    return ( flags != -1 ) && ( fcntl( fd, F_SETFL, flags | O_NONBLOCK ) != -1 );
+#endif
+}
 // ====================================================================================================
+static bool _budgetRoom( uint64_t len )
+
+/* Take len from the memory budget if it'll fit, counting a refusal if it won't */
+
+{
+    if ( ( _budget.max ) && ( atomic_load_explicit( &_budget.used, memory_order_relaxed ) + len > _budget.max ) )
+    {
+        atomic_fetch_add_explicit( &_budget.refused, 1, memory_order_relaxed );
+        return false;
+    }
+
+    atomic_fetch_add_explicit( &_budget.used, len, memory_order_relaxed );
+    return true;
+}
 // ====================================================================================================
-// Externally available routines
-// ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
-void nwclientSend( struct nwclientsHandle *h, uint32_t len, const uint8_t *ipbuffer )
+static struct nwClient *_clientCreate( struct nwclientsHandle *h, int fd )
+
+/* Make the record for a client on fd, which is closed if that can't be done */
 
 {
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+    struct nwClient *client = ( struct nwClient * )calloc( 1, sizeof( struct nwClient ) );
+
+    if ( client )
+    {
+        client->ring = ( uint8_t * )malloc( CLIENT_RING_SIZE );
+    }
 
-    if ( h && h->firstClient )
+    if ( ( !client ) || ( !client->ring ) || ( !_setNonBlocking( fd ) ) )
     {
-        if ( _lock_with_timeout( &h->clientList, &ts ) < 0 )
+        genericsReport( V_ERROR, "Could not set up connection index %d" EOL, fd );
+        close( fd );
+
+        if ( client )
         {
-            genericsExit( -1, "Failed to acquire mutex" EOL );
+            free( client->ring );
+            free( client );
         }
 
-        /* Now kick all the clients that new data arrived for them to distribute */
-        volatile struct nwClient *n = h->firstClient;
+        return NULL;
+    }
 
-        while ( n )
-        {
-            ssize_t t = len;
-            ssize_t sent = 0;
-            void *p = ( void * )ipbuffer;
+    client->parent = h;
+    client->fdNo = fd;
+    atomic_init( &client->wp, 0 );
+    atomic_init( &client->rp, 0 );
+    atomic_init( &client->qwp, 0 );
+    atomic_init( &client->qrp, 0 );
+    atomic_init( &client->borrowed, 0 );
+    atomic_init( &client->dropped, 0 );
+    atomic_init( &client->subscribed, false );
+    atomic_init( &client->replay, false );
+    atomic_init( &client->dead, false );
+    atomic_init( &client->spillMap, NULL );
+    atomic_init( &client->overflowed, false );
+    atomic_init( &client->spillWp, 0 );
+    atomic_init( &client->spillRp, 0 );
+    atomic_init( &client->spillFree, 0 );
+    return client;
+}
+// ====================================================================================================
+static void _clientPend( struct nwclientsHandle *h, struct nwClient *client )
 
-            while ( t && ( sent >= 0 ) )
-            {
-                sent = send( n->fdNo, p, t, MSG_NOSIGNAL );
-                p += sent;
-                t -= sent;
-            }
+/* Leave a new client for the reactor to add to the set */
 
-            if ( t )
-            {
-                genericsReport( V_INFO, "Killed connection index %d" EOL, n->fdNo );
-                volatile struct nwClient *newn = n->nextClient;
-                _clientRemoveNoLock( n );
-                n = newn;
-            }
-            else
-            {
-                n = n->nextClient;
-            }
-        }
+{
+    atomic_fetch_add_explicit( &h->connected, 1, memory_order_relaxed );
+    client->nextClient = atomic_load( &h->pending );
 
-        pthread_mutex_unlock( &h->clientList );
-    }
+    while ( !atomic_compare_exchange_weak( &h->pending, &client->nextClient, client ) );
 }
 // ====================================================================================================
-struct nwclientsHandle *nwclientStart( int port )
+static void _acceptClient( struct nwclientsHandle *h )
 
-/* Creating the listening server thread */
+/* Someone is knocking on this port, let them in and leave them to be added to the set */
 
 {
-    struct sockaddr_in serv_addr;
-    int flag = 1;
-    struct nwclientsHandle *h = ( struct nwclientsHandle * )calloc( 1, sizeof( struct nwclientsHandle ) );
-    MEMCHECK( h, NULL );
+    int newsockfd;
+#ifdef WIN32
+    int clilen;
+#else
+    socklen_t clilen;
+#endif
+    struct sockaddr_in cli_addr;
+    struct nwClient *client;
+    char s[100];
 
-    h->sockfd = socket( AF_INET, SOCK_STREAM, 0 );
-    setsockopt( h->sockfd, SOL_SOCKET, SO_REUSEPORT, ( const void * )&flag, sizeof( flag ) );
+    clilen = sizeof( cli_addr );
+    newsockfd = accept( h->sockfd, ( struct sockaddr * ) &cli_addr, &clilen );
 
-    if ( h->sockfd < 0 )
+    if ( newsockfd < 0 )
     {
-        genericsReport( V_ERROR, "Error opening socket" EOL );
-        goto free_and_return;
+        /* They may have given up already */
+        return;
     }
 
-    memset( ( char * ) &serv_addr, 0, sizeof( serv_addr ) );
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons( port );
+    inet_ntop( AF_INET, &cli_addr.sin_addr, s, 99 );
 
-    if ( setsockopt( h->sockfd, SOL_SOCKET, SO_REUSEADDR, ( const void * ) &flag, sizeof( flag ) ) < 0 )
+    if ( !_budgetRoom( CLIENT_RING_SIZE ) )
     {
-        genericsReport( V_ERROR, "setsockopt(SO_REUSEADDR) failed" );
-        goto free_and_return;
+        genericsReport( V_WARN, "Connection from %s refused, memory budget is used up" EOL, s );
+        close( newsockfd );
+        return;
     }
 
-    if ( bind( h->sockfd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
+    genericsReport( V_INFO, "New connection from %s index %d" EOL, s, newsockfd );
+    ORB_PROBE( liborb, client_connect, newsockfd, s );
+
+    /* We got a new connection - spawn a record to handle it */
+    if ( !( client = _clientCreate( h, newsockfd ) ) )
     {
-        genericsReport( V_ERROR, "Error on binding" EOL );
-        goto free_and_return;
+        return;
     }
 
-    /* Create a mutex to lock the client list */
-    pthread_mutex_init( &h->clientList, NULL );
+    client->connectTime = genericsTimestampmS();
+    client->holding = true;
+    _clientPend( h, client );
+}
+// ====================================================================================================
+static bool _queueFull( volatile struct nwClient *n )
+
+{
+    return ( atomic_load_explicit( &n->qwp, memory_order_relaxed ) -
+             atomic_load_explicit( &n->qrp, memory_order_acquire ) ) == CLIENT_QUEUE_LEN;
+}
+// ====================================================================================================
+static void _queuePush( volatile struct nwClient *n, struct nwclientBlock *b, bool lent, uint32_t len, uint64_t now )
+
+/* Put an item on the client queue. Caller has already checked there's room */
+
+{
+    size_t qwp = atomic_load_explicit( &n->qwp, memory_order_relaxed );
+
+    n->q[qwp & CLIENT_QUEUE_MASK].b = b;
+    n->q[qwp & CLIENT_QUEUE_MASK].lent = lent;
+    n->q[qwp & CLIENT_QUEUE_MASK].len = len;
+    n->q[qwp & CLIENT_QUEUE_MASK].queued = now;
+    atomic_store_explicit( &n->qwp, qwp + 1, memory_order_release );
+}
+// ====================================================================================================
+static void _drop( volatile struct nwClient *n, uint32_t len )
+
+{
+    ORB_PROBE( liborb, client_drop, n->fdNo, len );
+    atomic_fetch_add_explicit( &n->dropped, len, memory_order_relaxed );
+    atomic_fetch_add_explicit( &n->parent->droppedBytes, len, memory_order_relaxed );
+}
+// ====================================================================================================
+static bool _spillWrite( volatile struct nwClient *n, uint8_t *map, uint32_t len, const uint8_t *ipbuffer )
+
+/* Add data to the end of the client's spill, returning false if there isn't room */
 
-    /* We have the listening socket - spawn a thread to handle it */
-    if ( pthread_create( &( h->ipThread ), NULL, &_listenTask, h ) )
+{
+    uint64_t wp = atomic_load_explicit( &n->spillWp, memory_order_relaxed );
+    uint64_t rp = atomic_load_explicit( &n->spillFree, memory_order_acquire );
+    uint64_t ofs = wp % n->spillMax;
+    size_t first = ( len < n->spillMax - ofs ) ? len : n->spillMax - ofs;
+
+    if ( n->spillMax - ( wp - rp ) < len )
     {
-        genericsReport( V_ERROR, "Failed to create listening thread" EOL );
-        goto free_and_return;
+        return false;
     }
 
-    return h;
+    memcpy( &map[ofs], ipbuffer, first );
+    memcpy( map, &ipbuffer[first], len - first );
+    atomic_store_explicit( &n->spillWp, wp + len, memory_order_release );
 
-free_and_return:
-    free( h );
-    return NULL;
+    if ( n->spillMem )
+    {
+        atomic_fetch_add_explicit( &_budget.used, len, memory_order_relaxed );
+    }
+
+    return true;
 }
 // ====================================================================================================
-void nwclientShutdown( struct nwclientsHandle *h )
+static void _queueCopy( volatile struct nwClient *n, uint32_t len, const uint8_t *ipbuffer, uint64_t now )
+
+/* Copy data into the client ring and queue it. If there's no room it goes to the client's spill, if */
+/* it has one, and otherwise is dropped. Once something has been spilled everything else follows it, */
+/* until the reactor has sent all there was. If the spill itself fills, nothing more is queued at    */
+/* all, so what the client gets has no holes in it...it'll be let go once it's had it all.          */
 
 {
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+    size_t wp = atomic_load_explicit( &n->wp, memory_order_relaxed );
+    size_t rp = atomic_load_explicit( &n->rp, memory_order_acquire );
+    uint8_t *map = atomic_load_explicit( &n->spillMap, memory_order_acquire );
+    bool room = ( CLIENT_RING_SIZE - ( wp - rp ) >= len ) && !_queueFull( n );
 
-    if ( !h )
+    if ( atomic_load_explicit( &n->overflowed, memory_order_relaxed ) )
     {
+        _drop( n, len );
         return;
     }
 
-    /* Flag that we're ending - this ensures the listening thread dies */
-    int tsockfd = h->sockfd;
-    h->sockfd = 0;
-    close( tsockfd );
-
-    if ( _lock_with_timeout( &h->clientList, &ts ) < 0 )
+    if ( ( n->spilling ) && room && ( atomic_load_explicit( &n->spillRp, memory_order_acquire ) ==
+                                      atomic_load_explicit( &n->spillWp, memory_order_relaxed ) ) )
     {
-        genericsExit( -1, "Failed to acquire mutex" EOL );
+        n->spilling = false;
     }
 
-    /* Shut all the client connections */
-    volatile struct nwClient *c = h->firstClient;
+    if ( ( !room ) || ( n->spilling ) )
+    {
+        if ( ( map ) && ( n->spillMem ) && ( _budget.max ) &&
+                ( atomic_load_explicit( &_budget.used, memory_order_relaxed ) + len > _budget.max ) )
+        {
+            /* Memory is short, so this goes...but the spill didn't fill, so the client can stay */
+            _drop( n, len );
+        }
+        else if ( ( map ) && _spillWrite( n, map, len, ipbuffer ) )
+        {
+            n->spilling = true;
+        }
+        else
+        {
+            /* No room for this block, so the whole block goes...partial blocks would be worse */
+            _drop( n, len );
 
-    /* Terminate all the clients */
-    while ( c )
+            if ( map )
+            {
+                atomic_store_explicit( &n->overflowed, true, memory_order_relaxed );
+            }
+        }
+    }
+    else
     {
-        volatile struct nwClient *newc = c->nextClient;
-        _clientRemoveNoLock( c );
-        c = newc;
+        size_t ofs = wp & CLIENT_RING_MASK;
+        size_t first = ( len < CLIENT_RING_SIZE - ofs ) ? len : CLIENT_RING_SIZE - ofs;
+
+        memcpy( &n->ring[ofs], ipbuffer, first );
+        memcpy( n->ring, &ipbuffer[first], len - first );
+        atomic_store_explicit( &n->wp, wp + len, memory_order_release );
+        _queuePush( n, NULL, false, len, now );
     }
+}
+// ====================================================================================================
+static void _replayRelease( struct nwclientBlock *b, void *param )
 
-    pthread_mutex_unlock( &h->clientList );
-    free( h );
+{
+    atomic_fetch_sub_explicit( &_budget.replays, b->len, memory_order_relaxed );
+    free( param );
+}
+// ====================================================================================================
+static inline const struct nwSubscription *_subOf( volatile struct nwClient *n )
+
+/* The tags a subscribed client is being sent, which may be fewer than it asked for if memory is short */
+
+{
+    return atomic_load_explicit( &n->narrowed, memory_order_acquire ) ? ( const struct nwSubscription * )&n->narrow : ( const struct nwSubscription * )&n->sub;
+}
+// ====================================================================================================
+static void _replayHistory( struct nwclientsHandle *h, volatile struct nwClient *n, uint64_t now )
+
+/* Give a client that has just subscribed what's held for its tags, ahead of anything live. That's */
+/* done by the producer, so it can't get mixed up with what's being queued for the client anyway.  */
+
+{
+    size_t max = tagHistoryLen( h->history );
+    struct replayBlock *r;
+
+    atomic_store_explicit( &n->replay, false, memory_order_relaxed );
+
+    if ( ( !max ) || ( n->spilling ) || _queueFull( n ) )
+    {
+        return;
+    }
+
+    if ( !_budgetRoom( max ) )
+    {
+        genericsReport( V_WARN, "Connection index %d given no history, memory budget is used up" EOL, n->fdNo );
+        return;
+    }
+
+    r = ( struct replayBlock * )malloc( sizeof( struct replayBlock ) + max );
+    MEMCHECKV( r );
+    nwclientBlockInit( &r->b, r->d, tagHistoryReplay( h->history, _subOf( n ), r->d, max ), _replayRelease, r );
+    atomic_fetch_add_explicit( &_budget.replays, r->b.len, memory_order_relaxed );
+
+    if ( !r->b.len )
+    {
+        free( r );
+        return;
+    }
+
+    /* The queue holds the only reference, so it's gone as soon as the client has had it */
+    genericsReport( V_INFO, "Connection index %d given %" PRIu32 " bytes of history" EOL, n->fdNo, r->b.len );
+    atomic_fetch_add_explicit( &n->borrowed, 1, memory_order_relaxed );
+    _queuePush( n, &r->b, false, r->b.len, now );
+}
+// ====================================================================================================
+static void _wakeReactor( void )
+
+/* Tell the reactor there's new data, only going to the expense of a wakeup if it might be asleep */
+
+{
+    static const uint8_t poke = 0;
+
+    atomic_fetch_add( &_reactor.queued, 1 );
+
+    if ( atomic_load( &_reactor.waiting ) )
+    {
+        /* If this doesn't go, there's already a wakeup waiting to be read */
+        send( _reactor.wakefd, ( const void * )&poke, sizeof( poke ), MSG_NOSIGNAL | MSG_DONTWAIT );
+    }
+}
+// ====================================================================================================
+static size_t _itemData( volatile struct nwClient *c, struct clientQueueEntry *e, const uint8_t **p )
+
+/* Find the next piece of item e that is still to go, returning its length */
+
+{
+    if ( e->b )
+    {
+        /* Borrowed block, straight from the owner's buffer */
+        *p = &e->b->data[c->sendOfs];
+        return e->len - c->sendOfs;
+    }
+    else
+    {
+        /* Copied data, from the ring (possibly in two goes if it wraps) */
+        size_t ofs = ( atomic_load_explicit( &c->rp, memory_order_relaxed ) + c->sendOfs ) & CLIENT_RING_MASK;
+        *p = &c->ring[ofs];
+        return ( e->len - c->sendOfs < CLIENT_RING_SIZE - ofs ) ? e->len - c->sendOfs : CLIENT_RING_SIZE - ofs;
+    }
+}
+// ====================================================================================================
+static void _itemDone( volatile struct nwClient *c, struct clientQueueEntry *e, size_t *qrp, size_t n )
+
+/* Account for n more bytes of item e having gone, and give it back once it's all gone */
+
+{
+    c->sendOfs += n;
+
+    if ( c->sendOfs == e->len )
+    {
+        latencyRecord( &c->parent->sendLatency, genericsMonotonicnS() - e->queued );
+
+        if ( e->b )
+        {
+            if ( e->lent )
+            {
+                atomic_fetch_sub_explicit( &_budget.lent, 1, memory_order_relaxed );
+            }
+
+            atomic_fetch_sub_explicit( &c->borrowed, 1, memory_order_relaxed );
+            nwclientBlockRelease( e->b );
+            e->b = NULL;
+        }
+        else
+        {
+            atomic_store_explicit( &c->rp, atomic_load_explicit( &c->rp, memory_order_relaxed ) + e->len, memory_order_release );
+        }
+
+        c->sendOfs = 0;
+        atomic_store_explicit( &c->qrp, ++( *qrp ), memory_order_release );
+    }
+}
+// ====================================================================================================
+static ssize_t _sendSome( volatile struct nwClient *c, const uint8_t *p, size_t len, bool *blocked )
+
+/* Send as much of p as the socket will take, returning how much that was, or -1 if the client died */
+
+{
+    ssize_t sent = send( c->fdNo, ( const void * )p, len, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+    if ( sent <= 0 )
+    {
+        if ( ( sent < 0 ) && ( _wouldBlock() ) )
+        {
+            /* Socket is full, come back later */
+            *blocked = true;
+            return 0;
+        }
+
+        return -1;
+    }
+
+    c->sentBytes += sent;
+    return sent;
+}
+// ====================================================================================================
+static bool _spillPending( volatile struct nwClient *c )
+
+{
+    return atomic_load_explicit( &c->spillRp, memory_order_relaxed ) != atomic_load_explicit( &c->spillWp, memory_order_acquire );
+}
+// ====================================================================================================
+static size_t _spillNext( volatile struct nwClient *c, const uint8_t **p )
+
+/* Find the next piece of the spill that's ready to go, returning its length. Whatever is queued in */
+/* memory went in before anything in the spill did, so the spill waits until the queue is empty.    */
+
+{
+    uint8_t *map = atomic_load_explicit( &c->spillMap, memory_order_relaxed );
+    uint64_t rp = atomic_load_explicit( &c->spillRp, memory_order_relaxed );
+    uint64_t wp, ofs;
+
+    if ( !map )
+    {
+        return 0;
+    }
+
+    /* The producer queued the last thing in memory before it spilled this, so look at the spill first */
+    wp = atomic_load_explicit( &c->spillWp, memory_order_acquire );
+
+    if ( ( rp == wp ) || ( atomic_load_explicit( &c->qrp, memory_order_relaxed ) != atomic_load_explicit( &c->qwp, memory_order_acquire ) ) )
+    {
+        return 0;
+    }
+
+    ofs = rp % c->spillMax;
+    *p = &map[ofs];
+    return ( wp - rp < c->spillMax - ofs ) ? wp - rp : c->spillMax - ofs;
+}
+// ====================================================================================================
+static void _spillDone( volatile struct nwClient *c, size_t n )
+
+/* n more bytes of the spill have gone, so the producer can have the space back. A spill in memory is */
+/* given back to the system as well, a grain at a time, which has to be done before the producer can  */
+/* write there again. That way what it costs is only ever what's waiting in it.                       */
+
+{
+    uint64_t rp = atomic_load_explicit( &c->spillRp, memory_order_relaxed ) + n;
+    uint64_t freeTo = rp;
+
+#if !defined( WIN32 )
+
+    if ( c->spillMem )
+    {
+        uint8_t *map = atomic_load_explicit( &c->spillMap, memory_order_relaxed );
+
+        freeTo = rp - rp % SPILL_RELEASE_GRAIN;
+
+        for ( uint64_t p = atomic_load_explicit( &c->spillFree, memory_order_relaxed ); p < freeTo; p += SPILL_RELEASE_GRAIN )
+        {
+            madvise( &map[p % c->spillMax], SPILL_RELEASE_GRAIN, MADV_DONTNEED );
+        }
+    }
+
+#endif
+    atomic_store_explicit( &c->spillRp, rp, memory_order_release );
+    atomic_store_explicit( &c->spillFree, freeTo, memory_order_release );
+}
+// ====================================================================================================
+static uint64_t _spillShed( volatile struct nwClient *c, uint64_t want )
+
+/* Throw away at least want bytes from the front of a client's spill, or all of it if there isn't that */
+/* much. It goes up to the end of the frame that leaves it in the middle of, so the next thing the      */
+/* client sees is the end of a frame, and it loses what it had of that frame rather than the next one. */
+/* Returns how much went.                                                                              */
+
+{
+    uint8_t *map = atomic_load_explicit( &c->spillMap, memory_order_relaxed );
+    uint64_t rp = atomic_load_explicit( &c->spillRp, memory_order_relaxed );
+    uint64_t wp = atomic_load_explicit( &c->spillWp, memory_order_acquire );
+    uint64_t to = rp + want;
+
+    if ( wp - rp <= want )
+    {
+        to = wp;
+    }
+
+    while ( ( to < wp ) && ( map[to % c->spillMax] != COBS_SYNC_CHAR ) )
+    {
+        to++;
+    }
+
+    _drop( c, to - rp );
+    _spillDone( c, to - rp );
+    return to - rp;
+}
+// ====================================================================================================
+static bool _drainCompressed( volatile struct nwClient *c, bool *blocked )
+
+/* Compress queued items (and then anything spilled) and send as much of the result as the socket will */
+/* take. Items are given back as soon as the deflater has taken them, and the output is flushed         */
+/* whenever there's nothing left to give it, so nothing sits in the deflater waiting for more data.    */
+
+{
+    size_t qrp = atomic_load_explicit( &c->qrp, memory_order_relaxed );
+    size_t qwp = atomic_load_explicit( &c->qwp, memory_order_acquire );
+    z_stream *z = c->z;
+    size_t spilled = 0, chunk;
+    const uint8_t *p;
+    ssize_t sent;
+
+    while ( true )
+    {
+        if ( c->zofs < c->zlen )
+        {
+            if ( ( sent = _sendSome( c, &c->zbuf[c->zofs], c->zlen - c->zofs, blocked ) ) < 0 )
+            {
+                return false;
+            }
+
+            if ( !sent )
+            {
+                break;
+            }
+
+            c->zofs += sent;
+            continue;
+        }
+
+        c->zofs = c->zlen = 0;
+        z->next_out = c->zbuf;
+        z->avail_out = CLIENT_ZBUF_SIZE;
+
+        if ( ( qrp == qwp ) && ( spilled < SPILL_PER_VISIT ) && ( chunk = _spillNext( c, &p ) ) )
+        {
+            z->next_in = ( Bytef * )p;
+            z->avail_in = chunk;
+            deflate( z, Z_NO_FLUSH );
+            c->zflushed = false;
+            _spillDone( c, chunk - z->avail_in );
+            spilled += chunk - z->avail_in;
+        }
+        else if ( qrp == qwp )
+        {
+            if ( c->zflushed )
+            {
+                break;
+            }
+
+            /* Queue has run dry, so get everything out of the deflater */
+            deflate( z, Z_SYNC_FLUSH );
+            c->zflushed = ( z->avail_out != 0 );
+        }
+        else
+        {
+            struct clientQueueEntry *e = ( struct clientQueueEntry * )&c->q[qrp & CLIENT_QUEUE_MASK];
+            chunk = _itemData( c, e, &p );
+
+            z->next_in = ( Bytef * )p;
+            z->avail_in = chunk;
+            deflate( z, Z_NO_FLUSH );
+            c->zflushed = false;
+            _itemDone( c, e, &qrp, chunk - z->avail_in );
+        }
+
+        c->zlen = CLIENT_ZBUF_SIZE - z->avail_out;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static ssize_t _sendGather( volatile struct nwClient *c, IOV_T *iov, int niov )
+
+/* Send the pieces in one call, without waiting, returning how much went or -1 as send does */
+
+{
+#if defined( WIN32 )
+    DWORD sent;
+
+    /* With no OVERLAPPED this completes at once, taking whatever fits in the socket buffer */
+    return ( WSASend( c->fdNo, iov, niov, &sent, 0, NULL, NULL ) == 0 ) ? ( ssize_t )sent : -1;
+#else
+    struct msghdr msg;
+
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    return sendmsg( c->fdNo, &msg, MSG_NOSIGNAL | MSG_DONTWAIT );
+#endif
+}
+// ====================================================================================================
+static bool _drainQueue( volatile struct nwClient *c, bool *blocked )
+
+/* Send as many queued items as the socket will take. Returns false if the client died */
+
+{
+    size_t qrp = atomic_load_explicit( &c->qrp, memory_order_relaxed );
+    size_t qwp = atomic_load_explicit( &c->qwp, memory_order_acquire );
+    IOV_T iov[CLIENT_IOV_MAX];
+    ssize_t sent;
+
+    while ( qrp != qwp )
+    {
+        /* Gather up as much as is waiting, so it all goes in one call */
+        size_t ringPos = atomic_load_explicit( &c->rp, memory_order_relaxed );
+        size_t ofs, left, first;
+        int niov = 0;
+
+        for ( size_t i = qrp; ( i != qwp ) && ( niov < CLIENT_IOV_MAX - 1 ); i++ )
+        {
+            struct clientQueueEntry *e = ( struct clientQueueEntry * )&c->q[i & CLIENT_QUEUE_MASK];
+            size_t sofs = ( i == qrp ) ? c->sendOfs : 0;
+
+            if ( e->b )
+            {
+                IOV_SET( iov[niov], &e->b->data[sofs], e->len - sofs );
+                niov++;
+            }
+            else
+            {
+                /* Copied data may wrap around the end of the ring */
+                ofs   = ( ringPos + sofs ) & CLIENT_RING_MASK;
+                left  = e->len - sofs;
+                first = ( left < CLIENT_RING_SIZE - ofs ) ? left : CLIENT_RING_SIZE - ofs;
+                IOV_SET( iov[niov], &c->ring[ofs], first );
+                niov++;
+
+                if ( left > first )
+                {
+                    IOV_SET( iov[niov], c->ring, left - first );
+                    niov++;
+                }
+
+                ringPos += e->len;
+            }
+        }
+
+        sent = _sendGather( c, iov, niov );
+
+        if ( sent <= 0 )
+        {
+            if ( ( sent < 0 ) && ( _wouldBlock() ) )
+            {
+                /* Socket is full, come back later */
+                *blocked = true;
+                break;
+            }
+
+            return false;
+        }
+
+        c->sentBytes += sent;
+
+        /* ...and give back whatever went */
+        while ( sent )
+        {
+            struct clientQueueEntry *e = ( struct clientQueueEntry * )&c->q[qrp & CLIENT_QUEUE_MASK];
+            size_t n = ( ( size_t )sent < e->len - c->sendOfs ) ? ( size_t )sent : e->len - c->sendOfs;
+
+            _itemDone( c, e, &qrp, n );
+            sent -= n;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _coalescing( volatile struct nwClient *c )
+
+/* Is output to a bulk client being held back until there's more of it? */
+
+{
+    size_t qrp = atomic_load_explicit( &c->qrp, memory_order_relaxed );
+    size_t qwp = atomic_load_explicit( &c->qwp, memory_order_acquire );
+
+    if ( ( c->qos != NW_QOS_BULK ) || ( qrp == qwp ) || _spillPending( c ) ||
+            ( atomic_load_explicit( &c->borrowed, memory_order_relaxed ) ) || ( qwp - qrp >= CLIENT_QUEUE_LEN / 2 ) ||
+            ( atomic_load_explicit( &c->wp, memory_order_acquire ) - atomic_load_explicit( &c->rp, memory_order_relaxed ) >= BULK_COALESCE_BYTES ) )
+    {
+        return false;
+    }
+
+    return ( genericsMonotonicnS() - c->q[qrp & CLIENT_QUEUE_MASK].queued < BULK_COALESCE_MS * 1000000ULL );
+}
+// ====================================================================================================
+static bool _drainClient( volatile struct nwClient *c, bool *blocked )
+
+/* Send as much as the socket will take, what's queued in memory and then what's been spilled. */
+/* Returns false if the client died.                                                           */
+
+{
+    size_t spilled = 0, len;
+    const uint8_t *p;
+    ssize_t sent;
+
+    if ( ( c->holding ) || _coalescing( c ) )
+    {
+        /* Nothing goes until we know if this client wants its data compressed, or until there's enough of it */
+        return true;
+    }
+
+    if ( c->z )
+    {
+        return _drainCompressed( c, blocked );
+    }
+
+    while ( true )
+    {
+        if ( !_drainQueue( c, blocked ) )
+        {
+            return false;
+        }
+
+        if ( ( *blocked ) || ( spilled >= SPILL_PER_VISIT ) || ( !( len = _spillNext( c, &p ) ) ) )
+        {
+            break;
+        }
+
+        if ( ( sent = _sendSome( c, p, len, blocked ) ) < 0 )
+        {
+            return false;
+        }
+
+        _spillDone( c, sent );
+        spilled += sent;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _startCompression( struct nwClient *n )
+
+/* Set up compressed output for this client, with the acknowledgement as the last uncompressed thing it sees */
+
+{
+    if ( !_budgetRoom( CLIENT_ZBUF_SIZE + CLIENT_ZSTATE_SIZE ) )
+    {
+        genericsReport( V_WARN, "Connection index %d not compressed, memory budget is used up" EOL, n->fdNo );
+        return false;
+    }
+
+    n->z = ( z_stream * )calloc( 1, sizeof( z_stream ) );
+    n->zbuf = ( uint8_t * )malloc( CLIENT_ZBUF_SIZE );
+
+    if ( ( !n->z ) || ( !n->zbuf ) || ( deflateInit( n->z, CLIENT_ZLEVEL ) != Z_OK ) )
+    {
+        genericsReport( V_ERROR, "Could not start compression for connection index %d" EOL, n->fdNo );
+        free( n->z );
+        free( n->zbuf );
+        n->z = NULL;
+        n->zbuf = NULL;
+        return false;
+    }
+
+    memcpy( n->zbuf, NW_COMPRESS_MAGIC, NW_COMPRESS_MAGIC_LEN );
+    n->zlen = NW_COMPRESS_MAGIC_LEN;
+    n->zflushed = true;
+    return true;
+}
+// ====================================================================================================
+static void _startSpill( struct nwClient *n )
+
+/* Give a bulk client somewhere to overflow into, so it doesn't lose anything while it's behind. That's */
+/* a file mapped into memory, so the producer only has to copy into it and the reactor sends straight  */
+/* out of it. The file is unlinked as soon as it's made, so it goes when the client does however we    */
+/* part company. Without a directory it's just memory, which isn't used until it's needed.             */
+
+{
+#if defined( WIN32 )
+    genericsReport( V_WARN, "Spilling is not supported on this platform, connection index %d may lose data" EOL, n->fdNo );
+#else
+    const char *dir = n->parent->spillDir;
+    uint64_t len = n->parent->spillMax;
+    uint8_t *map = MAP_FAILED;
+    char *name;
+    int fd = -1;
+
+    if ( !dir )
+    {
+        /* It's given back to the system in grains once it's been sent, so it's made of whole ones */
+        len = ( len + SPILL_RELEASE_GRAIN - 1 ) / SPILL_RELEASE_GRAIN * SPILL_RELEASE_GRAIN;
+        map = ( uint8_t * )mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    }
+    else
+    {
+        name = ( char * )malloc( strlen( dir ) + sizeof( "/orbuculum-spill-XXXXXX" ) );
+        MEMCHECKV( name );
+        sprintf( name, "%s/orbuculum-spill-XXXXXX", dir );
+
+        if ( ( fd = mkstemp( name ) ) >= 0 )
+        {
+            unlink( name );
+
+            if ( !ftruncate( fd, len ) )
+            {
+                map = ( uint8_t * )mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+            }
+
+            /* The mapping keeps the file for as long as it's needed */
+            close( fd );
+        }
+
+        free( name );
+    }
+
+    if ( map == MAP_FAILED )
+    {
+        genericsReport( V_ERROR, "Could not create spill%s%s for connection index %d (%s)" EOL, dir ? " in " : "", dir ? dir : "", n->fdNo, strerror( errno ) );
+        return;
+    }
+
+    /* The producer only looks at spillMax once it sees the map */
+    n->spillMax = len;
+    n->spillMem = ( !dir );
+    atomic_store_explicit( &n->spillMap, map, memory_order_release );
+#endif
+}
+// ====================================================================================================
+static void _setQoS( struct nwClient *n, uint8_t qos )
+
+/* Set a client up for the class of service it asked for */
+
+{
+    static const char *const _qosName[NW_QOS_NUM] = { "default", "latency", "bulk" };
+    int flag = 1;
+    int sndbuf = BULK_SNDBUF;
+
+    switch ( qos )
+    {
+        case NW_QOS_DEFAULT:
+            break;
+
+        case NW_QOS_LATENCY:
+            /* Every write goes as it's made, rather than waiting to be joined by more */
+            setsockopt( n->fdNo, IPPROTO_TCP, TCP_NODELAY, ( const void * )&flag, sizeof( flag ) );
+            break;
+
+        case NW_QOS_BULK:
+            setsockopt( n->fdNo, SOL_SOCKET, SO_SNDBUF, ( const void * )&sndbuf, sizeof( sndbuf ) );
+
+            if ( n->parent->spillMax )
+            {
+                _startSpill( n );
+            }
+
+            break;
+
+        default:
+            genericsReport( V_INFO, "Connection index %d asked for unknown class %d" EOL, n->fdNo, qos );
+            return;
+    }
+
+    n->qos = qos;
+    genericsReport( V_INFO, "Connection index %d is %s class%s" EOL, n->fdNo, _qosName[qos],
+                    !atomic_load( &n->spillMap ) ? "" : ( n->parent->spillDir ) ? ", spilling to disk" : ", spilling to memory" );
+}
+// ====================================================================================================
+static void _requestTimers( struct nwClient *n )
+
+/* Stop waiting for requests from a client that's taking too long to send them */
+
+{
+    if ( genericsTimestampmS() - n->connectTime > REQUEST_HOLD_MS )
+    {
+        n->holding = false;
+    }
+
+    if ( genericsTimestampmS() - n->connectTime > REQUEST_WAIT_MS )
+    {
+        n->reqSettled = true;
+    }
+}
+// ====================================================================================================
+static void _readRequests( volatile struct nwClient *c )
+
+/* The client has sent something, so take any requests on board. A client may ask for compression */
+/* (but only as its first request), subscribe to specific tags, and then say what class of service */
+/* it wants. Anything after that is read and thrown away.                                         */
+
+{
+    struct nwClient *n = ( struct nwClient * )c;
+    uint8_t discard[256];
+    ssize_t got;
+
+    if ( n->reqSettled )
+    {
+        got = recv( n->fdNo, ( char * )discard, sizeof( discard ), 0 );
+    }
+    else
+    {
+        got = recv( n->fdNo, ( char * )&n->req[n->reqLen], sizeof( n->req ) - n->reqLen, 0 );
+    }
+
+    if ( got <= 0 )
+    {
+        if ( ( got < 0 ) && ( _wouldBlock() ) )
+        {
+            return;
+        }
+
+        /* Client closed its side, or something went wrong...either way it isn't going to ask for anything. */
+        /* It may still be listening though, so that's for sending to find out.                           */
+        n->reqSettled = true;
+        n->holding = false;
+        n->rxClosed = true;
+        return;
+    }
+
+    if ( n->reqSettled )
+    {
+        return;
+    }
+
+    n->reqLen += got;
+
+    while ( ( !n->reqSettled ) && ( n->reqLen >= NW_SUBSCRIBE_MAGIC_LEN ) )
+    {
+        if ( !memcmp( n->req, NW_COMPRESS_MAGIC, NW_COMPRESS_MAGIC_LEN ) )
+        {
+            /* We can only switch to compressed if the client hasn't been sent anything yet */
+            if ( ( n->sentBytes ) || ( n->z ) || ( atomic_load_explicit( &n->subscribed, memory_order_relaxed ) ) ||
+                    ( n->qos != NW_QOS_DEFAULT ) )
+            {
+                genericsReport( V_INFO, "Connection index %d asked for compression too late" EOL, n->fdNo );
+            }
+            else if ( _startCompression( n ) )
+            {
+                genericsReport( V_INFO, "Connection index %d compressed" EOL, n->fdNo );
+            }
+
+            n->reqLen -= NW_COMPRESS_MAGIC_LEN;
+            memmove( n->req, &n->req[NW_COMPRESS_MAGIC_LEN], n->reqLen );
+        }
+        else if ( !memcmp( n->req, NW_SUBSCRIBE_MAGIC, NW_SUBSCRIBE_MAGIC_LEN ) )
+        {
+            if ( n->reqLen < sizeof( n->sub ) )
+            {
+                /* Wait for the rest of it */
+                break;
+            }
+
+            if ( atomic_load_explicit( &n->subscribed, memory_order_relaxed ) )
+            {
+                /* Only the first one counts, the producer may already be using it */
+                genericsReport( V_INFO, "Connection index %d subscribed twice" EOL, n->fdNo );
+            }
+            else
+            {
+                int ntags = 0;
+                memcpy( &n->sub, n->req, sizeof( n->sub ) );
+
+                for ( int i = 0; i < NW_NUM_TAGS; i++ )
+                {
+                    ntags += nwSubscriptionHas( &n->sub, i ) ? 1 : 0;
+                }
+
+                /* Time frames say when the others were stamped, so everyone gets them */
+                n->sub.tags[OFLOW_TIME_TAG / 8] |= 1 << ( OFLOW_TIME_TAG % 8 );
+
+                /* The producer only looks at sub once it sees subscribed set, and then gives it any history first */
+                atomic_store_explicit( &n->replay, ( n->parent->history != NULL ), memory_order_relaxed );
+                atomic_store_explicit( &n->subscribed, true, memory_order_release );
+                atomic_fetch_add_explicit( &n->parent->subscribers, 1, memory_order_relaxed );
+                genericsReport( V_INFO, "Connection index %d subscribed to %d tag%s" EOL, n->fdNo, ntags, ( ntags == 1 ) ? "" : "s" );
+            }
+
+            /* A class of service may yet follow */
+            n->reqLen -= sizeof( n->sub );
+            memmove( n->req, &n->req[sizeof( n->sub )], n->reqLen );
+        }
+        else if ( !memcmp( n->req, NW_QOS_MAGIC, NW_QOS_MAGIC_LEN ) )
+        {
+            if ( n->reqLen < sizeof( struct nwQoSRequest ) )
+            {
+                /* Wait for the rest of it */
+                break;
+            }
+
+            _setQoS( n, n->req[NW_QOS_MAGIC_LEN] );
+
+            /* This is always the last request */
+            n->reqSettled = true;
+        }
+        else
+        {
+            /* Whatever this is, it isn't a request */
+            n->reqSettled = true;
+        }
+
+        /* Once the first request has been dealt with, there's nothing more to hold output back for */
+        n->holding = false;
+    }
+}
+// ====================================================================================================
+static void _reportDrops( volatile struct nwClient *c )
+
+/* Let the user know, occasionally, that a client isn't keeping up */
+
+{
+    uint64_t dropped = atomic_load_explicit( &c->dropped, memory_order_relaxed );
+    uint32_t now = genericsTimestampmS();
+
+    if ( ( dropped != c->reportedDropped ) && ( now - c->lastDropReport >= DROP_REPORT_INTERVAL_MS ) )
+    {
+        genericsReport( V_INFO, "Connection index %d not keeping up, %" PRIu64 " bytes dropped" EOL, c->fdNo, dropped - c->reportedDropped );
+        c->reportedDropped = dropped;
+        c->lastDropReport = now;
+    }
+}
+// ====================================================================================================
+static uint64_t _clientBacklog( volatile struct nwClient *c )
+
+/* What a client has waiting in memory, over and above what it was given to start with */
+
+{
+    uint64_t b = atomic_load_explicit( &c->wp, memory_order_relaxed ) - atomic_load_explicit( &c->rp, memory_order_relaxed );
+
+    if ( c->spillMem )
+    {
+        b += atomic_load_explicit( &c->spillWp, memory_order_relaxed ) - atomic_load_explicit( &c->spillRp, memory_order_relaxed );
+    }
+
+    return b;
+}
+// ====================================================================================================
+static uint64_t _clientMemory( volatile struct nwClient *c, uint64_t *compression, uint64_t *spill )
+
+/* Memory held on a client's behalf, and how much of that is for compression and its spill */
+
+{
+    *compression = ( c->z ) ? CLIENT_ZBUF_SIZE + CLIENT_ZSTATE_SIZE : 0;
+    *spill = ( c->spillMem ) ? atomic_load_explicit( &c->spillWp, memory_order_relaxed ) - atomic_load_explicit( &c->spillFree, memory_order_relaxed ) : 0;
+
+    return CLIENT_RING_SIZE + *compression + *spill;
+}
+// ====================================================================================================
+static void _budgetCount( void )
+
+/* Count up what's being held on behalf of the clients of every port */
+
+{
+    struct nwclientMemory *m = &_budget.count;
+    struct clientSet *cs;
+    uint64_t compression, spill;
+
+    m->rings = m->spills = m->compression = m->history = 0;
+
+    for ( struct nwclientsHandle *h = _reactor.handles; h; h = h->nextHandle )
+    {
+        m->history += ( h->history ) ? tagHistoryFootprint( h->history ) : 0;
+        cs = atomic_load( &h->clients );
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            if ( !atomic_load_explicit( &cs->c[i]->dead, memory_order_relaxed ) )
+            {
+                m->rings += _clientMemory( cs->c[i], &compression, &spill ) - compression - spill;
+                m->compression += compression;
+                m->spills += spill;
+            }
+        }
+    }
+
+    m->replays = atomic_load_explicit( &_budget.replays, memory_order_relaxed );
+    m->total = m->rings + m->spills + m->compression + m->replays + m->history;
+    atomic_store_explicit( &_budget.used, m->total, memory_order_relaxed );
+}
+// ====================================================================================================
+static bool _narrowable( volatile struct nwClient *c )
+
+/* Could this client get by on one of the tags it asked for? */
+
+{
+    int ntags = 0;
+
+    if ( ( !atomic_load_explicit( &c->subscribed, memory_order_acquire ) ) || ( atomic_load_explicit( &c->narrowed, memory_order_relaxed ) ) )
+    {
+        return false;
+    }
+
+    for ( int i = 0; i < NW_NUM_TAGS; i++ )
+    {
+        ntags += ( ( i != OFLOW_TIME_TAG ) && nwSubscriptionHas( ( const struct nwSubscription * )&c->sub, i ) ) ? 1 : 0;
+    }
+
+    return ( ntags > 1 );
+}
+// ====================================================================================================
+static struct nwClient *_worstClient( bool narrowable, bool spilled )
+
+/* Find whichever client has the most waiting in memory (from those that could be cut down to one */
+/* tag, or from those with a spill in memory, if asked), or NULL if nobody has anything waiting.  */
+
+{
+    struct nwClient *worst = NULL;
+    uint64_t most = 0, b;
+    struct clientSet *cs;
+
+    for ( struct nwclientsHandle *h = _reactor.handles; h; h = h->nextHandle )
+    {
+        cs = atomic_load( &h->clients );
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            struct nwClient *c = cs->c[i];
+
+            if ( ( atomic_load_explicit( &c->dead, memory_order_relaxed ) ) || ( ( narrowable ) && ( !_narrowable( c ) ) ) ||
+                    ( ( spilled ) && ( ( !c->spillMem ) || ( !_spillPending( c ) ) ) ) )
+            {
+                continue;
+            }
+
+            b = ( spilled ) ? atomic_load_explicit( &c->spillWp, memory_order_relaxed ) - atomic_load_explicit( &c->spillRp, memory_order_relaxed ) : _clientBacklog( c );
+
+            if ( b > most )
+            {
+                most = b;
+                worst = c;
+            }
+        }
+    }
+
+    return worst;
+}
+// ====================================================================================================
+static void _narrow( struct nwClient *c )
+
+/* Cut a client down to the first tag it asked for, along with the time frames that go with it */
+
+{
+    int t;
+
+    for ( t = 0; ( t == OFLOW_TIME_TAG ) || ( !nwSubscriptionHas( &c->sub, t ) ); t++ );
+
+    memcpy( &c->narrow, &c->sub, sizeof( c->narrow ) );
+    memset( c->narrow.tags, 0, sizeof( c->narrow.tags ) );
+    c->narrow.tags[t / 8] |= 1 << ( t % 8 );
+    c->narrow.tags[OFLOW_TIME_TAG / 8] |= 1 << ( OFLOW_TIME_TAG % 8 );
+
+    /* The producer only looks at narrow once it sees narrowed set */
+    atomic_store_explicit( &c->narrowed, true, memory_order_release );
+    genericsReport( V_WARN, "Connection index %d cut down to tag %d while memory is short" EOL, c->fdNo, t );
+}
+// ====================================================================================================
+static void _budgetCheck( void )
+
+/* Count up what's held, and if that's getting near the budget do what the policy says about it. */
+/* Whatever that is, the oldest of what's spilled in memory goes until there's enough room again, */
+/* since nothing else frees memory straight away.                                                */
+
+{
+    struct nwclientMemory *m = &_budget.count;
+    uint32_t now = genericsTimestampmS();
+    uint64_t excess, shed;
+    struct nwClient *c;
+
+    _budget.lastCheck = now;
+    _budgetCount();
+
+    if ( ( !_budget.max ) || ( m->total <= BUDGET_SHED_AT( _budget.max ) ) )
+    {
+        return;
+    }
+
+    excess = m->total - BUDGET_SHED_TO( _budget.max );
+
+    if ( ( _budget.policy == NW_SHED_DISCONNECT ) && ( c = _worstClient( false, false ) ) )
+    {
+        genericsReport( V_WARN, "Connection index %d disconnected with %" PRIu64 " bytes waiting, memory is short" EOL, c->fdNo, _clientBacklog( c ) );
+        _clientKill( c );
+        m->disconnected++;
+        _budgetCount();
+        return;
+    }
+
+    if ( ( _budget.policy == NW_SHED_FILTER ) && ( now - _budget.lastNarrow >= BUDGET_SETTLE_MS ) && ( c = _worstClient( true, false ) ) )
+    {
+        _narrow( c );
+        m->narrowed++;
+        _budget.lastNarrow = now;
+    }
+
+    while ( ( excess ) && ( c = _worstClient( false, true ) ) )
+    {
+        shed = _spillShed( c, excess );
+        m->shedBytes += shed;
+        excess -= ( shed < excess ) ? shed : excess;
+    }
+
+    _budgetCount();
+}
+// ====================================================================================================
+static void _pollAdd( int *np, int fd, short events, struct nwclientsHandle *h, struct nwClient *c )
+
+/* Add a descriptor to the set the reactor is going to wait on */
+
+{
+    if ( *np == _reactor.pmax )
+    {
+        _reactor.pmax = _reactor.pmax ? _reactor.pmax * 2 : 64;
+        _reactor.pfd = ( struct pollfd * )realloc( _reactor.pfd, _reactor.pmax * sizeof( struct pollfd ) );
+        _reactor.pt = ( struct pollTarget * )realloc( _reactor.pt, _reactor.pmax * sizeof( struct pollTarget ) );
+        MEMCHECKV( _reactor.pfd );
+        MEMCHECKV( _reactor.pt );
+    }
+
+    _reactor.pfd[*np].fd = fd;
+    _reactor.pfd[*np].events = events;
+    _reactor.pfd[*np].revents = 0;
+    _reactor.pt[*np].h = h;
+    _reactor.pt[*np].c = c;
+    ( *np )++;
+}
+// ====================================================================================================
+static int _serviceHandle( struct nwclientsHandle *h, int *np )
+
+/* Bring the client set for this port up to date, drain everyone's queues to the network, and */
+/* decide what to wait for next. Returns the longest the reactor should wait before coming back. */
+
+{
+    struct clientSet *cs;
+    struct nwClient *n;
+    int timeout = REACTOR_IDLE_WAIT_MS;
+    bool blocked;
+
+    if ( _updateClients( h ) )
+    {
+        /* Old sets are still being looked at, they won't be for long */
+        timeout = REACTOR_NAP_MS;
+    }
+
+    _pollAdd( np, h->sockfd, POLLIN, h, NULL );
+
+    /* We're the only one that replaces the set, so it can't go away under us */
+    cs = atomic_load( &h->clients );
+
+    /* Interactive clients go first, so time spent on everyone else's backlog doesn't add to theirs */
+    for ( int i = 0; cs && ( i < 2 * cs->n ); i++ )
+    {
+        n = cs->c[i % cs->n];
+
+        if ( ( ( n->qos == NW_QOS_LATENCY ) != ( i < cs->n ) ) || atomic_load_explicit( &n->dead, memory_order_relaxed ) )
+        {
+            continue;
+        }
+
+        if ( !n->reqSettled )
+        {
+            _requestTimers( n );
+        }
+
+        blocked = false;
+
+        if ( !_drainClient( n, &blocked ) )
+        {
+            genericsReport( V_INFO, "Killed connection index %d" EOL, n->fdNo );
+            _clientKill( n );
+            timeout = REACTOR_NAP_MS;
+            continue;
+        }
+
+        _reportDrops( n );
+
+        if ( !n->reqSettled )
+        {
+            timeout = ( timeout < REQUEST_POLL_MS ) ? timeout : REQUEST_POLL_MS;
+        }
+
+        if ( ( !blocked ) && atomic_load_explicit( &n->overflowed, memory_order_relaxed ) && ( !_spillPending( n ) ) &&
+                ( atomic_load_explicit( &n->qrp, memory_order_relaxed ) == atomic_load_explicit( &n->qwp, memory_order_acquire ) ) )
+        {
+            /* Everything up to the point its spill filled has gone, anything more would have a hole in it */
+            genericsReport( V_WARN, "Connection index %d filled its spill, disconnected after %" PRIu64 " bytes" EOL, n->fdNo, n->sentBytes );
+            _clientKill( n );
+            timeout = REACTOR_NAP_MS;
+            continue;
+        }
+
+        if ( !blocked )
+        {
+            if ( _spillPending( n ) )
+            {
+                /* It had its share this time, and can have more straight away */
+                timeout = 0;
+            }
+            else if ( _coalescing( n ) )
+            {
+                timeout = ( timeout < BULK_COALESCE_MS ) ? timeout : BULK_COALESCE_MS;
+            }
+        }
+
+        /* Wait to hear from it, and for room to send to it if it's full */
+        _pollAdd( np, n->fdNo, ( n->rxClosed ? 0 : POLLIN ) | ( blocked ? POLLOUT : 0 ), h, n );
+    }
+
+    return timeout;
+}
+// ====================================================================================================
+static void _serviceEvents( int np )
+
+/* Act on whatever poll found */
+
+{
+    uint8_t discard[64];
+
+    for ( int i = 0; i < np; i++ )
+    {
+        struct pollTarget *t = &_reactor.pt[i];
+        short r = _reactor.pfd[i].revents;
+
+        if ( !r )
+        {
+            continue;
+        }
+
+        if ( !t->h )
+        {
+            /* Just a wakeup, all there is to do is clear it */
+            while ( recv( _reactor.wakefd, ( char * )discard, sizeof( discard ), MSG_DONTWAIT ) > 0 );
+        }
+        else if ( !t->c )
+        {
+            _acceptClient( t->h );
+        }
+        else if ( !atomic_load_explicit( &t->c->dead, memory_order_relaxed ) )
+        {
+            if ( r & ( POLLERR | POLLNVAL | POLLHUP ) )
+            {
+                genericsReport( V_INFO, "Lost connection index %d" EOL, t->c->fdNo );
+                _clientKill( t->c );
+            }
+            else if ( r & POLLIN )
+            {
+                /* Anything writable will be found out next time round, when it's drained */
+                _readRequests( t->c );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void *_reactorTask( void *arg )
+
+/* Serve every port and every client, so a slow client only hurts itself */
+
+{
+    unsigned int gen, seen;
+    int np, timeout, t;
+
+    while ( !atomic_load( &_reactor.ending ) )
+    {
+        pthread_mutex_lock( &_reactor.lock );
+        gen = _reactor.generation;
+
+        /* Anything queued after this point will be seen before we go to sleep */
+        seen = atomic_load( &_reactor.queued );
+        timeout = REACTOR_IDLE_WAIT_MS;
+        np = 0;
+        _pollAdd( &np, _reactor.wakefd, POLLIN, NULL, NULL );
+
+        for ( struct nwclientsHandle *h = _reactor.handles; h; h = h->nextHandle )
+        {
+            t = _serviceHandle( h, &np );
+            timeout = ( t < timeout ) ? t : timeout;
+        }
+
+        if ( genericsTimestampmS() - _budget.lastCheck >= BUDGET_CHECK_MS )
+        {
+            _budgetCheck();
+        }
+
+        if ( _budget.max )
+        {
+            timeout = ( timeout < BUDGET_CHECK_MS ) ? timeout : BUDGET_CHECK_MS;
+        }
+
+        pthread_mutex_unlock( &_reactor.lock );
+
+        /* Producers only wake us once they see we're waiting, so check nothing arrived after we started */
+        atomic_store( &_reactor.waiting, true );
+
+        if ( atomic_load( &_reactor.queued ) != seen )
+        {
+            timeout = 0;
+        }
+
+        poll( _reactor.pfd, np, timeout );
+        atomic_store( &_reactor.waiting, false );
+
+        /* If the ports changed while we were waiting, what poll found may not mean much now */
+        pthread_mutex_lock( &_reactor.lock );
+
+        if ( gen == _reactor.generation )
+        {
+            _serviceEvents( np );
+        }
+
+        pthread_mutex_unlock( &_reactor.lock );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _wakeSocketCreate( void )
+
+/* A datagram socket connected to itself, which anyone can poke to wake the reactor. A socket rather */
+/* than a pipe, so it can be polled on every platform.                                             */
+
+{
+    struct sockaddr_in a;
+    socklen_t alen = sizeof( a );
+    int fd = socket( AF_INET, SOCK_DGRAM, 0 );
+
+    if ( fd < 0 )
+    {
+        return false;
+    }
+
+    memset( &a, 0, sizeof( a ) );
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    if ( ( bind( fd, ( struct sockaddr * )&a, sizeof( a ) ) < 0 ) ||
+            ( getsockname( fd, ( struct sockaddr * )&a, &alen ) < 0 ) ||
+            ( connect( fd, ( struct sockaddr * )&a, sizeof( a ) ) < 0 ) ||
+            ( !_setNonBlocking( fd ) ) )
+    {
+        close( fd );
+        return false;
+    }
+
+    _reactor.wakefd = fd;
+    return true;
+}
+// ====================================================================================================
+static bool _reactorAdd( struct nwclientsHandle *h )
+
+/* Have the reactor serve this port, starting it if this is the first */
+
+{
+    pthread_mutex_lock( &_reactor.lock );
+
+    if ( !_reactor.running )
+    {
+        atomic_store( &_reactor.ending, false );
+
+        if ( !_wakeSocketCreate() )
+        {
+            genericsReport( V_ERROR, "Failed to create reactor wakeup" EOL );
+            pthread_mutex_unlock( &_reactor.lock );
+            return false;
+        }
+
+        if ( pthread_create( &_reactor.thread, NULL, &_reactorTask, NULL ) )
+        {
+            genericsReport( V_ERROR, "Failed to create reactor thread" EOL );
+            close( _reactor.wakefd );
+            _reactor.wakefd = -1;
+            pthread_mutex_unlock( &_reactor.lock );
+            return false;
+        }
+
+        _reactor.running = true;
+    }
+
+    h->nextHandle = _reactor.handles;
+    _reactor.handles = h;
+    _reactor.generation++;
+    pthread_mutex_unlock( &_reactor.lock );
+
+    /* ...and get it to start listening */
+    _wakeReactor();
+    return true;
+}
+// ====================================================================================================
+static void _reactorRemove( struct nwclientsHandle *h )
+
+/* Stop serving this port, and stop the reactor if it was the last. Once this returns the reactor */
+/* won't touch the port again.                                                                     */
+
+{
+    bool last;
+
+    pthread_mutex_lock( &_reactor.lock );
+
+    for ( struct nwclientsHandle **p = &_reactor.handles; *p; p = &( *p )->nextHandle )
+    {
+        if ( *p == h )
+        {
+            *p = h->nextHandle;
+            break;
+        }
+    }
+
+    _reactor.generation++;
+    last = ( !_reactor.handles );
+
+    if ( last )
+    {
+        atomic_store( &_reactor.ending, true );
+    }
+
+    pthread_mutex_unlock( &_reactor.lock );
+
+    if ( last )
+    {
+        _wakeReactor();
+        pthread_join( _reactor.thread, NULL );
+        close( _reactor.wakefd );
+        _reactor.wakefd = -1;
+        _reactor.running = false;
+    }
+}
+// ====================================================================================================
+static bool _caughtUp( volatile struct nwClient *c )
+
+/* Has everything queued for a client gone out? */
+
+{
+    return ( atomic_load_explicit( &c->qrp, memory_order_relaxed ) == atomic_load_explicit( &c->qwp, memory_order_acquire ) ) &&
+           ( !_spillPending( c ) );
+}
+// ====================================================================================================
+static void _handOver( struct nwClient *c, nwclientHandoverCB cb, void *param )
+
+/* Give a client to cb if it can be carried on with elsewhere, or close it if it can't */
+
+{
+    struct nwclientHandover ho;
+
+    if ( atomic_load( &c->dead ) )
+    {
+        return;
+    }
+
+    if ( ( c->z ) || ( atomic_load( &c->narrowed ) ) || ( !_caughtUp( c ) ) )
+    {
+        genericsReport( V_INFO, "Connection index %d can't be handed over, closed" EOL, c->fdNo );
+        _clientKill( c );
+        return;
+    }
+
+    memset( &ho, 0, sizeof( ho ) );
+    ho.fd         = c->fdNo;
+    ho.settled    = c->reqSettled;
+    ho.subscribed = atomic_load( &c->subscribed );
+    ho.sub        = c->sub;
+    ho.qos        = c->qos;
+    ho.sentBytes  = c->sentBytes;
+    ho.reqLen     = c->reqLen;
+    memcpy( ho.req, c->req, c->reqLen );
+    cb( &ho, param );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void nwclientSend( struct nwclientsHandle *h, uint32_t len, const uint8_t *ipbuffer )
+
+/* Queue a copy of data for every client that hasn't subscribed to specific tags. This never blocks on */
+/* the network...a client that can't keep up loses data.                                              */
+
+{
+    struct clientSet *cs;
+    uint64_t now;
+    unsigned int e;
+
+    if ( h && atomic_load_explicit( &h->clients, memory_order_relaxed ) && len )
+    {
+        e = _readEnter( h );
+        cs = atomic_load( &h->clients );
+
+        /* One timestamp does for everyone this goes to */
+        now = genericsMonotonicnS();
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            struct nwClient *n = cs->c[i];
+
+            if ( !atomic_load_explicit( &n->subscribed, memory_order_relaxed ) && !atomic_load_explicit( &n->dead, memory_order_relaxed ) )
+            {
+                _queueCopy( n, len, ipbuffer, now );
+            }
+        }
+
+        _readExit( h, e );
+
+        /* ...and tell the sender there's work to be done */
+        _wakeReactor();
+    }
+}
+// ====================================================================================================
+static bool _lend( void )
+
+/* Take one of the blocks that may be lent to clients at once, if any are left */
+
+{
+    if ( ( atomic_fetch_add_explicit( &_budget.lent, 1, memory_order_relaxed ) < _budget.maxLent ) || ( !_budget.maxLent ) )
+    {
+        return true;
+    }
+
+    atomic_fetch_sub_explicit( &_budget.lent, 1, memory_order_relaxed );
+    return false;
+}
+// ====================================================================================================
+void nwclientSendBlock( struct nwclientsHandle *h, struct nwclientBlock *b )
+
+/* Queue a reference to an immutable block for every client that hasn't subscribed to specific tags. */
+/* Each client holding it takes a reference, which is released once the block is sent (or the client */
+/* dies). Clients that are already holding too many blocks get a copy instead, so they can't hold up  */
+/* the owner of the block, as do those spilling, so the block takes its turn behind what's spilled.    */
+/* Once as many blocks are lent as the limit allows, everyone gets copies until some come back.       */
+
+{
+    struct clientSet *cs;
+    uint64_t now;
+    unsigned int e;
+
+    if ( h && atomic_load_explicit( &h->clients, memory_order_relaxed ) && b->len )
+    {
+        e = _readEnter( h );
+        cs = atomic_load( &h->clients );
+        now = genericsMonotonicnS();
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            struct nwClient *n = cs->c[i];
+
+            if ( atomic_load_explicit( &n->subscribed, memory_order_relaxed ) || atomic_load_explicit( &n->dead, memory_order_relaxed ) )
+            {
+                continue;
+            }
+
+            if ( ( !n->spilling ) && ( atomic_load_explicit( &n->borrowed, memory_order_relaxed ) < CLIENT_MAX_BORROWED ) && !_queueFull( n ) && _lend() )
+            {
+                nwclientBlockRetain( b );
+                atomic_fetch_add_explicit( &n->borrowed, 1, memory_order_relaxed );
+                _queuePush( n, b, true, b->len, now );
+            }
+            else
+            {
+                _queueCopy( n, b->len, b->data, now );
+            }
+        }
+
+        _readExit( h, e );
+        _wakeReactor();
+    }
+}
+// ====================================================================================================
+void nwclientSendTag( struct nwclientsHandle *h, uint8_t tag, uint32_t len, const uint8_t *ipbuffer )
+
+/* Queue a copy of complete frame(s) carrying tag for every client that subscribed to it */
+
+{
+    struct clientSet *cs;
+    uint64_t now;
+    unsigned int e;
+
+    if ( h && atomic_load_explicit( &h->subscribers, memory_order_relaxed ) && len )
+    {
+        e = _readEnter( h );
+        cs = atomic_load( &h->clients );
+        now = genericsMonotonicnS();
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            struct nwClient *n = cs->c[i];
+
+            if ( ( !atomic_load_explicit( &n->subscribed, memory_order_acquire ) ) || atomic_load_explicit( &n->dead, memory_order_relaxed ) )
+            {
+                continue;
+            }
+
+            if ( atomic_load_explicit( &n->replay, memory_order_relaxed ) )
+            {
+                _replayHistory( h, n, now );
+            }
+
+            if ( nwSubscriptionHas( _subOf( n ), tag ) )
+            {
+                _queueCopy( n, len, ipbuffer, now );
+            }
+        }
+
+        _readExit( h, e );
+        _wakeReactor();
+    }
+
+    /* It's kept after it's been sent, so anyone subscribing later doesn't get it twice */
+    if ( ( h ) && ( h->history ) )
+    {
+        tagHistoryAdd( h->history, tag, ipbuffer, len );
+    }
+}
+// ====================================================================================================
+void nwclientReplayHistory( struct nwclientsHandle *h )
+
+/* Give clients that have just subscribed their history now, rather than along with whatever is sent */
+/* next. Like the other sends, this is for the producer only.                                        */
+
+{
+    struct clientSet *cs;
+    unsigned int e;
+
+    if ( h && h->history && atomic_load_explicit( &h->subscribers, memory_order_relaxed ) )
+    {
+        bool any = false;
+
+        e = _readEnter( h );
+        cs = atomic_load( &h->clients );
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            struct nwClient *n = cs->c[i];
+
+            if ( atomic_load_explicit( &n->subscribed, memory_order_acquire ) && !atomic_load_explicit( &n->dead, memory_order_relaxed ) &&
+                    atomic_load_explicit( &n->replay, memory_order_relaxed ) )
+            {
+                _replayHistory( h, n, genericsMonotonicnS() );
+                any = true;
+            }
+        }
+
+        _readExit( h, e );
+
+        if ( any )
+        {
+            _wakeReactor();
+        }
+    }
+}
+// ====================================================================================================
+void nwclientMarkTag( struct nwclientsHandle *h, uint8_t tag )
+
+/* The next frame sent with nwclientSendTag for tag is where a late subscriber can start decoding it */
+
+{
+    if ( ( h ) && ( h->history ) )
+    {
+        tagHistoryMark( h->history, tag );
+    }
+}
+// ====================================================================================================
+void nwclientSendFiltered( struct nwclientsHandle *h, uint32_t len, const uint8_t *ipbuffer, nwclientFilter filter, void *param )
+
+/* Queue data that's made of many separately tagged items. Clients that haven't subscribed get all */
+/* of it, and the rest get whatever filter leaves of it given their subscription. That keeps every */
+/* client's items in the order they were sent, which a copy per tag wouldn't.                     */
+
+{
+    struct clientSet *cs;
+    uint64_t now;
+    unsigned int e;
+    uint32_t flen;
+
+    if ( !h || !atomic_load_explicit( &h->clients, memory_order_relaxed ) || !len )
+    {
+        return;
+    }
+
+    if ( !atomic_load_explicit( &h->subscribers, memory_order_relaxed ) )
+    {
+        nwclientSend( h, len, ipbuffer );
+        return;
+    }
+
+    /* Only the producer ever uses this, so it can be kept between calls */
+    if ( h->filterLen < len )
+    {
+        h->filterBuf = ( uint8_t * )realloc( h->filterBuf, len );
+        MEMCHECKV( h->filterBuf );
+        h->filterLen = len;
+    }
+
+    e = _readEnter( h );
+    cs = atomic_load( &h->clients );
+    now = genericsMonotonicnS();
+
+    for ( int i = 0; cs && ( i < cs->n ); i++ )
+    {
+        struct nwClient *n = cs->c[i];
+
+        if ( atomic_load_explicit( &n->dead, memory_order_relaxed ) )
+        {
+            continue;
+        }
+
+        if ( !atomic_load_explicit( &n->subscribed, memory_order_acquire ) )
+        {
+            _queueCopy( n, len, ipbuffer, now );
+        }
+        else if ( ( flen = filter( _subOf( n ), ipbuffer, len, h->filterBuf, param ) ) )
+        {
+            _queueCopy( n, flen, h->filterBuf, now );
+        }
+    }
+
+    _readExit( h, e );
+    _wakeReactor();
+}
+// ====================================================================================================
+int nwclientSubscribers( struct nwclientsHandle *h )
+
+/* Number of clients that have subscribed to specific tags, and so need nwclientSendTag */
+
+{
+    return h ? atomic_load_explicit( &h->subscribers, memory_order_relaxed ) : 0;
+}
+// ====================================================================================================
+int nwclientConnected( struct nwclientsHandle *h )
+
+/* Number of clients on this port at all, so the caller can skip making what nobody would get */
+
+{
+    return h ? atomic_load_explicit( &h->connected, memory_order_relaxed ) : 0;
+}
+// ====================================================================================================
+struct latencyHist *nwclientSendLatency( struct nwclientsHandle *h )
+
+/* Histogram of how long data spent queued before being written out to clients */
+
+{
+    return &h->sendLatency;
+}
+// ====================================================================================================
+bool nwclientSenderThread( pthread_t *t )
+
+/* The thread that sends to every client of every port, if it's been started yet */
+
+{
+    bool running;
+
+    pthread_mutex_lock( &_reactor.lock );
+    running = _reactor.running;
+    *t = _reactor.thread;
+    pthread_mutex_unlock( &_reactor.lock );
+
+    return running;
+}
+// ====================================================================================================
+int nwclientClientStats( struct nwclientsHandle *h, struct nwclientStats *s, int max )
+
+/* Snapshot of up to max connected clients, returning how many there were. Values belonging to the */
+/* sender are read as they are, so may be a moment out of date.                                    */
+
+{
+    struct clientSet *cs;
+    uint64_t compression, spill;
+    unsigned int e;
+    int n = 0;
+
+    if ( !h )
+    {
+        return 0;
+    }
+
+    e = _readEnter( h );
+    cs = atomic_load( &h->clients );
+
+    for ( int i = 0; cs && ( i < cs->n ) && ( n < max ); i++ )
+    {
+        struct nwClient *c = cs->c[i];
+
+        if ( atomic_load_explicit( &c->dead, memory_order_relaxed ) )
+        {
+            continue;
+        }
+
+        s[n].fd          = c->fdNo;
+        s[n].queuedItems = atomic_load_explicit( &c->qwp, memory_order_relaxed ) - atomic_load_explicit( &c->qrp, memory_order_relaxed );
+        s[n].queuedBytes = atomic_load_explicit( &c->wp, memory_order_relaxed ) - atomic_load_explicit( &c->rp, memory_order_relaxed );
+        s[n].borrowed    = atomic_load_explicit( &c->borrowed, memory_order_relaxed );
+        s[n].dropped     = atomic_load_explicit( &c->dropped, memory_order_relaxed );
+        s[n].sentBytes   = c->sentBytes;
+        s[n].compressed  = ( c->z != NULL );
+        s[n].subscribed  = atomic_load_explicit( &c->subscribed, memory_order_relaxed );
+        s[n].qos         = c->qos;
+        s[n].spilledBytes = atomic_load_explicit( &c->spillWp, memory_order_relaxed ) - atomic_load_explicit( &c->spillRp, memory_order_relaxed );
+        s[n].memBytes    = _clientMemory( c, &compression, &spill );
+        s[n].narrowed    = atomic_load_explicit( &c->narrowed, memory_order_relaxed );
+        n++;
+    }
+
+    _readExit( h, e );
+    return n;
+}
+// ====================================================================================================
+void nwclientSetSpill( struct nwclientsHandle *h, const char *dir, uint64_t maxBytes )
+
+/* Let bulk clients arriving from now on overflow into up to maxBytes each, rather than lose data when */
+/* they fall behind. The spill is a file in dir, or just memory if that's NULL. A maxBytes of 0 stops   */
+/* them spilling at all.                                                                                */
+
+{
+    char *d = ( dir ) ? strdup( dir ) : NULL;
+
+    if ( !h )
+    {
+        free( d );
+        return;
+    }
+
+    /* The reactor only looks at these while it's holding the lock */
+    pthread_mutex_lock( &_reactor.lock );
+    free( h->spillDir );
+    h->spillDir = d;
+    h->spillMax = maxBytes;
+    pthread_mutex_unlock( &_reactor.lock );
+}
+// ====================================================================================================
+void nwclientSetHistory( struct nwclientsHandle *h, size_t maxBytes, uint32_t maxmS )
+
+/* Keep up to maxBytes (and maxmS, if that's set) of what's sent with nwclientSendTag, to replay each */
+/* client that subscribes before it sees anything live. This is to be done before anything is sent.  */
+
+{
+    if ( ( h ) && ( maxBytes ) && ( !h->history ) )
+    {
+        h->history = tagHistoryCreate( maxBytes, maxmS );
+    }
+}
+// ====================================================================================================
+void nwclientSetBudget( uint64_t maxBytes, enum nwShed policy )
+
+/* Keep what's held on behalf of the clients of every port to maxBytes (0 for no limit), doing what */
+/* policy says once it gets near. New clients, compression and history replays are refused if     */
+/* there isn't room for them, and spills in memory stop growing at the limit whatever the policy.  */
+
+{
+    pthread_mutex_lock( &_reactor.lock );
+    _budget.max = maxBytes;
+    _budget.policy = policy;
+    pthread_mutex_unlock( &_reactor.lock );
+}
+// ====================================================================================================
+void nwclientSetLendLimit( int maxBlocks )
+
+/* Lend no more than maxBlocks (0 for no limit) to the clients of every port at once. Whoever owns */
+/* the blocks then always has the rest to hand, whatever the clients are doing.                    */
+
+{
+    _budget.maxLent = maxBlocks;
+}
+// ====================================================================================================
+void nwclientMemoryStats( struct nwclientMemory *m )
+
+/* What's held on behalf of clients, and what's been done to keep it to the budget, as last counted */
+
+{
+    pthread_mutex_lock( &_reactor.lock );
+    *m = _budget.count;
+    m->budget = _budget.max;
+    pthread_mutex_unlock( &_reactor.lock );
+
+    m->refused = atomic_load_explicit( &_budget.refused, memory_order_relaxed );
+    m->lent = atomic_load_explicit( &_budget.lent, memory_order_relaxed );
+}
+// ====================================================================================================
+struct nwclientsHandle *nwclientStart( int port )
+
+/* Create the listening socket, and hand it to the reactor */
+
+{
+    struct sockaddr_in serv_addr;
+    int flag = 1;
+    struct nwclientsHandle *h = ( struct nwclientsHandle * )calloc( 1, sizeof( struct nwclientsHandle ) );
+    MEMCHECK( h, NULL );
+
+    h->sockfd = -1;
+
+    for ( int i = 0; i < _inherited.n; i++ )
+    {
+        if ( _inherited.l[i].port == port )
+        {
+            /* Already listening, with anyone who arrived while it was being handed over still waiting */
+            h->sockfd = _inherited.l[i].fd;
+            _inherited.l[i] = _inherited.l[--_inherited.n];
+            break;
+        }
+    }
+
+    if ( h->sockfd >= 0 )
+    {
+        if ( !_setNonBlocking( h->sockfd ) )
+        {
+            genericsReport( V_ERROR, "Error on listening" EOL );
+            goto free_and_return;
+        }
+
+        goto listening;
+    }
+
+    h->sockfd = socket( AF_INET, SOCK_STREAM, 0 );
+    setsockopt( h->sockfd, SOL_SOCKET, SO_REUSEPORT, ( const void * )&flag, sizeof( flag ) );
+
+    if ( h->sockfd < 0 )
+    {
+        genericsReport( V_ERROR, "Error opening socket" EOL );
+        goto free_and_return;
+    }
+
+    memset( ( char * ) &serv_addr, 0, sizeof( serv_addr ) );
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons( port );
+
+    if ( setsockopt( h->sockfd, SOL_SOCKET, SO_REUSEADDR, ( const void * ) &flag, sizeof( flag ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "setsockopt(SO_REUSEADDR) failed" );
+        goto free_and_return;
+    }
+
+    if ( bind( h->sockfd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Error on binding" EOL );
+        goto free_and_return;
+    }
+
+    if ( ( listen( h->sockfd, 5 ) < 0 ) || ( !_setNonBlocking( h->sockfd ) ) )
+    {
+        genericsReport( V_ERROR, "Error on listening" EOL );
+        goto free_and_return;
+    }
+
+listening:
+    /* The client list starts out empty */
+    atomic_init( &h->clients, NULL );
+    atomic_init( &h->pending, NULL );
+    atomic_init( &h->epoch, 0 );
+    atomic_init( &h->readers[0], 0 );
+    atomic_init( &h->readers[1], 0 );
+
+    atomic_init( &h->droppedBytes, 0 );
+    atomic_init( &h->subscribers, 0 );
+    atomic_init( &h->connected, 0 );
+
+    if ( _reactorAdd( h ) )
+    {
+        return h;
+    }
+
+free_and_return:
+
+    if ( h->sockfd >= 0 )
+    {
+        close( h->sockfd );
+    }
+
+    free( h );
+    return NULL;
+}
+// ====================================================================================================
+void nwclientShutdown( struct nwclientsHandle *h )
+
+{
+    struct clientSet *cs;
+    struct nwClient *c;
+
+    if ( !h )
+    {
+        return;
+    }
+
+    /* Once the reactor has let go of the port, nobody else is using the listener */
+    _reactorRemove( h );
+    close( h->sockfd );
+
+    /* Nobody may be sending by now, so everything can go...whatever state it's in */
+    cs = atomic_load( &h->clients );
+
+    for ( int i = 0; cs && ( i < cs->n ); i++ )
+    {
+        if ( !atomic_load( &cs->c[i]->dead ) )
+        {
+            _clientKill( cs->c[i] );
+        }
+
+        _clientFree( cs->c[i] );
+    }
+
+    free( cs );
+    free( h->retiredSet );
+
+    while ( ( c = h->retiredClients ) )
+    {
+        h->retiredClients = c->nextClient;
+        _clientFree( c );
+    }
+
+    while ( ( c = atomic_load( &h->pending ) ) )
+    {
+        atomic_store( &h->pending, c->nextClient );
+        _clientKill( c );
+        _clientFree( c );
+    }
+
+    free( h->spillDir );
+    free( h->filterBuf );
+    tagHistoryDelete( h->history );
+    free( h );
+}
+// ====================================================================================================
+int nwclientHandover( struct nwclientsHandle *h, uint32_t waitmS, nwclientHandoverCB cb, void *param )
+
+{
+    uint32_t start = genericsTimestampmS();
+    struct clientSet *cs;
+    struct nwClient *c;
+    bool behind = true;
+
+    /* The reactor carries on sending until everyone has had what was queued for them, or time is up */
+    while ( ( behind ) && ( genericsTimestampmS() - start < waitmS ) )
+    {
+        unsigned int e = _readEnter( h );
+        behind = false;
+        cs = atomic_load( &h->clients );
+
+        for ( int i = 0; cs && ( i < cs->n ); i++ )
+        {
+            c = cs->c[i];
+            behind |= ( !atomic_load( &c->dead ) ) && ( !c->z ) && ( !_caughtUp( c ) );
+        }
+
+        _readExit( h, e );
+
+        if ( behind )
+        {
+            usleep( REACTOR_NAP_MS * 1000 );
+        }
+    }
+
+    /* Once the reactor has let go of the port its clients are ours, including anyone not in the set yet */
+    _reactorRemove( h );
+    cs = atomic_load( &h->clients );
+
+    for ( int i = 0; cs && ( i < cs->n ); i++ )
+    {
+        _handOver( cs->c[i], cb, param );
+    }
+
+    for ( c = atomic_load( &h->pending ); c; c = c->nextClient )
+    {
+        _handOver( c, cb, param );
+    }
+
+    return h->sockfd;
+}
+// ====================================================================================================
+void nwclientInheritListener( int port, int fd )
+
+{
+    void *l = realloc( _inherited.l, ( _inherited.n + 1 ) * sizeof( *_inherited.l ) );
+    MEMCHECKV( l );
+
+    _inherited.l = l;
+    _inherited.l[_inherited.n].port = port;
+    _inherited.l[_inherited.n].fd = fd;
+    _inherited.n++;
+}
+// ====================================================================================================
+bool nwclientAdopt( struct nwclientsHandle *h, const struct nwclientHandover *ho )
+
+/* Carry on as if this client had been here all along, except that it's had its history already */
+
+{
+    struct nwClient *c;
+
+    if ( !_budgetRoom( CLIENT_RING_SIZE ) )
+    {
+        genericsReport( V_WARN, "Connection index %d not taken over, memory budget is used up" EOL, ho->fd );
+        close( ho->fd );
+        return false;
+    }
+
+    if ( !( c = _clientCreate( h, ho->fd ) ) )
+    {
+        return false;
+    }
+
+    c->connectTime = genericsTimestampmS();
+    c->reqSettled  = ho->settled;
+    c->sentBytes   = ho->sentBytes;
+    c->reqLen      = ( ho->reqLen <= sizeof( c->req ) ) ? ho->reqLen : 0;
+    memcpy( c->req, ho->req, c->reqLen );
+
+    if ( ho->subscribed )
+    {
+        c->sub = ho->sub;
+        atomic_store_explicit( &c->subscribed, true, memory_order_release );
+        atomic_fetch_add_explicit( &h->subscribers, 1, memory_order_relaxed );
+    }
+
+    if ( ho->qos != NW_QOS_DEFAULT )
+    {
+        _setQoS( c, ho->qos );
+    }
+
+    genericsReport( V_INFO, "Took over connection index %d" EOL, ho->fd );
+    _clientPend( h, c );
+    _wakeReactor();
+    return true;
+}
+// ====================================================================================================
+uint64_t nwclientDroppedBytes( struct nwclientsHandle *h )
+
+/* Total data dropped on this port because clients were not keeping up */
+
+{
+    return h ? atomic_load_explicit( &h->droppedBytes, memory_order_relaxed ) : 0;
 }
 // ====================================================================================================
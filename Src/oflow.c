@@ -13,6 +13,8 @@
 #include <time.h>
 #include "cobs.h"
 #include "oflow.h"
+#include "simd.h"
+#include "orbProbes.h"
 
 // ====================================================================================================
 struct OFLOW *OFLOWInit( struct OFLOW *t )
@@ -28,10 +30,18 @@ struct OFLOW *OFLOWInit( struct OFLOW *t )
 
     /* Initialise the containing COBS instance */
     COBSInit( &t->c );
+    t->stamped = false;
 
     return t;
 }
 // ====================================================================================================
+void OFLOWRegisterStats( struct OFLOW *t, struct statsRegistry *r, const char *prefix, const char *labels )
+
+{
+    statsRegistryAdd( r, prefix, "oflow_cobs_errors_total", "COBS framing errors in ORBFLOW", labels, STAT_COUNTER, &t->c.error );
+    statsRegistryAdd( r, prefix, "oflow_frame_errors_total", "Bad ORBFLOW frames", labels, STAT_COUNTER, &t->perror );
+}
+// ====================================================================================================
 void OFLOWDelete( struct OFLOW *t )
 
 /* Destroy a OFLOW instance, but only if we created it */
@@ -49,26 +59,114 @@ void OFLOWDelete( struct OFLOW *t )
 
 // ====================================================================================================
 
+void OFLOWEncStart( struct OFLOWEnc *e, uint8_t tag, uint8_t *out )
+
+/* Start encoding a frame for tag straight into out, which needs room for OFLOW_MAX_ENC_PACKET_LEN */
+
+{
+    COBSEncStart( &e->c, out );
+    COBSEncAdd( &e->c, &tag, 1 );
+    e->sum = tag;
+}
+// ====================================================================================================
+void OFLOWEncAdd( struct OFLOWEnc *e, const uint8_t *d, int len )
+
+/* Add payload to the frame, up to OFLOW_MAX_PACKET_LEN altogether */
+
+{
+    e->sum += SIMDKernels()->sumBytes( d, len );
+    COBSEncAdd( &e->c, d, len );
+}
+// ====================================================================================================
+int OFLOWEncEnd( struct OFLOWEnc *e )
+
+/* Add the checksum, making everything sum to 0, and finish the frame. Returns its encoded length */
+
+{
+    uint8_t backMatter = 256 - e->sum;
+
+    COBSEncAdd( &e->c, &backMatter, 1 );
+    return COBSEncEnd( &e->c );
+}
+// ====================================================================================================
 void OFLOWEncode( const uint8_t channel, const uint64_t tstamp, const uint8_t *inputMsg, int len, struct Frame *o )
 
 /* Encode frame and write into provided output Frame buffer */
 
 {
-    const uint8_t frontMatter[1] = { channel };
-    uint8_t sum = channel;
+    struct OFLOWEnc e;
+
+    OFLOWEncStart( &e, channel, o->d );
+    OFLOWEncAdd( &e, inputMsg, len );
+    o->len = OFLOWEncEnd( &e );
+}
+// ====================================================================================================
+int OFLOWEncodeTime( uint64_t tstamp, uint8_t *out )
 
-    /* Calculate packet sum for last byte */
-    for ( int i = 0; i < len; i++ )
+/* Encode a time frame into out, which needs room for OFLOW_TIME_ENC_LEN. Returns its length */
+
+{
+    struct OFLOWEnc e;
+    uint8_t t[OFLOW_TIME_LEN];
+
+    for ( int i = 0; i < OFLOW_TIME_LEN; i++ )
     {
-        sum += inputMsg[i];
+        t[i] = tstamp >> ( 8 * i );
     }
 
-    /* Ensure total sums to 0 */
-    uint8_t backMatter[1] = { 256 - sum };
+    OFLOWEncStart( &e, OFLOW_TIME_TAG, out );
+    OFLOWEncAdd( &e, t, OFLOW_TIME_LEN );
+    return OFLOWEncEnd( &e );
+}
+// ====================================================================================================
+void OFLOWCoalesceInit( struct OFLOWCoalesce *c, uint8_t tag )
 
-    COBSEncode( frontMatter, 1, backMatter, 1, inputMsg, len, o );
+{
+    c->tag = tag;
+    c->len = 0;
 }
+// ====================================================================================================
+void OFLOWCoalesceFlush( struct OFLOWCoalesce *c, OFLOWFrameCB frameOut, void *param )
+
+/* Send whatever is held as a frame of its own */
 
+{
+    if ( c->len )
+    {
+        c->len = 0;
+        frameOut( c->tag, c->heldSince, c->d, OFLOWEncEnd( &c->e ), param );
+    }
+}
+// ====================================================================================================
+void OFLOWCoalesceAdd( struct OFLOWCoalesce *c, const uint8_t *d, int len, uint64_t now, OFLOWFrameCB frameOut, void *param )
+
+/* Add payload to what's held, sending a frame each time there's enough to fill one. It's up to the */
+/* caller to decide when what's left over has waited long enough, and flush it. The payload is      */
+/* encoded as it arrives, so there's no copy of it held as well as the frame it's going in.          */
+
+{
+    int n;
+
+    while ( len )
+    {
+        if ( !c->len )
+        {
+            OFLOWEncStart( &c->e, c->tag, c->d );
+            c->heldSince = now;
+        }
+
+        n = ( len < ( int )( OFLOW_MAX_PACKET_LEN - c->len ) ) ? len : ( int )( OFLOW_MAX_PACKET_LEN - c->len );
+        OFLOWEncAdd( &c->e, d, n );
+        c->len += n;
+        d += n;
+        len -= n;
+
+        if ( c->len == OFLOW_MAX_PACKET_LEN )
+        {
+            OFLOWCoalesceFlush( c, frameOut, param );
+        }
+    }
+}
 // ====================================================================================================
 
 bool OFLOWisEOFRAME( const uint8_t *inputEnc )
@@ -78,40 +176,86 @@ bool OFLOWisEOFRAME( const uint8_t *inputEnc )
 }
 
 // ====================================================================================================
-static void _pumpcb( struct Frame *p, void *param )
+static void _frameRxed( struct OFLOW *t, uint8_t *d, int len )
 
-{
-    /* Callback function when a COBS packet is complete */
-    struct OFLOW *t = ( struct OFLOW * )param;
+/* A COBS packet is complete, wherever it happens to be, so check it and pass it on */
 
-    if ( p->len < 2 )
+{
+    if ( len < 2 )
     {
-        t->perror++;
+        STAT_INC( t->perror );
+        ORB_PROBE( liborb, oflow_bad_frame, 0, len );
     }
     else
     {
-        t->f.len  = p->len - 2;       /* OFLOW frames have the first element representing the tag and last element the checksum */
-        t->f.tag  = p->d[0];          /* First byte of an OFLOW frame is the tag */
-        t->f.sum  = p->d[p->len - 1]; /* Last byte of an OFLOW frame is the sum */
-        t->f.d    = &p->d[1];         /* This is the rest of the data */
+        t->f.len  = len - 2;          /* OFLOW frames have the first element representing the tag and last element the checksum */
+        t->f.tag  = d[0];             /* First byte of an OFLOW frame is the tag */
+        t->f.sum  = d[len - 1];       /* Last byte of an OFLOW frame is the sum */
+        t->f.d    = &d[1];            /* This is the rest of the data */
+
+        /* The whole frame, tag and sum included, adds up to zero if it's good. It's just been decoded, */
+        /* so it's still in the cache.                                                                */
+        t->f.good = ( SIMDKernels()->sumBytes( d, len ) == 0 );
+        STAT_ADD( t->perror, !( t->f.good ) );
 
-        /* Calculate received packet sum and insert good status into packet */
-        uint8_t sum  = t->f.tag;
+        if ( !t->f.good )
+        {
+            ORB_PROBE( liborb, oflow_bad_frame, t->f.tag, len );
+        }
 
-        for ( int i = 0; i < t->f.len; i++ )
+        if ( ( t->f.good ) && ( OFLOW_TIME_TAG == t->f.tag ) && ( OFLOW_TIME_LEN == t->f.len ) )
         {
-            sum += t->f.d[i];
+            /* This frame and the ones after it get the time it carries */
+            t->stamp = 0;
+
+            for ( int i = OFLOW_TIME_LEN - 1; i >= 0; i-- )
+            {
+                t->stamp = ( t->stamp << 8 ) | t->f.d[i];
+            }
+
+            t->stamped = true;
         }
 
-        sum += t->f.sum;
-        t->f.good = ( sum == 0 );
-        t->perror += !( t->f.good );
+        /* Otherwise the timestamp was already set for this cluster */
+        if ( t->stamped )
+        {
+            t->f.tstamp = t->stamp;
+            t->f.stamped = true;
+        }
 
-        /* Timestamp was already set for this cluster */
         ( t->cb )( &t->f, t->param );
     }
 }
+// ====================================================================================================
+static void _pumpcb( struct Frame *p, void *param )
+
+{
+    /* Callback function when a COBS packet is complete */
+    _frameRxed( ( struct OFLOW * )param, p->d, p->len );
+}
+// ====================================================================================================
+static void _pumpInPlacecb( uint8_t *d, int len, void *param )
+
+{
+    /* Callback function when a COBS packet is complete, either in place or in the COBS instance */
+    _frameRxed( ( struct OFLOW * )param, d, len );
+}
+// ====================================================================================================
+static void _setupPump( struct OFLOW *t, void ( *packetRxed )( struct OFLOWFrame *p, void *param ), void *param )
 
+{
+    struct timespec ts;
+    t->cb = packetRxed;
+    t->param = param;
+
+    if ( !t->stamped )
+    {
+        /* Nothing upstream is stamping the frames, so fake the timestamp */
+        clock_gettime( CLOCK_REALTIME, &ts );
+        t->f.tstamp = ts.tv_sec * OFLOW_TS_RESOLUTION + ts.tv_nsec;
+    }
+}
+// ====================================================================================================
 void OFLOWPump( struct OFLOW *t, const uint8_t *incoming, int len,
                 void ( *packetRxed )( struct OFLOWFrame *p, void *param ),
                 void *param )
@@ -120,13 +264,22 @@ void OFLOWPump( struct OFLOW *t, const uint8_t *incoming, int len,
 /* Assemble this packet into a complete frame and call back */
 
 {
-    struct timespec ts;
-    t->cb = packetRxed;
-    clock_gettime( CLOCK_REALTIME, &ts );
-    t->f.tstamp = ts.tv_sec * OFLOW_TS_RESOLUTION + ts.tv_nsec; /* For now, fake the timestamp */
-    t->param = param;
+    _setupPump( t, packetRxed, param );
     COBSPump( &t->c, incoming, len, _pumpcb, t );
 }
+// ====================================================================================================
+void OFLOWPumpInPlace( struct OFLOW *t, uint8_t *incoming, int len,
+                       void ( *packetRxed )( struct OFLOWFrame *p, void *param ),
+                       void *param )
+
+
+/* As OFLOWPump, but frames are decoded in place in incoming where possible, so the frame handed */
+/* to the callback may point into it. Only use this if incoming isn't needed afterwards.         */
+
+{
+    _setupPump( t, packetRxed, param );
+    COBSPumpInPlace( &t->c, incoming, len, _pumpInPlacecb, t );
+}
 
 // ====================================================================================================
 
@@ -0,0 +1,321 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * ORBFLOW Merge Module
+ * ====================
+ *
+ * Each stream has its own decoder and a queue of the frames that have come out of it but
+ * can't be released yet. Frames from any one stream are already in order, so the merge only
+ * ever has to look at the head of each queue.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "generics.h"
+#include "oflowMerge.h"
+
+/* A frame waiting in a queue. The data follows, and the next record starts 8 byte aligned after it */
+struct record
+{
+    uint64_t tstamp;
+    uint32_t len;                                  /* Length of the data, or RECORD_WRAP */
+    uint8_t tag;
+    bool stamped;
+};
+
+#define RECORD_WRAP  (0xffffffff)                  /* Rest of the queue is unused, carry on from the start */
+#define RECORD_ALIGN (8)
+#define RECORD_SIZE(n) ((sizeof(struct record)+(n)+RECORD_ALIGN-1)&~(size_t)(RECORD_ALIGN-1))
+
+struct mergeStream
+{
+    struct OFLOW o;                                /* Decoder for this stream */
+    uint8_t *q;                                    /* Records waiting to be released */
+    size_t wp;                                     /* Free running write offset into q */
+    size_t rp;                                     /* ...and read offset */
+    uint32_t count;                                /* Number of records waiting */
+    bool seen;                                     /* Anything has been heard from this stream */
+    uint64_t watermark;                            /* Latest time it's said, nothing earlier can follow */
+};
+
+struct OFLOWMerge
+{
+    int n;                                         /* Number of streams */
+    size_t qlen;                                   /* Size of each stream's queue (a multiple of RECORD_ALIGN) */
+    struct mergeStream *s;
+    int pumping;                                   /* Stream being decoded at the moment */
+
+    uint64_t forced;                               /* Frames released before every stream had caught up */
+    uint64_t errors;                               /* Bad frames thrown away */
+
+    OFLOWMergeCB cb;
+    void *param;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static struct record *_head( struct OFLOWMerge *m, struct mergeStream *s )
+
+/* The oldest record waiting on s, moving past the end of the queue if that's where it is */
+
+{
+    struct record *r;
+    size_t ofs = s->rp % m->qlen;
+
+    if ( !s->count )
+    {
+        return NULL;
+    }
+
+    if ( m->qlen - ofs >= sizeof( struct record ) )
+    {
+        r = ( struct record * )&s->q[ofs];
+
+        if ( r->len != RECORD_WRAP )
+        {
+            return r;
+        }
+    }
+
+    s->rp += m->qlen - ofs;
+    return ( struct record * )s->q;
+}
+// ====================================================================================================
+static bool _releaseOne( struct OFLOWMerge *m, bool force, uint64_t upTo )
+
+/* Send on the earliest frame waiting, if it's safe to (or if forced, and it's no later than upTo) */
+
+{
+    struct mergeStream *best = NULL;
+    struct record *r, *bestr = NULL;
+    struct OFLOWFrame f;
+
+    for ( int i = 0; i < m->n; i++ )
+    {
+        if ( ( r = _head( m, &m->s[i] ) ) && ( ( !bestr ) || ( r->tstamp < bestr->tstamp ) ) )
+        {
+            best = &m->s[i];
+            bestr = r;
+        }
+    }
+
+    if ( !bestr )
+    {
+        return false;
+    }
+
+    if ( force )
+    {
+        if ( bestr->tstamp > upTo )
+        {
+            return false;
+        }
+    }
+    else
+    {
+        /* Any stream with nothing waiting must already have got past this, or it could yet turn up earlier */
+        for ( int i = 0; i < m->n; i++ )
+        {
+            if ( ( !m->s[i].count ) && ( ( !m->s[i].seen ) || ( m->s[i].watermark < bestr->tstamp ) ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    f.len     = bestr->len;
+    f.tag     = bestr->tag;
+    f.sum     = 0;
+    f.good    = true;
+    f.stamped = bestr->stamped;
+    f.tstamp  = bestr->tstamp;
+    f.d       = ( uint8_t * )( bestr + 1 );
+
+    /* Let go of it before the callback, in case that looks at the queues */
+    best->rp += RECORD_SIZE( bestr->len );
+    best->count--;
+    m->cb( best - m->s, &f, m->param );
+    return true;
+}
+// ====================================================================================================
+static bool _room( struct OFLOWMerge *m, struct mergeStream *s, size_t need )
+
+/* Make sure there's room for a record of need bytes on s, wrapping round if need be */
+
+{
+    size_t ofs = s->wp % m->qlen;
+    size_t tail = m->qlen - ofs;
+    size_t used = s->wp - s->rp;
+
+    if ( tail < need )
+    {
+        /* Won't fit before the end, so the rest of the queue is skipped */
+        if ( m->qlen - used < tail + need )
+        {
+            return false;
+        }
+
+        if ( tail >= sizeof( struct record ) )
+        {
+            ( ( struct record * )&s->q[ofs] )->len = RECORD_WRAP;
+        }
+
+        s->wp += tail;
+
+        /* The skipped part only counts against the queue if something is in it, otherwise start afresh */
+        if ( !s->count )
+        {
+            s->rp = s->wp;
+        }
+
+        return true;
+    }
+
+    return m->qlen - used >= need;
+}
+// ====================================================================================================
+static void _frameRxed( struct OFLOWFrame *p, void *param )
+
+{
+    struct OFLOWMerge *m = ( struct OFLOWMerge * )param;
+    struct mergeStream *s = &m->s[m->pumping];
+    size_t need = RECORD_SIZE( p->len );
+    struct record *r;
+
+    if ( !p->good )
+    {
+        m->errors++;
+        return;
+    }
+
+    if ( ( !s->seen ) || ( p->tstamp > s->watermark ) )
+    {
+        s->watermark = p->tstamp;
+    }
+
+    s->seen = true;
+
+    if ( p->tag == OFLOW_TIME_TAG )
+    {
+        /* Nothing to pass on, but the stream has moved on in time */
+        return;
+    }
+
+    while ( !_room( m, s, need ) )
+    {
+        /* This stream is too far ahead of the others, so something has to go now */
+        if ( !_releaseOne( m, true, UINT64_MAX ) )
+        {
+            m->errors++;
+            return;
+        }
+
+        m->forced++;
+    }
+
+    r = ( struct record * )&s->q[s->wp % m->qlen];
+    r->tstamp  = p->tstamp;
+    r->len     = p->len;
+    r->tag     = p->tag;
+    r->stamped = p->stamped;
+    memcpy( r + 1, p->d, p->len );
+    s->wp += need;
+    s->count++;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct OFLOWMerge *OFLOWMergeCreate( int nstreams, size_t queueBytes, OFLOWMergeCB cb, void *param )
+
+/* Create a merge of nstreams ORBFLOW streams, each of which may have up to queueBytes waiting */
+
+{
+    struct OFLOWMerge *m = ( struct OFLOWMerge * )calloc( 1, sizeof( struct OFLOWMerge ) );
+    MEMCHECK( m, NULL );
+
+    /* Each queue must hold at least one frame of the largest size */
+    queueBytes = ( queueBytes < 2 * RECORD_SIZE( OFLOW_MAX_PACKET_LEN ) ) ? 2 * RECORD_SIZE( OFLOW_MAX_PACKET_LEN ) : queueBytes;
+    m->qlen = queueBytes & ~( size_t )( RECORD_ALIGN - 1 );
+    m->n = nstreams;
+    m->cb = cb;
+    m->param = param;
+    m->s = ( struct mergeStream * )calloc( nstreams, sizeof( struct mergeStream ) );
+    MEMCHECK( m->s, NULL );
+
+    for ( int i = 0; i < nstreams; i++ )
+    {
+        OFLOWInit( &m->s[i].o );
+        m->s[i].q = ( uint8_t * )malloc( m->qlen );
+        MEMCHECK( m->s[i].q, NULL );
+    }
+
+    return m;
+}
+// ====================================================================================================
+void OFLOWMergePump( struct OFLOWMerge *m, int stream, const uint8_t *d, int len )
+
+/* Feed data that arrived on stream, and send on anything that's now known to be next */
+
+{
+    if ( ( stream >= 0 ) && ( stream < m->n ) )
+    {
+        m->pumping = stream;
+        OFLOWPump( &m->s[stream].o, d, len, _frameRxed, m );
+
+        while ( _releaseOne( m, false, 0 ) );
+    }
+}
+// ====================================================================================================
+void OFLOWMergeRelease( struct OFLOWMerge *m, uint64_t before )
+
+/* Send on everything stamped before this, whether or not every stream has caught up with it */
+
+{
+    while ( _releaseOne( m, false, 0 ) || ( ( before ) && _releaseOne( m, true, before - 1 ) ) );
+}
+// ====================================================================================================
+void OFLOWMergeFlush( struct OFLOWMerge *m )
+
+/* Send on everything that's waiting, in as good an order as there is */
+
+{
+    while ( _releaseOne( m, true, UINT64_MAX ) );
+}
+// ====================================================================================================
+uint64_t OFLOWMergeForced( struct OFLOWMerge *m )
+
+{
+    return m->forced;
+}
+// ====================================================================================================
+uint64_t OFLOWMergeErrors( struct OFLOWMerge *m )
+
+{
+    return m->errors;
+}
+// ====================================================================================================
+void OFLOWMergeDelete( struct OFLOWMerge *m )
+
+{
+    if ( m )
+    {
+        for ( int i = 0; i < m->n; i++ )
+        {
+            OFLOWDelete( &m->s[i].o );
+            free( m->s[i].q );
+        }
+
+        free( m->s );
+        free( m );
+    }
+}
+// ====================================================================================================
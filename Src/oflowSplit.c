@@ -0,0 +1,452 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * ORBFLOW Split Module
+ * ====================
+ *
+ * Chunk k owns the frames that start in the k'th chunkBytes of the file, where a frame starts
+ * either at the beginning or just after a zero. Its decoder skips whatever comes before the first
+ * of those and carries on past the end of the chunk to finish the last, so every frame is decoded
+ * exactly once, by whichever chunk it starts in.
+ *
+ * Only so many chunks are decoded ahead of the one being handed out, and each chunk's buffers are
+ * used again by the one that many after it, so memory use doesn't depend on the size of the file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "generics.h"
+#include "nw.h"
+#include "stream.h"
+#include "oflowSplit.h"
+
+/* Chunks decoded or waiting to be handed out, for each thread */
+#define CHUNKS_PER_THREAD (2)
+
+/* Room first made for a tag's frames in a chunk, it grows from there as needed */
+#define TAG_START_LEN     (64*1024)
+#define TAG_START_FRAMES  (1024)
+
+/* What one chunk found for one tag */
+struct splitTag
+{
+    uint8_t *d;                                    /* The payloads, back to back */
+    size_t len;                                    /* ...how much there is */
+    size_t size;                                   /* ...and room for */
+    struct OFLOWSpanFrame *f;                      /* Each frame */
+    uint32_t n;                                    /* ...how many there are */
+    uint32_t max;                                  /* ...and room for */
+};
+
+struct splitChunk
+{
+    bool done;                                     /* Decoded and waiting to be handed out (under lock) */
+    bool ok;                                       /* ...and all of it could be read */
+    bool stamped;                                  /* A time frame was found in it... */
+    uint64_t stamp;                                /* ...and the last one said this */
+    uint64_t errors;                               /* Bad frames found in it */
+    struct splitTag *t;                            /* What was found, for each tag wanted */
+};
+
+struct OFLOWSplit
+{
+    char *file;
+    uint64_t start;                                /* Where decoding starts in the file */
+    uint64_t size;                                 /* ...and where the file ends */
+    uint64_t chunk;                                /* Size of each chunk */
+    uint64_t nchunks;                              /* ...and how many there are */
+
+    int ntags;                                     /* Number of tags wanted */
+    uint8_t tag[NW_NUM_TAGS];                      /* ...which they are, in order */
+    int16_t slot[NW_NUM_TAGS];                     /* ...and where each is in a chunk, -1 if not wanted */
+
+    int nthreads;
+    pthread_t *thread;
+    struct splitChunk *c;                          /* Chunks on the go, chunk k being in c[k % inflight] */
+    int inflight;
+
+    pthread_mutex_t l;
+    pthread_cond_t cv;
+    uint64_t next;                                 /* Next chunk to be decoded (under lock) */
+    uint64_t delivered;                            /* Chunks handed out so far (under lock) */
+    bool stop;                                     /* Set when the workers are to finish (under lock) */
+
+    uint64_t errors;
+};
+
+/* What the decoder callback needs to know */
+struct chunkWork
+{
+    struct OFLOWSplit *s;
+    struct splitChunk *c;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _frameRxed( struct OFLOWFrame *p, void *param )
+
+/* Keep a frame, if it's good and for a tag that's wanted */
+
+{
+    struct chunkWork *w = ( struct chunkWork * )param;
+    struct splitTag *t;
+    int i;
+
+    if ( ( !p->good ) || ( ( i = w->s->slot[p->tag] ) < 0 ) )
+    {
+        return;
+    }
+
+    t = &w->c->t[i];
+
+    if ( t->len + p->len > t->size )
+    {
+        while ( t->len + p->len > t->size )
+        {
+            t->size = ( t->size ) ? t->size * 2 : TAG_START_LEN;
+        }
+
+        t->d = ( uint8_t * )realloc( t->d, t->size );
+        MEMCHECKV( t->d );
+    }
+
+    if ( t->n == t->max )
+    {
+        t->max = ( t->max ) ? t->max * 2 : TAG_START_FRAMES;
+        t->f = ( struct OFLOWSpanFrame * )realloc( t->f, t->max * sizeof( struct OFLOWSpanFrame ) );
+        MEMCHECKV( t->f );
+    }
+
+    memcpy( &t->d[t->len], p->d, p->len );
+    t->len += p->len;
+    t->f[t->n].len = p->len;
+    t->f[t->n].stamped = p->stamped;
+    t->f[t->n].tstamp = ( p->stamped ) ? p->tstamp : 0;
+    t->n++;
+}
+// ====================================================================================================
+static void _decodeChunk( struct OFLOWSplit *s, struct splitChunk *c, uint64_t k )
+
+/* Decode the frames that start in chunk k. Apart from the first, each chunk is opened a byte early */
+/* so it can tell if a frame starts right at the beginning of it.                                   */
+
+{
+    uint64_t from = s->start + k * s->chunk;
+    uint64_t to = ( from + s->chunk < s->size ) ? from + s->chunk : s->size;
+    uint64_t ofs = ( k ) ? from - 1 : from;
+    struct Stream *stream = streamCreateMappedFileAt( s->file, ofs );
+    struct OFLOW *o = ( struct OFLOW * )calloc( 1, sizeof( struct OFLOW ) );
+    struct chunkWork w = { .s = s, .c = c };
+    uint8_t *cbw = ( uint8_t * )malloc( TRANSFER_SIZE );
+    bool inFrame = ( !k ), done = false;
+    const uint8_t *d, *e;
+    size_t len, l;
+
+    MEMCHECKV( o );
+    MEMCHECKV( cbw );
+    OFLOWInit( o );
+    c->ok = ( stream != NULL );
+
+    while ( ( stream ) && ( !done ) )
+    {
+        struct timeval tv = { .tv_sec = 0 };
+        enum ReceiveResult rr = streamAcquire( stream, cbw, TRANSFER_SIZE, ( const void ** )&d, &tv, &len );
+
+        if ( rr == RECEIVE_RESULT_ERROR )
+        {
+            c->ok = false;
+            break;
+        }
+
+        if ( ( rr == RECEIVE_RESULT_EOF ) || ( !len ) )
+        {
+            break;
+        }
+
+        /* Fed a frame at a time, so we know where the next one starts */
+        while ( ( len ) && ( !done ) )
+        {
+            e = ( const uint8_t * )memchr( d, COBS_SYNC_CHAR, len );
+            l = ( e ) ? ( size_t )( e - d ) + 1 : len;
+
+            if ( inFrame )
+            {
+                OFLOWPump( o, d, l, _frameRxed, &w );
+            }
+
+            d += l;
+            ofs += l;
+            len -= l;
+
+            if ( e )
+            {
+                /* A frame starts here, and if that's past the end of the chunk it's for the next one */
+                inFrame = true;
+                done = ( ofs >= to );
+            }
+        }
+
+        streamRelease( stream );
+    }
+
+    c->stamped = o->stamped;
+    c->stamp = o->stamp;
+    c->errors = OFLOWGetErrors( o ) + OFLOWGetCOBSErrors( o );
+
+    if ( stream )
+    {
+        stream->close( stream );
+        free( stream );
+    }
+
+    OFLOWDelete( o );
+    free( o );
+    free( cbw );
+}
+// ====================================================================================================
+static void *_splitTask( void *arg )
+
+/* Decode whichever chunk is next, as long as that's not too far ahead of the ones being handed out */
+
+{
+    struct OFLOWSplit *s = ( struct OFLOWSplit * )arg;
+    struct splitChunk *c;
+    uint64_t k;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &s->l );
+
+        while ( ( !s->stop ) && ( s->next < s->nchunks ) && ( s->next >= s->delivered + s->inflight ) )
+        {
+            pthread_cond_wait( &s->cv, &s->l );
+        }
+
+        if ( ( s->stop ) || ( s->next >= s->nchunks ) )
+        {
+            pthread_mutex_unlock( &s->l );
+            return NULL;
+        }
+
+        k = s->next++;
+        pthread_mutex_unlock( &s->l );
+
+        c = &s->c[k % s->inflight];
+        _decodeChunk( s, c, k );
+
+        pthread_mutex_lock( &s->l );
+        c->done = true;
+        pthread_cond_broadcast( &s->cv );
+        pthread_mutex_unlock( &s->l );
+    }
+}
+// ====================================================================================================
+static bool _handOut( struct OFLOWSplit *s, struct splitChunk *c, uint64_t k, bool *stamped, uint64_t *stamp, OFLOWSplitCB cb, void *param )
+
+/* Give the spans from chunk k to the caller, then empty it ready to be used again */
+
+{
+    struct OFLOWSpan span;
+    bool ok = c->ok;
+
+    s->errors += c->errors;
+
+    for ( int i = 0; ( ok ) && ( i < s->ntags ); i++ )
+    {
+        struct splitTag *t = &c->t[i];
+
+        if ( !t->n )
+        {
+            continue;
+        }
+
+        /* Frames ahead of the chunk's first time frame were stamped by one in the chunks before */
+        for ( uint32_t j = 0; ( *stamped ) && ( j < t->n ) && ( !t->f[j].stamped ); j++ )
+        {
+            t->f[j].stamped = true;
+            t->f[j].tstamp = *stamp;
+        }
+
+        span.tag = s->tag[i];
+        span.fileOfs = s->start + k * s->chunk;
+        span.d = t->d;
+        span.len = t->len;
+        span.f = t->f;
+        span.nframes = t->n;
+        ok = cb( &span, param );
+    }
+
+    if ( c->stamped )
+    {
+        *stamped = true;
+        *stamp = c->stamp;
+    }
+
+    for ( int i = 0; i < s->ntags; i++ )
+    {
+        c->t[i].len = 0;
+        c->t[i].n = 0;
+    }
+
+    return ok;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct OFLOWSplit *OFLOWSplitCreate( const char *file, uint64_t start, int threads, size_t chunkBytes, int ntags, const uint8_t *tags )
+
+{
+    bool want[NW_NUM_TAGS] = { false };
+    struct OFLOWSplit *s;
+    struct stat st;
+
+    if ( stat( file, &st ) < 0 )
+    {
+        genericsReport( V_ERROR, "Cannot read %s" EOL, file );
+        return NULL;
+    }
+
+    s = ( struct OFLOWSplit * )calloc( 1, sizeof( struct OFLOWSplit ) );
+    MEMCHECK( s, NULL );
+    s->file = strdup( file );
+    MEMCHECK( s->file, NULL );
+
+    s->start = start;
+    s->size = st.st_size;
+    s->chunk = ( chunkBytes ) ? chunkBytes : OFLOW_SPLIT_DEFAULT_CHUNK;
+    s->nchunks = ( s->size > start ) ? ( s->size - start + s->chunk - 1 ) / s->chunk : 0;
+    s->nthreads = ( threads > 0 ) ? threads : 1;
+
+    /* No tags given means all of them */
+    for ( int i = 0; i < ntags; i++ )
+    {
+        want[tags[i]] = true;
+    }
+
+    /* Spans go out in tag order, so number the slots that way */
+    for ( int i = 0; i < NW_NUM_TAGS; i++ )
+    {
+        s->slot[i] = -1;
+
+        if ( ( !ntags ) || ( want[i] ) )
+        {
+            s->slot[i] = s->ntags;
+            s->tag[s->ntags++] = i;
+        }
+    }
+
+    s->inflight = s->nthreads * CHUNKS_PER_THREAD;
+    s->c = ( struct splitChunk * )calloc( s->inflight, sizeof( struct splitChunk ) );
+    MEMCHECK( s->c, NULL );
+
+    for ( int i = 0; i < s->inflight; i++ )
+    {
+        s->c[i].t = ( struct splitTag * )calloc( s->ntags, sizeof( struct splitTag ) );
+        MEMCHECK( s->c[i].t, NULL );
+    }
+
+    s->thread = ( pthread_t * )calloc( s->nthreads, sizeof( pthread_t ) );
+    MEMCHECK( s->thread, NULL );
+    pthread_mutex_init( &s->l, NULL );
+    pthread_cond_init( &s->cv, NULL );
+    return s;
+}
+// ====================================================================================================
+bool OFLOWSplitRun( struct OFLOWSplit *s, OFLOWSplitCB cb, void *param )
+
+/* Decode the whole file, handing out the spans from each chunk in turn as soon as they're ready */
+
+{
+    bool ok = true, stamped = false;
+    uint64_t stamp = 0;
+    int started;
+
+    for ( started = 0; started < s->nthreads; started++ )
+    {
+        if ( pthread_create( &s->thread[started], NULL, _splitTask, s ) )
+        {
+            genericsReport( V_ERROR, "Failed to create split decode thread" EOL );
+            break;
+        }
+    }
+
+    for ( uint64_t k = 0; ( started ) && ( ok ) && ( k < s->nchunks ); k++ )
+    {
+        struct splitChunk *c = &s->c[k % s->inflight];
+
+        pthread_mutex_lock( &s->l );
+
+        while ( !c->done )
+        {
+            pthread_cond_wait( &s->cv, &s->l );
+        }
+
+        pthread_mutex_unlock( &s->l );
+
+        ok = _handOut( s, c, k, &stamped, &stamp, cb, param );
+
+        /* ...and its place can be taken by another */
+        pthread_mutex_lock( &s->l );
+        c->done = false;
+        s->delivered++;
+        pthread_cond_broadcast( &s->cv );
+        pthread_mutex_unlock( &s->l );
+    }
+
+    pthread_mutex_lock( &s->l );
+    s->stop = true;
+    pthread_cond_broadcast( &s->cv );
+    pthread_mutex_unlock( &s->l );
+
+    for ( int i = 0; i < started; i++ )
+    {
+        pthread_join( s->thread[i], NULL );
+    }
+
+    return ( ok ) && ( started );
+}
+// ====================================================================================================
+uint64_t OFLOWSplitErrors( struct OFLOWSplit *s )
+
+{
+    return s->errors;
+}
+// ====================================================================================================
+void OFLOWSplitDelete( struct OFLOWSplit *s )
+
+{
+    if ( !s )
+    {
+        return;
+    }
+
+    for ( int i = 0; i < s->inflight; i++ )
+    {
+        for ( int j = 0; j < s->ntags; j++ )
+        {
+            free( s->c[i].t[j].d );
+            free( s->c[i].t[j].f );
+        }
+
+        free( s->c[i].t );
+    }
+
+    pthread_mutex_destroy( &s->l );
+    pthread_cond_destroy( &s->cv );
+    free( s->c );
+    free( s->thread );
+    free( s->file );
+    free( s );
+}
+// ====================================================================================================
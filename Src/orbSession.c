@@ -0,0 +1,502 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Orbuculum Session
+ * =================
+ *
+ * One thread per session does the lot...opens the source, pulls blocks from it and takes each one
+ * apart as far as the subscribers need, using the block decoders throughout. Each subscription
+ * has decoders of its own, so two subscribers to the same tag don't upset each other.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "generics.h"
+#include "stream.h"
+#include "oflow.h"
+#include "tpiuDecoder.h"
+#include "itmDecoder.h"
+#include "orbSession.h"
+
+#define SESSION_WAIT_US      (100000L)             /* How often the session looks up to see if it should stop */
+#define SESSION_RETRY_US     (100000L)             /* ...and how long it waits before reconnecting */
+
+enum subKind { SUB_DATA, SUB_ITM, SUB_TRACE };
+
+struct orbSessionSub
+{
+    uint8_t tag;
+    enum subKind kind;
+    void *param;
+    orbSessionDataCB dataCB;
+    orbSessionMsgCB msgCB;
+    orbSessionTraceCB traceCB;
+
+    struct ITMDecoder i;                           /* Decoder for ITM subscriptions */
+    struct TRACEDecoder t;                         /* ...or for trace ones */
+};
+
+struct orbSession
+{
+    struct orbSessionSource src;                   /* Where it's all coming from, with our own copies of the names */
+    struct orbSessionSub sub[ORBSESSION_MAX_SUBS];
+    int nsub;
+
+    struct OFLOW oflow;
+    struct TPIUDecoder tpiu;
+    struct msg m[ORBSESSION_MSG_BATCH];            /* Batches being handed over */
+    struct TRACEEvent ev[ORBSESSION_EV_BATCH];
+    uint8_t buf[TRANSFER_SIZE];                    /* Received into, when the stream doesn't lend */
+
+    pthread_t thread;
+    bool started;                                  /* The thread has been made... */
+    atomic_bool running;                           /* ...and is still going */
+    atomic_bool ending;                            /* Time for it to stop */
+
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t badFrames;
+    atomic_uint connects;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _itm( struct orbSession *s, struct orbSessionSub *u, const uint8_t *d, size_t len )
+
+{
+    size_t n, used;
+
+    while ( len )
+    {
+        n = ITMPumpBlock( &u->i, d, len, s->m, ORBSESSION_MSG_BATCH, &used );
+        d += used;
+        len -= used;
+
+        if ( n )
+        {
+            u->msgCB( u->tag, s->m, n, u->param );
+        }
+    }
+}
+// ====================================================================================================
+static void _trace( struct orbSession *s, struct orbSessionSub *u, const uint8_t *d, size_t len )
+
+{
+    int n, consumed;
+
+    while ( len )
+    {
+        n = TRACEDecoderPumpEvents( &u->t, d, len, s->ev, ORBSESSION_EV_BATCH, &consumed );
+
+        if ( n )
+        {
+            u->traceCB( u->tag, s->ev, n, TRACECPUState( &u->t ), u->param );
+        }
+
+        if ( !consumed )
+        {
+            /* Only a part pair (for MTB) is left, which can't be decoded */
+            break;
+        }
+
+        d += consumed;
+        len -= consumed;
+    }
+}
+// ====================================================================================================
+static void _tagData( struct orbSession *s, uint8_t tag, const uint8_t *d, size_t len )
+
+/* Hand the data for one tag to everyone who wants it, decoded however they want it */
+
+{
+    for ( int j = 0; j < s->nsub; j++ )
+    {
+        struct orbSessionSub *u = &s->sub[j];
+
+        if ( u->tag != tag )
+        {
+            continue;
+        }
+
+        switch ( u->kind )
+        {
+            case SUB_DATA:
+                u->dataCB( tag, d, len, u->param );
+                break;
+
+            case SUB_ITM:
+                _itm( s, u, d, len );
+                break;
+
+            case SUB_TRACE:
+                _trace( s, u, d, len );
+                break;
+        }
+    }
+}
+// ====================================================================================================
+static void _spansRxed( enum TPIUPumpEvent e, const struct TPIUSpan *sp, int nspans, void *param )
+
+{
+    struct orbSession *s = ( struct orbSession * )param;
+
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        for ( ; nspans--; sp++ )
+        {
+            _tagData( s, sp->stream, sp->d, sp->len );
+        }
+    }
+}
+// ====================================================================================================
+static void _frameRxed( struct OFLOWFrame *f, void *param )
+
+{
+    struct orbSession *s = ( struct orbSession * )param;
+
+    if ( !f->good )
+    {
+        atomic_fetch_add_explicit( &s->badFrames, 1, memory_order_relaxed );
+        return;
+    }
+
+    if ( f->tag == OFLOW_TIME_TAG )
+    {
+        /* Time frames aren't data, they just stamp what follows */
+        return;
+    }
+
+    if ( ( s->src.useTPIU ) && ( f->tag == DEFAULT_ITM_STREAM ) )
+    {
+        TPIUPumpSpans( &s->tpiu, f->d, f->len, _spansRxed, s );
+    }
+    else
+    {
+        _tagData( s, f->tag, f->d, f->len );
+    }
+}
+// ====================================================================================================
+static void _process( struct orbSession *s, const uint8_t *d, size_t len )
+
+{
+    atomic_fetch_add_explicit( &s->bytes, len, memory_order_relaxed );
+
+    if ( s->src.oflow )
+    {
+        if ( d == s->buf )
+        {
+            OFLOWPumpInPlace( &s->oflow, s->buf, len, _frameRxed, s );
+        }
+        else
+        {
+            /* What's lent by the stream isn't ours to decode in place */
+            OFLOWPump( &s->oflow, d, len, _frameRxed, s );
+        }
+    }
+    else if ( s->src.useTPIU )
+    {
+        TPIUPumpSpans( &s->tpiu, d, len, _spansRxed, s );
+    }
+    else
+    {
+        _tagData( s, DEFAULT_ITM_STREAM, d, len );
+    }
+}
+// ====================================================================================================
+static struct Stream *_open( struct orbSession *s )
+
+{
+    struct Stream *stream;
+    uint8_t tags[ORBSESSION_MAX_SUBS];
+
+    if ( s->src.file )
+    {
+        return streamCreateMappedFileAt( s->src.file, 0 );
+    }
+
+    stream = streamCreateReader( streamCreateSocket( s->src.server ? s->src.server : "localhost", s->src.port ), STREAM_READER_BUFS, TRANSFER_SIZE );
+
+    if ( stream )
+    {
+        if ( s->src.oflow )
+        {
+            /* Only the tags that somebody wants, and the TPIU inside DEFAULT_ITM_STREAM if that's where they are */
+            for ( int j = 0; j < s->nsub; j++ )
+            {
+                tags[j] = ( s->src.useTPIU ) ? DEFAULT_ITM_STREAM : s->sub[j].tag;
+            }
+
+            nwSubscribe( stream, s->nsub, tags );
+        }
+
+        nwRequestQoS( stream, s->src.qos );
+    }
+
+    return stream;
+}
+// ====================================================================================================
+static bool _feed( struct orbSession *s, struct Stream *stream )
+
+/* Decode from stream until it ends, returning true if that's the end of the session */
+
+{
+    struct timeval t;
+    const uint8_t *d;
+    size_t len;
+    enum ReceiveResult r;
+
+    /* Nothing left over from any previous connection is any use */
+    OFLOWInit( &s->oflow );
+    TPIUDecoderInit( &s->tpiu );
+
+    while ( !atomic_load( &s->ending ) )
+    {
+        t.tv_sec = 0;
+        t.tv_usec = SESSION_WAIT_US;
+        r = streamAcquire( stream, s->buf, TRANSFER_SIZE, ( const void ** )&d, &t, &len );
+
+        if ( len )
+        {
+            _process( s, d, len );
+            streamRelease( stream );
+        }
+
+        if ( r == RECEIVE_RESULT_ERROR )
+        {
+            return ( s->src.file != NULL );
+        }
+
+        if ( r == RECEIVE_RESULT_EOF )
+        {
+            if ( s->src.file )
+            {
+                if ( s->src.fileTerminate )
+                {
+                    return true;
+                }
+
+                usleep( SESSION_RETRY_US );
+            }
+            else
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void *_sessionTask( void *arg )
+
+{
+    struct orbSession *s = ( struct orbSession * )arg;
+    struct Stream *stream;
+    bool done = false;
+    bool reported = false;
+
+    while ( ( !done ) && ( !atomic_load( &s->ending ) ) )
+    {
+        if ( !( stream = _open( s ) ) )
+        {
+            if ( s->src.file )
+            {
+                genericsReport( V_ERROR, "Can't open %s" EOL, s->src.file );
+                break;
+            }
+
+            if ( !reported )
+            {
+                genericsReport( V_INFO, "No connection" EOL );
+                reported = true;
+            }
+
+            usleep( SESSION_RETRY_US );
+            continue;
+        }
+
+        reported = false;
+        atomic_fetch_add_explicit( &s->connects, 1, memory_order_relaxed );
+        done = _feed( s, stream );
+        stream->close( stream );
+        free( stream );
+    }
+
+    atomic_store( &s->running, false );
+    return NULL;
+}
+// ====================================================================================================
+static struct orbSessionSub *_addSub( struct orbSession *s, uint8_t tag, enum subKind kind, void *param )
+
+{
+    struct orbSessionSub *u;
+
+    if ( ( s->started ) || ( s->nsub == ORBSESSION_MAX_SUBS ) )
+    {
+        genericsReport( V_ERROR, "Can't subscribe to tag %d" EOL, tag );
+        return NULL;
+    }
+
+    u = &s->sub[s->nsub++];
+    u->tag = tag;
+    u->kind = kind;
+    u->param = param;
+    return u;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct orbSession *orbSessionCreate( const struct orbSessionSource *src )
+
+{
+    struct orbSession *s = ( struct orbSession * )calloc( 1, sizeof( struct orbSession ) );
+    MEMCHECK( s, NULL );
+
+    s->src = *src;
+
+    if ( src->server )
+    {
+        s->src.server = strdup( src->server );
+        MEMCHECK( s->src.server, NULL );
+    }
+
+    if ( src->file )
+    {
+        s->src.file = strdup( src->file );
+        MEMCHECK( s->src.file, NULL );
+    }
+
+    if ( !s->src.port )
+    {
+        s->src.port = ( s->src.oflow ) ? OFCLIENT_SERVER_PORT : NWCLIENT_SERVER_PORT;
+    }
+
+    return s;
+}
+// ====================================================================================================
+bool orbSessionSubscribeData( struct orbSession *s, uint8_t tag, orbSessionDataCB cb, void *param )
+
+{
+    struct orbSessionSub *u = _addSub( s, tag, SUB_DATA, param );
+
+    if ( u )
+    {
+        u->dataCB = cb;
+    }
+
+    return ( u != NULL );
+}
+// ====================================================================================================
+bool orbSessionSubscribeITM( struct orbSession *s, uint8_t tag, orbSessionMsgCB cb, void *param )
+
+{
+    struct orbSessionSub *u = _addSub( s, tag, SUB_ITM, param );
+
+    if ( u )
+    {
+        u->msgCB = cb;
+        ITMDecoderInit( &u->i, true );
+        ITMDecoderSetProfile( &u->i, ITM_PROFILE_SW_HW );
+    }
+
+    return ( u != NULL );
+}
+// ====================================================================================================
+bool orbSessionSubscribeTrace( struct orbSession *s, uint8_t tag, enum TRACEprotocol protocol, bool altAddr,
+                               orbSessionTraceCB cb, void *param )
+
+{
+    struct orbSessionSub *u = _addSub( s, tag, SUB_TRACE, param );
+
+    if ( u )
+    {
+        u->traceCB = cb;
+        TRACEDecoderInit( &u->t, protocol, altAddr, genericsReport );
+    }
+
+    return ( u != NULL );
+}
+// ====================================================================================================
+bool orbSessionStart( struct orbSession *s )
+
+{
+    if ( s->started )
+    {
+        return false;
+    }
+
+    atomic_store( &s->ending, false );
+    atomic_store( &s->running, true );
+
+    if ( pthread_create( &s->thread, NULL, _sessionTask, s ) )
+    {
+        genericsReport( V_ERROR, "Failed to start session" EOL );
+        atomic_store( &s->running, false );
+        return false;
+    }
+
+    s->started = true;
+    return true;
+}
+// ====================================================================================================
+bool orbSessionRunning( struct orbSession *s )
+
+{
+    return atomic_load( &s->running );
+}
+// ====================================================================================================
+void orbSessionGetStats( struct orbSession *s, struct orbSessionStats *st )
+
+{
+    st->bytes = atomic_load_explicit( &s->bytes, memory_order_relaxed );
+    st->badFrames = atomic_load_explicit( &s->badFrames, memory_order_relaxed );
+    st->connects = atomic_load_explicit( &s->connects, memory_order_relaxed );
+}
+// ====================================================================================================
+void orbSessionStop( struct orbSession *s )
+
+{
+    if ( s->started )
+    {
+        atomic_store( &s->ending, true );
+        pthread_join( s->thread, NULL );
+        s->started = false;
+    }
+}
+// ====================================================================================================
+void orbSessionDelete( struct orbSession *s )
+
+{
+    if ( !s )
+    {
+        return;
+    }
+
+    orbSessionStop( s );
+
+    for ( int j = 0; j < s->nsub; j++ )
+    {
+        if ( ( s->sub[j].kind == SUB_TRACE ) && ( s->sub[j].t.engine ) )
+        {
+            s->sub[j].t.engine->destroy( s->sub[j].t.engine );
+        }
+    }
+
+    free( ( void * )s->src.server );
+    free( ( void * )s->src.file );
+    free( s );
+}
+// ====================================================================================================
@@ -17,6 +17,8 @@
 #include <getopt.h>
 #include <time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "nw.h"
 #include "git_version_info.h"
@@ -24,17 +26,34 @@
 #include "itmDecoder.h"
 #include "msgDecoder.h"
 #include "msgSeq.h"
+#include "timebase.h"
+#include "msgStream.h"
 #include "stream.h"
+#include "captureIndex.h"
+#include "fmtProgram.h"
+#include "tokenLog.h"
 #include "oflow.h"
+#include "oflowSplit.h"
+#include "mcast.h"
 
 #define NUM_CHANNELS  32
 #define HW_CHANNEL    (NUM_CHANNELS)      /* Make the hardware fifo on the end of the software ones */
 
 #define MAX_STRING_LENGTH (4096)          /* Maximum length that will be output */
+#define MSG_BLOCK_LEN     (256)           /* Number of messages decoded in one go */
 #define DEFAULT_TS_TRIGGER '\n'           /* Default trigger character for timestamp output */
 
 #define MSG_REORDER_BUFLEN  (10)          /* Maximum number of samples to re-order for timekeeping */
+
+#define MAX_WORKERS         (16)          /* Most formatter threads there can be */
+#define FMT_RING_LEN        (1024)        /* Messages in flight between decode and output, a power of two */
+#define FMT_RING_MASK       (FMT_RING_LEN-1)
+#define FMT_TEXT_LEN        (512)         /* Longest formatted text of a single software message */
+#define FMT_WAIT_NS         (10*1000*1000L)
+#define OUTPUT_BUF_LEN      (256*1024)    /* Output is gathered into this much before being written */
 #define ONE_SEC_IN_USEC     (1000000L)    /* Used for time conversions...usec in one sec */
+#define BATCH_LINE_WAIT     (4)           /* When batching, how many deadlines a part line can hold output back for */
+#define RECEIVE_WAIT_US     (100000L)     /* Longest time to wait for data */
 
 /* Formats for timestamping */
 #define REL_FORMAT            C_TSTAMP "%6" PRIu64 ".%03" PRIu64 "|" C_RESET
@@ -43,15 +62,16 @@
 #define DEL_FORMAT_CTD        C_TSTAMP "      +|" C_RESET
 #define DEL_FORMAT_INIT       C_TSTAMP "D-Initial|" C_RESET
 #define ABS_FORMAT_TM   "%d/%b/%y %H:%M:%S"
-#define ABS_FORMAT            C_TSTAMP "%s.%03" PRIu64"|" C_RESET
+#define ABS_FORMAT_HEAD       C_TSTAMP "%s."
+#define ABS_FORMAT_TAIL       "|" C_RESET
 #define STAMP_FORMAT          C_TSTAMP "%12" PRIu64 "|" C_RESET
 #define STAMP_FORMAT_MS       C_TSTAMP "%8" PRIu64 ".%03" PRIu64 "_%03" PRIu64 "|" C_RESET
 #define STAMP_FORMAT_MS_DELTA C_TSTAMP "%5" PRIu64 ".%03" PRIu64 "_%03" PRIu64 "|" C_RESET
 
 enum TSType { TSNone, TSAbsolute, TSRelative, TSDelta, TSStamp, TSStampDelta, TSNumTypes };
 
-enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
-const char *protString[] = {"OFLOW", "ITM", NULL};
+enum Prot { PROT_OFLOW, PROT_ITM, PROT_MSG, PROT_UNKNOWN };
+const char *protString[] = {"OFLOW", "ITM", "MSG", NULL};
 
 const char *tsTypeString[TSNumTypes] = { "None", "Absolute", "Relative", "Delta", "System Timestamp", "System Timestamp Delta" };
 
@@ -62,6 +82,7 @@ struct
     uint32_t tag;                            /* Which OFLOW tag are we decoding? */
     bool forceITMSync;
     uint64_t cps;                            /* Cycles per second for target CPU */
+    uint32_t prescale;                       /* Divider of the CPU clock the local timestamps count at */
 
     enum TSType tsType;
     char *tsLineFormat;
@@ -70,6 +91,9 @@ struct
 
     /* Sink information */
     char *presFormat[NUM_CHANNELS + 1];      /* Format string for each channel */
+    struct fmtProgram *presProgram[NUM_CHANNELS + 1]; /* ...and what it compiles to */
+    struct tokenLog *tokens;                 /* Decoder for tokenised logging, if it's in use */
+    unsigned int tokenChan;                  /* ...and the channel it's on */
 
     /* Source information */
     int port;                                /* What port to connect to on the server (default to orbuculum) */
@@ -77,8 +101,15 @@ struct
     enum Prot protocol;                      /* What protocol to communicate (default to OFLOW (== orbuculum)) */
 
     char *file;                              /* File host connection */
+    uint64_t startmS;                        /* How far into an indexed capture file to start */
+    int splitThreads;                        /* Decode an OFLOW file on this many threads, or 0 to read it as a stream */
+    char *shm;                               /* Shared memory connection to a local orbuculum */
+    char *mcast;                             /* Multicast group an orbuculum is sending to */
+    bool compress;                           /* Ask the server to compress what it sends */
     bool endTerminate;                       /* Terminate when file/socket "ends" */
     bool ex;                             /* Support exception reporting */
+    int workers;                             /* Number of formatter threads, or 0 to format as decoded */
+    int batchmS;                             /* Hold output for up to this long to write it in lumps, or 0 not to */
 } options =
 {
     .forceITMSync = true,
@@ -95,29 +126,105 @@ struct
     struct MSGSeq    d;
     struct ITMPacket h;
     struct OFLOW c;
+    struct msgStreamDecoder m;           /* For messages that were decoded by the server */
 
     struct Frame cobsPart;               /* Any part frame that has been received */
     enum timeDelay timeStatus;           /* Indicator of if this time is exact */
-    uint64_t timeStamp;                  /* Latest received time */
+    struct timebase tb;                  /* Target time, from the local and global timestamps */
+    uint64_t timeStamp;                  /* Latest received time, in cycles */
     uint64_t lastTimeStamp;              /* Last received time */
     uint64_t te;                         /* Time on host side for line stamping */
     bool gotte;                          /* Flag that we have the initial time */
     bool inLine;                         /* We are in progress with a line that has been timestamped already */
     uint64_t dwtte;                      /* Timestamp for dwt print age */
     uint64_t oldte;                      /* Old time for interval calculation */
+    uint64_t msgTime;                    /* Host time the message being output came in at, if it's known */
+    uint64_t frameTime;                  /* Time the OFLOW frame being decoded was stamped with, or 0 */
+    clockid_t clock;                     /* Clock to use when there's no message time */
+    time_t absSec;                       /* Second that absText was made for */
+    int absLen;                          /* ...and how long it is */
+    char absText[MAX_STRING_LENGTH];     /* Absolute timestamp, up to the milliseconds */
+    bool held;                           /* There may be output held in the buffer... */
+    uint64_t heldSince;                  /* ...since this time, if it's been noticed */
     char dwtText[MAX_STRING_LENGTH];     /* DWT text that arrived while a line was in progress */
     bool ending;                         /* Time to shut up shop */
 } _r;
 
+/* Somewhere for a thread to sleep until there's something for it to do */
+struct wakeup
+{
+    pthread_mutex_t l;
+    pthread_cond_t c;
+    atomic_bool sleeping;                /* Set while the owner is waiting, so it's only signalled when it matters */
+};
+
+/* A decoded message waiting to be output, in order */
+struct fmtSlot
+{
+    struct msg m;                        /* The message itself */
+    char text[FMT_TEXT_LEN];             /* ...and for software messages, what it formats to */
+    atomic_bool ready;                   /* Set once it can be output */
+};
+
+/* A formatter thread, working on the slots it's been given for its channels */
+struct fmtWorker
+{
+    pthread_t t;
+    uint32_t q[FMT_RING_LEN];            /* Sequence numbers of the slots to format */
+    atomic_uint wp;                      /* Written by the decoder */
+    atomic_uint rp;                      /* ...and read by the worker */
+    struct wakeup w;
+};
+
+/* When formatting is done by workers the decoder puts messages in the ring, in order, the workers   */
+/* format the software ones and the writer outputs them in that same order. All the output, and all */
+/* the state that goes with it (timestamps, line handling), is only touched by the writer.          */
+struct
+{
+    struct fmtSlot ring[FMT_RING_LEN];
+    atomic_uint wp;                      /* Next sequence number to be filled, by the decoder */
+    atomic_uint rp;                      /* Next sequence number to be output, by the writer */
+    atomic_uint events;                  /* Incremented whenever there's something new for the writer */
+    struct wakeup writerWake;            /* Writer waiting for messages to arrive or be formatted */
+    struct wakeup spaceWake;             /* Decoder waiting for the writer to make space */
+    struct fmtWorker worker[MAX_WORKERS];
+    pthread_t writer;
+} _f;
+
 #define DWT_TO_US (100000L)
 
+// ====================================================================================================
+static void _timestampInit( void )
+
+/* The coarse clock is much cheaper to read, and is fine as long as it's good to the millisecond we show */
+
+{
+    _r.clock = CLOCK_REALTIME;
+#if defined( CLOCK_REALTIME_COARSE )
+    struct timespec res;
+
+    if ( ( !clock_getres( CLOCK_REALTIME_COARSE, &res ) ) && ( !res.tv_sec ) && ( res.tv_nsec <= 1000000L ) )
+    {
+        _r.clock = CLOCK_REALTIME_COARSE;
+    }
+
+#endif
+}
 // ====================================================================================================
 uint64_t _timestamp( void )
 
 {
-    struct timeval te;
-    gettimeofday( &te, NULL ); // get current time
-    return te.tv_sec * ONE_SEC_IN_USEC + te.tv_usec;
+    struct timespec ts;
+    clock_gettime( _r.clock, &ts );
+    return ts.tv_sec * ONE_SEC_IN_USEC + ts.tv_nsec / 1000;
+}
+// ====================================================================================================
+static uint64_t _lineTime( void )
+
+/* Time to stamp a line with. That's when its message arrived, so there's no need to ask the system */
+
+{
+    return ( _r.msgTime ) ? _r.msgTime : _timestamp();
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -126,14 +233,37 @@ uint64_t _timestamp( void )
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static void _printAbsTimestamp( char *strstore, uint64_t t )
+
+/* Only the milliseconds change from line to line, so the rest is only formatted when the second does */
+
+{
+    time_t td = ( time_t )( t / ONE_SEC_IN_USEC );
+    unsigned int ms = ( t / ( ONE_SEC_IN_USEC / 1000 ) ) % 1000;
+
+    if ( ( !_r.absLen ) || ( td != _r.absSec ) )
+    {
+        char opConstruct[MAX_STRING_LENGTH];
+        struct tm tm = *localtime( &td );
+
+        strftime( opConstruct, MAX_STRING_LENGTH, ABS_FORMAT_TM, &tm );
+        _r.absLen = snprintf( _r.absText, sizeof( _r.absText ), ABS_FORMAT_HEAD, opConstruct );
+        _r.absSec = td;
+    }
+
+    memcpy( strstore, _r.absText, _r.absLen );
+    strstore += _r.absLen;
+    *strstore++ = '0' + ms / 100;
+    *strstore++ = '0' + ( ms / 10 ) % 10;
+    *strstore++ = '0' + ms % 10;
+    strcpy( strstore, ABS_FORMAT_TAIL );
+}
+// ====================================================================================================
 static void _printTimestamp( char *strstore )
 
 {
     /* Lets output a timestamp */
-    char opConstruct[MAX_STRING_LENGTH];
     uint64_t res;
-    struct tm tm;
-    time_t td;
 
     *strstore = 0;
 
@@ -146,37 +276,33 @@ static void _printTimestamp( char *strstore )
             if ( !_r.gotte )
             {
                 /* Get the starting time */
-                _r.oldte = _timestamp();
+                _r.oldte = _lineTime();
                 _r.gotte = true;
                 sprintf( strstore, REL_FORMAT_INIT );
             }
             else
             {
-                res = _timestamp() - _r.oldte;
+                res = _lineTime() - _r.oldte;
                 sprintf( strstore, REL_FORMAT, res / ONE_SEC_IN_USEC, ( res / ( ONE_SEC_IN_USEC / 1000 ) ) % 1000 );
             }
 
             break;
 
         case TSAbsolute: // -------------------------------------------------------------------
-            res = _timestamp();
-            td = ( time_t )res / ONE_SEC_IN_USEC;
-            tm = *localtime( &td );
-            strftime( opConstruct, MAX_STRING_LENGTH, ABS_FORMAT_TM, &tm );
-            sprintf( strstore, ABS_FORMAT, opConstruct, ( res / ( ONE_SEC_IN_USEC / 1000 ) ) % 1000 );
+            _printAbsTimestamp( strstore, _lineTime() );
             break;
 
         case TSDelta: // ----------------------------------------------------------------------
             if ( !_r.gotte )
             {
                 /* Get the starting time */
-                _r.oldte = _timestamp();
+                _r.oldte = _lineTime();
                 _r.gotte = true;
                 sprintf( strstore, DEL_FORMAT_INIT );
             }
             else
             {
-                uint64_t t = _timestamp();
+                uint64_t t = _lineTime();
                 res = t - _r.oldte;
                 _r.oldte = t;
 
@@ -420,82 +546,374 @@ void _handleNISYNC( struct nisyncMsg *m, struct ITMDecoder *i )
 }
 // ====================================================================================================
 
+static void _formatSW( struct swMsg *m, char *opConstruct, size_t maxLen )
+
+/* Format a software message according to its channel's format, into opConstruct */
+
+{
+    /* Make sure line is empty by default */
+    *opConstruct = 0;
+
+    /* A tokenised log channel only ever goes to one worker, so its records arrive in order */
+    if ( ( options.tokens ) && ( m->srcAddr == options.tokenChan ) )
+    {
+        tokenLogPump( options.tokens, m->value, m->len, opConstruct, maxLen );
+        return;
+    }
+
+    /* Print anything we want to output into the buffer */
+    if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.presProgram[m->srcAddr] ) )
+    {
+        fmtProgramRun( options.presProgram[m->srcAddr], m->value, m->len, opConstruct, maxLen );
+    }
+}
+// ====================================================================================================
 static void _handleSW( struct swMsg *m, struct ITMDecoder *i )
 
 {
     assert( m->msgtype == MSG_SOFTWARE );
     char opConstruct[MAX_STRING_LENGTH];
 
-    char *p = opConstruct;
+    _formatSW( m, opConstruct, MAX_STRING_LENGTH );
 
-    /* Make sure line is empty by default */
-    *p = 0;
+    /* Whatever we have, it can be sent for output */
+    _outputText( opConstruct );
+}
+// ====================================================================================================
+static void _handleTS( struct TSMsg *m, struct ITMDecoder *i )
 
-    /* Print anything we want to output into the buffer */
-    if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.presFormat[m->srcAddr] ) )
+{
+    assert( m->msgtype == MSG_TS );
+    timebaseLTS( &_r.tb, m->timeInc );
+    _r.timeStamp = timebaseCycles( &_r.tb );
+}
+// ====================================================================================================
+static void _handleGTS( struct GTSMsg *m, struct ITMDecoder *i )
+
+{
+    assert( m->msgtype == MSG_GTS );
+    timebaseGTS( &_r.tb, m );
+    _r.timeStamp = timebaseCycles( &_r.tb );
+}
+// ====================================================================================================
+typedef void ( *handlers )( void *decoded, struct ITMDecoder * i );
+
+/* Handlers for each complete message received */
+static const handlers _h[MSG_NUM_MSGS] =
+{
+    /* MSG_UNKNOWN */         NULL,
+    /* MSG_RESERVED */        NULL,
+    /* MSG_ERROR */           NULL,
+    /* MSG_NONE */            NULL,
+    /* MSG_SOFTWARE */        ( handlers )_handleSW,
+    /* MSG_NISYNC */          ( handlers )_handleNISYNC,
+    /* MSG_OSW */             ( handlers )_handleDataOffsetWP,
+    /* MSG_DATA_ACCESS_WP */  ( handlers )_handleDataAccessWP,
+    /* MSG_DATA_RWWP */       ( handlers )_handleDataRWWP,
+    /* MSG_PC_SAMPLE */       NULL,
+    /* MSG_DWT_EVENT */       ( handlers )_handleDWTEvent,
+    /* MSG_EXCEPTION */       ( handlers )_handleException,
+    /* MSG_TS */              ( handlers )_handleTS,
+    /* MSG_GTS */             ( handlers )_handleGTS
+};
+// ====================================================================================================
+static void _dispatch( struct msg *p )
+
+{
+    assert( p->genericMsg.msgtype < MSG_NUM_MSGS );
+
+    _r.msgTime = p->genericMsg.ts;
+    _r.held = true;
+
+    if ( _h[p->genericMsg.msgtype] )
+    {
+        ( _h[p->genericMsg.msgtype] )( p, &_r.i );
+    }
+}
+// ====================================================================================================
+static void _outputBuffered( void )
+
+/* Output is normally unbuffered, but it can be gathered up when something else decides when it goes */
+
+{
+    static char obuf[OUTPUT_BUF_LEN];
+    static bool done;
+
+    if ( !done )
+    {
+        setvbuf( stderr, obuf, _IOFBF, OUTPUT_BUF_LEN );
+        done = true;
+    }
+}
+// ====================================================================================================
+static void _outputFlush( void )
+
+/* Send the output on its way. When batching that's only once it's been held for long enough, and then */
+/* at the end of a line, unless a line has been in progress for so long it has to go part done.      */
+
+{
+    uint64_t now;
+
+    if ( !options.batchmS )
+    {
+        fflush( stderr );
+        return;
+    }
+
+    if ( !_r.held )
     {
-        // formatted output....start with specials
-        if ( strstr( options.presFormat[m->srcAddr], "%f" ) )
+        return;
+    }
+
+    now = _timestamp();
+
+    if ( !_r.heldSince )
+    {
+        _r.heldSince = now;
+    }
+
+    if ( ( now - _r.heldSince >= options.batchmS * 1000ULL ) &&
+            ( ( !_r.inLine ) || ( now - _r.heldSince >= BATCH_LINE_WAIT * options.batchmS * 1000ULL ) ) )
+    {
+        fflush( stderr );
+        _r.held = false;
+        _r.heldSince = 0;
+    }
+}
+// ====================================================================================================
+// Formatter workers. These are only used when -w is set, otherwise messages are dispatched as they're
+// decoded, as above.
+// ====================================================================================================
+static void _wakeInit( struct wakeup *w )
+
+{
+    pthread_mutex_init( &w->l, NULL );
+    pthread_cond_init( &w->c, NULL );
+    atomic_init( &w->sleeping, false );
+}
+// ====================================================================================================
+static void _wake( struct wakeup *w )
+
+{
+    if ( atomic_load( &w->sleeping ) )
+    {
+        pthread_mutex_lock( &w->l );
+        pthread_cond_signal( &w->c );
+        pthread_mutex_unlock( &w->l );
+    }
+}
+// ====================================================================================================
+static void _sleep( struct wakeup *w, atomic_uint *v, unsigned int was )
+
+/* Wait for v to move on from was, or for a while. Whoever moves it calls _wake after */
+
+{
+    struct timespec ts;
+
+    pthread_mutex_lock( &w->l );
+    atomic_store( &w->sleeping, true );
+
+    if ( ( atomic_load( v ) == was ) && ( !_r.ending ) )
+    {
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += FMT_WAIT_NS;
+
+        if ( ts.tv_nsec >= 1000000000L )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait( &w->c, &w->l, &ts );
+    }
+
+    atomic_store( &w->sleeping, false );
+    pthread_mutex_unlock( &w->l );
+}
+// ====================================================================================================
+static void _checkDWTTimeout( void )
+
+/* Check if an exception report, held back while a line was in progress, has waited long enough */
+
+{
+    if ( ( _r.inLine ) && _r.dwtText[0] && ( _timestamp() - _r.dwtte > DWT_TO_US ) )
+    {
+        genericsPrintf( EOL "%s", _r.dwtText );
+        _r.dwtText[0] = 0;
+        _r.inLine = false;
+    }
+}
+// ====================================================================================================
+static void *_workerTask( void *arg )
+
+{
+    struct fmtWorker *w = ( struct fmtWorker * )arg;
+    unsigned int rp;
+    struct fmtSlot *s;
+
+    while ( !_r.ending )
+    {
+        rp = atomic_load_explicit( &w->rp, memory_order_relaxed );
+
+        if ( rp == atomic_load_explicit( &w->wp, memory_order_acquire ) )
         {
-            /* type punning on same host, after correctly building 32bit val
-             * only unsafe on systems where u32/float have diff byte order */
-            float *nastycast = ( float * )&m->value;
-            p += snprintf( p, MAX_STRING_LENGTH - ( p - opConstruct ), options.presFormat[m->srcAddr], *nastycast, *nastycast, *nastycast, *nastycast );
+            _sleep( &w->w, &w->wp, rp );
+            continue;
         }
-        else if ( strstr( options.presFormat[m->srcAddr], "%c" ) )
+
+        s = &_f.ring[w->q[rp & FMT_RING_MASK] & FMT_RING_MASK];
+        _formatSW( &s->m.swMsg, s->text, FMT_TEXT_LEN );
+        atomic_store_explicit( &w->rp, rp + 1, memory_order_relaxed );
+        atomic_store_explicit( &s->ready, true, memory_order_release );
+        atomic_fetch_add( &_f.events, 1 );
+        _wake( &_f.writerWake );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void *_writerTask( void *arg )
+
+/* Output everything in the order it was decoded, only flushing when there's nothing more waiting */
+
+{
+    unsigned int rp, ev;
+    struct fmtSlot *s;
+
+    while ( !_r.ending )
+    {
+        ev = atomic_load( &_f.events );
+        rp = atomic_load_explicit( &_f.rp, memory_order_relaxed );
+
+        if ( rp == atomic_load_explicit( &_f.wp, memory_order_acquire ) )
         {
-            /* Format contains %c, so execute repeatedly for all characters in sent data */
-            uint8_t op[4] = {m->value & 0xff, ( m->value >> 8 ) & 0xff, ( m->value >> 16 ) & 0xff, ( m->value >> 24 ) & 0xff};
-            uint32_t l = 0;
+            _outputFlush();
+            _checkDWTTimeout();
+            _sleep( &_f.writerWake, &_f.events, ev );
+            continue;
+        }
 
-            do
-            {
-                p += snprintf( p, MAX_STRING_LENGTH - ( p - opConstruct ), options.presFormat[m->srcAddr], op[l], op[l], op[l] );
-            }
-            while ( ++l < m->len );
+        s = &_f.ring[rp & FMT_RING_MASK];
+
+        if ( !atomic_load_explicit( &s->ready, memory_order_acquire ) )
+        {
+            /* Still being formatted */
+            _sleep( &_f.writerWake, &_f.events, ev );
+            continue;
+        }
+
+        if ( s->m.genericMsg.msgtype == MSG_SOFTWARE )
+        {
+            _r.msgTime = s->m.genericMsg.ts;
+            _r.held = true;
+            _outputText( s->text );
         }
         else
         {
-            p += snprintf( p, MAX_STRING_LENGTH - ( p - opConstruct ), options.presFormat[m->srcAddr], m->value, m->value, m->value, m->value );
+            _dispatch( &s->m );
         }
+
+        atomic_store_explicit( &_f.rp, rp + 1, memory_order_release );
+        _wake( &_f.spaceWake );
     }
 
-    /* Whatever we have, it can be sent for output */
-    _outputText( opConstruct );
+    return NULL;
 }
 // ====================================================================================================
-static void _handleTS( struct TSMsg *m, struct ITMDecoder *i )
+static void _fmtQueue( struct msg *p )
+
+/* Put a decoded message into the ring for output, handing it to a worker if it needs formatting */
 
 {
-    assert( m->msgtype == MSG_TS );
-    _r.timeStamp += m->timeInc;
+    unsigned int wp = atomic_load_explicit( &_f.wp, memory_order_relaxed );
+    struct fmtSlot *s = &_f.ring[wp & FMT_RING_MASK];
+    struct fmtWorker *w;
+    unsigned int rp;
+
+    while ( ( wp - ( rp = atomic_load_explicit( &_f.rp, memory_order_acquire ) ) >= FMT_RING_LEN ) && ( !_r.ending ) )
+    {
+        _sleep( &_f.spaceWake, &_f.rp, rp );
+    }
+
+    s->m = *p;
+
+    if ( ( p->genericMsg.msgtype == MSG_SOFTWARE ) && ( p->swMsg.srcAddr < NUM_CHANNELS ) &&
+            ( ( options.presFormat[p->swMsg.srcAddr] ) || ( ( options.tokens ) && ( p->swMsg.srcAddr == options.tokenChan ) ) ) )
+    {
+        /* Each channel always goes to the same worker */
+        w = &_f.worker[p->swMsg.srcAddr % options.workers];
+        atomic_store_explicit( &s->ready, false, memory_order_relaxed );
+        w->q[atomic_load_explicit( &w->wp, memory_order_relaxed ) & FMT_RING_MASK] = wp;
+        atomic_fetch_add_explicit( &w->wp, 1, memory_order_release );
+        _wake( &w->w );
+    }
+    else
+    {
+        /* Anything else is output just as it is, unformatted software messages being nothing at all */
+        s->text[0] = 0;
+        atomic_store_explicit( &s->ready, true, memory_order_relaxed );
+    }
+
+    atomic_store_explicit( &_f.wp, wp + 1, memory_order_release );
+    atomic_fetch_add( &_f.events, 1 );
+    _wake( &_f.writerWake );
 }
 // ====================================================================================================
-static void _itmPumpProcess( char c )
+static void _fmtStart( void )
 
 {
-    struct msg p;
-    struct msg *pp;
+    /* The writer decides when output goes, so it can go in big lumps */
+    _outputBuffered();
+
+    _wakeInit( &_f.writerWake );
+    _wakeInit( &_f.spaceWake );
+
+    for ( int i = 0; i < options.workers; i++ )
+    {
+        _wakeInit( &_f.worker[i].w );
 
-    typedef void ( *handlers )( void *decoded, struct ITMDecoder * i );
-
-    /* Handlers for each complete message received */
-    static const handlers h[MSG_NUM_MSGS] =
-    {
-        /* MSG_UNKNOWN */         NULL,
-        /* MSG_RESERVED */        NULL,
-        /* MSG_ERROR */           NULL,
-        /* MSG_NONE */            NULL,
-        /* MSG_SOFTWARE */        ( handlers )_handleSW,
-        /* MSG_NISYNC */          ( handlers )_handleNISYNC,
-        /* MSG_OSW */             ( handlers )_handleDataOffsetWP,
-        /* MSG_DATA_ACCESS_WP */  ( handlers )_handleDataAccessWP,
-        /* MSG_DATA_RWWP */       ( handlers )_handleDataRWWP,
-        /* MSG_PC_SAMPLE */       NULL,
-        /* MSG_DWT_EVENT */       ( handlers )_handleDWTEvent,
-        /* MSG_EXCEPTION */       ( handlers )_handleException,
-        /* MSG_TS */              ( handlers )_handleTS
-    };
+        if ( pthread_create( &_f.worker[i].t, NULL, _workerTask, &_f.worker[i] ) )
+        {
+            genericsExit( -1, "Failed to create formatter thread" EOL );
+        }
+    }
+
+    if ( pthread_create( &_f.writer, NULL, _writerTask, NULL ) )
+    {
+        genericsExit( -1, "Failed to create writer thread" EOL );
+    }
+}
+// ====================================================================================================
+static void _fmtDrain( void )
+
+/* Wait for everything that has been decoded to have been output */
+
+{
+    while ( ( !_r.ending ) && ( atomic_load( &_f.rp ) != atomic_load( &_f.wp ) ) )
+    {
+        usleep( 1000 );
+    }
+
+    fflush( stderr );
+}
+// ====================================================================================================
+static void _route( struct msg *p )
+
+{
+    if ( options.workers )
+    {
+        _fmtQueue( p );
+    }
+    else
+    {
+        _dispatch( p );
+    }
+}
+// ====================================================================================================
+static void _itmPumpProcess( const uint8_t *c, int len )
+
+{
+    struct msg *pp;
 
     /* For any mode except the ones where we collect timestamps from the target we need to send */
     /* the samples out directly to give the host a chance of having accurate timing info. For   */
@@ -504,36 +922,41 @@ static void _itmPumpProcess( char c )
 
     if ( ( options.tsType != TSStamp ) && ( options.tsType != TSStampDelta ) )
     {
-        if ( ITM_EV_PACKET_RXED == ITMPump( &_r.i, c ) )
+        struct msg p[MSG_BLOCK_LEN];
+        size_t used, n;
+
+        while ( len )
         {
-            if ( ITMGetDecodedPacket( &_r.i, &p )  )
-            {
-                assert( p.genericMsg.msgtype < MSG_NUM_MSGS );
+            n = ITMPumpBlock( &_r.i, c, len, p, MSG_BLOCK_LEN, &used );
+            c += used;
+            len -= used;
 
-                if ( h[p.genericMsg.msgtype] )
+            for ( size_t j = 0; j < n; j++ )
+            {
+                /* If whoever made the frame stamped it then that's a better time than when it got here */
+                if ( _r.frameTime )
                 {
-                    ( h[p.genericMsg.msgtype] )( &p, &_r.i );
+                    p[j].genericMsg.ts = _r.frameTime;
                 }
+
+                _route( &p[j] );
             }
         }
     }
     else
     {
-
-        /* Pump messages into the store until we get a time message, then we can read them out */
-        if ( !MSGSeqPump( &_r.d, c ) )
+        while ( len-- )
         {
-            return;
-        }
-
-        /* We are synced timewise, so empty anything that has been waiting */
-        while ( ( pp = MSGSeqGetPacket( &_r.d ) ) )
-        {
-            assert( pp->genericMsg.msgtype < MSG_NUM_MSGS );
+            /* Pump messages into the store until we get a time message, then we can read them out */
+            if ( !MSGSeqPump( &_r.d, *c++ ) )
+            {
+                continue;
+            }
 
-            if ( h[pp->genericMsg.msgtype] )
+            /* We are synced timewise, so empty anything that has been waiting */
+            while ( ( pp = MSGSeqGetPacket( &_r.d ) ) )
             {
-                ( h[pp->genericMsg.msgtype] )( pp, &_r.i );
+                _route( pp );
             }
         }
     }
@@ -551,22 +974,31 @@ static void _printHelp( const char *const progName )
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
     genericsPrintf( "    -c, --channel:      <Number>,<Format> of channel to add into output stream (repeat per channel)" EOL );
+    genericsPrintf( "    -B, --batch:        <mS> Hold output for up to this long to write it in lumps (for pipelines)" EOL );
     genericsPrintf( "    -C, --cpufreq:      <Frequency in KHz> (Scaled) speed of the CPU" EOL
                     "                        generally /1, /4, /16 or /64 of the real CPU speed," EOL );
     genericsPrintf( "    -E, --eof:          Terminate when the file/socket ends/is closed, or wait for more/reconnect" EOL );
     genericsPrintf( "    -f, --input-file:   <filename> Take input from specified file" EOL );
     genericsPrintf( "    -g, --trigger:      <char> to use to trigger timestamp (default is newline)" EOL );
+    genericsPrintf( "    -G, --mcast-input:  [group][:port] Take ORBFLOW from an orbuculum sending to a multicast group (defaults to %s)" EOL, MCAST_DEFAULT_SPEC );
     genericsPrintf( "    -h, --help:         This help" EOL );
+    genericsPrintf( "    -H, --shm-input:    [name] Take ORBFLOW from a local orbuculum via shared memory (defaults to %s)" EOL, ORBUCULUM_SHM_NAME );
+    genericsPrintf( "    -j, --split:        <threads> Decode an OFLOW file in chunks on this many threads (with -f, reads it once)" EOL );
+    genericsPrintf( "    -k, --tokens:       <Number>,<ELF file> Channel carries tokenised logging, with formats from the ELF" EOL );
     genericsPrintf( "    -n, --itm-sync:     Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
-    genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -p, --protocol:     Protocol to communicate (OFLOW, ITM or MSG). Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -P, --prescale:     <1|4|16|64> Divider set for the local timestamps, so -C can be the real CPU speed" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
+    genericsPrintf( "    -S, --start:        <seconds> Start this far into an indexed capture file" EOL );
     genericsPrintf( "    -t, --tag:          <stream>: Which orbflow tag to use (normally 1)" EOL );
     genericsPrintf( "    -T, --timestamp:    <a|r|d|s|t>: Add absolute, relative (to session start)," EOL
                     "                        delta, system timestamp or system timestamp delta to output. Note" EOL
                     "                        the accuracy of a,r & d are host dependent." EOL );
     genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:      Print version and exit" EOL );
+    genericsPrintf( "    -w, --workers:      <n> Format channels on n threads, with output on another (default 0, all on one)" EOL );
     genericsPrintf( "    -x, --exceptions:   Include exception information in output, in time order" EOL );
+    genericsPrintf( "    -z, --compress:     Ask the server to compress what it sends" EOL );
 }
 // ====================================================================================================
 static void _printVersion( void )
@@ -577,22 +1009,31 @@ static void _printVersion( void )
 // ====================================================================================================
 static struct option _longOptions[] =
 {
+    {"batch", required_argument, NULL, 'B'},
     {"channel", required_argument, NULL, 'c'},
     {"cpufreq", required_argument, NULL, 'C'},
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
+    {"mcast-input", optional_argument, NULL, 'G'},
+    {"shm-input", optional_argument, NULL, 'H'},
     {"trigger", required_argument, NULL, 'g' },
     {"itm-sync", no_argument, NULL, 'n'},
+    {"split", required_argument, NULL, 'j'},
+    {"tokens", required_argument, NULL, 'k'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
     {"protocol", required_argument, NULL, 'p'},
+    {"prescale", required_argument, NULL, 'P'},
     {"server", required_argument, NULL, 's'},
+    {"start", required_argument, NULL, 'S'},
     {"tag", required_argument, NULL, 't'},
     {"timestamp", required_argument, NULL, 'T'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
+    {"workers", required_argument, NULL, 'w'},
     {"exceptions", no_argument, NULL, 'x'},
+    {"compress", no_argument, NULL, 'z'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
@@ -608,7 +1049,7 @@ bool _processOptions( int argc, char *argv[] )
 
 #define DELIMITER ','
 
-    while ( ( c = getopt_long ( argc, argv, "c:C:Ef:g:hVnMp:s:t:T:v:x", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "B:c:C:Ef:g:G::hH::j:k:VnMp:P:s:S:t:T:v:w:xz", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -628,6 +1069,16 @@ bool _processOptions( int argc, char *argv[] )
                 _printHelp( argv[0] );
                 return false;
 
+            // ------------------------------------
+            case 'G':
+                options.mcast = ( optarg ) ? optarg : MCAST_DEFAULT_SPEC;
+                break;
+
+            // ------------------------------------
+            case 'H':
+                options.shm = ( optarg ) ? optarg : ORBUCULUM_SHM_NAME;
+                break;
+
             // ------------------------------------
             case 'V':
                 _printVersion();
@@ -638,11 +1089,47 @@ bool _processOptions( int argc, char *argv[] )
                 options.endTerminate = true;
                 break;
 
+            // ------------------------------------
+            case 'B':
+                options.batchmS = atoi( optarg );
+
+                if ( options.batchmS <= 0 )
+                {
+                    genericsReport( V_ERROR, "Batch time out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'w':
+                options.workers = atoi( optarg );
+
+                if ( ( options.workers < 0 ) || ( options.workers > MAX_WORKERS ) )
+                {
+                    genericsReport( V_ERROR, "Number of workers out of range (0..%d)" EOL, MAX_WORKERS );
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
             case 'f':
                 options.file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'j':
+                options.splitThreads = atoi( optarg );
+
+                if ( options.splitThreads <= 0 )
+                {
+                    genericsReport( V_ERROR, "Number of split threads out of range" EOL );
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
             case 'g':
                 options.tsTrigger = genericsUnescape( optarg )[0];
@@ -660,6 +1147,19 @@ bool _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'P':
+                options.prescale = atoi( optarg );
+
+                if ( ( options.prescale != 1 ) && ( options.prescale != 4 ) && ( options.prescale != 16 ) && ( options.prescale != 64 ) )
+                {
+                    genericsReport( V_ERROR, "Prescale must be 1, 4, 16 or 64" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
             case 'p':
                 options.protocol = PROT_UNKNOWN;
                 protExplicit = true;
@@ -711,6 +1211,17 @@ bool _processOptions( int argc, char *argv[] )
 
                 break;
 
+            // ------------------------------------
+            case 'S':
+                if ( atof( optarg ) < 0 )
+                {
+                    genericsReport( V_ERROR, "Start time is out of range" EOL );
+                    return false;
+                }
+
+                options.startmS = atof( optarg ) * 1000;
+                break;
+
             // ------------------------------------
             case 't':
                 options.tag = atoi( optarg );
@@ -811,6 +1322,24 @@ bool _processOptions( int argc, char *argv[] )
                 }
 
                 options.presFormat[chan] = strdup( genericsUnescape( chanIndex ) );
+                fmtProgramFree( options.presProgram[chan] );
+                options.presProgram[chan] = fmtProgramCompile( options.presFormat[chan] );
+                break;
+
+            // ------------------------------------
+            case 'k':
+                tokenLogDelete( options.tokens );
+
+                if ( !( options.tokens = tokenLogFromOption( optarg, &options.tokenChan, NUM_CHANNELS ) ) )
+                {
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'z':
+                options.compress = true;
                 break;
 
             // ------------------------------------
@@ -848,10 +1377,51 @@ bool _processOptions( int argc, char *argv[] )
         options.port = NWCLIENT_SERVER_PORT;
     }
 
+    if ( ( options.protocol == PROT_MSG ) && !portExplicit )
+    {
+        options.port = NWMSG_SERVER_PORT;
+    }
+
+    /* Shared memory only ever carries what orbuculum publishes, which is OFLOW */
+    if ( options.shm )
+    {
+        if ( options.file || serverExplicit )
+        {
+            genericsReport( V_ERROR, "Cannot specify shared memory with file or server" EOL );
+            return false;
+        }
+
+        options.protocol = PROT_OFLOW;
+    }
+
+    /* ...as does multicast */
+    if ( options.mcast )
+    {
+        if ( options.file || serverExplicit || options.shm )
+        {
+            genericsReport( V_ERROR, "Cannot specify multicast with file, server or shared memory" EOL );
+            return false;
+        }
+
+        options.protocol = PROT_OFLOW;
+    }
+
+    /* Splitting only makes sense for something that's all there already, with frames to split at */
+    if ( ( options.splitThreads ) && ( ( !options.file ) || ( options.protocol != PROT_OFLOW ) ) )
+    {
+        genericsReport( V_ERROR, "Split decoding needs an OFLOW input file" EOL );
+        return false;
+    }
+
     genericsReport( V_INFO, "orbcat version " GIT_DESCRIBE EOL );
     genericsReport( V_INFO, "Server     : %s:%d" EOL, options.server, options.port );
     genericsReport( V_INFO, "ForceSync  : %s" EOL, options.forceITMSync ? "true" : "false" );
     genericsReport( V_INFO, "Timestamp  : %s" EOL, tsTypeString[options.tsType] );
+
+    if ( options.batchmS )
+    {
+        genericsReport( V_INFO, "Batching   : %dmS" EOL, options.batchmS );
+    }
     genericsReport( V_INFO, "Exceptions : %s" EOL, options.ex ? "On" : "Off" );
 
     if ( options.cps )
@@ -859,18 +1429,37 @@ bool _processOptions( int argc, char *argv[] )
         genericsReport( V_INFO, "S-CPU Speed: %d KHz" EOL, options.cps );
     }
 
+    if ( options.prescale > 1 )
+    {
+        genericsReport( V_INFO, "TS Prescale: /%d" EOL, options.prescale );
+    }
+
     if ( options.tsType != TSNone )
     {
         char unesc[2] = {options.tsTrigger, 0};
         genericsReport( V_INFO, "TriggerChr : '%s'" EOL, genericsEscape( unesc ) );
     }
 
+    if ( options.shm )
+    {
+        genericsReport( V_INFO, "Shared Mem : %s" EOL, options.shm );
+    }
+
+    if ( options.mcast )
+    {
+        genericsReport( V_INFO, "Multicast  : %s" EOL, options.mcast );
+    }
+
     if ( options.file )
     {
 
         genericsReport( V_INFO, "Input File : %s", options.file );
 
-        if ( options.endTerminate )
+        if ( options.splitThreads )
+        {
+            genericsReport( V_INFO, " (Split across %d threads)" EOL, options.splitThreads );
+        }
+        else if ( options.endTerminate )
         {
             genericsReport( V_INFO, " (Terminate on exhaustion)" EOL );
         }
@@ -890,6 +1479,10 @@ bool _processOptions( int argc, char *argv[] )
             genericsReport( V_INFO, "Decoding ITM" EOL );
             break;
 
+        case PROT_MSG:
+            genericsReport( V_INFO, "Taking messages decoded by the server" EOL );
+            break;
+
         default:
             genericsReport( V_INFO, "Decoding unknown" EOL );
             break;
@@ -903,21 +1496,85 @@ bool _processOptions( int argc, char *argv[] )
         {
             genericsReport( V_INFO, "             %02d [%s]" EOL, g, genericsEscape( options.presFormat[g] ) );
         }
+        else if ( ( options.tokens ) && ( g == options.tokenChan ) )
+        {
+            genericsReport( V_INFO, "             %02d [Tokenised]" EOL, g );
+        }
     }
 
     return true;
 }
 
+// ====================================================================================================
+static int _msgTags( uint8_t *tags )
+
+/* The message types and channels we'd do anything with, for subscribing to a message server */
+
+{
+    const enum MSGType hw[] = { MSG_NISYNC, MSG_OSW, MSG_DATA_ACCESS_WP, MSG_DATA_RWWP, MSG_DWT_EVENT, MSG_EXCEPTION };
+    int n = 0;
+
+    for ( int g = 0; g < NUM_CHANNELS; g++ )
+    {
+        if ( ( options.presFormat[g] ) || ( ( options.tokens ) && ( g == options.tokenChan ) ) )
+        {
+            tags[n++] = MSGSTREAM_TAG_SW( g );
+        }
+    }
+
+    /* Hardware events are only ever reported alongside exceptions */
+    for ( int g = 0; options.ex && ( g < sizeof( hw ) / sizeof( hw[0] ) ); g++ )
+    {
+        tags[n++] = MSGSTREAM_TAG_MSG( hw[g] );
+    }
+
+    tags[n++] = MSGSTREAM_TAG_MSG( MSG_TS );
+    tags[n++] = MSGSTREAM_TAG_MSG( MSG_GTS );
+    return n;
+}
 // ====================================================================================================
 static struct Stream *_tryOpenStream( void )
 {
     if ( options.file != NULL )
     {
-        return streamCreateFile( options.file );
+        return streamCreateMappedFileAt( options.file, captureIndexStart( options.file, options.startmS ) );
+    }
+    else if ( options.shm != NULL )
+    {
+        /* The ring doesn't wait for anyone so needs no draining, and we decode straight out of it */
+        return streamCreateShm( options.shm );
+    }
+    else if ( options.mcast != NULL )
+    {
+        /* Nothing resends what the socket can't hold, so it gets drained the same as a TCP one */
+        return streamCreateReader( streamCreateMulticast( options.mcast ), STREAM_READER_BUFS, TRANSFER_SIZE );
     }
     else
     {
-        return streamCreateSocket( options.server, options.port );
+        struct Stream *stream = ( options.compress ) ? streamCreateCompressedSocket( options.server, options.port ) : streamCreateSocket( options.server, options.port );
+
+        /* Formatting can take a while, the socket gets drained in the meantime */
+        stream = streamCreateReader( stream, STREAM_READER_BUFS, TRANSFER_SIZE );
+
+        if ( ( stream ) && ( options.protocol == PROT_OFLOW ) )
+        {
+            uint8_t tag = options.tag;
+            nwSubscribe( stream, 1, &tag );
+        }
+
+        if ( ( stream ) && ( options.protocol == PROT_MSG ) )
+        {
+            uint8_t tags[NW_NUM_TAGS];
+            nwSubscribe( stream, _msgTags( tags ), tags );
+        }
+
+        /* Someone is watching, so would rather see things promptly */
+        if ( stream )
+        {
+            nwRequestQoS( stream, NW_QOS_LATENCY );
+        }
+
+        return stream;
     }
 }
 // ====================================================================================================
@@ -927,34 +1584,46 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 {
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
         if ( p->tag == options.tag )
         {
-            for ( int i = 0; i < p->len; i++ )
-            {
-                _itmPumpProcess( p->d[i] );
-            }
+            _r.frameTime = ( p->stamped ) ? p->tstamp / ( OFLOW_TS_RESOLUTION / ONE_SEC_IN_USEC ) : 0;
+            _itmPumpProcess( p->d, p->len );
         }
     }
 }
 
 // ====================================================================================================
 
+static void _msgRxed( struct msg *m, void *param )
+
+/* Message already decoded (and put in order) by the server, so it can go straight out */
+
+{
+    _route( m );
+}
+// ====================================================================================================
+
 static void _feedStream( struct Stream *stream )
 {
     struct timeval t;
     unsigned char cbw[TRANSFER_SIZE];
+    const uint8_t *rxd;
+
+    /* Nothing left over from any previous connection is any use */
+    msgStreamDecoderInit( &_r.m );
 
     while ( !_r.ending )
     {
         size_t receivedSize;
 
+        /* ...but not so long that batched output misses its deadline */
         t.tv_sec = 0;
-        t.tv_usec = 100000;
-        enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, &t, &receivedSize );
+        t.tv_usec = ( ( options.batchmS ) && ( _r.held ) && ( options.batchmS * 1000L < RECEIVE_WAIT_US ) ) ? options.batchmS * 1000L : RECEIVE_WAIT_US;
+        enum ReceiveResult result = streamAcquire( stream, cbw, TRANSFER_SIZE, ( const void ** )&rxd, &t, &receivedSize );
 
         if ( result != RECEIVE_RESULT_OK )
         {
@@ -973,32 +1642,87 @@ static void _feedStream( struct Stream *stream )
         {
             if ( PROT_OFLOW == options.protocol )
             {
-                OFLOWPump( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
+                if ( rxd == cbw )
+                {
+                    OFLOWPumpInPlace( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
+                }
+                else
+                {
+                    /* What's lent by the stream isn't ours to decode in place */
+                    OFLOWPump( &_r.c, rxd, receivedSize, _OFLOWpacketRxed, &_r );
+                }
+            }
+            else if ( PROT_MSG == options.protocol )
+            {
+                msgStreamPump( &_r.m, rxd, receivedSize, _msgRxed, NULL );
             }
             else
             {
                 /* ITM goes directly through the protocol pump */
-                unsigned char *c = cbw;
-
-                while ( receivedSize-- )
-                {
-                    _itmPumpProcess( *c++ );
-                }
+                _itmPumpProcess( rxd, receivedSize );
             }
 
-            /* Check if an exception report timed out */
-            if ( ( _r.inLine ) && _r.dwtText[0] && ( _timestamp() - _r.dwtte > DWT_TO_US ) )
-            {
-                genericsPrintf( EOL "%s", _r.dwtText );
-                _r.dwtText[0] = 0;
-                _r.inLine = false;
-            }
+            streamRelease( stream );
+        }
 
-            fflush( stdout );
+        /* With workers all of the output is left to the writer */
+        if ( !options.workers )
+        {
+            _checkDWTTimeout();
+            _outputFlush();
         }
     }
 }
 
+// ====================================================================================================
+static bool _spanRxed( const struct OFLOWSpan *s, void *param )
+
+/* A chunk's worth of frames for our tag, decoded on one of the split threads */
+
+{
+    const uint8_t *d = s->d;
+
+    for ( uint32_t i = 0; i < s->nframes; i++ )
+    {
+        _r.frameTime = ( s->f[i].stamped ) ? s->f[i].tstamp / ( OFLOW_TS_RESOLUTION / ONE_SEC_IN_USEC ) : 0;
+        _itmPumpProcess( d, s->f[i].len );
+        d += s->f[i].len;
+    }
+
+    if ( !options.workers )
+    {
+        _checkDWTTimeout();
+        _outputFlush();
+    }
+
+    return !_r.ending;
+}
+// ====================================================================================================
+static void _splitFile( void )
+
+/* Decode the whole of the file at once, rather than as a stream that might grow */
+
+{
+    uint8_t tag = options.tag;
+    struct OFLOWSplit *s = OFLOWSplitCreate( options.file, captureIndexStart( options.file, options.startmS ), options.splitThreads, 0, 1, &tag );
+
+    if ( !s )
+    {
+        genericsExit( -1, "Cannot open %s" EOL, options.file );
+    }
+
+    if ( ( !OFLOWSplitRun( s, _spanRxed, NULL ) ) && ( !_r.ending ) )
+    {
+        genericsReport( V_ERROR, "Couldn't read all of %s" EOL, options.file );
+    }
+
+    if ( OFLOWSplitErrors( s ) )
+    {
+        genericsReport( V_INFO, "%" PRIu64 " bad packets received" EOL, OFLOWSplitErrors( s ) );
+    }
+
+    OFLOWSplitDelete( s );
+}
 // ====================================================================================================
 static void _intHandler( int sig )
 
@@ -1012,6 +1736,8 @@ int main( int argc, char *argv[] )
 {
     bool alreadyReported = false;
 
+    _timestampInit();
+
     if ( !_processOptions( argc, argv ) )
     {
         exit( -1 );
@@ -1022,7 +1748,13 @@ int main( int argc, char *argv[] )
     /* Reset the handlers before we start */
     ITMDecoderInit( &_r.i, options.forceITMSync );
     OFLOWInit( &_r.c );
-    MSGSeqInit( &_r.d, &_r.i, MSG_REORDER_BUFLEN );
+
+    if ( !MSGSeqInit( &_r.d, &_r.i, MSG_REORDER_BUFLEN ) )
+    {
+        genericsExit( -1, "No memory for message sequencer" EOL );
+    }
+
+    timebaseInit( &_r.tb, options.prescale, options.cps, 0 );
 
     /* This ensures the signal handler gets called */
     if ( SIG_ERR == signal( SIGINT, _intHandler ) )
@@ -1030,6 +1762,28 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to establish Int handler" EOL );
     }
 
+    if ( options.batchmS )
+    {
+        _outputBuffered();
+    }
+
+    if ( options.workers )
+    {
+        _fmtStart();
+    }
+
+    if ( options.splitThreads )
+    {
+        _splitFile();
+
+        if ( options.workers )
+        {
+            _fmtDrain();
+        }
+
+        return 0;
+    }
+
     while ( !_r.ending )
     {
         struct Stream *stream = NULL;
@@ -1068,6 +1822,11 @@ int main( int argc, char *argv[] )
         {
             _feedStream( stream );
 
+            if ( options.workers )
+            {
+                _fmtDrain();
+            }
+
             stream->close( stream );
             free( stream );
         }
@@ -4,13 +4,34 @@
  * ITM Dumper for Orbuculum
  * ========================
  *
+ * By default a fixed length of time is recorded from the point the ITM decoder reaches sync.
+ *
+ * In streaming mode (-S) the OFLOW frames for the selected tag are written out exactly as they
+ * arrived, without being decoded, until told to stop. The file starts with a header block of
+ * DUMP_HDR_LEN bytes and the frames follow it in writes of DUMP_CHUNK bytes, each starting on a
+ * DUMP_CHUNK boundary of the data. The header block is the OFLOW signature, then the details of
+ * the dump carried in an OFLOW frame of its own (tag DUMP_META_TAG, so nothing else takes any
+ * notice of it) and zero fill, and it's rewritten every checkpoint once the data it describes is
+ * on disk. A streamed dump can be replayed by orbuculum -f just like one of its own captures.
+ *
+ * With a ring (-r) the data area is a fixed size and is written round and round, so it always
+ * holds about the last N MB of frames. Use -u to turn one into an ordinary capture.
+ *
  */
 
 #include <unistd.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <getopt.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined( WIN32 )
+    #include <io.h>
+#endif
 
 #include "generics.h"
 #include "uthash.h"
@@ -26,6 +47,21 @@
 
 #define DEFAULT_OUTFILE "/dev/stdout"
 #define DEFAULT_TIMELEN 10000
+#define DEFAULT_CHECKPOINT_MS (1000)
+
+#define OFLOW_SIG         "%%ORBFLOW1.0.0%%"       /* The way orbuculum starts an OFLOW capture */
+#define OFLOW_SIG_LEN     (sizeof(OFLOW_SIG)-1)
+
+#define DUMP_HDR_LEN      (4096)                   /* Header block at the start of a streamed dump */
+#define DUMP_CHUNK        (1024*1024)              /* Size of each write of frames, and their alignment */
+#define DUMP_MAGIC        "ORBDUMP1"
+#define DUMP_MAGIC_LEN    (8)
+#define DUMP_META_TAG     (0xff)                   /* OFLOW tag the dump details are carried in */
+#define DUMP_META_LEN     (DUMP_MAGIC_LEN+5*8+4)
+
+#ifndef O_BINARY
+    #define O_BINARY 0
+#endif
 
 enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ITM", NULL};
@@ -46,6 +82,13 @@ struct                                      /* Record for options, either defaul
 
     /* How long to dump */
     uint32_t timelen;
+    bool timelenExplicit;
+
+    /* Streaming dump */
+    bool stream;                                  /* Write OFLOW frames straight out, without limit */
+    uint32_t ringMB;                              /* Keep only the last this many MB, or 0 to keep everything */
+    uint32_t checkpointmS;                        /* How often the header is brought up to date */
+    char *unroll;                                 /* Ring to be turned into an ordinary capture */
 
     /* Supress colour in output */
     bool mono;
@@ -59,11 +102,42 @@ struct                                      /* Record for options, either defaul
     .tag = 1,
     .outfile = DEFAULT_OUTFILE,
     .timelen = DEFAULT_TIMELEN,
+    .checkpointmS = DEFAULT_CHECKPOINT_MS,
     .port = OFCLIENT_SERVER_PORT,
     .server = "localhost"
 };
 
 /* ----------- LIVE STATE ----------------- */
+
+/* Where we are in the incoming stream, when picking out frames to keep */
+enum FrameState { FS_IDLE, FS_CODE, FS_KEEP, FS_SKIP };
+
+/* A streamed dump being written */
+struct dumpFile
+{
+    int fd;
+    uint8_t *buf;                                 /* Chunk being filled, DUMP_CHUNK long and aligned */
+    size_t fill;                                  /* ...how much of it is used */
+    uint64_t chunkOfs;                            /* Offset in the data area the chunk will be written to */
+    uint64_t lastOfs;                             /* File offset of the last full chunk written, 0 if none */
+    uint64_t ringLen;                             /* Length of the data area if it's a ring, otherwise 0 */
+    uint64_t total;                               /* Bytes of frames dumped in all */
+    uint64_t frames;                              /* ...and how many frames */
+    uint64_t startuS;                             /* When the dump started */
+    uint32_t checkpointmS;                        /* When the header was last brought up to date */
+};
+
+/* Details of a dump, as carried in its header */
+struct dumpMeta
+{
+    uint64_t ringLen;
+    uint64_t total;
+    uint64_t frames;
+    uint64_t startuS;
+    uint64_t checkpointuS;
+    uint32_t tag;
+};
+
 struct
 {
     /* The decoders and the packets from them */
@@ -71,6 +145,15 @@ struct
     struct ITMPacket h;
     struct OFLOW c;
     bool   ending;
+
+    /* Streaming dump */
+    struct dumpFile d;
+    enum FrameState fs;
+    uint8_t code;                                 /* COBS code that started the current frame */
+
+    /* Header found when unrolling */
+    struct dumpMeta meta;
+    bool   gotMeta;
 } _r;
 
 // ====================================================================================================
@@ -99,14 +182,18 @@ void _printHelp( const char *const progName )
 
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "    -c, --checkpoint:   <interval> mS between header updates when streaming (defaults to %dmS)" EOL, options.checkpointmS );
     genericsPrintf( "    -h, --help:         This help" EOL );
     genericsPrintf( "    -l, --length:       <timelen> Length of time in ms to record from point of acheiving sync (defaults to %dmS)" EOL, options.timelen );
     genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
     genericsPrintf( "    -n, --itm-sync:     Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     genericsPrintf( "    -o, --output-file:  <filename> to be used for dump file (defaults to %s)" EOL, options.outfile );
     genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -r, --ring:         <size> Stream into a ring that keeps the last <size>MB of frames" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
+    genericsPrintf( "    -S, --stream:       Stream OFLOW frames for the tag to the output file until stopped" EOL );
     genericsPrintf( "    -t, --tag:          <stream> Which Orbflow tag to use (normally 1)" EOL );
+    genericsPrintf( "    -u, --unroll:       <filename> Write streamed dump or ring out as an ordinary OFLOW capture" EOL );
     genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:      Print version and exit" EOL );
     genericsPrintf( "    -w, --sync-write:   Write synchronously to the output file after every packet" EOL );
@@ -120,6 +207,7 @@ void _printVersion( void )
 // ====================================================================================================
 static struct option _longOptions[] =
 {
+    {"checkpoint", required_argument, NULL, 'c'},
     {"help", no_argument, NULL, 'h'},
     {"length", required_argument, NULL, 'l'},
     {"itm-sync", no_argument, NULL, 'n'},
@@ -127,8 +215,11 @@ static struct option _longOptions[] =
     {"no-color", no_argument, NULL, 'M'},
     {"output-file", required_argument, NULL, 'o'},
     {"protocol", required_argument, NULL, 'p'},
+    {"ring", required_argument, NULL, 'r'},
     {"server", required_argument, NULL, 's'},
+    {"stream", no_argument, NULL, 'S'},
     {"tag", required_argument, NULL, 't'},
+    {"unroll", required_argument, NULL, 'u'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
     {"sync-write", no_argument, NULL, 'w'},
@@ -143,7 +234,7 @@ bool _processOptions( int argc, char *argv[] )
     bool serverExplicit = false;
     bool portExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "hVl:Mno:p:s:t:v:w", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "c:hVl:Mno:p:r:s:St:u:v:w", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             case 'o':
@@ -152,6 +243,24 @@ bool _processOptions( int argc, char *argv[] )
 
             case 'l':
                 options.timelen = atoi( optarg );
+                options.timelenExplicit = true;
+                break;
+
+            case 'c':
+                options.checkpointmS = atoi( optarg );
+                break;
+
+            case 'r':
+                options.ringMB = atoi( optarg );
+                options.stream = true;
+                break;
+
+            case 'S':
+                options.stream = true;
+                break;
+
+            case 'u':
+                options.unroll = optarg;
                 break;
 
             case 'M':
@@ -271,6 +380,27 @@ bool _processOptions( int argc, char *argv[] )
         options.port = NWCLIENT_SERVER_PORT;
     }
 
+    if ( options.stream )
+    {
+        if ( options.protocol != PROT_OFLOW )
+        {
+            genericsReport( V_ERROR, "Streaming dumps are of OFLOW frames, so need OFLOW protocol" EOL );
+            return false;
+        }
+
+        if ( !options.checkpointmS )
+        {
+            genericsReport( V_ERROR, "Checkpoint interval must be at least 1mS" EOL );
+            return false;
+        }
+
+        /* Streams go on until they're stopped, unless they've been told otherwise */
+        if ( !options.timelenExplicit )
+        {
+            options.timelen = 0;
+        }
+    }
+
     genericsReport( V_INFO, "orbdump version " GIT_DESCRIBE EOL );
     genericsReport( V_INFO, "Server    : %s:%d" EOL, options.server, options.port );
     genericsReport( V_INFO, "ForceSync : %s" EOL, options.forceITMSync ? "true" : "false" );
@@ -287,6 +417,18 @@ bool _processOptions( int argc, char *argv[] )
 
     genericsReport( V_INFO, "Sync Write: %s" EOL, options.writeSync ? "true" : "false" );
 
+    if ( options.stream )
+    {
+        if ( options.ringMB )
+        {
+            genericsReport( V_INFO, "Streaming : Ring of %dMB, checkpoint every %dmS" EOL, options.ringMB, options.checkpointmS );
+        }
+        else
+        {
+            genericsReport( V_INFO, "Streaming : Checkpoint every %dmS" EOL, options.checkpointmS );
+        }
+    }
+
     switch ( options.protocol )
     {
         case PROT_OFLOW:
@@ -312,7 +454,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 {
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
@@ -330,7 +472,558 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 
 static struct Stream *_tryOpenStream( void )
 {
-    return streamCreateSocket( options.server, options.port );
+    struct Stream *stream = streamCreateSocket( options.server, options.port );
+
+    if ( ( stream ) && ( options.protocol == PROT_OFLOW ) )
+    {
+        uint8_t tag = options.tag;
+        nwSubscribe( stream, 1, &tag );
+    }
+
+    /* A recording is only any good if it's complete, however late it arrives */
+    if ( stream )
+    {
+        nwRequestQoS( stream, NW_QOS_BULK );
+    }
+
+    return stream;
+}
+// ====================================================================================================
+static struct Stream *_connect( void )
+
+/* Keep trying to get a connection until there is one, or we're told to stop */
+
+{
+    struct Stream *stream;
+    bool reported = false;
+
+    while ( ( !( stream = _tryOpenStream() ) ) && ( !_r.ending ) )
+    {
+        if ( !reported )
+        {
+            genericsReport( V_INFO, EOL "No connection" EOL );
+            reported = true;
+        }
+
+        /* Checking every 100ms for a connection is quite often enough */
+        usleep( 100000 );
+    }
+
+    if ( ( stream ) && ( reported ) )
+    {
+        genericsReport( V_INFO, "Connected" EOL );
+    }
+
+    return stream;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Streaming dump
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _put64( uint8_t *d, uint64_t v )
+
+{
+    for ( int i = 0; i < 8; i++ )
+    {
+        d[i] = v >> ( i * 8 );
+    }
+}
+// ====================================================================================================
+static uint64_t _get64( const uint8_t *d )
+
+{
+    uint64_t v = 0;
+
+    for ( int i = 7; i >= 0; i-- )
+    {
+        v = ( v << 8 ) | d[i];
+    }
+
+    return v;
+}
+// ====================================================================================================
+static bool _writeAt( int fd, uint64_t ofs, const uint8_t *d, size_t len )
+
+{
+    if ( lseek( fd, ofs, SEEK_SET ) < 0 )
+    {
+        return false;
+    }
+
+    while ( len )
+    {
+        ssize_t w = write( fd, d, len );
+
+        if ( w <= 0 )
+        {
+            if ( ( w < 0 ) && ( errno == EINTR ) )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        d += w;
+        len -= w;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _syncFile( int fd )
+
+{
+#if defined( WIN32 )
+    return !_commit( fd );
+#elif defined( LINUX )
+    return !fdatasync( fd );
+#else
+    return !fsync( fd );
+#endif
+}
+// ====================================================================================================
+static bool _checkpoint( struct dumpFile *d )
+
+/* Get everything so far onto the disk, then update the header to say so */
+
+{
+    uint8_t hdr[DUMP_HDR_LEN] = { 0 };
+    uint8_t m[DUMP_META_LEN];
+    struct Frame f;
+
+    /* The chunk being filled goes where it will eventually end up, and is written again when it's full */
+    if ( ( d->fill ) && ( !_writeAt( d->fd, DUMP_HDR_LEN + d->chunkOfs, d->buf, d->fill ) ) )
+    {
+        return false;
+    }
+
+    if ( !_syncFile( d->fd ) )
+    {
+        return false;
+    }
+
+    memcpy( m, DUMP_MAGIC, DUMP_MAGIC_LEN );
+    _put64( &m[DUMP_MAGIC_LEN], d->ringLen );
+    _put64( &m[DUMP_MAGIC_LEN + 8], d->total );
+    _put64( &m[DUMP_MAGIC_LEN + 16], d->frames );
+    _put64( &m[DUMP_MAGIC_LEN + 24], d->startuS );
+    _put64( &m[DUMP_MAGIC_LEN + 32], genericsTimestampuS() );
+    m[DUMP_MAGIC_LEN + 40] = options.tag;
+    m[DUMP_MAGIC_LEN + 41] = m[DUMP_MAGIC_LEN + 42] = m[DUMP_MAGIC_LEN + 43] = 0;
+
+    memcpy( hdr, OFLOW_SIG, OFLOW_SIG_LEN );
+    OFLOWEncode( DUMP_META_TAG, 0, m, DUMP_META_LEN, &f );
+    memcpy( &hdr[OFLOW_SIG_LEN], f.d, f.len );
+
+    d->checkpointmS = genericsTimestampmS();
+    return _writeAt( d->fd, 0, hdr, DUMP_HDR_LEN );
+}
+// ====================================================================================================
+static bool _writeChunk( struct dumpFile *d )
+
+/* Write out the full chunk and move on to the next one, round to the start again if it's a ring */
+
+{
+    uint64_t ofs = DUMP_HDR_LEN + d->chunkOfs;
+
+    if ( !_writeAt( d->fd, ofs, d->buf, DUMP_CHUNK ) )
+    {
+        return false;
+    }
+
+#if defined( LINUX )
+    /* Start this chunk on its way, and drop the one before from the cache now it's had time to get there */
+    sync_file_range( d->fd, ofs, DUMP_CHUNK, SYNC_FILE_RANGE_WRITE );
+
+    if ( d->lastOfs )
+    {
+        sync_file_range( d->fd, d->lastOfs, DUMP_CHUNK, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+        posix_fadvise( d->fd, d->lastOfs, DUMP_CHUNK, POSIX_FADV_DONTNEED );
+    }
+
+#endif
+    d->lastOfs = ofs;
+    d->chunkOfs += DUMP_CHUNK;
+    d->fill = 0;
+
+    if ( ( d->ringLen ) && ( d->chunkOfs >= d->ringLen ) )
+    {
+        d->chunkOfs = 0;
+    }
+
+    return ( !options.writeSync ) || ( _syncFile( d->fd ) );
+}
+// ====================================================================================================
+static bool _emit( struct dumpFile *d, const uint8_t *p, size_t len )
+
+{
+    d->total += len;
+
+    while ( len )
+    {
+        size_t n = ( len < DUMP_CHUNK - d->fill ) ? len : DUMP_CHUNK - d->fill;
+
+        memcpy( &d->buf[d->fill], p, n );
+        d->fill += n;
+        p += n;
+        len -= n;
+
+        if ( ( d->fill == DUMP_CHUNK ) && ( !_writeChunk( d ) ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _dumpOpen( struct dumpFile *d, const char *name )
+
+{
+    struct stat st;
+
+    memset( d, 0, sizeof( struct dumpFile ) );
+    d->ringLen = ( uint64_t )options.ringMB * 1024 * 1024;
+    d->startuS = genericsTimestampuS();
+
+    if ( ( d->fd = open( name, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Could not open %s for writing (%s)" EOL, name, strerror( errno ) );
+        return false;
+    }
+
+    if ( ( fstat( d->fd, &st ) < 0 ) || ( !S_ISREG( st.st_mode ) ) )
+    {
+        genericsReport( V_ERROR, "A streaming dump has to go to a regular file" EOL );
+        return false;
+    }
+
+#if defined( WIN32 )
+    d->buf = ( uint8_t * )malloc( DUMP_CHUNK );
+#else
+
+    if ( posix_memalign( ( void ** )&d->buf, DUMP_HDR_LEN, DUMP_CHUNK ) )
+    {
+        d->buf = NULL;
+    }
+
+#endif
+    MEMCHECK( d->buf, false );
+
+#if defined( LINUX )
+
+    /* A ring is going to be filled anyway, so get all of its space now */
+    if ( ( d->ringLen ) && ( fallocate( d->fd, 0, 0, DUMP_HDR_LEN + d->ringLen ) < 0 ) )
+    {
+        genericsReport( V_INFO, "Cannot preallocate space for %s (%s), continuing without" EOL, name, strerror( errno ) );
+    }
+
+#endif
+    return _checkpoint( d );
+}
+// ====================================================================================================
+static bool _dumpClose( struct dumpFile *d )
+
+{
+    bool ok = _checkpoint( d ) && _syncFile( d->fd );
+
+    close( d->fd );
+    free( d->buf );
+    d->buf = NULL;
+    return ok;
+}
+// ====================================================================================================
+static bool _startFrame( uint8_t tag )
+
+/* Decide what to do with the frame that's just started, now its tag is known */
+
+{
+    if ( tag != options.tag )
+    {
+        _r.fs = FS_SKIP;
+        return true;
+    }
+
+    _r.fs = FS_KEEP;
+    _r.d.frames++;
+    return _emit( &_r.d, &_r.code, 1 );
+}
+// ====================================================================================================
+static bool _dumpFrames( const uint8_t *p, size_t len )
+
+/* Copy out the frames for our tag just as they arrived. The tag is the first byte of the decoded */
+/* frame, which is the byte after the COBS code that starts it...or zero if that code is 1.     */
+
+{
+    const uint8_t *e = p + len;
+    const uint8_t *z, *n;
+
+    while ( p < e )
+    {
+        switch ( _r.fs )
+        {
+            case FS_IDLE: // ----------------------------------------------------------------------
+                if ( COBS_SYNC_CHAR != *p )
+                {
+                    _r.code = *p;
+                    _r.fs = FS_CODE;
+
+                    if ( ( 1 == _r.code ) && ( !_startFrame( 0 ) ) )
+                    {
+                        return false;
+                    }
+                }
+
+                p++;
+                break;
+
+            case FS_CODE: // ----------------------------------------------------------------------
+                if ( COBS_SYNC_CHAR == *p )
+                {
+                    /* Too short to be anything */
+                    _r.fs = FS_IDLE;
+                    p++;
+                }
+                else if ( !_startFrame( *p ) )
+                {
+                    return false;
+                }
+
+                break;
+
+            case FS_KEEP: // ----------------------------------------------------------------------
+            case FS_SKIP: // ----------------------------------------------------------------------
+                z = ( const uint8_t * )memchr( p, COBS_SYNC_CHAR, e - p );
+                n = z ? z + 1 : e;
+
+                if ( ( FS_KEEP == _r.fs ) && ( !_emit( &_r.d, p, n - p ) ) )
+                {
+                    return false;
+                }
+
+                if ( z )
+                {
+                    _r.fs = FS_IDLE;
+                }
+
+                p = n;
+                break;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static int _streamDump( struct Stream *stream )
+
+/* Write the frames for our tag straight out to the dump until told to stop */
+
+{
+    static uint8_t cbw[TRANSFER_SIZE];
+    size_t receivedSize;
+    struct timeval tv;
+    uint64_t firstTime = _timestamp();
+
+    if ( !_dumpOpen( &_r.d, options.outfile ) )
+    {
+        return -2;
+    }
+
+    /* The server sends whole frames from the moment we connect */
+    _r.fs = FS_IDLE;
+    genericsReport( V_INFO, "Started streaming" EOL );
+
+    while ( !_r.ending )
+    {
+        if ( !stream )
+        {
+            if ( !( stream = _connect() ) )
+            {
+                break;
+            }
+
+            _r.fs = FS_IDLE;
+        }
+
+        tv.tv_sec  = options.checkpointmS / 1000;
+        tv.tv_usec = ( options.checkpointmS % 1000 ) * 1000;
+        enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, &tv, &receivedSize );
+
+        if ( ( result == RECEIVE_RESULT_OK ) && ( !_dumpFrames( cbw, receivedSize ) ) )
+        {
+            genericsReport( V_ERROR, "Writing to %s failed (%s)" EOL, options.outfile, strerror( errno ) );
+            break;
+        }
+
+        if ( ( result == RECEIVE_RESULT_EOF ) || ( result == RECEIVE_RESULT_ERROR ) )
+        {
+            /* Lost the server, so finish off any frame that was cut short (it'll fail its check) and go find it again */
+            genericsReport( V_WARN, "Lost connection, reconnecting" EOL );
+            stream->close( stream );
+            free( stream );
+            stream = NULL;
+
+            if ( ( FS_KEEP == _r.fs ) && ( !_emit( &_r.d, cobs_eop, COBS_EOP_LEN ) ) )
+            {
+                break;
+            }
+        }
+
+        if ( ( options.timelen ) && ( ( _timestamp() - firstTime ) > options.timelen ) )
+        {
+            break;
+        }
+
+        if ( ( genericsTimestampmS() - _r.d.checkpointmS >= options.checkpointmS ) && ( !_checkpoint( &_r.d ) ) )
+        {
+            genericsReport( V_ERROR, "Checkpoint of %s failed (%s)" EOL, options.outfile, strerror( errno ) );
+            break;
+        }
+    }
+
+    if ( stream )
+    {
+        stream->close( stream );
+        free( stream );
+    }
+
+    if ( !_dumpClose( &_r.d ) )
+    {
+        genericsReport( V_ERROR, "Could not complete %s (%s)" EOL, options.outfile, strerror( errno ) );
+        return -2;
+    }
+
+    genericsReport( V_INFO, "Wrote %" PRIu64 " frames, %" PRIu64 " bytes of data" EOL, _r.d.frames, _r.d.total );
+    return 0;
+}
+// ====================================================================================================
+static void _metaRxed( struct OFLOWFrame *p, void *param )
+
+{
+    if ( ( p->good ) && ( DUMP_META_TAG == p->tag ) && ( p->len >= DUMP_META_LEN ) && ( !memcmp( p->d, DUMP_MAGIC, DUMP_MAGIC_LEN ) ) )
+    {
+        _r.meta.ringLen      = _get64( &p->d[DUMP_MAGIC_LEN] );
+        _r.meta.total        = _get64( &p->d[DUMP_MAGIC_LEN + 8] );
+        _r.meta.frames       = _get64( &p->d[DUMP_MAGIC_LEN + 16] );
+        _r.meta.startuS      = _get64( &p->d[DUMP_MAGIC_LEN + 24] );
+        _r.meta.checkpointuS = _get64( &p->d[DUMP_MAGIC_LEN + 32] );
+        _r.meta.tag          = p->d[DUMP_MAGIC_LEN + 40];
+        _r.gotMeta = true;
+    }
+}
+// ====================================================================================================
+static bool _copyOut( FILE *f, FILE *o, uint64_t ofs, uint64_t len, bool toFrame )
+
+/* Copy len bytes from ofs in the data area, starting at the first whole frame if toFrame is set */
+
+{
+    static uint8_t b[DUMP_CHUNK];
+
+    if ( fseek( f, DUMP_HDR_LEN + ofs, SEEK_SET ) )
+    {
+        return false;
+    }
+
+    while ( len )
+    {
+        size_t n = ( len < DUMP_CHUNK ) ? len : DUMP_CHUNK;
+        uint8_t *p = b;
+
+        if ( fread( b, 1, n, f ) != n )
+        {
+            return false;
+        }
+
+        len -= n;
+
+        if ( toFrame )
+        {
+            uint8_t *z = ( uint8_t * )memchr( b, COBS_SYNC_CHAR, n );
+
+            if ( !z )
+            {
+                continue;
+            }
+
+            toFrame = false;
+            n -= z + 1 - b;
+            p = z + 1;
+        }
+
+        if ( fwrite( p, 1, n, o ) != n )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static int _unrollDump( void )
+
+/* Turn a streamed dump (most usefully a ring) back into a capture with its frames in order */
+
+{
+    uint8_t hdr[DUMP_HDR_LEN];
+    FILE *f = fopen( options.unroll, "rb" );
+    FILE *o;
+    bool ok;
+
+    if ( !f )
+    {
+        genericsReport( V_ERROR, "Could not open %s (%s)" EOL, options.unroll, strerror( errno ) );
+        return -2;
+    }
+
+    if ( ( fread( hdr, 1, DUMP_HDR_LEN, f ) == DUMP_HDR_LEN ) && ( !memcmp( hdr, OFLOW_SIG, OFLOW_SIG_LEN ) ) )
+    {
+        OFLOWInit( &_r.c );
+        OFLOWPump( &_r.c, &hdr[OFLOW_SIG_LEN], DUMP_HDR_LEN - OFLOW_SIG_LEN, _metaRxed, NULL );
+    }
+
+    if ( !_r.gotMeta )
+    {
+        genericsReport( V_ERROR, "%s is not a streamed dump" EOL, options.unroll );
+        fclose( f );
+        return -2;
+    }
+
+    if ( !( o = fopen( options.outfile, "wb" ) ) )
+    {
+        genericsReport( V_ERROR, "Could not open output file for writing" EOL );
+        fclose( f );
+        return -2;
+    }
+
+    genericsReport( V_INFO, "Tag %d, %" PRIu64 " frames, %" PRIu64 " bytes, %" PRIu64 "mS long" EOL, _r.meta.tag, _r.meta.frames, _r.meta.total,
+                    ( _r.meta.checkpointuS - _r.meta.startuS ) / 1000 );
+
+    ok = ( fwrite( OFLOW_SIG, 1, OFLOW_SIG_LEN, o ) == OFLOW_SIG_LEN );
+
+    if ( ( !_r.meta.ringLen ) || ( _r.meta.total <= _r.meta.ringLen ) )
+    {
+        ok = ok && _copyOut( f, o, 0, _r.meta.total, false );
+    }
+    else
+    {
+        /* The oldest data is just after the newest, and the frame it starts with has been cut into */
+        uint64_t pos = _r.meta.total % _r.meta.ringLen;
+        ok = ok && _copyOut( f, o, pos, _r.meta.ringLen - pos, true ) && _copyOut( f, o, 0, pos, false );
+    }
+
+    fclose( f );
+
+    if ( ( fclose( o ) ) || ( !ok ) )
+    {
+        genericsReport( V_ERROR, "Could not unroll %s into %s" EOL, options.unroll, options.outfile );
+        return -2;
+    }
+
+    return 0;
 }
 // ====================================================================================================
 static void _intHandler( int sig )
@@ -351,7 +1044,6 @@ int main( int argc, char *argv[] )
     size_t receivedSize;
 
     bool haveSynced = false;
-    bool alreadyReported = false;
     struct Stream *stream;
 
     if ( !_processOptions( argc, argv ) )
@@ -361,9 +1053,10 @@ int main( int argc, char *argv[] )
 
     genericsScreenHandling( !options.mono );
 
-    /* Reset the OFLOW handler before we start */
-    OFLOWInit( &_r.c );
-    stream = _tryOpenStream();
+    if ( options.unroll )
+    {
+        return _unrollDump();
+    }
 
     /* This ensures the signal handler gets called */
     if ( SIG_ERR == signal( SIGINT, _intHandler ) )
@@ -371,28 +1064,17 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to establish Int handler" EOL );
     }
 
-    if ( stream == NULL )
-    {
-
-        stream = _tryOpenStream();
-
-        if ( stream != NULL )
-        {
-            if ( alreadyReported )
-            {
-                genericsReport( V_INFO, "Connected" EOL );
-                alreadyReported = false;
-            }
-        }
+    /* Reset the OFLOW handler before we start */
+    OFLOWInit( &_r.c );
 
-        if ( !alreadyReported )
-        {
-            genericsReport( V_INFO, EOL "No connection" EOL );
-            alreadyReported = true;
-        }
+    if ( !( stream = _connect() ) )
+    {
+        return 0;
+    }
 
-        /* Checking every 100ms for a connection is quite often enough */
-        usleep( 10000 );
+    if ( options.stream )
+    {
+        return _streamDump( stream );
     }
 
     /* .... and the file to dump it into */
@@ -475,7 +1157,7 @@ int main( int argc, char *argv[] )
 
         if ( !ITMDecoderIsSynced( &_r.i ) )
         {
-            genericsReport( V_WARN, "Warning:Sync lost while writing output" EOL );
+            genericsReportRateLimited( V_WARN, "Warning:Sync lost while writing output" EOL );
         }
 
         if ( options.writeSync )
@@ -25,9 +25,11 @@
 #include "generics.h"
 #include "fileWriter.h"
 #include "stream.h"
+#include "mcast.h"
 #include "nw.h"
 
 #include "itmfifos.h"
+#include "tokenLog.h"
 
 const char *protString[] = {"OFLOW", "ITM", NULL};
 
@@ -39,10 +41,21 @@ struct
     /* Config information */
     bool filewriter;                    /* Supporting filewriter functionality */
     char *fwbasedir;                    /* Base directory for filewriter output */
+    struct fwOptions fw;                /* ...and how its files are written */
     bool permafile;                     /* Use permanent files rather than fifos */
+    bool useShm;                        /* Publish channels into shared memory too */
+    bool reactor;                       /* Serve all channels from a single thread */
+    bool binaryHW;                      /* Hardware events as records rather than text */
+    int tokenChan;                      /* Channel carrying tokenised logging, -1 if none does */
+    char *tokenSpec;                    /* ...and what it was given as, for any other tags to load too */
+    uint8_t tags[ITMFIFO_MAX_TAGS];     /* OFLOW tags to decode, the first being the one that's always there */
+    int ntags;
 
     /* Source information */
     char *file;                         /* File host connection */
+    char *shmInput;                     /* Shared memory connection to a local orbuculum */
+    char *mcastInput;                   /* Multicast group an orbuculum is sending to */
+    bool compress;                      /* Ask the server to compress what it sends */
     bool fileTerminate;                 /* Terminate when file read isn't successful */
     bool mono;                                          /* Supress colour in output */
 
@@ -52,7 +65,10 @@ struct
 } options =
 {
     .port = OFCLIENT_SERVER_PORT,
-    .server = "localhost"
+    .server = "localhost",
+    .tokenChan = -1,
+    .tags = { 1 },
+    .ntags = 1
 };
 
 struct
@@ -73,18 +89,26 @@ static void _printHelp( const char *const progName )
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
     genericsPrintf( "    -b, --basedir:      <basedir> for channels" EOL );
+    genericsPrintf( "    -B, --binary-hw:    Write " HWFIFO_NAME " as fixed size binary records (struct hwRecord) rather than text" EOL );
     genericsPrintf( "    -c, --channel:      <Number>,<Name>,<Format> of channel to populate (repeat per channel)" EOL );
     genericsPrintf( "    -E, --eof:          When reading from file, terminate at end of file" EOL );
     genericsPrintf( "    -f, --input-file:   <filename> Take input from specified file" EOL );
+    genericsPrintf( "    -G, --mcast-input:  [group][:port] Take ORBFLOW from an orbuculum sending to a multicast group (defaults to %s)" EOL, MCAST_DEFAULT_SPEC );
     genericsPrintf( "    -h, --help:         This help" EOL );
+    genericsPrintf( "    -H, --shm-input:    [name] Take ORBFLOW from a local orbuculum via shared memory (defaults to %s)" EOL, ORBUCULUM_SHM_NAME );
+    genericsPrintf( "    -k, --tokens:       <Number>,<ELF file> Channel carries tokenised logging, with formats from the ELF" EOL );
+    genericsPrintf( "    -m, --shm:          Also publish each channel in shared memory as /orbfifo.<Name>" EOL );
     genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
     genericsPrintf( "    -P, --permanent:    Create permanent files rather than fifos" EOL );
     genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -r, --reactor:      Serve all channels from one thread, so a slow reader only holds up its own" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
-    genericsPrintf( "    -t, --tag:          <stream> Which OFLOW tag to use (normally 1)" EOL );
+    genericsPrintf( "    -t, --tag:          <stream>[,<stream>...] Which OFLOW tags to use (normally 1), each in its own tag<N> directory if more than one" EOL );
     genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:      Print version and exit" EOL );
+    genericsPrintf( "    -w, --writer-opts:  <opt>[,<opt>...] How filewriter files are written, any of sync=none|close|write, direct, prealloc" EOL );
     genericsPrintf( "    -W, --writer-path:  <path> Enable filewriter functionality using specified base path" EOL );
+    genericsPrintf( "    -z, --compress:     Ask the server to compress what it sends" EOL );
 }
 // ====================================================================================================
 void _printVersion( void )
@@ -96,22 +120,67 @@ void _printVersion( void )
 struct option _longOptions[] =
 {
     {"basedir", required_argument, NULL, 'b'},
+    {"binary-hw", no_argument, NULL, 'B'},
     {"channel", required_argument, NULL, 'c'},
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
+    {"mcast-input", optional_argument, NULL, 'G'},
+    {"shm-input", optional_argument, NULL, 'H'},
+    {"tokens", required_argument, NULL, 'k'},
+    {"shm", no_argument, NULL, 'm'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
     {"permanent", no_argument, NULL, 'P'},
     {"protocol", required_argument, NULL, 'p'},
+    {"reactor", no_argument, NULL, 'r'},
     {"server", required_argument, NULL, 's'},
     {"tag", required_argument, NULL, 't'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
+    {"writer-opts", required_argument, NULL, 'w'},
     {"writer-path", required_argument, NULL, 'W'},
+    {"compress", no_argument, NULL, 'z'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
+static bool _parseTags( const char *s )
+
+/* A list of tags, each decoded on its own */
+
+{
+    char *e;
+    long t;
+
+    options.ntags = 0;
+
+    do
+    {
+        t = strtol( s, &e, 0 );
+
+        if ( ( e == s ) || ( t < 0 ) || ( t > 255 ) || ( options.ntags == ITMFIFO_MAX_TAGS ) || ( ( *e ) && ( *e != ',' ) ) )
+        {
+            genericsReport( V_ERROR, "Tags should be a list of up to %d stream numbers" EOL, ITMFIFO_MAX_TAGS );
+            return false;
+        }
+
+        for ( int i = 0; i < options.ntags; i++ )
+        {
+            if ( options.tags[i] == t )
+            {
+                genericsReport( V_ERROR, "Tag %ld is given twice" EOL, t );
+                return false;
+            }
+        }
+
+        options.tags[options.ntags++] = t;
+        s = e + 1;
+    }
+    while ( *e );
+
+    return true;
+}
+// ====================================================================================================
 static bool _processOptions( int argc, char *argv[] )
 
 {
@@ -127,7 +196,7 @@ static bool _processOptions( int argc, char *argv[] )
     bool portExplicit = false;
     enum Prot p;
 
-    while ( ( c = getopt_long ( argc, argv, "b:c:Ef:hVn:Pp:s:t:v:w:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "b:Bc:Ef:G::hH::k:mVn:Pp:rs:t:v:w:W:z", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -136,6 +205,11 @@ static bool _processOptions( int argc, char *argv[] )
                 itmfifoSetChanPath( _r.f, optarg );
                 break;
 
+            // ------------------------------------
+            case 'B':
+                options.binaryHW = true;
+                break;
+
             // ------------------------------------
             case 'E':
                 options.fileTerminate = true;
@@ -153,6 +227,18 @@ static bool _processOptions( int argc, char *argv[] )
                 _printHelp( argv[0] );
                 return false;
 
+            // ------------------------------------
+
+            case 'G':
+                options.mcastInput = ( optarg ) ? optarg : MCAST_DEFAULT_SPEC;
+                break;
+
+            // ------------------------------------
+
+            case 'H':
+                options.shmInput = ( optarg ) ? optarg : ORBUCULUM_SHM_NAME;
+                break;
+
             // ------------------------------------
             case 'V':
                 _printVersion();
@@ -170,12 +256,42 @@ static bool _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'k':
+            {
+                unsigned int chan;
+                struct tokenLog *t = tokenLogFromOption( optarg, &chan, NUM_CHANNELS );
+
+                if ( !t )
+                {
+                    return false;
+                }
+
+                itmfifoSetTokens( _r.f, chan, t );
+                options.tokenChan = chan;
+                options.tokenSpec = optarg;
+                break;
+            }
+
+            // ------------------------------------
+
+            case 'm':
+                options.useShm = true;
+                break;
+
+            // ------------------------------------
+
             case 'P':
                 options.permafile = true;
                 break;
 
             // ------------------------------------
 
+            case 'r':
+                options.reactor = true;
+                break;
+
+            // ------------------------------------
+
             case 'p':
                 p = PROT_UNKNOWN;
                 protExplicit = true;
@@ -231,7 +347,12 @@ static bool _processOptions( int argc, char *argv[] )
             // ------------------------------------
 
             case 't':
-                itmfifoSettag( _r.f, atoi( optarg ) );
+                if ( !_parseTags( optarg ) )
+                {
+                    return false;
+                }
+
+                itmfifoSettag( _r.f, options.tags[0] );
                 break;
 
             // ------------------------------------
@@ -255,6 +376,40 @@ static bool _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'w':
+                for ( char *o = strtok( optarg, "," ); o; o = strtok( NULL, "," ) )
+                {
+                    if ( !strcmp( o, "sync=none" ) )
+                    {
+                        options.fw.sync = FW_SYNC_NONE;
+                    }
+                    else if ( !strcmp( o, "sync=close" ) )
+                    {
+                        options.fw.sync = FW_SYNC_CLOSE;
+                    }
+                    else if ( !strcmp( o, "sync=write" ) )
+                    {
+                        options.fw.sync = FW_SYNC_WRITE;
+                    }
+                    else if ( !strcmp( o, "direct" ) )
+                    {
+                        options.fw.direct = true;
+                    }
+                    else if ( !strcmp( o, "prealloc" ) )
+                    {
+                        options.fw.prealloc = true;
+                    }
+                    else
+                    {
+                        genericsReport( V_ERROR, "Unrecognised filewriter option [%s]" EOL, o );
+                        return false;
+                    }
+                }
+
+                break;
+
+            // ------------------------------------
+
             /* Individual channel setup */
             case 'c':
                 chanIndex = chanConfig = strdup( optarg );
@@ -308,6 +463,12 @@ static bool _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'z':
+                options.compress = true;
+                break;
+
+            // ------------------------------------
+
             case '?':
                 if ( optopt == 'b' )
                 {
@@ -338,11 +499,52 @@ static bool _processOptions( int argc, char *argv[] )
         options.port = NWCLIENT_SERVER_PORT;
     }
 
+    /* Shared memory only ever carries what orbuculum publishes, which is OFLOW */
+    if ( options.shmInput )
+    {
+        if ( options.file || serverExplicit )
+        {
+            genericsReport( V_ERROR, "Cannot specify shared memory with file or server" EOL );
+            return false;
+        }
+
+        itmfifoSetProtocol( _r.f, PROT_OFLOW );
+    }
+
+    /* ...as does multicast */
+    if ( options.mcastInput )
+    {
+        if ( options.file || serverExplicit || options.shmInput )
+        {
+            genericsReport( V_ERROR, "Cannot specify multicast with file, server or shared memory" EOL );
+            return false;
+        }
+
+        itmfifoSetProtocol( _r.f, PROT_OFLOW );
+    }
+
+    /* Only OFLOW has tags for there to be more than one of */
+    if ( ( options.ntags > 1 ) && ( itmfifoGetProtocol( _r.f ) != PROT_OFLOW ) )
+    {
+        genericsReport( V_ERROR, "More than one tag needs OFLOW" EOL );
+        return false;
+    }
+
 
     /* ... and dump the config if we're being verbose */
     genericsReport( V_INFO, "orbfifo version " GIT_DESCRIBE EOL );
     genericsReport( V_INFO, "Server     : %s:%d" EOL, options.server, options.port );
 
+    if ( options.shmInput )
+    {
+        genericsReport( V_INFO, "Shared Mem : %s" EOL, options.shmInput );
+    }
+
+    if ( options.mcastInput )
+    {
+        genericsReport( V_INFO, "Multicast  : %s" EOL, options.mcastInput );
+    }
+
     if ( options.file )
     {
         genericsReport( V_INFO, "Input File  : %s", options.file );
@@ -361,7 +563,14 @@ static bool _processOptions( int argc, char *argv[] )
     switch ( itmfifoGetProtocol( _r.f ) )
     {
         case PROT_OFLOW:
-            genericsReport( V_INFO, "Decoding OFLOW (Orbuculum) with ITM in stream %d" EOL, itmfifoGettag( _r.f ) );
+            genericsReport( V_INFO, "Decoding OFLOW (Orbuculum) with ITM in stream" );
+
+            for ( int i = 0; i < options.ntags; i++ )
+            {
+                genericsReport( V_INFO, "%s%d", ( i ) ? "," : " ", options.tags[i] );
+            }
+
+            genericsReport( V_INFO, EOL );
             break;
 
         case PROT_ITM:
@@ -379,7 +588,8 @@ static bool _processOptions( int argc, char *argv[] )
     {
         if ( itmfifoGetChannelName( _r.f, g ) )
         {
-            genericsReport( V_INFO, "         %02d [%s] [%s]" EOL, g, genericsEscape( itmfifoGetChannelFormat( _r.f, g ) ? : "RAW" ), itmfifoGetChannelName( _r.f, g ) );
+            genericsReport( V_INFO, "         %02d [%s] [%s]" EOL, g, ( g == options.tokenChan ) ? "Tokenised" :
+                            genericsEscape( itmfifoGetChannelFormat( _r.f, g ) ? : "RAW" ), itmfifoGetChannelName( _r.f, g ) );
         }
     }
 
@@ -393,7 +603,7 @@ static void _processBlock( int s, unsigned char *cbw )
 /* Generic block processor for received data */
 
 {
-    genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, s );
+    genericsReportRateLimited( V_DEBUG, "RXED Packet of %d bytes" EOL, s );
 
     if ( s )
     {
@@ -461,6 +671,33 @@ int main( int argc, char *argv[] )
     genericsScreenHandling( !options.mono );
 
     itmfifoUsePermafiles( _r.f, options.permafile );
+    itmfifoUseShm( _r.f, options.useShm );
+    itmfifoUseReactor( _r.f, options.reactor );
+    itmfifoUseBinaryHW( _r.f, options.binaryHW );
+
+    /* Any other tags are decoded the same way, but each needs its own copy of the tokens */
+    for ( int i = 1; i < options.ntags; i++ )
+    {
+        struct itmfifosHandle *s = itmfifoAddTag( _r.f, options.tags[i] );
+
+        if ( !s )
+        {
+            genericsExit( -1, "Failed to add tag %d" EOL, options.tags[i] );
+        }
+
+        if ( options.tokenSpec )
+        {
+            unsigned int chan;
+            struct tokenLog *t = tokenLogFromOption( options.tokenSpec, &chan, NUM_CHANNELS );
+
+            if ( !t )
+            {
+                genericsExit( -1, "" EOL );
+            }
+
+            itmfifoSetTokens( s, chan, t );
+        }
+    }
 
     /* Make sure the fifos get removed at the end */
     atexit( _doExit );
@@ -486,19 +723,37 @@ int main( int argc, char *argv[] )
     }
 
     /* Start the filewriter */
-    itmfifoFilewriter( _r.f, options.filewriter, options.fwbasedir );
+    itmfifoFilewriter( _r.f, options.filewriter, options.fwbasedir, &options.fw );
 
     while ( !_r.ending )
     {
         if ( options.file != NULL )
         {
-            stream = streamCreateFile( options.file );
+            stream = streamCreateMappedFile( options.file );
         }
         else
         {
             while ( !_r.ending )
             {
-                stream = streamCreateSocket( options.server, options.port );
+                if ( options.shmInput != NULL )
+                {
+                    stream = streamCreateReader( streamCreateShm( options.shmInput ), STREAM_READER_BUFS, TRANSFER_SIZE );
+                }
+                else if ( options.mcastInput != NULL )
+                {
+                    stream = streamCreateReader( streamCreateMulticast( options.mcastInput ), STREAM_READER_BUFS, TRANSFER_SIZE );
+                }
+                else
+                {
+                    /* Receive on another thread, so a fifo reader that's slow to pick up doesn't stop the socket being drained */
+                    stream = ( options.compress ) ? streamCreateCompressedSocket( options.server, options.port ) : streamCreateSocket( options.server, options.port );
+                    stream = streamCreateReader( stream, STREAM_READER_BUFS, TRANSFER_SIZE );
+
+                    if ( ( stream ) && ( itmfifoGetProtocol( _r.f ) == PROT_OFLOW ) )
+                    {
+                        nwSubscribe( stream, options.ntags, options.tags );
+                    }
+                }
 
                 if ( stream )
                 {
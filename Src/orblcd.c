@@ -14,12 +14,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <SDL.h>
-#include <SDL_thread.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 #include <signal.h>
+#ifndef ORBLCD_NO_SDL
+    #include <SDL.h>
+#endif
 
 #include "git_version_info.h"
 #include "generics.h"
@@ -28,10 +33,18 @@
 #include "oflow.h"
 #include "stream.h"
 #include "nw.h"
+#include "frameSink.h"
 #include "orblcd_protocol.h"
 
 /************** APPLICATION SPECIFIC ********************************************************************/
 /* Target application specifics */
+
+/* Area of the screen, x1 and y1 are exclusive so it's empty when x1 <= x0 */
+struct lcdRect
+{
+    int x0, y0, x1, y1;
+};
+
 struct TApp
 {
     /* Application specific Options */
@@ -41,26 +54,50 @@ struct TApp
     /* Operational stuff */
     int x;                                                /* Current X pos */
     int y;                                                /* Current Y pos */
+    struct lcdRect win;                                   /* Window that drawing is wrapped within */
+    uint32_t repeat;                                      /* Number of times to use the next data word */
+    struct lcdRect dirty;                                 /* Area drawn on since the last frame was handed over */
     float scale;                                          /* Scale for output window */
     int modeDescriptor;                                   /* Descriptor for source mode */
     char *windowTitle;                                    /* Title for SDL output window */
+    char *output;                                         /* Where frames go instead of a window, if anywhere */
 
-    /* SDL stuff */
+#ifndef ORBLCD_NO_SDL
+    /* SDL stuff, only touched from the main thread */
     SDL_Window   *mainWindow;                             /* Output window */
-    SDL_Texture  *ctexture;                               /* Texture used for holding current image */
     SDL_Renderer *renderer;                               /* Renderer onto output window */
-
-    SDL_Texture  *texture;                                /* Texture used for construction of image */
-    uint8_t       *pixels;                                /* Pixel buffer in texture */
+    SDL_Texture  *texture;                                /* Streaming texture the frames are presented from */
+    int windowDescriptor;                                 /* Mode the window was created for */
+    Uint32 wakeEvent;                                     /* SDL event telling the main thread to look for work */
+#endif
+
+    /* Headless stuff, only touched from the main thread */
+    struct frameSink *sink;                               /* Where frames are put out to */
+    uint32_t     *outFrame;                               /* Copy of the frame being put out */
+    size_t       outLen;                                  /* ...and its size in bytes */
+
+    /* Decode stuff, only touched from the decode thread */
+    uint8_t       *pixels;                                /* Pixel buffer image is constructed in */
+    uint32_t      map1to24bit[256][8];                    /* Pixel table for 1 bit mapping, a byte at a time */
     uint32_t      map8to24bit[256];                       /* Colour index table for 8 to 24 bit mapping */
     int pwidth;                                           /* Width of one line of pixel buffer */
 
+    /* Handed from the decode thread to the main thread */
+    pthread_mutex_t frameLock;                            /* Lock protecting these */
+    pthread_cond_t frameCond;                             /* Signalled when there's a frame, for headless running */
+    uint8_t      *frame;                                  /* Last complete frame */
+    int frameDescriptor;                                  /* ...the mode it's in */
+    struct lcdRect frameDirty;                            /* ...what's changed in it since it was last presented */
+    bool frameReady;                                      /* ...and if it's not been presented yet */
+
 } _app =
 {
     .chan        = LCD_DATA_CHANNEL,
     .sbcolour    = 0x00ff00,
     .scale       = 1.5f,
-    .windowTitle = "ORBLcd Output Window"
+    .windowTitle = "ORBLcd Output Window",
+    .frameLock   = PTHREAD_MUTEX_INITIALIZER,
+    .frameCond   = PTHREAD_COND_INITIALIZER
 
 };
 /************** APPLICATION SPECIFIC ENDS ***************************************************************/
@@ -93,6 +130,7 @@ struct RunTime
 
     bool      ending;                                    /* Flag indicating app is terminating */
     bool      errored;                                   /* Flag indicating problem in reception process */
+    bool      decodeDone;                                /* Flag indicating the decode thread has finished */
 
     struct Frame cobsPart;                               /* Any part frame that has been received */
     int f;                                               /* File handle to data source */
@@ -109,66 +147,163 @@ struct RunTime
 // Target application specifics
 // ====================================================================================================
 
-static void _paintPixels( struct swMsg *m, struct RunTime *r )
+static void _wake( struct RunTime *r )
+
+/* Tell the main thread there's something for it to do */
 
 {
-    /* This is LCD data */
-    int d = m->value;
-    int y;
+    if ( r->app->sink )
+    {
+        pthread_cond_broadcast( &r->app->frameCond );
+    }
 
-    if ( !r->app->pixels )
+#ifndef ORBLCD_NO_SDL
+    else
+    {
+        SDL_Event e = { .type = r->app->wakeEvent };
+
+        SDL_PushEvent( &e );
+    }
+
+#endif
+}
+
+/*************************************/
+
+static void _waitTaken( struct RunTime *r )
+
+/* Reading a file there's no link to keep up with, so rather than merge into a frame that's still */
+/* waiting to be put out, wait for it to go. Called with the frame lock held.                   */
+
+{
+    while ( ( r->app->sink ) && ( r->options->file ) && ( r->app->frameReady ) && ( !r->ending ) )
+    {
+        pthread_cond_wait( &r->app->frameCond, &r->app->frameLock );
+    }
+}
+
+/*************************************/
+
+static void _rectAdd( struct lcdRect *d, const struct lcdRect *s )
+
+/* Grow d to cover s too */
+
+{
+    if ( s->x1 <= s->x0 )
     {
-        /* For whatever reason we aren't initialised yet */
         return;
     }
 
-    for ( int b = ORBLCD_PIXELS_PER_WORD( r->app->modeDescriptor ) - 1; b >= 0; b-- )
+    if ( d->x1 <= d->x0 )
     {
-        switch ( ORBLCD_DECODE_D( r->app->modeDescriptor ) )
-        {
-            case ORBLCD_DEPTH_1:
-                y = ( d & ( 1 << ( b % 8 ) ) ) ? r->app->sbcolour : 0;
+        *d = *s;
+        return;
+    }
 
-                if ( !( b % 8 ) )
-                {
-                    d >>= 8;
-                }
+    d->x0 = ( s->x0 < d->x0 ) ? s->x0 : d->x0;
+    d->y0 = ( s->y0 < d->y0 ) ? s->y0 : d->y0;
+    d->x1 = ( s->x1 > d->x1 ) ? s->x1 : d->x1;
+    d->y1 = ( s->y1 > d->y1 ) ? s->y1 : d->y1;
+}
 
-                break;
+/*************************************/
 
-            case ORBLCD_DEPTH_8:
-                y = r->app->map8to24bit[d & 0xff];
-                d >>= 8;
-                break;
+static void _setWindow( struct TApp *a, int x, int y, int w, int h )
 
-            case ORBLCD_DEPTH_16:
-                y = ( ( d & 0xF100 ) << 8 ) | ( ( d & 0x07e0 ) << 5 )  | ( d & 0x001f );
-                d >>= 16;
-                break;
+/* Set the window drawing is wrapped within, clipped to the screen, and move to its top left */
 
-            case ORBLCD_DEPTH_24:
-                y = d;
-                break;
+{
+    int sw = ORBLCD_DECODE_X( a->modeDescriptor );
+    int sh = ORBLCD_DECODE_Y( a->modeDescriptor );
+
+    a->win.x0 = ( x < sw ) ? x : sw - 1;
+    a->win.y0 = ( y < sh ) ? y : sh - 1;
+    a->win.x1 = ( ( w ) && ( a->win.x0 + w < sw ) ) ? a->win.x0 + w : sw;
+    a->win.y1 = ( ( h ) && ( a->win.y0 + h < sh ) ) ? a->win.y0 + h : sh;
+    a->x = a->win.x0;
+    a->y = a->win.y0;
+}
 
-            default:
-                y = 0xff;
-                break;
-        }
+/*************************************/
 
-        /* Output bitdepth is always the same, so span calculation is too */
-        *( uint32_t * )&r->app->pixels[r->app->x * 4 + r->app->y * r->app->pwidth] = y | 0xff000000;
+static inline uint32_t _rgb565( uint32_t d )
 
-        if ( ++r->app->x >= ORBLCD_DECODE_X( r->app->modeDescriptor ) )
-        {
-            r->app->y++;
-            r->app->x = 0;
+/* Expand a 16 bit RGB565 pixel to ARGB8888 */
 
-            if ( r->app->y == ORBLCD_DECODE_Y( r->app->modeDescriptor ) )
+{
+    return 0xff000000 | ( ( d & 0xf800 ) << 8 ) | ( ( d & 0x07e0 ) << 5 ) | ( ( d & 0x001f ) << 3 );
+}
+
+/*************************************/
+
+static void _paintPixels( struct swMsg *m, struct RunTime *r )
+
+{
+    /* This is LCD data */
+    struct TApp *a = r->app;
+    uint32_t d = m->value;
+    uint32_t px[32];
+    int n = ORBLCD_PIXELS_PER_WORD( a->modeDescriptor );
+
+    if ( !a->pixels )
+    {
+        /* For whatever reason we aren't initialised yet */
+        return;
+    }
+
+    /* The whole word is expanded at once, with a straight loop per depth that the compiler can vectorise */
+    switch ( ORBLCD_DECODE_D( a->modeDescriptor ) )
+    {
+        case ORBLCD_DEPTH_1:
+            for ( int i = 0; i < 4; i++ )
+            {
+                memcpy( &px[i * 8], a->map1to24bit[( d >> ( i * 8 ) ) & 0xff], 8 * sizeof( uint32_t ) );
+            }
+
+            break;
+
+        case ORBLCD_DEPTH_8:
+            for ( int i = 0; i < 4; i++ )
             {
-                r->app->y = 0;
+                px[i] = a->map8to24bit[( d >> ( i * 8 ) ) & 0xff];
             }
 
             break;
+
+        case ORBLCD_DEPTH_16:
+            for ( int i = 0; i < 2; i++ )
+            {
+                px[i] = _rgb565( d >> ( i * 16 ) );
+            }
+
+            break;
+
+        default:
+            px[0] = d | 0xff000000;
+            break;
+    }
+
+    /* Lines always start with a new word, so anything past the end of this one is dropped */
+    if ( n > a->win.x1 - a->x )
+    {
+        n = a->win.x1 - a->x;
+    }
+
+    /* Output bitdepth is always the same, so span calculation is too */
+    memcpy( &a->pixels[a->x * 4 + a->y * a->pwidth], px, n * sizeof( uint32_t ) );
+    _rectAdd( &a->dirty, &( struct lcdRect )
+    {
+        a->x, a->y, a->x + n, a->y + 1
+    } );
+
+    if ( ( a->x += n ) >= a->win.x1 )
+    {
+        a->y++;
+        a->x = a->win.x0;
+
+        if ( a->y >= a->win.y1 )
+        {
+            a->y = a->win.y0;
         }
     }
 }
@@ -182,7 +317,7 @@ static void _handleCommand( struct swMsg *m, struct RunTime *r )
     switch ( ORBLCD_DECODE_C( m->value ) )
     {
         case ORBLCD_CMD_INIT_LCD: // -------------------------------------------------------
-            if ( ( !r->app->mainWindow ) || ( m->value != r->app->modeDescriptor ) )
+            if ( ( !r->app->pixels ) || ( m->value != r->app->modeDescriptor ) )
             {
                 /* Create a new, or replacement, SDL window */
                 genericsReport( V_ERROR, "%s window %dx%d, depth %d" EOL,
@@ -190,54 +325,101 @@ static void _handleCommand( struct swMsg *m, struct RunTime *r )
                                 ORBLCD_DECODE_X( m->value ), ORBLCD_DECODE_Y( m->value ), ORBLCD_GET_DEPTH( m->value ) );
                 r->app->modeDescriptor = m->value;
 
-                /* If this is due to a resize activity then destroy the old stuff */
-                if ( r->app->renderer )
+                /* Create the memory for drawing the image, and for handing frames over to be presented */
+                free( r->app->pixels );
+                r->app->pwidth        = sizeof( uint32_t ) * ORBLCD_DECODE_X( r->app->modeDescriptor );
+                r->app->pixels        = ( uint8_t * )calloc( ORBLCD_DECODE_Y( r->app->modeDescriptor ) * r->app->pwidth, 1 );
+                MEMCHECKV( r->app->pixels );
+
+                pthread_mutex_lock( &r->app->frameLock );
+                _waitTaken( r );
+                free( r->app->frame );
+                r->app->frame           = ( uint8_t * )calloc( ORBLCD_DECODE_Y( r->app->modeDescriptor ) * r->app->pwidth, 1 );
+                MEMCHECKV( r->app->frame );
+                r->app->frameDescriptor = r->app->modeDescriptor;
+                r->app->frameDirty      = ( struct lcdRect )
                 {
-                    SDL_DestroyRenderer( r->app->renderer );
-                }
+                    0, 0, ORBLCD_DECODE_X( r->app->modeDescriptor ), ORBLCD_DECODE_Y( r->app->modeDescriptor )
+                };
+                r->app->frameReady      = true;
+                pthread_mutex_unlock( &r->app->frameLock );
 
-                if ( r->app->mainWindow )
-                {
-                    SDL_DestroyWindow( r->app->mainWindow );
-                }
+                r->app->dirty.x1 = 0;
+
+                /* ...the window itself can only be made on the main thread */
+                _wake( r );
+            }
+            else
+            {
+                /* Hand over whatever's changed to be presented. If the last lot hasn't been yet then this */
+                /* is added to it.                                                                          */
+                struct lcdRect *d = &r->app->dirty;
+                bool wasReady;
 
-                if ( r->app->pixels )
+                if ( d->x1 > d->x0 )
                 {
-                    free( r->app->pixels );
+                    pthread_mutex_lock( &r->app->frameLock );
+                    _waitTaken( r );
+
+                    for ( int y = d->y0; y < d->y1; y++ )
+                    {
+                        memcpy( &r->app->frame[d->x0 * 4 + y * r->app->pwidth], &r->app->pixels[d->x0 * 4 + y * r->app->pwidth], ( d->x1 - d->x0 ) * 4 );
+                    }
+
+                    _rectAdd( &r->app->frameDirty, d );
+                    wasReady = r->app->frameReady;
+                    r->app->frameReady = true;
+                    pthread_mutex_unlock( &r->app->frameLock );
+                    d->x1 = 0;
+
+                    if ( !wasReady )
+                    {
+                        _wake( r );
+                    }
                 }
+            }
 
-                r->app->mainWindow    = SDL_CreateWindow( r->app->windowTitle,
-                                        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                                        ORBLCD_DECODE_X( r->app->modeDescriptor ) * r->app->scale, ORBLCD_DECODE_Y( r->app->modeDescriptor ) * r->app->scale, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE );
-                SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
-                r->app->renderer      = SDL_CreateRenderer( r->app->mainWindow, -1, SDL_RENDERER_ACCELERATED );
-                SDL_RenderSetLogicalSize( r->app->renderer, ORBLCD_DECODE_X( r->app->modeDescriptor ), ORBLCD_DECODE_Y( r->app->modeDescriptor ) );
-                r->app->texture       = SDL_CreateTexture( r->app->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, ORBLCD_DECODE_X( r->app->modeDescriptor ), ORBLCD_DECODE_Y( r->app->modeDescriptor ) );
+            _setWindow( r->app, 0, 0, 0, 0 );
+            break;
 
-                /* Create the memory for drawing the image */
-                r->app->pwidth        = sizeof( uint32_t ) * ORBLCD_DECODE_X( r->app->modeDescriptor );
-                r->app->pixels        = ( uint8_t * )calloc( ORBLCD_DECODE_Y( r->app->modeDescriptor ) * r->app->pwidth, 1 );
+        case ORBLCD_CMD_CLEAR: // -------------------------------------------------------------
+            if ( r->app->pixels )
+            {
+                memset( r->app->pixels, 0, ORBLCD_DECODE_Y( r->app->modeDescriptor ) * r->app->pwidth );
+                r->app->dirty = ( struct lcdRect )
+                {
+                    0, 0, ORBLCD_DECODE_X( r->app->modeDescriptor ), ORBLCD_DECODE_Y( r->app->modeDescriptor )
+                };
             }
-            else
+
+            break;
+
+        case ORBLCD_CMD_WINDOW_XY: // ---------------------------------------------------------
+            if ( r->app->pixels )
             {
-                /* Repaint the SDL window */
-                SDL_UpdateTexture( r->app->texture, NULL, r->app->pixels, r->app->pwidth );
-                SDL_RenderCopy( r->app->renderer, r->app->texture, NULL, NULL );
-                SDL_RenderPresent( r->app->renderer );
+                _setWindow( r->app, ORBLCD_DECODE_X( m->value ), ORBLCD_DECODE_Y( m->value ), 0, 0 );
             }
 
-            r->app->x = r->app->y = 0;
             break;
 
-        case ORBLCD_CMD_CLEAR: // -------------------------------------------------------------
+        case ORBLCD_CMD_WINDOW_WH: // ---------------------------------------------------------
             if ( r->app->pixels )
             {
-                memset( r->app->pixels, 0, ORBLCD_DECODE_Y( r->app->modeDescriptor ) * r->app->pwidth );
+                _setWindow( r->app, r->app->win.x0, r->app->win.y0, ORBLCD_DECODE_X( m->value ), ORBLCD_DECODE_Y( m->value ) );
             }
 
             break;
 
+        case ORBLCD_CMD_REPEAT: // ------------------------------------------------------------
+            r->app->repeat = ORBLCD_DECODE_N( m->value );
+            break;
+
         case ORBLCD_CMD_GOTOXY: // ------------------------------------------------------------
+            if ( r->app->pixels )
+            {
+                _setWindow( r->app, 0, 0, 0, 0 );
+            }
+
             if ( ORBLCD_DECODE_X( m->value ) < ORBLCD_DECODE_X( r->app->modeDescriptor ) )
             {
                 r->app->x = ORBLCD_DECODE_X( m->value );
@@ -263,7 +445,15 @@ static void _handleSW( struct swMsg *m, struct RunTime *r )
 {
     if ( ( m->srcAddr == r->app->chan ) && ( r->app->pixels ) )
     {
-        _paintPixels( m, r );
+        /* A repeat only applies to the word that follows it */
+        uint32_t n = ( r->app->repeat ) ? r->app->repeat : 1;
+
+        r->app->repeat = 0;
+
+        while ( n-- )
+        {
+            _paintPixels( m, r );
+        }
     }
     else if ( m->srcAddr == r->app->chan + 1 )
     {
@@ -297,11 +487,11 @@ void _itmPumpProcess( char c, struct RunTime *r )
             break;
 
         case ITM_EV_OVERFLOW:
-            genericsReport( V_INFO, "ITM Overflow" EOL );
+            genericsReportRateLimited( V_INFO, "ITM Overflow" EOL );
             break;
 
         case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
+            genericsReportRateLimited( V_WARN, "ITM Error" EOL );
             break;
 
         case ITM_EV_PACKET_RXED:
@@ -326,11 +516,19 @@ static struct Stream *_tryOpenStream( struct RunTime *r )
 {
     if ( r->options->file != NULL )
     {
-        return streamCreateFile( r->options->file );
+        return streamCreateMappedFile( r->options->file );
     }
     else
     {
-        return streamCreateSocket( r->options->server, r->options->port );
+        struct Stream *stream = streamCreateSocket( r->options->server, r->options->port );
+
+        if ( ( stream ) && ( r->options->protocol == PROT_OFLOW ) )
+        {
+            uint8_t tag = r->options->tag;
+            nwSubscribe( stream, 1, &tag );
+        }
+
+        return stream;
     }
 }
 // ====================================================================================================
@@ -342,7 +540,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
@@ -358,7 +556,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 
 // ====================================================================================================
 
-static bool _feedStream( struct Stream *stream, struct RunTime *r )
+static void _feedStream( struct Stream *stream, struct RunTime *r )
 {
     unsigned char cbw[TRANSFER_SIZE];
     struct timeval t =
@@ -366,27 +564,17 @@ static bool _feedStream( struct Stream *stream, struct RunTime *r )
         .tv_sec = 0,
         .tv_usec = 100000
     };
-    SDL_Event e;
 
     while ( !_r.ending )
     {
         size_t receivedSize;
         enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, &t, &receivedSize );
 
-        /* Check for SDL close */
-        while ( SDL_PollEvent( &e ) != 0 )
-        {
-            if ( e.type == SDL_QUIT )
-            {
-                return false;
-            }
-        }
-
         if ( result != RECEIVE_RESULT_OK )
         {
             if ( result == RECEIVE_RESULT_EOF && r->options->fileTerminate )
             {
-                return true;
+                return;
             }
             else if ( result == RECEIVE_RESULT_ERROR )
             {
@@ -400,7 +588,7 @@ static bool _feedStream( struct Stream *stream, struct RunTime *r )
 
         if ( PROT_OFLOW == r->options->protocol )
         {
-            OFLOWPump( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
+            OFLOWPumpInPlace( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
         }
         else
         {
@@ -412,8 +600,6 @@ static bool _feedStream( struct Stream *stream, struct RunTime *r )
             }
         }
     }
-
-    return true;
 }
 
 // ====================================================================================================
@@ -427,6 +613,7 @@ void _printHelp( const char *const progName )
     genericsPrintf( "    -f, --input-file:   <filename> Take input from specified file" EOL );
     genericsPrintf( "    -h, --help:         This help" EOL );
     genericsPrintf( "    -n, --itm-sync:     Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
+    genericsPrintf( "    -o, --output:       <shm:name|png:pattern|raw:pattern> Put frames there instead of in a window" EOL );
     genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
     genericsPrintf( "    -S, --sbcolour:     <Colour> to be used for single bit renders, ignored for other bit depths" EOL );
@@ -451,6 +638,7 @@ static struct option _longOptions[] =
     {"help", no_argument, NULL, 'h'},
     {"input-file", required_argument, NULL, 'f'},
     {"itm-sync", no_argument, NULL, 'n'},
+    {"output", required_argument, NULL, 'o'},
     {"protocol", required_argument, NULL, 'p'},
     {"server", required_argument, NULL, 's'},
     {"sbcolour", required_argument, NULL, 'S'},
@@ -471,7 +659,7 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
     bool serverExplicit = false;
     bool portExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "c:Ef:hnp:s:S:t:v:Vw:z:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "c:Ef:hno:p:s:S:t:v:Vw:z:", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -500,6 +688,11 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->forceITMSync = false;
                 break;
 
+            // ------------------------------------
+            case 'o':
+                r->app->output = optarg;
+                break;
+
             // ------------------------------------
 
             case 'p':
@@ -628,7 +821,21 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
     genericsReport( V_INFO, "Relative Scale : %1.2f:1" EOL, r->app->scale );
     genericsReport( V_INFO, "Window Title   : %s" EOL, r->app->windowTitle );
 
-    if ( r->options->port )
+    if ( r->app->output )
+    {
+        genericsReport( V_INFO, "Frame Output   : %s" EOL, r->app->output );
+    }
+
+#ifdef ORBLCD_NO_SDL
+    else
+    {
+        genericsReport( V_ERROR, "Built without SDL, so frames can only be put out with -o" EOL );
+        return false;
+    }
+
+#endif
+
+    if ( ( r->options->port ) && ( !r->options->file ) )
     {
         genericsReport( V_INFO, "NW SERVER H&P  : %s:%d" EOL, r->options->server, r->options->port );
     }
@@ -647,7 +854,8 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
         }
     }
 
-    if ( ( r->options->file ) && ( r->options->port ) )
+    /* The port always has a default, so it's only a clash if a server was asked for */
+    if ( ( r->options->file ) && ( serverExplicit ) )
     {
         genericsReport( V_ERROR, "Cannot specify file and port or NW Server at same time" EOL );
         return false;
@@ -671,6 +879,206 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
     return true;
 }
 
+// ====================================================================================================
+static void *_decodeThread( void *param )
+
+/* Connect to the source and decode it into frames, leaving the window to the main thread */
+
+{
+    struct RunTime *r = ( struct RunTime * )param;
+    bool alreadyReported = false;
+
+    while ( !r->ending )
+    {
+        struct Stream *stream = NULL;
+
+        while ( !r->ending )
+        {
+            stream = _tryOpenStream( r );
+
+            if ( stream != NULL )
+            {
+                if ( alreadyReported )
+                {
+                    genericsReport( V_INFO, "Connected" EOL );
+                    alreadyReported = false;
+                }
+
+                break;
+            }
+
+            if ( !alreadyReported )
+            {
+                genericsReport( V_INFO, EOL "No connection" EOL );
+                alreadyReported = true;
+            }
+
+            if ( r->options->fileTerminate )
+            {
+                break;
+            }
+
+            /* Checking every 100ms for a connection is quite often enough */
+            usleep( 100000 );
+        }
+
+        if ( stream != NULL )
+        {
+            _feedStream( stream, r );
+            stream->close( stream );
+            free( stream );
+        }
+
+        if ( r->options->fileTerminate )
+        {
+            break;
+        }
+    }
+
+    r->decodeDone = true;
+    _wake( r );
+    return NULL;
+}
+// ====================================================================================================
+static void _putFrames( struct RunTime *r )
+
+/* Without a window, put each frame out as it arrives. From a live source, if this can't keep up */
+/* frames are merged just as they would be for a window that's slow to present.                 */
+
+{
+    struct TApp *a = r->app;
+    struct timespec until;
+    size_t len;
+    int mode;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &a->frameLock );
+
+        while ( ( !a->frameReady ) && ( !r->decodeDone ) )
+        {
+            /* decodeDone isn't under the lock, so don't rely on the wake for it */
+            clock_gettime( CLOCK_REALTIME, &until );
+
+            if ( ( until.tv_nsec += 100000000 ) >= 1000000000 )
+            {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait( &a->frameCond, &a->frameLock, &until );
+        }
+
+        if ( !a->frameReady )
+        {
+            pthread_mutex_unlock( &a->frameLock );
+            break;
+        }
+
+        mode = a->frameDescriptor;
+        len  = ( size_t )ORBLCD_DECODE_Y( mode ) * ORBLCD_DECODE_X( mode ) * sizeof( uint32_t );
+
+        if ( len > a->outLen )
+        {
+            free( a->outFrame );
+            a->outFrame = ( uint32_t * )malloc( a->outLen = len );
+            MEMCHECKV( a->outFrame );
+        }
+
+        memcpy( a->outFrame, a->frame, len );
+        a->frameDirty.x1 = 0;
+        a->frameReady = false;
+        pthread_cond_broadcast( &a->frameCond );
+        pthread_mutex_unlock( &a->frameLock );
+
+        if ( !frameSinkWrite( a->sink, a->outFrame, ORBLCD_DECODE_X( mode ), ORBLCD_DECODE_Y( mode ) ) )
+        {
+            pthread_mutex_lock( &a->frameLock );
+            r->ending = true;
+            pthread_cond_broadcast( &a->frameCond );
+            pthread_mutex_unlock( &a->frameLock );
+            break;
+        }
+    }
+}
+// ====================================================================================================
+#ifndef ORBLCD_NO_SDL
+static void _updateWindow( struct RunTime *r )
+
+/* Make sure the window matches the mode being sent, and present any new frame into it */
+
+{
+    struct TApp *a = r->app;
+    bool present = false;
+    int mode;
+    int pitch;
+    void *tp;
+
+    pthread_mutex_lock( &a->frameLock );
+    mode = a->frameDescriptor;
+    pthread_mutex_unlock( &a->frameLock );
+
+    if ( ( mode ) && ( mode != a->windowDescriptor ) )
+    {
+        /* If this is due to a resize activity then destroy the old stuff */
+        if ( a->texture )
+        {
+            SDL_DestroyTexture( a->texture );
+        }
+
+        if ( a->renderer )
+        {
+            SDL_DestroyRenderer( a->renderer );
+        }
+
+        if ( a->mainWindow )
+        {
+            SDL_DestroyWindow( a->mainWindow );
+        }
+
+        a->mainWindow    = SDL_CreateWindow( a->windowTitle,
+                                             SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                             ORBLCD_DECODE_X( mode ) * a->scale, ORBLCD_DECODE_Y( mode ) * a->scale, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE );
+        SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
+        a->renderer      = SDL_CreateRenderer( a->mainWindow, -1, SDL_RENDERER_ACCELERATED );
+        SDL_RenderSetLogicalSize( a->renderer, ORBLCD_DECODE_X( mode ), ORBLCD_DECODE_Y( mode ) );
+        a->texture       = SDL_CreateTexture( a->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ORBLCD_DECODE_X( mode ), ORBLCD_DECODE_Y( mode ) );
+        a->windowDescriptor = mode;
+    }
+
+    /* Copy just what's changed in the frame straight into the texture, which may have a different pitch to ours */
+    pthread_mutex_lock( &a->frameLock );
+
+    if ( ( a->frameReady ) && ( a->frameDescriptor == a->windowDescriptor ) && ( a->texture ) )
+    {
+        struct lcdRect *d = &a->frameDirty;
+        SDL_Rect rc = { d->x0, d->y0, d->x1 - d->x0, d->y1 - d->y0 };
+        int w = sizeof( uint32_t ) * ORBLCD_DECODE_X( a->frameDescriptor );
+
+        if ( ( d->x1 > d->x0 ) && ( !SDL_LockTexture( a->texture, &rc, &tp, &pitch ) ) )
+        {
+            for ( int y = d->y0; y < d->y1; y++ )
+            {
+                memcpy( ( uint8_t * )tp + ( y - d->y0 ) * pitch, &a->frame[y * w + d->x0 * 4], rc.w * 4 );
+            }
+
+            SDL_UnlockTexture( a->texture );
+            present = true;
+        }
+
+        d->x1 = 0;
+        a->frameReady = false;
+    }
+
+    pthread_mutex_unlock( &a->frameLock );
+
+    if ( present )
+    {
+        SDL_RenderCopy( a->renderer, a->texture, NULL, NULL );
+        SDL_RenderPresent( a->renderer );
+    }
+}
+#endif
 // ====================================================================================================
 static void _intHandler( int sig )
 
@@ -688,7 +1096,7 @@ static void _intHandler( int sig )
 int main( int argc, char *argv[] )
 
 {
-    bool alreadyReported = false;
+    pthread_t decoder;
 
     if ( !_processOptions( argc, argv, &_r ) )
     {
@@ -699,75 +1107,81 @@ int main( int argc, char *argv[] )
     ITMDecoderInit( &_r.i, _r.options->forceITMSync );
     OFLOWInit( &_r.c );
 
-    if ( SDL_Init( SDL_INIT_VIDEO ) < 0 )
+    /* Headless running doesn't go near SDL at all, so it's fine on a machine with no display */
+    if ( _r.app->output )
+    {
+        if ( !( _r.app->sink = frameSinkCreate( _r.app->output ) ) )
+        {
+            genericsExit( -1, "Could not set up frame output" EOL );
+        }
+    }
+
+#ifndef ORBLCD_NO_SDL
+    else
     {
-        genericsExit( -1, "Could not initailise SDL" );
+        if ( SDL_Init( SDL_INIT_VIDEO ) < 0 )
+        {
+            genericsExit( -1, "Could not initailise SDL" );
+        }
+
+        if ( ( _r.app->wakeEvent = SDL_RegisterEvents( 1 ) ) == ( Uint32 ) - 1 )
+        {
+            genericsExit( -1, "Could not create SDL resources" EOL );
+        }
     }
 
+#endif
+
     /* This ensures the signal handler gets called */
     if ( SIG_ERR == signal( SIGINT, _intHandler ) )
     {
         genericsExit( -1, "Failed to establish Int handler" EOL );
     }
 
-    /* Load up default colour index map R3G3B2 */
+    /* Load up default colour index map R3G3B2, and the map for single bit renders */
     for ( int i = 0; i < 256; i++ )
     {
-        _r.app->map8to24bit[i] = ( ( i & 0xE0 ) << 21 ) | ( ( i & 0x1c ) << 13 ) | ( i << 6 );
-    }
-
-    while ( !_r.ending )
-    {
-        struct Stream *stream = NULL;
+        _r.app->map8to24bit[i] = 0xff000000 | ( ( i & 0xE0 ) << 16 ) | ( ( i & 0x1c ) << 11 ) | ( ( i & 0x03 ) << 6 );
 
-        while ( !_r.ending )
+        for ( int b = 0; b < 8; b++ )
         {
-            stream = _tryOpenStream( &_r );
-
-            if ( stream != NULL )
-            {
-                if ( alreadyReported )
-                {
-                    genericsReport( V_INFO, "Connected" EOL );
-                    alreadyReported = false;
-                }
-
-                break;
-            }
+            _r.app->map1to24bit[i][b] = 0xff000000 | ( ( i & ( 0x80 >> b ) ) ? _r.app->sbcolour : 0 );
+        }
+    }
 
-            if ( !alreadyReported )
-            {
-                genericsReport( V_INFO, EOL "No connection" EOL );
-                alreadyReported = true;
-            }
+    /* Decoding happens on a thread of its own, this one looks after the window or the frame output */
+    if ( pthread_create( &decoder, NULL, _decodeThread, &_r ) )
+    {
+        genericsExit( -1, "Failed to create decode thread" EOL );
+    }
 
-            if ( _r.options->fileTerminate )
-            {
-                break;
-            }
+    if ( _r.app->sink )
+    {
+        _putFrames( &_r );
+        _r.ending = true;
+        pthread_join( decoder, NULL );
+        genericsReport( V_INFO, "%" PRIu64 " frames put out" EOL, frameSinkFrames( _r.app->sink ) );
+        frameSinkDelete( _r.app->sink );
+        free( _r.app->outFrame );
+        return 0;
+    }
 
-            /* Checking every 100ms for a connection is quite often enough */
-            usleep( 100000 );
-        }
+#ifndef ORBLCD_NO_SDL
+    SDL_Event e;
 
-        if ( stream != NULL )
+    while ( !_r.decodeDone )
+    {
+        if ( ( SDL_WaitEventTimeout( &e, 100 ) ) && ( e.type == SDL_QUIT ) )
         {
-            if ( !_feedStream( stream, &_r ) )
-            {
-                break;
-            }
-
-            stream->close( stream );
-            free( stream );
+            _r.ending = true;
         }
 
-        if ( _r.options->fileTerminate )
-        {
-            break;
-        }
+        _updateWindow( &_r );
     }
 
+    pthread_join( decoder, NULL );
     SDL_Quit();
+#endif
     return 0;
 }
 // ====================================================================================================
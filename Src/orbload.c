@@ -0,0 +1,844 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Load Generator for Orbuculum
+ * ============================
+ *
+ * Feeds orbuculum a synthetic ITM stream at a set rate, so it can be stressed without any hardware
+ * attached. The stream is either served to orbuculum -s, or written into a file or FIFO for
+ * orbuculum -f, and it can be raw ITM, ITM in TPIU frames, or OFLOW. A number of dummy clients
+ * can be attached to orbuculum's output at the same time.
+ *
+ * Probe messages go into the stream alongside printf-like filler. Each probe is a sequence
+ * number on one software channel and its send time on the next. That lets every client work out
+ * the throughput delivered to it, how late the data arrived, and how many probes never arrived.
+ * The clients and the generator must be on the same machine for the latencies to mean anything.
+ *
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "nw.h"
+#include "git_version_info.h"
+#include "generics.h"
+#include "itmDecoder.h"
+#include "msgDecoder.h"
+#include "tpiuDecoder.h"
+#include "oflow.h"
+#include "stream.h"
+
+#define NWSERVER_PORT     (2332)                  /* Where orbuculum -s looks by default */
+#define OFLOW_SIG         "%%ORBFLOW1.0.0%%"      /* The way an OFLOW capture file starts */
+#define OFLOW_SIG_LEN     (sizeof(OFLOW_SIG)-1)
+
+#define ITM_BLOCK_LEN     (2048)                  /* ITM is generated, wrapped and sent in lumps of about this much */
+#define PROBE_INTERVAL    (1024)                  /* Bytes of filler between probes */
+#define SYNC_INTERVAL     (65536)                 /* ...and between ITM syncs, so late joining clients can pick up */
+#define PROBE_SEQ_CHANNEL (30)
+#define PROBE_TS_CHANNEL  (31)
+#define TPIU_DATA_LEN     (14)                    /* Data bytes carried in each generated TPIU frame */
+#define TPIU_SYNC_FRAMES  (32)                    /* Frames between full TPIU syncs */
+
+#define MAX_CLIENTS       (1024)
+#define RX_BUFLEN         (65536)
+#define MSG_BLOCK_LEN     (256)
+#define CONNECT_RETRY_US  (100000)
+
+enum Mode { MODE_ITM, MODE_TPIU, MODE_OFLOW, MODE_NUM };
+static const char *_modeString[MODE_NUM] = { "ITM", "TPIU", "OFLOW" };
+static const char *_qosString[NW_QOS_NUM] = { "default", "latency", "bulk" };
+
+// Record for options, either defaults or from command line
+struct
+{
+    enum Mode mode;                       /* What the generated stream looks like */
+    int serverPort;                       /* Port to serve the stream on, for orbuculum -s */
+    char *file;                           /* ...or file to write it into, for orbuculum -f */
+    uint32_t rate;                        /* Bytes per second to send, 0 for as fast as possible */
+    uint32_t duration;                    /* Seconds to run for */
+    int clients;                          /* Dummy clients to attach */
+    char *clientHost;                     /* Where to attach them */
+    int clientPort;
+    bool legacy;                          /* Clients take raw ITM from a legacy port rather than OFLOW */
+    enum nwQoS qos;                       /* Class of service clients ask for */
+    uint8_t tag;                          /* OFLOW tag and TPIU stream the ITM is in */
+} options =
+{
+    .rate = 1000000,
+    .duration = 10,
+    .clientHost = "localhost",
+    .clientPort = OFCLIENT_SERVER_PORT,
+    .tag = DEFAULT_ITM_STREAM,
+};
+
+struct client
+{
+    pthread_t thread;
+    int id;
+    bool connected;                       /* Ever managed to connect */
+
+    uint64_t bytes;                       /* Bytes delivered */
+    uint64_t probes;                      /* Probes received */
+    uint64_t dropped;                     /* Probes that should have been received, but weren't */
+    uint64_t latSum;                      /* Total, least and most latency of probes, in uS */
+    uint32_t latMin;
+    uint32_t latMax;
+
+    bool haveSeq;                         /* Seen a sequence number yet */
+    uint32_t lastSeq;                     /* ...the last one */
+    bool seqPending;                      /* Got a sequence number, waiting for its time */
+
+    struct ITMDecoder i;
+    struct OFLOW o;
+};
+
+struct
+{
+    atomic_bool ending;                   /* Time to stop */
+    int fd;                               /* Where the stream is going */
+    int listenFd;                         /* Socket orbuculum connects to, when serving */
+
+    /* Generator state */
+    uint32_t seq;                         /* Next probe sequence number */
+    int sinceProbe;                       /* Filler since the last probe */
+    int sinceSync;                        /* ...and since the last ITM sync */
+    uint64_t genStart;                    /* When the stream started to flow */
+    uint64_t genEnd;                      /* ...and when it stopped */
+    uint64_t itmBytes;                    /* ITM generated */
+    uint64_t wireBytes;                   /* Bytes actually sent, after wrapping */
+    uint8_t itm[ITM_BLOCK_LEN + 32];      /* ITM under construction */
+    int ilen;
+    int tpiuFrames;                       /* Frames since the last TPIU sync */
+    struct Frame frame;                   /* OFLOW frame */
+
+    struct client *c;
+} _r;
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Stream generation
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint32_t _nowuS( void )
+
+{
+    return ( uint32_t )( genericsMonotonicnS() / 1000 );
+}
+// ====================================================================================================
+static void _putProbe( uint8_t channel, uint32_t value )
+
+{
+    uint8_t *p = &_r.itm[_r.ilen];
+
+    p[0] = ( channel << 3 ) | 3;
+    memcpy( &p[1], &value, sizeof( value ) );
+    _r.ilen += 5;
+}
+// ====================================================================================================
+static void _generateITM( void )
+
+/* Fill the ITM buffer with filler, probes and the occasional sync */
+
+{
+    _r.ilen = 0;
+
+    while ( _r.ilen < ITM_BLOCK_LEN )
+    {
+        if ( _r.sinceSync >= SYNC_INTERVAL )
+        {
+            static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0x80 };
+            memcpy( &_r.itm[_r.ilen], sync, sizeof( sync ) );
+            _r.ilen += sizeof( sync );
+            _r.sinceSync = 0;
+        }
+
+        if ( _r.sinceProbe >= PROBE_INTERVAL )
+        {
+            _putProbe( PROBE_SEQ_CHANNEL, _r.seq++ );
+            _putProbe( PROBE_TS_CHANNEL, _nowuS() );
+            _r.sinceProbe = 0;
+        }
+
+        /* Filler is what a retargeted printf sends, a byte at a time on channel 0 */
+        _r.itm[_r.ilen++] = 0x01;
+        _r.itm[_r.ilen++] = ' ' + rand() % 95;
+        _r.sinceProbe += 2;
+        _r.sinceSync += 2;
+    }
+
+    _r.itmBytes += _r.ilen;
+}
+// ====================================================================================================
+static bool _send( const uint8_t *d, size_t len )
+
+{
+    ssize_t n;
+
+    while ( len )
+    {
+        if ( ( n = write( _r.fd, d, len ) ) <= 0 )
+        {
+            if ( ( n < 0 ) && ( errno == EINTR ) )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        d += n;
+        len -= n;
+        _r.wireBytes += n;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _sendTPIU( void )
+
+/* Wrap the ITM into TPIU frames for the tag stream. Each frame opens with an ID change, then */
+/* carries TPIU_DATA_LEN bytes, with the low bit of each even-positioned byte in the aux byte. */
+/* Anything that doesn't fill a frame waits for the next lot of ITM.                        */
+
+{
+    static const uint8_t sync[] = { 0xff, 0xff, 0xff, 0x7f };
+    static uint8_t carry[TPIU_DATA_LEN];
+    static int clen;
+    uint8_t out[( ( ITM_BLOCK_LEN + 32 ) / TPIU_DATA_LEN + 2 ) * ( TPIU_PACKET_LEN + sizeof( sync ) )];
+    uint8_t d[TPIU_DATA_LEN];
+    int olen = 0, ip = 0;
+
+    while ( clen + _r.ilen - ip >= TPIU_DATA_LEN )
+    {
+        memcpy( d, carry, clen );
+        memcpy( &d[clen], &_r.itm[ip], TPIU_DATA_LEN - clen );
+        ip += TPIU_DATA_LEN - clen;
+        clen = 0;
+
+        if ( !( _r.tpiuFrames++ % TPIU_SYNC_FRAMES ) )
+        {
+            memcpy( &out[olen], sync, sizeof( sync ) );
+            olen += sizeof( sync );
+        }
+
+        uint8_t *f = &out[olen];
+        f[0] = ( options.tag << 1 ) | 1;
+        f[1] = d[0];
+        f[15] = 0;
+
+        for ( int i = 2, k = 1; i < TPIU_PACKET_LEN; i += 2 )
+        {
+            f[i] = d[k] & 0xfe;
+            f[15] |= ( d[k++] & 1 ) << ( i / 2 );
+
+            if ( i < TPIU_PACKET_LEN - 2 )
+            {
+                f[i + 1] = d[k++];
+            }
+        }
+
+        olen += TPIU_PACKET_LEN;
+    }
+
+    memcpy( &carry[clen], &_r.itm[ip], _r.ilen - ip );
+    clen += _r.ilen - ip;
+
+    return _send( out, olen );
+}
+// ====================================================================================================
+static bool _sendBlock( void )
+
+{
+    switch ( options.mode )
+    {
+        case MODE_TPIU:
+            return _sendTPIU();
+
+        case MODE_OFLOW:
+            OFLOWEncode( options.tag, 0, _r.itm, _r.ilen, &_r.frame );
+            return _send( _r.frame.d, _r.frame.len );
+
+        default:
+            return _send( _r.itm, _r.ilen );
+    }
+}
+// ====================================================================================================
+static bool _openOutput( void )
+
+/* Get somewhere to send the stream, waiting for orbuculum to connect if we're serving */
+
+{
+    if ( options.file )
+    {
+        /* A FIFO won't open until orbuculum has it open for reading */
+        if ( ( _r.fd = open( options.file, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) < 0 )
+        {
+            genericsReport( V_ERROR, "Can't open %s (%s)" EOL, options.file, strerror( errno ) );
+            return false;
+        }
+
+        return ( options.mode != MODE_OFLOW ) || _send( ( const uint8_t * )OFLOW_SIG, OFLOW_SIG_LEN );
+    }
+
+    genericsReport( V_INFO, "Waiting for orbuculum on port %d" EOL, options.serverPort );
+
+    while ( ( !_r.ending ) && ( ( _r.fd = accept( _r.listenFd, NULL, NULL ) ) < 0 ) )
+    {
+        if ( ( errno != EINTR ) && ( !_r.ending ) )
+        {
+            genericsReport( V_ERROR, "Accept failed (%s)" EOL, strerror( errno ) );
+            return false;
+        }
+    }
+
+    if ( _r.fd >= 0 )
+    {
+        int one = 1;
+        setsockopt( _r.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+        genericsReport( V_INFO, "orbuculum connected" EOL );
+    }
+
+    return _r.fd >= 0;
+}
+// ====================================================================================================
+static bool _listen( void )
+
+{
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons( options.serverPort ), .sin_addr.s_addr = htonl( INADDR_ANY ) };
+    int one = 1;
+
+    if ( ( _r.listenFd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        return false;
+    }
+
+    setsockopt( _r.listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+
+    if ( ( bind( _r.listenFd, ( struct sockaddr * )&a, sizeof( a ) ) < 0 ) || ( listen( _r.listenFd, 1 ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Can't listen on port %d (%s)" EOL, options.serverPort, strerror( errno ) );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void *_generator( void *arg )
+
+/* Send the stream at the requested rate until time is up */
+
+{
+    uint64_t start, now, due;
+
+    if ( !_openOutput() )
+    {
+        _r.ending = true;
+        return NULL;
+    }
+
+    start = _r.genStart = genericsMonotonicnS();
+
+    while ( !_r.ending )
+    {
+        _generateITM();
+
+        if ( !_sendBlock() )
+        {
+            genericsReport( V_WARN, "Lost the connection to orbuculum" EOL );
+            close( _r.fd );
+
+            if ( ( options.file ) || ( !_openOutput() ) )
+            {
+                break;
+            }
+        }
+
+        /* Stay on the line from the start by sleeping off any time we're ahead of it */
+        if ( options.rate )
+        {
+            now = genericsMonotonicnS();
+            due = start + _r.wireBytes * 1000000000ULL / options.rate;
+
+            if ( due > now )
+            {
+                usleep( ( due - now ) / 1000 );
+            }
+        }
+    }
+
+    _r.genEnd = genericsMonotonicnS();
+    _r.ending = true;
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Dummy clients
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _probe( struct client *c, uint8_t channel, uint32_t value )
+
+{
+    if ( channel == PROBE_SEQ_CHANNEL )
+    {
+        if ( ( c->haveSeq ) && ( value - c->lastSeq > 1 ) )
+        {
+            c->dropped += value - c->lastSeq - 1;
+        }
+
+        c->haveSeq = true;
+        c->seqPending = true;
+        c->lastSeq = value;
+    }
+    else if ( c->seqPending )
+    {
+        uint32_t lat = _nowuS() - value;
+
+        c->seqPending = false;
+        c->probes++;
+        c->latSum += lat;
+        c->latMin = ( ( c->probes == 1 ) || ( lat < c->latMin ) ) ? lat : c->latMin;
+        c->latMax = ( lat > c->latMax ) ? lat : c->latMax;
+    }
+}
+// ====================================================================================================
+static void _itmRxed( struct client *c, const uint8_t *d, size_t len )
+
+{
+    struct msg m[MSG_BLOCK_LEN];
+    size_t n, used;
+
+    while ( len )
+    {
+        n = ITMPumpBlock( &c->i, d, len, m, MSG_BLOCK_LEN, &used );
+        d += used;
+        len -= used;
+
+        for ( size_t j = 0; j < n; j++ )
+        {
+            if ( ( m[j].genericMsg.msgtype == MSG_SOFTWARE ) &&
+                    ( ( m[j].swMsg.srcAddr == PROBE_SEQ_CHANNEL ) || ( m[j].swMsg.srcAddr == PROBE_TS_CHANNEL ) ) )
+            {
+                _probe( c, m[j].swMsg.srcAddr, m[j].swMsg.value );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _oflowRxed( struct OFLOWFrame *p, void *param )
+
+{
+    if ( ( p->good ) && ( p->tag == options.tag ) )
+    {
+        _itmRxed( ( struct client * )param, p->d, p->len );
+    }
+}
+// ====================================================================================================
+static void *_client( void *arg )
+
+/* A client that does nothing but count what it's sent */
+
+{
+    struct client *c = ( struct client * )arg;
+    static uint8_t buf[MAX_CLIENTS][RX_BUFLEN];
+    struct Stream *stream = NULL;
+    struct timeval tv;
+    size_t got;
+
+    ITMDecoderInit( &c->i, false );
+    OFLOWInit( &c->o );
+
+    while ( !_r.ending )
+    {
+        if ( !stream )
+        {
+            if ( !( stream = streamCreateSocket( options.clientHost, options.clientPort ) ) )
+            {
+                usleep( CONNECT_RETRY_US );
+                continue;
+            }
+
+            if ( !options.legacy )
+            {
+                nwSubscribe( stream, 1, &options.tag );
+            }
+
+            if ( options.qos != NW_QOS_DEFAULT )
+            {
+                nwRequestQoS( stream, options.qos );
+            }
+
+            c->connected = true;
+        }
+
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+
+        switch ( stream->receive( stream, buf[c->id], RX_BUFLEN, &tv, &got ) )
+        {
+            case RECEIVE_RESULT_OK:
+                c->bytes += got;
+
+                if ( options.legacy )
+                {
+                    _itmRxed( c, buf[c->id], got );
+                }
+                else
+                {
+                    OFLOWPump( &c->o, buf[c->id], got, _oflowRxed, c );
+                }
+
+                break;
+
+            case RECEIVE_RESULT_TIMEOUT:
+                break;
+
+            default:
+                stream->close( stream );
+                free( stream );
+                stream = NULL;
+                break;
+        }
+    }
+
+    if ( stream )
+    {
+        stream->close( stream );
+        free( stream );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Setup and reporting
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _intHandler( int sig )
+
+{
+    _r.ending = true;
+}
+// ====================================================================================================
+static void _printHelp( const char *const progName )
+
+{
+    genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "    -c, --clients:      <n> Dummy clients to attach to orbuculum (default 0)" EOL );
+    genericsPrintf( "    -C, --client-host:  <host>:<port> Where the clients attach (default localhost:%d)" EOL, OFCLIENT_SERVER_PORT );
+    genericsPrintf( "    -d, --duration:     <seconds> How long to run for (default %d)" EOL, options.duration );
+    genericsPrintf( "    -h, --help:         This help" EOL );
+    genericsPrintf( "    -L, --legacy:       Clients take raw ITM from a legacy port rather than OFLOW" EOL );
+    genericsPrintf( "    -m, --mode:         <ITM|TPIU|OFLOW> What to generate (default ITM, OFLOW only to a file)" EOL );
+    genericsPrintf( "    -o, --output-file:  <filename> File or FIFO to write the stream into, for orbuculum -f" EOL );
+    genericsPrintf( "    -q, --qos:          <latency|bulk> Class of service the clients ask for (default none)" EOL );
+    genericsPrintf( "    -r, --rate:         <bytes/s> Rate to send at, 0 for as fast as possible (default %d)" EOL, options.rate );
+    genericsPrintf( "    -s, --serve:        [port] Serve the stream for orbuculum -s (default port %d)" EOL, NWSERVER_PORT );
+    genericsPrintf( "    -t, --tag:          <stream> OFLOW tag or TPIU stream that carries the ITM (default %d)" EOL, options.tag );
+    genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "    -V, --version:      Print version and exit" EOL );
+}
+// ====================================================================================================
+static void _printVersion( void )
+
+{
+    genericsPrintf( "orbload version " GIT_DESCRIBE EOL );
+}
+// ====================================================================================================
+static struct option _longOptions[] =
+{
+    {"clients", required_argument, NULL, 'c'},
+    {"client-host", required_argument, NULL, 'C'},
+    {"duration", required_argument, NULL, 'd'},
+    {"help", no_argument, NULL, 'h'},
+    {"legacy", no_argument, NULL, 'L'},
+    {"mode", required_argument, NULL, 'm'},
+    {"output-file", required_argument, NULL, 'o'},
+    {"qos", required_argument, NULL, 'q'},
+    {"rate", required_argument, NULL, 'r'},
+    {"serve", optional_argument, NULL, 's'},
+    {"tag", required_argument, NULL, 't'},
+    {"verbose", required_argument, NULL, 'v'},
+    {"version", no_argument, NULL, 'V'},
+    {NULL, no_argument, NULL, 0}
+};
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[] )
+
+{
+    int c, optionIndex = 0;
+    char *a;
+
+    while ( ( c = getopt_long ( argc, argv, "c:C:d:hLm:o:q:r:s::t:v:V", _longOptions, &optionIndex ) ) != -1 )
+        switch ( c )
+        {
+            // ------------------------------------
+            case 'c':
+                options.clients = atoi( optarg );
+
+                if ( ( options.clients < 0 ) || ( options.clients > MAX_CLIENTS ) )
+                {
+                    genericsReport( V_ERROR, "Number of clients out of range (0..%d)" EOL, MAX_CLIENTS );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'C':
+                options.clientHost = optarg;
+
+                if ( ( a = strchr( optarg, ':' ) ) )
+                {
+                    *a = 0;
+                    options.clientPort = atoi( a + 1 );
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'd':
+                options.duration = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'h':
+                _printHelp( argv[0] );
+                return false;
+
+            // ------------------------------------
+            case 'L':
+                options.legacy = true;
+
+                if ( options.clientPort == OFCLIENT_SERVER_PORT )
+                {
+                    options.clientPort = NWCLIENT_SERVER_PORT;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'm':
+                options.mode = MODE_NUM;
+
+                for ( int i = 0; i < MODE_NUM; i++ )
+                {
+                    if ( !strcasecmp( _modeString[i], optarg ) )
+                    {
+                        options.mode = i;
+                    }
+                }
+
+                if ( options.mode == MODE_NUM )
+                {
+                    genericsReport( V_ERROR, "Unrecognised mode" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'o':
+                options.file = optarg;
+                break;
+
+            // ------------------------------------
+            case 'q':
+                options.qos = NW_QOS_NUM;
+
+                for ( int i = 0; i < NW_QOS_NUM; i++ )
+                {
+                    if ( !strcasecmp( _qosString[i], optarg ) )
+                    {
+                        options.qos = i;
+                    }
+                }
+
+                if ( options.qos == NW_QOS_NUM )
+                {
+                    genericsReport( V_ERROR, "Unrecognised class of service" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'r':
+                options.rate = strtoul( optarg, NULL, 0 );
+                break;
+
+            // ------------------------------------
+            case 's':
+                options.serverPort = ( optarg ) ? atoi( optarg ) : NWSERVER_PORT;
+                break;
+
+            // ------------------------------------
+            case 't':
+                options.tag = atoi( optarg );
+
+                if ( ( !options.tag ) || ( options.tag > 0x7f ) )
+                {
+                    genericsReport( V_ERROR, "tag out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'v':
+                if ( !isdigit( *optarg ) )
+                {
+                    genericsReport( V_ERROR, "-v requires a numeric argument." EOL );
+                    return false;
+                }
+
+                genericsSetReportLevel( atoi( optarg ) );
+                break;
+
+            // ------------------------------------
+            case 'V':
+                _printVersion();
+                return false;
+
+            // ------------------------------------
+            case '?':
+                if ( optopt )
+                {
+                    genericsReport( V_ERROR, "Unknown option character `\\x%x'." EOL, optopt );
+                }
+
+                return false;
+
+            // ------------------------------------
+            default:
+                return false;
+                // ------------------------------------
+        }
+
+    if ( ( !options.file ) == ( !options.serverPort ) )
+    {
+        genericsReport( V_ERROR, "Need either -o or -s, to say where the stream goes" EOL );
+        return false;
+    }
+
+    if ( ( options.mode == MODE_OFLOW ) && ( !options.file ) )
+    {
+        genericsReport( V_ERROR, "orbuculum only recognises OFLOW input from a file" EOL );
+        return false;
+    }
+
+    genericsReport( V_INFO, "Generating %s at %" PRIu32 " bytes/s for %" PRIu32 "s, %d client%s" EOL,
+                    _modeString[options.mode], options.rate, options.duration, options.clients, ( options.clients == 1 ) ? "" : "s" );
+    return true;
+}
+// ====================================================================================================
+static void _report( double elapsed )
+
+{
+    uint64_t bytes = 0, probes = 0, dropped = 0;
+    double sending = ( _r.genStart ) ? ( _r.genEnd - _r.genStart ) / 1e9 : 0;
+
+    genericsPrintf( "Sent %" PRIu64 " bytes (%" PRIu64 " ITM, %" PRIu32 " probes) in %.2fs, %.2f MB/s" EOL,
+                    _r.wireBytes, _r.itmBytes, _r.seq, sending, sending ? _r.wireBytes / sending / 1e6 : 0 );
+
+    if ( !options.clients )
+    {
+        return;
+    }
+
+    genericsPrintf( "Client      MB/s     Probes    Dropped   Lat min/avg/max (us)" EOL );
+
+    for ( int i = 0; i < options.clients; i++ )
+    {
+        struct client *c = &_r.c[i];
+
+        if ( !c->connected )
+        {
+            genericsPrintf( "%6d   Never connected" EOL, i );
+            continue;
+        }
+
+        genericsPrintf( "%6d %9.2f %10" PRIu64 " %10" PRIu64 "   %" PRIu32 "/%" PRIu64 "/%" PRIu32 EOL, i, c->bytes / elapsed / 1e6, c->probes, c->dropped,
+                        c->latMin, c->probes ? c->latSum / c->probes : 0, c->latMax );
+        bytes += c->bytes;
+        probes += c->probes;
+        dropped += c->dropped;
+    }
+
+    genericsPrintf( " Total %9.2f %10" PRIu64 " %10" PRIu64 EOL, bytes / elapsed / 1e6, probes, dropped );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    pthread_t gen;
+    uint64_t start;
+
+    if ( !_processOptions( argc, argv ) )
+    {
+        exit( -1 );
+    }
+
+    signal( SIGINT, _intHandler );
+    signal( SIGPIPE, SIG_IGN );
+
+    if ( ( options.serverPort ) && ( !_listen() ) )
+    {
+        exit( -2 );
+    }
+
+    _r.c = ( struct client * )calloc( options.clients ? options.clients : 1, sizeof( struct client ) );
+    MEMCHECK( _r.c, -1 );
+
+    for ( int i = 0; i < options.clients; i++ )
+    {
+        _r.c[i].id = i;
+        pthread_create( &_r.c[i].thread, NULL, _client, &_r.c[i] );
+    }
+
+    pthread_create( &gen, NULL, _generator, NULL );
+    start = genericsMonotonicnS();
+
+    while ( ( !_r.ending ) && ( genericsMonotonicnS() - start < options.duration * 1000000000ULL ) )
+    {
+        usleep( 100000 );
+    }
+
+    _r.ending = true;
+
+    /* The generator may still be waiting for orbuculum to turn up */
+    if ( options.serverPort )
+    {
+        shutdown( _r.listenFd, SHUT_RDWR );
+    }
+
+    pthread_join( gen, NULL );
+
+    for ( int i = 0; i < options.clients; i++ )
+    {
+        pthread_join( _r.c[i].thread, NULL );
+    }
+
+    _report( ( genericsMonotonicnS() - start ) / 1e9 );
+    return 0;
+}
+// ====================================================================================================
@@ -18,15 +18,31 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#if !defined( WIN32 )
+    #include <sys/mman.h>
+#endif
+#if !defined( WIN32 )
+    #include <sys/uio.h>
+#endif
 
 #include "git_version_info.h"
 #include "generics.h"
 #include "nw.h"
 #include "traceDecoder.h"
+#include "itmDecoder.h"
+#include "msgDecoder.h"
 #include "oflow.h"
 #include "loadelf.h"
 #include "sio.h"
 #include "stream.h"
+#include "captureIndex.h"
+#include "bufPool.h"
+#include "memAccount.h"
+#include "addrFilter.h"
 
 #define REMOTE_SERVER       "localhost"
 
@@ -35,19 +51,37 @@ const char *protString[] = {"OFLOW", "ETM", NULL};
 
 #define SCRATCH_STRING_LEN  (65535)     /* Max length for a string under construction */
 //#define DUMP_BLOCK
+
+/* O_BINARY Only needed on platforms that differentiate between binary and text files */
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 #define DEFAULT_PM_BUFLEN_K (32)        /* Default size of the Postmortem buffer */
 #define MAX_TAGS            (10)        /* How many tags we will allow */
 
 #define INTERVAL_TIME_MS    (1000)      /* Intervaltime between acculumator resets */
 #define HANG_TIME_MS        (200)       /* Time without a packet after which we dump the buffer */
 #define TICK_TIME_MS        (100)       /* Time intervals for screen updates and keypress check */
+#define RECONNECT_TIME_US   (500000)    /* Time between attempts to connect to the source */
+#define NO_CONNECTION_ALERT_MS (1000)   /* ...and between telling the user there isn't one */
+
+/* A trigger stops collection a set distance after something interesting is seen in the trace as it */
+/* arrives, so the buffer holds what led up to it. Only events are looked at, nothing is decoded.   */
+enum TriggerType { TRIG_NONE, TRIG_EXCEPTION, TRIG_ADDRESS, TRIG_ITM };
+#define TRIG_ANY            (-1)        /* Any exception, or any value written to the ITM channel */
+#define TRIG_EVENT_BATCH    (64)        /* Events looked at in each pass of the trigger decoder */
+#define ITM_TAG             (1)         /* OFLOW stream that carries ITM */
+#define HARDFAULT_EXCEPTION (3)
 
 /* Record for options, either defaults or from command line */
 struct Options
 {
     /* Source information */
     char *file;                         /* File host connection */
+    uint64_t startmS;                   /* How far into an indexed capture file to start */
     bool fileTerminate;                 /* Terminate when file read isn't successful */
+    char *shmInput;                     /* Shared memory connection to a local orbuculum */
+    bool compress;                      /* Ask the server to compress what it sends */
     char *deleteMaterial;               /* Material to delete off front end of filenames */
     bool demangle;                      /* Indicator that C++ should be demangled */
 
@@ -55,7 +89,8 @@ struct Options
     char *odoptions;                    /* Options to pass directly to objdump */
 
     int buflen;                         /* Length of post-mortem buffer, in bytes */
-    int tag;                            /* which OFLOW stream are we decoding? */
+    uint8_t tags[MAX_TAGS];             /* Which OFLOW streams are we decoding, one for each core? */
+    int ntags;                          /* ...and how many of them there are */
     int port;                           /* Source information */
     char *server;
     enum Prot commProt;
@@ -65,14 +100,26 @@ struct Options
     char *openFileCL;                   /* Command line for opening refernced file */
 
     bool withDebugText;                 /* Include debug text (hidden in) output...screws line numbering a bit */
+    bool callTrace;                     /* Only show function calls, returns and exceptions, not every line */
+    struct addrFilter focus;            /* Only show the code in here, everything if it's empty */
+
+    enum TriggerType trigType;          /* What stops collection */
+    int64_t trigMatch;                  /* ...the exception, address or ITM channel it's looking for */
+    int64_t trigValue;                  /* ...and the value written to the channel, for ITM */
+    int trigAfter;                      /* Bytes to keep after the trigger, or -1 for a quarter of the buffer */
+
+    bool live;                          /* Decode continuously, showing the latest trace as it arrives */
+    char *session;                      /* Session file to show again, rather than taking any trace */
 } _options =
 {
     .port      = OFCLIENT_SERVER_PORT,
     .server    = REMOTE_SERVER,
     .demangle  = true,
     .traceProt = TRACE_PROT_ETM35,
-    .tag       = 2,
-    .buflen    = DEFAULT_PM_BUFLEN_K * 1024
+    .tags      = { 2 },
+    .ntags     = 1,
+    .buflen    = DEFAULT_PM_BUFLEN_K * 1024,
+    .trigAfter = -1
 };
 
 /* A block of received data */
@@ -89,8 +136,155 @@ struct opConstruct
     struct symbolFunctionStore *currentFunctionptr;       /* The function we're currently in */
     uint32_t currentLine;                /* The line we're currently in */
     uint32_t workingAddr;                /* The address we're currently in */
+    uint8_t callKind;                    /* In a call trace, how the next function change came about (a PM_CALL_*) */
+    bool outside;                        /* Executing outside the focus, which isn't shown */
+};
+
+/* The post-mortem buffer is decoded a page at a time, and only when the page is wanted. Pages are */
+/* added to the output buffer from the end backwards, since that's where the interesting bit is.   */
+#define PM_PAGE_BYTES       (4096)      /* Least trace in a page...pages start at sync points */
+#define PM_CACHE_PAGES      (32)        /* Number of decoded pages to hold on to */
+#define PM_LOOKBACK_LINES   (1000)      /* Decode more when we get this close to the start of what's decoded */
+
+/* Files that have been dived into keep their lines, ready for the next time, until this many others have been */
+#define PM_FILE_VIEWS       (8)
+
+struct pmFileView
+{
+    struct sioline *lines;              /* Lines of the file, with their text after them in the same allocation */
+    int32_t nlines;                     /* ...how many there are */
+    unsigned int filename;              /* ...the file they're from */
+    uint32_t lastUsed;                  /* ...and when it was last dived into */
+};
+
+/* A line of output as it's held in a page, it's only turned into text when it's displayed or saved */
+struct pmLine
+{
+    uint32_t ref;                       /* The address the line is about, or offset of its text in the page */
+    int32_t line;                       /* Source line number current when the line was generated, or call depth */
+    uint8_t lt;                         /* The type of line (an enum LineType) */
+    bool isText;                        /* Set if ref is text, rather than an address */
+    uint8_t call;                       /* For a function line in a call trace, how it was got to (a PM_CALL_*) */
+};
+
+/* In a call trace there are only function lines (with the call depth as their line) and events */
+enum { PM_CALL_NONE, PM_CALL_JUMP, PM_CALL_ENTRY, PM_CALL_RETURN };
+
+/* Each time a function is entered, a source line or instruction is executed or an exception is taken  */
+/* it's noted in the index of the page it happens in, so the next or previous time can be found with a */
+/* binary search of each page rather than by rendering and searching every line in between them. The   */
+/* index of a page is kept when its lines are dropped from the cache, so it never has to be decoded    */
+/* again just to be searched.                                                                          */
+enum pmOccKind { PM_OCC_FUNCTION, PM_OCC_LINE, PM_OCC_ADDRESS, PM_OCC_EXCEPTION };
+
+struct pmOcc
+{
+    uint32_t key;                       /* Start of the function or line, the instruction address, or exception number */
+    int32_t n;                          /* Line in the page it's at */
+    uint8_t kind;                       /* What the key is (an enum pmOccKind) */
+};
+
+/* With several tags each is a core, decoded on its own, and the lines of all of them are shown together */
+/* in the order the trace they came from arrived in. That's the time the OFLOW frames carrying it were  */
+/* stamped with, which is kept against where each frame went in its core's buffer.                      */
+struct pmStamp
+{
+    size_t at;                          /* Position in the buffer the frame's trace starts at */
+    uint64_t when;                      /* ...and the time it was stamped with */
+};
+
+struct pmMerged
+{
+    int32_t line;                       /* Line in the output buffer of its core */
+    uint8_t core;                       /* ...and which core that is */
+};
+
+/* How many rendered lines can be in use at once */
+#define PM_RENDER_SLOTS     (4)
+
+/* A save renders each page in the cache into its own chunk of the report in parallel, then writes them in order */
+#define PM_SAVE_THREADS     (8)         /* Most threads to render with */
+
+struct pmChunk
+{
+    char *buf;                          /* The text of the report for this page */
+    size_t len;                         /* ...how much of it there is */
+    size_t alloc;                       /* ...and how much space there is for it */
+};
+
+struct pmPage
+{
+    size_t start;                       /* Offset of the page from the oldest data in the buffer */
+    size_t len;                         /* ...and its length */
+    int32_t firstLine;                  /* Line number of its first line in the output buffer */
+    int32_t numLines;                   /* Number of lines it decodes to, or -1 if it's not been decoded */
+    struct pmLine *lines;               /* The decoded lines */
+    int32_t linesAlloc;                 /* ...how many there's space for */
+    char *text;                         /* ...text for the ones that can't be generated from the symbols */
+    size_t textLen;                     /* ...how much of it there is */
+    size_t textAlloc;                   /* ...and how much space there is for it */
+    bool cached;                        /* Set when the lines are valid, i.e. the page is in the cache */
+    bool mapped;                        /* ...they're in a restored session, so they're always valid */
+    struct pmOcc *occ;                  /* Index of what is where in the page, sorted by kind, key then line */
+    int32_t occCount;                   /* ...how many entries there are */
+    int32_t occAlloc;                   /* ...how many there's space for */
+    bool indexed;                       /* ...and if it's complete */
+    uint32_t lastUsed;                  /* When they were last used, to choose what to drop from the cache */
+};
+
+/* A session file is the post-mortem buffer, the pages it splits into (each starting at a sync point, so */
+/* each can be decoded on its own) and the lines each of them decodes to. It's a save with everything   */
+/* needed to show it again without decoding anything, which is done by mapping it in and using the     */
+/* lines where they are in the file.                                                                    */
+#define PM_SESSION_MAGIC    "ORBMSESS"
+#define PM_SESSION_VERSION  (3)
+#define PM_SESSION_ALIGN    (8)         /* Everything in the file starts on a multiple of this */
+
+struct pmSessionHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t lineSize;                  /* sizeof( struct pmLine ), so one from a different build isn't misread */
+    uint32_t traceProt;                 /* Protocol the trace was decoded with */
+    uint32_t startSynced;               /* If the decoder was synced at the start of the first page */
+    uint64_t elfSize;                   /* Size and modification time of the elf file it was decoded against */
+    int64_t elfTime;
+    uint64_t traceOfs;                  /* Where the trace is in the file */
+    uint64_t traceLen;                  /* ...and how much of it there is */
+    uint64_t pageOfs;                   /* Where the table of pages is */
+    uint32_t pageCount;                 /* ...and how many of them there are */
+    uint32_t occSize;                   /* sizeof( struct pmOcc ), for the same reason as lineSize */
 };
 
+struct pmSessionPage
+{
+    uint64_t start;                     /* Offset of the page in the trace */
+    uint64_t len;                       /* ...and its length */
+    uint64_t linesOfs;                  /* Where its lines are in the file */
+    uint64_t textOfs;                   /* ...and its text */
+    uint64_t textLen;                   /* ...how much text there is */
+    uint64_t occOfs;                    /* ...where its index is */
+    int32_t numLines;                   /* ...how many lines there are */
+    int32_t occCount;                   /* ...and how many index entries */
+};
+
+struct pmSessionSave
+{
+    FILE *f;
+    uint64_t at;                        /* How far into the file we are */
+    bool ok;                            /* ...and if everything's been written so far */
+    struct pmSessionHeader h;
+    struct pmSessionPage *page;         /* Table of pages, written at the end */
+};
+
+/* In live mode trace is decoded on a thread of its own as it arrives, a page of it at a time, and the   */
+/* pages are handed over to be shown. Only the most recent are kept, and the screen is only updated a */
+/* few times a second, so decoding isn't held up by the display and just runs as fast as it can.      */
+#define PM_LIVE_PAGES       (64)        /* Decoded pages kept for display (and waiting to be shown) */
+#define PM_LIVE_FRAME_MS    (100)       /* Interval between updates of the display */
+#define PM_LIVE_IDLE_US     (1000)      /* Time the decoder waits for more trace when it's caught up */
+#define PM_LIVE_MIN_BUFFER  (4*TRANSFER_SIZE) /* Smallest buffer, so arrivals don't overwrite what's being decoded */
+
 /* Maximum depth of call stack, defined Section 5.3 or ARM IHI0064H.a ID120820 */
 #define MAX_CALL_STACK (15)
 
@@ -101,18 +295,31 @@ struct RunTime
     const char *progName;               /* Name by which this program was called */
 
     struct symbol *s;                   /* Symbols read from elf */
-    bool     ending;                    /* Flag indicating app is terminating */
+    atomic_bool ending;                 /* Flag indicating app is terminating */
     bool     singleShot;                /* Flag indicating take a single buffer then stop */
-    uint64_t newTotalBytes;             /* Number of bytes of real data transferred in total */
+    _Atomic uint64_t newTotalBytes;     /* Number of bytes of real data transferred in total */
     uint64_t oldTotalBytes;             /* Old number of bytes of real data transferred in total */
     uint64_t oldTotalIntervalBytes;     /* Number of bytes transferred in previous interval */
     uint64_t oldTotalHangBytes;         /* Number of bytes transferred in previous hang interval */
 
     uint8_t *pmBuffer;                  /* The post-mortem buffer */
-    int wp;                             /* Index pointers for ring buffer */
-    int rp;
+    size_t pmSize;                      /* ...its size, a power of two so positions can be masked */
+    bool pmMirrored;                    /* ...and if it's mapped twice in a row, so it never needs to be read wrapped */
+    size_t wp;                          /* Index pointers for ring buffer, running freely and masked on use */
+    size_t rp;
+
+    struct pmPage *page;                /* Pages of the post-mortem buffer */
+    int32_t pageCount;                  /* ...how many there are */
+    int32_t firstPage;                  /* ...the first one in the output buffer */
+    int32_t cachedPages;                /* ...how many have their lines held */
+    uint32_t pageClock;                 /* ...the clock for marking when they were used */
+    bool startSynced;                   /* ...if the decoder is synced at the start of the first one */
+    struct pmPage *decoding;            /* ...and the one lines are being added to */
+
+    struct sioline render[PM_RENDER_SLOTS];  /* Lines of the output buffer turned into text */
+    char renderText[PM_RENDER_SLOTS][SCRATCH_STRING_LEN];
+    int renderNext;                     /* ...and the next of them to use */
 
-    struct sioline *opText;             /* Text of the output buffer */
     int32_t lineNum;                    /* Current line number in output buffer */
     int32_t numLines;                   /* Number of lines in the output buffer */
 
@@ -122,8 +329,23 @@ struct RunTime
 
     struct sioline *fileopText;         /* The text lines of the file we're diving into */
     int32_t filenumLines;               /* ...and how many lines of it there are */
+    struct pmFileView view[PM_FILE_VIEWS]; /* ...that and the others dived into lately */
+    uint32_t viewClock;                 /* ...and the clock for marking when they were used */
 
-    bool held;                          /* If we are actively collecting data */
+    atomic_bool held;                   /* If we are actively collecting data */
+
+    pthread_t captureThread;            /* Thread taking in data and adding it to the post-mortem buffer */
+    bool captureRunning;                /* ...if it was started */
+    pthread_mutex_t rxLock;             /* ...held while it's adding anything */
+    struct Stream *fileStream;          /* The file it reads from, if it's not a live source */
+    atomic_bool noConnection;           /* Set while it's unable to connect to a live source */
+    atomic_bool fileDone;               /* ...or when it's come to the end of the file */
+
+    struct TRACEDecoder trig;           /* Decoder watching what arrives for the trigger */
+    struct ITMDecoder itm;              /* ...or the ITM decoder, for an ITM trigger */
+    bool triggered;                     /* Set once the trigger has been seen */
+    size_t trigAt;                      /* ...where in the received data it was */
+    size_t trigStop;                    /* ...and where collection stops */
 
     struct SIOInstance *sio;            /* Our screen IO instance for managed I/O */
 
@@ -138,7 +360,41 @@ struct RunTime
     symbolMemaddr callStack[MAX_CALL_STACK]; /* Stack of calls */
     unsigned int stackDepth;            /* Maximum stack depth */
     bool stackDelPending;               /* Possibility to remove an entry from the stack, if address not given */
-} _r;
+
+    pthread_t loadThread;               /* Loads the symbols at startup, while trace is already being taken */
+    bool loading;                       /* ...set from starting it until what it loaded is picked up */
+    atomic_bool loadDone;               /* ...set by it when it's finished */
+    struct symbol *loaded;              /* ...and what it loaded, NULL if it couldn't */
+
+    pthread_t liveThread;               /* Live decode thread */
+    bool liveRunning;                   /* ...if it was started */
+    atomic_size_t liveWp;               /* How far into the received data there's trace for it */
+    atomic_size_t liveDp;               /* ...and how far it's decoded */
+    atomic_uint liveLost;               /* Times it fell so far behind that trace was overwritten before it was decoded */
+    unsigned int liveLostShown;         /* ...how many of those have been reported */
+    pthread_mutex_t liveLock;           /* Protects the pages waiting to be shown */
+    struct pmPage livePending[PM_LIVE_PAGES];
+    int livePendingCount;               /* ...how many there are */
+
+    uint8_t *sessionMap;                /* Restored session file, as it's mapped in */
+    size_t sessionLen;                  /* ...and its length */
+
+    /* With several tags, each core has a RunTime of its own for its buffer and decode, sharing the options */
+    /* and symbols of this one, which only shows the lines of all of them together.                       */
+    struct RunTime *core[MAX_TAGS];     /* The cores */
+    int ncores;                         /* ...how many there are, none if there's just the one tag */
+    struct pmMerged *merged;            /* ...and their lines, in the order their trace arrived */
+
+    uint8_t coreTag;                    /* For a core, the tag its trace is on */
+    struct pmStamp *stamp;              /* ...the times the trace in its buffer was stamped with */
+    int32_t stampCount;                 /* ...how many of them there are */
+    int32_t stampAlloc;                 /* ...and how many there's space for */
+    bool stamping;                      /* ...set while the time of each line decoded is to be noted */
+    uint64_t decodeWhen;                /* ...the time of the trace being decoded */
+    uint64_t *when;                     /* ...and the time of each line decoded */
+    int32_t whenCount;                  /* ...how many of those there are */
+    int32_t whenAlloc;                  /* ...and how many there's space for */
+} _r = { .liveLock = PTHREAD_MUTEX_INITIALIZER, .rxLock = PTHREAD_MUTEX_INITIALIZER };
 
 /* For opening the editor (Shift-Right-Arrow) the following command lines work for a few editors;
  *
@@ -169,15 +425,20 @@ static void _printHelp( const char *const progName )
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
     genericsPrintf( "    -A, --alt-addr-enc: Do not use alternate address encoding" EOL );
-    genericsPrintf( "    -b, --buffer-len:   <Length> Length of post-mortem buffer, in KBytes (Default %d KBytes)" EOL, DEFAULT_PM_BUFLEN_K );
+    genericsPrintf( "    -b, --buffer-len:   <Length> Length of post-mortem buffer, in KBytes, rounded up to a power of two (Default %d KBytes)" EOL, DEFAULT_PM_BUFLEN_K );
+    genericsPrintf( "    -c, --calls:        Only show function calls, returns and exceptions, which is much quicker for a big buffer" EOL );
     genericsPrintf( "    -C, --editor-cmd:   <command> Command line for external editor (%%f = filename, %%l = line)" EOL );
     genericsPrintf( "    -D, --no-demangle:  Switch off C++ symbol demangling" EOL );
     genericsPrintf( "    -d, --del-prefix:   <String> Material to delete off the front of filenames" EOL );
     genericsPrintf( "    -e, --elf-file:     <ElfFile> to use for symbols and source" EOL );
     genericsPrintf( "    -E, --eof:          When reading from file, terminate at end of file" EOL );
+    genericsPrintf( "    -F, --focus:        <lo-hi|lo+len|function> Only show this part of the program, can be given more than once" EOL );
     genericsPrintf( "    -f, --input-file:   <filename>: Take input from specified file" EOL );
     genericsPrintf( "    -h, --help:         This help" EOL );
+    genericsPrintf( "    -H, --shm-input:    [name] Take ORBFLOW from a local orbuculum via shared memory (defaults to %s)" EOL, ORBUCULUM_SHM_NAME );
+    genericsPrintf( "    -L, --live:         Decode continuously, following the trace as it arrives" EOL );
     genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
+    genericsPrintf( "    -n, --after:        <KBytes> Trace to keep after a trigger (Default a quarter of the buffer)" EOL );
     genericsPrintf( "    -O, --objdump-opts: <options> Options to pass directly to objdump" EOL );
     genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ETM" EOL );
     genericsPrintf( "    -P, --trace-proto:  { " );
@@ -188,10 +449,15 @@ static void _printHelp( const char *const progName )
     }
 
     genericsPrintf( "} trace protocol to use, default is %s" EOL, TRACEDecodeGetProtocolName( TRACE_PROT_LIST_START ) );
+    genericsPrintf( "    -r, --restore:      <filename> Show a session saved alongside a report (<name>.session) again, without decoding it" EOL );
+    genericsPrintf( "    -Q, --mem-limit:    <subsystem>=<size>[,...] Most memory for each of symbols, addresses, calls, hash, lines or sequencer (e.g. addresses=2G)" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
-    genericsPrintf( "    -t, --tag:          <stream>: Which OFLOW tag to use (normally 2)" EOL );
+    genericsPrintf( "    -S, --start:        <seconds> Start this far into an indexed capture file" EOL );
+    genericsPrintf( "    -t, --tag:          <stream>[,<stream>...]: Which OFLOW tag to use (normally 2), or one for each core" EOL );
+    genericsPrintf( "    -T, --trigger:      <trigger> Stop collecting after; exception[:<num>], hardfault, addr:<addr> or itm:<chan>[=<value>]" EOL );
     genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:      Print version and exit" EOL );
+    genericsPrintf( "    -z, --compress:     Ask the server to compress what it sends" EOL );
     genericsPrintf( EOL "(Legacy protocol will connect one port higher than that set in -s)" EOL );
     genericsPrintf(     "(This will automatically select the second output stream from orbuculum.)" EOL );
     genericsPrintf( EOL "Environment Variables;" EOL );
@@ -208,25 +474,138 @@ static struct option _longOptions[] =
 {
     {"alt-addr-enc", no_argument, NULL, 'A'},
     {"buffer-len", required_argument, NULL, 'b'},
+    {"calls", no_argument, NULL, 'c'},
     {"editor-cmd", required_argument, NULL, 'C'},
     {"no-demangle", required_argument, NULL, 'D'},
     {"del-prefix", required_argument, NULL, 'd'},
     {"elf-file", required_argument, NULL, 'e'},
     {"eof", no_argument, NULL, 'E'},
+    {"focus", required_argument, NULL, 'F'},
     {"input-file", required_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
+    {"shm-input", optional_argument, NULL, 'H'},
+    {"live", no_argument, NULL, 'L'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
+    {"after", required_argument, NULL, 'n'},
     {"objdump-opts", required_argument, NULL, 'O'},
     {"trace-proto", required_argument, NULL, 'P'},
     {"protocol", required_argument, NULL, 'p'},
+    {"mem-limit", required_argument, NULL, 'Q'},
+    {"restore", required_argument, NULL, 'r'},
     {"server", required_argument, NULL, 's'},
+    {"start", required_argument, NULL, 'S'},
     {"tag", required_argument, NULL, 't'},
+    {"trigger", required_argument, NULL, 'T'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
+    {"compress", no_argument, NULL, 'z'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
+static bool _parseTrigger( struct Options *o, const char *s )
+
+/* Trigger is one of exception[:<num>], hardfault, addr:<addr> or itm:<chan>[=<value>] */
+
+{
+    const char *a = strchr( s, ':' );
+    size_t n = ( a ) ? ( size_t )( a - s ) : strlen( s );
+    char *e;
+
+    o->trigMatch = o->trigValue = TRIG_ANY;
+
+    if ( !strcasecmp( s, "hardfault" ) )
+    {
+        o->trigType = TRIG_EXCEPTION;
+        o->trigMatch = HARDFAULT_EXCEPTION;
+        return true;
+    }
+
+    if ( ( n == strlen( "exception" ) ) && ( !strncasecmp( s, "exception", n ) ) )
+    {
+        o->trigType = TRIG_EXCEPTION;
+
+        if ( a )
+        {
+            o->trigMatch = strtol( a + 1, &e, 0 );
+            return ( e != a + 1 ) && ( !*e ) && ( o->trigMatch >= 0 );
+        }
+
+        return true;
+    }
+
+    if ( !a )
+    {
+        return false;
+    }
+
+    if ( !strncasecmp( s, "addr:", 5 ) )
+    {
+        o->trigType = TRIG_ADDRESS;
+        o->trigMatch = strtoll( a + 1, &e, 16 );
+        return ( e != a + 1 ) && ( !*e );
+    }
+
+    if ( !strncasecmp( s, "itm:", 4 ) )
+    {
+        o->trigType = TRIG_ITM;
+        o->trigMatch = strtol( a + 1, &e, 0 );
+
+        if ( ( e == a + 1 ) || ( o->trigMatch < 0 ) || ( o->trigMatch > 31 ) )
+        {
+            return false;
+        }
+
+        if ( *e == '=' )
+        {
+            const char *v = e + 1;
+            o->trigValue = strtoll( v, &e, 0 );
+            return ( e != v ) && ( !*e );
+        }
+
+        return !*e;
+    }
+
+    return false;
+}
+// ====================================================================================================
+static bool _parseTags( struct Options *o, const char *s )
+
+/* A list of tags, one for each core being traced */
+
+{
+    char *e;
+    long t;
+
+    o->ntags = 0;
+
+    do
+    {
+        t = strtol( s, &e, 0 );
+
+        if ( ( e == s ) || ( t < 0 ) || ( t > 255 ) || ( o->ntags == MAX_TAGS ) || ( ( *e ) && ( *e != ',' ) ) )
+        {
+            genericsReport( V_ERROR, "Tags should be a list of up to %d stream numbers" EOL, MAX_TAGS );
+            return false;
+        }
+
+        for ( int i = 0; i < o->ntags; i++ )
+        {
+            if ( o->tags[i] == t )
+            {
+                genericsReport( V_ERROR, "Tag %ld is given twice" EOL, t );
+                return false;
+            }
+        }
+
+        o->tags[o->ntags++] = t;
+        s = e + 1;
+    }
+    while ( *e );
+
+    return true;
+}
+// ====================================================================================================
 static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
 {
@@ -234,7 +613,7 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
     bool protExplicit = false;
     bool serverExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "Ab:C:Dd:Ee:f:hVMO:p:P:s:t:v:w", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "Ab:cC:Dd:Ee:F:f:hH::LVMn:O:p:P:Q:r:s:S:t:T:v:wz", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -247,6 +626,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->buflen = atoi( optarg ) * 1024;
                 break;
 
+            // ------------------------------------
+            case 'c':
+                r->options->callTrace = true;
+                break;
+
             // ------------------------------------
             case 'C':
                 r->options->openFileCL = optarg;
@@ -275,6 +659,17 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'F':
+                if ( !addrFilterAdd( &r->options->focus, optarg ) )
+                {
+                    genericsReport( V_ERROR, "Focus should be lo-hi, lo+len or a function name, not %s" EOL, optarg );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
             case 'f':
                 r->options->file = optarg;
                 break;
@@ -285,6 +680,12 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 _printHelp( r->progName );
                 return false;
 
+            // ------------------------------------
+
+            case 'H':
+                r->options->shmInput = ( optarg ) ? optarg : ORBUCULUM_SHM_NAME;
+                break;
+
             // ------------------------------------
             case 'V':
                 _printVersion();
@@ -292,10 +693,21 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'L':
+                r->options->live = true;
+                break;
+
+            // ------------------------------------
+
             case 'M':
                 r->options->mono = true;
                 break;
 
+            // ------------------------------------
+            case 'n':
+                r->options->trigAfter = atoi( optarg ) * 1024;
+                break;
+
             // ------------------------------------
             case 'O':
                 r->options->odoptions = optarg;
@@ -335,6 +747,21 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
                 break;
 
+            // ------------------------------------
+            case 'Q':
+                if ( !memSetLimits( optarg ) )
+                {
+                    genericsReport( V_ERROR, "Memory limits are <subsystem>=<size>[K|M|G][,...]" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'r':
+                r->options->session = optarg;
+                break;
+
             // ------------------------------------
 
             case 's':
@@ -364,8 +791,35 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'S':
+                if ( atof( optarg ) < 0 )
+                {
+                    genericsReport( V_ERROR, "Start time is out of range" EOL );
+                    return false;
+                }
+
+                r->options->startmS = atof( optarg ) * 1000;
+                break;
+
+            // ------------------------------------
+
             case 't':
-                r->options->tag = atoi( optarg );
+                if ( !_parseTags( r->options, optarg ) )
+                {
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'T':
+                if ( !_parseTrigger( r->options, optarg ) )
+                {
+                    genericsReport( V_ERROR, "Badly formed trigger [%s]" EOL, optarg );
+                    return false;
+                }
+
                 break;
 
             // ------------------------------------
@@ -388,6 +842,12 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'z':
+                r->options->compress = true;
+                break;
+
+            // ------------------------------------
+
             case '?':
                 if ( optopt == 'b' )
                 {
@@ -414,6 +874,18 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsReport( V_INFO, "(Auto-set ETM3.5 for TCP::%s:%d, override by setting protocol explicitly)" EOL, r->options->server, r->options->port );
     }
 
+    /* Shared memory only ever carries what orbuculum publishes, which is OFLOW */
+    if ( r->options->shmInput )
+    {
+        if ( r->options->file || serverExplicit )
+        {
+            genericsReport( V_ERROR, "Cannot specify shared memory with file or server" EOL );
+            return false;
+        }
+
+        r->options->commProt = PROT_OFLOW;
+    }
+
     /* ... and dump the config if we're being verbose */
     genericsReport( V_INFO, "orbmortem version " GIT_DESCRIBE EOL );
 
@@ -422,10 +894,24 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsReport( V_INFO, "Incoporate debug text in output buffer" EOL );
     }
 
-    if ( r->options->file )
+    if ( r->options->session )
+    {
+        if ( ( r->options->file ) || ( r->options->shmInput ) || ( r->options->live ) || ( serverExplicit ) )
+        {
+            genericsReport( V_ERROR, "A restored session can't be used with any other input, or live" EOL );
+            return false;
+        }
+
+        genericsReport( V_INFO, "Session File     : %s" EOL, r->options->session );
+    }
+    else if ( r->options->file )
     {
         genericsReport( V_INFO, "Input File       : %s", r->options->file );
     }
+    else if ( r->options->shmInput )
+    {
+        genericsReport( V_INFO, "Shared Mem       : %s" EOL, r->options->shmInput );
+    }
     else
     {
         genericsReport( V_INFO, "Server           : %s:%d" EOL, r->options->server, r->options->port );
@@ -442,7 +928,7 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsReport( V_INFO, "Protocol         : %s" EOL, TRACEDecodeGetProtocolName( r->options->traceProt ) );
     }
 
-    if ( ( r->options->traceProt == TRACE_PROT_MTB ) && ( !r->options->file ) )
+    if ( ( r->options->traceProt == TRACE_PROT_MTB ) && ( !r->options->file ) && ( !r->options->session ) )
     {
         genericsExit( V_ERROR, "MTB only makes sense when input is from a file" EOL );
     }
@@ -457,10 +943,61 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsExit( -1, "Illegal value for Post Mortem Buffer length" EOL );
     }
 
+    if ( ( r->options->live ) && ( r->options->buflen < PM_LIVE_MIN_BUFFER ) )
+    {
+        genericsReport( V_INFO, "Buffer increased to %d KBytes for live decode" EOL, PM_LIVE_MIN_BUFFER / 1024 );
+        r->options->buflen = PM_LIVE_MIN_BUFFER;
+    }
+
+    if ( ( r->options->trigType == TRIG_ITM ) && ( ( r->options->commProt != PROT_OFLOW ) || ( r->options->tags[0] == ITM_TAG ) ) )
+    {
+        genericsExit( V_ERROR, "ITM trigger needs ITM in OFLOW stream %d alongside the trace" EOL, ITM_TAG );
+    }
+
+    if ( ( r->options->ntags > 1 ) &&
+            ( ( r->options->commProt != PROT_OFLOW ) || ( r->options->live ) || ( r->options->session ) || ( r->options->trigType != TRIG_NONE ) ) )
+    {
+        genericsExit( V_ERROR, "Several cores need OFLOW to tell their trace apart, and are only shown once it's been taken (so not live, restored or triggered)" EOL );
+    }
+
+    switch ( r->options->trigType )
+    {
+        case TRIG_EXCEPTION:
+            if ( r->options->trigMatch == TRIG_ANY )
+            {
+                genericsReport( V_INFO, "Trigger          : Any exception" EOL );
+            }
+            else
+            {
+                genericsReport( V_INFO, "Trigger          : Exception %d" EOL, ( int )r->options->trigMatch );
+            }
+
+            break;
+
+        case TRIG_ADDRESS:
+            genericsReport( V_INFO, "Trigger          : Address 0x%08" PRIx64 EOL, ( uint64_t )r->options->trigMatch );
+            break;
+
+        case TRIG_ITM:
+            if ( r->options->trigValue == TRIG_ANY )
+            {
+                genericsReport( V_INFO, "Trigger          : Write to ITM channel %d" EOL, ( int )r->options->trigMatch );
+            }
+            else
+            {
+                genericsReport( V_INFO, "Trigger          : Write of 0x%" PRIx64 " to ITM channel %d" EOL, ( uint64_t )r->options->trigValue, ( int )r->options->trigMatch );
+            }
+
+            break;
+
+        default:
+            break;
+    }
+
     switch ( r->options->commProt )
     {
         case PROT_OFLOW:
-            genericsReport( V_INFO, "Decoding OFLOW with ETM in stream %d" EOL, r->options->tag );
+            genericsReport( V_INFO, "Decoding OFLOW with ETM in stream %d%s" EOL, r->options->tags[0], ( r->options->ntags > 1 ) ? " (and more, one per core)" : "" );
             break;
 
         case PROT_ETM:
@@ -475,732 +1012,2895 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
     return true;
 }
 // ====================================================================================================
-static void _processBlock( struct RunTime *r )
+static void _trigArm( struct RunTime *r )
 
-/* Generic block processor for received data */
+/* Get ready to look for the trigger in whatever arrives from now on */
 
 {
-    uint8_t *c = r->rawBlock.buffer;
-    uint32_t y = r->rawBlock.fillLevel;
+    r->triggered = false;
 
-    genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, y );
-
-    if ( y )
+    if ( r->options->trigType == TRIG_ITM )
     {
-#ifdef DUMP_BLOCK
-        fprintf( stderr, EOL );
-
-        while ( y-- )
+        ITMDecoderInit( &r->itm, true );
+    }
+    else if ( r->options->trigType != TRIG_NONE )
+    {
+        if ( r->trig.engine )
         {
-            fprintf( stderr, "%02X ", *c++ );
-
-            if ( !( y % 16 ) )
-            {
-                fprintf( stderr, EOL );
-            }
+            r->trig.engine->destroy( r->trig.engine );
         }
 
-        c = r->rawBlock.buffer;
-        y = r->rawBlock.fillLevel;
-#endif
+        TRACEDecoderInit( &r->trig, r->options->traceProt, !( r->options->noAltAddr ), NULL );
+    }
+}
+// ====================================================================================================
+static void _trigFire( struct RunTime *r, size_t at )
 
-        r->newTotalBytes += y;
+/* The trigger was seen at offset at in what's been received, so collect up to a set distance past it */
 
-        while ( y-- )
-        {
-            r->pmBuffer[r->wp] = *c++;
-            uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
+{
+    size_t after = ( r->options->trigAfter < 0 ) ? r->pmSize / 4 : ( size_t )r->options->trigAfter;
 
-            if ( nwp == r->rp )
-            {
-                if ( r->singleShot )
-                {
-                    r->held = true;
-                    return;
-                }
-                else
-                {
-                    r->rp = ( r->rp + 1 ) % r->options->buflen;
-                }
-            }
+    r->triggered = true;
+    r->trigAt = at;
 
-            r->wp = nwp;
-        }
-    }
+    /* ...and there's no point keeping so much afterwards that what led up to it gets pushed out */
+    r->trigStop = at + ( ( after < r->pmSize ) ? after : r->pmSize - 1 );
+    genericsReport( V_INFO, "Triggered, stopping after another %zu bytes" EOL, r->trigStop - at );
 }
-
 // ====================================================================================================
-static bool _rxAdd( struct RunTime *r, uint8_t c )
+static void _trigScan( struct RunTime *r, const uint8_t *d, size_t len )
 
-{
-    r->newTotalBytes ++;
+/* Run trace on its way into the buffer past the trigger decoder. This only produces events, which is */
+/* far cheaper than the decode that happens afterwards, so it can keep up while collecting.            */
 
-    r->pmBuffer[r->wp] = c;
-    uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
+{
+    struct TRACEEvent ev[TRIG_EVENT_BATCH];
+    size_t ofs = 0;
+    int n, used;
 
-    if ( nwp == r->rp )
+    while ( ( ofs < len ) && ( !r->triggered ) )
     {
-        if ( r->singleShot )
+        n = TRACEDecoderPumpEvents( &r->trig, d + ofs, len - ofs, ev, TRIG_EVENT_BATCH, &used );
+        ofs += used;
+
+        for ( int j = 0; j < n; j++ )
         {
-            r->held = true;
-            return true;
-        }
-        else
+            if ( ( ( r->options->trigType == TRIG_EXCEPTION ) && ( ev[j].changes & ( 1 << EV_CH_EX_ENTRY ) ) &&
+                    ( ( r->options->trigMatch == TRIG_ANY ) || ( ev[j].exception == r->options->trigMatch ) ) ) ||
+                    ( ( r->options->trigType == TRIG_ADDRESS ) && ( ev[j].changes & ( 1 << EV_CH_ADDRESS ) ) &&
+                      ( ev[j].addr == ( symbolMemaddr )r->options->trigMatch ) ) )
+            {
+                /* The event came from somewhere in what was just pumped, the end of it is close enough */
+                _trigFire( r, r->wp + ofs );
+                break;
+            }
+        }
+
+        if ( ( !n ) && ( !used ) )
         {
-            r->rp = ( r->rp + 1 ) % r->options->buflen;
+            break;
         }
     }
-
-    r->wp = nwp;
-    return false;
 }
-
 // ====================================================================================================
+static void _trigScanITM( struct RunTime *r, const uint8_t *d, size_t len )
 
-static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
+/* Look for the trigger write in the ITM that comes alongside the trace */
 
 {
-    struct RunTime *r = ( struct RunTime * )param;
+    struct msg m[TRIG_EVENT_BATCH];
+    size_t n, used;
 
-    if ( !p->good )
+    while ( ( len ) && ( !r->triggered ) )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
-    }
-    else
-    {
-        if ( p->tag == r->options->tag )
+        n = ITMPumpBlock( &r->itm, d, len, m, TRIG_EVENT_BATCH, &used );
+        d += used;
+        len -= used;
+
+        for ( size_t j = 0; j < n; j++ )
         {
-            for ( int i = 0; i < p->len; i++ )
+            if ( ( m[j].genericMsg.msgtype == MSG_SOFTWARE ) && ( m[j].swMsg.srcAddr == r->options->trigMatch ) &&
+                    ( ( r->options->trigValue == TRIG_ANY ) || ( m[j].swMsg.value == r->options->trigValue ) ) )
             {
-                if ( _rxAdd( r, p->d[i] ) )
-                {
-                    return;
-                }
+                /* ...which is as near to the trace at that moment as we can tell */
+                _trigFire( r, r->wp );
+                break;
             }
         }
+
+        if ( ( !n ) && ( !used ) )
+        {
+            break;
+        }
     }
 }
-
 // ====================================================================================================
-static void _flushBuffer( struct RunTime *r )
+static bool _rxAdd( struct RunTime *r, const uint8_t *d, size_t len )
 
-/* Empty the output buffer, and de-allocate its memory */
+/* Add data to the post-mortem buffer, returning true if it filled up and we've stopped collecting */
 
 {
-    /* Tell the UI there's nothing more to show */
-    SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
+    size_t ofs, seg;
+
+    r->newTotalBytes += len;
+
+    if ( ( r->options->trigType != TRIG_NONE ) && ( r->options->trigType != TRIG_ITM ) && ( !r->triggered ) )
+    {
+        _trigScan( r, d, len );
+    }
 
-    /* Remove all of the recorded lines */
-    while ( r->numLines-- )
+    if ( r->triggered )
     {
-        if ( !r->opText[r->numLines].isRef )
+        /* Only take what there's to go before the stop point, then hold */
+        if ( len >= r->trigStop - r->wp )
         {
-            free( r->opText[r->numLines].buffer );
+            len = r->trigStop - r->wp;
+            r->held = true;
         }
     }
 
-    /* and the opText buffer */
-    free( r->opText );
-    r->opText = NULL;
-    r->numLines = 0;
+    if ( r->singleShot )
+    {
+        /* Only take what there's room for, then hold */
+        if ( len >= r->pmSize - ( r->wp - r->rp ) )
+        {
+            len = r->pmSize - ( r->wp - r->rp );
+            r->held = true;
+        }
+    }
+    else
+    {
+        /* Only the most recent buffer full of data can be kept */
+        if ( len > r->pmSize )
+        {
+            d += len - r->pmSize;
+            len = r->pmSize;
+        }
+    }
 
-    /* ...and the file/line references */
-    r->op.currentLine = NO_LINE;
-    r->op.currentFileindex = NO_FILE;
-    r->op.currentFunctionptr = NULL;
-    r->op.workingAddr = NO_DESTADDRESS;
+    /* Copy in, in two pieces if it goes over the end...a mirrored buffer doesn't have an end */
+    ofs = r->wp & ( r->pmSize - 1 );
+    seg = ( ( r->pmMirrored ) || ( ofs + len <= r->pmSize ) ) ? len : r->pmSize - ofs;
+    memcpy( &r->pmBuffer[ofs], d, seg );
+    memcpy( r->pmBuffer, d + seg, len - seg );
+
+    r->wp += len;
+    atomic_store( &r->liveWp, r->wp );
+
+    if ( r->wp - r->rp > r->pmSize )
+    {
+        /* ...and anything that was overwritten is gone */
+        r->rp = r->wp - r->pmSize;
+    }
+
+    return r->held;
 }
 // ====================================================================================================
-// Strdup leak is deliberately ignored. That is the central purpose of this code. It's cleaned
-// upin __flushBuffer above.
-#pragma GCC diagnostic push
-#if !defined(__clang__)
-    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-#endif
-
-static void _appendToOPBuffer( struct RunTime *r, void *dat, int32_t lineno, enum LineType lt, const char *fmt, ... )
+static void _stampAdd( struct RunTime *r, uint64_t when )
 
-/* Add line to output buffer, in a printf stylee */
+/* Note the time of the trace about to go into a core's buffer */
 
 {
-    char construct[SCRATCH_STRING_LEN];
-    va_list va;
-    char *p;
+    int32_t gone = 0;
 
-    va_start( va, fmt );
-    vsnprintf( construct, SCRATCH_STRING_LEN, fmt, va );
-    va_end( va );
+    if ( r->stampCount == r->stampAlloc )
+    {
+        /* Anything that's wholly before the oldest data in the buffer isn't needed any more */
+        while ( ( gone + 1 < r->stampCount ) && ( r->stamp[gone + 1].at <= r->rp ) )
+        {
+            gone++;
+        }
 
-    /* Make sure we didn't accidentially admit a CR or LF */
-    for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
+        memmove( r->stamp, &r->stamp[gone], ( r->stampCount - gone ) * sizeof( struct pmStamp ) );
+        r->stampCount -= gone;
+    }
 
-    *p = 0;
+    if ( r->stampCount == r->stampAlloc )
+    {
+        r->stampAlloc = ( r->stampAlloc ) ? r->stampAlloc * 2 : 1024;
+        r->stamp = ( struct pmStamp * )memRealloc( MEM_LINES, r->stamp, r->stampAlloc * sizeof( struct pmStamp ) );
+        MEMCHECKV( r->stamp );
+    }
 
-    r->opText = ( struct sioline * )realloc( r->opText, ( sizeof( struct sioline ) ) * ( r->numLines + 1 ) );
-    r->opText[r->numLines].buffer = strdup( construct );
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = false;
-    r->opText[r->numLines].dat    = dat;
-    r->numLines++;
+    r->stamp[r->stampCount].at = r->wp;
+    r->stamp[r->stampCount++].when = when;
 }
-#pragma GCC diagnostic pop
-
 // ====================================================================================================
-static void _appendRefToOPBuffer( struct RunTime *r, void *dat, int32_t lineno, enum LineType lt, const char *ref )
+static void _rxReset( struct RunTime *r )
 
-/* Add line to output buffer, as a reference (which don't be free'd later) */
+/* Empty the post-mortem buffer, or each core's */
 
 {
-    r->opText = ( struct sioline * )realloc( r->opText, ( sizeof( struct sioline ) ) * ( r->numLines + 1 ) );
+    r->wp = r->rp = 0;
+    r->stampCount = 0;
 
-    /* This line removes the 'const', but we know to not mess with this line */
-    r->opText[r->numLines].buffer = ( char * )ref;
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = true;
-    r->opText[r->numLines].dat    = dat;
-    r->numLines++;
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        _rxReset( r->core[k] );
+    }
 }
 // ====================================================================================================
-static void _traceReport( enum verbLevel l, const char *fmt, ... )
+static bool _rxHasData( struct RunTime *r )
 
-/* Debug reporting stream */
+/* Check if there's anything in the post-mortem buffer, or in any core's */
 
 {
-    if ( _r.options->withDebugText )
-    {
-        static char op[SCRATCH_STRING_LEN];
+    bool has = ( r->wp != r->rp );
 
-        va_list va;
-        va_start( va, fmt );
-        vsnprintf( op, SCRATCH_STRING_LEN, fmt, va );
-        va_end( va );
-        _appendToOPBuffer( &_r, NULL, _r.op.currentLine, LT_DEBUG, op );
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        has |= _rxHasData( r->core[k] );
     }
+
+    return has;
 }
 // ====================================================================================================
-static void _addRetToStack( struct RunTime *r, symbolMemaddr p )
+static int _rxContents( struct RunTime *r, uint8_t **seg, size_t *seglen )
+
+/* Return the contents of the post-mortem buffer, oldest first, as one or two segments */
 
 {
-    if ( r->stackDepth == MAX_CALL_STACK - 1 )
-    {
-        /* Stack is full, so make room for a new entry */
-        memmove( &r->callStack[0], &r->callStack[1], sizeof( symbolMemaddr ) * ( MAX_CALL_STACK - 1 ) );
-    }
+    size_t ofs = r->rp & ( r->pmSize - 1 );
+    size_t len = r->wp - r->rp;
 
-    r->callStack[r->stackDepth] = p;
-    _traceReport( V_DEBUG, "Pushed %08x to return stack", r->callStack[r->stackDepth] );
+    seg[0] = &r->pmBuffer[ofs];
 
-    if ( r->stackDepth < MAX_CALL_STACK - 1 )
+    if ( ( r->pmMirrored ) || ( ofs + len <= r->pmSize ) )
     {
-        /* We aren't at max depth, so go ahead and remove this entry */
-        r->stackDepth++;
+        seglen[0] = len;
+        return 1;
     }
+
+    seglen[0] = r->pmSize - ofs;
+    seg[1] = r->pmBuffer;
+    seglen[1] = len - seglen[0];
+    return 2;
 }
 // ====================================================================================================
-static void _reportNonflowEvents( struct RunTime *r )
+static void _rxCreate( struct RunTime *r )
+
+/* Create the post-mortem buffer. Where we can, the buffer memory is mapped twice, one copy straight after */
+/* the other, so whatever is in it can be read or written as one piece even when it wraps.                 */
 
 {
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
+    /* Round the size up to a power of two (and no smaller than a page, so it can be mapped) */
+    for ( r->pmSize = 4096; r->pmSize < ( size_t )r->options->buflen; r->pmSize <<= 1 )
+    {}
 
-    if ( TRACEStateChanged( &r->i, EV_CH_TRACESTART ) )
+    if ( r->pmSize != ( size_t )r->options->buflen )
     {
-        if ( !r->traceRunning )
-        {
-            _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== TRACE START EVENT ==========" );
-            r->traceRunning = true;
-        }
+        genericsReport( V_INFO, "Post mortem buffer rounded up to %zu KBytes" EOL, r->pmSize / 1024 );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_VMID ) )
-    {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** VMID Set to %d", cpu->vmid );
-    }
+#if defined( LINUX )
+    int fd = memfd_create( "orbmortem", 0 );
+    uint8_t *m;
 
-    if ( TRACEStateChanged( &r->i, EV_CH_EX_EXIT ) )
+    if ( ( fd >= 0 ) && ( r->pmSize % sysconf( _SC_PAGESIZE ) == 0 ) && ( ftruncate( fd, r->pmSize ) == 0 ) )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Exit ==========" );
-    }
+        /* Reserve space for both copies, then map the buffer into each half of it */
+        m = ( uint8_t * )mmap( NULL, 2 * r->pmSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
 
-    if ( TRACEStateChanged( &r->i, EV_CH_TSTAMP ) )
-    {
-        if ( cpu->ts )
+        if ( m != MAP_FAILED )
         {
-            if ( cpu->ts != COUNT_UNKNOWN )
+            if ( ( mmap( m, r->pmSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) != MAP_FAILED ) &&
+                    ( mmap( m + r->pmSize, r->pmSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) != MAP_FAILED ) )
             {
-                _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Timestamp %ld", cpu->ts );
+                r->pmBuffer = m;
+                r->pmMirrored = true;
+#if defined( MADV_HUGEPAGE )
+                /* Worth asking for, a big ring gets walked through end to end. Only happens if shmem THP is allowed */
+                madvise( m, 2 * r->pmSize, MADV_HUGEPAGE );
+#endif
             }
             else
             {
-                _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Timestamp unknown" );
+                munmap( m, 2 * r->pmSize );
             }
         }
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_TRIGGER ) )
+    if ( fd >= 0 )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Trigger" );
+        close( fd );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_CLOCKSPEED ) )
-    {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Change Clockspeed" );
-    }
+#endif
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ISLSIP ) )
+    if ( !r->pmMirrored )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** ISLSIP Triggered" );
+        r->pmBuffer = ( uint8_t * )bufPoolAlloc( r->pmSize, BUFPOOL_HUGE );
+        MEMCHECKV( r->pmBuffer );
     }
+}
 
-    if ( TRACEStateChanged( &r->i, EV_CH_CYCLECOUNT ) )
+// ====================================================================================================
+static void _processBlock( struct RunTime *r )
+
+/* Generic block processor for received data */
+
+{
+    uint8_t *c = r->rawBlock.buffer;
+    uint32_t y = r->rawBlock.fillLevel;
+
+    genericsReportRateLimited( V_DEBUG, "RXED Packet of %d bytes" EOL, y );
+
+    if ( y )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Cycle Count %d)", cpu->cycleCount );
+#ifdef DUMP_BLOCK
+        fprintf( stderr, EOL );
+
+        while ( y-- )
+        {
+            fprintf( stderr, "%02X ", *c++ );
+
+            if ( !( y % 16 ) )
+            {
+                fprintf( stderr, EOL );
+            }
+        }
+
+        c = r->rawBlock.buffer;
+        y = r->rawBlock.fillLevel;
+#endif
+
+        _rxAdd( r, c, y );
     }
+}
+// ====================================================================================================
 
-    if ( TRACEStateChanged( &r->i, EV_CH_VMID ) )
+static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
+
+{
+    struct RunTime *r = ( struct RunTime * )param;
+
+    if ( !p->good )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(VMID is now %d)", cpu->vmid );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
-
-    if ( TRACEStateChanged( &r->i, EV_CH_CONTEXTID ) )
+    else
     {
-        if ( r->context != cpu->contextID )
+        if ( r->ncores )
         {
-            _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Context ID is now %d)", cpu->contextID );
-            r->context = cpu->contextID;
+            /* With several tags, each goes to its own core along with the time it was stamped with */
+            for ( int k = 0; k < r->ncores; k++ )
+            {
+                if ( ( p->tag == r->core[k]->coreTag ) && ( !r->held ) )
+                {
+                    _stampAdd( r->core[k], p->tstamp );
+                    _rxAdd( r->core[k], p->d, p->len );
+                    r->newTotalBytes += p->len;
+                }
+            }
+        }
+        else if ( p->tag == r->options->tags[0] )
+        {
+            if ( !r->held )
+            {
+                _rxAdd( r, p->d, p->len );
+            }
+        }
+        else if ( ( p->tag == ITM_TAG ) && ( r->options->trigType == TRIG_ITM ) && ( !r->triggered ) )
+        {
+            _trigScanITM( r, p->d, p->len );
         }
     }
+}
 
-    if ( TRACEStateChanged( &r->i, EV_CH_SECURE ) )
+// ====================================================================================================
+static void _pageFree( struct RunTime *r, struct pmPage *p )
+
+/* Remove a page's lines from the cache */
+
+{
+    if ( ( !p->cached ) || ( p->mapped ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Non-Secure State is now %s)", cpu->nonSecure ? "True" : "False" );
+        return;
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ALTISA ) )
+    memFree( MEM_LINES, p->lines );
+    memFree( MEM_LINES, p->text );
+    p->lines = NULL;
+    p->text = NULL;
+    p->linesAlloc = 0;
+    p->textLen = p->textAlloc = 0;
+    p->cached = false;
+    r->cachedPages--;
+}
+// ====================================================================================================
+static void _occFree( struct pmPage *p )
+
+/* Remove a page's index, for when the page itself is going */
+
+{
+    if ( !p->mapped )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Using AltISA  is now %s)", cpu->altISA ? "True" : "False" );
+        memFree( MEM_INDEX, p->occ );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_HYP ) )
+    p->occ = NULL;
+    p->occCount = p->occAlloc = 0;
+    p->indexed = false;
+}
+// ====================================================================================================
+static void _resetOp( struct RunTime *r )
+
+/* Reset the file/line references, and flow tracking, ready for a fresh decode */
+
+{
+    r->op.currentLine = NO_LINE;
+    r->op.currentFileindex = NO_FILE;
+    r->op.currentFunctionptr = NULL;
+    r->op.workingAddr = NO_DESTADDRESS;
+    r->op.callKind = PM_CALL_NONE;
+    r->op.outside = false;
+    r->traceRunning = false;
+    r->stackDepth = 0;
+    r->stackDelPending = false;
+}
+// ====================================================================================================
+static void _flushBuffer( struct RunTime *r )
+
+/* Empty the output buffer, and de-allocate its memory */
+
+{
+    /* Tell the UI there's nothing more to show...cores don't have one of their own */
+    if ( r->sio )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine,  LT_EVENT, "(Using Hypervisor is now %s)", cpu->hyp ? "True" : "False" );
+        SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_JAZELLE ) )
+    for ( int k = 0; k < r->ncores; k++ )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Using Jazelle is now %s)", cpu->jazelle ? "True" : "False" );
+        _flushBuffer( r->core[k] );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_THUMB ) )
+    memFree( MEM_LINES, r->merged );
+    r->merged = NULL;
+
+    /* Remove all of the recorded lines, and the pages they came from */
+    for ( int32_t p = 0; p < r->pageCount; p++ )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Using Thumb is now %s)", cpu->thumb ? "True" : "False" );
+        _pageFree( r, &r->page[p] );
+        _occFree( &r->page[p] );
     }
-}
 
+    memFree( MEM_LINES, r->page );
+    r->page = NULL;
+    r->pageCount = r->firstPage = 0;
+    r->numLines = 0;
+
+    /* ...and the file/line references */
+    _resetOp( r );
+}
 // ====================================================================================================
-static void _traceCB( void *d )
+static struct pmLine *_newLine( struct RunTime *r, int32_t lineno, enum LineType lt )
 
-/* Callback function for when valid TRACE decode is detected */
+/* Add a line to the page being decoded */
 
 {
-    struct RunTime *r = ( struct RunTime * )d;
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
-    uint32_t incAddr = 0;
-    uint32_t disposition;
-    uint32_t targetAddr = 0; /* Just to avoid unitialised variable warning */
-    bool linearRun = false;
-    enum instructionClass ic;
-    symbolMemaddr newaddr;
+    struct pmPage *pg = r->decoding;
 
-    /* 1: Report anything that doesn't affect the flow */
-    /* =============================================== */
-    _reportNonflowEvents( r );
+    if ( pg->numLines == pg->linesAlloc )
+    {
+        pg->linesAlloc = ( pg->linesAlloc ) ? pg->linesAlloc * 2 : 256;
+        pg->lines = ( struct pmLine * )memRealloc( MEM_LINES, pg->lines, pg->linesAlloc * sizeof( struct pmLine ) );
+        MEMCHECK( pg->lines, NULL );
+    }
 
-    /* 2: Deal with exception entry */
-    /* ============================ */
-    if ( TRACEStateChanged( &r->i, EV_CH_EX_ENTRY ) )
+    pg->lines[pg->numLines].line = lineno;
+    pg->lines[pg->numLines].lt   = lt;
+    pg->lines[pg->numLines].call = PM_CALL_NONE;
+
+    if ( r->stamping )
     {
-        switch ( r->options->traceProt )
+        if ( r->whenCount == r->whenAlloc )
         {
-            case TRACE_PROT_ETM35:
-                _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Entry%s (%d (%s) at 0x%08x) ==========",
-                                   TRACEStateChanged( &r->i, EV_CH_CANCELLED ) ? ", Last Instruction Cancelled" : "", cpu->exception, TRACEExceptionName( cpu->exception ), cpu->addr );
-                break;
+            r->whenAlloc = ( r->whenAlloc ) ? r->whenAlloc * 2 : 4096;
+            r->when = ( uint64_t * )memRealloc( MEM_LINES, r->when, r->whenAlloc * sizeof( uint64_t ) );
+            MEMCHECK( r->when, NULL );
+        }
 
-            case TRACE_PROT_MTB:
-                _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Entry ==========" );
-                break;
+        r->when[r->whenCount++] = r->decodeWhen;
+    }
 
+    return &pg->lines[pg->numLines++];
+}
+// ====================================================================================================
+static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType lt, const char *fmt, ... )
 
-            case TRACE_PROT_ETM4:
+/* Add line to output buffer, in a printf stylee. The text is kept, since it can't be regenerated later. */
 
-                /* For the ETM4 case we get a new address with the exception indication. This address is the preferred _return_ address, */
-                /* there will be a further address packet, which is the jump destination, along shortly. Note that _this_ address        */
-                /* change indication will be consumed here, and won't hit the test below (which is correct behaviour.                    */
-                if ( !TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
-                {
-                    _traceReport( V_DEBUG, "Exception occured without return address specification" );
-                }
-                else
-                {
-                    _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Entry (%d (%s) at 0x%08x return to %08x ) ==========",
-                                       cpu->exception, TRACEExceptionName( cpu->exception ), r->op.workingAddr, cpu->addr );
-                    _addRetToStack( r, cpu->addr );
-                }
+{
+    char construct[SCRATCH_STRING_LEN];
+    struct pmPage *pg = r->decoding;
+    struct pmLine *l;
+    va_list va;
+    char *p;
 
-                break;
+    va_start( va, fmt );
+    vsnprintf( construct, SCRATCH_STRING_LEN, fmt, va );
+    va_end( va );
+
+    /* Make sure we didn't accidentially admit a CR or LF */
+    for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
+
+    *p++ = 0;
+
+    if ( pg->textLen + ( p - construct ) > pg->textAlloc )
+    {
+        while ( pg->textLen + ( p - construct ) > pg->textAlloc )
+        {
+            pg->textAlloc = ( pg->textAlloc ) ? pg->textAlloc * 2 : 4096;
+        }
+
+        pg->text = ( char * )memRealloc( MEM_LINES, pg->text, pg->textAlloc );
+        MEMCHECKV( pg->text );
+    }
+
+    if ( ( l = _newLine( r, lineno, lt ) ) )
+    {
+        memcpy( &pg->text[pg->textLen], construct, p - construct );
+        l->ref    = pg->textLen;
+        l->isText = true;
+        pg->textLen += p - construct;
+    }
+}
+// ====================================================================================================
+static void _occAdd( struct RunTime *r, enum pmOccKind kind, uint32_t key )
+
+/* Note what the line just added to the page being decoded is, unless the page has been indexed already */
+
+{
+    struct pmPage *pg = r->decoding;
+
+    if ( ( pg->indexed ) || ( !pg->numLines ) )
+    {
+        return;
+    }
+
+    if ( pg->occCount == pg->occAlloc )
+    {
+        int32_t alloc = ( pg->occAlloc ) ? pg->occAlloc * 2 : 256;
+        struct pmOcc *o = ( struct pmOcc * )memRealloc( MEM_INDEX, pg->occ, alloc * sizeof( struct pmOcc ) );
+
+        if ( !o )
+        {
+            /* No room (or it's over its limit), so this page will just be searched for less than it should */
+            return;
+        }
+
+        pg->occ = o;
+        pg->occAlloc = alloc;
+    }
+
+    pg->occ[pg->occCount].key  = key;
+    pg->occ[pg->occCount].n    = pg->numLines - 1;
+    pg->occ[pg->occCount].kind = kind;
+    pg->occCount++;
+}
+// ====================================================================================================
+static int _occCompare( const void *a, const void *b )
+
+{
+    const struct pmOcc *x = ( const struct pmOcc * )a;
+    const struct pmOcc *y = ( const struct pmOcc * )b;
+
+    if ( x->kind != y->kind )
+    {
+        return ( x->kind < y->kind ) ? -1 : 1;
+    }
+
+    if ( x->key != y->key )
+    {
+        return ( x->key < y->key ) ? -1 : 1;
+    }
+
+    return ( x->n < y->n ) ? -1 : ( x->n > y->n );
+}
+// ====================================================================================================
+static void _occFinish( struct pmPage *p )
+
+/* A page has been decoded, so sort what was noted in it for searching */
+
+{
+    if ( p->indexed )
+    {
+        return;
+    }
+
+    qsort( p->occ, p->occCount, sizeof( struct pmOcc ), _occCompare );
+
+    /* It's kept for as long as the page is, so give back what isn't needed */
+    if ( ( p->occCount ) && ( p->occCount < p->occAlloc ) )
+    {
+        struct pmOcc *o = ( struct pmOcc * )memRealloc( MEM_INDEX, p->occ, p->occCount * sizeof( struct pmOcc ) );
+
+        if ( o )
+        {
+            p->occ = o;
+            p->occAlloc = p->occCount;
+        }
+    }
+
+    p->indexed = true;
+}
+// ====================================================================================================
+static void _appendAddrToOPBuffer( struct RunTime *r, symbolMemaddr addr, int32_t lineno, enum LineType lt )
+
+/* Add line to output buffer that is about addr. Its text is generated from the symbols when it's needed. */
+
+{
+    struct pmLine *l;
+
+    if ( ( l = _newLine( r, lineno, lt ) ) )
+    {
+        l->ref    = addr;
+        l->isText = false;
+
+        if ( lt == LT_ASSEMBLY )
+        {
+            _occAdd( r, PM_OCC_ADDRESS, addr );
+        }
+    }
+}
+// ====================================================================================================
+static _Thread_local struct RunTime *_reportTo;  /* What's being decoded on this thread, for the debug text */
+
+static void _traceReport( enum verbLevel l, const char *fmt, ... )
+
+/* Debug reporting stream */
+
+{
+    /* ...which only goes into the output while a page is being decoded */
+    if ( ( _r.options->withDebugText ) && ( _reportTo ) && ( _reportTo->decoding ) )
+    {
+        static _Thread_local char op[SCRATCH_STRING_LEN];
+
+        va_list va;
+        va_start( va, fmt );
+        vsnprintf( op, SCRATCH_STRING_LEN, fmt, va );
+        va_end( va );
+        _appendToOPBuffer( _reportTo, _reportTo->op.currentLine, LT_DEBUG, op );
+    }
+}
+// ====================================================================================================
+static void _addRetToStack( struct RunTime *r, symbolMemaddr p )
+
+{
+    if ( r->stackDepth == MAX_CALL_STACK - 1 )
+    {
+        /* Stack is full, so make room for a new entry */
+        memmove( &r->callStack[0], &r->callStack[1], sizeof( symbolMemaddr ) * ( MAX_CALL_STACK - 1 ) );
+    }
+
+    r->callStack[r->stackDepth] = p;
+    _traceReport( V_DEBUG, "Pushed %08x to return stack", r->callStack[r->stackDepth] );
+
+    if ( r->stackDepth < MAX_CALL_STACK - 1 )
+    {
+        /* We aren't at max depth, so go ahead and remove this entry */
+        r->stackDepth++;
+    }
+}
+// ====================================================================================================
+static void _reportNonflowEvents( struct RunTime *r )
+
+{
+    struct TRACECPUState *cpu = TRACECPUState( &r->i );
+
+    if ( TRACEStateChanged( &r->i, EV_CH_TRACESTART ) )
+    {
+        if ( !r->traceRunning )
+        {
+            _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "========== TRACE START EVENT ==========" );
+            r->traceRunning = true;
+        }
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_VMID ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** VMID Set to %d", cpu->vmid );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_EX_EXIT ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "========== Exception Exit ==========" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_TSTAMP ) )
+    {
+        if ( cpu->ts )
+        {
+            if ( cpu->ts != COUNT_UNKNOWN )
+            {
+                _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** Timestamp %ld", cpu->ts );
+            }
+            else
+            {
+                _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** Timestamp unknown" );
+            }
+        }
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_TRIGGER ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** Trigger" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_CLOCKSPEED ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** Change Clockspeed" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_ISLSIP ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** ISLSIP Triggered" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_CYCLECOUNT ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(Cycle Count %d)", cpu->cycleCount );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_VMID ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(VMID is now %d)", cpu->vmid );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_CONTEXTID ) )
+    {
+        if ( r->context != cpu->contextID )
+        {
+            _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(Context ID is now %d)", cpu->contextID );
+            r->context = cpu->contextID;
+        }
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_SECURE ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(Non-Secure State is now %s)", cpu->nonSecure ? "True" : "False" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_ALTISA ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(Using AltISA  is now %s)", cpu->altISA ? "True" : "False" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_HYP ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine,  LT_EVENT, "(Using Hypervisor is now %s)", cpu->hyp ? "True" : "False" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_JAZELLE ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(Using Jazelle is now %s)", cpu->jazelle ? "True" : "False" );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_THUMB ) )
+    {
+        _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "(Using Thumb is now %s)", cpu->thumb ? "True" : "False" );
+    }
+}
+
+// ====================================================================================================
+static void _callsFunction( struct RunTime *r )
+
+/* In a call trace, note when the function being executed changes, and whether by a call or a return */
+
+{
+    struct symbolFunctionStore *f = r->op.currentFunctionptr;
+    struct pmLine *l;
+    int32_t depth;
+
+    if ( ( r->op.workingAddr == NO_DESTADDRESS ) ||
+            ( ( r->op.callKind == PM_CALL_NONE ) && ( f ) && ( r->op.workingAddr >= f->lowaddr ) && ( r->op.workingAddr <= f->highaddr ) ) )
+    {
+        return;
+    }
+
+    f = symbolFunctionAt( r->s, r->op.workingAddr );
+
+    if ( ( r->op.callKind == PM_CALL_NONE ) && ( f == r->op.currentFunctionptr ) )
+    {
+        return;
+    }
+
+    /* A return hasn't come off the stack yet, in case it turns out not to be one */
+    depth = r->stackDepth - ( ( ( r->op.callKind == PM_CALL_RETURN ) && ( r->stackDepth ) ) ? 1 : 0 );
+
+    if ( ( l = _newLine( r, depth, LT_FILE ) ) )
+    {
+        l->ref    = r->op.workingAddr;
+        l->isText = false;
+        l->call   = ( r->op.callKind == PM_CALL_NONE ) ? PM_CALL_JUMP : r->op.callKind;
+
+        if ( f )
+        {
+            _occAdd( r, PM_OCC_FUNCTION, f->lowaddr );
+        }
+    }
+
+    r->op.currentFunctionptr = f;
+    r->op.currentFileindex   = ( f ) ? f->filename : NO_FILE;
+    r->op.callKind           = PM_CALL_NONE;
+}
+// ====================================================================================================
+static void _traceCB( void *d )
+
+/* Callback function for when valid TRACE decode is detected */
+
+{
+    struct RunTime *r = ( struct RunTime * )d;
+    struct TRACECPUState *cpu = TRACECPUState( &r->i );
+    uint32_t incAddr = 0;
+    uint32_t disposition;
+    uint32_t targetAddr = 0; /* Just to avoid unitialised variable warning */
+    bool linearRun = false;
+    enum instructionClass ic;
+    symbolMemaddr newaddr;
+
+    /* 1: Report anything that doesn't affect the flow */
+    /* =============================================== */
+    _reportNonflowEvents( r );
+
+    /* 2: Deal with exception entry */
+    /* ============================ */
+    if ( TRACEStateChanged( &r->i, EV_CH_EX_ENTRY ) )
+    {
+        switch ( r->options->traceProt )
+        {
+            case TRACE_PROT_ETM35:
+                _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "========== Exception Entry%s (%d (%s) at 0x%08x) ==========",
+                                   TRACEStateChanged( &r->i, EV_CH_CANCELLED ) ? ", Last Instruction Cancelled" : "", cpu->exception, TRACEExceptionName( cpu->exception ), cpu->addr );
+                _occAdd( r, PM_OCC_EXCEPTION, cpu->exception );
+                break;
+
+            case TRACE_PROT_MTB:
+                _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "========== Exception Entry ==========" );
+                break;
+
+
+            case TRACE_PROT_ETM4:
+
+                /* For the ETM4 case we get a new address with the exception indication. This address is the preferred _return_ address, */
+                /* there will be a further address packet, which is the jump destination, along shortly. Note that _this_ address        */
+                /* change indication will be consumed here, and won't hit the test below (which is correct behaviour.                    */
+                if ( !TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+                {
+                    _traceReport( V_DEBUG, "Exception occured without return address specification" );
+                }
+                else
+                {
+                    _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "========== Exception Entry (%d (%s) at 0x%08x return to %08x ) ==========",
+                                       cpu->exception, TRACEExceptionName( cpu->exception ), r->op.workingAddr, cpu->addr );
+                    _occAdd( r, PM_OCC_EXCEPTION, cpu->exception );
+                    _addRetToStack( r, cpu->addr );
+                }
+
+                break;
+
+            default:
+                _traceReport( V_DEBUG, "Unrecognised trace protocol in exception handler" );
+                break;
+        }
+    }
+
+
+    /* 3: Collect flow affecting changes introduced by this event */
+    /* ========================================================== */
+    if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+    {
+        /* Make debug report if calculated and reported addresses differ. This is most useful for testing when exhaustive  */
+        /* address reporting is switched on. It will give 'false positives' for uncalculable instructions (e.g. bx lr) but */
+        /* it's a decent safety net to be sure the jump decoder is working correctly.                                      */
+
+        if ( r->options->traceProt != TRACE_PROT_MTB )
+        {
+            _traceReport( V_DEBUG, "%sCommanded CPU Address change (Was:0x%08x Commanded:0x%08x)" EOL,
+                          ( r->op.workingAddr == cpu->addr ) ? "" : "***INCONSISTENT*** ", r->op.workingAddr, cpu->addr );
+        }
+
+        /* Return Stack: If we had a stack deletion pending because of a candidate match, it wasn't, so abort */
+        if ( r->stackDelPending )
+        {
+            _traceReport( V_DEBUG, "Stack delete aborted" );
+        }
+
+        /* ...and it's only shown as a return in a call trace if it's to where the call was from */
+        if ( ( r->op.callKind == PM_CALL_RETURN ) && ( ( !r->stackDepth ) || ( r->callStack[r->stackDepth - 1] != cpu->addr ) ) )
+        {
+            r->op.callKind = PM_CALL_NONE;
+        }
+
+        r->stackDelPending = false;
+        /* Whatever the state was, this is an explicit setting of an address, so we need to respect it */
+        r->op.workingAddr = cpu->addr;
+    }
+    else
+    {
+        /* Return Stack: If we had a stack deletion pending because of a candidate match, the match was good, so commit */
+        if ( ( r->stackDelPending == true ) && ( r->stackDepth ) )
+        {
+            r->stackDepth--;
+            _traceReport( V_DEBUG, "Stack delete comitted" );
+        }
+
+        r->stackDelPending = false;
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_LINEAR ) )
+    {
+        /* MTB-Specific mechanism: Execute instructions from the marked starting location to the indicated finishing one */
+        /* Disposition is all 1's because every instruction is executed.                                                 */
+        r->op.workingAddr = cpu->addr;
+        targetAddr        = cpu->toAddr;
+        linearRun         = true;
+        disposition       = 0xffffffff;
+        _traceReport( V_DEBUG, "Linear run 0x%08x to 0x%08x" EOL, cpu->addr, cpu->toAddr );
+    }
+
+    if ( TRACEStateChanged( &r->i, EV_CH_ENATOMS ) )
+    {
+        /* Atoms represent instruction steps...some of which will have been executed, some stepped over. The number of steps is the   */
+        /* total of the eatoms (executed) and natoms (not executed) and the disposition bitfield shows if each individual instruction */
+        /* was executed or not. For ETM3 each 'run' of instructions is a single instruction with the disposition bit telling you if   */
+        /* it was executed or not. For ETM4 each 'run' of instructions is from the current address to the next possible change of     */
+        /* program flow (and which point the disposition bit tells you if that jump was taken or not).                                */
+        incAddr = cpu->eatoms + cpu->natoms;
+        disposition = cpu->disposition;
+    }
+
+    /* 4: Execute the flow instructions */
+    /* ================================ */
+    while ( ( incAddr && !linearRun ) || ( ( r->op.workingAddr <= targetAddr ) && linearRun ) )
+    {
+        struct symbolLineStore *l = NULL;
+        bool outside = !addrFilterHas( &r->options->focus, r->op.workingAddr );
+
+        if ( outside )
+        {
+            /* Nothing out here is shown, so like a call trace only the ends of the blocks matter. The calls */
+            /* and returns are still followed, so the stack is right when it comes back into the focus.     */
+            if ( !r->op.outside )
+            {
+                _appendToOPBuffer( r, r->op.currentLine, LT_EVENT, "*** Outside the focus at 0x%08x", r->op.workingAddr );
+                r->op.currentFileindex   = NO_FILE;
+                r->op.currentFunctionptr = NULL;
+                r->op.currentLine        = NO_LINE;
+            }
+
+            if ( linearRun )
+            {
+                r->op.workingAddr = targetAddr;
+            }
+            else if ( ( r->i.protocol == TRACE_PROT_ETM4 ) && ( ( newaddr = symbolNextBranch( r->s, r->op.workingAddr ) ) != NO_ADDRESS ) )
+            {
+                r->op.workingAddr = newaddr;
+            }
+        }
+        else if ( r->options->callTrace )
+        {
+            /* Only what happens at the end of a basic block matters. For ETM4 nothing up to its branch uses */
+            /* an atom, and an MTB run only branches at its end, so the rest can be skipped over. ETM3.5     */
+            /* has an atom for every instruction, so it still steps through them, but shows none.            */
+            _callsFunction( r );
+
+            if ( linearRun )
+            {
+                r->op.workingAddr = targetAddr;
+            }
+            else if ( ( r->i.protocol == TRACE_PROT_ETM4 ) && ( ( newaddr = symbolNextBranch( r->s, r->op.workingAddr ) ) != NO_ADDRESS ) )
+            {
+                r->op.workingAddr = newaddr;
+            }
+        }
+        else
+        {
+            /* Firstly, lets get the source code line...*/
+            l = symbolLineAt( r->s, r->op.workingAddr );
+        }
+
+        r->op.outside = outside;
+
+        if ( l )
+        {
+            /* If we have changed file or function put a header line in */
+            if ( l->function )
+            {
+                /* There is a valid function tag recognised here. If it's a change highlight it in the output. */
+                if ( ( l->function->filename != r->op.currentFileindex ) || ( l->function != r->op.currentFunctionptr ) )
+                {
+                    _appendAddrToOPBuffer( r, r->op.workingAddr, r->op.currentLine, LT_FILE );
+                    _occAdd( r, PM_OCC_FUNCTION, l->function->lowaddr );
+                    r->op.currentFileindex     = l->function->filename;
+                    r->op.currentFunctionptr   = l->function;
+                    r->op.currentLine = NO_LINE;
+                }
+            }
+            else
+            {
+                /* We didn't find a valid function, but we might have some information to work with.... */
+                if ( ( NO_FILE != r->op.currentFileindex ) || ( NULL != r->op.currentFunctionptr ) )
+                {
+                    _appendAddrToOPBuffer( r, r->op.workingAddr, r->op.currentLine, LT_FILE );
+                    r->op.currentFileindex     = NO_FILE;
+                    r->op.currentFunctionptr   = NULL;
+                    r->op.currentLine = NO_LINE;
+                }
+            }
+        }
+
+        /* If we have changed line then output the new one */
+        if ( l && ( ( l->startline != r->op.currentLine ) ) )
+        {
+            r->op.currentLine = l->startline;
+            _appendAddrToOPBuffer( r, r->op.workingAddr, r->op.currentLine, LT_SOURCE );
+            _occAdd( r, PM_OCC_LINE, l->lowaddr );
+        }
+
+        /* Now output the matching assembly, and location updates */
+        if ( symbolInsnAt( r->s, r->op.workingAddr, &ic, &newaddr ) )
+        {
+            /* Calculate if this instruction was executed. This is slightly hairy depending on which protocol we're using;         */
+            /*   * ETM3.5: Instructions are executed based on disposition bit (LSB in disposition word)                            */
+            /*   * ETM4  : ETM4 everything up to a branch is executed...decision about that branch is based on disposition bit     */
+            /*   * MTB   : Everything except jumps are executed, jumps are executed only if they are the last instruction in a run */
+            bool insExecuted = (
+                                           /* ETM3.5 case - dependent on disposition */
+                                           ( ( !linearRun )  && ( r->i.protocol == TRACE_PROT_ETM35 ) && ( disposition & 1 ) ) ||
+
+                                           /* ETM4 case - either not a branch or disposition is 1 */
+                                           ( ( !linearRun ) && ( r->i.protocol == TRACE_PROT_ETM4 ) && ( ( !( ic & LE_IC_JUMP ) ) || ( disposition & 1 ) ) ) ||
+
+                                           /* MTB case - a linear run to last address */
+                                           ( ( linearRun ) && ( r->i.protocol == TRACE_PROT_MTB ) &&
+                                             ( ( ( r->op.workingAddr != targetAddr ) && ( ! ( ic & LE_IC_JUMP ) ) )  ||
+                                               ( r->op.workingAddr == targetAddr )
+                                             ) ) );
+            if ( ( !r->options->callTrace ) && ( !outside ) )
+            {
+                _appendAddrToOPBuffer( r, r->op.workingAddr, r->op.currentLine, insExecuted ? LT_ASSEMBLY : LT_NASSEMBLY );
+            }
+
+            /* Move addressing along */
+            if ( ( r->i.protocol != TRACE_PROT_ETM4 ) || ( ic & LE_IC_JUMP ) )
+            {
+                if ( r->i.protocol == TRACE_PROT_ETM4 )
+                {
+                    _traceReport( V_DEBUG, "Consumed, %sexecuted (%d left)", insExecuted ? "" : "not ", incAddr - 1 );
+                }
+
+                disposition >>= 1;
+                incAddr--;
+            }
+
+            if ( ic & LE_IC_CALL )
+            {
+                if ( insExecuted )
+                {
+                    /* Push the instruction after this if it's a subroutine or ISR */
+                    _traceReport( V_DEBUG, "Call to %08x", newaddr );
+                    _addRetToStack( r, r->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 ) );
+                    r->op.callKind = PM_CALL_ENTRY;
+                }
+
+                r->op.workingAddr = insExecuted ? newaddr : r->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 );
+            }
+            else if ( ic & LE_IC_JUMP )
+            {
+                _traceReport( V_DEBUG, "%sTAKEN JUMP", insExecuted ? "" : "NOT " );
+
+                if ( insExecuted )
+                {
+                    /* Update working address according to if jump was taken */
+                    if ( ic & LE_IC_IMMEDIATE )
+                    {
+                        _traceReport( V_DEBUG, "Immediate address %8x", newaddr );
+                        /* We have a good address, so update with it */
+                        r->op.workingAddr = newaddr;
+                    }
+                    else
+                    {
+                        /* We didn't get the address, so need to park the call stack address if we've got one. Either we won't      */
+                        /* get an address (in which case this one was correct), or we wont (in which case, don't unstack this one). */
+                        if ( r->stackDepth )
+                        {
+                            r->op.workingAddr = r->callStack[r->stackDepth - 1];
+                            r->op.callKind = PM_CALL_RETURN;
+                            _traceReport( V_DEBUG, "Return with stacked candidate to %08x", r->op.workingAddr );
+                        }
+                        else
+                        {
+                            _traceReport( V_DEBUG, "Return with no stacked candidate" );
+                        }
+
+                        r->stackDelPending = true;
+                    }
+                }
+                else
+                {
+                    /* The branch wasn't taken, so just move along */
+                    r->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
+                }
+            }
+            else
+            {
+                /* Just a regular instruction, so just move along */
+                r->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
+            }
+        }
+        else
+        {
+            if ( ( !r->options->callTrace ) && ( !outside ) )
+            {
+                _appendAddrToOPBuffer( r, r->op.workingAddr, r->op.currentLine, LT_ASSEMBLY );
+            }
+
+            r->op.workingAddr += 2;
+            disposition >>= 1;
+            incAddr--;
+        }
+    }
+}
+
+// ====================================================================================================
+static long _findSync( struct RunTime *r, size_t from )
+
+/* Return the offset of the first sync point at or after from in the post-mortem buffer, or -1 if there isn't one */
+
+{
+    uint8_t *seg[2];
+    size_t seglen[2];
+    size_t base = 0;
+    int s;
+
+    for ( int i = 0, nsegs = _rxContents( r, seg, seglen ); i < nsegs; base += seglen[i++] )
+    {
+        if ( ( from < base + seglen[i] ) &&
+                ( ( s = TRACEDecoderFindSync( &r->i, seg[i], seglen[i], ( from > base ) ? from - base : 0 ) ) >= 0 ) )
+        {
+            return base + s;
+        }
+    }
+
+    return -1;
+}
+// ====================================================================================================
+static void _pumpRange( struct RunTime *r, size_t start, size_t len )
+
+/* Pump part of the post-mortem buffer through the TRACE decoder, it will callback to _traceCB with complete sentences */
+
+{
+    uint8_t *seg[2];
+    size_t seglen[2];
+    size_t base = 0, from, to;
+
+    /* Two calls if the range is wrapped - submit both parts */
+    for ( int i = 0, nsegs = _rxContents( r, seg, seglen ); i < nsegs; base += seglen[i++] )
+    {
+        from = ( start > base ) ? start : base;
+        to   = ( start + len < base + seglen[i] ) ? start + len : base + seglen[i];
+
+        if ( from < to )
+        {
+            TRACEDecoderPump( &r->i, &seg[i][from - base], to - from, _traceCB, r );
+        }
+    }
+}
+// ====================================================================================================
+static void _pumpStamped( struct RunTime *r, size_t start, size_t len )
+
+/* As _pumpRange, but in pieces that each arrived at one time, so each line can be noted with when it did */
+
+{
+    size_t at = r->rp + start, end = at + len, next;
+    int32_t lo = 0, hi = r->stampCount - 1, mid;
+
+    /* Find the last stamp at or before the start of the range */
+    while ( lo < hi )
+    {
+        mid = ( lo + hi + 1 ) / 2;
+
+        if ( r->stamp[mid].at <= at )
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    for ( ; at < end; lo++ )
+    {
+        r->decodeWhen = ( lo < r->stampCount ) ? r->stamp[lo].when : r->decodeWhen;
+        next = ( ( lo + 1 < r->stampCount ) && ( r->stamp[lo + 1].at < end ) ) ? r->stamp[lo + 1].at : end;
+
+        if ( next > at )
+        {
+            _pumpRange( r, at - r->rp, next - at );
+            at = next;
+        }
+    }
+}
+// ====================================================================================================
+static void _pageDecode( struct RunTime *r, struct pmPage *p )
+
+/* Decode a page into lines, making room in the cache for them if needed */
+
+{
+    struct pmPage *lru;
+
+    while ( r->cachedPages >= PM_CACHE_PAGES )
+    {
+        lru = NULL;
+
+        for ( int32_t i = 0; i < r->pageCount; i++ )
+        {
+            if ( ( r->page[i].cached ) && ( !r->page[i].mapped ) && ( ( !lru ) || ( r->page[i].lastUsed < lru->lastUsed ) ) )
+            {
+                lru = &r->page[i];
+            }
+        }
+
+        _pageFree( r, lru );
+    }
+
+    /* Every page is decoded from scratch, so it gives the same lines whenever it's decoded */
+    r->i.engine->destroy( r->i.engine );
+    TRACEDecoderInit( &r->i, r->options->traceProt, !( r->options->noAltAddr ), _traceReport );
+    TRACEDecoderForceSync( &r->i, ( p == r->page ) && r->startSynced );
+    _resetOp( r );
+
+    p->numLines = 0;
+    r->decoding = p;
+    _reportTo = r;
+
+    if ( r->stamping )
+    {
+        _pumpStamped( r, p->start, p->len );
+    }
+    else
+    {
+        _pumpRange( r, p->start, p->len );
+    }
+
+    _reportTo = NULL;
+    r->decoding = NULL;
+    _occFinish( p );
+
+    p->cached = true;
+    r->cachedPages++;
+}
+// ====================================================================================================
+static struct pmPage *_pageGet( struct RunTime *r, int32_t n )
+
+/* Return page n, with its lines */
+
+{
+    struct pmPage *p = &r->page[n];
+
+    if ( !p->cached )
+    {
+        _pageDecode( r, p );
+    }
+
+    p->lastUsed = ++r->pageClock;
+    return p;
+}
+// ====================================================================================================
+static void _renderInto( struct RunTime *r, struct pmPage *p, int32_t n, struct sioline *s, char *t, csh h )
+
+/* Turn line n of page p into text in s, using t (SCRATCH_STRING_LEN long) for it if needed. If h is */
+/* set it's the caller's own disassembler, and this is safe to call from several threads at once.   */
+
+{
+    const struct pmLine *pl = &p->lines[n];
+    char dis[SYMBOL_DISASM_LEN];
+    struct symbolLineStore *l;
+    enum instructionClass ic;
+    char *a;
+
+    s->lt    = pl->lt;
+    s->line  = pl->line;
+    s->isRef = true;
+
+    if ( pl->isText )
+    {
+        s->buffer = &p->text[pl->ref];
+        s->dat    = NULL;
+        return;
+    }
+
+    s->dat = l = symbolLineAt( r->s, pl->ref );
+    s->buffer = t;
+
+    switch ( pl->lt )
+    {
+        case LT_FILE:
+            if ( ( l ) && ( l->function ) )
+            {
+                snprintf( t, SCRATCH_STRING_LEN, "%s::%s", symbolGetFilename( r->s, l->function->filename ), symbolFunctionName( l->function, r->options->demangle ) );
+            }
+            else
+            {
+                strcpy( t, "Unknown function" );
+            }
+
+            if ( pl->call )
+            {
+                /* In a call trace it's shown at its depth, marked with how it was got to */
+                const char *how = ( pl->call == PM_CALL_ENTRY ) ? "-> " : ( pl->call == PM_CALL_RETURN ) ? "<- " : "   ";
+                size_t indent = 2 * ( ( pl->line > 0 ) ? pl->line : 0 );
+                size_t len = strnlen( t, SCRATCH_STRING_LEN - indent - 4 );
+
+                memmove( &t[indent + 3], t, len );
+                t[indent + 3 + len] = 0;
+                memset( t, ' ', indent );
+                memcpy( &t[indent], how, 3 );
+            }
+
+            break;
+
+        case LT_SOURCE:
+            /* This line removes the 'const', but we know to not mess with this line */
+            s->buffer = ( char * )( l ? symbolSource( r->s, l->filename, l->startline - 1 ) : NULL );
+            break;
+
+        default:
+            a = ( h ) ? symbolDisassembleLineTo( r->s, h, dis, &ic, pl->ref, NULL ) : symbolDisassembleLine( r->s, &ic, pl->ref, NULL );
+
+            if ( a )
+            {
+                /* Make sure we don't admit a CR or LF */
+                snprintf( t, SCRATCH_STRING_LEN, "%.*s", ( int )strcspn( a, "\r\n" ), a );
+            }
+            else
+            {
+                snprintf( t, SCRATCH_STRING_LEN, "%8x:\tASSEMBLY NOT FOUND", pl->ref );
+            }
+
+            break;
+    }
+}
+// ====================================================================================================
+static struct sioline *_renderLine( struct RunTime *r, struct pmPage *p, int32_t n )
+
+/* Turn line n of page p into text. This is only valid until PM_RENDER_SLOTS more lines have been rendered. */
+
+{
+    struct sioline *s = &r->render[r->renderNext];
+
+    _renderInto( r, p, n, s, r->renderText[r->renderNext], 0 );
+    r->renderNext = ( r->renderNext + 1 ) % PM_RENDER_SLOTS;
+    return s;
+}
+// ====================================================================================================
+static int32_t _pageOf( struct RunTime *r, int32_t l )
+
+/* Return the page that line l of the output buffer is in */
+
+{
+    int32_t lo = r->firstPage, hi = r->pageCount - 1, mid;
+
+    assert( ( l >= 0 ) && ( l < r->numLines ) );
+
+    /* Find the last page that starts at or before this line...empty pages start where the next one does */
+    while ( lo < hi )
+    {
+        mid = ( lo + hi + 1 ) / 2;
+
+        if ( r->page[mid].firstLine <= l )
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+// ====================================================================================================
+static struct sioline *_lineAt( struct RunTime *r, int32_t l )
+
+/* Return line l of the output buffer, decoding it if needed. This is only valid until another page is decoded. */
+
+{
+    struct pmPage *p;
+
+    if ( r->merged )
+    {
+        /* It's a line of one of the cores, marked with which one */
+        struct RunTime *c = r->core[r->merged[l].core];
+        struct sioline *cl = _lineAt( c, r->merged[l].line );
+        struct sioline *s = &r->render[r->renderNext];
+        char *t = r->renderText[r->renderNext];
+        const char *b = ( cl->buffer ) ? cl->buffer : "";
+
+        *s = *cl;
+        s->buffer = t;
+        snprintf( t, SCRATCH_STRING_LEN, "%3d| %.*s", c->coreTag, ( int )strcspn( b, "\r\n" ), b );
+        r->renderNext = ( r->renderNext + 1 ) % PM_RENDER_SLOTS;
+        return s;
+    }
+
+    p = _pageGet( r, _pageOf( r, l ) );
+    return _renderLine( r, p, l - p->firstLine );
+}
+// ====================================================================================================
+static struct sioline *_fetchLine( void *ctx, int32_t l )
+
+{
+    return _lineAt( ( struct RunTime * )ctx, l );
+}
+// ====================================================================================================
+static int32_t _extendBack( struct RunTime *r, int32_t wanted )
+
+/* Add pages to the front of the output buffer until there are at least wanted more lines, or there are no more */
+
+{
+    int32_t added = 0;
+
+    while ( ( r->firstPage ) && ( added < wanted ) )
+    {
+        added += _pageGet( r, --r->firstPage )->numLines;
+    }
+
+    /* Everything after the new pages moves along */
+    for ( int32_t i = r->firstPage, line = 0; i < r->pageCount; line += r->page[i++].numLines )
+    {
+        r->page[i].firstLine = line;
+    }
+
+    r->numLines += added;
+    return added;
+}
+// ====================================================================================================
+static int32_t _occSeek( const struct pmPage *p, enum pmOccKind kind, uint32_t key, int32_t n )
+
+/* Return the first entry in the index of p that doesn't come before kind/key at line n */
+
+{
+    struct pmOcc want = { .key = key, .n = n, .kind = kind };
+    int32_t lo = 0, hi = p->occCount, mid;
+
+    while ( lo < hi )
+    {
+        mid = ( lo + hi ) / 2;
+
+        if ( _occCompare( &p->occ[mid], &want ) < 0 )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+// ====================================================================================================
+static int32_t _occFind( struct RunTime *r, enum pmOccKind kind, uint32_t key, int32_t from, bool back )
+
+/* Return the line of the output buffer where kind/key next turns up after line from (or before it, if  */
+/* back), or -1 if it doesn't. Pages in front of the output buffer are decoded to be searched, and only */
+/* if there's a match in one are they added to it...which moves every line along.                      */
+
+{
+    int32_t pg = _pageOf( r, from );
+    int32_t at = from - r->page[pg].firstLine;
+    struct pmPage *p;
+    int32_t i;
+
+    while ( ( pg >= 0 ) && ( pg < r->pageCount ) )
+    {
+        p = ( r->page[pg].indexed ) ? &r->page[pg] : _pageGet( r, pg );
+        i = ( back ) ? _occSeek( p, kind, key, at ) - 1 : _occSeek( p, kind, key, at + 1 );
+
+        if ( ( i >= 0 ) && ( i < p->occCount ) && ( p->occ[i].kind == kind ) && ( p->occ[i].key == key ) )
+        {
+            while ( r->firstPage > pg )
+            {
+                _extendBack( r, 1 );
+            }
+
+            return p->firstLine + p->occ[i].n;
+        }
+
+        pg += ( back ) ? -1 : 1;
+        at = ( back ) ? INT32_MAX : -1;
+    }
+
+    return -1;
+}
+// ====================================================================================================
+static bool _occOfLine( struct RunTime *r, int32_t l, bool inFunction, enum pmOccKind *kind, uint32_t *key )
+
+/* Work out what line l of the output buffer is in the index as or, with inFunction, the function it's in */
+
+{
+    struct pmPage *p = _pageGet( r, _pageOf( r, l ) );
+    const struct pmLine *pl = &p->lines[l - p->firstLine];
+    struct symbolLineStore *s;
+
+    if ( pl->isText )
+    {
+        /* The only text that's indexed are exception entries, and they're all together at the end of it */
+        for ( int32_t i = _occSeek( p, PM_OCC_EXCEPTION, 0, 0 ); ( !inFunction ) && ( i < p->occCount ); i++ )
+        {
+            if ( p->occ[i].n == l - p->firstLine )
+            {
+                *kind = PM_OCC_EXCEPTION;
+                *key  = p->occ[i].key;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    s = symbolLineAt( r->s, pl->ref );
+
+    if ( ( inFunction ) || ( pl->lt == LT_FILE ) )
+    {
+        *kind = PM_OCC_FUNCTION;
+        *key  = ( ( s ) && ( s->function ) ) ? s->function->lowaddr : 0;
+        return ( ( s ) && ( s->function ) );
+    }
+
+    switch ( pl->lt )
+    {
+        case LT_SOURCE:
+            *kind = PM_OCC_LINE;
+            *key  = ( s ) ? s->lowaddr : 0;
+            return ( s != NULL );
+
+        case LT_ASSEMBLY:
+        case LT_NASSEMBLY:
+            *kind = PM_OCC_ADDRESS;
+            *key  = pl->ref;
+            return true;
+
+        default:
+            return false;
+    }
+}
+// ====================================================================================================
+static void _pageIndex( struct RunTime *r )
+
+/* Split the post-mortem buffer into pages, each starting at a sync point. Nothing is decoded yet. */
+
+{
+    size_t len = r->wp - r->rp;
+    size_t start = 0;
+    int32_t alloc = 0;
+    long next;
+
+    while ( start < len )
+    {
+        /* The page runs to the first sync point far enough along, or the end of the buffer */
+        next = ( start + PM_PAGE_BYTES < len ) ? _findSync( r, start + PM_PAGE_BYTES ) : -1;
+
+        if ( next < 0 )
+        {
+            next = len;
+        }
+
+        if ( r->pageCount == alloc )
+        {
+            alloc = ( alloc ) ? alloc * 2 : 64;
+            r->page = ( struct pmPage * )memRealloc( MEM_LINES, r->page, alloc * sizeof( struct pmPage ) );
+            MEMCHECKV( r->page );
+        }
+
+        memset( &r->page[r->pageCount], 0, sizeof( struct pmPage ) );
+        r->page[r->pageCount].start = start;
+        r->page[r->pageCount].len = next - start;
+        r->page[r->pageCount].numLines = -1;
+        r->pageCount++;
+        start = next;
+    }
+
+    r->firstPage = r->pageCount;
+}
+// ====================================================================================================
+static int _focusLookup( struct addrFilter *f, const char *name, void *ctx )
+
+/* Find the functions with this name, by the name it's shown with or the one it was linked with */
+
+{
+    struct symbol *s = ( struct symbol * )ctx;
+    struct symbolFunctionStore *fn;
+    const char *shown;
+    int found = 0;
+
+    for ( unsigned int i = 0; ( fn = symbolFunctionIndex( s, i ) ); i++ )
+    {
+        shown = symbolFunctionName( fn, true );
+
+        if ( ( ( fn->funcname ) && ( !strcmp( fn->funcname, name ) ) ) ||
+                ( ( fn->manglename ) && ( !strcmp( fn->manglename, name ) ) ) ||
+                ( ( shown ) && ( !strcmp( shown, name ) ) ) )
+        {
+            addrFilterAddRange( f, fn->lowaddr, fn->highaddr );
+            found++;
+        }
+    }
+
+    return found;
+}
+// ====================================================================================================
+static bool _focusResolve( struct RunTime *r )
+
+/* The focus is looked up again with each set of symbols, since what's where changes with them */
+
+{
+    return ( !addrFilterActive( &r->options->focus ) ) || ( addrFilterResolve( &r->options->focus, _focusLookup, r->s ) );
+}
+// ====================================================================================================
+static void _dropFileViews( struct RunTime *r )
+
+/* Forget the files that have been dived into, they're for symbols that are going */
+
+{
+    for ( int i = 0; i < PM_FILE_VIEWS; i++ )
+    {
+        memFree( MEM_LINES, r->view[i].lines );
+        r->view[i].lines = NULL;
+        r->view[i].nlines = 0;
+    }
+}
+// ====================================================================================================
+static void *_loadTask( void *arg )
+
+/* Load the symbols, leaving them for _symbolsIn to pick up */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+
+    r->loaded = symbolAcquire( r->options->elffile, true, true );
+    atomic_store( &r->loadDone, true );
+    return NULL;
+}
+// ====================================================================================================
+static void _symbolsStart( struct RunTime *r )
+
+/* Start loading the symbols in the background */
+
+{
+    atomic_init( &r->loadDone, false );
+    r->loading = true;
+
+    if ( pthread_create( &r->loadThread, NULL, _loadTask, r ) )
+    {
+        genericsExit( -1, "Failed to create symbol load thread" EOL );
+    }
+}
+// ====================================================================================================
+static bool _symbolsIn( struct RunTime *r, bool wait )
+
+/* Pick up the symbols being loaded in the background if they're in (or wait for them). False if they couldn't be had. */
+
+{
+    if ( !r->loading )
+    {
+        return true;
+    }
+
+    while ( !atomic_load( &r->loadDone ) )
+    {
+        if ( !wait )
+        {
+            return true;
+        }
+
+        usleep( TICK_TIME_MS * 100 );
+    }
+
+    pthread_join( r->loadThread, NULL );
+    r->loading = false;
+
+    if ( !( r->s = r->loaded ) )
+    {
+        genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
+        return false;
+    }
+
+    genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+    return _focusResolve( r );
+}
+// ====================================================================================================
+static void *_coreDecode( void *arg )
+
+/* Decode all of a core's buffer, noting the time of each line it decodes to */
+
+{
+    struct RunTime *c = ( struct RunTime * )arg;
+    struct pmPage *p;
+    int32_t line = 0;
+
+    c->whenCount = 0;
+    c->stamping = true;
+
+    for ( int32_t pg = 0; pg < c->pageCount; pg++ )
+    {
+        p = _pageGet( c, pg );
+        p->firstLine = line;
+        line += p->numLines;
+    }
+
+    /* Pages dropped from the cache decode to the same lines again, so there's no need for their times then */
+    c->stamping = false;
+    c->firstPage = 0;
+    c->numLines = line;
+    return NULL;
+}
+// ====================================================================================================
+static bool _mergeCores( struct RunTime *r )
+
+/* Decode each core's buffer, each on a thread of its own, and put all of their lines together in */
+/* the order their trace arrived. Each core's lines are in order already, so it's a merge of them. */
+
+{
+    pthread_t t[MAX_TAGS];
+    int32_t at[MAX_TAGS] = { 0 };
+    struct RunTime *c;
+    int best;
+
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        c = r->core[k];
+        c->s = r->s;
+        c->startSynced = ( !c->rp ) && TRACEDecoderIsSynced( &c->i );
+        _pageIndex( c );
+
+        if ( pthread_create( &t[k], NULL, _coreDecode, c ) )
+        {
+            /* ...it'll have to be done here then */
+            t[k] = pthread_self();
+            _coreDecode( c );
+        }
+    }
+
+    r->numLines = 0;
+
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        if ( !pthread_equal( t[k], pthread_self() ) )
+        {
+            pthread_join( t[k], NULL );
+        }
+
+        if ( r->core[k]->whenCount != r->core[k]->numLines )
+        {
+            genericsReport( V_ERROR, "Couldn't note the time of every line for tag %d" EOL, r->core[k]->coreTag );
+            return false;
+        }
+
+        r->numLines += r->core[k]->numLines;
+    }
+
+    r->merged = ( struct pmMerged * )memAlloc( MEM_LINES, ( r->numLines ? r->numLines : 1 ) * sizeof( struct pmMerged ) );
+    MEMCHECK( r->merged, false );
+
+    /* Lines that arrived together stay in the order of their tags */
+    for ( int32_t n = 0; n < r->numLines; n++ )
+    {
+        best = -1;
+
+        for ( int k = 0; k < r->ncores; k++ )
+        {
+            if ( ( at[k] < r->core[k]->numLines ) &&
+                    ( ( best < 0 ) || ( r->core[k]->when[at[k]] < r->core[best]->when[at[best]] ) ) )
+            {
+                best = k;
+            }
+        }
+
+        r->merged[n].core = best;
+        r->merged[n].line = at[best]++;
+    }
+
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        memFree( MEM_LINES, r->core[k]->when );
+        r->core[k]->when = NULL;
+        r->core[k]->whenCount = r->core[k]->whenAlloc = 0;
+    }
+
+    SIOsetOutputFetch( r->sio, r->numLines, r->numLines - 1, _fetchLine, r );
+    return true;
+}
+// ====================================================================================================
+static bool _dumpBuffer( struct RunTime *r )
+
+/* Set up the received data buffer for display. Only the end of it is decoded now, the rest is when it's wanted. */
+
+{
+    _flushBuffer( r );
+
+    /* Nothing's decoded until now, so this is as long as the symbols loading at startup can be left */
+    if ( !_symbolsIn( r, true ) )
+    {
+        return false;
+    }
+
+    if ( !symbolSetValid( r->s ) )
+    {
+        _dropFileViews( r );
+        symbolDelete( r->s );
+
+        if ( !( r->s = symbolAcquire( r->options->elffile, true, true ) ) )
+        {
+            genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
+            return false;
+        }
+
+        if ( !_focusResolve( r ) )
+        {
+            return false;
+        }
+
+        genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+    }
+
+    if ( r->ncores )
+    {
+        return _mergeCores( r );
+    }
+
+    /* If we started wrapping (i.e. the start of what was received got overwritten) then any guesses about sync status are invalid */
+    r->startSynced = ( ( !r->rp ) || ( r->singleShot ) ) && TRACEDecoderIsSynced( &r->i );
+
+    _pageIndex( r );
+    _extendBack( r, PM_LOOKBACK_LINES );
+
+    /* Submit this constructed buffer for display */
+    SIOsetOutputFetch( r->sio, r->numLines, r->numLines - 1, _fetchLine, r );
+
+    return true;
+}
+// ====================================================================================================
+static void _liveCopy( struct RunTime *r, size_t from, uint8_t *d, size_t len )
+
+/* Copy len bytes of received data from position from, which may wrap around the end of the buffer */
+
+{
+    size_t ofs = from & ( r->pmSize - 1 );
+    size_t seg = ( ( r->pmMirrored ) || ( ofs + len <= r->pmSize ) ) ? len : r->pmSize - ofs;
+
+    memcpy( d, &r->pmBuffer[ofs], seg );
+    memcpy( d + seg, r->pmBuffer, len - seg );
+}
+// ====================================================================================================
+static void _liveQueue( struct RunTime *r, struct pmPage *p )
+
+/* Hand a decoded page over to be shown. If the display has let too many pile up the oldest one goes. */
+
+{
+    pthread_mutex_lock( &r->liveLock );
+
+    if ( r->livePendingCount == PM_LIVE_PAGES )
+    {
+        memFree( MEM_LINES, r->livePending[0].lines );
+        memFree( MEM_LINES, r->livePending[0].text );
+        memFree( MEM_INDEX, r->livePending[0].occ );
+        memmove( &r->livePending[0], &r->livePending[1], ( PM_LIVE_PAGES - 1 ) * sizeof( struct pmPage ) );
+        r->livePendingCount--;
+    }
+
+    r->livePending[r->livePendingCount++] = *p;
+    pthread_mutex_unlock( &r->liveLock );
+
+    memset( p, 0, sizeof( struct pmPage ) );
+}
+// ====================================================================================================
+static void *_liveWorker( void *arg )
+
+/* Decode trace as it arrives, a page at a time. The data is copied out of the buffer before it's */
+/* decoded, and only used if it wasn't overwritten while that was happening.                      */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    static uint8_t chunk[PM_PAGE_BYTES];
+    struct pmPage p = { 0 };
+    size_t dp = 0, wp, n;
+
+    while ( !r->ending )
+    {
+        wp = atomic_load( &r->liveWp );
+
+        if ( wp < dp )
+        {
+            /* The buffer was emptied, so start again with what goes into it now */
+            dp = 0;
+        }
+
+        if ( wp == dp )
+        {
+            usleep( PM_LIVE_IDLE_US );
+            continue;
+        }
+
+        /* Anything that's at risk of being written over is lost, so pick up from the next sync point */
+        if ( wp + TRANSFER_SIZE - dp > r->pmSize )
+        {
+            dp = wp + TRANSFER_SIZE - r->pmSize;
+            atomic_fetch_add( &r->liveLost, 1 );
+            r->i.engine->destroy( r->i.engine );
+            TRACEDecoderInit( &r->i, r->options->traceProt, !( r->options->noAltAddr ), _traceReport );
+            _resetOp( r );
+            continue;
+        }
+
+        n = ( wp - dp < PM_PAGE_BYTES ) ? wp - dp : PM_PAGE_BYTES;
+        _liveCopy( r, dp, chunk, n );
+
+        if ( atomic_load( &r->liveWp ) + TRANSFER_SIZE - dp > r->pmSize )
+        {
+            /* ...it was overwritten while it was being copied, so that's caught next time around */
+            continue;
+        }
+
+        dp += n;
+        atomic_store( &r->liveDp, dp );
+
+        r->decoding = &p;
+        _reportTo = r;
+        TRACEDecoderPump( &r->i, chunk, n, _traceCB, r );
+        _reportTo = NULL;
+        r->decoding = NULL;
+
+        if ( p.numLines )
+        {
+            _occFinish( &p );
+            _liveQueue( r, &p );
+        }
+    }
+
+    memFree( MEM_LINES, p.lines );
+    memFree( MEM_LINES, p.text );
+    memFree( MEM_INDEX, p.occ );
+    return NULL;
+}
+// ====================================================================================================
+static void _liveShow( struct RunTime *r )
+
+/* Move whatever has been decoded since last time into the output buffer, and show the end of it */
+
+{
+    int32_t dropped;
+
+    pthread_mutex_lock( &r->liveLock );
+
+    if ( !r->livePendingCount )
+    {
+        pthread_mutex_unlock( &r->liveLock );
+        return;
+    }
+
+    for ( int i = 0; i < r->livePendingCount; i++ )
+    {
+        /* The output buffer only holds so many pages, so the oldest make way */
+        if ( r->pageCount == PM_LIVE_PAGES )
+        {
+            dropped = r->page[0].numLines;
+            _pageFree( r, &r->page[0] );
+            _occFree( &r->page[0] );
+            memmove( &r->page[0], &r->page[1], ( PM_LIVE_PAGES - 1 ) * sizeof( struct pmPage ) );
+            r->pageCount--;
+            r->numLines -= dropped;
+
+            for ( int32_t j = 0; j < r->pageCount; j++ )
+            {
+                r->page[j].firstLine -= dropped;
+            }
+        }
+
+        r->page[r->pageCount] = r->livePending[i];
+        r->page[r->pageCount].firstLine = r->numLines;
+        r->page[r->pageCount].cached = true;
+        r->cachedPages++;
+        r->numLines += r->page[r->pageCount++].numLines;
+    }
+
+    r->livePendingCount = 0;
+    pthread_mutex_unlock( &r->liveLock );
+
+    SIOsetOutputFetch( r->sio, r->numLines, r->numLines - 1, _fetchLine, r );
+    SIOrequestRefresh( r->sio );
+
+    if ( atomic_load( &r->liveLost ) != r->liveLostShown )
+    {
+        r->liveLostShown = atomic_load( &r->liveLost );
+        SIOalert( r->sio, "Decode fell behind, trace lost" );
+    }
+}
+// ====================================================================================================
+static bool _liveStart( struct RunTime *r )
+
+/* Start decoding on a thread of its own */
+
+{
+    r->page = ( struct pmPage * )memCalloc( MEM_LINES, PM_LIVE_PAGES, sizeof( struct pmPage ) );
+    MEMCHECK( r->page, false );
+
+    r->liveRunning = true;
+
+    if ( pthread_create( &r->liveThread, NULL, _liveWorker, r ) )
+    {
+        genericsReport( V_ERROR, "Couldn't start live decode" EOL );
+        r->liveRunning = false;
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _liveStop( struct RunTime *r )
+
+{
+    if ( r->liveRunning )
+    {
+        pthread_join( r->liveThread, NULL );
+        r->liveRunning = false;
+    }
+}
+// ====================================================================================================
+static struct Stream *_openStream( struct RunTime *r )
+
+/* Connect to the live source */
+
+{
+    struct Stream *stream;
 
-            default:
-                _traceReport( V_DEBUG, "Unrecognised trace protocol in exception handler" );
-                break;
+    if ( r->options->shmInput )
+    {
+        return streamCreateShm( r->options->shmInput );
+    }
+
+    int port = r->options->port + ( ( PROT_OFLOW != r->options->commProt ) ? 1 : 0 );
+    stream = ( r->options->compress ) ? streamCreateCompressedSocket( r->options->server, port ) : streamCreateSocket( r->options->server, port );
+
+    if ( ( stream ) && ( PROT_OFLOW == r->options->commProt ) )
+    {
+        uint8_t tags[MAX_TAGS + 1];
+
+        memcpy( tags, r->options->tags, r->options->ntags );
+        tags[r->options->ntags] = ITM_TAG;
+        nwSubscribe( stream, r->options->ntags + ( ( r->options->trigType == TRIG_ITM ) ? 1 : 0 ), tags );
+    }
+
+    return stream;
+}
+// ====================================================================================================
+static void *_captureTask( void *arg )
+
+/* Take in data and add it to the post-mortem buffer. This is all that's done on this thread, and the */
+/* UI only ever waits for it while it's changing hold, so a slow redraw doesn't cost any trace.       */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    struct Stream *stream = r->fileStream;
+    enum ReceiveResult result;
+    struct timeval tv;
+
+    while ( !r->ending )
+    {
+        if ( ( !stream ) && ( !r->options->file ) )
+        {
+            /* Keep trying to open a network connection */
+            if ( !( stream = _openStream( r ) ) )
+            {
+                r->noConnection = true;
+                usleep( RECONNECT_TIME_US );
+                continue;
+            }
+
+            r->noConnection = false;
+        }
+
+        if ( !stream )
+        {
+            /* Read from file is complete, nothing more will arrive */
+            usleep( TICK_TIME_MS * 1000 );
+            continue;
+        }
+
+        if ( ( r->liveRunning ) && ( r->options->file ) && ( r->wp - atomic_load( &r->liveDp ) > r->pmSize / 2 ) )
+        {
+            /* A file can be read far faster than it can be decoded, so let the decode catch up rather than lose any */
+            usleep( PM_LIVE_IDLE_US );
+            continue;
+        }
+
+        /* We always read the data, even if we're held, to keep the socket alive */
+        tv.tv_sec = 0;
+        tv.tv_usec = 10000;
+        result = stream->receive( stream, r->rawBlock.buffer, TRANSFER_SIZE, &tv, ( size_t * )&r->rawBlock.fillLevel );
+
+        if ( ( result == RECEIVE_RESULT_ERROR ) ||
+                ( ( r->options->file ) && ( ( result == RECEIVE_RESULT_EOF ) || ( r->rawBlock.fillLevel <= 0 ) ) ) )
+        {
+            /* Read from file is complete, or the connection went, so remove it (to be re-established if it's live) */
+            stream->close( stream );
+            free( stream );
+            stream = NULL;
+
+            if ( r->options->file )
+            {
+                r->ending |= ( ( result == RECEIVE_RESULT_ERROR ) && ( r->options->fileTerminate ) );
+                r->fileDone = true;
+            }
+
+            continue;
+        }
+
+        pthread_mutex_lock( &r->rxLock );
+
+        if ( !r->held )
+        {
+            /* Pump all of the data through the protocol handler */
+            if ( PROT_OFLOW == r->options->commProt )
+            {
+                OFLOWPumpInPlace( &r->c, r->rawBlock.buffer, r->rawBlock.fillLevel, _OFLOWpacketRxed, r );
+            }
+            else
+            {
+                _processBlock( r );
+            }
+        }
+
+        pthread_mutex_unlock( &r->rxLock );
+    }
+
+    if ( stream )
+    {
+        stream->close( stream );
+        free( stream );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _captureStop( struct RunTime *r )
+
+/* Wait for the capture thread to notice we're ending */
+
+{
+    if ( r->captureRunning )
+    {
+        r->captureRunning = false;
+        pthread_join( r->captureThread, NULL );
+    }
+}
+// ====================================================================================================
+static bool _hasFileAndLine( struct RunTime *r, uint32_t i )
+
+{
+    struct sioline *l = _lineAt( r, i );
+
+    return ( ( l->lt == LT_SOURCE ) || ( l->lt == LT_ASSEMBLY ) ) && ( l->dat != NULL );
+}
+// ====================================================================================================
+static struct symbolLineStore *_fileAndLine( struct RunTime *r, uint32_t i )
+
+{
+    /* Search backwards from current position in buffer until we find a line a line record attached */
+    /* (b) a filename which contains this line. */
+
+    while ( ( i ) && ( !_hasFileAndLine( r, i ) ) )
+    {
+        i--;
+    }
+
+    if ( !i || !_lineAt( r, i )->dat )
+    {
+        i = SIOgetCurrentLineno( r->sio );
+
+        while ( ( i ) && ( i < r->numLines ) && ( !_hasFileAndLine( r, i ) ) )
+        {
+            i++;
+        }
+    }
+
+    return ( struct symbolLineStore * )( ( i < r->numLines ) ? _lineAt( r, i )->dat : NULL );
+}
+// ====================================================================================================
+static struct pmFileView *_fileView( struct RunTime *r, unsigned int filenameIndex )
+
+/* Get the lines of a file to dive into, from last time if it's been dived into lately. Otherwise they */
+/* are made now, with a copy of the text, since the symbols only keep so many files' source loaded.   */
+
+{
+    struct pmFileView *v = &r->view[0];
+    unsigned int nlines;
+    size_t len;
+    const char *c;
+    char *t;
+
+    for ( int i = 0; i < PM_FILE_VIEWS; i++ )
+    {
+        if ( ( r->view[i].lines ) && ( r->view[i].filename == filenameIndex ) )
+        {
+            r->view[i].lastUsed = ++r->viewClock;
+            return &r->view[i];
+        }
+
+        /* An empty slot, or the one used longest ago, is where a new one goes */
+        if ( ( v->lines ) && ( ( !r->view[i].lines ) || ( r->view[i].lastUsed < v->lastUsed ) ) )
+        {
+            v = &r->view[i];
+        }
+    }
+
+    if ( ( !symbolSourceSize( r->s, filenameIndex, &nlines, &len ) ) || ( !nlines ) )
+    {
+        return NULL;
+    }
+
+    /* Each line is at most its share of the text, plus the 0 at the end of it */
+    memFree( MEM_LINES, v->lines );
+    v->lines = ( struct sioline * )memAlloc( MEM_LINES, nlines * sizeof( struct sioline ) + len + nlines );
+    MEMCHECK( v->lines, NULL );
+    t = ( char * )&v->lines[nlines];
+
+    for ( v->nlines = 0; ( v->nlines < nlines ) && ( c = symbolSource( r->s, filenameIndex, v->nlines ) ); v->nlines++ )
+    {
+        size_t l = strlen( c ) + 1;
+
+        memcpy( t, c, l );
+        v->lines[v->nlines].buffer = t;
+        v->lines[v->nlines].dat    = NULL;
+        v->lines[v->nlines].lt     = LT_MU_SOURCE;
+        v->lines[v->nlines].isRef  = true;
+        v->lines[v->nlines].line   = v->nlines + 1;
+        t += l;
+    }
+
+    v->filename = filenameIndex;
+    v->lastUsed = ++r->viewClock;
+    return v;
+}
+// ====================================================================================================
+static void _mapFileBuffer( struct RunTime *r, int lineno, int filenameIndex )
+
+/* Put the lines of a file up for display, they belong to its view so there's nothing to free after */
+
+{
+    struct pmFileView *v = _fileView( r, filenameIndex );
+
+    r->fileopText = ( v ) ? v->lines : NULL;
+    r->filenumLines = ( v ) ? v->nlines : 0;
+
+    SIOsetOutputBuffer( r->sio, r->filenumLines, lineno - 1, &r->fileopText, true );
+    r->diving = true;
+}
+// ====================================================================================================
+static void _doFileDive( struct RunTime *r )
+
+/* Do actions required to get file contents to dive into */
+
+{
+    static struct symbolLineStore *l;
+
+    if ( ( r->diving ) || ( !r->numLines ) || ( !r->held ) )
+    {
+        return;
+    }
+
+    if ( !( l = _fileAndLine( r, SIOgetCurrentLineno( r->sio ) ) ) )
+    {
+        SIOalert( r->sio, "Couldn't get filename/line" );
+        return;
+    }
+
+    /* Cache the line in this file in case we need it later */
+    r->lineNum = SIOgetCurrentLineno( r->sio );
+
+    _mapFileBuffer( r,  l->startline, l->filename );
+}
+// ====================================================================================================
+static void _doFilesurface( struct RunTime *r )
+
+/* Come back out of a file we're diving into */
+
+{
+    if ( !r->diving )
+    {
+        return;
+    }
+
+    /* The lines are kept in their view for next time */
+    r->fileopText = NULL;
+    r->filenumLines = 0;
+    r->diving = false;
+
+    SIOsetOutputFetch( r->sio, r->numLines, r->numLines - 1, _fetchLine, r );
+    SIOsetCurrentLineno( r->sio, r->lineNum );
+}
+// ====================================================================================================
+static bool _parseGoto( const char *t, enum pmOccKind *kind, uint32_t *key )
+
+/* Read where to go to, a (hex) address or #exception */
+
+{
+    bool isException = ( ( t ) && ( *t == '#' ) );
+    unsigned long v;
+    char *e;
+
+    if ( ( !t ) || ( !*t ) )
+    {
+        return false;
+    }
+
+    v = strtoul( ( isException ) ? t + 1 : t, &e, ( isException ) ? 0 : 16 );
+
+    if ( ( e == t + isException ) || ( *e ) || ( v > UINT32_MAX ) )
+    {
+        return false;
+    }
+
+    *kind = ( isException ) ? PM_OCC_EXCEPTION : PM_OCC_ADDRESS;
+    *key  = v;
+    return true;
+}
+// ====================================================================================================
+static void _doOccurrence( struct RunTime *r, enum SIOEvent ev )
+
+/* Move to the next or previous time something turns up in the output buffer, or to where we were asked to go */
+
+{
+    int32_t from = SIOgetCurrentLineno( r->sio );
+    int32_t was = r->numLines;
+    enum pmOccKind kind;
+    uint32_t key;
+    int32_t l = -1;
+
+    if ( ( r->diving ) || ( !r->numLines ) )
+    {
+        SIObeep();
+        return;
+    }
+
+    if ( r->merged )
+    {
+        /* The indexes are each core's own, and don't say where anything is in the lines merged from them */
+        SIOalert( r->sio, "Searching needs a single tag" );
+        return;
+    }
+
+    if ( ev == SIO_EV_GOTO )
+    {
+        /* The next time it's there or, if it isn't again, the last time it was */
+        if ( _parseGoto( SIOgetGotoText( r->sio ), &kind, &key ) && ( ( l = _occFind( r, kind, key, from, false ) ) < 0 ) )
+        {
+            l = _occFind( r, kind, key, from, true );
+        }
+    }
+    else if ( _occOfLine( r, from, ( ev == SIO_EV_FUNC_PREV ) || ( ev == SIO_EV_FUNC_NEXT ), &kind, &key ) )
+    {
+        l = _occFind( r, kind, key, from, ( ev == SIO_EV_OCC_PREV ) || ( ev == SIO_EV_FUNC_PREV ) );
+    }
+
+    /* Anything added to the output buffer to get there went in at the front */
+    if ( r->numLines != was )
+    {
+        SIOprependLines( r->sio, r->numLines - was );
+    }
+
+    if ( l < 0 )
+    {
+        SIObeep();
+        return;
+    }
+
+    SIOsetCurrentLineno( r->sio, l );
+    SIOrequestRefresh( r->sio );
+}
+// ====================================================================================================
+static void _chunkAdd( struct pmChunk *c, const char *d, size_t len )
+
+/* Add text to a chunk of the report */
+
+{
+    if ( c->len + len > c->alloc )
+    {
+        while ( c->len + len > c->alloc )
+        {
+            c->alloc = ( c->alloc ) ? c->alloc * 2 : 65536;
         }
+
+        c->buf = ( char * )realloc( c->buf, c->alloc );
+        MEMCHECKV( c->buf );
+    }
+
+    memcpy( &c->buf[c->len], d, len );
+    c->len += len;
+}
+// ====================================================================================================
+static void _formatLine( const struct sioline *l, bool includeDebug, struct pmChunk *c )
+
+/* Add a line of the report to chunk c */
+
+{
+    char num[16];
+    char *p = l->buffer;
+
+    /* Skip blank and debug lines unless specifically told to include them */
+    if ( !p || ( ( l->lt == LT_DEBUG ) && ( !includeDebug ) ) )
+    {
+        return;
     }
 
+    if ( ( l->lt == LT_SOURCE ) || ( l->lt == LT_MU_SOURCE ) )
+    {
+        /* Need a line number on this */
+        _chunkAdd( c, num, snprintf( num, sizeof( num ), "%5d ", l->line ) );
+    }
+
+    if ( l->lt == LT_NASSEMBLY )
+    {
+        /* This is an _unexecuted_ assembly line, need to mark it */
+        _chunkAdd( c, "(**", 3 );
+    }
+
+    /* Search forward for a NL or 0, both are EOL for this purpose */
+    while ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) )
+    {
+        p++;
+    }
+
+    _chunkAdd( c, l->buffer, p - l->buffer );
+
+    if ( l->lt == LT_NASSEMBLY )
+    {
+        /* This is an _unexecuted_ assembly line, need to mark it */
+        _chunkAdd( c, " **)", 4 );
+    }
+
+    _chunkAdd( c, EOL, strlen( EOL ) );
+}
+// ====================================================================================================
+static void _formatPage( struct RunTime *r, struct pmPage *page, bool includeDebug, csh h, struct pmChunk *c )
+
+/* Write the report for a page into chunk c */
+
+{
+    char t[SCRATCH_STRING_LEN];
+    struct sioline l;
+
+    c->len = 0;
+
+    for ( int32_t w = 0; w < page->numLines; w++ )
+    {
+        _renderInto( r, page, w, &l, t, h );
+        _formatLine( &l, includeDebug, c );
+    }
+}
+// ====================================================================================================
+struct pmSaveJob
+{
+    struct RunTime *r;
+    bool includeDebug;                  /* Set if debug lines are to be written */
+    int32_t first;                      /* First page of the batch being rendered */
+    int32_t count;                      /* ...how many pages there are in it */
+    atomic_int next;                    /* ...and the next of them for a worker to take */
+    struct pmChunk chunk[PM_CACHE_PAGES];
+};
+
+struct pmSaveWorker
+{
+    pthread_t thread;
+    csh h;                              /* Disassembler of its own */
+    struct pmSaveJob *job;
+};
+
+static void *_saveWorker( void *arg )
+
+/* Render pages of the batch until there are none left */
+
+{
+    struct pmSaveWorker *w = ( struct pmSaveWorker * )arg;
+    struct pmSaveJob *j = w->job;
+    int32_t n;
 
-    /* 3: Collect flow affecting changes introduced by this event */
-    /* ========================================================== */
-    if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+    while ( ( n = atomic_fetch_add( &j->next, 1 ) ) < j->count )
     {
-        /* Make debug report if calculated and reported addresses differ. This is most useful for testing when exhaustive  */
-        /* address reporting is switched on. It will give 'false positives' for uncalculable instructions (e.g. bx lr) but */
-        /* it's a decent safety net to be sure the jump decoder is working correctly.                                      */
+        _formatPage( j->r, &j->r->page[j->first + n], j->includeDebug, w->h, &j->chunk[n] );
+    }
 
-        if ( r->options->traceProt != TRACE_PROT_MTB )
-        {
-            _traceReport( V_DEBUG, "%sCommanded CPU Address change (Was:0x%08x Commanded:0x%08x)" EOL,
-                          ( r->op.workingAddr == cpu->addr ) ? "" : "***INCONSISTENT*** ", r->op.workingAddr, cpu->addr );
-        }
+    return NULL;
+}
+// ====================================================================================================
+static bool _writeChunks( int fd, struct pmChunk *c, int n )
 
-        /* Return Stack: If we had a stack deletion pending because of a candidate match, it wasn't, so abort */
-        if ( r->stackDelPending )
-        {
-            _traceReport( V_DEBUG, "Stack delete aborted" );
-        }
+/* Write out n chunks of the report in order */
 
-        r->stackDelPending = false;
-        /* Whatever the state was, this is an explicit setting of an address, so we need to respect it */
-        r->op.workingAddr = cpu->addr;
-    }
-    else
+{
+#if defined( WIN32 )
+
+    for ( int i = 0; i < n; i++ )
     {
-        /* Return Stack: If we had a stack deletion pending because of a candidate match, the match was good, so commit */
-        if ( ( r->stackDelPending == true ) && ( r->stackDepth ) )
+        for ( size_t done = 0; done < c[i].len; )
         {
-            r->stackDepth--;
-            _traceReport( V_DEBUG, "Stack delete comitted" );
-        }
+            int w = write( fd, &c[i].buf[done], c[i].len - done );
 
-        r->stackDelPending = false;
-    }
+            if ( w <= 0 )
+            {
+                return false;
+            }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_LINEAR ) )
-    {
-        /* MTB-Specific mechanism: Execute instructions from the marked starting location to the indicated finishing one */
-        /* Disposition is all 1's because every instruction is executed.                                                 */
-        r->op.workingAddr = cpu->addr;
-        targetAddr        = cpu->toAddr;
-        linearRun         = true;
-        disposition       = 0xffffffff;
-        _traceReport( V_DEBUG, "Linear run 0x%08x to 0x%08x" EOL, cpu->addr, cpu->toAddr );
+            done += w;
+        }
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ENATOMS ) )
+#else
+    struct iovec iov[PM_CACHE_PAGES];
+    struct iovec *v = iov;
+    int cnt = 0;
+    ssize_t w;
+
+    for ( int i = 0; i < n; i++ )
     {
-        /* Atoms represent instruction steps...some of which will have been executed, some stepped over. The number of steps is the   */
-        /* total of the eatoms (executed) and natoms (not executed) and the disposition bitfield shows if each individual instruction */
-        /* was executed or not. For ETM3 each 'run' of instructions is a single instruction with the disposition bit telling you if   */
-        /* it was executed or not. For ETM4 each 'run' of instructions is from the current address to the next possible change of     */
-        /* program flow (and which point the disposition bit tells you if that jump was taken or not).                                */
-        incAddr = cpu->eatoms + cpu->natoms;
-        disposition = cpu->disposition;
+        if ( c[i].len )
+        {
+            iov[cnt].iov_base = c[i].buf;
+            iov[cnt++].iov_len = c[i].len;
+        }
     }
 
-    /* 4: Execute the flow instructions */
-    /* ================================ */
-    while ( ( incAddr && !linearRun ) || ( ( r->op.workingAddr <= targetAddr ) && linearRun ) )
+    while ( cnt )
     {
-        /* Firstly, lets get the source code line...*/
-        struct symbolLineStore *l = symbolLineAt( r->s, r->op.workingAddr );
-
-        if ( l )
+        if ( ( w = writev( fd, v, cnt ) ) < 0 )
         {
-            /* If we have changed file or function put a header line in */
-            if ( l->function )
-            {
-                /* There is a valid function tag recognised here. If it's a change highlight it in the output. */
-                if ( ( l->function->filename != r->op.currentFileindex ) || ( l->function != r->op.currentFunctionptr ) )
-                {
-                    _appendToOPBuffer( r, l, r->op.currentLine, LT_FILE, "%s::%s", symbolGetFilename( r->s, l->function->filename ), l->function->funcname );
-                    r->op.currentFileindex     = l->function->filename;
-                    r->op.currentFunctionptr   = l->function;
-                    r->op.currentLine = NO_LINE;
-                }
-            }
-            else
+            if ( errno == EINTR )
             {
-                /* We didn't find a valid function, but we might have some information to work with.... */
-                if ( ( NO_FILE != r->op.currentFileindex ) || ( NULL != r->op.currentFunctionptr ) )
-                {
-                    _appendToOPBuffer( r, l, r->op.currentLine, LT_FILE, "Unknown function" );
-                    r->op.currentFileindex     = NO_FILE;
-                    r->op.currentFunctionptr   = NULL;
-                    r->op.currentLine = NO_LINE;
-                }
+                continue;
             }
+
+            return false;
         }
 
-        /* If we have changed line then output the new one */
-        if ( l && ( ( l->startline != r->op.currentLine ) ) )
+        /* Step over whatever got written, which might have stopped part way through a chunk */
+        while ( ( cnt ) && ( ( size_t )w >= v->iov_len ) )
         {
-            const char *v = symbolSource( r->s, l->filename, l->startline - 1 );
-            r->op.currentLine = l->startline;
-            _appendRefToOPBuffer( r, l, r->op.currentLine, LT_SOURCE, v );
+            w -= v->iov_len;
+            v++;
+            cnt--;
         }
 
-        /* Now output the matching assembly, and location updates */
-        char *a = symbolDisassembleLine( r->s, &ic, r->op.workingAddr, &newaddr );
-
-        if ( a )
+        if ( cnt )
         {
-            /* Calculate if this instruction was executed. This is slightly hairy depending on which protocol we're using;         */
-            /*   * ETM3.5: Instructions are executed based on disposition bit (LSB in disposition word)                            */
-            /*   * ETM4  : ETM4 everything up to a branch is executed...decision about that branch is based on disposition bit     */
-            /*   * MTB   : Everything except jumps are executed, jumps are executed only if they are the last instruction in a run */
-            bool insExecuted = (
-                                           /* ETM3.5 case - dependent on disposition */
-                                           ( ( !linearRun )  && ( r->i.protocol == TRACE_PROT_ETM35 ) && ( disposition & 1 ) ) ||
+            v->iov_base = ( char * )v->iov_base + w;
+            v->iov_len -= w;
+        }
+    }
 
-                                           /* ETM4 case - either not a branch or disposition is 1 */
-                                           ( ( !linearRun ) && ( r->i.protocol == TRACE_PROT_ETM4 ) && ( ( !( ic & LE_IC_JUMP ) ) || ( disposition & 1 ) ) ) ||
+#endif
+    return true;
+}
+// ====================================================================================================
+static void _sessionPut( struct pmSessionSave *ss, const void *d, size_t len )
 
-                                           /* MTB case - a linear run to last address */
-                                           ( ( linearRun ) && ( r->i.protocol == TRACE_PROT_MTB ) &&
-                                             ( ( ( r->op.workingAddr != targetAddr ) && ( ! ( ic & LE_IC_JUMP ) ) )  ||
-                                               ( r->op.workingAddr == targetAddr )
-                                             ) ) );
-            _appendToOPBuffer( r, l, r->op.currentLine, insExecuted ? LT_ASSEMBLY : LT_NASSEMBLY, a );
+{
+    if ( ( ss->ok ) && ( len ) )
+    {
+        ss->ok = ( fwrite( d, 1, len, ss->f ) == len );
+        ss->at += len;
+    }
+}
+// ====================================================================================================
+static void _sessionAlign( struct pmSessionSave *ss )
 
+/* Pad the session out to the start of the next record */
 
-            /* Move addressing along */
-            if ( ( r->i.protocol != TRACE_PROT_ETM4 ) || ( ic & LE_IC_JUMP ) )
-            {
-                if ( r->i.protocol == TRACE_PROT_ETM4 )
-                {
-                    _traceReport( V_DEBUG, "Consumed, %sexecuted (%d left)", insExecuted ? "" : "not ", incAddr - 1 );
-                }
+{
+    static const uint8_t pad[PM_SESSION_ALIGN] = { 0 };
 
-                disposition >>= 1;
-                incAddr--;
-            }
+    _sessionPut( ss, pad, ( PM_SESSION_ALIGN - ss->at % PM_SESSION_ALIGN ) % PM_SESSION_ALIGN );
+}
+// ====================================================================================================
+static bool _sessionBegin( struct RunTime *r, struct pmSessionSave *ss, const char *fn )
 
-            if ( ic & LE_IC_CALL )
-            {
-                if ( insExecuted )
-                {
-                    /* Push the instruction after this if it's a subroutine or ISR */
-                    _traceReport( V_DEBUG, "Call to %08x", newaddr );
-                    _addRetToStack( r, r->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 ) );
-                }
+/* Start a session file off with the trace. The pages are added as they're decoded for the report */
 
-                r->op.workingAddr = insExecuted ? newaddr : r->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 );
-            }
-            else if ( ic & LE_IC_JUMP )
-            {
-                _traceReport( V_DEBUG, "%sTAKEN JUMP", insExecuted ? "" : "NOT " );
+{
+    struct stat st;
+    uint8_t *seg[2];
+    size_t seglen[2];
 
-                if ( insExecuted )
-                {
-                    /* Update working address according to if jump was taken */
-                    if ( ic & LE_IC_IMMEDIATE )
-                    {
-                        _traceReport( V_DEBUG, "Immediate address %8x", newaddr );
-                        /* We have a good address, so update with it */
-                        r->op.workingAddr = newaddr;
-                    }
-                    else
-                    {
-                        /* We didn't get the address, so need to park the call stack address if we've got one. Either we won't      */
-                        /* get an address (in which case this one was correct), or we wont (in which case, don't unstack this one). */
-                        if ( r->stackDepth )
-                        {
-                            r->op.workingAddr = r->callStack[r->stackDepth - 1];
-                            _traceReport( V_DEBUG, "Return with stacked candidate to %08x", r->op.workingAddr );
-                        }
-                        else
-                        {
-                            _traceReport( V_DEBUG, "Return with no stacked candidate" );
-                        }
+    memset( ss, 0, sizeof( struct pmSessionSave ) );
+    ss->page = ( struct pmSessionPage * )memCalloc( MEM_LINES, r->pageCount + 1, sizeof( struct pmSessionPage ) );
+    MEMCHECK( ss->page, false );
 
-                        r->stackDelPending = true;
-                    }
-                }
-                else
-                {
-                    /* The branch wasn't taken, so just move along */
-                    r->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
-                }
-            }
-            else
-            {
-                /* Just a regular instruction, so just move along */
-                r->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
-            }
-        }
-        else
-        {
-            _appendToOPBuffer( r, l, r->op.currentLine, LT_ASSEMBLY, "%8x:\tASSEMBLY NOT FOUND" EOL, r->op.workingAddr );
-            r->op.workingAddr += 2;
-            disposition >>= 1;
-            incAddr--;
-        }
+    if ( !( ss->f = fopen( fn, "wb" ) ) )
+    {
+        memFree( MEM_LINES, ss->page );
+        return false;
+    }
+
+    /* Until the header is filled in at the end this isn't a session, so nothing half written can be taken for one */
+    ss->ok = true;
+    _sessionPut( ss, &ss->h, sizeof( ss->h ) );
+    _sessionAlign( ss );
+
+    memcpy( ss->h.magic, PM_SESSION_MAGIC, sizeof( ss->h.magic ) );
+    ss->h.version     = PM_SESSION_VERSION;
+    ss->h.lineSize    = sizeof( struct pmLine );
+    ss->h.occSize     = sizeof( struct pmOcc );
+    ss->h.traceProt   = r->options->traceProt;
+    ss->h.startSynced = r->startSynced;
+    ss->h.pageCount   = r->pageCount;
+
+    if ( !stat( r->options->elffile, &st ) )
+    {
+        ss->h.elfSize = st.st_size;
+        ss->h.elfTime = st.st_mtime;
+    }
+
+    ss->h.traceOfs = ss->at;
+
+    for ( int i = 0, nsegs = _rxContents( r, seg, seglen ); i < nsegs; i++ )
+    {
+        _sessionPut( ss, seg[i], seglen[i] );
     }
+
+    ss->h.traceLen = ss->at - ss->h.traceOfs;
+    _sessionAlign( ss );
+    return ss->ok;
 }
+// ====================================================================================================
+static void _sessionAddPage( struct RunTime *r, struct pmSessionSave *ss, int32_t n )
+
+/* Add the lines of page n, which is in the cache */
 
+{
+    struct pmPage *p = &r->page[n];
+    struct pmSessionPage *sp = &ss->page[n];
+
+    sp->start    = p->start;
+    sp->len      = p->len;
+    sp->numLines = p->numLines;
+    sp->linesOfs = ss->at;
+    _sessionPut( ss, p->lines, p->numLines * sizeof( struct pmLine ) );
+    _sessionAlign( ss );
+    sp->textOfs  = ss->at;
+    sp->textLen  = p->textLen;
+    _sessionPut( ss, p->text, p->textLen );
+    _sessionAlign( ss );
+    sp->occOfs   = ss->at;
+    sp->occCount = p->occCount;
+    _sessionPut( ss, p->occ, p->occCount * sizeof( struct pmOcc ) );
+    _sessionAlign( ss );
+}
 // ====================================================================================================
-static bool _dumpBuffer( struct RunTime *r )
+static bool _sessionEnd( struct pmSessionSave *ss, bool complete )
 
-/* Dump received data buffer into text buffer */
+/* Write the table of pages, and then the header that says where everything is. Without the header */
+/* (if it's not complete) the file won't be taken for a session.                                   */
 
 {
-    _flushBuffer( r );
+    bool ok;
 
-    if ( !symbolSetValid( r->s ) )
+    ss->ok &= complete;
+    ss->h.pageOfs = ss->at;
+    _sessionPut( ss, ss->page, ss->h.pageCount * sizeof( struct pmSessionPage ) );
+
+    ok = ( ss->ok ) && ( !fseek( ss->f, 0, SEEK_SET ) ) && ( fwrite( &ss->h, 1, sizeof( ss->h ), ss->f ) == sizeof( ss->h ) );
+    ok = ( !fclose( ss->f ) ) && ( ok );
+    memFree( MEM_LINES, ss->page );
+    return ok;
+}
+// ====================================================================================================
+static bool _sessionRestore( struct RunTime *r, const char *fn )
+
+/* Map a session file in and set up the post-mortem buffer and its pages from it, using the lines as they are in the file */
+
+{
+    const struct pmSessionHeader *h;
+    const struct pmSessionPage *sp;
+    struct stat st;
+    int fd;
+
+    if ( ( fd = open( fn, O_RDONLY | O_BINARY ) ) < 0 )
     {
-        symbolDelete( r->s );
+        genericsReport( V_ERROR, "Couldn't open session %s" EOL, fn );
+        return false;
+    }
 
-        if ( !( r->s = symbolAcquire( r->options->elffile, true, true ) ) )
+    if ( ( fstat( fd, &st ) ) || ( ( size_t )st.st_size < sizeof( struct pmSessionHeader ) ) )
+    {
+        close( fd );
+        genericsReport( V_ERROR, "%s isn't a session" EOL, fn );
+        return false;
+    }
+
+    r->sessionLen = st.st_size;
+#if defined( WIN32 )
+    r->sessionMap = ( uint8_t * )memAlloc( MEM_LINES, r->sessionLen );
+
+    for ( size_t got = 0; ( r->sessionMap ) && ( got < r->sessionLen ); )
+    {
+        int n = read( fd, &r->sessionMap[got], r->sessionLen - got );
+
+        if ( n <= 0 )
         {
-            genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
-            return false;
+            memFree( MEM_LINES, r->sessionMap );
+            r->sessionMap = NULL;
+            break;
         }
 
-        genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+        got += n;
     }
 
-    /* Pump the received messages through the TRACE decoder, it will callback to _traceCB with complete sentences */
-    int bytesAvailable = ( ( r->wp + r->options->buflen ) - r->rp ) % r->options->buflen;
+#else
+    r->sessionMap = ( uint8_t * )mmap( NULL, r->sessionLen, PROT_READ, MAP_PRIVATE, fd, 0 );
 
-    /* If we started wrapping (i.e. the rx ring buffer got full) then any guesses about sync status are invalid */
-    if ( ( bytesAvailable == r->options->buflen - 1 ) && ( !r->singleShot ) )
+    if ( r->sessionMap == MAP_FAILED )
     {
-        TRACEDecoderForceSync( &r->i, false );
+        r->sessionMap = NULL;
     }
 
-    /* Two calls in case buffer is wrapped - submit both parts */
-    TRACEDecoderPump( &r->i, &r->pmBuffer[r->rp], r->options->buflen - r->rp, _traceCB, r );
-
-    /* The length of this second buffer can be 0 for case buffer is not wrapped */
-    TRACEDecoderPump( &r->i, &r->pmBuffer[0], r->wp, _traceCB, r );
+#endif
+    close( fd );
 
-    /* Submit this constructed buffer for display */
-    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
+    if ( !r->sessionMap )
+    {
+        genericsReport( V_ERROR, "Couldn't read session %s" EOL, fn );
+        return false;
+    }
 
-    return true;
-}
-// ====================================================================================================
-static struct symbolLineStore *_fileAndLine( struct RunTime *r, uint32_t i )
+    h = ( const struct pmSessionHeader * )r->sessionMap;
 
-{
-    /* Search backwards from current position in buffer until we find a line a line record attached */
-    /* (b) a filename which contains this line. */
+    if ( ( memcmp( h->magic, PM_SESSION_MAGIC, sizeof( h->magic ) ) ) || ( h->version != PM_SESSION_VERSION ) ||
+            ( h->lineSize != sizeof( struct pmLine ) ) || ( h->occSize != sizeof( struct pmOcc ) ) || ( h->traceProt >= TRACE_PROT_NONE ) ||
+            ( h->traceOfs + h->traceLen > r->sessionLen ) || ( h->pageOfs % PM_SESSION_ALIGN ) ||
+            ( h->pageOfs + ( uint64_t )h->pageCount * sizeof( struct pmSessionPage ) > r->sessionLen ) )
+    {
+        genericsReport( V_ERROR, "%s isn't a session this version of orbmortem can use" EOL, fn );
+        return false;
+    }
 
-    while ( ( i ) &&
-            ( ( ( ( r->opText[i].lt != LT_SOURCE ) && ( r->opText[i].lt != LT_ASSEMBLY ) ) || r->opText[i].dat == NULL ) ) )
+    if ( ( !stat( r->options->elffile, &st ) ) && ( ( ( uint64_t )st.st_size != h->elfSize ) || ( st.st_mtime != h->elfTime ) ) )
     {
-        i--;
+        genericsReport( V_WARN, "%s has changed since the session was saved, so what's shown may not match it" EOL, r->options->elffile );
     }
 
-    if ( !i || !r->opText[i].dat )
+    /* The trace is used where it is, as one piece, just as if it had been received */
+    r->options->traceProt = h->traceProt;
+    r->startSynced = h->startSynced;
+    r->pmBuffer    = &r->sessionMap[h->traceOfs];
+    r->pmMirrored  = true;
+    r->rp          = 0;
+    r->wp          = h->traceLen;
+
+    for ( r->pmSize = 4096; r->pmSize < h->traceLen; r->pmSize <<= 1 )
+    {}
+
+    r->page = ( struct pmPage * )memCalloc( MEM_LINES, h->pageCount + 1, sizeof( struct pmPage ) );
+    MEMCHECK( r->page, false );
+    sp = ( const struct pmSessionPage * )&r->sessionMap[h->pageOfs];
+
+    for ( r->pageCount = 0; r->pageCount < ( int32_t )h->pageCount; r->pageCount++, sp++ )
     {
-        i = SIOgetCurrentLineno( r->sio );
+        struct pmPage *p = &r->page[r->pageCount];
+
+        /* Everything has to be inside the file, and each text reference inside its page's text */
+        if ( ( sp->start + sp->len > h->traceLen ) || ( sp->numLines < 0 ) || ( sp->linesOfs % PM_SESSION_ALIGN ) ||
+                ( sp->linesOfs + ( uint64_t )sp->numLines * sizeof( struct pmLine ) > r->sessionLen ) ||
+                ( sp->textOfs + sp->textLen > r->sessionLen ) || ( ( sp->textLen ) && ( r->sessionMap[sp->textOfs + sp->textLen - 1] ) ) ||
+                ( sp->occCount < 0 ) || ( sp->occOfs % PM_SESSION_ALIGN ) ||
+                ( sp->occOfs + ( uint64_t )sp->occCount * sizeof( struct pmOcc ) > r->sessionLen ) )
+        {
+            break;
+        }
+
+        p->start      = sp->start;
+        p->len        = sp->len;
+        p->numLines   = p->linesAlloc = sp->numLines;
+        p->lines      = ( struct pmLine * )&r->sessionMap[sp->linesOfs];
+        p->text       = ( char * )&r->sessionMap[sp->textOfs];
+        p->textLen    = p->textAlloc = sp->textLen;
+        p->occ        = ( struct pmOcc * )&r->sessionMap[sp->occOfs];
+        p->occCount   = p->occAlloc = sp->occCount;
+        p->cached     = p->mapped = p->indexed = true;
+
+        for ( int32_t l = 0; l < p->numLines; l++ )
+        {
+            if ( ( p->lines[l].isText ) && ( p->lines[l].ref >= p->textLen ) )
+            {
+                p->numLines = -1;
+                break;
+            }
+        }
+
+        /* ...and the index has to be in order, and only refer to lines that are there */
+        for ( int32_t i = 0; ( p->numLines >= 0 ) && ( i < p->occCount ); i++ )
+        {
+            if ( ( p->occ[i].n < 0 ) || ( p->occ[i].n >= p->numLines ) || ( ( i ) && ( _occCompare( &p->occ[i - 1], &p->occ[i] ) > 0 ) ) )
+            {
+                p->numLines = -1;
+            }
+        }
 
-        while ( ( i ) &&
-                ( ( ( ( r->opText[i].lt != LT_SOURCE ) && ( r->opText[i].lt != LT_ASSEMBLY ) ) || r->opText[i].dat == NULL ) ) )
+        if ( p->numLines < 0 )
         {
-            i++;
+            break;
         }
     }
 
-    return ( struct symbolLineStore * )( ( i < r->numLines ) ? r->opText[i].dat : NULL );
-}
-// ====================================================================================================
-static void _mapFileBuffer( struct RunTime *r, int lineno, int filenameIndex )
-
-/* Map filename records into buffer */
-
-{
-    /* Get line reference from current buffer */
-    assert( r->fileopText == NULL );
-    assert( r->filenumLines == 0 );
-    unsigned int index = 0;
-    const char *c;
-
-    r->filenumLines = 0;
-
-    while ( ( c = symbolSource( r->s, filenameIndex, index++ ) ) )
+    if ( r->pageCount != ( int32_t )h->pageCount )
     {
-        r->fileopText = ( struct sioline * )realloc( r->fileopText, ( sizeof( struct sioline ) ) * ( r->filenumLines + 1 ) );
-
-        /* This line removes the 'const', but we know to not mess with this line */
-        r->fileopText[r->filenumLines].buffer = ( char * )c;
-        r->fileopText[r->filenumLines].dat    = NULL;
-        r->fileopText[r->filenumLines].lt     = LT_MU_SOURCE;
-        r->fileopText[r->filenumLines].isRef  = true;
-        r->fileopText[r->filenumLines].line   = r->filenumLines + 1;
-        r->filenumLines++;
+        genericsReport( V_ERROR, "Session %s is damaged at page %d" EOL, fn, r->pageCount );
+        return false;
     }
 
-    SIOsetOutputBuffer( r->sio, r->filenumLines, lineno - 1, &r->fileopText, true );
-    r->diving = true;
+    r->firstPage = r->pageCount;
+    r->held = true;
+    return true;
 }
 // ====================================================================================================
-static void _doFileDive( struct RunTime *r )
+static void _doSaveMerged( struct RunTime *r, bool includeDebug )
 
-/* Do actions required to get file contents to dive into */
+/* Save each core's trace, and the report of them all together. There's no session for several cores. */
 
 {
-    static struct symbolLineStore *l;
+    struct pmChunk c = { 0 };
+    char fn[SCRATCH_STRING_LEN];
+    uint8_t *seg[2];
+    size_t seglen[2];
+    bool ok = true;
+    int fd;
+    FILE *f;
 
-    if ( ( r->diving ) || ( !r->numLines ) || ( !r->held ) )
+    for ( int k = 0; k < r->ncores; k++ )
     {
-        return;
-    }
+        snprintf( fn, SCRATCH_STRING_LEN, "%s.%d.trace", SIOgetSaveFilename( r->sio ), r->core[k]->coreTag );
 
-    /* There should be no file read in at the moment */
-    assert( !r->fileopText );
-    assert( !r->filenumLines );
-
-    if ( !( l = _fileAndLine( r, SIOgetCurrentLineno( r->sio ) ) ) )
-    {
-        SIOalert( r->sio, "Couldn't get filename/line" );
-        return;
-    }
+        if ( !( f = fopen( fn, "wb" ) ) )
+        {
+            SIOalert( r->sio, "Save Trace Failed" );
+            return;
+        }
 
-    /* Cache the line in this file in case we need it later */
-    r->lineNum = SIOgetCurrentLineno( r->sio );
+        for ( int i = 0, nsegs = _rxContents( r->core[k], seg, seglen ); i < nsegs; i++ )
+        {
+            fwrite( seg[i], 1, seglen[i], f );
+        }
 
-    _mapFileBuffer( r,  l->startline, l->filename );
-}
-// ====================================================================================================
-static void _doFilesurface( struct RunTime *r )
+        fclose( f );
+    }
 
-/* Come back out of a file we're diving into */
+    snprintf( fn, SCRATCH_STRING_LEN, "%s.report", SIOgetSaveFilename( r->sio ) );
+    fd = open( fn, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644 );
 
-{
-    if ( !r->diving )
+    if ( fd < 0 )
     {
+        SIOalert( r->sio, "Save Report Failed" );
         return;
     }
 
-    /* Buffer is a ref so we don't need to delete it, just remove the index */
-    free( r->fileopText );
-    r->fileopText = NULL;
-    r->filenumLines = 0;
-    r->diving = false;
+    /* Written out a cache-full of lines at a time, so the cores' caches aren't churned through in one go */
+    for ( int32_t n = 0; ( ok ) && ( n < r->numLines ); n++ )
+    {
+        _formatLine( _lineAt( r, n ), includeDebug, &c );
 
-    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
-    SIOsetCurrentLineno( r->sio, r->lineNum );
+        if ( ( c.len > 65536 ) || ( n == r->numLines - 1 ) )
+        {
+            ok = _writeChunks( fd, &c, 1 );
+            c.len = 0;
+        }
+    }
+
+    free( c.buf );
+    close( fd );
+    SIOalert( r->sio, ( ok ) ? "Save Complete" : "Save Report Failed" );
 }
 // ====================================================================================================
 static void _doSave( struct RunTime *r, bool includeDebug )
@@ -1208,10 +3908,24 @@ static void _doSave( struct RunTime *r, bool includeDebug )
 /* Save buffer in both raw and processed formats */
 
 {
+    static struct pmSaveJob job;
+    struct pmSaveWorker worker[PM_SAVE_THREADS];
+    struct pmSessionSave ss;
+    int nworkers = 0;
+    int maxWorkers = 1;
+    bool ok = true;
+    bool sessionOk;
+    int fd;
     FILE *f;
     char fn[SCRATCH_STRING_LEN];
-    uint32_t w;
-    char *p;
+    uint8_t *seg[2];
+    size_t seglen[2];
+
+    if ( r->merged )
+    {
+        _doSaveMerged( r, includeDebug );
+        return;
+    }
 
     snprintf( fn, SCRATCH_STRING_LEN, "%s.trace", SIOgetSaveFilename( r->sio ) );
     f = fopen( fn, "wb" );
@@ -1222,71 +3936,111 @@ static void _doSave( struct RunTime *r, bool includeDebug )
         return;
     }
 
-    w = r->rp;
-
-    while ( w != r->wp )
+    for ( int i = 0, nsegs = _rxContents( r, seg, seglen ); i < nsegs; i++ )
     {
-        fwrite( &r->pmBuffer[w], 1, 1, f );
-        w = ( w + 1 ) % r->options->buflen;
+        fwrite( seg[i], 1, seglen[i], f );
     }
 
     fclose( f );
 
     snprintf( fn, SCRATCH_STRING_LEN, "%s.report", SIOgetSaveFilename( r->sio ) );
-    f = fopen( fn, "wb" );
 
-    if ( !f )
+    fd = open( fn, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644 );
+
+    if ( fd < 0 )
     {
         SIOalert( r->sio, "Save Report Failed" );
         return;
     }
 
-    w = 0;
+    /* The session goes along with the report, getting each page's lines while they're decoded for it */
+    snprintf( fn, SCRATCH_STRING_LEN, "%s.session", SIOgetSaveFilename( r->sio ) );
+    sessionOk = _sessionBegin( r, &ss, fn );
 
-    while ( w != r->numLines )
+#if defined( _SC_NPROCESSORS_ONLN )
+    maxWorkers = sysconf( _SC_NPROCESSORS_ONLN );
+    maxWorkers = ( maxWorkers < 1 ) ? 1 : ( maxWorkers > PM_SAVE_THREADS ) ? PM_SAVE_THREADS : maxWorkers;
+#endif
+
+    /* Each worker needs its own disassembler, the one in the symbols can only be used from here */
+    while ( ( nworkers < maxWorkers ) && ( symbolDisassemblerOpen( &worker[nworkers].h ) ) )
     {
-        p = r->opText[w].buffer;
+        worker[nworkers++].job = &job;
+    }
 
-        /* Skip blank and debug lines unless specifically told to include them */
-        if ( !p || ( ( r->opText[w].lt == LT_DEBUG ) && ( !includeDebug ) ) )
-        {
-            w++;
-            continue;
-        }
+    if ( !nworkers )
+    {
+        worker[nworkers].h = 0;
+        worker[nworkers++].job = &job;
+    }
 
-        if ( ( r->opText[w].lt == LT_SOURCE ) || ( r->opText[w].lt == LT_MU_SOURCE ) )
+    job.r = r;
+    job.includeDebug = includeDebug;
+
+    /* This is all of the buffer, not just what's been looked at so far. Pages are decoded here, since */
+    /* there's only one decoder, a cache-full at a time. None of those will be dropped from the cache  */
+    /* while the batch is being decoded since they are all more recently used than anything else.      */
+    for ( job.first = 0; ( ok ) && ( job.first < r->pageCount ); job.first += job.count )
+    {
+        job.count = ( r->pageCount - job.first < PM_CACHE_PAGES ) ? r->pageCount - job.first : PM_CACHE_PAGES;
+
+        for ( int32_t pg = 0; pg < job.count; pg++ )
         {
-            /* Need a line number on this */
-            fwrite( fn, sprintf( fn, "%5d ", r->opText[w].line ), 1, f );
+            _pageGet( r, job.first + pg );
+
+            if ( sessionOk )
+            {
+                _sessionAddPage( r, &ss, job.first + pg );
+            }
         }
 
-        if ( r->opText[w].lt == LT_NASSEMBLY )
+        atomic_store( &job.next, 0 );
+
+        /* ...and then rendered in parallel, with this thread doing its share using the first worker */
+        for ( int t = 1; t < nworkers; t++ )
         {
-            /* This is an _unexecuted_ assembly line, need to mark it */
-            fwrite( "(**", 3, 1, f );
+            if ( pthread_create( &worker[t].thread, NULL, _saveWorker, &worker[t] ) )
+            {
+                worker[t].thread = pthread_self();
+            }
         }
 
-        /* Search forward for a NL or 0, both are EOL for this purpose */
-        while ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) )
+        _saveWorker( &worker[0] );
+
+        for ( int t = 1; t < nworkers; t++ )
         {
-            p++;
+            if ( !pthread_equal( worker[t].thread, pthread_self() ) )
+            {
+                pthread_join( worker[t].thread, NULL );
+            }
         }
 
-        fwrite( r->opText[w].buffer, p - r->opText[w].buffer, 1, f );
+        ok = _writeChunks( fd, job.chunk, job.count );
+    }
 
-        if ( r->opText[w].lt == LT_NASSEMBLY )
+    for ( int t = 0; t < nworkers; t++ )
+    {
+        if ( worker[t].h )
         {
-            /* This is an _unexecuted_ assembly line, need to mark it */
-            fwrite( " **)", 4, 1, f );
+            cs_close( &worker[t].h );
         }
+    }
 
-        fwrite( EOL, strlen( EOL ), 1, f );
-        w++;
+    for ( int32_t i = 0; i < PM_CACHE_PAGES; i++ )
+    {
+        free( job.chunk[i].buf );
+        job.chunk[i].buf = NULL;
+        job.chunk[i].len = job.chunk[i].alloc = 0;
     }
 
-    fclose( f );
+    close( fd );
+
+    if ( ss.f )
+    {
+        sessionOk = _sessionEnd( &ss, ( ok ) && ( sessionOk ) );
+    }
 
-    SIOalert( r->sio, "Save Complete" );
+    SIOalert( r->sio, ( !ok ) ? "Save Report Failed" : ( !sessionOk ) ? "Save Session Failed" : "Save Complete" );
 }
 // ====================================================================================================
 static void _doExit( void )
@@ -1295,6 +4049,9 @@ static void _doExit( void )
 
 {
     _r.ending = true;
+    _captureStop( &_r );
+    _liveStop( &_r );
+
     /* Give them a bit of time, then we're leaving anyway */
     usleep( 200 );
     SIOterminate( _r.sio );
@@ -1310,9 +4067,8 @@ static void _doExit( void )
 int main( int argc, char *argv[] )
 
 {
-    int32_t lastTTime, lastTSTime, lastHTime;
-    struct Stream *stream;              /* Stream that we are collecting data from */
-    struct timeval tv;
+    int32_t lastTTime, lastTSTime, lastHTime, lastFTime, lastCTime;
+    struct Stream *stream = NULL;       /* Stream that we are collecting data from, if it's a file */
     enum SIOEvent s;
 
     /* Have a basic name and search string set up */
@@ -1334,24 +4090,37 @@ int main( int argc, char *argv[] )
 
     if ( _r.options->file != NULL )
     {
-        if ( NULL == ( stream = streamCreateFile( _r.options->file ) ) )
+        if ( NULL == ( stream = streamCreateMappedFileAt( _r.options->file, captureIndexStart( _r.options->file, _r.options->startmS ) ) ) )
         {
             genericsExit( V_ERROR, "File not found" EOL );
             _r.ending = true;
         }
     }
 
-    /* Check we've got _some_ symbols to start from */
-    _r.s = symbolAcquire( _r.options->elffile, true, true );
+    if ( ( _r.options->session ) || ( _r.options->live ) )
+    {
+        /* These show what they have straight away, so they need _some_ symbols to start from */
+        _r.s = symbolAcquire( _r.options->elffile, true, true );
+
+        if ( !_r.s )
+        {
+            genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
+            return -1;
+        }
+
+        genericsReport( V_DEBUG, "Loaded %s" EOL, _r.options->elffile );
 
-    if ( !_r.s )
+        if ( !_focusResolve( &_r ) )
+        {
+            return -1;
+        }
+    }
+    else
     {
-        genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
-        return -1;
+        /* ...otherwise trace is only decoded when the buffer is dumped, so it can be taken while they load */
+        _symbolsStart( &_r );
     }
 
-    genericsReport( V_DEBUG, "Loaded %s" EOL, _r.options->elffile );
-
     /* This ensures the atexit gets called */
     if ( SIG_ERR == signal( SIGINT, _intHandler ) )
     {
@@ -1359,7 +4128,7 @@ int main( int argc, char *argv[] )
     }
 
     /* Fill in a time to start from */
-    lastHTime = lastTTime = lastTSTime = genericsTimestampmS();
+    lastHTime = lastTTime = lastTSTime = lastFTime = lastCTime = genericsTimestampmS();
 
 
 #if !defined( WIN32 )
@@ -1372,292 +4141,314 @@ int main( int argc, char *argv[] )
 
 #endif
 
-    /* Create the buffer memory */
-    _r.pmBuffer = ( uint8_t * )calloc( 1, _r.options->buflen );
+    /* Create the buffer memory, or take it (and everything decoded from it) from a session */
+    if ( _r.options->session )
+    {
+        if ( !_sessionRestore( &_r, _r.options->session ) )
+        {
+            return -1;
+        }
+    }
+    else if ( _r.options->ntags > 1 )
+    {
+        /* Each tag is a core with its own buffer and decoder, merged together when they're shown */
+        for ( _r.ncores = 0; _r.ncores < _r.options->ntags; _r.ncores++ )
+        {
+            struct RunTime *c = ( struct RunTime * )calloc( 1, sizeof( struct RunTime ) );
+            MEMCHECK( c, -1 );
+            c->options = _r.options;
+            c->progName = _r.progName;
+            c->coreTag = _r.options->tags[_r.ncores];
+            _rxCreate( c );
+            TRACEDecoderInit( &c->i, c->options->traceProt, !( c->options->noAltAddr ), _traceReport );
+            _r.core[_r.ncores] = c;
+        }
+    }
+    else
+    {
+        _rxCreate( &_r );
+    }
 
     TRACEDecoderInit( &_r.i, _r.options->traceProt, !( _r.options->noAltAddr ), _traceReport );
 
     OFLOWInit( &_r.c );
+    _trigArm( &_r );
 
     /* Create a screen and interaction handler */
-    _r.sio = SIOsetup( _r.progName, _r.options->elffile, ( _r.options->file != NULL ) );
+    _r.sio = SIOsetup( _r.progName, _r.options->elffile, ( _r.options->file != NULL ) || ( _r.options->session != NULL ) );
 
     /* Put a record of the protocol in use on screen */
     SIOtagText( _r.sio, TRACEDecodeGetProtocolName( _r.options->traceProt ) );
 
-    while ( !_r.ending )
+    if ( ( _r.options->live ) && ( !_liveStart( &_r ) ) )
     {
-        if ( NULL == _r.options->file )
-        {
-            /* Keep trying to open a network connection at half second intervals */
-            while ( 1 )
-            {
-                stream = streamCreateSocket( _r.options->server, _r.options->port + ( ( PROT_OFLOW != _r.options->commProt ) ? 1 : 0 ) );
+        return -1;
+    }
 
-                if ( stream )
-                {
-                    break;
-                }
+    if ( _r.options->session )
+    {
+        /* Everything a restored session needs is already there, so it's shown straight away */
+        _extendBack( &_r, PM_LOOKBACK_LINES );
+        SIOsetOutputFetch( _r.sio, _r.numLines, _r.numLines - 1, _fetchLine, &_r );
+        SIOheld( _r.sio, _r.held );
+    }
+    else
+    {
+        /* Input is taken on a thread of its own, so nothing done here can hold it up */
+        _r.fileStream = stream;
 
-                /* This can happen when the feeder has gone missing... */
-                SIOalert( _r.sio, "No connection" );
+        if ( pthread_create( &_r.captureThread, NULL, _captureTask, &_r ) )
+        {
+            genericsExit( -1, "Failed to start capture thread" EOL );
+        }
 
-                if ( SIOHandler( _r.sio, true, 0, _r.options->withDebugText ) == SIO_EV_QUIT )
-                {
-                    _r.ending = true;
-                    break;
-                }
+        _r.captureRunning = true;
+    }
 
-                usleep( 1000000 );
-            }
-        }
+    /* ----------------------------------------------------------------------------- */
+    /* This is the main UI loop...only break out of this when ending                 */
+    /* ----------------------------------------------------------------------------- */
+    while ( !_r.ending )
+    {
+        /* No point in checking for keypresses _too_ often! */
+        usleep( TICK_TIME_MS * 100 );
 
-        /* ----------------------------------------------------------------------------- */
-        /* This is the main active loop...only break out of this when ending or on error */
-        /* ----------------------------------------------------------------------------- */
-        while ( !_r.ending )
+        if ( !_symbolsIn( &_r, false ) )
         {
-            tv.tv_sec = 0;
-            tv.tv_usec  = 10000;
-
-            if ( stream )
-            {
-                /* We always read the data, even if we're held, to keep the socket alive */
-                enum ReceiveResult result = stream->receive( stream, _r.rawBlock.buffer, TRANSFER_SIZE, &tv, ( size_t * )&_r.rawBlock.fillLevel );
+            /* ...there's nothing to be done with the trace without them */
+            _r.ending = true;
+            break;
+        }
 
-                /* Try to re-establish socket if there was an error */
-                if ( result == RECEIVE_RESULT_ERROR )
-                {
-                    break;
-                }
+        if ( ( _r.noConnection ) && ( ( genericsTimestampmS() - lastCTime ) > NO_CONNECTION_ALERT_MS ) )
+        {
+            /* This can happen when the feeder has gone missing... */
+            SIOalert( _r.sio, "No connection" );
+            lastCTime = genericsTimestampmS();
+        }
 
-                if ( ( ( result == RECEIVE_RESULT_EOF ) || ( _r.rawBlock.fillLevel <= 0 ) ) && _r.options->file )
+        /* Update the outputs and deal with any keys that made it up this high */
+        /* =================================================================== */
+        switch ( ( s = SIOHandler( _r.sio, ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS, _r.oldTotalIntervalBytes, _r.options->withDebugText ) ) )
+        {
+            case SIO_EV_HOLD:  // ----------------- Request for Hold Start/Stop -------------------------------------
+                if ( ( !_r.options->file ) && ( !_r.options->session ) )
                 {
-                    /* Read from file is complete, remove it */
-                    stream->close( stream );
-                    free( stream );
+                    /* The capture thread mustn't be part way through adding to the buffer while this changes */
+                    pthread_mutex_lock( &_r.rxLock );
+                    _r.held = !_r.held;
 
-                    stream = NULL;
-                }
-            }
-            else
-            {
-                /* No point in checking for keypresses _too_ often! */
-                usleep( TICK_TIME_MS * 100 );
-            }
+                    if ( !_r.held )
+                    {
+                        _trigArm( &_r );
 
-            if ( !_r.held )
-            {
-                /* Pump all of the data through the protocol handler */
+                        if ( !_r.liveRunning )
+                        {
+                            _rxReset( &_r );
+                        }
+                    }
 
-                if ( PROT_OFLOW == _r.options->commProt )
-                {
-                    OFLOWPump( &_r.c, _r.rawBlock.buffer, _r.rawBlock.fillLevel, _OFLOWpacketRxed, &_r );
-                }
-                else
-                {
-                    _processBlock( &_r );
-                }
-            }
+                    pthread_mutex_unlock( &_r.rxLock );
 
-            /* Update the outputs and deal with any keys that made it up this high */
-            /* =================================================================== */
-            switch ( ( s = SIOHandler( _r.sio, ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS, _r.oldTotalIntervalBytes, _r.options->withDebugText ) ) )
-            {
-                case SIO_EV_HOLD:  // ----------------- Request for Hold Start/Stop -------------------------------------
-                    if ( !_r.options->file )
+                    /* Live, holding just stops the display following the trace, there's nothing to start afresh */
+                    if ( ( !_r.held ) && ( !_r.liveRunning ) )
                     {
-                        _r.held = !_r.held;
-
-                        if ( !_r.held )
+                        if ( _r.diving )
                         {
-                            _r.wp = _r.rp = 0;
+                            _doFilesurface( &_r );
+                        }
+
+                        _flushBuffer( &_r );
+                    }
 
-                            if ( _r.diving )
-                            {
-                                _doFilesurface( &_r );
-                            }
+                    /* Flag held status to the UI */
+                    SIOheld( _r.sio, _r.held );
+                }
 
-                            _flushBuffer( &_r );
-                        }
+                break;
+
+            case SIO_EV_PREV:
+            case SIO_EV_NEXT: // ----------------- Request for next/prev execution line -----------------------------
+                if ( !_r.diving )
+                {
+                    int32_t l = SIOgetCurrentLineno( _r.sio );
 
-                        /* Flag held status to the UI */
-                        SIOheld( _r.sio, _r.held );
+                    if ( ( ( s == SIO_EV_PREV ) && ( !l ) ) || ( ( s == SIO_EV_NEXT ) && ( l >= _r.numLines - 1 ) ) )
+                    {
+                        break;
                     }
 
-                    break;
+                    /* In a regular window, scroll back looking for an earlier assembly instruction */
+                    do
+                    {
+                        l += s == SIO_EV_PREV ? -1 : 1;
+                    }
+                    while ( l && ( l < _r.numLines - 1 ) && ( ( _lineAt( &_r, l )->lt != LT_ASSEMBLY ) ) );
 
-                case SIO_EV_PREV:
-                case SIO_EV_NEXT: // ----------------- Request for next/prev execution line -----------------------------
-                    if ( !_r.diving )
+                    if ( l )
+                    {
+                        SIOsetCurrentLineno( _r.sio, l );
+                        SIOrequestRefresh( _r.sio );
+                    }
+                    else
                     {
-                        int32_t l = SIOgetCurrentLineno( _r.sio );
+                        SIObeep();
+                    }
+                }
+                else
+                {
+                    /* In a diving window, situation is slightly more complicated */
+                    int32_t l = _r.lineNum;
+                    struct symbolLineStore *oldLine = _fileAndLine( &_r, l );
 
-                        if ( ( ( s == SIO_EV_PREV ) && ( !l ) ) || ( ( s == SIO_EV_NEXT ) && ( l >= _r.numLines - 1 ) ) )
-                        {
-                            break;
-                        }
+                    if ( ( ( s == SIO_EV_PREV ) && ( !l ) ) || ( ( s == SIO_EV_NEXT ) && ( l >= _r.numLines - 1 ) ) )
+                    {
+                        break;
+                    }
 
-                        /* In a regular window, scroll back looking for an earlier assembly instruction */
-                        do
-                        {
-                            l += s == SIO_EV_PREV ? -1 : 1;
-                        }
-                        while ( l && ( l < _r.numLines - 1 ) && ( ( _r.opText[l].lt != LT_ASSEMBLY ) ) );
+                    /* Search for different _source_line_ to the one we started from */
+                    do
+                    {
+                        l += s == SIO_EV_PREV ? -1 : 1;
+                    }
+                    while ( l && ( l < _r.numLines - 1 ) && ( ( _lineAt( &_r, l )->lt != LT_SOURCE ) ) );
 
-                        if ( l )
+                    if ( l )
+                    {
+                        if ( oldLine->filename == _fileAndLine( &_r, l )->filename )
                         {
-                            SIOsetCurrentLineno( _r.sio, l );
+                            /* We are still in the same file, so only the line number to change */
+                            _r.lineNum = l;
+                            SIOsetCurrentLineno( _r.sio, _fileAndLine( &_r, l )->startline - 1 );
                             SIOrequestRefresh( _r.sio );
                         }
                         else
                         {
-                            SIObeep();
+                            /* We have changed diving file, surface and enter the new one */
+                            _r.lineNum = l;
+                            _doFilesurface( &_r );
+                            _doFileDive( &_r );
+                            SIOrequestRefresh( _r.sio );
                         }
                     }
                     else
                     {
-                        /* In a diving window, situation is slightly more complicated */
-                        int32_t l = _r.lineNum;
-                        struct symbolLineStore *oldLine = _fileAndLine( &_r, l );
+                        SIObeep();
+                    }
 
-                        if ( ( ( s == SIO_EV_PREV ) && ( !l ) ) || ( ( s == SIO_EV_NEXT ) && ( l >= _r.numLines - 1 ) ) )
-                        {
-                            break;
-                        }
+                }
 
-                        /* Search for different _source_line_ to the one we started from */
-                        do
-                        {
-                            l += s == SIO_EV_PREV ? -1 : 1;
-                        }
-                        while ( l && ( l < _r.numLines - 1 ) && ( ( _r.opText[l].lt != LT_SOURCE ) ) );
+                break;
 
-                        if ( l )
-                        {
-                            if ( oldLine->filename == _fileAndLine( &_r, l )->filename )
-                            {
-                                /* We are still in the same file, so only the line number to change */
-                                _r.lineNum = l;
-                                SIOsetCurrentLineno( _r.sio, _fileAndLine( &_r, l )->startline - 1 );
-                                SIOrequestRefresh( _r.sio );
-                            }
-                            else
-                            {
-                                /* We have changed diving file, surface and enter the new one */
-                                _r.lineNum = l;
-                                _doFilesurface( &_r );
-                                _doFileDive( &_r );
-                                SIOrequestRefresh( _r.sio );
-                            }
-                        }
-                        else
-                        {
-                            SIObeep();
-                        }
+            case SIO_EV_OCC_PREV:
+            case SIO_EV_OCC_NEXT:
+            case SIO_EV_FUNC_PREV:
+            case SIO_EV_FUNC_NEXT:
+            case SIO_EV_GOTO: // ------------------- Request for next/prev occurrence, or an address ---------------
+                _doOccurrence( &_r, s );
+                break;
 
-                    }
+            case SIO_EV_SAVE: // ------------------ Request for file save -------------------------------------------
+                if ( ( !_r.options->file ) && ( !_r.options->session ) )
+                {
+                    _doSave( &_r, false );
+                }
 
-                    break;
+                break;
 
-                case SIO_EV_SAVE: // ------------------ Request for file save -------------------------------------------
-                    if ( !_r.options->file )
-                    {
-                        _doSave( &_r, false );
-                    }
+            case SIO_EV_DIVE: // -------------------- Request for dive into source file -----------------------------
+                _doFileDive( &_r );
+                break;
 
-                    break;
+            case SIO_EV_FOPEN: // ------------------- Request for file open -----------------------------------------
+                if ( _r.options->openFileCL )
+                {
+                    //                        _doFileOpen( &_r, false );
+                }
 
-                case SIO_EV_DIVE: // -------------------- Request for dive into source file -----------------------------
-                    _doFileDive( &_r );
-                    break;
+                break;
 
-                case SIO_EV_FOPEN: // ------------------- Request for file open -----------------------------------------
-                    if ( _r.options->openFileCL )
-                    {
-                        //                        _doFileOpen( &_r, false );
-                    }
+            case SIO_EV_SURFACE: // --------------------- Request for file surface ----------------------------------
+                _doFilesurface( &_r );
+                break;
 
-                    break;
+            case SIO_EV_QUIT: // ------------------------- Request to exit ------------------------------------------
+                _r.ending = true;
+                break;
 
-                case SIO_EV_SURFACE: // --------------------- Request for file surface ----------------------------------
-                    _doFilesurface( &_r );
-                    break;
+            default:
+                break;
+        }
 
-                case SIO_EV_QUIT: // ------------------------- Request to exit ------------------------------------------
-                    _r.ending = true;
-                    break;
+        /* If we're getting close to the start of what's been decoded, decode some more in front of it */
+        if ( ( !_r.diving ) && ( _r.firstPage ) && ( _r.numLines ) && ( SIOgetCurrentLineno( _r.sio ) < PM_LOOKBACK_LINES ) )
+        {
+            SIOprependLines( _r.sio, _extendBack( &_r, PM_LOOKBACK_LINES ) );
+        }
 
-                default:
-                    break;
-            }
+        /* Live, the display follows the decode every so often, unless it's being looked around */
+        if ( ( _r.liveRunning ) && ( !_r.held ) && ( !_r.diving ) && ( ( genericsTimestampmS() - lastFTime ) > PM_LIVE_FRAME_MS ) )
+        {
+            _liveShow( &_r );
+            lastFTime = genericsTimestampmS();
+        }
 
-            /* Deal with possible timeout on sampling, or if this is a read-from-file that is finished */
-            if ( ( !_r.numLines )  &&
-                    (
-                                ( _r.options->file && !stream ) ||
-                                ( ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS ) &&
-                                  ( _r.newTotalBytes - _r.oldTotalHangBytes == 0 ) &&
-                                  ( _r.wp != _r.rp ) )
-                    )
-               )
-            {
-                if ( !_dumpBuffer( &_r ) )
-                {
-                    /* Dumping the buffer failed, so give up */
-                    _r.ending = true;
-                }
-                else
-                {
-                    _r.held = true;
-                    SIOheld( _r.sio, _r.held );
-                }
-            }
+        /* Deal with possible timeout on sampling, or if this is a read-from-file that is finished */
+        if ( ( !_r.liveRunning ) && ( !_r.numLines )  &&
+                (
+                            ( _r.options->file && _r.fileDone ) ||
+                            ( _r.triggered && _r.held ) ||
+                            ( ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS ) &&
+                              ( _r.newTotalBytes - _r.oldTotalHangBytes == 0 ) &&
+                              _rxHasData( &_r ) )
+                )
+           )
+        {
+            /* Hold first, so the buffer doesn't change under the decode */
+            pthread_mutex_lock( &_r.rxLock );
+            _r.held = true;
+            pthread_mutex_unlock( &_r.rxLock );
 
-            /* Update the intervals */
-            if ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS )
+            if ( !_dumpBuffer( &_r ) )
             {
-                _r.oldTotalHangBytes = _r.newTotalBytes;
-                lastHTime = genericsTimestampmS();
+                /* Dumping the buffer failed, so give up */
+                _r.ending = true;
             }
-
-            if ( ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS )
+            else
             {
-                lastTTime = genericsTimestampmS();
-            }
+                SIOheld( _r.sio, _r.held );
 
-            if ( ( genericsTimestampmS() - lastTSTime ) > INTERVAL_TIME_MS )
-            {
-                _r.oldTotalIntervalBytes = _r.newTotalBytes - _r.oldTotalBytes;
-                _r.oldTotalBytes = _r.newTotalBytes;
-                lastTSTime = genericsTimestampmS();
+                if ( _r.triggered )
+                {
+                    SIOalert( _r.sio, "Triggered" );
+                }
             }
         }
 
-        /* ----------------------------------------------------------------------------- */
-        /* End of main loop ... we get here because something forced us out              */
-        /* ----------------------------------------------------------------------------- */
-
-        if ( stream )
+        /* Update the intervals */
+        if ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS )
         {
-            stream->close( stream );
-            free( stream );
-
-            stream = NULL;
+            _r.oldTotalHangBytes = _r.newTotalBytes;
+            lastHTime = genericsTimestampmS();
         }
 
-        if ( _r.options->file )
+        if ( ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS )
         {
-            /* Don't keep re-reading the file if it is a file! */
-            _r.held = true;
+            lastTTime = genericsTimestampmS();
         }
 
-        if ( _r.options->fileTerminate )
+        if ( ( genericsTimestampmS() - lastTSTime ) > INTERVAL_TIME_MS )
         {
-            _r.ending = true;
+            _r.oldTotalIntervalBytes = _r.newTotalBytes - _r.oldTotalBytes;
+            _r.oldTotalBytes = _r.newTotalBytes;
+            lastTSTime = genericsTimestampmS();
         }
     }
 
+    _captureStop( &_r );
+    _liveStop( &_r );
+
+    _dropFileViews( &_r );
     symbolDelete( _r.s );
     return OK;
 }
@@ -16,8 +16,11 @@
 #include <pthread.h>
 #include <assert.h>
 #include <getopt.h>
+#include <stdatomic.h>
+#include <inttypes.h>
 
 #include "git_version_info.h"
+#define MEM_ACCOUNT_UTHASH
 #include "uthash.h"
 #include "generics.h"
 #include "traceDecoder.h"
@@ -26,26 +29,92 @@
 #include "nw.h"
 #include "ext_fileformats.h"
 #include "stream.h"
+#include "perfetto.h"
+#include "memAccount.h"
+#include "addrFilter.h"
 
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
 
 enum Prot { PROT_OFLOW, PROT_ETM, PROT_UNKNOWN };
+
+/* Where statistical decode is in its period */
+enum WinState { WIN_SEEK, WIN_OPEN, WIN_GAP };
 const char *protString[] = {"OFLOW", "ETM", NULL};
 
+/* Memory management for the results of a sample */
+#define CALL_STACK_DEPTH (256)           /* Initial call stack depth, it's grown if a deeper one turns up */
+#define ARENA_BLOCK_SIZE (1024*1024)     /* Size of each block of memory for exec and call records */
+
+/* How many events to collect from the decoder before processing them */
+#define EVENT_BATCH    (256)
+
 /* How many transfer buffers from the source to allocate */
 #define NUM_RAW_BLOCKS (1000)
 
+#define PROCESS_IDLE_WAIT_NS    (100*1000*1000L) /* Longest the block processor sleeps without being kicked */
+#define DROP_REPORT_INTERVAL_MS (1000)           /* Shortest time between reports of dropped data */
+
+/* Most cores whose trace, each on its own tag, can be profiled together */
+#define MAX_CORES      (8)
+
+/* Parallel decode of offline captures */
+#define CHUNKS_PER_JOB (4)               /* Chunks to split the capture into for each thread, to balance the load */
+#define MIN_CHUNK_SIZE (64*1024)         /* Smallest chunk worth handing to a thread */
+
+/* Instructions waiting for a cycle count to share out. Beyond this the cycle counts have stopped, */
+/* or never came for these, so they're dropped.                                                  */
+#define CYCLE_PENDING_MAX (64*1024)
+
 #define DBG_OUT(...) fprintf(stderr,__VA_ARGS__)
 //#define DBG_OUT(...)
 
+/* What each instruction has cost, counted straight into a flat array and folded into the exec entries at output */
+struct insnCost
+{
+    uint64_t count;                      /* Times executed */
+    uint64_t cycles;                     /* ...and the cycles that took */
+};
+
 struct _subcallAccount
 {
     struct subcallSig sig;
     uint64_t inTicks;
 };
 
+/* Calls made in one context (an RTOS thread, going by the context ID it's traced with), which */
+/* each have a stack of their own since a switch can come at any depth in any of them.     */
+struct callContext
+{
+    uint32_t contextID;
+    struct _subcallAccount *substack;    /* Calls stack data */
+    uint32_t substacklen;                /* Calls stack length */
+    uint32_t substackAlloc;              /* ...and how much of it is allocated */
+    struct stackNode *at;                /* Where it was in the stack tree when it was switched out */
+    uint64_t tlCalls;                    /* Timeline tracks for its slices... */
+    uint64_t tlDepth;                    /* ...and how deep they are */
+    UT_hash_handle hh;
+};
+
+/* What a called address is named in the timeline */
+struct timelineName
+{
+    uint32_t addr;
+    uint64_t iid;
+    UT_hash_handle hh;
+};
+
+/* A block of memory in an arena. Records are bump allocated from these and freed together */
+struct arenaBlock
+{
+    struct arenaBlock *next;
+    enum memSubsystem ms;                       /* What it's counted against */
+    size_t used;
+    size_t size;
+    uint8_t d[];
+};
+
 
 /* ---------- CONFIGURATION ----------------- */
 struct Options                           /* Record for options, either defaults or from command line */
@@ -62,10 +131,23 @@ struct Options                           /* Record for options, either defaults
 
     char *dotfile;                       /* File to output dot information */
     char *profile;                       /* File to output profile information */
+    char *covfile;                       /* File to keep the coverage map in, adding to it on each run */
+    char *lcovfile;                      /* File to output coverage in lcov format */
+    char *stackfile;                     /* File to output folded stacks */
+    char *pproffile;                     /* File to output pprof profile */
+    char *timeline;                      /* File to write a Perfetto timeline of the calls to */
+    double timelineMHz;                  /* ...and how many instructions there are to a uS in it, or 0 for one to a nS */
     int  sampleDuration;                 /* How long we are going to sample for */
     bool mono;                           /* Supress colour in output */
     bool noaltAddr;                      /* Dont use alternate addressing */
-    int  tag;                            /*  Which OFLOW stream are we decoding? */
+    uint8_t tags[MAX_CORES];             /* Which OFLOW streams are we decoding, one for each core? */
+    int  ntags;                          /* ...and how many of them there are */
+    int  jobs;                           /* Number of threads to decode a file with, or 0 to decode as it's read */
+    int  continuous;                     /* Interval between rolling outputs (in seconds), or 0 to output once at the end */
+    uint32_t winLen;                     /* Statistical decode, bytes of trace decoded... */
+    uint32_t winPeriod;                  /* ...out of every this many, or 0 to decode everything */
+    struct addrFilter focus;             /* Parts of the program to profile, everything if it's empty */
+    uint8_t *focusInsn;                  /* ...flagged for each instruction in the symbols, NULL if there's no filter */
     enum TRACEprotocol tProtocol;        /* Encoding protocol to use */
 
     int  port;                           /* Source information for where to connect to */
@@ -79,7 +161,8 @@ struct Options                           /* Record for options, either defaults
     .sampleDuration = DEFAULT_DURATION_MS,
     .port           = OFCLIENT_SERVER_PORT,
     .tProtocol      = TRACE_PROT_ETM35,
-    .tag            = 2,
+    .tags           = { 2 },
+    .ntags          = 1,
     .server         = "localhost"
 };
 
@@ -95,15 +178,29 @@ struct opConstruct
 
     uint64_t firsttstamp;                /* First timestamp we recorded (that was valid) */
     uint64_t lasttstamp;                 /* Last timestamp we recorded (that was valid) */
+    uint64_t elapsed;                    /* Time in earlier windows, in statistical decode */
+    bool resync;                         /* Waiting for an address to pick up the flow from */
 
     bool isExceptReturn;                 /* Is this flagged as an exception return? */
     bool isException;                    /* Is this flagged as an exception? */
+
+    uint64_t runInsns;                   /* Instructions executed in linear runs, which is MTB's measure of time */
+
+    uint32_t insn;                       /* Index of the last instruction we were in, in the symbol table */
+    uint32_t incAddr;                    /* Instructions outstanding from the last batch of atoms */
+    uint32_t disposition;                /* ...and what happened to each of them */
+
+    uint64_t lastCycles;                 /* Cycle count last reported by the decoder (ETM4 counts are running totals) */
+
+    struct execEntryHash pass;           /* Stands in for an exec entry outside the focus, which doesn't get one */
 };
 
 /* A block of received data */
 struct dataBlock
 {
     ssize_t fillLevel;
+    bool stamped;                        /* tstamp is when the trace in it was captured (for a core's blocks) */
+    uint64_t tstamp;
     uint8_t buffer[TRANSFER_SIZE];
 };
 
@@ -122,10 +219,48 @@ struct RunTime
     struct edge *calls;                         /* Call data table */
     struct subcall *subhead;                    /* Calls onstruct data */
     struct execEntryHash *insthead;             /* Exec table handle for hash */
-
-    /* Subroutine related info...the call stack and its length */
-    struct _subcallAccount *substack;           /* Calls stack data */
-    uint32_t substacklen;                       /* Calls stack length */
+    struct execEntryHash **exec;                /* ...and the same entries, indexed by instruction in the symbol table */
+    struct insnCost *cost;                      /* Costs not yet in the exec entries, indexed the same way */
+    bool costsPending;                          /* Are there any costs that haven't been folded in yet? */
+
+    /* Cycle counts (in cycle accurate mode) cover all the instructions since the last one */
+    bool cyclesSeen;                            /* Have there been any cycle counts at all? */
+    uint32_t *pend;                             /* Instructions executed since the last cycle count */
+    uint32_t pendLen;
+    uint32_t pendAlloc;
+    uint32_t pendPassed;                        /* Instructions outside the focus since the last cycle count */
+
+    /* Linear runs (MTB) are only recorded by where they start and end, and counted into the exec entries later */
+    int64_t *runEdge;                           /* Per instruction, runs starting there less those that ended before it */
+    uint64_t *runStart;                         /* ...and just the runs starting there */
+    bool runsPending;                           /* Are there any runs that haven't been counted in yet? */
+
+    uint8_t *cov;                               /* Coverage (COV_xxx) of each instruction in the symbol table, if wanted */
+
+    /* Subroutine related info...a call stack for each context, and the one executing */
+    struct callContext *contexts;               /* Hashed by context ID */
+    struct callContext *ctx;
+
+    struct arenaBlock *arena;                   /* Where the exec records come from */
+    struct arenaBlock *callArena;               /* ...and the call records */
+    struct stackTree stacks;                    /* Costs by calling context, for the stack formats */
+
+    /* Timeline the calls go to as they happen, if there is one */
+    struct perfettoTrace *tl;
+    uint64_t tlCalls;                           /* ...the track for their slices */
+    uint64_t tlDepth;                           /* ...and the one for how deep they are */
+    uint64_t tlBase;                            /* ...instructions up to the start of this window */
+    struct timelineName *tlNames;               /* ...and what's been named in it so far */
+    pthread_mutex_t *tlLock;                    /* ...held while writing to it, when cores share it */
+    uint64_t tlStamp;                           /* ...and when the last trace for this core was captured */
+
+    /* With trace from several cores, each has a RunTime of its own fed from this one's processor */
+    struct RunTime *core[MAX_CORES];
+    int ncores;
+    uint8_t coreTag;                            /* For a core, the tag its trace is on */
+    struct dataBlock *fill;                     /* ...the block of it being filled */
+    pthread_t coreThread;                       /* ...and the thread decoding it */
+    pthread_mutex_t tlMutex;                    /* What the cores' timeline locks are */
 
     /* Stats about the run */
     int instCount;                              /* Number of instruction locations */
@@ -134,21 +269,38 @@ struct RunTime
 
     /* State of the target tracker */
     struct opConstruct op;                      /* The mechanical elements for creating the output buffer */
+    const struct TRACEEvent *ev;                /* Decoder event currently being processed */
+    uint32_t changes;                           /* Changes reported by the decoder and not yet acted on */
+
+    /* Statistical decode, where only windows of the trace are decoded, each starting at a sync point */
+    enum WinState winState;
+    uint32_t winLeft;                           /* Bytes left in the window or gap */
+    uint64_t winSeen;                           /* Bytes of trace seen */
+    uint64_t winDecoded;                        /* ...and how many of them were decoded */
 
     /* Subprocess control and interworking */
     pthread_t processThread;                    /* Thread handling received data flow */
-    pthread_cond_t dataForClients;              /* Semaphore counting data for clients */
-    pthread_mutex_t dataForClients_m;           /* Mutex for counting data for clients */
-
-    /* Ring buffer for samples ... this 'pads' the rate data arrive and how fast they can be processed */
-    int wp;                                     /* Read and write pointers into transfer buffers */
-    int rp;
-    struct dataBlock rawBlock[NUM_RAW_BLOCKS];  /* Transfer buffers from the receiver */
+    bool processing;                            /* ...set once it's running */
+    struct SymbolReload *reload;                /* Symbols being loaded in the background, while data queue up */
+    pthread_mutex_t kickLock;                   /* Lock protecting the kick flag */
+    pthread_cond_t kick;                        /* Signal that there are blocks to process */
+    bool kicked;                                /* ...and the flag that goes with it */
+
+    /* Single producer (receiver) single consumer (_processBlocks) queue of transfer buffers...this */
+    /* 'pads' the rate data arrive and how fast they can be processed.                              */
+    struct dataBlock *rawBlock;                 /* Transfer buffers from the receiver */
+    atomic_size_t wp;                           /* Write position, only changed by the receiver */
+    atomic_size_t rp;                           /* Read position, only changed by _processBlocks */
+    uint64_t droppedBlocks;                     /* Blocks thrown away because the queue was full */
+    uint64_t droppedBytes;                      /* ...and the data that were in them */
+    uint64_t reportedDropped;                   /* ...and how many of those we've told the user about */
+    uint32_t lastDropReport;                    /* Time of last drop report */
 
     /* State info */
     volatile bool ending;                       /* Flag indicating app is terminating */
     bool     sampling;                          /* Are we actively sampling at the moment */
     uint32_t starttime;                         /* At what time did we start sampling? */
+    uint32_t lastWrite;                         /* ...and when did we last write the output files (continuous mode) */
 
     /* Turn addresses into files and routines tags */
     uint32_t nameCount;
@@ -165,42 +317,288 @@ struct RunTime
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static void *_arenaAlloc( struct arenaBlock **arena, enum memSubsystem ms, size_t len )
+
+/* Get zeroed memory from an arena. It is only ever given back by freeing the whole arena */
+
+{
+    struct arenaBlock *b = *arena;
+    void *p;
+
+    len = ( len + 7 ) & ~7;
+
+    if ( ( !b ) || ( b->used + len > b->size ) )
+    {
+        size_t size = ( len > ARENA_BLOCK_SIZE ) ? len : ARENA_BLOCK_SIZE;
+
+        b = ( struct arenaBlock * )memCalloc( ms, 1, sizeof( struct arenaBlock ) + size );
+        MEMCHECK( b, NULL );
+        b->ms = ms;
+        b->size = size;
+        b->next = *arena;
+        *arena = b;
+    }
+
+    p = &b->d[b->used];
+    b->used += len;
+    return p;
+}
+// ====================================================================================================
+static void _arenaAdopt( struct arenaBlock **arena, struct arenaBlock **from )
+
+/* Take over all of the memory of another arena, behind the block we're currently allocating from */
+
+{
+    struct arenaBlock *t = *from;
+
+    if ( !t )
+    {
+        return;
+    }
+
+    while ( t->next )
+    {
+        t = t->next;
+    }
+
+    if ( *arena )
+    {
+        t->next = ( *arena )->next;
+        ( *arena )->next = *from;
+    }
+    else
+    {
+        *arena = *from;
+    }
+
+    *from = NULL;
+}
+// ====================================================================================================
+static void _arenaFree( struct arenaBlock **arena )
+
+{
+    struct arenaBlock *n;
+
+    while ( *arena )
+    {
+        n = ( *arena )->next;
+        memFree( ( *arena )->ms, *arena );
+        *arena = n;
+    }
+}
+// ====================================================================================================
+static inline uint64_t _now( struct RunTime *r )
+
+/* Instructions executed so far, which is what all the costs are measured in */
+
+{
+    return ( r->options->tProtocol == TRACE_PROT_MTB ) ? r->op.runInsns : r->ev->instCount;
+}
+// ====================================================================================================
+static void _timelineLock( struct RunTime *r )
+
+{
+    if ( r->tlLock )
+    {
+        pthread_mutex_lock( r->tlLock );
+    }
+}
+// ====================================================================================================
+static void _timelineUnlock( struct RunTime *r )
+
+{
+    if ( r->tlLock )
+    {
+        pthread_mutex_unlock( r->tlLock );
+    }
+}
+// ====================================================================================================
+static void _timelineCall( struct RunTime *r, uint32_t to )
+
+/* A call to to has just been made, name it the first time it's called */
+
+{
+    struct timelineName *n;
+    struct nameEntry ne;
+    char addr[16];
+
+    _timelineLock( r );
+    HASH_FIND_INT( r->tlNames, &to, n );
+
+    if ( !n )
+    {
+        n = ( struct timelineName * )calloc( 1, sizeof( struct timelineName ) );
+        MEMCHECKV( n );
+        n->addr = to;
+
+        if ( SymbolLookup( r->s, to, &ne ) )
+        {
+            n->iid = perfettoName( r->tl, SymbolFunction( r->s, ne.functionindex ) );
+        }
+        else
+        {
+            snprintf( addr, sizeof( addr ), "0x%08x", to );
+            n->iid = perfettoName( r->tl, addr );
+        }
+
+        HASH_ADD_INT( r->tlNames, addr, n );
+    }
+
+    perfettoBegin( r->tl, r->ctx->tlCalls, r->tlBase + _now( r ), n->iid );
+    perfettoCounter( r->tl, r->ctx->tlDepth, r->tlBase + _now( r ), r->ctx->substacklen );
+    _timelineUnlock( r );
+}
+// ====================================================================================================
+static void _timelineReturn( struct RunTime *r, struct callContext *c, uint64_t t )
+
+{
+    _timelineLock( r );
+    perfettoEnd( r->tl, c->tlCalls, t );
+    perfettoCounter( r->tl, c->tlDepth, t, c->substacklen );
+    _timelineUnlock( r );
+}
+// ====================================================================================================
+static void _timelineAlign( struct RunTime *r, uint64_t tstamp )
+
+/* Each core's timeline runs on its own instruction count, which says nothing about the others. Move   */
+/* it on to no earlier than when the trace before this was captured, so the cores line up with each */
+/* other (as closely as the capture times go). It's only ever moved forward, so it stays in order.  */
+
+{
+    uint64_t at = ( uint64_t )( tstamp * ( ( r->options->timelineMHz ) ? r->options->timelineMHz / 1000.0 : 1.0 ) );
+    uint64_t now = ( r->sampling ) ? _now( r ) : 0;
+
+    if ( at > r->tlBase + now )
+    {
+        r->tlBase = at - now;
+    }
+}
+// ====================================================================================================
+static void _switchContext( struct RunTime *r, uint32_t contextID )
+
+/* Another context is executing, so carry on with its calls from where they were left */
+
+{
+    bool stacks = ( r->options->stackfile ) || ( r->options->pproffile );
+    struct callContext *c;
+    char name[64];
+    char tag[16] = "";
+
+    HASH_FIND_INT( r->contexts, &contextID, c );
+
+    if ( !c )
+    {
+        c = ( struct callContext * )memCalloc( MEM_CALLS, 1, sizeof( struct callContext ) );
+        MEMCHECKV( c );
+        c->contextID = contextID;
+        c->at = ( stacks ) ? ext_ff_stackThread( &r->stacks, contextID ) : NULL;
+
+        if ( r->tl )
+        {
+            if ( !contextID )
+            {
+                /* Which is all there will be without an RTOS, so that gets the only tracks there are */
+                c->tlCalls = r->tlCalls;
+                c->tlDepth = r->tlDepth;
+            }
+            else
+            {
+                /* ...and with several cores, they each have their own contexts */
+                if ( r->coreTag )
+                {
+                    snprintf( tag, sizeof( tag ), "tag %d, ", r->coreTag );
+                }
+
+                _timelineLock( r );
+                snprintf( name, sizeof( name ), "Calls (%scontext 0x%08x)", tag, contextID );
+                c->tlCalls = perfettoTrack( r->tl, name );
+                snprintf( name, sizeof( name ), "Call depth (%scontext 0x%08x)", tag, contextID );
+                c->tlDepth = perfettoCounterTrack( r->tl, name );
+                _timelineUnlock( r );
+            }
+        }
+
+        HASH_ADD_INT( r->contexts, contextID, c );
+    }
+
+    if ( stacks )
+    {
+        if ( r->ctx )
+        {
+            r->ctx->at = r->stacks.at;
+        }
+
+        ext_ff_stackSwitch( &r->stacks, c->at, _now( r ) );
+    }
+
+    r->ctx = c;
+}
+// ====================================================================================================
+static void _freeContexts( struct RunTime *r )
+
+{
+    struct callContext *c, *ct;
+
+    HASH_ITER( hh, r->contexts, c, ct )
+    {
+        HASH_DEL( r->contexts, c );
+        memFree( MEM_CALLS, c->substack );
+        memFree( MEM_CALLS, c );
+    }
+
+    r->ctx = NULL;
+}
+// ====================================================================================================
 static void _callEvent( struct RunTime *r, uint32_t retAddr, uint32_t to )
 
 /* This is a call or a return, manipulate stack tracking appropriately */
 
 {
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
+    struct callContext *c = r->ctx;
     struct subcall *s;
 
-    /* ...add it to the call stack */
-    r->substack = ( struct _subcallAccount * )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct _subcallAccount ) );
+    /* ...add it to the call stack, which only has to grow if this is deeper than we've been before */
+    if ( c->substacklen == c->substackAlloc )
+    {
+        c->substackAlloc = ( c->substackAlloc ) ? c->substackAlloc * 2 : CALL_STACK_DEPTH;
+        c->substack = ( struct _subcallAccount * )memRealloc( MEM_CALLS, c->substack, c->substackAlloc * sizeof( struct _subcallAccount ) );
+        MEMCHECKV( c->substack );
+    }
+
+    if ( ( r->options->stackfile ) || ( r->options->pproffile ) )
+    {
+        ext_ff_stackCall( &r->stacks, to, _now( r ) );
+    }
 
     /* This is a call */
-    r->substack[r->substacklen].sig.src     = retAddr;
-    r->substack[r->substacklen].sig.dst     = to;
-    r->substack[r->substacklen].inTicks     = cpu->instCount;
+    c->substack[c->substacklen].sig.src     = retAddr;
+    c->substack[c->substacklen].sig.dst     = to;
+    c->substack[c->substacklen].inTicks     = _now( r );
 
     /* Find a record for this source/dest pair */
-    HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
+    HASH_FIND( hh, r->subhead, &c->substack[c->substacklen].sig, sizeof( struct subcallSig ), s );
 
     if ( !s )
     {
         /* This call entry doesn't exist (i.e. it's the first time this from/to pair have been seen...let's create it */
-        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
-        MEMCHECKV( s );
-        memcpy( &s->sig, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ) );
+        s = ( struct subcall * )_arenaAlloc( &r->callArena, MEM_CALLS, sizeof( struct subcall ) );
+        memcpy( &s->sig, &c->substack[c->substacklen].sig, sizeof( struct subcallSig ) );
         HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
     }
 
-    r->substacklen++;
+    c->substacklen++;
+
+    if ( r->tl )
+    {
+        _timelineCall( r, to );
+    }
 
-    for ( uint32_t g = 0; g < r->substacklen; g++ )
+    for ( uint32_t g = 0; g < c->substacklen; g++ )
     {
         putchar( ' ' );
     }
 
-    DBG_OUT( "INC:%3d %08x -> %08x" EOL, r->substacklen, retAddr, to );
+    DBG_OUT( "INC:%3d %08x -> %08x" EOL, c->substacklen, retAddr, to );
 }
 // ====================================================================================================
 static void _returnEvent( struct RunTime *r, uint32_t to )
@@ -208,12 +606,12 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
 /* This is a return, manipulate stack tracking appropriately */
 
 {
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
+    struct callContext *c = r->ctx;
     struct subcall *s;
-    uint32_t orig = r->substacklen;
+    uint32_t orig = c->substacklen;
 
     /* Cover the startup case that we happen to hit a return before a call */
-    if ( !r->substack )
+    if ( !c->substack )
     {
         return;
     }
@@ -221,618 +619,2168 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
     /* Check we've got a valid stack entry to match to */
     do
     {
-        if ( !r->substacklen )
+        if ( !c->substacklen )
         {
             DBG_OUT( "OUT OUT OF STACK ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^" EOL );
             break;
         }
 
         /* The -1th entry was the last written, so see if that is back far enough */
-        r->substacklen--;
+        c->substacklen--;
 
-        for ( uint32_t g = 0; g < r->substacklen + 1; g++ )
+        if ( r->tl )
+        {
+            _timelineReturn( r, c, r->tlBase + _now( r ) );
+        }
+
+        if ( ( r->options->stackfile ) || ( r->options->pproffile ) )
+        {
+            ext_ff_stackReturn( &r->stacks, _now( r ) );
+        }
+
+        for ( uint32_t g = 0; g < c->substacklen + 1; g++ )
         {
             putchar( ' ' );
         }
 
-        DBG_OUT( " DEC:%3d %08x " EOL, r->substacklen + 1, r->substack[r->substacklen].sig.src );
-        HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
+        DBG_OUT( " DEC:%3d %08x " EOL, c->substacklen + 1, c->substack[c->substacklen].sig.src );
+        HASH_FIND( hh, r->subhead, &c->substack[c->substacklen].sig, sizeof( struct subcallSig ), s );
         assert( s );
 
         /* We don't bother deallocating memory here cos it'll be done the next time we make a call */
-        s->myCost += cpu->instCount - r->substack[r->substacklen].inTicks;
+        s->myCost += _now( r ) - c->substack[c->substacklen].inTicks;
         s->count++;
     }
-    while ( to != r->substack[r->substacklen].sig.src );
+    while ( to != c->substack[c->substacklen].sig.src );
 
     /* Check function we popped back to matches where we think we should be */
-    if ( to != r->substack[r->substacklen].sig.src )
+    if ( to != c->substack[c->substacklen].sig.src )
     {
         for ( uint32_t ty = 0; ty < orig; ty++ )
         {
-            DBG_OUT( "%d:%08X ", ty, r->substack[ty].sig.src );
+            DBG_OUT( "%d:%08X ", ty, c->substack[ty].sig.src );
         }
 
-        DBG_OUT( "(wanted %08x, got %08x)" EOL, to, r->substack[r->substacklen].sig.src );
+        DBG_OUT( "(wanted %08x, got %08x)" EOL, to, c->substack[c->substacklen].sig.src );
     }
 }
 // ====================================================================================================
-static void _hashFindOrCreate( struct RunTime *r, uint32_t addr, struct execEntryHash **h )
+static void _coverInit( struct RunTime *r )
+
+/* Start a coverage map for the symbols we have, if coverage is being collected */
+
 {
-    struct nameEntry n;
+    if ( ( r->options->covfile ) || ( r->options->lcovfile ) )
+    {
+        memFree( MEM_ADDRESSES, r->cov );
+        r->cov = ( uint8_t * )memCalloc( MEM_ADDRESSES, r->s->insnCount + 1, sizeof( uint8_t ) );
+        MEMCHECKV( r->cov );
+    }
+}
+// ====================================================================================================
+static int _focusLookup( struct addrFilter *f, const char *name, void *ctx )
 
-    HASH_FIND_INT( r->insthead, &addr, *h );
+/* Find the functions with this name, there can be several statics with the same one */
 
-    if ( !( *h ) )
+{
+    struct SymbolSet *s = ( struct SymbolSet * )ctx;
+    int found = 0;
+
+    for ( uint32_t i = 1; i < s->functionCount; i++ )
     {
-        /* We don't have this address captured yet, do it now */
-        if ( SymbolLookup( r->s, r->op.workingAddr, &n ) )
-        {
-            if ( n.assyLine == ASSY_NOT_FOUND )
-            {
-                genericsExit( -1, "No assembly for function at address %08x, %s" EOL, r->op.workingAddr, SymbolFunction( r->s, n.functionindex ) );
-            }
+        struct functionEntry *fe = &s->functions[i];
 
-            *h = calloc( 1, sizeof( struct execEntryHash ) );
-            MEMCHECKV( *h );
-
-            ( *h )->addr          = r->op.workingAddr;
-            ( *h )->fileindex     = n.fileindex;
-            ( *h )->line          = n.line;
-            ( *h )->functionindex = n.functionindex;
-            ( *h )->isJump        = n.assy[n.assyLine].isJump;
-            ( *h )->isSubCall     = n.assy[n.assyLine].isSubCall;
-            ( *h )->isReturn      = n.assy[n.assyLine].isReturn;
-            ( *h )->jumpdest      = n.assy[n.assyLine].jumpdest;
-            ( *h )->is4Byte       = n.assy[n.assyLine].is4Byte;
-            ( *h )->codes         = n.assy[n.assyLine].codes;
-            ( *h )->assyText      = n.assy[n.assyLine].lineText;
-        }
-        else
+        if ( ( ( fe->name ) && ( !strcmp( fe->name, name ) ) ) || ( ( fe->mangled ) && ( !strcmp( fe->mangled, name ) ) ) )
         {
-            genericsExit( -1, "No symbol for address %08x" EOL, r->op.workingAddr );
+            addrFilterAddRange( f, fe->startAddr, fe->endAddr );
+            found++;
         }
-
-        HASH_ADD_INT( r->insthead, addr, ( *h ) );
     }
+
+    return found;
 }
 // ====================================================================================================
-static void _handleInstruction( struct RunTime *r, bool actioned )
+static void _focusInit( struct RunTime *r )
+
+/* Flag the instructions that are of interest, once there are symbols to say where everything is */
 
 {
-    /* ------------------------------------------------------------------------------------*/
-    /* First Stage: Individual address visit accounting.                                   */
-    /* Let's find the local hash record for this address, or create it if it doesn't exist */
-    /* ------------------------------------------------------------------------------------*/
+    if ( !addrFilterActive( &r->options->focus ) )
+    {
+        return;
+    }
 
-    r->op.oldh = r->op.h;
-    _hashFindOrCreate( r, r->op.workingAddr, &r->op.h );
+    if ( !addrFilterResolve( &r->options->focus, _focusLookup, r->s ) )
+    {
+        genericsExit( -1, "Couldn't set up the focus" EOL );
+    }
 
-    //    if ( r->op.oldh ) DBG_OUT( "%4d,%4d %4d %s%s%c %s", r->op.h->functionindex, ( r->op.h ? r->op.oldh->functionindex : 0 ),  r->op.h->fileindex,
-    //                               ( r->op.h->isJump ) ? "J" : " ", ( r->op.h->isSubCall ) ? "S" : r->op.h->isReturn ? "R" : " ", ( actioned ) ? ( r->op.h->is4Byte ? 'X' : 'x' ) : '-',
-    //                               r->op.h->assyText );
+    memFree( MEM_ADDRESSES, r->options->focusInsn );
+    r->options->focusInsn = ( uint8_t * )memAlloc( MEM_ADDRESSES, r->s->insnCount + 1 );
+    MEMCHECKV( r->options->focusInsn );
+
+    for ( uint32_t i = 0; i < r->s->insnCount; i++ )
+    {
+        r->options->focusInsn[i] = addrFilterHas( &r->options->focus, r->s->insns[i].assy->addr );
+    }
+}
+// ====================================================================================================
+static inline bool _inFocus( struct RunTime *r, uint32_t i )
 
-    /* OK, by hook or by crook we've got an address entry now, so increment the number of executions */
-    r->op.h->count++;
+{
+    return ( !r->options->focusInsn ) || ( r->options->focusInsn[i] );
+}
+// ====================================================================================================
+static inline void _cover( struct RunTime *r, uint32_t i, uint8_t how )
 
-    /* If source postion changed then update source code line visitation counts too */
-    if ( ( r->op.oldh ) && ( ( r->op.h->line != r->op.oldh->line ) || ( r->op.h->functionindex != r->op.oldh->functionindex ) ) )
+{
+    if ( ( r->cov ) && ( _inFocus( r, i ) ) )
     {
-        r->op.h->scount++;
+        r->cov[i] |= how;
     }
+}
+// ====================================================================================================
+static struct execEntryHash *_execEntry( struct RunTime *r, uint32_t i )
+
+/* Return the exec entry for instruction i in the symbol table, creating it if this is the first visit */
+
+{
+    const struct symbolInsn *in;
+    struct execEntryHash *h;
 
-    /* If this is a computable destination then action it */
-    if ( ( actioned ) && ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) ) )
+    if ( !r->exec )
     {
-        /* Take this call ... note that the jumpdest may not be known at this point */
-        r->op.workingAddr = r->op.h->jumpdest;
+        r->exec = ( struct execEntryHash ** )memCalloc( MEM_ADDRESSES, r->s->insnCount, sizeof( struct execEntryHash * ) );
+        MEMCHECK( r->exec, NULL );
+        r->cost = ( struct insnCost * )memCalloc( MEM_ADDRESSES, r->s->insnCount, sizeof( struct insnCost ) );
+        MEMCHECK( r->cost, NULL );
     }
-    else
+
+    if ( !r->exec[i] )
     {
-        /* If it wasn't a jump or subroutine then increment the address */
-        r->op.workingAddr += ( r->op.h->is4Byte ) ? 4 : 2;
+        /* We don't have this address captured yet, do it now */
+        in = &r->s->insns[i];
+        h = r->exec[i] = ( struct execEntryHash * )_arenaAlloc( &r->arena, MEM_ADDRESSES, sizeof( struct execEntryHash ) );
+
+        h->addr          = in->assy->addr;
+        h->fileindex     = r->s->sources[in->sourceIdx].fileIdx;
+        h->line          = r->s->sources[in->sourceIdx].lineNo;
+        h->functionindex = r->s->sources[in->sourceIdx].functionIdx;
+        h->isJump        = in->assy->isJump;
+        h->isSubCall     = in->assy->isSubCall;
+        h->isReturn      = in->assy->isReturn;
+        h->jumpdest      = in->assy->jumpdest;
+        h->is4Byte       = in->assy->is4Byte;
+        h->codes         = in->assy->codes;
+        h->assyText      = in->assy->lineText;
+        HASH_ADD_INT( r->insthead, addr, h );
     }
-}
 
+    return r->exec[i];
+}
 // ====================================================================================================
-static void _checkJumps( struct RunTime *r )
+static uint32_t _insnAt( struct RunTime *r, uint32_t addr )
+
+/* Find the instruction at an address, and make it the current one. Most of the time this is just the */
+/* next instruction on from the last one, so that's checked before searching for it.                 */
 
 {
-    if ( r->op.h )
-    {
+    uint32_t i = r->op.insn + 1;
 
-        if ( ( TRACEStateChanged( &r->i, EV_CH_EX_EXIT ) ) || ( r->op.h->isReturn ) )
-        {
-            _returnEvent( r, r->op.workingAddr );
-        }
+    if ( ( i >= r->s->insnCount ) || ( r->s->insns[i].assy->addr != addr ) )
+    {
+        i = SymbolInsnIndex( r->s, addr );
 
-        if ( r->op.h->isSubCall )
+        if ( NO_INSN == i )
         {
-            _callEvent( r, r->op.h->addr + ( ( r->op.h->is4Byte ) ? 4 : 2 ), r->op.workingAddr );
+            genericsExit( -1, "No assembly for address %08x" EOL, addr );
         }
     }
+
+    r->op.insn = i;
+    return i;
 }
 // ====================================================================================================
-static void _traceCB( void *d )
+static struct execEntryHash *_passAt( struct RunTime *r, uint32_t i )
 
-/* Callback function for when valid TRACE decode is detected */
+/* Follow the flow through an instruction outside the focus. Only where it goes matters, so it isn't */
+/* counted or looked up in the source, and none of it comes out in the results.                     */
 
 {
-    struct RunTime *r       = ( struct RunTime * )d;
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
-    static uint32_t incAddr        = 0;
-    static uint32_t disposition    = 0;
+    const struct assyLineEntry *a = r->s->insns[i].assy;
+    struct execEntryHash *h = &r->op.pass;
+
+    h->addr          = a->addr;
+    h->isJump        = a->isJump;
+    h->isSubCall     = a->isSubCall;
+    h->isReturn      = a->isReturn;
+    h->jumpdest      = a->jumpdest;
+    h->is4Byte       = a->is4Byte;
+    h->fileindex     = NO_LINE;
+    h->functionindex = NO_LINE;
+    h->line          = NO_LINE;
+    return h;
+}
+// ====================================================================================================
+static void _handleRun( struct RunTime *r, uint32_t from, uint32_t to )
 
-    /* This routine gets called when valid data are available */
-    /* if these are the first data, then reset counters etc.  */
-    if ( !r->sampling )
+/* Account for a linear run (MTB), where everything from one address to another was executed. The run is walked */
+/* a basic block at a time and only its ends are recorded, so it costs the same however long it is. The number */
+/* of instructions in it is just the difference in their indexes in the symbol table.                          */
+
+{
+    struct execEntryHash *h;
+    uint32_t i = SymbolInsnIndex( r->s, from );
+    uint32_t last = SymbolInsnIndex( r->s, to );
+    uint32_t e;
+
+    if ( ( NO_INSN == i ) || ( NO_INSN == last ) || ( last < i ) )
     {
-        r->op.firsttstamp = cpu->instCount;
-        genericsReport( V_INFO, "Sampling" EOL );
-        /* Fill in a time to start from */
-        r->starttime = genericsTimestampmS();
+        genericsReportRateLimited( V_WARN, "No linear run from %08x to %08x" EOL, from, to );
+        r->op.h = NULL;
+        return;
+    }
 
-        if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+    /* Any change of flow ends a block, and only untaken jumps can be inside a run. Anything else means it was cut short */
+    for ( e = r->s->insns[i].blockEnd; e < last; e = r->s->insns[e + 1].blockEnd )
+    {
+        const struct assyLineEntry *a = r->s->insns[e].assy;
+
+        if ( ( !a->isJump ) || ( a->isSubCall ) || ( a->isReturn ) )
         {
-            r->op.workingAddr = cpu->addr;
-            DBG_OUT( "Got initial address %08x" EOL, r->op.workingAddr );
-            r->sampling  = true;
+            last = e;
+            break;
         }
 
-        /* Create false entry for an interrupt source */
-        r->op.inth = calloc( 1, sizeof( struct execEntryHash ) );
+        _cover( r, e, COV_NOT_TAKEN );
+    }
 
-        MEMCHECKV( r->op.inth );
-        r->op.inth->addr          = INTERRUPT;
-        r->op.inth->fileindex     = INTERRUPT;
-        r->op.inth->line          = NO_LINE;
-        r->op.inth->count         = NO_LINE;
-        r->op.inth->functionindex = INTERRUPT;
-        HASH_ADD_INT( r->insthead, addr, r->op.inth );
+    /* ...whereas the one it finished on went somewhere else */
+    if ( r->s->insns[last].assy->isJump )
+    {
+        _cover( r, last, COV_TAKEN );
     }
 
-    r->op.lasttstamp = cpu->instCount;
+    if ( !r->runEdge )
+    {
+        r->runEdge  = ( int64_t * )memCalloc( MEM_ADDRESSES, r->s->insnCount + 1, sizeof( int64_t ) );
+        MEMCHECKV( r->runEdge );
+        r->runStart = ( uint64_t * )memCalloc( MEM_ADDRESSES, r->s->insnCount, sizeof( uint64_t ) );
+        MEMCHECKV( r->runStart );
+    }
 
-    /* Pull changes introduced by this event ============================== */
+    r->runEdge[i]++;
+    r->runEdge[last + 1]--;
+    r->runStart[i]++;
+    r->runsPending = true;
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ENATOMS ) )
+    /* Where the run joins on to the last one is the only source line change that depends on the path taken */
+    if ( _inFocus( r, i ) )
     {
-        /* We are going to execute some instructions. Check if the last of the old batch of    */
-        /* instructions was cancelled and, if it wasn't and it's still outstanding, action it. */
-        if ( TRACEStateChanged( &r->i, EV_CH_CANCELLED ) )
+        h = _execEntry( r, i );
+
+        if ( ( r->op.h ) && ( ( h->line != r->op.h->line ) || ( h->functionindex != r->op.h->functionindex ) ) )
         {
-            DBG_OUT( "CANCELLED" EOL );
+            h->scount++;
         }
-        else
-        {
-            if ( incAddr )
-            {
-                DBG_OUT( "***" EOL );
-                _handleInstruction( r, disposition & 1 );
+    }
 
-                if ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) || ( r->op.h->isReturn ) )
-                {
-                    if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
-                    {
-                        DBG_OUT( "New addr %08x" EOL, cpu->addr );
-                        r->op.workingAddr = cpu->addr;
-                    }
+    r->op.runInsns += last - i + 1;
+    r->op.insn = last;
+    r->op.oldh = r->op.h;
+    r->op.h = ( _inFocus( r, last ) ) ? _execEntry( r, last ) : _passAt( r, last );
+}
+// ====================================================================================================
+static void _flushRuns( struct RunTime *r )
 
-                    _checkJumps( r );
-                }
-            }
-        }
+/* Count the linear runs recorded so far into the exec entries of the instructions they covered */
 
-        if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
-        {
-            if ( TRACEStateChanged( &r->i, EV_CH_EX_ENTRY ) )
-            {
-                DBG_OUT( "INTERRUPT!!" EOL );
-                _callEvent( r, r->op.workingAddr, cpu->addr );
-            }
+{
+    const struct sourceLineEntry *src, *prevsrc = NULL;
+    struct execEntryHash *h;
+    int64_t cover = 0;
 
-            r->op.workingAddr = cpu->addr;
-            DBG_OUT( "A:%08x" EOL, cpu->addr );
-        }
+    if ( !r->runsPending )
+    {
+        return;
+    }
 
-        /* ================================================ */
-        /* OK, now collect the next iterations worth of fun */
-        /* ================================================ */
-        incAddr     = cpu->eatoms + cpu->natoms;
-        disposition = cpu->disposition;
-        DBG_OUT( "E:%d N:%d" EOL, cpu->eatoms, cpu->natoms );
+    for ( uint32_t k = 0; k < r->s->insnCount; k++, prevsrc = src )
+    {
+        src = &r->s->sources[r->s->insns[k].sourceIdx];
+        cover += r->runEdge[k];
 
-        /* Action those changes, except the last one */
-        while ( incAddr > 1 )
+        if ( ( cover ) && ( _inFocus( r, k ) ) )
         {
-            incAddr--;
-            _handleInstruction( r, disposition & 1 );
-            _checkJumps( r );
-            disposition >>= 1;
+            h = _execEntry( r, k );
+            h->count += cover;
+            _cover( r, k, COV_EXECUTED );
+
+            /* Inside a run, a line is visited each time the one before it was on a different line */
+            if ( ( prevsrc ) && ( ( src->lineNo != prevsrc->lineNo ) || ( src->functionIdx != prevsrc->functionIdx ) ) )
+            {
+                h->scount += cover - r->runStart[k];
+            }
         }
     }
+
+    memset( r->runEdge, 0, ( r->s->insnCount + 1 ) * sizeof( int64_t ) );
+    memset( r->runStart, 0, r->s->insnCount * sizeof( uint64_t ) );
+    r->runsPending = false;
 }
+// ====================================================================================================
+static void _flushCosts( struct RunTime *r )
+
+/* Fold the instruction and cycle counts into the exec entries, for output */
+
+{
+    if ( !r->costsPending )
+    {
+        return;
+    }
 
+    for ( uint32_t k = 0; k < r->s->insnCount; k++ )
+    {
+        if ( ( r->cost[k].count ) || ( r->cost[k].cycles ) )
+        {
+            r->exec[k]->count  += r->cost[k].count;
+            r->exec[k]->cycles += r->cost[k].cycles;
+        }
+    }
+
+    memset( r->cost, 0, r->s->insnCount * sizeof( struct insnCost ) );
+    r->costsPending = false;
+}
 // ====================================================================================================
-static void _printHelp( const char *const progName )
+static void _cycleCount( struct RunTime *r, const struct TRACEEvent *ev )
+
+/* A cycle count has arrived, so share the cycles since the last one between the instructions executed */
+/* since then. They all get the same, with whatever doesn't divide evenly going to the last of them.    */
 
 {
-    genericsPrintf( "Usage: %s [options]" EOL, progName );
-    genericsPrintf( "    -A, --alt-addr-enc: Switch off alternate address decoding (on by default)" EOL );
-    genericsPrintf( "    -D, --no-demangle:  Switch off C++ symbol demangling" EOL );
-    genericsPrintf( "    -d, --del-prefix:   <String> Material to delete off front of filenames" EOL );
-    genericsPrintf( "    -e, --elf-file:     <ElfFile> to use for symbols" EOL );
-    genericsPrintf( "    -E, --eof:          When reading from file, terminate at EOF" EOL );
-    genericsPrintf( "    -f, --input-file:   Take input from specified file" EOL );
-    genericsPrintf( "    -h, --help:         This help" EOL );
-    genericsPrintf( "    -I, --interval:     <Interval> Time between samples (in ms)" EOL );
-    genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
-    genericsPrintf( "    -O, --objdump-opts: <options> Options to pass directly to objdump" EOL );
-    genericsPrintf( "    -P, --trace-proto:  {ETM35|MTB} trace protocol to use, default is ETM35" EOL );
-    genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise raw ETM" EOL );
-    genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
-    genericsPrintf( "    -t, --tag:          <stream>: Which OFLOW tag to use (normally 2)" EOL );
-    genericsPrintf( "    -T, --all-truncate: truncate -d material off all references (i.e. make output relative)" EOL );
-    genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
-    genericsPrintf( "    -V, --version:      Print version and exit" EOL );
-    genericsPrintf( "    -y, --graph-file:   <Filename> dotty filename for structured callgraph output" EOL );
-    genericsPrintf( "    -z, --cache-file:   <Filename> profile filename for kcachegrind output" EOL );
-    genericsPrintf( EOL "(Will connect one port higher than that set in -s when Orbflow is not used)" EOL );
+    uint64_t n;
+
+    if ( ev->cycleCount == COUNT_UNKNOWN )
+    {
+        /* Nothing to measure from, so wait for the next one */
+        r->op.lastCycles = COUNT_UNKNOWN;
+        r->pendLen = 0;
+        return;
+    }
+
+    if ( r->options->tProtocol == TRACE_PROT_ETM4 )
+    {
+        n = ( ( r->cyclesSeen ) && ( r->op.lastCycles != COUNT_UNKNOWN ) ) ? ev->cycleCount - r->op.lastCycles : 0;
+        r->op.lastCycles = ev->cycleCount;
+    }
+    else
+    {
+        /* ETM3.5 counts are since the last one */
+        n = ev->cycleCount;
+    }
+
+    r->cyclesSeen = true;
+
+    if ( r->pendLen )
+    {
+        /* Instructions outside the focus had their share too, it just isn't kept */
+        uint64_t each = n / ( r->pendLen + r->pendPassed );
+
+        for ( uint32_t i = 0; i < r->pendLen; i++ )
+        {
+            r->cost[r->pend[i]].cycles += each;
+        }
+
+        if ( !r->pendPassed )
+        {
+            r->cost[r->pend[r->pendLen - 1]].cycles += n % r->pendLen;
+        }
+
+        r->costsPending = true;
+    }
+
+    r->pendLen = r->pendPassed = 0;
 }
 // ====================================================================================================
-void _printVersion( void )
+static struct execEntryHash *_callEnd( struct RunTime *r, uint32_t addr )
+
+/* Find the exec entry for one end of a call, which is the interrupt entry if it isn't in the program */
 
 {
-    genericsPrintf( "orbprofile version " GIT_DESCRIBE );
+    struct execEntryHash *h;
+    uint32_t i;
+
+    HASH_FIND_INT( r->insthead, &addr, h );
+
+    if ( !h )
+    {
+        if ( NO_INSN != ( i = SymbolInsnIndex( r->s, addr ) ) )
+        {
+            return _execEntry( r, i );
+        }
+
+        /* Not in the program, so it's the interrupt entry (r->op doesn't have it after a parallel merge) */
+        addr = INTERRUPT;
+        HASH_FIND_INT( r->insthead, &addr, h );
+    }
+
+    return h;
 }
 // ====================================================================================================
-static struct option _longOptions[] =
+static void _linkCalls( struct RunTime *r )
+
+/* The output routines need to know the source and destination records for every call */
+
 {
-    {"alt-addr-enc", no_argument, NULL, 'A'},
-    {"no-demangle", required_argument, NULL, 'D'},
-    {"del-prefix", required_argument, NULL, 'd'},
-    {"elf-file", required_argument, NULL, 'e'},
-    {"eof", no_argument, NULL, 'E'},
-    {"input-file", required_argument, NULL, 'f'},
-    {"help", no_argument, NULL, 'h'},
-    {"interval", required_argument, NULL, 'I'},
-    {"no-colour", no_argument, NULL, 'M'},
-    {"no-color", no_argument, NULL, 'M'},
-    {"objdump-opts", required_argument, NULL, 'O'},
-    {"trace-proto", required_argument, NULL, 'P'},
-    {"protocol", required_argument, NULL, 'p'},
-    {"server", required_argument, NULL, 's'},
-    {"all-truncate", no_argument, NULL, 'T'},
-    {"tag", required_argument, NULL, 't'},
-    {"verbose", required_argument, NULL, 'v'},
-    {"version", no_argument, NULL, 'V'},
-    {"graph-file", required_argument, NULL, 'y'},
-    {"cache-file", required_argument, NULL, 'z'},
-    {NULL, no_argument, NULL, 0}
-};
+    for ( struct subcall *s = r->subhead; s; s = s->hh.next )
+    {
+        s->srch = _callEnd( r, s->sig.src );
+        s->dsth = _callEnd( r, s->sig.dst );
+    }
+}
 // ====================================================================================================
-static bool _processOptions( int argc, char *argv[], struct RunTime *r )
+static void _outputResults( struct RunTime *r )
+
+/* Write out whichever of the dot and profile files were asked for */
 
 {
-    int c, optionIndex = 0;
-    bool protExplicit = false;
-    bool serverExplicit = false;
+    double scale = 1.0;
+    char memLine[160];
 
-    while ( ( c = getopt_long ( argc, argv, "ADd:e:Ef:hVI:MO:P:p:s:t:Tv:y:z:", _longOptions, &optionIndex ) ) != -1 )
+    _flushRuns( r );
+    _flushCosts( r );
+    _linkCalls( r );
 
-        switch ( c )
-        {
-            // ------------------------------------
-            case 'A':
-                r->options->noaltAddr = true;
-                break;
+    if ( memReport( memLine, sizeof( memLine ) ) )
+    {
+        genericsReport( V_INFO, "Memory: %s" EOL, memLine );
+    }
 
-            // ------------------------------------
-            case 'd':
-                r->options->deleteMaterial = optarg;
-                break;
+    /* Only some of the trace was decoded in statistical mode, so scale up to what all of it would have given */
+    if ( ( r->options->winPeriod ) && ( r->winDecoded ) )
+    {
+        scale = ( double )r->winSeen / r->winDecoded;
+        ext_ff_scaleCounts( r->insthead, r->subhead, scale );
+        ext_ff_stackScale( &r->stacks, scale );
+    }
 
-            // ------------------------------------
-            case 'D':
-                r->options->demangle = false;
-                break;
+    if ( ext_ff_outputDot( r->options->dotfile, r->subhead, r->s ) )
+    {
+        genericsReport( V_INFO, "Output DOT" EOL );
+    }
+    else
+    {
+        if ( r->options->dotfile )
+        {
+            genericsExit( -1, "Failed to output DOT" EOL );
+        }
+    }
 
-            // ------------------------------------
-            case 'E':
-                r->options->fileTerminate = true;
-                break;
+    if ( ext_ff_outputProfile( r->options->profile, r->options->elffile,
+                               r->options->truncateDeleteMaterial ? r->options->deleteMaterial : NULL,
+                               true, r->cyclesSeen,
+                               ( uint64_t )( ( r->op.elapsed + r->op.lasttstamp - r->op.firsttstamp ) * scale ),
+                               r->insthead,
+                               r->subhead,
+                               r->s ) )
+    {
+        genericsReport( V_INFO, "Output Profile" EOL );
+    }
+    else
+    {
+        if ( r->options->profile )
+        {
+            genericsExit( -1, "Failed to output profile" EOL );
+        }
+    }
 
-            // ------------------------------------
-            case 'e':
-                r->options->elffile = optarg;
-                break;
+    if ( ( r->options->stackfile ) && ( !ext_ff_outputFolded( r->options->stackfile, &r->stacks, r->s ) ) )
+    {
+        genericsExit( -1, "Failed to output folded stacks" EOL );
+    }
 
-            // ------------------------------------
-            case 'f':
-                r->options->file = optarg;
-                break;
+    if ( ( r->options->pproffile ) && ( !ext_ff_outputPprof( r->options->pproffile, "instructions", "count", &r->stacks, r->s ) ) )
+    {
+        genericsExit( -1, "Failed to output pprof" EOL );
+    }
 
-            // ------------------------------------
-            case 'h':
-                _printHelp( r->progName );
-                exit( 0 );
+    if ( ( r->options->covfile ) && ( !ext_ff_outputCoverage( r->options->covfile, r->cov, r->s ) ) )
+    {
+        genericsExit( -1, "Failed to output coverage map" EOL );
+    }
 
-            // ------------------------------------
+    if ( ext_ff_outputLcov( r->options->lcovfile, r->options->truncateDeleteMaterial ? NULL : r->options->deleteMaterial, r->cov, r->s ) )
+    {
+        genericsReport( V_INFO, "Output lcov" EOL );
+    }
+    else
+    {
+        if ( r->options->lcovfile )
+        {
+            genericsExit( -1, "Failed to output lcov" EOL );
+        }
+    }
+}
+// ====================================================================================================
+static void _checkContinuous( struct RunTime *r )
 
-            case 'M':
-                r->options->mono = true;
-                break;
+/* In continuous mode write out what has happened since the last output, once its interval is up */
 
-            // ------------------------------------
-            case 'V':
-                _printVersion();
-                return false;
+{
+    if ( ( !r->options->continuous ) || ( !r->sampling ) || ( !HASH_COUNT( r->subhead ) ) ||
+            ( genericsTimestampmS() - r->lastWrite < r->options->continuous * 1000 ) )
+    {
+        return;
+    }
 
-            // ------------------------------------
-            case 'I':
-                r->options->sampleDuration = atoi( optarg );
-                break;
+    _outputResults( r );
 
-            // ------------------------------------
+    /* ...and start counting again from here, without disturbing the trace tracking */
+    ext_ff_zeroCounts( r->insthead, r->subhead );
+    ext_ff_stackZero( &r->stacks );
+    r->op.firsttstamp = r->op.lasttstamp;
+    r->op.elapsed = 0;
+    r->winSeen = r->winDecoded = 0;
+    r->lastWrite = genericsTimestampmS();
+}
+// ====================================================================================================
+static void _handleInstruction( struct RunTime *r, bool actioned )
 
-            case 'O':
-                r->options->odoptions = optarg;
-                break;
+/* Account for an atom. For ETM4 an atom covers a whole basic block, up to the change of flow at the end */
+/* of it (which is what actioned refers to). For everything else it's a single instruction.            */
 
-            // ------------------------------------
+{
+    bool wholeBlock = ( r->options->tProtocol == TRACE_PROT_ETM4 );
 
-            case 'P':
+    do
+    {
+        /* ------------------------------------------------------------------------------------*/
+        /* First Stage: Individual address visit accounting.                                   */
+        /* Let's find the local record for this address, or create it if it doesn't exist     */
+        /* ------------------------------------------------------------------------------------*/
 
-                /* Index through protocol strings looking for match or end of list */
-                for ( r->options->tProtocol = TRACE_PROT_LIST_START;
-                        ( ( r->options->tProtocol != TRACE_PROT_LIST_END ) && strcasecmp( optarg, TRACEDecodeGetProtocolName( r->options->tProtocol ) ) );
-                        r->options->tProtocol++ )
-                {}
+        r->op.oldh = r->op.h;
+        _insnAt( r, r->op.workingAddr );
 
-                break;
+        if ( !_inFocus( r, r->op.insn ) )
+        {
+            /* Outside the focus only where the flow goes matters, so a whole block can go in one step */
+            uint32_t last = ( wholeBlock ) ? r->s->insns[r->op.insn].blockEnd : r->op.insn;
 
-            // ------------------------------------
+            if ( r->cyclesSeen )
+            {
+                r->pendPassed += last - r->op.insn + 1;
+            }
 
-            case 'p':
-                r->options->protocol = PROT_UNKNOWN;
-                protExplicit = true;
+            r->op.insn = last;
+            r->op.h = _passAt( r, last );
+        }
+        else
+        {
+            r->op.h = _execEntry( r, r->op.insn );
 
-                for ( int i = 0; protString[i]; i++ )
+            /* OK, by hook or by crook we've got an address entry now, so increment the number of executions */
+            r->cost[r->op.insn].count++;
+            r->costsPending = true;
+
+            /* ...and if there are cycle counts it waits for its share of the next one */
+            if ( r->cyclesSeen )
+            {
+                if ( r->pendLen == r->pendAlloc )
                 {
-                    if ( !strcmp( protString[i], optarg ) )
+                    if ( r->pendAlloc == CYCLE_PENDING_MAX )
                     {
-                        r->options->protocol = i;
-                        break;
+                        r->pendLen = 0;
+                    }
+                    else
+                    {
+                        r->pendAlloc = ( r->pendAlloc ) ? r->pendAlloc * 2 : EVENT_BATCH;
+                        r->pend = ( uint32_t * )memRealloc( MEM_ADDRESSES, r->pend, r->pendAlloc * sizeof( uint32_t ) );
+                        MEMCHECKV( r->pend );
                     }
                 }
 
-                if ( r->options->protocol == PROT_UNKNOWN )
-                {
-                    genericsReport( V_ERROR, "Unrecognised protocol type" EOL );
-                    return false;
-                }
+                r->pend[r->pendLen++] = r->op.insn;
+            }
+            _cover( r, r->op.insn, COV_EXECUTED | ( ( r->op.h->isJump ) ? ( ( actioned ) ? COV_TAKEN : COV_NOT_TAKEN ) : 0 ) );
 
-                break;
+            /* If source postion changed then update source code line visitation counts too */
+            if ( ( r->op.oldh ) && ( ( r->op.h->line != r->op.oldh->line ) || ( r->op.h->functionindex != r->op.oldh->functionindex ) ) )
+            {
+                r->op.h->scount++;
+            }
+        }
 
-            // ------------------------------------
-            case 's':
-                r->options->server = optarg;
-                serverExplicit = true;
+        /* If this is a computable destination then action it */
+        if ( ( actioned ) && ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) ) )
+        {
+            /* Take this call ... note that the jumpdest may not be known at this point */
+            r->op.workingAddr = r->op.h->jumpdest;
+        }
+        else
+        {
+            /* If it wasn't a jump or subroutine then increment the address */
+            r->op.workingAddr += ( r->op.h->is4Byte ) ? 4 : 2;
+        }
+    }
+    while ( ( wholeBlock ) && ( r->op.insn != r->s->insns[r->op.insn].blockEnd ) );
+}
+
+// ====================================================================================================
+static bool _changed( struct RunTime *r, enum TRACEchanges c )
+
+/* Check if something changed, and mark it as dealt with */
+
+{
+    bool ret = ( r->changes & ( 1 << c ) ) != 0;
+    r->changes &= ~( 1 << c );
+    return ret;
+}
+// ====================================================================================================
+static void _checkJumps( struct RunTime *r )
+
+{
+    if ( r->op.h )
+    {
+
+        if ( ( _changed( r, EV_CH_EX_EXIT ) ) || ( r->op.h->isReturn ) )
+        {
+            _returnEvent( r, r->op.workingAddr );
+        }
+
+        if ( r->op.h->isSubCall )
+        {
+            _callEvent( r, r->op.h->addr + ( ( r->op.h->is4Byte ) ? 4 : 2 ), r->op.workingAddr );
+        }
+    }
+}
+// ====================================================================================================
+static void _traceEvent( struct RunTime *r, const struct TRACEEvent *ev )
+
+/* Process one event from a valid TRACE decode */
+
+{
+    /* Changes that aren't acted on now stay pending for later events, as they did in the decoder */
+    r->ev = ev;
+    r->changes |= ev->changes;
+
+    /* Calls and returns from here on belong to whichever context is executing */
+    if ( ( !r->ctx ) || ( ev->contextID != r->ctx->contextID ) )
+    {
+        _switchContext( r, ev->contextID );
+    }
+
+    /* This routine gets called when valid data are available */
+    /* if these are the first data, then reset counters etc.  */
+    if ( !r->sampling )
+    {
+        r->op.firsttstamp = _now( r );
+        genericsReport( V_INFO, "Sampling" EOL );
+        /* Fill in a time to start from */
+        r->starttime = r->lastWrite = genericsTimestampmS();
+
+        if ( _changed( r, EV_CH_ADDRESS ) )
+        {
+            r->op.workingAddr = ev->addr;
+            DBG_OUT( "Got initial address %08x" EOL, r->op.workingAddr );
+            r->sampling  = true;
+        }
+
+        /* Create false entry for an interrupt source, if we didn't get it already */
+        if ( !r->op.inth )
+        {
+            r->op.inth = ( struct execEntryHash * )_arenaAlloc( &r->arena, MEM_ADDRESSES, sizeof( struct execEntryHash ) );
+            r->op.inth->addr          = INTERRUPT;
+            r->op.inth->fileindex     = INTERRUPT;
+            r->op.inth->line          = NO_LINE;
+            r->op.inth->count         = NO_LINE;
+            r->op.inth->functionindex = INTERRUPT;
+            HASH_ADD_INT( r->insthead, addr, r->op.inth );
+        }
+    }
+
+    r->op.lasttstamp = _now( r );
+
+    /* After a gap in statistical decode nothing can be followed until there's an address to follow it from */
+    if ( r->op.resync )
+    {
+        if ( !( r->changes & ( 1 << EV_CH_ADDRESS ) ) )
+        {
+            r->changes = 0;
+            return;
+        }
+
+        r->op.workingAddr = ev->addr;
+        r->op.resync = false;
+    }
+
+    /* Pull changes introduced by this event ============================== */
+
+    if ( _changed( r, EV_CH_CYCLECOUNT ) )
+    {
+        _cycleCount( r, ev );
+    }
+
+    if ( _changed( r, EV_CH_LINEAR ) )
+    {
+        /* The last run ended with the branch that got us here, so this is where any call or return from it went to */
+        r->op.workingAddr = ev->addr;
+
+        if ( _changed( r, EV_CH_EX_ENTRY ) )
+        {
+            if ( r->op.h )
+            {
+                _callEvent( r, r->op.h->addr, ev->addr );
+            }
+        }
+        else
+        {
+            _checkJumps( r );
+        }
+
+        _changed( r, EV_CH_ADDRESS );
+        _handleRun( r, ev->addr, ev->toAddr );
+        r->op.lasttstamp = _now( r );
+        return;
+    }
+
+    if ( _changed( r, EV_CH_ENATOMS ) )
+    {
+        /* We are going to execute some instructions. Check if the last of the old batch of    */
+        /* instructions was cancelled and, if it wasn't and it's still outstanding, action it. */
+        if ( _changed( r, EV_CH_CANCELLED ) )
+        {
+            DBG_OUT( "CANCELLED" EOL );
+        }
+        else
+        {
+            if ( r->op.incAddr )
+            {
+                DBG_OUT( "***" EOL );
+                _handleInstruction( r, r->op.disposition & 1 );
+
+                if ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) || ( r->op.h->isReturn ) )
+                {
+                    if ( _changed( r, EV_CH_ADDRESS ) )
+                    {
+                        DBG_OUT( "New addr %08x" EOL, ev->addr );
+                        r->op.workingAddr = ev->addr;
+                    }
+
+                    _checkJumps( r );
+                }
+            }
+        }
+
+        if ( _changed( r, EV_CH_ADDRESS ) )
+        {
+            if ( _changed( r, EV_CH_EX_ENTRY ) )
+            {
+                DBG_OUT( "INTERRUPT!!" EOL );
+                _callEvent( r, r->op.workingAddr, ev->addr );
+            }
+
+            r->op.workingAddr = ev->addr;
+            DBG_OUT( "A:%08x" EOL, ev->addr );
+        }
+
+        /* ================================================ */
+        /* OK, now collect the next iterations worth of fun */
+        /* ================================================ */
+        r->op.incAddr     = ev->eatoms + ev->natoms;
+        r->op.disposition = ev->disposition;
+        DBG_OUT( "E:%d N:%d" EOL, ev->eatoms, ev->natoms );
+
+        /* Action those changes, except the last one */
+        while ( r->op.incAddr > 1 )
+        {
+            r->op.incAddr--;
+            _handleInstruction( r, r->op.disposition & 1 );
+            _checkJumps( r );
+            r->op.disposition >>= 1;
+        }
+    }
+}
+
+// ====================================================================================================
+static void _decodeTrace( struct RunTime *r, const uint8_t *buf, int len )
+
+/* Decode trace data, processing the events from it in batches */
+
+{
+    struct TRACEEvent ev[EVENT_BATCH];
+    int consumed;
+    int n;
+
+    while ( len > 0 )
+    {
+        n = TRACEDecoderPumpEvents( &r->i, buf, len, ev, EVENT_BATCH, &consumed );
+
+        for ( int e = 0; e < n; e++ )
+        {
+            _traceEvent( r, &ev[e] );
+        }
+
+        if ( !consumed )
+        {
+            /* Only a part pair (for MTB) is left, which can't be decoded */
+            break;
+        }
+
+        buf += consumed;
+        len -= consumed;
+    }
+}
+// ====================================================================================================
+static void _windowStart( struct RunTime *r )
+
+/* A statistical decode window is starting at a sync point, so pick up the flow afresh from there */
+
+{
+    struct callContext *c, *ct;
+
+    /* Nothing that was called before the gap is known to still be running, in any context, and the */
+    /* timeline carries on from where it was.                                                       */
+    HASH_ITER( hh, r->contexts, c, ct )
+    {
+        while ( ( r->tl ) && ( c->substacklen ) )
+        {
+            c->substacklen--;
+            _timelineReturn( r, c, r->tlBase + r->op.lasttstamp );
+        }
+
+        c->substacklen = 0;
+        c->at = ( c->at ) ? ext_ff_stackThread( &r->stacks, c->contextID ) : NULL;
+    }
+
+    r->tlBase += r->op.lasttstamp;
+
+    r->i.engine->destroy( r->i.engine );
+    TRACEDecoderInit( &r->i, r->options->tProtocol, !r->options->noaltAddr, genericsReport );
+
+    /* The new decoder counts instructions from zero */
+    r->op.elapsed += r->op.lasttstamp - r->op.firsttstamp;
+    r->op.firsttstamp = r->op.lasttstamp = 0;
+    r->op.lastCycles = COUNT_UNKNOWN;
+
+    /* ...and nothing carries across the gap, not even the call stack */
+    r->op.h = NULL;
+    r->op.incAddr = 0;
+    r->op.resync = r->sampling;
+    r->changes = 0;
+    r->pendLen = 0;
+    r->stacks.at = ( ( r->ctx ) && ( r->ctx->at ) ) ? r->ctx->at : &r->stacks.root;
+    r->stacks.lastTicks = 0;
+}
+// ====================================================================================================
+static void _pumpTrace( struct RunTime *r, const uint8_t *buf, int len )
+
+/* Decode trace data or, in statistical mode, just the windows of it that are to be decoded */
+
+{
+    int n;
+
+    if ( !r->options->winPeriod )
+    {
+        _decodeTrace( r, buf, len );
+        return;
+    }
+
+    r->winSeen += len;
+
+    while ( len > 0 )
+    {
+        switch ( r->winState )
+        {
+            case WIN_SEEK:
+                if ( ( n = TRACEDecoderFindSync( &r->i, buf, len, 0 ) ) < 0 )
+                {
+                    return;
+                }
+
+                buf += n;
+                len -= n;
+                _windowStart( r );
+                r->winState = WIN_OPEN;
+                r->winLeft = r->options->winLen;
+                break;
+
+            case WIN_OPEN:
+                n = ( len < r->winLeft ) ? len : r->winLeft;
+                _decodeTrace( r, buf, n );
+                r->winDecoded += n;
+                r->winLeft -= n;
+                buf += n;
+                len -= n;
+
+                if ( !r->winLeft )
+                {
+                    r->winState = WIN_GAP;
+                    r->winLeft = r->options->winPeriod - r->options->winLen;
+                }
+
+                break;
+
+            case WIN_GAP:
+                n = ( len < r->winLeft ) ? len : r->winLeft;
+                r->winLeft -= n;
+                buf += n;
+                len -= n;
+
+                if ( !r->winLeft )
+                {
+                    r->winState = WIN_SEEK;
+                }
+
+                break;
+        }
+    }
+}
+// ====================================================================================================
+static void _printHelp( const char *const progName )
+
+{
+    genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "    -A, --alt-addr-enc: Switch off alternate address decoding (on by default)" EOL );
+    genericsPrintf( "    -C, --coverage:     <Filename> Coverage map, added to by each run" EOL );
+    genericsPrintf( "    -c, --continuous:   <Seconds> Keep sampling, rewriting the output files with each interval's results" EOL );
+    genericsPrintf( "    -D, --no-demangle:  Switch off C++ symbol demangling" EOL );
+    genericsPrintf( "    -d, --del-prefix:   <String> Material to delete off front of filenames" EOL );
+    genericsPrintf( "    -e, --elf-file:     <ElfFile> to use for symbols" EOL );
+    genericsPrintf( "    -E, --eof:          When reading from file, terminate at EOF" EOL );
+    genericsPrintf( "    -F, --focus:        <lo-hi|lo+len|function> Only profile this part of the program, can be given more than once" EOL );
+    genericsPrintf( "    -f, --input-file:   Take input from specified file" EOL );
+    genericsPrintf( "    -h, --help:         This help" EOL );
+    genericsPrintf( "    -I, --interval:     <Interval> Time between samples (in ms)" EOL );
+    genericsPrintf( "    -j, --jobs:         <Threads> Decode all of the input file in parallel using this many threads" EOL );
+    genericsPrintf( "    -L, --lcov:         <Filename> lcov tracefile for coverage output" EOL );
+    genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
+    genericsPrintf( "    -O, --objdump-opts: <options> Options to pass directly to objdump" EOL );
+    genericsPrintf( "    -P, --trace-proto:  {ETM35|MTB} trace protocol to use, default is ETM35" EOL );
+    genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise raw ETM" EOL );
+    genericsPrintf( "    -Q, --mem-limit:    <subsystem>=<size>[,...] Most memory for each of symbols, addresses, calls, hash, lines or sequencer (e.g. addresses=2G)" EOL );
+    genericsPrintf( "    -S, --stack-file:   <Filename> folded stacks output (flamegraph.pl, speedscope)" EOL );
+    genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
+    genericsPrintf( "    -t, --tag:          <stream>[,<stream>...]: Which OFLOW tag to use (normally 2), or one for each core" EOL );
+    genericsPrintf( "    -T, --all-truncate: truncate -d material off all references (i.e. make output relative)" EOL );
+    genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "    -V, --version:      Print version and exit" EOL );
+    genericsPrintf( "    -W, --window:       <KBytes>:<KBytes> Only decode windows of this much trace out of every so much, scaling the results" EOL );
+    genericsPrintf( "    -X, --timeline:     <Filename>[,MHz] Perfetto timeline of the calls, with instructions going at MHz" EOL );
+    genericsPrintf( "    -y, --graph-file:   <Filename> dotty filename for structured callgraph output" EOL );
+    genericsPrintf( "    -z, --cache-file:   <Filename> profile filename for kcachegrind output" EOL );
+    genericsPrintf( "    -Z, --pprof-file:   <Filename> gzipped pprof profile output" EOL );
+    genericsPrintf( EOL "(Will connect one port higher than that set in -s when Orbflow is not used)" EOL );
+}
+// ====================================================================================================
+void _printVersion( void )
+
+{
+    genericsPrintf( "orbprofile version " GIT_DESCRIBE );
+}
+// ====================================================================================================
+static struct option _longOptions[] =
+{
+    {"alt-addr-enc", no_argument, NULL, 'A'},
+    {"continuous", required_argument, NULL, 'c'},
+    {"coverage", required_argument, NULL, 'C'},
+    {"no-demangle", required_argument, NULL, 'D'},
+    {"del-prefix", required_argument, NULL, 'd'},
+    {"elf-file", required_argument, NULL, 'e'},
+    {"eof", no_argument, NULL, 'E'},
+    {"focus", required_argument, NULL, 'F'},
+    {"input-file", required_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {"interval", required_argument, NULL, 'I'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"lcov", required_argument, NULL, 'L'},
+    {"no-colour", no_argument, NULL, 'M'},
+    {"no-color", no_argument, NULL, 'M'},
+    {"objdump-opts", required_argument, NULL, 'O'},
+    {"trace-proto", required_argument, NULL, 'P'},
+    {"protocol", required_argument, NULL, 'p'},
+    {"mem-limit", required_argument, NULL, 'Q'},
+    {"server", required_argument, NULL, 's'},
+    {"stack-file", required_argument, NULL, 'S'},
+    {"all-truncate", no_argument, NULL, 'T'},
+    {"tag", required_argument, NULL, 't'},
+    {"verbose", required_argument, NULL, 'v'},
+    {"version", no_argument, NULL, 'V'},
+    {"window", required_argument, NULL, 'W'},
+    {"timeline", required_argument, NULL, 'X'},
+    {"graph-file", required_argument, NULL, 'y'},
+    {"cache-file", required_argument, NULL, 'z'},
+    {"pprof-file", required_argument, NULL, 'Z'},
+    {NULL, no_argument, NULL, 0}
+};
+// ====================================================================================================
+static bool _parseTags( struct Options *o, const char *s )
+
+/* A list of tags, one for each core being traced */
+
+{
+    char *e;
+    long t;
+
+    o->ntags = 0;
+
+    do
+    {
+        t = strtol( s, &e, 0 );
+
+        if ( ( e == s ) || ( t < 0 ) || ( t > 255 ) || ( o->ntags == MAX_CORES ) || ( ( *e ) && ( *e != ',' ) ) )
+        {
+            genericsReport( V_ERROR, "Tags should be a list of up to %d stream numbers" EOL, MAX_CORES );
+            return false;
+        }
+
+        for ( int i = 0; i < o->ntags; i++ )
+        {
+            if ( o->tags[i] == t )
+            {
+                genericsReport( V_ERROR, "Tag %ld is given twice" EOL, t );
+                return false;
+            }
+        }
+
+        o->tags[o->ntags++] = t;
+        s = e + 1;
+    }
+    while ( *e );
+
+    return true;
+}
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[], struct RunTime *r )
+
+{
+    int c, optionIndex = 0;
+    bool protExplicit = false;
+    bool serverExplicit = false;
+
+    while ( ( c = getopt_long ( argc, argv, "Ac:C:Dd:e:EF:f:hVI:j:L:MO:P:p:Q:s:S:t:Tv:W:X:y:z:Z:", _longOptions, &optionIndex ) ) != -1 )
+
+        switch ( c )
+        {
+            // ------------------------------------
+            case 'A':
+                r->options->noaltAddr = true;
+                break;
+
+            // ------------------------------------
+            case 'c':
+                r->options->continuous = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'C':
+                r->options->covfile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'd':
+                r->options->deleteMaterial = optarg;
+                break;
+
+            // ------------------------------------
+            case 'D':
+                r->options->demangle = false;
+                break;
+
+            // ------------------------------------
+            case 'E':
+                r->options->fileTerminate = true;
+                break;
+
+            // ------------------------------------
+            case 'e':
+                r->options->elffile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'F':
+                if ( !addrFilterAdd( &r->options->focus, optarg ) )
+                {
+                    genericsReport( V_ERROR, "Focus should be lo-hi, lo+len or a function name, not %s" EOL, optarg );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'f':
+                r->options->file = optarg;
+                break;
+
+            // ------------------------------------
+            case 'h':
+                _printHelp( r->progName );
+                exit( 0 );
+
+            // ------------------------------------
+
+            case 'M':
+                r->options->mono = true;
+                break;
+
+            // ------------------------------------
+            case 'V':
+                _printVersion();
+                return false;
+
+            // ------------------------------------
+            case 'I':
+                r->options->sampleDuration = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'j':
+                r->options->jobs = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'L':
+                r->options->lcovfile = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'O':
+                r->options->odoptions = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'P':
+
+                /* Index through protocol strings looking for match or end of list */
+                for ( r->options->tProtocol = TRACE_PROT_LIST_START;
+                        ( ( r->options->tProtocol != TRACE_PROT_LIST_END ) && strcasecmp( optarg, TRACEDecodeGetProtocolName( r->options->tProtocol ) ) );
+                        r->options->tProtocol++ )
+                {}
+
+                break;
+
+            // ------------------------------------
+
+            case 'p':
+                r->options->protocol = PROT_UNKNOWN;
+                protExplicit = true;
+
+                for ( int i = 0; protString[i]; i++ )
+                {
+                    if ( !strcmp( protString[i], optarg ) )
+                    {
+                        r->options->protocol = i;
+                        break;
+                    }
+                }
+
+                if ( r->options->protocol == PROT_UNKNOWN )
+                {
+                    genericsReport( V_ERROR, "Unrecognised protocol type" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'Q':
+                if ( !memSetLimits( optarg ) )
+                {
+                    genericsReport( V_ERROR, "Memory limits are <subsystem>=<size>[K|M|G][,...]" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 's':
+                r->options->server = optarg;
+                serverExplicit = true;
+
+                // See if we have an optional port number too
+                char *a = optarg;
+
+                while ( ( *a ) && ( *a != ':' ) )
+                {
+                    a++;
+                }
+
+                if ( *a == ':' )
+                {
+                    *a = 0;
+                    r->options->port = atoi( ++a );
+                }
+
+                if ( !r->options->port )
+                {
+                    r->options->port = NWCLIENT_SERVER_PORT;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'S':
+                r->options->stackfile = optarg;
+                break;
+
+            // ------------------------------------
+            case 't':
+                if ( !_parseTags( r->options, optarg ) )
+                {
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'T':
+                r->options->truncateDeleteMaterial = true;
+                break;
+
+            // ------------------------------------
+            case 'v':
+                if ( !isdigit( *optarg ) )
+                {
+                    genericsReport( V_ERROR, "-v requires a numeric argument." EOL );
+                    return false;
+                }
+
+                genericsSetReportLevel( atoi( optarg ) );
+                break;
+
+            // ------------------------------------
+            case 'y':
+                r->options->dotfile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'z':
+                r->options->profile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'Z':
+                r->options->pproffile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'W':
+            {
+                char *e;
+                r->options->winLen = strtoul( optarg, &e, 10 ) * 1024;
+                r->options->winPeriod = ( *e == ':' ) ? strtoul( e + 1, NULL, 10 ) * 1024 : 0;
+
+                if ( ( !r->options->winLen ) || ( r->options->winPeriod < r->options->winLen ) )
+                {
+                    genericsReport( V_ERROR, "Window should be <KBytes>:<KBytes>, with the second no smaller than the first" EOL );
+                    return false;
+                }
+            }
+            break;
+
+            // ------------------------------------
+            case 'X':
+            {
+                char *a = strchr( optarg, ',' );
+                r->options->timeline = optarg;
+
+                if ( a )
+                {
+                    *a++ = 0;
+                    r->options->timelineMHz = atof( a );
+
+                    if ( r->options->timelineMHz <= 0 )
+                    {
+                        genericsReport( V_ERROR, "Timeline instruction rate out of range" EOL );
+                        return false;
+                    }
+                }
+            }
+            break;
+
+            // ------------------------------------
+            case '?':
+                if ( optopt == 'b' )
+                {
+                    genericsReport( V_ERROR, "Option '%c' requires an argument." EOL, optopt );
+                }
+                else if ( !isprint ( optopt ) )
+                {
+                    genericsReport( V_ERROR, "Unknown option character `\\x%x'." EOL, optopt );
+                }
+
+                return false;
+
+            // ------------------------------------
+            default:
+                genericsReport( V_ERROR, "Unknown option %c" EOL, optopt );
+                return false;
+                // ------------------------------------
+        }
+
+    /* If we set an explicit server and port and didn't set a protocol chances are we want ETM, not OFLOW */
+    if ( serverExplicit && !protExplicit )
+    {
+        r->options->protocol = PROT_ETM;
+    }
+
+    if ( !r->options->elffile )
+    {
+        genericsExit( -2, "Elf File not specified" EOL );
+    }
+
+    if ( !r->options->sampleDuration )
+    {
+        genericsExit( -2, "Illegal sample duration" EOL );
+    }
+
+    if ( r->options->tProtocol >= TRACE_PROT_NONE )
+    {
+        genericsExit( V_ERROR, "Unrecognised decode protocol" EOL );
+    }
+
+    if ( ( r->options->jobs < 0 ) || ( ( r->options->jobs ) && ( !r->options->file ) ) )
+    {
+        genericsExit( -2, "Parallel decode needs a positive number of jobs and an input file" EOL );
+    }
+
+    if ( ( r->options->continuous < 0 ) || ( ( r->options->continuous ) && ( r->options->jobs ) ) )
+    {
+        genericsExit( -2, "Continuous output needs a positive interval, and can't be used with parallel decode" EOL );
+    }
+
+    if ( ( r->options->winPeriod ) && ( ( r->options->jobs ) || ( r->options->tProtocol == TRACE_PROT_MTB ) ) )
+    {
+        genericsExit( -2, "Windowed decode needs sync points to start from (so not MTB), and can't be used with parallel decode" EOL );
+    }
+
+    if ( ( r->options->timeline ) && ( r->options->jobs ) )
+    {
+        genericsExit( -2, "A timeline needs the calls in order, so can't be made with parallel decode" EOL );
+    }
+
+    if ( ( r->options->ntags > 1 ) && ( ( r->options->protocol != PROT_OFLOW ) || ( r->options->continuous ) ) )
+    {
+        genericsExit( -2, "Several cores need OFLOW to tell their trace apart, and are only put together at the end (so not continuous)" EOL );
+    }
+
+
+    genericsReport( V_INFO, "orbprofile version " GIT_DESCRIBE EOL );
+    genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
+    genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
+    genericsReport( V_INFO, "Elf File        : %s (%s Names)" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "Truncate" : "Don't Truncate" );
+    genericsReport( V_INFO, "Objdump options : %s" EOL, r->options->odoptions ? r->options->odoptions : "None" );
+    genericsReport( V_INFO, "Protocol        : %s" EOL, TRACEDecodeGetProtocolName( r->options->tProtocol ) );
+    genericsReport( V_INFO, "Orbflow Tag     : %d%s" EOL, r->options->tags[0], ( r->options->ntags > 1 ) ? " (and more, one per core)" : "" );
+    genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
+    genericsReport( V_INFO, "Coverage map    : %s" EOL, r->options->covfile ? r->options->covfile : "None" );
+    genericsReport( V_INFO, "lcov file       : %s" EOL, r->options->lcovfile ? r->options->lcovfile : "None" );
+    genericsReport( V_INFO, "Folded stacks   : %s" EOL, r->options->stackfile ? r->options->stackfile : "None" );
+    genericsReport( V_INFO, "pprof file      : %s" EOL, r->options->pproffile ? r->options->pproffile : "None" );
+    genericsReport( V_INFO, "Timeline        : %s" EOL, r->options->timeline ? r->options->timeline : "None" );
+    genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
+
+    if ( r->options->continuous )
+    {
+        genericsReport( V_INFO, "Continuous      : Output every %d S" EOL, r->options->continuous );
+    }
+
+    if ( r->options->jobs )
+    {
+        genericsReport( V_INFO, "Parallel Decode : %d threads" EOL, r->options->jobs );
+    }
+
+    if ( r->options->winPeriod )
+    {
+        genericsReport( V_INFO, "Windowed Decode : %u KBytes in every %u" EOL, r->options->winLen / 1024, r->options->winPeriod / 1024 );
+    }
+
+    for ( unsigned int i = 0; i < r->options->focus.nspec; i++ )
+    {
+        genericsReport( V_INFO, "Focus           : %s" EOL, r->options->focus.spec[i] );
+    }
+
+    switch ( r->options->protocol )
+    {
+        case PROT_OFLOW:
+            genericsReport( V_INFO, "Decoding OFLOW (Orbuculum) with ITM in stream %d" EOL, r->options->tags[0] );
+            break;
+
+        case  PROT_ETM:
+            genericsReport( V_INFO, "Using raw ETM" EOL );
+            break;
+
+        default:
+            genericsReport( V_INFO, "Decoding unknown" EOL );
+            break;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _doExit( void )
+
+/* Perform any explicit exit functions */
+
+{
+    _r.ending = true;
+    /* Give them a bit of time, then we're leaving anyway */
+    usleep( 200 );
+
+}
+// ====================================================================================================
+static void _intHandler( int sig )
+
+/* Catch CTRL-C so things can be cleaned up properly via atexit functions */
+{
+    /* CTRL-C exit is not an error... */
+    _doExit();
+}
+
+// ====================================================================================================
+
+static void _coreFeed( struct RunTime *c, struct OFLOWFrame *p ); /* Forward definition needed */
+
+static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
+
+{
+    struct RunTime *r = ( struct RunTime * )param;
+
+    if ( !p->good )
+    {
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
+    }
+    else if ( !r->ncores )
+    {
+        if ( p->tag == r->options->tags[0] )
+        {
+            _pumpTrace( r, p->d, p->len );
+        }
+    }
+    else
+    {
+        for ( int k = 0; k < r->ncores; k++ )
+        {
+            if ( p->tag == r->core[k]->coreTag )
+            {
+                _coreFeed( r->core[k], p );
+                break;
+            }
+        }
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Transfer of blocks from the receiver to the processor
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static struct dataBlock *_queueSlot( struct RunTime *r )
+
+/* Return the block for the receiver to fill next, or NULL if the processor hasn't finished with it yet */
+
+{
+    size_t wp = atomic_load_explicit( &r->wp, memory_order_relaxed );
+
+    if ( wp - atomic_load_explicit( &r->rp, memory_order_acquire ) == NUM_RAW_BLOCKS )
+    {
+        return NULL;
+    }
+
+    return &r->rawBlock[wp % NUM_RAW_BLOCKS];
+}
+// ====================================================================================================
+static void _queuePush( struct RunTime *r )
+
+/* Hand over the block returned by _queueSlot. The processor only gets kicked if the queue was empty, */
+/* since otherwise it's still busy and will find this block before it waits again.                   */
+
+{
+    size_t wp = atomic_load_explicit( &r->wp, memory_order_relaxed );
+    bool wasEmpty = ( wp == atomic_load_explicit( &r->rp, memory_order_acquire ) );
+
+    atomic_store_explicit( &r->wp, wp + 1, memory_order_release );
+
+    if ( wasEmpty )
+    {
+        pthread_mutex_lock( &r->kickLock );
+        r->kicked = true;
+        pthread_cond_signal( &r->kick );
+        pthread_mutex_unlock( &r->kickLock );
+    }
+}
+// ====================================================================================================
+static void _queueDrop( struct RunTime *r, size_t len )
+
+/* Account for data that had to be thrown away because the processor isn't keeping up */
+
+{
+    uint32_t now = genericsTimestampmS();
+
+    r->droppedBlocks++;
+    r->droppedBytes += len;
+
+    if ( now - r->lastDropReport >= DROP_REPORT_INTERVAL_MS )
+    {
+        genericsReport( V_WARN, "Processing not keeping up, %" PRIu64 " bytes dropped" EOL, r->droppedBytes - r->reportedDropped );
+        r->reportedDropped = r->droppedBytes;
+        r->lastDropReport = now;
+    }
+}
+// ====================================================================================================
+static struct dataBlock *_queuePop( struct RunTime *r )
+
+/* Wait until there's a block to process, and return it. It stays owned by the processor until _queueRelease */
+
+{
+    size_t rp = atomic_load_explicit( &r->rp, memory_order_relaxed );
+    struct timespec ts;
+
+    while ( rp == atomic_load_explicit( &r->wp, memory_order_acquire ) )
+    {
+        /* Wait to be told there's more data (or for a timeout, just in case) */
+        pthread_mutex_lock( &r->kickLock );
+
+        if ( !r->kicked )
+        {
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_nsec += PROCESS_IDLE_WAIT_NS;
+
+            if ( ts.tv_nsec >= 1000000000L )
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            pthread_cond_timedwait( &r->kick, &r->kickLock, &ts );
+        }
+
+        r->kicked = false;
+        pthread_mutex_unlock( &r->kickLock );
+    }
+
+    return &r->rawBlock[rp % NUM_RAW_BLOCKS];
+}
+// ====================================================================================================
+static void _queueRelease( struct RunTime *r )
+
+/* Give the block returned by _queuePop back to the receiver */
+
+{
+    atomic_fetch_add_explicit( &r->rp, 1, memory_order_release );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Trace from several cores
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+/* Each core's trace is on a tag of its own. The block processor takes the frames out of OFLOW and    */
+/* queues each core's trace for it, in the same way that the receiver queues blocks for the processor, */
+/* and every core has its own RunTime decoding its trace on a thread of its own. They're only put     */
+/* together at the end, when the cores' results are merged into the main RunTime.                     */
+static void _coreSend( struct RunTime *c )
+
+/* Hand over whatever's been put together for the core so far */
+
+{
+    if ( c->fill )
+    {
+        _queuePush( c );
+        c->fill = NULL;
+    }
+}
+// ====================================================================================================
+static void _coreFeed( struct RunTime *c, struct OFLOWFrame *p )
+
+/* Add a frame of trace to what's going to the core */
+
+{
+    if ( ( c->fill ) && ( c->fill->fillLevel + p->len > TRANSFER_SIZE ) )
+    {
+        _coreSend( c );
+    }
+
+    if ( !c->fill )
+    {
+        /* A file can wait for the core to catch up, but a live source can't be held up */
+        while ( !( c->fill = _queueSlot( c ) ) )
+        {
+            if ( !c->options->file )
+            {
+                _queueDrop( c, p->len );
+                return;
+            }
+
+            usleep( TICK_TIME_MS * 1000 );
+        }
+
+        c->fill->fillLevel = 0;
+        c->fill->stamped = p->stamped;
+        c->fill->tstamp = p->tstamp;
+    }
+
+    memcpy( &c->fill->buffer[c->fill->fillLevel], p->d, p->len );
+    c->fill->fillLevel += p->len;
+}
+// ====================================================================================================
+static void *_processCore( void *params )
+
+/* Decode the trace from one core, as it's handed over, until an empty block says that's it */
+
+{
+    struct RunTime *c = ( struct RunTime * )params;
+    struct dataBlock *b;
+
+    while ( ( b = _queuePop( c ) )->fillLevel )
+    {
+        if ( ( c->tl ) && ( b->stamped ) )
+        {
+            if ( c->tlStamp )
+            {
+                _timelineAlign( c, c->tlStamp );
+            }
+
+            c->tlStamp = b->tstamp;
+        }
+
+        _pumpTrace( c, b->buffer, b->fillLevel );
+        _queueRelease( c );
+    }
+
+    _queueRelease( c );
+    return NULL;
+}
+// ====================================================================================================
+static void _coresStart( struct RunTime *r )
+
+/* Set up a RunTime and a thread for each core, when there's more than one */
+
+{
+    struct RunTime *c;
+    char name[32];
+
+    if ( r->options->ntags < 2 )
+    {
+        return;
+    }
+
+    pthread_mutex_init( &r->tlMutex, NULL );
+
+    for ( r->ncores = 0; r->ncores < r->options->ntags; r->ncores++ )
+    {
+        c = r->core[r->ncores] = ( struct RunTime * )calloc( 1, sizeof( struct RunTime ) );
+        MEMCHECKV( c );
+        c->options = r->options;
+        c->s = r->s;
+        c->coreTag = r->options->tags[r->ncores];
+        _coverInit( c );
+        ext_ff_stackInit( &c->stacks );
+        TRACEDecoderInit( &c->i, r->options->tProtocol, !r->options->noaltAddr, genericsReport );
+
+        if ( r->tl )
+        {
+            c->tl = r->tl;
+            c->tlLock = &r->tlMutex;
+            snprintf( name, sizeof( name ), "Calls (tag %d)", c->coreTag );
+            c->tlCalls = perfettoTrack( r->tl, name );
+            snprintf( name, sizeof( name ), "Call depth (tag %d)", c->coreTag );
+            c->tlDepth = perfettoCounterTrack( r->tl, name );
+        }
+
+        c->rawBlock = ( struct dataBlock * )calloc( NUM_RAW_BLOCKS, sizeof( struct dataBlock ) );
+        MEMCHECKV( c->rawBlock );
+        atomic_init( &c->wp, 0 );
+        atomic_init( &c->rp, 0 );
+
+        if ( ( pthread_mutex_init( &c->kickLock, NULL ) ) || ( pthread_cond_init( &c->kick, NULL ) ) ||
+                ( pthread_create( &c->coreThread, NULL, &_processCore, c ) ) )
+        {
+            genericsExit( -1, "Failed to start decoding core with tag %d" EOL, c->coreTag );
+        }
+    }
+}
+// ====================================================================================================
+static void _coresFlush( struct RunTime *r )
+
+/* Pass on what's been gathered for the cores from the last block, and see if any has started sampling */
+
+{
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        _coreSend( r->core[k] );
+
+        if ( ( !r->sampling ) && ( ( volatile bool ) r->core[k]->sampling ) )
+        {
+            r->starttime = ( volatile uint32_t )r->core[k]->starttime;
+            r->sampling = true;
+        }
+    }
+}
+// ====================================================================================================
+static void _coresStop( struct RunTime *r )
+
+/* Tell the cores there's nothing more coming, then wait for them to finish with what they've got */
+
+{
+    struct dataBlock *b;
+
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        _coreSend( r->core[k] );
+
+        while ( !( b = _queueSlot( r->core[k] ) ) )
+        {
+            usleep( TICK_TIME_MS * 1000 );
+        }
+
+        b->fillLevel = 0;
+        _queuePush( r->core[k] );
+    }
+
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        pthread_join( r->core[k]->coreThread, NULL );
+    }
+}
+// ====================================================================================================
+static void *_processBlocks( void *params )
+
+/* Generic block processor for received data. This runs in a task parallel to the receiver and *
+ * processes all of the data that arrive.                                                      */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+    struct dataBlock *b;
+
+    while ( true )
+    {
+        b = _queuePop( r );
+
+        genericsReportRateLimited( V_DEBUG, "RXED Packet of %d bytes" EOL, b->fillLevel );
+
+        /* Check to see if we've finished (a zero length packet */
+        if ( !b->fillLevel )
+        {
+            _queueRelease( r );
+            _coresStop( r );
+            break;
+        }
+
+#ifdef DUMP_BLOCK
+        uint8_t *c = b->buffer;
+        uint32_t y = b->fillLevel;
+
+        DBG_OUT( EOL );
+
+        while ( y-- )
+        {
+            DBG_OUT( "%02X ", *c++ );
+
+            if ( !( y % 16 ) )
+            {
+                DBG_OUT( EOL );
+            }
+        }
+
+#endif
+
+        if ( PROT_OFLOW == r->options->protocol )
+        {
+            OFLOWPumpInPlace( &_r.c, b->buffer, b->fillLevel, _OFLOWpacketRxed, &_r );
+            _coresFlush( r );
+        }
+        else
+        {
+            /* Pump all of the data through the protocol handler */
+            _pumpTrace( &_r, b->buffer, b->fillLevel );
+        }
+
+        _queueRelease( r );
+        _checkContinuous( r );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Parallel decode of an offline capture
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* A section of the capture, starting at a sync point, which is decoded independently of the others */
+struct chunk
+{
+    int core;                            /* Whose trace this is */
+    int start;                           /* Offset of this chunk in that core's capture */
+    int len;                             /* ...and its length */
+    struct RunTime r;                    /* Decoder, tracking state and results for this chunk */
+};
+
+struct parallelDecode
+{
+    uint8_t *capture[MAX_CORES];         /* The entire trace stream for each core, with any OFLOW framing removed */
+    int len[MAX_CORES];
+    int alloc[MAX_CORES];
+
+    struct chunk *chunk;                 /* The chunks the capture was split into */
+    int chunkCount;
+    int nextChunk;                       /* The next chunk to be picked up by a thread */
+    pthread_mutex_t nextChunk_m;
+};
+
+// ====================================================================================================
+static void _captureAppend( struct parallelDecode *p, int core, const uint8_t *d, int len )
+
+{
+    if ( p->len[core] + len > p->alloc[core] )
+    {
+        p->alloc[core] = ( p->len[core] + len ) * 2;
+        p->capture[core] = ( uint8_t * )realloc( p->capture[core], p->alloc[core] );
+        MEMCHECKV( p->capture[core] );
+    }
+
+    memcpy( &p->capture[core][p->len[core]], d, len );
+    p->len[core] += len;
+}
+// ====================================================================================================
+static void _OFLOWpacketCollect( struct OFLOWFrame *f, void *param )
+
+{
+    for ( int k = 0; ( f->good ) && ( k < _r.options->ntags ); k++ )
+    {
+        if ( f->tag == _r.options->tags[k] )
+        {
+            _captureAppend( ( struct parallelDecode * )param, k, f->d, f->len );
+            break;
+        }
+    }
+}
+// ====================================================================================================
+static void *_decodeChunks( void *params )
+
+/* Worker thread, decoding chunks until there are none left */
+
+{
+    struct parallelDecode *p = ( struct parallelDecode * )params;
+    struct chunk *c;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &p->nextChunk_m );
+        c = ( p->nextChunk < p->chunkCount ) ? &p->chunk[p->nextChunk++] : NULL;
+        pthread_mutex_unlock( &p->nextChunk_m );
+
+        if ( !c )
+        {
+            break;
+        }
+
+        _pumpTrace( &c->r, &p->capture[c->core][c->start], c->len );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _mergeRun( struct RunTime *r, struct RunTime *from )
+
+/* Fold the results of a chunk into the overall ones, consuming them in the process */
+
+{
+    struct execEntryHash *h, *ht, *e;
+    struct subcall *s, *st, *t;
+
+    _flushRuns( from );
+    _flushCosts( from );
+
+    for ( uint32_t i = 0; ( from->cov ) && ( i < r->s->insnCount ); i++ )
+    {
+        r->cov[i] |= from->cov[i];
+    }
+
+    HASH_ITER( hh, from->insthead, h, ht )
+    {
+        HASH_DEL( from->insthead, h );
+        HASH_FIND_INT( r->insthead, &h->addr, e );
+
+        if ( !e )
+        {
+            HASH_ADD_INT( r->insthead, addr, h );
+            continue;
+        }
+
+        /* The interrupt entry is a marker rather than a count, so it only needs to be there */
+        if ( h->addr != INTERRUPT )
+        {
+            e->count  += h->count;
+            e->scount += h->scount;
+            e->cycles += h->cycles;
+        }
+    }
+
+    HASH_ITER( hh, from->subhead, s, st )
+    {
+        HASH_DEL( from->subhead, s );
+        HASH_FIND( hh, r->subhead, &s->sig, sizeof( struct subcallSig ), t );
+
+        if ( !t )
+        {
+            HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
+            continue;
+        }
+
+        t->myCost += s->myCost;
+        t->count  += s->count;
+    }
 
-                // See if we have an optional port number too
-                char *a = optarg;
+    /* Instruction counts restart in each chunk, so the elapsed time is the sum of theirs */
+    if ( from->sampling )
+    {
+        r->op.lasttstamp += from->op.lasttstamp - from->op.firsttstamp;
+        r->sampling = true;
+    }
 
-                while ( ( *a ) && ( *a != ':' ) )
-                {
-                    a++;
-                }
+    r->cyclesSeen |= from->cyclesSeen;
+    ext_ff_stackMerge( &r->stacks, &from->stacks );
+    ext_ff_stackDelete( &from->stacks );
+
+    /* Records that were moved across still live in the chunk's arena, so keep all of it */
+    _arenaAdopt( &r->arena, &from->arena );
+    _arenaAdopt( &r->callArena, &from->callArena );
+    _freeContexts( from );
+    memFree( MEM_ADDRESSES, from->exec );
+    memFree( MEM_ADDRESSES, from->runEdge );
+    memFree( MEM_ADDRESSES, from->runStart );
+    memFree( MEM_ADDRESSES, from->cov );
+    memFree( MEM_ADDRESSES, from->cost );
+    memFree( MEM_ADDRESSES, from->pend );
+}
+// ====================================================================================================
+static void _decodeParallel( struct RunTime *r, struct Stream *stream )
 
-                if ( *a == ':' )
-                {
-                    *a = 0;
-                    r->options->port = atoi( ++a );
-                }
+/* Read in the whole capture, split it at sync points and decode the pieces in parallel */
 
-                if ( !r->options->port )
-                {
-                    r->options->port = NWCLIENT_SERVER_PORT;
-                }
+{
+    struct parallelDecode p = { 0 };
+    struct timeval tv;
+    enum ReceiveResult result;
+    size_t fillLevel;
+    pthread_t *worker;
+    int target, total = 0;
 
-                break;
+    /* Pull in the trace stream, taking it out of its OFLOW framing if it has any */
+    while ( true )
+    {
+        tv.tv_sec = 0;
+        tv.tv_usec  = TICK_TIME_MS * 1000;
+        result = stream->receive( stream, r->rawBlock[0].buffer, TRANSFER_SIZE, &tv, &fillLevel );
 
-            // ------------------------------------
-            case 't':
-                r->options->tag = atoi( optarg );
-                break;
+        if ( ( result == RECEIVE_RESULT_EOF ) || ( result == RECEIVE_RESULT_ERROR ) || ( !fillLevel ) )
+        {
+            break;
+        }
 
-            // ------------------------------------
-            case 'T':
-                r->options->truncateDeleteMaterial = true;
-                break;
+        r->intervalBytes += fillLevel;
 
-            // ------------------------------------
-            case 'v':
-                if ( !isdigit( *optarg ) )
-                {
-                    genericsReport( V_ERROR, "-v requires a numeric argument." EOL );
-                    return false;
-                }
+        if ( PROT_OFLOW == r->options->protocol )
+        {
+            OFLOWPump( &r->c, r->rawBlock[0].buffer, fillLevel, _OFLOWpacketCollect, &p );
+        }
+        else
+        {
+            _captureAppend( &p, 0, r->rawBlock[0].buffer, fillLevel );
+        }
+    }
 
-                genericsSetReportLevel( atoi( optarg ) );
-                break;
+    for ( int k = 0; k < r->options->ntags; k++ )
+    {
+        total += p.len[k];
+    }
 
-            // ------------------------------------
-            case 'y':
-                r->options->dotfile = optarg;
-                break;
+    /* Chop it up. Each chunk starts where a freshly initialised decoder can pick up the flow. Every */
+    /* core's trace is a flow of its own, and it's all merged together at the end anyway.            */
+    target = total / ( r->options->jobs * CHUNKS_PER_JOB );
+    target = ( target < MIN_CHUNK_SIZE ) ? MIN_CHUNK_SIZE : target;
 
-            // ------------------------------------
-            case 'z':
-                r->options->profile = optarg;
-                break;
+    for ( int k = 0; k < r->options->ntags; k++ )
+    {
+        for ( int start = 0, next; start < p.len[k]; start = next )
+        {
+            next = ( p.len[k] - start > target ) ? TRACEDecoderFindSync( &r->i, p.capture[k], p.len[k], start + target ) : -1;
+            next = ( next < 0 ) ? p.len[k] : next;
+
+            p.chunk = ( struct chunk * )realloc( p.chunk, ( p.chunkCount + 1 ) * sizeof( struct chunk ) );
+            MEMCHECKV( p.chunk );
+            memset( &p.chunk[p.chunkCount], 0, sizeof( struct chunk ) );
+            p.chunk[p.chunkCount].core      = k;
+            p.chunk[p.chunkCount].start     = start;
+            p.chunk[p.chunkCount].len       = next - start;
+            p.chunk[p.chunkCount].r.options = r->options;
+            p.chunk[p.chunkCount].r.s       = r->s;
+            _coverInit( &p.chunk[p.chunkCount].r );
+            ext_ff_stackInit( &p.chunk[p.chunkCount].r.stacks );
+            TRACEDecoderInit( &p.chunk[p.chunkCount].r.i, r->options->tProtocol, !r->options->noaltAddr, genericsReport );
+            p.chunkCount++;
+        }
+    }
 
-            // ------------------------------------
-            case '?':
-                if ( optopt == 'b' )
-                {
-                    genericsReport( V_ERROR, "Option '%c' requires an argument." EOL, optopt );
-                }
-                else if ( !isprint ( optopt ) )
-                {
-                    genericsReport( V_ERROR, "Unknown option character `\\x%x'." EOL, optopt );
-                }
+    genericsReport( V_INFO, "Decoding %d bytes in %d chunks using %d threads" EOL, total, p.chunkCount, r->options->jobs );
 
-                return false;
+    /* ...and set the threads to work on them */
+    worker = ( pthread_t * )calloc( r->options->jobs, sizeof( pthread_t ) );
+    MEMCHECKV( worker );
+    pthread_mutex_init( &p.nextChunk_m, NULL );
 
-            // ------------------------------------
-            default:
-                genericsReport( V_ERROR, "Unknown option %c" EOL, optopt );
-                return false;
-                // ------------------------------------
-        }
+    for ( int t = 0; t < r->options->jobs; t++ )
+    {
+        pthread_create( &worker[t], NULL, &_decodeChunks, &p );
+    }
 
-    /* If we set an explicit server and port and didn't set a protocol chances are we want ETM, not OFLOW */
-    if ( serverExplicit && !protExplicit )
+    for ( int t = 0; t < r->options->jobs; t++ )
     {
-        r->options->protocol = PROT_ETM;
+        pthread_join( worker[t], NULL );
     }
 
-    if ( !r->options->elffile )
+    /* Combine the results, in order, so the outcome is the same for any number of threads */
+    for ( int n = 0; n < p.chunkCount; n++ )
     {
-        genericsExit( -2, "Elf File not specified" EOL );
+        _mergeRun( r, &p.chunk[n].r );
+        p.chunk[n].r.i.engine->destroy( p.chunk[n].r.i.engine );
     }
 
-    if ( !r->options->sampleDuration )
+    pthread_mutex_destroy( &p.nextChunk_m );
+    free( worker );
+    free( p.chunk );
+
+    for ( int k = 0; k < MAX_CORES; k++ )
     {
-        genericsExit( -2, "Illegal sample duration" EOL );
+        free( p.capture[k] );
     }
+}
+// ====================================================================================================
+static void _coresMerge( struct RunTime *r )
 
-    if ( r->options->tProtocol >= TRACE_PROT_NONE )
+/* Fold what each core found into the overall results, and be done with the cores */
+
+{
+    for ( int k = 0; k < r->ncores; k++ )
     {
-        genericsExit( V_ERROR, "Unrecognised decode protocol" EOL );
+        struct RunTime *c = r->core[k];
+        struct timelineName *n, *nt;
+
+        _mergeRun( r, c );
+        c->i.engine->destroy( c->i.engine );
+        r->droppedBlocks += c->droppedBlocks;
+        r->droppedBytes  += c->droppedBytes;
+
+        HASH_ITER( hh, c->tlNames, n, nt )
+        {
+            HASH_DEL( c->tlNames, n );
+            free( n );
+        }
+
+        pthread_mutex_destroy( &c->kickLock );
+        pthread_cond_destroy( &c->kick );
+        free( c->rawBlock );
+        free( c );
     }
 
+    if ( r->ncores )
+    {
+        pthread_mutex_destroy( &r->tlMutex );
+    }
 
-    genericsReport( V_INFO, "orbprofile version " GIT_DESCRIBE EOL );
-    genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
-    genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
-    genericsReport( V_INFO, "Elf File        : %s (%s Names)" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "Truncate" : "Don't Truncate" );
-    genericsReport( V_INFO, "Objdump options : %s" EOL, r->options->odoptions ? r->options->odoptions : "None" );
-    genericsReport( V_INFO, "Protocol        : %s" EOL, TRACEDecodeGetProtocolName( r->options->tProtocol ) );
-    genericsReport( V_INFO, "Orbflow Tag     : %d" EOL, r->options->tag );
-    genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
-    genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
+    r->ncores = 0;
+}
+// ====================================================================================================
+static void _symbolsIn( struct RunTime *r, enum symbolErr err )
 
-    switch ( r->options->protocol )
+/* Get going with a new symbol set, or give up if we didn't get one */
+
+{
+    switch ( err )
     {
-        case PROT_OFLOW:
-            genericsReport( V_INFO, "Decoding OFLOW (Orbuculum) with ITM in stream %d" EOL, r->options->tag );
+        case SYMBOL_NOELF:
+            genericsExit( -1, "Elf file or symbols in it not found" EOL );
             break;
 
-        case  PROT_ETM:
-            genericsReport( V_INFO, "Using raw ETM" EOL );
+        case SYMBOL_NOOBJDUMP:
+            genericsExit( -1, "No objdump found" EOL );
+            break;
+
+        case SYMBOL_UNSPECIFIED:
+            genericsExit( -1, "Unknown error in symbol subsystem" EOL );
             break;
 
         default:
-            genericsReport( V_INFO, "Decoding unknown" EOL );
             break;
     }
 
-    return true;
-}
-// ====================================================================================================
-static void _doExit( void )
+    genericsReport( V_WARN, "Loaded %s" EOL, r->options->elffile );
 
-/* Perform any explicit exit functions */
+    /* The focus is by instruction too, and the names in it might be somewhere else now */
+    _focusInit( r );
 
-{
-    _r.ending = true;
-    /* Give them a bit of time, then we're leaving anyway */
-    usleep( 200 );
+    /* Coverage is by instruction, so it starts again with new symbols (or from what the map file has) */
+    _coverInit( r );
 
-}
-// ====================================================================================================
-static void _intHandler( int sig )
+    for ( int k = 0; k < r->ncores; k++ )
+    {
+        r->core[k]->s = r->s;
+        _coverInit( r->core[k] );
+    }
 
-/* Catch CTRL-C so things can be cleaned up properly via atexit functions */
-{
-    /* CTRL-C exit is not an error... */
-    _doExit();
+    if ( ext_ff_mergeCoverage( r->options->covfile, r->cov, r->s ) )
+    {
+        genericsReport( V_INFO, "Adding to coverage in %s" EOL, r->options->covfile );
+    }
 }
-
 // ====================================================================================================
+static void _processingStart( struct RunTime *r )
 
-static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
+/* Start the result processing task, which carries on across reconnections */
 
 {
-    if ( !p->good )
-    {
-        genericsReport( V_INFO, "Bad packet received" EOL );
-    }
-    else
+    if ( ( !r->processing ) && ( !r->reload ) )
     {
-        if ( p->tag == _r.options->tag )
-        {
-            TRACEDecoderPump( &_r.i, p->d, p->len, _traceCB, &_r );
-        }
+        _coresStart( r );
+        pthread_create( &r->processThread, NULL, &_processBlocks, r );
+        r->processing = true;
     }
 }
 // ====================================================================================================
-static void *_processBlocks( void *params )
+static void _symbolsPoll( struct RunTime *r, bool wait )
 
-/* Generic block processor for received data. This runs in a task parallel to the receiver and *
- * processes all of the data that arrive.                                                      */
+/* Pick up the symbols being loaded in the background if they're in (or wait for them), and start on the queued data */
 
 {
-    struct RunTime *r = ( struct RunTime * )params;
+    struct SymbolSet *s;
+    enum symbolErr err;
 
-    while ( true )
+    while ( r->reload )
     {
-        pthread_cond_wait( &r->dataForClients, &r->dataForClients_m );
-
-        if ( r->rp != ( volatile int )r->wp )
+        if ( SymbolReloadPoll( &r->reload, &s, &err ) )
         {
-            genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, r->rawBlock[r->rp].fillLevel );
-
-            /* Check to see if we've finished (a zero length packet */
-            if ( !r->rawBlock[r->rp].fillLevel )
-            {
-                break;
-            }
-
-#ifdef DUMP_BLOCK
-            uint8_t *c = r->rawBlock[r->rp].buffer;
-            uint32_t y = r->rawBlock[r->rp].fillLevel;
-
-            DBG_OUT( EOL );
-
-            while ( y-- )
-            {
-                DBG_OUT( "%02X ", *c++ );
-
-                if ( !( y % 16 ) )
-                {
-                    DBG_OUT( EOL );
-                }
-            }
-
-#endif
-
-            if ( PROT_OFLOW == r->options->protocol )
-            {
-                OFLOWPump( &_r.c, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel, _OFLOWpacketRxed, &_r );
-            }
-            else
-            {
-                /* Pump all of the data through the protocol handler */
-                TRACEDecoderPump( &r->i, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel, _traceCB, &_r );
-            }
-
-            r->rp = ( r->rp + 1 ) % NUM_RAW_BLOCKS;
+            r->s = s;
+            _symbolsIn( r, err );
+            _processingStart( r );
+        }
+        else if ( wait )
+        {
+            usleep( TICK_TIME_MS * 1000 );
+        }
+        else
+        {
+            break;
         }
     }
-
-    return NULL;
 }
 // ====================================================================================================
 int main( int argc, char *argv[] )
@@ -848,12 +2796,12 @@ int main( int argc, char *argv[] )
     _r.progName = genericsBasename( argv[0] );
     _r.options = &_options;
 
-    if ( pthread_mutex_init( &_r.dataForClients_m, NULL ) != 0 )
+    if ( pthread_mutex_init( &_r.kickLock, NULL ) != 0 )
     {
         genericsExit( -1, "Failed to establish mutex for condition variablee" EOL );
     }
 
-    if ( pthread_cond_init( &_r.dataForClients, NULL ) != 0 )
+    if ( pthread_cond_init( &_r.kick, NULL ) != 0 )
     {
         genericsExit( -1, "Failed to establish condition variablee" EOL );
     }
@@ -866,6 +2814,12 @@ int main( int argc, char *argv[] )
 
     genericsScreenHandling( !_r.options->mono );
 
+    /* ...with one spare, which is received into and discarded when the queue is full */
+    _r.rawBlock = ( struct dataBlock * )calloc( NUM_RAW_BLOCKS + 1, sizeof( struct dataBlock ) );
+    MEMCHECK( _r.rawBlock, -1 );
+    atomic_init( &_r.wp, 0 );
+    atomic_init( &_r.rp, 0 );
+
     /* Make sure the fifos get removed at the end */
     atexit( _doExit );
 
@@ -887,12 +2841,25 @@ int main( int argc, char *argv[] )
 
     TRACEDecoderInit( &_r.i, _r.options->tProtocol, !_r.options->noaltAddr, genericsReport );
     OFLOWInit( &_r.c );
+    ext_ff_stackInit( &_r.stacks );
+
+    if ( ( _r.options->timeline ) && ( !( _r.tl = perfettoCreate( _r.options->timeline, _r.options->elffile, ( _r.options->timelineMHz ) ? 1000.0 / _r.options->timelineMHz : 1.0 ) ) ) )
+    {
+        genericsExit( -1, "Could not create timeline" EOL );
+    }
+
+    /* ...several cores each get tracks of their own */
+    if ( ( _r.tl ) && ( _r.options->ntags == 1 ) )
+    {
+        _r.tlCalls = perfettoTrack( _r.tl, "Calls" );
+        _r.tlDepth = perfettoCounterTrack( _r.tl, "Call depth" );
+    }
 
     while ( !_r.ending )
     {
         if ( _r.options->file != NULL )
         {
-            stream = streamCreateFile( _r.options->file );
+            stream = streamCreateMappedFile( _r.options->file );
         }
         else
         {
@@ -900,6 +2867,11 @@ int main( int argc, char *argv[] )
             {
                 stream = streamCreateSocket( _r.options->server, _r.options->port );
 
+                if ( ( stream ) && ( _r.options->protocol == PROT_OFLOW ) )
+                {
+                    nwSubscribe( stream, _r.options->ntags, _r.options->tags );
+                }
+
                 if ( !stream )
                 {
                     break;
@@ -912,35 +2884,38 @@ int main( int argc, char *argv[] )
 
 
         /* We need symbols constantly while running ... lets get them */
-        if ( !SymbolSetValid( &_r.s, _r.options->elffile ) )
+        if ( ( !_r.reload ) && ( !SymbolSetValid( &_r.s, _r.options->elffile ) ) )
         {
-            r = SymbolSetCreate( &_r.s, _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true, _r.options->odoptions );
-
-            switch ( r )
+            if ( ( !_r.processing ) && ( !_r.options->file ) )
             {
-                case SYMBOL_NOELF:
-                    genericsExit( -1, "Elf file or symbols in it not found" EOL );
-                    break;
-
-                case SYMBOL_NOOBJDUMP:
-                    genericsExit( -1, "No objdump found" EOL );
-                    break;
+                /* A live source can't wait, so it's queued while they load and dealt with once they're in */
+                _r.reload = SymbolReloadStart( _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true, _r.options->odoptions );
+            }
+            else
+            {
+                r = SymbolSetCreate( &_r.s, _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true, _r.options->odoptions );
+                _symbolsIn( &_r, r );
+            }
+        }
 
-                case SYMBOL_UNSPECIFIED:
-                    genericsExit( -1, "Unknown error in symbol subsystem" EOL );
-                    break;
+        _r.intervalBytes = 0;
 
-                default:
-                    break;
+        if ( _r.options->jobs )
+        {
+            /* This is an offline capture, so it can be decoded all at once */
+            if ( !stream )
+            {
+                genericsExit( -1, "Could not open %s" EOL, _r.options->file );
             }
 
-            genericsReport( V_WARN, "Loaded %s" EOL, _r.options->elffile );
+            _decodeParallel( &_r, stream );
+            stream->close( stream );
+            free( stream );
+            break;
         }
 
-        _r.intervalBytes = 0;
-
-        /* Now start the result processing task */
-        pthread_create( &_r.processThread, NULL, &_processBlocks, &_r );
+        /* Now start the result processing task, unless it's waiting for the symbols */
+        _processingStart( &_r );
 
         /* ----------------------------------------------------------------------------- */
         /* This is the main active loop...only break out of this when ending or on error */
@@ -953,7 +2928,23 @@ int main( int argc, char *argv[] )
             tv.tv_usec  = TICK_TIME_MS * 1000;
 
 
-            struct dataBlock *rxBlock = &_r.rawBlock[_r.wp];
+            _symbolsPoll( &_r, false );
+
+            struct dataBlock *rxBlock = _queueSlot( &_r );
+
+            /* A file can wait for the processor to catch up, but a live source can't be held up */
+            if ( ( !rxBlock ) && ( _r.options->file ) )
+            {
+                usleep( TICK_TIME_MS * 1000 );
+                continue;
+            }
+
+            bool discard = ( !rxBlock );
+
+            if ( discard )
+            {
+                rxBlock = &_r.rawBlock[NUM_RAW_BLOCKS];
+            }
 
             enum ReceiveResult result = stream->receive( stream, rxBlock->buffer, TRANSFER_SIZE, &tv, ( size_t * )&rxBlock->fillLevel );
 
@@ -971,33 +2962,38 @@ int main( int argc, char *argv[] )
             /* ...record the fact that we received some data */
             _r.intervalBytes += rxBlock->fillLevel;
 
-            int nwp = ( _r.wp + 1 ) % NUM_RAW_BLOCKS;
-
-            if ( nwp == ( volatile int )_r.rp )
+            if ( discard )
             {
-                genericsExit( -1, "Overflow" EOL );
+                _queueDrop( &_r, rxBlock->fillLevel );
+            }
+            else
+            {
+                _queuePush( &_r );
             }
 
-            _r.wp = nwp;
-            pthread_cond_signal( &_r.dataForClients );
-
-            /* Update the intervals */
-            if ( ( ( volatile bool ) _r.sampling ) && ( ( genericsTimestampmS() - ( volatile uint32_t )_r.starttime ) > _r.options->sampleDuration ) )
+            /* Update the intervals...in continuous mode we keep going until we're stopped */
+            if ( ( !_r.options->continuous ) && ( ( volatile bool ) _r.sampling ) && ( ( genericsTimestampmS() - ( volatile uint32_t )_r.starttime ) > _r.options->sampleDuration ) )
             {
                 _r.ending = true;
+            }
+        }
 
-                /* Post an empty data packet to flag to packet processor that it's done */
-                int nwp = ( _r.wp + 1 ) % NUM_RAW_BLOCKS;
+        if ( _r.ending )
+        {
+            /* Post an empty data packet to flag to packet processor that it's done...this is also */
+            /* how a continuous run, which only ends with CTRL-C, gets to write its final output.  */
+            /* Whatever queued up while the symbols were loading is processed first.                */
+            struct dataBlock *endBlock;
 
-                if ( nwp == ( volatile int )_r.rp )
-                {
-                    genericsExit( -1, "Overflow" EOL );
-                }
+            _symbolsPoll( &_r, true );
 
-                _r.rawBlock[_r.wp].fillLevel = 0;
-                _r.wp = nwp;
-                pthread_cond_signal( &_r.dataForClients );
+            while ( !( endBlock = _queueSlot( &_r ) ) )
+            {
+                usleep( TICK_TIME_MS * 1000 );
             }
+
+            endBlock->fillLevel = 0;
+            _queuePush( &_r );
         }
 
         stream->close( stream );
@@ -1005,7 +3001,19 @@ int main( int argc, char *argv[] )
     }
 
     /* Wait for data processing to be completed */
-    pthread_join( _r.processThread, NULL );
+    if ( _r.processing )
+    {
+        pthread_join( _r.processThread, NULL );
+        _coresMerge( &_r );
+    }
+
+    perfettoClose( _r.tl );
+
+    if ( _r.droppedBlocks )
+    {
+        genericsReport( V_WARN, "Dropped %" PRIu64 " blocks (%" PRIu64 " bytes) because processing didn't keep up" EOL,
+                        _r.droppedBlocks, _r.droppedBytes );
+    }
 
     /* Data are collected, now process and report */
     genericsReport( V_INFO, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL,
@@ -1013,37 +3021,24 @@ int main( int argc, char *argv[] )
 
     if ( HASH_COUNT( _r.subhead ) )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
-        {
-            genericsReport( V_INFO, "Output DOT" EOL );
-        }
-        else
-        {
-            if ( _r.options->dotfile )
-            {
-                genericsExit( -1, "Failed to output DOT" EOL );
-            }
-        }
-
-        if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile,
-                                   _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL,
-                                   true,
-                                   _r.op.lasttstamp - _r.op.firsttstamp,
-                                   _r.insthead,
-                                   _r.subhead,
-                                   _r.s ) )
-        {
-            genericsReport( V_INFO, "Output Profile" EOL );
-        }
-        else
-        {
-            if ( _r.options->profile )
-            {
-                genericsExit( -1, "Failed to output profile" EOL );
-            }
-        }
+        _outputResults( &_r );
     }
 
+    /* The sample is done with, so the records can go in one go */
+    HASH_CLEAR( hh, _r.insthead );
+    HASH_CLEAR( hh, _r.subhead );
+    ext_ff_stackDelete( &_r.stacks );
+    _arenaFree( &_r.arena );
+    _arenaFree( &_r.callArena );
+    memFree( MEM_ADDRESSES, _r.exec );
+    _r.exec = NULL;
+    memFree( MEM_ADDRESSES, _r.cost );
+    _r.cost = NULL;
+    memFree( MEM_ADDRESSES, _r.pend );
+    _r.pend = NULL;
+    memFree( MEM_ADDRESSES, _r.cov );
+    _r.cov = NULL;
+
     return OK;
 }
 
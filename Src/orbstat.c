@@ -14,8 +14,10 @@
 #include <signal.h>
 #include <assert.h>
 #include <getopt.h>
+#include <inttypes.h>
 
 #include "git_version_info.h"
+#define MEM_ACCOUNT_UTHASH
 #include "uthash.h"
 #include "generics.h"
 #include "itmDecoder.h"
@@ -25,6 +27,8 @@
 #include "nw.h"
 #include "ext_fileformats.h"
 #include "stream.h"
+#include "memAccount.h"
+#include "markerLatency.h"
 
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
@@ -32,16 +36,27 @@
 #define DEFAULT_TRACE_CHANNEL  30        /* ITM Channel that we expect trace data to arrive on */
 #define DEFAULT_FILE_CHANNEL   29        /* ITM Channel that we expect file data to arrive on */
 
+#define DEFAULT_MAX_EDGES   (16384)      /* Distinct calls we'll keep track of, by default */
+#define MAX_HELD            (32*1024*1024) /* Most data held while the symbols load, in bytes */
+#define MAX_CALL_DEPTH      (1024)       /* Deepest call stack we'll account for */
+
 /* Interface to/from target */
 #define COMMS_MASK (0xF0000000)
 #define IN_EVENT   (0x40000000)
 #define OUT_EVENT  (0x50000000)
 
+/* Compact variant (see Support/orbstat), one word plus a short call site for functions with an id */
+#define CIN_EVENT  (0x60000000)          /* Call to function id, with 16 bit timestamp */
+#define COUT_EVENT (0x70000000)          /* Return from function id, with 16 bit timestamp */
+#define CDEF_EVENT (0x80000000)          /* Function id is defined by the address in the next word */
+#define CID(x)     (((x)>>16)&0xFFF)
+#define MAX_FNIDS  (4096)
+
 enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ITM", NULL};
 
 /* States for sample reception state machine */
-enum CDState { CD_waitinout, CD_waitsrc, CD_waitdst };
+enum CDState { CD_waitinout, CD_waitsrc, CD_waitdst, CD_waitsite, CD_waitdef };
 
 /* ---------- CONFIGURATION ----------------- */
 struct Options                           /* Record for options, either defaults or from command line */
@@ -61,11 +76,17 @@ struct Options                           /* Record for options, either defaults
 
     char *dotfile;                       /* File to output dot information */
     char *profile;                       /* File to output profile information */
+    char *stackfile;                     /* File to output folded stacks */
+    char *pproffile;                     /* File to output pprof profile */
     uint32_t sampleDuration;             /* How long we are going to sample for */
+    int continuous;                      /* Interval between rolling outputs (in seconds), or 0 to output once at the end */
+    uint32_t maxEdges;                   /* Upper limit on number of distinct calls recorded */
+    bool fold;                           /* Fold calls to function level, rather than call site */
     bool forceITMSync;                   /* Do we assume ITM starts synced? */
     bool mono;                           /* Supress colour in output */
 
     uint32_t tag;                        /* Which OFLOW stream are we decoding? */
+    uint32_t clockHz;                    /* Timestamp clock, for latencies in uS rather than ticks, or 0 */
 
     int port;                            /* Source information for where to connect to */
     char *server;
@@ -75,6 +96,7 @@ struct Options                           /* Record for options, either defaults
 {
     .demangle       = true,
     .sampleDuration = DEFAULT_DURATION_MS,
+    .maxEdges       = DEFAULT_MAX_EDGES,
     .port           = OFCLIENT_SERVER_PORT,
     .traceChannel   = DEFAULT_TRACE_CHANNEL,
     .fileChannel    = DEFAULT_FILE_CHANNEL,
@@ -83,6 +105,13 @@ struct Options                           /* Record for options, either defaults
     .server         = "localhost"
 };
 
+/* Slot in the address table, mapping a target address to its (possibly folded) record */
+struct addrSlot
+{
+    uint32_t addr;
+    struct execEntryHash *e;            /* ...NULL if the slot is free */
+};
+
 /* A block of received data */
 struct dataBlock
 {
@@ -104,29 +133,55 @@ struct RunTime
 
     /* Calls related info */
     enum CDState CDState;               /* State of the call data machine */
+    bool isIn;                          /* Is the event in progress a call (or a return)? */
+    uint32_t srcAddr;                   /* Call site of the event in progress */
+    uint32_t dstAddr;                   /* ...and the function it's to */
+    uint32_t defId;                     /* Function id being defined */
+    uint32_t lastSite;                  /* Last call site in compact form, which the next is relative to */
+    uint32_t fnAddr[MAX_FNIDS];         /* Function ids to addresses, as target has defined them */
     struct edge *calls;                 /* Call data table */
 
     struct subcall *subhead;            /* Calls onstruct data */
-    struct subcall **substack;          /* Calls stack data */
-    uint32_t substacklen;               /* Calls stack length */
+    struct subcall *substack[MAX_CALL_DEPTH]; /* Calls stack data */
+    uint32_t substacklen;               /* Calls stack length (which may be deeper than we record) */
+    struct stackTree stacks;            /* Time by calling context, for the stack formats */
 
     struct execEntryHash *insthead;     /* Exec table handle for hash */
 
+    /* Fixed size open addressed tables that all lookups go through, so memory use doesn't grow */
+    struct addrSlot *addrTab;           /* Address to record table */
+    uint32_t addrBits;                  /* log2 of its number of slots */
+    uint32_t addrUsed;                  /* ...and how many of them are in use */
+    struct subcall **edgeTab;           /* (src,dst) to call record table */
+    uint32_t edgeBits;
+    uint32_t edgeUsed;
+
+    struct execEntryHash *instPool;     /* Storage for the records themselves */
+    uint32_t instUsed;
+    struct subcall *edgePool;
+
+    uint64_t dropped;                   /* Calls we couldn't record 'cos the tables were full */
+
     struct SymbolSet *s;                /* Symbols read from elf */
+    struct SymbolReload *reload;        /* ...or being loaded in the background, if they are */
+    uint8_t *held;                      /* Data received while they load, decoded once they're in */
+    size_t heldLen;                     /* ...how much of it there is */
+    size_t heldSize;                    /* ...and room for */
+    uint64_t heldDropped;               /* Data there wasn't room to hold */
+    struct markerLatency *ml;           /* Marker pairs being timed, if any */
     struct Options *options;            /* Our runtime configuration */
 
     struct dataBlock rawBlock;          /* Datablock received from distribution */
 
     bool sampling;                      /* Are we actively sampling at the moment */
     uint32_t starttime;                 /* At what time did we start sampling? */
+    uint32_t lastWrite;                 /* ...and when did we last write the output files (continuous mode) */
 
     /* Turn addresses into files and routines tags */
     struct execEntryHash *from;         /* Where the call was from */
     struct execEntryHash *to;           /* Where the call was to */
 
     /* Used for stretching number of bits in target timer */
-    uint32_t oldt;                      /* Last received timestamp */
-    uint64_t highOrdert;                /* High order bits */
     uint64_t tcount;                    /* Constructed current count */
     uint64_t starttcount;               /* Count at which we started */
 } _r;
@@ -141,196 +196,431 @@ struct RunTime
 
 
 // ====================================================================================================
-// Callback function for trace messages from the target CPU (via ITM channel)
+static inline uint32_t _slot( uint32_t h, uint32_t bits )
+
+/* Fibonacci hash into a table of 2^bits slots. Takes the top bits, since code addresses all share their bottom one */
+
+{
+    return ( h * 0x9E3779B1 ) >> ( 32 - bits );
+}
 // ====================================================================================================
-static void _handleSW( struct RunTime *r )
+static void _allocTables( struct RunTime *r )
+
+/* Size the tables once at the start. Two addresses per call at most, and keep everything under half full */
+
+{
+    r->edgeBits = 1;
+
+    while ( ( 1U << r->edgeBits ) < 2 * r->options->maxEdges )
+    {
+        r->edgeBits++;
+    }
+
+    r->addrBits = r->edgeBits + 1;
+
+    r->addrTab  = ( struct addrSlot * )memCalloc( MEM_ADDRESSES, 1U << r->addrBits, sizeof( struct addrSlot ) );
+    MEMCHECKV( r->addrTab );
+    r->edgeTab  = ( struct subcall ** )memCalloc( MEM_CALLS, 1U << r->edgeBits, sizeof( struct subcall * ) );
+    MEMCHECKV( r->edgeTab );
+    r->instPool = ( struct execEntryHash * )memCalloc( MEM_ADDRESSES, 2 * r->options->maxEdges, sizeof( struct execEntryHash ) );
+    MEMCHECKV( r->instPool );
+    r->edgePool = ( struct subcall * )memCalloc( MEM_CALLS, r->options->maxEdges, sizeof( struct subcall ) );
+    MEMCHECKV( r->edgePool );
+}
+// ====================================================================================================
+static void _tableFull( struct RunTime *r )
 
 {
+    r->dropped++;
+    genericsReportRateLimited( V_WARN, "Call tables full, dropping calls (increase -k, or fold with -F)" EOL );
+}
+// ====================================================================================================
+static struct execEntryHash *_lookupAddr( struct RunTime *r, uint32_t addr )
+
+/* Find the record for an address, creating it if it's new. With folding, all of a function shares one record */
+
+{
+    uint32_t mask = ( 1U << r->addrBits ) - 1;
+    uint32_t i = _slot( addr, r->addrBits );
+    struct execEntryHash *e = NULL;
     struct nameEntry n;
-    struct subcallSig sig;
+    uint32_t key = addr;
+
+    while ( r->addrTab[i].e )
+    {
+        if ( r->addrTab[i].addr == addr )
+        {
+            return r->addrTab[i].e;
+        }
+
+        i = ( i + 1 ) & mask;
+    }
+
+    /* First time we've seen this address, which is the only time it goes near the symbol table */
+    if ( r->addrUsed == 2 * r->options->maxEdges )
+    {
+        _tableFull( r );
+        return NULL;
+    }
+
+    if ( !SymbolLookup( r->s, addr, &n ) )
+    {
+        genericsReportRateLimited( V_ERROR, "No symbol for address %08x" EOL, addr );
+        return NULL;
+    }
+
+    if ( ( r->options->fold ) && ( n.functionindex < r->s->functionCount ) )
+    {
+        key = r->s->functions[n.functionindex].startAddr;
+        HASH_FIND_INT( r->insthead, &key, e );
+
+        if ( ( !e ) && ( key != addr ) )
+        {
+            SymbolLookup( r->s, key, &n );
+        }
+    }
+
+    if ( !e )
+    {
+        e = &r->instPool[r->instUsed++];
+        e->addr          = key;
+        e->fileindex     = n.fileindex;
+        e->line          = n.line;
+        e->functionindex = n.functionindex;
+        HASH_ADD_INT( r->insthead, addr, e );
+    }
+
+    r->addrTab[i].addr = addr;
+    r->addrTab[i].e    = e;
+    r->addrUsed++;
+    return e;
+}
+// ====================================================================================================
+static struct subcall *_lookupEdge( struct RunTime *r, struct execEntryHash *from, struct execEntryHash *to )
+
+/* Find the record for a call, creating it if it's new */
+
+{
+    uint32_t mask = ( 1U << r->edgeBits ) - 1;
+    uint32_t i = _slot( ( from->addr * 0x85EBCA77 ) ^ to->addr, r->edgeBits );
     struct subcall *s;
-    static bool isIn;
-    uint32_t addr;
 
+    while ( ( s = r->edgeTab[i] ) )
+    {
+        if ( ( s->sig.src == from->addr ) && ( s->sig.dst == to->addr ) )
+        {
+            return s;
+        }
+
+        i = ( i + 1 ) & mask;
+    }
+
+    if ( r->edgeUsed == r->options->maxEdges )
+    {
+        _tableFull( r );
+        return NULL;
+    }
+
+    s = &r->edgePool[r->edgeUsed++];
+    s->sig.src = from->addr;
+    s->sig.dst = to->addr;
+    s->srch    = from;
+    s->dsth    = to;
+    HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
+    r->edgeTab[i] = s;
+    return s;
+}
+// ====================================================================================================
+static void _updateTime( struct RunTime *r, uint32_t t, int bits )
+
+/* Stretch the bottom bits of the target timer we've been sent into the full count, accomodating rollover */
+
+{
+    uint64_t mask = ( 1ULL << bits ) - 1;
+    uint64_t newt = ( r->tcount & ~mask ) | ( t & mask );
+
+    if ( newt < r->tcount )
+    {
+        newt += mask + 1;
+    }
+
+    r->tcount = newt;
+
+    /* Finally, if we're not sampling, then start sampling */
+    if ( !r->sampling )
+    {
+        genericsReport( V_WARN, "Sampling" EOL );
+        /* Fill in a time to start from */
+        r->starttime     = genericsTimestampmS();
+        r->lastWrite     = r->starttime;
+        r->intervalBytes = 0;
+        r->starttcount   = r->tcount;
+        r->sampling      = true;
+    }
+}
+// ====================================================================================================
+static void _callEvent( struct RunTime *r )
+
+/* We have everything. Record calls between functions. These are flagged via isIn true/false for call/return */
+
+{
+    struct subcall *s;
+
+    /* Source address is the address of the _return_, so subtract 4 */
+    if ( !( r->from = _lookupAddr( r, r->srcAddr - 4 ) ) )
+    {
+        return;
+    }
+
+    r->from->count++;
+
+    if ( !( r->to = _lookupAddr( r, r->dstAddr ) ) )
+    {
+        return;
+    }
+
+    r->to->count++;
+
+    if ( r->isIn )
+    {
+        /* Find, or create, the call record */
+        s = _lookupEdge( r, r->from, r->to );
+
+        /* Now handle calling/return stack */
+        /* If we've got a subcall record, initialise its starting ticks */
+        if ( s )
+        {
+            s->inTicks = r->tcount;
+            s->count++;
+        }
+
+        if ( ( r->options->stackfile ) || ( r->options->pproffile ) )
+        {
+            ext_ff_stackCall( &r->stacks, r->to->addr, r->tcount );
+        }
+
+        /* ...and add it to the call stack, keeping depth even if it's too deep (or too full) to record */
+        if ( r->substacklen < MAX_CALL_DEPTH )
+        {
+            r->substack[r->substacklen] = s;
+        }
+
+        r->substacklen++;
+    }
+    else
+    {
+        /* We've come out */
+        if ( ( r->substacklen ) && ( ( r->options->stackfile ) || ( r->options->pproffile ) ) )
+        {
+            ext_ff_stackReturn( &r->stacks, r->tcount );
+        }
+
+        if ( ( !r->substacklen ) || ( --r->substacklen >= MAX_CALL_DEPTH ) || ( !( s = r->substack[r->substacklen] ) ) )
+        {
+            return;
+        }
+
+        if ( ( s->sig.src != r->from->addr ) || ( s->sig.dst != r->to->addr ) )
+        {
+            genericsReportRateLimited( V_WARN, "Address mismatch" EOL );
+        }
+
+        s->myCost = ( r->tcount - s->inTicks );
+    }
+}
+// ====================================================================================================
+// Callback function for trace messages from the target CPU (via ITM channel)
+// ====================================================================================================
+static void _handleSW( struct RunTime *r )
+
+{
     struct swMsg *m = ( struct swMsg * )&r->m;
 
+    if ( r->ml )
+    {
+        markerLatencySW( r->ml, m->srcAddr, m->value );
+    }
+
     if ( m->srcAddr == r->options->traceChannel )
     {
         switch ( r->CDState )
         {
             // -------------------- Reporting the time stamp and if it's an In or Out event
             case CD_waitinout:
-                if ( ( m->value & COMMS_MASK ) == IN_EVENT )
+                switch ( m->value & COMMS_MASK )
                 {
-                    isIn = true;
-                    r->CDState = CD_waitsrc;
-                }
+                    case IN_EVENT:
+                    case OUT_EVENT:
+                        /* Time is encoded in lowest three octets */
+                        r->isIn = ( ( m->value & COMMS_MASK ) == IN_EVENT );
+                        _updateTime( r, m->value, 24 );
+                        r->CDState = CD_waitsrc;
+                        break;
 
-                if ( ( m->value & COMMS_MASK ) == OUT_EVENT )
-                {
-                    isIn = false;
-                    r->CDState = CD_waitsrc;
-                }
+                    case CIN_EVENT:
+                    case COUT_EVENT:
+                        /* ...and in the lowest two for the compact form, where we already know the function */
+                        r->isIn = ( ( m->value & COMMS_MASK ) == CIN_EVENT );
+                        _updateTime( r, m->value, 16 );
+                        r->dstAddr = r->fnAddr[CID( m->value )];
+                        r->CDState = CD_waitsite;
 
-                if ( r->CDState != CD_waitinout )
-                {
-                    /* Time is encoded in lowest three octets ...accomodate rollover */
-                    uint32_t t = m->value & 0xFFFFFF;
+                        if ( !r->dstAddr )
+                        {
+                            genericsReportRateLimited( V_WARN, "Undefined function id %d" EOL, CID( m->value ) );
+                        }
 
-                    if ( t < _r.oldt )
-                    {
-                        r->highOrdert++;
-                    }
+                        break;
 
-                    r->oldt = t;
-                    r->tcount = ( _r.highOrdert << 24 ) | t;
+                    case CDEF_EVENT:
+                        r->defId = CID( m->value );
+                        r->CDState = CD_waitdef;
+                        break;
 
-                    /* Finally, if we're not sampling, then start sampling */
-                    if ( !r->sampling )
-                    {
-                        genericsReport( V_WARN, "Sampling" EOL );
-                        /* Fill in a time to start from */
-                        r->starttime     = genericsTimestampmS();
-                        r->intervalBytes = 0;
-                        r->starttcount   = r->tcount;
-                        r->sampling      = true;
-                    }
+                    default:
+                        break;
                 }
 
                 break;
 
             // -------------------- Reporting the source address
             case CD_waitsrc:
-                /* Source address is the address of the _return_, so subtract 4 */
-                addr = ( m->value - 4 );
+                r->srcAddr = m->value;
                 r->CDState = CD_waitdst;
-                HASH_FIND_INT( r->insthead, &addr, r->from );
-
-                if ( !r->from )
-                {
-                    if ( SymbolLookup( r->s, addr, &n ) )
-                    {
-                        r->from = calloc( 1, sizeof( struct execEntryHash ) );
+                break;
 
-                        if ( !r->from )
-                        {
-                            genericsExit( ENOMEM,  "Memory allocation failure at %s::%d", __FILE__, __LINE__ );
-                        }
+            // -------------------- Reporting the destination address
+            case CD_waitdst:
+                r->dstAddr = m->value;
+                r->CDState = CD_waitinout;
+                _callEvent( r );
+                break;
 
-                        r->from->addr          = addr;
-                        r->from->fileindex     = n.fileindex;
-                        r->from->line          = n.line;
-                        r->from->functionindex = n.functionindex;
-                    }
-                    else
-                    {
-                        genericsReport( V_ERROR, "No symbol for address %08x" EOL, addr );
-                        r->CDState = CD_waitinout;
-                        return;
-                    }
+            // -------------------- Reporting the call site in compact form, either relative (by halfwords) or absolute
+            case CD_waitsite:
+                r->CDState = CD_waitinout;
+                r->lastSite = ( m->len == 2 ) ? r->lastSite + 2 * ( int16_t )( m->value & 0xFFFF ) : m->value;
+                r->srcAddr = r->lastSite;
 
-                    HASH_ADD_INT( r->insthead, addr, ( r->from ) );
+                if ( r->dstAddr )
+                {
+                    _callEvent( r );
                 }
 
-                r->from->count++;
                 break;
 
-            // -------------------- Reporting the return address
-            case CD_waitdst:
-                addr = m->value;
+            // -------------------- Reporting the address for a function id
+            case CD_waitdef:
+                r->fnAddr[r->defId] = m->value;
                 r->CDState = CD_waitinout;
+                break;
+                // --------------------
+        }
+    }
+}
+// ====================================================================================================
+static void _handleTS( struct RunTime *r )
 
-                HASH_FIND_INT( r->insthead, &addr, r->to );
-
-                if ( !r->to )
-                {
-                    if ( SymbolLookup( r->s, addr, &n ) )
-                    {
-                        r->to = calloc( 1, sizeof( struct execEntryHash ) );
+{
+    struct TSMsg *m = ( struct TSMsg * )&r->m;
 
-                        if ( !r->to )
-                        {
-                            genericsExit( ENOMEM,  "Memory allocation failure at %s::%d", __FILE__, __LINE__ );
-                        }
+    if ( r->ml )
+    {
+        markerLatencyTS( r->ml, m->timeInc );
+    }
+}
+// ====================================================================================================
+static double _latencyUnits( struct RunTime *r, uint64_t ticks )
 
-                        r->to->addr          = addr;
-                        r->to->fileindex     = n.fileindex;
-                        r->to->line          = n.line;
-                        r->to->functionindex = n.functionindex;
-                    }
-                    else
-                    {
-                        genericsReport( V_ERROR, "No symbol for address %08x" EOL, addr );
-                        r->CDState = CD_waitinout;
-                        return;
-                    }
+{
+    return ( r->options->clockHz ) ? ticks * 1000000.0 / r->options->clockHz : ticks;
+}
+// ====================================================================================================
+static void _outputLatency( struct RunTime *r )
 
-                    HASH_ADD_INT( r->insthead, addr, ( r->to ) );
-                }
+/* A line for each marker pair, covering what's happened since the last one, and its worst ever */
 
-                r->to->count++;
+{
+    struct markerLatencyStats s;
 
-                /* ----------------------------------------------------------------------------------------------------------*/
-                /* We have everything. Record calls between functions. These are flagged via isIn true/false for call/return */
-                /* ----------------------------------------------------------------------------------------------------------*/
-                if ( isIn )
-                {
-                    /* Now make calling record */
-                    sig.src = r->from->addr;
-                    sig.dst = r->to->addr;
+    if ( !markerLatencyTimed( r->ml ) )
+    {
+        genericsReportRateLimited( V_WARN, "No ITM timestamps, so latencies can't be measured (is TSENA set?)" EOL );
+    }
 
-                    /* Find, or create, the call record */
-                    HASH_FIND( hh, r->subhead, &sig, sizeof( struct subcallSig ), s );
+    genericsPrintf( C_RESET "%-20s %10s %10s %10s %10s %10s %12s %10s %9s %9s" EOL, "Pair", "Count", "p50", "p99", "p99.9", "Max",
+                    "Total", "Worst", "Overruns", "Strays" );
 
-                    if ( !s )
-                    {
-                        /* This entry doesn't exist...let's create it */
-                        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
+    for ( unsigned int i = 0; i < markerLatencyNumPairs( r->ml ); i++ )
+    {
+        markerLatencyTake( r->ml, i, &s );
+        genericsPrintf( "%-20s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %12" PRIu64 " %10.1f %9" PRIu64 " %9" PRIu64 EOL,
+                        markerLatencyName( r->ml, i ), s.count, _latencyUnits( r, s.p50 ), _latencyUnits( r, s.p99 ), _latencyUnits( r, s.p999 ),
+                        _latencyUnits( r, s.max ), s.total, _latencyUnits( r, s.worst ), s.overruns, s.strays );
+    }
 
-                        if ( !s )
-                        {
-                            genericsExit( ENOMEM,  "Memory allocation failure at %s::%d", __FILE__, __LINE__ );
-                        }
+    genericsPrintf( "(%s)" EOL EOL, ( r->options->clockHz ) ? "uS" : "timestamp ticks" );
+}
+// ====================================================================================================
+static void _checkLatency( struct RunTime *r )
 
-                        memcpy( &s->sig, &sig, sizeof( struct subcallSig ) );
-                        s->srch = r->from;
-                        s->dsth = r->to;
-                        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
-                    }
+{
+    uint32_t now = genericsTimestampmS();
+    uint32_t interval = ( r->options->continuous ) ? r->options->continuous * 1000 : DEFAULT_DURATION_MS;
 
+    if ( now - r->lastWrite >= interval )
+    {
+        _outputLatency( r );
+        r->lastWrite = now;
+    }
+}
+// ====================================================================================================
+static void _outputResults( struct RunTime *r )
 
-                    /* Now handle calling/return stack */
-                    /* However we got here, we've got a subcall record, so initialise its starting ticks */
-                    s->inTicks = r->tcount;
-                    s->count++;
+/* Write out whichever of the dot and profile files were asked for */
 
-                    /* ...and add it to the call stack */
-                    r->substack = ( struct subcall ** )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct subcall * ) );
-                    r->substack[r->substacklen++] = s;
-                }
-                else
-                {
-                    /* We've come out */
-                    if ( r->substacklen )
-                    {
-                        /* We don't bother deallocating memory here cos it'll be done on the next isSubCall */
-                        s = r->substack[--r->substacklen];
+{
+    if ( ext_ff_outputDot( r->options->dotfile, r->subhead, r->s ) )
+    {
+        genericsReport( V_WARN, "Output DOT" EOL );
+    }
 
-                        if ( ( s->sig.src != r->from->addr ) || ( s->sig.dst != r->to->addr ) )
-                        {
-                            genericsReport( V_WARN, "Address mismatch" EOL );
-                        }
+    if ( ext_ff_outputProfile( r->options->profile, r->options->elffile, r->options->truncateDeleteMaterial ? r->options->deleteMaterial : NULL, false, false,
+                               r->tcount - r->starttcount, r->insthead, r->subhead, r->s ) )
+    {
+        genericsReport( V_WARN, "Output Profile" EOL );
+    }
 
-                        s->myCost = ( r->tcount - s->inTicks );
-                    }
-                }
+    if ( ext_ff_outputFolded( r->options->stackfile, &r->stacks, r->s ) )
+    {
+        genericsReport( V_WARN, "Output folded stacks" EOL );
+    }
 
-                break;
-                // --------------------
-        }
+    if ( ext_ff_outputPprof( r->options->pproffile, "ticks", "count", &r->stacks, r->s ) )
+    {
+        genericsReport( V_WARN, "Output pprof" EOL );
     }
 }
+// ====================================================================================================
+static void _checkContinuous( struct RunTime *r )
+
+/* Write out what has happened since the last output, once its interval is up */
 
+{
+    if ( ( !r->sampling ) || ( !HASH_COUNT( r->subhead ) ) ||
+            ( genericsTimestampmS() - r->lastWrite < r->options->continuous * 1000 ) )
+    {
+        return;
+    }
+
+    _outputResults( r );
+
+    /* ...and start counting again from here, leaving the call stack as it is */
+    ext_ff_zeroCounts( r->insthead, r->subhead );
+    ext_ff_stackZero( &r->stacks );
+    r->starttcount = r->tcount;
+    r->lastWrite = genericsTimestampmS();
+}
 // ====================================================================================================
 void _itmPumpProcess( struct RunTime *r, char c )
 
@@ -355,7 +645,7 @@ void _itmPumpProcess( struct RunTime *r, char c )
         /* MSG_PC_SAMPLE */       NULL,
         /* MSG_DWT_EVENT */       NULL,
         /* MSG_EXCEPTION */       NULL,
-        /* MSG_TS */              NULL
+        /* MSG_TS */              ( handlers )_handleTS
     };
 
     switch ( ITMPump( &r->i, c ) )
@@ -366,22 +656,35 @@ void _itmPumpProcess( struct RunTime *r, char c )
 
         // ------------------------------------
         case ITM_EV_UNSYNCED:
-            genericsReport( V_INFO, "ITM Lost Sync (%d)" EOL, ITMDecoderGetStats( &r->i )->lostSyncCount );
+            genericsReport( V_INFO, "ITM Lost Sync (%" PRIu64 ")" EOL, ITMDecoderGetStats( &r->i )->lostSyncCount );
+
+            if ( r->ml )
+            {
+                markerLatencyReset( r->ml );
+            }
+
             break;
 
         // ------------------------------------
         case ITM_EV_SYNCED:
-            genericsReport( V_INFO, "ITM In Sync (%d)" EOL, ITMDecoderGetStats( &r->i )->syncCount );
+            genericsReport( V_INFO, "ITM In Sync (%" PRIu64 ")" EOL, ITMDecoderGetStats( &r->i )->syncCount );
             break;
 
         // ------------------------------------
         case ITM_EV_OVERFLOW:
-            genericsReport( V_WARN, "ITM Overflow (%d)" EOL, ITMDecoderGetStats( &r->i )->overflow );
+            genericsReportRateLimited( V_WARN, "ITM Overflow (%" PRIu64 ")" EOL, ITMDecoderGetStats( &r->i )->overflow );
+
+            /* Markers may have been lost, so nothing that's open can be trusted */
+            if ( r->ml )
+            {
+                markerLatencyReset( r->ml );
+            }
+
             break;
 
         // ------------------------------------
         case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
+            genericsReportRateLimited( V_WARN, "ITM Error" EOL );
             break;
 
         // ------------------------------------
@@ -405,18 +708,24 @@ static void _printHelp( struct RunTime *r )
 
 {
     genericsPrintf( "Usage: %s [options]" EOL, r->progName );
+    genericsPrintf( "    -C, --clock:        <Hz> Timestamp clock, to give latencies in uS rather than ticks" EOL );
+    genericsPrintf( "    -c, --continuous:   <Seconds> Keep sampling, rewriting the output files with each interval's results" EOL );
     genericsPrintf( "    -D, --no-demangle:  Switch off C++ symbol demangling" EOL );
     genericsPrintf( "    -d, --del-prefix:   <String> Material to delete off front of filenames" EOL );
     genericsPrintf( "    -e, --elf-file:     <ElfFile> to use for symbols" EOL );
     genericsPrintf( "    -E, --eof:          When reading from file, terminate at end of file" EOL );
     genericsPrintf( "    -f, --input-file:   <filename>: Take input from specified file" EOL );
+    genericsPrintf( "    -F, --fold:         Fold calls to function level, rather than recording each call site" EOL );
     genericsPrintf( "    -g, --trace-chn:    <TraceChannel> ITM channel for trace (default %d)" EOL, r->options->traceChannel );
     genericsPrintf( "    -h, --help:         This help" EOL );
     genericsPrintf( "    -I, --interval:     <Interval>: Time to sample (in mS)" EOL );
+    genericsPrintf( "    -k, --edges:        <Count> Maximum number of distinct calls to record (default %d)" EOL, r->options->maxEdges );
+    genericsPrintf( "    -L, --latency:      [<Name>=]<Chn>[:<Value>],<Chn>[:<Value>] Time from a start to a stop marker, repeat for more" EOL );
     genericsPrintf( "    -n, --itm-sync:     Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
     genericsPrintf( "    -O, --objdump-opts: <options> Options to pass directly to objdump" EOL );
     genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -S, --stack-file:   <Filename> folded stacks output (flamegraph.pl, speedscope)" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
     genericsPrintf( "    -t, --tag:          <stream>: Which OFLOW tag to use (normally 1)" EOL );
     genericsPrintf( "    -T, --all-truncate: truncate -d material off all references (i.e. make output relative)" EOL );
@@ -424,6 +733,7 @@ static void _printHelp( struct RunTime *r )
     genericsPrintf( "    -V, --version:      Print version and exit" EOL );
     genericsPrintf( "    -y, --graph-file:   <Filename> dotty filename for structured callgraph output" EOL );
     genericsPrintf( "    -z, --cache-file:   <Filename> profile filename for kcachegrind output" EOL );
+    genericsPrintf( "    -Z, --pprof-file:   <Filename> gzipped pprof profile output" EOL );
 }
 // ====================================================================================================
 void _printVersion( void )
@@ -434,26 +744,33 @@ void _printVersion( void )
 // ====================================================================================================
 static struct option _longOptions[] =
 {
+    {"clock", required_argument, NULL, 'C'},
+    {"continuous", required_argument, NULL, 'c'},
     {"no-demangle", no_argument, NULL, 'D'},
     {"del-prefix", required_argument, NULL, 'd'},
     {"elf-file", required_argument, NULL, 'e'},
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
+    {"fold", no_argument, NULL, 'F'},
     {"trace-chn", required_argument, NULL, 'g'},
     {"help", no_argument, NULL, 'h'},
     {"interval", required_argument, NULL, 'I'},
+    {"edges", required_argument, NULL, 'k'},
     {"itm-sync", no_argument, NULL, 'n'},
+    {"latency", required_argument, NULL, 'L'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
     {"objdump-opts", required_argument, NULL, 'O'},
     {"protocol", required_argument, NULL, 'p'},
     {"server", required_argument, NULL, 's'},
+    {"stack-file", required_argument, NULL, 'S'},
     {"tag", required_argument, NULL, 't'},
     {"all-truncate", no_argument, NULL, 'T'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
     {"graph-file", required_argument, NULL, 'y'},
     {"cache-file", required_argument, NULL, 'z'},
+    {"pprof-file", required_argument, NULL, 'Z'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
@@ -465,9 +782,19 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
     bool serverExplicit = false;
     bool portExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "Dd:e:Ef:g:hI:nO:p:s:t:Tv:Vy:z:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "C:c:Dd:e:Ef:Fg:hI:k:L:nO:p:s:S:t:Tv:Vy:z:Z:", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
+            // ------------------------------------
+            case 'C':
+                r->options->clockHz = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'c':
+                r->options->continuous = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'd':
                 r->options->deleteMaterial = optarg;
@@ -493,6 +820,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->fold = true;
+                break;
+
             // ------------------------------------
             case 'g':
                 r->options->traceChannel = atoi( optarg );
@@ -513,6 +845,25 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->sampleDuration = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'k':
+                r->options->maxEdges = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'L':
+                if ( ( !r->ml ) && ( !( r->ml = markerLatencyCreate() ) ) )
+                {
+                    return false;
+                }
+
+                if ( !markerLatencyAdd( r->ml, optarg ) )
+                {
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
             case 'M':
                 r->options->mono = true;
@@ -552,6 +903,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
                 break;
 
+            // ------------------------------------
+            case 'S':
+                r->options->stackfile = optarg;
+                break;
+
             // ------------------------------------
             case 's':
                 r->options->server = optarg;
@@ -613,6 +969,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->profile = optarg;
                 break;
 
+            // ------------------------------------
+            case 'Z':
+                r->options->pproffile = optarg;
+                break;
+
             // ------------------------------------
             case '?':
                 if ( optopt == 'b' )
@@ -644,7 +1005,7 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         r->options->port = NWCLIENT_SERVER_PORT;
     }
 
-    if ( !r->options->elffile )
+    if ( ( !r->options->elffile ) && ( !r->ml ) )
     {
         genericsReport( V_ERROR, "Elf File not specified" EOL );
         exit( -2 );
@@ -656,13 +1017,38 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         exit( -2 );
     }
 
+    if ( r->options->continuous < 0 )
+    {
+        genericsReport( V_ERROR, "Illegal continuous output interval" EOL );
+        exit( -2 );
+    }
+
+    if ( ( r->options->maxEdges < 1 ) || ( r->options->maxEdges > ( 1 << 24 ) ) )
+    {
+        genericsReport( V_ERROR, "Illegal number of edges" EOL );
+        exit( -2 );
+    }
+
     genericsReport( V_INFO, "orbstat version " GIT_DESCRIBE EOL );
     genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
     genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
-    genericsReport( V_INFO, "Elf File        : %s %s" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "(Truncate)" : "(Don't Truncate)" );
+    genericsReport( V_INFO, "Elf File        : %s %s" EOL, r->options->elffile ? r->options->elffile : "None", r->options->truncateDeleteMaterial ? "(Truncate)" : "(Don't Truncate)" );
     genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
     genericsReport( V_INFO, "ForceSync       : %s" EOL, r->options->forceITMSync ? "true" : "false" );
     genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
+
+    if ( r->options->continuous )
+    {
+        genericsReport( V_INFO, "Continuous      : Output every %d S" EOL, r->options->continuous );
+    }
+
+    genericsReport( V_INFO, "Call table      : %u edges%s" EOL, r->options->maxEdges, r->options->fold ? ", folded to functions" : "" );
+
+    for ( unsigned int i = 0; ( r->ml ) && ( i < markerLatencyNumPairs( r->ml ) ); i++ )
+    {
+        genericsReport( V_INFO, "Latency pair    : %s" EOL, markerLatencyName( r->ml, i ) );
+    }
+
     genericsReport( V_INFO, "Objdump options  : %s" EOL, r->options->odoptions ? r->options->odoptions : "None" );
 
     switch ( r->options->protocol )
@@ -699,7 +1085,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
@@ -713,6 +1099,129 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
     }
 }
 
+// ====================================================================================================
+static void _pumpData( struct RunTime *r, uint8_t *c, size_t len )
+
+/* Pump received data through the protocol handler */
+
+{
+    if ( PROT_OFLOW == r->options->protocol )
+    {
+        OFLOWPumpInPlace( &r->c, c, len, _OFLOWpacketRxed, r );
+    }
+    else
+    {
+        while ( len-- )
+        {
+            _itmPumpProcess( r, *c++ );
+        }
+    }
+}
+// ====================================================================================================
+static void _holdData( struct RunTime *r, const uint8_t *c, size_t len )
+
+/* Keep data that can't be decoded until the symbols are in, as much of it as there's room for */
+
+{
+    if ( r->heldLen + len > r->heldSize )
+    {
+        size_t want = ( r->heldSize ) ? r->heldSize : TRANSFER_SIZE;
+
+        while ( ( want < r->heldLen + len ) && ( want < MAX_HELD ) )
+        {
+            want *= 2;
+        }
+
+        if ( want > MAX_HELD )
+        {
+            want = MAX_HELD;
+        }
+
+        if ( want > r->heldSize )
+        {
+            r->held = ( uint8_t * )realloc( r->held, want );
+            MEMCHECKV( r->held );
+            r->heldSize = want;
+        }
+    }
+
+    if ( r->heldLen + len > r->heldSize )
+    {
+        r->heldDropped += r->heldLen + len - r->heldSize;
+        len = r->heldSize - r->heldLen;
+    }
+
+    memcpy( &r->held[r->heldLen], c, len );
+    r->heldLen += len;
+}
+// ====================================================================================================
+static void _symbolsIn( struct RunTime *r, enum symbolErr err )
+
+/* Get going with a new symbol set, or give up if we didn't get one */
+
+{
+    switch ( err )
+    {
+        case SYMBOL_NOELF:
+            genericsExit( -1, "Elf file or symbols in it not found" EOL );
+            break;
+
+        case SYMBOL_NOOBJDUMP:
+            genericsExit( -1, "No objdump found" EOL );
+            break;
+
+        case SYMBOL_UNSPECIFIED:
+            genericsExit( -1, "Unknown error in symbol subsystem" EOL );
+            break;
+
+        default:
+            break;
+    }
+
+    genericsReport( V_WARN, "Loaded %s" EOL, r->options->elffile );
+
+    /* ...and now what arrived while they were loading can be decoded */
+    if ( r->heldLen )
+    {
+        genericsReport( V_INFO, "Decoding %zu bytes received while loading" EOL, r->heldLen );
+        _pumpData( r, r->held, r->heldLen );
+    }
+
+    if ( r->heldDropped )
+    {
+        genericsReport( V_WARN, "%" PRIu64 " bytes lost while loading, there wasn't room to hold them" EOL, r->heldDropped );
+    }
+
+    free( r->held );
+    r->held = NULL;
+    r->heldLen = r->heldSize = 0;
+}
+// ====================================================================================================
+static void _symbolsPoll( struct RunTime *r, bool wait )
+
+/* Pick up the symbols being loaded in the background if they're in (or wait for them) */
+
+{
+    struct SymbolSet *s;
+    enum symbolErr err;
+
+    while ( r->reload )
+    {
+        if ( SymbolReloadPoll( &r->reload, &s, &err ) )
+        {
+            r->s = s;
+            _symbolsIn( r, err );
+        }
+        else if ( wait )
+        {
+            usleep( TICK_TIME_MS * 1000 );
+        }
+        else
+        {
+            break;
+        }
+    }
+}
 // ====================================================================================================
 int main( int argc, char *argv[] )
 
@@ -720,6 +1229,7 @@ int main( int argc, char *argv[] )
     struct Stream *stream = NULL;
     enum symbolErr r;
     struct timeval tv;
+    bool firstLoad = true;
 
     /* Have a basic name and search string set up */
     _r.progName = genericsBasename( argv[0] );
@@ -751,21 +1261,31 @@ int main( int argc, char *argv[] )
 
 #endif
 
+    /* All the memory we'll need for calls, up front */
+    _allocTables( &_r );
+
     /* Reset the handlers before we start */
     ITMDecoderInit( &_r.i, _r.options->forceITMSync );
     OFLOWInit( &_r.c );
+    ext_ff_stackInit( &_r.stacks );
 
     while ( !_r.ending )
     {
         if ( _r.options->file != NULL )
         {
-            stream = streamCreateFile( _r.options->file );
+            stream = streamCreateMappedFile( _r.options->file );
         }
         else
         {
             while ( 1 )
             {
-                stream = streamCreateSocket( _r.options->server, _r.options->port );
+                stream = streamCreateReader( streamCreateSocket( _r.options->server, _r.options->port ), STREAM_READER_BUFS, TRANSFER_SIZE );
+
+                if ( ( stream ) && ( _r.options->protocol == PROT_OFLOW ) )
+                {
+                    uint8_t tag = _r.options->tag;
+                    nwSubscribe( stream, 1, &tag );
+                }
 
                 if ( stream )
                 {
@@ -777,33 +1297,23 @@ int main( int argc, char *argv[] )
             }
         }
 
-        /* We need symbols constantly while running ... check they are current */
         /* We need symbols constantly while running ... lets get them */
-        if ( !SymbolSetValid( &_r.s, _r.options->elffile ) )
+        if ( ( _r.options->elffile ) && ( !_r.reload ) && ( !SymbolSetValid( &_r.s, _r.options->elffile ) ) )
         {
-            r = SymbolSetCreate( &_r.s, _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true, _r.options->odoptions );
-
-            switch ( r )
+            if ( ( firstLoad ) && ( !_r.options->file ) )
             {
-                case SYMBOL_NOELF:
-                    genericsExit( -1, "Elf file or symbols in it not found" EOL );
-                    break;
-
-                case SYMBOL_NOOBJDUMP:
-                    genericsExit( -1, "No objdump found" EOL );
-                    break;
-
-                case SYMBOL_UNSPECIFIED:
-                    genericsExit( -1, "Unknown error in symbol subsystem" EOL );
-                    break;
-
-                default:
-                    break;
+                /* A live source can't wait, so what it sends is held while they load */
+                _r.reload = SymbolReloadStart( _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true, _r.options->odoptions );
+            }
+            else
+            {
+                r = SymbolSetCreate( &_r.s, _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true, _r.options->odoptions );
+                _symbolsIn( &_r, r );
             }
-
-            genericsReport( V_WARN, "Loaded %s" EOL, _r.options->elffile );
         }
 
+        firstLoad = false;
+
         /* ----------------------------------------------------------------------------- */
         /* This is the main active loop...only break out of this when ending or on error */
         /* ----------------------------------------------------------------------------- */
@@ -834,20 +1344,16 @@ int main( int argc, char *argv[] )
             /* ...and record the fact that we received some data */
             _r.intervalBytes += _r.rawBlock.fillLevel;
 
-            if ( PROT_OFLOW == _r.options->protocol )
+            /* Anything held while the symbols loaded goes through ahead of this */
+            _symbolsPoll( &_r, false );
+
+            if ( _r.reload )
             {
-                OFLOWPump( &_r.c, _r.rawBlock.buffer, _r.rawBlock.fillLevel, _OFLOWpacketRxed, &_r );
+                _holdData( &_r, _r.rawBlock.buffer, _r.rawBlock.fillLevel );
             }
             else
             {
-                /* Pump all of the data through the protocol handler */
-                uint8_t *c = _r.rawBlock.buffer;
-
-                while ( _r.rawBlock.fillLevel > 0 )
-                {
-                    _itmPumpProcess( &_r, *c++ );
-                    _r.rawBlock.fillLevel--;
-                }
+                _pumpData( &_r, _r.rawBlock.buffer, _r.rawBlock.fillLevel );
             }
 
             /* Check to make sure there's not an unexpected TPIU in here */
@@ -856,8 +1362,21 @@ int main( int argc, char *argv[] )
                 genericsReport( V_WARN, "Got a TPIU sync while decoding ITM...did you miss a -t option?" EOL );
             }
 
-            /* Update the intervals */
-            if ( ( _r.sampling ) && ( ( genericsTimestampmS() - _r.starttime ) > _r.options->sampleDuration ) )
+            /* Latencies are reported live, and that goes on until we're stopped */
+            if ( _r.ml )
+            {
+                _checkLatency( &_r );
+            }
+
+            /* Update the intervals...in continuous mode we keep going, writing out as we go, until we're stopped */
+            if ( ( _r.options->continuous ) && ( _r.options->elffile ) )
+            {
+                if ( !_r.reload )
+                {
+                    _checkContinuous( &_r );
+                }
+            }
+            else if ( ( _r.sampling ) && ( !_r.ml ) && ( ( genericsTimestampmS() - _r.starttime ) > _r.options->sampleDuration ) )
             {
                 _r.ending = true;
             }
@@ -867,23 +1386,29 @@ int main( int argc, char *argv[] )
         free( stream );
     }
 
+    /* Whatever was held while the symbols loaded still needs to be decoded */
+    _symbolsPoll( &_r, true );
+
     /* Data are collected, now process and report */
     genericsReport( V_WARN, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL, _r.intervalBytes, HASH_COUNT( _r.subhead ), HASH_COUNT( _r.insthead ) );
 
+    if ( _r.dropped )
+    {
+        genericsReport( V_WARN, "%" PRIu64 " calls dropped with call tables full" EOL, _r.dropped );
+    }
+
     if ( HASH_COUNT( _r.subhead ) )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
-        {
-            genericsReport( V_WARN, "Output DOT" EOL );
-        }
+        _outputResults( &_r );
+    }
 
-        if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile, _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL, false,
-                                   _r.tcount - _r.starttcount, _r.insthead, _r.subhead, _r.s ) )
-        {
-            genericsReport( V_WARN, "Output Profile" EOL );
-        }
+    if ( _r.ml )
+    {
+        _outputLatency( &_r );
+        markerLatencyDelete( _r.ml );
     }
 
+    ext_ff_stackDelete( &_r.stacks );
     return OK;
 }
 
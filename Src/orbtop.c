@@ -10,23 +10,33 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <signal.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <assert.h>
 #include <inttypes.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
-#include "cJSON.h"
 #include "generics.h"
+#define MEM_ACCOUNT_UTHASH
 #include "uthash.h"
+#include "memAccount.h"
 #include "git_version_info.h"
 #include "itmDecoder.h"
+#include "traceDecoder.h"
 #include "oflow.h"
 #include "symbols.h"
 #include "msgSeq.h"
+#include "msgStream.h"
 #include "nw.h"
 #include "stream.h"
+#include "captureIndex.h"
+#include "latencyHist.h"
+#include "tsStore.h"
+#include "perfetto.h"
 
 #define CUTOFF              (10)             /* Default cutoff at 0.1% */
 #define TOP_UPDATE_INTERVAL (1000)           /* Interval between each on screen update */
@@ -35,11 +45,77 @@
 #define NO_EXCEPTION        (0xFFFFFFFF)     /* Flag indicating no exception is being processed */
 
 #define MSG_REORDER_BUFLEN  (10)             /* Maximum number of samples to re-order for timekeeping */
+#define DISPLAY_POLL_US     (20000)          /* How often the display looks for a new report */
+
+#define EXACT_EVENT_BATCH   (256)            /* Trace decoder events taken at a time in exact mode */
+
+#define PARALLEL_MAX_THREADS (256)           /* Most threads an offline decode can be split across */
+#define PARALLEL_MIN_CHUNK  (1024*1024)      /* ...and the least amount of file each one gets */
+
+#define TOP_K_MAX           (1<<24)          /* Most addresses the heavy hitter sketch can be asked to count */
+
+/* Position of an ITM byte in the file, as the offset of the frame it's in and its index in that frame */
+#define PARALLEL_POS(ofs,idx) (((uint64_t)(ofs)<<16)|(idx))
+
+/* Binary output format. Every record is a little-endian uint32_t length (of what follows it), a   */
+/* one byte record type and then the payload. Strings are a uint16_t length followed by the bytes. */
+#define BIN_MAGIC           "OTOP"
+#define BIN_VERSION         (3)
+#define BIN_REC_HEADER      ('H')            /* Magic, u16 version, u8 flags (b0 lines, b1 filenames), i64 interval    */
+#define BIN_REC_RESET       ('R')            /* All previously announced ids are invalid                               */
+#define BIN_REC_DICT        ('D')            /* u32 id, u32 line, string filename, string function                     */
+#define BIN_REC_FRAME       ('F')            /* i64 timestamp, i64 interval, u32 total, u32 overflow, u32 itmsync,     */
+/*                                              u32 error, u32 rows, u32 exceptions, u32 id[rows], u32 count[rows],   */
+/*                                              u32 ex[], u32 count[], u32 maxd[], i64 totalt[], i64 mint[],          */
+/*                                              i64 maxt[], i64 maxwt[], then p50[], p99[], p999[] (all i64) for    */
+/*                                              each of duration, interval and depth in turn                          */
+#define BIN_REC_DWT         ('W')            /* u32 count[6] of DWT counter events in the interval just framed, in the */
+/*                                              order CPI, EXC, SLEEP, LSU, FOLD, CYC. Only sent once any are seen     */
+#define BIN_SLEEP_ID        (0)              /* Dictionary id always used for sleeping, report lines start from 1      */
+
+struct reportKey                             /* What distinguishes one line of the report from another */
+{
+    uint32_t fileindex;
+    uint32_t functionindex;
+    uint32_t line;
+};
+
+struct reportSlot                            /* Structure for Hashmap of report lines, with their counts */
+{
+    struct reportKey k;
+    uint32_t id;                             /* Identifier used for this line in binary output */
+    uint64_t visits;                         /* Visits in the current interval */
+    struct nameEntry n;
+
+    uint64_t windowSum;                      /* Visits across the sliding window */
+    double decayed;                          /* Exponentially decayed visits */
+
+    UT_hash_handle hh;
+    uint32_t bucket[];                       /* Visits in each interval of the sliding window */
+};
 
 struct visitedAddr                           /* Structure for Hashmap of visited/observed addresses */
 {
-    uint64_t visits;
-    struct nameEntry *n;
+    uint32_t pc;
+    struct reportSlot *slot;                 /* Report line this address is counted against */
+
+    UT_hash_handle hh;
+};
+
+struct hitter                                /* An address counted by the heavy hitter sketch (see _hitterAdd) */
+{
+    uint32_t pc;
+    uint64_t count;                          /* Samples counted against it in this interval... */
+    uint64_t err;                            /* ...of which at most this many might belong to addresses it replaced */
+    uint32_t heapIdx;                        /* Where it is in the heap */
+
+    UT_hash_handle hh;
+};
+
+struct pendingAddr                           /* Samples that arrived while the symbols were being reloaded */
+{
+    uint32_t pc;
+    uint64_t count;
 
     UT_hash_handle hh;
 };
@@ -48,11 +124,28 @@ struct reportLine
 
 {
     uint64_t count;
+    uint32_t id;
     struct nameEntry *n;
 };
 
-enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
-const char *protString[] = {"OFLOW", "ITM", NULL};
+enum Prot { PROT_OFLOW, PROT_ITM, PROT_MSG, PROT_UNKNOWN };
+const char *protString[] = {"OFLOW", "ITM", "MSG", NULL};
+
+/* Distributions kept for each exception */
+enum exDist { EXD_DURATION, EXD_INTERVAL, EXD_DEPTH, EXD_NUM };
+const char *exDistString[EXD_NUM] = { "dur", "int", "depth" };
+
+/* DWT profiling counters, in the order they have bits in an event packet. The first five count */
+/* cycles (or, for FOLD, instructions) and send an event each time they wrap, which is every    */
+/* DWT_COUNTER_WRAP of them. CYC is the cycle counter tap, at whatever rate the target set up.  */
+enum dwtCounter { DWT_CPI, DWT_EXC, DWT_SLEEP, DWT_LSU, DWT_FOLD, DWT_CYC, DWT_NUM };
+const char *dwtString[DWT_NUM] = { "cpi", "exc", "sleep", "lsu", "fold", "cyc" };
+#define DWT_COUNTER_WRAP (256)
+
+struct exceptionDists                        /* Made the first time an exception is seen */
+{
+    struct latencyHist h[EXD_NUM];
+};
 
 struct exceptionRecord                       /* Record of exception activity */
 
@@ -69,8 +162,111 @@ struct exceptionRecord                       /* Record of exception activity */
     int64_t thisTime;
     int64_t stealTime;
     uint32_t prev;
+    int64_t lastEntry;                       /* When it was last entered, for the interval between entries */
+
+    /* Distributions for the interval, as they were when the report was made */
+    struct latencyStats dist[EXD_NUM];
+};
+
+struct taskRecord                            /* An RTOS task, as told us by the switch markers */
+{
+    uint32_t id;                             /* What the target writes to the channel when switching to it */
+    uint64_t samples;                        /* PC samples while it was running, this interval */
+    int64_t ticks;                           /* ...and target time it was running for */
+    uint64_t switches;                       /* ...and times it was switched to */
+
+    UT_hash_handle hh;
 };
 
+struct taskLine                              /* A task, as it is in the report */
+{
+    uint32_t id;
+    uint64_t samples;
+    int64_t ticks;
+    uint64_t switches;
+};
+
+/* The report as it's displayed. It's made by the capture thread at the end of each interval and handed */
+/* over to the display thread, which only ever looks at this. Only lines that will be shown are kept.   */
+struct topLine
+{
+    uint64_t count;
+    uint32_t rank;                           /* Position in the report */
+    uint32_t line;
+    size_t function;                         /* Offsets of the names in the snapshot */
+    size_t file;                             /* ...or NO_NAME if there isn't one */
+};
+
+#define NO_NAME ((size_t)-1)
+
+struct topSnapshot
+{
+    uint32_t total;                          /* Samples in the report */
+    uint64_t samples;                        /* ...and across all of its lines */
+    uint32_t lines;                          /* Lines to show */
+    uint32_t linesAlloc;
+    struct topLine *line;
+    char *names;                             /* Function and file names, for those lines */
+    size_t namesLen;
+    size_t namesAlloc;
+
+    struct exceptionRecord er[MAX_EXCEPTIONS];
+    struct taskLine *task;                   /* Tasks that ran in the interval */
+    uint32_t tasks;
+    uint32_t tasksAlloc;
+    bool dwtSeen;                            /* Set once there have been any DWT counter events */
+    uint32_t dwt[DWT_NUM];                   /* ...and how many of each there were in the interval */
+    int64_t thisTime;                        /* Time the report was made */
+    int64_t lastReportus;                    /* ...and the one before it */
+    bool haveTicks;                          /* Set if there was a report before this one to count ticks from */
+    uint64_t ticks;                          /* Target time that passed in between */
+    bool ovf, sw, ts, hw;                    /* What's been seen in the interval */
+    uint32_t overflow;                       /* Decoder stats, as they were */
+    uint32_t syncCount;
+    uint32_t errorPkt;
+    uint32_t hitters;                        /* Addresses the heavy hitter sketch was tracking, if it's in use */
+    uint64_t hitterBound;                    /* ...and the most any count might have been over by */
+};
+
+/* There are three snapshots, so the capture thread always has one to fill, the display thread always */
+/* has one to show, and there's the latest one between them. They are swapped over without any lock. */
+#define SNAP_INDEX (3)
+#define SNAP_FRESH (4)
+
+enum parallelSync { PSYNC_PENDING, PSYNC_FOUND, PSYNC_NONE };
+
+struct pcCount                               /* Samples at one address, counted by a parallel worker */
+{
+    uint32_t pc;
+    uint64_t visits;
+
+    UT_hash_handle hh;
+};
+
+struct parallelWorker                        /* One thread of a parallel offline decode */
+{
+    int index;                               /* Which chunk of the file this is */
+    pthread_t thread;
+    uint64_t start;                          /* Where in the file this chunk starts */
+    uint64_t end;                            /* ...and where the next one does */
+
+    struct ITMDecoder i;                     /* Decoders for this thread */
+    struct MSGSeq d;
+    struct OFLOW c;
+    uint64_t frameStart;                     /* File offset of the OFLOW frame being received */
+
+    enum parallelSync syncState;             /* Has this worker found where it starts counting (under lock) */
+    uint64_t syncPos;                        /* ...and where that is, if it has */
+    int next;                                /* Next worker to check with for where to stop */
+    bool stopKnown;                          /* We know where to stop */
+    uint64_t stopPos;                        /* ...and this is it */
+    bool done;                               /* Finished decoding */
+
+    struct pcCount *counts;                  /* Samples seen, by address */
+    uint64_t sleeps;                         /* Sleep samples seen */
+    uint64_t ticks;                          /* Target time that passed */
+    uint32_t dwt[DWT_NUM];                   /* DWT counter events seen */
+};
 
 /* ---------- CONFIGURATION ----------------- */
 struct                                       /* Record for options, either defaults or from command line */
@@ -80,6 +276,9 @@ struct                                       /* Record for options, either defau
     bool outputExceptions;                   /* Set to include exceptions in output flow */
     bool forceITMSync;                       /* Must ITM start synced? */
     char *file;                              /* File host connection */
+    uint64_t startmS;                        /* How far into an indexed capture file to start */
+    char *shm;                               /* Shared memory connection to a local orbuculum */
+    bool compress;                           /* Ask the server to compress what it sends */
 
     uint32_t hwOutputs;                      /* What hardware outputs are enabled */
 
@@ -89,18 +288,34 @@ struct                                       /* Record for options, either defau
     char *odoptions;                         /* Options to pass directly to objdump */
 
     char *json;                              /* Output in JSON format rather than human readable, either '-' for screen or filename */
+    char *binary;                            /* Output in binary format, either '-' for screen or filename */
+    char *timeline;                          /* Perfetto timeline of the exceptions, if one's wanted */
+    double timelineMHz;                      /* ...and the rate target time goes at, or 0 to show ticks as ns */
     char *outfile;                           /* File to output current information */
     char *logfile;                           /* File to output historic information */
+    char *history;                           /* Directory of the time series store to keep counts in */
+    bool historyQuery;                       /* Print what's in the store, rather than capturing */
+    int64_t historyFrom;                     /* ...from when, up to when, in unix seconds */
+    int64_t historyTo;
+    enum tsLevel historyLevel;               /* ...and at what resolution */
     bool mono;                               /* Supress colour in output */
     uint32_t cutscreen;                      /* Cut screen output after specified number of lines */
     uint32_t maxRoutines;                    /* Historic information to emit */
     bool lineDisaggregation;                 /* Aggregate per line or per function? */
     bool demangle;                           /* Do we want to demangle any C++ we come across? */
     int64_t displayInterval;                 /* What is the display interval? */
+    int64_t window;                          /* Length of sliding window to report over, or 0 for none */
+    uint32_t windowBuckets;                  /* ...and the number of display intervals in it */
+    int64_t decay;                           /* Time constant for decayed reporting, or 0 for none */
+    uint32_t topK;                           /* Only count the busiest this many addresses in each interval, or 0 for all */
+    int taskChannel;                         /* ITM channel RTOS task switches are marked on, or -1 for none */
+    int exactTag;                            /* OFLOW tag with ETM or MTB to count execution exactly from, or 0 */
+    enum TRACEprotocol exactProtocol;        /* ...and what's in it */
 
     int port;                                /* Source information */
     char *server;
     enum Prot protocol;                      /* What protocol to communicate (default to OFLOW (== orbuculum)) */
+    int parallel;                            /* Decode the file offline across this many threads, 0 for live */
 
 } options =
 {
@@ -110,7 +325,10 @@ struct                                       /* Record for options, either defau
     .logfile = NULL,
     .lineDisaggregation = false,
     .maxRoutines = 8,
+    .historyLevel = TS_AUTO,
     .demangle = true,
+    .taskChannel = -1,
+    .exactProtocol = TRACE_PROT_ETM35,
     .displayInterval = TOP_UPDATE_INTERVAL * 1000,
     .port = OFCLIENT_SERVER_PORT,
     .server = "localhost"
@@ -123,6 +341,7 @@ struct
     struct MSGSeq    d;                                   /* Message (re-)sequencer */
     struct ITMPacket h;
     struct OFLOW c;
+    struct msgStreamDecoder m;                         /* For messages and histograms from the server */
     enum timeDelay timeStatus;                         /* Indicator of if this time is exact */
     uint64_t timeStamp;                                /* Latest received time */
     struct Frame cobsPart;                             /* Any part frame that has been received */
@@ -130,13 +349,55 @@ struct
     struct SymbolSet *s;                               /* Symbols read from elf */
     struct nameEntry *n;                               /* Current table of recognised names */
 
-    struct visitedAddr *addresses;                     /* Addresses we received in the SWV */
+    struct visitedAddr *addresses;                     /* Addresses we received in the SWV, kept between intervals */
+    struct reportSlot *slots;                          /* Report lines those addresses are counted against */
+    uint32_t slotCount;                                /* Number of report lines */
+    struct reportLine *report;                         /* Report constructed at each interval */
+    uint32_t reportAlloc;                              /* Space allocated for report */
+    struct nameEntry sleepName;                        /* Name entry used for sleep reporting */
+
+    bool reloading;                                    /* Set from finding the symbols changed until new ones are in */
+    struct SymbolReload *reload;                       /* Symbols being loaded in the background, if they are */
+    int64_t reloadRetry;                               /* ...or when to try again, if they couldn't be */
+    struct pendingAddr *pending;                       /* Samples held until the reload is done */
+
+    struct hitter *hitters;                            /* With topK, the fixed pool of addresses counted this interval */
+    struct hitter **hitterHeap;                        /* ...in a heap, least counted at the top */
+    struct hitter *hitterIndex;                        /* ...and hashed by address */
+    uint32_t hitterCount;                              /* ...and how many of them are in use */
+    uint64_t hitterBound;                              /* Most any count could have been over by, in the last interval */
+    uint32_t hitterReported;                           /* ...and how many addresses were tracked in it */
 
     struct exceptionRecord er[MAX_EXCEPTIONS];         /* Exceptions we received on this interval */
+    struct exceptionDists *erDists[MAX_EXCEPTIONS];    /* ...and how their timings were spread */
     uint32_t currentException;                         /* Exception we are currently embedded in */
     uint32_t erDepth;                                  /* Current depth of exception stack */
+    struct perfettoTrace *tl;                          /* Timeline the exceptions go to as they happen, if there is one */
+    uint64_t tlExceptions;                             /* ...the track for their slices */
+    uint64_t tlDepth;                                  /* ...and the one for how deep they are */
+    uint64_t tlName[MAX_EXCEPTIONS];                   /* ...and each one's name in it, once it's been seen */
     char *depthList;                                   /* Record of maximum depth of exceptions */
 
+    struct taskRecord *tasks;                          /* RTOS tasks seen, hashed by their id */
+    struct taskRecord *task;                           /* ...the one running, if it's known */
+    int64_t taskSince;                                 /* ...and the time it was switched to */
+    struct taskLine *taskReport;                       /* Tasks that ran in the interval, busiest first */
+    uint32_t taskLines;
+    uint32_t taskAlloc;
+
+    /* Exact mode, counting execution from the trace without following it instruction by instruction */
+    struct TRACEDecoder t;
+    uint32_t tChanges;                                 /* Changes from the decoder not yet acted on */
+    int64_t *runEdge;                                  /* Per instruction, runs starting there less those ending just before */
+    uint32_t *branchTo;                                /* Index (+1) each direct branch goes to, once it's looked up */
+    uint32_t exactInsn;                                /* Instruction the trace has got to, or NO_INSN if it's not known */
+    bool atomPending;                                  /* The last atom of a batch waits to see if an address follows it */
+    bool atomPendingE;                                 /* ...and whether it was executed */
+
+    uint32_t dwt[DWT_NUM];                             /* DWT counter events in this interval */
+    uint32_t dwtReport[DWT_NUM];                       /* ...and in the one just reported */
+    bool dwtSeen;                                      /* There have been some */
+
     int64_t lastReportus;                              /* Last time an output report was generated, in microseconds */
     int64_t lastReportTicks;                           /* Last time an output report was generated, in ticks */
     uint32_t ITMoverflows;                             /* Has an ITM overflow been detected? */
@@ -145,12 +406,37 @@ struct
     uint32_t HWPkt;                                    /* Number of HW Packets received */
 
     FILE *jsonfile;                                    /* File where json output is being dumped */
+    FILE *binfile;                                     /* File where binary output is being dumped */
+    struct tsStore *ts;                                /* Time series store counts are kept in, if there is one */
+    uint8_t *binBuf;                                   /* Record under construction for binary output */
+    uint32_t binAlloc;                                 /* ...and space allocated for it */
     uint32_t interrupts;
     uint32_t sleeps;
+    uint32_t *sleepBucket;                             /* Sleeps in each interval of the sliding window */
+    uint64_t sleepWindowSum;                           /* ...and in total across it */
+    double sleepDecayed;                               /* Exponentially decayed sleeps */
+    uint32_t bucketIdx;                                /* Current interval in the sliding window */
     uint32_t notFound;
-    bool ending;                                       /* Flag to exit */
-
-} _r;
+    bool histSeen;                                     /* Set once a histogram has come from the server... */
+    uint16_t histSeq;                                  /* ...and the interval it was for */
+    atomic_bool ending;                                /* Flag to exit */
+
+    pthread_t captureThread;                           /* Thread receiving and decoding */
+    bool showTop;                                      /* Set if the report is shown on screen */
+    struct topSnapshot snap[3];                        /* Reports on their way to be shown */
+    atomic_int snapShared;                             /* ...the one in between (and SNAP_FRESH if it's not been shown) */
+    int snapBack;                                      /* ...the one the capture thread is filling */
+    int snapFront;                                     /* ...and the one being shown */
+} _r = { .snapShared = 1, .snapBack = 0, .snapFront = 2 };
+
+/* ----------- PARALLEL DECODE STATE ----------------- */
+struct
+{
+    struct parallelWorker *w;                          /* Workers, plus one to mark the end of the file */
+    int n;                                             /* Number of workers */
+    pthread_mutex_t l;                                 /* Lock protecting the sync states */
+    pthread_cond_t c;                                  /* ...and signal that one has changed */
+} _p;
 
 // ====================================================================================================
 // ====================================================================================================
@@ -168,59 +454,95 @@ int64_t _timestamp( void )
     return microseconds;
 }
 // ====================================================================================================
-int _addresses_sort_fn( void *a, void *b )
+int _report_sort_fn( const void *a, const void *b )
 
 {
-    if ( ( ( ( struct visitedAddr * )a )->n->addr ) < ( ( ( struct visitedAddr * )b )->n->addr ) )
-    {
-        return -1;
-    }
+    uint64_t ca = ( ( struct reportLine * )a )->count;
+    uint64_t cb = ( ( struct reportLine * )b )->count;
+
+    return ( ca < cb ) ? 1 : ( ca > cb ) ? -1 : 0;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Handler for individual message types from SWO
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static const char *ExceptionNames[] =
+{
+    [0] = "None",
+    [1] = "Reset",
+    [2] = "NMI",
+    [3] = "HardFault",
+    [4] = "MemManage",
+    [5] = "BusFault",
+    [6] = "UsageFault",
+    [7] = "Reserved",
+    [8] = "Reserved",
+    [9] = "Reserved",
+    [10] = "Reserved",
+    [11] = "SVCall",
+    [12] = "DebugMonitor",
+    [13] = "Reserved",
+    [14] = "PendSV",
+    [15] = "SysTick",
+};
+// ====================================================================================================
+static void _exRecord( uint32_t e, enum exDist d, int64_t v )
+
+/* Add to the distribution of d for exception e, which is fixed size so this is always quick */
 
-    if ( ( ( ( struct visitedAddr * )a )->n->addr ) > ( ( ( struct visitedAddr * )b )->n->addr ) )
+{
+    if ( !_r.erDists[e] )
     {
-        return 1;
+        _r.erDists[e] = ( struct exceptionDists * )calloc( 1, sizeof( struct exceptionDists ) );
+        MEMCHECKV( _r.erDists[e] );
     }
 
-    return 0;
+    latencyRecord( &_r.erDists[e]->h[d], ( v > 0 ) ? v : 0 );
 }
 // ====================================================================================================
-int _routines_sort_fn( void *a, void *b )
+static void _timelineEnter( uint32_t e )
+
+/* Exception e has just been entered, on top of any that were already running */
 
 {
-    int r;
+    char name[30];
 
-    if ( ( options.reportFilenames ) && ( ( ( ( struct visitedAddr * )a )->n->fileindex ) && ( ( ( struct visitedAddr * )b )->n->fileindex ) ) )
+    if ( !_r.tl )
     {
-        r = ( ( int )( ( struct visitedAddr * )a )->n->fileindex ) - ( ( int )( ( struct visitedAddr * )b )->n->fileindex );
+        return;
+    }
 
-        if ( r )
+    if ( !_r.tlName[e] )
+    {
+        if ( e < 16 )
         {
-            return r;
+            snprintf( name, sizeof( name ), "%s", ExceptionNames[e] );
+        }
+        else
+        {
+            snprintf( name, sizeof( name ), "IRQ %d", e - 16 );
         }
-    }
-
-    r = ( ( int )( ( struct visitedAddr * )a )->n->functionindex ) - ( ( int )( ( struct visitedAddr * )b )->n->functionindex );
 
-    if ( r )
-    {
-        return r;
+        _r.tlName[e] = perfettoName( _r.tl, name );
     }
 
-    return ( ( int )( ( struct visitedAddr * )a )->n->line ) - ( ( int )( ( struct visitedAddr * )b )->n->line );
+    perfettoBegin( _r.tl, _r.tlExceptions, _r.timeStamp, _r.tlName[e] );
+    perfettoCounter( _r.tl, _r.tlDepth, _r.timeStamp, _r.erDepth );
 }
 // ====================================================================================================
-int _report_sort_fn( const void *a, const void *b )
+static void _timelineExit( int64_t ts )
 
 {
-    return ( ( struct reportLine * )b )->count - ( ( struct reportLine * )a )->count;
+    if ( _r.tl )
+    {
+        perfettoEnd( _r.tl, _r.tlExceptions, ts );
+        perfettoCounter( _r.tl, _r.tlDepth, ts, _r.erDepth );
+    }
 }
 // ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
-// Handler for individual message types from SWO
-// ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
 void _exitEx( int64_t ts )
 
 {
@@ -237,6 +559,7 @@ void _exitEx( int64_t ts )
     _r.er[_r.currentException].thisTime += thisTime;
     _r.er[_r.currentException].visits++;
     _r.er[_r.currentException].totalTime += _r.er[_r.currentException].thisTime;
+    _exRecord( _r.currentException, EXD_DURATION, _r.er[_r.currentException].thisTime );
 
     /* Zero the entryTime as it's used to show when an exception is 'live' */
     _r.er[_r.currentException].entryTime = 0;
@@ -272,6 +595,8 @@ void _exitEx( int64_t ts )
         _r.erDepth--;
     }
 
+    _timelineExit( ts );
+
     /* If we are still in an exception then carry on accounting */
     if ( _r.currentException != NO_EXCEPTION )
     {
@@ -322,6 +647,16 @@ void _handleException( struct excMsg *m, struct ITMDecoder *i )
             _r.er[m->exceptionNumber].thisTime = 0;
             _r.er[m->exceptionNumber].stealTime = 0;
             _r.erDepth++;
+
+            _exRecord( m->exceptionNumber, EXD_DEPTH, _r.erDepth );
+            _timelineEnter( m->exceptionNumber );
+
+            if ( _r.er[m->exceptionNumber].lastEntry )
+            {
+                _exRecord( m->exceptionNumber, EXD_INTERVAL, _r.timeStamp - _r.er[m->exceptionNumber].lastEntry );
+            }
+
+            _r.er[m->exceptionNumber].lastEntry = _r.timeStamp;
             break;
 
         case EXEVENT_RESUME: /* Unwind all levels of exception (deals with tail chaining) */
@@ -343,10 +678,55 @@ void _handleException( struct excMsg *m, struct ITMDecoder *i )
     };
 }
 // ====================================================================================================
-void _handleDWTEvent( struct ITMDecoder *i, struct ITMPacket *p )
+void _handleSoftware( struct swMsg *m, struct ITMDecoder *i )
+
+/* A write to the task channel is the target telling us which task it has just switched to */
+
+{
+    struct taskRecord *t;
+
+    assert( m->msgtype == MSG_SOFTWARE );
+
+    if ( m->srcAddr != options.taskChannel )
+    {
+        return;
+    }
+
+    if ( _r.task )
+    {
+        _r.task->ticks += _r.timeStamp - _r.taskSince;
+    }
+
+    HASH_FIND_INT( _r.tasks, &m->value, t );
+
+    if ( !t )
+    {
+        t = ( struct taskRecord * )memCalloc( MEM_ADDRESSES, 1, sizeof( struct taskRecord ) );
+        MEMCHECKV( t );
+        t->id = m->value;
+        HASH_ADD_INT( _r.tasks, id, t );
+    }
+
+    t->switches++;
+    _r.task = t;
+    _r.taskSince = _r.timeStamp;
+}
+// ====================================================================================================
+void _handleDWTEvent( struct dwtMsg *m, struct ITMDecoder *i )
+
+/* Count which of the DWT profiling counters wrapped; there can be several in the one event */
 
 {
+    assert( m->msgtype == MSG_DWT_EVENT );
 
+    for ( enum dwtCounter d = 0; d < DWT_NUM; d++ )
+    {
+        if ( m->event & ( 1 << d ) )
+        {
+            _r.dwt[d]++;
+            _r.dwtSeen = true;
+        }
+    }
 }
 // ====================================================================================================
 void _handleSW( struct ITMDecoder *i, struct ITMPacket *p )
@@ -359,530 +739,1646 @@ void _handleSW( struct ITMDecoder *i, struct ITMPacket *p )
 // Outputter routines
 // ====================================================================================================
 // ====================================================================================================
+static uint64_t _accumulate( uint64_t visits, uint32_t *bucket, uint64_t *windowSum, double *decayed )
+
+/* Fold this interval's visits into the count that is to be reported, according to the reporting mode */
+
+{
+    if ( options.windowBuckets )
+    {
+        /* Sliding window; the oldest interval drops out as this one goes in */
+        *windowSum += visits - bucket[_r.bucketIdx];
+        bucket[_r.bucketIdx] = visits;
+        return *windowSum;
+    }
+
+    if ( options.decay )
+    {
+        /* First order decay, with the time constant expressed in display intervals */
+        *decayed = ( *decayed * options.decay + visits * options.displayInterval ) / ( options.decay + options.displayInterval );
+        return ( uint64_t )( *decayed + 0.5 );
+    }
+
+    return visits;
+}
+// ====================================================================================================
+int _task_sort_fn( const void *a, const void *b )
+
+{
+    uint64_t ca = ( ( struct taskLine * )a )->samples;
+    uint64_t cb = ( ( struct taskLine * )b )->samples;
+
+    return ( ca < cb ) ? 1 : ( ca > cb ) ? -1 : 0;
+}
+// ====================================================================================================
+static void _consolodateTasks( void )
+
+/* Collect what each task did in this interval, the one still running up to now, resetting them as we go */
+
+{
+    struct taskRecord *t;
+
+    _r.taskLines = 0;
+
+    if ( _r.task )
+    {
+        _r.task->ticks += _r.timeStamp - _r.taskSince;
+        _r.taskSince = _r.timeStamp;
+    }
+
+    if ( _r.taskAlloc < HASH_COUNT( _r.tasks ) )
+    {
+        _r.taskAlloc = HASH_COUNT( _r.tasks );
+        _r.taskReport = ( struct taskLine * )memRealloc( MEM_LINES, _r.taskReport, sizeof( struct taskLine ) * _r.taskAlloc );
+        MEMCHECKV( _r.taskReport );
+    }
+
+    for ( t = _r.tasks; t != NULL; t = t->hh.next )
+    {
+        if ( ( t->samples ) || ( t->ticks ) || ( t->switches ) )
+        {
+            _r.taskReport[_r.taskLines].id       = t->id;
+            _r.taskReport[_r.taskLines].samples  = t->samples;
+            _r.taskReport[_r.taskLines].ticks    = t->ticks;
+            _r.taskReport[_r.taskLines].switches = t->switches;
+            _r.taskLines++;
+            t->samples = t->ticks = t->switches = 0;
+        }
+    }
+
+    qsort( _r.taskReport, _r.taskLines, sizeof( struct taskLine ), _task_sort_fn );
+}
+// ====================================================================================================
 uint32_t _consolodateReport( struct reportLine **returnReport, uint32_t *returnReportLines )
 
+/* Collect the counts for this interval into a report, resetting them as we go. The counts are already */
+/* aggregated per report line, so this is proportional to the number of lines, not samples.            */
+
 {
-    struct nameEntry *n;
-    struct visitedAddr *a;
+    struct reportSlot *a, *at;
 
     uint32_t reportLines = 0;
-    struct reportLine *report = NULL;
+    uint32_t significant = 0;
     uint32_t total = 0;
 
+    /* Make sure there's room for every line, plus the sleeping one */
+    if ( _r.reportAlloc < HASH_COUNT( _r.slots ) + 1 )
+    {
+        _r.reportAlloc = HASH_COUNT( _r.slots ) + 1;
+        _r.report = ( struct reportLine * )memRealloc( MEM_LINES, _r.report, sizeof( struct reportLine ) * _r.reportAlloc );
 
-    /* Put the address into order of the file and function names */
-    HASH_SORT( _r.addresses, _routines_sort_fn );
+        if ( !_r.report )
+        {
+            genericsExit( -1, "Out of memory" EOL );
+        }
+    }
 
-    /* Now merge them together */
-    for ( a = _r.addresses; a != NULL; a = a->hh.next )
+    HASH_ITER( hh, _r.slots, a, at )
     {
-        if ( !a->visits )
+        uint64_t count = _accumulate( a->visits, a->bucket, &a->windowSum, &a->decayed );
+
+        /* The store gets what actually happened in the interval, whatever is being reported */
+        if ( ( _r.ts ) && ( _r.s ) )
         {
-            continue;
+            tsStoreAdd( _r.ts, SymbolFunction( _r.s, a->n.functionindex ), a->visits );
         }
 
-        if ( ( reportLines == 0 ) ||
-                ( ( options.reportFilenames ) &&  ( report[reportLines - 1].n->fileindex != a->n->fileindex ) ) ||
-                ( report[reportLines - 1].n->functionindex != a->n->functionindex ) ||
-                ( ( report[reportLines - 1].n->line != a->n->line ) && ( options.lineDisaggregation ) ) )
-        {
-            /* Make room for a report line */
-            reportLines++;
-            report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( reportLines ) );
+        a->visits = 0;
 
-            if ( !report )
+        if ( !count )
+        {
+            /* With the heavy hitters nothing refers to a line but its count, so once that has all */
+            /* gone it can go too, and only lines that were busy recently are ever kept.          */
+            if ( ( options.topK ) && ( !a->windowSum ) && ( a->decayed < 0.5 ) )
             {
-                genericsExit( -1, "Out of memory" EOL );
+                HASH_DEL( _r.slots, a );
+                memFree( MEM_ADDRESSES, a );
             }
 
-            report[reportLines - 1].n = a->n;
-            report[reportLines - 1].count = 0;
+            continue;
         }
 
-        report[reportLines - 1].count += a->visits;
-        total += a->visits;
-        a->visits = 0;
+        _r.report[reportLines].n = &a->n;
+        _r.report[reportLines].id = a->id;
+        _r.report[reportLines].count = count;
+        reportLines++;
+        total += count;
     }
 
-
     /* Now fold in any sleeping entries */
-    report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( reportLines + 1 ) );
+    _r.sleepName.fileindex = NO_FILE;
+    _r.sleepName.functionindex = FN_SLEEPING;
+    _r.sleepName.addr = 0;
+    _r.sleepName.line = 0;
+
+    _r.report[reportLines].n = &_r.sleepName;
+    _r.report[reportLines].id = BIN_SLEEP_ID;
+    _r.report[reportLines].count = _accumulate( _r.sleeps, _r.sleepBucket, &_r.sleepWindowSum, &_r.sleepDecayed );
+    total += _r.report[reportLines].count;
+    reportLines++;
 
-    if ( !report )
+    if ( _r.ts )
     {
-        genericsExit( -1, "Out of memory" EOL );
+        tsStoreAdd( _r.ts, FN_SLEEPING_STR, _r.sleeps );
     }
 
-    uint32_t addr = FN_SLEEPING;
-    HASH_FIND_INT( _r.addresses, &addr, a );
+    _r.sleeps = 0;
 
-    if ( a )
+    if ( options.windowBuckets )
     {
-        n = a->n;
+        _r.bucketIdx = ( _r.bucketIdx + 1 ) % options.windowBuckets;
     }
-    else
+
+    /* Only lines above the cutoff are ever displayed individually, so move those to the front and only */
+    /* sort them. The rest just contribute to the totals.                                                */
+    for ( uint32_t n = 0; ( total ) && ( n < reportLines ); n++ )
     {
-        n = ( struct nameEntry * )malloc( sizeof( struct nameEntry ) );
+        if ( ( _r.report[n].count * 10000 ) / total >= CUTOFF )
+        {
+            struct reportLine t = _r.report[significant];
+            _r.report[significant++] = _r.report[n];
+            _r.report[n] = t;
+        }
     }
 
-    n->fileindex = NO_FILE;
-    n->functionindex = FN_SLEEPING;
-    n->addr = 0;
-    n->line = 0;
+    qsort( _r.report, significant, sizeof( struct reportLine ), _report_sort_fn );
 
-    report[reportLines].n = n;
-    report[reportLines].count = _r.sleeps;
-    reportLines++;
-    total += _r.sleeps;
-    _r.sleeps = 0;
+    if ( options.taskChannel >= 0 )
+    {
+        _consolodateTasks();
+    }
 
-    /* Now put the whole thing into order of number of samples */
-    qsort( report, reportLines, sizeof( struct reportLine ), _report_sort_fn );
+    memcpy( _r.dwtReport, _r.dwt, sizeof( _r.dwt ) );
+    memset( _r.dwt, 0, sizeof( _r.dwt ) );
 
-    *returnReport = report;
+    /* ...and the exceptions' distributions over the interval go with it */
+    for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+    {
+        for ( enum exDist d = 0; ( _r.erDists[e] ) && ( d < EXD_NUM ); d++ )
+        {
+            latencyTake( &_r.erDists[e]->h[d], &_r.er[e].dist[d] );
+        }
+    }
+
+    *returnReport = _r.report;
     *returnReportLines = reportLines;
 
     return total;
 }
 // ====================================================================================================
+static void _jsonString( FILE *f, const char *s )
+
+/* Write s as a JSON string, escaping whatever needs it */
+
+{
+    if ( !s )
+    {
+        fputs( "null", f );
+        return;
+    }
+
+    fputc( '"', f );
+
+    for ( ; *s; s++ )
+    {
+        switch ( *s )
+        {
+            case '"':
+                fputs( "\\\"", f );
+                break;
+
+            case '\\':
+                fputs( "\\\\", f );
+                break;
+
+            case '\n':
+                fputs( "\\n", f );
+                break;
+
+            case '\r':
+                fputs( "\\r", f );
+                break;
+
+            case '\t':
+                fputs( "\\t", f );
+                break;
+
+            default:
+                if ( ( uint8_t )*s < ' ' )
+                {
+                    fprintf( f, "\\u%04x", ( uint8_t )*s );
+                }
+                else
+                {
+                    fputc( *s, f );
+                }
+        }
+    }
+
+    fputc( '"', f );
+}
+// ====================================================================================================
 static void _outputJson( FILE *f, uint32_t total, uint32_t reportLines, struct reportLine *report, int64_t timeStamp )
 
-/* Produce the output to JSON */
+/* Produce the output to JSON. It's written straight out as it goes, one line per report */
 
 {
-    /* JSON output constructor */
-    cJSON *jsonStore;
-    cJSON *jsonElement;
-    cJSON *jsonTopTable;
-    cJSON *jsonStatsTable;
-    cJSON *jsonTableEntry;
-    cJSON *jsonIntTable;
-    char *opString;
+    const char *sep = "";
 
     /* Start of frame  ====================================================== */
-    jsonStore = cJSON_CreateObject();
-    assert( jsonStore );
-    jsonElement = cJSON_CreateNumber( timeStamp );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStore, "timestamp", jsonElement );
-    jsonElement = cJSON_CreateNumber( total );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStore, "elements", jsonElement );
-    jsonElement = cJSON_CreateNumber( timeStamp - _r.lastReportus );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStore, "interval", jsonElement );
-
-    /* Create stats ========================================================= */
-    jsonStatsTable = cJSON_CreateObject();
-    assert( jsonStatsTable );
-    cJSON_AddItemToObject( jsonStore, "stats", jsonStatsTable );
-
-    jsonElement = cJSON_CreateNumber( ITMDecoderGetStats( &_r.i )->overflow );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "overflow", jsonElement );
-
-    jsonElement = cJSON_CreateNumber( ITMDecoderGetStats( &_r.i )->syncCount );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "itmsync", jsonElement );
-    jsonElement = cJSON_CreateNumber( ITMDecoderGetStats( &_r.i )->ErrorPkt );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "error", jsonElement );
-
-
-    /* Create top table ====================================================== */
-    jsonTopTable = cJSON_CreateArray();
-    assert( jsonTopTable );
-    cJSON_AddItemToObject( jsonStore, "toptable", jsonTopTable );
+    fprintf( f, "{\"timestamp\":%" PRId64 ",\"elements\":%" PRIu32 ",\"interval\":%" PRId64,
+             timeStamp, total, timeStamp - _r.lastReportus );
 
-    for ( uint32_t n = 0; n < reportLines; n++ )
+    /* Stats ================================================================= */
+    fprintf( f, ",\"stats\":{\"overflow\":%" PRIu32 ",\"itmsync\":%" PRIu32 ",\"error\":%" PRIu32 "}",
+             ( uint32_t )ITMDecoderGetStats( &_r.i )->overflow,
+             ( uint32_t )ITMDecoderGetStats( &_r.i )->syncCount,
+             ( uint32_t )ITMDecoderGetStats( &_r.i )->ErrorPkt );
+
+    /* Memory, live and peak bytes by what it's for ========================== */
+    fputs( ",\"memory\":{", f );
+
+    for ( int m = 0; m < MEM_NUM_SUBSYSTEMS; m++ )
     {
-        if ( report[n].count )
-        {
-            char *d = NULL;
+        struct memUse u;
+
+        memGetUse( m, &u );
+        fprintf( f, "%s\"%s\":{\"live\":%" PRIu64 ",\"peak\":%" PRIu64 "}", ( m ) ? "," : "", memSubsystemName( m ), u.live, u.peak );
+    }
 
-            /* Output in JSON Format */
-            jsonTableEntry = cJSON_CreateObject();
-            assert( jsonTableEntry );
+    fputc( '}', f );
 
-            jsonElement = cJSON_CreateNumber( report[n].count );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "count", jsonElement );
-            jsonElement = cJSON_CreateString( SymbolFilename( _r.s, report[n].n->fileindex ) );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "filename", jsonElement );
+    /* Top table ============================================================= */
+    fputs( ",\"toptable\":[", f );
 
-            jsonElement = cJSON_CreateString(  d ? d : SymbolFunction( _r.s, report[n].n->functionindex ) );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "function", jsonElement );
+    for ( uint32_t n = 0; n < reportLines; n++ )
+    {
+        if ( report[n].count )
+        {
+            fprintf( f, "%s{\"count\":%" PRIu64 ",\"filename\":", sep, report[n].count );
+            _jsonString( f, SymbolFilename( _r.s, report[n].n->fileindex ) );
+            fputs( ",\"function\":", f );
+            _jsonString( f, SymbolFunction( _r.s, report[n].n->functionindex ) );
 
             if ( options.lineDisaggregation )
             {
-                jsonElement = cJSON_CreateNumber( report[n].n->line ? report[n].n->line : 0 );
-                assert( jsonElement );
-                cJSON_AddItemToObject( jsonTableEntry, "line", jsonElement );
+                fprintf( f, ",\"line\":%" PRIu32, report[n].n->line );
             }
 
-            cJSON_AddItemToObject( jsonTopTable, "top", jsonTableEntry );
+            fputc( '}', f );
+            sep = ",";
         }
     }
 
-    /* Now add the interrupt metrics ================================================ */
-    jsonIntTable = cJSON_CreateArray();
-    assert( jsonIntTable );
-    cJSON_AddItemToObject( jsonStore, "exceptions", jsonIntTable );
+    /* Now the interrupt metrics ============================================= */
+    fputs( "],\"exceptions\":[", f );
+    sep = "";
 
     for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
     {
         if ( _r.er[e].visits )
         {
-            jsonTableEntry = cJSON_CreateObject();
-            assert( jsonTableEntry );
-            cJSON_AddItemToObject( jsonIntTable, "exceptions", jsonTableEntry );
-            jsonElement = cJSON_CreateNumber( e );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "ex", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].visits );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "count", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].maxDepth );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "maxd", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].totalTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "totalt", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].minTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "mint", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].maxTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "maxt", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].maxWallTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "maxwt", jsonElement );
-        }
-    }
-
-    /* Close off JSON report - if you want your printing pretty then use the first line */
-    //opString=cJSON_Print(jsonStore);
-
-    opString = cJSON_PrintUnformatted( jsonStore );
-    cJSON_Delete( jsonStore );
-    fprintf( f, "%s" EOL, opString );
-    free( opString );
-}
+            fprintf( f, "%s{\"ex\":%" PRIu32 ",\"count\":%" PRIu64 ",\"maxd\":%" PRIu32 ",\"totalt\":%" PRId64
+                     ",\"mint\":%" PRId64 ",\"maxt\":%" PRId64 ",\"maxwt\":%" PRId64,
+                     sep, e, _r.er[e].visits, _r.er[e].maxDepth, _r.er[e].totalTime,
+                     _r.er[e].minTime, _r.er[e].maxTime, _r.er[e].maxWallTime );
 
-static const char *ExceptionNames[] =
-{
-    [0] = "None",
-    [1] = "Reset",
-    [2] = "NMI",
-    [3] = "HardFault",
-    [4] = "MemManage",
-    [5] = "BusFault",
-    [6] = "UsageFault",
-    [7] = "Reserved",
-    [8] = "Reserved",
-    [9] = "Reserved",
-    [10] = "Reserved",
-    [11] = "SVCall",
-    [12] = "DebugMonitor",
-    [13] = "Reserved",
-    [14] = "PendSV",
-    [15] = "SysTick",
-};
+            for ( enum exDist d = 0; d < EXD_NUM; d++ )
+            {
+                fprintf( f, ",\"%s\":{\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 "}",
+                         exDistString[d], _r.er[e].dist[d].p50, _r.er[e].dist[d].p99, _r.er[e].dist[d].p999 );
+            }
 
-// ====================================================================================================
-static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine *report, int64_t lastTime )
+            fputc( '}', f );
+            sep = ",";
+        }
+    }
 
-/* Produce the output */
+    fputc( ']', f );
 
-{
-    uint64_t samples = 0;
-    uint64_t dispSamples = 0;
-    uint32_t percentage;
-    uint32_t totPercent = 0;
+    /* ...and the DWT counters, once there have been any ==================== */
+    if ( _r.dwtSeen )
+    {
+        fputs( ",\"dwt\":{", f );
 
-    FILE *p = NULL;
-    FILE *q = NULL;
-    uint32_t printed = 0;
+        for ( enum dwtCounter d = 0; d < DWT_NUM; d++ )
+        {
+            fprintf( f, "%s\"%s\":%" PRIu32, ( d ) ? "," : "", dwtString[d], _r.dwtReport[d] );
+        }
 
-    /* This is the file retaining the current samples */
-    if ( options.outfile )
-    {
-        p = fopen( options.outfile, "w" );
+        fputc( '}', f );
     }
 
-    /* This is the file containing the historic samples */
-    if ( options.logfile )
+    /* ...and the tasks, if they're being followed ============================ */
+    if ( options.taskChannel >= 0 )
     {
-        q = fopen( options.logfile, "a" );
+        fputs( ",\"tasks\":[", f );
+
+        for ( uint32_t n = 0; n < _r.taskLines; n++ )
+        {
+            fprintf( f, "%s{\"task\":%" PRIu32 ",\"samples\":%" PRIu64 ",\"ticks\":%" PRId64 ",\"switches\":%" PRIu64 "}",
+                     ( n ) ? "," : "", _r.taskReport[n].id, _r.taskReport[n].samples, _r.taskReport[n].ticks, _r.taskReport[n].switches );
+        }
+
+        fputc( ']', f );
     }
 
-    genericsPrintf( CLEAR_SCREEN );
+    fputs( "}" EOL, f );
+}
+
+// ====================================================================================================
+static uint8_t *_binSpace( uint32_t len )
+
+/* Make sure the binary record buffer can hold len bytes, and return it */
 
-    if ( total )
+{
+    if ( _r.binAlloc < len )
     {
-        for ( uint32_t n = 0; n < reportLines; n++ )
+        _r.binAlloc = len + len / 2;
+        _r.binBuf = ( uint8_t * )realloc( _r.binBuf, _r.binAlloc );
+
+        if ( !_r.binBuf )
         {
-            percentage = ( report[n].count * 10000 ) / total;
-            samples += report[n].count;
+            genericsExit( -1, "Out of memory" EOL );
+        }
+    }
 
-            if ( report[n].count )
-            {
-                char *d = NULL;
+    return _r.binBuf;
+}
+// ====================================================================================================
+static uint8_t *_binU16( uint8_t *p, uint16_t v )
 
-                if ( ( percentage >= CUTOFF ) && ( ( !options.cutscreen ) || ( n < options.cutscreen ) ) )
-                {
-                    dispSamples += report[n].count;
-                    totPercent += percentage;
+{
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+// ====================================================================================================
+static uint8_t *_binU32( uint8_t *p, uint32_t v )
 
-                    genericsPrintf( C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " ", percentage / 100, percentage % 100, report[n].count );
+{
+    p = _binU16( p, v );
+    return _binU16( p, v >> 16 );
+}
+// ====================================================================================================
+static uint8_t *_binI64( uint8_t *p, int64_t v )
 
+{
+    p = _binU32( p, ( uint64_t )v );
+    return _binU32( p, ( uint64_t )v >> 32 );
+}
+// ====================================================================================================
+static uint8_t *_binString( uint8_t *p, const char *str, uint16_t len )
 
-                    if ( ( options.reportFilenames ) && ( report[n].n->fileindex != NO_FILE ) )
-                    {
-                        genericsPrintf( C_CONTEXT "%s" C_RESET "::", SymbolFilename( _r.s, report[n].n->fileindex ) );
-                    }
+{
+    p = _binU16( p, len );
+    memcpy( p, str, len );
+    return p + len;
+}
+// ====================================================================================================
+static uint8_t *_binStart( uint8_t type, uint32_t len )
 
-                    if ( ( options.lineDisaggregation ) && ( report[n].n->line ) )
-                    {
-                        genericsPrintf( C_SUPPORT2 "%s" C_RESET "::" C_CONTEXT "%d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line );
-                    }
-                    else
-                    {
-                        genericsPrintf( C_SUPPORT2 "%s" C_RESET EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ) );
-                    }
+/* Start a binary record of type with a payload of len, returning where the payload goes */
 
-                    printed++;
-                }
+{
+    uint8_t *p = _binSpace( len + 5 );
 
-                /* Write to current and historical data files if appropriate */
-                if ( percentage >= CUTOFF )
-                {
-                    if ( !options.lineDisaggregation )
-                    {
-                        if ( ( p ) && ( n < options.maxRoutines ) )
-                        {
-                            fprintf( p, "%s,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), percentage / 100, percentage % 100 );
-                        }
+    p = _binU32( p, len + 1 );
+    *p++ = type;
+    return p;
+}
+// ====================================================================================================
+static void _binEnd( uint8_t *p )
 
-                        if ( q )
-                        {
-                            fprintf( q, "%s,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), percentage / 100, percentage % 100 );
-                        }
-                    }
-                    else
-                    {
-                        if ( ( p ) && ( n < options.maxRoutines ) )
-                        {
-                            fprintf( p, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
-                        }
+/* Send the record that finishes at p */
 
-                        if ( q )
-                        {
-                            fprintf( q, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
-                        }
-                    }
+{
+    fwrite( _r.binBuf, 1, p - _r.binBuf, _r.binfile );
+}
+// ====================================================================================================
+static void _outputBinaryDict( uint32_t id, struct nameEntry *n )
 
+/* Announce the names for a report line. This happens once, when the line is first seen. */
 
-                }
-            }
-        }
-    }
+{
+    const char *fn = SymbolFunction( _r.s, n->functionindex );
+    const char *file = ( n->fileindex == NO_FILE ) ? "" : SymbolFilename( _r.s, n->fileindex );
+    uint16_t fnLen = strnlen( fn, UINT16_MAX );
+    uint16_t fileLen = strnlen( file, UINT16_MAX );
+    uint8_t *p;
+
+    p = _binStart( BIN_REC_DICT, 12 + fnLen + fileLen );
+    p = _binU32( p, id );
+    p = _binU32( p, n->line );
+    p = _binString( p, file, fileLen );
+    p = _binString( p, fn, fnLen );
+    _binEnd( p );
+}
+// ====================================================================================================
+static void _outputBinaryReset( void )
 
-    genericsPrintf( C_RESET "-----------------" EOL );
+/* Invalidate all announced report lines, then announce the one that's always present */
 
-    genericsPrintf( C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " " C_RESET "of "C_DATA" %" PRIu64 " "C_RESET" Samples" EOL, totPercent / 100, totPercent % 100, dispSamples, samples );
+{
+    struct nameEntry n = { .fileindex = NO_FILE, .functionindex = FN_SLEEPING };
 
-    if ( p )
+    _binEnd( _binStart( BIN_REC_RESET, 0 ) );
+    _outputBinaryDict( BIN_SLEEP_ID, &n );
+}
+// ====================================================================================================
+static void _outputBinaryHeader( void )
+
+{
+    uint8_t *p = _binStart( BIN_REC_HEADER, 4 + 2 + 1 + 8 );
+
+    memcpy( p, BIN_MAGIC, 4 );
+    p = _binU16( p + 4, BIN_VERSION );
+    *p++ = ( options.lineDisaggregation ? 1 : 0 ) | ( options.reportFilenames ? 2 : 0 );
+    p = _binI64( p, options.displayInterval );
+    _binEnd( p );
+}
+// ====================================================================================================
+static void _outputBinary( uint32_t total, uint32_t reportLines, struct reportLine *report, int64_t timeStamp )
+
+/* Produce the output in columnar binary form, referring to report lines by their announced ids */
+
+{
+    uint32_t rows = 0;
+    uint32_t exceptions = 0;
+    uint8_t *p;
+
+    for ( uint32_t n = 0; n < reportLines; n++ )
     {
-        fclose( p );
+        rows += ( report[n].count != 0 );
     }
 
-    if ( q )
+    for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
     {
-        fprintf( q, "===================================" EOL );
-        fclose( q );
+        exceptions += ( _r.er[e].visits != 0 );
     }
 
+    p = _binStart( BIN_REC_FRAME, 8 + 8 + 6 * 4 + rows * 8 + exceptions * ( 3 * 4 + 4 * 8 + EXD_NUM * 3 * 8 ) );
+    p = _binI64( p, timeStamp );
+    p = _binI64( p, timeStamp - _r.lastReportus );
+    p = _binU32( p, total );
+    p = _binU32( p, ITMDecoderGetStats( &_r.i )->overflow );
+    p = _binU32( p, ITMDecoderGetStats( &_r.i )->syncCount );
+    p = _binU32( p, ITMDecoderGetStats( &_r.i )->ErrorPkt );
+    p = _binU32( p, rows );
+    p = _binU32( p, exceptions );
+
+    /* Top table, one column at a time */
+    for ( uint32_t n = 0; n < reportLines; n++ )
+    {
+        if ( report[n].count )
+        {
+            p = _binU32( p, report[n].id );
+        }
+    }
 
-    if ( options.outputExceptions )
+    for ( uint32_t n = 0; n < reportLines; n++ )
     {
-        /* Tidy up screen output */
-        while ( printed++ <= options.cutscreen )
+        if ( report[n].count )
         {
-            genericsPrintf( EOL );
+            p = _binU32( p, report[n].count );
         }
+    }
 
-        genericsPrintf( EOL " Exception         |   Count  |  MaxD | TotalTicks  |   %%   |  AveTicks  |  minTicks  |  maxTicks  |  maxWall " EOL );
-        genericsPrintf( /**/"-------------------+----------+-------+-------------+-------+------------+------------+------------+----------" EOL );
+    /* ...and the same for the exceptions */
+#define EXCEPTION_COLUMN(field, fn) for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ ) if ( _r.er[e].visits ) p = fn( p, field )
+    EXCEPTION_COLUMN( e, _binU32 );
+    EXCEPTION_COLUMN( _r.er[e].visits, _binU32 );
+    EXCEPTION_COLUMN( _r.er[e].maxDepth, _binU32 );
+    EXCEPTION_COLUMN( _r.er[e].totalTime, _binI64 );
+    EXCEPTION_COLUMN( _r.er[e].minTime, _binI64 );
+    EXCEPTION_COLUMN( _r.er[e].maxTime, _binI64 );
+    EXCEPTION_COLUMN( _r.er[e].maxWallTime, _binI64 );
+
+    for ( enum exDist d = 0; d < EXD_NUM; d++ )
+    {
+        EXCEPTION_COLUMN( _r.er[e].dist[d].p50, _binI64 );
+        EXCEPTION_COLUMN( _r.er[e].dist[d].p99, _binI64 );
+        EXCEPTION_COLUMN( _r.er[e].dist[d].p999, _binI64 );
+    }
 
-        for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
-        {
+#undef EXCEPTION_COLUMN
 
-            if ( _r.er[e].visits )
-            {
-                char exceptionName[30] = { 0 };
+    _binEnd( p );
 
-                if ( e < 16 )
-                {
-                    snprintf( exceptionName, sizeof( exceptionName ), "(%s)", ExceptionNames[e] );
-                }
-                else
-                {
-                    snprintf( exceptionName, sizeof( exceptionName ), "(IRQ %d)", e - 16 );
-                }
+    if ( _r.dwtSeen )
+    {
+        p = _binStart( BIN_REC_DWT, DWT_NUM * 4 );
 
-                const float util_percent = ( float )_r.er[e].totalTime / ( _r.timeStamp - _r.lastReportTicks ) * 100.0f;
-                genericsPrintf( C_DATA "%3" PRId32 " %-14s" C_RESET " | " C_DATA "%8" PRIu64 C_RESET " |" C_DATA " %5"
-                                PRIu32 C_RESET " | "C_DATA " %9" PRIu64 C_RESET "  |" C_DATA "%6.1f" C_RESET " |  " C_DATA "%9" PRIu64 C_RESET " | " C_DATA "%9" PRIu64 C_RESET "  | " C_DATA" %9" PRIu64 C_RESET " | " C_DATA "%9"
-                                PRIu64 C_RESET EOL,
-                                e, exceptionName, _r.er[e].visits, _r.er[e].maxDepth, _r.er[e].totalTime, util_percent, _r.er[e].totalTime / _r.er[e].visits, _r.er[e].minTime, _r.er[e].maxTime, _r.er[e].maxWallTime );
-            }
+        for ( enum dwtCounter d = 0; d < DWT_NUM; d++ )
+        {
+            p = _binU32( p, _r.dwtReport[d] );
         }
+
+        _binEnd( p );
     }
 
-    genericsPrintf( EOL C_RESET "[%s%s%s%s" C_RESET "] ",
-                    ( _r.ITMoverflows != ITMDecoderGetStats( &_r.i )->overflow ) ? C_OVF_IND "V" : C_RESET "-",
-                    ( _r.SWPkt != ITMDecoderGetStats( &_r.i )->SWPkt ) ? C_SOFT_IND "S" : C_RESET "-",
-                    ( _r.TSPkt != ITMDecoderGetStats( &_r.i )->TSPkt ) ? C_TSTAMP_IND "T" : C_RESET "-",
-                    ( _r.HWPkt != ITMDecoderGetStats( &_r.i )->HWPkt ) ? C_HW_IND "H" : C_RESET "-" );
+    fflush( _r.binfile );
+}
+// ====================================================================================================
+static void _exceptionName( uint32_t e, char *name, size_t len )
 
-    if ( ( _r.lastReportTicks ) && ( lastTime != _r.lastReportus ) )
-        genericsPrintf( "Interval = " C_DATA "%" PRIu64 "ms " C_RESET "/ "C_DATA "%" PRIu64 C_RESET " (~" C_DATA "%" PRIu64 C_RESET " Ticks/ms)" EOL,
-                        ( ( lastTime - _r.lastReportus ) ) / 1000, _r.timeStamp - _r.lastReportTicks, ( ( _r.timeStamp - _r.lastReportTicks ) * 1000 ) / ( lastTime - _r.lastReportus ) );
+{
+    if ( e < 16 )
+    {
+        snprintf( name, len, "(%s)", ExceptionNames[e] );
+    }
     else
     {
-        genericsPrintf( C_RESET "Interval = " C_DATA "%" PRIu64 C_RESET "ms" EOL, ( ( lastTime - _r.lastReportus ) ) / 1000 );
+        snprintf( name, len, "(IRQ %d)", e - 16 );
+    }
+}
+
+// ====================================================================================================
+static size_t _snapName( struct topSnapshot *s, const char *str )
+
+/* Keep a copy of str in the snapshot, returning where it is */
+
+{
+    size_t len, ofs = s->namesLen;
+
+    if ( !str )
+    {
+        return NO_NAME;
     }
 
-    genericsReport( V_INFO, "         Ovf=%3d  ITMSync=%3d ITMErrors=%3d" EOL,
-                    ITMDecoderGetStats( &_r.i )->overflow,
-                    ITMDecoderGetStats( &_r.i )->syncCount,
-                    ITMDecoderGetStats( &_r.i )->ErrorPkt );
+    len = strlen( str ) + 1;
 
-}
+    if ( s->namesLen + len > s->namesAlloc )
+    {
+        s->namesAlloc = ( s->namesAlloc + len ) * 2;
+        s->names = ( char * )memRealloc( MEM_LINES, s->names, s->namesAlloc );
+        MEMCHECK( s->names, NO_NAME );
+    }
 
+    memcpy( &s->names[ofs], str, len );
+    s->namesLen += len;
+    return ofs;
+}
 // ====================================================================================================
-void _handlePCSample( struct pcSampleMsg *m, struct ITMDecoder *i )
+static const char *_snapString( const struct topSnapshot *s, size_t ofs )
 
 {
-    assert( m->msgtype == MSG_PC_SAMPLE );
+    return ( ofs == NO_NAME ) ? "" : &s->names[ofs];
+}
+// ====================================================================================================
+static void _historyCommit( void )
 
-    struct visitedAddr *a;
+/* Put the interval's counts into the store, by the wall clock since that's what a long run is followed by */
 
-    if ( m->sleep )
+{
+    if ( ( _r.ts ) && ( !tsStoreCommit( _r.ts, time( NULL ) ) ) )
     {
-        /* This is a sleep packet */
-        _r.sleeps++;
+        genericsReport( V_WARN, "Could not write history to %s" EOL, options.history );
     }
-    else
+}
+// ====================================================================================================
+static void _snapshotMake( struct topSnapshot *s, uint32_t total, uint32_t reportLines, struct reportLine *report, int64_t thisTime )
+
+/* Take everything the screen needs out of this report, so it can be shown without touching the decode */
+
+{
+    struct ITMDecoderStats *stats = ITMDecoderGetStats( &_r.i );
+
+    s->total = total;
+    s->samples = 0;
+    s->lines = 0;
+    s->namesLen = 0;
+
+    for ( uint32_t n = 0; n < reportLines; n++ )
     {
-        HASH_FIND_INT( _r.addresses, &m->pc, a );
+        s->samples += report[n].count;
 
-        if ( a )
+        if ( ( !report[n].count ) || ( ( report[n].count * 10000 ) / total < CUTOFF ) )
         {
-            a->visits++;
+            continue;
         }
-        else
-        {
-            struct nameEntry n;
 
-            /* Find a matching name record if there is one */
-            SymbolLookup( _r.s, m->pc, &n );
+        if ( s->lines == s->linesAlloc )
+        {
+            s->linesAlloc = ( s->linesAlloc ) ? s->linesAlloc * 2 : 64;
+            s->line = ( struct topLine * )memRealloc( MEM_LINES, s->line, s->linesAlloc * sizeof( struct topLine ) );
+            MEMCHECKV( s->line );
+        }
 
-            /* This is a new entry - record it */
+        struct topLine *l = &s->line[s->lines++];
+        l->count = report[n].count;
+        l->rank = n;
+        l->line = report[n].n->line;
+        l->function = _snapName( s, SymbolFunction( _r.s, report[n].n->functionindex ) );
+        l->file = ( report[n].n->fileindex != NO_FILE ) ? _snapName( s, SymbolFilename( _r.s, report[n].n->fileindex ) ) : NO_NAME;
+    }
 
-            a = ( struct visitedAddr * )calloc( 1, sizeof( struct visitedAddr ) );
-            MEMCHECKV( a );
-            a->visits = 1;
+    memcpy( s->er, _r.er, sizeof( s->er ) );
 
-            a->n = ( struct nameEntry * )malloc( sizeof( struct nameEntry ) );
-            MEMCHECKV( a->n );
-            memcpy( a->n, &n, sizeof( struct nameEntry ) );
-            HASH_ADD_INT( _r.addresses, n->addr, a );
-        }
+    if ( s->tasksAlloc < _r.taskLines )
+    {
+        s->tasksAlloc = _r.taskLines;
+        s->task = ( struct taskLine * )memRealloc( MEM_LINES, s->task, s->tasksAlloc * sizeof( struct taskLine ) );
+        MEMCHECKV( s->task );
     }
+
+    memcpy( s->task, _r.taskReport, _r.taskLines * sizeof( struct taskLine ) );
+    s->tasks = _r.taskLines;
+    s->dwtSeen = _r.dwtSeen;
+    memcpy( s->dwt, _r.dwtReport, sizeof( s->dwt ) );
+    s->thisTime = thisTime;
+    s->lastReportus = _r.lastReportus;
+    s->haveTicks = ( _r.lastReportTicks != 0 );
+    s->ticks = _r.timeStamp - _r.lastReportTicks;
+    s->ovf = ( _r.ITMoverflows != stats->overflow );
+    s->sw = ( _r.SWPkt != stats->SWPkt );
+    s->ts = ( _r.TSPkt != stats->TSPkt );
+    s->hw = ( _r.HWPkt != stats->HWPkt );
+    s->overflow = stats->overflow;
+    s->syncCount = stats->syncCount;
+    s->errorPkt = stats->ErrorPkt;
+    s->hitters = _r.hitterReported;
+    s->hitterBound = _r.hitterBound;
 }
 // ====================================================================================================
-void _flushHash( void )
+static void _snapshotPublish( void )
+
+/* Hand the snapshot just made over to the display, taking back whichever one it had been offered */
 
 {
-    struct visitedAddr *a;
-    UT_hash_handle hh;
+    _r.snapBack = atomic_exchange( &_r.snapShared, _r.snapBack | SNAP_FRESH ) & SNAP_INDEX;
+}
+// ====================================================================================================
+static const struct topSnapshot *_snapshotTake( void )
 
-    for ( a = _r.addresses; a != NULL; a = hh.next )
+/* Get the latest snapshot, if there's been one since last time */
+
+{
+    if ( !( atomic_load( &_r.snapShared ) & SNAP_FRESH ) )
     {
-        hh = a->hh;
-        free( a );
+        return NULL;
     }
 
-    _r.addresses = NULL;
+    _r.snapFront = atomic_exchange( &_r.snapShared, _r.snapFront ) & SNAP_INDEX;
+    return &_r.snap[_r.snapFront];
 }
 // ====================================================================================================
-// Pump characters into the itm decoder
-// ====================================================================================================
-void _itmPumpProcess( uint8_t c )
+static void _outputDWT( const struct topSnapshot *s )
 
-{
-    typedef void ( *handlers )( void *decoded, struct ITMDecoder * i );
+/* The DWT counters, as rates and, when the target time is known, as a share of it. That's only */
+/* right if the timestamps are counting core cycles, which is how they're usually set up.       */
 
-    /* Handlers for each complete message received */
-    static const handlers h[MSG_NUM_MSGS] =
-    {
-        /* MSG_UNKNOWN */         NULL,
-        /* MSG_RESERVED */        NULL,
-        /* MSG_ERROR */           NULL,
-        /* MSG_NONE */            NULL,
-        /* MSG_SOFTWARE */        NULL,
-        /* MSG_NISYNC */          NULL,
-        /* MSG_OSW */             NULL,
-        /* MSG_DATA_ACCESS_WP */  NULL,
-        /* MSG_DATA_RWWP */       NULL,
-        /* MSG_PC_SAMPLE */       ( handlers )_handlePCSample,
-        /* MSG_DWT_EVENT */       NULL,
-        /* MSG_EXCEPTION */       ( handlers )_handleException,
-        /* MSG_TS */              ( handlers )_handleTS
-    };
+{
+    const char *dwtLabel[DWT_NUM] = { "Stalled", "Exception", "Sleeping", "Load/Store", "Folded", "Cycle tap" };
+    int64_t us = s->thisTime - s->lastReportus;
 
-    struct msg *p;
+    genericsPrintf( EOL " DWT counter |  Events  |   Cycles/s   | %% of ticks" EOL );
+    genericsPrintf( /**/"-------------+----------+--------------+-----------" EOL );
 
-    if ( !MSGSeqPump( &_r.d, c ) )
+    for ( enum dwtCounter d = 0; d < DWT_NUM; d++ )
     {
-        return;
-    }
+        /* The cycle tap rate depends on how it was set up, so all there is to say is how many */
+        uint64_t n = ( d == DWT_CYC ) ? s->dwt[d] : ( uint64_t )s->dwt[d] * DWT_COUNTER_WRAP;
 
-    /* We are synced timewise, so empty anything that has been waiting */
-    while ( true )
-    {
-        p = MSGSeqGetPacket( &_r.d );
+        genericsPrintf( C_DATA " %-11s" C_RESET " | " C_DATA "%8" PRIu32 C_RESET " | " C_DATA "%12" PRIu64 C_RESET " | ",
+                        dwtLabel[d], s->dwt[d], ( us > 0 ) ? ( n * 1000000 ) / us : 0 );
 
-        if ( !p )
+        if ( ( d != DWT_CYC ) && ( d != DWT_FOLD ) && ( s->haveTicks ) && ( s->ticks ) )
         {
-            /* all read */
-            break;
+            genericsPrintf( C_DATA "%8.1f%%" C_RESET EOL, n * 100.0 / s->ticks );
         }
-
-        assert( p->genericMsg.msgtype < MSG_NUM_MSGS );
-
-        if ( h[p->genericMsg.msgtype] )
+        else
         {
-            ( h[p->genericMsg.msgtype] )( p, &_r.i );
+            genericsPrintf( "        -" EOL );
         }
     }
-
-    return;
 }
 // ====================================================================================================
-// ====================================================================================================
-// Protocol pump for decoding messages
-// ====================================================================================================
-// ====================================================================================================
-void _printHelp( const char *const progName )
+static void _outputTop( const struct topSnapshot *s )
+
+/* Produce the output */
 
 {
-    genericsPrintf( "Usage: %s [options]" EOL, progName );
-    genericsPrintf( "    -c, --cut-after:    <num> Cut screen output after number of lines" EOL );
+    uint64_t dispSamples = 0;
+    uint32_t percentage;
+    uint32_t totPercent = 0;
+
+    FILE *p = NULL;
+    FILE *q = NULL;
+    uint32_t printed = 0;
+    char memLine[160];
+
+    /* This is the file retaining the current samples */
+    if ( options.outfile )
+    {
+        p = fopen( options.outfile, "w" );
+    }
+
+    /* This is the file containing the historic samples */
+    if ( options.logfile )
+    {
+        q = fopen( options.logfile, "a" );
+    }
+
+    genericsPrintf( CLEAR_SCREEN );
+
+    for ( uint32_t i = 0; i < s->lines; i++ )
+    {
+        const struct topLine *l = &s->line[i];
+        const char *function = _snapString( s, l->function );
+
+        percentage = ( l->count * 10000 ) / s->total;
+
+        if ( ( !options.cutscreen ) || ( l->rank < options.cutscreen ) )
+        {
+            dispSamples += l->count;
+            totPercent += percentage;
+
+            genericsPrintf( C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " ", percentage / 100, percentage % 100, l->count );
+
+            if ( ( options.reportFilenames ) && ( l->file != NO_NAME ) )
+            {
+                genericsPrintf( C_CONTEXT "%s" C_RESET "::", _snapString( s, l->file ) );
+            }
+
+            if ( ( options.lineDisaggregation ) && ( l->line ) )
+            {
+                genericsPrintf( C_SUPPORT2 "%s" C_RESET "::" C_CONTEXT "%d" EOL, function, l->line );
+            }
+            else
+            {
+                genericsPrintf( C_SUPPORT2 "%s" C_RESET EOL, function );
+            }
+
+            printed++;
+        }
+
+        /* Write to current and historical data files if appropriate */
+        if ( !options.lineDisaggregation )
+        {
+            if ( ( p ) && ( l->rank < options.maxRoutines ) )
+            {
+                fprintf( p, "%s,%3d.%02d" EOL, function, percentage / 100, percentage % 100 );
+            }
+
+            if ( q )
+            {
+                fprintf( q, "%s,%3d.%02d" EOL, function, percentage / 100, percentage % 100 );
+            }
+        }
+        else
+        {
+            if ( ( p ) && ( l->rank < options.maxRoutines ) )
+            {
+                fprintf( p, "%s::%d,%3d.%02d" EOL, function, l->line, percentage / 100, percentage % 100 );
+            }
+
+            if ( q )
+            {
+                fprintf( q, "%s::%d,%3d.%02d" EOL, function, l->line, percentage / 100, percentage % 100 );
+            }
+        }
+    }
+
+    genericsPrintf( C_RESET "-----------------" EOL );
+
+    genericsPrintf( C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " " C_RESET "of "C_DATA" %" PRIu64 " "C_RESET" Samples" EOL, totPercent / 100, totPercent % 100, dispSamples, s->samples );
+
+    if ( p )
+    {
+        fclose( p );
+    }
+
+    if ( q )
+    {
+        fprintf( q, "===================================" EOL );
+        fclose( q );
+    }
+
+
+    if ( options.taskChannel >= 0 )
+    {
+        uint64_t taskSamples = 0;
+
+        for ( uint32_t t = 0; t < s->tasks; t++ )
+        {
+            taskSamples += s->task[t].samples;
+        }
+
+        genericsPrintf( EOL " Task        |  Samples |    %%   |    Ticks    |    %%   | Switches" EOL );
+        genericsPrintf( /**/"-------------+----------+--------+-------------+--------+---------" EOL );
+
+        for ( uint32_t t = 0; t < s->tasks; t++ )
+        {
+            const struct taskLine *l = &s->task[t];
+
+            genericsPrintf( C_DATA " 0x%08" PRIx32 C_RESET "  | " C_DATA "%8" PRIu64 C_RESET " | " C_DATA "%5.1f%%" C_RESET " | " C_DATA "%11" PRId64
+                            C_RESET " | " C_DATA "%5.1f%%" C_RESET " | " C_DATA "%8" PRIu64 C_RESET EOL,
+                            l->id, l->samples, ( taskSamples ) ? l->samples * 100.0 / taskSamples : 0.0,
+                            l->ticks, ( s->ticks ) ? l->ticks * 100.0 / s->ticks : 0.0, l->switches );
+        }
+    }
+
+    if ( s->dwtSeen )
+    {
+        _outputDWT( s );
+    }
+
+    if ( options.outputExceptions )
+    {
+        /* Tidy up screen output */
+        while ( printed++ <= options.cutscreen )
+        {
+            genericsPrintf( EOL );
+        }
+
+        genericsPrintf( EOL " Exception         |   Count  |  MaxD | TotalTicks  |   %%   |  AveTicks  |  minTicks  |  maxTicks  |  maxWall " EOL );
+        genericsPrintf( /**/"-------------------+----------+-------+-------------+-------+------------+------------+------------+----------" EOL );
+
+        for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+        {
+
+            if ( s->er[e].visits )
+            {
+                char exceptionName[30];
+
+                _exceptionName( e, exceptionName, sizeof( exceptionName ) );
+                const float util_percent = ( float )s->er[e].totalTime / s->ticks * 100.0f;
+                genericsPrintf( C_DATA "%3" PRId32 " %-14s" C_RESET " | " C_DATA "%8" PRIu64 C_RESET " |" C_DATA " %5"
+                                PRIu32 C_RESET " | "C_DATA " %9" PRIu64 C_RESET "  |" C_DATA "%6.1f" C_RESET " |  " C_DATA "%9" PRIu64 C_RESET " | " C_DATA "%9" PRIu64 C_RESET "  | " C_DATA" %9" PRIu64 C_RESET " | " C_DATA "%9"
+                                PRIu64 C_RESET EOL,
+                                e, exceptionName, s->er[e].visits, s->er[e].maxDepth, s->er[e].totalTime, util_percent, s->er[e].totalTime / s->er[e].visits, s->er[e].minTime, s->er[e].maxTime, s->er[e].maxWallTime );
+            }
+        }
+
+        /* ...and how they were spread */
+        genericsPrintf( EOL " Exception         |  Ticks p50   p99  p99.9  |  Between p50   p99  p99.9  | Depth p50 p99 p99.9" EOL );
+        genericsPrintf( /**/"-------------------+--------------------------+----------------------------+--------------------" EOL );
+
+        for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+        {
+            if ( s->er[e].visits )
+            {
+                const struct latencyStats *d = s->er[e].dist;
+                char exceptionName[30];
+
+                _exceptionName( e, exceptionName, sizeof( exceptionName ) );
+                genericsPrintf( C_DATA "%3" PRId32 " %-14s" C_RESET " | " C_DATA "%7" PRIu64 " %6" PRIu64 " %6" PRIu64 C_RESET "  | "
+                                C_DATA "%9" PRIu64 " %6" PRIu64 " %6" PRIu64 C_RESET "  | " C_DATA "%7" PRIu64 " %3" PRIu64 " %5" PRIu64 C_RESET EOL,
+                                e, exceptionName,
+                                d[EXD_DURATION].p50, d[EXD_DURATION].p99, d[EXD_DURATION].p999,
+                                d[EXD_INTERVAL].p50, d[EXD_INTERVAL].p99, d[EXD_INTERVAL].p999,
+                                d[EXD_DEPTH].p50, d[EXD_DEPTH].p99, d[EXD_DEPTH].p999 );
+            }
+        }
+    }
+
+    genericsPrintf( EOL C_RESET "[%s%s%s%s" C_RESET "] ",
+                    ( s->ovf ) ? C_OVF_IND "V" : C_RESET "-",
+                    ( s->sw ) ? C_SOFT_IND "S" : C_RESET "-",
+                    ( s->ts ) ? C_TSTAMP_IND "T" : C_RESET "-",
+                    ( s->hw ) ? C_HW_IND "H" : C_RESET "-" );
+
+    if ( ( s->haveTicks ) && ( s->thisTime != s->lastReportus ) )
+        genericsPrintf( "Interval = " C_DATA "%" PRIu64 "ms " C_RESET "/ "C_DATA "%" PRIu64 C_RESET " (~" C_DATA "%" PRIu64 C_RESET " Ticks/ms)" EOL,
+                        ( ( s->thisTime - s->lastReportus ) ) / 1000, s->ticks, ( s->ticks * 1000 ) / ( s->thisTime - s->lastReportus ) );
+    else
+    {
+        genericsPrintf( C_RESET "Interval = " C_DATA "%" PRIu64 C_RESET "ms" EOL, ( ( s->thisTime - s->lastReportus ) ) / 1000 );
+    }
+
+    genericsReport( V_INFO, "         Ovf=%3d  ITMSync=%3d ITMErrors=%3d" EOL, s->overflow, s->syncCount, s->errorPkt );
+
+    if ( options.topK )
+    {
+        genericsReport( V_INFO, "         Top %" PRIu32 ": %" PRIu32 " addresses, counts at most %" PRIu64 " high" EOL, options.topK, s->hitters, s->hitterBound );
+    }
+
+    if ( memReport( memLine, sizeof( memLine ) ) )
+    {
+        genericsReport( V_INFO, "         Mem: %s" EOL, memLine );
+    }
+}
+
+// ====================================================================================================
+static struct reportSlot *_slotFor( uint32_t pc )
+
+/* Find the report line an address is counted against, making it if it's the first there's been */
+
+{
+    struct nameEntry n;
+    struct reportKey k;
+    struct reportSlot *slot;
+
+    /* Find a matching name record if there is one */
+    SymbolLookup( _r.s, pc, &n );
+
+    memset( &k, 0, sizeof( k ) );
+    k.fileindex     = options.reportFilenames ? n.fileindex : 0;
+    k.functionindex = n.functionindex;
+    k.line          = options.lineDisaggregation ? n.line : 0;
+
+    HASH_FIND( hh, _r.slots, &k, sizeof( struct reportKey ), slot );
+
+    if ( !slot )
+    {
+        /* This is a new report line - record it */
+        slot = ( struct reportSlot * )memCalloc( MEM_ADDRESSES, 1, sizeof( struct reportSlot ) + options.windowBuckets * sizeof( uint32_t ) );
+        MEMCHECK( slot, NULL );
+        slot->k = k;
+        slot->id = ++_r.slotCount;
+        memcpy( &slot->n, &n, sizeof( struct nameEntry ) );
+        HASH_ADD( hh, _r.slots, k, sizeof( struct reportKey ), slot );
+
+        if ( _r.binfile )
+        {
+            _outputBinaryDict( slot->id, &slot->n );
+        }
+    }
+
+    return slot;
+}
+// ====================================================================================================
+static struct visitedAddr *_newAddr( uint32_t pc )
+
+/* Resolve a newly seen address to the report line it will be counted against */
+
+{
+    struct visitedAddr *a = ( struct visitedAddr * )memCalloc( MEM_ADDRESSES, 1, sizeof( struct visitedAddr ) );
+    MEMCHECK( a, NULL );
+    a->pc = pc;
+    a->slot = _slotFor( pc );
+    HASH_ADD_INT( _r.addresses, pc, a );
+    return a;
+}
+// ====================================================================================================
+// ====================================================================================================
+// Heavy hitters, for counting in fixed memory however many addresses there are
+// ====================================================================================================
+// ====================================================================================================
+static void _hitterSwap( uint32_t i, uint32_t j )
+
+{
+    struct hitter *t = _r.hitterHeap[i];
+
+    _r.hitterHeap[i] = _r.hitterHeap[j];
+    _r.hitterHeap[j] = t;
+    _r.hitterHeap[i]->heapIdx = i;
+    _r.hitterHeap[j]->heapIdx = j;
+}
+// ====================================================================================================
+static void _hitterDown( uint32_t i )
+
+/* An entry's count has gone up, so move it away from the top until it's no more than those under it */
+
+{
+    while ( true )
+    {
+        uint32_t least = i;
+        uint32_t l = 2 * i + 1;
+
+        if ( ( l < _r.hitterCount ) && ( _r.hitterHeap[l]->count < _r.hitterHeap[least]->count ) )
+        {
+            least = l;
+        }
+
+        if ( ( l + 1 < _r.hitterCount ) && ( _r.hitterHeap[l + 1]->count < _r.hitterHeap[least]->count ) )
+        {
+            least = l + 1;
+        }
+
+        if ( least == i )
+        {
+            return;
+        }
+
+        _hitterSwap( i, least );
+        i = least;
+    }
+}
+// ====================================================================================================
+static void _hitterUp( uint32_t i )
+
+/* A new entry, at the bottom, goes up past any that are counted more than it */
+
+{
+    while ( ( i ) && ( _r.hitterHeap[( i - 1 ) / 2]->count > _r.hitterHeap[i]->count ) )
+    {
+        _hitterSwap( i, ( i - 1 ) / 2 );
+        i = ( i - 1 ) / 2;
+    }
+}
+// ====================================================================================================
+static void _hitterAdd( uint32_t pc, uint64_t n )
+
+/* Count n samples at pc with the Space-Saving algorithm. Up to topK addresses are counted as they   */
+/* are; after that a new one takes the place of the least counted, inheriting its count as the error */
+/* on its own. So no count is too low, none is more than its err too high, and any address that was */
+/* busier than the least counted one is in the table.                                               */
+
+{
+    struct hitter *h;
+
+    HASH_FIND_INT( _r.hitterIndex, &pc, h );
+
+    if ( h )
+    {
+        h->count += n;
+        _hitterDown( h->heapIdx );
+        return;
+    }
+
+    if ( _r.hitterCount < options.topK )
+    {
+        h = &_r.hitters[_r.hitterCount];
+        h->pc = pc;
+        h->count = n;
+        h->err = 0;
+        h->heapIdx = _r.hitterCount;
+        _r.hitterHeap[_r.hitterCount++] = h;
+        HASH_ADD_INT( _r.hitterIndex, pc, h );
+        _hitterUp( h->heapIdx );
+        return;
+    }
+
+    h = _r.hitterHeap[0];
+    HASH_DEL( _r.hitterIndex, h );
+    h->pc = pc;
+    h->err = h->count;
+    h->count += n;
+    HASH_ADD_INT( _r.hitterIndex, pc, h );
+    _hitterDown( 0 );
+}
+// ====================================================================================================
+static void _hitterFlush( void )
+
+/* Count the interval's heavy hitters against their report lines. This is the only place their */
+/* addresses are looked up, so it's once for each of them in each interval, and then they go.  */
+
+{
+    _r.hitterReported = _r.hitterCount;
+    _r.hitterBound = ( _r.hitterCount == options.topK ) ? _r.hitterHeap[0]->count : 0;
+
+    for ( uint32_t i = 0; i < _r.hitterCount; i++ )
+    {
+        _slotFor( _r.hitters[i].pc )->visits += _r.hitters[i].count;
+    }
+
+    HASH_CLEAR( hh, _r.hitterIndex );
+    _r.hitterCount = 0;
+}
+// ====================================================================================================
+static void _countPC( uint32_t pc, uint32_t n )
+
+/* Count n samples at pc, whether they came one at a time or already added up by the server */
+
+{
+    struct visitedAddr *a;
+
+    if ( _r.reloading )
+    {
+        /* These can't be attributed until the new symbols are in, so just count them by address for now */
+        struct pendingAddr *p;
+
+        HASH_FIND_INT( _r.pending, &pc, p );
+
+        if ( !p )
+        {
+            p = ( struct pendingAddr * )memCalloc( MEM_ADDRESSES, 1, sizeof( struct pendingAddr ) );
+            MEMCHECKV( p );
+            p->pc = pc;
+            HASH_ADD_INT( _r.pending, pc, p );
+        }
+
+        p->count += n;
+    }
+    else if ( options.topK )
+    {
+        /* Only counted by address for now, they're looked up when they're reported */
+        _hitterAdd( pc, n );
+    }
+    else
+    {
+        HASH_FIND_INT( _r.addresses, &pc, a );
+
+        if ( !a )
+        {
+            /* First time we've seen this address, so work out where it's counted */
+            a = _newAddr( pc );
+        }
+
+        a->slot->visits += n;
+    }
+}
+// ====================================================================================================
+void _handlePCSample( struct pcSampleMsg *m, struct ITMDecoder *i )
+
+{
+    assert( m->msgtype == MSG_PC_SAMPLE );
+
+    /* With exact counts there's no need for samples, and they'd only be counting something different */
+    if ( options.exactTag )
+    {
+        return;
+    }
+
+    if ( _r.task )
+    {
+        _r.task->samples++;
+    }
+
+    if ( m->sleep )
+    {
+        /* This is a sleep packet */
+        _r.sleeps++;
+    }
+    else
+    {
+        _countPC( m->pc, 1 );
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// Exact mode, execution counted from the trace
+// ====================================================================================================
+// ====================================================================================================
+static void _exactRun( uint32_t from, uint32_t to )
+
+/* Instructions from..to (inclusive) each ran once more. Only the ends are recorded, so a run costs the */
+/* same however long it is; the counts for each instruction come from adding them up at the report.   */
+
+{
+    if ( !_r.runEdge )
+    {
+        _r.runEdge = ( int64_t * )memCalloc( MEM_ADDRESSES, _r.s->insnCount + 1, sizeof( int64_t ) );
+        MEMCHECKV( _r.runEdge );
+        _r.branchTo = ( uint32_t * )memCalloc( MEM_ADDRESSES, _r.s->insnCount, sizeof( uint32_t ) );
+        MEMCHECKV( _r.branchTo );
+    }
+
+    _r.runEdge[from]++;
+    _r.runEdge[to + 1]--;
+}
+// ====================================================================================================
+static uint32_t _exactAfter( uint32_t i, bool executed )
+
+/* Where the flow goes after instruction i, or NO_INSN if it's a branch whose destination has to come from the trace */
+
+{
+    const struct assyLineEntry *a = _r.s->insns[i].assy;
+
+    if ( ( executed ) && ( ( a->isJump ) || ( a->isSubCall ) ) )
+    {
+        if ( ( a->isReturn ) || ( a->jumpdest == NO_DESTADDRESS ) )
+        {
+            return NO_INSN;
+        }
+
+        if ( !_r.branchTo[i] )
+        {
+            _r.branchTo[i] = SymbolInsnIndex( _r.s, a->jumpdest ) + 1;
+        }
+
+        return _r.branchTo[i] - 1;
+    }
+
+    if ( ( i + 1 < _r.s->insnCount ) && ( _r.s->insns[i + 1].assy->addr == a->addr + ( ( a->is4Byte ) ? 4 : 2 ) ) )
+    {
+        return i + 1;
+    }
+
+    return SymbolInsnIndex( _r.s, a->addr + ( ( a->is4Byte ) ? 4 : 2 ) );
+}
+// ====================================================================================================
+static uint32_t _exactAtoms( uint32_t n, uint32_t disposition )
+
+/* Account for n atoms, returning the disposition left over. For ETM4 an atom is a whole basic block; */
+/* otherwise it's one instruction, but only the last in each block can change the flow, so a block is */
+/* still taken at a time and the atoms for the instructions before its end are just stepped over.     */
+
+{
+    bool etm4 = ( options.exactProtocol == TRACE_PROT_ETM4 );
+    uint32_t i = _r.exactInsn;
+    uint32_t end, len;
+
+    while ( ( n ) && ( i != NO_INSN ) )
+    {
+        end = _r.s->insns[i].blockEnd;
+        len = ( etm4 ) ? 1 : end - i + 1;
+
+        if ( n < len )
+        {
+            _exactRun( i, i + n - 1 );
+            disposition >>= n;
+            i += n;
+            break;
+        }
+
+        _exactRun( i, end );
+        disposition >>= len - 1;
+        i = _exactAfter( end, disposition & 1 );
+        disposition >>= 1;
+        n -= len;
+    }
+
+    _r.exactInsn = i;
+    return disposition;
+}
+// ====================================================================================================
+static void _exactAddress( uint32_t addr )
+
+{
+    if ( NO_INSN == ( _r.exactInsn = SymbolInsnIndex( _r.s, addr ) ) )
+    {
+        genericsReportRateLimited( V_INFO, "No assembly for address %08x" EOL, addr );
+    }
+}
+// ====================================================================================================
+static void _exactEvent( const struct TRACEEvent *ev )
+
+/* Follow the flow through one event from the trace decoder. As in orbprofile, the last atom of each */
+/* batch is held until the next, since an address that comes between them is where it went to.      */
+
+{
+    uint32_t n, d;
+
+    _r.tChanges |= ev->changes;
+
+    /* MTB gives us the runs already */
+    if ( _r.tChanges & ( 1 << EV_CH_LINEAR ) )
+    {
+        uint32_t from = SymbolInsnIndex( _r.s, ev->addr );
+        uint32_t to = SymbolInsnIndex( _r.s, ev->toAddr );
+
+        if ( ( from != NO_INSN ) && ( to != NO_INSN ) && ( to >= from ) )
+        {
+            _exactRun( from, to );
+        }
+
+        _r.tChanges = 0;
+        return;
+    }
+
+    if ( !( _r.tChanges & ( 1 << EV_CH_ENATOMS ) ) )
+    {
+        /* Until there's an address nothing can be followed, so take the first one that turns up */
+        if ( ( _r.exactInsn == NO_INSN ) && ( _r.tChanges & ( 1 << EV_CH_ADDRESS ) ) )
+        {
+            _exactAddress( ev->addr );
+            _r.atomPending = false;
+            _r.tChanges = 0;
+        }
+
+        _r.tChanges &= ( 1 << EV_CH_ADDRESS ) | ( 1 << EV_CH_CANCELLED );
+        return;
+    }
+
+    if ( ( _r.atomPending ) && ( !( _r.tChanges & ( 1 << EV_CH_CANCELLED ) ) ) )
+    {
+        _exactAtoms( 1, _r.atomPendingE );
+    }
+
+    if ( _r.tChanges & ( 1 << EV_CH_ADDRESS ) )
+    {
+        _exactAddress( ev->addr );
+    }
+
+    _r.tChanges = 0;
+
+    n = ev->eatoms + ev->natoms;
+    d = ( n > 1 ) ? _exactAtoms( n - 1, ev->disposition ) : ev->disposition;
+    _r.atomPending = ( n != 0 );
+    _r.atomPendingE = d & 1;
+}
+// ====================================================================================================
+static void _exactPump( const uint8_t *buf, int len )
+
+{
+    struct TRACEEvent ev[EXACT_EVENT_BATCH];
+    int consumed;
+    int n;
+
+    while ( len > 0 )
+    {
+        n = TRACEDecoderPumpEvents( &_r.t, buf, len, ev, EXACT_EVENT_BATCH, &consumed );
+
+        for ( int e = 0; e < n; e++ )
+        {
+            _exactEvent( &ev[e] );
+        }
+
+        if ( !consumed )
+        {
+            break;
+        }
+
+        buf += consumed;
+        len -= consumed;
+    }
+}
+// ====================================================================================================
+static void _exactFlush( void )
+
+/* Add up the runs into counts for each instruction, and count those as if they were samples */
+
+{
+    int64_t count = 0;
+
+    if ( !_r.runEdge )
+    {
+        return;
+    }
+
+    for ( uint32_t i = 0; i < _r.s->insnCount; i++ )
+    {
+        count += _r.runEdge[i];
+        _r.runEdge[i] = 0;
+
+        if ( count > 0 )
+        {
+            _countPC( _r.s->insns[i].assy->addr, count );
+        }
+    }
+
+    _r.runEdge[_r.s->insnCount] = 0;
+}
+// ====================================================================================================
+static void _exactReset( void )
+
+/* The symbols are changing, so nothing indexed by instruction is any use any more */
+
+{
+    memFree( MEM_ADDRESSES, _r.runEdge );
+    memFree( MEM_ADDRESSES, _r.branchTo );
+    _r.runEdge = NULL;
+    _r.branchTo = NULL;
+    _r.exactInsn = NO_INSN;
+    _r.atomPending = false;
+    _r.tChanges = 0;
+}
+// ====================================================================================================
+static void _attributePending( void )
+
+/* Count the samples held during a reload against the lines the new symbols give them */
+
+{
+    struct pendingAddr *p, *pt;
+    struct visitedAddr *a;
+
+    HASH_ITER( hh, _r.pending, p, pt )
+    {
+        if ( options.topK )
+        {
+            _hitterAdd( p->pc, p->count );
+        }
+        else
+        {
+            HASH_FIND_INT( _r.addresses, &p->pc, a );
+
+            if ( !a )
+            {
+                a = _newAddr( p->pc );
+            }
+
+            a->slot->visits += p->count;
+        }
+
+        HASH_DEL( _r.pending, p );
+        memFree( MEM_ADDRESSES, p );
+    }
+}
+// ====================================================================================================
+void _flushHash( void )
+
+/* Forget all addresses and report lines, needed when the symbols change */
+
+{
+    struct visitedAddr *a, *at;
+    struct reportSlot *s, *st;
+
+    HASH_ITER( hh, _r.addresses, a, at )
+    {
+        HASH_DEL( _r.addresses, a );
+        memFree( MEM_ADDRESSES, a );
+    }
+
+    HASH_ITER( hh, _r.slots, s, st )
+    {
+        HASH_DEL( _r.slots, s );
+        memFree( MEM_ADDRESSES, s );
+    }
+
+    _r.addresses = NULL;
+    _r.slots = NULL;
+    _r.slotCount = 0;
+
+    if ( _r.binfile )
+    {
+        _outputBinaryReset();
+    }
+
+    /* The sleeps are counted against a slot that's always there, so reset it by hand */
+    if ( _r.sleepBucket )
+    {
+        memset( _r.sleepBucket, 0, options.windowBuckets * sizeof( uint32_t ) );
+    }
+
+    _r.sleepWindowSum = 0;
+    _r.sleepDecayed = 0;
+}
+// ====================================================================================================
+// Pump characters into the itm decoder
+// ====================================================================================================
+void _itmPumpProcess( uint8_t c )
+
+{
+    typedef void ( *handlers )( void *decoded, struct ITMDecoder * i );
+
+    /* Handlers for each complete message received */
+    static const handlers h[MSG_NUM_MSGS] =
+    {
+        /* MSG_UNKNOWN */         NULL,
+        /* MSG_RESERVED */        NULL,
+        /* MSG_ERROR */           NULL,
+        /* MSG_NONE */            NULL,
+        /* MSG_SOFTWARE */        ( handlers )_handleSoftware,
+        /* MSG_NISYNC */          NULL,
+        /* MSG_OSW */             NULL,
+        /* MSG_DATA_ACCESS_WP */  NULL,
+        /* MSG_DATA_RWWP */       NULL,
+        /* MSG_PC_SAMPLE */       ( handlers )_handlePCSample,
+        /* MSG_DWT_EVENT */       ( handlers )_handleDWTEvent,
+        /* MSG_EXCEPTION */       ( handlers )_handleException,
+        /* MSG_TS */              ( handlers )_handleTS
+    };
+
+    struct msg *p;
+
+    if ( !MSGSeqPump( &_r.d, c ) )
+    {
+        return;
+    }
+
+    /* We are synced timewise, so empty anything that has been waiting */
+    while ( true )
+    {
+        p = MSGSeqGetPacket( &_r.d );
+
+        if ( !p )
+        {
+            /* all read */
+            break;
+        }
+
+        assert( p->genericMsg.msgtype < MSG_NUM_MSGS );
+
+        if ( h[p->genericMsg.msgtype] )
+        {
+            ( h[p->genericMsg.msgtype] )( p, &_r.i );
+        }
+    }
+
+    return;
+}
+// ====================================================================================================
+static void _msgRxed( struct msg *m, void *param )
+
+/* A message the server decoded for us, and it only sends what we subscribed to */
+
+{
+    switch ( m->genericMsg.msgtype )
+    {
+        case MSG_EXCEPTION:
+            _handleException( &m->excMsg, &_r.i );
+            break;
+
+        case MSG_TS:
+            _handleTS( ( struct TSMsg * )m, &_r.i );
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+static void _histRxed( const struct msgStreamHist *h, void *param )
+
+/* Some of the PC sample counts for an interval, as added up by the server */
+
+{
+    if ( ( _r.histSeen ) && ( h->seq != _r.histSeq ) && ( h->seq != ( uint16_t )( _r.histSeq + 1 ) ) )
+    {
+        genericsReportRateLimited( V_WARN, "Missed %d PC sample histograms" EOL, ( uint16_t )( h->seq - _r.histSeq - 1 ) );
+    }
+
+    _r.histSeen = true;
+    _r.histSeq = h->seq;
+    _r.sleeps += h->sleeps;
+
+    for ( uint32_t i = 0; i < h->n; i++ )
+    {
+        _countPC( h->e[i].pc, h->e[i].count );
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// Protocol pump for decoding messages
+// ====================================================================================================
+// ====================================================================================================
+static bool _historyTime( const char *c, char **e, int64_t *t )
+
+/* A time is in unix seconds, or if it's zero or less, that many back from now. It can be in s, m, h or d. */
+
+{
+    *t = strtoll( c, e, 10 );
+
+    if ( *e == c )
+    {
+        return false;
+    }
+
+    switch ( **e )
+    {
+        case 'd':
+            *t *= 24;
+        // fall through
+
+        case 'h':
+            *t *= 60;
+        // fall through
+
+        case 'm':
+            *t *= 60;
+        // fall through
+
+        case 's':
+            ( *e )++;
+            break;
+
+        default:
+            break;
+    }
+
+    if ( *t <= 0 )
+    {
+        *t += time( NULL );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _historySpec( const char *spec )
+
+/* <from>[,<to>][,s|m|h] */
+
+{
+    char *e;
+
+    options.historyTo = time( NULL );
+    options.historyLevel = TS_AUTO;
+
+    if ( !_historyTime( spec, &e, &options.historyFrom ) )
+    {
+        return false;
+    }
+
+    if ( ( *e == ',' ) && ( ( isdigit( ( unsigned char )e[1] ) ) || ( e[1] == '-' ) ) && ( !_historyTime( e + 1, &e, &options.historyTo ) ) )
+    {
+        return false;
+    }
+
+    if ( *e == ',' )
+    {
+        switch ( *++e )
+        {
+            case 's':
+                options.historyLevel = TS_SECONDS;
+                break;
+
+            case 'm':
+                options.historyLevel = TS_MINUTES;
+                break;
+
+            case 'h':
+                options.historyLevel = TS_HOURS;
+                break;
+
+            default:
+                return false;
+        }
+
+        e++;
+    }
+
+    return ( !*e ) && ( options.historyFrom < options.historyTo );
+}
+// ====================================================================================================
+void _printHelp( const char *const progName )
+
+{
+    genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "    -b, --binary-file:  <filename> Output to file in binary format (or screen if <filename> is '-')" EOL );
+    genericsPrintf( "    -c, --cut-after:    <num> Cut screen output after number of lines" EOL );
     genericsPrintf( "    -D, --no-demangle:  Switch off C++ symbol demangling" EOL );
     genericsPrintf( "    -d, --del-prefix:   <DeleteMaterial> to take off front of filenames" EOL );
     genericsPrintf( "    -e, --elf-file:     <ElfFile> to use for symbols" EOL );
@@ -890,20 +2386,33 @@ void _printHelp( const char *const progName )
     genericsPrintf( "    -f, --input-file:   <filename> Take input from specified file" EOL );
     genericsPrintf( "    -g, --record-file:  <LogFile> append historic records to specified file" EOL );
     genericsPrintf( "    -h, --help:         This help" EOL );
+    genericsPrintf( "    -H, --shm-input:    [name] Take ORBFLOW from a local orbuculum via shared memory (defaults to %s)" EOL, ORBUCULUM_SHM_NAME );
     genericsPrintf( "    -I, --interval:     <interval> Display interval in milliseconds (defaults to %dms)" EOL, TOP_UPDATE_INTERVAL );
     genericsPrintf( "    -j, --json-file:    <filename> Output to file in JSON format (or screen if <filename> is '-')" EOL );
+    genericsPrintf( "    -k, --top-k:        <K> Only count the busiest K addresses in each interval, in fixed memory" EOL );
     genericsPrintf( "    -l, --agg-lines:    Aggregate per line rather than per function" EOL );
+    genericsPrintf( "    -L, --history:      <dir> Keep counts per function in a time series store in this directory" EOL );
     genericsPrintf( "    -M, --no-colour:    Supress colour in output" EOL );
     genericsPrintf( "    -n, --itm-sync:     Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     genericsPrintf( "    -o, --output-file:  <filename> to be used for output live file" EOL );
     genericsPrintf( "    -O, --objdump-opts: <options> Options to pass directly to objdump" EOL );
-    genericsPrintf( "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -p, --protocol:     Protocol to communicate (OFLOW, ITM or MSG). Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -P, --parallel:     <threads> Decode the whole input file across this many threads, report once and exit" EOL );
+    genericsPrintf( "    -q, --history-query:<from>[,<to>][,s|m|h] Print what the store (-L) has for a time window as CSV, and exit" EOL );
+    genericsPrintf( "    -Q, --mem-limit:    <subsystem>=<size>[,...] Most memory for each of symbols, addresses, calls, hash, lines or sequencer (e.g. addresses=2G)" EOL );
     genericsPrintf( "    -r, --routines:     <routines> to record in live file (default %d routines)" EOL, options.maxRoutines );
     genericsPrintf( "    -R, --report-files: Report filenames as part of function discriminator" EOL );
     genericsPrintf( "    -s, --server:       <Server>:<Port> to use" EOL );
+    genericsPrintf( "    -S, --start:        <seconds> Start this far into an indexed capture file" EOL );
     genericsPrintf( "    -t, --tag:          <stream> Which OFLOW tag to use (normally 1)" EOL );
+    genericsPrintf( "    -T, --tasks:        <channel> Attribute samples and time to RTOS tasks, from the task ids written to this ITM channel on each switch" EOL );
     genericsPrintf( "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:      Print version and exit" EOL );
+    genericsPrintf( "    -x, --exact:        <tag>[,ETM35|ETM4|MTB] Count execution exactly from the trace on this OFLOW tag, rather than from PC samples" EOL );
+    genericsPrintf( "    -w, --window:       <window> Report over sliding window of this many milliseconds" EOL );
+    genericsPrintf( "    -X, --timeline:     <filename>[,MHz] Write exceptions to a Perfetto timeline, with target time going at MHz" EOL );
+    genericsPrintf( "    -y, --decay:        <time> Report exponentially decayed counts with this time constant in milliseconds" EOL );
+    genericsPrintf( "    -z, --compress:     Ask the server to compress what it sends" EOL );
     genericsPrintf( EOL "Environment Variables;" EOL );
     genericsPrintf( "  OBJDUMP: to use non-standard obbdump binary" EOL );
 }
@@ -916,6 +2425,7 @@ void _printVersion( void )
 // ====================================================================================================
 static struct option _longOptions[] =
 {
+    {"binary-file", required_argument, NULL, 'b'},
     {"cut-after", required_argument, NULL, 'c'},
     {"no-demangle", required_argument, NULL, 'D'},
     {"del-prefix", required_argument, NULL, 'd'},
@@ -924,21 +2434,34 @@ static struct option _longOptions[] =
     {"input-file", required_argument, NULL, 'f'},
     {"record-file", required_argument, NULL, 'g'},
     {"help", no_argument, NULL, 'h'},
+    {"shm-input", optional_argument, NULL, 'H'},
     {"interval", required_argument, NULL, 'I'},
     {"json-file", required_argument, NULL, 'j'},
+    {"top-k", required_argument, NULL, 'k'},
     {"agg-lines", no_argument, NULL, 'l'},
+    {"history", required_argument, NULL, 'L'},
     {"itm-sync", no_argument, NULL, 'n'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
     {"output-file", required_argument, NULL, 'o'},
     {"objdump-opts", required_argument, NULL, 'O'},
     {"protocol", required_argument, NULL, 'p'},
+    {"parallel", required_argument, NULL, 'P'},
+    {"history-query", required_argument, NULL, 'q'},
+    {"mem-limit", required_argument, NULL, 'Q'},
     {"routines", required_argument, NULL, 'r'},
     {"report-files", no_argument, NULL, 'R'},
     {"server", required_argument, NULL, 's'},
+    {"start", required_argument, NULL, 'S'},
     {"tag", required_argument, NULL, 't'},
+    {"tasks", required_argument, NULL, 'T'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
+    {"window", required_argument, NULL, 'w'},
+    {"exact", required_argument, NULL, 'x'},
+    {"timeline", required_argument, NULL, 'X'},
+    {"decay", required_argument, NULL, 'y'},
+    {"compress", no_argument, NULL, 'z'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
@@ -948,10 +2471,16 @@ bool _processOptions( int argc, char *argv[] )
     int c, optionIndex = 0;
     bool protExplicit = false;
     bool serverExplicit = false;
+    bool portExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "c:d:DEe:f:g:hVI:j:lMnO:o:p:r:Rs:t:v:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "b:c:d:DEe:f:g:hH::VI:j:k:lL:MnO:o:p:P:q:Q:r:Rs:S:t:T:v:w:x:X:y:z", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
+            // ------------------------------------
+            case 'b':
+                options.binary = optarg;
+                break;
+
             // ------------------------------------
             case 'c':
                 options.cutscreen = atoi( optarg );
@@ -992,6 +2521,11 @@ bool _processOptions( int argc, char *argv[] )
                 options.displayInterval = ( int64_t ) ( atof( optarg ) ) * 1000;
                 break;
 
+            // ------------------------------------
+            case 'k':
+                options.topK = strtoul( optarg, NULL, 0 );
+                break;
+
             // ------------------------------------
             case 'j':
                 options.json = optarg;
@@ -1002,6 +2536,22 @@ bool _processOptions( int argc, char *argv[] )
                 options.lineDisaggregation = true;
                 break;
 
+            // ------------------------------------
+            case 'L':
+                options.history = optarg;
+                break;
+
+            // ------------------------------------
+            case 'q':
+                if ( !_historySpec( optarg ) )
+                {
+                    genericsReport( V_ERROR, "History query should be <from>[,<to>][,s|m|h], not %s" EOL, optarg );
+                    return -EINVAL;
+                }
+
+                options.historyQuery = true;
+                break;
+
             // ------------------------------------
             case 'r':
                 options.maxRoutines = atoi( optarg );
@@ -1047,6 +2597,18 @@ bool _processOptions( int argc, char *argv[] )
 
                 break;
 
+            // ------------------------------------
+            case 'P':
+                options.parallel = atoi( optarg );
+
+                if ( ( options.parallel <= 0 ) || ( options.parallel > PARALLEL_MAX_THREADS ) )
+                {
+                    genericsReport( V_ERROR, "Number of threads out of range (1..%d)" EOL, PARALLEL_MAX_THREADS );
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
 
             case 'O':
@@ -1069,6 +2631,57 @@ bool _processOptions( int argc, char *argv[] )
                 options.tag = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'x':
+            {
+                char *e;
+
+                options.exactTag = strtol( optarg, &e, 0 );
+
+                if ( *e == ',' )
+                {
+                    /* Index through protocol strings looking for match or end of list */
+                    for ( options.exactProtocol = TRACE_PROT_LIST_START;
+                            ( ( options.exactProtocol != TRACE_PROT_LIST_END ) && strcasecmp( e + 1, TRACEDecodeGetProtocolName( options.exactProtocol ) ) );
+                            options.exactProtocol++ )
+                    {}
+                }
+                else if ( *e )
+                {
+                    options.exactProtocol = TRACE_PROT_LIST_END;
+                }
+
+                if ( ( options.exactTag <= 0 ) || ( options.exactTag >= OFLOW_TIME_TAG ) || ( options.exactProtocol == TRACE_PROT_LIST_END ) )
+                {
+                    genericsReport( V_ERROR, "Exact mode is <tag>[,ETM35|ETM4|MTB]" EOL );
+                    return false;
+                }
+
+                break;
+            }
+
+            // ------------------------------------
+            case 'T':
+                options.taskChannel = atoi( optarg );
+
+                if ( ( options.taskChannel < 0 ) || ( options.taskChannel > 31 ) )
+                {
+                    genericsReport( V_ERROR, "Task channel should be 0..31" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'Q':
+                if ( !memSetLimits( optarg ) )
+                {
+                    genericsReport( V_ERROR, "Memory limits are <subsystem>=<size>[K|M|G][,...]" EOL );
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
             case 'R':
                 options.reportFilenames = true;
@@ -1091,6 +2704,7 @@ bool _processOptions( int argc, char *argv[] )
                 {
                     *a = 0;
                     options.port = atoi( ++a );
+                    portExplicit = true;
                 }
 
                 if ( !options.port )
@@ -1100,16 +2714,68 @@ bool _processOptions( int argc, char *argv[] )
 
                 break;
 
+            // ------------------------------------
+            case 'S':
+                if ( atof( optarg ) < 0 )
+                {
+                    genericsReport( V_ERROR, "Start time is out of range" EOL );
+                    return false;
+                }
+
+                options.startmS = atof( optarg ) * 1000;
+                break;
+
+            // ------------------------------------
+            case 'w':
+                options.window = ( int64_t ) ( atof( optarg ) ) * 1000;
+                break;
+
+            // ------------------------------------
+            case 'X':
+            {
+                char *a = strchr( optarg, ',' );
+
+                options.timeline = optarg;
+
+                if ( a )
+                {
+                    *a++ = 0;
+                    options.timelineMHz = atof( a );
+
+                    if ( options.timelineMHz <= 0 )
+                    {
+                        genericsReport( V_ERROR, "Timeline clock rate out of range" EOL );
+                        return -EINVAL;
+                    }
+                }
+            }
+            break;
+
+            // ------------------------------------
+            case 'y':
+                options.decay = ( int64_t ) ( atof( optarg ) ) * 1000;
+                break;
+
             // ------------------------------------
             case 'h':
                 _printHelp( argv[0] );
                 return ERR;
 
+            // ------------------------------------
+            case 'H':
+                options.shm = ( optarg ) ? optarg : ORBUCULUM_SHM_NAME;
+                break;
+
             // ------------------------------------
             case 'V':
                 _printVersion();
                 return -EINVAL;
 
+            // ------------------------------------
+            case 'z':
+                options.compress = true;
+                break;
+
             // ------------------------------------
             case '?':
                 if ( optopt == 'b' )
@@ -1130,10 +2796,39 @@ bool _processOptions( int argc, char *argv[] )
                 // ------------------------------------
         }
 
-    /* If we set an explicit server and port and didn't set a protocol chances are we want ITM, not OFLOW */
-    if ( serverExplicit && !protExplicit )
+    /* If we set an explicit server and port and didn't set a protocol chances are we want ITM, not OFLOW */
+    if ( serverExplicit && !protExplicit )
+    {
+        options.protocol = PROT_ITM;
+    }
+
+    if ( ( options.protocol == PROT_MSG ) && !portExplicit )
+    {
+        options.port = NWMSG_SERVER_PORT;
+    }
+
+    /* Shared memory only ever carries what orbuculum publishes, which is OFLOW */
+    if ( options.shm )
+    {
+        if ( options.file || serverExplicit )
+        {
+            genericsReport( V_ERROR, "Cannot specify shared memory with file or server" EOL );
+            return -EINVAL;
+        }
+
+        options.protocol = PROT_OFLOW;
+    }
+
+    /* A query only needs the store, it's all in there */
+    if ( options.historyQuery )
     {
-        options.protocol = PROT_ITM;
+        if ( !options.history )
+        {
+            genericsReport( V_ERROR, "A history query needs the store (-L) to look in" EOL );
+            return -EINVAL;
+        }
+
+        return OK;
     }
 
     if ( !options.elffile )
@@ -1142,12 +2837,70 @@ bool _processOptions( int argc, char *argv[] )
         exit( -EBADF );
     }
 
+    if ( ( options.parallel ) && ( !options.file ) )
+    {
+        genericsReport( V_ERROR, "Parallel decode needs an input file" EOL );
+        return -EINVAL;
+    }
+
+    if ( ( options.parallel ) && ( options.timeline ) )
+    {
+        genericsReport( V_ERROR, "A timeline needs events in order, so can't come from a parallel decode" EOL );
+        return -EINVAL;
+    }
+
+    if ( ( options.exactTag ) && ( ( options.parallel ) || ( options.protocol != PROT_OFLOW ) || ( options.exactTag == options.tag ) ) )
+    {
+        genericsReport( V_ERROR, "Exact mode takes the trace on an OFLOW tag of its own, and can't be used with a parallel decode" EOL );
+        return -EINVAL;
+    }
+
+    if ( ( options.taskChannel >= 0 ) && ( ( options.parallel ) || ( options.protocol == PROT_MSG ) ) )
+    {
+        genericsReport( V_ERROR, "Tasks are followed by seeing each sample after the switch before it, so need every sample in order" EOL );
+        return -EINVAL;
+    }
+
+    if ( options.window && options.decay )
+    {
+        genericsReport( V_ERROR, "Sliding window and decay are mutually exclusive" EOL );
+        return -EINVAL;
+    }
+
+    if ( options.json && options.binary && ( options.json[0] == '-' ) && ( options.binary[0] == '-' ) )
+    {
+        genericsReport( V_ERROR, "JSON and binary output cannot both go to the screen" EOL );
+        return -EINVAL;
+    }
+
+    if ( options.displayInterval <= 0 )
+    {
+        genericsReport( V_ERROR, "Display interval must be positive" EOL );
+        return -EINVAL;
+    }
+
+    if ( options.topK > TOP_K_MAX )
+    {
+        genericsReport( V_ERROR, "Top-K can't be more than %d" EOL, TOP_K_MAX );
+        return -EINVAL;
+    }
+
+    if ( options.window )
+    {
+        /* The window is made of whole display intervals */
+        options.windowBuckets = ( options.window + options.displayInterval - 1 ) / options.displayInterval;
+    }
+
     genericsReport( V_INFO, "orbtop version " GIT_DESCRIBE EOL );
 
     if ( options.file )
     {
         genericsReport( V_INFO, "Input File       : %s", options.file );
     }
+    else if ( options.shm )
+    {
+        genericsReport( V_INFO, "Shared Mem       : %s" EOL, options.shm );
+    }
     else
     {
         genericsReport( V_INFO, "Server           : %s:%d" EOL, options.server, options.port );
@@ -1158,7 +2911,40 @@ bool _processOptions( int argc, char *argv[] )
     genericsReport( V_INFO, "ForceSync        : %s" EOL, options.forceITMSync ? "true" : "false" );
     genericsReport( V_INFO, "C++ Demangle     : %s" EOL, options.demangle ? "true" : "false" );
     genericsReport( V_INFO, "Display Interval : %d ms" EOL, options.displayInterval / 1000 );
+
+    if ( options.windowBuckets )
+    {
+        genericsReport( V_INFO, "Sliding window   : %d ms in %d intervals" EOL, ( int )( options.windowBuckets * options.displayInterval / 1000 ), options.windowBuckets );
+    }
+
+    if ( options.decay )
+    {
+        genericsReport( V_INFO, "Decay constant   : %d ms" EOL, ( int )( options.decay / 1000 ) );
+    }
+
+    if ( options.topK )
+    {
+        genericsReport( V_INFO, "Top-K            : %" PRIu32 " addresses" EOL, options.topK );
+    }
     genericsReport( V_INFO, "Log File         : %s" EOL, options.logfile ? options.logfile : "None" );
+    genericsReport( V_INFO, "History          : %s" EOL, options.history ? options.history : "None" );
+    genericsReport( V_INFO, "Binary File      : %s" EOL, options.binary ? options.binary : "None" );
+
+    if ( options.timeline )
+    {
+        genericsReport( V_INFO, "Timeline         : %s" EOL, options.timeline );
+    }
+
+    if ( options.taskChannel >= 0 )
+    {
+        genericsReport( V_INFO, "Task channel     : %d" EOL, options.taskChannel );
+    }
+
+    if ( options.exactTag )
+    {
+        genericsReport( V_INFO, "Exact counts     : %s in stream %d" EOL, TRACEDecodeGetProtocolName( options.exactProtocol ), options.exactTag );
+    }
+
     genericsReport( V_INFO, "Objdump options  : %s" EOL, options.odoptions ? options.odoptions : "None" );
 
     switch ( options.protocol )
@@ -1171,6 +2957,10 @@ bool _processOptions( int argc, char *argv[] )
             genericsReport( V_INFO, "Decoding ITM" EOL );
             break;
 
+        case PROT_MSG:
+            genericsReport( V_INFO, "Taking PC sample histograms from the server" EOL );
+            break;
+
         default:
             genericsReport( V_INFO, "Decoding unknown" EOL );
             break;
@@ -1185,7 +2975,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 {
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
@@ -1196,6 +2986,10 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
                 _itmPumpProcess( p->d[i] );
             }
         }
+        else if ( ( options.exactTag ) && ( p->tag == options.exactTag ) )
+        {
+            _exactPump( p->d, p->len );
+        }
     }
 }
 
@@ -1205,32 +2999,420 @@ static struct Stream *_openStream( void )
 {
     if ( options.file != NULL )
     {
-        return streamCreateFile( options.file );
+        return streamCreateMappedFileAt( options.file, captureIndexStart( options.file, options.startmS ) );
+    }
+    else if ( options.shm != NULL )
+    {
+        /* The ring doesn't wait for anyone so needs no draining, and we decode straight out of it */
+        return streamCreateShm( options.shm );
     }
     else
     {
-        return streamCreateSocket( options.server, options.port );
+        struct Stream *stream = ( options.compress ) ? streamCreateCompressedSocket( options.server, options.port ) : streamCreateSocket( options.server, options.port );
+
+        /* Reports and symbol loads take a while, the socket gets drained in the meantime */
+        stream = streamCreateReader( stream, STREAM_READER_BUFS, TRANSFER_SIZE );
+
+        if ( ( stream ) && ( options.protocol == PROT_OFLOW ) )
+        {
+            uint8_t tag = options.tag;
+            nwSubscribe( stream, 1, &tag );
+        }
+
+        if ( ( stream ) && ( options.protocol == PROT_MSG ) )
+        {
+            /* The counts rather than every sample, and what the exception figures are made from */
+            uint8_t tags[] = { MSGSTREAM_TAG_PCHIST, MSGSTREAM_TAG_MSG( MSG_EXCEPTION ), MSGSTREAM_TAG_MSG( MSG_TS ) };
+            nwSubscribe( stream, sizeof( tags ), tags );
+        }
+
+        /* Someone is watching, so would rather see things promptly */
+        if ( stream )
+        {
+            nwRequestQoS( stream, NW_QOS_LATENCY );
+        }
+
+        return stream;
     }
 }
 
 // ====================================================================================================
-static void _intHandler( int sig )
+// ====================================================================================================
+// Parallel offline decode
+// ====================================================================================================
+// ====================================================================================================
+// The file is cut into one chunk per thread. Each thread (apart from the first) starts unsynced and
+// only counts from the first ITM sync in its chunk. The thread before it carries on past the end of
+// its own chunk up to that same sync, so nothing is counted twice or missed. If a chunk has no sync
+// in it at all then the thread before takes that chunk on too, and so on.
+// ====================================================================================================
+static void _parallelPublish( struct parallelWorker *w, enum parallelSync state, uint64_t pos )
+
+/* Let the worker before us know where we start counting from, if we do at all */
 
 {
-    /* CTRL-C exit is not an error... */
-    _r.ending = true;
+    pthread_mutex_lock( &_p.l );
+    w->syncPos = pos;
+    w->syncState = state;
+    pthread_cond_broadcast( &_p.c );
+    pthread_mutex_unlock( &_p.l );
+}
+// ====================================================================================================
+static bool _parallelContinue( struct parallelWorker *w, uint64_t fileOfs, uint64_t pos )
+
+/* Check if this worker is still to process data at fileOfs/pos, finding out where it stops if needed */
+
+{
+    struct parallelWorker *n;
+
+    if ( ( w->syncState == PSYNC_PENDING ) && ( fileOfs >= w->end ) )
+    {
+        /* Never found a sync in our own chunk, so the one before us will deal with it */
+        _parallelPublish( w, PSYNC_NONE, 0 );
+        return false;
+    }
+
+    while ( ( !w->stopKnown ) && ( fileOfs >= _p.w[w->next].start ) )
+    {
+        n = &_p.w[w->next];
+        pthread_mutex_lock( &_p.l );
+
+        while ( n->syncState == PSYNC_PENDING )
+        {
+            pthread_cond_wait( &_p.c, &_p.l );
+        }
+
+        pthread_mutex_unlock( &_p.l );
+
+        if ( n->syncState == PSYNC_FOUND )
+        {
+            w->stopPos = n->syncPos;
+            w->stopKnown = true;
+        }
+        else if ( ++w->next == _p.n )
+        {
+            w->stopPos = UINT64_MAX;
+            w->stopKnown = true;
+        }
+    }
+
+    return ( !w->stopKnown ) || ( pos < w->stopPos );
+}
+// ====================================================================================================
+static void _parallelDrain( struct parallelWorker *w )
+
+/* Count the PC samples from whatever the sequencer has released */
+
+{
+    struct pcCount *p;
+    struct msg *m;
+
+    while ( ( m = MSGSeqGetPacket( &w->d ) ) )
+    {
+        if ( m->genericMsg.msgtype == MSG_PC_SAMPLE )
+        {
+            if ( m->pcSampleMsg.sleep )
+            {
+                w->sleeps++;
+                continue;
+            }
+
+            HASH_FIND_INT( w->counts, &m->pcSampleMsg.pc, p );
+
+            if ( !p )
+            {
+                p = ( struct pcCount * )memCalloc( MEM_ADDRESSES, 1, sizeof( struct pcCount ) );
+                MEMCHECK( p, );
+                p->pc = m->pcSampleMsg.pc;
+                HASH_ADD_INT( w->counts, pc, p );
+            }
+
+            p->visits++;
+        }
+        else if ( m->genericMsg.msgtype == MSG_TS )
+        {
+            w->ticks += ( ( struct TSMsg * )m )->timeInc;
+        }
+        else if ( m->genericMsg.msgtype == MSG_DWT_EVENT )
+        {
+            for ( enum dwtCounter d = 0; d < DWT_NUM; d++ )
+            {
+                w->dwt[d] += ( m->dwtMsg.event >> d ) & 1;
+            }
+        }
+    }
+}
+// ====================================================================================================
+static bool _parallelPump( struct parallelWorker *w, uint8_t c, uint64_t fileOfs, uint64_t pos )
+
+/* Put one ITM byte through this worker's decoder, returning false once it's done */
+
+{
+    if ( !_parallelContinue( w, fileOfs, pos ) )
+    {
+        return false;
+    }
+
+    if ( MSGSeqPump( &w->d, c ) )
+    {
+        _parallelDrain( w );
+    }
+
+    if ( ( w->syncState == PSYNC_PENDING ) && ( ITMDecoderGetStats( &w->i )->syncCount ) )
+    {
+        /* This is where we take over from the worker before us */
+        _parallelPublish( w, PSYNC_FOUND, pos );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _parallelOFLOWRxed( struct OFLOWFrame *p, void *param )
+
+{
+    struct parallelWorker *w = ( struct parallelWorker * )param;
+
+    if ( ( p->good ) && ( p->tag == options.tag ) )
+    {
+        for ( int i = 0; ( i < p->len ) && ( !w->done ); i++ )
+        {
+            w->done = !_parallelPump( w, p->d[i], w->frameStart, PARALLEL_POS( w->frameStart, i ) );
+        }
+    }
+}
+// ====================================================================================================
+static void *_parallelTask( void *arg )
+
+{
+    struct parallelWorker *w = ( struct parallelWorker * )arg;
+    struct Stream *stream = streamCreateMappedFileAt( options.file, w->start );
+    uint8_t cbw[TRANSFER_SIZE];
+    const uint8_t *d;
+    uint64_t ofs = w->start;
+    size_t len;
+
+    /* Apart from the first, chunks start part way through a frame, so skip to the next one */
+    bool inFrame = ( !w->index );
+    w->frameStart = ofs;
+
+    while ( ( stream ) && ( !w->done ) && ( !_r.ending ) && ( _parallelContinue( w, ofs, PARALLEL_POS( ofs, 0 ) ) ) )
+    {
+        struct timeval tv = { .tv_sec = 0 };
+        enum ReceiveResult rr;
+
+        rr = streamAcquire( stream, cbw, TRANSFER_SIZE, ( const void ** )&d, &tv, &len );
+
+        if ( ( rr == RECEIVE_RESULT_EOF ) || ( rr == RECEIVE_RESULT_ERROR ) || ( !len ) )
+        {
+            break;
+        }
+
+        if ( options.protocol == PROT_ITM )
+        {
+            for ( size_t i = 0; ( i < len ) && ( !w->done ); i++, ofs++ )
+            {
+                w->done = !_parallelPump( w, d[i], ofs, PARALLEL_POS( ofs, 0 ) );
+            }
+
+            streamRelease( stream );
+            continue;
+        }
+
+        /* OFLOW is fed a frame at a time, so we know where each one started */
+        while ( ( len ) && ( !w->done ) )
+        {
+            const uint8_t *e = ( const uint8_t * )memchr( d, COBS_SYNC_CHAR, len );
+            size_t l = ( e ) ? e - d + 1 : len;
+
+            if ( inFrame )
+            {
+                OFLOWPump( &w->c, d, l, _parallelOFLOWRxed, w );
+            }
+
+            d += l;
+            ofs += l;
+            len -= l;
+
+            if ( e )
+            {
+                w->frameStart = ofs;
+                inFrame = true;
+                w->done = !_parallelContinue( w, ofs, PARALLEL_POS( ofs, 0 ) );
+            }
+        }
+
+        streamRelease( stream );
+    }
+
+    /* Got to the end of the file without finding a sync, so let anyone waiting know */
+    if ( w->syncState == PSYNC_PENDING )
+    {
+        _parallelPublish( w, PSYNC_NONE, 0 );
+    }
+
+    if ( stream )
+    {
+        stream->close( stream );
+        free( stream );
+    }
+
+    /* ...and anything the sequencer was still holding on to counts too */
+    _parallelDrain( w );
+    return NULL;
+}
+// ====================================================================================================
+static int _parallelDecode( void )
+
+/* Decode the whole input file across options.parallel threads, merge their counts and report them */
+
+{
+    struct stat st;
+    struct pcCount *p, *pt;
+    struct visitedAddr *a;
+    struct reportLine *report;
+    uint32_t reportLines;
+    uint64_t base = captureIndexStart( options.file, options.startmS );
+
+    if ( ( stat( options.file, &st ) < 0 ) || ( ( uint64_t )st.st_size <= base ) )
+    {
+        genericsReport( V_ERROR, "Cannot read %s" EOL, options.file );
+        return -ENOENT;
+    }
+
+    /* No point in having chunks so small that starting up costs more than decoding them */
+    _p.n = options.parallel;
+
+    if ( ( st.st_size - base ) / _p.n < PARALLEL_MIN_CHUNK )
+    {
+        _p.n = ( ( st.st_size - base ) / PARALLEL_MIN_CHUNK ) ? ( st.st_size - base ) / PARALLEL_MIN_CHUNK : 1;
+    }
+
+    _p.w = ( struct parallelWorker * )calloc( _p.n + 1, sizeof( struct parallelWorker ) );
+    MEMCHECK( _p.w, -ENOMEM );
+    pthread_mutex_init( &_p.l, NULL );
+    pthread_cond_init( &_p.c, NULL );
+
+    int64_t startTime = _timestamp();
+
+    for ( int i = 0; i < _p.n; i++ )
+    {
+        struct parallelWorker *w = &_p.w[i];
+
+        w->index = i;
+        w->start = base + ( ( st.st_size - base ) * i ) / _p.n;
+        w->end   = base + ( ( st.st_size - base ) * ( i + 1 ) ) / _p.n;
+        w->next  = i + 1;
+        w->stopKnown = ( w->next == _p.n );
+        w->stopPos = UINT64_MAX;
+
+        /* The first worker starts however the user asked, the rest have to find a sync */
+        w->syncState = ( i ) ? PSYNC_PENDING : PSYNC_FOUND;
+        ITMDecoderInit( &w->i, ( i ) ? false : options.forceITMSync );
+
+        if ( !MSGSeqInit( &w->d, &w->i, MSG_REORDER_BUFLEN ) )
+        {
+            genericsExit( -1, "No memory for message sequencer" EOL );
+        }
+
+        OFLOWInit( &w->c );
+    }
+
+    /* The extra one on the end is only there to give a start position for the last worker to check against */
+    _p.w[_p.n].start = UINT64_MAX;
+
+    for ( int i = 0; i < _p.n; i++ )
+    {
+        if ( pthread_create( &_p.w[i].thread, NULL, _parallelTask, &_p.w[i] ) )
+        {
+            genericsExit( -1, "Failed to create decode thread" EOL );
+        }
+    }
+
+    /* Now fold everything into the report lines as one interval */
+    _flushHash();
+    _r.lastReportus = startTime;
+
+    for ( int i = 0; i < _p.n; i++ )
+    {
+        struct parallelWorker *w = &_p.w[i];
+        struct ITMDecoderStats *s = ITMDecoderGetStats( &w->i );
+
+        pthread_join( w->thread, NULL );
+
+        HASH_ITER( hh, w->counts, p, pt )
+        {
+            if ( options.topK )
+            {
+                _hitterAdd( p->pc, p->visits );
+            }
+            else
+            {
+                HASH_FIND_INT( _r.addresses, &p->pc, a );
+
+                if ( !a )
+                {
+                    a = _newAddr( p->pc );
+                }
+
+                a->slot->visits += p->visits;
+            }
+
+            HASH_DEL( w->counts, p );
+            memFree( MEM_ADDRESSES, p );
+        }
+
+        _r.sleeps += w->sleeps;
+        _r.timeStamp += w->ticks;
+
+        for ( enum dwtCounter d = 0; d < DWT_NUM; d++ )
+        {
+            _r.dwt[d] += w->dwt[d];
+            _r.dwtSeen |= ( w->dwt[d] != 0 );
+        }
+        ITMDecoderGetStats( &_r.i )->overflow += s->overflow;
+        ITMDecoderGetStats( &_r.i )->syncCount += s->syncCount;
+        ITMDecoderGetStats( &_r.i )->ErrorPkt += s->ErrorPkt;
+        genericsReport( V_DEBUG, "Worker %d: %" PRIu64 " to %" PRIu64 ", %s" EOL, i, w->start, w->end,
+                        ( w->syncState == PSYNC_NONE ) ? "no sync, covered by previous worker" : "synced" );
+    }
+
+    if ( options.topK )
+    {
+        _hitterFlush();
+    }
+
+    int64_t thisTime = _timestamp();
+    uint32_t total = _consolodateReport( &report, &reportLines );
+    genericsReport( V_INFO, "Decoded %" PRIu64 " bytes on %d threads in %" PRIi64 "ms" EOL, ( uint64_t )st.st_size - base, _p.n, ( thisTime - startTime ) / 1000 );
+
+    if ( options.json )
+    {
+        _outputJson( _r.jsonfile, total, reportLines, report, thisTime );
+    }
+
+    if ( options.binary )
+    {
+        _outputBinary( total, reportLines, report, thisTime );
+    }
+
+    _historyCommit();
+
+    if ( ( ( !options.json ) || ( options.json[0] != '-' ) ) && ( ( !options.binary ) || ( options.binary[0] != '-' ) ) )
+    {
+        _snapshotMake( &_r.snap[0], total, reportLines, report, thisTime );
+        _outputTop( &_r.snap[0] );
+    }
+
+    return OK;
 }
 // ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
-// Externally available routines
-// ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
-int main( int argc, char *argv[] )
+static void *_captureTask( void *arg )
+
+/* Receive and decode, making a report at each interval, until told to stop */
 
 {
     uint8_t cbw[TRANSFER_SIZE];
+    const uint8_t *rxd = cbw;
 
     /* Output variables for interval report */
     uint32_t total;
@@ -1244,70 +3426,7 @@ int main( int argc, char *argv[] )
     enum ReceiveResult receiveResult = RECEIVE_RESULT_OK;
     size_t receivedSize = 0;
     enum symbolErr r;
-
-    if ( OK != _processOptions( argc, argv ) )
-    {
-        exit( -EINVAL );
-    }
-
-    genericsScreenHandling( !options.mono );
-
-    /* Check we've got _some_ symbols to start from */
-    r = SymbolSetCreate( &_r.s, options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
-
-    switch ( r )
-    {
-        case SYMBOL_NOELF:
-            genericsExit( -1, "Elf file or symbols in it not found" EOL );
-            break;
-
-        case SYMBOL_NOOBJDUMP:
-            genericsExit( -1, "No objdump found" EOL );
-            break;
-
-        case SYMBOL_UNSPECIFIED:
-            genericsExit( -1, "Unknown error in symbol subsystem" EOL );
-            break;
-
-        default:
-            break;
-    }
-
-    genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
-
-    /* Reset the handlers before we start */
-    ITMDecoderInit( &_r.i, options.forceITMSync );
-    OFLOWInit( &_r.c );
-    MSGSeqInit( &_r.d, &_r.i, MSG_REORDER_BUFLEN );
-
-    /* This ensures the signal handler gets called */
-    if ( SIG_ERR == signal( SIGINT, _intHandler ) )
-    {
-        genericsExit( -1, "Failed to establish Int handler" EOL );
-    }
-
-    /* First interval will be from startup to first packet arriving */
-    _r.lastReportus = _timestamp();
-    _r.currentException = NO_EXCEPTION;
-
-    /* Open file for JSON output if we have one */
-    if ( options.json )
-    {
-        if ( options.json[0] == '-' )
-        {
-            _r.jsonfile = stdout;
-        }
-        else
-        {
-            _r.jsonfile = fopen( options.json, "w" );
-
-            if ( !_r.jsonfile )
-            {
-                perror( "Couldn't open json output file" );
-                return -ENOENT;
-            }
-        }
-    }
+    struct SymbolSet *newSymbols;
 
     while ( !_r.ending )
     {
@@ -1327,13 +3446,16 @@ int main( int argc, char *argv[] )
 
         alreadyReported = false;
 
-        if ( ( !options.json ) || ( options.json[0] != '-' ) )
+        if ( _r.showTop )
         {
             genericsPrintf( CLEAR_SCREEN "Connected..." EOL );
         }
 
         /* ...just in case we have any readings from a previous incantation */
         _flushHash( );
+        msgStreamDecoderInit( &_r.m );
+        msgStreamDecoderSetHist( &_r.m, _histRxed, NULL );
+        _r.histSeen = false;
 
         thisTime = _r.lastReportus = _timestamp();
 
@@ -1345,7 +3467,8 @@ int main( int argc, char *argv[] )
             {
                 tv.tv_sec = remainTime / 1000000;
                 tv.tv_usec  = remainTime % 1000000;
-                receiveResult = stream->receive( stream, cbw, TRANSFER_SIZE, &tv, &receivedSize );
+                /* If the stream can give us direct access to its data then that's used rather than copying */
+                receiveResult = streamAcquire( stream, cbw, TRANSFER_SIZE, ( const void ** )&rxd, &tv, &receivedSize );
             }
             else
             {
@@ -1366,17 +3489,24 @@ int main( int argc, char *argv[] )
                 /* We are at EOF, hopefully next loop will get more data. */
             }
 
-            /* Check to make sure our symbols are still appropriate */
-            if ( !SymbolSetValid( &_r.s, options.elffile ) )
+            /* Check to make sure our symbols are still appropriate, and reload them in the background if not */
+            if ( ( !_r.reload ) && ( thisTime >= _r.reloadRetry ) && ( SymbolSetChanged( _r.s, options.elffile ) ) )
             {
-                /* Make sure old references are invalidated */
-                _flushHash();
-
-                r = SymbolSetCreate( &_r.s, options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
+                _r.reload = SymbolReloadStart( options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
+                _r.reloading = true;
+            }
 
+            if ( ( _r.reload ) && ( SymbolReloadPoll( &_r.reload, &newSymbols, &r ) ) )
+            {
                 switch ( r )
                 {
                     case SYMBOL_NOELF:
+                        if ( !_r.s )
+                        {
+                            /* ...there's nothing to carry on with if the first set couldn't be had */
+                            genericsExit( -1, "Elf file or symbols in it not found" EOL );
+                        }
+
                         genericsReport( V_WARN, "Elf file or symbols in it not found" EOL );
                         break;
 
@@ -1394,11 +3524,26 @@ int main( int argc, char *argv[] )
 
                 if ( SYMBOL_NOELF == r )
                 {
-                    usleep( 1000000L );
-                    continue;
+                    /* ...the samples stay held, and it's tried again in a while */
+                    _r.reloadRetry = thisTime + 1000000L;
                 }
+                else
+                {
+                    /* Make sure old references are invalidated before swapping to the new set. Anything */
+                    /* counted exactly so far is held by address with the samples, until the new set is in. */
+                    if ( options.exactTag )
+                    {
+                        _exactFlush();
+                        _exactReset();
+                    }
 
-                genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+                    _flushHash();
+                    SymbolSetDelete( &_r.s );
+                    _r.s = newSymbols;
+                    _r.reloading = false;
+                    _attributePending();
+                    genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+                }
             }
 
 
@@ -1407,12 +3552,24 @@ int main( int argc, char *argv[] )
             {
                 if ( PROT_OFLOW == options.protocol )
                 {
-                    OFLOWPump( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
+                    if ( rxd == cbw )
+                    {
+                        OFLOWPumpInPlace( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
+                    }
+                    else
+                    {
+                        /* Can't decode in place in a window that belongs to the stream */
+                        OFLOWPump( &_r.c, rxd, receivedSize, _OFLOWpacketRxed, &_r );
+                    }
+                }
+                else if ( PROT_MSG == options.protocol )
+                {
+                    msgStreamPump( &_r.m, rxd, receivedSize, _msgRxed, NULL );
                 }
                 else
                 {
                     /* Pump all of the data through the protocol handler */
-                    uint8_t *c = cbw;
+                    const uint8_t *c = rxd;
 
                     while ( receivedSize > 0 )
                     {
@@ -1420,12 +3577,24 @@ int main( int argc, char *argv[] )
                         receivedSize--;
                     }
                 }
+
+                streamRelease( stream );
             }
 
             /* See if its time to post-process it */
             if ( receiveResult == RECEIVE_RESULT_TIMEOUT || remainTime <= 0 )
             {
-                /* Create the report that we will output */
+                /* Create the report that we will output, with anything counted exactly added in first */
+                if ( options.exactTag )
+                {
+                    _exactFlush();
+                }
+
+                if ( options.topK )
+                {
+                    _hitterFlush();
+                }
+
                 total = _consolodateReport( &report, &reportLines );
 
                 if ( options.json )
@@ -1433,15 +3602,21 @@ int main( int argc, char *argv[] )
                     _outputJson( _r.jsonfile, total, reportLines, report, thisTime );
                 }
 
-                if ( ( !options.json ) || ( options.json[0] != '-' ) )
+                if ( options.binary )
+                {
+                    _outputBinary( total, reportLines, report, thisTime );
+                }
+
+                _historyCommit();
+
+                /* ...the screen gets it by way of a snapshot, before any of the counts move on */
+                if ( _r.showTop )
                 {
-                    _outputTop( total, reportLines, report, thisTime );
+                    _snapshotMake( &_r.snap[_r.snapBack], total, reportLines, report, thisTime );
+                    _snapshotPublish();
                 }
 
-                /* ... and we are done with the report now, get rid of it */
-                free( report );
-                /* and, the hash of seen addresses! */
-                _flushHash();
+                /* The counts were reset as the report was made, so the addresses can be kept for next time */
 
                 /* ...and zero the exception records */
                 for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
@@ -1477,6 +3652,252 @@ int main( int argc, char *argv[] )
         free( stream );
     }
 
+    return NULL;
+}
+// ====================================================================================================
+static void _intHandler( int sig )
+
+{
+    /* CTRL-C exit is not an error... */
+    _r.ending = true;
+}
+// ====================================================================================================
+static void _historyLine( int64_t start, uint32_t seconds, const char *name, uint64_t count, void *param )
+
+/* One line of CSV, with the name quoted since C++ ones can have commas in */
+
+{
+    printf( "%" PRId64 ",%" PRIu32 ",\"", start, seconds );
+
+    for ( const char *c = ( name ) ? name : "** Other **"; *c; c++ )
+    {
+        if ( *c == '"' )
+        {
+            putchar( '"' );
+        }
+
+        putchar( *c );
+    }
+
+    printf( "\",%" PRIu64 EOL, count );
+}
+// ====================================================================================================
+static int _historyPrint( void )
+
+/* Print what the store has for the window asked for, without anything needing to be captured */
+
+{
+    struct tsStore *t = tsStoreOpen( options.history, false );
+    int l;
+
+    if ( !t )
+    {
+        return -ENOENT;
+    }
+
+    printf( "time,seconds,function,count" EOL );
+    l = tsStoreQuery( t, options.historyFrom, options.historyTo, options.historyLevel, _historyLine, NULL );
+    tsStoreClose( t );
+
+    if ( l < 0 )
+    {
+        genericsReport( V_ERROR, "Could not read history from %s" EOL, options.history );
+        return -EIO;
+    }
+
+    genericsReport( V_INFO, "From %" PRId64 " to %" PRId64 " in %" PRIu32 "s slots" EOL, options.historyFrom, options.historyTo, tsStoreResolution( l ) );
+    return OK;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    enum symbolErr r;
+
+    if ( OK != _processOptions( argc, argv ) )
+    {
+        exit( -EINVAL );
+    }
+
+    genericsScreenHandling( !options.mono );
+
+    if ( options.historyQuery )
+    {
+        return _historyPrint();
+    }
+
+    if ( options.history )
+    {
+        _r.ts = tsStoreOpen( options.history, true );
+
+        if ( !_r.ts )
+        {
+            return -ENOENT;
+        }
+    }
+
+    if ( options.windowBuckets )
+    {
+        _r.sleepBucket = ( uint32_t * )calloc( options.windowBuckets, sizeof( uint32_t ) );
+        MEMCHECK( _r.sleepBucket, -ENOMEM );
+    }
+
+    if ( options.topK )
+    {
+        /* This is all the heavy hitters will ever have, apart from their hash table */
+        _r.hitters = ( struct hitter * )memCalloc( MEM_ADDRESSES, options.topK, sizeof( struct hitter ) );
+        MEMCHECK( _r.hitters, -ENOMEM );
+        _r.hitterHeap = ( struct hitter ** )memCalloc( MEM_ADDRESSES, options.topK, sizeof( struct hitter * ) );
+        MEMCHECK( _r.hitterHeap, -ENOMEM );
+    }
+
+    if ( ( options.exactTag ) || ( options.parallel ) )
+    {
+        /* Exact counting walks the instructions as it decodes, and so does a parallel decode, so these need symbols first */
+        r = SymbolSetCreate( &_r.s, options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
+
+        switch ( r )
+        {
+            case SYMBOL_NOELF:
+                genericsExit( -1, "Elf file or symbols in it not found" EOL );
+                break;
+
+            case SYMBOL_NOOBJDUMP:
+                genericsExit( -1, "No objdump found" EOL );
+                break;
+
+            case SYMBOL_UNSPECIFIED:
+                genericsExit( -1, "Unknown error in symbol subsystem" EOL );
+                break;
+
+            default:
+                break;
+        }
+
+        genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+    }
+    else
+    {
+        /* Otherwise capture starts straight away, with samples held by address just as they are over a reload */
+        _r.reload = SymbolReloadStart( options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
+        _r.reloading = true;
+    }
+
+    /* Reset the handlers before we start */
+    ITMDecoderInit( &_r.i, options.forceITMSync );
+    OFLOWInit( &_r.c );
+
+    if ( !MSGSeqInit( &_r.d, &_r.i, MSG_REORDER_BUFLEN ) )
+    {
+        genericsExit( -1, "No memory for message sequencer" EOL );
+    }
+
+    if ( options.exactTag )
+    {
+        TRACEDecoderInit( &_r.t, options.exactProtocol, true, genericsReport );
+        _r.exactInsn = NO_INSN;
+    }
+
+    /* This ensures the signal handler gets called */
+    if ( SIG_ERR == signal( SIGINT, _intHandler ) )
+    {
+        genericsExit( -1, "Failed to establish Int handler" EOL );
+    }
+
+    /* First interval will be from startup to first packet arriving */
+    _r.lastReportus = _timestamp();
+    _r.currentException = NO_EXCEPTION;
+
+    /* Open file for JSON output if we have one */
+    if ( options.json )
+    {
+        if ( options.json[0] == '-' )
+        {
+            _r.jsonfile = stdout;
+        }
+        else
+        {
+            _r.jsonfile = fopen( options.json, "w" );
+
+            if ( !_r.jsonfile )
+            {
+                perror( "Couldn't open json output file" );
+                return -ENOENT;
+            }
+        }
+    }
+
+    /* ...and the same for binary output */
+    if ( options.binary )
+    {
+        if ( options.binary[0] == '-' )
+        {
+            _r.binfile = stdout;
+        }
+        else
+        {
+            _r.binfile = fopen( options.binary, "wb" );
+
+            if ( !_r.binfile )
+            {
+                perror( "Couldn't open binary output file" );
+                return -ENOENT;
+            }
+        }
+
+        _outputBinaryHeader();
+    }
+
+    if ( options.parallel )
+    {
+        return _parallelDecode();
+    }
+
+    /* ...and the timeline, which only has things to show once they happen */
+    if ( options.timeline )
+    {
+        _r.tl = perfettoCreate( options.timeline, options.elffile, ( options.timelineMHz ) ? 1000.0 / options.timelineMHz : 1.0 );
+
+        if ( !_r.tl )
+        {
+            return -ENOENT;
+        }
+
+        _r.tlExceptions = perfettoTrack( _r.tl, "Exceptions" );
+        _r.tlDepth = perfettoCounterTrack( _r.tl, "Exception depth" );
+    }
+
+    /* Everything from here is received and decoded on its own thread, which leaves this one just showing the reports */
+    _r.showTop = ( ( !options.json ) || ( options.json[0] != '-' ) ) && ( ( !options.binary ) || ( options.binary[0] != '-' ) );
+
+    if ( pthread_create( &_r.captureThread, NULL, _captureTask, NULL ) )
+    {
+        genericsExit( -1, "Failed to create capture thread" EOL );
+    }
+
+    while ( !_r.ending )
+    {
+        const struct topSnapshot *snap = _snapshotTake();
+
+        if ( snap )
+        {
+            _outputTop( snap );
+        }
+        else
+        {
+            usleep( DISPLAY_POLL_US );
+        }
+    }
+
+    pthread_join( _r.captureThread, NULL );
+    perfettoClose( _r.tl );
+
     if ( !_r.ending && ( !ITMDecoderGetStats( &_r.i )->tpiuSyncCount ) )
     {
         genericsReport( V_ERROR, "Read failed" EOL );
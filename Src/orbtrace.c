@@ -11,18 +11,45 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <signal.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "git_version_info.h"
 #include "generics.h"
 
 #include "orbtraceIf.h"
+#include "itmDecoder.h"
+#include "tpiuDecoder.h"
+#include "oflow.h"
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/* Trying out trace settings to find the best one */
+#define TUNE_SETTLE_MS      (20)         /* Thrown away after each change, in case it's from before */
+#define TUNE_SAMPLE_MS      (500)        /* ...then this long is looked at */
+#define TUNE_READ_MS        (50)         /* ...in reads of up to this long */
+#define TUNE_MIN_PACKETS    (256)        /* A setting is only good if the target said this much with it */
+#define TUNE_ITM_STREAM     (1)
+
+#define CONFIG_LINE_LEN     (1024)       /* Longest line a config file can have */
+
+/* SWO speeds to try, fastest first. The target's core clock divided down by its prescaler sets the */
+/* speed, so these are the usual clocks over small divisors, along with the classic UART rates.     */
+static const uint32_t _tuneSpeeds[] =
+{
+    64000000, 60000000, 48000000, 42000000, 40000000, 36000000, 32000000, 30000000, 28000000, 24000000,
+    21000000, 20000000, 18000000, 16000000, 15000000, 14000000, 12000000, 10500000, 10000000, 9000000,
+    8000000, 7200000, 6000000, 5250000, 4800000, 4000000, 3000000, 2400000, 2000000, 1500000, 1000000,
+    921600, 500000, 460800, 230400, 115200, 0
+};
+
+/* ...and parallel widths, widest first */
+static const int _tuneWidths[] = { 4, 2, 1, 0 };
+
 /* Record for options, either defaults or from command line */
 struct Options
 {
@@ -36,6 +63,8 @@ struct Options
     bool swoMANCH;            /* SWO Manchester output */
     bool swoUART;             /* SWO UART output */
     bool useTPIU;             /* Decode TPIU on SWO */
+    bool autoSpeed;           /* Find the SWO UART speed that works, rather than being told it */
+    bool autoWidth;           /* ...or the parallel trace width */
 
     bool opJSON;              /* Set output to JSON */
     bool mono;                /* Supress colour in output */
@@ -47,6 +76,8 @@ struct Options
     int TRefmv;               /* Target voltage setting in mv */
     bool TPwrEN;              /* If to enable/disable TPwr */
     bool TRefEN;              /* If to enable/disable TRef */
+
+    char *configFile;         /* Lines of options, each for the probes it matches */
 } _options;
 
 enum Actions { ACTION_BRIGHTNESS, ACTION_ENCHANGE_VTREF, ACTION_ENCHANGE_VTPWR, ACTION_LIST_DEVICES,
@@ -69,6 +100,25 @@ struct RunTime
     .options = &_options
 };
 
+/* One line of a config file, with the options it gave */
+struct configLine
+{
+    char *text;                 /* Copy of the line, which the options point into */
+    struct Options options;
+    struct RunTime r;
+};
+
+/* ...and a probe that some of them matched, set up in a thread of its own */
+struct configProbe
+{
+    struct RunTime *r;          /* What found it */
+    int entry;
+    struct configLine *lines;
+    int nlines;
+    pthread_t thread;
+    int retVal;
+};
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -138,12 +188,13 @@ static void _printHelp( const char *const progName )
 
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
-    genericsPrintf( "       -a, --serial-speed:  <serialSpeed> to use (when SWO UART is selected)" EOL );
+    genericsPrintf( "       -a, --serial-speed:  <serialSpeed> to use (when SWO UART is selected), or auto to find the fastest that works" EOL );
+    genericsPrintf( "       -c, --config:        <file> Set up every probe a line of file matches with the options on it, all at once" EOL );
     genericsPrintf( "       -e, --power:         <Ch>,<On> Enable or Disable power. Ch is vtref, vtpwr or all" EOL );
     genericsPrintf( "       -h, --help::         This help" EOL );
     genericsPrintf( "       -l, --list:          Show all OrbTrace devices attached to system" EOL );
     genericsPrintf( "       -M, --no-colour:     Supress colour in output" EOL );
-    genericsPrintf( "       -T, --trace-format:  <x> Trace format; 1,2 or 4 bit parallel with TPIU decode," EOL \
+    genericsPrintf( "       -T, --trace-format:  <x> Trace format; 1,2 or 4 bit parallel with TPIU decode, a to find the width," EOL \
                     "                                              m for Manchester SWO, u=UART SWO," EOL \
                     "                                              M for Manchester SWO+TPIU, U=UART SWO+TPIU" EOL );
     genericsPrintf( "       -n, --serial-number: <Serial> any part of serial number to differentiate specific OrbTrace device" EOL );
@@ -172,6 +223,7 @@ void _printVersion( void )
 static struct option _longOptions[] =
 {
     {"serial-speed", required_argument, NULL, 'a'},
+    {"config", required_argument, NULL, 'c'},
     {"power", required_argument, NULL, 'e'},
     {"help", no_argument, NULL, 'h'},
     {"list", no_argument, NULL, 'l'},
@@ -218,15 +270,21 @@ static int _processOptions( struct RunTime *r, int argc, char *argv[]  )
     bool action;
     char *a;
 
-    while ( ( c = getopt_long ( argc, argv, "a:e:hlp:Mn:T:v:V", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "a:c:e:hlp:Mn:T:v:V", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
             case 'a': /* Serial Speed */
-                r->options->serial_speed = atoi( optarg );
+                r->options->autoSpeed = !strcmp( optarg, "auto" );
+                r->options->serial_speed = ( r->options->autoSpeed ) ? 0 : atoi( optarg );
                 _set_action( r, ACTION_SERIAL_SPEED );
                 break;
 
+            // ------------------------------------
+            case 'c': /* Config file */
+                r->options->configFile = optarg;
+                break;
+
             // ------------------------------------
             case 'b': /* Brightness */
                 r->options->brightness = atoi( optarg );
@@ -348,6 +406,10 @@ static int _processOptions( struct RunTime *r, int argc, char *argv[]  )
                         r->options->traceWidth = atoi( optarg );
                         break;
 
+                    case 'a':
+                        r->options->autoWidth = true;
+                        break;
+
                     default:
                         genericsReport( V_ERROR, "Badly formatted tracewidth" EOL );
                         return false;
@@ -465,13 +527,25 @@ static int _processOptions( struct RunTime *r, int argc, char *argv[]  )
     }
 
     if ( ( _tst_action( r, ACTION_SET_TRACE ) ) &&
-            ( ( ( r->options->traceWidth ) && ( ( r->options->swoUART ) || ( r->options->swoMANCH ) ) ) ||
+            ( ( ( ( r->options->traceWidth ) || ( r->options->autoWidth ) ) && ( ( r->options->swoUART ) || ( r->options->swoMANCH ) ) ) ||
               ( ( r->options->swoUART ) && ( r->options->swoMANCH ) ) ) )
     {
         genericsReport( V_ERROR, "Only one trace configuration can be set at the same time" EOL );
         return false;
     }
 
+    if ( ( r->options->autoSpeed ) && ( !r->options->swoUART ) )
+    {
+        genericsReport( V_ERROR, "Finding the serial speed needs SWO UART trace format (-T u or -T U)" EOL );
+        return false;
+    }
+
+    if ( ( r->options->configFile ) && ( _num_actions( r ) > _tst_action( r, ACTION_SN ) ) )
+    {
+        genericsReport( V_ERROR, "With a config file, what's to be done goes in the file" EOL );
+        return false;
+    }
+
     if ( _tst_action( r, ACTION_LIST_DEVICES ) && ( ( _num_actions( r ) > 1 ) ) )
     {
         genericsReport( V_ERROR, "Listing devices is an exclusive operation" EOL );
@@ -506,6 +580,220 @@ static void _doExit( void )
 
 // ====================================================================================================
 
+// ====================================================================================================
+// Finding trace settings that work
+// ====================================================================================================
+struct tuneScore
+{
+    struct ITMDecoder i;
+    struct TPIUDecoder t;
+    struct OFLOW c;
+    uint64_t bytes;                     /* Trace that came in */
+    uint32_t packets;                   /* ITM packets decoded from it */
+    uint32_t errors;                    /* ...things that couldn't be, at any level */
+    uint32_t overflows;                 /* ...and the times the target's ITM overflowed */
+};
+
+static void _tuneITM( struct tuneScore *s, const uint8_t *d, int len )
+
+{
+    while ( len-- )
+    {
+        switch ( ITMPump( &s->i, *d++ ) )
+        {
+            case ITM_EV_PACKET_RXED:
+                s->packets++;
+                break;
+
+            case ITM_EV_OVERFLOW:
+                s->overflows++;
+                break;
+
+            case ITM_EV_UNSYNCED:
+            case ITM_EV_ERROR:
+                s->errors++;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+static void _tuneTPIU( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param )
+
+{
+    struct tuneScore *s = ( struct tuneScore * )param;
+
+    if ( ( e == TPIU_EV_ERROR ) || ( e == TPIU_EV_UNSYNCED ) )
+    {
+        s->errors++;
+    }
+
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        for ( int g = 0; g < p->len; g++ )
+        {
+            if ( p->packet[g].s == TUNE_ITM_STREAM )
+            {
+                uint8_t c = p->packet[g].d;
+                _tuneITM( s, &c, 1 );
+            }
+        }
+    }
+}
+
+static void _tuneOFLOW( struct OFLOWFrame *f, void *param )
+
+{
+    struct tuneScore *s = ( struct tuneScore * )param;
+
+    if ( !f->good )
+    {
+        s->errors++;
+    }
+    else if ( f->tag == TUNE_ITM_STREAM )
+    {
+        _tuneITM( s, f->d, f->len );
+    }
+}
+// ====================================================================================================
+static bool _tuneSample( struct RunTime *r, bool framed, struct tuneScore *s )
+
+/* See how well whatever the probe is set to now decodes. The probe says which protocol it's sending */
+/* in; without ORBFLOW the data is TPIU framed if it's parallel trace, or if the probe was asked to. */
+
+{
+    uint8_t *d = ( uint8_t * )malloc( USB_TRANSFER_SIZE );
+    uint32_t start = genericsTimestampmS();
+    bool ok = false;
+    int n;
+
+    MEMCHECK( d, false );
+
+    memset( s, 0, sizeof( struct tuneScore ) );
+    ITMDecoderInit( &s->i, true );
+    TPIUDecoderInit( &s->t );
+    OFLOWInit( &s->c );
+
+    while ( genericsTimestampmS() - start < TUNE_SETTLE_MS )
+    {
+        if ( OrbtraceIfRead( r->dev, d, USB_TRANSFER_SIZE, TUNE_SETTLE_MS ) < 0 )
+        {
+            goto done;
+        }
+    }
+
+    start = genericsTimestampmS();
+
+    while ( genericsTimestampmS() - start < TUNE_SAMPLE_MS )
+    {
+        if ( ( n = OrbtraceIfRead( r->dev, d, USB_TRANSFER_SIZE, TUNE_READ_MS ) ) < 0 )
+        {
+            genericsReport( V_ERROR, "Couldn't read trace (%d)" EOL, n );
+            goto done;
+        }
+
+        s->bytes += n;
+
+        if ( OrbtraceSupportsOFLOW( r->dev ) )
+        {
+            OFLOWPump( &s->c, d, n, _tuneOFLOW, s );
+        }
+        else if ( framed )
+        {
+            TPIUPump( &s->t, d, n, _tuneTPIU, s );
+        }
+        else
+        {
+            _tuneITM( s, d, n );
+        }
+    }
+
+    /* Almost any byte starts some ITM packet or other, so noise decodes nearly as well as trace does. */
+    /* The giveaway is the reserved headers, which turn up every fifty bytes or so in noise and never  */
+    /* in real trace.                                                                                  */
+    s->errors += ITMDecoderGetStats( &s->i )->ReservedPkt;
+    ok = true;
+
+done:
+    free( d );
+    return ok;
+}
+// ====================================================================================================
+static bool _tuneClean( struct tuneScore *s )
+
+{
+    return ( s->packets >= TUNE_MIN_PACKETS ) && ( !s->errors );
+}
+// ====================================================================================================
+static bool _autoTune( struct RunTime *r )
+
+/* Step through the SWO speeds or parallel widths, fastest first, and stay at the first that decodes */
+/* cleanly. Only the one the target is actually sending at will, so this finds that, and leaves the   */
+/* fastest when it's close enough that several do.                                                    */
+
+{
+    const bool bySpeed = r->options->autoSpeed;
+    struct tuneScore s;
+    int i;
+
+    if ( !OrbtraceGetIfandEP( r->dev ) )
+    {
+        genericsReport( V_ERROR, "Couldn't get at the trace interface" EOL );
+        return false;
+    }
+
+    for ( i = 0; ( bySpeed ) ? ( _tuneSpeeds[i] != 0 ) : ( _tuneWidths[i] != 0 ); i++ )
+    {
+        if ( ( bySpeed ) ? ( !OrbtraceIfSetSWOBaudrate( r->dev, _tuneSpeeds[i] ) ) : ( !OrbtraceIfSetTraceWidth( r->dev, _tuneWidths[i] ) ) )
+        {
+            genericsReport( V_ERROR, "Couldn't change trace setting" EOL );
+            return false;
+        }
+
+        if ( !_tuneSample( r, ( !bySpeed ) || ( r->options->useTPIU ), &s ) )
+        {
+            return false;
+        }
+
+        if ( bySpeed )
+        {
+            genericsReport( V_INFO, "  %8u bps: %" PRIu64 " bytes, %u packets, %u errors" EOL, _tuneSpeeds[i], s.bytes, s.packets, s.errors );
+        }
+        else
+        {
+            genericsReport( V_INFO, "  %d bit: %" PRIu64 " bytes, %u packets, %u errors" EOL, _tuneWidths[i], s.bytes, s.packets, s.errors );
+        }
+
+        if ( _tuneClean( &s ) )
+        {
+            break;
+        }
+    }
+
+    if ( ( bySpeed ) ? ( !_tuneSpeeds[i] ) : ( !_tuneWidths[i] ) )
+    {
+        genericsReport( V_ERROR, "Nothing decoded cleanly, is the target sending trace?" EOL );
+        return false;
+    }
+
+    if ( bySpeed )
+    {
+        genericsReport( V_INFO, "Using %u bps" EOL, _tuneSpeeds[i] );
+    }
+    else
+    {
+        genericsReport( V_INFO, "Using %d bit parallel trace" EOL, _tuneWidths[i] );
+    }
+
+    if ( s.overflows )
+    {
+        genericsReport( V_WARN, "The target's ITM overflowed %u times in %dms, it has more to send than the link can carry" EOL, s.overflows, TUNE_SAMPLE_MS );
+    }
+
+    return true;
+}
 // ====================================================================================================
 static int _performActions( struct RunTime *r )
 
@@ -626,7 +914,7 @@ static int _performActions( struct RunTime *r )
     }
 
     // -----------------------------------------------------------------------------------
-    if ( _tcl_action( r, ACTION_SERIAL_SPEED ) )
+    if ( ( _tcl_action( r, ACTION_SERIAL_SPEED ) ) && ( !r->options->autoSpeed ) )
     {
         genericsReport( V_INFO, "Setting baudrate to %d bps" EOL, r->options->serial_speed );
 
@@ -644,7 +932,11 @@ static int _performActions( struct RunTime *r )
     // -----------------------------------------------------------------------------------
     if ( _tcl_action( r, ACTION_SET_TRACE ) )
     {
-        if ( r->options->traceWidth )
+        if ( r->options->autoWidth )
+        {
+            /* Left to the tuning, below */
+        }
+        else if ( r->options->traceWidth )
         {
             genericsReport( V_INFO, "Setting port width to %d" EOL, r->options->traceWidth );
 
@@ -674,6 +966,17 @@ static int _performActions( struct RunTime *r )
         }
     }
 
+    // -----------------------------------------------------------------------------------
+    if ( ( ( r->options->autoSpeed ) || ( r->options->autoWidth ) ) && ( !retVal ) )
+    {
+        genericsReport( V_INFO, "Finding the %s that works" EOL, ( r->options->autoSpeed ) ? "serial speed" : "port width" );
+
+        if ( !_autoTune( r ) )
+        {
+            retVal |= -1;
+        }
+    }
+
     // -----------------------------------------------------------------------------------
     if ( _tst_action( r, ACTION_WRITE_PARAMS ) )
     {
@@ -687,6 +990,200 @@ static int _performActions( struct RunTime *r )
     return retVal;
 }
 // ====================================================================================================
+static void _resetOptionParsing( void )
+
+/* Get getopt to start again on a new set of arguments */
+
+{
+#if defined( OSX ) || defined( FREEBSD )
+    optreset = 1;
+    optind = 1;
+#else
+    optind = 0;
+#endif
+}
+// ====================================================================================================
+static int _readConfig( const char *file, struct configLine **lines )
+
+/* Each line is a set of orbtrace options, for the probes its -n matches or for all of them if it */
+/* hasn't got one. Anything after a # is a comment. Returns how many lines there were, -1 if bad. */
+
+{
+    char l[CONFIG_LINE_LEN];
+    char *argv[CONFIG_LINE_LEN / 2 + 2];
+    struct configLine *c;
+    int argc, count = 0, lineNo = 0;
+    char *p;
+    FILE *f;
+
+    *lines = NULL;
+
+    if ( !( f = fopen( file, "r" ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't open config file %s" EOL, file );
+        return -1;
+    }
+
+    while ( fgets( l, CONFIG_LINE_LEN, f ) )
+    {
+        lineNo++;
+
+        if ( ( p = strchr( l, '#' ) ) )
+        {
+            *p = 0;
+        }
+
+        argv[0] = "orbtrace";
+        argc = 1;
+
+        for ( p = strtok( l, " \t\r\n" ); p; p = strtok( NULL, " \t\r\n" ) )
+        {
+            argv[argc++] = p;
+        }
+
+        if ( argc == 1 )
+        {
+            continue;
+        }
+
+        argv[argc] = NULL;
+
+        *lines = ( struct configLine * )realloc( *lines, ( count + 1 ) * sizeof( struct configLine ) );
+        MEMCHECK( *lines, -1 );
+        c = &( *lines )[count];
+        memset( c, 0, sizeof( struct configLine ) );
+        c->r.options = &c->options;
+
+        /* The options keep pointers into their arguments, so those need to stay around */
+        c->text = ( char * )malloc( CONFIG_LINE_LEN );
+        MEMCHECK( c->text, -1 );
+
+        for ( int i = 1; i < argc; i++ )
+        {
+            argv[i] = &c->text[argv[i] - l];
+        }
+
+        memcpy( c->text, l, CONFIG_LINE_LEN );
+        count++;
+
+        _resetOptionParsing();
+
+        if ( ( !_processOptions( &c->r, argc, argv ) ) || ( c->options.configFile ) || ( _tst_action( &c->r, ACTION_LIST_DEVICES ) ) )
+        {
+            genericsReport( V_ERROR, "Bad options at line %d of %s" EOL, lineNo, file );
+            fclose( f );
+            return -1;
+        }
+    }
+
+    fclose( f );
+
+    /* The lines may have moved as more were added */
+    for ( int i = 0; i < count; i++ )
+    {
+        ( *lines )[i].r.options = &( *lines )[i].options;
+    }
+
+    return count;
+}
+// ====================================================================================================
+static void *_configureProbe( void *arg )
+
+/* Apply each of the lines that matched, in file order, to the one probe this thread has */
+
+{
+    struct configProbe *p = ( struct configProbe * )arg;
+    const char *sn = OrbtraceIfGetSN( p->r->dev, p->entry );
+    struct RunTime r;
+    int matched = 0;
+
+    if ( !( r.dev = OrbtraceIfCreateDeviceContext( p->r->dev, p->entry ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't open device S/N %s" EOL, sn );
+        p->retVal = -1;
+        return NULL;
+    }
+
+    for ( int i = 0; i < p->nlines; i++ )
+    {
+        struct RunTime *l = &p->lines[i].r;
+
+        if ( ( l->options->sn ) && ( !strstr( sn, l->options->sn ) ) )
+        {
+            continue;
+        }
+
+        /* Actions get used up as they're done, and other probes will want them too */
+        matched++;
+        r.actions = l->actions;
+        r.options = l->options;
+
+        if ( !_checkVoltages( &r ) )
+        {
+            genericsReport( V_ERROR, "Voltage check failed for S/N %s" EOL, sn );
+            p->retVal |= -1;
+            continue;
+        }
+
+        p->retVal |= _performActions( &r );
+    }
+
+    if ( matched )
+    {
+        genericsReport( V_INFO, "S/N %s %s" EOL, sn, ( p->retVal ) ? "had problems" : "set up" );
+    }
+
+    OrbtraceIfCloseDevice( r.dev );
+    free( r.dev );
+    return NULL;
+}
+// ====================================================================================================
+static int _configureAll( struct RunTime *r )
+
+/* Do what the config file says to every probe found, each one on its own thread */
+
+{
+    struct configProbe *p;
+    struct configLine *lines;
+    int nlines, retVal = 0;
+
+    if ( ( nlines = _readConfig( r->options->configFile, &lines ) ) < 0 )
+    {
+        return -1;
+    }
+
+    p = ( struct configProbe * )calloc( r->ndevices, sizeof( struct configProbe ) );
+    MEMCHECK( p, -1 );
+
+    for ( int i = 0; i < r->ndevices; i++ )
+    {
+        p[i].r = r;
+        p[i].entry = i;
+        p[i].lines = lines;
+        p[i].nlines = nlines;
+
+        if ( pthread_create( &p[i].thread, NULL, _configureProbe, &p[i] ) )
+        {
+            genericsExit( -1, "Failed to create probe thread" EOL );
+        }
+    }
+
+    for ( int i = 0; i < r->ndevices; i++ )
+    {
+        pthread_join( p[i].thread, NULL );
+        retVal |= p[i].retVal;
+    }
+
+    for ( int i = 0; i < nlines; i++ )
+    {
+        free( lines[i].text );
+    }
+
+    free( lines );
+    free( p );
+    return retVal;
+}
+// ====================================================================================================
 int main( int argc, char *argv[] )
 
 {
@@ -727,6 +1224,10 @@ int main( int argc, char *argv[] )
         {
             OrbtraceIfListDevices( _r.dev );
         }
+        else if ( _r.options->configFile )
+        {
+            retVal = _configureAll( &_r );
+        }
         else
         {
             selection = OrbtraceIfSelectDevice( _r.dev );
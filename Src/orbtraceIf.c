@@ -11,20 +11,121 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <unistd.h>
+#if defined( LINUX )
+    #include <dirent.h>
+#endif
 #include "orbtraceIf.h"
 #include "generics.h"
 
 /* List of device VID/PID pairs this library works with */
-static const struct OrbtraceInterfaceType _validDevices[DEVICE_NUM_DEVICES] =
+static const struct OrbtraceInterfaceType _validDevices[] =
 {
     { 0x1209, 0x3443, DEVICE_ORBTRACE_MINI },
     { 0x1d50, 0x6018, DEVICE_BMP},
+    { 0x0403, 0x6010, DEVICE_FTDI },     /* FT2232H */
+    { 0x0403, 0x6011, DEVICE_FTDI },     /* FT4232H */
+    { 0x0403, 0x6014, DEVICE_FTDI },     /* FT232H */
     { 0,      0      }
 };
 
+/* A device can only be handed over on Linux, where libusb can take on one that's already open */
+#if defined( LINUX ) && defined( LIBUSB_API_VERSION ) && ( LIBUSB_API_VERSION >= 0x01000107 )
+    #define HANDOVER_USB
+#endif
+
 /* BMP iInterface string */
 #define BMP_IFACE "Black Magic Trace Capture"
 
+/* CMSIS-DAP v2 probes have no VID/PID of their own, they're known by this in their interface name */
+#define DAP_IFACE "CMSIS-DAP"
+
+/* CMSIS-DAP commands used to get SWO streaming from the trace endpoint */
+#define DAP_INFO            (0x00)
+#define DAP_SWO_TRANSPORT   (0x17)
+#define DAP_SWO_MODE        (0x18)
+#define DAP_SWO_BAUDRATE    (0x19)
+#define DAP_SWO_CONTROL     (0x1a)
+
+#define DAP_INFO_CAPS       (0xf0)
+#define DAP_CAP_SWO_UART    (1<<2)
+#define DAP_CAP_SWO_STREAM  (1<<6)
+#define DAP_OK              (0x00)
+#define DAP_TRANSPORT_EP    (2)          /* Trace goes out on its own endpoint */
+#define DAP_MODE_UART       (1)
+
+#define DAP_MAX_PACKET      (1024)       /* A whole number of packets at any speed */
+#define DAP_TIMEOUT_MS      (500)
+
+/* ...and those used to get at target memory over SWD */
+#define DAP_CONNECT         (0x02)
+#define DAP_DISCONNECT      (0x03)
+#define DAP_XFER_CONFIGURE  (0x04)
+#define DAP_TRANSFER        (0x05)
+#define DAP_SWJ_CLOCK       (0x11)
+#define DAP_SWJ_SEQUENCE    (0x12)
+#define DAP_SWD_CONFIGURE   (0x13)
+
+#define DAP_INFO_PACKET     (0xff)
+#define DAP_PORT_SWD        (1)
+#define DAP_WAIT_RETRY      (100)        /* WAIT responses the probe rides out before giving up */
+#define DAP_XFER_MAX        (255)        /* Transfers in one DAP_Transfer */
+
+/* The request byte of a transfer, and its responses */
+#define DAP_AP              (1<<0)
+#define DAP_RD              (1<<1)
+#define DAP_ACK_OK          (1)
+#define DAP_ACK_FAULT       (4)
+
+#define DP_IDCODE           (0x00)       /* Read */
+#define DP_ABORT            (0x00)       /* Write */
+#define DP_CTRL_STAT        (0x04)
+#define DP_SELECT           (0x08)
+#define AP_CSW              (0x00)
+#define AP_TAR              (0x04)
+#define AP_DRW              (0x0c)
+
+#define DP_ABORT_CLEAR      (0x1e)       /* All the sticky errors */
+#define DP_PWRUP_REQ        (0x50000000) /* CSYSPWRUPREQ | CDBGPWRUPREQ */
+#define DP_PWRUP_ACK        (0xa0000000)
+#define AP_CSW_WORD_INC     (0x23000012) /* 32 bit, incrementing, privileged debug access */
+#define TAR_WRAP            (0x400)      /* TAR only has to increment within this */
+
+/* A BMP has no CMSIS-DAP, so target memory is got at by talking GDB remote protocol to its GDB server */
+#define GDB_IFACE           "Black Magic GDB Server"
+#define GDB_MAX_PACKET      (1024)       /* Longest packet the BMP takes or sends */
+#define GDB_READ_MAX        (480)        /* Most memory asked for at once, so its hex fits in a packet */
+#define GDB_RETRIES         (3)          /* Times a packet is tried again if it's not got through */
+#define GDB_TIMEOUT_MS      (500)
+#define GDB_INTERRUPT       (0x03)
+#define GDB_RLE_BIAS        (29)         /* Run length encoding counts are sent with this added */
+
+#define CDC_SET_LINE_STATE  (0x22)       /* The GDB server only talks while DTR is set */
+#define CDC_DTR_RTS         (0x03)
+
+/* FTDI vendor requests, all on the first channel, which is the only one that can be a sync FIFO */
+#define FTDI_RQ_OUT         (0x40)
+#define FTDI_RESET          (0x00)
+#define FTDI_SET_FLOW       (0x02)
+#define FTDI_SET_BAUD       (0x03)
+#define FTDI_SET_DATA       (0x04)
+#define FTDI_SET_LATENCY    (0x09)
+#define FTDI_SET_BITMODE    (0x0b)
+
+#define FTDI_CHANNEL_A      (1)
+#define FTDI_RESET_SIO      (0)
+#define FTDI_PURGE_RX       (1)
+#define FTDI_FLOW_RTS_CTS   (0x0100)
+#define FTDI_DATA_8N1       (8)
+#define FTDI_MODE_RESET     (0x00)
+#define FTDI_MODE_SYNCFF    (0x40)
+#define FTDI_LATENCY_MS     (2)          /* Longest a part filled packet waits before it's sent anyway */
+#define FTDI_STATUS_LEN     (2)          /* Modem and line status on the front of every packet */
+#define FTDI_H_CLK          (120000000)  /* The H parts' baud clock, which divides by ten... */
+#define FTDI_H_CLK_DIV      (10)
+#define FTDI_H_CLK_SEL      (0x20000)    /* ...when this is in the divisor */
+#define FTDI_TIMEOUT_MS     (500)
+
 #define SCRATCH_STRINGLEN (255)
 #define MAX_DESC_FIELDLEN (50)
 
@@ -51,6 +152,9 @@ static const struct OrbtraceInterfaceType _validDevices[DEVICE_NUM_DEVICES] =
 #define PROT_TPIU       (0x01)
 #define PROT_OFLOWV1_0  (0x10)
 
+/* How often to look for news of a device arriving when someone else is handling the USB events */
+#define MIN_ARRIVAL_POLL_US (1000)
+
 /* String on front of version number to remove */
 #define VERSION_FRONTMATTER "Version: "
 static const struct
@@ -233,255 +337,1069 @@ static bool _doInterfaceControlTransfer( struct OrbtraceIf *o, uint8_t interface
 
     return isOk;
 }
-
-// ====================================================================================================
-// ====================================================================================================
 // ====================================================================================================
-int OrbtraceIfValidateVoltage( struct OrbtraceIf *o, int vmv )
-
-/* Return matching voltage or zero if none can be found */
+static bool _isBulk( const struct libusb_endpoint_descriptor *e, bool in )
 
 {
-    return ( ( vmv >= MIN_GENERIC_VOLTAGE_MV ) && ( vmv <= ( MAX_GENERIC_VOLTAGE_MV + MAX_VOLTAGE_DIFF_MV ) ) ) ? vmv : 0;
+    return ( ( e->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK ) == LIBUSB_TRANSFER_TYPE_BULK ) &&
+           ( ( ( e->bEndpointAddress & LIBUSB_ENDPOINT_IN ) != 0 ) == in );
 }
 // ====================================================================================================
-struct OrbtraceIf *OrbtraceIfCreateContext( void )
+static bool _findDapIf( libusb_device *dev, libusb_device_handle *h, struct OrbtraceIf *o, bool swo )
+
+/* Look for a CMSIS-DAP v2 interface; vendor class, with bulk command and response endpoints and, if   */
+/* swo is set, the trace one after them. Without a handle only its shape can be checked, not its name. */
+/* The endpoints go in o when it's given, the interface as the one for data too if it's for SWO.      */
 
 {
-    struct OrbtraceIf *o = ( struct OrbtraceIf * )calloc( 1, sizeof( struct OrbtraceIf ) );
+    struct libusb_config_descriptor *config;
+    char tfrString[MAX_USB_DESC_LEN];
+    bool found = false;
 
-    if ( libusb_init( &o->context ) < 0 )
+    if ( libusb_get_active_config_descriptor( dev, &config ) < 0 )
     {
-        free( o );
-        return NULL;
+        return false;
     }
-    else
+
+    for ( int if_num = 0; ( if_num < config->bNumInterfaces ) && ( !found ); if_num++ )
     {
-        //        libusb_set_debug(o->context, LIBUSB_LOG_LEVEL_DEBUG);
-        return o;
-    }
-}
+        for ( int alt_num = 0; ( alt_num < config->interface[if_num].num_altsetting ) && ( !found ); alt_num++ )
+        {
+            const struct libusb_interface_descriptor *i = &config->interface[if_num].altsetting[alt_num];
 
-// ====================================================================================================
-void OrbtraceIfDestroyContext( struct OrbtraceIf *o )
+            if ( ( i->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC ) || ( i->bNumEndpoints < ( ( swo ) ? 3 : 2 ) ) ||
+                    ( !_isBulk( &i->endpoint[0], false ) ) || ( !_isBulk( &i->endpoint[1], true ) ) ||
+                    ( ( swo ) && ( !_isBulk( &i->endpoint[2], true ) ) ) )
+            {
+                continue;
+            }
 
-{
-    if ( o )
-    {
-        libusb_exit( o->context );
+            if ( ( h ) && ( ( !i->iInterface ) ||
+                            ( libusb_get_string_descriptor_ascii( h, i->iInterface, ( unsigned char * )tfrString, MAX_USB_DESC_LEN ) < 0 ) ||
+                            ( !strstr( tfrString, DAP_IFACE ) ) ) )
+            {
+                continue;
+            }
+
+            if ( o )
+            {
+                o->dapIface = i->bInterfaceNumber;
+                o->dapOut   = i->endpoint[0].bEndpointAddress;
+                o->dapIn    = i->endpoint[1].bEndpointAddress;
+
+                if ( swo )
+                {
+                    o->iface = i->bInterfaceNumber;
+                    o->ep    = i->endpoint[2].bEndpointAddress;
+                }
+            }
+
+            found = true;
+        }
     }
+
+    libusb_free_config_descriptor( config );
+    return found;
 }
 // ====================================================================================================
-int OrbtraceIfGetDeviceList( struct OrbtraceIf *o, char *sn, uint32_t devmask )
+static int _dapExchange( struct OrbtraceIf *o, uint8_t *cmd, int len, uint8_t *rsp )
 
-/* Get list of devices that match (partial) serial number & devmask */
+/* Send a CMSIS-DAP command and collect its response (into DAP_MAX_PACKET bytes), which echoes the */
+/* command. Returns how long the response is, or <0 if there wasn't one.                           */
 
 {
-    char tfrString[MAX_USB_DESC_LEN];
-    struct OrbtraceIfDevice *d;
-    int versionIndex;
-    size_t y;
-
-    assert( o );
+    int n;
 
-    /* Close any active device */
-    OrbtraceIfCloseDevice( o );
-
-    /* Flush out any old scans we might be holding */
-    _flushDeviceList( o );
-
-    if ( o->list )
+    if ( ( libusb_bulk_transfer( o->handle, o->dapOut, cmd, len, &n, DAP_TIMEOUT_MS ) ) || ( n != len ) )
     {
-        libusb_free_device_list( o->list, true );
+        return -1;
     }
 
-    int count = libusb_get_device_list( o->context, &o->list );
-
-    for ( size_t i = 0; i < count; i++ )
+    if ( ( libusb_bulk_transfer( o->handle, o->dapIn, rsp, DAP_MAX_PACKET, &n, DAP_TIMEOUT_MS ) ) || ( n < 1 ) || ( rsp[0] != cmd[0] ) )
     {
-        o->dev = o->list[i];
-        struct libusb_device_descriptor desc = { 0 };
-        libusb_get_device_descriptor( o->dev, &desc );
+        return -1;
+    }
 
-        /* Loop through known devices to see if this one is one we recognise */
-        for ( y = 0; ( ( _validDevices[y].vid ) &&
-                       ( ( _validDevices[y].vid != desc.idVendor ) || ( _validDevices[y].pid != desc.idProduct ) ) ); y++ );
+    return n;
+}
+// ====================================================================================================
+static bool _dapCommand( struct OrbtraceIf *o, uint8_t *cmd, int len, uint8_t *rsp, int rsplen )
 
-        /* If it's one we're interested in then process further */
-        if ( _validDevices[y].vid )
-        {
-            /* We'll store this match for access later */
-            o->devices = realloc( o->devices, ( o->numDevices + 1 ) * sizeof( struct OrbtraceIfDevice ) );
-            d = &o->devices[o->numDevices];
-            memset( d, 0, sizeof( struct OrbtraceIfDevice ) );
-            d->devtype = _validDevices[y].devtype;
+/* Send a CMSIS-DAP command and collect the first rsplen bytes of its response */
 
-            if ( !libusb_open( o->list[i], &o->handle ) )
-            {
-                if ( desc.iSerialNumber )
-                {
-                    libusb_get_string_descriptor_ascii( o->handle, desc.iSerialNumber, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
-                }
+{
+    uint8_t r[DAP_MAX_PACKET];
 
-                /* This is a match if no S/N match was requested or if there is a S/N and they part-match, and it's a matching devtype */
-                if ( ( devmask & ( 1 << d->devtype ) ) && ( ( !sn ) || ( ( desc.iSerialNumber ) && ( strstr( tfrString, sn ) ) ) ) )
-                {
-                    /* We will keep this one! */
-                    o->numDevices++;
-                    d->sn = strdup( desc.iSerialNumber ? tfrString : "" );
+    if ( _dapExchange( o, cmd, len, r ) < rsplen )
+    {
+        return false;
+    }
 
-                    if ( desc.iManufacturer )
-                    {
-                        libusb_get_string_descriptor_ascii( o->handle, desc.iManufacturer, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
-                    }
+    memcpy( rsp, r, rsplen );
+    return true;
+}
+// ====================================================================================================
+static bool _dapSet( struct OrbtraceIf *o, uint8_t command, uint8_t value )
 
-                    d->manufacturer = strdup( desc.iManufacturer ? tfrString : "" );
+/* A command taking one byte that only says whether it worked */
 
-                    if ( desc.iProduct )
-                    {
-                        libusb_get_string_descriptor_ascii( o->handle, desc.iProduct, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
-                    }
+{
+    uint8_t cmd[2] = { command, value };
+    uint8_t rsp[2];
 
-                    d->product = strdup( desc.iProduct ? tfrString : "" );
-                    d->devIndex = i;
+    return ( _dapCommand( o, cmd, sizeof( cmd ), rsp, sizeof( rsp ) ) ) && ( rsp[1] == DAP_OK );
+}
+// ====================================================================================================
+static uint8_t *_put32( uint8_t *p, uint32_t v )
 
-                    switch ( d->devtype )
-                    {
-                        case DEVICE_ORBTRACE_MINI:
-                            d->powerIf = _getInterface( o, 'P', NULL );
-                            d->traceIf = _getInterface( o, 'T', NULL );
+{
+    *p++ = v;
+    *p++ = v >> 8;
+    *p++ = v >> 16;
+    *p++ = v >> 24;
+    return p;
+}
+// ====================================================================================================
+static bool _dapTransfer( struct OrbtraceIf *o, const uint8_t *req, const uint32_t *wr, int n, uint32_t *rd )
 
-                            /* Collect the probe version from the version interface */
-                            d->versionIf = _getInterface( o, 'V', &versionIndex );
+/* Do n SWD transfers in one command. Writes take their values from wr in turn, and what reads get */
+/* goes into rd in turn. A fault leaves sticky errors set in the DP, so they're cleared for next time. */
 
-                            if ( versionIndex )
-                            {
-                                libusb_get_string_descriptor_ascii( o->handle, versionIndex, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
-                                /* If string contains 'Version: ' at the start then remove it */
-                                d->version = strdup( ( strstr( tfrString, VERSION_FRONTMATTER ) ) ? &tfrString[strlen( VERSION_FRONTMATTER )] : "" );
-                            }
-                            else
-                            {
-                                d->version = strdup( "" );
-                            }
+{
+    uint8_t cmd[DAP_MAX_PACKET];
+    uint8_t rsp[DAP_MAX_PACKET];
+    uint8_t *p = cmd;
+    int nrd = 0;
+    int got;
 
-                            break;
+    *p++ = DAP_TRANSFER;
+    *p++ = 0;
+    *p++ = n;
 
-                        case DEVICE_BMP:
-                            /* On BMP version and serial are merged, so let's unmerge them by making the last word of the product the version */
-                            d->version = &d->product[strlen( d->product ) - 1];
+    for ( int i = 0; i < n; i++ )
+    {
+        *p++ = req[i];
 
-                            while ( ( !isspace( *d->version ) ) && ( d->version != d->product ) )
-                            {
-                                d->version--;
-                            }
+        if ( req[i] & DAP_RD )
+        {
+            nrd++;
+        }
+        else
+        {
+            p = _put32( p, *wr++ );
+        }
+    }
 
-                            *d->version++ = 0;
-                            break;
+    if ( ( got = _dapExchange( o, cmd, p - cmd, rsp ) ) < 3 )
+    {
+        return false;
+    }
 
-                        default:
-                            break;
-                    }
-                }
+    if ( ( rsp[1] != n ) || ( rsp[2] != DAP_ACK_OK ) )
+    {
+        if ( rsp[2] == DAP_ACK_FAULT )
+        {
+            uint8_t a = 0;
+            uint32_t v = DP_ABORT_CLEAR;
 
-                libusb_close( o->handle );
-                o->handle = NULL;
+            if ( req[0] != DP_ABORT )
+            {
+                _dapTransfer( o, &a, &v, 1, NULL );
             }
         }
+
+        return false;
     }
 
-    /* Now sort matching devices into defined order, so they're always the same way up */
-    qsort( o->devices, o->numDevices, sizeof( struct OrbtraceIfDevice ), _compareFunc );
+    if ( got < 3 + 4 * nrd )
+    {
+        return false;
+    }
 
-    return o->numDevices;
+    for ( int i = 0; i < nrd; i++ )
+    {
+        rd[i] = rsp[3 + i * 4] | ( rsp[4 + i * 4] << 8 ) | ( rsp[5 + i * 4] << 16 ) | ( ( uint32_t )rsp[6 + i * 4] << 24 );
+    }
+
+    return true;
 }
 // ====================================================================================================
-void OrbtraceIfListDevices( struct OrbtraceIf *o )
+static bool _dapSequence( struct OrbtraceIf *o, int bits, const uint8_t *d )
 
 {
-    char printConstruct[SCRATCH_STRINGLEN];
-
-    /* Get longest line */
-    genericsPrintf( C_RESET " Id |                    Description                    |      Serial      |           Version" EOL );
-    genericsPrintf( " ---+---------------------------------------------------+------------------+----------------------------" EOL );
+    uint8_t cmd[2 + 32] = { DAP_SWJ_SEQUENCE, bits };
+    uint8_t rsp[2];
 
-    for ( int i = 0; i < o->numDevices; i++ )
-    {
-        snprintf( printConstruct, MAX_DESC_FIELDLEN, "%s %s", OrbtraceIfGetManufacturer( o, i ), OrbtraceIfGetProduct( o, i ) ) ;
-        genericsPrintf( C_SEL " %2d " C_RESET "|"C_ELEMENT" %-49s "C_RESET"|"C_ELEMENT" %16s "C_RESET"|"C_ELEMENT" %s" C_RESET EOL,
-                        i + 1, printConstruct, OrbtraceIfGetSN( o, i ), OrbtraceIfGetVersion( o, i ) );
-    }
+    memcpy( &cmd[2], d, ( bits + 7 ) / 8 );
+    return ( _dapCommand( o, cmd, 2 + ( bits + 7 ) / 8, rsp, 2 ) ) && ( rsp[1] == DAP_OK );
 }
-
 // ====================================================================================================
-int OrbtraceIfSelectDevice( struct OrbtraceIf *o )
+static bool _findGdbIf( struct OrbtraceIf *o )
+
+/* Find the BMP's GDB server; a CDC interface named for it, and the data interface after it  */
 
 {
-    int selection = o->numDevices;
+    struct libusb_config_descriptor *config;
+    char tfrString[MAX_USB_DESC_LEN];
+    bool found = false;
 
-    if ( o->numDevices > 1 )
+    if ( libusb_get_active_config_descriptor( o->dev, &config ) < 0 )
     {
-        OrbtraceIfListDevices( o );
+        return false;
+    }
 
-        selection = 0;
+    for ( int if_num = 0; ( if_num + 1 < config->bNumInterfaces ) && ( !found ); if_num++ )
+    {
+        const struct libusb_interface_descriptor *c = &config->interface[if_num].altsetting[0];
+        const struct libusb_interface_descriptor *d = &config->interface[if_num + 1].altsetting[0];
 
-        while ( ( selection < 1 ) || ( selection > o->numDevices ) )
+        if ( ( c->bInterfaceClass != LIBUSB_CLASS_COMM ) || ( d->bInterfaceClass != LIBUSB_CLASS_DATA ) || ( d->bNumEndpoints < 2 ) ||
+                ( !c->iInterface ) ||
+                ( libusb_get_string_descriptor_ascii( o->handle, c->iInterface, ( unsigned char * )tfrString, MAX_USB_DESC_LEN ) < 0 ) ||
+                ( strcmp( tfrString, GDB_IFACE ) ) )
         {
-            genericsPrintf( EOL C_SEL "Selection>" C_RESET );
-            scanf( "%d", &selection );
+            continue;
+        }
+
+        o->gdbComm = c->bInterfaceNumber;
+        o->gdbData = d->bInterfaceNumber;
+
+        for ( int e = 0; e < d->bNumEndpoints; e++ )
+        {
+            if ( _isBulk( &d->endpoint[e], true ) )
+            {
+                o->gdbIn = d->endpoint[e].bEndpointAddress;
+            }
+            else if ( _isBulk( &d->endpoint[e], false ) )
+            {
+                o->gdbOut = d->endpoint[e].bEndpointAddress;
+            }
         }
+
+        found = ( o->gdbIn ) && ( o->gdbOut );
     }
 
-    return selection - 1;
+    libusb_free_config_descriptor( config );
+    return found;
 }
 // ====================================================================================================
-bool OrbtraceIfOpenDevice( struct OrbtraceIf *o, int entry )
+static bool _gdbGetc( struct OrbtraceIf *o, char *c )
 
 {
-    if ( ( entry < 0 ) || ( entry >= o->numDevices ) )
+    int n = 0;
+
+    if ( o->gdbRxAt == o->gdbRxLen )
     {
-        return false;
-    }
+        /* A timeout can still have brought something with it */
+        libusb_bulk_transfer( o->handle, o->gdbIn, o->gdbRx, GDB_RX_LEN, &n, GDB_TIMEOUT_MS );
 
-    o->dev = o->list[ o->devices[entry].devIndex];
+        if ( n <= 0 )
+        {
+            return false;
+        }
 
-    if ( libusb_open( o->dev, &o->handle ) )
-    {
-        o->dev = NULL;
-        o->handle = NULL;
-        return false;
+        o->gdbRxAt = 0;
+        o->gdbRxLen = n;
     }
 
-    o->activeDevice = entry;
+    *c = o->gdbRx[o->gdbRxAt++];
     return true;
 }
 // ====================================================================================================
-bool OrbtraceGetIfandEP( struct OrbtraceIf *o )
+static bool _gdbWrite( struct OrbtraceIf *o, const char *d, int len )
 
 {
-    struct libusb_config_descriptor *config;
-    bool interface_found = false;
-    uint8_t altsetting = 0;
-    uint8_t num_altsetting = 0;
-    int32_t err;
+    int n;
 
-    if ( ( !o->dev ) || ( !o->handle ) )
+    return ( !libusb_bulk_transfer( o->handle, o->gdbOut, ( uint8_t * )d, len, &n, GDB_TIMEOUT_MS ) ) && ( n == len );
+}
+// ====================================================================================================
+static bool _gdbPut( struct OrbtraceIf *o, const char *body )
+
+/* Send a packet, and wait for the server to say it got it */
+
+{
+    char p[GDB_MAX_PACKET];
+    uint8_t sum = 0;
+    int len;
+    char c;
+
+    for ( const char *b = body; *b; b++ )
     {
-        return false;
+        sum += *b;
     }
 
-    /* For the BMP case we can quickly return the correct values */
-    switch ( o->devices[o->activeDevice].devtype )
+    len = snprintf( p, GDB_MAX_PACKET, "$%s#%02x", body, sum );
+
+    for ( int tries = 0; tries < GDB_RETRIES; tries++ )
     {
-        default: // -------------------------------------------------------------------------------------
+        if ( !_gdbWrite( o, p, len ) )
+        {
             return false;
+        }
 
-        case DEVICE_BMP: // -----------------------------------------------------------------------------
-            genericsReport( V_DEBUG, "Searching for BMP trace interface" EOL );
-
-            if ( ( err = libusb_get_active_config_descriptor( o->dev, &config ) ) < 0 )
+        do
+        {
+            if ( !_gdbGetc( o, &c ) )
             {
-                genericsReport( V_WARN, "Failed to get config descriptor (%d)" EOL, err );
+                return false;
+            }
+        }
+        while ( ( c != '+' ) && ( c != '-' ) );
+
+        if ( c == '+' )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static int _gdbGet( struct OrbtraceIf *o, char *b )
+
+/* Take a packet from the server (into GDB_MAX_PACKET bytes, and ended with a 0), acknowledging it. */
+/* Returns how long it is, or <0 if there wasn't one.                                             */
+
+{
+    char c, n, cs[3] = { 0 };
+    uint8_t sum;
+    int len;
+
+    for ( int tries = 0; tries < GDB_RETRIES; tries++ )
+    {
+        do
+        {
+            if ( !_gdbGetc( o, &c ) )
+            {
+                return -1;
+            }
+        }
+        while ( c != '$' );
+
+        for ( sum = 0, len = 0; ( _gdbGetc( o, &c ) ) && ( c != '#' ); sum += c )
+        {
+            if ( ( c == '*' ) && ( len ) && ( _gdbGetc( o, &n ) ) )
+            {
+                /* The last character again, this many more times */
+                sum += c;
+                c = n;
+
+                for ( int i = n - GDB_RLE_BIAS; ( i > 0 ) && ( len < GDB_MAX_PACKET - 1 ); i-- )
+                {
+                    b[len] = b[len - 1];
+                    len++;
+                }
+            }
+            else if ( len < GDB_MAX_PACKET - 1 )
+            {
+                b[len++] = c;
+            }
+        }
+
+        if ( ( c != '#' ) || ( !_gdbGetc( o, &cs[0] ) ) || ( !_gdbGetc( o, &cs[1] ) ) )
+        {
+            return -1;
+        }
+
+        b[len] = 0;
+
+        if ( strtoul( cs, NULL, 16 ) == sum )
+        {
+            return ( _gdbWrite( o, "+", 1 ) ) ? len : -1;
+        }
+
+        _gdbWrite( o, "-", 1 );
+    }
+
+    return -1;
+}
+// ====================================================================================================
+static bool _gdbCommand( struct OrbtraceIf *o, const char *cmd, char *rsp, bool stopReply )
+
+/* Send a command and get its reply. Console output on the way is passed over, as is any news of */
+/* the target stopping, unless that's the reply that's wanted.                                   */
+
+{
+    if ( !_gdbPut( o, cmd ) )
+    {
+        return false;
+    }
+
+    while ( _gdbGet( o, rsp ) >= 0 )
+    {
+        bool isStop = ( rsp[0] == 'T' ) || ( rsp[0] == 'S' ) || ( rsp[0] == 'W' ) || ( rsp[0] == 'X' );
+
+        if ( ( ( rsp[0] != 'O' ) || ( !strcmp( rsp, "OK" ) ) ) && ( ( !isStop ) || ( stopReply ) ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static bool _gdbOpen( struct OrbtraceIf *o )
+
+/* Take the GDB server interfaces of the open BMP from the tty driver, and tell the server we're there */
+
+{
+    int err;
+
+    if ( !_findGdbIf( o ) )
+    {
+        genericsReport( V_ERROR, "No GDB server interface on this BMP" EOL );
+        return false;
+    }
+
+    libusb_set_auto_detach_kernel_driver( o->handle, 1 );
+
+    if ( ( ( err = libusb_claim_interface( o->handle, o->gdbComm ) ) < 0 ) ||
+            ( ( err = libusb_claim_interface( o->handle, o->gdbData ) ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Failed to claim BMP GDB server interface (%d), is something else using it?" EOL, err );
+        libusb_release_interface( o->handle, o->gdbComm );
+        return false;
+    }
+
+    o->gdbClaimed = true;
+    o->gdbRxAt = o->gdbRxLen = 0;
+
+    if ( libusb_control_transfer( o->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                                  CDC_SET_LINE_STATE, CDC_DTR_RTS, o->gdbComm, NULL, 0, GDB_TIMEOUT_MS ) < 0 )
+    {
+        genericsReport( V_ERROR, "Couldn't start BMP GDB server session" EOL );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _gdbAttach( struct OrbtraceIf *o )
+
+/* Have the GDB server find the target over SWD and attach to it, then set it going again */
+
+{
+    static const char scan[] = "swdp_scan";
+    char cmd[sizeof( "qRcmd," ) + 2 * sizeof( scan )];
+    char rsp[GDB_MAX_PACKET];
+    char *p = cmd + sprintf( cmd, "qRcmd," );
+
+    for ( const char *c = scan; *c; c++ )
+    {
+        p += sprintf( p, "%02x", ( uint8_t )*c );
+    }
+
+    if ( ( !_gdbCommand( o, cmd, rsp, false ) ) || ( strcmp( rsp, "OK" ) ) )
+    {
+        genericsReport( V_ERROR, "BMP found no target over SWD" EOL );
+        return false;
+    }
+
+    if ( ( !_gdbCommand( o, "vAttach;1", rsp, true ) ) || ( ( rsp[0] != 'T' ) && ( rsp[0] != 'S' ) ) )
+    {
+        genericsReport( V_ERROR, "BMP couldn't attach to target" EOL );
+        return false;
+    }
+
+    o->gdbAttached = true;
+
+    /* Attaching stopped it. There's no reply to this until it stops again, which is passed over if it does */
+    return _gdbPut( o, "c" );
+}
+// ====================================================================================================
+static bool _gdbRead( struct OrbtraceIf *o, uint32_t addr, uint8_t *d, uint32_t len )
+
+{
+    char cmd[32];
+    char rsp[GDB_MAX_PACKET];
+    char hex[3] = { 0 };
+    uint32_t n;
+
+    while ( len )
+    {
+        n = ( len > GDB_READ_MAX ) ? GDB_READ_MAX : len;
+        snprintf( cmd, sizeof( cmd ), "m%x,%x", addr, n );
+
+        if ( ( !_gdbCommand( o, cmd, rsp, false ) ) || ( strlen( rsp ) != 2 * n ) )
+        {
+            return false;
+        }
+
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            if ( ( !isxdigit( ( int )rsp[2 * i] ) ) || ( !isxdigit( ( int )rsp[2 * i + 1] ) ) )
+            {
+                return false;
+            }
+
+            hex[0] = rsp[2 * i];
+            hex[1] = rsp[2 * i + 1];
+            *d++ = strtoul( hex, NULL, 16 );
+        }
+
+        addr += n;
+        len -= n;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _gdbWrite32( struct OrbtraceIf *o, uint32_t addr, uint32_t v )
+
+{
+    char cmd[48];
+    char rsp[GDB_MAX_PACKET];
+
+    snprintf( cmd, sizeof( cmd ), "M%x,4:%02x%02x%02x%02x", addr, v & 0xff, ( v >> 8 ) & 0xff, ( v >> 16 ) & 0xff, v >> 24 );
+    return ( _gdbCommand( o, cmd, rsp, false ) ) && ( !strcmp( rsp, "OK" ) );
+}
+// ====================================================================================================
+static void _gdbClose( struct OrbtraceIf *o )
+
+/* Detach, which leaves the target running, and give the interfaces back to the tty driver */
+
+{
+    char rsp[GDB_MAX_PACKET];
+    char i = GDB_INTERRUPT;
+
+    if ( o->gdbAttached )
+    {
+        /* It has to be stopped to be detached from */
+        if ( _gdbWrite( o, &i, 1 ) )
+        {
+            while ( ( _gdbGet( o, rsp ) >= 0 ) && ( rsp[0] != 'T' ) && ( rsp[0] != 'S' ) )
+            {}
+        }
+
+        _gdbCommand( o, "D", rsp, false );
+        o->gdbAttached = false;
+    }
+
+    if ( o->gdbClaimed )
+    {
+        libusb_control_transfer( o->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                                 CDC_SET_LINE_STATE, 0, o->gdbComm, NULL, 0, GDB_TIMEOUT_MS );
+        libusb_release_interface( o->handle, o->gdbData );
+        libusb_release_interface( o->handle, o->gdbComm );
+        o->gdbClaimed = false;
+    }
+
+    o->gdbIn = o->gdbOut = 0;
+}
+// ====================================================================================================
+static bool _ftdiRequest( struct OrbtraceIf *o, uint8_t request, uint16_t value, uint16_t index )
+
+{
+    int err = libusb_control_transfer( o->handle, FTDI_RQ_OUT, request, value, index | FTDI_CHANNEL_A, NULL, 0, FTDI_TIMEOUT_MS );
+
+    if ( err < 0 )
+    {
+        genericsReport( V_DEBUG, "FTDI request %d failed (%s)" EOL, request, libusb_error_name( err ) );
+    }
+
+    return err >= 0;
+}
+// ====================================================================================================
+static uint32_t _ftdiDivisor( uint32_t speed, uint32_t *actual )
+
+/* The divisor for the H parts' 12MHz baud clock nearest to speed, which is in eighths, coded as  */
+/* the chip wants it, with what speed that actually is. This is how libftdi works it out for them. */
+
+{
+    static const uint8_t fracCode[8] = { 0, 3, 2, 4, 1, 5, 6, 7 };
+    const uint32_t base = FTDI_H_CLK / FTDI_H_CLK_DIV;
+    uint32_t divisor;
+
+    if ( speed >= base )
+    {
+        *actual = base;
+        return FTDI_H_CLK_SEL;
+    }
+
+    if ( speed >= base * 2 / 3 )
+    {
+        *actual = base * 2 / 3;
+        return FTDI_H_CLK_SEL | 1;
+    }
+
+    if ( speed >= base / 2 )
+    {
+        *actual = base / 2;
+        return FTDI_H_CLK_SEL | 2;
+    }
+
+    /* In sixteenths to start with, so it can be rounded to the nearest eighth */
+    divisor = ( ( uint64_t )base * 16 / speed + 1 ) / 2;
+    divisor = ( divisor > 0x1ffff ) ? 0x1ffff : divisor;
+    *actual = ( ( uint64_t )base * 16 / divisor + 1 ) / 2;
+
+    return FTDI_H_CLK_SEL | ( divisor >> 3 ) | ( fracCode[divisor & 7] << 14 );
+}
+// ====================================================================================================
+static int LIBUSB_CALL _deviceArrived( libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *userData )
+
+/* Called from libusb event handling when something is plugged in. Nothing can be opened from in here, */
+/* so just note that it's worth looking again if it's a device we know.                               */
+
+{
+    struct OrbtraceIf *o = ( struct OrbtraceIf * )userData;
+    struct libusb_device_descriptor desc = { 0 };
+    int y;
+
+    libusb_get_device_descriptor( dev, &desc );
+
+    for ( y = 0; ( ( _validDevices[y].vid ) &&
+                   ( ( _validDevices[y].vid != desc.idVendor ) || ( _validDevices[y].pid != desc.idProduct ) ) ); y++ );
+
+    if ( _validDevices[y].vid )
+    {
+        o->arrived = true;
+    }
+
+    /* Keep the registration */
+    return 0;
+}
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+int OrbtraceIfValidateVoltage( struct OrbtraceIf *o, int vmv )
+
+/* Return matching voltage or zero if none can be found */
+
+{
+    return ( ( vmv >= MIN_GENERIC_VOLTAGE_MV ) && ( vmv <= ( MAX_GENERIC_VOLTAGE_MV + MAX_VOLTAGE_DIFF_MV ) ) ) ? vmv : 0;
+}
+// ====================================================================================================
+struct OrbtraceIf *OrbtraceIfCreateContext( void )
+
+{
+    struct OrbtraceIf *o = ( struct OrbtraceIf * )calloc( 1, sizeof( struct OrbtraceIf ) );
+
+    if ( libusb_init( &o->context ) < 0 )
+    {
+        free( o );
+        return NULL;
+    }
+    else
+    {
+        //        libusb_set_debug(o->context, LIBUSB_LOG_LEVEL_DEBUG);
+        return o;
+    }
+}
+// ====================================================================================================
+struct OrbtraceIf *OrbtraceIfCreateSharedContext( libusb_context *context )
+
+/* Create a context that works through a libusb context owned (and event-handled) by the caller */
+
+{
+    struct OrbtraceIf *o = ( struct OrbtraceIf * )calloc( 1, sizeof( struct OrbtraceIf ) );
+
+    if ( o )
+    {
+        o->context = context;
+        o->sharedContext = true;
+    }
+
+    return o;
+}
+
+// ====================================================================================================
+struct OrbtraceIf *OrbtraceIfCreateDeviceContext( struct OrbtraceIf *o, int entry )
+
+/* A context for just one of the devices o found, opened and active. It leans on o for its libusb */
+/* context and the device record, so o has to outlast it and mustn't look for devices again, but  */
+/* each one found can be worked on from a thread of its own like this. Close then free it.        */
+
+{
+    struct OrbtraceIf *d;
+
+    if ( ( entry < 0 ) || ( entry >= o->numDevices ) || ( !( d = OrbtraceIfCreateSharedContext( o->context ) ) ) )
+    {
+        return NULL;
+    }
+
+    d->devices = &o->devices[entry];
+    d->numDevices = 1;
+    d->activeDevice = 0;
+    d->dev = o->list[o->devices[entry].devIndex];
+
+    if ( libusb_open( d->dev, &d->handle ) )
+    {
+        free( d );
+        return NULL;
+    }
+
+    return d;
+}
+// ====================================================================================================
+void OrbtraceIfDestroyContext( struct OrbtraceIf *o )
+
+{
+    if ( ( o ) && ( o->hotplugging ) )
+    {
+        libusb_hotplug_deregister_callback( o->context, o->hotplug );
+        o->hotplugging = false;
+    }
+
+    if ( ( o ) && ( !o->sharedContext ) )
+    {
+        libusb_exit( o->context );
+    }
+}
+// ====================================================================================================
+bool OrbtraceIfWatchArrivals( struct OrbtraceIf *o )
+
+/* Ask to hear when devices are plugged in, so OrbtraceIfWaitForArrival can return as soon as one is */
+
+{
+    if ( !o->hotplugging )
+    {
+        o->hotplugging = libusb_has_capability( LIBUSB_CAP_HAS_HOTPLUG ) &&
+                         ( LIBUSB_SUCCESS == libusb_hotplug_register_callback( o->context, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_NO_FLAGS,
+                                 LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                 _deviceArrived, o, &o->hotplug ) );
+    }
+
+    return o->hotplugging;
+}
+// ====================================================================================================
+bool OrbtraceIfWaitForArrival( struct OrbtraceIf *o, unsigned int uS )
+
+/* Wait up to uS for a device we know to be plugged in, returning true if one was. Without hotplug */
+/* support this just waits, and it's up to the caller to look again anyway.                        */
+
+{
+    if ( !o->hotplugging )
+    {
+        usleep( uS );
+        return false;
+    }
+
+    if ( o->sharedContext )
+    {
+        /* Someone else is handling the events, so the callback will happen on their thread */
+        for ( unsigned int w = 0; ( w < uS ) && ( !o->arrived ); w += MIN_ARRIVAL_POLL_US )
+        {
+            usleep( MIN_ARRIVAL_POLL_US );
+        }
+    }
+    else if ( !o->arrived )
+    {
+        struct timeval tv = { .tv_sec = uS / 1000000, .tv_usec = uS % 1000000 };
+        libusb_handle_events_timeout_completed( o->context, &tv, &o->arrived );
+    }
+
+    if ( o->arrived )
+    {
+        o->arrived = false;
+        return true;
+    }
+
+    return false;
+}
+// ====================================================================================================
+int OrbtraceIfGetDeviceList( struct OrbtraceIf *o, char *sn, uint32_t devmask )
+
+/* Get list of devices that match (partial) serial number & devmask */
+
+{
+    char tfrString[MAX_USB_DESC_LEN];
+    struct OrbtraceIfDevice *d;
+    enum ORBTraceDevice devtype;
+    int versionIndex;
+    size_t y;
+
+    assert( o );
+
+    /* Close any active device */
+    OrbtraceIfCloseDevice( o );
+
+    /* Flush out any old scans we might be holding */
+    _flushDeviceList( o );
+
+    if ( o->list )
+    {
+        libusb_free_device_list( o->list, true );
+    }
+
+    int count = libusb_get_device_list( o->context, &o->list );
+
+    for ( size_t i = 0; i < count; i++ )
+    {
+        o->dev = o->list[i];
+        struct libusb_device_descriptor desc = { 0 };
+        libusb_get_device_descriptor( o->dev, &desc );
+
+        /* Loop through known devices to see if this one is one we recognise */
+        for ( y = 0; ( ( _validDevices[y].vid ) &&
+                       ( ( _validDevices[y].vid != desc.idVendor ) || ( _validDevices[y].pid != desc.idProduct ) ) ); y++ );
+
+        /* ...or if it could be a CMSIS-DAP, which we'll only know for sure once it's open */
+        if ( _validDevices[y].vid )
+        {
+            devtype = _validDevices[y].devtype;
+        }
+        else
+        {
+            devtype = ( ( devmask & DEVTYPE( DEVICE_CMSIS_DAP ) ) && ( _findDapIf( o->dev, NULL, NULL, false ) ) ) ? DEVICE_CMSIS_DAP : DEVICE_NULL;
+        }
+
+        /* If it's one we're interested in then process further */
+        if ( devtype != DEVICE_NULL )
+        {
+            /* We'll store this match for access later */
+            o->devices = realloc( o->devices, ( o->numDevices + 1 ) * sizeof( struct OrbtraceIfDevice ) );
+            d = &o->devices[o->numDevices];
+            memset( d, 0, sizeof( struct OrbtraceIfDevice ) );
+            d->devtype = devtype;
+
+            if ( !libusb_open( o->list[i], &o->handle ) )
+            {
+                if ( desc.iSerialNumber )
+                {
+                    libusb_get_string_descriptor_ascii( o->handle, desc.iSerialNumber, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
+                }
+
+                /* This is a match if no S/N match was requested or if there is a S/N and they part-match, and it's a matching devtype */
+                if ( ( devmask & ( 1 << d->devtype ) ) && ( ( !sn ) || ( ( desc.iSerialNumber ) && ( strstr( tfrString, sn ) ) ) ) &&
+                        ( ( d->devtype != DEVICE_CMSIS_DAP ) || ( _findDapIf( o->dev, o->handle, NULL, false ) ) ) )
+                {
+                    /* We will keep this one! */
+                    o->numDevices++;
+                    d->sn = strdup( desc.iSerialNumber ? tfrString : "" );
+
+                    if ( desc.iManufacturer )
+                    {
+                        libusb_get_string_descriptor_ascii( o->handle, desc.iManufacturer, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
+                    }
+
+                    d->manufacturer = strdup( desc.iManufacturer ? tfrString : "" );
+
+                    if ( desc.iProduct )
+                    {
+                        libusb_get_string_descriptor_ascii( o->handle, desc.iProduct, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
+                    }
+
+                    d->product = strdup( desc.iProduct ? tfrString : "" );
+                    d->devIndex = i;
+
+                    switch ( d->devtype )
+                    {
+                        case DEVICE_ORBTRACE_MINI:
+                            d->powerIf = _getInterface( o, 'P', NULL );
+                            d->traceIf = _getInterface( o, 'T', NULL );
+
+                            /* Collect the probe version from the version interface */
+                            d->versionIf = _getInterface( o, 'V', &versionIndex );
+
+                            if ( versionIndex )
+                            {
+                                libusb_get_string_descriptor_ascii( o->handle, versionIndex, ( unsigned char * )tfrString, MAX_USB_DESC_LEN );
+                                /* If string contains 'Version: ' at the start then remove it */
+                                d->version = strdup( ( strstr( tfrString, VERSION_FRONTMATTER ) ) ? &tfrString[strlen( VERSION_FRONTMATTER )] : "" );
+                            }
+                            else
+                            {
+                                d->version = strdup( "" );
+                            }
+
+                            break;
+
+                        case DEVICE_BMP:
+                            /* On BMP version and serial are merged, so let's unmerge them by making the last word of the product the version */
+                            d->version = &d->product[strlen( d->product ) - 1];
+
+                            while ( ( !isspace( *d->version ) ) && ( d->version != d->product ) )
+                            {
+                                d->version--;
+                            }
+
+                            *d->version++ = 0;
+                            break;
+
+                        default:
+                            break;
+                    }
+                }
+
+                libusb_close( o->handle );
+                o->handle = NULL;
+            }
+        }
+    }
+
+    /* Now sort matching devices into defined order, so they're always the same way up */
+    qsort( o->devices, o->numDevices, sizeof( struct OrbtraceIfDevice ), _compareFunc );
+
+    return o->numDevices;
+}
+// ====================================================================================================
+void OrbtraceIfListDevices( struct OrbtraceIf *o )
+
+{
+    char printConstruct[SCRATCH_STRINGLEN];
+
+    /* Get longest line */
+    genericsPrintf( C_RESET " Id |                    Description                    |      Serial      |           Version" EOL );
+    genericsPrintf( " ---+---------------------------------------------------+------------------+----------------------------" EOL );
+
+    for ( int i = 0; i < o->numDevices; i++ )
+    {
+        snprintf( printConstruct, MAX_DESC_FIELDLEN, "%s %s", OrbtraceIfGetManufacturer( o, i ), OrbtraceIfGetProduct( o, i ) ) ;
+        genericsPrintf( C_SEL " %2d " C_RESET "|"C_ELEMENT" %-49s "C_RESET"|"C_ELEMENT" %16s "C_RESET"|"C_ELEMENT" %s" C_RESET EOL,
+                        i + 1, printConstruct, OrbtraceIfGetSN( o, i ), OrbtraceIfGetVersion( o, i ) );
+    }
+}
+
+// ====================================================================================================
+int OrbtraceIfSelectDevice( struct OrbtraceIf *o )
+
+{
+    int selection = o->numDevices;
+
+    if ( o->numDevices > 1 )
+    {
+        OrbtraceIfListDevices( o );
+
+        selection = 0;
+
+        while ( ( selection < 1 ) || ( selection > o->numDevices ) )
+        {
+            genericsPrintf( EOL C_SEL "Selection>" C_RESET );
+            scanf( "%d", &selection );
+        }
+    }
+
+    return selection - 1;
+}
+// ====================================================================================================
+#if defined( HANDOVER_USB )
+static bool _isDeviceFd( libusb_device *d, int fd )
+
+/* Is fd the usbfs node for d? */
+
+{
+    char link[32];
+    char n[64];
+    char want[32];
+    ssize_t l;
+
+    snprintf( link, sizeof( link ), "/proc/self/fd/%d", fd );
+
+    if ( ( l = readlink( link, n, sizeof( n ) - 1 ) ) < 0 )
+    {
+        return false;
+    }
+
+    n[l] = 0;
+    snprintf( want, sizeof( want ), "/dev/bus/usb/%03d/%03d", libusb_get_bus_number( d ), libusb_get_device_address( d ) );
+    return !strcmp( n, want );
+}
+#endif
+// ====================================================================================================
+int OrbtraceIfDeviceFd( struct OrbtraceIf *o )
+
+{
+#if defined( HANDOVER_USB )
+    struct dirent *e;
+    int fd = -1;
+    DIR *d;
+
+    /* libusb doesn't say which descriptor a device is open on, but it's the one onto its usbfs node */
+    if ( ( !o->dev ) || ( !o->handle ) || ( !( d = opendir( "/proc/self/fd" ) ) ) )
+    {
+        return -1;
+    }
+
+    while ( ( fd < 0 ) && ( e = readdir( d ) ) )
+    {
+        if ( ( isdigit( e->d_name[0] ) ) && ( _isDeviceFd( o->dev, atoi( e->d_name ) ) ) )
+        {
+            fd = atoi( e->d_name );
+        }
+    }
+
+    closedir( d );
+    return fd;
+#else
+    return -1;
+#endif
+}
+// ====================================================================================================
+void OrbtraceIfInheritDevice( struct OrbtraceIf *o, int fd )
+
+{
+    o->inheritedFd = fd;
+    o->inherited = true;
+}
+// ====================================================================================================
+bool OrbtraceIfOpenDevice( struct OrbtraceIf *o, int entry )
+
+{
+    if ( ( entry < 0 ) || ( entry >= o->numDevices ) )
+    {
+        return false;
+    }
+
+    o->dev = o->list[ o->devices[entry].devIndex];
+
+    if ( o->inherited )
+    {
+        o->inherited = false;
+#if defined( HANDOVER_USB )
+
+        /* Carry on with the device as it was handed over, its interfaces still claimed, if this is it */
+        if ( ( _isDeviceFd( o->dev, o->inheritedFd ) ) && ( !libusb_wrap_sys_device( o->context, o->inheritedFd, &o->handle ) ) )
+        {
+            o->dev = libusb_get_device( o->handle );
+            o->activeDevice = entry;
+            return true;
+        }
+
+#endif
+        genericsReport( V_INFO, "Device handed over couldn't be taken on, opening it again" EOL );
+        close( o->inheritedFd );
+    }
+
+    if ( libusb_open( o->dev, &o->handle ) )
+    {
+        o->dev = NULL;
+        o->handle = NULL;
+        return false;
+    }
+
+    o->activeDevice = entry;
+    return true;
+}
+// ====================================================================================================
+bool OrbtraceGetIfandEP( struct OrbtraceIf *o )
+
+{
+    struct libusb_config_descriptor *config;
+    bool interface_found = false;
+    uint8_t altsetting = 0;
+    uint8_t num_altsetting = 0;
+    int32_t err;
+
+    if ( ( !o->dev ) || ( !o->handle ) )
+    {
+        return false;
+    }
+
+    /* For the BMP case we can quickly return the correct values */
+    switch ( o->devices[o->activeDevice].devtype )
+    {
+        default: // -------------------------------------------------------------------------------------
+            return false;
+
+        case DEVICE_BMP: // -----------------------------------------------------------------------------
+            genericsReport( V_DEBUG, "Searching for BMP trace interface" EOL );
+
+            if ( ( err = libusb_get_active_config_descriptor( o->dev, &config ) ) < 0 )
+            {
+                genericsReport( V_WARN, "Failed to get config descriptor (%d)" EOL, err );
                 return false;
             }
 
@@ -562,24 +1480,77 @@ bool OrbtraceGetIfandEP( struct OrbtraceIf *o )
                     o->iface = i->bInterfaceNumber;
                     o->ep = i->endpoint[0].bEndpointAddress;
 
-                    altsetting = i->bAlternateSetting;
-                    num_altsetting = config->interface[if_num].num_altsetting;
-                    o->supportsOFLOW = ( i->bInterfaceProtocol == PROT_OFLOWV1_0 );
+                    altsetting = i->bAlternateSetting;
+                    num_altsetting = config->interface[if_num].num_altsetting;
+                    o->supportsOFLOW = ( i->bInterfaceProtocol == PROT_OFLOWV1_0 );
+
+                    genericsReport( V_DEBUG, "Found interface %#x with altsetting %#x and ep %#x" EOL, o->iface, altsetting, o->ep );
+                    interface_found = true;
+                }
+            }
+
+            libusb_free_config_descriptor( config );
+
+            if ( !interface_found )
+            {
+                genericsReport( V_DEBUG, "No supported interfaces found" EOL );
+                return false;
+            }
+
+            o->isOrbtrace = true;
+            break;
+
+        case DEVICE_FTDI: // ----------------------------------------------------------------------------
+            genericsReport( V_DEBUG, "Searching for FTDI channel A" EOL );
+
+            if ( ( err = libusb_get_active_config_descriptor( o->dev, &config ) ) < 0 )
+            {
+                genericsReport( V_WARN, "Failed to get config descriptor (%d)" EOL, err );
+                return false;
+            }
+
+            /* Channel A is the first interface, with its data in on the first endpoint that's an IN */
+            if ( config->bNumInterfaces )
+            {
+                const struct libusb_interface_descriptor *i = &config->interface[0].altsetting[0];
 
-                    genericsReport( V_DEBUG, "Found interface %#x with altsetting %#x and ep %#x" EOL, o->iface, altsetting, o->ep );
-                    interface_found = true;
+                for ( int e = 0; ( e < i->bNumEndpoints ) && ( !interface_found ); e++ )
+                {
+                    if ( _isBulk( &i->endpoint[e], true ) )
+                    {
+                        o->iface = i->bInterfaceNumber;
+                        o->ep = i->endpoint[e].bEndpointAddress;
+                        o->ftdiPacket = i->endpoint[e].wMaxPacketSize;
+                        interface_found = true;
+                    }
                 }
             }
 
             libusb_free_config_descriptor( config );
 
-            if ( !interface_found )
+            if ( ( !interface_found ) || ( o->ftdiPacket <= FTDI_STATUS_LEN ) )
             {
-                genericsReport( V_DEBUG, "No supported interfaces found" EOL );
+                genericsReport( V_DEBUG, "No FTDI data endpoint found" EOL );
+                o->ftdiPacket = 0;
                 return false;
             }
 
-            o->isOrbtrace = true;
+            genericsReport( V_DEBUG, "Found interface %#x with ep %#x, %d byte packets" EOL, o->iface, o->ep, o->ftdiPacket );
+
+            /* It's normally a tty, so the kernel has to let go of it for now */
+            libusb_set_auto_detach_kernel_driver( o->handle, 1 );
+            break;
+
+        case DEVICE_CMSIS_DAP: // -----------------------------------------------------------------------
+            genericsReport( V_DEBUG, "Searching for CMSIS-DAP SWO interface" EOL );
+
+            if ( !_findDapIf( o->dev, o->handle, o, true ) )
+            {
+                genericsReport( V_DEBUG, "No CMSIS-DAP SWO interface found" EOL );
+                return false;
+            }
+
+            genericsReport( V_DEBUG, "Found interface %#x with SWO ep %#x" EOL, o->iface, o->ep );
             break;
     }
 
@@ -608,7 +1579,7 @@ bool OrbtraceIsOrbtrace( struct OrbtraceIf *o )
 
 // ====================================================================================================
 
-bool OrbtraceIfSetupTransfers( struct OrbtraceIf *o, bool hiresTime, struct dataBlock *d, int numBlocks, libusb_transfer_cb_fn callback )
+bool OrbtraceIfSetupTransfers( struct OrbtraceIf *o, bool hiresTime, struct dataBlock *d, int numBlocks, libusb_transfer_cb_fn callback, void *userData )
 
 {
     assert( !o->numBlocks );
@@ -629,7 +1600,7 @@ bool OrbtraceIfSetupTransfers( struct OrbtraceIf *o, bool hiresTime, struct data
                                     o->d[t].buffer,
                                     USB_TRANSFER_SIZE,
                                     callback,
-                                    &o->d[t].usbtfr,
+                                    userData,
                                     hiresTime ? 1 : 100 /* Use 1ms timeout if hires mode, otherwise 100ms */
                                   );
 
@@ -653,19 +1624,28 @@ int OrbtraceIfHandleEvents( struct OrbtraceIf *o )
 
 // ====================================================================================================
 
+int OrbtraceIfHandleEventsTimeout( struct OrbtraceIf *o, unsigned int uS )
+
+{
+    struct timeval tv = { .tv_sec = uS / 1000000, .tv_usec = uS % 1000000 };
+
+    return libusb_handle_events_timeout_completed( o->context, &tv, NULL );
+}
+
+// ====================================================================================================
+
 void OrbtraceIfCloseTransfers( struct OrbtraceIf *o )
 
+/* Stop the transfers. They stay allocated in the datablocks, and get used again by the next */
+/* OrbtraceIfSetupTransfers, once their cancellations have been handled.                     */
+
 {
     for ( uint32_t t = 0; t < o->numBlocks; t++ )
     {
         if ( o->d[t].usbtfr )
         {
             libusb_cancel_transfer( o->d[t].usbtfr );
-            libusb_free_transfer( o->d[t].usbtfr );
-            o->d[t].usbtfr = 0;
         }
-
-        o->d[t].usbtfr = NULL;
     }
 
     o->d = NULL;
@@ -674,6 +1654,35 @@ void OrbtraceIfCloseTransfers( struct OrbtraceIf *o )
 
 // ====================================================================================================
 
+void OrbtraceIfFreeTransfers( struct dataBlock *d, int numBlocks )
+
+/* Finally free the transfers, which must all have come back by now */
+
+{
+    for ( int t = 0; t < numBlocks; t++ )
+    {
+        if ( d[t].usbtfr )
+        {
+            libusb_free_transfer( d[t].usbtfr );
+            d[t].usbtfr = NULL;
+        }
+    }
+}
+
+// ====================================================================================================
+
+int OrbtraceIfRead( struct OrbtraceIf *o, uint8_t *d, int len, unsigned int timeoutmS )
+
+/* For a quick look at the trace without setting up transfers. Timing out with nothing isn't an error */
+
+{
+    int n = 0;
+    int err = libusb_bulk_transfer( o->handle, o->ep, d, len, &n, timeoutmS );
+
+    return ( ( err ) && ( err != LIBUSB_ERROR_TIMEOUT ) ) ? err : n;
+}
+// ====================================================================================================
+
 bool OrbtraceIfSetTraceWidth( struct OrbtraceIf *o, int width )
 
 {
@@ -725,6 +1734,382 @@ bool OrbtraceIfSetSWOBaudrate( struct OrbtraceIf *o, uint32_t speed )
            );
 }
 // ====================================================================================================
+bool OrbtraceIfStartDapSWO( struct OrbtraceIf *o, uint32_t speed )
+
+/* Have a CMSIS-DAP probe, whose interface has been claimed, stream UART SWO at speed out of */
+/* its trace endpoint. It's left running until the device is closed.                         */
+
+{
+    uint8_t cmd[5] = { DAP_INFO, DAP_INFO_CAPS };
+    uint8_t rsp[5];
+    uint32_t actual;
+
+    if ( !_dapCommand( o, cmd, 2, rsp, 3 ) )
+    {
+        genericsReport( V_ERROR, "No response from CMSIS-DAP probe" EOL );
+        return false;
+    }
+
+    if ( ( !rsp[1] ) || ( ( rsp[2] & ( DAP_CAP_SWO_UART | DAP_CAP_SWO_STREAM ) ) != ( DAP_CAP_SWO_UART | DAP_CAP_SWO_STREAM ) ) )
+    {
+        genericsReport( V_ERROR, "CMSIS-DAP probe can't stream UART SWO" EOL );
+        return false;
+    }
+
+    /* It may still be running from someone else, and won't change settings like that */
+    _dapSet( o, DAP_SWO_CONTROL, 0 );
+
+    if ( ( !_dapSet( o, DAP_SWO_TRANSPORT, DAP_TRANSPORT_EP ) ) || ( !_dapSet( o, DAP_SWO_MODE, DAP_MODE_UART ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't set CMSIS-DAP SWO transport and mode" EOL );
+        return false;
+    }
+
+    cmd[0] = DAP_SWO_BAUDRATE;
+    cmd[1] = speed & 0xff;
+    cmd[2] = ( speed >> 8 ) & 0xff;
+    cmd[3] = ( speed >> 16 ) & 0xff;
+    cmd[4] = ( speed >> 24 ) & 0xff;
+
+    if ( !_dapCommand( o, cmd, 5, rsp, 5 ) )
+    {
+        genericsReport( V_ERROR, "Couldn't set CMSIS-DAP SWO speed" EOL );
+        return false;
+    }
+
+    /* The probe says what it could actually manage, with 0 if that's nothing like it */
+    actual = rsp[1] | ( rsp[2] << 8 ) | ( rsp[3] << 16 ) | ( ( uint32_t )rsp[4] << 24 );
+
+    if ( !actual )
+    {
+        genericsReport( V_ERROR, "CMSIS-DAP probe can't do SWO at %u baud" EOL, speed );
+        return false;
+    }
+
+    if ( actual != speed )
+    {
+        genericsReport( V_WARN, "CMSIS-DAP SWO running at %u baud rather than %u" EOL, actual, speed );
+    }
+
+    if ( !_dapSet( o, DAP_SWO_CONTROL, 1 ) )
+    {
+        genericsReport( V_ERROR, "Couldn't start CMSIS-DAP SWO" EOL );
+        return false;
+    }
+
+    o->dapSWO = true;
+    return true;
+}
+// ====================================================================================================
+bool OrbtraceIfOpenDap( struct OrbtraceIf *o )
+
+/* Get the CMSIS-DAP command interface of the open device, which a CMSIS-DAP probe taking SWO */
+/* will have already, so the target can be got at over SWD.                                  */
+
+{
+    int err;
+
+    if ( o->dapOut )
+    {
+        return true;
+    }
+
+    if ( !_findDapIf( o->dev, o->handle, o, false ) )
+    {
+        genericsReport( V_ERROR, "No CMSIS-DAP interface on this probe" EOL );
+        return false;
+    }
+
+    if ( ( err = libusb_claim_interface( o->handle, o->dapIface ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Failed to claim CMSIS-DAP interface (%d)" EOL, err );
+        o->dapOut = o->dapIn = 0;
+        return false;
+    }
+
+    o->dapClaimed = true;
+    return true;
+}
+// ====================================================================================================
+bool OrbtraceIfDapAttach( struct OrbtraceIf *o, uint32_t clockHz )
+
+/* Connect to the target over SWD at clockHz, power up its debug, and set the MEM-AP for word accesses */
+
+{
+    static const uint8_t lineReset[7] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    static const uint8_t jtagToSwd[2] = { 0x9e, 0xe7 };
+    static const uint8_t idle[1] = { 0 };
+    uint8_t cmd[8], rsp[4];
+    uint8_t req;
+    uint32_t v;
+    int tries;
+
+    /* Commands and responses both have to fit in one of the probe's packets */
+    cmd[0] = DAP_INFO;
+    cmd[1] = DAP_INFO_PACKET;
+    o->dapPacket = ( ( _dapCommand( o, cmd, 2, rsp, 4 ) ) && ( rsp[1] == 2 ) ) ? rsp[2] | ( rsp[3] << 8 ) : 64;
+    o->dapPacket = ( o->dapPacket > DAP_MAX_PACKET ) ? DAP_MAX_PACKET : o->dapPacket;
+
+    cmd[0] = DAP_CONNECT;
+    cmd[1] = DAP_PORT_SWD;
+
+    if ( ( !_dapCommand( o, cmd, 2, rsp, 2 ) ) || ( rsp[1] != DAP_PORT_SWD ) )
+    {
+        genericsReport( V_ERROR, "CMSIS-DAP probe can't do SWD" EOL );
+        return false;
+    }
+
+    o->dapAttached = true;
+    cmd[0] = DAP_SWJ_CLOCK;
+    _put32( &cmd[1], clockHz );
+
+    if ( ( !_dapCommand( o, cmd, 5, rsp, 2 ) ) || ( rsp[1] != DAP_OK ) )
+    {
+        genericsReport( V_ERROR, "Couldn't set SWD clock to %u Hz" EOL, clockHz );
+        return false;
+    }
+
+    cmd[0] = DAP_XFER_CONFIGURE;
+    cmd[1] = 0;
+    cmd[2] = DAP_WAIT_RETRY & 0xff;
+    cmd[3] = DAP_WAIT_RETRY >> 8;
+    cmd[4] = cmd[5] = 0;
+
+    if ( ( !_dapCommand( o, cmd, 6, rsp, 2 ) ) || ( rsp[1] != DAP_OK ) || ( !_dapSet( o, DAP_SWD_CONFIGURE, 0 ) ) ||
+            ( !_dapSequence( o, 51, lineReset ) ) || ( !_dapSequence( o, 16, jtagToSwd ) ) ||
+            ( !_dapSequence( o, 51, lineReset ) ) || ( !_dapSequence( o, 8, idle ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't set up SWD" EOL );
+        return false;
+    }
+
+    /* Reading IDCODE is what takes the DP out of reset */
+    req = DAP_RD | DP_IDCODE;
+
+    if ( !_dapTransfer( o, &req, NULL, 1, &v ) )
+    {
+        genericsReport( V_ERROR, "No response from target over SWD" EOL );
+        return false;
+    }
+
+    genericsReport( V_INFO, "SWD target IDCODE %08x" EOL, v );
+
+    {
+        const uint8_t up[3] = { DP_ABORT, DP_SELECT, DP_CTRL_STAT };
+        const uint32_t upv[3] = { DP_ABORT_CLEAR, 0, DP_PWRUP_REQ };
+
+        if ( !_dapTransfer( o, up, upv, 3, NULL ) )
+        {
+            genericsReport( V_ERROR, "Couldn't power up target debug" EOL );
+            return false;
+        }
+    }
+
+    req = DAP_RD | DP_CTRL_STAT;
+    v = 0;
+
+    for ( tries = 0; ( tries < 100 ) && ( _dapTransfer( o, &req, NULL, 1, &v ) ) && ( ( v & DP_PWRUP_ACK ) != DP_PWRUP_ACK ); tries++ )
+    {
+        usleep( 1000 );
+    }
+
+    if ( ( v & DP_PWRUP_ACK ) != DP_PWRUP_ACK )
+    {
+        genericsReport( V_ERROR, "Target debug didn't power up" EOL );
+        return false;
+    }
+
+    req = DAP_AP | AP_CSW;
+    v = AP_CSW_WORD_INC;
+
+    if ( !_dapTransfer( o, &req, &v, 1, NULL ) )
+    {
+        genericsReport( V_ERROR, "Couldn't set up target memory access" EOL );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+bool OrbtraceIfDapRead( struct OrbtraceIf *o, uint32_t addr, uint8_t *d, uint32_t len )
+
+/* Read target memory, which can be at any alignment. TAR is set and as many words read as will fit */
+/* in a packet, all in the one command; so one round trip for each, and no more than a 1K span each. */
+
+{
+    uint8_t req[DAP_XFER_MAX];
+    uint32_t w[DAP_XFER_MAX];
+    uint32_t at = addr & ~3;
+    uint32_t end = addr + len;
+    int most = ( o->dapPacket - 3 ) / 4;
+
+    most = ( most > DAP_XFER_MAX - 1 ) ? DAP_XFER_MAX - 1 : most;
+    req[0] = DAP_AP | AP_TAR;
+    memset( &req[1], DAP_AP | DAP_RD | AP_DRW, most );
+
+    while ( at < end )
+    {
+        int n = ( ( end - at + 3 ) / 4 < ( uint32_t )most ) ? ( end - at + 3 ) / 4 : most;
+
+        if ( n > ( int )( ( ( at | ( TAR_WRAP - 1 ) ) + 1 - at ) / 4 ) )
+        {
+            n = ( ( at | ( TAR_WRAP - 1 ) ) + 1 - at ) / 4;
+        }
+
+        if ( !_dapTransfer( o, req, &at, n + 1, w ) )
+        {
+            return false;
+        }
+
+        for ( int i = 0; i < n * 4; i++, at++ )
+        {
+            if ( ( at >= addr ) && ( at < end ) )
+            {
+                *d++ = w[i / 4] >> ( ( i & 3 ) * 8 );
+            }
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+bool OrbtraceIfDapWrite32( struct OrbtraceIf *o, uint32_t addr, uint32_t v )
+
+{
+    const uint8_t req[2] = { DAP_AP | AP_TAR, DAP_AP | AP_DRW };
+    const uint32_t w[2] = { addr, v };
+
+    return _dapTransfer( o, req, w, 2, NULL );
+}
+// ====================================================================================================
+bool OrbtraceIfTargetAttach( struct OrbtraceIf *o, uint32_t clockHz )
+
+/* Get at target memory over SWD. A BMP looks after SWD itself, so the clock is down to it there */
+
+{
+    if ( o->devices[o->activeDevice].devtype == DEVICE_BMP )
+    {
+        return ( _gdbOpen( o ) ) && ( _gdbAttach( o ) );
+    }
+
+    return ( OrbtraceIfOpenDap( o ) ) && ( OrbtraceIfDapAttach( o, clockHz ) );
+}
+// ====================================================================================================
+bool OrbtraceIfTargetRead( struct OrbtraceIf *o, uint32_t addr, uint8_t *d, uint32_t len )
+
+{
+    return ( o->gdbAttached ) ? _gdbRead( o, addr, d, len ) : OrbtraceIfDapRead( o, addr, d, len );
+}
+// ====================================================================================================
+bool OrbtraceIfTargetWrite32( struct OrbtraceIf *o, uint32_t addr, uint32_t v )
+
+{
+    return ( o->gdbAttached ) ? _gdbWrite32( o, addr, v ) : OrbtraceIfDapWrite32( o, addr, v );
+}
+// ====================================================================================================
+void OrbtraceIfTargetDetach( struct OrbtraceIf *o )
+
+/* Let go of the target, leaving it running, and of whatever interface was claimed to get at it */
+
+{
+    if ( !o->handle )
+    {
+        return;
+    }
+
+    _gdbClose( o );
+
+    if ( o->dapAttached )
+    {
+        uint8_t cmd[1] = { DAP_DISCONNECT };
+        uint8_t rsp[2];
+
+        _dapCommand( o, cmd, 1, rsp, 2 );
+        o->dapAttached = false;
+    }
+
+    if ( o->dapClaimed )
+    {
+        /* ...which it was just for this, rather than for SWO too */
+        libusb_release_interface( o->handle, o->dapIface );
+        o->dapClaimed = false;
+        o->dapOut = o->dapIn = 0;
+    }
+}
+// ====================================================================================================
+bool OrbtraceIfStartFTDI( struct OrbtraceIf *o, uint32_t speed )
+
+/* Run the claimed FTDI channel as an 8N1 UART at speed, or as a synchronous 245 FIFO (for hardware */
+/* that's doing the decoding itself) if speed is 0. Either way it's read through the usual transfers. */
+
+{
+    uint32_t actual;
+    uint32_t divisor;
+
+    if ( ( !_ftdiRequest( o, FTDI_RESET, FTDI_RESET_SIO, 0 ) ) ||
+            ( !_ftdiRequest( o, FTDI_SET_LATENCY, FTDI_LATENCY_MS, 0 ) ) ||
+            ( !_ftdiRequest( o, FTDI_SET_BITMODE, ( FTDI_MODE_RESET << 8 ) | 0xff, 0 ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't reset FTDI device" EOL );
+        return false;
+    }
+
+    if ( !speed )
+    {
+        /* The FIFO's own handshake holds the sender off when we aren't keeping up */
+        if ( ( !_ftdiRequest( o, FTDI_SET_BITMODE, ( FTDI_MODE_SYNCFF << 8 ) | 0xff, 0 ) ) ||
+                ( !_ftdiRequest( o, FTDI_SET_FLOW, 0, FTDI_FLOW_RTS_CTS ) ) )
+        {
+            genericsReport( V_ERROR, "Couldn't put FTDI device into synchronous FIFO mode" EOL );
+            return false;
+        }
+    }
+    else
+    {
+        divisor = _ftdiDivisor( speed, &actual );
+
+        if ( ( !_ftdiRequest( o, FTDI_SET_BAUD, divisor & 0xffff, ( divisor >> 8 ) & 0xff00 ) ) ||
+                ( !_ftdiRequest( o, FTDI_SET_DATA, FTDI_DATA_8N1, 0 ) ) ||
+                ( !_ftdiRequest( o, FTDI_SET_FLOW, 0, 0 ) ) )
+        {
+            genericsReport( V_ERROR, "Couldn't set FTDI UART to %u baud" EOL, speed );
+            return false;
+        }
+
+        /* Within 3% is as good as the UART needs, further out and what arrives will be junk */
+        if ( ( actual > speed + speed / 33 ) || ( actual < speed - speed / 33 ) )
+        {
+            genericsReport( V_WARN, "FTDI UART running at %u baud rather than %u" EOL, actual, speed );
+        }
+    }
+
+    /* Anything already received is from before we were set up */
+    return _ftdiRequest( o, FTDI_RESET, FTDI_PURGE_RX, 0 );
+}
+// ====================================================================================================
+size_t OrbtraceIfFTDIPayload( struct OrbtraceIf *o, uint8_t *d, size_t len )
+
+/* Every packet in the transfer begins with two status bytes, close them up out of the data */
+
+{
+    size_t in = 0, out = 0, n;
+
+    while ( in < len )
+    {
+        n = ( len - in < o->ftdiPacket ) ? len - in : o->ftdiPacket;
+
+        if ( n > FTDI_STATUS_LEN )
+        {
+            memmove( &d[out], &d[in + FTDI_STATUS_LEN], n - FTDI_STATUS_LEN );
+            out += n - FTDI_STATUS_LEN;
+        }
+
+        in += n;
+    }
+
+    return out;
+}
+// ====================================================================================================
 enum Channel OrbtraceIfNameToChannel( char *x )
 
 /* Turn case insensitive text name to channel number. Can be terminated with NULL or a ',' */
@@ -791,6 +2176,24 @@ void OrbtraceIfCloseDevice( struct OrbtraceIf *o )
 {
     if ( o->handle )
     {
+        if ( o->dapSWO )
+        {
+            /* Leave the probe as we found it, if it's still there to be told */
+            _dapSet( o, DAP_SWO_CONTROL, 0 );
+            o->dapSWO = false;
+        }
+
+        OrbtraceIfTargetDetach( o );
+        o->dapOut = o->dapIn = 0;
+
+        if ( o->ftdiPacket )
+        {
+            /* Back to how the tty driver expects to find it, and let it have the channel again */
+            _ftdiRequest( o, FTDI_SET_BITMODE, ( FTDI_MODE_RESET << 8 ) | 0xff, 0 );
+            libusb_release_interface( o->handle, o->iface );
+            o->ftdiPacket = 0;
+        }
+
         libusb_close( o->handle );
     }
 
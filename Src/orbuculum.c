@@ -11,6 +11,11 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <assert.h>
+#include <stddef.h>
+#include <pthread.h>
+#if !defined( WIN32 )
+    #include <sched.h>
+#endif
 #ifdef WIN32
     #include <winsock2.h>
 #else
@@ -25,6 +30,7 @@
 #include <strings.h>
 #include <string.h>
 #include <getopt.h>
+#include <inttypes.h>
 #if defined OSX
     #include <sys/ioctl.h>
     #include <libusb.h>
@@ -34,6 +40,7 @@
     #include <asm/ioctls.h>
     #if defined TCGETS2
         #include <asm/termios.h>
+        #include <linux/serial.h>
         /* Manual declaration to avoid conflict. */
         extern int ioctl ( int __fd, unsigned long int __request, ... ) ;
     #else
@@ -55,9 +62,26 @@
 #include "generics.h"
 #include "tpiuDecoder.h"
 #include "oflow.h"
+#include "msgSeq.h"
+#include "msgStream.h"
+#include "pcHist.h"
+#include "capture.h"
+#include "captureIndex.h"
+#include "captureArchive.h"
 #include "nwclient.h"
+#include "latencyHist.h"
+#include "metricsServer.h"
+#include "controlServer.h"
 #include "orbtraceIf.h"
+#include "bufPool.h"
 #include "stream.h"
+#include "orbProbes.h"
+#include "rtt.h"
+#if !defined( WIN32 )
+    #include "shmRing.h"
+    #include "mcast.h"
+    #include "pluginHost.h"
+#endif
 
 #define MAX_LINE_LEN (1024)
 #define ORBTRACE "orbtrace"
@@ -66,6 +90,68 @@
 /* Multiple blocks are used for USB, otherwise just the one */
 #define NUM_RAW_BLOCKS (32)
 
+/* Spare blocks that can be swapped into a USB transfer while its data is processed */
+#define NUM_SPARE_BLOCKS (32)
+#define NUM_USB_BLOCKS   (NUM_RAW_BLOCKS+NUM_SPARE_BLOCKS)
+
+/* Length of each pipeline stage queue ... must be a power of two, and at least NUM_USB_BLOCKS */
+#define STAGE_QUEUE_LEN  (64)
+#define STAGE_QUEUE_MASK (STAGE_QUEUE_LEN-1)
+#define STAGE_WAIT_NS    (100*1000*1000L)
+
+/* Most blocks the write stage will gather into a single write to the output file */
+#define WRITE_GATHER_MAX (16)
+
+/* Interval between entries in the index of the output file */
+#define CAPTURE_INDEX_MS (100)
+
+/* Adaptive USB transfers: how many completions to judge over, and how far down depth and length may go */
+#define ADAPT_WINDOW     (64)
+#define ADAPT_MIN_DEPTH  (4)
+#define ADAPT_MIN_LENGTH (4096)
+
+/* Serial reads are batched for throughput at or above this speed, and returned at once below it */
+#define SERIAL_THROUGHPUT_SPEED (1000000)
+#define SERIAL_BATCH_MIN        (255)            /* Bytes a batched read waits for... */
+#define SERIAL_BATCH_TIME       (1)              /* ...unless the line is quiet this long, in 100mS */
+
+/* Most plugin results that are reported in the metrics, per instance */
+#define METRICS_MAX_PLUGIN_VALUES (256)
+
+/* Most clients on any one port that are reported in the metrics */
+#define METRICS_MAX_CLIENTS (64)
+
+/* Most each bulk client may spill to disk, unless told otherwise */
+#define DEFAULT_SPILL_MB (1024)
+
+/* Messages the decoded message service can hold waiting for a timestamp before it has to grow */
+#define MSG_REORDER_BUFLEN (16*1024)
+
+/* Shortest interval PC sample histograms can be sent at */
+#define PCHIST_MIN_MS (10)
+
+/* How often the stats port is updated if there's no monitor interval */
+#define STATS_INTERVAL_MS (1000)
+
+/* With nobody connected to anything that needs decoding, only the monitor's per tag counts do. For */
+/* them a run of this many blocks is decoded in every so many, and counted for what was skipped.   */
+#define STATS_SAMPLE_RUN   (2)
+#define STATS_SAMPLE_EVERY (32)
+
+/* When serving several probes, each one's network ports are this far on from the previous one's */
+#define MULTI_PORT_STRIDE (100)
+
+/* How long a control command waits for the data path to take up what it asked for */
+#define CONTROL_APPLY_WAIT_MS (2000)
+
+/* Handing over to a new process. The state goes in a file whose descriptor is named by HANDOVER_ENV, */
+/* clients get HANDOVER_DRAIN_MS to catch up, and HANDOVER_QUIET_MS is allowed for held OFLOW to go. */
+#define HANDOVER_ENV          "ORBUCULUM_HANDOVER"
+#define HANDOVER_DRAIN_MS     (2000)
+#define HANDOVER_QUIET_MS     (50)
+#define HANDOVER_LINE_LEN     (512)
+#define HANDOVER_MAX_FD       (65536)           /* Highest descriptor looked at for closing on exec */
+
 /* File header for OFLOW formatted file */
 #define OFLOW_SIG (const char*)"%%ORBFLOW1.0.0%%"
 #define OFLOW_SIG_LEN (strlen(OFLOW_SIG))
@@ -79,15 +165,37 @@ struct TagDataCount
 {
     bool     hasHandler;
     uint64_t ts;
-    uint64_t totalData;
+    atomic_uint_fast64_t totalData;                      /* Only written by the decoder, see _count */
     uint64_t intervalData;
 };
 
+/* The kinds of thread that can be kept to their own CPUs. Capture is the one taking data in (for a */
+/* probe, the one handling libusb events) and send is the one serving every network client.      */
+enum threadKind { THREAD_CAPTURE, THREAD_DECODE, THREAD_WRITE, THREAD_SEND, THREAD_NUM_KINDS };
+#define THREAD_KIND_NAMES { "capture", "decode", "write", "send" }
+
+/* Stages of the capture path that can be timed. Each is only ever run by one thread, and a stage's */
+/* time includes that of any other it calls...decode covers everything the decode thread does.   */
+enum profStage { PROF_USB, PROF_DECODE, PROF_TPIU, PROF_OFLOW, PROF_ENCODE, PROF_SEND, PROF_WRITE, PROF_NUM_STAGES };
+#define PROF_STAGE_NAMES { "usb", "decode", "tpiu", "oflow", "encode", "send", "write" }
+
+/* Time spent in one stage, on a line of its own so the threads running the stages don't share */
+struct profCounter
+{
+    atomic_uint_fast64_t calls;                          /* Times the stage has run */
+    atomic_uint_fast64_t ns;                             /* ...and how long it took altogether */
+    atomic_uint_fast64_t maxns;                          /* Longest once, since the last interval report */
+    uint64_t lastCalls;                                  /* Both totals as of the last interval report */
+    uint64_t lastns;
+} __attribute__( ( aligned( BUFPOOL_CACHE_LINE ) ) );
+
 /* Record for options, either defaults or from command line */
 struct Options
 {
     /* Config information */
     bool nwserver;                                       /* Using a nw server source */
+    bool relay;                                          /* ...which is another orbuculum, whose OFLOW is passed straight on */
+    enum nwQoS relayQoS;                                 /* ...and how we ask it to treat us */
 
     /* Source information */
     char *nwserverHost;                                  /* NW Server host connection */
@@ -98,22 +206,105 @@ struct Options
     uint32_t dataSpeed;                                  /* Effective data speed (can be less than link speed!) */
     char *file;                                          /* File host connection */
     bool fileTerminate;                                  /* Terminate when file read isn't successful */
+    bool swoSamples;                                     /* File is logic analyser samples of the SWO pin */
+    struct SWOSampleConfig swoConfig;                    /* ...and how to decode them */
     char *outfile;                                       /* Output file for raw data dumping */
+    uint32_t rotateMB;                                   /* Start a new output file at this size, or 0 */
+    uint32_t rotateSecs;                                 /* Start a new output file at this age, or 0 */
+    int archive;                                         /* zlib level to compress the output file at, or 0 to keep it raw */
     char *otcl;                                          /* Orbtrace command line options */
+    uint32_t dapSpeed;                                   /* SWO speed for CMSIS-DAP probes, which are only used if it's set */
+    bool ftdi;                                           /* Take data from FTDI parts too */
+    uint32_t ftdiSpeed;                                  /* ...as a UART at this speed, or a sync FIFO if 0 */
+    bool rtt;                                            /* Take data from RTT up-buffers over SWD, alongside any SWO */
+    uint32_t rttAddr;                                    /* ...looking for the control block from here */
+    uint32_t rttLen;                                     /* ...for this far, or exactly at rttAddr if 0 */
+    int rttTag;                                          /* ...with up-buffer 0 going out on this tag, 1 on the next, and so on */
     uint32_t intervalReportTime;                         /* If we want interval reports about performance */
     bool mono;                                           /* Supress colour in output */
     int paceDelay;                                       /* Delay between blocks of data transmission in file readout */
+    bool realtime;                                       /* Replay file at the rate it was captured, from its index */
     char *channelList;                                   /* List of channels to be exported over legacy connection */
     bool hiresTime;                                      /* Use hiresolution time (shorter timeouts...obsolete) */
+    bool adaptiveUSB;                                    /* Adjust USB transfer depth and length to suit the data rate */
     char *sn;                                            /* Any part serial number for identifying a specific device */
     int listenPort;                                      /* Listening port for network */
+    char *shmName;                                       /* Name of shared memory to publish OFLOW into, if any */
+    char *mcastSpec;                                     /* Multicast group to publish OFLOW to, if any */
+    int statsPort;                                       /* Port to serve statistics lines on, or 0 */
+    int metricsPort;                                     /* Port to serve Prometheus metrics on, or 0 */
+    int controlPort;                                     /* Port to take reconfiguration commands on, or 0 */
+    bool compress;                                       /* Ask the NW Server to compress what it sends */
+    char *spillDir;                                      /* Where bulk clients spill what they can't keep up with, or NULL */
+    uint32_t spillMB;                                    /* ...and most each of them may spill there */
+    uint32_t spillMemMB;                                 /* Most each may spill into memory if there's no spillDir, or 0 */
+    uint32_t historyMB;                                  /* Recent ORBFLOW kept to replay for subscribers as they arrive, or 0 */
+    uint32_t historySecs;                                /* ...and the oldest of it that's kept, or 0 for any age */
+    uint32_t budgetMB;                                   /* Most memory to hold for network clients, or 0 for no limit */
+    enum nwShed shedPolicy;                              /* ...and what to do when it gets near that */
+    int msgPort;                                         /* Port to serve decoded ITM messages on, or 0 */
+    uint32_t pcHistmS;                                   /* ...and how often to send PC sample histograms on it, or 0 */
+    char **plugins;                                      /* Plugins to load into each instance, file[,args] */
+    int numPlugins;                                      /* ...and how many there are */
+    uint32_t coalesceuS;                                 /* Longest ORBFLOW we make is held to fill out a frame, or 0 */
+    char *cpus[THREAD_NUM_KINDS];                        /* CPUs each kind of thread is kept to, or NULL for any */
+    int schedPolicy;                                     /* Real-time scheduling policy for the capture path, or 0 */
+    int schedPriority;                                   /* ...and its priority */
+    bool profile;                                        /* Start with the stages being timed */
+};
+
+/* Wrapper allowing a USB (or serial) buffer to be passed down the pipeline and lent to network clients. */
+/* When everyone is done with it it's either resubmitted on its transfer (t set) or returned as a spare.  */
+struct usbBlockRef
+{
+    struct nwclientBlock b;                              /* The lendable block */
+    struct libusb_transfer *t;                           /* Transfer to resubmit when it comes back, or NULL */
+    uint32_t generation;                                 /* Connection generation the transfer belongs to */
+    struct RunTime *r;                                   /* Instance the buffer belongs to */
+    uint64_t rxTime;                                     /* Monotonic time the transfer completed */
+    bool resubmit;                                       /* Should the transfer be resubmitted on return */
+};
+
+/* Bounded single producer, single consumer queue between two pipeline stages */
+struct stageQueue
+{
+    struct usbBlockRef *q[STAGE_QUEUE_LEN];              /* Blocks waiting for this stage */
+    atomic_size_t wp;                                    /* Write position, only changed by producer */
+    atomic_size_t hwm;                                   /* Deepest the queue has been this interval */
+    uint8_t wpPad[BUFPOOL_CACHE_LINE];                   /* Each side's position is on a line of its own */
+    atomic_size_t rp;                                    /* Read position, only changed by consumer */
+    uint8_t rpPad[BUFPOOL_CACHE_LINE];
+    pthread_mutex_t l;                                   /* Lock protecting the kick flag */
+    pthread_cond_t c;                                    /* Signal that there's something on the queue */
+    bool kicked;                                         /* ...and the flag that goes with it */
 };
 
 struct handlers
 {
     int channel;                                         /* Channel number for this handler */
     struct dataBlock *strippedBlock;                     /* Processed buffers for output to clients */
+    struct OFLOWCoalesce *oflowOtg;                      /* ORBFLOW being built from them */
     struct nwclientsHandle *n;                           /* Link to the network client subsystem */
+    bool wanted;                                         /* Someone takes what's stripped for it, this block */
+};
+
+/* Changes asked for on the control port, waiting for the thread they concern to take them up at */
+/* the end of a block. Each is only ever made by the control thread, and cleared by the other.   */
+struct reconfig
+{
+    pthread_mutex_t l;                                   /* Lock for signalling that a change has been taken */
+    pthread_cond_t c;
+
+    atomic_bool handlersDue;                             /* New legacy handlers for the decode thread */
+    struct handlers *handler;                            /* ...which are these */
+    int numHandlers;
+
+    atomic_bool fileDue;                                 /* Changes for whoever writes the output file */
+    bool setRotation;                                    /* ...the rotation is to change */
+    uint64_t rotateBytes;                                /* ...to this */
+    uint32_t rotateSecs;
+    bool rotateNow;                                      /* ...and/or the next file is to be started */
+    bool fileOK;                                         /* Set by the writer if it could do what was asked */
 };
 
 struct RunTime
@@ -124,26 +315,101 @@ struct RunTime
     struct OrbtraceIf  *o;                               /* For accessing ORBTrace devices + BMPs */
 
     uint64_t  intervalRawBytes;                          /* Number of bytes transferred in current interval */
+    atomic_uint_fast64_t totalRawBytes;                  /* ...and altogether */
     uint64_t lastInterval;                               /* Timestamp of previous interval */
 
     bool      ending;                                    /* Flag indicating app is terminating */
     bool      errored;                                   /* Flag indicating problem in reception process */
     bool      conn;                                      /* Flag indicating that we have a good connection */
+    const char *probe;                                   /* Serial number asked for, when serving several probes */
+    int port;                                            /* Base port for this instance's network outputs */
 
     int f;                                               /* File handle to data source */
 
-    int opFileHandle;                                    /* Handle if we're writing orb output locally */
+    struct captureFile *capture;                         /* Set if we're writing orb output locally */
     struct Options *options;                             /* Command line options (reference to above) */
 
-    struct dataBlock rawBlock[NUM_RAW_BLOCKS];           /* Transfer buffers from the receiver */
+    struct dataBlock *rawBlock;                          /* Transfer buffers from the receiver */
+    struct dataBlock *spareBlock;                        /* Buffers to swap into transfers while data is processed */
+    struct usbBlockRef usbRef[NUM_USB_BLOCKS];           /* ...lending records for all of the above */
+    pthread_mutex_t usbLock;                             /* Lock covering resubmission vs. connection teardown */
+    uint32_t usbGeneration;                              /* Incremented each time the USB transfers are torn down */
+    libusb_context *usbContext;                          /* USB context shared with other probes, or NULL for our own */
+    atomic_int inFlight;                                 /* Number of transfers currently out with libusb */
+    int usbDepth;                                        /* Number of transfers we want out with libusb */
+    int usbLength;                                       /* ...and how long each of them should be */
+    struct libusb_transfer *parked[NUM_RAW_BLOCKS];      /* Transfers held back while the depth is reduced */
+    int numParked;                                       /* ...and how many there are */
+    int adaptCount;                                      /* Completions in the current adaption window */
+    int adaptFull;                                       /* ...and how many of them filled their transfer */
+    atomic_uint_fast64_t tfrCount;                       /* Transfers completed */
+    atomic_uint_fast64_t tfrShort;                       /* ...and how many of them came back short */
+    uint64_t lastTfrCount;                               /* Both of the above, as of the last interval report */
+    uint64_t lastTfrShort;
+
+    struct usbBlockRef *spare[NUM_USB_BLOCKS];           /* Stack of buffers available to swap into transfers */
+    int numSpare;                                        /* ...and how many there are */
+    pthread_mutex_t spareLock;                           /* Lock for the spare stack */
+
+    struct stageQueue decodeQ;                           /* USB to decode stage */
+    struct stageQueue writeQ;                            /* Decode to output file stage */
+    pthread_t decodeThread;                              /* Thread doing TPIU/OFLOW processing of USB data */
+    pthread_t writeThread;                               /* Thread writing USB data to the output file */
+    bool pipelineRunning;                                /* Flag that the above threads exist */
 
     struct nwclientsHandle *oflowHandler;                /* Handle to OFLOW output handler */
+    struct nwclientsHandle *statsHandler;                /* Handle to statistics output, if there is one */
+    struct nwclientsHandle *msgHandler;                  /* Handle to decoded message output, if there is one */
+    struct ITMDecoder msgITM;                            /* ITM decoder for the message output... */
+    struct MSGSeq msgSeq;                                /* ...putting what it decodes into timestamp order */
+    bool msgTSSeen;                                      /* Set once the target has sent a timestamp */
+    struct msgStreamFrame msgFrame;                      /* Frame of messages being built up to send */
+    struct pcHist *pcHist;                               /* PC samples counted by address, if they're being sent that way */
+    uint32_t pcHistStartmS;                              /* ...and when the current interval started */
+    uint64_t rxTime;                                     /* Monotonic time the block being decoded arrived */
+    struct latencyHist dispatchLatency;                  /* Time from blocks arriving to being queued for the clients */
     bool usingOFLOW;                                     /* Flag that OFLOW protocol is in use from the source */
+    struct OFLOWCoalesce itmOflowOtg;                    /* ORBFLOW being built from unframed ITM */
+    uint64_t lastStamp;                                  /* Time in the last time frame sent */
+    bool oflowAligned;                                   /* Last OFLOW block from the source ended on a frame boundary */
+
+    bool wantMsgs;                                       /* The message port has clients, this block */
+    bool wantOFLOW;                                      /* ...and something takes the OFLOW we'd make */
+    bool wantDecode;                                     /* ...and anything but the monitor wants the decoders' output */
+    bool decoding;                                       /* The last block went through the decoders */
+    unsigned int sampleBlock;                            /* Blocks since the current stats sample started */
+    uint64_t sampleSkipped;                              /* Raw bytes that went by undecoded since the last block that wasn't */
+    uint64_t statsMul;                                   /* ...so what's counted from this block stands for statsMul/statsDiv as much */
+    uint64_t statsDiv;
+#if !defined( WIN32 )
+    struct shmRing *oflowShm;                            /* Shared memory copy of the OFLOW output, for local clients */
+    struct mcast *oflowMcast;                            /* Multicast copy of it, for any number of clients on the LAN */
+    struct pluginHost *plugins;                          /* Analysis plugins running alongside us, if any */
+#endif
 
     struct TagDataCount tagCount[NUM_TAGS];              /* Data carried per tag/TPIU channel */
     int numHandlers;                                     /* Number of TPIU channel handlers in use */
     struct handlers *handler;
+    struct handlers *tagHandler[NUM_TAGS];               /* Direct map from tag to its handler, NULL if none */
     char *sn;                                            /* Serial number for any device we've established contact with */
+
+    struct profCounter prof[PROF_NUM_STAGES];            /* Time spent in each stage, when it's being measured */
+    struct reconfig rc;                                  /* Changes from the control port on their way in */
+
+    atomic_bool handingOver;                             /* Capture is to stop, for a new process to carry on with */
+    atomic_bool feederParked;                            /* ...and it has */
+    int usbFd;                                           /* USB device handed over to us, if haveUsbFd */
+    bool haveUsbFd;
+    unsigned int captureSeq;                             /* First number in the output file series */
+
+    bool swo;                                            /* The probe sends SWO, rather than only being there for RTT */
+    pthread_t rttThread;                                 /* Thread reading RTT up-buffers from the target */
+    atomic_bool rttRunning;                              /* ...which is running */
+    atomic_bool rttStop;                                 /* ...and is to stop */
+    pthread_mutex_t rttLock;                             /* Lock for what it's read */
+    uint8_t *rttPend;                                    /* ...which waits here for the decode thread */
+    size_t rttPendLen;
+    uint8_t *rttTake;                                    /* ...and the buffer the decode thread took the last of it in */
 };
 
 #ifdef WIN32
@@ -156,20 +422,61 @@ struct RunTime
 
 #define NUM_OFLOW_CHANNELS 0x7F
 
+/* Longest that ORBFLOW may be held to fill out a frame, so it always gets to the clients reasonably promptly */
+#define COALESCE_MAX_US    (100000)
+
+/* An ITM sync, ETM A-sync or ETM4 async is at least this many zero bytes and then 0x80 */
+#define SYNC_MIN_ZEROS     (5)
+#define SYNC_END           (0x80)
+#define DEFAULT_RT_PRIORITY (10)                         /* Scheduling priority if a policy is given without one */
+
 #define INTERVAL_100US (100U)
 #define INTERVAL_1MS   (10*INTERVAL_100US)
 #define INTERVAL_100MS (100*INTERVAL_1MS)
 #define INTERVAL_1S    (10*INTERVAL_100MS)
 
+#define RTT_SWD_CLOCK  (4000000)                         /* SWD clock for reading RTT up-buffers */
+#define RTT_DEFAULT_TAG (16)                             /* First tag for up-buffers, clear of the ones SWO uses */
+#define RTT_POLL_MAX   (USB_TRANSFER_SIZE/4)             /* Most taken per poll... */
+#define RTT_STAGE_LEN  (3*RTT_POLL_MAX)                  /* ...which has room to go as ITM, with syncs and record headers */
+#define RTT_PEND_LEN   (USB_TRANSFER_SIZE)               /* Most waiting for the decode thread */
+#define RTT_FRAME_MAX  ((OFLOW_MAX_PACKET_LEN-SYNC_MIN_ZEROS-1)/2) /* Most RTT bytes in one ORBFLOW frame */
+#define RTT_REC_HDR    (1+2+8)                           /* Tag, length and time in front of each record of it */
+
 struct Options _options =
 {
     .listenPort   = OFCLIENT_SERVER_PORT,
     .nwserverHost = NWSERVER_HOST,
     .channelList  = "1",
+    .spillMB      = DEFAULT_SPILL_MB,
 };
 
 struct RunTime _r;
 
+/* Stages are only timed while this is set, otherwise all it costs is looking at it */
+static atomic_bool _profiling;
+static const char *_profStageName[PROF_NUM_STAGES] = PROF_STAGE_NAMES;
+
+/* What every instance's decoders count, for the metrics */
+static struct statsRegistry *_stats;
+
+/* All of the instances when serving several probes, the first of which is _r */
+static struct RunTime **_probe;
+static int _numProbes;
+static pthread_mutex_t _reportLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Held while the legacy handlers of any instance are being changed, and by anyone else looking at them */
+static pthread_mutex_t _handlerLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* How we were started, so a new binary can be started the same way, and the clients it was handed */
+static char **_argv;
+static struct handedClient
+{
+    int port;
+    struct nwclientHandover c;
+} *_handed;
+static int _numHanded;
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -183,6 +490,26 @@ struct RunTime _r;
 // ====================================================================================================
 // Linux Specific Drivers
 // ====================================================================================================
+static void _setLowLatency( int f, bool lowLatency )
+
+/* Ask the driver not to hold on to received data (e.g. the FTDI latency timer). Not all do this */
+
+{
+    struct serial_struct ss;
+
+    if ( ioctl( f, TIOCGSERIAL, &ss ) < 0 )
+    {
+        return;
+    }
+
+    ss.flags = ( lowLatency ) ? ( ss.flags | ASYNC_LOW_LATENCY ) : ( ss.flags & ~ASYNC_LOW_LATENCY );
+
+    if ( ioctl( f, TIOCSSERIAL, &ss ) < 0 )
+    {
+        genericsReport( V_DEBUG, "Could not set serial latency mode" EOL );
+    }
+}
+// ====================================================================================================
 static int _setSerialConfig ( int f, speed_t speed )
 {
     // Use Linux specific termios2.
@@ -202,6 +529,8 @@ static int _setSerialConfig ( int f, speed_t speed )
     settings.c_cflag &= ~( CBAUD | CIBAUD );
     settings.c_cflag |= CS8 | CLOCAL; /* 8 bits */
     settings.c_oflag &= ~OPOST; /* raw output */
+    settings.c_cc[VMIN]  = ( speed >= SERIAL_THROUGHPUT_SPEED ) ? SERIAL_BATCH_MIN : 1;
+    settings.c_cc[VTIME] = ( speed >= SERIAL_THROUGHPUT_SPEED ) ? SERIAL_BATCH_TIME : 0;
 
     settings.c_cflag |= BOTHER;
     settings.c_ispeed = speed;
@@ -229,6 +558,8 @@ static int _setSerialConfig ( int f, speed_t speed )
         return -4;
     }
 
+    _setLowLatency( f, speed < SERIAL_THROUGHPUT_SPEED );
+
     // Flush port.
     ioctl( f, TCFLSH, TCIOFLUSH );
     return 0;
@@ -313,6 +644,8 @@ static int _setSerialConfig ( int f, speed_t speed )
     settings.c_cflag &= ~CSIZE;
     settings.c_cflag |= CS8 | CLOCAL; /* 8 bits */
     settings.c_oflag &= ~OPOST; /* raw output */
+    settings.c_cc[VMIN]  = ( speed >= SERIAL_THROUGHPUT_SPEED ) ? SERIAL_BATCH_MIN : 1;
+    settings.c_cc[VTIME] = ( speed >= SERIAL_THROUGHPUT_SPEED ) ? SERIAL_BATCH_TIME : 0;
 
     if ( tcsetattr( f, TCSANOW, &settings ) < 0 )
     {
@@ -325,16 +658,38 @@ static int _setSerialConfig ( int f, speed_t speed )
 }
 #endif
 
+// ====================================================================================================
+static void _closeRunTime( struct RunTime *r )
+
+{
+    r->ending = true;
+
+    if ( r->capture )
+    {
+        captureClose( r->capture );
+        r->capture = NULL;
+    }
+
+#if !defined( WIN32 )
+    /* Let any shared memory clients know we're gone, and remove it */
+    shmRingClose( r->oflowShm );
+    r->oflowShm = NULL;
+    mcastClose( r->oflowMcast );
+    r->oflowMcast = NULL;
+
+    /* ...and give the plugins a chance to finish up */
+    pluginHostStop( r->plugins );
+#endif
+}
 // ====================================================================================================
 static void _doExit( void )
 
 {
-    _r.ending = true;
+    _closeRunTime( &_r );
 
-    if ( _r.opFileHandle )
+    for ( int i = 1; i < _numProbes; i++ )
     {
-        close( _r.opFileHandle );
-        _r.opFileHandle = 0;
+        _closeRunTime( _probe[i] );
     }
 
     /* Need to nudge our own process in case it's stuck in a read or similar */
@@ -348,27 +703,82 @@ static void _intHandler( int sig )
     _doExit();
 }
 // ====================================================================================================
+#if !defined( WIN32 )
+static void _profileHandler( int sig )
+
+/* Switch timing of the stages on or off, while running */
+
+{
+    atomic_store( &_profiling, !atomic_load( &_profiling ) );
+}
+#endif
+// ====================================================================================================
 void _printHelp( const char *const progName, struct RunTime *r )
 
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
     genericsPrintf( "    -a, --serial-speed:  <serialSpeed> to use" EOL );
+    genericsPrintf( "    -A, --adaptive:      Adjust USB transfer depth and length to suit the data rate" EOL );
+    genericsPrintf( "    -b, --spill-memory:  <MBytes> Let bulk clients spill into this much memory each rather than lose data" EOL );
+    genericsPrintf( "    -B, --spill:         <dir>[,<MBytes>] Let bulk clients spill to files in <dir> rather than lose data (up to %d MBytes each)" EOL, DEFAULT_SPILL_MB );
+    genericsPrintf( "    -c, --coalesce:      <microseconds> Hold ORBFLOW made here for up to this long to fill out frames" EOL );
+#if defined( LINUX )
+    genericsPrintf( "    -C, --cpus:          <thread>=<cpus>[:<thread>=<cpus>...] Keep capture, decode, write or send threads to CPUs (e.g. capture=2:send=4-7)" EOL );
+#endif
+    genericsPrintf( "    -D, --dap-swo:       <baud> Also take UART SWO from CMSIS-DAP v2 probes, at this speed" EOL );
     genericsPrintf( "    -E, --eof:           When reading from file, terminate at end of file" EOL );
     genericsPrintf( "    -f, --input-file:    <filename> Take input from specified file" EOL );
+    genericsPrintf( "    -F, --realtime:      When reading from file, replay it at the rate it was captured" EOL );
+    genericsPrintf( "    -g, --pc-hist:       <interval> Also send PC samples on the message port counted by address, every <interval>ms" EOL );
+#if !defined( WIN32 )
+    genericsPrintf( "    -G, --multicast:     [group][:port][,ttl] Also send ORBFLOW to a UDP multicast group, for any number of clients (defaults to %s, ttl %d)" EOL, MCAST_DEFAULT_SPEC, MCAST_DEFAULT_TTL );
+#endif
     genericsPrintf( "    -h, --help:          This help" EOL );
+    genericsPrintf( "    -I, --ftdi:          <baud>|fifo Also take data from FTDI H series parts, as a UART at <baud> or a synchronous FIFO" EOL );
+    genericsPrintf( "    -i, --msg-port:      [port] Also serve ITM decoded into messages, for clients that don't want to decode it (defaults to %d)" EOL, NWMSG_SERVER_PORT );
+    genericsPrintf( "    -j, --rtt:           <addr>[:<len>][,<tag>] Also take data from RTT up-buffers over SWD, with the control block at <addr>, or" EOL );
+    genericsPrintf( "                         searched for in <len> bytes from there. Up-buffer n goes out as ITM channel n on tag <tag>+n (defaults to %d)" EOL, RTT_DEFAULT_TAG );
+#if !defined( WIN32 )
+    genericsPrintf( "    -H, --shm:           [name] Also publish ORBFLOW into shared memory for local clients (defaults to %s)" EOL, ORBUCULUM_SHM_NAME );
+#endif
+    genericsPrintf( "    -k, --history:       <MBytes>[,<seconds>] Keep recent ORBFLOW to replay to clients as they subscribe, so they start with something" EOL );
+    genericsPrintf( "    -K, --control:       <port> Take commands to reconfigure a running capture on <port>, from this host only" EOL );
+#if !defined( WIN32 )
+    genericsPrintf( "    -L, --plugin:        <file>[,<args>] Load an analysis plugin, and run it on the incoming data (repeat per plugin)" EOL );
+#endif
     genericsPrintf( "    -l, --listen-port:   <port> Listen port for incoming ORBFLOW connections (defaults to %d)" EOL, r->options->listenPort );
     genericsPrintf( "    -m, --monitor:       <interval> Output monitor information about the link at <interval>ms, min 500ms" EOL );
     genericsPrintf( "    -M, --no-colour:     Supress colour in output" EOL );
-    genericsPrintf( "    -n, --serial-number: <Serial> any part of serial number to differentiate specific device" EOL );
+    genericsPrintf( "    -n, --serial-number: <Serial[,Serial...]> any part of serial number to differentiate specific device, or a list to serve several" EOL );
     genericsPrintf( "    -o, --output-file:   <filename> to be used for dump file" EOL );
     genericsPrintf( "    -O, --orbtrace:      \"<options>\" run orbtrace with specified options on device connect" EOL );
     genericsPrintf( "    -p, --serial-port:   <serialPort> to use" EOL );
     genericsPrintf( "    -P, --pace:          <microseconds> delay in block of data transmission to clients" EOL );
+    genericsPrintf( "    -q, --mem-budget:    <MBytes>[,drop|disconnect|filter] Most memory to hold for network clients, and what to do as it runs out (default drop)" EOL );
+    genericsPrintf( "    -r, --rotate-size:   <MBytes> Start a new numbered dump file when this size is reached" EOL );
+    genericsPrintf( "    -R, --rotate-time:   <seconds> Start a new numbered dump file when this age is reached" EOL );
     genericsPrintf( "    -s, --server:        <Server>:<Port> to use" EOL );
+    genericsPrintf( "    -u, --relay:         [bulk] Server is another orbuculum, relay its OFLOW untouched (as a bulk client if asked)" EOL );
+    genericsPrintf( "    -S, --stats-port:    <port> Serve a line of link and latency statistics each interval on <port>" EOL );
     genericsPrintf( "    -T, --tpiu:          Strip TPIU framing from input flows (mostly not relevant)" EOL );
     genericsPrintf( "    -t, --tag:           <stream,stream....> Legacy TPIU streams to decode and route (Default %s)" EOL, r->options->channelList );
     genericsPrintf( "    -v, --verbose:       <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:       Print version, connected usb devices, and exit" EOL );
+#if !defined( WIN32 )
+    genericsPrintf( "    -w, --swo-samples:   <bit>[,u|m][,<bytes>][,<samples>] Input file is logic analyser samples of SWO, on <bit> of" EOL );
+    genericsPrintf( "                         each sample of <bytes> (default 1). UART (default) or Manchester, at <samples> a bit or found" EOL );
+#endif
+    genericsPrintf( "    -x, --metrics-port:  <port> Serve Prometheus metrics over HTTP on <port>" EOL );
+#if !defined( WIN32 )
+    genericsPrintf( "    -X, --profile:       Time each stage of the capture path from the start (SIGUSR1 toggles it)" EOL );
+#else
+    genericsPrintf( "    -X, --profile:       Time each stage of the capture path" EOL );
+#endif
+#if !defined( WIN32 )
+    genericsPrintf( "    -Y, --sched:         <fifo|rr>[,<priority>] Run the capture and decode threads at real-time priority (defaults to %d)" EOL, DEFAULT_RT_PRIORITY );
+#endif
+    genericsPrintf( "    -z, --compress:      Ask the NW Server to compress what it sends" EOL );
+    genericsPrintf( "    -Z, --archive:       [level] Write the dump file as a compressed archive, at zlib level 1..9 (defaults to %d)" EOL, CAPTURE_ARCHIVE_LEVEL );
 }
 
 // ====================================================================================================
@@ -377,7 +787,7 @@ void _printVersion( struct RunTime *r )
 {
     genericsPrintf( "orbuculum version " GIT_DESCRIBE EOL );
     r->o = OrbtraceIfCreateContext();
-    int ndevices = OrbtraceIfGetDeviceList( r->o, NULL, DEVTYPE( DEVICE_ORBTRACE_MINI ) | DEVTYPE( DEVICE_BMP ) );
+    int ndevices = OrbtraceIfGetDeviceList( r->o, NULL, DEVTYPE( DEVICE_ORBTRACE_MINI ) | DEVTYPE( DEVICE_BMP ) | DEVTYPE( DEVICE_CMSIS_DAP ) );
 
     if ( !ndevices )
     {
@@ -393,13 +803,172 @@ void _printVersion( struct RunTime *r )
     r->o = NULL;
 }
 // ====================================================================================================
+/* Names of what can be done when the memory budget runs out, as given to -q */
+static const char *_shedName[NW_SHED_NUM] = { "drop", "disconnect", "filter" };
+
+#if defined( LINUX )
+static const char *_threadKindName[THREAD_NUM_KINDS] = THREAD_KIND_NAMES;
+static cpu_set_t _startCPUs;                             /* What we were allowed to start with, for threads not given any */
+static bool _pinning;                                    /* ...which matters once any have been */
+
+static bool _parseCPUs( const char *s, cpu_set_t *set )
+
+/* Turn a list of CPUs and ranges of them (e.g. 1,4-7) into a set, returning false if it makes no sense */
+
+{
+    char *e;
+    long from, to;
+
+    CPU_ZERO( set );
+
+    do
+    {
+        from = to = strtol( s, &e, 10 );
+
+        if ( ( e == s ) || ( from < 0 ) )
+        {
+            return false;
+        }
+
+        if ( *e == '-' )
+        {
+            s = e + 1;
+            to = strtol( s, &e, 10 );
+
+            if ( ( e == s ) || ( to < from ) )
+            {
+                return false;
+            }
+        }
+
+        if ( to >= CPU_SETSIZE )
+        {
+            return false;
+        }
+
+        while ( from <= to )
+        {
+            CPU_SET( from++, set );
+        }
+
+        s = e + 1;
+    }
+    while ( *e == ',' );
+
+    return ( !*e ) || ( *e == ':' );
+}
+// ====================================================================================================
+static bool _parseThreadCPUs( struct Options *o, char *spec )
+
+/* Take <thread>=<cpus>[:<thread>=<cpus>...], noting the CPUs for each kind of thread named */
+
+{
+    cpu_set_t set;
+    char *c, *e;
+    int k = THREAD_NUM_KINDS;
+
+    if ( sched_getaffinity( 0, sizeof( _startCPUs ), &_startCPUs ) )
+    {
+        genericsReport( V_ERROR, "Could not get CPU affinity (%s)" EOL, strerror( errno ) );
+        return false;
+    }
+
+    for ( c = strtok( spec, ":" ); c; c = strtok( NULL, ":" ) )
+    {
+        if ( ( e = strchr( c, '=' ) ) )
+        {
+            *e = 0;
+
+            for ( k = 0; ( k < THREAD_NUM_KINDS ) && ( strcmp( c, _threadKindName[k] ) ); k++ );
+        }
+
+        if ( ( !e ) || ( k == THREAD_NUM_KINDS ) || ( !_parseCPUs( e + 1, &set ) ) )
+        {
+            genericsReport( V_ERROR, "CPUs for threads should be <capture|decode|write|send>=<cpus>, e.g. capture=2:send=4-7" EOL );
+            return false;
+        }
+
+        o->cpus[k] = e + 1;
+        _pinning = true;
+    }
+
+    return true;
+}
+#endif
+// ====================================================================================================
+static void _threadPolicy( struct Options *o, pthread_t t, enum threadKind k )
+
+/* Keep a thread to the CPUs asked for its kind, and if it's on the capture path give it the    */
+/* real-time scheduling asked for. Threads inherit both from whoever created them, so the others */
+/* are put back explicitly. Neither is fatal if it can't be done, things just aren't as good.    */
+
+{
+#if defined( LINUX )
+    if ( _pinning )
+    {
+        cpu_set_t set = _startCPUs;
+        int e;
+
+        if ( o->cpus[k] )
+        {
+            _parseCPUs( o->cpus[k], &set );
+        }
+
+        if ( ( e = pthread_setaffinity_np( t, sizeof( set ), &set ) ) )
+        {
+            genericsReport( V_WARN, "Could not keep %s thread to CPUs %s (%s)" EOL, _threadKindName[k], ( o->cpus[k] ) ? o->cpus[k] : "it started with", strerror( e ) );
+        }
+    }
+
+#endif
+#if !defined( WIN32 )
+
+    if ( o->schedPolicy )
+    {
+        bool rt = ( k == THREAD_CAPTURE ) || ( k == THREAD_DECODE );
+        struct sched_param p = { .sched_priority = ( rt ) ? o->schedPriority : 0 };
+        int err = pthread_setschedparam( t, ( rt ) ? o->schedPolicy : SCHED_OTHER, &p );
+
+        if ( err )
+        {
+            genericsReport( V_WARN, "Could not set real-time scheduling (%s), this usually needs root or CAP_SYS_NICE" EOL, strerror( err ) );
+        }
+    }
+
+#endif
+}
+// ====================================================================================================
 static struct option _longOptions[] =
 {
     {"serial-speed", required_argument, NULL, 'a'},
+    {"adaptive", no_argument, NULL, 'A'},
+    {"spill-memory", required_argument, NULL, 'b'},
+    {"spill", required_argument, NULL, 'B'},
+    {"coalesce", required_argument, NULL, 'c'},
+#if defined( LINUX )
+    {"cpus", required_argument, NULL, 'C'},
+#endif
+    {"dap-swo", required_argument, NULL, 'D'},
     {"eof", no_argument, NULL, 'E'},
+    {"ftdi", required_argument, NULL, 'I'},
+    {"rtt", required_argument, NULL, 'j'},
     {"input-file", required_argument, NULL, 'f'},
+    {"realtime", no_argument, NULL, 'F'},
+    {"pc-hist", required_argument, NULL, 'g'},
+#if !defined( WIN32 )
+    {"multicast", optional_argument, NULL, 'G'},
+#endif
     {"help", no_argument, NULL, 'h'},
+    {"msg-port", optional_argument, NULL, 'i'},
+    {"history", required_argument, NULL, 'k'},
+    {"control", required_argument, NULL, 'K'},
+#if !defined( WIN32 )
+    {"shm", optional_argument, NULL, 'H'},
+#endif
     {"listen-port", required_argument, NULL, 'l'},
+#if !defined( WIN32 )
+    {"plugin", required_argument, NULL, 'L'},
+#endif
     {"monitor", required_argument, NULL, 'm'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
@@ -408,21 +977,87 @@ static struct option _longOptions[] =
     {"orbtrace", required_argument, NULL, 'O'},
     {"serial-port", required_argument, NULL, 'p'},
     {"pace", required_argument, NULL, 'P'},
+    {"mem-budget", required_argument, NULL, 'q'},
+    {"rotate-size", required_argument, NULL, 'r'},
+    {"rotate-time", required_argument, NULL, 'R'},
     {"server", required_argument, NULL, 's'},
+    {"stats-port", required_argument, NULL, 'S'},
     {"tpiu", required_argument, NULL, 'T'},
     {"tag", required_argument, NULL, 't'},
+    {"relay", optional_argument, NULL, 'u'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
+#if !defined( WIN32 )
+    {"swo-samples", required_argument, NULL, 'w'},
+#endif
+    {"metrics-port", required_argument, NULL, 'x'},
+    {"profile", no_argument, NULL, 'X'},
+#if !defined( WIN32 )
+    {"sched", required_argument, NULL, 'Y'},
+#endif
+    {"compress", no_argument, NULL, 'z'},
+    {"archive", optional_argument, NULL, 'Z'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
+static bool _swoSamplesSpec( const char *spec, struct SWOSampleConfig *c )
+
+/* Set up from <bit>[,u|m][,<bytes a sample>][,<samples a bit>] */
+
+{
+    char *e;
+
+    *c = ( struct SWOSampleConfig )
+    {
+        .unitSize = 1, .encoding = SWO_SAMPLES_NRZ
+    };
+
+    c->channel = strtoul( spec, &e, 0 );
+
+    if ( e == spec )
+    {
+        return false;
+    }
+
+    if ( ( *e == ',' ) && ( ( e[1] == 'u' ) || ( e[1] == 'm' ) ) )
+    {
+        c->encoding = ( e[1] == 'm' ) ? SWO_SAMPLES_MANCHESTER : SWO_SAMPLES_NRZ;
+        e += 2;
+    }
+
+    if ( *e == ',' )
+    {
+        spec = e + 1;
+        c->unitSize = strtoul( spec, &e, 0 );
+
+        if ( ( e == spec ) || ( !c->unitSize ) || ( c->unitSize > 8 ) )
+        {
+            return false;
+        }
+    }
+
+    if ( *e == ',' )
+    {
+        spec = e + 1;
+        c->samplesPerBit = strtod( spec, &e );
+
+        if ( ( e == spec ) || ( c->samplesPerBit <= 0 ) )
+        {
+            return false;
+        }
+    }
+
+    return ( !*e ) && ( c->channel < 8 * c->unitSize );
+}
+// ====================================================================================================
 bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
 {
     int c, optionIndex = 0;
+    char *a;
 #define DELIMITER ','
 
-    while ( ( c = getopt_long ( argc, argv, "a:Ef:hVl:m:Mn:o:O:p:P:s:Tt:v:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "a:Ab:B:c:C:D:Ef:Fg:G::hH::i::I:j:k:K:Vl:L:m:Mn:o:O:p:P:q:r:R:s:S:Tt:u::v:w:x:XY:zZ::", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -439,102 +1074,323 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 break;
 
             // ------------------------------------
-
-            case 'E':
-                r->options->fileTerminate = true;
-                break;
-
-            // ------------------------------------
-            case 'f':
-                r->options->file = optarg;
+            case 'A':
+                r->options->adaptiveUSB = true;
                 break;
 
             // ------------------------------------
-            case 'h':
-                _printHelp( argv[0], r );
-                return false;
+            case 'b':
+                r->options->spillMemMB = atoi( optarg );
 
-            // ------------------------------------
+                if ( !r->options->spillMemMB )
+                {
+                    genericsReport( V_ERROR, "Spill size out of range" EOL );
+                    return false;
+                }
 
-            case 'V':
-                _printVersion( r );
-                return false;
+                break;
 
             // ------------------------------------
+            case 'B':
+                r->options->spillDir = optarg;
 
-            case 'l':
-                r->options->listenPort = atoi( optarg );
-
-                if ( ( r->options->listenPort <= 0 ) || ( r->options->listenPort > 0xffff ) )
+                if ( ( a = strchr( optarg, DELIMITER ) ) )
                 {
-                    genericsReport( V_ERROR, "Port to listen on is out of range" EOL );
-                    return false;
+                    *a = 0;
+                    r->options->spillMB = atoi( a + 1 );
+
+                    if ( !r->options->spillMB )
+                    {
+                        genericsReport( V_ERROR, "Spill size out of range" EOL );
+                        return false;
+                    }
                 }
 
                 break;
 
             // ------------------------------------
+            case 'k':
+                r->options->historyMB = atoi( optarg );
 
-            case 'm':
-                r->options->intervalReportTime = atoi( optarg );
+                if ( ( a = strchr( optarg, DELIMITER ) ) )
+                {
+                    r->options->historySecs = atoi( a + 1 );
+                }
 
-                if ( r->options->intervalReportTime < 500 )
+                if ( ( !r->options->historyMB ) || ( ( a ) && ( !r->options->historySecs ) ) )
                 {
-                    genericsReport( V_ERROR, "intervalReportTime is out of range" EOL );
+                    genericsReport( V_ERROR, "History size out of range" EOL );
                     return false;
                 }
 
                 break;
 
             // ------------------------------------
+            case 'q':
+                r->options->budgetMB = atoi( optarg );
 
-            case 'M':
-                r->options->mono = true;
-                break;
+                if ( ( a = strchr( optarg, DELIMITER ) ) )
+                {
+                    for ( r->options->shedPolicy = 0; ( r->options->shedPolicy < NW_SHED_NUM ) &&
+                            ( strcmp( a + 1, _shedName[r->options->shedPolicy] ) ); r->options->shedPolicy++ );
+                }
 
-            // ------------------------------------
+                if ( ( !r->options->budgetMB ) || ( r->options->shedPolicy == NW_SHED_NUM ) )
+                {
+                    genericsReport( V_ERROR, "Memory budget should be <MBytes>[,drop|disconnect|filter]" EOL );
+                    return false;
+                }
 
-            case 'n':
-                r->options->sn = optarg;
                 break;
 
             // ------------------------------------
+            case 'c':
+                r->options->coalesceuS = atoi( optarg );
 
-            case 'o':
-                r->options->outfile = optarg;
-                break;
-
-            // ------------------------------------
+                if ( r->options->coalesceuS > COALESCE_MAX_US )
+                {
+                    genericsReport( V_ERROR, "Coalesce time out of range" EOL );
+                    return false;
+                }
 
-            case 'O':
-                r->options->otcl = optarg;
                 break;
 
             // ------------------------------------
+#if defined( LINUX )
+
+            case 'C':
+                if ( !_parseThreadCPUs( r->options, optarg ) )
+                {
+                    return false;
+                }
 
-            case 'p':
-                r->options->port = optarg;
                 break;
 
             // ------------------------------------
+#endif
 
-            case 'P':
-                r->options->paceDelay = atoi( optarg );
+            case 'D':
+                r->options->dapSpeed = atoi( optarg );
 
-                if ( r->options->paceDelay <= 0 )
+                if ( ( int )r->options->dapSpeed <= 0 )
                 {
-                    genericsReport( V_ERROR, "paceDelay is out of range" EOL );
+                    genericsReport( V_ERROR, "CMSIS-DAP SWO speed out of range" EOL );
                     return false;
                 }
 
                 break;
 
+            // ------------------------------------
+            case 'E':
+                r->options->fileTerminate = true;
+                break;
+
+            // ------------------------------------
+            case 'f':
+                r->options->file = optarg;
+                break;
+
+            // ------------------------------------
+            case 'F':
+                r->options->realtime = true;
+                break;
+
+            // ------------------------------------
+            case 'h':
+                _printHelp( argv[0], r );
+                return false;
+
+            // ------------------------------------
+#if !defined( WIN32 )
+
+            case 'G':
+                r->options->mcastSpec = ( optarg ) ? optarg : MCAST_DEFAULT_SPEC;
+                break;
+
+            // ------------------------------------
+
+            case 'H':
+                r->options->shmName = ( optarg ) ? optarg : ORBUCULUM_SHM_NAME;
+                break;
+
+            // ------------------------------------
+
+            case 'L':
+                r->options->plugins = ( char ** )realloc( r->options->plugins, ( r->options->numPlugins + 1 ) * sizeof( char * ) );
+                MEMCHECK( r->options->plugins, false );
+                r->options->plugins[r->options->numPlugins++] = optarg;
+                break;
+
+            // ------------------------------------
+#endif
+
+            case 'g':
+                r->options->pcHistmS = atoi( optarg );
+
+                if ( r->options->pcHistmS < PCHIST_MIN_MS )
+                {
+                    genericsReport( V_ERROR, "PC sample histogram interval must be at least %dms" EOL, PCHIST_MIN_MS );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'i':
+                r->options->msgPort = ( optarg ) ? atoi( optarg ) : NWMSG_SERVER_PORT;
+
+                if ( ( r->options->msgPort <= 0 ) || ( r->options->msgPort > 0xffff ) )
+                {
+                    genericsReport( V_ERROR, "Message port out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'I':
+                r->options->ftdi = true;
+
+                if ( strcmp( optarg, "fifo" ) )
+                {
+                    r->options->ftdiSpeed = atoi( optarg );
+
+                    if ( ( int )r->options->ftdiSpeed <= 0 )
+                    {
+                        genericsReport( V_ERROR, "FTDI speed out of range" EOL );
+                        return false;
+                    }
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'j':
+            {
+                char *e;
+
+                r->options->rtt     = true;
+                r->options->rttAddr = strtoul( optarg, &e, 0 );
+                r->options->rttLen  = ( *e == ':' ) ? strtoul( e + 1, &e, 0 ) : 0;
+                r->options->rttTag  = ( *e == ',' ) ? strtol( e + 1, &e, 0 ) : RTT_DEFAULT_TAG;
+
+                if ( ( *e ) || ( r->options->rttTag < 1 ) || ( r->options->rttTag >= OFLOW_TIME_TAG ) )
+                {
+                    genericsReport( V_ERROR, "RTT should be <addr>[:<len>][,<tag>], with a tag from 1 to %d" EOL, OFLOW_TIME_TAG - 1 );
+                    return false;
+                }
+
+                break;
+            }
+
+            // ------------------------------------
+
+            case 'V':
+                _printVersion( r );
+                return false;
+
+            // ------------------------------------
+
+            case 'l':
+                r->options->listenPort = atoi( optarg );
+
+                if ( ( r->options->listenPort <= 0 ) || ( r->options->listenPort > 0xffff ) )
+                {
+                    genericsReport( V_ERROR, "Port to listen on is out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'm':
+                r->options->intervalReportTime = atoi( optarg );
+
+                if ( r->options->intervalReportTime < 500 )
+                {
+                    genericsReport( V_ERROR, "intervalReportTime is out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'M':
+                r->options->mono = true;
+                break;
+
+            // ------------------------------------
+
+            case 'n':
+                r->options->sn = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'o':
+                r->options->outfile = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'O':
+                r->options->otcl = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'p':
+                r->options->port = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'P':
+                r->options->paceDelay = atoi( optarg );
+
+                if ( r->options->paceDelay <= 0 )
+                {
+                    genericsReport( V_ERROR, "paceDelay is out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'r':
+                if ( atoi( optarg ) <= 0 )
+                {
+                    genericsReport( V_ERROR, "Rotation size is out of range" EOL );
+                    return false;
+                }
+
+                r->options->rotateMB = atoi( optarg );
+                break;
+
+            // ------------------------------------
+
+            case 'R':
+                if ( atoi( optarg ) <= 0 )
+                {
+                    genericsReport( V_ERROR, "Rotation time is out of range" EOL );
+                    return false;
+                }
+
+                r->options->rotateSecs = atoi( optarg );
+                break;
+
             // ------------------------------------
 
             case 's':
                 r->options->nwserverHost = optarg;
+                r->options->nwserver = true;
 
-                // See if we have an optional port number too
+                // See if we have an optional port number too...the default depends on what's at the other end
                 char *a = optarg;
 
                 while ( ( *a ) && ( *a != ':' ) )
@@ -544,12 +1400,20 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
                 if ( *a == ':' )
                 {
-                    r->options->nwserverPort = atoi( ++a );
+                    *a++ = 0;
+                    r->options->nwserverPort = atoi( a );
                 }
 
-                if ( !r->options->nwserverPort )
+                break;
+
+            // ------------------------------------
+            case 'S':
+                r->options->statsPort = atoi( optarg );
+
+                if ( ( r->options->statsPort <= 0 ) || ( r->options->statsPort > 65535 ) )
                 {
-                    r->options->nwserverPort = NWSERVER_PORT;
+                    genericsReport( V_ERROR, "Stats port out of range" EOL );
+                    return false;
                 }
 
                 break;
@@ -565,6 +1429,25 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 break;
 
             // ------------------------------------
+            case 'u':
+                r->options->relay = true;
+                r->options->relayQoS = NW_QOS_LATENCY;
+
+                if ( optarg )
+                {
+                    if ( strcmp( optarg, "bulk" ) )
+                    {
+                        genericsReport( V_ERROR, "Relay can only be asked to be bulk" EOL );
+                        return false;
+                    }
+
+                    r->options->relayQoS = NW_QOS_BULK;
+                }
+
+                break;
+
+            // ------------------------------------
+
             case 'v':
                 if ( !isdigit( *optarg ) )
                 {
@@ -580,6 +1463,87 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
                 break;
 
+            // ------------------------------------
+            case 'K':
+                r->options->controlPort = atoi( optarg );
+
+                if ( ( r->options->controlPort <= 0 ) || ( r->options->controlPort > 65535 ) )
+                {
+                    genericsReport( V_ERROR, "Control port out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'x':
+                r->options->metricsPort = atoi( optarg );
+
+                if ( ( r->options->metricsPort <= 0 ) || ( r->options->metricsPort > 65535 ) )
+                {
+                    genericsReport( V_ERROR, "Metrics port out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'X':
+                r->options->profile = true;
+                break;
+
+            // ------------------------------------
+#if !defined( WIN32 )
+
+            case 'w':
+                if ( !_swoSamplesSpec( optarg, &r->options->swoConfig ) )
+                {
+                    genericsReport( V_ERROR, "SWO samples should be <bit>[,u|m][,<bytes a sample>][,<samples a bit>]" EOL );
+                    return false;
+                }
+
+                r->options->swoSamples = true;
+                break;
+
+            // ------------------------------------
+
+            case 'Y':
+                r->options->schedPolicy = ( !strncasecmp( optarg, "fifo", 4 ) ) ? SCHED_FIFO : ( !strncasecmp( optarg, "rr", 2 ) ) ? SCHED_RR : 0;
+                r->options->schedPriority = ( a = strchr( optarg, DELIMITER ) ) ? atoi( a + 1 ) : DEFAULT_RT_PRIORITY;
+
+                if ( ( !r->options->schedPolicy ) ||
+                        ( r->options->schedPriority < sched_get_priority_min( r->options->schedPolicy ) ) ||
+                        ( r->options->schedPriority > sched_get_priority_max( r->options->schedPolicy ) ) )
+                {
+                    genericsReport( V_ERROR, "Scheduling policy must be fifo or rr, with a priority from %d to %d" EOL,
+                                    sched_get_priority_min( SCHED_FIFO ), sched_get_priority_max( SCHED_FIFO ) );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+#endif
+
+            case 'z':
+                r->options->compress = true;
+                break;
+
+            // ------------------------------------
+
+            case 'Z':
+                r->options->archive = ( optarg ) ? atoi( optarg ) : CAPTURE_ARCHIVE_LEVEL;
+
+                if ( ( r->options->archive < 1 ) || ( r->options->archive > 9 ) )
+                {
+                    genericsReport( V_ERROR, "Archive level should be 1..9" EOL );
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
 
             case '?':
@@ -601,6 +1565,24 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 // ------------------------------------
         }
 
+    if ( ( r->options->pcHistmS ) && ( !r->options->msgPort ) )
+    {
+        genericsReport( V_ERROR, "PC sample histograms go out on the message port, so need -i" EOL );
+        return false;
+    }
+
+    if ( ( r->options->rtt ) && ( ( r->options->nwserver ) || ( r->options->port ) || ( r->options->file ) ||
+                                  ( ( r->options->sn ) && ( strchr( r->options->sn, ',' ) ) ) ) )
+    {
+        genericsReport( V_ERROR, "RTT is read from a single USB probe, so can't be used with another source" EOL );
+        return false;
+    }
+
+    if ( ( r->options->nwserver ) && ( !r->options->nwserverPort ) )
+    {
+        r->options->nwserverPort = ( r->options->relay ) ? OFCLIENT_SERVER_PORT : NWSERVER_PORT;
+    }
+
     /* ... and dump the config if we're being verbose */
     genericsReport( V_INFO, "orbuculum version " GIT_DESCRIBE EOL );
 
@@ -609,6 +1591,15 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
         /* For the base of a UART only 8 of 10 bits contain useful data */
         r->options->dataSpeed = ( r->options->dataSpeed * 8 ) / 10;
     }
+    else if ( ( r->options->dapSpeed ) && ( !r->options->dataSpeed ) )
+    {
+        /* ...and that goes for SWO too */
+        r->options->dataSpeed = ( r->options->dapSpeed * 8 ) / 10;
+    }
+    else if ( ( r->options->ftdiSpeed ) && ( !r->options->dataSpeed ) )
+    {
+        r->options->dataSpeed = ( r->options->ftdiSpeed * 8 ) / 10;
+    }
 
     if ( r->options->intervalReportTime )
     {
@@ -630,23 +1621,69 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsReport( V_INFO, "Serial Number  : %s" EOL, r->options->sn );
     }
 
-    if ( r->options->dataSpeed )
+    if ( r->options->dapSpeed )
     {
-        genericsReport( V_INFO, "Max Data Rt    : %d bps" EOL, r->options->dataSpeed );
+        genericsReport( V_INFO, "CMSIS-DAP SWO  : %d baud" EOL, r->options->dapSpeed );
     }
 
-    if ( r->options->outfile )
+    if ( r->options->rtt )
     {
-        genericsReport( V_INFO, "Raw Output file: %s" EOL, r->options->outfile );
+        if ( r->options->rttLen )
+        {
+            genericsReport( V_INFO, "RTT            : Search 0x%08x-0x%08x, from tag %d" EOL, r->options->rttAddr,
+                            r->options->rttAddr + r->options->rttLen - 1, r->options->rttTag );
+        }
+        else
+        {
+            genericsReport( V_INFO, "RTT            : At 0x%08x, from tag %d" EOL, r->options->rttAddr, r->options->rttTag );
+        }
     }
 
-    if ( r->options->nwserverPort )
+    if ( r->options->ftdi )
     {
-        genericsReport( V_INFO, "NW Server      : %s:%d" EOL, r->options->nwserverHost, r->options->nwserverPort );
-    }
-
-    genericsReport( V_INFO, "Use/Strip TPIU : %s" EOL, r->options->useTPIU ? "True" : "False" );
-    genericsReport( V_INFO, "Decode/Forward : %s" EOL, r->options->channelList ? r->options->channelList : "None" );
+        if ( r->options->ftdiSpeed )
+        {
+            genericsReport( V_INFO, "FTDI UART      : %d baud" EOL, r->options->ftdiSpeed );
+        }
+        else
+        {
+            genericsReport( V_INFO, "FTDI           : Synchronous FIFO" EOL );
+        }
+    }
+
+    if ( r->options->dataSpeed )
+    {
+        genericsReport( V_INFO, "Max Data Rt    : %d bps" EOL, r->options->dataSpeed );
+    }
+
+    if ( r->options->outfile )
+    {
+        genericsReport( V_INFO, "Raw Output file: %s" EOL, r->options->outfile );
+
+        if ( r->options->rotateMB )
+        {
+            genericsReport( V_INFO, "Rotate at      : %d MBytes" EOL, r->options->rotateMB );
+        }
+
+        if ( r->options->rotateSecs )
+        {
+            genericsReport( V_INFO, "Rotate every   : %d seconds" EOL, r->options->rotateSecs );
+        }
+
+        if ( r->options->archive )
+        {
+            genericsReport( V_INFO, "Archived at    : zlib level %d" EOL, r->options->archive );
+        }
+    }
+
+    if ( r->options->nwserverPort )
+    {
+        genericsReport( V_INFO, "NW Server      : %s:%d%s" EOL, r->options->nwserverHost, r->options->nwserverPort,
+                        ( r->options->relay ) ? ( ( r->options->relayQoS == NW_QOS_BULK ) ? " (bulk relay)" : " (relay)" ) : "" );
+    }
+
+    genericsReport( V_INFO, "Use/Strip TPIU : %s" EOL, r->options->useTPIU ? "True" : "False" );
+    genericsReport( V_INFO, "Decode/Forward : %s" EOL, r->options->channelList ? r->options->channelList : "None" );
 
     if ( r->options->otcl )
     {
@@ -655,9 +1692,81 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
     genericsReport( V_INFO, "OFLOW Port     : %d" EOL, r->options->listenPort );
 
+    if ( r->options->shmName )
+    {
+        genericsReport( V_INFO, "OFLOW Shm      : %s" EOL, r->options->shmName );
+    }
+
+    if ( r->options->mcastSpec )
+    {
+        genericsReport( V_INFO, "OFLOW Mcast    : %s" EOL, r->options->mcastSpec );
+    }
+
+    if ( r->options->statsPort )
+    {
+        genericsReport( V_INFO, "Stats Port     : %d" EOL, r->options->statsPort );
+    }
+
+    if ( r->options->metricsPort )
+    {
+        genericsReport( V_INFO, "Metrics Port   : %d" EOL, r->options->metricsPort );
+    }
+
+    if ( r->options->controlPort )
+    {
+        genericsReport( V_INFO, "Control Port   : %d" EOL, r->options->controlPort );
+    }
+
+    if ( r->options->msgPort )
+    {
+        genericsReport( V_INFO, "Message Port   : %d" EOL, r->options->msgPort );
+    }
+
+    if ( r->options->pcHistmS )
+    {
+        genericsReport( V_INFO, "PC Histograms  : Every %dms" EOL, r->options->pcHistmS );
+    }
+
+    for ( int i = 0; i < r->options->numPlugins; i++ )
+    {
+        genericsReport( V_INFO, "Plugin         : %s" EOL, r->options->plugins[i] );
+    }
+
+    if ( r->options->spillDir )
+    {
+        genericsReport( V_INFO, "Bulk Spill     : %s (up to %d MBytes per client)" EOL, r->options->spillDir, r->options->spillMB );
+    }
+    else if ( r->options->spillMemMB )
+    {
+        genericsReport( V_INFO, "Bulk Spill     : Memory (up to %d MBytes per client)" EOL, r->options->spillMemMB );
+    }
+
+    if ( r->options->historyMB )
+    {
+        if ( r->options->historySecs )
+        {
+            genericsReport( V_INFO, "History        : %d MBytes, up to %d seconds" EOL, r->options->historyMB, r->options->historySecs );
+        }
+        else
+        {
+            genericsReport( V_INFO, "History        : %d MBytes" EOL, r->options->historyMB );
+        }
+    }
+
+    if ( r->options->budgetMB )
+    {
+        genericsReport( V_INFO, "Memory Budget  : %d MBytes, then %s" EOL, r->options->budgetMB, _shedName[r->options->shedPolicy] );
+    }
+
     if ( r->options->file )
     {
         genericsReport( V_INFO, "Pace Delay     : %dus" EOL, r->options->paceDelay );
+
+        if ( r->options->realtime )
+        {
+            genericsReport( V_INFO, "Replay         : At capture rate" EOL );
+        }
+
         genericsReport( V_INFO, "Input File  : %s", r->options->file );
 
         if ( r->options->fileTerminate )
@@ -668,6 +1777,12 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
         {
             genericsReport( V_INFO, " (Ongoing read)" EOL );
         }
+
+        if ( r->options->swoSamples )
+        {
+            genericsReport( V_INFO, "SWO Samples    : Bit %u of %u byte samples, %s" EOL, r->options->swoConfig.channel, r->options->swoConfig.unitSize,
+                            ( r->options->swoConfig.encoding == SWO_SAMPLES_MANCHESTER ) ? "Manchester" : "UART" );
+        }
     }
 
     if ( r->options->hiresTime )
@@ -675,6 +1790,16 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsReport( V_INFO, "High Res Time" EOL );
     }
 
+    if ( r->options->adaptiveUSB )
+    {
+        genericsReport( V_INFO, "Adaptive USB transfers" EOL );
+    }
+
+    if ( r->options->coalesceuS )
+    {
+        genericsReport( V_INFO, "Coalesce OFLOW : %d uS" EOL, r->options->coalesceuS );
+    }
+
     if ( ( r->options->file ) && ( ( r->options->port ) || ( r->options->nwserverPort ) ) )
     {
         genericsReport( V_ERROR, "Cannot specify file and port or NW Server at same time" EOL );
@@ -687,41 +1812,179 @@ bool _processOptions( int argc, char *argv[], struct RunTime *r )
         return false;
     }
 
+    if ( ( r->options->realtime ) && ( ( !r->options->file ) || ( r->options->paceDelay ) ) )
+    {
+        genericsReport( V_ERROR, "Realtime replay needs an input file, and doesn't go with a Pace Delay" EOL );
+        return false;
+    }
+
+    if ( ( r->options->swoSamples ) && ( ( !r->options->file ) || ( r->options->realtime ) ) )
+    {
+        genericsReport( V_ERROR, "SWO samples are read from an input file, and can't be replayed in realtime" EOL );
+        return false;
+    }
+
     if ( ( r->options->port ) && ( r->options->nwserverPort ) )
     {
         genericsReport( V_ERROR, "Cannot specify port and NW Server at same time" EOL );
         return false;
     }
 
+    if ( ( r->options->sn ) && ( strchr( r->options->sn, ',' ) ) && ( ( r->options->file ) || ( r->options->port ) || ( r->options->nwserverPort ) ) )
+    {
+        genericsReport( V_ERROR, "Several serial numbers can only be served from USB probes" EOL );
+        return false;
+    }
+
+    if ( ( r->options->relay ) && ( ( !r->options->nwserver ) || ( r->options->useTPIU ) ) )
+    {
+        genericsReport( V_ERROR, "Relay needs a NW Server, and what it relays is never TPIU" EOL );
+        return false;
+    }
+
     return true;
 }
 // ====================================================================================================
+static inline void _count( atomic_uint_fast64_t *c, uint64_t n )
+
+/* Add to a counter that only one thread writes, but that others (e.g. the metrics server) may read */
+
+{
+    atomic_store_explicit( c, atomic_load_explicit( c, memory_order_relaxed ) + n, memory_order_relaxed );
+}
+// ====================================================================================================
+static inline void _countTag( struct RunTime *r, uint8_t tag, uint64_t n )
+
+/* Account for data decoded for a tag, standing in for any that went by undecoded (see _sampleBlock) */
+
+{
+    n = n * r->statsMul / r->statsDiv;
+    _count( &r->tagCount[tag].totalData, n );
+    r->tagCount[tag].intervalData += n;
+}
+// ====================================================================================================
+static inline uint64_t _profStart( void )
+
+/* Start timing a stage, if stages are being timed. What's returned goes to _profEnd */
+
+{
+    return ( atomic_load_explicit( &_profiling, memory_order_relaxed ) ) ? genericsMonotonicnS() : 0;
+}
+// ====================================================================================================
+static inline void _profEnd( struct RunTime *r, enum profStage s, uint64_t start )
+
+{
+    if ( start )
+    {
+        struct profCounter *c = &r->prof[s];
+        uint64_t t = genericsMonotonicnS() - start;
+
+        _count( &c->calls, 1 );
+        _count( &c->ns, t );
+
+        if ( t > atomic_load_explicit( &c->maxns, memory_order_relaxed ) )
+        {
+            atomic_store_explicit( &c->maxns, t, memory_order_relaxed );
+        }
+    }
+}
+// ====================================================================================================
+static void _sendStats( struct RunTime *r, uint64_t bps, struct latencyStats *dispatch, struct latencyStats *send )
+
+/* Send a line of statistics to anyone connected to the stats port. Latencies are in uS */
+
+{
+    char l[MAX_LINE_LEN];
+    int n;
+
+    if ( !r->statsHandler )
+    {
+        return;
+    }
+
+    n = snprintf( l, MAX_LINE_LEN, "%s%s%sconn=%d bps=%" PRIu64 " dropped=%" PRIu64
+                  " dispatch_n=%" PRIu64 " dispatch_p50=%" PRIu64 " dispatch_p99=%" PRIu64 " dispatch_p999=%" PRIu64 " dispatch_max=%" PRIu64
+                  " send_n=%" PRIu64 " send_p50=%" PRIu64 " send_p99=%" PRIu64 " send_p999=%" PRIu64 " send_max=%" PRIu64 "\n",
+                  ( r->probe ) ? "probe=" : "", ( r->probe ) ? r->probe : "", ( r->probe ) ? " " : "",
+                  r->conn, bps, nwclientDroppedBytes( r->oflowHandler ),
+                  dispatch->count, dispatch->p50 / 1000, dispatch->p99 / 1000, dispatch->p999 / 1000, dispatch->max / 1000,
+                  send->count, send->p50 / 1000, send->p99 / 1000, send->p999 / 1000, send->max / 1000 );
+
+    nwclientSend( r->statsHandler, ( n < MAX_LINE_LEN ) ? n : MAX_LINE_LEN - 1, ( uint8_t * )l );
+}
+// ====================================================================================================
+static void _reportProfile( struct RunTime *r, uint32_t interval )
+
+/* For each stage that ran in the interval, how much of it was spent there and the longest it took once */
+
+{
+    for ( enum profStage s = 0; s < PROF_NUM_STAGES; s++ )
+    {
+        struct profCounter *c = &r->prof[s];
+        uint64_t calls = atomic_load_explicit( &c->calls, memory_order_relaxed );
+        uint64_t ns = atomic_load_explicit( &c->ns, memory_order_relaxed );
+
+        if ( calls != c->lastCalls )
+        {
+            genericsReport( V_INFO, " %s=%d.%d%%/%" PRIu64 "uS", _profStageName[s],
+                            ( int )( ( ns - c->lastns ) / ( interval * 10000ULL ) ), ( int )( ( ns - c->lastns ) / ( interval * 1000ULL ) % 10 ),
+                            ( uint64_t )atomic_exchange_explicit( &c->maxns, 0, memory_order_relaxed ) / 1000 );
+        }
+
+        c->lastCalls = calls;
+        c->lastns = ns;
+    }
+}
+// ====================================================================================================
 void _checkInterval( void *params )
 
 /* Perform any interval reporting that may be needed */
 
 {
     struct RunTime *r = ( struct RunTime * )params;
+    uint32_t interval = ( r->options->intervalReportTime ) ? r->options->intervalReportTime : STATS_INTERVAL_MS;
+    struct latencyStats dispatch, send;
     struct timespec ts;
     uint64_t tnow;
     uint64_t snapInterval;
     int w;
 
-    if ( r->options->intervalReportTime )
+    /* Once clients are being handed over nothing more may go to them from here */
+    if ( atomic_load( &r->handingOver ) )
+    {
+        return;
+    }
+
+    /* Anyone who has just subscribed can have their history now, even if there's nothing new to send them */
+    nwclientReplayHistory( r->oflowHandler );
+
+    if ( ( r->options->intervalReportTime ) || ( r->statsHandler ) )
     {
         clock_gettime( CLOCK_REALTIME, &ts );
         tnow = ts.tv_sec * 1000000000L + ts.tv_nsec;
 
-        if ( tnow - r->lastInterval >= r->options->intervalReportTime * 1000000L )
+        if ( tnow - r->lastInterval >= interval * 1000000L )
         {
             r->lastInterval = tnow;
 
             /* Grab the interval and scale to bits per 1 second */
-            snapInterval = r->intervalRawBytes * 8000L / r->options->intervalReportTime;
+            snapInterval = r->intervalRawBytes * 8000L / interval;
 
-            if ( r->conn )
+            /* ...and the latencies over the same interval */
+            latencyTake( &r->dispatchLatency, &dispatch );
+            latencyTake( nwclientSendLatency( r->oflowHandler ), &send );
+            _sendStats( r, snapInterval, &dispatch, &send );
+
+            if ( ( r->probe ) && ( r->options->intervalReportTime ) )
+            {
+                /* With several probes sharing the screen each reports on a line of its own, named for the probe */
+                pthread_mutex_lock( &_reportLock );
+                genericsPrintf( C_DATA "%s: " C_RESET "%s", r->probe, ( r->conn ) ? "" : "No connection" EOL );
+            }
+
+            if ( ( r->conn ) && ( r->options->intervalReportTime ) )
             {
-                genericsPrintf( C_PREV_LN C_DATA );
+                genericsPrintf( "%s" C_DATA, ( r->probe ) ? "" : C_PREV_LN );
 
                 if ( snapInterval / 1000000 )
                 {
@@ -777,10 +2040,51 @@ void _checkInterval( void *params )
                     genericsPrintf( "(" C_DATA " %3d%% " C_RESET "full)", ( fullPercent > 100 ) ? 100 : fullPercent );
                 }
 
-                genericsReport( V_INFO, "Ce=%d Oe=%d", OFLOWGetCOBSErrors( &_r.oflow ), OFLOWGetErrors( &_r.oflow ) );
+                genericsReport( V_INFO, "Ce=%" PRIu64 " Oe=%" PRIu64 " Dr=%" PRIu64, OFLOWGetCOBSErrors( &r->oflow ), OFLOWGetErrors( &r->oflow ), nwclientDroppedBytes( r->oflowHandler ) );
+
+                /* Latencies as median/99th percentile/worst, from block arrival to queueing and queueing to the socket */
+                genericsReport( V_INFO, " Lq=%" PRIu64 "/%" PRIu64 "/%" PRIu64 "uS Ls=%" PRIu64 "/%" PRIu64 "/%" PRIu64 "uS",
+                                dispatch.p50 / 1000, dispatch.p99 / 1000, dispatch.max / 1000, send.p50 / 1000, send.p99 / 1000, send.max / 1000 );
+
+                if ( r->pipelineRunning )
+                {
+                    /* Report the deepest each pipeline queue got during this interval */
+                    genericsReport( V_INFO, " Dq=%d Wq=%d",
+                                    ( int )atomic_exchange( &r->decodeQ.hwm, 0 ), ( int )atomic_exchange( &r->writeQ.hwm, 0 ) );
+                }
+
+                if ( r->options->budgetMB )
+                {
+                    /* Memory held for network clients, against what they're allowed */
+                    struct nwclientMemory m;
+                    nwclientMemoryStats( &m );
+                    genericsReport( V_INFO, " Mem=%" PRIu64 "/%" PRIu64 "M", m.total >> 20, m.budget >> 20 );
+                }
+
+                if ( r->o )
+                {
+                    /* How the USB transfers are running, with the proportion that came back short */
+                    uint64_t tfrs = atomic_load( &r->tfrCount ) - r->lastTfrCount;
+                    uint64_t tfrShort = atomic_load( &r->tfrShort ) - r->lastTfrShort;
+                    r->lastTfrCount += tfrs;
+                    r->lastTfrShort += tfrShort;
+                    genericsReport( V_INFO, " Ud=%d Ul=%dK Us=%d%%", atomic_load( &r->inFlight ), r->usbLength / 1024,
+                                    ( tfrs ) ? ( int )( ( tfrShort * 100ULL ) / tfrs ) : 0 );
+                }
+
+                if ( atomic_load_explicit( &_profiling, memory_order_relaxed ) )
+                {
+                    _reportProfile( r, interval );
+                }
+
                 genericsPrintf( "   " C_RESET C_CLR_LN EOL );
             }
 
+            if ( ( r->probe ) && ( r->options->intervalReportTime ) )
+            {
+                pthread_mutex_unlock( &_reportLock );
+            }
+
             r->intervalRawBytes = 0;
         }
     }
@@ -788,712 +2092,3746 @@ void _checkInterval( void *params )
 // ====================================================================================================
 // Block decoders and handlers for the various line formats
 // ====================================================================================================
-static void _purgeBlock( struct RunTime *r, bool createOFLOW )
+static void _sendOFLOW( struct RunTime *r, ssize_t len, const uint8_t *d, struct nwclientBlock *b )
 
-/* Send any packets to clients who want it, no matter where they originate from */
+/* Send OFLOW data to the network clients (lending them b if it's set) and to any shared memory clients */
 
 {
-    struct Frame oflowOtg;
-    struct handlers *h = r->handler;
-    int i = r->numHandlers;
+    uint64_t prof = _profStart();
 
-    while ( i-- )
+    if ( b )
     {
-        if ( h->strippedBlock->fillLevel )
-        {
-            nwclientSend( h->n, h->strippedBlock->fillLevel, h->strippedBlock->buffer );
-
-            if ( createOFLOW )
-            {
-                /* The OFLOW encoded version goes out on the combined OFLOW channel, with a specific channel header */
-                int j = h->strippedBlock->fillLevel;
-                const uint8_t *b = h->strippedBlock->buffer;
+        nwclientSendBlock( r->oflowHandler, b );
+    }
+    else
+    {
+        nwclientSend( r->oflowHandler, len, d );
+    }
 
-                while ( j )
-                {
-                    OFLOWEncode( h->channel, 0, b, ( j < OFLOW_MAX_PACKET_LEN ) ? j : OFLOW_MAX_PACKET_LEN, &oflowOtg );
-                    nwclientSend( _r.oflowHandler, oflowOtg.len, oflowOtg.d );
-                    b += ( j < OFLOW_MAX_PACKET_LEN ) ? j : OFLOW_MAX_PACKET_LEN;
-                    j -= ( j < OFLOW_MAX_PACKET_LEN ) ? j : OFLOW_MAX_PACKET_LEN;
-                }
-            }
+#if !defined( WIN32 )
 
-            h->strippedBlock->fillLevel = 0;
-        }
+    if ( r->oflowShm )
+    {
+        shmRingWrite( r->oflowShm, d, len );
+    }
 
-        h++;
+    if ( r->oflowMcast )
+    {
+        mcastWrite( r->oflowMcast, d, len );
     }
+
+#endif
+    _profEnd( r, PROF_SEND, prof );
 }
 // ====================================================================================================
-static void _TPIUpacketRxed( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param )
+static void _flushMulticast( struct RunTime *r )
 
-/* Callback for when a TPIU frame has been assembled */
+/* Datagrams are filled from what's sent, so what's left over at the end of a block goes now */
 
 {
-    struct RunTime *r = ( struct RunTime * )param;
-
-    struct handlers *h = NULL;
-    int cachedChannel = -1;
-    int chIndex = 0;
+#if !defined( WIN32 )
 
-    switch ( e )
+    if ( r->oflowMcast )
     {
-        case TPIU_EV_RXEDPACKET:
+        mcastFlush( r->oflowMcast );
+    }
 
-            /* Iterate through the packet, putting it into the correct output buffers */
-            for ( uint32_t g = 0; g < p->len; g++ )
-            {
-                if ( cachedChannel != p->packet[g].s )
-                {
-                    /* Whatever happens, cache this result */
-                    cachedChannel = p->packet[g].s;
+#endif
+}
+// ====================================================================================================
+static void _stampOFLOW( struct RunTime *r, uint64_t stamp )
 
-                    /* Search for channel */
-                    h = r->handler;
+/* What's sent next was received at stamp, so say so if that's later than the last time we did. */
+/* Time frames only ever go forward, so anything held from before the last one inherits it.     */
 
-                    for ( chIndex = 0; chIndex < r->numHandlers; chIndex++ )
-                    {
-                        if ( h->channel == p->packet[g].s )
-                        {
-                            break;
-                        }
+{
+    uint8_t t[OFLOW_TIME_ENC_LEN];
+    int len;
 
-                        h++;
-                    }
-                }
+    if ( stamp > r->lastStamp )
+    {
+        r->lastStamp = stamp;
+        len = OFLOWEncodeTime( stamp, t );
+        _sendOFLOW( r, len, t, NULL );
 
-                r->tagCount[p->packet[g].s].totalData++;
-                r->tagCount[p->packet[g].s].intervalData++;
+        /* Every subscriber takes time frames, whatever else it asked for */
+        nwclientSendTag( r->oflowHandler, OFLOW_TIME_TAG, len, t );
+    }
+}
+// ====================================================================================================
+static void _sendOFLOWFrame( uint8_t tag, uint64_t heldSince, const uint8_t *d, unsigned int len, void *param )
 
-                if ( ( chIndex != r->numHandlers ) && ( h ) )
-                {
-                    /* We must have found a match for this at some point, so add it to the queue */
-                    h->strippedBlock->buffer[h->strippedBlock->fillLevel++] = p->packet[g].d;
-                }
-                else
-                {
-                    genericsReport( V_DEBUG, "No handler for tag %d" EOL, p->packet[g].s );
-                }
-            }
+/* Send an OFLOW frame we built ourselves. Since we know its tag it can go to subscribed clients too */
 
-            break;
+{
+    struct RunTime *r = ( struct RunTime * )param;
 
-        case TPIU_EV_ERROR:
-            genericsReport( V_WARN, "****ERROR****%s" EOL, ( r->options->intervalReportTime ) ? EOL : "" );
-            break;
+    _stampOFLOW( r, heldSince );
+    _sendOFLOW( r, len, d, NULL );
+    nwclientSendTag( r->oflowHandler, tag, len, d );
+}
+// ====================================================================================================
+static bool _hasSync( const uint8_t *d, int len )
 
-        case TPIU_EV_NEWSYNC:
-        case TPIU_EV_SYNCED:
-        case TPIU_EV_RXING:
-        case TPIU_EV_NONE:
-        case TPIU_EV_UNSYNCED:
-        default:
-            break;
+/* Is there anything a trace decoder could sync up on in here? */
+
+{
+    int zeros = 0;
+
+    for ( int i = 0; i < len; i++ )
+    {
+        if ( ( d[i] == SYNC_END ) && ( zeros >= SYNC_MIN_ZEROS ) )
+        {
+            return true;
+        }
+
+        zeros = ( d[i] ) ? 0 : zeros + 1;
     }
+
+    return false;
 }
 // ====================================================================================================
+static void _encodeOFLOW( struct RunTime *r, struct OFLOWCoalesce *c, const uint8_t *d, int len )
 
-static void _OFLOWpacketRxed( struct OFLOWFrame *p, void *param )
-
-/* OFLOW packet received, account for it and reflect it to legacy buffers if needed */
+/* Turn data for a tag into OFLOW frames. Full frames go straight away, and what's left over either */
+/* goes too, or is held for more to arrive and go with it if we're coalescing.                      */
 
 {
-    int chIndex;
-    struct RunTime *r = ( struct RunTime * )param;
-    struct handlers *h = _r.handler;
+    uint64_t prof = _profStart();
 
-    if ( !p->good )
+    if ( ( r->options->historyMB ) && _hasSync( d, len ) )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        /* The next frame for this tag has (or is followed by) the sync, late subscribers can start there */
+        nwclientMarkTag( r->oflowHandler, c->tag );
     }
-    else if ( ( r->options->useTPIU ) && ( h->channel == DEFAULT_ITM_STREAM ) )
+
+    OFLOWCoalesceAdd( c, d, len, r->rxTime, _sendOFLOWFrame, r );
+
+    if ( !r->options->coalesceuS )
     {
-        /* Deal with the bizzare combination of OFLOW and TPIU in channel 1 */
-        /* Accounting will be done in TPIUPump */
-        TPIUPump( &r->t, p->d, p->len, _TPIUpacketRxed, r );
+        OFLOWCoalesceFlush( c, _sendOFLOWFrame, r );
     }
-    else
+
+    _profEnd( r, PROF_ENCODE, prof );
+}
+// ====================================================================================================
+static uint64_t _flushOFLOW( struct RunTime *r, bool all )
+
+/* Send any held OFLOW that has waited long enough (or all of it). Returns how long it is until */
+/* the next of what's still held is due, or STAGE_WAIT_NS if nothing is.                         */
+
+{
+    uint64_t now = genericsMonotonicnS();
+    uint64_t holdnS = r->options->coalesceuS * 1000ULL;
+    uint64_t next = STAGE_WAIT_NS;
+    struct OFLOWCoalesce *c;
+    bool flushed = false;
+
+    for ( int i = -1; i < r->numHandlers; i++ )
     {
-        /* Account for this reception */
-        r->tagCount[p->tag].totalData += p->len;
-        r->tagCount[p->tag].intervalData += p->len;
+        c = ( i < 0 ) ? &r->itmOflowOtg : r->handler[i].oflowOtg;
 
-        /* Search for channel */
-        for ( chIndex = 0; chIndex < r->numHandlers; chIndex++ )
+        if ( OFLOWCoalesceHeld( c ) )
         {
-            if ( h->channel == p->tag )
+            if ( ( all ) || ( now - c->heldSince >= holdnS ) )
             {
-                break;
+                OFLOWCoalesceFlush( c, _sendOFLOWFrame, r );
+                flushed = true;
+            }
+            else if ( c->heldSince + holdnS - now < next )
+            {
+                next = c->heldSince + holdnS - now;
             }
-
-            h++;
         }
+    }
+
+    if ( flushed )
+    {
+        _flushMulticast( r );
+    }
+
+    return next;
+}
+// ====================================================================================================
+static void _purgeBlock( struct RunTime *r, bool createOFLOW )
+
+/* Send any packets to clients who want it, no matter where they originate from */
+
+{
+    struct handlers *h = r->handler;
+    int i = r->numHandlers;
 
-        if ( ( chIndex != r->numHandlers ) && ( h ) )
+    while ( i-- )
+    {
+        if ( h->strippedBlock->fillLevel )
         {
-            /* We must have found a match for this at some point, so add it to the queue */
-            for ( int i = 0; i < p->len; i++ )
-            {
-                h->strippedBlock->buffer[h->strippedBlock->fillLevel++] = p->d[i];
+            uint64_t prof = _profStart();
+            nwclientSend( h->n, h->strippedBlock->fillLevel, h->strippedBlock->buffer );
+            _profEnd( r, PROF_SEND, prof );
 
-                if ( h->strippedBlock->fillLevel == sizeof( h->strippedBlock->buffer ) )
-                {
-                    /* We filled this block...better send it right now */
-                    nwclientSend( h->n, h->strippedBlock->fillLevel, h->strippedBlock->buffer );
-                    h->strippedBlock->fillLevel = 0;
-                }
+            if ( ( createOFLOW ) && ( r->wantOFLOW ) )
+            {
+                /* The OFLOW encoded version goes out on the combined OFLOW channel, with a specific channel header */
+                _encodeOFLOW( r, h->oflowOtg, h->strippedBlock->buffer, h->strippedBlock->fillLevel );
             }
+
+            h->strippedBlock->fillLevel = 0;
         }
+
+        h++;
     }
 }
-
 // ====================================================================================================
+static void _sendMsgFrame( struct RunTime *r )
 
-static void _processNonOFLOWBlock( struct RunTime *r, ssize_t fillLevel, uint8_t *buffer )
+/* Send the frame of decoded messages built so far, with each subscriber getting only what it asked for */
 
-/* Not an OFLOW block, so might be TPIU or clean ITM...deal with both */
+{
+    uint32_t len = msgStreamFinish( &r->msgFrame );
+
+    if ( len )
+    {
+        nwclientSendFiltered( r->msgHandler, len, r->msgFrame.d, msgStreamFilter, NULL );
+    }
+}
+// ====================================================================================================
+static void _sendPCHist( struct RunTime *r )
+
+/* The interval is over, so its counts go out, in as many records and frames as it takes */
 
 {
-    struct Frame oflowOtg;
+    struct msgStreamHist h;
 
-    if ( fillLevel )
+    pcHistTake( r->pcHist, &h );
+
+    while ( true )
     {
-        if ( r-> options->useTPIU )
+        if ( !msgStreamAddHist( &r->msgFrame, &h ) )
         {
-            /* Strip the TPIU framing from this input */
-            TPIUPump( &r->t, buffer, fillLevel, _TPIUpacketRxed, r );
+            _sendMsgFrame( r );
         }
-        else
+        else if ( !h.n )
         {
-            /* Not TPIU ... need to assume this is ITM on the first channel..and assume it's present */
-            r->tagCount[DEFAULT_ITM_STREAM].totalData += fillLevel;
-            r->tagCount[DEFAULT_ITM_STREAM].intervalData += fillLevel;
+            break;
+        }
+    }
+}
+// ====================================================================================================
+static void _queueMsg( struct RunTime *r, struct msg *m )
 
-            if ( r->handler )
-            {
-                nwclientSend( r->handler->n, fillLevel, buffer );
-            }
+/* Add a decoded message to the frame for the message port */
 
-            /* The OFLOW encoded version goes out on the default OFLOW channel */
-            uint8_t *b = buffer;
+{
+    if ( m->genericMsg.msgtype == MSG_TS )
+    {
+        r->msgTSSeen = true;
+    }
 
-            while ( fillLevel )
-            {
-                OFLOWEncode( DEFAULT_ITM_STREAM, 0, b,
-                             ( fillLevel < OFLOW_MAX_PACKET_LEN ) ? fillLevel : OFLOW_MAX_PACKET_LEN,
-                             &oflowOtg );
-                nwclientSend( r->oflowHandler, oflowOtg.len, oflowOtg.d );
-                b += ( fillLevel < OFLOW_MAX_PACKET_LEN ) ? fillLevel : OFLOW_MAX_PACKET_LEN;
-                fillLevel -= ( fillLevel < OFLOW_MAX_PACKET_LEN ) ? fillLevel : OFLOW_MAX_PACKET_LEN;
-            }
-        }
+    if ( ( r->pcHist ) && ( m->genericMsg.msgtype == MSG_PC_SAMPLE ) )
+    {
+        /* Counted here as well as sent, the clients each say which they'd rather have */
+        pcHistAdd( r->pcHist, &m->pcSampleMsg );
+    }
+
+    if ( !msgStreamAdd( &r->msgFrame, m ) )
+    {
+        /* Frame is full, so it goes now and this starts the next one */
+        _sendMsgFrame( r );
+        msgStreamAdd( &r->msgFrame, m );
     }
 }
 // ====================================================================================================
-static void _handleBlock( struct RunTime *r, ssize_t fillLevel, uint8_t *buffer )
+static void _decodeMsgs( struct RunTime *r, const uint8_t *d, size_t len )
 
-/* Handle an incoming block from any source in either 'conventional' or orbflow format */
+/* Decode ITM for the message port, so its clients don't each have to do it themselves */
 
 {
-    if ( fillLevel )
-    {
-        genericsReport( V_DEBUG, "RXED Packet of %d bytes%s" EOL, fillLevel, ( r->options->intervalReportTime ) ? EOL : "" );
+    struct msg *m;
 
-        if ( r->opFileHandle )
+    while ( len-- )
+    {
+        if ( MSGSeqPump( &r->msgSeq, *d++ ) )
         {
-            if ( write( r->opFileHandle, buffer, fillLevel ) <= 0 )
+            while ( ( m = MSGSeqGetPacket( &r->msgSeq ) ) )
             {
-                genericsExit( -3, "Writing to file failed" EOL );
+                _queueMsg( r, m );
             }
         }
+    }
+}
+// ====================================================================================================
+static void _flushMsgs( struct RunTime *r )
 
-        if ( r->usingOFLOW )
-        {
-            if ( r->options->intervalReportTime )
-            {
-                /* We need to decode this so we can get the stats out of it .. we don't bother if we don't need stats */
-                OFLOWPump( &r->oflow, buffer, fillLevel, _OFLOWpacketRxed, r );
-            }
+/* End of an incoming block, so send on whatever has been decoded from it */
 
-            /* ...and reflect this packet to the outgoing OFLOW channels, if we don't need to reconstruct them */
-            if ( !r->options->useTPIU )
-            {
-                nwclientSend( r->oflowHandler, fillLevel, buffer );
-            }
-        }
-        else
+{
+    struct msg *m;
+
+    if ( !r->msgTSSeen )
+    {
+        /* Without timestamps from the target there's nothing to put in order, so don't hold on to anything */
+        while ( ( m = MSGSeqGetPacket( &r->msgSeq ) ) )
         {
-            _processNonOFLOWBlock( r, fillLevel, buffer );
+            _queueMsg( r, m );
         }
+    }
 
-        r->intervalRawBytes += fillLevel;
-
-        /* Send the block to clients, but only send OFLOW if it wasn't OFLOW already */
-        /* or if we're decoding TPIU in the default tag */
-        _purgeBlock( r, ( !r->usingOFLOW ) || r->options->useTPIU );
+    if ( ( r->pcHist ) && ( genericsTimestampmS() - r->pcHistStartmS >= r->options->pcHistmS ) )
+    {
+        _sendPCHist( r );
+        r->pcHistStartmS = genericsTimestampmS();
     }
 
-    _checkInterval( r );
+    _sendMsgFrame( r );
 }
-
 // ====================================================================================================
-// Generic handlers for each of the source types. These all call _handleBlock above to process.
-// ====================================================================================================
-static void _usb_callback( struct libusb_transfer *t )
+static void _TPIUspansRxed( enum TPIUPumpEvent e, const struct TPIUSpan *s, int nspans, void *param )
 
-/* For the USB case the ringbuffer isn't used .. packets are sent directly from this callback */
+/* Callback for when a run of TPIU frames has been decoded into per-stream spans */
 
 {
-    /* Whatever the status that comes back, there may be data... */
-    _handleBlock( &_r, t->actual_length, t->buffer );
+    struct RunTime *r = ( struct RunTime * )param;
+    struct handlers *h;
 
-    if ( ( t->status != LIBUSB_TRANSFER_COMPLETED ) &&
-            ( t->status != LIBUSB_TRANSFER_TIMED_OUT ) &&
-            ( t->status != LIBUSB_TRANSFER_CANCELLED )
-       )
+    switch ( e )
     {
-        if ( !_r.errored )
-        {
-            genericsReport( V_WARN, "Errored out with status %d (%s)" EOL, t->status, libusb_error_name( t->status ) );
-        }
+        case TPIU_EV_RXEDPACKET:
+            for ( ; nspans--; s++ )
+            {
+                _countTag( r, s->stream, s->len );
+
+                if ( ( s->stream == DEFAULT_ITM_STREAM ) && ( r->wantMsgs ) )
+                {
+                    _decodeMsgs( r, s->d, s->len );
+                }
+
+                if ( !( h = r->tagHandler[s->stream] ) )
+                {
+                    genericsReportRateLimited( V_DEBUG, "No handler for tag %d" EOL, s->stream );
+                    continue;
+                }
+
+                if ( !h->wanted )
+                {
+                    /* Nobody to give it to */
+                    continue;
+                }
+
+                if ( h->strippedBlock->fillLevel + s->len > sizeof( h->strippedBlock->buffer ) )
+                {
+                    /* This block would overflow...better send what we've got right now */
+                    nwclientSend( h->n, h->strippedBlock->fillLevel, h->strippedBlock->buffer );
+                    h->strippedBlock->fillLevel = 0;
+                }
+
+                memcpy( &h->strippedBlock->buffer[h->strippedBlock->fillLevel], s->d, s->len );
+                h->strippedBlock->fillLevel += s->len;
+            }
+
+            break;
 
-        _r.errored = true;
+        case TPIU_EV_ERROR:
+            genericsReport( V_WARN, "****ERROR****%s" EOL, ( r->options->intervalReportTime ) ? EOL : "" );
+            break;
+
+        case TPIU_EV_NEWSYNC:
+        case TPIU_EV_SYNCED:
+        case TPIU_EV_RXING:
+        case TPIU_EV_NONE:
+        case TPIU_EV_UNSYNCED:
+        default:
+            break;
     }
-    else
+}
+// ====================================================================================================
+static void _stripInto( struct handlers *h, const uint8_t *d, int len )
+
+/* Add data for a tag to what's going out on its legacy port */
+
+{
+    for ( int i = 0; i < len; i++ )
     {
-        if ( t->status != LIBUSB_TRANSFER_CANCELLED )
+        h->strippedBlock->buffer[h->strippedBlock->fillLevel++] = d[i];
+
+        if ( h->strippedBlock->fillLevel == sizeof( h->strippedBlock->buffer ) )
         {
-            libusb_submit_transfer( t );
+            /* We filled this block...better send it right now */
+            nwclientSend( h->n, h->strippedBlock->fillLevel, h->strippedBlock->buffer );
+            h->strippedBlock->fillLevel = 0;
         }
     }
 }
-
 // ====================================================================================================
 
-void _actionOrbtraceCommand( struct RunTime *r, char *sn, enum ORBTraceDevice d )
+static void _OFLOWpacketRxed( struct OFLOWFrame *p, void *param )
 
-/* There is an orbtrace command line to be executed as part of the probe connect process */
+/* OFLOW packet received, account for it and reflect it to legacy buffers if needed */
 
 {
-    char commandLine[MAX_LINE_LEN];
+    struct RunTime *r = ( struct RunTime * )param;
+    struct handlers *h = r->handler;
+    struct Frame oflowOtg;
 
-    /* If we have any configuration to do on this device, go ahead */
-    if ( r->options->otcl )
+    if ( ( p->good ) && ( !r->options->useTPIU ) && ( nwclientSubscribers( r->oflowHandler ) || r->options->historyMB ) )
     {
-        if ( getenv( ORBTRACEENVNAME ) )
+        /* Clients that subscribed to specific tags get whole frames for just those, rather than the raw flow */
+        if ( ( r->options->historyMB ) && _hasSync( p->d, p->len ) )
         {
-            snprintf( commandLine, MAX_LINE_LEN, "%s %s %s %s", getenv( ORBTRACEENVNAME ), r->options->otcl, sn ? ( ( d == DEVICE_ORBTRACE_MINI ) ? "-n " : "-s " ) : "", sn ? sn : "" );
+            nwclientMarkTag( r->oflowHandler, p->tag );
         }
-        else
-        {
-            char *baseDirectory = genericsGetBaseDirectory( );
 
-            if ( !baseDirectory )
-            {
-                genericsExit( -1, "Failed to establish base directory" EOL );
-            }
+        uint64_t prof = _profStart();
+        OFLOWEncode( p->tag, p->tstamp, p->d, p->len, &oflowOtg );
+        _profEnd( r, PROF_ENCODE, prof );
 
-            snprintf( commandLine, MAX_LINE_LEN, "%s" ORBTRACE " %s %s %s", baseDirectory, r->options->otcl, sn ? ( ( d == DEVICE_ORBTRACE_MINI ) ? "-n " : "-s " ) : "", sn ? sn : "" );
-            free( baseDirectory );
-        }
+        prof = _profStart();
+        nwclientSendTag( r->oflowHandler, p->tag, oflowOtg.len, oflowOtg.d );
+        _profEnd( r, PROF_SEND, prof );
+    }
 
-        genericsReport( V_INFO, "%s" EOL, commandLine );
+    if ( !p->good )
+    {
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
+    }
+    else if ( p->tag == OFLOW_TIME_TAG )
+    {
+        /* Only there to stamp the frames that follow it, which it's done */
+    }
+    else if ( ( r->options->useTPIU ) && ( h->channel == DEFAULT_ITM_STREAM ) )
+    {
+        /* Deal with the bizzare combination of OFLOW and TPIU in channel 1 */
+        /* Accounting will be done in TPIUPump */
+        uint64_t prof = _profStart();
+        TPIUPumpSpans( &r->t, p->d, p->len, _TPIUspansRxed, r );
+        _profEnd( r, PROF_TPIU, prof );
+    }
+    else
+    {
+        /* Account for this reception */
+        _countTag( r, p->tag, p->len );
 
-        if (  system( commandLine ) )
+        if ( ( p->tag == DEFAULT_ITM_STREAM ) && ( r->wantMsgs ) )
         {
-            genericsReport( V_ERROR, "Invoking orbtrace failed" EOL );
+            _decodeMsgs( r, p->d, p->len );
+        }
+
+        if ( ( h = r->tagHandler[p->tag] ) && ( h->wanted ) )
+        {
+            /* We must have found a match for this at some point, so add it to the queue */
+            _stripInto( h, p->d, p->len );
         }
     }
 }
 
 // ====================================================================================================
-static int _usbFeeder( struct RunTime *r )
+static void _takeDemand( struct RunTime *r )
 
-/* Setup USB transfers from an ORBTrace or BMP */
+/* See who is listening to what, for the block that's about to be decoded. Nobody connected to a */
+/* port means nothing needs to be made for it, and with nobody at all the decoders can sit idle. */
 
 {
-    bool firstRunThrough = true;
-    int workingDev;
+    bool createOFLOW = ( !r->usingOFLOW ) || ( r->options->useTPIU );
 
-    /* Copy any part serial number across */
-    if ( r->options->sn )
+    r->wantOFLOW = ( nwclientConnected( r->oflowHandler ) ) || ( r->options->historyMB );
+#if !defined( WIN32 )
+    /* Shared memory and multicast readers can't be counted, so they're always there */
+    r->wantOFLOW |= ( r->oflowShm ) || ( r->oflowMcast );
+#endif
+    r->wantMsgs = ( nwclientConnected( r->msgHandler ) != 0 );
+    r->wantDecode = r->wantMsgs;
+
+    for ( int i = 0; i < r->numHandlers; i++ )
     {
-        r->sn = strdup( r->options->sn );
+        /* A handler's data goes to its own port, and to the OFLOW port if we're making that from it */
+        r->handler[i].wanted = ( nwclientConnected( r->handler[i].n ) ) || ( ( createOFLOW ) && ( r->wantOFLOW ) );
+        r->wantDecode |= r->handler[i].wanted;
     }
 
-    while ( !r->ending )
+    if ( ( r->usingOFLOW ) && ( !r->options->useTPIU ) )
     {
-        r->errored = false;
+        /* Tag subscribers (and the history kept for them) get frames split out of the flow */
+        r->wantDecode |= ( nwclientSubscribers( r->oflowHandler ) ) || ( r->options->historyMB );
+    }
+}
+// ====================================================================================================
+static bool _sampleBlock( struct RunTime *r, ssize_t fillLevel, bool canStart )
 
-        /* ...just in case we had a context */
-        OrbtraceIfDestroyContext( r->o );
-        r->o = OrbtraceIfCreateContext();
-        assert( r->o );
+/* Should this block go through the decoders? It does while anything but the monitor wants what they */
+/* make. For the monitor alone a run of blocks is decoded every so often, with what's counted from   */
+/* them standing for what went by in between. canStart is false if this block starts part way       */
+/* through a frame, so the decoders can only carry on with it, not start.                          */
 
-        while ( 0 == OrbtraceIfGetDeviceList( r->o, r->sn, DEVTYPE_ALL ) )
-        {
-            usleep( INTERVAL_1S );
-        }
+{
+    bool stats = ( r->options->intervalReportTime != 0 );
+    bool decode;
 
-        genericsReport( V_INFO, "Found device" EOL );
-        workingDev = OrbtraceIfSelectDevice( r->o );
+    r->sampleBlock++;
 
-        if ( !OrbtraceIfOpenDevice( r->o, workingDev ) )
-        {
-            genericsReport( V_INFO, "Couldn't open device" EOL );
-            break;
-        }
+    if ( r->decoding )
+    {
+        /* Carry on to the end of the run, and never stop part way through a frame */
+        decode = ( r->wantDecode ) || ( !canStart ) || ( ( stats ) && ( r->sampleBlock < STATS_SAMPLE_RUN ) );
+    }
+    else
+    {
+        decode = ( canStart ) && ( ( r->wantDecode ) || ( ( stats ) && ( r->sampleBlock >= STATS_SAMPLE_EVERY ) ) );
 
-        /* Take a record of what device we're using...we'll use that next time around to re-connect */
-        if ( r->sn )
+        if ( decode )
         {
-            free( r->sn );
+            /* What the TPIU decoder was part way through has gone by, so it has to find sync again */
+            r->sampleBlock = 0;
+            TPIUDecoderUnsync( &r->t );
         }
+    }
 
-        r->sn = strdup( OrbtraceIfGetSN( r->o, workingDev ) );
-
-        /* Before we open, perform any orbtrace configuration that is needed */
-        _actionOrbtraceCommand( r, r->sn, OrbtraceIfGetDevtype( r->o, workingDev ) );
+    if ( decode )
+    {
+        r->statsMul = r->sampleSkipped + fillLevel;
+        r->statsDiv = fillLevel;
+        r->sampleSkipped = 0;
+    }
+    else
+    {
+        /* Only worth keeping count of if the monitor is going to make up for it */
+        r->sampleSkipped = ( stats ) ? r->sampleSkipped + fillLevel : 0;
+    }
 
-        if ( !OrbtraceGetIfandEP( r->o ) )
-        {
-            genericsReport( V_INFO, "Couldn't get IF and EP" EOL );
-            break;
-        }
+    r->decoding = decode;
+    return decode;
+}
+// ====================================================================================================
+static void _processNonOFLOWBlock( struct RunTime *r, ssize_t fillLevel, uint8_t *buffer, struct nwclientBlock *b )
 
-        r->usingOFLOW = OrbtraceSupportsOFLOW( r->o );
+/* Not an OFLOW block, so might be TPIU or clean ITM...deal with both */
 
-        if ( r->usingOFLOW )
-        {
-            genericsReport( V_INFO, "Orbtrace supports ORBFLOW protocol" EOL );
+{
+    if ( fillLevel )
+    {
+        if ( r-> options->useTPIU )
+        {
+            if ( _sampleBlock( r, fillLevel, true ) )
+            {
+                /* Strip the TPIU framing from this input */
+                uint64_t prof = _profStart();
+                TPIUPumpSpans( &r->t, buffer, fillLevel, _TPIUspansRxed, r );
+                _profEnd( r, PROF_TPIU, prof );
+            }
+        }
+        else
+        {
+            /* Not TPIU ... need to assume this is ITM on the first channel..and assume it's present */
+            _count( &r->tagCount[DEFAULT_ITM_STREAM].totalData, fillLevel );
+            r->tagCount[DEFAULT_ITM_STREAM].intervalData += fillLevel;
 
-            if ( r->options->useTPIU )
+            if ( r->wantMsgs )
             {
-                genericsReport( V_WARN, "TPIU decoding specified, but ORBTrace supports ORBFLOW, are you sure?" EOL );
+                _decodeMsgs( r, buffer, fillLevel );
             }
 
-            if ( firstRunThrough && _r.opFileHandle )
+            if ( ( r->handler ) && ( r->handler->wanted ) )
             {
-                if ( write( _r.opFileHandle, OFLOW_SIG, OFLOW_SIG_LEN ) < 0 )
+                if ( b )
                 {
-                    genericsExit( -4, "Could not write OFLOW signature to file (%s)" EOL, strerror( errno ) );
+                    nwclientSendBlock( r->handler->n, b );
+                }
+                else
+                {
+                    nwclientSend( r->handler->n, fillLevel, buffer );
                 }
             }
 
-            /* We only attempt to write the file header on the first run through */
-            firstRunThrough = false;
+            /* The OFLOW encoded version goes out on the default OFLOW channel */
+            if ( r->wantOFLOW )
+            {
+                _encodeOFLOW( r, &r->itmOflowOtg, buffer, fillLevel );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _reconfigDone( struct RunTime *r, atomic_bool *due )
+
+/* Let the control port know that what it asked for has been taken up */
+
+{
+    pthread_mutex_lock( &r->rc.l );
+    atomic_store( due, false );
+    pthread_cond_broadcast( &r->rc.c );
+    pthread_mutex_unlock( &r->rc.l );
+}
+// ====================================================================================================
+static void _takeFileChanges( struct RunTime *r )
+
+/* Make any changes to the output file the control port has asked for, between writes */
+
+{
+    if ( !atomic_load_explicit( &r->rc.fileDue, memory_order_acquire ) )
+    {
+        return;
+    }
+
+    r->rc.fileOK = true;
+
+    if ( r->rc.setRotation )
+    {
+        captureSetRotation( r->capture, r->rc.rotateBytes, r->rc.rotateSecs );
+    }
+
+    if ( r->rc.rotateNow )
+    {
+        r->rc.fileOK = captureRotate( r->capture );
+    }
+
+    _reconfigDone( r, &r->rc.fileDue );
+}
+// ====================================================================================================
+static void _writeBlock( struct RunTime *r, ssize_t fillLevel, uint8_t *buffer )
+
+/* Write block to the local output file, if there is one */
+
+{
+    struct captureSeg s = { .d = buffer, .len = fillLevel };
+
+    if ( r->capture )
+    {
+        uint64_t prof;
+
+        _takeFileChanges( r );
+        prof = _profStart();
+
+        if ( !captureWrite( r->capture, &s, 1 ) )
+        {
+            genericsExit( -3, "Writing to file failed" EOL );
+        }
+
+        _profEnd( r, PROF_WRITE, prof );
+    }
+}
+// ====================================================================================================
+static void _mapHandlers( struct RunTime *r )
+
+/* Build the tag lookup for the handlers (first one wins for duplicates) */
+
+{
+    memset( r->tagHandler, 0, sizeof( r->tagHandler ) );
+
+    for ( int i = 0; i < NUM_TAGS; i++ )
+    {
+        r->tagCount[i].hasHandler = false;
+    }
+
+    for ( int i = 0; i < r->numHandlers; i++ )
+    {
+        r->tagCount[r->handler[i].channel].hasHandler = true;
+
+        if ( !r->tagHandler[r->handler[i].channel] )
+        {
+            r->tagHandler[r->handler[i].channel] = &r->handler[i];
+        }
+    }
+}
+// ====================================================================================================
+static void _takeHandlers( struct RunTime *r )
+
+/* Swap in any legacy handlers the control port has made. This is done between blocks, when nothing is */
+/* left in the old ones. Ports that are kept carry on with their clients, whichever tag they now carry. */
+
+{
+    struct handlers *old = r->handler;
+    int oldNum = r->numHandlers;
+
+    if ( !atomic_load_explicit( &r->rc.handlersDue, memory_order_acquire ) )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &_handlerLock );
+
+    for ( int i = 0; i < oldNum; i++ )
+    {
+        bool kept = ( i < r->rc.numHandlers );
+
+        if ( ( !kept ) || ( r->rc.handler[i].oflowOtg != old[i].oflowOtg ) )
+        {
+            /* Whatever is held for the tag it carried goes now, before it's forgotten */
+            OFLOWCoalesceFlush( old[i].oflowOtg, _sendOFLOWFrame, r );
+            free( old[i].oflowOtg );
+        }
+
+        if ( !kept )
+        {
+            nwclientShutdown( old[i].n );
+            bufPoolFree( old[i].strippedBlock );
+        }
+    }
+
+    r->handler = r->rc.handler;
+    r->numHandlers = r->rc.numHandlers;
+    _mapHandlers( r );
+    pthread_mutex_unlock( &_handlerLock );
+
+    _flushMulticast( r );
+    free( old );
+    _reconfigDone( r, &r->rc.handlersDue );
+}
+// ====================================================================================================
+static void _decodeBlock( struct RunTime *r, ssize_t fillLevel, uint8_t *buffer, struct nwclientBlock *b )
+
+/* Decode an incoming block in either 'conventional' or orbflow format and queue it for clients. If b */
+/* is set then the buffer can be lent to the network clients rather than being copied for them.      */
+
+{
+    if ( fillLevel )
+    {
+        uint64_t prof = _profStart();
+        ORB_PROBE( orbuculum, block, fillLevel, r->rxTime );
+#if !defined( WIN32 )
+
+        if ( r->plugins )
+        {
+            /* Plugins get the block before anyone else has a chance to hold it up */
+            pluginHostFeed( r->plugins, buffer, fillLevel, b, r->usingOFLOW );
+        }
+
+#endif
+
+        _takeDemand( r );
+
+        if ( r->usingOFLOW )
+        {
+            bool startAligned = r->oflowAligned;
+
+            if ( ( !r->options->relay ) && ( !r->options->useTPIU ) && ( r->oflowAligned ) )
+            {
+                /* We can only slip a time frame in between frames. A relay keeps the stamps it was given */
+                _stampOFLOW( r, r->rxTime );
+            }
+
+            r->oflowAligned = ( COBS_SYNC_CHAR == buffer[fillLevel - 1] );
+
+            if ( _sampleBlock( r, fillLevel, startAligned ) )
+            {
+                /* We need to decode this to get the stats out of it, to split it by tag for subscribed clients */
+                /* (or the history they'll be given), to feed the legacy ports, or to get at the ITM for the   */
+                /* message port.                                                                              */
+                uint64_t oflowProf = _profStart();
+                OFLOWPump( &r->oflow, buffer, fillLevel, _OFLOWpacketRxed, r );
+                _profEnd( r, PROF_OFLOW, oflowProf );
+            }
+
+            /* ...and reflect this packet to the outgoing OFLOW channels, if we don't need to reconstruct them */
+            if ( !r->options->useTPIU )
+            {
+                _sendOFLOW( r, fillLevel, buffer, b );
+            }
         }
         else
         {
-            genericsReport( V_INFO, "Orbtrace supports legacy protocol" EOL );
+            _processNonOFLOWBlock( r, fillLevel, buffer, b );
         }
 
-        genericsReport( V_DEBUG, "USB Interface claimed, ready for data" EOL );
+        r->intervalRawBytes += fillLevel;
+        _count( &r->totalRawBytes, fillLevel );
 
-        /* Create the USB transfer blocks .. if we are connected depends on if there was an error submitting the requests */
-        r->errored = !( r->conn = OrbtraceIfSetupTransfers( r->o, r->options->hiresTime, r->rawBlock, NUM_RAW_BLOCKS, _usb_callback ) );
+        /* Send the block to clients, but only send OFLOW if it wasn't OFLOW already */
+        /* or if we're decoding TPIU in the default tag */
+        _purgeBlock( r, ( !r->usingOFLOW ) || r->options->useTPIU );
+        _flushMulticast( r );
 
-        /* =========================== The main dispatch loop ======================================= */
-        while ( ( !r->ending )  && ( !r->errored ) )
+        if ( r->wantMsgs )
         {
-            int ret =   OrbtraceIfHandleEvents( r->o );
+            _flushMsgs( r );
+        }
 
-            if ( ( ret ) && ( ret != LIBUSB_ERROR_INTERRUPTED ) )
+        /* Everything from this block has been handed over to the clients now */
+        uint64_t dispatched = genericsMonotonicnS() - r->rxTime;
+        latencyRecord( &r->dispatchLatency, dispatched );
+        ORB_PROBE( orbuculum, block_done, fillLevel, dispatched );
+        _profEnd( r, PROF_DECODE, prof );
+    }
+
+    _takeHandlers( r );
+    _checkInterval( r );
+}
+// ====================================================================================================
+static void _decodeRTT( struct RunTime *r )
+
+/* Send on what's been read from RTT up-buffers, as ORBFLOW on their own tags just as though it had */
+/* come in with the SWO. Frames can only go into the flow itself between frames of the flow from the */
+/* probe, so while that's part way through one, RTT only goes to the clients subscribed to its tags. */
+
+{
+    bool intoFlow = ( !r->usingOFLOW ) || ( r->options->useTPIU ) || ( r->oflowAligned );
+    struct handlers *h;
+    struct Frame f;
+    uint64_t when;
+    uint8_t *d;
+    uint8_t tag;
+    size_t len;
+    int l;
+
+    pthread_mutex_lock( &r->rttLock );
+    d = r->rttPend;
+    len = r->rttPendLen;
+    r->rttPend = r->rttTake;
+    r->rttPendLen = 0;
+    r->rttTake = d;
+    pthread_mutex_unlock( &r->rttLock );
+
+    if ( !len )
+    {
+        return;
+    }
+
+    _takeDemand( r );
+
+    for ( uint8_t *p = d; p < d + len; p += RTT_REC_HDR + l )
+    {
+        tag = p[0];
+        l = p[1] | ( p[2] << 8 );
+        memcpy( &when, &p[3], sizeof( when ) );
+
+        _countTag( r, tag, l );
+
+        if ( ( tag == DEFAULT_ITM_STREAM ) && ( r->wantMsgs ) )
+        {
+            _decodeMsgs( r, &p[RTT_REC_HDR], l );
+        }
+
+        if ( ( h = r->tagHandler[tag] ) && ( h->wanted ) )
+        {
+            _stripInto( h, &p[RTT_REC_HDR], l );
+        }
+
+        if ( ( r->options->historyMB ) && _hasSync( &p[RTT_REC_HDR], l ) )
+        {
+            nwclientMarkTag( r->oflowHandler, tag );
+        }
+
+        OFLOWEncode( tag, when, &p[RTT_REC_HDR], l, &f );
+
+        if ( intoFlow )
+        {
+            _stampOFLOW( r, when );
+            _sendOFLOW( r, f.len, f.d, NULL );
+        }
+
+        nwclientSendTag( r->oflowHandler, tag, f.len, f.d );
+    }
+
+    /* It's on its way as ORBFLOW already, so its legacy ports mustn't be made into more of it */
+    _purgeBlock( r, false );
+    _flushMulticast( r );
+
+    if ( r->wantMsgs )
+    {
+        _flushMsgs( r );
+    }
+}
+// ====================================================================================================
+static void _handleBlock( struct RunTime *r, ssize_t fillLevel, uint8_t *buffer )
+
+/* Handle an incoming block from any source, all in the calling thread */
+
+{
+    r->rxTime = genericsMonotonicnS();
+
+    if ( fillLevel )
+    {
+        genericsReportRateLimited( V_DEBUG, "RXED Packet of %d bytes%s" EOL, fillLevel, ( r->options->intervalReportTime ) ? EOL : "" );
+        _writeBlock( r, fillLevel, buffer );
+    }
+
+    _decodeBlock( r, fillLevel, buffer, NULL );
+
+    /* There's no decode thread to come back for anything held, so it goes now too */
+    _flushOFLOW( r, true );
+}
+
+// ====================================================================================================
+// Pipeline for USB data. The libusb callback only queues the completed buffer and resubmits the
+// transfer (with a spare buffer swapped in), the decode thread does TPIU/OFLOW processing and queues
+// data for the network clients, and the write thread deals with the output file. The network clients
+// are serviced by their own sender threads. Serial data uses the same pipeline, the feeder reading
+// into each spare block in turn.
+// ====================================================================================================
+static void _stageInit( struct stageQueue *s )
+
+{
+    atomic_init( &s->wp, 0 );
+    atomic_init( &s->rp, 0 );
+    atomic_init( &s->hwm, 0 );
+    pthread_mutex_init( &s->l, NULL );
+    pthread_cond_init( &s->c, NULL );
+}
+// ====================================================================================================
+static void _stageKick( struct stageQueue *s )
+
+/* Wake whoever is waiting on the queue, for a block or for anything else there is for it */
+
+{
+    pthread_mutex_lock( &s->l );
+    s->kicked = true;
+    pthread_cond_signal( &s->c );
+    pthread_mutex_unlock( &s->l );
+}
+// ====================================================================================================
+static void _stagePush( struct stageQueue *s, struct usbBlockRef *u )
+
+/* Add a block to the queue. There are never more blocks than queue slots, so this always fits */
+
+{
+    size_t wp = atomic_load_explicit( &s->wp, memory_order_relaxed );
+    size_t depth = wp + 1 - atomic_load_explicit( &s->rp, memory_order_acquire );
+
+    assert( depth <= STAGE_QUEUE_LEN );
+    nwclientBlockRetain( &u->b );
+    s->q[wp & STAGE_QUEUE_MASK] = u;
+    atomic_store_explicit( &s->wp, wp + 1, memory_order_release );
+
+    if ( depth > atomic_load_explicit( &s->hwm, memory_order_relaxed ) )
+    {
+        atomic_store_explicit( &s->hwm, depth, memory_order_relaxed );
+    }
+
+    _stageKick( s );
+}
+// ====================================================================================================
+static struct usbBlockRef *_stageTryPop( struct stageQueue *s )
+
+/* Get the next block from the queue if there is one, without waiting */
+
+{
+    size_t rp = atomic_load_explicit( &s->rp, memory_order_relaxed );
+
+    if ( rp == atomic_load_explicit( &s->wp, memory_order_acquire ) )
+    {
+        return NULL;
+    }
+
+    struct usbBlockRef *u = s->q[rp & STAGE_QUEUE_MASK];
+    atomic_store_explicit( &s->rp, rp + 1, memory_order_release );
+    return u;
+}
+// ====================================================================================================
+static struct usbBlockRef *_stagePop( struct stageQueue *s, uint64_t waitnS )
+
+/* Get the next block from the queue, waiting up to waitnS for one if it's empty. Returns NULL on timeout */
+
+{
+    struct timespec ts;
+    size_t rp = atomic_load_explicit( &s->rp, memory_order_relaxed );
+
+    if ( rp == atomic_load_explicit( &s->wp, memory_order_acquire ) )
+    {
+        pthread_mutex_lock( &s->l );
+
+        if ( !s->kicked )
+        {
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_nsec += waitnS;
+
+            if ( ts.tv_nsec >= 1000000000L )
             {
-                genericsReport( V_ERROR, "Error waiting for USB requests to complete %d" EOL, ret );
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
             }
 
+            pthread_cond_timedwait( &s->c, &s->l, &ts );
         }
 
-        /* ========================================================================================= */
+        s->kicked = false;
+        pthread_mutex_unlock( &s->l );
+    }
 
-        r->conn = false;
+    return _stageTryPop( s );
+}
+// ====================================================================================================
+static void *_decodeTask( void *arg )
 
-        /* Remove transfers from list and release the memory */
-        OrbtraceIfCloseTransfers( r->o );
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    struct usbBlockRef *u;
+    uint64_t waitnS = STAGE_WAIT_NS;
 
-        if ( !r->ending )
+    while ( !r->ending )
+    {
+        if ( ( u = _stagePop( &r->decodeQ, waitnS ) ) )
+        {
+            genericsReportRateLimited( V_DEBUG, "RXED Packet of %d bytes%s" EOL, u->b.len, ( r->options->intervalReportTime ) ? EOL : "" );
+
+            if ( r->capture )
+            {
+                _stagePush( &r->writeQ, u );
+            }
+
+            r->rxTime = u->rxTime;
+            _decodeBlock( r, u->b.len, ( uint8_t * )u->b.data, &u->b );
+            nwclientBlockRelease( &u->b );
+        }
+        else
+        {
+            /* Nothing arrived, but the interval report still needs to happen, and any changes taken up */
+            _takeHandlers( r );
+            _checkInterval( r );
+        }
+
+        if ( r->rttRunning )
+        {
+            _decodeRTT( r );
+        }
+
+        if ( r->options->coalesceuS )
+        {
+            /* Come back in time for whatever OFLOW is being held, if nothing arrives before then */
+            waitnS = _flushOFLOW( r, false );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void *_writeTask( void *arg )
+
+/* Whatever has queued up for the output file goes out in one write, so a burst of small USB */
+/* transfers doesn't turn into a burst of small system calls.                                */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    struct usbBlockRef *u[WRITE_GATHER_MAX];
+    struct captureSeg s[WRITE_GATHER_MAX];
+    int n;
+
+    while ( !r->ending )
+    {
+        /* Changes to the file are made between writes, or while there's nothing to write */
+        _takeFileChanges( r );
+
+        if ( !( u[0] = _stagePop( &r->writeQ, STAGE_WAIT_NS ) ) )
+        {
+            continue;
+        }
+
+        for ( n = 1; ( n < WRITE_GATHER_MAX ) && ( u[n] = _stageTryPop( &r->writeQ ) ); n++ );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            s[i].d   = u[i]->b.data;
+            s[i].len = u[i]->b.len;
+        }
+
+        uint64_t prof = _profStart();
+
+        if ( !captureWrite( r->capture, s, n ) )
+        {
+            genericsExit( -3, "Writing to file failed" EOL );
+        }
+
+        _profEnd( r, PROF_WRITE, prof );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            nwclientBlockRelease( &u[i]->b );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static struct usbBlockRef *_refForBuffer( struct RunTime *r, uint8_t *buffer )
+
+/* Find the lending record for a USB buffer, which may be a raw or a spare one */
+
+{
+    struct dataBlock *d = ( struct dataBlock * )( buffer - offsetof( struct dataBlock, buffer ) );
+
+    if ( ( d >= r->rawBlock ) && ( d < &r->rawBlock[NUM_RAW_BLOCKS] ) )
+    {
+        return &r->usbRef[d - r->rawBlock];
+    }
+
+    assert( ( d >= r->spareBlock ) && ( d < &r->spareBlock[NUM_SPARE_BLOCKS] ) );
+    return &r->usbRef[NUM_RAW_BLOCKS + ( d - r->spareBlock )];
+}
+// ====================================================================================================
+static struct usbBlockRef *_takeSpare( struct RunTime *r )
+
+{
+    struct usbBlockRef *u = NULL;
+
+    pthread_mutex_lock( &r->spareLock );
+
+    if ( r->numSpare )
+    {
+        u = r->spare[--r->numSpare];
+    }
+
+    pthread_mutex_unlock( &r->spareLock );
+    return u;
+}
+// ====================================================================================================
+static void _giveSpare( struct RunTime *r, struct usbBlockRef *u )
+
+{
+    pthread_mutex_lock( &r->spareLock );
+    assert( r->numSpare < NUM_USB_BLOCKS );
+    r->spare[r->numSpare++] = u;
+    pthread_mutex_unlock( &r->spareLock );
+}
+// ====================================================================================================
+static void _resetSpares( struct RunTime *r, bool all )
+
+/* On USB connection all the raw blocks go to the transfers, and the spare blocks are available. */
+/* Serial has no transfers, so all of the blocks are available to be read into.                 */
+
+{
+    struct usbBlockRef *u;
+
+    pthread_mutex_lock( &r->spareLock );
+    r->numSpare = 0;
+
+    for ( int i = ( all ) ? 0 : NUM_RAW_BLOCKS; i < NUM_USB_BLOCKS; i++ )
+    {
+        u = &r->usbRef[i];
+        u->b.data = ( i < NUM_RAW_BLOCKS ) ? r->rawBlock[i].buffer : r->spareBlock[i - NUM_RAW_BLOCKS].buffer;
+        u->t = NULL;
+        r->spare[r->numSpare++] = u;
+    }
+
+    pthread_mutex_unlock( &r->spareLock );
+}
+// ====================================================================================================
+static void _startPipeline( struct RunTime *r )
+
+{
+    if ( !r->pipelineRunning )
+    {
+        _stageInit( &r->decodeQ );
+        _stageInit( &r->writeQ );
+        pthread_mutex_init( &r->spareLock, NULL );
+
+        for ( int i = 0; i < NUM_USB_BLOCKS; i++ )
+        {
+            r->usbRef[i].r = r;
+        }
+
+        if ( pthread_create( &r->decodeThread, NULL, &_decodeTask, r ) ||
+                pthread_create( &r->writeThread, NULL, &_writeTask, r ) )
+        {
+            genericsExit( -1, "Failed to create pipeline threads" EOL );
+        }
+
+        _threadPolicy( r->options, r->decodeThread, THREAD_DECODE );
+        _threadPolicy( r->options, r->writeThread, THREAD_WRITE );
+
+        r->pipelineRunning = true;
+    }
+}
+// ====================================================================================================
+static void _submit( struct RunTime *r, struct libusb_transfer *t )
+
+/* Send a transfer back out, keeping count of how many are out there */
+
+{
+    atomic_fetch_add( &r->inFlight, 1 );
+
+    if ( libusb_submit_transfer( t ) )
+    {
+        atomic_fetch_sub( &r->inFlight, 1 );
+    }
+}
+// ====================================================================================================
+static void _resubmit( struct RunTime *r, struct libusb_transfer *t, int others )
+
+/* Put a transfer back to work, or park it if there are already enough out there. Called with usbLock held, */
+/* others being how many of the transfers counted as in flight are really on their way back.                */
+
+{
+    if ( ( r->options->adaptiveUSB ) && ( atomic_load( &r->inFlight ) - others >= r->usbDepth ) )
+    {
+        assert( r->numParked < NUM_RAW_BLOCKS );
+        r->parked[r->numParked++] = t;
+        return;
+    }
+
+    t->length = r->usbLength;
+    _submit( r, t );
+}
+// ====================================================================================================
+static void _adaptTransfers( struct RunTime *r, struct libusb_transfer *t )
+
+/* Judge from how full transfers are coming back whether they should be longer or deeper (when they're   */
+/* filling, as data is arriving faster than they complete) or shorter and fewer (when they're not, and   */
+/* the data is waiting for each one to time out). Called from the completion callback with usbLock held. */
+
+{
+    r->adaptFull += ( t->actual_length == t->length );
+
+    if ( ++r->adaptCount < ADAPT_WINDOW )
+    {
+        return;
+    }
+
+    if ( r->adaptFull * 4 >= r->adaptCount * 3 )
+    {
+        /* Mostly full...longer transfers first, so there's less overhead per byte, then more of them */
+        if ( r->usbLength < USB_TRANSFER_SIZE )
+        {
+            r->usbLength *= 2;
+        }
+        else if ( r->usbDepth < NUM_RAW_BLOCKS )
+        {
+            r->usbDepth = ( r->usbDepth * 2 < NUM_RAW_BLOCKS ) ? r->usbDepth * 2 : NUM_RAW_BLOCKS;
+        }
+    }
+    else if ( r->adaptFull * 4 < r->adaptCount )
+    {
+        /* Mostly short...shorter transfers first, since that's what gets data out sooner, then fewer */
+        if ( r->usbLength > ADAPT_MIN_LENGTH )
+        {
+            r->usbLength /= 2;
+        }
+        else if ( r->usbDepth > ADAPT_MIN_DEPTH )
+        {
+            r->usbDepth--;
+        }
+    }
+
+    genericsReport( V_DEBUG, "USB transfers %d full of %d, now %d deep x %d bytes" EOL, r->adaptFull, r->adaptCount, r->usbDepth, r->usbLength );
+    r->adaptCount = r->adaptFull = 0;
+
+    /* If we've got deeper then anything that was parked can go back out */
+    while ( ( r->numParked ) && ( atomic_load( &r->inFlight ) - 1 < r->usbDepth ) )
+    {
+        struct libusb_transfer *p = r->parked[--r->numParked];
+        p->length = r->usbLength;
+        _submit( r, p );
+    }
+}
+// ====================================================================================================
+static void _drainTransfers( struct RunTime *r )
+
+/* Cancel everything that's out with libusb and wait for it all to come back, so the transfers are */
+/* free to be set up again. If someone else is handling the USB events they'll see to the callbacks, */
+/* otherwise we have to.                                                                             */
+
+{
+    for ( int i = 0; i < NUM_RAW_BLOCKS; i++ )
+    {
+        if ( r->rawBlock[i].usbtfr )
+        {
+            libusb_cancel_transfer( r->rawBlock[i].usbtfr );
+        }
+    }
+
+    for ( int w = 0; ( w < INTERVAL_1S / INTERVAL_1MS ) && ( atomic_load( &r->inFlight ) > 0 ); w++ )
+    {
+        if ( r->usbContext )
+        {
+            usleep( INTERVAL_1MS );
+        }
+        else
+        {
+            OrbtraceIfHandleEventsTimeout( r->o, INTERVAL_1MS );
+        }
+    }
+}
+
+// ====================================================================================================
+// Generic handlers for each of the source types. These all call _handleBlock above, or queue into the pipeline.
+// ====================================================================================================
+static void _usbBlockReturned( struct nwclientBlock *b, void *param )
+
+/* Everyone has finished with a USB buffer, so it can go back to libusb or onto the spare stack */
+
+{
+    struct usbBlockRef *u = ( struct usbBlockRef * )param;
+    struct RunTime *r = u->r;
+
+    if ( !u->t )
+    {
+        _giveSpare( r, u );
+    }
+    else if ( u->resubmit )
+    {
+        pthread_mutex_lock( &r->usbLock );
+
+        /* Only resubmit if the transfer still belongs to the current connection */
+        if ( ( u->generation == r->usbGeneration ) && ( !r->errored ) && ( !r->ending ) )
+        {
+            _resubmit( r, u->t, 0 );
+        }
+
+        pthread_mutex_unlock( &r->usbLock );
+    }
+}
+// ====================================================================================================
+static void _usb_callback( struct libusb_transfer *t )
+
+/* For the USB case the ringbuffer isn't used. The completed buffer is queued for the decode stage and */
+/* a spare buffer goes back to libusb in its place. If there are no spares then the transfer is only   */
+/* resubmitted once everyone downstream has finished with its buffer.                                  */
+
+{
+    struct RunTime *r = ( struct RunTime * )t->user_data;
+    struct usbBlockRef *u = _refForBuffer( r, t->buffer );
+    struct usbBlockRef *spare = NULL;
+    size_t len = t->actual_length;
+    uint64_t prof = _profStart();
+    bool resubmit;
+
+    ORB_PROBE( orbuculum, usb_transfer, t->actual_length, t->status );
+
+    if ( ( t->status != LIBUSB_TRANSFER_COMPLETED ) &&
+            ( t->status != LIBUSB_TRANSFER_TIMED_OUT ) &&
+            ( t->status != LIBUSB_TRANSFER_CANCELLED )
+       )
+    {
+        if ( !r->errored )
+        {
+            genericsReport( V_WARN, "Errored out with status %d (%s)" EOL, t->status, libusb_error_name( t->status ) );
+        }
+
+        r->errored = true;
+        resubmit = false;
+    }
+    else
+    {
+        /* Once the connection is coming down nothing goes back out, so the transfers all drain */
+        resubmit = ( t->status != LIBUSB_TRANSFER_CANCELLED ) && ( !r->errored ) && ( !r->ending );
+    }
+
+    if ( t->status != LIBUSB_TRANSFER_CANCELLED )
+    {
+        atomic_fetch_add( &r->tfrCount, 1 );
+        atomic_fetch_add( &r->tfrShort, ( t->actual_length < t->length ) );
+    }
+
+    if ( ( resubmit ) && ( r->options->adaptiveUSB ) )
+    {
+        pthread_mutex_lock( &r->usbLock );
+        _adaptTransfers( r, t );
+        pthread_mutex_unlock( &r->usbLock );
+    }
+
+    /* Whatever the status that comes back, there may be data... */
+    if ( ( r->o->ftdiPacket ) && ( len ) )
+    {
+        /* ...although from an FTDI part some of it is only status, sent even when there's nothing else */
+        len = OrbtraceIfFTDIPayload( r->o, t->buffer, len );
+    }
+
+    nwclientBlockInit( &u->b, t->buffer, len, _usbBlockReturned, u );
+    u->generation = r->usbGeneration;
+    u->rxTime = genericsMonotonicnS();
+
+    if ( ( resubmit ) && ( len ) && ( spare = _takeSpare( r ) ) )
+    {
+        /* Swap the spare in and get the transfer straight back out there (this one is still counted in flight) */
+        u->t = NULL;
+        t->buffer = ( uint8_t * )spare->b.data;
+        pthread_mutex_lock( &r->usbLock );
+        _resubmit( r, t, 1 );
+        pthread_mutex_unlock( &r->usbLock );
+    }
+    else
+    {
+        /* This buffer goes back on this transfer when it's released */
+        u->t = t;
+        u->resubmit = resubmit;
+    }
+
+    if ( len )
+    {
+        _stagePush( &r->decodeQ, u );
+    }
+
+    /* ...and drop our own reference. If nobody else took one then this returns the buffer immediately */
+    nwclientBlockRelease( &u->b );
+
+    /* This transfer is finished with, unless it went straight back out above */
+    _profEnd( r, PROF_USB, prof );
+    atomic_fetch_sub( &r->inFlight, 1 );
+}
+// ====================================================================================================
+static void _waitForLentBlocks( struct RunTime *r )
+
+/* Give the pipeline and network clients a moment to give back any buffers they still hold */
+
+{
+    for ( int w = 0; w < INTERVAL_1S / INTERVAL_1MS; w++ )
+    {
+        int busy = 0;
+
+        for ( int i = 0; i < NUM_USB_BLOCKS; i++ )
+        {
+            busy += ( atomic_load( &r->usbRef[i].b.refs ) != 0 );
+        }
+
+        if ( !busy )
+        {
+            return;
+        }
+
+        usleep( INTERVAL_1MS );
+    }
+
+    genericsReport( V_INFO, "Clients still holding transfer buffers, continuing anyway" EOL );
+}
+// ====================================================================================================
+
+void _actionOrbtraceCommand( struct RunTime *r, char *sn, enum ORBTraceDevice d )
+
+/* There is an orbtrace command line to be executed as part of the probe connect process */
+
+{
+    char commandLine[MAX_LINE_LEN];
+
+    /* If we have any configuration to do on this device, go ahead */
+    if ( r->options->otcl )
+    {
+        if ( getenv( ORBTRACEENVNAME ) )
+        {
+            snprintf( commandLine, MAX_LINE_LEN, "%s %s %s %s", getenv( ORBTRACEENVNAME ), r->options->otcl, sn ? ( ( d == DEVICE_ORBTRACE_MINI ) ? "-n " : "-s " ) : "", sn ? sn : "" );
+        }
+        else
+        {
+            char *baseDirectory = genericsGetBaseDirectory( );
+
+            if ( !baseDirectory )
+            {
+                genericsExit( -1, "Failed to establish base directory" EOL );
+            }
+
+            snprintf( commandLine, MAX_LINE_LEN, "%s" ORBTRACE " %s %s %s", baseDirectory, r->options->otcl, sn ? ( ( d == DEVICE_ORBTRACE_MINI ) ? "-n " : "-s " ) : "", sn ? sn : "" );
+            free( baseDirectory );
+        }
+
+        genericsReport( V_INFO, "%s" EOL, commandLine );
+
+        if (  system( commandLine ) )
+        {
+            genericsReport( V_ERROR, "Invoking orbtrace failed" EOL );
+        }
+    }
+}
+
+// ====================================================================================================
+static void _queueRead( struct RunTime *r, struct usbBlockRef *u, ssize_t n )
+
+/* Data has been read into a spare block, so send it down the pipeline */
+
+{
+    nwclientBlockInit( &u->b, u->b.data, n, _usbBlockReturned, u );
+    u->rxTime = genericsMonotonicnS();
+    _stagePush( &r->decodeQ, u );
+    nwclientBlockRelease( &u->b );
+}
+// ====================================================================================================
+static void _park( struct RunTime *r )
+
+/* Nothing more is to be taken in, so say so and wait to be replaced */
+
+{
+    atomic_store( &r->feederParked, true );
+
+    while ( true )
+    {
+        usleep( INTERVAL_100MS );
+    }
+}
+// ====================================================================================================
+static bool _rttRead( void *param, uint32_t addr, uint8_t *d, uint32_t len )
+
+{
+    return OrbtraceIfTargetRead( ( struct OrbtraceIf * )param, addr, d, len );
+}
+// ====================================================================================================
+static bool _rttWrite( void *param, uint32_t addr, uint32_t v )
+
+{
+    return OrbtraceIfTargetWrite32( ( struct OrbtraceIf * )param, addr, v );
+}
+// ====================================================================================================
+struct rttFill
+{
+    struct RunTime *r;
+    uint8_t d[RTT_STAGE_LEN];                            /* Records of what one poll took, in ITM */
+    size_t len;                                          /* ...and how much there is so far */
+    uint64_t when;                                       /* When the poll was */
+    uint32_t lastSyncmS[RTT_MAX_UP_BUFFERS];             /* When each tag last had an ITM sync put in */
+    bool synced[RTT_MAX_UP_BUFFERS];                     /* ...if it has at all, since connecting */
+};
+
+static void _rttData( unsigned int buf, const uint8_t *d, uint32_t len, void *param )
+
+/* Up-buffer n goes out on a tag of its own as 1 byte ITM writes to channel n, so anything that */
+/* takes printf from SWO takes it from RTT just the same. A sync goes in now and again, so that */
+/* a client joining part way through knows where it is.                                          */
+
+{
+    struct rttFill *f = ( struct rttFill * )param;
+    uint32_t nowmS = genericsTimestampmS();
+    unsigned int tag = f->r->options->rttTag + buf;
+    uint8_t *p;
+    uint32_t n, l;
+
+    if ( tag >= OFLOW_TIME_TAG )
+    {
+        return;
+    }
+
+    while ( len )
+    {
+        n = ( len > RTT_FRAME_MAX ) ? RTT_FRAME_MAX : len;
+        p = &f->d[f->len + RTT_REC_HDR];
+        l = 0;
+
+        if ( ( !f->synced[buf] ) || ( nowmS - f->lastSyncmS[buf] >= INTERVAL_1S / 1000 ) )
+        {
+            memset( p, 0, SYNC_MIN_ZEROS );
+            p[SYNC_MIN_ZEROS] = SYNC_END;
+            l = SYNC_MIN_ZEROS + 1;
+            f->lastSyncmS[buf] = nowmS;
+            f->synced[buf] = true;
+        }
+
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            p[l++] = ( buf << 3 ) | 1;
+            p[l++] = *d++;
+        }
+
+        f->d[f->len]     = tag;
+        f->d[f->len + 1] = l;
+        f->d[f->len + 2] = l >> 8;
+        memcpy( &f->d[f->len + 3], &f->when, sizeof( f->when ) );
+        f->len += RTT_REC_HDR + l;
+        len -= n;
+    }
+}
+// ====================================================================================================
+static bool _rttRoom( struct RunTime *r )
+
+{
+    bool room;
+
+    pthread_mutex_lock( &r->rttLock );
+    room = ( r->rttPendLen + RTT_STAGE_LEN <= RTT_PEND_LEN );
+    pthread_mutex_unlock( &r->rttLock );
+    return room;
+}
+// ====================================================================================================
+static void _rttQueue( struct RunTime *r, struct rttFill *f )
+
+/* Pass what a poll took on to the decode thread, there being room for it already */
+
+{
+    pthread_mutex_lock( &r->rttLock );
+    memcpy( &r->rttPend[r->rttPendLen], f->d, f->len );
+    r->rttPendLen += f->len;
+    pthread_mutex_unlock( &r->rttLock );
+
+    _stageKick( &r->decodeQ );
+}
+// ====================================================================================================
+static void *_rttTask( void *arg )
+
+/* Read RTT up-buffers from the target over SWD, for as long as the probe is connected. It all goes */
+/* through the decode thread, so it's sent on in among whatever the probe sends as SWO.             */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    struct rttFill *f = ( struct rttFill * )calloc( 1, sizeof( struct rttFill ) );
+    struct rtt *rtt;
+    int n;
+
+    MEMCHECK( f, NULL );
+    f->r = r;
+
+    while ( !atomic_load( &r->rttStop ) )
+    {
+        if ( !OrbtraceIfTargetAttach( r->o, RTT_SWD_CLOCK ) )
+        {
+            /* Most likely there's no target, or it's powered down, so keep trying */
+            genericsReport( V_INFO, "Couldn't attach to target over SWD" EOL );
+            OrbtraceIfTargetDetach( r->o );
+
+            if ( !r->swo )
+            {
+                /* ...unless there's nothing else from the probe, when it may be the probe that's gone */
+                r->errored = true;
+                break;
+            }
+
+            for ( int w = 0; ( w < INTERVAL_1S / INTERVAL_100MS ) && ( !atomic_load( &r->rttStop ) ); w++ )
+            {
+                usleep( INTERVAL_100MS );
+            }
+
+            continue;
+        }
+
+        genericsReport( V_INFO, "Attached to target over SWD" EOL );
+        rtt = rttCreate( _rttRead, _rttWrite, r->o );
+        assert( rtt );
+        memset( f->synced, 0, sizeof( f->synced ) );
+
+        while ( !atomic_load( &r->rttStop ) )
+        {
+            if ( !rttFound( rtt ) )
+            {
+                /* The target may not have got as far as setting it up yet */
+                if ( ( n = rttFind( rtt, r->options->rttAddr, r->options->rttLen ) ) < 0 )
+                {
+                    break;
+                }
+
+                if ( !n )
+                {
+                    usleep( INTERVAL_100MS );
+                    continue;
+                }
+
+                genericsReport( V_INFO, "RTT control block at 0x%08x" EOL, rttAddress( rtt ) );
+
+                for ( unsigned int i = 0; i < rttNumUp( rtt ); i++ )
+                {
+                    genericsReport( V_INFO, "  Up-buffer %u (%s) on tag %d" EOL, i, rttUpName( rtt, i ), r->options->rttTag + i );
+                }
+            }
+
+            if ( !_rttRoom( r ) )
+            {
+                /* The decode thread is behind, what's not been taken yet can wait in the target */
+                usleep( INTERVAL_1MS );
+                continue;
+            }
+
+            f->len  = 0;
+            f->when = genericsMonotonicnS();
+
+            if ( rttPoll( rtt, RTT_POLL_MAX, _rttData, f ) < 0 )
+            {
+                break;
+            }
+
+            if ( !f->len )
+            {
+                /* Each poll is a few SWD reads, so there's no point going round faster than this when it's quiet */
+                if ( !rttFound( rtt ) )
+                {
+                    genericsReport( V_INFO, "RTT control block gone, looking for it again" EOL );
+                }
+
+                usleep( INTERVAL_1MS );
+                continue;
+            }
+
+            _rttQueue( r, f );
+        }
+
+        if ( !atomic_load( &r->rttStop ) )
+        {
+            genericsReport( V_INFO, "Lost target over SWD" EOL );
+        }
+
+        rttDelete( rtt );
+        OrbtraceIfTargetDetach( r->o );
+    }
+
+    free( f );
+    return NULL;
+}
+// ====================================================================================================
+static void _rttStart( struct RunTime *r )
+
+{
+    if ( !r->rttPend )
+    {
+        /* These stay, the decode thread may still be looking at them as the RTT one stops */
+        r->rttPend = ( uint8_t * )malloc( RTT_PEND_LEN );
+        r->rttTake = ( uint8_t * )malloc( RTT_PEND_LEN );
+        MEMCHECKV( r->rttPend );
+        MEMCHECKV( r->rttTake );
+        pthread_mutex_init( &r->rttLock, NULL );
+    }
+
+    r->rttPendLen = 0;
+    atomic_store( &r->rttStop, false );
+
+    if ( pthread_create( &r->rttThread, NULL, &_rttTask, r ) )
+    {
+        genericsExit( -1, "Failed to create RTT thread" EOL );
+    }
+
+    atomic_store( &r->rttRunning, true );
+}
+// ====================================================================================================
+static void _rttEnd( struct RunTime *r )
+
+{
+    if ( atomic_load( &r->rttRunning ) )
+    {
+        atomic_store( &r->rttStop, true );
+        pthread_join( r->rttThread, NULL );
+        atomic_store( &r->rttRunning, false );
+    }
+}
+// ====================================================================================================
+static int _usbFeeder( struct RunTime *r )
+
+/* Setup USB transfers from an ORBTrace, BMP, CMSIS-DAP probe or FTDI part */
+
+{
+    /* A CMSIS-DAP probe may well be someone's debugger, and an FTDI part could be anything at all, */
+    /* so they're left alone unless we're told otherwise.                                           */
+    uint32_t devmask = DEVTYPE_ALL & ~( ( ( r->options->dapSpeed ) || ( r->options->rtt ) ) ? 0 : DEVTYPE( DEVICE_CMSIS_DAP ) )
+                       & ~( ( r->options->ftdi ) ? 0 : DEVTYPE( DEVICE_FTDI ) );
+    bool firstRunThrough = true;
+    int workingDev;
+
+    /* Copy any part serial number across, unless this instance was given its own */
+    if ( ( !r->sn ) && ( r->options->sn ) )
+    {
+        r->sn = strdup( r->options->sn );
+    }
+
+    /* The context lasts across reconnects, so it can tell us the moment the probe comes back */
+    r->o = ( r->usbContext ) ? OrbtraceIfCreateSharedContext( r->usbContext ) : OrbtraceIfCreateContext();
+    assert( r->o );
+
+    if ( !OrbtraceIfWatchArrivals( r->o ) )
+    {
+        genericsReport( V_DEBUG, "No USB hotplug support, polling for devices" EOL );
+    }
+
+    if ( r->haveUsbFd )
+    {
+        OrbtraceIfInheritDevice( r->o, r->usbFd );
+    }
+
+    while ( !r->ending )
+    {
+        bool arrived = false;
+        r->errored = false;
+
+        while ( ( !r->ending ) && ( 0 == OrbtraceIfGetDeviceList( r->o, r->sn, devmask ) ) )
+        {
+            if ( atomic_load( &r->handingOver ) )
+            {
+                _park( r );
+            }
+
+            /* Still look every so often in case an arrival was missed. Just after one, the device may */
+            /* not be ready to open yet (permissions being set up, say), so try again sooner.         */
+            arrived = OrbtraceIfWaitForArrival( r->o, ( arrived ) ? INTERVAL_100MS : INTERVAL_1S );
+        }
+
+        if ( r->ending )
+        {
+            break;
+        }
+
+        genericsReport( V_INFO, "Found device" EOL );
+
+        if ( r->probe )
+        {
+            /* There's nobody to ask when serving several probes, so the serial number has to be enough */
+            if ( OrbtraceIfGetNumDevices( r->o ) > 1 )
+            {
+                genericsReport( V_WARN, "Serial number %s matches several devices, taking the first" EOL, r->probe );
+            }
+
+            workingDev = 0;
+        }
+        else
+        {
+            workingDev = OrbtraceIfSelectDevice( r->o );
+        }
+
+        if ( !OrbtraceIfOpenDevice( r->o, workingDev ) )
+        {
+            genericsReport( V_INFO, "Couldn't open device" EOL );
+            break;
+        }
+
+        /* Take a record of what device we're using...we'll use that next time around to re-connect */
+        if ( r->sn )
+        {
+            free( r->sn );
+        }
+
+        r->sn = strdup( OrbtraceIfGetSN( r->o, workingDev ) );
+
+        /* Before we open, perform any orbtrace configuration that is needed */
+        _actionOrbtraceCommand( r, r->sn, OrbtraceIfGetDevtype( r->o, workingDev ) );
+
+        /* A CMSIS-DAP probe without a speed for it is only there for RTT */
+        r->swo = ( OrbtraceIfGetDevtype( r->o, workingDev ) != DEVICE_CMSIS_DAP ) || ( r->options->dapSpeed );
+
+        if ( ( r->options->rtt ) && ( OrbtraceIfGetDevtype( r->o, workingDev ) == DEVICE_FTDI ) )
+        {
+            genericsReport( V_WARN, "FTDI parts can't get at target memory, so there'll be no RTT" EOL );
+        }
+
+        if ( ( r->swo ) && ( !OrbtraceGetIfandEP( r->o ) ) )
+        {
+            genericsReport( V_INFO, "Couldn't get IF and EP" EOL );
+            break;
+        }
+
+        /* Nothing else is going to set one of these up to send its SWO */
+        if ( ( OrbtraceIfGetDevtype( r->o, workingDev ) == DEVICE_CMSIS_DAP ) && ( r->swo ) && ( !OrbtraceIfStartDapSWO( r->o, r->options->dapSpeed ) ) )
+        {
+            genericsReport( V_INFO, "Couldn't start SWO on CMSIS-DAP probe" EOL );
+            break;
+        }
+
+        if ( ( OrbtraceIfGetDevtype( r->o, workingDev ) == DEVICE_FTDI ) && ( !OrbtraceIfStartFTDI( r->o, r->options->ftdiSpeed ) ) )
+        {
+            genericsReport( V_INFO, "Couldn't set up FTDI device" EOL );
+            break;
+        }
+
+        r->usingOFLOW = OrbtraceSupportsOFLOW( r->o );
+
+        if ( r->usingOFLOW )
+        {
+            genericsReport( V_INFO, "Orbtrace supports ORBFLOW protocol" EOL );
+
+            if ( r->options->useTPIU )
+            {
+                genericsReport( V_WARN, "TPIU decoding specified, but ORBTrace supports ORBFLOW, are you sure?" EOL );
+            }
+
+            if ( firstRunThrough && r->capture )
+            {
+                /* ...and it goes at the start of every file if they're being rotated */
+                if ( !captureSetHeader( r->capture, OFLOW_SIG, OFLOW_SIG_LEN ) )
+                {
+                    genericsExit( -4, "Could not write OFLOW signature to file (%s)" EOL, strerror( errno ) );
+                }
+
+                /* Index entries can point straight at the start of an OFLOW frame */
+                captureSetIndex( r->capture, CAPTURE_INDEX_MS, COBS_SYNC_CHAR );
+            }
+
+            /* We only attempt to write the file header on the first run through */
+            firstRunThrough = false;
+        }
+        else
+        {
+            genericsReport( V_INFO, "Orbtrace supports legacy protocol" EOL );
+        }
+
+        genericsReport( V_DEBUG, "USB Interface claimed, ready for data" EOL );
+
+        /* Make sure nobody is still using a previous connection's buffers, then hand out the spares */
+        _waitForLentBlocks( r );
+        _resetSpares( r, false );
+        _startPipeline( r );
+
+        /* Create the USB transfer blocks .. if we are connected depends on if there was an error submitting the requests */
+        r->usbDepth  = NUM_RAW_BLOCKS;
+        r->usbLength = USB_TRANSFER_SIZE;
+        r->numParked = r->adaptCount = r->adaptFull = 0;
+        atomic_store( &r->inFlight, ( r->swo ) ? NUM_RAW_BLOCKS : 0 );
+        r->errored = !( r->conn = ( !r->swo ) || OrbtraceIfSetupTransfers( r->o, r->options->hiresTime, r->rawBlock, NUM_RAW_BLOCKS, _usb_callback, r ) );
+
+        if ( ( r->conn ) && ( r->options->rtt ) && ( OrbtraceIfGetDevtype( r->o, workingDev ) != DEVICE_FTDI ) )
+        {
+            _rttStart( r );
+        }
+
+        /* =========================== The main dispatch loop ======================================= */
+        while ( ( !r->ending )  && ( !r->errored ) && ( !atomic_load( &r->handingOver ) ) )
+        {
+            if ( r->usbContext )
+            {
+                /* Events are being handled for all the probes elsewhere, just watch for this one failing */
+                usleep( INTERVAL_100MS );
+                continue;
+            }
+
+            /* ...or for the RTT thread to give up on it, when there's nothing else */
+            int ret = ( r->swo ) ? OrbtraceIfHandleEvents( r->o ) : OrbtraceIfHandleEventsTimeout( r->o, INTERVAL_100MS );
+
+            if ( ( ret ) && ( ret != LIBUSB_ERROR_INTERRUPTED ) )
+            {
+                genericsReport( V_ERROR, "Error waiting for USB requests to complete %d" EOL, ret );
+            }
+
+        }
+
+        /* ========================================================================================= */
+
+        _rttEnd( r );
+        r->conn = false;
+
+        /* Stop any buffers still out with clients being resubmitted, then remove transfers and release the memory */
+        pthread_mutex_lock( &r->usbLock );
+        r->usbGeneration++;
+        pthread_mutex_unlock( &r->usbLock );
+
+        /* The transfers get used again next time, so they all have to have come back first */
+        _drainTransfers( r );
+        OrbtraceIfCloseTransfers( r->o );
+
+        if ( atomic_load( &r->handingOver ) )
+        {
+            /* ...leaving the device open and claimed, for the new process to carry on with */
+            _park( r );
+        }
+
+        if ( !r->ending )
+        {
+            genericsReport( V_INFO, "USB connection lost" EOL );
+        }
+
+        genericsReport( V_INFO, "USB Interface closed" EOL );
+    }
+
+    OrbtraceIfFreeTransfers( r->rawBlock, NUM_RAW_BLOCKS );
+    OrbtraceIfCloseDevice( r->o );
+    OrbtraceIfDestroyContext( r->o );
+    return 0;
+}
+// ====================================================================================================
+
+static int _nwserverFeeder( struct RunTime *r )
+
+/* Setup network based transfers (typically used for things like J-Link but can also be a legacy orbuculum session, */
+/* or a relay from another orbuculum, where what arrives is already OFLOW and goes out again exactly as it came in).  */
+
+{
+    struct usbBlockRef *u;
+
+    while ( !r->ending )
+    {
+        struct Stream *stream = ( r->options->compress ) ? streamCreateCompressedSocket( r->options->nwserverHost, r->options->nwserverPort ) : streamCreateSocket( r->options->nwserverHost, r->options->nwserverPort );
+        bool midFrame = false;
+
+        if ( stream == NULL )
+        {
+            usleep( INTERVAL_100MS );
+            continue;
+        }
+
+        genericsReport( V_INFO, "Established NW Server Link" EOL );
+
+        if ( r->options->relay )
+        {
+            /* Upstream has already done the tagging and timestamping, so there's nothing to rebuild here */
+            r->usingOFLOW = true;
+            nwRequestQoS( stream, r->options->relayQoS );
+        }
+
+        /* This thread only receives, like the serial feeder, so blocks can be lent straight on to the clients */
+        _waitForLentBlocks( r );
+        _resetSpares( r, true );
+        _startPipeline( r );
+        r->conn = true;
+
+        while ( !r->ending )
+        {
+            size_t fl;
+
+            if ( !( u = _takeSpare( r ) ) )
+            {
+                usleep( INTERVAL_100US );
+                continue;
+            }
+
+            if ( ( stream->receive( stream, ( uint8_t * )u->b.data, USB_TRANSFER_SIZE, NULL, &fl ) != RECEIVE_RESULT_OK ) || ( !fl ) )
+            {
+                _giveSpare( r, u );
+                break;
+            }
+
+            midFrame = ( u->b.data[fl - 1] != COBS_SYNC_CHAR );
+            _queueRead( r, u, fl );
+        }
+
+        if ( ( r->options->relay ) && ( midFrame ) )
+        {
+            /* Finish off the frame that was cut short, so it doesn't run into whatever comes after reconnection */
+            u = NULL;
+
+            while ( ( !r->ending ) && ( !( u = _takeSpare( r ) ) ) )
+            {
+                usleep( INTERVAL_100US );
+            }
+
+            if ( u )
+            {
+                *( uint8_t * )u->b.data = COBS_SYNC_CHAR;
+                _queueRead( r, u, 1 );
+            }
+        }
+
+        if ( !r->ending )
+        {
+            genericsReport( V_INFO, "Lost NW Server Link" EOL );
+        }
+
+        r->conn = false;
+        stream->close( stream );
+    }
+
+    return 0;
+}
+// ====================================================================================================
+
+
+#ifdef WIN32
+// ====================================================================================================
+// WIN32 Specific Driver
+// ====================================================================================================
+
+static int _serialFeeder( struct RunTime *r )
+{
+    char portPath[MAX_PATH] = { 0 };
+    snprintf( portPath, sizeof( portPath ), "\\\\.\\%s", r->options->port );
+
+    while ( !r->ending )
+    {
+        HANDLE portHandle = CreateFile( portPath,
+                                        GENERIC_READ,
+                                        0,      //  must be opened with exclusive-access
+                                        NULL,   //  default security attributes
+                                        OPEN_EXISTING, //  must use OPEN_EXISTING
+                                        0,    //  not overlapped I/O
+                                        NULL ); //  hTemplate must be NULL for comm devices
+
+        if ( portHandle == INVALID_HANDLE_VALUE )
+        {
+            genericsExit( 1, "Can't open serial port" EOL );
+        }
+
+        genericsReport( V_INFO, "Port opened" EOL );
+
+        if ( !_setSerialSpeed( portHandle, r->options->speed ) )
+        {
+            genericsExit( 2, "setSerialConfig failed" EOL );
+        }
+
+        SetCommMask( portHandle, EV_RXCHAR );
+
+        genericsReport( V_INFO, "Port configured" EOL );
+
+        r->conn = true;
+
+        while ( !r->ending )
+        {
+            DWORD eventMask = 0;
+            WaitCommEvent( portHandle, &eventMask, NULL );
+            DWORD unused;
+            COMSTAT stats;
+            ClearCommError( portHandle, &unused, &stats );
+
+            if ( stats.cbInQue == 0 )
+            {
+                continue;
+            }
+
+            struct dataBlock *rxBlock = &r->rawBlock[0];
+
+            DWORD transferSize = stats.cbInQue;
+
+            if ( transferSize > USB_TRANSFER_SIZE )
+            {
+                transferSize = USB_TRANSFER_SIZE;
+            }
+
+            ReadFile( portHandle, rxBlock->buffer, transferSize, &rxBlock->fillLevel, NULL );
+
+            if ( rxBlock->fillLevel <= 0 )
+            {
+                break;
+            }
+
+            _handleBlock( r, rxBlock->fillLevel, rxBlock->buffer );
+        }
+
+        r->conn = false;
+
+        if ( ! r->ending )
+        {
+            genericsReport( V_INFO, "Read failed" EOL );
+        }
+
+        CloseHandle( portHandle );
+    }
+
+    return 0;
+}
+
+#else
+// =========================================================================================================
+// Default Driver ( OSX and Linux )
+// =========================================================================================================
+
+static int _serialFeeder( struct RunTime *r )
+
+/* Setup incoming feed from a serial port */
+
+{
+    int ret;
+    ssize_t n;
+    struct usbBlockRef *u;
+
+    while ( !r->ending )
+    {
+#ifdef OSX
+        int flags;
+
+        while ( !r->ending && ( r->f = open( r->options->port, O_RDONLY | O_NONBLOCK ) ) < 0 )
+#else
+        while ( !r->ending && ( r->f = open( r->options->port, O_RDONLY ) ) < 0 )
+#endif
+        {
+            genericsReport( V_WARN, "Can't open serial port" EOL );
+            usleep( INTERVAL_100MS );
+        }
+
+        genericsReport( V_INFO, "Port opened" EOL );
+
+#ifdef OSX
+        /* Remove the O_NONBLOCK flag now the port is open (OSX Only) */
+
+        if ( ( flags = fcntl( r->f, F_GETFL, NULL ) ) < 0 )
+        {
+            genericsExit( -3, "F_GETFL failed" EOL );
+        }
+
+        flags &= ~O_NONBLOCK;
+
+        if ( ( flags = fcntl( r->f, F_SETFL, flags ) ) < 0 )
+        {
+            genericsExit( -3, "F_SETFL failed" EOL );
+        }
+
+#endif
+
+        if ( ( ret = _setSerialConfig ( r->f, r->options->speed ) ) < 0 )
+        {
+            genericsExit( ret, "setSerialConfig failed" EOL );
+        }
+
+        genericsReport( V_INFO, "Serial reads tuned for %s" EOL, ( r->options->speed >= SERIAL_THROUGHPUT_SPEED ) ? "throughput" : "latency" );
+
+        /* This thread only reads, into whichever block is free, and the pipeline does everything else */
+        _waitForLentBlocks( r );
+        _resetSpares( r, true );
+        _startPipeline( r );
+        r->conn = true;
+
+        while ( !r->ending )
+        {
+            if ( !( u = _takeSpare( r ) ) )
+            {
+                /* Everything is still being processed, so leave it in the driver for a moment */
+                usleep( INTERVAL_100US );
+                continue;
+            }
+
+            if ( ( n = read( r->f, ( uint8_t * )u->b.data, USB_TRANSFER_SIZE ) ) <= 0 )
+            {
+                _giveSpare( r, u );
+                break;
+            }
+
+            _queueRead( r, u, n );
+        }
+
+        r->conn = false;
+
+        if ( ! r->ending )
+        {
+            genericsReport( V_INFO, "Read failed" EOL );
+        }
+
+        close( r->f );
+    }
+
+    return 0;
+}
+#endif
+
+// ====================================================================================================
+static void _paceFromIndex( const struct captureIndexEntry *idx, size_t numIdx, size_t *k, uint64_t ofs, uint64_t startnS )
+
+/* Wait until the data up to ofs in the file would have arrived, going by when it did during the */
+/* capture. Between index entries it's taken to have arrived at an even rate.                    */
+
+{
+    uint64_t at = 0;
+    int64_t wait;
+
+    while ( ( *k + 1 < numIdx ) && ( idx[*k + 1].ofs <= ofs ) )
+    {
+        ( *k )++;
+    }
+
+    if ( ofs >= idx[*k].ofs )
+    {
+        at = idx[*k].tsuS - idx[0].tsuS;
+
+        if ( ( *k + 1 < numIdx ) && ( idx[*k + 1].ofs > idx[*k].ofs ) )
+        {
+            at += ( idx[*k + 1].tsuS - idx[*k].tsuS ) * ( ofs - idx[*k].ofs ) / ( idx[*k + 1].ofs - idx[*k].ofs );
+        }
+    }
+
+    if ( ( wait = ( int64_t )( startnS + at * 1000 - genericsMonotonicnS() ) ) > 0 )
+    {
+        struct timespec ts = { .tv_sec = wait / 1000000000L, .tv_nsec = wait % 1000000000L };
+        nanosleep( &ts, NULL );
+    }
+}
+// ====================================================================================================
+static ssize_t _fileRead( int f, struct Stream *archive, void *d, size_t len )
+
+/* Read from the file, or from the capture in it if it's an archive (or samples of the SWO pin) */
+
+{
+    size_t got;
+
+    if ( !archive )
+    {
+        return read( f, d, len );
+    }
+
+    switch ( archive->receive( archive, d, len, NULL, &got ) )
+    {
+        case RECEIVE_RESULT_OK:
+            return got;
+
+        case RECEIVE_RESULT_EOF:
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+// ====================================================================================================
+static int _fileFeeder( struct RunTime *r )
+
+/* Setup incoming data stream from a file in either legacy or OFLOW format. The file is read ahead */
+/* into the pipeline's blocks while earlier ones are being decoded and sent.                      */
+
+{
+    struct captureIndexEntry *idx = NULL;
+    struct Stream *archive = NULL;
+    struct usbBlockRef *u;
+    size_t numIdx = 0, k = 0;
+    uint64_t ofs, startnS;
+    ssize_t n;
+
+    if ( ( r->f = open( r->options->file, O_RDONLY ) ) < 0 )
+    {
+        genericsExit( -4, "Can't open file %s" EOL, r->options->file );
+    }
+
+#if defined( LINUX )
+    posix_fadvise( r->f, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+#if !defined( WIN32 )
+
+    if ( ( r->options->swoSamples ) && ( !( archive = streamCreateSWOSamples( r->options->file, &r->options->swoConfig ) ) ) )
+    {
+        genericsExit( -4, "Can't decode SWO samples from %s" EOL, r->options->file );
+    }
+
+#endif
+
+    if ( ( !archive ) && ( streamIsArchive( r->options->file ) ) && ( !( archive = streamCreateArchiveAt( r->options->file, 0 ) ) ) )
+    {
+        genericsExit( -4, "Can't read archive %s" EOL, r->options->file );
+    }
+
+    if ( ( r->options->realtime ) && ( !( idx = captureIndexLoad( r->options->file, &numIdx ) ) ) )
+    {
+        genericsReport( V_WARN, "No usable index for %s, replaying as fast as possible" EOL, r->options->file );
+    }
+
+    _resetSpares( r, true );
+    _startPipeline( r );
+    r->conn = true;
+
+    /* Start off by checking if this is OFLOW formatted */
+    u = _takeSpare( r );
+    n = _fileRead( r->f, archive, ( uint8_t * )u->b.data, OFLOW_SIG_LEN );
+    r->usingOFLOW = ( ( OFLOW_SIG_LEN == n ) && ( !strncmp( OFLOW_SIG, ( char * )u->b.data, OFLOW_SIG_LEN ) ) );
+    genericsReport( V_INFO, "File is %sin OFLOW format" EOL, ( r->usingOFLOW ) ? "" : "not " );
+    ofs = ( n > 0 ) ? n : 0;
+    startnS = genericsMonotonicnS();
+
+    /* The header isn't passed on, but anything else that was read is data */
+    if ( ( !r->usingOFLOW ) && ( n > 0 ) )
+    {
+        _queueRead( r, u, n );
+        u = NULL;
+    }
+
+    while ( !r->ending )
+    {
+        if ( ( !u ) && ( !( u = _takeSpare( r ) ) ) )
+        {
+            /* All of the blocks are read ahead already */
+            usleep( INTERVAL_100US );
+            continue;
+        }
+
+        if ( ( n = _fileRead( r->f, archive, ( uint8_t * )u->b.data, USB_TRANSFER_SIZE ) ) <= 0 )
+        {
+            if ( ( n < 0 ) || ( r->options->fileTerminate ) )
+            {
+                break;
+            }
+
+            // Just spin for a while to avoid clogging the CPU
+            usleep( INTERVAL_100MS );
+            continue;
+        }
+
+#if defined( LINUX )
+        /* ...and get the kernel fetching the next lot while this is dealt with */
+        posix_fadvise( r->f, ofs + n, USB_TRANSFER_SIZE * NUM_RAW_BLOCKS, POSIX_FADV_WILLNEED );
+#endif
+        ofs += n;
+
+        if ( idx )
+        {
+            _paceFromIndex( idx, numIdx, &k, ofs, startnS );
+        }
+
+        _queueRead( r, u, n );
+        u = NULL;
+
+        if ( r->options->paceDelay )
+        {
+            usleep( r->options->paceDelay );
+        }
+    }
+
+    if ( u )
+    {
+        _giveSpare( r, u );
+    }
+
+    /* Let the pipeline finish off what was read before going */
+    _waitForLentBlocks( r );
+    r->conn = false;
+
+    if ( !r->options->fileTerminate )
+    {
+        genericsReport( V_INFO, "File read error" EOL );
+    }
+
+    if ( archive )
+    {
+        archive->close( archive );
+        free( archive );
+    }
+
+    free( idx );
+    close( r->f );
+    return true;
+}
+// ====================================================================================================
+static struct RunTime *_instance( int i )
+
+{
+    return ( _numProbes ) ? _probe[i] : &_r;
+}
+// ====================================================================================================
+static int _numPorts( struct RunTime *r )
+
+/* How many network outputs _portHandle knows about for an instance */
+
+{
+    return 1 + r->numHandlers + ( r->msgHandler ? 1 : 0 );
+}
+// ====================================================================================================
+static struct nwclientsHandle *_portHandle( struct RunTime *r, int j, int *port )
+
+/* Network outputs of an instance, the OFLOW one first, then the legacy ones and the message port last */
+
+{
+    if ( !j )
+    {
+        *port = r->port;
+        return r->oflowHandler;
+    }
+
+    if ( j > r->numHandlers )
+    {
+        *port = r->options->msgPort + ( r->port - r->options->listenPort );
+        return r->msgHandler;
+    }
+
+    *port = r->port + LEGACY_SERVER_PORT_OFS + j - 1;
+    return r->handler[j - 1].n;
+}
+// ====================================================================================================
+#define PROBE(r) ( ( r )->probe ? ( r )->probe : ( ( r )->options->sn ? ( r )->options->sn : "" ) )
+
+static void _clientMetrics( struct metricsBuf *b, const char *name, const char *type, const char *help, int which )
+
+/* One per client metric for every client on every port. Samples of a metric have to be kept */
+/* together, so the client list is gone through again for each.                               */
+
+{
+    int n = ( _numProbes ) ? _numProbes : 1;
+    struct nwclientStats cs[METRICS_MAX_CLIENTS];
+    uint64_t v;
+    int port, nc;
+
+    metricsType( b, name, type, help );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        for ( int j = 0; j < _numPorts( _instance( i ) ); j++ )
+        {
+            nc = nwclientClientStats( _portHandle( _instance( i ), j, &port ), cs, METRICS_MAX_CLIENTS );
+
+            for ( int c = 0; c < nc; c++ )
+            {
+                switch ( which )
+                {
+                    case 0:
+                        v = cs[c].queuedItems;
+                        break;
+
+                    case 1:
+                        v = cs[c].queuedBytes;
+                        break;
+
+                    case 2:
+                        v = cs[c].sentBytes;
+                        break;
+
+                    case 4:
+                        v = cs[c].spilledBytes;
+                        break;
+
+                    case 5:
+                        v = cs[c].memBytes;
+                        break;
+
+                    default:
+                        v = cs[c].dropped;
+                        break;
+                }
+
+                metricsPrintf( b, "%s{probe=\"%s\",port=\"%d\",client=\"%d\"} %" PRIu64 "\n", name, PROBE( _instance( i ) ), port, cs[c].fd, v );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _renderMetrics( struct metricsBuf *b, void *param )
+
+/* Render everything we know about each instance as Prometheus metrics. This runs on the metrics */
+/* server thread, and only ever reads what the data path maintains anyway. The legacy ports can   */
+/* be changed from the control port though, so they're held still while it's done.               */
+
+{
+    int n = ( _numProbes ) ? _numProbes : 1;
+    struct nwclientsHandle *h;
+    struct nwclientMemory mem;
+    char l[MAX_LINE_LEN];
+    int port;
+
+    pthread_mutex_lock( &_handlerLock );
+    metricsType( b, "orbuculum_connected", "gauge", "Whether there is a connection to the source" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        metricsPrintf( b, "orbuculum_connected{probe=\"%s\"} %d\n", PROBE( _instance( i ) ), _instance( i )->conn );
+    }
+
+    metricsType( b, "orbuculum_received_bytes_total", "counter", "Bytes received from the source" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        metricsPrintf( b, "orbuculum_received_bytes_total{probe=\"%s\"} %" PRIu64 "\n", PROBE( _instance( i ) ), ( uint64_t )atomic_load_explicit( &_instance( i )->totalRawBytes, memory_order_relaxed ) );
+    }
+
+    metricsType( b, "orbuculum_tag_bytes_total", "counter", "Bytes received for each tag or TPIU channel" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        for ( int t = 0; t < NUM_TAGS; t++ )
+        {
+            uint64_t v = atomic_load_explicit( &_instance( i )->tagCount[t].totalData, memory_order_relaxed );
+
+            if ( v )
+            {
+                metricsPrintf( b, "orbuculum_tag_bytes_total{probe=\"%s\",tag=\"%d\"} %" PRIu64 "\n", PROBE( _instance( i ) ), t, v );
+            }
+        }
+    }
+
+    /* ...and what the decoders count, for each probe */
+    metricsStats( b, _stats );
+
+    if ( _instance( 0 )->o )
+    {
+        metricsType( b, "orbuculum_usb_transfers_total", "counter", "USB transfers completed" );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            metricsPrintf( b, "orbuculum_usb_transfers_total{probe=\"%s\"} %" PRIu64 "\n", PROBE( _instance( i ) ), ( uint64_t )atomic_load( &_instance( i )->tfrCount ) );
+        }
+
+        metricsType( b, "orbuculum_usb_short_transfers_total", "counter", "USB transfers that completed before they were full" );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            metricsPrintf( b, "orbuculum_usb_short_transfers_total{probe=\"%s\"} %" PRIu64 "\n", PROBE( _instance( i ) ), ( uint64_t )atomic_load( &_instance( i )->tfrShort ) );
+        }
+
+        metricsType( b, "orbuculum_usb_transfers_in_flight", "gauge", "USB transfers currently submitted" );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            metricsPrintf( b, "orbuculum_usb_transfers_in_flight{probe=\"%s\"} %d\n", PROBE( _instance( i ) ), atomic_load( &_instance( i )->inFlight ) );
+        }
+
+        metricsType( b, "orbuculum_usb_transfer_length_bytes", "gauge", "Length of each USB transfer" );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            metricsPrintf( b, "orbuculum_usb_transfer_length_bytes{probe=\"%s\"} %d\n", PROBE( _instance( i ) ), _instance( i )->usbLength );
+        }
+    }
+
+    metricsType( b, "orbuculum_port_dropped_bytes_total", "counter", "Bytes dropped on a network port because clients were not keeping up" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        for ( int j = 0; j < _numPorts( _instance( i ) ); j++ )
+        {
+            h = _portHandle( _instance( i ), j, &port );
+            metricsPrintf( b, "orbuculum_port_dropped_bytes_total{probe=\"%s\",port=\"%d\"} %" PRIu64 "\n", PROBE( _instance( i ) ), port, nwclientDroppedBytes( h ) );
+        }
+    }
+
+    _clientMetrics( b, "orbuculum_client_queued_items", "gauge", "Items waiting to go to a network client", 0 );
+    _clientMetrics( b, "orbuculum_client_queued_bytes", "gauge", "Copied bytes waiting to go to a network client", 1 );
+    _clientMetrics( b, "orbuculum_client_sent_bytes_total", "counter", "Bytes sent to a network client", 2 );
+    _clientMetrics( b, "orbuculum_client_dropped_bytes_total", "counter", "Bytes dropped because a network client was not keeping up", 3 );
+    _clientMetrics( b, "orbuculum_client_spilled_bytes", "gauge", "Bytes a bulk network client has waiting in its spill file", 4 );
+    _clientMetrics( b, "orbuculum_client_memory_bytes", "gauge", "Memory held on behalf of a network client", 5 );
+
+    /* Memory is budgeted across every client of every instance, so these have no labels but what it's for */
+    nwclientMemoryStats( &mem );
+    metricsType( b, "orbuculum_client_memory_total_bytes", "gauge", "Memory held on behalf of all network clients, by what it's for" );
+    metricsPrintf( b, "orbuculum_client_memory_total_bytes{use=\"rings\"} %" PRIu64 "\n", mem.rings );
+    metricsPrintf( b, "orbuculum_client_memory_total_bytes{use=\"spills\"} %" PRIu64 "\n", mem.spills );
+    metricsPrintf( b, "orbuculum_client_memory_total_bytes{use=\"compression\"} %" PRIu64 "\n", mem.compression );
+    metricsPrintf( b, "orbuculum_client_memory_total_bytes{use=\"replays\"} %" PRIu64 "\n", mem.replays );
+    metricsPrintf( b, "orbuculum_client_memory_total_bytes{use=\"history\"} %" PRIu64 "\n", mem.history );
+    metricsType( b, "orbuculum_client_memory_budget_bytes", "gauge", "Most memory that may be held for network clients, 0 for no limit" );
+    metricsPrintf( b, "orbuculum_client_memory_budget_bytes %" PRIu64 "\n", mem.budget );
+    metricsType( b, "orbuculum_shed_bytes_total", "counter", "Spilled data dropped to keep to the memory budget" );
+    metricsPrintf( b, "orbuculum_shed_bytes_total %" PRIu64 "\n", mem.shedBytes );
+    metricsType( b, "orbuculum_shed_clients_total", "counter", "Times network clients were disconnected, cut down to one tag, or refused memory, to keep to the memory budget" );
+    metricsPrintf( b, "orbuculum_shed_clients_total{action=\"disconnected\"} %" PRIu64 "\n", mem.disconnected );
+    metricsPrintf( b, "orbuculum_shed_clients_total{action=\"narrowed\"} %" PRIu64 "\n", mem.narrowed );
+    metricsPrintf( b, "orbuculum_shed_clients_total{action=\"refused\"} %" PRIu64 "\n", mem.refused );
+    metricsType( b, "orbuculum_lent_blocks", "gauge", "Capture buffers lent to network clients right now" );
+    metricsPrintf( b, "orbuculum_lent_blocks %d\n", mem.lent );
+
+    metricsType( b, "orbuculum_dispatch_latency_seconds", "histogram", "Time from a block arriving to it being queued for the network clients" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        snprintf( l, MAX_LINE_LEN, "probe=\"%s\"", PROBE( _instance( i ) ) );
+        metricsLatency( b, "orbuculum_dispatch_latency_seconds", l, &_instance( i )->dispatchLatency );
+    }
+
+    metricsType( b, "orbuculum_stage_profiling", "gauge", "1 while each stage of the capture path is being timed" );
+    metricsPrintf( b, "orbuculum_stage_profiling %d\n", atomic_load( &_profiling ) ? 1 : 0 );
+    metricsType( b, "orbuculum_stage_calls_total", "counter", "Times each stage of the capture path has run while being timed" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        for ( enum profStage s = 0; s < PROF_NUM_STAGES; s++ )
+        {
+            metricsPrintf( b, "orbuculum_stage_calls_total{probe=\"%s\",stage=\"%s\"} %" PRIu64 "\n", PROBE( _instance( i ) ), _profStageName[s],
+                           ( uint64_t )atomic_load_explicit( &_instance( i )->prof[s].calls, memory_order_relaxed ) );
+        }
+    }
+
+    metricsType( b, "orbuculum_stage_seconds_total", "counter", "Time spent in each stage of the capture path while being timed, including any stages it calls" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        for ( enum profStage s = 0; s < PROF_NUM_STAGES; s++ )
+        {
+            metricsPrintf( b, "orbuculum_stage_seconds_total{probe=\"%s\",stage=\"%s\"} %.9f\n", PROBE( _instance( i ) ), _profStageName[s],
+                           ( double )atomic_load_explicit( &_instance( i )->prof[s].ns, memory_order_relaxed ) / 1e9 );
+        }
+    }
+
+    metricsType( b, "orbuculum_send_latency_seconds", "histogram", "Time from data being queued for ORBFLOW clients to it being written to them" );
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( _instance( i )->oflowHandler )
+        {
+            snprintf( l, MAX_LINE_LEN, "probe=\"%s\"", PROBE( _instance( i ) ) );
+            metricsLatency( b, "orbuculum_send_latency_seconds", l, nwclientSendLatency( _instance( i )->oflowHandler ) );
+        }
+    }
+
+#if !defined( WIN32 )
+
+    if ( _r.options->numPlugins )
+    {
+        struct pluginValue pv[METRICS_MAX_PLUGIN_VALUES];
+
+        metricsType( b, "orbuculum_plugin_dropped_bytes_total", "counter", "Bytes the analysis plugins missed because they were not keeping up" );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            metricsPrintf( b, "orbuculum_plugin_dropped_bytes_total{probe=\"%s\"} %" PRIu64 "\n", PROBE( _instance( i ) ), pluginHostDroppedBytes( _instance( i )->plugins ) );
+        }
+
+        metricsType( b, "orbuculum_plugin_value", "gauge", "Results published by the analysis plugins" );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            int nv = pluginHostValues( _instance( i )->plugins, pv, METRICS_MAX_PLUGIN_VALUES );
+
+            for ( int v = 0; v < nv; v++ )
+            {
+                metricsPrintf( b, "orbuculum_plugin_value{probe=\"%s\",plugin=\"%s\",name=\"%s\"} %" PRId64 "\n", PROBE( _instance( i ) ), pv[v].plugin, pv[v].name, pv[v].value );
+            }
+        }
+    }
+
+#endif
+    pthread_mutex_unlock( &_handlerLock );
+}
+// ====================================================================================================
+static void _registerStats( struct RunTime *r )
+
+/* What the decoders of an instance count goes in the registry for the metrics, labelled by probe */
+
+{
+    char labels[MAX_LINE_LEN];
+
+    if ( !_stats )
+    {
+        _stats = statsRegistryCreate();
+    }
+
+    snprintf( labels, sizeof( labels ), "probe=\"%s\"", PROBE( r ) );
+    OFLOWRegisterStats( &r->oflow, _stats, "orbuculum", labels );
+
+    if ( r->options->useTPIU )
+    {
+        TPIUDecoderRegisterStats( &r->t, _stats, "orbuculum", labels );
+    }
+
+    if ( r->msgHandler )
+    {
+        ITMDecoderRegisterStats( &r->msgITM, _stats, "orbuculum", labels );
+    }
+}
+// ====================================================================================================
+static void _startMetrics( void )
+
+{
+    if ( _r.options->metricsPort )
+    {
+        if ( !metricsServerStart( _r.options->metricsPort, _renderMetrics, NULL ) )
+        {
+            genericsExit( -1, "Could not start metrics server" EOL );
+        }
+
+        genericsReport( V_INFO, "Serving metrics on port %d" EOL, _r.options->metricsPort );
+    }
+}
+// ====================================================================================================
+static char *_instanceName( struct RunTime *r, const char *base )
+
+/* Name for a file or shared memory belonging to this instance, which includes the probe if there are several */
+
+{
+    char *n = ( char * )malloc( strlen( base ) + ( ( r->probe ) ? strlen( r->probe ) + 1 : 0 ) + 1 );
+    MEMCHECK( n, NULL );
+
+    if ( r->probe )
+    {
+        sprintf( n, "%s-%s", base, r->probe );
+    }
+    else
+    {
+        strcpy( n, base );
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _setSpill( struct RunTime *r, struct nwclientsHandle *h )
+
+/* Tell a port where its bulk clients can spill to, if anywhere */
+
+{
+    if ( r->options->spillDir )
+    {
+        nwclientSetSpill( h, r->options->spillDir, ( uint64_t )r->options->spillMB << 20 );
+    }
+    else
+    {
+        nwclientSetSpill( h, NULL, ( uint64_t )r->options->spillMemMB << 20 );
+    }
+}
+// ====================================================================================================
+static int _parseTagList( const char *c, int *tag, const char **why )
+
+/* Turn a list of legacy tags into tag[], returning how many there are or -1 (with why) if it's no good */
+
+{
+    int n = 0;
+    int x = 0;
+
+    while ( *c )
+    {
+        while ( *c == ',' )
+        {
+            c++;
+        }
+
+        while ( isdigit( *c ) )
+        {
+            x = x * 10 + ( *c++ -'0' );
+        }
+
+        if ( ( *c ) && ( *c != ',' ) )
+        {
+            *why = "Illegal character in channel list";
+            return -1;
+        }
+
+        if ( x )
+        {
+            /* This is a good number, so it's wanted */
+            if ( x >= NUM_OFLOW_CHANNELS )
+            {
+                *why = "Channel number out of range";
+                return -1;
+            }
+
+            if ( n == NUM_OFLOW_CHANNELS )
+            {
+                *why = "Too many channels in list";
+                return -1;
+            }
+
+            tag[n++] = x;
+            x = 0;
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _openHandler( struct RunTime *r, struct handlers *h, int tag, int pos )
+
+/* Set up a legacy handler for tag, on the pos'th legacy port */
+
+{
+    h->channel = tag;
+    h->strippedBlock = ( struct dataBlock * )bufPoolAlloc( sizeof( struct dataBlock ), 0 );
+    MEMCHECKV( h->strippedBlock );
+    h->oflowOtg = ( struct OFLOWCoalesce * )calloc( 1, sizeof( struct OFLOWCoalesce ) );
+    MEMCHECKV( h->oflowOtg );
+    OFLOWCoalesceInit( h->oflowOtg, tag );
+    h->n = nwclientStart( r->port + LEGACY_SERVER_PORT_OFS + pos );
+    _setSpill( r, h->n );
+    genericsReport( V_INFO, "Will decode tag %d, exported Legacy interface on port %d" EOL, tag, r->port + LEGACY_SERVER_PORT_OFS + pos );
+}
+// ====================================================================================================
+static bool _controlWait( struct RunTime *r, atomic_bool *due )
+
+/* Wait a while for a change to be taken up, which is false if it hasn't been (yet) */
+
+{
+    struct timespec ts;
+    bool done;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+    ts.tv_sec += CONTROL_APPLY_WAIT_MS / 1000;
+    ts.tv_nsec += ( CONTROL_APPLY_WAIT_MS % 1000 ) * 1000000L;
+
+    if ( ts.tv_nsec >= 1000000000L )
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock( &r->rc.l );
+
+    while ( ( atomic_load( due ) ) && ( !pthread_cond_timedwait( &r->rc.c, &r->rc.l, &ts ) ) );
+
+    done = !atomic_load( due );
+    pthread_mutex_unlock( &r->rc.l );
+    return done;
+}
+// ====================================================================================================
+static bool _controlTags( struct RunTime *r, const int *tag, int n )
+
+/* Make the new set of legacy handlers for the decode thread to swap in. Each port that is still */
+/* wanted is kept, with its clients, and only gets a new coalescer if its tag has changed.      */
+
+{
+    struct handlers *h = NULL;
+
+    if ( n )
+    {
+        h = ( struct handlers * )calloc( n, sizeof( struct handlers ) );
+        MEMCHECK( h, false );
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( i < r->numHandlers )
+        {
+            h[i] = r->handler[i];
+
+            if ( h[i].channel != tag[i] )
+            {
+                h[i].channel = tag[i];
+                h[i].oflowOtg = ( struct OFLOWCoalesce * )calloc( 1, sizeof( struct OFLOWCoalesce ) );
+                MEMCHECK( h[i].oflowOtg, false );
+                OFLOWCoalesceInit( h[i].oflowOtg, tag[i] );
+            }
+        }
+        else
+        {
+            _openHandler( r, &h[i], tag[i], i );
+        }
+    }
+
+    r->rc.handler = h;
+    r->rc.numHandlers = n;
+    atomic_store_explicit( &r->rc.handlersDue, true, memory_order_release );
+    return true;
+}
+// ====================================================================================================
+static void _controlTagList( char *arg, struct controlConn *c )
+
+{
+    static char *list;                                   /* The last list set from here, for status */
+    int n = ( _numProbes ) ? _numProbes : 1;
+    int tag[NUM_OFLOW_CHANNELS];
+    const char *why;
+    bool late = false;
+    char *l;
+    int nt;
+
+    if ( ( nt = _parseTagList( ( arg ) ? arg : "", tag, &why ) ) < 0 )
+    {
+        controlPrintf( c, "ERR %s\n", why );
+        return;
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( atomic_load( &_instance( i )->rc.handlersDue ) )
+        {
+            controlPrintf( c, "ERR Last change of tags hasn't been taken up yet\n" );
+            return;
+        }
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( !_controlTags( _instance( i ), tag, nt ) )
+        {
+            controlPrintf( c, "ERR Out of memory\n" );
+            return;
+        }
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        late |= !_controlWait( _instance( i ), &_instance( i )->rc.handlersDue );
+    }
+
+    /* ...and keep the list for anyone who asks */
+    l = ( nt ) ? strdup( arg ) : NULL;
+    _r.options->channelList = l;
+    free( list );
+    list = l;
+
+    controlPrintf( c, "OK%s\n", ( late ) ? " Tags will be taken up when data next arrives" : "" );
+}
+// ====================================================================================================
+static void _controlFile( struct controlConn *c, bool setRotation, uint32_t rotateMB, uint32_t rotateSecs, bool rotateNow )
+
+/* Hand a change to whoever is writing each output file, and see it was made */
+
+{
+    int n = ( _numProbes ) ? _numProbes : 1;
+    bool late = false;
+    bool ok = true;
+
+    if ( !_r.options->outfile )
+    {
+        controlPrintf( c, "ERR Not writing to a file\n" );
+        return;
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( atomic_load( &_instance( i )->rc.fileDue ) )
+        {
+            controlPrintf( c, "ERR Last change to the file hasn't been taken up yet\n" );
+            return;
+        }
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        struct RunTime *r = _instance( i );
+
+        r->rc.setRotation = setRotation;
+        r->rc.rotateBytes = ( uint64_t )rotateMB * 1024 * 1024;
+        r->rc.rotateSecs  = rotateSecs;
+        r->rc.rotateNow   = rotateNow;
+        atomic_store_explicit( &r->rc.fileDue, true, memory_order_release );
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( !_controlWait( _instance( i ), &_instance( i )->rc.fileDue ) )
+        {
+            late = true;
+        }
+        else
+        {
+            ok &= _instance( i )->rc.fileOK;
+        }
+    }
+
+    if ( !ok )
+    {
+        controlPrintf( c, "ERR Output isn't a numbered series, set rotate size or time first\n" );
+        return;
+    }
+
+    if ( setRotation )
+    {
+        _r.options->rotateMB   = rotateMB;
+        _r.options->rotateSecs = rotateSecs;
+    }
+
+    controlPrintf( c, "OK%s\n", ( late ) ? " Will be taken up when data next arrives" : "" );
+}
+// ====================================================================================================
+static void _controlTrace( char *what, char *arg, struct controlConn *c )
+
+/* Change how ORBTrace probes take trace in, while they carry on sending it. It's set up again */
+/* from the command line options if a probe goes away and comes back.                         */
+
+{
+    int n = ( _numProbes ) ? _numProbes : 1;
+    int done = 0;
+    bool isMANCH = false;
+    bool useTPIU = false;
+    int v = 0;
+
+    if ( ( !what ) || ( !arg ) )
+    {
+        controlPrintf( c, "ERR trace width <1|2|4>, trace swo <manch|uart>[,tpiu] or trace baud <bps>\n" );
+        return;
+    }
+
+    if ( !strcmp( what, "width" ) )
+    {
+        v = atoi( arg );
+
+        if ( ( v != 1 ) && ( v != 2 ) && ( v != 4 ) )
+        {
+            controlPrintf( c, "ERR Trace width must be 1, 2 or 4\n" );
+            return;
+        }
+    }
+    else if ( !strcmp( what, "swo" ) )
+    {
+        isMANCH = !strncmp( arg, "manch", 5 );
+        useTPIU = ( strstr( arg, ",tpiu" ) != NULL );
+
+        if ( ( !isMANCH ) && ( strncmp( arg, "uart", 4 ) ) )
+        {
+            controlPrintf( c, "ERR SWO is manch or uart\n" );
+            return;
+        }
+    }
+    else if ( !strcmp( what, "baud" ) )
+    {
+        if ( ( v = atoi( arg ) ) <= 0 )
+        {
+            controlPrintf( c, "ERR Baudrate out of range\n" );
+            return;
+        }
+    }
+    else
+    {
+        controlPrintf( c, "ERR Unknown trace setting %s\n", what );
+        return;
+    }
+
+    for ( int i = 0; i < n; i++ )
+    {
+        struct RunTime *r = _instance( i );
+        bool ok;
+
+        /* Holding usbLock with a connection means it can't go away until this is done */
+        pthread_mutex_lock( &r->usbLock );
+
+        if ( ( r->conn ) && ( r->o ) && ( OrbtraceIsOrbtrace( r->o ) ) )
+        {
+            if ( !strcmp( what, "width" ) )
+            {
+                ok = OrbtraceIfSetTraceWidth( r->o, v );
+            }
+            else if ( !strcmp( what, "swo" ) )
+            {
+                ok = OrbtraceIfSetTraceSWO( r->o, isMANCH, useTPIU );
+            }
+            else
+            {
+                ok = OrbtraceIfSetSWOBaudrate( r->o, v );
+            }
+
+            if ( !ok )
+            {
+                controlPrintf( c, "%s: Failed\n", PROBE( r ) );
+            }
+            else
+            {
+                done++;
+            }
+        }
+
+        pthread_mutex_unlock( &r->usbLock );
+    }
+
+    if ( done )
+    {
+        controlPrintf( c, "OK %d probe%s changed\n", done, ( done == 1 ) ? "" : "s" );
+    }
+    else
+    {
+        controlPrintf( c, "ERR No connected ORBTrace to change\n" );
+    }
+}
+// ====================================================================================================
+static void _controlStatus( struct controlConn *c )
+
+{
+    int n = ( _numProbes ) ? _numProbes : 1;
+
+    for ( int i = 0; i < n; i++ )
+    {
+        struct RunTime *r = _instance( i );
+
+        controlPrintf( c, "probe %s connected %d port %d\n", ( *PROBE( r ) ) ? PROBE( r ) : "-", r->conn, r->port );
+    }
+
+    controlPrintf( c, "tags %s\n", ( _r.options->channelList ) ? _r.options->channelList : "none" );
+    controlPrintf( c, "interval %d\n", _r.options->intervalReportTime );
+
+    if ( _r.options->outfile )
+    {
+        controlPrintf( c, "file %s rotate size %d time %d\n", _r.options->outfile, _r.options->rotateMB, _r.options->rotateSecs );
+    }
+
+    controlPrintf( c, "OK\n" );
+}
+// ====================================================================================================
+#if !defined( WIN32 )
+struct handoverState
+{
+    FILE *f;                                             /* Where the state goes, for the new process to read */
+    int port;                                            /* Port whose clients are being written out */
+    int *keep;                                           /* Descriptors the new process is to be left */
+    int numKeep;
+};
+
+static void _handoverKeep( struct handoverState *h, int fd )
+
+{
+    int *k = ( int * )realloc( h->keep, ( h->numKeep + 1 ) * sizeof( int ) );
+    MEMCHECKV( k );
+    h->keep = k;
+    h->keep[h->numKeep++] = fd;
+}
+// ====================================================================================================
+static void _handoverHex( FILE *f, const uint8_t *d, size_t len )
+
+{
+    fputc( ' ', f );
+
+    if ( !len )
+    {
+        fputc( '-', f );
+    }
+
+    for ( size_t i = 0; i < len; i++ )
+    {
+        fprintf( f, "%02x", d[i] );
+    }
+}
+// ====================================================================================================
+static size_t _handoverUnhex( const char *c, uint8_t *d, size_t max )
+
+{
+    size_t n = 0;
+
+    while ( ( n < max ) && ( isxdigit( ( unsigned char )c[0] ) ) && ( isxdigit( ( unsigned char )c[1] ) ) )
+    {
+        sscanf( c, "%2hhx", &d[n++] );
+        c += 2;
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _handoverClient( const struct nwclientHandover *c, void *param )
+
+{
+    struct handoverState *h = ( struct handoverState * )param;
+
+    fprintf( h->f, "client %d %d %d %d %d %" PRIu64, h->port, c->fd, c->qos, c->settled, c->subscribed, c->sentBytes );
+    _handoverHex( h->f, ( const uint8_t * )&c->sub, sizeof( c->sub ) );
+    _handoverHex( h->f, c->req, c->reqLen );
+    fputc( '\n', h->f );
+    _handoverKeep( h, c->fd );
+}
+// ====================================================================================================
+static void _handoverPort( struct handoverState *h, struct nwclientsHandle *n, int port )
+
+{
+    int fd;
+
+    h->port = port;
+    fd = nwclientHandover( n, HANDOVER_DRAIN_MS, _handoverClient, h );
+
+    if ( fd >= 0 )
+    {
+        fprintf( h->f, "listen %d %d\n", port, fd );
+        _handoverKeep( h, fd );
+    }
+}
+// ====================================================================================================
+static void _handoverCloexec( struct handoverState *h )
+
+/* Only what's been written down is to survive into the new process, everything else is closed by exec */
+
+{
+    long max = sysconf( _SC_OPEN_MAX );
+
+    max = ( ( max < 0 ) || ( max > HANDOVER_MAX_FD ) ) ? HANDOVER_MAX_FD : max;
+
+    for ( int fd = STDERR_FILENO + 1; fd < max; fd++ )
+    {
+        int fl = fcntl( fd, F_GETFD );
+        bool kept = false;
+
+        if ( fl < 0 )
+        {
+            continue;
+        }
+
+        for ( int k = 0; ( !kept ) && ( k < h->numKeep ); k++ )
+        {
+            kept = ( h->keep[k] == fd );
+        }
+
+        fcntl( fd, F_SETFD, ( kept ) ? ( fl & ~FD_CLOEXEC ) : ( fl | FD_CLOEXEC ) );
+    }
+}
+// ====================================================================================================
+static void _handover( struct RunTime *r, const char *path )
+
+/* Stop taking data in, let what's been taken in get out, then become path, leaving it the probe, */
+/* the output file series, the ports and their clients so that nobody has to reconnect and       */
+/* nothing is lost. Once started there's no going back, so this doesn't return.                  */
+
+{
+    struct handoverState h = { 0 };
+    char e[16];
+    int fd;
+    int port;
+
+    atomic_store( &r->handingOver, true );
+
+    for ( int w = 1; !atomic_load( &r->feederParked ); w++ )
+    {
+        if ( !( w % ( INTERVAL_1S / INTERVAL_1MS ) ) )
+        {
+            genericsReport( V_INFO, "Waiting for capture to stop" EOL );
+        }
+
+        usleep( INTERVAL_1MS );
+    }
+
+    /* Nothing more is arriving, so once the buffers are back and anything held has gone it's all out */
+    _waitForLentBlocks( r );
+    usleep( r->options->coalesceuS + HANDOVER_QUIET_MS * 1000 );
+
+    if ( !( h.f = tmpfile() ) )
+    {
+        genericsExit( -1, "Could not make handover state (%s)" EOL, strerror( errno ) );
+    }
+
+    if ( r->capture )
+    {
+        fprintf( h.f, "seq %u\n", captureNextSeq( r->capture ) );
+        captureClose( r->capture );
+        r->capture = NULL;
+    }
+
+    fprintf( h.f, "tags %s\n", ( r->options->channelList ) ? r->options->channelList : "-" );
+    fprintf( h.f, "rotate %u %u\n", r->options->rotateMB, r->options->rotateSecs );
+    fprintf( h.f, "interval %d\n", r->options->intervalReportTime );
+
+    for ( int j = 0; j < _numPorts( r ); j++ )
+    {
+        struct nwclientsHandle *n = _portHandle( r, j, &port );
+
+        if ( n )
+        {
+            _handoverPort( &h, n, port );
+        }
+    }
+
+    if ( r->statsHandler )
+    {
+        _handoverPort( &h, r->statsHandler, r->options->statsPort );
+    }
+
+    if ( ( r->o ) && ( ( fd = OrbtraceIfDeviceFd( r->o ) ) >= 0 ) )
+    {
+        fprintf( h.f, "usb %d\n", fd );
+        _handoverKeep( &h, fd );
+    }
+
+    fflush( h.f );
+    fd = fileno( h.f );
+    lseek( fd, 0, SEEK_SET );
+    _handoverKeep( &h, fd );
+    snprintf( e, sizeof( e ), "%d", fd );
+    setenv( HANDOVER_ENV, e, 1 );
+
+    _handoverCloexec( &h );
+    genericsReport( V_INFO, "Handing over to %s" EOL, path );
+    execvp( path, _argv );
+    genericsExit( -1, "Could not start %s (%s)" EOL, path, strerror( errno ) );
+}
+// ====================================================================================================
+static void _handoverTakeClient( const char *l )
+
+{
+    struct handedClient h = { 0 };
+    char sub[HANDOVER_LINE_LEN];
+    char req[HANDOVER_LINE_LEN];
+    struct handedClient *n;
+    int settled, subscribed;
+
+    if ( 8 != sscanf( l, "client %d %d %d %d %d %" SCNu64 " %s %s", &h.port, &h.c.fd, &h.c.qos, &settled, &subscribed, &h.c.sentBytes, sub, req ) )
+    {
+        genericsReport( V_WARN, "Handover line not understood: %s" EOL, l );
+        return;
+    }
+
+    h.c.settled    = settled;
+    h.c.subscribed = subscribed;
+    _handoverUnhex( sub, ( uint8_t * )&h.c.sub, sizeof( h.c.sub ) );
+    h.c.reqLen = _handoverUnhex( req, h.c.req, sizeof( h.c.req ) );
+
+    n = ( struct handedClient * )realloc( _handed, ( _numHanded + 1 ) * sizeof( struct handedClient ) );
+    MEMCHECKV( n );
+    _handed = n;
+    _handed[_numHanded++] = h;
+}
+#endif
+// ====================================================================================================
+static void _handoverTake( struct RunTime *r )
+
+/* If this process was started by another handing over to it, pick up where that one was */
+
+{
+#if !defined( WIN32 )
+    char l[HANDOVER_LINE_LEN];
+    char *e = getenv( HANDOVER_ENV );
+    unsigned int a, b;
+    int port, fd;
+    FILE *f;
+
+    if ( !e )
+    {
+        return;
+    }
+
+    fd = atoi( e );
+    unsetenv( HANDOVER_ENV );
+
+    if ( !( f = fdopen( fd, "r" ) ) )
+    {
+        genericsReport( V_ERROR, "Could not read handover state (%s)" EOL, strerror( errno ) );
+        return;
+    }
+
+    while ( fgets( l, sizeof( l ), f ) )
+    {
+        l[strcspn( l, "\r\n" )] = 0;
+
+        if ( 2 == sscanf( l, "listen %d %d", &port, &fd ) )
+        {
+            nwclientInheritListener( port, fd );
+        }
+        else if ( 1 == sscanf( l, "seq %u", &a ) )
+        {
+            r->captureSeq = a;
+        }
+        else if ( 1 == sscanf( l, "usb %d", &fd ) )
+        {
+            r->usbFd     = fd;
+            r->haveUsbFd = true;
+        }
+        else if ( 2 == sscanf( l, "rotate %u %u", &a, &b ) )
+        {
+            r->options->rotateMB   = a;
+            r->options->rotateSecs = b;
+        }
+        else if ( 1 == sscanf( l, "interval %u", &a ) )
+        {
+            r->options->intervalReportTime = a;
+        }
+        else if ( !strncmp( l, "tags ", 5 ) )
+        {
+            r->options->channelList = ( strcmp( &l[5], "-" ) ) ? strdup( &l[5] ) : NULL;
+        }
+        else if ( !strncmp( l, "client ", 7 ) )
+        {
+            _handoverTakeClient( l );
+        }
+    }
+
+    fclose( f );
+    genericsReport( V_INFO, "Carrying on from the previous process, with %d client%s" EOL, _numHanded, ( _numHanded == 1 ) ? "" : "s" );
+#endif
+}
+// ====================================================================================================
+static void _handoverAdopt( struct RunTime *r )
+
+/* Now the ports are open again, give each of them back the clients it had */
+
+{
+#if !defined( WIN32 )
+
+    for ( int i = 0; i < _numHanded; i++ )
+    {
+        struct nwclientsHandle *n = NULL;
+        int port;
+
+        for ( int j = 0; ( !n ) && ( j < _numPorts( r ) ); j++ )
+        {
+            n = _portHandle( r, j, &port );
+            n = ( port == _handed[i].port ) ? n : NULL;
+        }
+
+        if ( ( !n ) && ( r->statsHandler ) && ( _handed[i].port == r->options->statsPort ) )
+        {
+            n = r->statsHandler;
+        }
+
+        if ( ( !n ) || ( !nwclientAdopt( n, &_handed[i].c ) ) )
+        {
+            close( _handed[i].c.fd );
+        }
+    }
+
+    free( _handed );
+    _handed = NULL;
+    _numHanded = 0;
+#endif
+}
+// ====================================================================================================
+static void _controlUpgrade( char *path, struct controlConn *c )
+
+{
+#if defined( WIN32 )
+    controlPrintf( c, "ERR Handing over isn't supported on this platform\n" );
+#else
+    path = ( path ) ? path : _argv[0];
+
+    if ( ( _numProbes ) || ( _r.options->nwserverPort ) || ( _r.options->port ) || ( _r.options->file ) || ( _r.options->rtt ) )
+    {
+        controlPrintf( c, "ERR Only capture from a single USB probe can be handed over\n" );
+    }
+    else if ( ( _r.options->outfile ) && ( !_r.options->rotateMB ) && ( !_r.options->rotateSecs ) )
+    {
+        controlPrintf( c, "ERR The output file would be written over, set a rotate size or time first\n" );
+    }
+    else if ( ( strchr( path, '/' ) ) && ( access( path, X_OK ) ) )
+    {
+        controlPrintf( c, "ERR %s can't be run\n", path );
+    }
+    else
+    {
+        controlPrintf( c, "OK Handing over to %s\n", path );
+        _handover( &_r, path );
+    }
+
+#endif
+}
+// ====================================================================================================
+static void _controlCommand( char *line, struct controlConn *c, void *param )
+
+/* One line from the control port. Changes go to every instance, since they share their options */
+
+{
+    char *save;
+    char *cmd = strtok_r( line, " \t", &save );
+    char *a1  = strtok_r( NULL, " \t", &save );
+    char *a2  = strtok_r( NULL, " \t", &save );
+
+    if ( !cmd )
+    {
+        controlPrintf( c, "OK\n" );
+    }
+    else if ( !strcmp( cmd, "help" ) )
+    {
+        controlPrintf( c, "status                        What's running, and how\n" );
+        controlPrintf( c, "tags <stream,stream...>       Legacy streams to decode and route, or none\n" );
+        controlPrintf( c, "interval <mS>                 Interval report time, 0 for none\n" );
+        controlPrintf( c, "rotate [size <MB>|time <s>]   Start the next output file now, or change when it's done\n" );
+        controlPrintf( c, "trace width <1|2|4>           ORBTrace parallel trace width\n" );
+        controlPrintf( c, "trace swo <manch|uart>[,tpiu] ORBTrace SWO encoding\n" );
+        controlPrintf( c, "trace baud <bps>              ORBTrace SWO baudrate\n" );
+        controlPrintf( c, "upgrade [binary]              Hand capture and clients over to binary, by default this one\n" );
+        controlPrintf( c, "OK\n" );
+    }
+    else if ( !strcmp( cmd, "status" ) )
+    {
+        _controlStatus( c );
+    }
+    else if ( !strcmp( cmd, "tags" ) )
+    {
+        _controlTagList( ( ( a1 ) && ( strcmp( a1, "none" ) ) ) ? a1 : NULL, c );
+    }
+    else if ( !strcmp( cmd, "interval" ) )
+    {
+        int v = ( a1 ) ? atoi( a1 ) : -1;
+
+        if ( ( v < 0 ) || ( ( v ) && ( v < 500 ) ) )
+        {
+            controlPrintf( c, "ERR Interval is 0, or at least 500mS\n" );
+        }
+        else
+        {
+            _r.options->intervalReportTime = v;
+            controlPrintf( c, "OK\n" );
+        }
+    }
+    else if ( !strcmp( cmd, "rotate" ) )
+    {
+        if ( !a1 )
+        {
+            _controlFile( c, false, 0, 0, true );
+        }
+        else if ( ( a2 ) && ( !strcmp( a1, "size" ) ) )
+        {
+            _controlFile( c, true, atoi( a2 ), _r.options->rotateSecs, false );
+        }
+        else if ( ( a2 ) && ( !strcmp( a1, "time" ) ) )
         {
-            genericsReport( V_INFO, "USB connection lost" EOL );
+            _controlFile( c, true, _r.options->rotateMB, atoi( a2 ), false );
+        }
+        else
+        {
+            controlPrintf( c, "ERR rotate, rotate size <MB> or rotate time <s>\n" );
         }
-
-        genericsReport( V_INFO, "USB Interface closed" EOL );
     }
-
-    return 0;
+    else if ( !strcmp( cmd, "trace" ) )
+    {
+        _controlTrace( a1, a2, c );
+    }
+    else if ( !strcmp( cmd, "upgrade" ) )
+    {
+        _controlUpgrade( a1, c );
+    }
+    else
+    {
+        controlPrintf( c, "ERR Unknown command %s, try help\n", cmd );
+    }
 }
 // ====================================================================================================
-
-static int _nwserverFeeder( struct RunTime *r )
-
-/* Setup network based transfers (typically used for things like J-Link but can also be a legacy orbuculum session */
+static void _startControl( void )
 
 {
-    struct dataBlock *rxBlock = &r->rawBlock[0];
-
-    while ( true )
+    if ( _r.options->controlPort )
     {
-        struct Stream *stream = streamCreateSocket( r->options->nwserverHost, r->options->nwserverPort );
-
-        if ( stream == NULL )
+        if ( !controlServerStart( _r.options->controlPort, _controlCommand, NULL ) )
         {
-            continue;
+            genericsExit( -1, "Could not start control server" EOL );
         }
 
-        genericsReport( V_INFO, "Established NW Server Link" EOL );
+        genericsReport( V_INFO, "Taking control commands on port %d" EOL, _r.options->controlPort );
+    }
+}
+#undef PROBE
+// ====================================================================================================
+static void _openRunTime( struct RunTime *r, int slot )
 
-        r->conn = true;
+/* Set up the decoders and outputs for an instance, with its network ports in the slot'th range */
 
-        while ( !r->ending )
-        {
-            size_t fl;
-            enum ReceiveResult result = stream->receive( stream, rxBlock->buffer, USB_TRANSFER_SIZE, NULL, &fl );
-            rxBlock->fillLevel = fl;
+{
+    struct timespec ts;
+    pthread_t sender;
 
-            if ( result != RECEIVE_RESULT_OK )
-            {
-                break;
-            }
+    r->port = r->options->listenPort + slot * MULTI_PORT_STRIDE;
 
-            _handleBlock( r, rxBlock->fillLevel, rxBlock->buffer );
-        }
+    /* However slow the clients get, every instance keeps half its spare buffers for capture */
+    nwclientSetLendLimit( ( slot + 1 ) * NUM_SPARE_BLOCKS / 2 );
+    nwclientSetBudget( ( uint64_t )r->options->budgetMB << 20, r->options->shedPolicy );
 
-        if ( !r->ending )
-        {
-            genericsReport( V_INFO, "Lost NW Server Link" EOL );
-        }
+    /* All of the buffers data comes in through, in one piece so it can go in huge pages */
+    r->rawBlock = ( struct dataBlock * )bufPoolAlloc( NUM_USB_BLOCKS * sizeof( struct dataBlock ), BUFPOOL_HUGE );
+    MEMCHECKV( r->rawBlock );
+    r->spareBlock = &r->rawBlock[NUM_RAW_BLOCKS];
 
-        r->conn = false;
-        free( stream );
+    if ( r->options->useTPIU )
+    {
+        TPIUDecoderInit( &r->t );
     }
 
-    return 0;
-}
-// ====================================================================================================
-
+    OFLOWInit( &r->oflow );
+    OFLOWCoalesceInit( &r->itmOflowOtg, DEFAULT_ITM_STREAM );
+    pthread_mutex_init( &r->usbLock, NULL );
 
-#ifdef WIN32
-// ====================================================================================================
-// WIN32 Specific Driver
-// ====================================================================================================
-
-static int _serialFeeder( struct RunTime *r )
-{
-    char portPath[MAX_PATH] = { 0 };
-    snprintf( portPath, sizeof( portPath ), "\\\\.\\%s", r->options->port );
+    pthread_mutex_init( &r->rc.l, NULL );
+    pthread_cond_init( &r->rc.c, NULL );
 
-    while ( !r->ending )
+    if ( r->options->channelList )
     {
-        HANDLE portHandle = CreateFile( portPath,
-                                        GENERIC_READ,
-                                        0,      //  must be opened with exclusive-access
-                                        NULL,   //  default security attributes
-                                        OPEN_EXISTING, //  must use OPEN_EXISTING
-                                        0,    //  not overlapped I/O
-                                        NULL ); //  hTemplate must be NULL for comm devices
+        /* Channel list is only needed for legacy ports that we are re-exporting (i.e. clean unencapsulated flows) */
+        int tag[NUM_OFLOW_CHANNELS];
+        const char *why;
+        int n = _parseTagList( r->options->channelList, tag, &why );
 
-        if ( portHandle == INVALID_HANDLE_VALUE )
+        if ( n < 0 )
         {
-            genericsExit( 1, "Can't open serial port" EOL );
+            genericsExit( -1, "%s" EOL, why );
         }
 
-        genericsReport( V_INFO, "Port opened" EOL );
-
-        if ( !_setSerialSpeed( portHandle, r->options->speed ) )
+        if ( n )
         {
-            genericsExit( 2, "setSerialConfig failed" EOL );
+            r->handler = ( struct handlers * )calloc( n, sizeof( struct handlers ) );
+            MEMCHECKV( r->handler );
         }
 
-        SetCommMask( portHandle, EV_RXCHAR );
-
-        genericsReport( V_INFO, "Port configured" EOL );
-
-        r->conn = true;
-
-        while ( !r->ending )
+        for ( r->numHandlers = 0; r->numHandlers < n; r->numHandlers++ )
         {
-            DWORD eventMask = 0;
-            WaitCommEvent( portHandle, &eventMask, NULL );
-            DWORD unused;
-            COMSTAT stats;
-            ClearCommError( portHandle, &unused, &stats );
-
-            if ( stats.cbInQue == 0 )
-            {
-                continue;
-            }
+            _openHandler( r, &r->handler[r->numHandlers], tag[r->numHandlers], r->numHandlers );
+        }
+    }
 
-            struct dataBlock *rxBlock = &r->rawBlock[0];
+    /* Handlers are all in place now, so build the tag lookup for them */
+    _mapHandlers( r );
 
-            DWORD transferSize = stats.cbInQue;
+    /* The OFLOW handler doesn't need a channel list ... it works on all channels */
+    r->oflowHandler = nwclientStart( r->port );
+    _setSpill( r, r->oflowHandler );
+    nwclientSetHistory( r->oflowHandler, ( size_t )r->options->historyMB << 20, r->options->historySecs * 1000 );
 
-            if ( transferSize > USB_TRANSFER_SIZE )
-            {
-                transferSize = USB_TRANSFER_SIZE;
-            }
+    /* ...by now the one thread that sends to every client is running */
+    if ( nwclientSenderThread( &sender ) )
+    {
+        _threadPolicy( r->options, sender, THREAD_SEND );
+    }
+    genericsReport( V_INFO, "Started Network interface for OFLOW on port %d" EOL, r->port );
 
-            ReadFile( portHandle, rxBlock->buffer, transferSize, &rxBlock->fillLevel, NULL );
+    if ( r->options->statsPort )
+    {
+        r->statsHandler = nwclientStart( r->options->statsPort + slot * MULTI_PORT_STRIDE );
+        genericsReport( V_INFO, "Started statistics on port %d" EOL, r->options->statsPort + slot * MULTI_PORT_STRIDE );
+    }
 
-            if ( rxBlock->fillLevel <= 0 )
-            {
-                break;
-            }
+    if ( r->options->msgPort )
+    {
+        ITMDecoderInit( &r->msgITM, true );
 
-            _handleBlock( r, rxBlock->fillLevel, rxBlock->buffer );
+        if ( !MSGSeqInit( &r->msgSeq, &r->msgITM, MSG_REORDER_BUFLEN ) )
+        {
+            genericsExit( -1, "No memory for message sequencer" EOL );
         }
 
-        r->conn = false;
+        r->msgHandler = nwclientStart( r->options->msgPort + slot * MULTI_PORT_STRIDE );
+        _setSpill( r, r->msgHandler );
 
-        if ( ! r->ending )
+        if ( r->options->pcHistmS )
         {
-            genericsReport( V_INFO, "Read failed" EOL );
+            r->pcHist = pcHistCreate();
+            r->pcHistStartmS = genericsTimestampmS();
         }
-
-        CloseHandle( portHandle );
+        genericsReport( V_INFO, "Started decoded messages on port %d" EOL, r->options->msgPort + slot * MULTI_PORT_STRIDE );
     }
 
-    return 0;
-}
-
-#else
-// =========================================================================================================
-// Default Driver ( OSX and Linux )
-// =========================================================================================================
-
-static int _serialFeeder( struct RunTime *r )
-
-/* Setup incoming feed from a serial port */
+    _registerStats( r );
 
-{
-    int ret;
-    struct dataBlock *rxBlock = &r->rawBlock[0];
+#if !defined( WIN32 )
 
-    while ( !r->ending )
+    if ( r->options->shmName )
     {
-#ifdef OSX
-        int flags;
+        char *n = _instanceName( r, r->options->shmName );
 
-        while ( !r->ending && ( r->f = open( r->options->port, O_RDONLY | O_NONBLOCK ) ) < 0 )
-#else
-        while ( !r->ending && ( r->f = open( r->options->port, O_RDONLY ) ) < 0 )
-#endif
+        if ( !( r->oflowShm = shmRingCreate( n, SHMRING_DEFAULT_SIZE ) ) )
         {
-            genericsReport( V_WARN, "Can't open serial port" EOL );
-            usleep( INTERVAL_100MS );
+            genericsExit( -1, "Could not create shared memory for OFLOW" EOL );
         }
 
-        genericsReport( V_INFO, "Port opened" EOL );
-
-#ifdef OSX
-        /* Remove the O_NONBLOCK flag now the port is open (OSX Only) */
+        genericsReport( V_INFO, "Publishing OFLOW into shared memory %s" EOL, n );
+        free( n );
+    }
 
-        if ( ( flags = fcntl( r->f, F_GETFL, NULL ) ) < 0 )
+    if ( r->options->mcastSpec )
+    {
+        /* Each probe goes to a port of its own, same as its network ports */
+        if ( !( r->oflowMcast = mcastCreate( r->options->mcastSpec, slot * MULTI_PORT_STRIDE ) ) )
         {
-            genericsExit( -3, "F_GETFL failed" EOL );
+            genericsExit( -1, "Could not set up multicast for OFLOW" EOL );
         }
 
-        flags &= ~O_NONBLOCK;
+        genericsReport( V_INFO, "Sending OFLOW to multicast %s (port offset %d)" EOL, r->options->mcastSpec, slot * MULTI_PORT_STRIDE );
+    }
 
-        if ( ( flags = fcntl( r->f, F_SETFL, flags ) ) < 0 )
+    if ( r->options->numPlugins )
+    {
+        r->plugins = pluginHostCreate( r->probe, r->options->useTPIU );
+
+        for ( int i = 0; i < r->options->numPlugins; i++ )
         {
-            genericsExit( -3, "F_SETFL failed" EOL );
+            if ( !pluginHostLoad( r->plugins, r->options->plugins[i] ) )
+            {
+                genericsExit( -1, "Could not load plugin" EOL );
+            }
         }
 
-#endif
-
-        if ( ( ret = _setSerialConfig ( r->f, r->options->speed ) ) < 0 )
+        if ( !pluginHostStart( r->plugins ) )
         {
-            genericsExit( ret, "setSerialConfig failed" EOL );
+            genericsExit( -1, "Could not start plugins" EOL );
         }
+    }
 
-        r->conn = true;
-
-        while ( !r->ending )
-        {
-            if ( ( rxBlock->fillLevel = read( r->f, rxBlock->buffer, USB_TRANSFER_SIZE ) ) <= 0 )
-            {
-                break;
-            }
+#endif
 
-            _handleBlock( r, rxBlock->fillLevel, rxBlock->buffer );
-        }
+    /* Don't do anything with interval times for at least the first interval time */
+    clock_gettime( CLOCK_REALTIME, &ts );
+    r->lastInterval = ts.tv_sec * 1000000000L + ts.tv_nsec;
 
-        r->conn = false;
+    if ( r->options->outfile )
+    {
+        char *n = _instanceName( r, r->options->outfile );
+        r->capture = captureOpenAt( n, ( uint64_t )r->options->rotateMB * 1024 * 1024, r->options->rotateSecs, r->captureSeq );
+        free( n );
 
-        if ( ! r->ending )
+        if ( ( !r->capture ) || ( ( r->options->archive ) && ( !captureSetArchive( r->capture, r->options->archive ) ) ) )
         {
-            genericsReport( V_INFO, "Read failed" EOL );
+            genericsExit( -2, "" EOL );
         }
 
-        close( r->f );
+        captureSetIndex( r->capture, CAPTURE_INDEX_MS, -1 );
     }
-
-    return 0;
 }
-#endif
-
 // ====================================================================================================
-static int _fileFeeder( struct RunTime *r )
-
-/* Setup incoming data stream from a file in either legacy or OFLOW format */
+static void *_usbFeederTask( void *arg )
 
 {
-    struct dataBlock *rxBlock = &r->rawBlock[0];
+    struct RunTime *r = ( struct RunTime * )arg;
 
+    _usbFeeder( r );
+    genericsReport( V_WARN, "Stopped serving probe %s" EOL, r->probe );
+    return NULL;
+}
+// ====================================================================================================
+static int _multiUsbFeeder( struct RunTime *r )
 
-    if ( ( r->f = open( r->options->file, O_RDONLY ) ) < 0 )
-    {
-        genericsExit( -4, "Can't open file %s" EOL, r->options->file );
-    }
+/* Serve several probes from the one process. Each gets its own instance, with its own connection */
+/* handling and pipeline, but they all share one libusb context whose events are handled here.   */
 
-    r->conn = true;
+{
+    struct timeval tv = { .tv_sec = 0, .tv_usec = INTERVAL_100MS };
+    libusb_context *context;
+    pthread_t t;
+    char *sns = strdup( r->options->sn );
+    char *sn;
 
-    /* Start off by checking if this is OFLOW formatted */
-    rxBlock->fillLevel = read( r->f, rxBlock->buffer, OFLOW_SIG_LEN );
-    r->usingOFLOW = ( ( OFLOW_SIG_LEN == rxBlock->fillLevel ) && ( !strncmp( OFLOW_SIG, ( char * )rxBlock->buffer, OFLOW_SIG_LEN ) ) );
-    genericsReport( V_INFO, "File is %sin OFLOW format" EOL, ( r->usingOFLOW ) ? "" : "not " );
+    MEMCHECK( sns, -1 );
 
-    if ( r->usingOFLOW )
+    if ( libusb_init( &context ) < 0 )
     {
-        /* This is OFLOW, so we need to read the first data after the header */
-        rxBlock->fillLevel = read( r->f, rxBlock->buffer, USB_TRANSFER_SIZE );
+        genericsExit( -1, "Could not create USB context" EOL );
     }
 
-    while ( !r->ending )
+    for ( sn = strtok( sns, "," ); sn; sn = strtok( NULL, "," ) )
     {
-        if ( !rxBlock->fillLevel )
-        {
-            if ( r->options->fileTerminate )
-            {
-                break;
-            }
-            else
-            {
-                // Just spin for a while to avoid clogging the CPU
-                usleep( INTERVAL_100MS );
-                continue;
-            }
-        }
+        struct RunTime *p = ( _numProbes ) ? ( struct RunTime * )calloc( 1, sizeof( struct RunTime ) ) : r;
+        MEMCHECK( p, -1 );
+
+        _probe = ( struct RunTime ** )realloc( _probe, sizeof( struct RunTime * ) * ( _numProbes + 1 ) );
+        MEMCHECK( _probe, -1 );
+
+        p->options    = r->options;
+        p->probe      = sn;
+        p->sn         = strdup( sn );
+        p->usbContext = context;
+        _probe[_numProbes] = p;
+        _openRunTime( p, _numProbes++ );
+        genericsReport( V_INFO, "Serving probe %s with ports from %d" EOL, sn, p->port );
+    }
 
-        _handleBlock( r, rxBlock->fillLevel, rxBlock->buffer );
+    _startMetrics();
+    _startControl();
+    genericsPrintf( EOL );
 
-        if ( r->options->paceDelay )
+    for ( int i = 0; i < _numProbes; i++ )
+    {
+        if ( pthread_create( &t, NULL, &_usbFeederTask, _probe[i] ) )
         {
-            usleep( r->options->paceDelay );
+            genericsExit( -1, "Failed to create probe thread" EOL );
         }
 
-        rxBlock->fillLevel = read( r->f, rxBlock->buffer, USB_TRANSFER_SIZE );
+        pthread_detach( t );
     }
 
-    r->conn = false;
+    /* ...and from here on this thread just services the USB events for all of them */
+    _threadPolicy( r->options, pthread_self(), THREAD_CAPTURE );
 
-    if ( !r->options->fileTerminate )
+    while ( !r->ending )
     {
-        genericsReport( V_INFO, "File read error" EOL );
+        int ret = libusb_handle_events_timeout_completed( context, &tv, NULL );
+
+        if ( ( ret ) && ( ret != LIBUSB_ERROR_INTERRUPTED ) )
+        {
+            genericsReport( V_ERROR, "Error waiting for USB requests to complete %d" EOL, ret );
+        }
     }
 
-    close( r->f );
-    return true;
+    return 0;
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -1506,10 +5844,9 @@ static int _fileFeeder( struct RunTime *r )
 int main( int argc, char *argv[] )
 
 {
-    struct timespec ts;
-
     /* This is set here to avoid huge .data section in startup image */
     _r.options = &_options;
+    _argv = argv;
 
 #ifdef WIN32
     WSADATA wsaData;
@@ -1522,14 +5859,8 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "" EOL );
     }
 
-    if ( _r.options->useTPIU )
-    {
-        TPIUDecoderInit( &_r.t );
-    }
-
-    OFLOWInit( &_r.oflow );
-
     genericsScreenHandling( !_r.options->mono );
+    _handoverTake( &_r );
 
     /* Make sure the network clients get removed at the end */
     atexit( _doExit );
@@ -1548,75 +5879,31 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
     }
 
-#endif
-
-    if ( _r.options->channelList )
+    if ( SIG_ERR == signal( SIGUSR1, _profileHandler ) )
     {
-        /* Channel list is only needed for legacy ports that we are re-exporting (i.e. clean unencapsulated flows) */
-        char *c = _r.options->channelList;
-        int x = 0;
-
-        while ( *c )
-        {
-            while ( *c == ',' )
-            {
-                c++;
-            }
-
-            while ( isdigit( *c ) )
-            {
-                x = x * 10 + ( *c++ -'0' );
-            }
-
-            if ( ( *c ) && ( *c != ',' ) )
-            {
-                genericsExit( -1, "Illegal character in channel list (%c)" EOL, *c );
-            }
-
-            if ( x )
-            {
-                /* This is a good number, so open */
-                if ( ( x < 0 ) || ( x >= NUM_OFLOW_CHANNELS ) )
-                {
-                    genericsExit( -1, "Channel number out of range" EOL );
-                }
-
-                _r.handler = ( struct handlers * )realloc( _r.handler, sizeof( struct handlers ) * ( _r.numHandlers + 1 ) );
-
-                _r.handler[_r.numHandlers].channel = x;
-                _r.handler[_r.numHandlers].strippedBlock = ( struct dataBlock * )calloc( 1, sizeof( struct dataBlock ) );
-                _r.tagCount[x].hasHandler = true;
-                _r.handler[_r.numHandlers].n = nwclientStart(  _r.options->listenPort + LEGACY_SERVER_PORT_OFS + _r.numHandlers );
-                genericsReport( V_INFO, "Will decode tag %d, exported Legacy interface on port %d" EOL, x, _r.options->listenPort + LEGACY_SERVER_PORT_OFS + _r.numHandlers );
-
-                _r.numHandlers++;
-                x = 0;
-            }
-        }
+        genericsExit( -1, "Failed to establish profiling handler" EOL );
     }
 
-    /* The OFLOW handler doesn't need a channel list ... it works on all channels */
-    _r.oflowHandler = nwclientStart( _r.options->listenPort );
-    genericsReport( V_INFO, "Started Network interface for OFLOW on port %d" EOL, _r.options->listenPort );
+#endif
 
-    /* Don't do anything with interval times for at least the first interval time */
-    clock_gettime( CLOCK_REALTIME, &ts );
-    _r.lastInterval = ts.tv_sec * 1000000000L + ts.tv_nsec;
+    atomic_store( &_profiling, _r.options->profile );
 
-    if ( _r.options->outfile )
+    if ( ( _r.options->sn ) && ( strchr( _r.options->sn, ',' ) ) )
     {
-        _r.opFileHandle = open( _r.options->outfile, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH );
-
-        if ( _r.opFileHandle < 0 )
-        {
-            genericsReport( V_ERROR, "Could not open output file for writing" EOL );
-            return -2;
-        }
+        exit( _multiUsbFeeder( &_r ) );
     }
 
+    _openRunTime( &_r, 0 );
+    _handoverAdopt( &_r );
+    _startMetrics();
+    _startControl();
+
     /* Blank line for tidyness' sake */
     genericsPrintf( EOL );
 
+    /* Whichever feeder it is runs on this thread */
+    _threadPolicy( _r.options, pthread_self(), THREAD_CAPTURE );
+
     if ( ( _r.options->nwserverPort ) || ( _r.options->port ) || ( _r.options->file ) )
     {
         if ( _r.options->nwserverPort )
@@ -0,0 +1,886 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Data trace variable logger for Orbuculum
+ * ========================================
+ *
+ * DWT comparators set up for data value trace send the value of what they watch each time it's
+ * written (and read, if that's wanted too). Each comparator is given the variable it's watching,
+ * named from the DWARF in the elf, and everything that arrives from it is written to a columnar
+ * file and/or decimated into min/max/mean buckets. The buckets are served over HTTP, so a plot can
+ * ask for what's new at whatever rate it refreshes without every sample having to be sent to it.
+ *
+ * The file is a header, then blocks which each hold a run of samples from one variable, as a column
+ * of times followed by a column of values;
+ *
+ *   header : FILE_MAGIC, uint32 number of variables, then a struct varFileEntry for each
+ *   block  : uint32 variable, uint32 n, n x uint64 time in nS, n x double value
+ *
+ * all in the byte order of the host that wrote it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "git_version_info.h"
+#include "generics.h"
+#include "loadelf.h"
+#include "orbSession.h"
+#include "metricsServer.h"
+
+#define MAX_COMP            (4)              /* Data trace packets can only say which of four comparators they're from */
+#define NAME_LEN            (64)             /* Longest variable name kept */
+#define FILE_MAGIC          "ORBVAR1"
+#define FILE_BLOCK          (4096)           /* Samples held for a variable before they're written as a block */
+#define PENDING_MAX         (256)            /* Most samples waiting for a timestamp */
+#define DEFAULT_INTERVAL_US (10000)          /* Width of a decimation bucket */
+#define DEFAULT_KEEP        (1000)           /* ...and how many of them are kept for serving */
+
+/* Each variable as described at the start of the file */
+struct varFileEntry
+{
+    char     name[NAME_LEN];
+    uint32_t addr;
+    uint8_t  comp;
+    uint8_t  size;
+    uint8_t  type;                           /* enum symbolVarType */
+    uint8_t  spare;
+};
+
+/* Samples over one interval, decimated */
+struct bucket
+{
+    uint64_t start;                          /* Time of start of interval in nS */
+    double min;
+    double max;
+    double sum;
+    uint32_t n;                              /* Samples in it, 0 if it hasn't been started */
+};
+
+/* What's known about, and has arrived from, one comparator */
+struct watch
+{
+    const char *spec;                        /* What it was set to watch from the command line, NULL if unused */
+    char name[NAME_LEN];                     /* Name it's known by */
+    symbolMemaddr addr;
+    unsigned int size;                       /* Bytes in the variable */
+    enum symbolVarType type;                 /* ...and how to read them */
+    unsigned int index;                      /* Variable number in the output file */
+
+    uint64_t samples;                        /* Taken from this comparator */
+    double last;                             /* ...and the most recent */
+
+    uint64_t *ft;                            /* Samples waiting to be written to the file */
+    double *fv;
+    unsigned int fn;
+
+    struct bucket cur;                       /* Bucket being filled */
+    struct bucket *ring;                     /* ...and the last ones that were, oldest at ringStart */
+    unsigned int ringStart;
+    unsigned int ringLen;
+};
+
+/* A sample that's arrived, but not yet the timestamp that says when */
+struct pending
+{
+    uint8_t comp;
+    double v;
+};
+
+// Record for options, either defaults or from command line
+struct
+{
+    char *elffile;                           /* Where the variables are described */
+    char *outfile;                           /* Columnar output file */
+    uint32_t intervaluS;                     /* Width of decimation buckets */
+    uint32_t keep;                           /* ...and how many are kept */
+    int httpPort;                            /* Port to serve series and metrics on, 0 for none */
+    bool reads;                              /* Take reads as well as writes */
+    uint64_t cps;                            /* Cycles per second for target CPU, to time from its timestamps */
+    bool mono;                               /* Supress colour in output */
+
+    /* Source information */
+    char *server;
+    int port;
+    bool oflow;                              /* Source is ORBFLOW (i.e. orbuculum) */
+    uint32_t tag;                            /* ...and the tag the ITM is in */
+    char *file;                              /* File host connection */
+    bool endTerminate;                       /* Terminate when file/socket "ends" */
+} options =
+{
+    .intervaluS = DEFAULT_INTERVAL_US,
+    .keep = DEFAULT_KEEP,
+    .oflow = true,
+    .tag = 1,
+};
+
+struct
+{
+    struct symbol *s;                        /* The symbols the variables are found in */
+    struct watch w[MAX_COMP];
+    unsigned int nused;                      /* Number of comparators in use */
+    FILE *o;                                 /* Columnar output, if we're writing it */
+    pthread_mutex_t lock;                    /* Between the decode and the HTTP server */
+
+    uint64_t ticks;                          /* Target time in cycles, from its timestamps */
+    struct pending p[PENDING_MAX];           /* Samples waiting for a timestamp */
+    unsigned int np;
+
+    uint64_t unwatched;                      /* Samples from comparators we weren't told about */
+    bool ending;
+} _r;
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static double _value( struct watch *w, uint32_t d )
+
+/* Interpret the bits sent as the variable would be */
+
+{
+    float f;
+
+    switch ( w->type )
+    {
+        case SV_FLOAT:
+
+            /* Only 32 bits are ever sent, so a double can only be shown as its raw top or bottom half */
+            if ( w->size == sizeof( float ) )
+            {
+                memcpy( &f, &d, sizeof( f ) );
+                return f;
+            }
+
+            return d;
+
+        case SV_SIGNED:
+            return ( w->size == 1 ) ? ( int8_t )d : ( w->size == 2 ) ? ( int16_t )d : ( int32_t )d;
+
+        default:
+            return ( w->size == 1 ) ? ( uint8_t )d : ( w->size == 2 ) ? ( uint16_t )d : d;
+    }
+}
+// ====================================================================================================
+static void _writeBlock( struct watch *w )
+
+{
+    uint32_t hdr[2] = { w->index, w->fn };
+
+    if ( ( _r.o ) && ( w->fn ) )
+    {
+        if ( ( fwrite( hdr, sizeof( hdr ), 1, _r.o ) != 1 ) ||
+                ( fwrite( w->ft, sizeof( *w->ft ), w->fn, _r.o ) != w->fn ) ||
+                ( fwrite( w->fv, sizeof( *w->fv ), w->fn, _r.o ) != w->fn ) )
+        {
+            genericsReport( V_ERROR, "Failed to write to %s, no more will be" EOL, options.outfile );
+            fclose( _r.o );
+            _r.o = NULL;
+        }
+    }
+
+    w->fn = 0;
+}
+// ====================================================================================================
+static void _bucketClose( struct watch *w )
+
+/* The bucket being filled is done, so move it into the ring, or out to the console if there's nowhere else */
+
+{
+    if ( !w->cur.n )
+    {
+        return;
+    }
+
+    if ( ( !options.outfile ) && ( !options.httpPort ) )
+    {
+        genericsPrintf( "%.6f,%s,%.9g,%.9g,%.9g,%" PRIu32 EOL, w->cur.start / 1e9, w->name, w->cur.min, w->cur.max, w->cur.sum / w->cur.n, w->cur.n );
+    }
+
+    if ( w->ringLen < options.keep )
+    {
+        w->ring[( w->ringStart + w->ringLen++ ) % options.keep] = w->cur;
+    }
+    else
+    {
+        w->ring[w->ringStart] = w->cur;
+        w->ringStart = ( w->ringStart + 1 ) % options.keep;
+    }
+
+    w->cur.n = 0;
+}
+// ====================================================================================================
+static void _sample( struct watch *w, uint64_t t, double v )
+
+{
+    uint64_t interval = ( uint64_t )options.intervaluS * 1000;
+
+    pthread_mutex_lock( &_r.lock );
+
+    if ( ( w->cur.n ) && ( t >= w->cur.start + interval ) )
+    {
+        _bucketClose( w );
+    }
+
+    if ( !w->cur.n )
+    {
+        w->cur = ( struct bucket )
+        {
+            .start = t - ( t % interval ), .min = v, .max = v
+        };
+    }
+
+    w->cur.min = ( v < w->cur.min ) ? v : w->cur.min;
+    w->cur.max = ( v > w->cur.max ) ? v : w->cur.max;
+    w->cur.sum += v;
+    w->cur.n++;
+    w->samples++;
+    w->last = v;
+
+    pthread_mutex_unlock( &_r.lock );
+
+    if ( _r.o )
+    {
+        w->ft[w->fn] = t;
+        w->fv[w->fn] = v;
+
+        if ( ++w->fn == FILE_BLOCK )
+        {
+            _writeBlock( w );
+        }
+    }
+}
+// ====================================================================================================
+static uint64_t _targetnS( void )
+
+{
+    return ( uint64_t )( ( double )_r.ticks * 1e9 / options.cps );
+}
+// ====================================================================================================
+static void _flushPending( void )
+
+/* Everything waiting has been timestamped */
+
+{
+    uint64_t t = _targetnS();
+
+    for ( unsigned int i = 0; i < _r.np; i++ )
+    {
+        _sample( &_r.w[_r.p[i].comp], t, _r.p[i].v );
+    }
+
+    _r.np = 0;
+}
+// ====================================================================================================
+static void _msgs( uint8_t tag, const struct msg *m, size_t n, void *param )
+
+/* Messages from the ITM, of which we only care about data trace and (maybe) timestamps */
+
+{
+    for ( size_t i = 0; i < n; i++ )
+    {
+        switch ( m[i].genericMsg.msgtype )
+        {
+            case MSG_TS:
+                if ( options.cps )
+                {
+                    _r.ticks += ( ( const struct TSMsg * )&m[i] )->timeInc;
+                    _flushPending();
+                }
+
+                break;
+
+            case MSG_DATA_RWWP:
+            {
+                const struct watchMsg *d = &m[i].watchMsg;
+
+                if ( ( d->comp >= MAX_COMP ) || ( !_r.w[d->comp].spec ) )
+                {
+                    _r.unwatched++;
+                    break;
+                }
+
+                if ( ( !d->isWrite ) && ( !options.reads ) )
+                {
+                    break;
+                }
+
+                if ( !options.cps )
+                {
+                    _sample( &_r.w[d->comp], d->ts * 1000, _value( &_r.w[d->comp], d->data ) );
+                    break;
+                }
+
+                /* A local timestamp says when the packets before it happened, so wait for one */
+                if ( _r.np == PENDING_MAX )
+                {
+                    _flushPending();
+                }
+
+                _r.p[_r.np++] = ( struct pending )
+                {
+                    .comp = d->comp, .v = _value( &_r.w[d->comp], d->data )
+                };
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+// ====================================================================================================
+static const char *_series( const char *path, struct metricsBuf *b, void *param )
+
+/* /series[?since=<seconds>] gives every complete bucket that started after since, as CSV */
+
+{
+    const char *q;
+    uint64_t since = 0;
+    bool any = false;
+
+    if ( ( strncmp( path, "/series", 7 ) ) || ( ( path[7] ) && ( path[7] != '?' ) ) )
+    {
+        return NULL;
+    }
+
+    if ( ( q = strstr( path, "since=" ) ) )
+    {
+        since = ( uint64_t )( atof( q + 6 ) * 1e9 );
+        any = true;
+    }
+
+    metricsPrintf( b, "time,name,min,max,mean,count\n" );
+    pthread_mutex_lock( &_r.lock );
+
+    for ( int c = 0; c < MAX_COMP; c++ )
+    {
+        struct watch *w = &_r.w[c];
+
+        for ( unsigned int i = 0; ( w->spec ) && ( i < w->ringLen ); i++ )
+        {
+            struct bucket *k = &w->ring[( w->ringStart + i ) % options.keep];
+
+            if ( ( !any ) || ( k->start > since ) )
+            {
+                metricsPrintf( b, "%.6f,%s,%.9g,%.9g,%.9g,%" PRIu32 "\n", k->start / 1e9, w->name, k->min, k->max, k->sum / k->n, k->n );
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &_r.lock );
+    return "text/csv";
+}
+// ====================================================================================================
+static void _renderMetrics( struct metricsBuf *b, void *param )
+
+{
+    metricsType( b, "orbvar_samples_total", "counter", "Samples taken of each variable" );
+    pthread_mutex_lock( &_r.lock );
+
+    for ( int c = 0; c < MAX_COMP; c++ )
+    {
+        if ( _r.w[c].spec )
+        {
+            metricsPrintf( b, "orbvar_samples_total{var=\"%s\",comp=\"%d\"} %" PRIu64 "\n", _r.w[c].name, c, _r.w[c].samples );
+        }
+    }
+
+    metricsType( b, "orbvar_value", "gauge", "Most recent value of each variable" );
+
+    for ( int c = 0; c < MAX_COMP; c++ )
+    {
+        if ( ( _r.w[c].spec ) && ( _r.w[c].samples ) )
+        {
+            metricsPrintf( b, "orbvar_value{var=\"%s\",comp=\"%d\"} %.9g\n", _r.w[c].name, c, _r.w[c].last );
+        }
+    }
+
+    pthread_mutex_unlock( &_r.lock );
+    metricsType( b, "orbvar_unwatched_total", "counter", "Samples from comparators that weren't given a variable" );
+    metricsPrintf( b, "orbvar_unwatched_total %" PRIu64 "\n", _r.unwatched );
+}
+// ====================================================================================================
+static bool _resolve( void )
+
+/* Find out what each comparator is watching, and get ready to keep what arrives from it */
+
+{
+    struct symbolVariableStore *v;
+    unsigned int index = 0;
+    char *e;
+
+    if ( ( options.elffile ) && ( !( _r.s = symbolAcquire( options.elffile, false, false ) ) ) )
+    {
+        genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
+        return false;
+    }
+
+    for ( int c = 0; c < MAX_COMP; c++ )
+    {
+        struct watch *w = &_r.w[c];
+
+        if ( !w->spec )
+        {
+            continue;
+        }
+
+        if ( isdigit( ( unsigned char )*w->spec ) )
+        {
+            /* An address, which is named for the variable there if we know it */
+            w->addr = strtoul( w->spec, &e, 0 );
+            v = ( _r.s ) ? symbolVariableAt( _r.s, w->addr ) : NULL;
+
+            if ( *e )
+            {
+                genericsReport( V_ERROR, "Can't read address %s for comparator %d" EOL, w->spec, c );
+                return false;
+            }
+        }
+        else if ( !_r.s )
+        {
+            genericsReport( V_ERROR, "Variable %s can only be found with an elf file (-e)" EOL, w->spec );
+            return false;
+        }
+        else if ( !( v = symbolVariableByName( _r.s, w->spec ) ) )
+        {
+            genericsReport( V_ERROR, "Variable %s not found in %s" EOL, w->spec, options.elffile );
+            return false;
+        }
+
+        if ( ( v ) && ( w->addr > v->addr ) )
+        {
+            /* Part way into something (a member of a structure, say), of which we only know the whole */
+            snprintf( w->name, NAME_LEN, "%s+%" PRIu32, v->varname, ( uint32_t )( w->addr - v->addr ) );
+            w->size = sizeof( uint32_t );
+            w->type = SV_UNSIGNED;
+        }
+        else if ( v )
+        {
+            snprintf( w->name, NAME_LEN, "%s", v->varname );
+            w->addr = v->addr;
+            w->size = v->size;
+            w->type = v->type;
+        }
+        else
+        {
+            /* Nothing known about it, so take it as a word */
+            snprintf( w->name, NAME_LEN, "%s", w->spec );
+            w->size = sizeof( uint32_t );
+            w->type = SV_UNSIGNED;
+        }
+
+        if ( ( w->type == SV_FLOAT ) && ( w->size != sizeof( float ) ) )
+        {
+            genericsReport( V_WARN, "%s is %u bytes, only floats can be shown as they are" EOL, w->name, w->size );
+        }
+
+        w->index = index++;
+        w->ring = ( struct bucket * )calloc( options.keep, sizeof( struct bucket ) );
+        MEMCHECK( w->ring, false );
+
+        if ( options.outfile )
+        {
+            w->ft = ( uint64_t * )malloc( FILE_BLOCK * sizeof( *w->ft ) );
+            w->fv = ( double * )malloc( FILE_BLOCK * sizeof( *w->fv ) );
+            MEMCHECK( w->ft, false );
+            MEMCHECK( w->fv, false );
+        }
+
+        genericsReport( V_INFO, "Comparator %2d: %s at 0x%08" PRIx32 ", %u bytes %s" EOL, c, w->name, ( uint32_t )w->addr, w->size,
+                        ( w->type == SV_FLOAT ) ? "float" : ( w->type == SV_SIGNED ) ? "signed" : "unsigned" );
+    }
+
+    _r.nused = index;
+    return true;
+}
+// ====================================================================================================
+static bool _openOutput( void )
+
+{
+    uint32_t n = _r.nused;
+
+    if ( !( _r.o = fopen( options.outfile, "wb" ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't open %s for output" EOL, options.outfile );
+        return false;
+    }
+
+    fwrite( FILE_MAGIC, sizeof( FILE_MAGIC ), 1, _r.o );
+    fwrite( &n, sizeof( n ), 1, _r.o );
+
+    for ( int c = 0; c < MAX_COMP; c++ )
+    {
+        if ( _r.w[c].spec )
+        {
+            struct varFileEntry e = { .addr = _r.w[c].addr, .comp = c, .size = _r.w[c].size, .type = _r.w[c].type };
+            strncpy( e.name, _r.w[c].name, NAME_LEN - 1 );
+            fwrite( &e, sizeof( e ), 1, _r.o );
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _printHelp( const char *const progName )
+
+{
+    genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "    -C, --cpufreq:     <Frequency in KHz> (Scaled) speed of the CPU, to time samples from target timestamps" EOL );
+    genericsPrintf( "    -d, --decimate:    <uS> Width of decimation buckets, default %d" EOL, DEFAULT_INTERVAL_US );
+    genericsPrintf( "    -e, --elf:         <ElfFile> to find variables in" EOL );
+    genericsPrintf( "    -E, --eof:         Terminate when the file/socket ends/is closed, or wait for more/reconnect" EOL );
+    genericsPrintf( "    -f, --input-file:  <filename> Take input from specified file" EOL );
+    genericsPrintf( "    -h, --help:        This help" EOL );
+    genericsPrintf( "    -k, --keep:        <Number> of decimation buckets kept for each variable, default %d" EOL, DEFAULT_KEEP );
+    genericsPrintf( "    -M, --no-colour:   Supress colour in output" EOL );
+    genericsPrintf( "    -o, --output-file: <filename> Write every sample to a columnar file" EOL );
+    genericsPrintf( "    -P, --http:        <port> Serve decimated series on /series and metrics on /metrics" EOL );
+    genericsPrintf( "    -p, --protocol:    Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -r, --reads:       Take reads of variables as well as writes" EOL );
+    genericsPrintf( "    -s, --server:      <Server>:<Port> to use" EOL );
+    genericsPrintf( "    -t, --tag:         <stream>: Which OFLOW tag to use (normally 1)" EOL );
+    genericsPrintf( "    -v, --verbose:     <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "    -V, --version:     Print version and exit" EOL );
+    genericsPrintf( "    -w, --watch:       <Comparator>:<Variable or address> Comparator watches this (repeat per comparator)" EOL );
+}
+// ====================================================================================================
+static void _printVersion( void )
+
+{
+    genericsPrintf( "orbvar version " GIT_DESCRIBE EOL );
+}
+// ====================================================================================================
+static struct option _longOptions[] =
+{
+    {"cpufreq", required_argument, NULL, 'C'},
+    {"decimate", required_argument, NULL, 'd'},
+    {"elf", required_argument, NULL, 'e'},
+    {"eof", no_argument, NULL, 'E'},
+    {"input-file", required_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {"keep", required_argument, NULL, 'k'},
+    {"no-colour", no_argument, NULL, 'M'},
+    {"no-color", no_argument, NULL, 'M'},
+    {"output-file", required_argument, NULL, 'o'},
+    {"http", required_argument, NULL, 'P'},
+    {"protocol", required_argument, NULL, 'p'},
+    {"reads", no_argument, NULL, 'r'},
+    {"server", required_argument, NULL, 's'},
+    {"tag", required_argument, NULL, 't'},
+    {"verbose", required_argument, NULL, 'v'},
+    {"version", no_argument, NULL, 'V'},
+    {"watch", required_argument, NULL, 'w'},
+    {NULL, no_argument, NULL, 0}
+};
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[] )
+
+{
+    int c, optionIndex = 0;
+    bool protExplicit = false;
+    bool serverExplicit = false;
+    unsigned int comp;
+    char *a;
+
+    while ( ( c = getopt_long ( argc, argv, "C:d:e:Ef:hk:Mo:P:p:rs:t:v:Vw:", _longOptions, &optionIndex ) ) != -1 )
+    {
+        switch ( c )
+        {
+            // ------------------------------------
+            case 'h':
+                _printHelp( argv[0] );
+                return false;
+
+            // ------------------------------------
+            case 'V':
+                _printVersion();
+                return false;
+
+            // ------------------------------------
+            case 'C':
+                options.cps = atoi( optarg ) * 1000;
+
+                if ( !options.cps )
+                {
+                    genericsReport( V_ERROR, "cps out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'd':
+                if ( ( options.intervaluS = atoi( optarg ) ) == 0 )
+                {
+                    genericsReport( V_ERROR, "Decimation interval out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'e':
+                options.elffile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'E':
+                options.endTerminate = true;
+                break;
+
+            // ------------------------------------
+            case 'f':
+                options.file = optarg;
+                break;
+
+            // ------------------------------------
+            case 'k':
+                if ( ( options.keep = atoi( optarg ) ) == 0 )
+                {
+                    genericsReport( V_ERROR, "Number of buckets to keep out of range" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'M':
+                options.mono = true;
+                break;
+
+            // ------------------------------------
+            case 'o':
+                options.outfile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'P':
+                options.httpPort = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'p':
+                protExplicit = true;
+
+                if ( !strcmp( optarg, "OFLOW" ) )
+                {
+                    options.oflow = true;
+                }
+                else if ( !strcmp( optarg, "ITM" ) )
+                {
+                    options.oflow = false;
+                }
+                else
+                {
+                    genericsReport( V_ERROR, "Unrecognised protocol type" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'r':
+                options.reads = true;
+                break;
+
+            // ------------------------------------
+            case 's':
+                options.server = optarg;
+                serverExplicit = true;
+
+                // See if we have an optional port number too
+                if ( ( a = strchr( optarg, ':' ) ) )
+                {
+                    *a = 0;
+                    options.port = atoi( ++a );
+                }
+
+                break;
+
+            // ------------------------------------
+            case 't':
+                options.tag = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'v':
+                if ( !isdigit( *optarg ) )
+                {
+                    genericsReport( V_ERROR, "-v requires a numeric argument." EOL );
+                    return false;
+                }
+
+                genericsSetReportLevel( atoi( optarg ) );
+                break;
+
+            // ------------------------------------
+            case 'w':
+                comp = strtoul( optarg, &a, 0 );
+
+                if ( ( *a != ':' ) || ( !a[1] ) || ( comp >= MAX_COMP ) )
+                {
+                    genericsReport( V_ERROR, "Watch should be <Comparator>:<Variable or address>, with comparator 0..%d" EOL, MAX_COMP - 1 );
+                    return false;
+                }
+
+                _r.w[comp].spec = a + 1;
+                break;
+
+            // ------------------------------------
+            case '?':
+                if ( !isprint ( optopt ) )
+                {
+                    genericsReport( V_ERROR, "Unknown option character `\\x%x'." EOL, optopt );
+                }
+
+                return false;
+
+            // ------------------------------------
+            default:
+                return false;
+                // ------------------------------------
+        }
+    }
+
+    /* If we set an explicit server and didn't set a protocol chances are we want ITM, not OFLOW */
+    if ( serverExplicit && !protExplicit )
+    {
+        options.oflow = false;
+    }
+
+    for ( comp = 0; ( comp < MAX_COMP ) && ( !_r.w[comp].spec ); comp++ );
+
+    if ( comp == MAX_COMP )
+    {
+        genericsReport( V_ERROR, "Nothing to watch, give at least one comparator with -w" EOL );
+        return false;
+    }
+
+    genericsReport( V_INFO, "orbvar version " GIT_DESCRIBE EOL );
+    genericsReport( V_INFO, "Server      : %s" EOL, options.server ? options.server : "localhost" );
+    genericsReport( V_INFO, "Decimation  : %" PRIu32 "uS, %" PRIu32 " buckets kept" EOL, options.intervaluS, options.keep );
+
+    if ( options.cps )
+    {
+        genericsReport( V_INFO, "Timing      : From target timestamps at %" PRIu64 " cycles per second" EOL, options.cps );
+    }
+
+    if ( options.outfile )
+    {
+        genericsReport( V_INFO, "Output File : %s" EOL, options.outfile );
+    }
+
+    if ( options.httpPort )
+    {
+        genericsReport( V_INFO, "HTTP        : Port %d" EOL, options.httpPort );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _intHandler( int sig )
+
+{
+    /* CTRL-C exit is not an error... */
+    _r.ending = true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct orbSessionSource src;
+    struct orbSession *s;
+
+    if ( !_processOptions( argc, argv ) )
+    {
+        exit( -1 );
+    }
+
+    genericsScreenHandling( !options.mono );
+    pthread_mutex_init( &_r.lock, NULL );
+
+    if ( ( !_resolve() ) || ( ( options.outfile ) && ( !_openOutput() ) ) )
+    {
+        exit( -1 );
+    }
+
+    if ( ( options.httpPort ) && ( !metricsServerStartPaths( options.httpPort, _renderMetrics, _series, NULL ) ) )
+    {
+        exit( -1 );
+    }
+
+    src = ( struct orbSessionSource )
+    {
+        .server = options.server, .port = options.port, .file = options.file, .fileTerminate = options.endTerminate,
+        .oflow = options.oflow
+    };
+
+    if ( ( !( s = orbSessionCreate( &src ) ) ) ||
+            ( !orbSessionSubscribeITM( s, options.oflow ? options.tag : DEFAULT_ITM_STREAM, _msgs, NULL ) ) ||
+            ( !orbSessionStart( s ) ) )
+    {
+        genericsExit( -1, "Couldn't start reading trace" EOL );
+    }
+
+    /* This ensures the signal handler gets called */
+    if ( SIG_ERR == signal( SIGINT, _intHandler ) )
+    {
+        genericsExit( -1, "Failed to establish Int handler" EOL );
+    }
+
+    while ( ( !_r.ending ) && ( orbSessionRunning( s ) ) )
+    {
+        usleep( 100000 );
+    }
+
+    orbSessionDelete( s );
+
+    /* Whatever is still waiting goes out as it is */
+    if ( options.cps )
+    {
+        _flushPending();
+    }
+
+    for ( int c = 0; c < MAX_COMP; c++ )
+    {
+        if ( _r.w[c].spec )
+        {
+            pthread_mutex_lock( &_r.lock );
+            _bucketClose( &_r.w[c] );
+            pthread_mutex_unlock( &_r.lock );
+            _writeBlock( &_r.w[c] );
+            genericsReport( V_INFO, "%s: %" PRIu64 " samples" EOL, _r.w[c].name, _r.w[c].samples );
+        }
+    }
+
+    if ( _r.o )
+    {
+        fclose( _r.o );
+    }
+
+    if ( _r.s )
+    {
+        symbolDelete( _r.s );
+    }
+
+    return 0;
+}
+// ====================================================================================================
@@ -18,6 +18,8 @@
 #include "itmDecoder.h"
 #include "msgDecoder.h"
 #include "oflow.h"
+#include "fmtProgram.h"
+#include "tokenLog.h"
 
 #define NUM_CHANNELS  32
 #define HWFIFO_NAME "hwevent"
@@ -25,15 +27,43 @@
 
 #define DEFAULT_ZMQ_BIND_URL "tcp://*:3442"  /* by default bind to all source interfaces */
 
+#define NUM_HWEVENTS  (HWEVENT_NISYNC+1)
+#define BATCH_LEN     (64*1024)              /* Largest batch of messages published in one go */
+#define BATCH_HDR_LEN (2)                    /* Length (little endian) ahead of each message in a batch */
+#define MAX_BIND_URLS (8)
+#define DROP_REPORT_MS (1000)                /* Shortest time between reports of dropped messages */
+#define CLOSE_LINGER_MS (1000)               /* Longest wait for queued messages to go at exit */
+#define MAX_SUB_LEN   (256)                  /* Longest subscription prefix we take notice of */
+
 enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ITM", NULL};
 
 // Record for options, either defaults or from command line
 
+/* Messages waiting to be published on a topic */
+struct topicBatch
+{
+    const char *topic;
+    uint8_t *d;                                         /* Batch being filled, given to ZeroMQ when it goes */
+    size_t len;
+    uint64_t openeduS;                                  /* When the first message went into it */
+    uint32_t msgs;                                      /* Number of messages in it */
+    bool wanted;                                        /* Someone is subscribed to the topic, so it's worth making */
+};
+
+/* A prefix that subscribers have asked for, every topic starting with it is in demand */
+struct subscription
+{
+    uint8_t *prefix;
+    size_t len;
+};
+
 struct Channel
 {
     char *topic;
     char *format;
+    struct fmtProgram *program;                         /* What format compiles to */
+    struct topicBatch batch;
 };
 
 struct
@@ -44,8 +74,14 @@ struct
     uint32_t hwOutputs;
 
     /* Sink information */
-    char *bindUrl;
+    char *bindUrl[MAX_BIND_URLS];                       /* Endpoints to publish on */
+    int numBindUrls;
+    int sndHWM;                                         /* Send high water mark, 0 for ZeroMQ default */
+    int sndBuf;                                         /* Kernel send buffer size, 0 for OS default */
+    int ioThreads;                                      /* Number of ZeroMQ I/O threads, 0 for ZeroMQ default */
     struct Channel channel[NUM_CHANNELS + 1];
+    struct tokenLog *tokens;                            /* Decoder for tokenised logging, if it's in use */
+    unsigned int tokenChan;                             /* ...and the channel it's on */
 
     /* Source information */
     int port;
@@ -56,11 +92,11 @@ struct
     char *file;                                         /* File host connection */
     bool endTerminate;                                  /* Terminate when file/socket "ends" */
 
+    uint32_t batchmS;                                   /* Longest a message waits to be published in a batch, 0 for no batching */
 } options =
 {
     .forceITMSync = true,
     .tag = 1,
-    .bindUrl = DEFAULT_ZMQ_BIND_URL,
     .port = OFCLIENT_SERVER_PORT,
     .server = "localhost"
 };
@@ -81,13 +117,349 @@ struct
     void *zmqSocket;
     bool ending;
 
+    struct topicBatch hw[NUM_HWEVENTS];           /* Batches for the hardware events */
+
+    /* What subscribers have asked for */
+    struct subscription *subs;
+    int numSubs;
+
+    /* Publishing statistics */
+    uint64_t sent;                                /* Messages published */
+    uint64_t dropped;                             /* Messages dropped because subscribers weren't keeping up */
+    uint64_t droppedReported;                     /* ...as of the last report */
+    uint32_t dropReportmS;                        /* When that was */
 } _r;
 
 // ====================================================================================================
-void _publishMessage( const char *topic, void *payload, size_t size )
+static void _batchFree( void *data, void *hint )
+
+/* ZeroMQ has finished with a batch */
+
+{
+    free( data );
+}
+// ====================================================================================================
+static bool _sendTopic( struct topicBatch *b, zmq_msg_t *m )
+
+/* Publish m under the topic for b. If the topic can't go then neither can m, or subscribers would */
+/* get it without one, so it's closed unsent instead (which frees anything it was holding).       */
+
+{
+    zmq_msg_t t;
+
+    /* Topics last as long as we do, so never need freeing */
+    zmq_msg_init_data( &t, ( void * )b->topic, strlen( b->topic ), NULL, NULL );
+
+    if ( zmq_msg_send( &t, _r.zmqSocket, ZMQ_SNDMORE | ZMQ_DONTWAIT ) < 0 )
+    {
+        zmq_msg_close( &t );
+        zmq_msg_close( m );
+        return false;
+    }
+
+    if ( zmq_msg_send( m, _r.zmqSocket, ZMQ_DONTWAIT ) < 0 )
+    {
+        zmq_msg_close( m );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _sendBatch( struct topicBatch *b )
+
+/* Publish the batch without copying it. It then belongs to ZeroMQ, so the next one is a new buffer */
+
+{
+    zmq_msg_t m;
+
+    if ( !b->len )
+    {
+        return;
+    }
+
+    zmq_msg_init_data( &m, b->d, b->len, _batchFree, NULL );
+
+    if ( _sendTopic( b, &m ) )
+    {
+        _r.sent += b->msgs;
+    }
+    else
+    {
+        _r.dropped += b->msgs;
+    }
+
+    b->d = NULL;
+    b->len = 0;
+    b->msgs = 0;
+}
+// ====================================================================================================
+static void _flushBatches( bool all )
+
+/* Send any batches that have been waiting for as long as they're allowed to, or all of them */
+
+{
+    uint64_t now = genericsTimestampuS();
+    uint64_t budgetuS = ( uint64_t )options.batchmS * 1000;
+
+    for ( int g = 0; g < NUM_CHANNELS; g++ )
+    {
+        struct topicBatch *b = &options.channel[g].batch;
+
+        if ( ( b->len ) && ( ( all ) || ( now - b->openeduS >= budgetuS ) ) )
+        {
+            _sendBatch( b );
+        }
+    }
+
+    for ( int g = 0; g < NUM_HWEVENTS; g++ )
+    {
+        struct topicBatch *b = &_r.hw[g];
+
+        if ( ( b->len ) && ( ( all ) || ( now - b->openeduS >= budgetuS ) ) )
+        {
+            _sendBatch( b );
+        }
+    }
+}
+// ====================================================================================================
+void _publishMessage( struct topicBatch *b, const void *payload, size_t size )
+
+/* Send a message on its own, or add it to the batch for its topic */
+
+{
+    zmq_msg_t m;
+
+    if ( !options.batchmS )
+    {
+        if ( zmq_msg_init_size( &m, size ) < 0 )
+        {
+            _r.dropped++;
+            return;
+        }
+
+        memcpy( zmq_msg_data( &m ), payload, size );
+
+        if ( _sendTopic( b, &m ) )
+        {
+            _r.sent++;
+        }
+        else
+        {
+            _r.dropped++;
+        }
+
+        return;
+    }
+
+    if ( b->len + BATCH_HDR_LEN + size > BATCH_LEN )
+    {
+        _sendBatch( b );
+    }
+
+    if ( !b->d )
+    {
+        b->d = ( uint8_t * )malloc( BATCH_LEN );
+        MEMCHECK( b->d, );
+    }
+
+    if ( !b->len )
+    {
+        b->openeduS = genericsTimestampuS();
+    }
+
+    b->d[b->len++] = size & 0xff;
+    b->d[b->len++] = size >> 8;
+    memcpy( &b->d[b->len], payload, size );
+    b->len += size;
+    b->msgs++;
+}
+// ====================================================================================================
+static bool _subscribed( const char *topic )
+
+/* Subscriptions are by prefix, so the topic is wanted if any of them starts it */
+
+{
+    size_t l = strlen( topic );
+
+    for ( int i = 0; i < _r.numSubs; i++ )
+    {
+        if ( ( _r.subs[i].len <= l ) && ( !memcmp( _r.subs[i].prefix, topic, _r.subs[i].len ) ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static void _updateDemand( void )
+
+/* Work out again which topics anyone wants, the others aren't formatted or sent at all */
+
 {
-    zmq_send( _r.zmqSocket, topic, strlen( topic ), ZMQ_SNDMORE );
-    zmq_send( _r.zmqSocket, payload, size, 0 );
+    for ( int g = 0; g < NUM_CHANNELS; g++ )
+    {
+        if ( options.channel[g].topic )
+        {
+            options.channel[g].batch.wanted = _subscribed( options.channel[g].topic );
+        }
+    }
+
+    for ( int g = 0; g < NUM_HWEVENTS; g++ )
+    {
+        if ( _r.hw[g].topic )
+        {
+            _r.hw[g].wanted = ( options.hwOutputs & ( 1 << g ) ) && ( _subscribed( _r.hw[g].topic ) );
+        }
+    }
+}
+// ====================================================================================================
+static void _takeSubscriptions( void )
+
+/* The XPUB socket hands us (un)subscriptions as messages; a 1 or 0 byte followed by the prefix. Only */
+/* the first subscription to a prefix and the last unsubscription from it come through, so they're a set. */
+
+{
+    uint8_t m[MAX_SUB_LEN + 1];
+    bool changed = false;
+    size_t len;
+    int n, i;
+
+    while ( ( n = zmq_recv( _r.zmqSocket, m, sizeof( m ), ZMQ_DONTWAIT ) ) > 0 )
+    {
+        /* Anything too long is taken by its start, which can only make more topics wanted, not fewer */
+        len = ( ( size_t )n > sizeof( m ) ? sizeof( m ) : ( size_t )n ) - 1;
+
+        for ( i = 0; ( i < _r.numSubs ) && ( ( _r.subs[i].len != len ) || ( memcmp( _r.subs[i].prefix, &m[1], len ) ) ); i++ );
+
+        if ( ( m[0] == 1 ) && ( i == _r.numSubs ) )
+        {
+            _r.subs = ( struct subscription * )realloc( _r.subs, ( _r.numSubs + 1 ) * sizeof( struct subscription ) );
+            MEMCHECKV( _r.subs );
+            _r.subs[_r.numSubs].prefix = ( uint8_t * )malloc( len ? len : 1 );
+            MEMCHECKV( _r.subs[_r.numSubs].prefix );
+            memcpy( _r.subs[_r.numSubs].prefix, &m[1], len );
+            _r.subs[_r.numSubs++].len = len;
+            genericsReport( V_DEBUG, "Subscribed to [%.*s]" EOL, ( int )len, &m[1] );
+            changed = true;
+        }
+        else if ( ( m[0] == 0 ) && ( i != _r.numSubs ) )
+        {
+            free( _r.subs[i].prefix );
+            _r.subs[i] = _r.subs[--_r.numSubs];
+            genericsReport( V_DEBUG, "Unsubscribed from [%.*s]" EOL, ( int )len, &m[1] );
+            changed = true;
+        }
+    }
+
+    if ( changed )
+    {
+        _updateDemand();
+    }
+}
+// ====================================================================================================
+static void _closePublisher( void )
+
+/* Give what's still queued a moment to get out before it all goes */
+
+{
+    int lingermS = CLOSE_LINGER_MS;
+
+    zmq_setsockopt( _r.zmqSocket, ZMQ_LINGER, &lingermS, sizeof( lingermS ) );
+    zmq_close( _r.zmqSocket );
+    zmq_ctx_term( _r.zmqContext );
+
+    for ( int i = 0; i < _r.numSubs; i++ )
+    {
+        free( _r.subs[i].prefix );
+    }
+
+    free( _r.subs );
+    _r.subs = NULL;
+    _r.numSubs = 0;
+}
+// ====================================================================================================
+static void _reportDrops( bool final )
+
+/* Let the user know if subscribers aren't keeping up, but not too often */
+
+{
+    uint32_t now = genericsTimestampmS();
+
+    if ( ( !final ) && ( now - _r.dropReportmS < DROP_REPORT_MS ) )
+    {
+        return;
+    }
+
+    if ( _r.dropped != _r.droppedReported )
+    {
+        genericsReport( V_WARN, "%" PRIu64 " messages dropped, %" PRIu64 " dropped and %" PRIu64 " published in all" EOL,
+                        _r.dropped - _r.droppedReported, _r.dropped, _r.sent );
+        _r.droppedReported = _r.dropped;
+    }
+    else if ( final )
+    {
+        genericsReport( V_INFO, "%" PRIu64 " messages published, %" PRIu64 " dropped" EOL, _r.sent, _r.dropped );
+    }
+
+    _r.dropReportmS = now;
+}
+// ====================================================================================================
+static void _openPublisher( void )
+
+/* Create the publishing socket, set it up and bind it to all its endpoints */
+
+{
+    int one = 1;
+
+    _r.zmqContext = zmq_ctx_new();
+
+    if ( !_r.zmqContext )
+    {
+        genericsExit( -1, "Could not create ZeroMQ context (%s)" EOL, zmq_strerror( zmq_errno() ) );
+    }
+
+    if ( ( options.ioThreads ) && ( zmq_ctx_set( _r.zmqContext, ZMQ_IO_THREADS, options.ioThreads ) < 0 ) )
+    {
+        genericsExit( -1, "Could not set %d ZeroMQ I/O threads (%s)" EOL, options.ioThreads, zmq_strerror( zmq_errno() ) );
+    }
+
+    /* XPUB rather than PUB so we hear about subscriptions, and don't make what nobody wants */
+    if ( !( _r.zmqSocket = zmq_socket( _r.zmqContext, ZMQ_XPUB ) ) )
+    {
+        genericsExit( -1, "Could not create ZeroMQ socket (%s)" EOL, zmq_strerror( zmq_errno() ) );
+    }
+
+    if ( ( options.sndHWM ) && ( zmq_setsockopt( _r.zmqSocket, ZMQ_SNDHWM, &options.sndHWM, sizeof( options.sndHWM ) ) < 0 ) )
+    {
+        genericsExit( -1, "Could not set ZeroMQ send high water mark (%s)" EOL, zmq_strerror( zmq_errno() ) );
+    }
+
+    if ( ( options.sndBuf ) && ( zmq_setsockopt( _r.zmqSocket, ZMQ_SNDBUF, &options.sndBuf, sizeof( options.sndBuf ) ) < 0 ) )
+    {
+        genericsExit( -1, "Could not set ZeroMQ send buffer size (%s)" EOL, zmq_strerror( zmq_errno() ) );
+    }
+
+#ifdef ZMQ_XPUB_NODROP
+
+    /* A publishing socket silently drops messages it has no room for. This makes it say so, so they can be counted */
+    if ( zmq_setsockopt( _r.zmqSocket, ZMQ_XPUB_NODROP, &one, sizeof( one ) ) < 0 )
+    {
+        genericsReport( V_WARN, "ZeroMQ can't report dropped messages, they won't be counted" EOL );
+    }
+
+#else
+    ( void )one;
+#endif
+
+    for ( int i = 0; i < options.numBindUrls; i++ )
+    {
+        if ( zmq_bind( _r.zmqSocket, options.bindUrl[i] ) < 0 )
+        {
+            genericsExit( -1, "Could not bind to %s (%s)" EOL, options.bindUrl[i], zmq_strerror( zmq_errno() ) );
+        }
+    }
 }
 
 static const char *hwEventNames[] =
@@ -114,40 +486,34 @@ void _handleSW( struct swMsg *m, struct ITMDecoder *i )
     if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.channel[m->srcAddr].topic ) )
     {
         struct Channel *channel = &options.channel[m->srcAddr];
-        char formatted[30];
+        char formatted[TOKENLOG_MAX_OUTPUT];
         size_t size = 0;
 
         // formatted output....start with specials
-        if ( channel->format == NULL )
+        if ( ( options.tokens ) && ( m->srcAddr == options.tokenChan ) )
         {
-            memcpy( formatted, &m->value, m->len );
-            size = m->len;
+            /* Only a complete record makes anything to publish. Records are followed even when they */
+            /* aren't wanted (just not made into text), so we're in step as soon as someone does want them. */
+            if ( !( size = tokenLogPump( options.tokens, m->value, m->len, formatted, ( channel->batch.wanted ) ? sizeof( formatted ) : 0 ) ) )
+            {
+                return;
+            }
         }
-        else if ( strstr( channel->format, "%f" ) )
+        else if ( !channel->batch.wanted )
         {
-            /* type punning on same host, after correctly building 32bit val
-             * only unsafe on systems where u32/float have diff byte order */
-            float *nastycast = ( float * )&m->value;
-            size = snprintf( formatted, sizeof( formatted ), channel->format, *nastycast, *nastycast, *nastycast, *nastycast );
+            return;
         }
-        else if ( strstr( channel->format, "%c" ) )
+        else if ( channel->format == NULL )
         {
-            /* Format contains %c, so execute repeatedly for all characters in sent data */
-            uint8_t op[4] = {m->value & 0xff, ( m->value >> 8 ) & 0xff, ( m->value >> 16 ) & 0xff, ( m->value >> 24 ) & 0xff};
-            uint32_t l = 0;
-
-            do
-            {
-                size += snprintf( formatted + size, sizeof( formatted ) - size, channel->format, op[l], op[l], op[l] );
-            }
-            while ( ++l < m->len );
+            memcpy( formatted, &m->value, m->len );
+            size = m->len;
         }
         else
         {
-            size = snprintf( formatted, sizeof( formatted ), channel->format, m->value, m->value, m->value, m->value );
+            size = fmtProgramRun( channel->program, m->value, m->len, formatted, sizeof( formatted ) );
         }
 
-        _publishMessage( channel->topic, formatted, size );
+        _publishMessage( &channel->batch, formatted, size );
     }
 }
 void _handleException( struct excMsg *m )
@@ -155,7 +521,7 @@ void _handleException( struct excMsg *m )
 {
     assert( m->msgtype == MSG_EXCEPTION );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_EXCEPTION ) ) )
+    if ( !_r.hw[HWEVENT_EXCEPTION].wanted )
     {
         return;
     }
@@ -182,7 +548,7 @@ void _handleException( struct excMsg *m )
         opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%s,External,%d", eventdifftS, exEvent[m->eventType & 0x03], m->exceptionNumber - 16 );
     }
 
-    _publishMessage( hwEventNames[HWEVENT_EXCEPTION], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_EXCEPTION], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDWTEvent( struct dwtMsg *m )
@@ -190,7 +556,7 @@ void _handleDWTEvent( struct dwtMsg *m )
 {
     assert( m->msgtype == MSG_DWT_EVENT );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_DWT ) ) )
+    if ( !_r.hw[HWEVENT_DWT].wanted )
     {
         return;
     }
@@ -221,7 +587,7 @@ void _handleDWTEvent( struct dwtMsg *m )
         }
     }
 
-    _publishMessage( hwEventNames[HWEVENT_DWT], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_DWT], outputString, opLen );
 }
 // ====================================================================================================
 void _handlePCSample( struct pcSampleMsg *m )
@@ -231,7 +597,7 @@ void _handlePCSample( struct pcSampleMsg *m )
 {
     assert( m->msgtype == MSG_PC_SAMPLE );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_PCSample ) ) )
+    if ( !_r.hw[HWEVENT_PCSample].wanted )
     {
         return;
     }
@@ -252,7 +618,7 @@ void _handlePCSample( struct pcSampleMsg *m )
         opLen = snprintf( outputString, ( MAX_STRING_LENGTH - 1 ), "%" PRIu64 ",0x%08x", eventdifftS, m->pc );
     }
 
-    _publishMessage( hwEventNames[HWEVENT_PCSample], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_PCSample], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataRWWP( struct watchMsg *m )
@@ -262,7 +628,7 @@ void _handleDataRWWP( struct watchMsg *m )
 {
     assert( m->msgtype == MSG_DATA_RWWP );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_RWWT ) ) )
+    if ( !_r.hw[HWEVENT_RWWT].wanted )
     {
         return;
     }
@@ -274,7 +640,7 @@ void _handleDataRWWP( struct watchMsg *m )
     _r.lastHWExceptionTS = m->ts;
 
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%d,%s,0x%x", eventdifftS, m->comp, m->isWrite ? "Write" : "Read", m->data );
-    _publishMessage( hwEventNames[HWEVENT_RWWT], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_RWWT], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataAccessWP( struct wptMsg *m )
@@ -284,7 +650,7 @@ void _handleDataAccessWP( struct wptMsg *m )
 {
     assert( m->msgtype == MSG_DATA_ACCESS_WP );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_AWP ) ) )
+    if ( !_r.hw[HWEVENT_AWP].wanted )
     {
         return;
     }
@@ -296,7 +662,7 @@ void _handleDataAccessWP( struct wptMsg *m )
 
     _r.lastHWExceptionTS = m->ts;
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%d,0x%08x", eventdifftS, m->comp, m->data );
-    _publishMessage( hwEventNames[HWEVENT_AWP], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_AWP], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataOffsetWP( struct oswMsg *m )
@@ -306,7 +672,7 @@ void _handleDataOffsetWP( struct oswMsg *m )
 {
     assert( m->msgtype == MSG_OSW );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_OFS ) ) )
+    if ( !_r.hw[HWEVENT_OFS].wanted )
     {
         return;
     }
@@ -317,7 +683,7 @@ void _handleDataOffsetWP( struct oswMsg *m )
 
     _r.lastHWExceptionTS = m->ts;
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%d,0x%04x", eventdifftS, m->comp, m->offset );
-    _publishMessage( hwEventNames[HWEVENT_OFS], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_OFS], outputString, opLen );
 }
 // ====================================================================================================
 void _handleTS( struct TSMsg *m )
@@ -327,7 +693,7 @@ void _handleTS( struct TSMsg *m )
 {
     assert( m->msgtype == MSG_TS );
 
-    if ( !( options.hwOutputs & ( 1 << HWEVENT_TS ) ) )
+    if ( !_r.hw[HWEVENT_TS].wanted )
     {
         return;
     }
@@ -340,7 +706,7 @@ void _handleTS( struct TSMsg *m )
     _r.timeStatus = m->timeStatus;
 
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu32, m->timeStatus, m->timeInc );
-    _publishMessage( hwEventNames[HWEVENT_TS], outputString, opLen );
+    _publishMessage( &_r.hw[HWEVENT_TS], outputString, opLen );
 }
 // ====================================================================================================
 void _itmPumpProcess( char c )
@@ -381,11 +747,11 @@ void _itmPumpProcess( char c )
             break;
 
         case ITM_EV_OVERFLOW:
-            genericsReport( V_WARN, "ITM Overflow" EOL );
+            genericsReportRateLimited( V_WARN, "ITM Overflow" EOL );
             break;
 
         case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
+            genericsReportRateLimited( V_WARN, "ITM Error" EOL );
             break;
 
         case ITM_EV_PACKET_RXED:
@@ -415,19 +781,24 @@ void _printHelp( const char *const progName )
 
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "    -b, --batch:      <mS> Publish messages for each topic in batches, sent at least this often" EOL );
     genericsPrintf( "    -c, --channel:    <Number>,<Name>,<Format> of channel to populate (repeat per channel)" EOL );
     genericsPrintf( "    -e, --hwevent:    Comma-separated list of published hwevents" EOL );
     genericsPrintf( "    -E, --eof:        Terminate when the file/socket ends/is closed, otherwise wait to reconnect" EOL );
     genericsPrintf( "    -f, --input-file: <filename> Take input from specified file" EOL );
     genericsPrintf( "    -h, --help:       This help" EOL );
+    genericsPrintf( "    -k, --tokens:     <Number>,<ELF file> Channel (named with -c) carries tokenised logging, formats from the ELF" EOL );
     genericsPrintf( "    -M, --no-colour:  Supress colour in output" EOL );
     genericsPrintf( "    -n, --itm-sync:   Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     genericsPrintf( "    -p, --protocol:   Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
+    genericsPrintf( "    -Q, --hwm:        <messages> ZeroMQ send high water mark, beyond which messages are dropped" EOL );
     genericsPrintf( "    -s, --server:     <Server>:<Port> to use, default %s:%d" EOL, options.server, options.port );
+    genericsPrintf( "    -S, --sndbuf:     <bytes> Kernel send buffer size for network endpoints" EOL );
     genericsPrintf( "    -t, --tag:        <stream>: Which Orbflow tag to use (normally 1)" EOL );
+    genericsPrintf( "    -T, --io-threads: <n> Number of ZeroMQ I/O threads" EOL );
     genericsPrintf( "    -v, --verbose:    <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "    -V, --version:    Print version and exit" EOL );
-    genericsPrintf( "    -z, --zbind:      <url>: ZeroMQ bind URL, default %s" EOL, options.bindUrl );
+    genericsPrintf( "    -z, --zbind:      <url>: ZeroMQ bind URL, repeat for more than one endpoint, default %s" EOL, DEFAULT_ZMQ_BIND_URL );
     genericsPrintf( EOL );
     genericsPrintf( "Available HW events: " EOL );
     genericsPrintf( "      all  - All hwevents          TS   - Timestamp" EOL );
@@ -499,17 +870,22 @@ static int32_t _parseHWEventsArg( char *s )
 static struct option _longOptions[] =
 {
     {"zbind", required_argument, NULL, 'z'},
+    {"batch", required_argument, NULL, 'b'},
     {"channel", required_argument, NULL, 'c'},
     {"hwevent", required_argument, NULL, 'e'},
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
     {"itm-sync", no_argument, NULL, 'n'},
+    {"tokens", required_argument, NULL, 'k'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
     {"protocol", required_argument, NULL, 'p'},
+    {"hwm", required_argument, NULL, 'Q'},
     {"server", required_argument, NULL, 's'},
+    {"sndbuf", required_argument, NULL, 'S'},
     {"tag", required_argument, NULL, 't'},
+    {"io-threads", required_argument, NULL, 'T'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
     {NULL, no_argument, NULL, 0}
@@ -534,7 +910,7 @@ bool _processOptions( int argc, char *argv[] )
         options.channel[g].topic = NULL;
     }
 
-    while ( ( c = getopt_long ( argc, argv, "c:e:Ef:hnp:s:t:v:Vz:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "b:c:e:Ef:hk:np:Q:s:S:t:T:v:Vz:", _longOptions, &optionIndex ) ) != -1 )
     {
         switch ( c )
         {
@@ -548,6 +924,11 @@ bool _processOptions( int argc, char *argv[] )
                 _printVersion();
                 return false;
 
+            // ------------------------------------
+            case 'b':
+                options.batchmS = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'E':
                 options.endTerminate = true;
@@ -563,6 +944,17 @@ bool _processOptions( int argc, char *argv[] )
                 options.mono = true;
                 break;
 
+            // ------------------------------------
+            case 'k':
+                tokenLogDelete( options.tokens );
+
+                if ( !( options.tokens = tokenLogFromOption( optarg, &options.tokenChan, NUM_CHANNELS ) ) )
+                {
+                    return false;
+                }
+
+                break;
+
             // ------------------------------------
             case 'n':
                 options.forceITMSync = false;
@@ -626,6 +1018,19 @@ bool _processOptions( int argc, char *argv[] )
                 options.tag = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'Q':
+                options.sndHWM = atoi( optarg );
+                break;
+
+            case 'S':
+                options.sndBuf = atoi( optarg );
+                break;
+
+            case 'T':
+                options.ioThreads = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'v':
                 if ( !isdigit( *optarg ) )
@@ -686,10 +1091,12 @@ bool _processOptions( int argc, char *argv[] )
 
                 *chanIndex++ = 0;
                 options.channel[chan].topic = strdup( chanName );
+                options.channel[chan].batch.topic = options.channel[chan].topic;
 
                 if ( strcmp( chanIndex, "" ) != 0 )
                 {
                     options.channel[chan].format = strdup( genericsUnescape( chanIndex ) );
+                    options.channel[chan].program = fmtProgramCompile( options.channel[chan].format );
                 }
 
                 break;
@@ -720,7 +1127,13 @@ bool _processOptions( int argc, char *argv[] )
             // ------------------------------------
 
             case 'z':
-                options.bindUrl = optarg;
+                if ( options.numBindUrls == MAX_BIND_URLS )
+                {
+                    genericsReport( V_ERROR, "No more than %d bind URLs" EOL, MAX_BIND_URLS );
+                    return false;
+                }
+
+                options.bindUrl[options.numBindUrls++] = optarg;
                 break;
 
             // ------------------------------------
@@ -761,7 +1174,36 @@ bool _processOptions( int argc, char *argv[] )
     }
 
     genericsReport( V_INFO, "Tag         : " EOL, options.tag );
-    genericsReport( V_INFO, "ZeroMQ bind : %s" EOL, options.bindUrl );
+    if ( !options.numBindUrls )
+    {
+        options.bindUrl[options.numBindUrls++] = DEFAULT_ZMQ_BIND_URL;
+    }
+
+    for ( int i = 0; i < options.numBindUrls; i++ )
+    {
+        genericsReport( V_INFO, "ZeroMQ bind : %s" EOL, options.bindUrl[i] );
+    }
+
+    if ( options.sndHWM )
+    {
+        genericsReport( V_INFO, "Send HWM    : %d messages" EOL, options.sndHWM );
+    }
+
+    if ( options.sndBuf )
+    {
+        genericsReport( V_INFO, "Send buffer : %d bytes" EOL, options.sndBuf );
+    }
+
+    if ( options.ioThreads )
+    {
+        genericsReport( V_INFO, "I/O threads : %d" EOL, options.ioThreads );
+    }
+
+    if ( options.batchmS )
+    {
+        genericsReport( V_INFO, "Batching    : Up to %dmS" EOL, options.batchmS );
+    }
+
     genericsReport( V_INFO, "Channels    :" EOL );
 
     for ( int g = 0; g < NUM_CHANNELS; g++ )
@@ -813,11 +1255,20 @@ static struct Stream *_tryOpenStream()
 {
     if ( options.file != NULL )
     {
-        return streamCreateFile( options.file );
+        return streamCreateMappedFile( options.file );
     }
     else
     {
-        return streamCreateSocket( options.server, options.port );
+        /* Publishing can back up, so receive on another thread to keep the socket drained */
+        struct Stream *stream = streamCreateReader( streamCreateSocket( options.server, options.port ), STREAM_READER_BUFS, TRANSFER_SIZE );
+
+        if ( ( stream ) && ( options.protocol == PROT_OFLOW ) )
+        {
+            uint8_t tag = options.tag;
+            nwSubscribe( stream, 1, &tag );
+        }
+
+        return stream;
     }
 }
 // ====================================================================================================
@@ -827,7 +1278,7 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 {
     if ( !p->good )
     {
-        genericsReport( V_INFO, "Bad packet received" EOL );
+        genericsReportRateLimited( V_INFO, "Bad packet received" EOL );
     }
     else
     {
@@ -849,11 +1300,21 @@ static void _feedStream( struct Stream *stream )
     while ( !_r.ending )
     {
         size_t receivedSize;
-        enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, NULL, &receivedSize );
+        struct timeval tv = { .tv_sec = options.batchmS / 1000, .tv_usec = ( options.batchmS % 1000 ) * 1000 };
+        enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, options.batchmS ? &tv : NULL, &receivedSize );
+
+        /* Whoever has come or gone since, it's known before any of this is decoded */
+        _takeSubscriptions();
 
         if ( result != RECEIVE_RESULT_OK )
         {
-            if ( result == RECEIVE_RESULT_EOF && options.endTerminate )
+            if ( result == RECEIVE_RESULT_TIMEOUT )
+            {
+                /* Nothing new, but there might be batches that shouldn't wait any longer */
+                _flushBatches( false );
+                continue;
+            }
+            else if ( result == RECEIVE_RESULT_EOF && options.endTerminate )
             {
                 return;
             }
@@ -869,7 +1330,7 @@ static void _feedStream( struct Stream *stream )
 
         if ( PROT_OFLOW == options.protocol )
         {
-            OFLOWPump( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
+            OFLOWPumpInPlace( &_r.c, cbw, receivedSize, _OFLOWpacketRxed, &_r );
         }
         else
         {
@@ -882,6 +1343,13 @@ static void _feedStream( struct Stream *stream )
 
             fflush( stdout );
         }
+
+        if ( options.batchmS )
+        {
+            _flushBatches( false );
+        }
+
+        _reportDrops( false );
     }
 }
 
@@ -907,9 +1375,12 @@ int main( int argc, char *argv[] )
 
     genericsScreenHandling( !options.mono );
 
-    _r.zmqContext = zmq_ctx_new();
-    _r.zmqSocket = zmq_socket( _r.zmqContext, ZMQ_PUB );
-    zmq_bind( _r.zmqSocket, "tcp://*:3442" ); //options.bindUrl );
+    _openPublisher();
+
+    for ( int g = 0; g < NUM_HWEVENTS; g++ )
+    {
+        _r.hw[g].topic = hwEventNames[g];
+    }
 
     /* Reset the OFLOW handler before we start */
     OFLOWInit( &_r.c );
@@ -957,6 +1428,8 @@ int main( int argc, char *argv[] )
         if ( stream != NULL )
         {
             _feedStream( stream );
+            _flushBatches( true );
+            _reportDrops( false );
 
             stream->close( stream );
             free( stream );
@@ -968,5 +1441,7 @@ int main( int argc, char *argv[] )
         }
     }
 
+    _reportDrops( true );
+    _closePublisher();
     return 0;
 }
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * PC Sample Histograms
+ * ====================
+ *
+ * The counts are in an open addressed table, keyed by address, that only ever holds the current
+ * interval. A count of zero marks a free slot, since anything that's in there has been seen at
+ * least once. The table doubles whenever it gets half full, and is just wiped for the next interval,
+ * which is cheap next to the number of samples that went into it.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "generics.h"
+#include "pcHist.h"
+
+#define PCHIST_INITIAL_SLOTS (1024)          /* Starting size of the table, always a power of two */
+
+struct pcHist
+{
+    struct msgStreamHistEntry *t;            /* Table of counts */
+    uint32_t slots;                          /* ...how big it is */
+    uint32_t used;                           /* ...and how many of them have something in */
+
+    struct msgStreamHistEntry *out;          /* Counts as last taken, in address order */
+    uint32_t outLen;                         /* ...and how many there is room for */
+
+    uint32_t samples;                        /* Samples this interval */
+    uint32_t sleeps;                         /* ...of which were asleep */
+    uint64_t ts;                             /* Timestamp of the latest of them */
+    uint16_t seq;                            /* Number of the current interval */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint32_t _slot( struct pcHist *h, uint32_t pc )
+
+/* Thumb code is on halfword boundaries, so the bottom bit tells us nothing */
+
+{
+    return ( ( pc >> 1 ) * 2654435761u ) & ( h->slots - 1 );
+}
+// ====================================================================================================
+static struct msgStreamHistEntry *_find( struct pcHist *h, uint32_t pc )
+
+/* Find where pc is counted, or the free slot it should go in */
+
+{
+    uint32_t s = _slot( h, pc );
+
+    while ( ( h->t[s].count ) && ( h->t[s].pc != pc ) )
+    {
+        s = ( s + 1 ) & ( h->slots - 1 );
+    }
+
+    return &h->t[s];
+}
+// ====================================================================================================
+static bool _grow( struct pcHist *h )
+
+{
+    struct msgStreamHistEntry *old = h->t;
+    uint32_t oldSlots = h->slots;
+
+    h->t = ( struct msgStreamHistEntry * )calloc( oldSlots * 2, sizeof( struct msgStreamHistEntry ) );
+    MEMCHECK( h->t, false );
+    h->slots = oldSlots * 2;
+
+    for ( uint32_t i = 0; i < oldSlots; i++ )
+    {
+        if ( old[i].count )
+        {
+            *_find( h, old[i].pc ) = old[i];
+        }
+    }
+
+    free( old );
+    return true;
+}
+// ====================================================================================================
+static int _compare( const void *a, const void *b )
+
+{
+    uint32_t pa = ( ( const struct msgStreamHistEntry * )a )->pc;
+    uint32_t pb = ( ( const struct msgStreamHistEntry * )b )->pc;
+
+    return ( pa > pb ) - ( pa < pb );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct pcHist *pcHistCreate( void )
+
+{
+    struct pcHist *h = ( struct pcHist * )calloc( 1, sizeof( struct pcHist ) );
+    MEMCHECK( h, NULL );
+
+    h->slots = PCHIST_INITIAL_SLOTS;
+    h->t = ( struct msgStreamHistEntry * )calloc( h->slots, sizeof( struct msgStreamHistEntry ) );
+    MEMCHECK( h->t, NULL );
+    return h;
+}
+// ====================================================================================================
+void pcHistAdd( struct pcHist *h, const struct pcSampleMsg *m )
+
+{
+    struct msgStreamHistEntry *e;
+
+    h->samples++;
+    h->ts = m->ts;
+
+    if ( m->sleep )
+    {
+        h->sleeps++;
+        return;
+    }
+
+    e = _find( h, m->pc );
+
+    if ( !e->count )
+    {
+        if ( ( h->used + 1 ) * 2 > h->slots )
+        {
+            if ( !_grow( h ) )
+            {
+                return;
+            }
+
+            e = _find( h, m->pc );
+        }
+
+        e->pc = m->pc;
+        h->used++;
+    }
+
+    e->count++;
+}
+// ====================================================================================================
+uint32_t pcHistSamples( struct pcHist *h )
+
+{
+    return h->samples;
+}
+// ====================================================================================================
+void pcHistTake( struct pcHist *h, struct msgStreamHist *o )
+
+{
+    uint32_t n = 0;
+
+    if ( h->outLen < h->used )
+    {
+        free( h->out );
+        h->outLen = h->slots / 2;
+        h->out = ( struct msgStreamHistEntry * )malloc( h->outLen * sizeof( struct msgStreamHistEntry ) );
+        MEMCHECKV( h->out );
+    }
+
+    for ( uint32_t i = 0; ( h->used ) && ( i < h->slots ); i++ )
+    {
+        if ( h->t[i].count )
+        {
+            h->out[n++] = h->t[i];
+        }
+    }
+
+    qsort( h->out, n, sizeof( struct msgStreamHistEntry ), _compare );
+
+    o->ts = h->ts;
+    o->seq = h->seq++;
+    o->last = true;
+    o->sleeps = h->sleeps;
+    o->n = n;
+    o->e = h->out;
+
+    /* ...and start again from nothing */
+    if ( h->used )
+    {
+        memset( h->t, 0, h->slots * sizeof( struct msgStreamHistEntry ) );
+    }
+
+    h->used = 0;
+    h->samples = 0;
+    h->sleeps = 0;
+}
+// ====================================================================================================
+void pcHistDelete( struct pcHist *h )
+
+{
+    if ( h )
+    {
+        free( h->t );
+        free( h->out );
+        free( h );
+    }
+}
+// ====================================================================================================
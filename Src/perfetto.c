@@ -0,0 +1,348 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Perfetto Timeline Writer
+ * ========================
+ *
+ * The trace is a series of TracePackets, each written as soon as it's made. Everything is on one
+ * packet sequence, the first packet of which clears the incremental state, so interned names sent
+ * on it are good for the rest of the trace. A name is sent along with whatever event uses it
+ * first.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generics.h"
+#include "perfetto.h"
+
+#define PBUF_INITIAL        (256)        /* Initial size of a message being built */
+#define OUTPUT_BUFFER       (256*1024)   /* Events are tiny, so don't write them one at a time */
+
+#define SEQUENCE_ID         (1)          /* Our one packet sequence */
+#define PROCESS_PID         (1)          /* ...and the made up pid the tracks hang off */
+
+/* Fields used, from perfetto's trace.proto and what it includes */
+#define TRACE_PACKET        (1)
+
+#define PACKET_TIMESTAMP    (8)
+#define PACKET_SEQUENCE_ID  (10)
+#define PACKET_TRACK_EVENT  (11)
+#define PACKET_INTERNED     (12)
+#define PACKET_SEQ_FLAGS    (13)
+#define PACKET_TRACK_DESC   (60)
+
+#define SEQ_STATE_CLEARED   (1)
+#define SEQ_NEEDS_STATE     (2)
+
+#define DESC_UUID           (1)
+#define DESC_NAME           (2)
+#define DESC_PROCESS        (3)
+#define DESC_PARENT         (5)
+#define DESC_COUNTER        (8)
+
+#define PROCESS_PID_FIELD   (1)
+#define PROCESS_NAME        (6)
+
+#define EVENT_TYPE          (9)
+#define EVENT_NAME_IID      (10)
+#define EVENT_TRACK         (11)
+#define EVENT_COUNTER_VALUE (30)
+
+#define TYPE_SLICE_BEGIN    (1)
+#define TYPE_SLICE_END      (2)
+#define TYPE_COUNTER        (4)
+
+#define INTERNED_NAMES      (2)
+#define NAME_IID            (1)
+#define NAME_NAME           (2)
+
+struct pbuf
+{
+    uint8_t *d;
+    size_t len;
+    size_t alloc;
+};
+
+struct perfettoTrace
+{
+    FILE *f;
+    bool ok;                             /* Everything so far has been written */
+    double nsPerTick;
+
+    uint64_t process;                    /* Track everything else hangs off */
+    uint64_t nextUuid;                   /* ...and the ones the next track and name get */
+    uint64_t nextIid;
+
+    struct pbuf pkt;                     /* Packet being built */
+    struct pbuf msg;                     /* ...a message going into it */
+    struct pbuf sub;                     /* ...and one going into that */
+    struct pbuf hdr;                     /* Length prefix for a packet being written */
+    struct pbuf interned;                /* Names to go with the next packet to be written */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _pbRaw( struct pbuf *b, const void *d, size_t len )
+
+{
+    if ( !len )
+    {
+        return;
+    }
+
+    if ( b->len + len > b->alloc )
+    {
+        while ( b->len + len > b->alloc )
+        {
+            b->alloc = ( b->alloc ) ? b->alloc * 2 : PBUF_INITIAL;
+        }
+
+        b->d = ( uint8_t * )realloc( b->d, b->alloc );
+        MEMCHECKV( b->d );
+    }
+
+    memcpy( &b->d[b->len], d, len );
+    b->len += len;
+}
+
+static void _pbVarint( struct pbuf *b, uint64_t v )
+
+{
+    uint8_t o[10];
+    int n = 0;
+
+    do
+    {
+        o[n++] = ( v & 0x7f ) | ( ( v > 0x7f ) ? 0x80 : 0 );
+        v >>= 7;
+    }
+    while ( v );
+
+    _pbRaw( b, o, n );
+}
+
+static void _pbUint( struct pbuf *b, uint32_t field, uint64_t v )
+
+{
+    _pbVarint( b, field << 3 );
+    _pbVarint( b, v );
+}
+
+static void _pbBytes( struct pbuf *b, uint32_t field, const void *d, size_t len )
+
+{
+    _pbVarint( b, ( field << 3 ) | 2 );
+    _pbVarint( b, len );
+    _pbRaw( b, d, len );
+}
+
+static void _pbString( struct pbuf *b, uint32_t field, const char *s )
+
+{
+    _pbBytes( b, field, s, strlen( s ) );
+}
+
+static void _pbFree( struct pbuf *b )
+
+{
+    free( b->d );
+}
+// ====================================================================================================
+static void _packetStart( struct perfettoTrace *p )
+
+{
+    p->pkt.len = 0;
+    _pbUint( &p->pkt, PACKET_SEQUENCE_ID, SEQUENCE_ID );
+}
+// ====================================================================================================
+static void _packetWrite( struct perfettoTrace *p )
+
+/* The trace is just its packets one after another, each as a field of the outer message */
+
+{
+    p->hdr.len = 0;
+    _pbVarint( &p->hdr, ( TRACE_PACKET << 3 ) | 2 );
+    _pbVarint( &p->hdr, p->pkt.len );
+
+    if ( ( p->ok ) && ( ( fwrite( p->hdr.d, 1, p->hdr.len, p->f ) != p->hdr.len ) || ( fwrite( p->pkt.d, 1, p->pkt.len, p->f ) != p->pkt.len ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write timeline" EOL );
+        p->ok = false;
+    }
+}
+// ====================================================================================================
+static uint64_t _track( struct perfettoTrace *p, const char *name, bool counter )
+
+/* Describe a new track under the process */
+
+{
+    uint64_t uuid = p->nextUuid++;
+
+    p->msg.len = 0;
+    _pbUint( &p->msg, DESC_UUID, uuid );
+    _pbString( &p->msg, DESC_NAME, name );
+    _pbUint( &p->msg, DESC_PARENT, p->process );
+
+    if ( counter )
+    {
+        _pbBytes( &p->msg, DESC_COUNTER, NULL, 0 );
+    }
+
+    _packetStart( p );
+    _pbBytes( &p->pkt, PACKET_TRACK_DESC, p->msg.d, p->msg.len );
+    _packetWrite( p );
+    return uuid;
+}
+// ====================================================================================================
+static void _event( struct perfettoTrace *p, uint64_t ticks )
+
+/* Send the event in msg at ticks, along with any names it's the first to use */
+
+{
+    _packetStart( p );
+    _pbUint( &p->pkt, PACKET_TIMESTAMP, ( uint64_t )( ticks * p->nsPerTick ) );
+    _pbBytes( &p->pkt, PACKET_TRACK_EVENT, p->msg.d, p->msg.len );
+
+    if ( p->interned.len )
+    {
+        _pbBytes( &p->pkt, PACKET_INTERNED, p->interned.d, p->interned.len );
+        p->interned.len = 0;
+    }
+
+    _pbUint( &p->pkt, PACKET_SEQ_FLAGS, SEQ_NEEDS_STATE );
+    _packetWrite( p );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct perfettoTrace *perfettoCreate( const char *filename, const char *process, double nsPerTick )
+
+{
+    struct perfettoTrace *p = ( struct perfettoTrace * )calloc( 1, sizeof( struct perfettoTrace ) );
+    MEMCHECK( p, NULL );
+
+    if ( !( p->f = fopen( filename, "wb" ) ) )
+    {
+        genericsReport( V_ERROR, "Couldn't open timeline file %s" EOL, filename );
+        free( p );
+        return NULL;
+    }
+
+    setvbuf( p->f, NULL, _IOFBF, OUTPUT_BUFFER );
+    p->ok = true;
+    p->nsPerTick = nsPerTick;
+    p->nextUuid = 1;
+    p->nextIid = 1;
+
+    /* The process everything is in, on the packet that starts the sequence off */
+    p->process = p->nextUuid++;
+    p->sub.len = 0;
+    _pbUint( &p->sub, PROCESS_PID_FIELD, PROCESS_PID );
+    _pbString( &p->sub, PROCESS_NAME, process );
+
+    p->msg.len = 0;
+    _pbUint( &p->msg, DESC_UUID, p->process );
+    _pbBytes( &p->msg, DESC_PROCESS, p->sub.d, p->sub.len );
+
+    _packetStart( p );
+    _pbBytes( &p->pkt, PACKET_TRACK_DESC, p->msg.d, p->msg.len );
+    _pbUint( &p->pkt, PACKET_SEQ_FLAGS, SEQ_STATE_CLEARED );
+    _packetWrite( p );
+    return p;
+}
+// ====================================================================================================
+uint64_t perfettoTrack( struct perfettoTrace *p, const char *name )
+
+{
+    return _track( p, name, false );
+}
+// ====================================================================================================
+uint64_t perfettoCounterTrack( struct perfettoTrace *p, const char *name )
+
+{
+    return _track( p, name, true );
+}
+// ====================================================================================================
+uint64_t perfettoName( struct perfettoTrace *p, const char *name )
+
+/* Give name a number. It's only sent with the first event that uses it, so one that never gets */
+/* used costs nothing in the file, but the caller should keep the number rather than ask again. */
+
+{
+    uint64_t iid = p->nextIid++;
+
+    p->sub.len = 0;
+    _pbUint( &p->sub, NAME_IID, iid );
+    _pbString( &p->sub, NAME_NAME, name );
+    _pbBytes( &p->interned, INTERNED_NAMES, p->sub.d, p->sub.len );
+    return iid;
+}
+// ====================================================================================================
+void perfettoBegin( struct perfettoTrace *p, uint64_t track, uint64_t ticks, uint64_t name )
+
+{
+    p->msg.len = 0;
+    _pbUint( &p->msg, EVENT_TYPE, TYPE_SLICE_BEGIN );
+    _pbUint( &p->msg, EVENT_NAME_IID, name );
+    _pbUint( &p->msg, EVENT_TRACK, track );
+    _event( p, ticks );
+}
+// ====================================================================================================
+void perfettoEnd( struct perfettoTrace *p, uint64_t track, uint64_t ticks )
+
+{
+    p->msg.len = 0;
+    _pbUint( &p->msg, EVENT_TYPE, TYPE_SLICE_END );
+    _pbUint( &p->msg, EVENT_TRACK, track );
+    _event( p, ticks );
+}
+// ====================================================================================================
+void perfettoCounter( struct perfettoTrace *p, uint64_t track, uint64_t ticks, int64_t v )
+
+{
+    p->msg.len = 0;
+    _pbUint( &p->msg, EVENT_TYPE, TYPE_COUNTER );
+    _pbUint( &p->msg, EVENT_TRACK, track );
+    _pbUint( &p->msg, EVENT_COUNTER_VALUE, ( uint64_t )v );
+    _event( p, ticks );
+}
+// ====================================================================================================
+bool perfettoClose( struct perfettoTrace *p )
+
+{
+    bool ok;
+
+    if ( !p )
+    {
+        return true;
+    }
+
+    if ( ( fclose( p->f ) ) && ( p->ok ) )
+    {
+        genericsReport( V_ERROR, "Failed to write timeline" EOL );
+        p->ok = false;
+    }
+
+    ok = p->ok;
+
+    _pbFree( &p->pkt );
+    _pbFree( &p->msg );
+    _pbFree( &p->sub );
+    _pbFree( &p->hdr );
+    _pbFree( &p->interned );
+    free( p );
+    return ok;
+}
+// ====================================================================================================
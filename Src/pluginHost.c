@@ -0,0 +1,547 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Plugin Host
+ * ===========
+ *
+ * Loads analysis plugins into orbuculum and runs them alongside the capture. The decode thread
+ * only ever queues blocks here, and never waits...if the worker falls behind the queue fills
+ * and what doesn't fit is counted as dropped. Everything the plugins are called with, including
+ * any OFLOW, TPIU or ITM decoding they need, happens on the worker.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include "generics.h"
+#include "oflow.h"
+#include "tpiuDecoder.h"
+#include "itmDecoder.h"
+#include "orbPlugin.h"
+#include "pluginHost.h"
+
+#define PLUGIN_QUEUE_LEN     (64)                  /* Blocks waiting for the worker, a power of two */
+#define PLUGIN_QUEUE_MASK    (PLUGIN_QUEUE_LEN-1)
+#define PLUGIN_MAX_BORROWED  (8)                   /* Blocks held at once, after that they're copied */
+#define PLUGIN_MAX_METRICS   (32)                  /* Values each plugin instance may publish */
+#define PLUGIN_MSG_BATCH     (256)                 /* Most messages handed over in one call */
+#define PLUGIN_WAIT_NS       (50*1000*1000L)
+
+/* One plugin loaded into one host */
+struct pluginInstance
+{
+    const struct orbPlugin *p;                     /* What the plugin said about itself */
+    void *dl;                                      /* The shared object it came from */
+    char *args;                                    /* Arguments it was given */
+    void *ctx;                                     /* ...and the context it made from them, NULL if it failed */
+    struct orbPluginHost h;                        /* What it was given to call us back with */
+
+    atomic_int numMetrics;                         /* Values it has published, only ever grows */
+    char *metricName[PLUGIN_MAX_METRICS];          /* Their names, set before numMetrics covers them */
+    atomic_int_fast64_t metric[PLUGIN_MAX_METRICS];
+};
+
+/* A block waiting for the worker */
+struct pluginEntry
+{
+    struct nwclientBlock *b;                       /* Block being borrowed, or NULL if it was copied */
+    const uint8_t *d;                              /* The data... */
+    uint32_t len;                                  /* ...its length */
+    bool oflow;                                    /* ...and if it's ORBFLOW framed */
+    uint8_t *copy;                                 /* This slot's own buffer for copies */
+    uint32_t copyLen;                              /* ...and how big it is */
+};
+
+struct pluginHost
+{
+    char *probe;                                   /* Serial number of the probe we're attached to */
+    bool useTPIU;                                  /* Strip TPIU the same way orbuculum does */
+    struct pluginInstance *inst;                   /* Plugins loaded */
+    int numInst;                                   /* ...and how many */
+    bool wantRaw;                                  /* Do any of them want each sort of data */
+    bool wantTags;
+    bool wantMsgs;
+
+    struct pluginEntry q[PLUGIN_QUEUE_LEN];        /* Blocks waiting for the worker */
+    atomic_size_t wp;                              /* Only changed by the decode thread */
+    atomic_size_t rp;                              /* Only changed by the worker */
+    atomic_int borrowed;                           /* Number of blocks in the queue that are borrowed */
+    pthread_mutex_t l;                             /* Lock protecting the kick flag */
+    pthread_cond_t c;                              /* Signal that there's something on the queue */
+    bool kicked;                                   /* ...and the flag that goes with it */
+    atomic_bool ending;                            /* Time for the worker to close everything up */
+    bool running;                                  /* Flag that the worker exists */
+    pthread_t thread;
+    atomic_uint_fast64_t droppedBytes;             /* Data the worker had no room for */
+
+    /* Decoders, only used by the worker */
+    struct OFLOW oflow;
+    struct TPIUDecoder t;
+    struct ITMDecoder i;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Routines called by plugins
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static int _addMetric( struct orbPluginHost *h, const char *name )
+
+{
+    struct pluginInstance *n = ( struct pluginInstance * )h->priv;
+    int id = atomic_load_explicit( &n->numMetrics, memory_order_relaxed );
+
+    if ( id == PLUGIN_MAX_METRICS )
+    {
+        genericsReport( V_WARN, "Plugin %s has too many metrics, %s isn't published" EOL, n->p->name, name );
+        return -1;
+    }
+
+    n->metricName[id] = strdup( name );
+    MEMCHECK( n->metricName[id], -1 );
+    atomic_init( &n->metric[id], 0 );
+
+    /* Anyone reading the metrics only looks at names once this covers them */
+    atomic_store_explicit( &n->numMetrics, id + 1, memory_order_release );
+    return id;
+}
+// ====================================================================================================
+static void _setMetric( struct orbPluginHost *h, int id, int64_t v )
+
+{
+    struct pluginInstance *n = ( struct pluginInstance * )h->priv;
+
+    if ( ( id >= 0 ) && ( id < atomic_load_explicit( &n->numMetrics, memory_order_relaxed ) ) )
+    {
+        atomic_store_explicit( &n->metric[id], v, memory_order_relaxed );
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Worker
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _msgs( struct pluginHost *p, const uint8_t *d, size_t len )
+
+/* Decode ITM into batches of messages for the plugins that want them */
+
+{
+    struct msg m[PLUGIN_MSG_BATCH];
+    size_t n, used;
+
+    while ( len )
+    {
+        n = ITMPumpBlock( &p->i, d, len, m, PLUGIN_MSG_BATCH, &used );
+        d += used;
+        len -= used;
+
+        for ( int j = 0; n && ( j < p->numInst ); j++ )
+        {
+            if ( p->inst[j].ctx && p->inst[j].p->msgs )
+            {
+                p->inst[j].p->msgs( p->inst[j].ctx, m, n );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _tagData( struct pluginHost *p, uint8_t tag, const uint8_t *d, size_t len )
+
+/* Hand the data for one tag to everyone who wants it, and decode it if it's the ITM */
+
+{
+    for ( int j = 0; p->wantTags && ( j < p->numInst ); j++ )
+    {
+        if ( p->inst[j].ctx && p->inst[j].p->tagData )
+        {
+            p->inst[j].p->tagData( p->inst[j].ctx, tag, d, len );
+        }
+    }
+
+    if ( ( p->wantMsgs ) && ( tag == DEFAULT_ITM_STREAM ) )
+    {
+        _msgs( p, d, len );
+    }
+}
+// ====================================================================================================
+static void _spansRxed( enum TPIUPumpEvent e, const struct TPIUSpan *s, int nspans, void *param )
+
+{
+    struct pluginHost *p = ( struct pluginHost * )param;
+
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        for ( ; nspans--; s++ )
+        {
+            _tagData( p, s->stream, s->d, s->len );
+        }
+    }
+}
+// ====================================================================================================
+static void _frameRxed( struct OFLOWFrame *f, void *param )
+
+{
+    struct pluginHost *p = ( struct pluginHost * )param;
+
+    if ( ( !f->good ) || ( f->tag == OFLOW_TIME_TAG ) )
+    {
+        /* Time frames aren't data, they just stamp what follows */
+        return;
+    }
+
+    if ( ( p->useTPIU ) && ( f->tag == DEFAULT_ITM_STREAM ) )
+    {
+        /* TPIU carried inside ORBFLOW, as orbuculum handles it */
+        TPIUPumpSpans( &p->t, f->d, f->len, _spansRxed, p );
+    }
+    else
+    {
+        _tagData( p, f->tag, f->d, f->len );
+    }
+}
+// ====================================================================================================
+static void _process( struct pluginHost *p, struct pluginEntry *e )
+
+/* Give one block to the plugins, decoding it only as far as any of them need */
+
+{
+    for ( int j = 0; p->wantRaw && ( j < p->numInst ); j++ )
+    {
+        if ( p->inst[j].ctx && p->inst[j].p->rawData )
+        {
+            p->inst[j].p->rawData( p->inst[j].ctx, e->d, e->len );
+        }
+    }
+
+    if ( !p->wantTags && !p->wantMsgs )
+    {
+        return;
+    }
+
+    if ( e->oflow )
+    {
+        OFLOWPump( &p->oflow, e->d, e->len, _frameRxed, p );
+    }
+    else if ( p->useTPIU )
+    {
+        TPIUPumpSpans( &p->t, e->d, e->len, _spansRxed, p );
+    }
+    else
+    {
+        _tagData( p, DEFAULT_ITM_STREAM, e->d, e->len );
+    }
+}
+// ====================================================================================================
+static bool _wait( struct pluginHost *p )
+
+/* Wait a while for something to be queued, returning false if it's time to stop */
+
+{
+    struct timespec ts;
+
+    pthread_mutex_lock( &p->l );
+
+    if ( !p->kicked && !atomic_load( &p->ending ) )
+    {
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += PLUGIN_WAIT_NS;
+
+        if ( ts.tv_nsec >= 1000000000L )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait( &p->c, &p->l, &ts );
+    }
+
+    p->kicked = false;
+    pthread_mutex_unlock( &p->l );
+    return !atomic_load( &p->ending );
+}
+// ====================================================================================================
+static void *_workerTask( void *arg )
+
+{
+    struct pluginHost *p = ( struct pluginHost * )arg;
+    struct pluginInstance *n;
+
+    /* Plugins are only ever called from here, including to set them up */
+    for ( int j = 0; j < p->numInst; j++ )
+    {
+        n = &p->inst[j];
+
+        if ( !( n->ctx = n->p->init ? n->p->init( &n->h, n->args ) : n ) )
+        {
+            genericsReport( V_ERROR, "Plugin %s failed to start" EOL, n->p->name );
+        }
+    }
+
+    while ( true )
+    {
+        size_t rp = atomic_load_explicit( &p->rp, memory_order_relaxed );
+
+        if ( rp == atomic_load_explicit( &p->wp, memory_order_acquire ) )
+        {
+            if ( !_wait( p ) )
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        struct pluginEntry *e = &p->q[rp & PLUGIN_QUEUE_MASK];
+        _process( p, e );
+
+        if ( e->b )
+        {
+            nwclientBlockRelease( e->b );
+            atomic_fetch_sub_explicit( &p->borrowed, 1, memory_order_relaxed );
+            e->b = NULL;
+        }
+
+        atomic_store_explicit( &p->rp, rp + 1, memory_order_release );
+    }
+
+    for ( int j = 0; j < p->numInst; j++ )
+    {
+        n = &p->inst[j];
+
+        if ( n->ctx && n->p->close )
+        {
+            n->p->close( n->ctx );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct pluginHost *pluginHostCreate( const char *probe, bool useTPIU )
+
+/* Make a host for a probe, for plugins to be loaded into */
+
+{
+    struct pluginHost *p = ( struct pluginHost * )calloc( 1, sizeof( struct pluginHost ) );
+    MEMCHECK( p, NULL );
+
+    p->probe = strdup( probe ? probe : "" );
+    p->useTPIU = useTPIU;
+    pthread_mutex_init( &p->l, NULL );
+    pthread_cond_init( &p->c, NULL );
+    OFLOWInit( &p->oflow );
+    TPIUDecoderInit( &p->t );
+    ITMDecoderInit( &p->i, true );
+
+    /* Plugins are as likely to be after PC samples and DWT events as printf, so short cut those too */
+    ITMDecoderSetProfile( &p->i, ITM_PROFILE_SW_HW );
+    return p;
+}
+// ====================================================================================================
+bool pluginHostLoad( struct pluginHost *p, const char *spec )
+
+/* Load the plugin described by spec, which is its filename optionally followed by a comma and */
+/* whatever arguments it takes.                                                                 */
+
+{
+    struct pluginInstance *n;
+    orbPluginEntryFn entry;
+    const struct orbPlugin *desc;
+    char *file = strdup( spec );
+    char *args;
+    void *dl;
+
+    MEMCHECK( file, false );
+
+    if ( ( args = strchr( file, ',' ) ) )
+    {
+        *args++ = 0;
+    }
+
+    if ( !( dl = dlopen( file, RTLD_NOW | RTLD_LOCAL ) ) )
+    {
+        genericsReport( V_ERROR, "Could not load plugin %s (%s)" EOL, file, dlerror() );
+        free( file );
+        return false;
+    }
+
+    if ( ( !( entry = ( orbPluginEntryFn )dlsym( dl, ORBPLUGIN_ENTRY ) ) ) || ( !( desc = entry() ) ) )
+    {
+        genericsReport( V_ERROR, "%s isn't an orbuculum plugin" EOL, file );
+        dlclose( dl );
+        free( file );
+        return false;
+    }
+
+    if ( desc->apiVersion != ORBPLUGIN_API_VERSION )
+    {
+        genericsReport( V_ERROR, "Plugin %s is for API version %d, this is version %d" EOL, file, desc->apiVersion, ORBPLUGIN_API_VERSION );
+        dlclose( dl );
+        free( file );
+        return false;
+    }
+
+    p->inst = ( struct pluginInstance * )realloc( p->inst, ( p->numInst + 1 ) * sizeof( struct pluginInstance ) );
+    MEMCHECK( p->inst, false );
+    n = &p->inst[p->numInst];
+    memset( n, 0, sizeof( struct pluginInstance ) );
+
+    n->p = desc;
+    n->dl = dl;
+    n->args = strdup( args ? args : "" );
+    n->h.apiVersion = ORBPLUGIN_API_VERSION;
+    n->h.probe = p->probe;
+    n->h.report = genericsReport;
+    n->h.addMetric = _addMetric;
+    n->h.setMetric = _setMetric;
+    atomic_init( &n->numMetrics, 0 );
+
+    p->wantRaw |= ( desc->rawData != NULL );
+    p->wantTags |= ( desc->tagData != NULL );
+    p->wantMsgs |= ( desc->msgs != NULL );
+    p->numInst++;
+
+    genericsReport( V_INFO, "Loaded plugin %s from %s" EOL, desc->name, file );
+    free( file );
+    return true;
+}
+// ====================================================================================================
+bool pluginHostStart( struct pluginHost *p )
+
+/* Start the worker, once all of the plugins are loaded. Since the instance array can't move */
+/* after this, each plugin's pointer back to its instance is only filled in here.            */
+
+{
+    for ( int j = 0; j < p->numInst; j++ )
+    {
+        p->inst[j].h.priv = &p->inst[j];
+    }
+
+    if ( pthread_create( &p->thread, NULL, _workerTask, p ) )
+    {
+        genericsReport( V_ERROR, "Failed to start plugin thread" EOL );
+        return false;
+    }
+
+    p->running = true;
+    return true;
+}
+// ====================================================================================================
+void pluginHostFeed( struct pluginHost *p, const uint8_t *d, uint32_t len, struct nwclientBlock *b, bool oflow )
+
+/* Queue a block for the plugins, borrowing b if it's set and we're not holding too many already */
+
+{
+    size_t wp = atomic_load_explicit( &p->wp, memory_order_relaxed );
+    struct pluginEntry *e;
+
+    if ( ( !p->running ) || ( !len ) || atomic_load_explicit( &p->ending, memory_order_relaxed ) )
+    {
+        return;
+    }
+
+    if ( wp - atomic_load_explicit( &p->rp, memory_order_acquire ) == PLUGIN_QUEUE_LEN )
+    {
+        /* The plugins aren't keeping up, and capture doesn't wait for them */
+        atomic_fetch_add_explicit( &p->droppedBytes, len, memory_order_relaxed );
+        return;
+    }
+
+    e = &p->q[wp & PLUGIN_QUEUE_MASK];
+    e->oflow = oflow;
+    e->len = len;
+
+    if ( ( b ) && ( atomic_load_explicit( &p->borrowed, memory_order_relaxed ) < PLUGIN_MAX_BORROWED ) )
+    {
+        nwclientBlockRetain( b );
+        atomic_fetch_add_explicit( &p->borrowed, 1, memory_order_relaxed );
+        e->b = b;
+        e->d = d;
+    }
+    else
+    {
+        if ( e->copyLen < len )
+        {
+            e->copy = ( uint8_t * )realloc( e->copy, len );
+            MEMCHECKV( e->copy );
+            e->copyLen = len;
+        }
+
+        memcpy( e->copy, d, len );
+        e->d = e->copy;
+    }
+
+    atomic_store_explicit( &p->wp, wp + 1, memory_order_release );
+
+    pthread_mutex_lock( &p->l );
+    p->kicked = true;
+    pthread_cond_signal( &p->c );
+    pthread_mutex_unlock( &p->l );
+}
+// ====================================================================================================
+uint64_t pluginHostDroppedBytes( struct pluginHost *p )
+
+/* Data that never reached the plugins because they weren't keeping up */
+
+{
+    return p ? atomic_load_explicit( &p->droppedBytes, memory_order_relaxed ) : 0;
+}
+// ====================================================================================================
+int pluginHostValues( struct pluginHost *p, struct pluginValue *v, int max )
+
+/* Fill in up to max of the values the plugins have published, returning how many there were */
+
+{
+    int c = 0;
+
+    for ( int j = 0; p && ( j < p->numInst ); j++ )
+    {
+        struct pluginInstance *n = &p->inst[j];
+        int nm = atomic_load_explicit( &n->numMetrics, memory_order_acquire );
+
+        for ( int k = 0; ( k < nm ) && ( c < max ); k++ )
+        {
+            v[c].plugin = n->p->name;
+            v[c].name = n->metricName[k];
+            v[c].value = atomic_load_explicit( &n->metric[k], memory_order_relaxed );
+            c++;
+        }
+    }
+
+    return c;
+}
+// ====================================================================================================
+void pluginHostStop( struct pluginHost *p )
+
+/* Let the worker finish what's queued, then close the plugins down. The host itself stays */
+/* around (but ignores anything fed to it) since the decode thread may still be using it.  */
+
+{
+    if ( ( !p ) || ( !p->running ) || atomic_exchange( &p->ending, true ) )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &p->l );
+    p->kicked = true;
+    pthread_cond_signal( &p->c );
+    pthread_mutex_unlock( &p->l );
+    pthread_join( p->thread, NULL );
+}
+// ====================================================================================================
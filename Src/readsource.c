@@ -2,11 +2,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#if !defined(WIN32)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
 #include "generics.h"
+#include "readsource.h"
+#include "memAccount.h"
 
 #define BLOCKSIZE    (65536)
 #define MAX_LINE_LEN (4095)
 
+/* Set once it's known that source isn't being pretty printed, so files can be used just as they are */
+static bool _prettyPrinterTested = false;
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -27,14 +38,14 @@ char *readsourcefile( char *path, size_t *l )
         return NULL;
     }
 
-    char *retBuffer = ( char * )malloc( BLOCKSIZE );
+    char *retBuffer = ( char * )memAlloc( MEM_SYMBOLS, BLOCKSIZE );
 
     size_t insize = fread( retBuffer, 1, BLOCKSIZE, f );
     *l = insize;
 
     while ( !feof( f ) )
     {
-        retBuffer = ( char * )realloc( retBuffer, *l + BLOCKSIZE );
+        retBuffer = ( char * )memRealloc( MEM_SYMBOLS, retBuffer, *l + BLOCKSIZE );
 
         if ( !retBuffer )
         {
@@ -47,7 +58,7 @@ char *readsourcefile( char *path, size_t *l )
 
     fclose( f );
 
-    retBuffer = ( char * )realloc( retBuffer, *l + 1 );
+    retBuffer = ( char * )memRealloc( MEM_SYMBOLS, retBuffer, *l + 1 );
 
     if ( !retBuffer )
     {
@@ -59,6 +70,16 @@ char *readsourcefile( char *path, size_t *l )
     return retBuffer;
 }
 
+char *readsourcemap( char *path, size_t *l )
+{
+    *l = 0;
+    return NULL;
+}
+
+void readsourceunmap( char *d, size_t l )
+{
+}
+
 #else
 
 char *readsourcefile( char *path, size_t *l )
@@ -67,14 +88,13 @@ char *readsourcefile( char *path, size_t *l )
 
 {
     FILE *fd = NULL;
-    static bool prettyPrinterTested = false;
     char commandLine[MAX_LINE_LEN];
     bool isProcess = true;
 
-    char *retBuffer = ( char * )malloc( BLOCKSIZE );
+    char *retBuffer = ( char * )memAlloc( MEM_SYMBOLS, BLOCKSIZE );
     size_t insize = 0;
 
-    if ( !prettyPrinterTested )
+    if ( !_prettyPrinterTested )
     {
         /* Try and grab the file via a prettyprinter. If that doesn't work, grab it via cat */
         if ( getenv( "ORB_PRETTYPRINTER" ) )
@@ -102,7 +122,7 @@ char *readsourcefile( char *path, size_t *l )
         }
 
         isProcess = false;
-        prettyPrinterTested = true;
+        _prettyPrinterTested = true;
 
         if ( ( fd = fopen( path, "r" ) ) )
         {
@@ -117,7 +137,7 @@ char *readsourcefile( char *path, size_t *l )
     while ( insize == BLOCKSIZE )
     {
         /* Make another block available */
-        retBuffer = ( char * )realloc( retBuffer, *l + BLOCKSIZE );
+        retBuffer = ( char * )memRealloc( MEM_SYMBOLS, retBuffer, *l + BLOCKSIZE );
 
         if ( !retBuffer )
         {
@@ -140,7 +160,7 @@ char *readsourcefile( char *path, size_t *l )
     /* Resize the memory to what was actually read in */
     if ( *l )
     {
-        retBuffer = ( char * )realloc( retBuffer, *l );
+        retBuffer = ( char * )memRealloc( MEM_SYMBOLS, retBuffer, *l );
 
         if ( !retBuffer )
         {
@@ -149,12 +169,54 @@ char *readsourcefile( char *path, size_t *l )
     }
     else
     {
-        free( retBuffer );
+        memFree( MEM_SYMBOLS, retBuffer );
         retBuffer = NULL;
     }
 
     return retBuffer;
 }
+// ====================================================================================================
+char *readsourcemap( char *path, size_t *l )
+
+/* Map the source file in, when it's going to be shown as it is, or return NULL if it can't be */
+
+{
+    struct stat st;
+    char *d;
+    int fd;
+
+    *l = 0;
+
+    if ( ( !_prettyPrinterTested ) || ( ( fd = open( path, O_RDONLY ) ) < 0 ) )
+    {
+        return NULL;
+    }
+
+    /* There has to be room left in the last page for the 0 on the end, which the mapping gives us for nothing */
+    if ( ( fstat( fd, &st ) < 0 ) || ( !st.st_size ) || ( !( st.st_size % sysconf( _SC_PAGESIZE ) ) ) )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    /* Private and writable, so lines can be terminated in place without any of it going back to the file */
+    d = ( char * )mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( d == MAP_FAILED )
+    {
+        return NULL;
+    }
+
+    *l = st.st_size;
+    return d;
+}
+// ====================================================================================================
+void readsourceunmap( char *d, size_t l )
+
+{
+    munmap( d, l );
+}
 
 #endif
 
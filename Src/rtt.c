@@ -0,0 +1,312 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Real Time Transfer
+ * ==================
+ *
+ * The control block, as the target has it, is;
+ *
+ *   char acID[16];                "SEGGER RTT", NUL padded
+ *   int  MaxNumUpBuffers;
+ *   int  MaxNumDownBuffers;
+ *   struct { const char *sName; char *pBuffer; unsigned SizeOfBuffer, WrOff, RdOff, Flags; } aUp[];
+ *   ...and then the down-buffers, which aren't of interest here.
+ *
+ * The target only ever moves WrOff and we only ever move RdOff, so nothing has to be locked. The
+ * header and all the up descriptors are read in one go each poll, then at most two reads for each
+ * buffer with anything in it (two if it has wrapped) and a write to give the space back.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "generics.h"
+#include "rtt.h"
+
+#define RTT_ID           "SEGGER RTT"
+#define RTT_ID_LEN       (sizeof( RTT_ID ))       /* Matched with its terminator */
+#define RTT_HDR_LEN      (24)
+#define RTT_DESC_LEN     (24)
+#define RTT_SEARCH_CHUNK (1024)                   /* Memory read at a time looking for the control block */
+
+/* Offsets in an up-buffer descriptor */
+#define RTT_DESC_NAME    (0)
+#define RTT_DESC_BUFFER  (4)
+#define RTT_DESC_SIZE    (8)
+#define RTT_DESC_WROFF   (12)
+#define RTT_DESC_RDOFF   (16)
+
+struct rtt
+{
+    rttReadFn read;                               /* Getting at target memory */
+    rttWriteFn write;
+    void *param;
+
+    bool found;                                   /* The control block is known */
+    uint32_t addr;                                /* ...and where it is */
+    unsigned int numUp;                           /* Up-buffers being followed */
+    unsigned int next;                            /* Buffer to start from next poll, so none is starved */
+    char name[RTT_MAX_UP_BUFFERS][RTT_MAX_NAME_LEN];
+
+    uint8_t desc[RTT_HDR_LEN + RTT_MAX_UP_BUFFERS * RTT_DESC_LEN];
+    uint8_t *d;                                   /* Data read from the buffers */
+    uint32_t dLen;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint32_t _le32( const uint8_t *p )
+
+{
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( ( uint32_t )p[3] << 24 );
+}
+// ====================================================================================================
+static void _readNames( struct rtt *r )
+
+/* Names are only for telling people what's what, so one that can't be read is just left empty */
+
+{
+    for ( unsigned int i = 0; i < r->numUp; i++ )
+    {
+        uint32_t n = _le32( &r->desc[RTT_HDR_LEN + i * RTT_DESC_LEN + RTT_DESC_NAME] );
+
+        if ( ( !n ) || ( !r->read( r->param, n, ( uint8_t * )r->name[i], RTT_MAX_NAME_LEN - 1 ) ) )
+        {
+            r->name[i][0] = 0;
+        }
+
+        r->name[i][RTT_MAX_NAME_LEN - 1] = 0;
+
+        for ( char *c = r->name[i]; *c; c++ )
+        {
+            if ( ( *c < ' ' ) || ( *c > '~' ) )
+            {
+                *c = 0;
+                break;
+            }
+        }
+    }
+}
+// ====================================================================================================
+static bool _readDesc( struct rtt *r )
+
+/* Read the header and up descriptors, checking it's still a control block */
+
+{
+    uint32_t n;
+
+    if ( !r->read( r->param, r->addr, r->desc, RTT_HDR_LEN + r->numUp * RTT_DESC_LEN ) )
+    {
+        return false;
+    }
+
+    if ( memcmp( r->desc, RTT_ID, RTT_ID_LEN ) )
+    {
+        r->found = false;
+        return true;
+    }
+
+    n = _le32( &r->desc[16] );
+    n = ( n > RTT_MAX_UP_BUFFERS ) ? RTT_MAX_UP_BUFFERS : n;
+
+    if ( n != r->numUp )
+    {
+        /* The target has been restarted with a different size of control block, so read it all again */
+        r->numUp = n;
+        return _readDesc( r );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _grow( struct rtt *r, uint32_t len )
+
+{
+    if ( len > r->dLen )
+    {
+        uint8_t *d = ( uint8_t * )realloc( r->d, len );
+        MEMCHECK( d, false );
+        r->d = d;
+        r->dLen = len;
+    }
+
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct rtt *rttCreate( rttReadFn read, rttWriteFn write, void *param )
+
+{
+    struct rtt *r = ( struct rtt * )calloc( 1, sizeof( struct rtt ) );
+    MEMCHECK( r, NULL );
+
+    r->read  = read;
+    r->write = write;
+    r->param = param;
+    return r;
+}
+// ====================================================================================================
+int rttFind( struct rtt *r, uint32_t addr, uint32_t len )
+
+{
+    uint8_t d[RTT_SEARCH_CHUNK + RTT_ID_LEN - 1];
+    uint32_t at;
+
+    r->found = false;
+
+    if ( !len )
+    {
+        /* Told exactly where it is, so it's there or it isn't */
+        at = addr;
+    }
+    else
+    {
+        at = 0;
+
+        for ( uint32_t o = 0; ( !at ) && ( o < len ); o += RTT_SEARCH_CHUNK )
+        {
+            /* Each chunk overlaps the next by enough that the ID can't fall between them */
+            uint32_t l = ( len - o < sizeof( d ) ) ? len - o : sizeof( d );
+
+            if ( !r->read( r->param, addr + o, d, l ) )
+            {
+                return -1;
+            }
+
+            for ( uint32_t i = 0; i + RTT_ID_LEN <= l; i++ )
+            {
+                if ( ( d[i] == 'S' ) && ( !memcmp( &d[i], RTT_ID, RTT_ID_LEN ) ) )
+                {
+                    at = addr + o + i;
+                    break;
+                }
+            }
+        }
+
+        if ( !at )
+        {
+            return 0;
+        }
+    }
+
+    r->addr  = at;
+    r->numUp = 0;
+
+    if ( !_readDesc( r ) )
+    {
+        return -1;
+    }
+
+    if ( memcmp( r->desc, RTT_ID, RTT_ID_LEN ) )
+    {
+        return 0;
+    }
+
+    r->found = true;
+    r->next  = 0;
+    _readNames( r );
+    return 1;
+}
+// ====================================================================================================
+bool rttFound( struct rtt *r )
+
+{
+    return r->found;
+}
+// ====================================================================================================
+uint32_t rttAddress( struct rtt *r )
+
+{
+    return r->addr;
+}
+// ====================================================================================================
+unsigned int rttNumUp( struct rtt *r )
+
+{
+    return r->numUp;
+}
+// ====================================================================================================
+const char *rttUpName( struct rtt *r, unsigned int buf )
+
+{
+    return ( buf < r->numUp ) ? r->name[buf] : "";
+}
+// ====================================================================================================
+int rttPoll( struct rtt *r, uint32_t max, rttDataCB cb, void *param )
+
+{
+    uint32_t total = 0;
+
+    if ( ( !r->found ) || ( !_readDesc( r ) ) )
+    {
+        return ( r->found ) ? -1 : 0;
+    }
+
+    if ( ( !r->found ) || ( !r->numUp ) || ( !_grow( r, max ) ) )
+    {
+        return 0;
+    }
+
+    for ( unsigned int k = 0; ( k < r->numUp ) && ( total < max ); k++ )
+    {
+        unsigned int i = ( r->next + k ) % r->numUp;
+        const uint8_t *desc = &r->desc[RTT_HDR_LEN + i * RTT_DESC_LEN];
+        uint32_t buffer = _le32( &desc[RTT_DESC_BUFFER] );
+        uint32_t size   = _le32( &desc[RTT_DESC_SIZE] );
+        uint32_t wrOff  = _le32( &desc[RTT_DESC_WROFF] );
+        uint32_t rdOff  = _le32( &desc[RTT_DESC_RDOFF] );
+        uint32_t len, first;
+
+        /* Anything that doesn't make sense is a buffer still being set up, or one being overwritten */
+        if ( ( !buffer ) || ( !size ) || ( wrOff >= size ) || ( rdOff >= size ) || ( wrOff == rdOff ) )
+        {
+            continue;
+        }
+
+        len = ( wrOff > rdOff ) ? wrOff - rdOff : size - rdOff + wrOff;
+        len = ( len > max - total ) ? max - total : len;
+
+        /* ...which may be in two parts if it has wrapped */
+        first = ( rdOff + len > size ) ? size - rdOff : len;
+
+        if ( ( !r->read( r->param, buffer + rdOff, r->d, first ) ) ||
+                ( ( first < len ) && ( !r->read( r->param, buffer, &r->d[first], len - first ) ) ) )
+        {
+            return -1;
+        }
+
+        /* It's not taken until RdOff says so, which gives the target the space back */
+        if ( !r->write( r->param, r->addr + RTT_HDR_LEN + i * RTT_DESC_LEN + RTT_DESC_RDOFF, ( rdOff + len ) % size ) )
+        {
+            return -1;
+        }
+
+        cb( i, r->d, len, param );
+        total += len;
+    }
+
+    r->next = ( r->next + 1 ) % r->numUp;
+    return total;
+}
+// ====================================================================================================
+void rttDelete( struct rtt *r )
+
+{
+    if ( r )
+    {
+        free( r->d );
+        free( r );
+    }
+}
+// ====================================================================================================
@@ -0,0 +1,398 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Shared Memory Broadcast Ring
+ * ============================
+ *
+ * The ring is a header followed by a power-of-two sized data area, in a POSIX shared memory object.
+ * The writer moves a (free running) reserve position on to the end of what it's about to write, copies
+ * the data in, and then moves the write position on to match. Readers copy out from their own position
+ * up to the write position, and check the reserve position afterwards, so they know about anything the
+ * writer had started to overwrite while they were copying it, not only what it had finished with.
+ * A reader that finds nothing to read registers as a waiter and sleeps, and the writer only makes
+ * a wakeup call when there's someone waiting.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined( LINUX )
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+
+#include "generics.h"
+#include "shmRing.h"
+
+#define SHMRING_MAGIC       (0x4f524252)   /* 'ORBR' */
+#define SHMRING_VERSION     (2)
+#define SHMRING_POLL_MS     (1)            /* How often to look for data where there's no way to be woken */
+
+/* This is what's at the start of the shared memory */
+struct shmRingHeader
+{
+    _Atomic uint32_t magic;                /* Set to SHMRING_MAGIC once the rest is valid */
+    uint32_t version;                      /* Version of this layout */
+    uint64_t size;                         /* Size of the data area, a power of two */
+    pid_t pid;                             /* Process that is writing */
+    _Atomic uint32_t closed;               /* Set when the writer has finished */
+    _Atomic uint64_t wp;                   /* Total number of bytes ever written */
+    _Atomic uint64_t reserve;              /* ...and what will have been once the write in progress is done */
+    _Atomic uint32_t wake;                 /* Changed each time waiting readers are to be woken */
+    _Atomic uint32_t waiters;              /* Number of readers waiting for data */
+};
+
+/* Data area starts on a cache line of its own */
+#define SHMRING_HDR_LEN     ((sizeof(struct shmRingHeader)+63)&~63)
+
+struct shmRing
+{
+    struct shmRingHeader *h;               /* The shared memory */
+    uint8_t *d;                            /* ...its data area */
+    size_t mapLen;                         /* ...and how much is mapped altogether */
+    uint64_t rp;                           /* Our read position, if we're a reader */
+    char *name;                            /* Name of the shared memory object, set if we created it */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _wait( struct shmRing *r, int timeoutMs )
+
+/* Wait until there might be something to read, or for timeoutMs */
+
+{
+    uint32_t w = atomic_load( &r->h->wake );
+
+    /* Register as waiting before the final check, so the writer either sees us or we see the data */
+    atomic_fetch_add( &r->h->waiters, 1 );
+
+    if ( ( atomic_load( &r->h->wp ) == r->rp ) && ( !atomic_load( &r->h->closed ) ) )
+    {
+#if defined( LINUX )
+        struct timespec ts = { .tv_sec = timeoutMs / 1000, .tv_nsec = ( timeoutMs % 1000 ) * 1000000L };
+
+        /* This is a shared futex, since the writer is in another process */
+        syscall( SYS_futex, &r->h->wake, FUTEX_WAIT, w, &ts, NULL, 0 );
+#else
+        usleep( ( ( timeoutMs < SHMRING_POLL_MS ) ? timeoutMs : SHMRING_POLL_MS ) * 1000 );
+#endif
+    }
+
+    atomic_fetch_sub( &r->h->waiters, 1 );
+}
+// ====================================================================================================
+static size_t _waiting( struct shmRing *r, int timeoutMs, uint64_t *lost )
+
+/* How much there is to read, waiting up to timeoutMs if there's nothing, after skipping anything */
+/* that's been overwritten since we last looked (which is added to lost).                          */
+
+{
+    uint64_t wp = atomic_load_explicit( &r->h->wp, memory_order_acquire );
+
+    if ( wp == r->rp )
+    {
+        _wait( r, timeoutMs );
+
+        if ( ( wp = atomic_load_explicit( &r->h->wp, memory_order_acquire ) ) == r->rp )
+        {
+            return 0;
+        }
+    }
+
+    /* If we've been lapped then the oldest data is gone */
+    if ( wp - r->rp > r->h->size )
+    {
+        *lost += wp - r->h->size - r->rp;
+        r->rp  = wp - r->h->size;
+    }
+
+    return wp - r->rp;
+}
+// ====================================================================================================
+static struct shmRing *_map( int fd, size_t len, const char *name )
+
+/* Map len of the shared memory object fd into a ring */
+
+{
+    struct shmRing *r = ( struct shmRing * )calloc( 1, sizeof( struct shmRing ) );
+    MEMCHECK( r, NULL );
+
+    r->mapLen = len;
+    r->h = ( struct shmRingHeader * )mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if ( r->h == MAP_FAILED )
+    {
+        genericsReport( V_ERROR, "Could not map shared memory %s (%s)" EOL, name, strerror( errno ) );
+        free( r );
+        return NULL;
+    }
+
+    r->d = ( uint8_t * )r->h + SHMRING_HDR_LEN;
+    return r;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct shmRing *shmRingCreate( const char *name, size_t size )
+
+/* Create named ring for writing, with size rounded up to a power of two */
+
+{
+    struct shmRing *r;
+    size_t s = 4096;
+    int fd;
+
+    assert( name );
+
+    while ( s < size )
+    {
+        s <<= 1;
+    }
+
+    /* Anything left from a previous run is of no use to anyone */
+    shm_unlink( name );
+
+    if ( ( ( fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) ) < 0 ) ||
+            ( ftruncate( fd, SHMRING_HDR_LEN + s ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Could not create shared memory %s (%s)" EOL, name, strerror( errno ) );
+
+        if ( fd >= 0 )
+        {
+            close( fd );
+            shm_unlink( name );
+        }
+
+        return NULL;
+    }
+
+    if ( !( r = _map( fd, SHMRING_HDR_LEN + s, name ) ) )
+    {
+        shm_unlink( name );
+        return NULL;
+    }
+
+    r->name = strdup( name );
+    MEMCHECK( r->name, NULL );
+
+    r->h->version = SHMRING_VERSION;
+    r->h->size    = s;
+    r->h->pid     = getpid();
+    atomic_store( &r->h->magic, SHMRING_MAGIC );
+    return r;
+}
+// ====================================================================================================
+void shmRingWrite( struct shmRing *r, const void *d, size_t len )
+
+/* Publish data to all readers. If there's more than will fit then only the end of it is kept */
+
+{
+    const uint8_t *s = ( const uint8_t * )d;
+    uint64_t wp = atomic_load_explicit( &r->h->wp, memory_order_relaxed );
+    uint64_t end = wp + len;
+    size_t ofs, first;
+
+    assert( r->name );
+
+    if ( len > r->h->size )
+    {
+        s  += len - r->h->size;
+        wp += len - r->h->size;
+        len = r->h->size;
+    }
+
+    /* Say what we're about to overwrite before we start on it, for anyone reading it right now */
+    atomic_store_explicit( &r->h->reserve, end, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+
+    ofs   = wp & ( r->h->size - 1 );
+    first = ( len < r->h->size - ofs ) ? len : r->h->size - ofs;
+    memcpy( &r->d[ofs], s, first );
+    memcpy( r->d, &s[first], len - first );
+
+    /* Publish it, then see if anyone needs waking up to go read it */
+    atomic_store_explicit( &r->h->wp, end, memory_order_release );
+
+    if ( atomic_load( &r->h->waiters ) )
+    {
+        atomic_fetch_add( &r->h->wake, 1 );
+#if defined( LINUX )
+        syscall( SYS_futex, &r->h->wake, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0 );
+#endif
+    }
+}
+// ====================================================================================================
+struct shmRing *shmRingOpen( const char *name )
+
+/* Attach to named ring for reading, starting with what's written next */
+
+{
+    struct shmRingHeader h;
+    struct shmRing *r;
+    int fd;
+
+    assert( name );
+
+    if ( ( fd = shm_open( name, O_RDWR, 0 ) ) < 0 )
+    {
+        return NULL;
+    }
+
+    /* Take a look at the header to find out how big it is, and if it's ready for use */
+    if ( ( pread( fd, &h, sizeof( h ), 0 ) != sizeof( h ) ) || ( h.magic != SHMRING_MAGIC ) || ( h.version != SHMRING_VERSION ) )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    if ( !( r = _map( fd, SHMRING_HDR_LEN + h.size, name ) ) )
+    {
+        return NULL;
+    }
+
+    r->rp = atomic_load( &r->h->wp );
+    return r;
+}
+// ====================================================================================================
+size_t shmRingRead( struct shmRing *r, void *d, size_t len, int timeoutMs, uint64_t *lost )
+
+/* Read whatever is waiting, up to len, waiting up to timeoutMs if there's nothing. Anything that */
+/* was overwritten before we read it is added to lost.                                            */
+
+{
+    uint8_t *o = ( uint8_t * )d;
+    uint64_t ignored = 0;
+    size_t n, ofs, first, drop;
+
+    assert( !r->name );
+    lost = ( lost ) ? lost : &ignored;
+
+    if ( !( n = _waiting( r, timeoutMs, lost ) ) )
+    {
+        return 0;
+    }
+
+    n     = ( n < len ) ? n : len;
+    ofs   = r->rp & ( r->h->size - 1 );
+    first = ( n < r->h->size - ofs ) ? n : r->h->size - ofs;
+    memcpy( o, &r->d[ofs], first );
+    memcpy( &o[first], r->d, n - first );
+
+    /* The writer may have lapped us while we were copying, in which case the start of it is bad */
+    if ( ( drop = shmRingConsume( r, n ) ) )
+    {
+        memmove( o, &o[drop], n - drop );
+        *lost += drop;
+        n -= drop;
+    }
+
+    return n;
+}
+// ====================================================================================================
+size_t shmRingPeek( struct shmRing *r, const void **d, size_t len, int timeoutMs, uint64_t *lost )
+
+/* As shmRingRead, but pointing d at the data where it is in the ring rather than copying it out. */
+/* There's no wrapping around the end of the ring, so this might be less than there is to read.  */
+
+{
+    uint64_t ignored = 0;
+    size_t n, ofs;
+
+    assert( !r->name );
+    lost = ( lost ) ? lost : &ignored;
+
+    if ( !( n = _waiting( r, timeoutMs, lost ) ) )
+    {
+        return 0;
+    }
+
+    ofs = r->rp & ( r->h->size - 1 );
+    n   = ( n < len ) ? n : len;
+    n   = ( n < r->h->size - ofs ) ? n : r->h->size - ofs;
+    *d  = &r->d[ofs];
+    return n;
+}
+// ====================================================================================================
+size_t shmRingConsume( struct shmRing *r, size_t len )
+
+/* Move on past len bytes, returning how many of them (from the start) the writer got to first. That's */
+/* measured against the reserve, so it includes anything the writer was part way through overwriting.  */
+
+{
+    uint64_t reserve, drop = 0;
+
+    atomic_thread_fence( memory_order_acquire );
+    reserve = atomic_load_explicit( &r->h->reserve, memory_order_relaxed );
+
+    if ( reserve - r->rp > r->h->size )
+    {
+        drop = reserve - r->h->size - r->rp;
+        drop = ( drop < len ) ? drop : len;
+    }
+
+    r->rp += len;
+    return drop;
+}
+// ====================================================================================================
+size_t shmRingHeadroom( struct shmRing *r )
+
+/* How much more the writer can write (or already is writing) before it starts on what's at our read position */
+
+{
+    uint64_t reserve = atomic_load_explicit( &r->h->reserve, memory_order_acquire );
+
+    return ( reserve - r->rp < r->h->size ) ? r->h->size - ( reserve - r->rp ) : 0;
+}
+// ====================================================================================================
+bool shmRingWriterGone( struct shmRing *r )
+
+/* Check if the writer has finished, or died without saying so */
+
+{
+    return ( atomic_load( &r->h->closed ) ) || ( ( kill( r->h->pid, 0 ) < 0 ) && ( errno == ESRCH ) );
+}
+// ====================================================================================================
+void shmRingClose( struct shmRing *r )
+
+/* Detach from ring, removing it if we created it */
+
+{
+    if ( !r )
+    {
+        return;
+    }
+
+    if ( r->name )
+    {
+        /* Tell the readers, and remove the name so no new ones can find it...existing ones keep their mapping */
+        atomic_store( &r->h->closed, 1 );
+        atomic_fetch_add( &r->h->wake, 1 );
+#if defined( LINUX )
+        syscall( SYS_futex, &r->h->wake, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0 );
+#endif
+        shm_unlink( r->name );
+        free( r->name );
+    }
+
+    munmap( r->h, r->mapLen );
+    free( r );
+}
+// ====================================================================================================
@@ -0,0 +1,423 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * SIMD Kernel Dispatch
+ * ====================
+ *
+ * x86 kernels are built with target attributes rather than -m flags, so only the kernel itself
+ * is compiled for the wider instruction set and nothing gets run that the CPU can't handle.
+ */
+
+#include <string.h>
+#include "simd.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+    #define SIMD_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #define SIMD_ARM64
+    #include <arm_neon.h>
+#endif
+
+#define FRAME_LEN (16)
+
+static const char *_levelName[SIMD_NUM_LEVELS] = { "scalar", "sse4.2", "avx2", "neon" };
+
+/* Level to drop back to when one isn't available */
+static const enum SIMDLevel _fallback[SIMD_NUM_LEVELS] = { SIMD_SCALAR, SIMD_SCALAR, SIMD_SSE42, SIMD_SCALAR };
+
+static const struct SIMDKernels *_k;
+static enum SIMDLevel _level;
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Kernels
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static int _cleanFramesScalar( const uint8_t *p, int n, uint8_t c )
+
+{
+    int i;
+
+    for ( i = 0; ( i < n ) && ( !memchr( p, c, FRAME_LEN ) ); i++ )
+    {
+        p += FRAME_LEN;
+    }
+
+    return i;
+}
+// ====================================================================================================
+static void _packBitsScalar( const uint8_t *p, int n, unsigned int b, uint64_t *w )
+
+/* Eight bytes at a time, with the multiply gathering bit 8i of x into bit i of its top byte */
+
+{
+    uint64_t x, v;
+
+    while ( n-- )
+    {
+        v = 0;
+
+        for ( int i = 0; i < 8; i++ )
+        {
+            memcpy( &x, p, sizeof( x ) );
+            x = ( x >> b ) & 0x0101010101010101ULL;
+            v |= ( ( x * 0x0102040810204080ULL ) >> 56 ) << ( 8 * i );
+            p += 8;
+        }
+
+        *w++ = v;
+    }
+}
+// ====================================================================================================
+static uint8_t _sumBytesScalar( const uint8_t *p, int n )
+
+/* Eight bytes at a time, in pairs into 16 bit lanes, which can take 128 words before they might carry. */
+/* Only the bottom byte of each lane matters to the sum, so they're just added up as they stand.        */
+
+{
+    const uint64_t m = 0x00ff00ff00ff00ffULL;
+    uint64_t x, acc;
+    uint8_t s = 0;
+
+    while ( n >= 8 )
+    {
+        acc = 0;
+
+        for ( int i = 0; ( i < 128 ) && ( n >= 8 ); i++ )
+        {
+            memcpy( &x, p, sizeof( x ) );
+            acc += ( x & m ) + ( ( x >> 8 ) & m );
+            p += 8;
+            n -= 8;
+        }
+
+        s += acc + ( acc >> 16 ) + ( acc >> 32 ) + ( acc >> 48 );
+    }
+
+    while ( n-- )
+    {
+        s += *p++;
+    }
+
+    return s;
+}
+// ====================================================================================================
+#ifdef SIMD_X86
+__attribute__( ( target( "sse4.2" ) ) )
+static int _cleanFramesSSE42( const uint8_t *p, int n, uint8_t c )
+
+{
+    const __m128i m = _mm_set1_epi8( c );
+    int i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( ( const __m128i * )p ), m ) ) )
+        {
+            break;
+        }
+
+        p += FRAME_LEN;
+    }
+
+    return i;
+}
+// ====================================================================================================
+__attribute__( ( target( "avx2" ) ) )
+static int _cleanFramesAVX2( const uint8_t *p, int n, uint8_t c )
+
+/* Two frames per compare, with the low half of the mask belonging to the first of them */
+
+{
+    const __m256i m = _mm256_set1_epi8( c );
+    uint32_t hits;
+    int i;
+
+    for ( i = 0; i + 1 < n; i += 2 )
+    {
+        hits = _mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_loadu_si256( ( const __m256i * )p ), m ) );
+
+        if ( hits )
+        {
+            return i + ( ( hits & 0xffff ) == 0 );
+        }
+
+        p += 2 * FRAME_LEN;
+    }
+
+    if ( ( i < n ) && ( !_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( ( const __m128i * )p ), _mm256_castsi256_si128( m ) ) ) ) )
+    {
+        i++;
+    }
+
+    return i;
+}
+// ====================================================================================================
+__attribute__( ( target( "sse4.2" ) ) )
+static void _packBitsSSE42( const uint8_t *p, int n, unsigned int b, uint64_t *w )
+
+/* Bit b of each byte is shifted up to the top, where movemask takes it from. The shift is of 16 bit */
+/* lanes, but nothing crosses into the top bit of either byte from the other.                       */
+
+{
+    const __m128i s = _mm_cvtsi32_si128( 7 - b );
+    uint64_t v;
+
+    while ( n-- )
+    {
+        v = 0;
+
+        for ( int i = 0; i < 4; i++ )
+        {
+            v |= ( uint64_t )( uint16_t )_mm_movemask_epi8( _mm_sll_epi16( _mm_loadu_si128( ( const __m128i * )p ), s ) ) << ( 16 * i );
+            p += 16;
+        }
+
+        *w++ = v;
+    }
+}
+// ====================================================================================================
+__attribute__( ( target( "avx2" ) ) )
+static void _packBitsAVX2( const uint8_t *p, int n, unsigned int b, uint64_t *w )
+
+{
+    const __m128i s = _mm_cvtsi32_si128( 7 - b );
+    uint32_t lo, hi;
+
+    while ( n-- )
+    {
+        lo = _mm256_movemask_epi8( _mm256_sll_epi16( _mm256_loadu_si256( ( const __m256i * )p ), s ) );
+        hi = _mm256_movemask_epi8( _mm256_sll_epi16( _mm256_loadu_si256( ( const __m256i * )( p + 32 ) ), s ) );
+        *w++ = ( ( uint64_t )hi << 32 ) | lo;
+        p += 64;
+    }
+}
+// ====================================================================================================
+__attribute__( ( target( "sse4.2" ) ) )
+static uint8_t _sumBytesSSE42( const uint8_t *p, int n )
+
+/* psadbw against zero adds up each eight bytes into a 64 bit lane */
+
+{
+    const __m128i z = _mm_setzero_si128();
+    __m128i acc = z;
+    uint8_t s;
+
+    for ( ; n >= 16; n -= 16, p += 16 )
+    {
+        acc = _mm_add_epi64( acc, _mm_sad_epu8( _mm_loadu_si128( ( const __m128i * )p ), z ) );
+    }
+
+    s = _mm_cvtsi128_si32( _mm_add_epi64( acc, _mm_srli_si128( acc, 8 ) ) );
+
+    while ( n-- )
+    {
+        s += *p++;
+    }
+
+    return s;
+}
+// ====================================================================================================
+__attribute__( ( target( "avx2" ) ) )
+static uint8_t _sumBytesAVX2( const uint8_t *p, int n )
+
+{
+    const __m256i z = _mm256_setzero_si256();
+    __m256i acc = z;
+    __m128i a;
+    uint8_t s;
+
+    for ( ; n >= 32; n -= 32, p += 32 )
+    {
+        acc = _mm256_add_epi64( acc, _mm256_sad_epu8( _mm256_loadu_si256( ( const __m256i * )p ), z ) );
+    }
+
+    a = _mm_add_epi64( _mm256_castsi256_si128( acc ), _mm256_extracti128_si256( acc, 1 ) );
+
+    if ( n >= 16 )
+    {
+        a = _mm_add_epi64( a, _mm_sad_epu8( _mm_loadu_si128( ( const __m128i * )p ), _mm256_castsi256_si128( z ) ) );
+        n -= 16;
+        p += 16;
+    }
+
+    s = _mm_cvtsi128_si32( _mm_add_epi64( a, _mm_srli_si128( a, 8 ) ) );
+
+    while ( n-- )
+    {
+        s += *p++;
+    }
+
+    return s;
+}
+#endif
+// ====================================================================================================
+#ifdef SIMD_ARM64
+static int _cleanFramesNEON( const uint8_t *p, int n, uint8_t c )
+
+{
+    const uint8x16_t m = vdupq_n_u8( c );
+    int i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( vmaxvq_u8( vceqq_u8( vld1q_u8( p ), m ) ) )
+        {
+            break;
+        }
+
+        p += FRAME_LEN;
+    }
+
+    return i;
+}
+// ====================================================================================================
+static void _packBitsNEON( const uint8_t *p, int n, unsigned int b, uint64_t *w )
+
+/* Bit b of each byte is brought down to the bottom and weighted by its place, then each half adds up to a byte */
+
+{
+    static const uint8_t weight[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t wt = vld1q_u8( weight );
+    const int8x16_t s = vdupq_n_s8( -( int8_t )b );
+    const uint8x16_t one = vdupq_n_u8( 1 );
+    uint8x16_t x;
+    uint64_t v;
+
+    while ( n-- )
+    {
+        v = 0;
+
+        for ( int i = 0; i < 4; i++ )
+        {
+            x = vmulq_u8( vandq_u8( vshlq_u8( vld1q_u8( p ), s ), one ), wt );
+            v |= ( ( uint64_t )vaddv_u8( vget_low_u8( x ) ) | ( ( uint64_t )vaddv_u8( vget_high_u8( x ) ) << 8 ) ) << ( 16 * i );
+            p += 16;
+        }
+
+        *w++ = v;
+    }
+}
+// ====================================================================================================
+static uint8_t _sumBytesNEON( const uint8_t *p, int n )
+
+{
+    uint32_t s = 0;
+
+    for ( ; n >= 16; n -= 16, p += 16 )
+    {
+        s += vaddlvq_u8( vld1q_u8( p ) );
+    }
+
+    while ( n-- )
+    {
+        s += *p++;
+    }
+
+    return s;
+}
+#endif
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Dispatch
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static const struct SIMDKernels _kernels[SIMD_NUM_LEVELS] =
+{
+    [SIMD_SCALAR] = { .cleanFrames = _cleanFramesScalar, .packBits = _packBitsScalar, .sumBytes = _sumBytesScalar },
+#ifdef SIMD_X86
+    [SIMD_SSE42]  = { .cleanFrames = _cleanFramesSSE42, .packBits = _packBitsSSE42, .sumBytes = _sumBytesSSE42 },
+    [SIMD_AVX2]   = { .cleanFrames = _cleanFramesAVX2, .packBits = _packBitsAVX2, .sumBytes = _sumBytesAVX2 },
+#endif
+#ifdef SIMD_ARM64
+    [SIMD_NEON]   = { .cleanFrames = _cleanFramesNEON, .packBits = _packBitsNEON, .sumBytes = _sumBytesNEON },
+#endif
+};
+// ====================================================================================================
+bool SIMDSupported( enum SIMDLevel l )
+
+{
+    switch ( l )
+    {
+        case SIMD_SCALAR:
+            return true;
+
+#ifdef SIMD_X86
+
+        case SIMD_SSE42:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports( "sse4.2" );
+
+        case SIMD_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports( "avx2" );
+#endif
+#ifdef SIMD_ARM64
+
+        case SIMD_NEON:
+            /* Always there on 64 bit ARM */
+            return true;
+#endif
+
+        default:
+            return false;
+    }
+}
+// ====================================================================================================
+bool SIMDSetLevel( enum SIMDLevel l )
+
+{
+    if ( ( l >= SIMD_NUM_LEVELS ) || ( !SIMDSupported( l ) ) )
+    {
+        return false;
+    }
+
+    _level = l;
+    _k = &_kernels[l];
+    return true;
+}
+// ====================================================================================================
+const struct SIMDKernels *SIMDKernels( void )
+
+/* Choose the kernels on first use. Racing threads will all choose the same ones, so no harm done */
+
+{
+    if ( !_k )
+    {
+#ifdef SIMD_FORCE_LEVEL
+        enum SIMDLevel l = SIMD_FORCE_LEVEL;
+#elif defined(SIMD_ARM64)
+        enum SIMDLevel l = SIMD_NEON;
+#else
+        enum SIMDLevel l = SIMD_AVX2;
+#endif
+
+        while ( !SIMDSupported( l ) )
+        {
+            l = _fallback[l];
+        }
+
+        SIMDSetLevel( l );
+    }
+
+    return _k;
+}
+// ====================================================================================================
+enum SIMDLevel SIMDGetLevel( void )
+
+{
+    SIMDKernels();
+    return _level;
+}
+// ====================================================================================================
+const char *SIMDLevelName( enum SIMDLevel l )
+
+{
+    return ( l < SIMD_NUM_LEVELS ) ? _levelName[l] : "unknown";
+}
+// ====================================================================================================
@@ -20,6 +20,7 @@
 
 #include "generics.h"
 #include "sio.h"
+#include "memAccount.h"
 
 /* Colours for output */
 enum CP
@@ -52,6 +53,13 @@ enum SRCH { SRCH_OFF, SRCH_FORWARDS, SRCH_BACKWARDS };
 /* Display modes */
 enum DISP { DISP_BOTH, DISP_SRC, DISP_ASSY, DISP_MAX_OPTIONS };
 
+/* What's on a row of the output window, when it isn't a line number */
+#define ROW_EMPTY           (-1)
+#define ROW_DIRTY           (-2)
+
+#define SEARCH_SLICE_MS     (20)        /* Longest a search runs for before giving the UI a look in */
+#define SEARCH_CHECK_LINES  (1024)      /* ...and how often we look at the clock while searching */
+
 struct SIOInstance
 {
     /* Materials for window handling */
@@ -60,6 +68,9 @@ struct SIOInstance
     int32_t lines;                      /* Number of lines on current window config */
     int32_t cols;                       /* Number of columns on current window config */
     bool forceRefresh;                  /* Force a refresh of everything */
+    int32_t *shownLine;                 /* Line that's on each row of the output window */
+    int32_t *wantLine;                  /* ...and which should be */
+    int32_t shownRows;                  /* Number of rows those are for */
     int Key;                            /* Latest keypress */
 
     /* Tagging */
@@ -71,16 +82,23 @@ struct SIOInstance
     char storedFirstSearch;             /* Storage for first char of search string to allow repeats */
     int32_t searchStartPos;             /* Location the search started from (for aborts) */
     bool searchOK;                      /* Is the search currently sucessful? */
+    bool searchPending;                 /* Is a search still in progress? */
+    int32_t searchPos;                  /* ...and if so, the next line it's to look at */
 
     /* Save stuff */
     char *saveFilename;                 /* Filename under construction */
 
+    /* Goto stuff */
+    char *gotoText;                     /* Address (or #exception) under construction */
+
     /* Warning and info messages */
     char *warnText;                     /* Text of the warning message */
     uint32_t warnTimeout;               /* Time at which it should be removed, or 0 if it's not active */
 
     /* Current position in buffer */
     struct sioline **opText;            /* Pointer to lines of Text of the output buffer */
+    SIOlineFetch fetch;                 /* ...or where to get them from, if they're not in an array */
+    void *fetchCtx;                     /* ...and the context to pass it */
     int32_t opTextWline;                /* Next line number to be written */
     int32_t opTextRline;                /* Current read position in op buffer */
     int32_t oldopTextRline;             /* Old read position in op buffer (for redraw) */
@@ -92,6 +110,7 @@ struct SIOInstance
     /* UI State information */
     bool held;
     bool enteringSaveFilename;          /* State indicator that we're entering filename */
+    bool enteringGoto;                  /* ...or somewhere to go */
     bool amDiving;                      /* Indicator that we're in a diving buffer */
     bool outputtingHelp;                /* Output help window */
     bool enteringMark;                  /* Set if we are in the process of marking a location */
@@ -127,7 +146,17 @@ static void _deleteTags( struct SIOInstance *sio )
     }
 }
 // ====================================================================================================
-static enum SIOEvent _processSaveFilename( struct SIOInstance *sio )
+static struct sioline *_line( struct SIOInstance *sio, int32_t lineNum )
+
+/* Return a line of the output buffer...this is only valid until the next one is asked for */
+
+{
+    return ( sio->fetch ) ? sio->fetch( sio->fetchCtx, lineNum ) : &( *sio->opText )[lineNum];
+}
+// ====================================================================================================
+static enum SIOEvent _processEntry( struct SIOInstance *sio, char **text, bool *entering, enum SIOEvent commit )
+
+/* Handle keys while a line of text (a filename to save to, or somewhere to go) is being entered */
 
 {
     enum SIOEvent op = SIO_EV_NONE;
@@ -139,35 +168,34 @@ static enum SIOEvent _processSaveFilename( struct SIOInstance *sio )
             break;
 
         case 3: /* ------------------------------ CTRL-C Exit ------------------------------------ */
-            sio->enteringSaveFilename = false;
+            *entering = false;
             curs_set( 0 );
             op = SIO_EV_CONSUMED;
             break;
 
-        case 263: /* --------------------------- Del Remove char from save string ----------------- */
+        case 263: /* --------------------------- Del Remove char from the text ------------------- */
 
-            /* Delete last character in save string */
-            if ( strlen( sio->saveFilename ) )
+            /* Delete last character in the text */
+            if ( strlen( *text ) )
             {
-                sio->saveFilename[strlen( sio->saveFilename ) - 1] = 0;
+                ( *text )[strlen( *text ) - 1] = 0;
             }
 
             op = SIO_EV_CONSUMED;
             break;
 
-        case 10: /* ----------------------------- Newline Commit Save ---------------------------- */
-            /* Commit the save */
+        case 10: /* ----------------------------- Newline Commit -------------------------------- */
             curs_set( 0 );
-            sio->enteringSaveFilename = false;
-            op = SIO_EV_SAVE;
+            *entering = false;
+            op = commit;
             break;
 
-        default: /* ---------------------------- Add valid chars to save string ------------------ */
+        default: /* ---------------------------- Add valid chars to the text -------------------- */
             if ( ( sio->Key > 31 ) && ( sio->Key < 255 ) )
             {
-                sio->saveFilename = ( char * )realloc( sio->saveFilename, strlen( sio->saveFilename ) + 2 );
-                sio->saveFilename[strlen( sio->saveFilename ) + 1] = 0;
-                sio->saveFilename[strlen( sio->saveFilename )] = sio->Key;
+                *text = ( char * )realloc( *text, strlen( *text ) + 2 );
+                ( *text )[strlen( *text ) + 1] = 0;
+                ( *text )[strlen( *text )] = sio->Key;
                 op = SIO_EV_CONSUMED;
             }
 
@@ -201,6 +229,9 @@ static void _outputHelp( struct SIOInstance *sio )
     wprintw( sio->outputWindow, "  CTRL-F: Search forwards, CTRL-F again for next match" EOL );
     wprintw( sio->outputWindow, "       p: Step backwards through execution history of current window" EOL );
     wprintw( sio->outputWindow, "       n: Step forwards through execution history of current window" EOL );
+    wprintw( sio->outputWindow, "     o/O: Next/previous time the function, line, instruction or exception under the cursor turns up" EOL );
+    wprintw( sio->outputWindow, "     f/F: Next/previous entry to the function the cursor is in" EOL );
+    wprintw( sio->outputWindow, "       G: Go to the next execution of an address, or entry to #exception" EOL );
     wprintw( sio->outputWindow, EOL "  Use PgUp/PgDown/Home/End and the arrow keys to move around the sample buffer" EOL );
     wprintw( sio->outputWindow, "  Shift-PgUp and Shift-PgDown move more quickly" EOL );
     wprintw( sio->outputWindow, EOL "       <?> again to leave this help screen." EOL );
@@ -211,19 +242,21 @@ static bool _onDisplay( struct SIOInstance *sio, int32_t lineNum )
 /* Return true if this lineNum is currently to be displayed, according to the set filter criteria */
 
 {
+    enum LineType lt = _line( sio, lineNum )->lt;
+
     return !(
                        /* Debug line and not in debug mode */
-                       ( ( ( *sio->opText )[lineNum].lt == LT_DEBUG ) && ( !sio->outputDebug ) ) ||
+                       ( ( lt == LT_DEBUG ) && ( !sio->outputDebug ) ) ||
 
                        /* Label or Assembly line and in Source Mode */
                        ( ( sio->displayMode == DISP_SRC )  &&
-                         ( ( ( *sio->opText )[lineNum].lt == LT_LABEL ) ||
-                           ( ( *sio->opText )[lineNum].lt == LT_ASSEMBLY ) ||
-                           ( ( *sio->opText )[lineNum].lt == LT_NASSEMBLY ) ) ) ||
+                         ( ( lt == LT_LABEL ) ||
+                           ( lt == LT_ASSEMBLY ) ||
+                           ( lt == LT_NASSEMBLY ) ) ) ||
 
                        /* Source Line and in Assembly Mode */
                        ( ( sio->displayMode == DISP_ASSY ) &&
-                         ( ( *sio->opText )[lineNum].lt == LT_SOURCE ) )
+                         ( lt == LT_SOURCE ) )
            );
 }
 // ====================================================================================================
@@ -323,6 +356,23 @@ static enum SIOEvent _processRegularKeys( struct SIOInstance *sio )
             op = SIO_EV_CONSUMED;
             break;
 
+        case 'g':
+        case 'G': /* ---------------------------- Enter goto address ----------------------------- */
+            if ( ( sio->opTextWline ) && ( !sio->amDiving ) )
+            {
+                sio->gotoText = ( char * )realloc( sio->gotoText, 1 );
+                *sio->gotoText = 0;
+                curs_set( 1 );
+                sio->enteringGoto = true;
+            }
+            else
+            {
+                SIObeep();
+            }
+
+            op = SIO_EV_CONSUMED;
+            break;
+
         case '0' ... '0'+MAX_TAGS: /* ----------- Tagged Location -------------------------------- */
             if ( sio->amDiving )
             {
@@ -402,28 +452,69 @@ static enum SIOEvent _processRegularKeys( struct SIOInstance *sio )
     return op;
 }
 // ====================================================================================================
-static bool _updateSearch( struct SIOInstance *sio )
+static void _continueSearch( struct SIOInstance *sio )
 
-/* Progress search to next element, or ping and return false if we can't */
+/* Carry on with a search for a while, leaving it pending if it's taking too long, so typing isn't held up */
 
 {
-    for ( int32_t l = sio->opTextRline;
-            ( sio->searchMode == SRCH_FORWARDS ) ? ( l < sio->opTextWline - 1 ) : ( l > 0 );
-            ( sio->searchMode == SRCH_FORWARDS ) ? l++ : l-- )
+    uint32_t endTime = genericsTimestampmS() + SEARCH_SLICE_MS;
+    int32_t checkCount = 0;
+    int32_t l = sio->searchPos;
+
+    while ( ( sio->searchMode == SRCH_FORWARDS ) ? ( l < sio->opTextWline - 1 ) : ( l > 0 ) )
     {
-        if ( ( ( *sio->opText )[l].buffer ) && strstr( ( *sio->opText )[l].buffer, sio->searchString ) )
+        if ( ( _line( sio, l )->buffer ) && strstr( _line( sio, l )->buffer, sio->searchString ) )
         {
             /* This is a match */
             sio->opTextRline = l;
             sio->searchOK = true;
-            return true;
+            sio->searchPending = false;
+            return;
+        }
+
+        ( sio->searchMode == SRCH_FORWARDS ) ? l++ : l--;
+
+        if ( ++checkCount == SEARCH_CHECK_LINES )
+        {
+            checkCount = 0;
+
+            if ( genericsTimestampmS() > endTime )
+            {
+                sio->searchPos = l;
+                return;
+            }
         }
     }
 
     /* If we get here then we had no match */
     SIObeep();
     sio->searchOK = false;
-    return false;
+    sio->searchPending = false;
+    SIOrequestRefresh( sio );
+}
+// ====================================================================================================
+static void _updateSearch( struct SIOInstance *sio, bool extended )
+
+/* Progress search to next element, or ping if we can't. When the search string has only been extended */
+/* nothing already passed over can match it, so just carry on from wherever we'd got to.               */
+
+{
+    if ( extended && sio->searchPending )
+    {
+        _continueSearch( sio );
+        return;
+    }
+
+    if ( extended && !sio->searchOK )
+    {
+        /* Nothing matched the shorter string, so nothing will match this one */
+        SIObeep();
+        return;
+    }
+
+    sio->searchPos = sio->opTextRline;
+    sio->searchPending = true;
+    _continueSearch( sio );
 }
 // ====================================================================================================
 static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
@@ -442,6 +533,7 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
         case 10: /* ----------------------------- Newline Commit Search -------------------------- */
             /* Commit the search */
             sio->searchMode = SRCH_OFF;
+            sio->searchPending = false;
             curs_set( 0 );
             sio->storedFirstSearch = *sio->searchString;
             *sio->searchString = 0;
@@ -452,6 +544,7 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
         case 3: /* ------------------------------ CTRL-C Abort Search ---------------------------- */
             /* Abort the search */
             sio->searchMode = SRCH_OFF;
+            sio->searchPending = false;
             sio->opTextRline = sio->searchStartPos;
             sio->storedFirstSearch = *sio->searchString;
             *sio->searchString = 0;
@@ -470,12 +563,12 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
             sio->searchMode = SRCH_FORWARDS;
 
             /* Find next match */
-            if ( ( sio->searchOK ) && ( sio->opTextRline < sio->opTextWline - 1 ) )
+            if ( ( sio->searchOK ) && ( !sio->searchPending ) && ( sio->opTextRline < sio->opTextWline - 1 ) )
             {
                 sio->opTextRline++;
             }
 
-            _updateSearch( sio );
+            _updateSearch( sio, false );
             SIOrequestRefresh( sio );
             op = SIO_EV_CONSUMED;
             break;
@@ -490,12 +583,12 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
             /* Find prev match */
             sio->searchMode = SRCH_BACKWARDS;
 
-            if ( ( sio->searchOK ) && ( sio->opTextRline > 0 ) )
+            if ( ( sio->searchOK ) && ( !sio->searchPending ) && ( sio->opTextRline > 0 ) )
             {
                 sio->opTextRline--;
             }
 
-            _updateSearch( sio );
+            _updateSearch( sio, false );
             SIOrequestRefresh( sio );
             op = SIO_EV_CONSUMED;
             break;
@@ -508,7 +601,7 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
                 sio->searchString[strlen( sio->searchString ) - 1] = 0;
             }
 
-            _updateSearch( sio );
+            _updateSearch( sio, false );
             SIOrequestRefresh( sio );
             op = SIO_EV_CONSUMED;
             break;
@@ -516,10 +609,10 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
         default: /* ---------------------------- Add valid chars to search string ---------------- */
             if ( ( sio->Key > 31 ) && ( sio->Key < 255 ) )
             {
-                sio->searchString = ( char * )realloc( sio->searchString, strlen( sio->searchString ) + 1 );
+                sio->searchString = ( char * )realloc( sio->searchString, strlen( sio->searchString ) + 2 );
                 sio->searchString[strlen( sio->searchString ) + 1] = 0;
                 sio->searchString[strlen( sio->searchString )] = sio->Key;
-                _updateSearch( sio );
+                _updateSearch( sio, true );
                 SIOrequestRefresh( sio );
                 op = SIO_EV_CONSUMED;
             }
@@ -538,6 +631,7 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
     short pair;
     char *ssp;                  /* Position in search match string */
     char *u;
+    struct sioline *l;          /* The line being displayed */
 
     /* Make sure this line is valid */
     if ( ( lineNum < 0 ) || ( lineNum >= sio->opTextWline ) )
@@ -551,12 +645,13 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
         return false;
     }
 
-    u = ( *sio->opText )[lineNum].buffer;
+    l = _line( sio, lineNum );
+    u = l->buffer;
     ssp = sio->searchString;
 
     wmove( sio->outputWindow, screenline, 0 );
 
-    switch ( ( *sio->opText )[lineNum].lt )
+    switch ( l->lt )
     {
         case LT_EVENT:
             wattrset( sio->outputWindow, ( highlight ? A_STANDOUT : 0 ) | A_BOLD | COLOR_PAIR( CP_EVENT ) );
@@ -569,7 +664,7 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
         case LT_MU_SOURCE:
         case LT_SOURCE:
             wattrset( sio->outputWindow, ( highlight ? A_STANDOUT : 0 ) | COLOR_PAIR( CP_LINENO ) );
-            wprintw( sio->outputWindow, "%5d ", ( *sio->opText )[lineNum].line );
+            wprintw( sio->outputWindow, "%5d ", l->line );
             wattrset( sio->outputWindow, ( highlight ? A_STANDOUT : 0 ) | A_BOLD | COLOR_PAIR( CP_NORMAL ) );
             break;
 
@@ -674,33 +769,120 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
 // ====================================================================================================
 static void _outputOutput( struct SIOInstance *sio )
 
+/* Bring the output window up to date. Rows are only repainted when what's on them has changed, and */
+/* when the view has just moved what's still visible is scrolled into place rather than redrawn.     */
+
 {
-    werase( sio->outputWindow );
-    int32_t cp, cl;
+    int32_t rows = OUTPUT_WINDOW_L;
+    int32_t centre = rows / 2;
+    int32_t cp, cl, k;
+
+    if ( rows <= 0 )
+    {
+        return;
+    }
+
+    if ( rows != sio->shownRows )
+    {
+        sio->shownLine = ( int32_t * )realloc( sio->shownLine, 2 * rows * sizeof( int32_t ) );
+        MEMCHECKV( sio->shownLine );
+        sio->wantLine = &sio->shownLine[rows];
+        sio->shownRows = rows;
+        sio->forceRefresh = true;
+    }
 
+    int32_t *shown = sio->shownLine;
+    int32_t *want  = sio->wantLine;
+
+    if ( sio->forceRefresh )
+    {
+        for ( cl = 0; cl < rows; cl++ )
+        {
+            shown[cl] = ROW_DIRTY;
+        }
+    }
+
+    /* Work out which line should be on each row...first, going forwards from current position */
+    for ( cl = 0; cl < rows; cl++ )
+    {
+        want[cl] = ROW_EMPTY;
+    }
 
-    /* First, output lines _forward_ from current position */
     cp = sio->opTextRline;
-    cl = ( OUTPUT_WINDOW_L / 2 );
+    cl = centre;
 
-    /* Firstly go forwards filling in each line of the screen */
-    while ( ( cl < OUTPUT_WINDOW_L ) && ( cp < sio->opTextWline ) )
+    while ( ( cl < rows ) && ( cp < sio->opTextWline ) )
     {
-        if ( _displayLine( sio, cp++, cl, ( cl == ( OUTPUT_WINDOW_L / 2 ) ) ) )
+        if ( _onDisplay( sio, cp ) )
         {
-            cl++;
+            want[cl++] = cp;
         }
+
+        cp++;
     }
 
     /* Now go backwards doing likewise */
     cp = sio->opTextRline - 1;
-    cl = ( OUTPUT_WINDOW_L / 2 ) - 1;
+    cl = centre - 1;
 
     while ( ( cl >= 0 ) && ( cp >= 0 ) )
     {
-        if ( _displayLine( sio, cp--, cl, false ) )
+        if ( _onDisplay( sio, cp ) )
+        {
+            want[cl--] = cp;
+        }
+
+        cp--;
+    }
+
+    /* If the new current line is already on screen somewhere, scroll it to the centre */
+    for ( k = 0; ( want[centre] >= 0 ) && ( k < rows ) && ( shown[k] != want[centre] ); k++ );
+
+    if ( ( want[centre] >= 0 ) && ( k < rows ) && ( k != centre ) )
+    {
+        k -= centre;
+        scrollok( sio->outputWindow, true );
+        wscrl( sio->outputWindow, k );
+        scrollok( sio->outputWindow, false );
+
+        if ( k > 0 )
+        {
+            for ( cl = 0; cl < rows; cl++ )
+            {
+                shown[cl] = ( cl + k < rows ) ? shown[cl + k] : ROW_DIRTY;
+            }
+        }
+        else
+        {
+            for ( cl = rows - 1; cl >= 0; cl-- )
+            {
+                shown[cl] = ( cl + k >= 0 ) ? shown[cl + k] : ROW_DIRTY;
+            }
+        }
+
+        /* The highlight has to move, from wherever the old current line went to, onto the new one */
+        if ( ( centre - k >= 0 ) && ( centre - k < rows ) )
+        {
+            shown[centre - k] = ROW_DIRTY;
+        }
+
+        shown[centre] = ROW_DIRTY;
+    }
+
+    /* ...and finally paint whatever is different */
+    for ( cl = 0; cl < rows; cl++ )
+    {
+        if ( shown[cl] != want[cl] )
         {
-            cl--;
+            wmove( sio->outputWindow, cl, 0 );
+            wclrtoeol( sio->outputWindow );
+
+            if ( want[cl] != ROW_EMPTY )
+            {
+                _displayLine( sio, want[cl], cl, ( cl == centre ) );
+            }
+
+            shown[cl] = want[cl];
         }
     }
 }
@@ -708,11 +890,21 @@ static void _outputOutput( struct SIOInstance *sio )
 static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
 
 {
+    size_t nameLen = strlen( sio->progName ) + strlen( genericsBasename( sio->elffile ) );
+    uint64_t mem = memLiveTotal();
+    char memText[32];
+
     werase( sio->statusWindow );
     wattrset( sio->statusWindow, A_BOLD | COLOR_PAIR( CP_BASELINE ) );
     mvwhline( sio->statusWindow, 0, 0, ACS_HLINE, COLS );
-    mvwprintw( sio->statusWindow, 0, COLS - 4 - ( strlen( sio->progName ) + strlen( genericsBasename( sio->elffile ) ) ),
-               " %s:%s ", sio->progName, genericsBasename( sio->elffile ) );
+    mvwprintw( sio->statusWindow, 0, COLS - 4 - nameLen, " %s:%s ", sio->progName, genericsBasename( sio->elffile ) );
+
+    /* What's being held onto, so growth over a long run shows up */
+    if ( mem )
+    {
+        snprintf( memText, sizeof( memText ), " Mem %" PRIu64 "M ", ( mem + ( 1 << 19 ) ) >> 20 );
+        mvwprintw( sio->statusWindow, 0, COLS - 5 - nameLen - strlen( memText ), "%s", memText );
+    }
 
     if ( sio->warnTimeout )
     {
@@ -794,9 +986,15 @@ static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
                 if ( ( sio->tag[t] >= ( sio->opTextRline - OUTPUT_WINDOW_L / 2 ) ) &&
                         ( sio->tag[t] <= ( sio->opTextRline + ( OUTPUT_WINDOW_L + 1 ) / 2 ) ) )
                 {
-                    /* This tag is on the visible page */
+                    /* This tag is on the visible page, and that row will need repainting when it moves */
+                    int32_t row = ( OUTPUT_WINDOW_L ) / 2 + sio->tag[t] - sio->opTextRline - 1;
                     wattrset( sio->outputWindow, A_BOLD | COLOR_PAIR( CP_BASELINETEXT ) );
-                    mvwprintw( sio->outputWindow, ( OUTPUT_WINDOW_L ) / 2 + sio->tag[t] - sio->opTextRline - 1, OUTPUT_WINDOW_W - 1, "%d", t );
+                    mvwprintw( sio->outputWindow, row, OUTPUT_WINDOW_W - 1, "%d", t );
+
+                    if ( ( row >= 0 ) && ( row < sio->shownRows ) )
+                    {
+                        sio->shownLine[row] = ROW_DIRTY;
+                    }
                 }
             }
             else
@@ -820,10 +1018,16 @@ static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
         mvwprintw( sio->statusWindow, 1, 2, "Save Filename :%s", sio->saveFilename );
     }
 
+    if ( sio->enteringGoto )
+    {
+        wattrset( sio->statusWindow, A_BOLD | COLOR_PAIR( CP_SEARCH ) );
+        mvwprintw( sio->statusWindow, 1, 2, "Go to address or #exception :%s", sio->gotoText );
+    }
+
     if ( sio->searchMode )
     {
         wattrset( sio->statusWindow, A_BOLD | COLOR_PAIR( CP_SEARCH ) );
-        mvwprintw( sio->statusWindow, 1, 2, "%sSearch %s :%s", sio->searchOK ? "" : "(Failing) ", ( sio->searchMode == SRCH_FORWARDS ) ? "Forwards" : "Backwards", sio->searchString );
+        mvwprintw( sio->statusWindow, 1, 2, "%sSearch %s :%s", sio->searchPending ? "(Searching) " : sio->searchOK ? "" : "(Failing) ", ( sio->searchMode == SRCH_FORWARDS ) ? "Forwards" : "Backwards", sio->searchString );
     }
 
     if ( sio->enteringMark )
@@ -860,8 +1064,8 @@ static void _updateWindows( struct SIOInstance *sio, bool isTick, bool isKey, ui
         }
     }
 
-    /* Now update the status */
-    if ( ( isTick ) || ( isKey ) || ( sio->forceRefresh ) || ( sio->warnTimeout ) )
+    /* Now update the status, which also marks tags on the output window */
+    if ( ( isTick ) || ( isKey ) || ( sio->forceRefresh ) || ( sio->warnTimeout ) || ( refreshOutput ) )
     {
         _outputStatus( sio, oldintervalBytes );
         refreshOutput = refreshStatus = true;
@@ -936,6 +1140,7 @@ struct SIOInstance *SIOsetup( const char *progname, const char *elffile, bool is
     sio->statusWindow = newwin( STATUS_WINDOW_L, STATUS_WINDOW_W, OUTPUT_WINDOW_L, 0 );
     wtimeout( sio->statusWindow, 0 );
     scrollok( sio->outputWindow, false );
+    idlok( sio->outputWindow, true );
     keypad( sio->statusWindow, true );
 
     /* This allows CTRL-C and CTRL-S to be used in-program */
@@ -956,6 +1161,12 @@ const char *SIOgetSaveFilename( struct SIOInstance *sio )
     return sio->saveFilename;
 }
 // ====================================================================================================
+const char *SIOgetGotoText( struct SIOInstance *sio )
+
+{
+    return sio->gotoText;
+}
+// ====================================================================================================
 int32_t SIOgetCurrentLineno( struct SIOInstance *sio )
 
 {
@@ -1008,18 +1219,16 @@ void SIOrequestRefresh( struct SIOInstance *sio  )
     sio->forceRefresh = true;
 }
 // ====================================================================================================
-void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t currentLine, struct sioline **opTextSet, bool amDiving )
+static void _setOutput( struct SIOInstance *sio, int32_t numLines, int32_t currentLine, bool haveLines, bool amDiving )
 
 {
-    sio->opText      = opTextSet;
-
     /* If we're starting diving store the current cursor position, on surfacing restore it */
     if ( ( !sio->amDiving ) && ( amDiving ) )
     {
         sio->pushedopTextRline = sio->opTextRline;
     }
 
-    if ( opTextSet )
+    if ( haveLines )
     {
         sio->opTextWline = numLines;
 
@@ -1042,6 +1251,46 @@ void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t curr
     SIOrequestRefresh( sio );
 }
 // ====================================================================================================
+void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t currentLine, struct sioline **opTextSet, bool amDiving )
+
+{
+    sio->opText      = opTextSet;
+    sio->fetch       = NULL;
+    _setOutput( sio, numLines, currentLine, ( opTextSet != NULL ), amDiving );
+}
+// ====================================================================================================
+void SIOsetOutputFetch( struct SIOInstance *sio, int32_t numLines, int32_t currentLine, SIOlineFetch fetch, void *ctx )
+
+/* As SIOsetOutputBuffer, but the lines are got from fetch as they're needed */
+
+{
+    sio->opText      = NULL;
+    sio->fetch       = fetch;
+    sio->fetchCtx    = ctx;
+    _setOutput( sio, numLines, currentLine, ( fetch != NULL ), false );
+}
+// ====================================================================================================
+void SIOprependLines( struct SIOInstance *sio, int32_t n )
+
+/* More lines have become available at the start of the output buffer, so move everything along */
+
+{
+    sio->opTextWline    += n;
+    sio->opTextRline    += n;
+    sio->oldopTextRline += n;
+    sio->searchStartPos += n;
+
+    for ( uint32_t t = 0; t < MAX_TAGS; t++ )
+    {
+        if ( sio->tag[t] )
+        {
+            sio->tag[t] += n;
+        }
+    }
+
+    SIOrequestRefresh( sio );
+}
+// ====================================================================================================
 void SIOtagText ( struct SIOInstance *sio, const char *ttext )
 
 {
@@ -1073,7 +1322,11 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
     {
         if ( sio->enteringSaveFilename )
         {
-            op =  _processSaveFilename( sio );
+            op = _processEntry( sio, &sio->saveFilename, &sio->enteringSaveFilename, SIO_EV_SAVE );
+        }
+        else if ( sio->enteringGoto )
+        {
+            op = _processEntry( sio, &sio->gotoText, &sio->enteringGoto, SIO_EV_GOTO );
         }
         else
         {
@@ -1143,6 +1396,22 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
                     op = SIO_EV_NEXT;
                     break;
 
+                case 'o':
+                    op = SIO_EV_OCC_NEXT;
+                    break;
+
+                case 'O':
+                    op = SIO_EV_OCC_PREV;
+                    break;
+
+                case 'f':
+                    op = SIO_EV_FUNC_NEXT;
+                    break;
+
+                case 'F':
+                    op = SIO_EV_FUNC_PREV;
+                    break;
+
                 case 'q':
                 case 'Q':
                     op = SIO_EV_QUIT;
@@ -1154,6 +1423,12 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
         }
     }
 
+    /* Any search that's still going gets another go */
+    if ( ( sio->searchMode ) && ( sio->searchPending ) )
+    {
+        _continueSearch( sio );
+    }
+
     /* Now deal with the output windows */
     _updateWindows( sio, isTick, sio->Key != ERR, oldintervalBytes );
 
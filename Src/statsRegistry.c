@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Statistics Registry
+ * ===================
+ *
+ * Entries are kept grouped by name as they're added, each new one going after the last with the
+ * same name, so a snapshot is a straight copy under the lock.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "generics.h"
+#include "statsRegistry.h"
+
+#define REGISTRY_START_SIZE (32)
+
+struct statEntry
+{
+    char *name;
+    char *help;
+    char *labels;
+    enum statType type;
+    const orbStat *s;
+};
+
+struct statsRegistry
+{
+    pthread_mutex_t lock;
+    struct statEntry *e;
+    int n;                                         /* Entries in use */
+    int size;                                      /* ...and room for */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _freeEntry( struct statEntry *e )
+
+{
+    free( e->name );
+    free( e->help );
+    free( e->labels );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct statsRegistry *statsRegistryCreate( void )
+
+{
+    struct statsRegistry *r = ( struct statsRegistry * )calloc( 1, sizeof( struct statsRegistry ) );
+    MEMCHECK( r, NULL );
+
+    pthread_mutex_init( &r->lock, NULL );
+    return r;
+}
+// ====================================================================================================
+void statsRegistryDelete( struct statsRegistry *r )
+
+{
+    if ( !r )
+    {
+        return;
+    }
+
+    for ( int i = 0; i < r->n; i++ )
+    {
+        _freeEntry( &r->e[i] );
+    }
+
+    pthread_mutex_destroy( &r->lock );
+    free( r->e );
+    free( r );
+}
+// ====================================================================================================
+bool statsRegistryAdd( struct statsRegistry *r, const char *prefix, const char *name, const char *help,
+                       const char *labels, enum statType type, const orbStat *s )
+
+{
+    struct statEntry e = { 0 };
+    size_t len;
+    int at;
+
+    if ( ( !r ) || ( !name ) || ( !s ) )
+    {
+        return false;
+    }
+
+    len = ( ( prefix ) ? strlen( prefix ) + 1 : 0 ) + strlen( name ) + 1;
+
+    if ( ( e.name = ( char * )malloc( len ) ) )
+    {
+        snprintf( e.name, len, "%s%s%s", ( prefix ) ? prefix : "", ( prefix ) ? "_" : "", name );
+    }
+
+    e.help   = strdup( ( help ) ? help : "" );
+    e.labels = strdup( ( labels ) ? labels : "" );
+    e.type   = type;
+    e.s      = s;
+
+    if ( ( !e.name ) || ( !e.help ) || ( !e.labels ) )
+    {
+        _freeEntry( &e );
+        return false;
+    }
+
+    pthread_mutex_lock( &r->lock );
+
+    if ( r->n == r->size )
+    {
+        int size = ( r->size ) ? r->size * 2 : REGISTRY_START_SIZE;
+        struct statEntry *n = ( struct statEntry * )realloc( r->e, size * sizeof( struct statEntry ) );
+
+        if ( !n )
+        {
+            pthread_mutex_unlock( &r->lock );
+            _freeEntry( &e );
+            return false;
+        }
+
+        r->e = n;
+        r->size = size;
+    }
+
+    /* Goes after the last one with the same name, or at the end */
+    for ( at = r->n; ( at ) && ( strcmp( r->e[at - 1].name, e.name ) ); at-- );
+
+    if ( !at )
+    {
+        at = r->n;
+    }
+
+    memmove( &r->e[at + 1], &r->e[at], ( r->n - at ) * sizeof( struct statEntry ) );
+    r->e[at] = e;
+    r->n++;
+    pthread_mutex_unlock( &r->lock );
+    return true;
+}
+// ====================================================================================================
+bool statsRegistryAddSet( struct statsRegistry *r, const char *prefix, const char *labels, const void *base,
+                          const struct statDef *d, int n )
+
+{
+    bool ok = true;
+
+    for ( int i = 0; i < n; i++ )
+    {
+        ok &= statsRegistryAdd( r, prefix, d[i].name, d[i].help, labels, d[i].type,
+                                ( const orbStat * )( ( const uint8_t * )base + d[i].ofs ) );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+void statsRegistryRemove( struct statsRegistry *r, const void *from, size_t len )
+
+{
+    const uint8_t *lo = ( const uint8_t * )from;
+    int k = 0;
+
+    if ( !r )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &r->lock );
+
+    for ( int i = 0; i < r->n; i++ )
+    {
+        const uint8_t *p = ( const uint8_t * )r->e[i].s;
+
+        if ( ( p >= lo ) && ( p < lo + len ) )
+        {
+            _freeEntry( &r->e[i] );
+        }
+        else
+        {
+            r->e[k++] = r->e[i];
+        }
+    }
+
+    r->n = k;
+    pthread_mutex_unlock( &r->lock );
+}
+// ====================================================================================================
+int statsRegistrySnapshot( struct statsRegistry *r, struct statValue *v, int max )
+
+{
+    int n;
+
+    if ( !r )
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock( &r->lock );
+
+    for ( int i = 0; ( i < r->n ) && ( i < max ); i++ )
+    {
+        v[i].name   = r->e[i].name;
+        v[i].help   = r->e[i].help;
+        v[i].labels = r->e[i].labels;
+        v[i].type   = r->e[i].type;
+        v[i].v      = STAT_READ( *r->e[i].s );
+    }
+
+    n = r->n;
+    pthread_mutex_unlock( &r->lock );
+    return n;
+}
+// ====================================================================================================
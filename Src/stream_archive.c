@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Compressed Capture Archive Stream
+ * =================================
+ *
+ * Reads the capture back out of an archive (see captureArchive.h) a block at a time. To start part
+ * way through, headers are read from the start of the file, skipping over each block's data, until
+ * the one holding the place asked for turns up...only that block needs decompressing. If a block
+ * isn't all there yet then that's the end of the file for now, but it's tried again next time, so
+ * an archive that's still being written can be followed.
+ *
+ */
+
+#include "stream.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "generics.h"
+#include "captureArchive.h"
+
+struct ArchiveStream
+{
+    struct Stream base;
+    FILE *f;
+    uint8_t *packed;               /* A block as it is in the file */
+    size_t packedMax;              /* ...the most that can be */
+    uint8_t *d;                    /* ...and decompressed */
+    size_t len;                    /* ...how much of it there is */
+    size_t pos;                    /* ...and how far through it we are */
+    uint64_t skip;                 /* Capture still to be passed over, to get to where we were asked to start */
+};
+
+#define SELF(stream) ((struct ArchiveStream*)(stream))
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint64_t _getLE( const uint8_t *d, int len )
+
+{
+    uint64_t v = 0;
+
+    for ( int i = len - 1; i >= 0; i-- )
+    {
+        v = ( v << 8 ) | d[i];
+    }
+
+    return v;
+}
+// ====================================================================================================
+static enum ReceiveResult _archiveNextBlock( struct ArchiveStream *self )
+
+/* Read and decompress the next block. If it isn't all there then go back to its start to try later */
+
+{
+    uint8_t h[CAPTURE_ARCHIVE_HDR_LEN];
+    off_t at = ftello( self->f );
+    uint32_t stored, len;
+    uLongf n;
+
+    while ( true )
+    {
+        if ( fread( h, CAPTURE_ARCHIVE_HDR_LEN, 1, self->f ) != 1 )
+        {
+            break;
+        }
+
+        stored = _getLE( h, 4 );
+        len    = _getLE( &h[4], 4 );
+
+        if ( ( len > CAPTURE_ARCHIVE_BLOCK ) || ( CAPTURE_ARCHIVE_HDR_LEN + ( size_t )stored > self->packedMax ) )
+        {
+            genericsReport( V_ERROR, "Archive is corrupt" EOL );
+            return RECEIVE_RESULT_ERROR;
+        }
+
+        /* Whole blocks that are before where we're starting needn't be read at all */
+        if ( self->skip >= len )
+        {
+            if ( fseeko( self->f, stored, SEEK_CUR ) < 0 )
+            {
+                break;
+            }
+
+            self->skip -= len;
+            at = ftello( self->f );
+            continue;
+        }
+
+        if ( fread( self->packed, 1, stored, self->f ) != stored )
+        {
+            break;
+        }
+
+        n = CAPTURE_ARCHIVE_BLOCK;
+
+        if ( ( uncompress( self->d, &n, self->packed, stored ) != Z_OK ) || ( n != len ) )
+        {
+            genericsReport( V_ERROR, "Archive block at %lld is corrupt" EOL, ( long long )at );
+            return RECEIVE_RESULT_ERROR;
+        }
+
+        self->len  = len;
+        self->pos  = self->skip;
+        self->skip = 0;
+        return RECEIVE_RESULT_OK;
+    }
+
+    /* Not there (yet), so next time start again from the same place */
+    clearerr( self->f );
+    fseeko( self->f, at, SEEK_SET );
+    return RECEIVE_RESULT_EOF;
+}
+// ====================================================================================================
+static enum ReceiveResult _archiveStreamAcquire( struct Stream *stream, const void **data, size_t maxSize,
+        struct timeval *timeout, size_t *receivedSize )
+
+/* Lend out the next part of the current block. It stays put until the next acquire */
+
+{
+    struct ArchiveStream *self = SELF( stream );
+    enum ReceiveResult r;
+
+    ( void )timeout;
+    *receivedSize = 0;
+
+    if ( self->pos == self->len )
+    {
+        if ( ( r = _archiveNextBlock( self ) ) != RECEIVE_RESULT_OK )
+        {
+            return r;
+        }
+    }
+
+    *data = &self->d[self->pos];
+    *receivedSize = ( self->len - self->pos < maxSize ) ? self->len - self->pos : maxSize;
+    self->pos += *receivedSize;
+    return RECEIVE_RESULT_OK;
+}
+// ====================================================================================================
+static enum ReceiveResult _archiveStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    const void *d = NULL;
+    enum ReceiveResult r = _archiveStreamAcquire( stream, &d, bufferSize, timeout, receivedSize );
+
+    if ( *receivedSize )
+    {
+        memcpy( buffer, d, *receivedSize );
+    }
+
+    return r;
+}
+// ====================================================================================================
+static void _archiveStreamClose( struct Stream *stream )
+{
+    struct ArchiveStream *self = SELF( stream );
+
+    fclose( self->f );
+    free( self->packed );
+    free( self->d );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool streamIsArchive( const char *file )
+
+{
+    char m[CAPTURE_ARCHIVE_MAGIC_LEN];
+    FILE *f = fopen( file, "rb" );
+    bool is;
+
+    if ( !f )
+    {
+        return false;
+    }
+
+    is = ( fread( m, CAPTURE_ARCHIVE_MAGIC_LEN, 1, f ) == 1 ) && ( !memcmp( m, CAPTURE_ARCHIVE_MAGIC, CAPTURE_ARCHIVE_MAGIC_LEN ) );
+    fclose( f );
+    return is;
+}
+// ====================================================================================================
+struct Stream *streamCreateArchiveAt( const char *file, uint64_t ofs )
+
+{
+    struct ArchiveStream *stream = SELF( calloc( 1, sizeof( struct ArchiveStream ) ) );
+    char m[CAPTURE_ARCHIVE_MAGIC_LEN];
+
+    MEMCHECK( stream, NULL );
+
+    if ( !( stream->f = fopen( file, "rb" ) ) )
+    {
+        genericsExit( -4, "Can't open file %s" EOL, file );
+    }
+
+    if ( ( fread( m, CAPTURE_ARCHIVE_MAGIC_LEN, 1, stream->f ) != 1 ) || ( memcmp( m, CAPTURE_ARCHIVE_MAGIC, CAPTURE_ARCHIVE_MAGIC_LEN ) ) )
+    {
+        genericsReport( V_ERROR, "%s is not an archive" EOL, file );
+        fclose( stream->f );
+        free( stream );
+        return NULL;
+    }
+
+    stream->packedMax = CAPTURE_ARCHIVE_HDR_LEN + compressBound( CAPTURE_ARCHIVE_BLOCK );
+    stream->packed = ( uint8_t * )malloc( stream->packedMax );
+    MEMCHECK( stream->packed, NULL );
+    stream->d = ( uint8_t * )malloc( CAPTURE_ARCHIVE_BLOCK );
+    MEMCHECK( stream->d, NULL );
+    stream->skip = ofs;
+
+    stream->base.receive = _archiveStreamReceive;
+    stream->base.acquire = _archiveStreamAcquire;
+    stream->base.close = _archiveStreamClose;
+    return &stream->base;
+}
+// ====================================================================================================
@@ -1,9 +1,14 @@
 #include "stream.h"
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "generics.h"
+#include "captureArchive.h"
 
 
 struct PosixFileStream
@@ -12,7 +17,17 @@ struct PosixFileStream
     int file;
 };
 
+struct PosixMappedFileStream
+{
+    struct Stream base;
+    int file;
+    const uint8_t *map;            /* Mapping of the file */
+    size_t mapLen;                 /* ...its length */
+    size_t pos;                    /* ...and how far through it we are */
+};
+
 #define SELF(stream) ((struct PosixFileStream*)(stream))
+#define MSELF(stream) ((struct PosixMappedFileStream*)(stream))
 
 // ====================================================================================================
 static enum ReceiveResult _posixFileStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
@@ -66,6 +81,97 @@ static int _posixFileStreamCreate( const char *file )
     return f;
 }
 
+// ====================================================================================================
+static bool _posixMappedFileStreamMap( struct PosixMappedFileStream *self )
+
+/* (Re-)map the file if it has grown since we last looked. Returns false if it can't be mapped */
+
+{
+    struct stat st;
+
+    if ( ( fstat( self->file, &st ) < 0 ) || ( !S_ISREG( st.st_mode ) ) )
+    {
+        return false;
+    }
+
+    if ( ( size_t )st.st_size <= self->mapLen )
+    {
+        /* Nothing new, but no problem either */
+        return true;
+    }
+
+    if ( self->map )
+    {
+        munmap( ( void * )self->map, self->mapLen );
+        self->map = NULL;
+        self->mapLen = 0;
+    }
+
+    void *m = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, self->file, 0 );
+
+    if ( m == MAP_FAILED )
+    {
+        return false;
+    }
+
+    madvise( m, st.st_size, MADV_SEQUENTIAL );
+    self->map = ( const uint8_t * )m;
+    self->mapLen = st.st_size;
+    return true;
+}
+// ====================================================================================================
+static enum ReceiveResult _posixMappedFileStreamAcquire( struct Stream *stream, const void **data, size_t maxSize,
+        struct timeval *timeout, size_t *receivedSize )
+
+/* Lend out the next part of the mapping. Nothing moves until the next acquire, so no release is needed */
+
+{
+    struct PosixMappedFileStream *self = MSELF( stream );
+
+    *receivedSize = 0;
+
+    if ( ( self->pos == self->mapLen ) && ( !_posixMappedFileStreamMap( self ) ) )
+    {
+        return RECEIVE_RESULT_ERROR;
+    }
+
+    if ( self->pos == self->mapLen )
+    {
+        return RECEIVE_RESULT_EOF;
+    }
+
+    *data = &self->map[self->pos];
+    *receivedSize = ( self->mapLen - self->pos < maxSize ) ? self->mapLen - self->pos : maxSize;
+    self->pos += *receivedSize;
+    return RECEIVE_RESULT_OK;
+}
+// ====================================================================================================
+static enum ReceiveResult _posixMappedFileStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    const void *d = NULL;
+    enum ReceiveResult r = _posixMappedFileStreamAcquire( stream, &d, bufferSize, timeout, receivedSize );
+
+    if ( *receivedSize )
+    {
+        memcpy( buffer, d, *receivedSize );
+    }
+
+    return r;
+}
+// ====================================================================================================
+static void _posixMappedFileStreamClose( struct Stream *stream )
+{
+    struct PosixMappedFileStream *self = MSELF( stream );
+
+    if ( self->map )
+    {
+        munmap( ( void * )self->map, self->mapLen );
+    }
+
+    close( self->file );
+}
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -101,5 +207,66 @@ struct Stream *streamCreateFile( const char *file )
 
     return &stream->base;
 }
+
+// ====================================================================================================
+struct Stream *streamCreateMappedFile( const char *file )
+
+/* As streamCreateFile, but the file is memory mapped and read without any syscalls. If it can't */
+/* be mapped (i.e. it's a pipe or a device) then it falls back to being a conventional file, and */
+/* if it's a compressed archive then it's decompressed as it's read.                            */
+
+{
+    return streamCreateMappedFileAt( file, 0 );
+}
+// ====================================================================================================
+struct Stream *streamCreateMappedFileAt( const char *file, uint64_t ofs )
+
+/* As streamCreateMappedFile, starting ofs bytes into the file */
+
+{
+    struct PosixMappedFileStream *stream = MSELF( calloc( 1, sizeof( struct PosixMappedFileStream ) ) );
+
+    if ( stream == NULL )
+    {
+        return NULL;
+    }
+
+    stream->base.receive = _posixMappedFileStreamReceive;
+    stream->base.acquire = _posixMappedFileStreamAcquire;
+    stream->base.close = _posixMappedFileStreamClose;
+    stream->file = _posixFileStreamCreate( file );
+
+    if ( stream->file == -1 )
+    {
+        free( stream );
+        return NULL;
+    }
+
+    if ( !_posixMappedFileStreamMap( stream ) )
+    {
+        close( stream->file );
+        free( stream );
+
+        struct Stream *s = streamCreateFile( file );
+
+        if ( ( s ) && ( ofs ) && ( lseek( SELF( s )->file, ofs, SEEK_SET ) < 0 ) )
+        {
+            genericsReport( V_WARN, "Cannot seek in %s, starting from the beginning" EOL, file );
+        }
+
+        return s;
+    }
+
+    /* A compressed archive reads quite differently, but to the caller it's just the capture in it */
+    if ( ( stream->mapLen >= CAPTURE_ARCHIVE_MAGIC_LEN ) && ( !memcmp( stream->map, CAPTURE_ARCHIVE_MAGIC, CAPTURE_ARCHIVE_MAGIC_LEN ) ) )
+    {
+        _posixMappedFileStreamClose( &stream->base );
+        free( stream );
+        return streamCreateArchiveAt( file, ofs );
+    }
+
+    stream->pos = ( ofs < stream->mapLen ) ? ofs : stream->mapLen;
+    return &stream->base;
+}
 #pragma GCC diagnostic pop
 // ====================================================================================================
@@ -62,4 +62,42 @@ struct Stream *streamCreateFile( const char *file )
     }
 
     return &stream->base.base;
-}
\ No newline at end of file
+}
+// ====================================================================================================
+struct Stream *streamCreateMappedFile( const char *file )
+{
+    return streamCreateMappedFileAt( file, 0 );
+}
+// ====================================================================================================
+struct Stream *streamCreateMappedFileAt( const char *file, uint64_t ofs )
+{
+    /* No mapped file support here yet, so fall back to a conventional file...unless it's an archive */
+    if ( streamIsArchive( file ) )
+    {
+        return streamCreateArchiveAt( file, ofs );
+    }
+
+    struct Stream *s = streamCreateFile( file );
+
+    if ( s )
+    {
+        ( ( struct Win32Stream * )s )->readOffset = ofs;
+    }
+
+    return s;
+}
+
+// ====================================================================================================
+struct Stream *streamCreateShm( const char *name )
+{
+    /* No shared memory support here yet, so there's nothing to fall back to */
+    genericsReport( V_ERROR, "Shared memory input is not supported on this platform" EOL );
+    return NULL;
+}
+
+// ====================================================================================================
+struct Stream *streamCreateMulticast( const char *spec )
+{
+    genericsReport( V_ERROR, "Multicast input is not supported on this platform" EOL );
+    return NULL;
+}
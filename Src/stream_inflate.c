@@ -0,0 +1,193 @@
+#include "stream.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "generics.h"
+#include "nw.h"
+
+/* Size of the buffer for compressed data coming in */
+#define INFLATE_BUF_SIZE (64*1024)
+
+enum InflateState
+{
+    INFLATE_WAITING,               /* Waiting to see if the server agreed to compress */
+    INFLATE_COMPRESSED,            /* ...it did */
+    INFLATE_PLAIN                  /* ...it didn't, so data is passed straight through */
+};
+
+struct InflateStream
+{
+    struct Stream base;
+    struct Stream *inner;          /* Stream that the compressed data arrives on */
+    enum InflateState state;
+    z_stream z;                    /* Inflater */
+    uint8_t *ibuf;                 /* Compressed data waiting to be inflated */
+    uint8_t ack[NW_COMPRESS_MAGIC_LEN]; /* What has arrived of what might be the server's acknowledgement */
+    size_t ackLen;                 /* ...how much of it there is */
+    size_t ackOfs;                 /* ...and how much has been handed on, if it turned out not to be one */
+};
+
+#define SELF(stream) ((struct InflateStream*)(stream))
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static enum ReceiveResult _inflateStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    struct InflateStream *self = SELF( stream );
+    enum ReceiveResult r;
+    size_t got;
+    int zr;
+
+    *receivedSize = 0;
+
+    /* Find out whether or not the server agreed to compress, from the first thing it sent */
+    while ( self->state == INFLATE_WAITING )
+    {
+        r = self->inner->receive( self->inner, &self->ack[self->ackLen], NW_COMPRESS_MAGIC_LEN - self->ackLen, timeout, &got );
+
+        if ( r != RECEIVE_RESULT_OK )
+        {
+            return r;
+        }
+
+        self->ackLen += got;
+
+        if ( memcmp( self->ack, NW_COMPRESS_MAGIC, self->ackLen ) )
+        {
+            /* Not the acknowledgement, so this is a server that doesn't compress */
+            genericsReport( V_INFO, "Server did not agree to compress" EOL );
+            self->state = INFLATE_PLAIN;
+        }
+        else if ( self->ackLen == NW_COMPRESS_MAGIC_LEN )
+        {
+            self->state = INFLATE_COMPRESSED;
+        }
+    }
+
+    if ( self->state == INFLATE_PLAIN )
+    {
+        if ( self->ackOfs < self->ackLen )
+        {
+            /* Hand on what we took while we were looking for the acknowledgement */
+            *receivedSize = ( self->ackLen - self->ackOfs < bufferSize ) ? self->ackLen - self->ackOfs : bufferSize;
+            memcpy( buffer, &self->ack[self->ackOfs], *receivedSize );
+            self->ackOfs += *receivedSize;
+            return RECEIVE_RESULT_OK;
+        }
+
+        return self->inner->receive( self->inner, buffer, bufferSize, timeout, receivedSize );
+    }
+
+    self->z.next_out = ( Bytef * )buffer;
+    self->z.avail_out = bufferSize;
+
+    while ( self->z.avail_out == bufferSize )
+    {
+        if ( !self->z.avail_in )
+        {
+            r = self->inner->receive( self->inner, self->ibuf, INFLATE_BUF_SIZE, timeout, &got );
+
+            if ( r != RECEIVE_RESULT_OK )
+            {
+                return r;
+            }
+
+            self->z.next_in = self->ibuf;
+            self->z.avail_in = got;
+        }
+
+        zr = inflate( &self->z, Z_SYNC_FLUSH );
+
+        if ( ( zr != Z_OK ) && ( zr != Z_BUF_ERROR ) )
+        {
+            genericsReport( V_ERROR, "Compressed stream is corrupt (%d)" EOL, zr );
+            return RECEIVE_RESULT_ERROR;
+        }
+    }
+
+    *receivedSize = bufferSize - self->z.avail_out;
+    return RECEIVE_RESULT_OK;
+}
+
+// ====================================================================================================
+static bool _inflateStreamSend( struct Stream *stream, const void *buffer, size_t size )
+{
+    struct InflateStream *self = SELF( stream );
+
+    return self->inner->send( self->inner, buffer, size );
+}
+
+// ====================================================================================================
+static void _inflateStreamClose( struct Stream *stream )
+{
+    struct InflateStream *self = SELF( stream );
+
+    inflateEnd( &self->z );
+    free( self->ibuf );
+    self->inner->close( self->inner );
+    free( self->inner );
+}
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+// Malloc leak is deliberately ignored. That is the central purpose of this code!
+#pragma GCC diagnostic push
+#if !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+#endif
+
+struct Stream *streamCreateCompressedSocket( const char *server, int port )
+{
+    struct InflateStream *stream = SELF( calloc( 1, sizeof( struct InflateStream ) ) );
+
+    if ( stream == NULL )
+    {
+        return NULL;
+    }
+
+    stream->base.receive = _inflateStreamReceive;
+    stream->base.close = _inflateStreamClose;
+    stream->base.send = _inflateStreamSend;
+    stream->ibuf = ( uint8_t * )malloc( INFLATE_BUF_SIZE );
+
+    if ( ( !stream->ibuf ) || ( inflateInit( &stream->z ) != Z_OK ) )
+    {
+        free( stream->ibuf );
+        free( stream );
+        return NULL;
+    }
+
+    /* Ask for compression before anything else, a server that doesn't understand will just ignore it */
+    if ( ( !( stream->inner = streamCreateSocket( server, port ) ) ) ||
+            ( !stream->inner->send( stream->inner, NW_COMPRESS_MAGIC, NW_COMPRESS_MAGIC_LEN ) ) )
+    {
+        if ( stream->inner )
+        {
+            stream->inner->close( stream->inner );
+            free( stream->inner );
+        }
+
+        inflateEnd( &stream->z );
+        free( stream->ibuf );
+        free( stream );
+        return NULL;
+    }
+
+    return &stream->base;
+}
+#pragma GCC diagnostic pop
+// ====================================================================================================
@@ -0,0 +1,105 @@
+#include "stream.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "generics.h"
+#include "mcast.h"
+
+/* How long to wait for each datagram when there's no timeout set */
+#define MCAST_WAIT_MS (1000)
+
+struct PosixMcastStream
+{
+    struct Stream base;
+    struct mcast *m;               /* Group we are listening to */
+    uint64_t lostSeen;             /* Lost datagrams we've already told about */
+    uint64_t restartsSeen;         /* ...and sender restarts */
+};
+
+#define SELF(stream) ((struct PosixMcastStream*)(stream))
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static enum ReceiveResult _posixMcastStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    struct PosixMcastStream *self = SELF( stream );
+    int timeoutMs = ( timeout ) ? ( timeout->tv_sec * 1000 + timeout->tv_usec / 1000 ) : MCAST_WAIT_MS;
+    const struct mcastStats *s = mcastGetStats( self->m );
+
+    do
+    {
+        if ( ( *receivedSize = mcastRead( self->m, buffer, bufferSize, timeoutMs ) ) )
+        {
+            if ( s->lost != self->lostSeen )
+            {
+                /* The frames they carried are gone, but the decoder picks up again with the next one */
+                genericsReportRateLimited( V_WARN, "Multicast lost %" PRIu64 " datagrams (%" PRIu64 " of %" PRIu64 " so far)" EOL,
+                                           s->lost - self->lostSeen, s->lost, s->lost + s->datagrams );
+                self->lostSeen = s->lost;
+            }
+
+            if ( s->restarts != self->restartsSeen )
+            {
+                genericsReport( V_WARN, "Multicast sender started again, following it from here" EOL );
+                self->restartsSeen = s->restarts;
+            }
+
+            return RECEIVE_RESULT_OK;
+        }
+    }
+    while ( !timeout );
+
+    return RECEIVE_RESULT_TIMEOUT;
+}
+// ====================================================================================================
+static void _posixMcastStreamClose( struct Stream *stream )
+{
+    struct PosixMcastStream *self = SELF( stream );
+    mcastClose( self->m );
+    self->m = NULL;
+}
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+// Malloc leak is deliberately ignored. That is the central purpose of this code!
+#pragma GCC diagnostic push
+#if !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+#endif
+
+struct Stream *streamCreateMulticast( const char *spec )
+{
+    struct PosixMcastStream *stream = SELF( calloc( 1, sizeof( struct PosixMcastStream ) ) );
+
+    if ( stream == NULL )
+    {
+        return NULL;
+    }
+
+    stream->base.receive = _posixMcastStreamReceive;
+    stream->base.close = _posixMcastStreamClose;
+    stream->m = mcastOpen( spec );
+
+    if ( stream->m == NULL )
+    {
+        free( stream );
+        return NULL;
+    }
+
+    return &stream->base;
+}
+#pragma GCC diagnostic pop
+// ====================================================================================================
@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Reader Stream
+ * =============
+ *
+ * Receives from another stream on a thread of its own, into a ring of buffers, so the source keeps
+ * being drained while whoever is reading is busy decoding or formatting. Otherwise a client that
+ * stops to think leaves orbuculum with a full socket, and it takes that for a client that's gone.
+ *
+ * Buffers are filled in order by the reader thread and handed over in the same order. Once the inner
+ * stream ends or fails then that is reported, in turn, after all of the data before it.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stream.h"
+#include "generics.h"
+
+#define READER_POLL_US (100000L)   /* How often the reader looks up to see if it should stop */
+
+struct ReaderBuf
+{
+    uint8_t *d;
+    size_t len;                    /* How much was received into it */
+    enum ReceiveResult result;     /* ...and how it went, only OK has any data */
+};
+
+struct ReaderStream
+{
+    struct Stream base;
+    struct Stream *inner;          /* Stream being read from */
+    pthread_t thread;
+    pthread_mutex_t l;
+    pthread_cond_t filled;         /* Signalled when a buffer has been filled */
+    pthread_cond_t emptied;        /* ...and when one has been handed back */
+
+    struct ReaderBuf *b;
+    unsigned int n;                /* Number of buffers */
+    size_t bufLen;                 /* ...and how big each one is */
+    unsigned int wp;               /* Next buffer to be filled */
+    unsigned int rp;               /* ...and to be read from, wp-rp of them are full */
+    size_t ofs;                    /* How far into the one at rp has been read */
+    size_t lent;                   /* ...and how much more was lent out by the last acquire */
+    bool stop;
+};
+
+#define SELF(stream) ((struct ReaderStream*)(stream))
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void *_readerTask( void *arg )
+
+{
+    struct ReaderStream *self = ( struct ReaderStream * )arg;
+    struct timeval tv;
+    struct ReaderBuf *b;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &self->l );
+
+        while ( ( self->wp - self->rp == self->n ) && ( !self->stop ) )
+        {
+            pthread_cond_wait( &self->emptied, &self->l );
+        }
+
+        pthread_mutex_unlock( &self->l );
+
+        if ( self->stop )
+        {
+            break;
+        }
+
+        /* Only this thread touches the buffer at wp until it's published */
+        b = &self->b[self->wp % self->n];
+        tv.tv_sec = 0;
+        tv.tv_usec = READER_POLL_US;
+        b->result = self->inner->receive( self->inner, b->d, self->bufLen, &tv, &b->len );
+
+        if ( ( b->result == RECEIVE_RESULT_TIMEOUT ) || ( ( b->result == RECEIVE_RESULT_OK ) && ( !b->len ) ) )
+        {
+            continue;
+        }
+
+        pthread_mutex_lock( &self->l );
+        self->wp++;
+        pthread_cond_signal( &self->filled );
+        pthread_mutex_unlock( &self->l );
+
+        /* Nothing more will come once the stream has ended */
+        if ( b->result != RECEIVE_RESULT_OK )
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _giveBack( struct ReaderStream *self )
+
+/* With the lock held, take back whatever was lent, and pass the buffer back to the reader once it's all used */
+
+{
+    self->ofs += self->lent;
+    self->lent = 0;
+
+    if ( ( self->wp != self->rp ) && ( self->ofs == self->b[self->rp % self->n].len ) &&
+            ( self->b[self->rp % self->n].result == RECEIVE_RESULT_OK ) )
+    {
+        self->ofs = 0;
+        self->rp++;
+        pthread_cond_signal( &self->emptied );
+    }
+}
+// ====================================================================================================
+static struct ReaderBuf *_next( struct ReaderStream *self, struct timeval *timeout )
+
+/* With the lock held, give back whatever was lent last time, then wait for a buffer with something in it */
+
+{
+    struct timespec until;
+
+    _giveBack( self );
+
+    if ( timeout )
+    {
+        clock_gettime( CLOCK_REALTIME, &until );
+        until.tv_sec += timeout->tv_sec;
+        until.tv_nsec += timeout->tv_usec * 1000L;
+
+        if ( until.tv_nsec >= 1000000000L )
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while ( self->wp == self->rp )
+    {
+        if ( !timeout )
+        {
+            pthread_cond_wait( &self->filled, &self->l );
+        }
+        else if ( pthread_cond_timedwait( &self->filled, &self->l, &until ) )
+        {
+            return NULL;
+        }
+    }
+
+    return &self->b[self->rp % self->n];
+}
+// ====================================================================================================
+static enum ReceiveResult _readerStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    struct ReaderStream *self = SELF( stream );
+    enum ReceiveResult r = RECEIVE_RESULT_TIMEOUT;
+    struct ReaderBuf *b;
+
+    *receivedSize = 0;
+    pthread_mutex_lock( &self->l );
+
+    if ( ( b = _next( self, timeout ) ) )
+    {
+        /* An end stays at the head, so it's what every receive sees from then on */
+        if ( ( r = b->result ) == RECEIVE_RESULT_OK )
+        {
+            *receivedSize = ( b->len - self->ofs < bufferSize ) ? b->len - self->ofs : bufferSize;
+            memcpy( buffer, &b->d[self->ofs], *receivedSize );
+            self->ofs += *receivedSize;
+        }
+    }
+
+    pthread_mutex_unlock( &self->l );
+    return r;
+}
+// ====================================================================================================
+static enum ReceiveResult _readerStreamAcquire( struct Stream *stream, const void **data, size_t maxSize,
+        struct timeval *timeout, size_t *receivedSize )
+
+/* As receive, but lending out the buffer itself until it's released */
+
+{
+    struct ReaderStream *self = SELF( stream );
+    enum ReceiveResult r = RECEIVE_RESULT_TIMEOUT;
+    struct ReaderBuf *b;
+
+    *receivedSize = 0;
+    pthread_mutex_lock( &self->l );
+
+    if ( ( b = _next( self, timeout ) ) )
+    {
+        if ( ( r = b->result ) == RECEIVE_RESULT_OK )
+        {
+            *receivedSize = ( b->len - self->ofs < maxSize ) ? b->len - self->ofs : maxSize;
+            *data = &b->d[self->ofs];
+            self->lent = *receivedSize;
+        }
+    }
+
+    pthread_mutex_unlock( &self->l );
+    return r;
+}
+// ====================================================================================================
+static bool _readerStreamRelease( struct Stream *stream )
+
+/* Nothing can touch a lent buffer, but the sooner it goes back the sooner the reader can refill it */
+
+{
+    struct ReaderStream *self = SELF( stream );
+
+    pthread_mutex_lock( &self->l );
+    _giveBack( self );
+    pthread_mutex_unlock( &self->l );
+    return true;
+}
+// ====================================================================================================
+static bool _readerStreamSend( struct Stream *stream, const void *buffer, size_t size )
+{
+    struct ReaderStream *self = SELF( stream );
+
+    return ( self->inner->send ) ? self->inner->send( self->inner, buffer, size ) : false;
+}
+// ====================================================================================================
+static void _readerStreamClose( struct Stream *stream )
+{
+    struct ReaderStream *self = SELF( stream );
+
+    pthread_mutex_lock( &self->l );
+    self->stop = true;
+    pthread_cond_signal( &self->emptied );
+    pthread_mutex_unlock( &self->l );
+    pthread_join( self->thread, NULL );
+
+    self->inner->close( self->inner );
+    free( self->inner );
+
+    for ( unsigned int i = 0; i < self->n; i++ )
+    {
+        free( self->b[i].d );
+    }
+
+    free( self->b );
+    pthread_cond_destroy( &self->filled );
+    pthread_cond_destroy( &self->emptied );
+    pthread_mutex_destroy( &self->l );
+}
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+// Malloc leak is deliberately ignored. That is the central purpose of this code!
+#pragma GCC diagnostic push
+#if !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+#endif
+
+struct Stream *streamCreateReader( struct Stream *inner, unsigned int bufs, size_t bufLen )
+{
+    struct ReaderStream *stream;
+
+    if ( inner == NULL )
+    {
+        return NULL;
+    }
+
+    stream = SELF( calloc( 1, sizeof( struct ReaderStream ) ) );
+    MEMCHECK( stream, NULL );
+
+    stream->base.receive = _readerStreamReceive;
+    stream->base.acquire = _readerStreamAcquire;
+    stream->base.release = _readerStreamRelease;
+    stream->base.close = _readerStreamClose;
+    stream->base.send = ( inner->send ) ? _readerStreamSend : NULL;
+    stream->inner = inner;
+    stream->n = bufs;
+    stream->bufLen = bufLen;
+    stream->b = ( struct ReaderBuf * )calloc( bufs, sizeof( struct ReaderBuf ) );
+    MEMCHECK( stream->b, NULL );
+
+    for ( unsigned int i = 0; i < bufs; i++ )
+    {
+        stream->b[i].d = ( uint8_t * )malloc( bufLen );
+        MEMCHECK( stream->b[i].d, NULL );
+    }
+
+    pthread_mutex_init( &stream->l, NULL );
+    pthread_cond_init( &stream->filled, NULL );
+    pthread_cond_init( &stream->emptied, NULL );
+
+    if ( pthread_create( &stream->thread, NULL, _readerTask, stream ) )
+    {
+        genericsExit( -1, "Failed to create stream reader thread" EOL );
+    }
+
+    return &stream->base;
+}
+#pragma GCC diagnostic pop
+// ====================================================================================================
@@ -0,0 +1,191 @@
+#include "stream.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "generics.h"
+#include "shmRing.h"
+
+/* How long to wait for each look at the ring when there's no timeout set */
+#define SHM_WAIT_MS (1000)
+
+/* How far the writer has to be from overwriting what's lent out, or it's copied out instead. That's */
+/* a good few frames, so there's time for them to be decoded before the writer gets to them.         */
+#define SHM_LEND_MARGIN (64*1024)
+
+struct PosixShmStream
+{
+    struct Stream base;
+    struct shmRing *ring;          /* Ring we are following */
+    size_t lent;                   /* How much of it was lent out by the last acquire */
+    uint8_t *copy;                 /* Where it's copied out to when it's too close to the writer to lend */
+    size_t copyLen;                /* ...and how big that is */
+};
+
+#define SELF(stream) ((struct PosixShmStream*)(stream))
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static size_t _giveBack( struct PosixShmStream *self )
+
+/* Move on past what was lent, returning how much of it the writer overwrote while it was in use */
+
+{
+    size_t drop = shmRingConsume( self->ring, self->lent );
+
+    self->lent = 0;
+
+    if ( drop )
+    {
+        genericsReport( V_WARN, "Shared memory reader fell behind, %zu bytes overwritten while in use" EOL, drop );
+    }
+
+    return drop;
+}
+// ====================================================================================================
+static bool _posixShmStreamRelease( struct Stream *stream )
+
+/* Finished with what was lent. The writer doesn't wait for us, so it may have overwritten some of it */
+
+{
+    return !_giveBack( SELF( stream ) );
+}
+// ====================================================================================================
+static enum ReceiveResult _posixShmStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    struct PosixShmStream *self = SELF( stream );
+    int timeoutMs = ( timeout ) ? ( timeout->tv_sec * 1000 + timeout->tv_usec / 1000 ) : SHM_WAIT_MS;
+    uint64_t lost = 0;
+
+    /* Anything still lent out is done with, if this is being asked for instead...there's no release */
+    /* to say if it was overwritten while in use, so that's counted as lost with the rest.          */
+    lost += _giveBack( self );
+
+    do
+    {
+        if ( ( *receivedSize = shmRingRead( self->ring, buffer, bufferSize, timeoutMs, &lost ) ) )
+        {
+            if ( lost )
+            {
+                /* The decoder will resync at the next frame boundary, but it's worth knowing about */
+                genericsReport( V_WARN, "Shared memory reader fell behind, %" PRIu64 " bytes lost" EOL, lost );
+            }
+
+            return RECEIVE_RESULT_OK;
+        }
+
+        if ( shmRingWriterGone( self->ring ) )
+        {
+            return RECEIVE_RESULT_EOF;
+        }
+    }
+    while ( !timeout );
+
+    return RECEIVE_RESULT_TIMEOUT;
+}
+
+// ====================================================================================================
+static enum ReceiveResult _posixShmStreamAcquire( struct Stream *stream, const void **data, size_t maxSize,
+        struct timeval *timeout, size_t *receivedSize )
+
+/* As receive, but lending out the data where it is in the ring */
+
+{
+    struct PosixShmStream *self = SELF( stream );
+    int timeoutMs = ( timeout ) ? ( timeout->tv_sec * 1000 + timeout->tv_usec / 1000 ) : SHM_WAIT_MS;
+    uint64_t lost = 0;
+
+    /* As for receive, anything still lent out is done with */
+    lost += _giveBack( self );
+
+    do
+    {
+        if ( ( self->lent = *receivedSize = shmRingPeek( self->ring, data, maxSize, timeoutMs, &lost ) ) )
+        {
+            /* If the writer's about to get to it then it's safer to take a copy, checked once it's taken */
+            if ( shmRingHeadroom( self->ring ) < SHM_LEND_MARGIN )
+            {
+                if ( self->copyLen < maxSize )
+                {
+                    self->copy = ( uint8_t * )realloc( self->copy, maxSize );
+                    MEMCHECK( self->copy, RECEIVE_RESULT_ERROR );
+                    self->copyLen = maxSize;
+                }
+
+                self->lent = 0;
+                *data = self->copy;
+                *receivedSize = shmRingRead( self->ring, self->copy, maxSize, 0, &lost );
+            }
+
+            if ( lost )
+            {
+                genericsReport( V_WARN, "Shared memory reader fell behind, %" PRIu64 " bytes lost" EOL, lost );
+            }
+
+            return RECEIVE_RESULT_OK;
+        }
+
+        if ( shmRingWriterGone( self->ring ) )
+        {
+            return RECEIVE_RESULT_EOF;
+        }
+    }
+    while ( !timeout );
+
+    return RECEIVE_RESULT_TIMEOUT;
+}
+// ====================================================================================================
+static void _posixShmStreamClose( struct Stream *stream )
+{
+    struct PosixShmStream *self = SELF( stream );
+    shmRingClose( self->ring );
+    self->ring = NULL;
+    free( self->copy );
+    self->copy = NULL;
+}
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+// Malloc leak is deliberately ignored. That is the central purpose of this code!
+#pragma GCC diagnostic push
+#if !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+#endif
+
+struct Stream *streamCreateShm( const char *name )
+{
+    struct PosixShmStream *stream = SELF( calloc( 1, sizeof( struct PosixShmStream ) ) );
+
+    if ( stream == NULL )
+    {
+        return NULL;
+    }
+
+    stream->base.receive = _posixShmStreamReceive;
+    stream->base.acquire = _posixShmStreamAcquire;
+    stream->base.release = _posixShmStreamRelease;
+    stream->base.close = _posixShmStreamClose;
+    stream->ring = shmRingOpen( name );
+
+    if ( stream->ring == NULL )
+    {
+        free( stream );
+        return NULL;
+    }
+
+    return &stream->base;
+}
+#pragma GCC diagnostic pop
+// ====================================================================================================
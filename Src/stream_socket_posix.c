@@ -10,16 +10,27 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <poll.h>
+#include <errno.h>
 
 #include "generics.h"
 
+#if defined OSX || defined FREEBSD
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
+#endif
+
 /* How long to wait for a connection before declaring failure */
 #define CONNECT_WAIT_TIME_MS (2000)
 
+/* Kernel buffering to ask for, enough to ride out a client that stops to think for a while */
+#define SOCKET_RCVBUF (4*1024*1024)
+
 struct PosixSocketStream
 {
     struct Stream base;
     int socket;
+    struct pollfd pfd;             /* What we wait on when there is nothing to read already */
 };
 
 #define SELF(stream) ((struct PosixSocketStream*)(stream))
@@ -35,29 +46,34 @@ static enum ReceiveResult _posixSocketStreamReceive( struct Stream *stream, void
         struct timeval *timeout, size_t *receivedSize )
 {
     struct PosixSocketStream *self = SELF( stream );
+    ssize_t result;
+    int r;
 
     *receivedSize = 0;
 
-    fd_set readFd;
-    FD_ZERO( &readFd );
-    FD_SET( self->socket, &readFd );
-
-    int r = select( self->socket + 1, &readFd, NULL, NULL, timeout );
-
-    if ( r < 0 )
+    /* When data is flowing there's usually some waiting already, so only wait if there isn't */
+    while ( ( result = recv( self->socket, buffer, bufferSize, MSG_DONTWAIT ) ) < 0 )
     {
-        return RECEIVE_RESULT_ERROR;
+        if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) )
+        {
+            return RECEIVE_RESULT_ERROR;
+        }
+
+        self->pfd.revents = 0;
+        r = poll( &self->pfd, 1, ( timeout ) ? timeout->tv_sec * 1000 + timeout->tv_usec / 1000 : -1 );
+
+        if ( ( r < 0 ) && ( errno != EINTR ) )
+        {
+            return RECEIVE_RESULT_ERROR;
+        }
+
+        if ( r == 0 )
+        {
+            return RECEIVE_RESULT_TIMEOUT;
+        }
     }
 
-    if ( r == 0 )
-    {
-        *receivedSize = 0;
-        return RECEIVE_RESULT_TIMEOUT;
-    }
-
-    ssize_t result = recv( self->socket, buffer, bufferSize, 0 );
-
-    if ( result <= 0 )
+    if ( result == 0 )
     {
         // report connection broken as error
         return RECEIVE_RESULT_ERROR;
@@ -67,6 +83,28 @@ static enum ReceiveResult _posixSocketStreamReceive( struct Stream *stream, void
     return RECEIVE_RESULT_OK;
 }
 
+// ====================================================================================================
+static bool _posixSocketStreamSend( struct Stream *stream, const void *buffer, size_t size )
+{
+    struct PosixSocketStream *self = SELF( stream );
+    const uint8_t *p = ( const uint8_t * )buffer;
+
+    while ( size )
+    {
+        ssize_t sent = send( self->socket, p, size, MSG_NOSIGNAL );
+
+        if ( sent <= 0 )
+        {
+            return false;
+        }
+
+        p += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
 // ====================================================================================================
 static void _posixSocketStreamClose( struct Stream *stream )
 {
@@ -97,6 +135,9 @@ static int _posixSocketStreamCreate( const char *server, int port )
         return -1;
     }
 
+    /* The window is agreed as the connection is made, so this has to be asked for before then */
+    int rcvbuf = SOCKET_RCVBUF;
+    setsockopt( sockfd, SOL_SOCKET, SO_RCVBUF, ( const void * )&rcvbuf, sizeof( rcvbuf ) );
 
     /* Now open the network connection */
     memset( &serv_addr, 0, sizeof( serv_addr ) );
@@ -173,6 +214,7 @@ struct Stream *streamCreateSocket( const char *server, int port )
 
     stream->base.receive = _posixSocketStreamReceive;
     stream->base.close = _posixSocketStreamClose;
+    stream->base.send = _posixSocketStreamSend;
     stream->socket = _posixSocketStreamCreate( server, port );
 
     if ( stream->socket == -1 )
@@ -181,6 +223,9 @@ struct Stream *streamCreateSocket( const char *server, int port )
         return NULL;
     }
 
+    stream->pfd.fd = stream->socket;
+    stream->pfd.events = POLLIN;
+
     return &stream->base;
 }
 #pragma GCC diagnostic pop
@@ -33,12 +33,36 @@ static void _win32SocketStreamClose( struct Stream *stream )
 {
     struct Win32SocketStream *self = SELF( stream );
 
+    /* Reads still in flight have to be done with before the socket goes */
+    streamWin32Stop( &self->base );
     closesocket( ( intptr_t )self->base.source );
     self->base.source = INVALID_HANDLE_VALUE;
 
     streamWin32Close( &self->base );
 }
 
+// ====================================================================================================
+static bool _win32SocketStreamSend( struct Stream *stream, const void *buffer, size_t size )
+{
+    struct Win32SocketStream *self = SELF( stream );
+    const char *p = ( const char * )buffer;
+
+    while ( size )
+    {
+        int sent = send( ( SOCKET )( intptr_t )self->base.source, p, size, 0 );
+
+        if ( sent <= 0 )
+        {
+            return false;
+        }
+
+        p += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
 // ====================================================================================================
 static HANDLE _win32SocketStreamCreate( const char *server, int port )
 {
@@ -110,6 +134,7 @@ struct Stream *streamCreateSocket( const char *server, int port )
     }
 
     stream->base.base.close = _win32SocketStreamClose;
+    stream->base.base.send = _win32SocketStreamSend;
 
     return &stream->base.base;
 }
@@ -0,0 +1,555 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * SWO from Logic Analyser Samples
+ * ===============================
+ *
+ * A capture of the SWO pin by a logic analyser (sigrok-cli's binary output, or anything else that's just
+ * the samples one after another) decoded back into the bytes that were sent on it. The pin's samples are
+ * packed 64 to a word, so the edges in a word come from a single xor, and most words don't have any to
+ * look at. Everything after that goes from edge to edge.
+ *
+ * NRZ is a UART, 8N1 and idle high, with each byte sampled at the middle of the bit times after its start
+ * edge. Manchester is as the TPIU sends it; idle low, then a start bit (a 1) and the bits of the bytes,
+ * each with a transition half way through it, falling for a 1. Those transitions are what's decoded and
+ * each one sets the timing for the next, so there the bit time only has to be roughly right.
+ *
+ * Unless it's given, the bit time is found from the lengths of the runs between edges near the start of
+ * the capture. The shortest run there's a fair number of is a bit (or half of one, for Manchester), and
+ * the runs that are close to a whole number of those refine it.
+ *
+ */
+
+#include "stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "generics.h"
+#include "simd.h"
+
+#define SWO_CHUNK_WORDS   (4096)                /* Words of samples packed and decoded at a time */
+#define SWO_OUT_LEN       (SWO_CHUNK_WORDS*8)   /* Room for the bytes from them, for anything with 2 samples a bit or more */
+#define SWO_FRAC          (8)                   /* Times are kept in 1/256ths of a sample */
+#define SWO_MIN_BIT       (2<<SWO_FRAC)         /* ...and a bit has to be at least this long to be decoded */
+
+#define SWO_RECOVER_SAMPLES (64*1024*1024)      /* Most samples looked through to find the bit time */
+#define SWO_RECOVER_RUNS    (16384)             /* ...stopping once there are this many runs */
+#define SWO_RECOVER_MIN     (64)                /* ...and which needs at least this many */
+#define SWO_RECOVER_MAXK    (12)                /* Longest run, in units, used to refine it */
+
+enum SWOState
+{
+    SWO_IDLE,                                   /* Waiting for a start bit */
+    SWO_START,                                  /* Manchester start bit begun, waiting for its mid bit transition */
+    SWO_DATA                                    /* Taking the bits of a byte (NRZ) or a packet (Manchester) */
+};
+
+struct SWOSampleStream
+{
+    struct Stream base;
+    struct SWOSampleConfig c;
+    const struct SIMDKernels *k;
+
+    int file;
+    const uint8_t *map;                         /* Mapping of the capture */
+    size_t mapLen;                              /* ...its length */
+    uint64_t samples;                           /* ...the samples in it */
+    uint64_t pos;                               /* ...and how many of them are decoded */
+
+    uint64_t *w;                                /* The pin's samples, packed */
+    uint64_t prev;                              /* ...with the one before them in the top bit */
+    int64_t bit;                                /* Bit time, in 1/256ths of a sample */
+
+    enum SWOState state;
+    unsigned int level;                         /* Level of the line now */
+    int64_t at;                                 /* NRZ: next time to sample the line. Manchester: last transition that counted */
+    unsigned int nbits;                         /* Bits of the byte so far */
+    uint32_t sr;                                /* ...and the byte they're going into */
+
+    uint8_t out[SWO_OUT_LEN];                   /* Bytes decoded and not yet handed out */
+    size_t outLen;                              /* ...how many there are */
+    size_t outPos;                              /* ...and how many are handed out */
+
+    uint64_t bytes;                             /* Bytes decoded in all */
+    uint64_t errors;                            /* ...and ones lost to bad framing or cut short packets */
+};
+
+#define SELF(stream) ((struct SWOSampleStream*)(stream))
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Private routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline unsigned int _sampleAt( struct SWOSampleStream *self, uint64_t s )
+
+{
+    return ( self->map[s * self->c.unitSize + self->c.channel / 8] >> ( self->c.channel % 8 ) ) & 1;
+}
+// ====================================================================================================
+static void _pack( struct SWOSampleStream *self, uint64_t from, unsigned int n )
+
+/* Pack n samples from from into self->w. A part filled last word is padded out with the last sample. */
+
+{
+    unsigned int whole = n / 64;
+    unsigned int i;
+    uint64_t v;
+
+    if ( self->c.unitSize == 1 )
+    {
+        self->k->packBits( &self->map[from], whole, self->c.channel, self->w );
+    }
+    else
+    {
+        for ( i = 0; i < whole; i++ )
+        {
+            v = 0;
+
+            for ( unsigned int b = 0; b < 64; b++ )
+            {
+                v |= ( uint64_t )_sampleAt( self, from + i * 64 + b ) << b;
+            }
+
+            self->w[i] = v;
+        }
+    }
+
+    if ( n % 64 )
+    {
+        v = 0;
+
+        for ( i = 0; i < 64; i++ )
+        {
+            v |= ( uint64_t )_sampleAt( self, from + whole * 64 + ( ( i < n % 64 ) ? i : n % 64 - 1 ) ) << i;
+        }
+
+        self->w[whole] = v;
+    }
+}
+// ====================================================================================================
+static inline void _emit( struct SWOSampleStream *self, uint8_t c )
+
+{
+    if ( self->outLen < SWO_OUT_LEN )
+    {
+        self->out[self->outLen++] = c;
+        self->bytes++;
+    }
+}
+// ====================================================================================================
+static void _nrzAdvance( struct SWOSampleStream *self, int64_t t )
+
+/* Sample the line at the bit times before t, while it holds at the level it's at */
+
+{
+    while ( ( self->state == SWO_DATA ) && ( self->at < t ) )
+    {
+        if ( !self->nbits )
+        {
+            /* A start bit that's gone again by the middle of it was a glitch */
+            if ( self->level )
+            {
+                self->state = SWO_IDLE;
+                break;
+            }
+        }
+        else if ( self->nbits <= 8 )
+        {
+            self->sr |= self->level << ( self->nbits - 1 );
+        }
+        else
+        {
+            if ( self->level )
+            {
+                _emit( self, self->sr );
+            }
+            else
+            {
+                /* No stop bit */
+                self->errors++;
+            }
+
+            self->state = SWO_IDLE;
+        }
+
+        self->nbits++;
+        self->at += self->bit;
+    }
+}
+// ====================================================================================================
+static void _nrzEdge( struct SWOSampleStream *self, int64_t t, unsigned int level )
+
+{
+    _nrzAdvance( self, t );
+    self->level = level;
+
+    if ( ( self->state == SWO_IDLE ) && ( !level ) )
+    {
+        self->state = SWO_DATA;
+        self->nbits = 0;
+        self->sr = 0;
+        self->at = t + self->bit / 2;
+    }
+}
+// ====================================================================================================
+static void _manchesterEdge( struct SWOSampleStream *self, int64_t t, unsigned int level )
+
+{
+    int64_t dt = t - self->at;
+
+    self->level = level;
+
+    switch ( self->state )
+    {
+        case SWO_DATA:
+            if ( dt < 3 * self->bit / 4 )
+            {
+                /* Between two bits, so it doesn't say anything */
+                return;
+            }
+
+            if ( dt <= 3 * self->bit / 2 )
+            {
+                /* Half way through a bit, falling for a 1 */
+                self->sr |= ( !level ) << self->nbits;
+                self->at = t;
+
+                if ( ++self->nbits == 8 )
+                {
+                    _emit( self, self->sr );
+                    self->nbits = 0;
+                    self->sr = 0;
+                }
+
+                return;
+            }
+
+            /* A bit with nothing half way through it is the end of the packet, so this starts the next */
+            self->errors += ( self->nbits != 0 );
+            self->state = ( level ) ? SWO_START : SWO_IDLE;
+            self->at = t;
+            return;
+
+        case SWO_START:
+            if ( ( !level ) && ( dt > self->bit / 4 ) && ( dt < 3 * self->bit / 4 ) )
+            {
+                self->state = SWO_DATA;
+                self->nbits = 0;
+                self->sr = 0;
+                self->at = t;
+                return;
+            }
+
+            self->state = ( level ) ? SWO_START : SWO_IDLE;
+            self->at = t;
+            return;
+
+        default:
+            if ( level )
+            {
+                self->state = SWO_START;
+                self->at = t;
+            }
+
+            return;
+    }
+}
+// ====================================================================================================
+static void _decodeWords( struct SWOSampleStream *self, uint64_t s, unsigned int nw )
+
+/* Decode from the edges in nw packed words, the first of which is sample s */
+
+{
+    bool manchester = ( self->c.encoding == SWO_SAMPLES_MANCHESTER );
+    uint64_t v, e;
+    int64_t t;
+    unsigned int b;
+
+    for ( unsigned int i = 0; i < nw; i++, s += 64 )
+    {
+        v = self->w[i];
+        e = v ^ ( ( v << 1 ) | ( self->prev >> 63 ) );
+        self->prev = v;
+
+        while ( e )
+        {
+            b = __builtin_ctzll( e );
+            e &= e - 1;
+
+            /* The transition was somewhere between the sample before and this one */
+            t = ( ( int64_t )( s + b ) << SWO_FRAC ) - ( 1 << ( SWO_FRAC - 1 ) );
+
+            if ( manchester )
+            {
+                _manchesterEdge( self, t, ( v >> b ) & 1 );
+            }
+            else
+            {
+                _nrzEdge( self, t, ( v >> b ) & 1 );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _decodeChunk( struct SWOSampleStream *self )
+
+{
+    uint64_t left = self->samples - self->pos;
+    unsigned int n = ( left < SWO_CHUNK_WORDS * 64 ) ? left : SWO_CHUNK_WORDS * 64;
+
+    _pack( self, self->pos, n );
+    _decodeWords( self, self->pos, ( n + 63 ) / 64 );
+    self->pos += n;
+
+    if ( self->c.encoding == SWO_SAMPLES_NRZ )
+    {
+        /* Anything due before the end of these samples can be taken now */
+        _nrzAdvance( self, ( ( int64_t )self->pos << SWO_FRAC ) - ( 1 << ( SWO_FRAC - 1 ) ) );
+    }
+}
+// ====================================================================================================
+static int _compareRun( const void *a, const void *b )
+
+{
+    uint32_t x = *( const uint32_t * )a, y = *( const uint32_t * )b;
+    return ( x > y ) - ( x < y );
+}
+// ====================================================================================================
+static bool _recoverBit( struct SWOSampleStream *self )
+
+/* Find the bit time from the runs between edges near the start of the capture */
+
+{
+    uint64_t toScan = ( self->samples < SWO_RECOVER_SAMPLES ) ? self->samples : SWO_RECOVER_SAMPLES;
+    uint32_t *run = ( uint32_t * )malloc( SWO_RECOVER_RUNS * sizeof( uint32_t ) );
+    uint64_t s = 0, lastEdge = 0, sumRun = 0, sumK = 0, v, e;
+    unsigned int nruns = 0, n, b;
+    bool seen = false;
+    uint32_t unit, k;
+
+    MEMCHECK( run, false );
+    self->prev = ( uint64_t )_sampleAt( self, 0 ) << 63;
+
+    while ( ( s < toScan ) && ( nruns < SWO_RECOVER_RUNS ) )
+    {
+        n = ( toScan - s < SWO_CHUNK_WORDS * 64 ) ? toScan - s : SWO_CHUNK_WORDS * 64;
+        _pack( self, s, n );
+
+        for ( unsigned int i = 0; ( i < ( n + 63 ) / 64 ) && ( nruns < SWO_RECOVER_RUNS ); i++ )
+        {
+            v = self->w[i];
+            e = v ^ ( ( v << 1 ) | ( self->prev >> 63 ) );
+            self->prev = v;
+
+            while ( ( e ) && ( nruns < SWO_RECOVER_RUNS ) )
+            {
+                b = __builtin_ctzll( e );
+                e &= e - 1;
+
+                /* The run before the first edge could have started any time before the capture did */
+                if ( seen )
+                {
+                    run[nruns++] = s + i * 64 + b - lastEdge;
+                }
+
+                seen = true;
+                lastEdge = s + i * 64 + b;
+            }
+        }
+
+        s += n;
+    }
+
+    if ( nruns < SWO_RECOVER_MIN )
+    {
+        free( run );
+        return false;
+    }
+
+    /* A few very short runs could be glitches, so the unit is taken a little way up from the shortest */
+    qsort( run, nruns, sizeof( uint32_t ), _compareRun );
+    unit = run[nruns / 50];
+
+    for ( unsigned int i = 0; i < nruns; i++ )
+    {
+        k = ( 2 * run[i] + unit ) / ( 2 * unit );
+
+        if ( ( k ) && ( k <= SWO_RECOVER_MAXK ) && ( 4 * ( ( run[i] > k * unit ) ? run[i] - k * unit : k * unit - run[i] ) <= unit ) )
+        {
+            sumRun += run[i];
+            sumK += k;
+        }
+    }
+
+    free( run );
+
+    if ( !sumK )
+    {
+        return false;
+    }
+
+    self->bit = ( sumRun << SWO_FRAC ) / sumK;
+
+    if ( self->c.encoding == SWO_SAMPLES_MANCHESTER )
+    {
+        /* ...what was found there was half a bit */
+        self->bit *= 2;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static enum ReceiveResult _swoSampleStreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    struct SWOSampleStream *self = SELF( stream );
+
+    *receivedSize = 0;
+
+    while ( self->outPos == self->outLen )
+    {
+        if ( self->pos == self->samples )
+        {
+            return RECEIVE_RESULT_EOF;
+        }
+
+        self->outPos = self->outLen = 0;
+        _decodeChunk( self );
+    }
+
+    *receivedSize = ( self->outLen - self->outPos < bufferSize ) ? self->outLen - self->outPos : bufferSize;
+    memcpy( buffer, &self->out[self->outPos], *receivedSize );
+    self->outPos += *receivedSize;
+    return RECEIVE_RESULT_OK;
+}
+// ====================================================================================================
+static void _swoSampleStreamClose( struct Stream *stream )
+{
+    struct SWOSampleStream *self = SELF( stream );
+
+    genericsReport( V_INFO, "%" PRIu64 " bytes decoded from %" PRIu64 " SWO samples, %" PRIu64 " lost to bad framing" EOL,
+                    self->bytes, self->pos, self->errors );
+
+    if ( self->map )
+    {
+        munmap( ( void * )self->map, self->mapLen );
+    }
+
+    free( self->w );
+    close( self->file );
+}
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+// Malloc leak is deliberately ignored. That is the central purpose of this code!
+#pragma GCC diagnostic push
+#if !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+#endif
+
+struct Stream *streamCreateSWOSamples( const char *file, const struct SWOSampleConfig *c )
+
+{
+    struct SWOSampleStream *self;
+    struct stat st;
+
+    if ( ( !c->unitSize ) || ( c->channel >= 8 * c->unitSize ) )
+    {
+        genericsReport( V_ERROR, "Channel %u isn't in a %u byte sample" EOL, c->channel, c->unitSize );
+        return NULL;
+    }
+
+    self = SELF( calloc( 1, sizeof( struct SWOSampleStream ) ) );
+    MEMCHECK( self, NULL );
+    self->c = *c;
+    self->k = SIMDKernels();
+    self->w = ( uint64_t * )malloc( SWO_CHUNK_WORDS * sizeof( uint64_t ) );
+    MEMCHECK( self->w, NULL );
+
+    self->base.receive = _swoSampleStreamReceive;
+    self->base.close = _swoSampleStreamClose;
+
+    if ( ( self->file = open( file, O_RDONLY ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Can't open file %s" EOL, file );
+        goto fail;
+    }
+
+    /* The whole capture is mapped, there's no following a file that's still being written */
+    if ( ( fstat( self->file, &st ) < 0 ) || ( !S_ISREG( st.st_mode ) ) || ( ( size_t )st.st_size < c->unitSize ) )
+    {
+        genericsReport( V_ERROR, "%s isn't a file of samples" EOL, file );
+        goto fail;
+    }
+
+    self->mapLen = st.st_size;
+    void *m = mmap( NULL, self->mapLen, PROT_READ, MAP_SHARED, self->file, 0 );
+
+    if ( m == MAP_FAILED )
+    {
+        genericsReport( V_ERROR, "Can't map %s" EOL, file );
+        goto fail;
+    }
+
+    madvise( m, self->mapLen, MADV_SEQUENTIAL );
+    self->map = ( const uint8_t * )m;
+    self->samples = self->mapLen / c->unitSize;
+
+    if ( c->samplesPerBit > 0 )
+    {
+        self->bit = ( int64_t )( c->samplesPerBit * ( 1 << SWO_FRAC ) );
+    }
+    else if ( !_recoverBit( self ) )
+    {
+        genericsReport( V_ERROR, "Couldn't find the bit rate in %s, there aren't enough edges" EOL, file );
+        goto fail;
+    }
+
+    if ( self->bit < SWO_MIN_BIT )
+    {
+        genericsReport( V_ERROR, "%.2f samples a bit are too few to decode" EOL, ( double )self->bit / ( 1 << SWO_FRAC ) );
+        goto fail;
+    }
+
+    genericsReport( V_INFO, "%s SWO at %.2f samples a bit" EOL, ( c->encoding == SWO_SAMPLES_MANCHESTER ) ? "Manchester" : "NRZ",
+                    ( double )self->bit / ( 1 << SWO_FRAC ) );
+
+    /* The line starts out at whatever the first sample says, there's no edge before it */
+    self->level = _sampleAt( self, 0 );
+    self->prev = ( uint64_t )self->level << 63;
+    return &self->base;
+
+fail:
+
+    if ( self->map )
+    {
+        munmap( ( void * )self->map, self->mapLen );
+    }
+
+    if ( self->file >= 0 )
+    {
+        close( self->file );
+    }
+
+    free( self->w );
+    free( self );
+    return NULL;
+}
+
+#pragma GCC diagnostic pop
+// ====================================================================================================
@@ -1,7 +1,17 @@
 #include "stream_win32.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "generics.h"
 
 #define SELF( stream ) ( ( struct Win32Stream* )( stream ) )
 
+/* Several reads are kept in flight, each into a buffer of its own, so the source always has somewhere */
+/* to put data while we are busy with what came before. They are handed out in the order they were     */
+/* issued, which is the order the data arrives in. For files on disk each read is for the next part of */
+/* the file, and anything issued past a short read is thrown away and asked for again, since the file  */
+/* may have grown in the meantime.                                                                     */
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -24,70 +34,213 @@ static uint32_t _convertTimeout( const struct timeval *timeout )
 }
 
 // ====================================================================================================
-static enum ReceiveResult _win32StreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
-        struct timeval *timeout, size_t *receivedSize )
+static void _issue( struct Win32Stream *self )
+
+/* Get as many reads going as there is room for */
+
 {
-    struct Win32Stream *self = SELF( stream );
+    struct Win32Read *r;
 
-    *receivedSize = 0;
+    while ( ( self->wp - self->rp < WIN32_STREAM_READS ) && ( !self->stalled ) )
+    {
+        r = &self->r[self->wp % WIN32_STREAM_READS];
+        HANDLE e = r->o.hEvent;
+        memset( &r->o, 0, sizeof( r->o ) );
+        r->o.hEvent = e;
+        r->o.Offset = self->readOffset & UINT32_MAX;
+        r->o.OffsetHigh = ( self->readOffset >> 32 ) & UINT32_MAX;
+        r->done = false;
+        r->len = 0;
+        self->wp++;
+
+        if ( ( !ReadFile( self->source, r->d, WIN32_STREAM_READ_LEN, NULL, &r->o ) ) && ( GetLastError() != ERROR_IO_PENDING ) )
+        {
+            /* It's finished already, badly, so there's no sense asking for more after it */
+            r->result = ( GetLastError() == ERROR_HANDLE_EOF ) ? RECEIVE_RESULT_EOF : RECEIVE_RESULT_ERROR;
+            r->done = true;
+            self->stalled = true;
+            break;
+        }
+
+        if ( self->seekable )
+        {
+            self->readOffset += WIN32_STREAM_READ_LEN;
+        }
+    }
+}
+
+// ====================================================================================================
+static void _discard( struct Win32Stream *self, unsigned int from )
 
-    OVERLAPPED asyncRead;
-    memset( &asyncRead, 0, sizeof( asyncRead ) );
-    asyncRead.hEvent = self->readDoneEvent;
-    asyncRead.Offset = self->readOffset & UINT32_MAX;
-    asyncRead.OffsetHigh = ( self->readOffset >> 32 ) & UINT32_MAX;
+/* Cancel and forget all of the reads from this one on */
 
+{
     DWORD bytesRead;
-    bool readResult = ReadFile( self->source, buffer, bufferSize, &bytesRead, &asyncRead );
 
-    if ( readResult )
+    for ( unsigned int i = from; i != self->wp; i++ )
     {
-        *receivedSize = bytesRead;
-        asyncRead.Offset += bytesRead;
-        return RECEIVE_RESULT_OK;
+        struct Win32Read *r = &self->r[i % WIN32_STREAM_READS];
+
+        if ( !r->done )
+        {
+            CancelIoEx( self->source, &r->o );
+            GetOverlappedResult( self->source, &r->o, &bytesRead, true );
+            r->done = true;
+        }
     }
 
-    if ( GetLastError() != ERROR_IO_PENDING )
+    self->wp = from;
+}
+
+// ====================================================================================================
+static bool _complete( struct Win32Stream *self, struct Win32Read *r, struct timeval *timeout )
+
+/* Wait for the read to finish, returning false if it didn't in time */
+
+{
+    DWORD bytesRead;
+
+    if ( r->done )
     {
-        return RECEIVE_RESULT_ERROR;
+        return true;
     }
 
-    // async operation
+    if ( WaitForSingleObjectEx( r->o.hEvent, _convertTimeout( timeout ), true ) != WAIT_OBJECT_0 )
+    {
+        /* It's left going, to be picked up next time */
+        return false;
+    }
 
-    DWORD waitResult = WaitForSingleObjectEx( self->readDoneEvent, _convertTimeout( timeout ), true );
+    r->done = true;
 
-    if ( waitResult == WAIT_TIMEOUT )
+    if ( !GetOverlappedResult( self->source, &r->o, &bytesRead, false ) )
     {
-        CancelIoEx( self->source, &asyncRead );
-        WaitForSingleObjectEx( self->readDoneEvent, INFINITE, true );
-        GetOverlappedResult( self->source, &asyncRead, &bytesRead, true );
-        return RECEIVE_RESULT_TIMEOUT;
+        r->result = ( GetLastError() == ERROR_HANDLE_EOF ) ? RECEIVE_RESULT_EOF : RECEIVE_RESULT_ERROR;
+        bytesRead = 0;
     }
+    else
+    {
+        /* Nothing at all from a socket or pipe means whoever was at the other end has gone */
+        r->result = ( bytesRead ) ? RECEIVE_RESULT_OK : ( self->seekable ) ? RECEIVE_RESULT_EOF : RECEIVE_RESULT_ERROR;
+    }
+
+    r->len = bytesRead;
 
-    if ( GetOverlappedResult( self->source, &asyncRead, &bytesRead, true ) == 0 )
+    if ( ( self->seekable ) && ( bytesRead < WIN32_STREAM_READ_LEN ) )
     {
-        if ( GetLastError() != ERROR_HANDLE_EOF )
-        {
-            return RECEIVE_RESULT_ERROR;
-        }
+        /* Got to the end of the file, so whatever was asked for after this will have to be asked for again */
+        _discard( self, self->rp + 1 );
+        self->readOffset = ( ( uint64_t )r->o.OffsetHigh << 32 ) + r->o.Offset + bytesRead;
     }
 
-    *receivedSize = bytesRead;
+    if ( r->result != RECEIVE_RESULT_OK )
+    {
+        self->stalled = true;
+    }
+
+    return true;
+}
 
-    if ( bytesRead == 0 )
+// ====================================================================================================
+static void _giveBack( struct Win32Stream *self )
+
+/* Take back whatever was lent, and use the buffer for another read once it's all gone */
+
+{
+    self->ofs += self->lent;
+    self->lent = 0;
+
+    if ( ( self->wp != self->rp ) && ( self->r[self->rp % WIN32_STREAM_READS].done ) &&
+            ( self->ofs == self->r[self->rp % WIN32_STREAM_READS].len ) &&
+            ( self->r[self->rp % WIN32_STREAM_READS].result == RECEIVE_RESULT_OK ) )
     {
-        if ( GetLastError() == ERROR_HANDLE_EOF )
-        {
-            return RECEIVE_RESULT_EOF;
-        }
-        else
-        {
-            return RECEIVE_RESULT_TIMEOUT;
-        }
+        self->ofs = 0;
+        self->rp++;
+    }
+}
+
+// ====================================================================================================
+static struct Win32Read *_next( struct Win32Stream *self, struct timeval *timeout, enum ReceiveResult *result )
+
+/* Find the read that's next to be handed out, once it's finished with something in it */
+
+{
+    struct Win32Read *r;
+
+    _giveBack( self );
+    _issue( self );
+
+    r = &self->r[self->rp % WIN32_STREAM_READS];
+
+    if ( ( self->wp == self->rp ) || ( !_complete( self, r, timeout ) ) )
+    {
+        *result = RECEIVE_RESULT_TIMEOUT;
+        return NULL;
+    }
+
+    if ( ( *result = r->result ) != RECEIVE_RESULT_OK )
+    {
+        /* This is reported once, then reading carries on (a file may grow, for example) */
+        self->rp++;
+        self->stalled = false;
+        return NULL;
+    }
+
+    return r;
+}
+
+// ====================================================================================================
+static enum ReceiveResult _win32StreamReceive( struct Stream *stream, void *buffer, size_t bufferSize,
+        struct timeval *timeout, size_t *receivedSize )
+{
+    struct Win32Stream *self = SELF( stream );
+    enum ReceiveResult result;
+    struct Win32Read *r;
+
+    *receivedSize = 0;
+
+    if ( ( r = _next( self, timeout, &result ) ) )
+    {
+        *receivedSize = ( r->len - self->ofs < bufferSize ) ? r->len - self->ofs : bufferSize;
+        memcpy( buffer, &r->d[self->ofs], *receivedSize );
+        self->ofs += *receivedSize;
     }
 
-    self->readOffset += bytesRead;
-    return RECEIVE_RESULT_OK;
+    return result;
+}
+
+// ====================================================================================================
+static enum ReceiveResult _win32StreamAcquire( struct Stream *stream, const void **data, size_t maxSize,
+        struct timeval *timeout, size_t *receivedSize )
+
+/* As receive, but lending out the read buffer itself until it's released */
+
+{
+    struct Win32Stream *self = SELF( stream );
+    enum ReceiveResult result;
+    struct Win32Read *r;
+
+    *receivedSize = 0;
+
+    if ( ( r = _next( self, timeout, &result ) ) )
+    {
+        *receivedSize = ( r->len - self->ofs < maxSize ) ? r->len - self->ofs : maxSize;
+        *data = &r->d[self->ofs];
+        self->lent = *receivedSize;
+    }
+
+    return result;
+}
+
+// ====================================================================================================
+static bool _win32StreamRelease( struct Stream *stream )
+
+{
+    struct Win32Stream *self = SELF( stream );
+
+    _giveBack( self );
+    _issue( self );
+    return true;
 }
 
 // ====================================================================================================
@@ -114,23 +267,50 @@ bool streamWin32Initialize( struct Win32Stream *stream, HANDLE sourceHandle )
     }
 
     stream->base.receive = _win32StreamReceive;
+    stream->base.acquire = _win32StreamAcquire;
+    stream->base.release = _win32StreamRelease;
     stream->base.close = _win32StreamCloseInner;
     stream->source = sourceHandle;
-    stream->readDoneEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    stream->seekable = ( GetFileType( sourceHandle ) == FILE_TYPE_DISK );
+
+    /* Nothing is read yet, whoever made us may still want to say where from */
+    for ( unsigned int i = 0; i < WIN32_STREAM_READS; i++ )
+    {
+        stream->r[i].d = ( uint8_t * )malloc( WIN32_STREAM_READ_LEN );
+        MEMCHECK( stream->r[i].d, false );
+        stream->r[i].o.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+    }
 
     return true;
 }
 
+// ====================================================================================================
+void streamWin32Stop( struct Win32Stream *stream )
+
+/* Cancel whatever is still in flight, ready for the source to be closed */
+
+{
+    if ( stream->source != INVALID_HANDLE_VALUE )
+    {
+        _discard( stream, stream->rp );
+    }
+}
+
 // ====================================================================================================
 void streamWin32Close( struct Win32Stream *stream )
 {
     if ( stream->source != INVALID_HANDLE_VALUE )
     {
-        CancelIo( stream->source );
+        streamWin32Stop( stream );
         CloseHandle( stream->source );
         stream->source = INVALID_HANDLE_VALUE;
     }
 
-    CloseHandle( stream->readDoneEvent );
-    stream->readDoneEvent = INVALID_HANDLE_VALUE;
-}
\ No newline at end of file
+    for ( unsigned int i = 0; i < WIN32_STREAM_READS; i++ )
+    {
+        free( stream->r[i].d );
+        stream->r[i].d = NULL;
+        CloseHandle( stream->r[i].o.hEvent );
+        stream->r[i].o.hEvent = INVALID_HANDLE_VALUE;
+    }
+}
@@ -9,36 +9,54 @@
 #include <stdio.h>
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "generics.h"
+#include "loadelf.h"
+
+/* loadelf has its own (signed) versions of these, we want the ones from symbols.h */
+#undef NO_LINE
+#undef NO_FILE
+#undef NO_DESTADDRESS
 #include "symbols.h"
-#if defined(WIN32)
-    #include <Windows.h>
-    #include <io.h>
-    #include <fcntl.h>
+#define MEM_ACCOUNT_UTHASH
+#include "memAccount.h"
+
+#if ( SYMBOLS_MAX_ELF != SYMBOL_MAX_IMAGES )
+    #error "SYMBOLS_MAX_ELF and SYMBOL_MAX_IMAGES have to match"
 #endif
 
 #define MAX_LINE_LEN (4096)
 #define ELF_RELOAD_DELAY_TIME 1000000   /* Time before elf reload will be attempted when its been lost */
 
-#define OBJDUMP "arm-none-eabi-objdump"
-#define OBJENVNAME "OBJDUMP"
-
-#define SOURCE_INDICATOR "sRc##"
 #define SYM_NOT_FOUND (0xffffffff)
 
+#define MAP_MAX_SPAN        (16*1024*1024) /* Largest address span we will direct map */
+#define MAP_MAX_SPARSENESS  (4)            /* ...and how much of it can be holes before we don't bother */
+#define MAP_NO_ASSY         (0xffff)       /* No assembly at this address in the map */
+
+#define ASSY_SPILL_LEN      (256)          /* Source line memory that fits on the stack when it crosses regions */
+
 #define NO_FUNCTION_TXT "No Function Name"
 #define NO_FILE_TXT      "No Source"
 
-//#define GPTI_DEBUG 1                 /* Define this for objdump data collection state machine trace */
+/* A symbol set being loaded in the background. Only the loading thread touches it until done is set. */
+struct SymbolReload
+{
+    pthread_t thread;
+    atomic_bool done;
 
-#ifdef GPTI_DEBUG
-    #define GTPIP(...) { fprintf(stderr, __VA_ARGS__); }
-#else
-    #define GTPIP(...) {}
-#endif
+    char *filename;
+    char *deleteMaterial;
+    char *objdumpOptions;
+    bool demanglecpp;
+    bool recordSource;
+    bool recordAssy;
 
-enum LineType { LT_NULL, LT_NOISE, LT_PROC_LABEL, LT_LABEL, LT_SOURCE, LT_ASSEMBLY, LT_FILEANDLINE, LT_NEWLINE, LT_ERROR };
-enum ProcessingState {PS_IDLE, PS_GET_SOURCE, PS_GET_ASSY} ps = PS_IDLE;
+    struct SymbolSet *s;                   /* What was loaded */
+    enum symbolErr err;                    /* ...and how it went */
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -47,19 +65,90 @@ enum ProcessingState {PS_IDLE, PS_GET_SOURCE, PS_GET_ASSY} ps = PS_IDLE;
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static uint32_t _getFileEntryIdx( struct SymbolSet *s, char *filename )
+static bool _statDiffers( const struct stat *a, const struct stat *b )
 
-/* Get index to file entry in the files table, or SYM_NOT_FOUND */
+/* Check filesize, modification time and status change time for any differences */
 
 {
-    uint32_t i = 0;
+    return ( ( memcmp( &a->st_size, &b->st_size, sizeof( off_t ) ) ) ||
+#ifdef OSX
+             ( memcmp( &a->st_mtimespec, &b->st_mtimespec, sizeof( struct timespec ) ) ) ||
+             ( memcmp( &a->st_ctimespec, &b->st_ctimespec, sizeof( struct timespec ) ) )
+#elif WIN32
+             ( memcmp( &a->st_mtime, &b->st_mtime, sizeof( a->st_mtime ) ) ) ||
+             ( memcmp( &a->st_ctime, &b->st_ctime, sizeof( a->st_ctime ) ) )
+#else
+             ( memcmp( &a->st_mtim, &b->st_mtim, sizeof( struct timespec ) ) ) ||
+             ( memcmp( &a->st_ctim, &b->st_ctim, sizeof( struct timespec ) ) )
+#endif
+           );
+}
+// ====================================================================================================
+static bool _statImages( const char *filename, struct stat *st, unsigned int *n )
+
+/* Stat each of the elf files in the list, false if any of them isn't a file that's there */
 
-    while ( ( i < s->fileCount ) && ( strcmp( s->files[i].name, filename ) ) )
+{
+    char name[PATH_MAX];
+    symbolMemaddr offset;
+
+    *n = 0;
+
+    while ( ( filename = symbolNextImage( filename, name, sizeof( name ), &offset ) ) )
     {
-        i++;
+        if ( ( *n == SYMBOLS_MAX_ELF ) || ( stat( name, &st[*n] ) != 0 ) || !( st[*n].st_mode & S_IFREG ) )
+        {
+            return false;
+        }
+
+        ( *n )++;
     }
 
-    return ( i < s->fileCount ) ? i : SYM_NOT_FOUND;
+    return ( *n != 0 );
+}
+// ====================================================================================================
+static uint32_t _nameFind( struct symbolName *idx, const char *name )
+
+/* Get index of name in the table idx covers, or SYM_NOT_FOUND */
+
+{
+    struct symbolName *n;
+
+    HASH_FIND_STR( idx, name, n );
+    return ( n ) ? n->index : SYM_NOT_FOUND;
+}
+// ====================================================================================================
+static void _nameAdd( struct symbolName **idx, const char *name, uint32_t index )
+
+/* Record where name is in the table...name has to stay put for as long as the index is around */
+
+{
+    struct symbolName *n = ( struct symbolName * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct symbolName ) );
+    MEMCHECKV( n );
+
+    n->name = name;
+    n->index = index;
+    HASH_ADD_KEYPTR( hh, *idx, n->name, strlen( n->name ), n );
+}
+// ====================================================================================================
+static void _nameIndexDelete( struct symbolName **idx )
+
+{
+    struct symbolName *n, *t;
+
+    HASH_ITER( hh, *idx, n, t )
+    {
+        HASH_DEL( *idx, n );
+        memFree( MEM_SYMBOLS, n );
+    }
+}
+// ====================================================================================================
+static uint32_t _getFileEntryIdx( struct SymbolSet *s, char *filename )
+
+/* Get index to file entry in the files table, or SYM_NOT_FOUND */
+
+{
+    return _nameFind( s->fileIndex, filename );
 }
 // ====================================================================================================
 static uint32_t _getOrAddFileEntryIdx( struct SymbolSet *s, char *filename )
@@ -89,10 +178,12 @@ static uint32_t _getOrAddFileEntryIdx( struct SymbolSet *s, char *filename )
     if ( SYM_NOT_FOUND == f )
     {
         /* Doesn't exist, so create it */
-        s->files = ( struct fileEntry * )realloc( s->files, sizeof( struct fileEntry ) * ( s->fileCount + 1 ) );
+        s->files = ( struct fileEntry * )memRealloc( MEM_SYMBOLS, s->files, sizeof( struct fileEntry ) * ( s->fileCount + 1 ) );
         f = s->fileCount;
         memset( &( s->files[f] ), 0, sizeof( struct fileEntry ) );
-        s->files[f].name = strdup( fl );
+        s->files[f].name = memStrdup( MEM_SYMBOLS, fl );
+        MEMCHECK( s->files[f].name, 0 );
+        _nameAdd( &s->fileIndex, s->files[f].name, f );
         s->fileCount++;
     }
 
@@ -104,14 +195,7 @@ static uint32_t _getFunctionEntryIdx( struct SymbolSet *s, char *function )
 /* Get index to file entry in the functions table, or SYM_NOT_FOUND */
 
 {
-    uint32_t i = 0;
-
-    while ( ( i < s->functionCount ) && ( strcmp( s->functions[i].name, function ) ) )
-    {
-        i++;
-    }
-
-    return ( i < s->functionCount ) ? i : SYM_NOT_FOUND;
+    return _nameFind( s->functionIndex, function );
 }
 // ====================================================================================================
 // Strdup leak is deliberately ignored. That is the central purpose of this code!
@@ -129,31 +213,18 @@ static uint32_t _getOrAddFunctionEntryIdx( struct SymbolSet *s, char *function )
     if ( SYM_NOT_FOUND == f )
     {
         /* Doesn't exist, so create it */
-        s->functions = ( struct functionEntry * )realloc( s->functions, sizeof( struct functionEntry ) * ( s->functionCount + 1 ) );
+        s->functions = ( struct functionEntry * )memRealloc( MEM_SYMBOLS, s->functions, sizeof( struct functionEntry ) * ( s->functionCount + 1 ) );
         f = s->functionCount;
         memset( &( s->functions[f] ), 0, sizeof( struct functionEntry ) );
-        s->functions[f].name = strdup( function );
+        s->functions[f].name = memStrdup( MEM_SYMBOLS, function );
         MEMCHECK( s->functions[f].name, 0 );
+        _nameAdd( &s->functionIndex, s->functions[f].name, f );
         s->functionCount++;
     }
 
     return f;
 }
 #pragma GCC diagnostic pop
-// ====================================================================================================
-static struct sourceLineEntry *_AddSourceLineEntry( struct SymbolSet *s )
-
-/* Add an entry to the sources table, and return a pointer to created entry */
-
-{
-    struct sourceLineEntry *src;
-    s->sources = ( struct sourceLineEntry * )realloc( s->sources, sizeof( struct sourceLineEntry ) * ( s->sourceCount + 1 ) );
-    src = &s->sources[s->sourceCount];
-    memset( src, 0, sizeof( struct sourceLineEntry ) );
-    s->sourceCount++;
-    return src;
-}
-
 // ====================================================================================================
 static int _compareLines( const void *a, const void *b )
 
@@ -189,666 +260,571 @@ static void _sortLines( struct SymbolSet *s )
 }
 
 // ====================================================================================================
-static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
-                          uint32_t *fileindex, uint32_t *functionindex, uint32_t *pline,
-                          uint16_t *linesInBlock, const char **psource,
-                          const struct assyLineEntry **assy,
-                          uint32_t *assyLine )
+static uint32_t _eytzinger( struct SymbolSet *s, uint32_t *sorted, uint32_t i, uint32_t k )
 
-/* Find symbol and return pointers to contents */
+/* Lay the sorted line indicies out in Eytzinger (breadth first) order, so searches walk down through memory */
 
 {
-    struct sourceLineEntry needle = { .startAddr = workingAddr, .endAddr = workingAddr };
-    struct sourceLineEntry *found = bsearch( &needle, s->sources, s->sourceCount, sizeof( struct sourceLineEntry ), _compareLines );
-
-    if ( found )
+    if ( k <= s->eytCount )
     {
-        *pline         = found->lineNo;
-        *linesInBlock  = found->linesInBlock;
-        *psource       = found->lineText;
-        *assy          = found->assy;
-        *fileindex     = found->fileIdx;
-        *functionindex = found->functionIdx;
-
-        /* If there is assembly then match the line too */
-        for ( *assyLine = 0; *assyLine < found->assyLines; ( *assyLine )++ )
-        {
-            if ( ( *assy )[*assyLine].addr == workingAddr )
-            {
-                break;
-            }
-        }
-
-        /* If the assembly line wasn't found then indicate that */
-        if ( *assyLine == found->assyLines )
-        {
-            *assyLine = ASSY_NOT_FOUND;
-        }
-
-        return true;
+        i = _eytzinger( s, sorted, i, 2 * k );
+        s->eytSource[k] = sorted[i++];
+        s->eytEnd[k] = s->sources[s->eytSource[k]].endAddr;
+        i = _eytzinger( s, sorted, i, 2 * k + 1 );
     }
 
-    return false;
+    return i;
 }
 // ====================================================================================================
-static enum LineType _getLineType( char *sourceLine, char *p1, char *p2, char *p3, char *p4 )
+static void _buildAddrIndex( struct SymbolSet *s )
 
-/* Analyse line returned by objdump and categorise it. If objdump output is misinterpreted, this is the first place to check */
+/* Build the address lookup. For a dense image this is a table indexed directly by halfword offset, mapping */
+/* straight to the line and assembly entry. If that would be too big we fall back to an Eytzinger search.   */
 
 {
-    /* If it's empty, something is badly wrong */
-    if ( !*sourceLine )
-    {
-        return LT_NULL;
-    }
+    uint32_t lo = 0xffffffff;
+    uint32_t hi = 0;
+    uint64_t covered = 0;
+    uint32_t *sorted;
 
-    /* If it starts with a source tag, it's unambigious */
-    if ( !strncmp( sourceLine, SOURCE_INDICATOR, strlen( SOURCE_INDICATOR ) ) )
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
     {
-        return LT_SOURCE;
-    }
-
-    /* If it has an address followed by pairs of hex digits then it's a data block and we're not interested */
-    if ( 1 == sscanf( sourceLine, " %*[0-9a-fA-F]: %[0-9a-fA-F]", p1 ) )
-    {
-        /* Match is two digits followed by a whitespace */
-        if ( ( isxdigit( *p1 ) ) && ( isxdigit( *( p1 + 1 ) ) ) && ( !( *( p1 + 2 ) ) ) )
+        if ( s->sources[i].startAddr <= s->sources[i].endAddr )
         {
-            return LT_NOISE;
+            lo = ( s->sources[i].startAddr < lo ) ? s->sources[i].startAddr : lo;
+            hi = ( s->sources[i].endAddr > hi ) ? s->sources[i].endAddr : hi;
+            covered += s->sources[i].endAddr - s->sources[i].startAddr + 1;
         }
     }
 
-    /* If it has something with <xxx> in it, it's a proc label (function) */
-    if ( 2 == sscanf( sourceLine, "%[0-9a-fA-F] <%[^>]>", p1, p2 ) )
+    if ( !covered )
     {
-        return LT_PROC_LABEL;
+        return;
     }
 
-    /* If it has (): on the end it's a label */
-    if ( 2 == sscanf( sourceLine, "%[^(]()%c", p1, p2 ) )
+    if ( ( hi - lo < MAP_MAX_SPAN ) && ( hi - lo < covered * MAP_MAX_SPARSENESS ) )
     {
-        if ( *p2 == ':' )
+        s->mapBase   = lo & ~1;
+        s->mapLen    = ( ( hi - s->mapBase ) >> 1 ) + 1;
+        s->mapSource = ( uint32_t * )memAlloc( MEM_SYMBOLS, s->mapLen * sizeof( uint32_t ) );
+        s->mapAssy   = ( uint16_t * )memAlloc( MEM_SYMBOLS, s->mapLen * sizeof( uint16_t ) );
+        MEMCHECKV( s->mapSource );
+        MEMCHECKV( s->mapAssy );
+        memset( s->mapSource, 0xff, s->mapLen * sizeof( uint32_t ) );
+        memset( s->mapAssy, 0xff, s->mapLen * sizeof( uint16_t ) );
+
+        for ( uint32_t i = 0; i < s->sourceCount; i++ )
         {
-            return LT_LABEL;
-        }
-    }
-
-    /* If it starts with a space and has specific fields, it's a 16 or 32 bit assembly line */
-    if ( 4 == sscanf( sourceLine, " %[0-9a-fA-F]: %[0-9a-fA-F]%*1[ ]%[0-9a-fA-F] %[^\n]", p1, p2, p3, p4 ) )
-    {
-        return LT_ASSEMBLY;
-    }
+            struct sourceLineEntry *l = &s->sources[i];
 
-    *p2 = 0;
+            for ( uint32_t a = l->startAddr & ~1; ( l->startAddr <= l->endAddr ) && ( a <= l->endAddr ); a += 2 )
+            {
+                s->mapSource[( a - s->mapBase ) >> 1] = i;
+            }
 
-    if ( 3 == sscanf( sourceLine, " %[0-9a-fA-F]: %[0-9a-fA-F] %[^\n]", p1, p3, p4 ) )
-    {
-        return LT_ASSEMBLY;
-    }
+            for ( uint32_t j = 0; ( j < l->assyLines ) && ( j < MAP_NO_ASSY ); j++ )
+            {
+                if ( ( l->assy[j].addr >= s->mapBase ) && ( ( l->assy[j].addr - s->mapBase ) >> 1 < s->mapLen ) )
+                {
+                    s->mapAssy[( l->assy[j].addr - s->mapBase ) >> 1] = j;
+                }
+            }
+        }
 
-    /* If it contains text:num then it's a file and line */
-    if ( 2 == sscanf( sourceLine, "%[^:]:%[0-9]", p1, p2 ) )
-    {
-        return LT_FILEANDLINE;
+        return;
     }
 
-    /* Alternative form for Windows; If it contains Drive:text:num then it's a file and line */
-    if ( 3 == sscanf( sourceLine, "%2c%[^:]:%[0-9]", p1, &p1[2], p2 ) )
-    {
-        return LT_FILEANDLINE;
-    }
+    /* Sparse, so collect the lines that cover memory, they're already in address order */
+    sorted = ( uint32_t * )memAlloc( MEM_SYMBOLS, s->sourceCount * sizeof( uint32_t ) );
+    MEMCHECKV( sorted );
 
-    /* If it contains nothing other than newline then its a newline */
-    if ( ( *sourceLine == '\n' ) || ( *sourceLine == '\r' ) )
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
     {
-        return LT_NEWLINE;
+        if ( s->sources[i].startAddr <= s->sources[i].endAddr )
+        {
+            sorted[s->eytCount++] = i;
+        }
     }
 
-    /* ...otherwise we consider it junk */
-    return LT_NOISE;
+    s->eytSource = ( uint32_t * )memAlloc( MEM_SYMBOLS, ( s->eytCount + 1 ) * sizeof( uint32_t ) );
+    s->eytEnd    = ( uint32_t * )memAlloc( MEM_SYMBOLS, ( s->eytCount + 1 ) * sizeof( uint32_t ) );
+    MEMCHECKV( s->eytSource );
+    MEMCHECKV( s->eytEnd );
+    _eytzinger( s, sorted, 0, 1 );
+    memFree( MEM_SYMBOLS, sorted );
 }
 // ====================================================================================================
-static bool _getDest( char *assy, uint32_t *dest )
-
-/* Return destination address if this assembly instruction is a precomputed jump */
-/* The jump destination is the second field in the assembly string */
+static int _compareInsns( const void *a, const void *b )
 
 {
-    int r = sscanf( assy, "%*[^\t]\t%x", dest );
-
-    if ( r == 1 )
-    {
-        return r;
-    }
+    uint32_t aa = ( ( struct symbolInsn * )a )->assy->addr;
+    uint32_t ba = ( ( struct symbolInsn * )b )->assy->addr;
 
-    /* Check for cbz destination format (i.e. with a register in front of the destination address) */
-    return ( 1 == sscanf( assy, "%*[^\t]\tr%*[0-7],%x", dest ) );
+    return ( aa < ba ) ? -1 : ( aa > ba ) ? 1 : 0;
 }
+// ====================================================================================================
+static void _buildInsnIndex( struct SymbolSet *s )
 
-#if defined(WIN32)
-static FILE *_openProcess( char *commandLine, PROCESS_INFORMATION *processInfo, FILE **errorOutput )
-{
-    HANDLE readingPipe;
-    HANDLE processOutPipe;
+/* Build the table of instructions in address order, and split it into basic blocks. A block ends at anything */
+/* that can change the flow (a jump, call, return or any other ETM4 waypoint, such as an indirect branch) or */
+/* where the next instruction doesn't follow on.                                                            */
 
-    HANDLE errorReadingPipe;
-    HANDLE processErrorPipe;
+{
+    uint32_t total = 0;
+    uint32_t n = 0;
 
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
     {
-        // Create pipe for process' stdout
-        SECURITY_ATTRIBUTES pipeSecurity;
-        pipeSecurity.nLength = sizeof( pipeSecurity );
-        pipeSecurity.bInheritHandle = true;
-        pipeSecurity.lpSecurityDescriptor = NULL;
-        CreatePipe( &readingPipe, &processOutPipe, &pipeSecurity, 0 );
-
-        // only write side of pipe should be inherited
-        SetHandleInformation( readingPipe, HANDLE_FLAG_INHERIT, 0 );
+        total += s->sources[i].assyLines;
     }
 
+    if ( !total )
     {
-        // Create pipe for process' stderr
-        SECURITY_ATTRIBUTES pipeSecurity;
-        pipeSecurity.nLength = sizeof( pipeSecurity );
-        pipeSecurity.bInheritHandle = true;
-        pipeSecurity.lpSecurityDescriptor = NULL;
-        CreatePipe( &errorReadingPipe, &processErrorPipe, &pipeSecurity, 1 * 1024 * 1024 );
-
-        // only write side of pipe should be inherited
-        SetHandleInformation( errorReadingPipe, HANDLE_FLAG_INHERIT, 0 );
+        return;
     }
 
-    memset( processInfo, 0, sizeof( PROCESS_INFORMATION ) );
+    s->insns = ( struct symbolInsn * )memAlloc( MEM_SYMBOLS, total * sizeof( struct symbolInsn ) );
+    MEMCHECKV( s->insns );
 
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
     {
-        STARTUPINFOA startupInfo;
-        memset( &startupInfo, 0, sizeof( startupInfo ) );
-        startupInfo.cb = sizeof( startupInfo );
-        startupInfo.hStdOutput = processOutPipe;
-        startupInfo.hStdInput = GetStdHandle( STD_INPUT_HANDLE );
-        startupInfo.hStdError = processErrorPipe;
-        startupInfo.dwFlags = STARTF_USESTDHANDLES;
-
-        BOOL success = CreateProcessA(
-                                   NULL,
-                                   commandLine,
-                                   NULL,
-                                   NULL,
-                                   true,
-                                   DETACHED_PROCESS,
-                                   NULL,
-                                   NULL,
-                                   &startupInfo,
-                                   processInfo
-                       );
-
-        // Close handle passed to child process
-        CloseHandle( processOutPipe );
-        CloseHandle( processErrorPipe );
-
-        if ( !success )
+        for ( uint32_t j = 0; j < s->sources[i].assyLines; j++ )
         {
-            CloseHandle( readingPipe );
-            CloseHandle( errorReadingPipe );
-            return NULL;
+            s->insns[n].assy = &s->sources[i].assy[j];
+            s->insns[n++].sourceIdx = i;
         }
     }
 
-    int fd = _open_osfhandle( ( intptr_t )readingPipe, _O_RDONLY );
+    /* Lines can overlap, so sort and keep only the first record of any address */
+    qsort( s->insns, n, sizeof( struct symbolInsn ), _compareInsns );
+    s->insnCount = 0;
 
-    if ( fd == -1 )
+    for ( uint32_t i = 0; i < n; i++ )
     {
-        CloseHandle( readingPipe );
-        CloseHandle( errorReadingPipe );
-        return NULL;
+        if ( ( !s->insnCount ) || ( s->insns[s->insnCount - 1].assy->addr != s->insns[i].assy->addr ) )
+        {
+            s->insns[s->insnCount++] = s->insns[i];
+        }
     }
 
-    FILE *f = _fdopen( fd, "r" );
-
-    if ( f == NULL )
+    /* ...then work backwards, so each instruction can inherit the end of the block from the next one */
+    for ( uint32_t i = s->insnCount; i--; )
     {
-        _close( fd );
-        return NULL;
+        const struct assyLineEntry *a = s->insns[i].assy;
+
+        if ( ( a->isJump ) || ( a->isSubCall ) || ( a->isReturn ) || ( a->etm4branch ) || ( i + 1 == s->insnCount ) ||
+                ( s->insns[i + 1].assy->addr != a->addr + ( a->is4Byte ? 4 : 2 ) ) )
+        {
+            s->insns[i].blockEnd = i;
+        }
+        else
+        {
+            s->insns[i].blockEnd = s->insns[i + 1].blockEnd;
+        }
     }
+}
+// ====================================================================================================
+static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
+                          uint32_t *fileindex, uint32_t *functionindex, uint32_t *pline,
+                          uint16_t *linesInBlock, const char **psource,
+                          const struct assyLineEntry **assy,
+                          uint32_t *assyLine )
 
-    int errorFd = _open_osfhandle( ( intptr_t )errorReadingPipe, _O_RDONLY );
+/* Find symbol and return pointers to contents */
 
-    if ( errorFd == -1 )
+{
+    struct sourceLineEntry *found = NULL;
+    uint32_t mappedAssy = 0;
+    bool assyKnown = false;
+
+    if ( s->mapSource )
     {
-        fclose( f );
-        CloseHandle( errorReadingPipe );
-        return NULL;
+        /* Dense image, so straight to the entry. The map covers every line, so a miss is a miss */
+        uint32_t o = ( workingAddr - s->mapBase ) >> 1;
+
+        if ( ( workingAddr >= s->mapBase ) && ( o < s->mapLen ) && ( s->mapSource[o] != NO_LINE ) )
+        {
+            found = &s->sources[s->mapSource[o]];
+            mappedAssy = ( ( workingAddr & 1 ) || ( s->mapAssy[o] == MAP_NO_ASSY ) ) ? found->assyLines : s->mapAssy[o];
+            assyKnown = true;
+        }
     }
+    else if ( s->eytCount )
+    {
+        /* Sparse image, find the first line that ends at or after this address */
+        uint32_t k = 1;
 
-    *errorOutput = _fdopen( errorFd, "r" );
+        while ( k <= s->eytCount )
+        {
+            k = 2 * k + ( s->eytEnd[k] < workingAddr );
+        }
+
+        k >>= __builtin_ffs( ~k );
 
-    if ( *errorOutput == NULL )
+        if ( ( k ) && ( s->sources[s->eytSource[k]].startAddr <= workingAddr ) )
+        {
+            found = &s->sources[s->eytSource[k]];
+        }
+    }
+
+    if ( found )
     {
-        _close( errorFd );
-        fclose( f );
-        return NULL;
+        *pline         = found->lineNo;
+        *linesInBlock  = found->linesInBlock;
+        *psource       = found->lineText;
+        *assy          = found->assy;
+        *fileindex     = found->fileIdx;
+        *functionindex = found->functionIdx;
+
+        /* If there is assembly then match the line too, unless the map already did that for us */
+        for ( *assyLine = mappedAssy; ( !assyKnown ) && ( *assyLine < found->assyLines ); ( *assyLine )++ )
+        {
+            if ( ( *assy )[*assyLine].addr == workingAddr )
+            {
+                break;
+            }
+        }
+
+        /* If the assembly line wasn't found then indicate that */
+        if ( *assyLine == found->assyLines )
+        {
+            *assyLine = ASSY_NOT_FOUND;
+        }
+
+        return true;
     }
 
-    return f;
+    return false;
 }
-#endif
-
 // ====================================================================================================
-static enum symbolErr _getTargetProgramInfo( struct SymbolSet *s )
+static bool _getDest( const char *assy, uint32_t *dest )
 
-/* Analyse line returned by objdump and categorise it, putting results into correct structures. */
-/* If objdump output is misinterpreted, this is the second place to check */
+/* Return destination address if this assembly instruction is a precomputed jump */
+/* The jump destination is the last immediate operand in the assembly string     */
 
 {
-    FILE *f;                                    /* Connection to objdum process */
-    char line[MAX_LINE_LEN];                    /* Line read from objdump process */
-    char commandLine[MAX_LINE_LEN];             /* Command line used to run objdump */
-    uint32_t existingTextLen;                   /* Line under construction */
-
-    char label[MAX_LINE_LEN];                   /* Any cached label */
-    uint32_t lineNo = 0;                        /* Any cached line number */
-    bool startAddrSet = false;                  /* If to attach start address to function */
-
-    char p1[MAX_LINE_LEN];
-    char p2[MAX_LINE_LEN];
-    char p3[MAX_LINE_LEN];
-    char p4[MAX_LINE_LEN];                      /* Elements returned by line analysis */
-    enum LineType lt;                           /* Line type returned from anaylsis */
-
-    uint32_t fileEntryIdx;                      /* Index into file entry table */
-    uint32_t functionEntryIdx;                  /* Index into function entry table */
-    uint32_t nullFileEntry;                     /* Tag for when we don't have a filename */
-    struct sourceLineEntry *sourceEntry = NULL; /* pointer to current source entry */
+    const char *h = strrchr( assy, '#' );
 
-    if ( stat( s->elfFile, &s->st ) != 0 )
+    if ( !h )
     {
-        return SYMBOL_NOELF;
+        return false;
     }
 
-    if ( getenv( OBJENVNAME ) )
+    *dest = strtoul( h + 1, NULL, 0 );
+    return true;
+}
+// ====================================================================================================
+static void _classifyAssy( struct assyLineEntry *a )
+
+/* Label the instruction according to how it affects the flow of execution */
+
+{
+#define MASKED_COMPARE(mask,compare) (((a->codes)&(mask))==(compare))
+
+    /* For ETM4 we need to know direct and indirect branches, cos they are the only instructions                */
+    /* that will get traced. So let's label those...Per definition in ARM IHI0064H.a ID20820 Appendix F         */
+    a->etm4branch = (
+                                MASKED_COMPARE( 0xffffff03, 0x00004700 ) || /* BL, BLX rx */
+                                MASKED_COMPARE( 0xfffff500, 0x0000b100 ) || /* CBNZ/CBZ   */
+                                MASKED_COMPARE( 0xfffff000, 0x0000d000 ) || /* B          */
+                                MASKED_COMPARE( 0xffffffef, 0x0000bf20 ) || /* WFE/WFI    */
+
+                                /* 32 bit matches */
+                                MASKED_COMPARE( 0xffd08000, 0xe8908000 ) || /* LDM */
+                                MASKED_COMPARE( 0xffd08000, 0xe9908000 ) || /* LDMDB */
+                                MASKED_COMPARE( 0xfe10f000, 0xf810f000 ) || /* LDR to PC */
+                                MASKED_COMPARE( 0xf8008000, 0xf0008000 )  /* Branches and misc control */
+                    );
+
+    /* The only way a subroutine will be called from gcc (See gcc source code file gcc/config/arm/thumb2.md) is */
+    /* via blx reg, blxns reg. In theory it could also be done via direct manipulation of R15, but fortunately  */
+    /* gcc doesn't pull tricks like that. It _will_ tail chain (with BX) though.                                */
+    /* Also see https://gcc.gnu.org/onlinedocs/gccint/Machine-Desc.html                                         */
+
+    /* Mark if this is a subroutine call (BL/BLX) */
+    if (
+                MASKED_COMPARE( 0xf800D000, 0xf000D000 ) ||  /* BL Encoding T1 */
+                MASKED_COMPARE( 0xffffff80, 0x00004780 )     /* BLX rx */
+    )
     {
-        snprintf( commandLine, MAX_LINE_LEN, "%s -Sl%s --source-comment=" SOURCE_INDICATOR " %s %s", getenv( OBJENVNAME ),  s->demanglecpp ? " -C" : "", s->elfFile, s->odoptions );
+        a->isSubCall = true;
+        _getDest( a->assy, &a->jumpdest );
     }
-    else
+
+    /* Returns are selected via the function output_return_instruction in arm.c in the gcc source.              */
+    /* Mark if instruction is a return (i.e. PC popped from stack)                                              */
+    if (
+                MASKED_COMPARE( 0xffd0a000, 0xe8908000 ) ||  /* LDM including PC */
+                MASKED_COMPARE( 0xffffff00, 0x0000bd00 ) ||  /* POP PC Encoding T1 */
+                MASKED_COMPARE( 0xffff8000, 0xe8bd8000 ) ||  /* POP PC Encoding T2 */
+                MASKED_COMPARE( 0xffffffff, 0xf85dfb04 ) ||  /* POP PC Encoding T3 */
+                MASKED_COMPARE( 0xffffffff, 0x000047f0 ) ||  /* BLX LR */
+                MASKED_COMPARE( 0xffffffff, 0x00004770 )     /* BX LR */
+    )
     {
-        snprintf( commandLine, MAX_LINE_LEN, OBJDUMP " -Sl%s --source-comment=" SOURCE_INDICATOR " %s %s",  s->demanglecpp ? " -C" : "", s->elfFile, s->odoptions );
+        a->isReturn = true;
     }
 
-#if defined(WIN32)
-    PROCESS_INFORMATION processInfo;
-    FILE *errorOut;
-    f = _openProcess( commandLine, &processInfo, &errorOut );
-#else
-    f = popen( commandLine, "r" );
-#endif
-
-    if ( !f )
+    /* Finally, if this is a jump that might be taken, then get the jump destination */
+    /* This is done by checking if the opcode is a valid jump in either 16 or 32 bit world */
+    if (
+                MASKED_COMPARE( 0xfff00000, 0xE8D00000 ) || /* TBB (T1) */
+                MASKED_COMPARE( 0xfffff800, 0x0000e000 ) || /* Bc Label (T2) */
+                MASKED_COMPARE( 0xfffff500, 0x0000b100 ) || /* CBNZ/CBZ      */
+                MASKED_COMPARE( 0xfffff000, 0x0000d000 ) || /* Bc Label (T1) */
+                MASKED_COMPARE( 0xf800d000, 0xf0009000 ) || /* Bc Label (T4) */
+                ( MASKED_COMPARE( 0xf800d000, 0xf0008000 ) &&
+                  ( !( MASKED_COMPARE( 0x03800000, 0x03800000 ) ) ) ) /* Bc Label (T3) (Excludes AL condition ) */
+    )
     {
-        return SYMBOL_NOOBJDUMP;
+        a->isJump = true;
+        _getDest( a->assy, &a->jumpdest );
     }
 
+#undef MASKED_COMPARE
+}
+// ====================================================================================================
+static void _getAssy( struct symbol *p, csh cs, cs_insn *insn, struct sourceLineEntry *src )
 
-    /* Create the null entries */
-    functionEntryIdx = _getOrAddFunctionEntryIdx( s, NO_FUNCTION_TXT );
-    nullFileEntry    = fileEntryIdx = _getOrAddFileEntryIdx( s, NO_FILE_TXT );
+/* Disassemble the memory covered by a source line into its assembly entries */
+
+{
+    char op[MAX_LINE_LEN];
+    uint8_t spill[ASSY_SPILL_LEN];
+    uint8_t *buf = spill;
+    unsigned int avail;
+    int ofs;
 
-    while ( !feof( f ) )
+    /* Fetch the whole line in one go...it's only copied if it runs across regions */
+    size_t span = src->endAddr - src->startAddr + 1;
+
+    if ( span > sizeof( spill ) )
     {
-        fgets( line, MAX_LINE_LEN, f );
+        buf = ( uint8_t * )memAlloc( MEM_SYMBOLS, span );
+        MEMCHECKV( buf );
+    }
 
-        lt = _getLineType( line, p1, p2, p3, p4 );
+    const uint8_t *block = symbolCodeRange( p, src->startAddr, src->endAddr + 1, buf, &avail );
 
-        if ( lt == LT_ERROR )
+    for ( symbolMemaddr addr = src->startAddr; addr < src->startAddr + avail; )
+    {
+        /* Anything past avail has no memory image, so there's nothing more we can say about it */
+        const uint8_t *m = &block[addr - src->startAddr];
+        uint64_t a = addr;
+        size_t len = src->startAddr + avail - addr;
+
+        if ( !cs_disasm_iter( cs, &m, &len, &a, insn ) )
         {
-            pclose( f );
-            return SYMBOL_UNSPECIFIED;
+            /* This is data (a literal pool, or padding) rather than code, so step past it */
+            addr += 2;
+            continue;
         }
 
-        GTPIP( "**************** %s", line );
+        addr = a;
 
-    repeat_process: // In case we need to process the state machine more than once
+        src->assy = ( struct assyLineEntry * )memRealloc( MEM_SYMBOLS, src->assy, sizeof( struct assyLineEntry ) * ( src->assyLines + 1 ) );
+        MEMCHECKV( src->assy );
+        struct assyLineEntry *e = &src->assy[src->assyLines++];
+        memset( e, 0, sizeof( struct assyLineEntry ) );
 
-#ifdef GPTI_DEBUG
+        e->addr     = insn->address;
+        e->is4Byte  = ( insn->size == 4 );
+        e->codes    = insn->bytes[0] | ( insn->bytes[1] << 8 );
+        e->jumpdest = NO_DESTADDRESS;
 
-        switch ( ps )
+        /* Present the line the same way objdump would, so the assembly text starts after the codes */
+        if ( e->is4Byte )
         {
-            case PS_IDLE:
-                GTPIP( "IDLE(" );
-                break;
-
-            case PS_GET_SOURCE:
-                GTPIP( "GET_SOURCE(" );
-                break;
-
-            case PS_GET_ASSY:
-                GTPIP( "GET_ASSY(" );
-                break;
+            e->codes = ( e->codes << 16 ) | insn->bytes[2] | ( insn->bytes[3] << 8 );
+            ofs = snprintf( op, MAX_LINE_LEN, "%8" PRIx64 ":\t%04x %04x \t", insn->address, e->codes >> 16, e->codes & 0xffff );
         }
-
-        switch ( lt )
+        else
         {
-            case LT_NOISE:
-                GTPIP( "NOISE" );
-                break;
-
-            case LT_PROC_LABEL:
-                GTPIP( "PROC_LABEL" );
-                break;
+            ofs = snprintf( op, MAX_LINE_LEN, "%8" PRIx64 ":\t%04x      \t", insn->address, e->codes );
+        }
 
-            case LT_LABEL:
-                GTPIP( "LABEL" );
-                break;
+        snprintf( &op[ofs], MAX_LINE_LEN - ofs, "%s\t%s" EOL, insn->mnemonic, insn->op_str );
+        e->lineText = memStrdup( MEM_SYMBOLS, op );
+        MEMCHECKV( e->lineText );
+        e->assy     = &e->lineText[ofs];
 
-            case LT_SOURCE:
-                GTPIP( "SOURCE" );
-                break;
+        _classifyAssy( e );
+    }
 
-            case LT_ASSEMBLY:
-                GTPIP( "ASSEMBLY" );
-                break;
+    if ( buf != spill )
+    {
+        memFree( MEM_SYMBOLS, buf );
+    }
+}
+// ====================================================================================================
+static uint32_t _getFunctionIdx( struct symbol *p, struct symbolFunctionStore *f )
 
-            case LT_FILEANDLINE:
-                GTPIP( "FILEANDLINE" );
-                break;
+/* Return index in our functions table corresponding to the loadelf function, or the null function */
 
-            case LT_NEWLINE:
-                GTPIP( "NEWLINE" );
-                break;
+{
+    unsigned int l = 0;
+    unsigned int h = p->nfunc;
 
-            case LT_ERROR:
-                GTPIP( "ERROR" );
-                break;
-        }
+    if ( !f )
+    {
+        return 0;
+    }
 
-        GTPIP( ")" EOL );
-#endif
+    /* Functions are sorted by start address, so binary search to the first with this start... */
+    while ( l < h )
+    {
+        unsigned int m = ( l + h ) / 2;
 
-        switch ( ps )
+        if ( p->func[m]->lowaddr < f->lowaddr )
         {
-            case PS_IDLE: /* Waiting for name of function ================================== */
-                switch ( lt )
-                {
-                    case LT_NOISE: /* ------------------------------------------------------ */
-                        break;
-
-                    case LT_SOURCE: /* ----------------------------------------------------- */
-                        ps = PS_GET_SOURCE;
-                        sourceEntry = _AddSourceLineEntry( s );
-                        sourceEntry->lineNo = lineNo;
-                        sourceEntry->functionIdx = functionEntryIdx;
-                        sourceEntry->fileIdx = fileEntryIdx;
-                        startAddrSet = false;
-                        GTPIP( "Switching to get source" EOL );
-                        goto repeat_process;
-                        break;
-
-                    case LT_ASSEMBLY: /* --------------------------------------------------- */
-                        /* This happens when there is no corresponding source code */
-                        sourceEntry = _AddSourceLineEntry( s );
-                        sourceEntry->functionIdx = functionEntryIdx;
-                        sourceEntry->fileIdx = fileEntryIdx;
-                        startAddrSet = false;
-                        GTPIP( "Straight to Assembly" EOL );
-                        ps = PS_GET_ASSY;
-                        goto repeat_process;
-                        break;
-
-                    case LT_PROC_LABEL: /* ------------------------------------------------- */
-                        functionEntryIdx = _getOrAddFunctionEntryIdx( s, p2 );
-                        s->functions[functionEntryIdx].startAddr = strtoul( p1, NULL, 16 );
-                        GTPIP( "Got function name [%08x %s]" EOL, s->functions[functionEntryIdx].startAddr, s->functions[functionEntryIdx].name );
-                        break;
-
-                    case LT_FILEANDLINE: /* ------------------------------------------------ */
-                        fileEntryIdx = _getOrAddFileEntryIdx( s, p1 );
-                        s->functions[functionEntryIdx].fileEntryIdx = fileEntryIdx;
-                        lineNo = strtoul( p2, NULL, 10 );
-                        GTPIP( "Got filename and line [%d %s]" EOL, lineNo, p1 );
-                        break;
-
-                    case LT_LABEL: /* -----------------------------------------------------  */
-                        strcpy( label, p1 );
-                        GTPIP( "Got label [%s]" EOL, label );
-                        break;
-
-                    case LT_ERROR: /* ------------------------------------------------------ */
-                    case LT_NEWLINE:
-                    default:
-                        GTPIP( "Unhandled" EOL );
-                        break;
-                }
+            l = m + 1;
+        }
+        else
+        {
+            h = m;
+        }
+    }
 
-                break;
+    /* ...then walk any that share it. Entry 0 is the null function, so everything is one on */
+    while ( ( l < p->nfunc ) && ( p->func[l]->lowaddr == f->lowaddr ) )
+    {
+        if ( p->func[l] == f )
+        {
+            return l + 1;
+        }
 
-            case PS_GET_SOURCE: /* Collecting source ========================================== */
-                switch ( lt )
-                {
-                    case LT_NOISE: /* ------------------------------------------------------ */
-                        break;
+        l++;
+    }
 
-                    case LT_SOURCE: /* ----------------------------------------------------- */
-                        /* Bundle source lines together, separated by the newlines */
-                        existingTextLen = sourceEntry->lineText ? strlen( sourceEntry->lineText ) : 0;
-                        sourceEntry->functionIdx = functionEntryIdx;
-                        sourceEntry->lineNo = lineNo;
+    return 0;
+}
+// ====================================================================================================
+static enum symbolErr _getTargetProgramInfo( struct SymbolSet *s )
 
-                        // Add this to source line repository
-                        if ( s->recordSource )
-                        {
-                            sourceEntry->lineText = ( char * )realloc( sourceEntry->lineText, strlen( line ) - strlen( SOURCE_INDICATOR ) + existingTextLen + 1 );
-                            strcpy( &sourceEntry->lineText[existingTextLen], &line[strlen( SOURCE_INDICATOR )] );
-                            sourceEntry->linesInBlock++;
-                            GTPIP( "Got Source [%s]", &line[strlen( SOURCE_INDICATOR )] );
-                        }
+/* Read the DWARF from the elf file and build the files, functions, source and assembly tables from it */
 
-                        break;
-
-                    case LT_ASSEMBLY: /* --------------------------------------------------- */
-                        ps = PS_GET_ASSY;
-                        goto repeat_process;
-                        break;
-
-                    case LT_PROC_LABEL: /* ------------------------------------------------- */
-                    case LT_ERROR:
-                    case LT_LABEL:
-                    case LT_NEWLINE:
-                    case LT_FILEANDLINE:
-                    default:
-                        GTPIP( "Unhandled" EOL );
-                        break;
-                }
+{
+    struct symbol *p;                           /* Symbols as read from the elf */
+    uint32_t *fileMap;                          /* Mapping from loadelf filename index to our files table */
+    uint32_t nullFileEntry;                     /* Tag for when we don't have a filename */
+    csh cs = 0;                                 /* Disassembler handle */
+    cs_insn *insn = NULL;                       /* Disassembler output */
 
-                break;
+    if ( !_statImages( s->elfFile, s->st, &s->nimages ) )
+    {
+        return SYMBOL_NOELF;
+    }
 
-            case PS_GET_ASSY: /* Waiting for assembly ========================================= */
-                switch ( lt )
-                {
-                    case LT_NOISE: /* ------------------------------------------------------ */
-                        break;
-
-                    case LT_PROC_LABEL: /* ------------------------------------------------- */
-                    case LT_FILEANDLINE: /* ------------------------------------------------ */
-                    case LT_NEWLINE: /* ---------------------------------------------------- */
-                        ps = PS_IDLE;
-
-                        /* For all these cases we would expect a new file and line, so reset those */
-                        fileEntryIdx = nullFileEntry;
-                        lineNo = 0;
-                        goto repeat_process;
-                        break;
-
-                    case LT_ASSEMBLY: /* --------------------------------------------------- */
-                        sourceEntry->endAddr = strtoul( p1, NULL, 16 );
-                        s->functions[functionEntryIdx].endAddr = sourceEntry->endAddr;
-
-                        /* If we're recording entries and this is not seomthing we explicitly want to ignore */
-                        if ( ( s->recordAssy )  && ( !strstr( p4, ".word" ) ) && ( !strstr( p4, ".short" ) ) )
-                        {
-                            sourceEntry->assy = ( struct assyLineEntry * )realloc( sourceEntry->assy, sizeof( struct assyLineEntry ) * ( sourceEntry->assyLines + 1 ) );
-                            sourceEntry->assy[sourceEntry->assyLines].addr = sourceEntry->endAddr;
-                            sourceEntry->assy[sourceEntry->assyLines].is4Byte = ( ( *p2 ) != 0 );
-                            sourceEntry->assy[sourceEntry->assyLines].codes = strtoul( p3, NULL, 16 );
-
-                            if ( *p2 )
-                            {
-                                sourceEntry->assy[sourceEntry->assyLines].codes |= ( strtoul( p2, NULL, 16 ) << 16 );
-                            }
-
-                            sourceEntry->assy[sourceEntry->assyLines].lineText           = strdup( line );
-                            sourceEntry->assy[sourceEntry->assyLines].isJump             = false;
-                            sourceEntry->assy[sourceEntry->assyLines].isReturn           = false;
-                            sourceEntry->assy[sourceEntry->assyLines].isSubCall          = false;
-                            sourceEntry->assy[sourceEntry->assyLines].jumpdest  = NO_DESTADDRESS;
-
-                            /* Just hook the assy pointer to the location in the line where the assembly itself starts */
-                            sourceEntry->assy[sourceEntry->assyLines].assy = strstr( sourceEntry->assy[sourceEntry->assyLines].lineText, p4 );
-
-                            /* Record the label is there was one */
-                            sourceEntry->assy[sourceEntry->assyLines].label = *label ? strdup( label ) : NULL;
-                            GTPIP( "%08x %x [%s]" EOL, sourceEntry->assy[sourceEntry->assyLines].addr,
-                                   sourceEntry->assy[sourceEntry->assyLines].codes,
-                                   sourceEntry->assy[sourceEntry->assyLines].lineText );
-
-#define MASKED_COMPARE(mask,compare) (((sourceEntry->assy[sourceEntry->assyLines].codes)&(mask))==(compare))
-
-                            /* For ETM4 we need to know direct and indirect branches, cos they are the only instructions                */
-                            /* that will get traced. So let's label those...Per definition in ARM IHI0064H.a ID20820 Appendix F         */
-                            if (
-                                        MASKED_COMPARE( 0xffffff03, 0x00004700 ) || /* BL, BLX rx */
-                                        MASKED_COMPARE( 0xfffff500, 0x0000b100 ) || /* CBNZ/CBZ   */
-                                        MASKED_COMPARE( 0xfffff000, 0x0000d000 ) || /* B          */
-                                        MASKED_COMPARE( 0xffffffef, 0x0000bf20 ) || /* WFE/WFI    */
-
-                                        /* 32 bit matches */
-                                        MASKED_COMPARE( 0xffd08000, 0xe8908000 ) || /* LDM */
-                                        MASKED_COMPARE( 0xffd08000, 0xe9908000 ) || /* LDMDB */
-                                        MASKED_COMPARE( 0xfe10f000, 0xf810f000 ) || /* LDR to PC */
-                                        MASKED_COMPARE( 0xf8008000, 0xf0008000 )  /* Branches and misc control */
-                            )
-                            {
-                                sourceEntry->assy[sourceEntry->assyLines].etm4branch = true;
-                            }
-                            else
-                            {
-                                sourceEntry->assy[sourceEntry->assyLines].etm4branch = false;
-                            }
-
-                            /* The only way a subroutine will be called from gcc (See gcc source code file gcc/config/arm/thumb2.md) is */
-                            /* via blx reg, blxns reg. In theory it could also be done via direct manipulation of R15, but fortunately  */
-                            /* gcc doesn't pull tricks like that. It _will_ tail chain (with BX) though.                                */
-                            /* Also see https://gcc.gnu.org/onlinedocs/gccint/Machine-Desc.html                                         */
-
-                            /* Mark if this is a subroutine call (BL/BLX) */
-                            if (
-                                        MASKED_COMPARE( 0xf800D000, 0xf000D000 ) ||  /* BL Encoding T1 */
-                                        MASKED_COMPARE( 0xffffff80, 0x00004780 )     /* BLX rx */
-                            )
-                            {
-                                sourceEntry->assy[sourceEntry->assyLines].isSubCall = true;
-                                _getDest( sourceEntry->assy[sourceEntry->assyLines].assy, &sourceEntry->assy[sourceEntry->assyLines].jumpdest );
-                            }
-
-                            /* Returns are selected via the function output_return_instruction in arm.c in the gcc source.              */
-                            /* Mark if instruction is a return (i.e. PC popped from stack)                                              */
-                            if (
-                                        MASKED_COMPARE( 0xffd0a000, 0xe8908000 ) ||  /* LDM including PC */
-                                        MASKED_COMPARE( 0xffffff00, 0x0000bd00 ) ||  /* POP PC Encoding T1 */
-                                        MASKED_COMPARE( 0xffff8000, 0xe8bd8000 ) ||  /* POP PC Encoding T2 */
-                                        MASKED_COMPARE( 0xffffffff, 0xf85dfb04 ) ||  /* POP PC Encoding T3 */
-                                        MASKED_COMPARE( 0xffffff00, 0x0000bd00 ) ||
-                                        MASKED_COMPARE( 0xffff8000, 0xe8bd8000 ) ||
-                                        MASKED_COMPARE( 0xffffffff, 0x000047f0 ) ||  /* BLX LR */
-                                        MASKED_COMPARE( 0xffffffff, 0x00004770 )     /* BX LR */
-                            )
-                            {
-                                sourceEntry->assy[sourceEntry->assyLines].isReturn = true;
-                            }
-
-                            /* Finally, if this is a jump that might be taken, then get the jump destination */
-                            /* This is done by checking if the opcode is a valid jump in either 16 or 32 bit world */
-                            if (
-                                        MASKED_COMPARE( 0xfff00000, 0xE8D00000 ) || /* TBB (T1) */
-                                        MASKED_COMPARE( 0xfffff800, 0x0000e000 ) || /* Bc Label (T2) */
-                                        MASKED_COMPARE( 0xfffff500, 0x0000b100 ) || /* CBNZ/CBZ      */
-                                        MASKED_COMPARE( 0xfffff000, 0x0000d000 ) || /* Bc Label (T1) */
-                                        MASKED_COMPARE( 0xf800d000, 0xf0009000 ) || /* Bc Label (T4) */
-                                        ( MASKED_COMPARE( 0xf800d000, 0xf0008000 ) &&
-                                          ( !( MASKED_COMPARE( 0x03800000, 0x03800000 ) ) ) ) /* Bc Label (T3) (Excludes AL condition ) */
-                            )
-                            {
-                                sourceEntry->assy[sourceEntry->assyLines].isJump = true;
-
-                                if ( !_getDest( sourceEntry->assy[sourceEntry->assyLines].assy, &sourceEntry->assy[sourceEntry->assyLines].jumpdest ) )
-                                {
-                                    GTPIP( "Failed to get jump destination for text %s " EOL, sourceEntry->assy[sourceEntry->assyLines].assy );
-                                }
-                            }
-
-                            sourceEntry->assyLines++;
-                        }
+    /* Memory is needed for assembly, and loadelf will only load source alongside it */
+    p = symbolAcquire( s->elfFile, s->recordAssy || s->recordSource, s->recordSource );
 
-                        *label = 0;
+    if ( !p )
+    {
+        return SYMBOL_UNSPECIFIED;
+    }
 
-                        if ( !startAddrSet )
-                        {
-                            startAddrSet = true;
-                            sourceEntry->startAddr = sourceEntry->endAddr;
-                        }
+    if ( s->recordAssy )
+    {
+        if ( cs_open( CS_ARCH_ARM, CS_MODE_THUMB + CS_MODE_LITTLE_ENDIAN, &cs ) != CS_ERR_OK )
+        {
+            symbolDelete( p );
+            return SYMBOL_UNSPECIFIED;
+        }
 
-                        break;
+        insn = cs_malloc( cs );
+    }
 
-                    case LT_LABEL: /* ------------------------------------------------------ */
-                        strcpy( label, p1 );
-                        GTPIP( "Got label [%s]" EOL, label );
-                        break;
+    /* Create the null entries */
+    _getOrAddFunctionEntryIdx( s, NO_FUNCTION_TXT );
+    nullFileEntry = _getOrAddFileEntryIdx( s, NO_FILE_TXT );
 
-                    case LT_SOURCE:  /* ---------------------------------------------------- */
-                    case LT_ERROR:
-                    default:
-                        GTPIP( "Unhandled" EOL );
-                        break;
-                }
+    /* Files, which loadelf can have several copies of once delete material is taken off */
+    fileMap = ( uint32_t * )memCalloc( MEM_SYMBOLS, p->tableLen[PT_FILENAME], sizeof( uint32_t ) );
+    MEMCHECK( fileMap, SYMBOL_UNSPECIFIED );
 
-                break;
-        }
+    for ( unsigned int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
+    {
+        const char *n = symbolGetFilename( p, i );
+        fileMap[i] = ( n && *n ) ? _getOrAddFileEntryIdx( s, ( char * )n ) : nullFileEntry;
     }
 
-#if defined(WIN32)
-    WaitForSingleObject( processInfo.hProcess, INFINITE );
-
-    DWORD exitCode = 1;
+    /* Functions, in the same order as loadelf holds them, after the null entry */
+    s->functions = ( struct functionEntry * )memRealloc( MEM_SYMBOLS, s->functions, sizeof( struct functionEntry ) * ( p->nfunc + 1 ) );
+    MEMCHECK( s->functions, SYMBOL_UNSPECIFIED );
 
-    if ( !GetExitCodeProcess( processInfo.hProcess, &exitCode ) )
+    for ( unsigned int i = 0; i < p->nfunc; i++ )
     {
-        exitCode = 1;
+        struct symbolFunctionStore *f = p->func[i];
+        struct functionEntry *fe = &s->functions[s->functionCount++];
+
+        /* C++ names are only demangled if they're shown, which most never are */
+        if ( ( s->demanglecpp ) && ( f->manglename ) && ( !strncmp( f->manglename, "_Z", 2 ) ) && ( symbolCanDemangle() ) )
+        {
+            fe->mangled = memStrdup( MEM_SYMBOLS, f->manglename );
+            MEMCHECK( fe->mangled, SYMBOL_UNSPECIFIED );
+        }
+        else
+        {
+            fe->name = memStrdup( MEM_SYMBOLS, ( ( !s->demanglecpp ) && f->manglename ) ? f->manglename : f->funcname );
+            MEMCHECK( fe->name, SYMBOL_UNSPECIFIED );
+        }
+
+        fe->startAddr    = f->lowaddr;
+        fe->endAddr      = f->highaddr;
+        fe->fileEntryIdx = ( f->filename < p->tableLen[PT_FILENAME] ) ? fileMap[f->filename] : nullFileEntry;
     }
 
-    CloseHandle( processInfo.hThread );
-    CloseHandle( processInfo.hProcess );
+    /* Source lines, which are already in address order */
+    s->sources = ( struct sourceLineEntry * )memCalloc( MEM_SYMBOLS, p->nlines, sizeof( struct sourceLineEntry ) );
+    MEMCHECK( s->sources, SYMBOL_UNSPECIFIED );
 
-    if ( exitCode != 0 )
+    for ( unsigned int i = 0; i < p->nlines; i++ )
     {
-        while ( !feof( errorOut ) )
+        struct symbolLineStore *l = p->line[i];
+        struct sourceLineEntry *src = &s->sources[s->sourceCount++];
+
+        src->startAddr   = l->lowaddr;
+        src->endAddr     = l->highaddr;
+        src->lineNo      = l->startline;
+        src->fileIdx     = ( l->filename < p->tableLen[PT_FILENAME] ) ? fileMap[l->filename] : nullFileEntry;
+        src->functionIdx = _getFunctionIdx( p, l->function );
+
+        if ( s->recordSource )
         {
-            fgets( line, MAX_LINE_LEN, errorOut );
-            fputs( line, stderr );
+            const char *t = symbolSource( p, l->filename, l->startline - 1 );
+
+            if ( t )
+            {
+                src->lineText = ( char * )memAlloc( MEM_SYMBOLS, strlen( t ) + 2 );
+                MEMCHECK( src->lineText, SYMBOL_UNSPECIFIED );
+                strcpy( src->lineText, t );
+                strcat( src->lineText, "\n" );
+                src->linesInBlock = 1;
+            }
         }
 
-        return SYMBOL_NOOBJDUMP;
+        if ( s->recordAssy && insn )
+        {
+            _getAssy( p, cs, insn, src );
+        }
     }
 
-    fclose( errorOut );
-#else
+    if ( insn )
+    {
+        cs_free( insn, 1 );
+    }
 
-    if ( 0 != pclose( f ) )
+    if ( s->recordAssy )
     {
-        /* Something went wrong in the subprocess */
-        return SYMBOL_NOOBJDUMP;
+        cs_close( &cs );
     }
 
-#endif
+    memFree( MEM_SYMBOLS, fileMap );
+    symbolDelete( p );
 
     _sortLines( s );
+    _buildAddrIndex( s );
+    _buildInsnIndex( s );
     return SYMBOL_OK;
 }
 // ====================================================================================================
@@ -858,7 +834,7 @@ const char *SymbolFilename( struct SymbolSet *s, uint32_t index )
     switch ( index )
     {
         default:
-            if ( index < s->fileCount )
+            if ( ( s ) && ( index < s->fileCount ) )
             {
                 return s->files[index].name;
             }
@@ -879,9 +855,11 @@ const char *SymbolFunction( struct SymbolSet *s, uint32_t index )
             return FN_INTERRUPT_STR;
 
         default:
-            if ( index < s->functionCount )
+            if ( ( s ) && ( index < s->functionCount ) )
             {
-                return s->functions[index].name;
+                const char *n = s->functions[index].name;
+
+                return ( n ) ? n : ( ( n = symbolDemangle( s->functions[index].mangled ) ) ? n : s->functions[index].mangled );
             }
 
             return "NONE";
@@ -933,6 +911,31 @@ bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
     return false;
 }
 // ====================================================================================================
+uint32_t SymbolInsnIndex( struct SymbolSet *s, uint32_t addr )
+
+/* Find the instruction at an address, returning its index in the instruction table or NO_INSN */
+
+{
+    uint32_t lo = 0;
+    uint32_t hi = s->insnCount;
+
+    while ( lo < hi )
+    {
+        uint32_t mid = lo + ( hi - lo ) / 2;
+
+        if ( s->insns[mid].assy->addr < addr )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ( ( lo < s->insnCount ) && ( s->insns[lo].assy->addr == addr ) ) ? lo : NO_INSN;
+}
+// ====================================================================================================
 void SymbolSetDelete( struct SymbolSet **s )
 
 /* Delete existing symbol set, by means of deleting all memory-allocated components of it first */
@@ -940,7 +943,9 @@ void SymbolSetDelete( struct SymbolSet **s )
 {
     if ( *s )
     {
-        free( ( *s )->elfFile );
+        memFree( MEM_SYMBOLS, ( *s )->elfFile );
+        _nameIndexDelete( &( *s )->fileIndex );
+        _nameIndexDelete( &( *s )->functionIndex );
 
         /* Free off any files dynamic memory we allocated */
         if ( ( *s )->files )
@@ -949,11 +954,11 @@ void SymbolSetDelete( struct SymbolSet **s )
             {
                 if ( ( *s )->files[i].name )
                 {
-                    free( ( *s )->files[i].name );
+                    memFree( MEM_SYMBOLS, ( *s )->files[i].name );
                 }
             }
 
-            free( ( *s )->files );
+            memFree( MEM_SYMBOLS, ( *s )->files );
         }
 
         /* Free off any functions dynamic memory we allocated */
@@ -961,13 +966,11 @@ void SymbolSetDelete( struct SymbolSet **s )
         {
             for ( uint32_t i = 0; i < ( *s )->functionCount; i++ )
             {
-                if ( ( *s )->functions[i].name )
-                {
-                    free( ( *s )->functions[i].name );
-                }
+                memFree( MEM_SYMBOLS, ( *s )->functions[i].name );
+                memFree( MEM_SYMBOLS, ( *s )->functions[i].mangled );
             }
 
-            free( ( *s )->functions );
+            memFree( MEM_SYMBOLS, ( *s )->functions );
         }
 
         /* Free off any sources dynamic memory we allocated */
@@ -977,7 +980,7 @@ void SymbolSetDelete( struct SymbolSet **s )
             {
                 if ( ( *s )->sources[i].lineText )
                 {
-                    free( ( *s )->sources[i].lineText );
+                    memFree( MEM_SYMBOLS, ( *s )->sources[i].lineText );
                 }
 
                 /* For any source line, free off it's assembly if there is some */
@@ -985,76 +988,82 @@ void SymbolSetDelete( struct SymbolSet **s )
                 {
                     if ( ( *s )->sources[i].assy->label )
                     {
-                        free( ( *s )->sources[i].assy->label );
+                        memFree( MEM_SYMBOLS, ( *s )->sources[i].assy->label );
                     }
 
                     for ( uint32_t j = 0; j < ( *s )->sources[i].assyLines; j++ )
                     {
                         if ( ( *s )->sources[i].assy[j].lineText )
                         {
-                            free( ( *s )->sources[i].assy[j].lineText );
+                            memFree( MEM_SYMBOLS, ( *s )->sources[i].assy[j].lineText );
                         }
                     }
 
-                    free( ( *s )->sources[i].assy );
+                    memFree( MEM_SYMBOLS, ( *s )->sources[i].assy );
                 }
             }
 
-            free( ( *s )->sources );
+            memFree( MEM_SYMBOLS, ( *s )->sources );
         }
 
+        memFree( MEM_SYMBOLS, ( *s )->mapSource );
+        memFree( MEM_SYMBOLS, ( *s )->mapAssy );
+        memFree( MEM_SYMBOLS, ( *s )->eytSource );
+        memFree( MEM_SYMBOLS, ( *s )->eytEnd );
+        memFree( MEM_SYMBOLS, ( *s )->insns );
+
         if ( ( *s )->deleteMaterial )
         {
-            free( ( *s )->deleteMaterial );
+            memFree( MEM_SYMBOLS, ( *s )->deleteMaterial );
         }
 
         if ( ( *s )->odoptions )
         {
-            free( ( *s )->odoptions );
+            memFree( MEM_SYMBOLS, ( *s )->odoptions );
         }
 
-        free( *s );
+        memFree( MEM_SYMBOLS, *s );
         *s = NULL;
     }
 }
 // ====================================================================================================
-bool SymbolSetValid( struct SymbolSet **s, char *filename )
+bool SymbolSetChanged( struct SymbolSet *s, const char *filename )
 
-/* Check if current symbol set remains valid */
+/* Check, without disturbing anything, if the files are any different to when the symbol set was made from them */
 
 {
-    struct stat n;
+    struct stat n[SYMBOLS_MAX_ELF];
+    unsigned int count;
 
-    if ( 0 != stat( filename, &n ) )
+    if ( ( !s ) || ( !_statImages( filename, n, &count ) ) || ( count != s->nimages ) )
     {
-        /* We can't even stat the file, assume it's invalid */
-        SymbolSetDelete( s );
-        return false;
+        /* We can't even stat them all, assume it's changed */
+        return true;
     }
 
-    /* We check filesize, modification time and status change time for any differences */
-    if ( ( !( *s ) ) ||
-            ( memcmp( &n.st_size, &( ( *s )->st.st_size ), sizeof( off_t ) ) ) ||
+    for ( unsigned int i = 0; i < count; i++ )
+    {
+        if ( _statDiffers( &n[i], &s->st[i] ) )
+        {
+            return true;
+        }
+    }
 
-#ifdef OSX
-            ( memcmp( &n.st_mtimespec, &( ( *s )->st.st_mtimespec ), sizeof( struct timespec ) ) ) ||
-            ( memcmp( &n.st_ctimespec, &( ( *s )->st.st_ctimespec ), sizeof( struct timespec ) ) )
-#elif WIN32
-            ( memcmp( &n.st_mtime, &( ( *s )->st.st_mtime ), sizeof( n.st_mtime ) ) ) ||
-            ( memcmp( &n.st_ctime, &( ( *s )->st.st_ctime ), sizeof( n.st_ctime ) ) )
-#else
-            ( memcmp( &n.st_mtim, &( ( *s )->st.st_mtim ), sizeof( struct timespec ) ) ) ||
-            ( memcmp( &n.st_ctim, &( ( *s )->st.st_ctim ), sizeof( struct timespec ) ) )
-#endif
-       )
+    return false;
+}
+// ====================================================================================================
+bool SymbolSetValid( struct SymbolSet **s, char *filename )
+
+/* Check if current symbol set remains valid, deleting it if not */
+
+{
+    if ( SymbolSetChanged( *s, filename ) )
     {
         SymbolSetDelete( s );
         return false;
     }
-    else
-    {
-        return true;
-    }
+
+    return true;
 }
 // ====================================================================================================
 // Malloc leak is deliberately ignored. That is the central purpose of this code!
@@ -1068,26 +1077,27 @@ enum symbolErr SymbolSetCreate( struct SymbolSet **ss, const char *filename, con
 /* Create new symbol set by reading from elf file, if it's there and stable */
 
 {
-    struct stat statbuf, newstatbuf;
+    struct stat statbuf[SYMBOLS_MAX_ELF], newstatbuf[SYMBOLS_MAX_ELF];
+    unsigned int n, newn;
     struct SymbolSet *s;
     enum symbolErr  ret = SYMBOL_UNSPECIFIED;
 
-    s = ( struct SymbolSet * )calloc( sizeof( struct SymbolSet ), 1 );
+    s = ( struct SymbolSet * )memCalloc( MEM_SYMBOLS, sizeof( struct SymbolSet ), 1 );
     MEMCHECK( s, 0 );
 
-    s->odoptions        = strdup( objdumpOptions ? objdumpOptions : "" );
+    s->odoptions        = memStrdup( MEM_SYMBOLS, objdumpOptions ? objdumpOptions : "" );
     MEMCHECK( s->odoptions, 0 );
-    s->elfFile          = strdup( filename );
+    s->elfFile          = memStrdup( MEM_SYMBOLS, filename );
     MEMCHECK( s->elfFile, 0 );
-    s->deleteMaterial   = strdup( deleteMaterial ? deleteMaterial : "" );
+    s->deleteMaterial   = memStrdup( MEM_SYMBOLS, deleteMaterial ? deleteMaterial : "" );
     MEMCHECK( s->deleteMaterial, 0 );
     s->recordSource     = recordSource;
     s->demanglecpp      = demanglecpp;
     s->recordAssy       = recordAssy;
 
 
-    /* Make sure this file is stable before trying to load it */
-    if ( ( stat( filename, &statbuf ) != 0 ) || !( statbuf.st_mode & S_IFREG ) )
+    /* Make sure the files are stable before trying to load them */
+    if ( !_statImages( filename, statbuf, &n ) )
     {
         ret = SYMBOL_NOELF;
     }
@@ -1099,26 +1109,20 @@ enum symbolErr SymbolSetCreate( struct SymbolSet **ss, const char *filename, con
         {
             usleep( ELF_RELOAD_DELAY_TIME );
 
-            if ( stat( filename, &newstatbuf ) == 0 )
+            if ( _statImages( filename, newstatbuf, &newn ) )
             {
-                /* We check filesize, modification time and status change time for any differences */
-                if (
-                            ( !newstatbuf.st_size ) ||
-                            ( memcmp( &statbuf.st_size, &newstatbuf.st_size, sizeof( off_t ) ) ) ||
-#ifdef OSX
-                            ( memcmp( &statbuf.st_mtimespec, &newstatbuf.st_mtimespec, sizeof( struct timespec ) ) ) ||
-                            ( memcmp( &statbuf.st_ctimespec, &newstatbuf.st_ctimespec, sizeof( struct timespec ) ) )
-#elif WIN32
-                            ( memcmp( &statbuf.st_mtime, &newstatbuf.st_mtime, sizeof( statbuf.st_mtime ) ) ) ||
-                            ( memcmp( &statbuf.st_ctime, &newstatbuf.st_ctime, sizeof( statbuf.st_ctime ) ) )
-#else
-                            ( memcmp( &statbuf.st_mtim, &newstatbuf.st_mtim, sizeof( struct timespec ) ) ) ||
-                            ( memcmp( &statbuf.st_ctim, &newstatbuf.st_ctim, sizeof( struct timespec ) ) )
-#endif
-                )
+                bool changed = ( newn != n );
+
+                for ( unsigned int i = 0; ( !changed ) && ( i < n ); i++ )
+                {
+                    changed = ( !newstatbuf[i].st_size ) || ( _statDiffers( &statbuf[i], &newstatbuf[i] ) );
+                }
+
+                if ( changed )
                 {
                     /* Make this the version we check next time around */
-                    memcpy( &statbuf, &newstatbuf, sizeof( struct stat ) );
+                    memcpy( statbuf, newstatbuf, sizeof( statbuf ) );
+                    n = newn;
                     continue;
                 }
                 else
@@ -1143,3 +1147,60 @@ enum symbolErr SymbolSetCreate( struct SymbolSet **ss, const char *filename, con
 }
 #pragma GCC diagnostic pop
 // ====================================================================================================
+static void *_reloadTask( void *arg )
+
+{
+    struct SymbolReload *r = ( struct SymbolReload * )arg;
+
+    r->err = SymbolSetCreate( &r->s, r->filename, r->deleteMaterial, r->demanglecpp, r->recordSource, r->recordAssy, r->objdumpOptions );
+    atomic_store( &r->done, true );
+    return NULL;
+}
+// ====================================================================================================
+struct SymbolReload *SymbolReloadStart( const char *filename, const char *deleteMaterial,
+                                        bool demanglecpp, bool recordSource, bool recordAssy, const char *objdumpOptions )
+
+/* Start loading a symbol set on its own thread, with SymbolReloadPoll to find when it's there */
+
+{
+    struct SymbolReload *r = ( struct SymbolReload * )memCalloc( MEM_SYMBOLS, 1, sizeof( struct SymbolReload ) );
+    MEMCHECK( r, NULL );
+
+    r->filename       = memStrdup( MEM_SYMBOLS, filename );
+    r->deleteMaterial = ( deleteMaterial ) ? memStrdup( MEM_SYMBOLS, deleteMaterial ) : NULL;
+    r->objdumpOptions = ( objdumpOptions ) ? memStrdup( MEM_SYMBOLS, objdumpOptions ) : NULL;
+    r->demanglecpp    = demanglecpp;
+    r->recordSource   = recordSource;
+    r->recordAssy     = recordAssy;
+    atomic_init( &r->done, false );
+
+    if ( pthread_create( &r->thread, NULL, _reloadTask, r ) )
+    {
+        genericsExit( -1, "Failed to create symbol load thread" EOL );
+    }
+
+    return r;
+}
+// ====================================================================================================
+bool SymbolReloadPoll( struct SymbolReload **r, struct SymbolSet **ss, enum symbolErr *err )
+
+/* If the load has finished then hand over what it made, and tidy up after it. Never waits. */
+
+{
+    if ( !atomic_load( &( *r )->done ) )
+    {
+        return false;
+    }
+
+    pthread_join( ( *r )->thread, NULL );
+    *ss = ( *r )->s;
+    *err = ( *r )->err;
+
+    memFree( MEM_SYMBOLS, ( *r )->filename );
+    memFree( MEM_SYMBOLS, ( *r )->deleteMaterial );
+    memFree( MEM_SYMBOLS, ( *r )->objdumpOptions );
+    memFree( MEM_SYMBOLS, *r );
+    *r = NULL;
+    return true;
+}
+// ====================================================================================================
@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Tagged Frame History
+ * ====================
+ *
+ * Frames are copied into a byte ring, and each call to tagHistoryAdd gets an entry in a second ring
+ * saying where its data is, which tag it was for, when it arrived and if it was marked. The oldest
+ * entries go whenever there isn't room for a new one, or they get too old.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generics.h"
+#include "oflow.h"
+#include "tagHistory.h"
+
+/* Entries are made for each frame, so allow for frames as small as this on average */
+#define SMALLEST_FRAME (8)
+#define MIN_ENTRIES    (256)
+
+struct tagEntry
+{
+    uint64_t pos;                          /* Where its data starts, a count of all bytes ever held */
+    uint32_t len;                          /* ...and how long it is */
+    uint32_t when;                         /* Timestamp (in mS) it was added */
+    uint8_t tag;
+    bool mark;                             /* It's somewhere that a decoder can start from */
+};
+
+struct tagHistory
+{
+    uint8_t *d;                            /* The byte ring */
+    size_t size;                           /* ...its size */
+    uint64_t wp;                           /* ...and total bytes ever written to it */
+    size_t held;                           /* Bytes covered by the entries we still have */
+
+    struct tagEntry *e;                    /* The entry ring */
+    uint32_t emax;                         /* ...its size */
+    uint64_t eOld;                         /* ...index of the oldest entry */
+    uint64_t eNew;                         /* ...and of the one after the newest */
+
+    uint32_t maxmS;                        /* Oldest an entry can be before it goes, 0 for no limit */
+    uint8_t marking[NW_NUM_TAGS / 8];      /* Tags whose next entry is to be marked */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _dropOldest( struct tagHistory *t )
+
+{
+    t->held -= t->e[t->eOld % t->emax].len;
+    t->eOld++;
+}
+// ====================================================================================================
+static void _dropAged( struct tagHistory *t, uint32_t now )
+
+/* Let go of anything that's been held longer than we're keeping it for */
+
+{
+    while ( ( t->maxmS ) && ( t->eOld != t->eNew ) && ( now - t->e[t->eOld % t->emax].when > t->maxmS ) )
+    {
+        _dropOldest( t );
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct tagHistory *tagHistoryCreate( size_t maxBytes, uint32_t maxmS )
+
+{
+    struct tagHistory *t = ( struct tagHistory * )calloc( 1, sizeof( struct tagHistory ) );
+    MEMCHECK( t, NULL );
+
+    t->size = maxBytes;
+    t->emax = ( maxBytes / SMALLEST_FRAME > MIN_ENTRIES ) ? maxBytes / SMALLEST_FRAME : MIN_ENTRIES;
+    t->maxmS = maxmS;
+    t->d = ( uint8_t * )malloc( t->size );
+    MEMCHECK( t->d, NULL );
+    t->e = ( struct tagEntry * )malloc( t->emax * sizeof( struct tagEntry ) );
+    MEMCHECK( t->e, NULL );
+    return t;
+}
+// ====================================================================================================
+void tagHistoryAdd( struct tagHistory *t, uint8_t tag, const uint8_t *d, uint32_t len )
+
+/* Hold a copy of frame(s) sent for tag, letting the oldest go to make room */
+
+{
+    uint32_t now = genericsTimestampmS();
+    struct tagEntry *e;
+    size_t ofs, first;
+
+    if ( ( !len ) || ( len > t->size ) )
+    {
+        return;
+    }
+
+    _dropAged( t, now );
+
+    while ( ( t->eOld != t->eNew ) && ( ( t->held + len > t->size ) || ( t->eNew - t->eOld == t->emax ) ) )
+    {
+        _dropOldest( t );
+    }
+
+    ofs = t->wp % t->size;
+    first = ( len < t->size - ofs ) ? len : t->size - ofs;
+    memcpy( &t->d[ofs], d, first );
+    memcpy( t->d, &d[first], len - first );
+
+    e = &t->e[t->eNew % t->emax];
+    e->pos  = t->wp;
+    e->len  = len;
+    e->when = now;
+    e->tag  = tag;
+    e->mark = ( t->marking[tag / 8] & ( 1 << ( tag % 8 ) ) ) != 0;
+    t->marking[tag / 8] &= ~( 1 << ( tag % 8 ) );
+
+    t->eNew++;
+    t->wp += len;
+    t->held += len;
+}
+// ====================================================================================================
+void tagHistoryMark( struct tagHistory *t, uint8_t tag )
+
+/* The next frame added for tag is a good place to start decoding it from */
+
+{
+    t->marking[tag / 8] |= 1 << ( tag % 8 );
+}
+// ====================================================================================================
+size_t tagHistoryReplay( struct tagHistory *t, const struct nwSubscription *sub, uint8_t *o, size_t max )
+
+/* Copy out, in the order they were added, the frames held for the tags in sub. Each tag starts at */
+/* its oldest mark if it has one, otherwise at its oldest frame. Returns how much that came to.    */
+
+{
+    uint64_t start[NW_NUM_TAGS];
+    bool marked[NW_NUM_TAGS] = { false };
+    uint64_t earliest = t->eNew;
+    size_t len = 0, ofs, first;
+    struct tagEntry *e;
+
+    _dropAged( t, genericsTimestampmS() );
+
+    for ( int i = 0; i < NW_NUM_TAGS; i++ )
+    {
+        start[i] = t->eNew;
+    }
+
+    /* Find where each tag begins */
+    for ( uint64_t i = t->eOld; i != t->eNew; i++ )
+    {
+        e = &t->e[i % t->emax];
+
+        if ( ( e->tag == OFLOW_TIME_TAG ) || ( marked[e->tag] ) || ( !nwSubscriptionHas( sub, e->tag ) ) )
+        {
+            continue;
+        }
+
+        if ( ( e->mark ) || ( start[e->tag] == t->eNew ) )
+        {
+            start[e->tag] = i;
+            marked[e->tag] = e->mark;
+        }
+    }
+
+    for ( int i = 0; i < NW_NUM_TAGS; i++ )
+    {
+        earliest = ( start[i] < earliest ) ? start[i] : earliest;
+    }
+
+    /* Time frames are only any use alongside something else */
+    start[OFLOW_TIME_TAG] = earliest;
+
+    for ( uint64_t i = earliest; i != t->eNew; i++ )
+    {
+        e = &t->e[i % t->emax];
+
+        if ( ( i < start[e->tag] ) || ( !nwSubscriptionHas( sub, e->tag ) ) )
+        {
+            continue;
+        }
+
+        if ( len + e->len > max )
+        {
+            break;
+        }
+
+        ofs = e->pos % t->size;
+        first = ( e->len < t->size - ofs ) ? e->len : t->size - ofs;
+        memcpy( &o[len], &t->d[ofs], first );
+        memcpy( &o[len + first], t->d, e->len - first );
+        len += e->len;
+    }
+
+    return len;
+}
+// ====================================================================================================
+size_t tagHistoryLen( struct tagHistory *t )
+
+{
+    return t->held;
+}
+// ====================================================================================================
+size_t tagHistoryFootprint( struct tagHistory *t )
+
+{
+    return sizeof( struct tagHistory ) + t->size + t->emax * sizeof( struct tagEntry );
+}
+// ====================================================================================================
+void tagHistoryDelete( struct tagHistory *t )
+
+{
+    if ( t )
+    {
+        free( t->d );
+        free( t->e );
+        free( t );
+    }
+}
+// ====================================================================================================
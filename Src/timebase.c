@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Target Timebase
+ * ===============
+ *
+ * Global timestamps only ever raise the floor, they don't move the count directly, because the
+ * local timestamp after a global one still counts from the local one before it. Moving the count
+ * up to the global time there and then would count that stretch twice.
+ *
+ */
+
+#include <string.h>
+
+#include "timebase.h"
+
+#define GTS1_BITS     (26)                        /* Low bits of the global timestamp carried in a GTS1 */
+#define GTS1_MASK     ((1ULL<<GTS1_BITS)-1)
+#define NS_PER_SEC    (1000000000ULL)
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint64_t _scale( uint64_t v, uint64_t mul, uint64_t div )
+
+/* v*mul/div, without overflowing for anything that fits in the answer */
+
+{
+    return ( v / div ) * mul + ( ( v % div ) * mul ) / div;
+}
+// ====================================================================================================
+static void _useGTS( struct timebase *t )
+
+/* The global timestamp is all there, so it can set the floor */
+
+{
+    uint64_t g = ( ( t->gtsHz ) && ( t->coreHz ) ) ? _scale( t->gts, t->coreHz, t->gtsHz ) : t->gts;
+
+    if ( !t->anchored )
+    {
+        /* The first one says where the count really is, so that's not a correction */
+        t->anchored = true;
+        t->cycles = ( g > t->cycles ) ? g : t->cycles;
+    }
+
+    t->drift = ( int64_t )( t->cycles - g );
+    t->floor = ( g > t->floor ) ? g : t->floor;
+    t->timed = true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void timebaseInit( struct timebase *t, uint32_t prescale, uint64_t coreHz, uint64_t gtsHz )
+
+{
+    memset( t, 0, sizeof( struct timebase ) );
+    t->prescale = ( prescale ) ? prescale : 1;
+    t->coreHz = coreHz;
+    t->gtsHz = gtsHz;
+}
+// ====================================================================================================
+void timebaseLTS( struct timebase *t, uint32_t timeInc )
+
+{
+    t->cycles += ( uint64_t )timeInc * t->prescale;
+    t->timed = true;
+
+    if ( t->cycles < t->floor )
+    {
+        /* Local timestamps have been lost, an overflow most likely */
+        t->cycles = t->floor;
+        t->corrections++;
+    }
+}
+// ====================================================================================================
+void timebaseGTS( struct timebase *t, const struct GTSMsg *m )
+
+{
+    if ( m->high )
+    {
+        /* Everything above the GTS1 bits */
+        t->gts = ( t->gts & GTS1_MASK ) | ( m->bits << GTS1_BITS );
+        t->gtsHigh = true;
+        t->gtsWait = false;
+    }
+    else
+    {
+        /* Only the bytes that changed are sent, each with 7 bits of it */
+        uint64_t mask = ( m->len >= 4 ) ? GTS1_MASK : ( 1ULL << ( 7 * m->len ) ) - 1;
+
+        t->gts = ( t->gts & ~mask ) | ( m->bits & mask );
+        t->gtsLow |= ( m->len >= 4 );
+
+        if ( m->clkch )
+        {
+            t->clockChanges++;
+        }
+
+        if ( m->wrap )
+        {
+            t->gtsWait = true;
+        }
+    }
+
+    if ( ( t->gtsLow ) && ( t->gtsHigh ) && ( !t->gtsWait ) )
+    {
+        _useGTS( t );
+    }
+}
+// ====================================================================================================
+void timebaseMsg( struct timebase *t, const struct msg *m )
+
+{
+    switch ( m->genericMsg.msgtype )
+    {
+        case MSG_TS:
+            timebaseLTS( t, ( ( const struct TSMsg * )m )->timeInc );
+            break;
+
+        case MSG_GTS:
+            timebaseGTS( t, &m->gtsMsg );
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+uint64_t timebaseCycles( struct timebase *t )
+
+{
+    return ( t->cycles > t->floor ) ? t->cycles : t->floor;
+}
+// ====================================================================================================
+uint64_t timebaseNs( struct timebase *t )
+
+{
+    uint64_t c = timebaseCycles( t );
+    return ( t->coreHz ) ? _scale( c, NS_PER_SEC, t->coreHz ) : c;
+}
+// ====================================================================================================
+bool timebaseTimed( struct timebase *t )
+
+{
+    return t->timed;
+}
+// ====================================================================================================
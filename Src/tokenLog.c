@@ -0,0 +1,621 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Tokenised Logging
+ * =================
+ *
+ * Each format is parsed the first time its address turns up, into literal text and conversions
+ * rewritten for the host (so a %ld or %lld gets the right sized argument here, whatever the target
+ * thought a long was), and kept by address. After that a record is just the words it's waiting
+ * for and a snprintf for each conversion.
+ *
+ * Formats are found in the sections of the ELF that are loaded onto the target. That's read with
+ * libelf directly rather than through loadelf, which would bring the disassembler and DWARF along
+ * with it.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gelf.h>
+
+#include "generics.h"
+#include "uthash.h"
+#include "tokenLog.h"
+
+#ifndef O_BINARY
+    #define O_BINARY 0
+#endif
+
+#define TOKENLOG_MAX_ARGS  (16)                    /* Most argument words a record can carry */
+#define TOKENLOG_MAX_FMT   (1024)                  /* Longest format that will be looked for */
+#define TOKENLOG_MAX_SPEC  (32)                    /* Longest single conversion that's taken */
+
+enum tokenArg
+{
+    TA_NONE,                                       /* Literal text, takes nothing */
+    TA_INT,                                        /* A word, printed as an int */
+    TA_INT64,                                      /* Two words, printed as a long long */
+    TA_DOUBLE,                                     /* Two words, printed as a double */
+    TA_STRING,                                     /* The address of a string in the image */
+    TA_PTR,                                        /* A pointer, printed as its address */
+    TA_IGNORE                                      /* A word that makes no output (%n) */
+};
+
+struct tokenStep
+{
+    enum tokenArg arg;
+    const char *s;                                 /* Literal text, or conversion spec for the host */
+    size_t len;                                    /* ...and its length */
+    int stars;                                     /* Number of * in the spec, each taking a word first */
+};
+
+struct tokenFormat
+{
+    uint32_t addr;                                 /* Where the format is on the target */
+    int words;                                     /* How many argument words a record with it carries */
+    char *text;                                    /* Literals and specs the steps point into */
+    int numSteps;
+    struct tokenStep *step;
+    UT_hash_handle hh;
+};
+
+struct tokenRegion
+{
+    uint32_t start;
+    size_t len;
+    uint8_t *d;
+};
+
+struct tokenLog
+{
+    struct tokenRegion *r;                         /* Copies of the target's memory */
+    int numRegions;
+    struct tokenFormat *formats;                   /* Formats parsed so far, by address */
+
+    /* The record being collected */
+    struct tokenFormat *cur;                       /* Its format, NULL if waiting for one */
+    uint32_t w[TOKENLOG_MAX_ARGS];                 /* ...and the arguments so far */
+    int numWords;
+
+    struct tokenLogStats stats;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static const char *_string( struct tokenLog *t, uint32_t addr, size_t limit )
+
+/* Find the string at addr in the image, so long as it ends within limit and before the region does */
+
+{
+    for ( int i = 0; i < t->numRegions; i++ )
+    {
+        if ( ( addr >= t->r[i].start ) && ( addr - t->r[i].start < t->r[i].len ) )
+        {
+            const char *s = ( const char * )&t->r[i].d[addr - t->r[i].start];
+            size_t left = t->r[i].len - ( addr - t->r[i].start );
+
+            return ( memchr( s, 0, ( left < limit ) ? left : limit ) ) ? s : NULL;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _parseSpec( const char *f, size_t *used, struct tokenStep *s, char **t, int *words )
+
+/* Parse the conversion at f into s, with its spec for the host written at t. Returns false if it isn't */
+/* a conversion, in which case it's printed as it is.                                                  */
+
+{
+    const char *c = f + 1;
+    char *o = *t;
+    bool wide = false;
+
+    memset( s, 0, sizeof( struct tokenStep ) );
+    *o++ = '%';
+
+    while ( ( *c ) && ( strchr( "-+ #0", *c ) ) )
+    {
+        *o++ = *c++;
+    }
+
+    for ( int part = 0; part < 2; part++ )
+    {
+        /* The width and then the precision, either of which can be a * */
+        if ( *c == '*' )
+        {
+            s->stars++;
+            *o++ = *c++;
+        }
+        else
+        {
+            while ( ( *c >= '0' ) && ( *c <= '9' ) )
+            {
+                *o++ = *c++;
+            }
+        }
+
+        if ( ( part ) || ( *c != '.' ) )
+        {
+            break;
+        }
+
+        *o++ = *c++;
+    }
+
+    /* Length modifiers only say how many words there are, the host has its own */
+    if ( ( ( c[0] == 'l' ) && ( c[1] == 'l' ) ) || ( ( c[0] == 'h' ) && ( c[1] == 'h' ) ) )
+    {
+        wide = ( c[0] == 'l' );
+        c += 2;
+    }
+    else if ( ( *c ) && ( strchr( "hljztLq", *c ) ) )
+    {
+        wide = ( ( *c == 'j' ) || ( *c == 'q' ) );
+        c++;
+    }
+
+    if ( ( !*c ) || ( o - *t > TOKENLOG_MAX_SPEC ) )
+    {
+        return false;
+    }
+
+    switch ( *c )
+    {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            s->arg = ( wide ) ? TA_INT64 : TA_INT;
+
+            if ( wide )
+            {
+                *o++ = 'l';
+                *o++ = 'l';
+            }
+
+            break;
+
+        case 'c':
+            s->arg = TA_INT;
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            s->arg = TA_DOUBLE;
+            break;
+
+        case 's':
+            s->arg = TA_STRING;
+            break;
+
+        case 'p':
+            /* Target pointers are 32 bits, whatever ours are */
+            s->arg = TA_PTR;
+            o = *t;
+            memcpy( o, "0x%08x", 6 );
+            o += 6;
+            break;
+
+        case 'n':
+            s->arg = TA_IGNORE;
+            break;
+
+        default:
+            return false;
+    }
+
+    if ( s->arg != TA_PTR )
+    {
+        *o++ = *c;
+    }
+
+    *o = 0;
+    s->s = *t;
+    s->len = o - *t;
+    *t = o + 1;
+    *used = c + 1 - f;
+    *words += s->stars + ( ( ( s->arg == TA_INT64 ) || ( s->arg == TA_DOUBLE ) ) ? 2 : 1 );
+    return true;
+}
+// ====================================================================================================
+static struct tokenFormat *_parse( struct tokenLog *t, uint32_t addr )
+
+/* Find the format at addr and take it apart, returning NULL if there isn't one there */
+
+{
+    const char *fmt = _string( t, addr, TOKENLOG_MAX_FMT );
+    struct tokenFormat *f;
+    struct tokenStep *s;
+    char *o;
+    size_t l, used;
+
+    if ( !fmt )
+    {
+        return NULL;
+    }
+
+    l = strlen( fmt );
+    f = ( struct tokenFormat * )calloc( 1, sizeof( struct tokenFormat ) );
+    MEMCHECK( f, NULL );
+    f->addr = addr;
+    f->step = ( struct tokenStep * )calloc( l + 1, sizeof( struct tokenStep ) );
+    MEMCHECK( f->step, NULL );
+
+    /* A spec is never more than three times as long once it's rewritten (%p being the worst) */
+    f->text = o = ( char * )malloc( 4 * l + 2 );
+    MEMCHECK( f->text, NULL );
+
+    while ( *fmt )
+    {
+        s = &f->step[f->numSteps];
+
+        if ( ( *fmt == '%' ) && ( fmt[1] != '%' ) && ( _parseSpec( fmt, &used, s, &o, &f->words ) ) )
+        {
+            f->numSteps++;
+            fmt += used;
+            continue;
+        }
+
+        /* Literal text, which can go on the end of the previous literal */
+        if ( ( !f->numSteps ) || ( s[-1].arg != TA_NONE ) )
+        {
+            memset( s, 0, sizeof( struct tokenStep ) );
+            s->s = o;
+            f->numSteps++;
+        }
+        else
+        {
+            s--;
+        }
+
+        *o++ = *fmt;
+        s->len++;
+        fmt += ( ( *fmt == '%' ) && ( fmt[1] == '%' ) ) ? 2 : 1;
+    }
+
+    if ( f->words > TOKENLOG_MAX_ARGS )
+    {
+        genericsReport( V_WARN, "Tokenised log format at 0x%08x has too many arguments" EOL, addr );
+        f->words = TOKENLOG_MAX_ARGS;
+    }
+
+    t->stats.formats++;
+    return f;
+}
+// ====================================================================================================
+static void _spec( const struct tokenStep *s, const uint32_t **w, char *spec )
+
+/* Copy the spec for use, with the value of each * put in its place */
+
+{
+    const char *c = s->s;
+    char *o = spec;
+    int32_t v;
+
+    for ( size_t i = 0; i < s->len; i++, c++ )
+    {
+        if ( *c != '*' )
+        {
+            *o++ = *c;
+            continue;
+        }
+
+        v = ( int32_t ) * ( *w )++;
+
+        if ( ( v < 0 ) && ( o[-1] == '.' ) )
+        {
+            /* A negative precision is taken as if there wasn't one */
+            o--;
+            continue;
+        }
+
+        o += sprintf( o, "%" PRId32, v );
+    }
+
+    *o = 0;
+}
+// ====================================================================================================
+static size_t _render( struct tokenLog *t, const struct tokenFormat *f, char *o, size_t max )
+
+/* Make the text for a complete record */
+
+{
+    char spec[TOKENLOG_MAX_SPEC + 2 * 12];
+    const uint32_t *w = t->w;
+    const char *str;
+    uint64_t v;
+    double d;
+    size_t n = 0;
+    int r;
+
+    for ( int i = 0; ( i < f->numSteps ) && ( n + 1 < max ); i++ )
+    {
+        const struct tokenStep *s = &f->step[i];
+
+        if ( s->arg == TA_NONE )
+        {
+            r = ( s->len < max - n - 1 ) ? s->len : max - n - 1;
+            memcpy( &o[n], s->s, r );
+            n += r;
+            continue;
+        }
+
+        _spec( s, &w, spec );
+
+        switch ( s->arg )
+        {
+            case TA_PTR:
+                /* Its * were taken out along with the rest of the spec, but they were still sent */
+                w += s->stars;
+                r = snprintf( &o[n], max - n, spec, *w++ );
+                break;
+
+            case TA_INT:
+                r = snprintf( &o[n], max - n, spec, *w++ );
+                break;
+
+            case TA_INT64:
+                v = w[0] | ( ( uint64_t )w[1] << 32 );
+                w += 2;
+                r = snprintf( &o[n], max - n, spec, ( unsigned long long )v );
+                break;
+
+            case TA_DOUBLE:
+                v = w[0] | ( ( uint64_t )w[1] << 32 );
+                w += 2;
+                memcpy( &d, &v, sizeof( d ) );
+                r = snprintf( &o[n], max - n, spec, d );
+                break;
+
+            case TA_STRING:
+                if ( ( str = _string( t, *w, TOKENLOG_MAX_OUTPUT ) ) )
+                {
+                    r = snprintf( &o[n], max - n, spec, str );
+                }
+                else
+                {
+                    r = snprintf( &o[n], max - n, "<0x%08" PRIx32 ">", *w );
+                }
+
+                w++;
+                break;
+
+            default:
+                w++;
+                r = 0;
+                break;
+        }
+
+        /* Clipped the way snprintf clips */
+        n += ( r > 0 ) ? r : 0;
+        n = ( n < max ) ? n : max - 1;
+    }
+
+    o[n] = 0;
+    return n;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct tokenLog *tokenLogCreate( void )
+
+{
+    struct tokenLog *t = ( struct tokenLog * )calloc( 1, sizeof( struct tokenLog ) );
+
+    MEMCHECK( t, NULL );
+    return t;
+}
+// ====================================================================================================
+bool tokenLogAddImage( struct tokenLog *t, uint32_t addr, const void *d, size_t len )
+
+{
+    struct tokenRegion *r = ( struct tokenRegion * )realloc( t->r, ( t->numRegions + 1 ) * sizeof( struct tokenRegion ) );
+
+    MEMCHECK( r, false );
+    t->r = r;
+    r = &t->r[t->numRegions];
+    r->d = ( uint8_t * )malloc( len );
+    MEMCHECK( r->d, false );
+    memcpy( r->d, d, len );
+    r->start = addr;
+    r->len = len;
+    t->numRegions++;
+    return true;
+}
+// ====================================================================================================
+bool tokenLogLoadElf( struct tokenLog *t, const char *filename )
+
+{
+    Elf *e;
+    Elf_Scn *scn = NULL;
+    Elf_Data *data;
+    GElf_Shdr shdr;
+    int fd;
+    bool ok = true;
+
+    if ( elf_version( EV_CURRENT ) == EV_NONE )
+    {
+        genericsReport( V_ERROR, "ELF library initialization failed : %s" EOL, elf_errmsg( -1 ) );
+        return false;
+    }
+
+    if ( ( fd = open( filename, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Couldn't open %s for tokenised log formats" EOL, filename );
+        return false;
+    }
+
+    if ( !( e = elf_begin( fd, ELF_C_READ, NULL ) ) )
+    {
+        genericsReport( V_ERROR, "%s isn't an ELF file: %s" EOL, filename, elf_errmsg( -1 ) );
+        close( fd );
+        return false;
+    }
+
+    /* Whatever's loaded onto the target, since that's where the format strings are */
+    while ( ( ok ) && ( ( scn = elf_nextscn( e, scn ) ) ) )
+    {
+        if ( ( gelf_getshdr( scn, &shdr ) == &shdr ) && ( shdr.sh_flags & SHF_ALLOC ) && ( shdr.sh_type == SHT_PROGBITS ) &&
+                ( shdr.sh_size ) && ( ( data = elf_rawdata( scn, NULL ) ) ) && ( data->d_buf ) )
+        {
+            ok = tokenLogAddImage( t, shdr.sh_addr, data->d_buf, data->d_size );
+        }
+    }
+
+    elf_end( e );
+    close( fd );
+
+    if ( ( ok ) && ( !t->numRegions ) )
+    {
+        genericsReport( V_WARN, "No loaded sections in %s, so no tokenised log formats" EOL, filename );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+struct tokenLog *tokenLogFromOption( const char *opt, unsigned int *chan, unsigned int numChans )
+
+/* The tools all take the channel and where its formats are as one option */
+
+{
+    const char *elf = strchr( opt, ',' );
+    struct tokenLog *t;
+
+    *chan = atoi( opt );
+
+    if ( ( !elf ) || ( !elf[1] ) || ( *chan >= numChans ) )
+    {
+        genericsReport( V_ERROR, "Tokenised logging needs <channel>,<elf file>, with a channel below %u" EOL, numChans );
+        return NULL;
+    }
+
+    if ( ( !( t = tokenLogCreate() ) ) || ( !tokenLogLoadElf( t, elf + 1 ) ) )
+    {
+        tokenLogDelete( t );
+        return NULL;
+    }
+
+    return t;
+}
+// ====================================================================================================
+size_t tokenLogPump( struct tokenLog *t, uint32_t w, int len, char *o, size_t max )
+
+{
+    struct tokenFormat *f;
+    size_t n;
+
+    if ( max )
+    {
+        *o = 0;
+    }
+
+    if ( len != 4 )
+    {
+        /* Records are only ever made of whole words, so this is something else */
+        if ( t->cur )
+        {
+            t->stats.restarts++;
+            t->cur = NULL;
+        }
+
+        return 0;
+    }
+
+    if ( !t->cur )
+    {
+        HASH_FIND( hh, t->formats, &w, sizeof( uint32_t ), f );
+
+        if ( ( !f ) && ( ( f = _parse( t, w ) ) ) )
+        {
+            HASH_ADD( hh, t->formats, addr, sizeof( uint32_t ), f );
+        }
+
+        if ( !f )
+        {
+            /* Nothing's kept for these, else a stream that has lost its place would fill memory */
+            t->stats.unknown++;
+            genericsReportRateLimited( V_WARN, "No tokenised log format at 0x%08" PRIx32 EOL, w );
+            return 0;
+        }
+
+        t->cur = f;
+        t->numWords = 0;
+    }
+    else
+    {
+        t->w[t->numWords++] = w;
+    }
+
+    if ( t->numWords < t->cur->words )
+    {
+        return 0;
+    }
+
+    n = ( max ) ? _render( t, t->cur, o, max ) : 0;
+    t->cur = NULL;
+    t->stats.records++;
+    return n;
+}
+// ====================================================================================================
+void tokenLogReset( struct tokenLog *t )
+
+{
+    t->cur = NULL;
+}
+// ====================================================================================================
+const struct tokenLogStats *tokenLogGetStats( struct tokenLog *t )
+
+{
+    return &t->stats;
+}
+// ====================================================================================================
+void tokenLogDelete( struct tokenLog *t )
+
+{
+    struct tokenFormat *f, *tmp;
+
+    if ( !t )
+    {
+        return;
+    }
+
+    HASH_ITER( hh, t->formats, f, tmp )
+    {
+        HASH_DEL( t->formats, f );
+        free( f->step );
+        free( f->text );
+        free( f );
+    }
+
+    for ( int i = 0; i < t->numRegions; i++ )
+    {
+        free( t->r[i].d );
+    }
+
+    free( t->r );
+    free( t );
+}
+// ====================================================================================================
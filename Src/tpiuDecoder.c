@@ -15,6 +15,8 @@
     #define genericsReport(x...)
 #endif
 #include "tpiuDecoder.h"
+#include "simd.h"
+#include "orbProbes.h"
 
 #ifndef timersub
 #define timersub(a, b, result) \
@@ -36,6 +38,15 @@
 #define TPIU_TIMEOUT_US (200000U)        // Note that this timeout must be less than 1sec (<1000000 us)
 #define STAT_SYNC_BYTE (0xA6)            // Sync header for status
 
+/* Collector for decoded data being assembled into per-stream spans */
+struct spanBuild
+{
+    uint8_t out[TPIU_SPAN_BUFLEN];       /* Decoded data */
+    int olen;                            /* ...and how much of it there is */
+    struct TPIUSpan s[TPIU_SPAN_BUFLEN]; /* Spans over the decoded data */
+    int ns;                              /* ...and how many of them there are */
+};
+
 // ====================================================================================================
 struct TPIUDecoder *TPIUDecoderCreate( void )
 
@@ -77,6 +88,33 @@ struct TPIUDecoderStats *TPIUDecoderGetStats( struct TPIUDecoder *t )
     return &t->stats;
 }
 // ====================================================================================================
+void TPIUDecoderRegisterStats( struct TPIUDecoder *t, struct statsRegistry *r, const char *prefix, const char *labels )
+
+{
+#define TPIUSTAT(f)  offsetof( struct TPIUDecoderStats, f )
+#define COMMSSTAT(f) offsetof( struct TPIUCommsStats, f )
+    static const struct statDef _stats[] =
+    {
+        { "tpiu_lost_sync_total",  "Times TPIU sync was lost",               STAT_COUNTER, TPIUSTAT( lostSync ) },
+        { "tpiu_syncs_total",      "TPIU syncs",                             STAT_COUNTER, TPIUSTAT( syncCount ) },
+        { "tpiu_half_syncs_total", "TPIU half syncs",                        STAT_COUNTER, TPIUSTAT( halfSyncCount ) },
+        { "tpiu_packets_total",    "TPIU frames",                            STAT_COUNTER, TPIUSTAT( packets ) },
+        { "tpiu_errors_total",     "TPIU decode errors",                     STAT_COUNTER, TPIUSTAT( error ) },
+    };
+    static const struct statDef _comms[] =
+    {
+        { "tpiu_link_pending",     "Frames the probe had pending at its last report", STAT_GAUGE, COMMSSTAT( pendingCount ) },
+        { "tpiu_link_leds",        "The probe's LEDs at its last report",             STAT_GAUGE, COMMSSTAT( leds ) },
+        { "tpiu_link_lost_frames", "Frames the probe had lost at its last report",    STAT_GAUGE, COMMSSTAT( lostFrames ) },
+        { "tpiu_link_frames",      "Frames the probe had sent at its last report",    STAT_GAUGE, COMMSSTAT( totalFrames ) },
+    };
+#undef TPIUSTAT
+#undef COMMSSTAT
+
+    statsRegistryAddSet( r, prefix, labels, &t->stats, _stats, sizeof( _stats ) / sizeof( _stats[0] ) );
+    statsRegistryAddSet( r, prefix, labels, &t->commsStats, _comms, sizeof( _comms ) / sizeof( _comms[0] ) );
+}
+// ====================================================================================================
 void TPIUDecoderForceSync( struct TPIUDecoder *t, uint8_t offset )
 
 /* Force the decoder into a specific sync state */
@@ -84,16 +122,31 @@ void TPIUDecoderForceSync( struct TPIUDecoder *t, uint8_t offset )
 {
     if ( t->state == TPIU_UNSYNCED )
     {
-        t->stats.syncCount++;
+        STAT_INC( t->stats.syncCount );
     }
 
+    /* Bytes are collected in pairs, so the offset has to land on a pair, and inside the frame */
     t->state = TPIU_RXING;
-    t->byteCount = offset;
+    t->byteCount = ( offset % TPIU_PACKET_LEN ) & ~1;
+    t->got_lowbits = false;
 
     /* Consider this a valid timestamp */
     gettimeofday( &t->lastPacket, NULL );
 }
 // ====================================================================================================
+void TPIUDecoderUnsync( struct TPIUDecoder *t )
+
+/* Go back to waiting for a sync, as at startup, for when the caller has let data go by undecoded */
+
+{
+    t->state = TPIU_UNSYNCED;
+    t->byteCount = 0;
+    t->got_lowbits = false;
+
+    /* ...and there's no last packet, so the gap isn't taken as a lost sync */
+    timerclear( &t->lastPacket );
+}
+// ====================================================================================================
 bool _getPacket( struct TPIUDecoder *t, struct TPIUPacket *p )
 
 /* Copy received packet into transfer buffer, and reset receiver */
@@ -173,25 +226,20 @@ void _decodeCommsStats( struct TPIUDecoder *t )
 /* Decode received communication stats into transfer buffer */
 
 {
-    t->commsStats.pendingCount = ( t->rxedPacket[2] << 8 ) | t->rxedPacket[1];
-    t->commsStats.leds         = t->rxedPacket[5];
-    t->commsStats.lostFrames   = ( t->rxedPacket[7] << 8 ) | t->rxedPacket[6];
-    t->commsStats.totalFrames  = ( t->rxedPacket[11] << 24 ) | ( t->rxedPacket[10] << 16 ) | ( t->rxedPacket[9] << 8 ) | ( t->rxedPacket[8] );
+    STAT_SET( t->commsStats.pendingCount, ( t->rxedPacket[2] << 8 ) | t->rxedPacket[1] );
+    STAT_SET( t->commsStats.leds, t->rxedPacket[5] );
+    STAT_SET( t->commsStats.lostFrames, ( t->rxedPacket[7] << 8 ) | t->rxedPacket[6] );
+    STAT_SET( t->commsStats.totalFrames, ( ( uint32_t )t->rxedPacket[11] << 24 ) | ( t->rxedPacket[10] << 16 ) | ( t->rxedPacket[9] << 8 ) | ( t->rxedPacket[8] ) );
 }
 // ====================================================================================================
-void TPIUPump( struct TPIUDecoder *t, uint8_t *frame, int len,
-               void ( *packetRxed )( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param ),
-               void *param )
+static bool _checkTimeout( struct TPIUDecoder *t )
 
-
-/* Assemble this packet into TPIU frames and call them back */
+/* Check if this packet arrived a sensible time since the last one, returns true if sync lost */
 
 {
     struct timeval nowTime, diffTime;
-    uint8_t d;
-    struct TPIUPacket _packet;
+    bool lost = false;
 
-    /* Check if this packet arrived a sensible time since the last one */
     gettimeofday( &nowTime, NULL );
     timersub( &nowTime, &t->lastPacket, &diffTime );
 
@@ -202,90 +250,297 @@ void TPIUPump( struct TPIUDecoder *t, uint8_t *frame, int len,
         {
             /* There was a legal value for last time...this is not the startup case */
             genericsReport( V_WARN, ">>>>>>>>> PACKET INTERVAL TOO LONG <<<<<<<<<<<<<<" EOL );
-            t->stats.lostSync++;
+            STAT_INC( t->stats.lostSync );
+            ORB_PROBE( liborb, tpiu_lost_sync, ( uint64_t )diffTime.tv_sec * 1000000 + diffTime.tv_usec );
         }
 
         t->state = TPIU_UNSYNCED;
-        packetRxed( TPIU_EV_UNSYNCED, NULL, param );
+        lost = true;
     }
 
     memcpy( &t->lastPacket, &nowTime, sizeof( struct timeval ) );
+    return lost;
+}
+// ====================================================================================================
+static enum TPIUPumpEvent _pumpByte( struct TPIUDecoder *t, uint8_t d )
+
+/* Run a single octet through the state machine. Returns TPIU_EV_RXEDPACKET when rxedPacket is complete */
+
+{
+    t->syncMonitor = ( t->syncMonitor << 8 ) | d;
+
+    /* ----------------------------------------------------------------------------------- */
+    /* First case : This is a sync pattern. If so then process it, then move to next octet */
+    if ( t->syncMonitor == SYNCPATTERN )
+    {
+        enum TPIUPumpEvent e = ( t->state == TPIU_UNSYNCED ) ? TPIU_EV_NEWSYNC : TPIU_EV_SYNCED;
+
+        if ( e == TPIU_EV_NEWSYNC )
+        {
+            ORB_PROBE( liborb, tpiu_sync, t->stats.syncCount + 1 );
+        }
+
+        /* Deal with the special state that these are communication stats from the link */
+        /* ...it is still a reset though!                                               */
+        if ( ( t->byteCount == 14 ) && ( t->rxedPacket[0] == STAT_SYNC_BYTE ) )
+        {
+            _decodeCommsStats( t );
+        }
+
+        t->state = TPIU_RXING;
+        STAT_INC( t->stats.syncCount );
+        t->byteCount = 0;
+        t->got_lowbits = false;
+        genericsReport( V_DEBUG, "!!!! " EOL );
+
+        /* Consider this a valid timestamp */
+        gettimeofday( &t->lastPacket, NULL );
+        return e;
+    }
+
+    /* ----------------------------------------------- */
+    /* Second case : We're not synced, just move along */
+    if ( t->state == TPIU_UNSYNCED )
+    {
+        return TPIU_EV_NONE;
+    }
+
+    /* ------------------------------------------------------------------------------- */
+    /* Otherwise : Process this into a frame, and deal with the frame if it's complete */
+
+    // We collect in sets of 16 bits, in order to filter halfsyncs (0x7fff)
+    if ( !t->got_lowbits )
+    {
+        t->got_lowbits = true;
+        t->rxedPacket[t->byteCount] = d;
+        return TPIU_EV_NONE;
+    }
+
+    t->got_lowbits = false;
+
+    if ( ( d == HALFSYNC_HIGH ) && ( t->rxedPacket[t->byteCount] == HALFSYNC_LOW ) )
+    {
+        // A halfsync, waste of space, to be ignored
+        STAT_INC( t->stats.halfSyncCount );
+        return TPIU_EV_NONE;
+    }
+
+    // Pre-increment for the low byte we already got, post increment for this one
+    genericsReport( V_DEBUG, "[%02x %02x] ", t->rxedPacket[t->byteCount], d );
+    t->byteCount++;
+    t->rxedPacket[t->byteCount++] = d;
+
+    if ( t->byteCount == TPIU_PACKET_LEN )
+    {
+        STAT_INC( t->stats.packets );
+        t->byteCount = 0;
+        genericsReport( V_DEBUG, EOL );
+        return TPIU_EV_RXEDPACKET;
+    }
+
+    return TPIU_EV_NONE;
+}
+// ====================================================================================================
+void TPIUPump( struct TPIUDecoder *t, uint8_t *frame, int len,
+               void ( *packetRxed )( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param ),
+               void *param )
+
+
+/* Assemble this packet into TPIU frames and call them back */
+
+{
+    struct TPIUPacket _packet;
+    enum TPIUPumpEvent e;
+
+    if ( _checkTimeout( t ) )
+    {
+        packetRxed( TPIU_EV_UNSYNCED, NULL, param );
+    }
 
     /* Now process the packet */
     while ( len-- )
     {
-        d = *frame++;
-        t->syncMonitor = ( t->syncMonitor << 8 ) | d;
-
-        /* ----------------------------------------------------------------------------------- */
-        /* First case : This is a sync pattern. If so then process it, then move to next octet */
-        if ( t->syncMonitor == SYNCPATTERN )
+        switch ( ( e = _pumpByte( t, *frame++ ) ) )
         {
-            packetRxed( ( t->state == TPIU_UNSYNCED ) ? TPIU_EV_NEWSYNC : TPIU_EV_SYNCED, NULL, param );
+            case TPIU_EV_RXEDPACKET:
+                if ( _getPacket( t, &_packet ) )
+                {
+                    packetRxed( TPIU_EV_RXEDPACKET, &_packet, param );
+                }
 
-            /* Deal with the special state that these are communication stats from the link */
-            /* ...it is still a reset though!                                               */
-            if ( ( t->byteCount == 14 ) && ( t->rxedPacket[0] == STAT_SYNC_BYTE ) )
-            {
-                _decodeCommsStats( t );
-            }
+                break;
 
-            t->state = TPIU_RXING;
-            t->stats.syncCount++;
-            t->byteCount = 0;
-            t->got_lowbits = false;
-            genericsReport( V_DEBUG, "!!!! " EOL );
+            case TPIU_EV_NEWSYNC:
+            case TPIU_EV_SYNCED:
+                packetRxed( e, NULL, param );
+                break;
 
-            /* Consider this a valid timestamp */
-            gettimeofday( &t->lastPacket, NULL );
-            continue;
+            default:
+                break;
         }
+    }
+}
+// ====================================================================================================
+// Block oriented decoder. Frames that can't contain a sync are decoded straight from the input, and
+// everything is returned as runs of bytes for the same stream.
+// ====================================================================================================
+static inline void _spanAdd( struct spanBuild *b, uint8_t stream, uint8_t d )
 
-        /* ----------------------------------------------- */
-        /* Second case : We're not synced, just move along */
-        if ( t->state == TPIU_UNSYNCED )
+{
+    if ( ( !b->ns ) || ( b->s[b->ns - 1].stream != stream ) )
+    {
+        b->s[b->ns].stream = stream;
+        b->s[b->ns].d = &b->out[b->olen];
+        b->s[b->ns].len = 0;
+        b->ns++;
+    }
+
+    b->out[b->olen++] = d;
+    b->s[b->ns - 1].len++;
+}
+// ====================================================================================================
+static void _decodeFrame( struct TPIUDecoder *t, const uint8_t *f, struct spanBuild *b )
+
+/* Decode a complete frame into the span collector ... same logic as _getPacket */
+
+{
+    uint8_t delayedStreamChange = NO_CHANNEL_CHANGE;
+    uint8_t lowbits = f[TPIU_PACKET_LEN - 1];
+
+    for ( uint32_t i = 0; i < TPIU_PACKET_LEN; i += 2 )
+    {
+        if ( f[i] & 1 )
         {
-            continue;
+            /* This is a stream change - either before or after the data byte */
+            if ( lowbits & 1 )
+            {
+                delayedStreamChange = f[i] >> 1;
+            }
+            else
+            {
+                t->currentStream = f[i] >> 1;
+            }
+        }
+        else if ( t->currentStream )
+        {
+            /* This is a data byte - store it, provided it's not padding */
+            _spanAdd( b, t->currentStream, f[i] | ( lowbits & 1 ) );
         }
 
-        /* ------------------------------------------------------------------------------- */
-        /* Otherwise : Process this into a frame, and deal with the frame if it's complete */
+        /* The other byte of the pair is always data */
+        if ( ( i < 14 ) && ( t->currentStream ) )
+        {
+            _spanAdd( b, t->currentStream, f[i + 1] );
+        }
 
-        // We collect in sets of 16 bits, in order to filter halfsyncs (0x7fff)
-        if ( !t->got_lowbits )
+        if ( delayedStreamChange != NO_CHANNEL_CHANGE )
         {
-            t->got_lowbits = true;
-            t->rxedPacket[t->byteCount] = d;
-            continue;
+            t->currentStream = delayedStreamChange;
+            delayedStreamChange = NO_CHANNEL_CHANGE;
         }
 
-        t->got_lowbits = false;
+        lowbits >>= 1;
+    }
+}
+// ====================================================================================================
+static void _spanFlush( struct spanBuild *b, TPIUSpansCB spansRxed, void *param )
+
+{
+    if ( b->ns )
+    {
+        spansRxed( TPIU_EV_RXEDPACKET, b->s, b->ns, param );
+    }
+
+    b->ns = 0;
+    b->olen = 0;
+}
+// ====================================================================================================
+void TPIUPumpSpans( struct TPIUDecoder *t, const uint8_t *frame, int len, TPIUSpansCB spansRxed, void *param )
+
+/* Decode a block of TPIU data, calling back with per-stream spans of data */
+
+{
+    const struct SIMDKernels *k = SIMDKernels();
+    struct spanBuild b;
+    enum TPIUPumpEvent e;
+    const uint8_t *p;
+    int clean;
+
+    b.ns = b.olen = 0;
+
+    if ( _checkTimeout( t ) )
+    {
+        spansRxed( TPIU_EV_UNSYNCED, NULL, 0, param );
+    }
 
-        if ( ( d == HALFSYNC_HIGH ) && ( t->rxedPacket[t->byteCount] == HALFSYNC_LOW ) )
+    while ( len )
+    {
+        /* Both full syncs and halfsyncs end with HALFSYNC_HIGH, so a frame without one can't contain either */
+        if ( ( t->state == TPIU_RXING ) && ( !t->byteCount ) && ( !t->got_lowbits ) &&
+                ( clean = k->cleanFrames( frame, len / TPIU_PACKET_LEN, HALFSYNC_HIGH ) ) )
         {
-            // A halfsync, waste of space, to be ignored
-            t->stats.halfSyncCount++;
+            /* Fast path: whole frames with no sync possible in them, decode them in place */
+            while ( clean-- )
+            {
+                t->syncMonitor = ( frame[12] << 24 ) | ( frame[13] << 16 ) | ( frame[14] << 8 ) | frame[15];
+                STAT_INC( t->stats.packets );
+                _decodeFrame( t, frame, &b );
+                frame += TPIU_PACKET_LEN;
+                len -= TPIU_PACKET_LEN;
+
+                if ( b.olen > TPIU_SPAN_BUFLEN - TPIU_PACKET_LEN )
+                {
+                    _spanFlush( &b, spansRxed, param );
+                }
+            }
+
             continue;
         }
 
-        // Pre-increment for the low byte we already got, post increment for this one
-        genericsReport( V_DEBUG, "[%02x %02x] ", t->rxedPacket[t->byteCount], d );
-        t->byteCount++;
-        t->rxedPacket[t->byteCount++] = d;
-
-        if ( t->byteCount == TPIU_PACKET_LEN )
+        if ( t->state == TPIU_UNSYNCED )
         {
-            t->stats.packets++;
-            t->byteCount = 0;
-            genericsReport( V_DEBUG, EOL );
+            /* Nothing before the next HALFSYNC_HIGH can complete a sync, just remember the tail end of it */
+            p = memchr( frame, HALFSYNC_HIGH, len );
+
+            for ( int n = p ? p - frame : len; n; n-- )
+            {
+                t->syncMonitor = ( t->syncMonitor << 8 ) | *frame++;
+                len--;
+            }
 
-            if ( _getPacket( t, &_packet ) )
+            if ( !len )
             {
-                packetRxed( TPIU_EV_RXEDPACKET, &_packet, param );
+                break;
             }
         }
 
-        continue;
+        /* Slow path: octet at a time */
+        len--;
+
+        switch ( ( e = _pumpByte( t, *frame++ ) ) )
+        {
+            case TPIU_EV_RXEDPACKET:
+                _decodeFrame( t, t->rxedPacket, &b );
+
+                if ( b.olen > TPIU_SPAN_BUFLEN - TPIU_PACKET_LEN )
+                {
+                    _spanFlush( &b, spansRxed, param );
+                }
+
+                break;
+
+            case TPIU_EV_NEWSYNC:
+            case TPIU_EV_SYNCED:
+                /* Events are delivered in order with the data around them */
+                _spanFlush( &b, spansRxed, param );
+                spansRxed( e, NULL, 0, param );
+                break;
+
+            default:
+                break;
+        }
     }
+
+    _spanFlush( &b, spansRxed, param );
 }
 // ====================================================================================================
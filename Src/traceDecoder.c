@@ -14,6 +14,7 @@
 #include "msgDecoder.h"
 #include "traceDecoder.h"
 #include "generics.h"
+#include "orbProbes.h"
 
 /* Individual trace decoders defined in their own file */
 extern struct TRACEDecoderEngine *ETM35DecoderPumpCreate( void );
@@ -58,6 +59,19 @@ struct TRACEDecoderStats *TRACEDecoderGetStats( struct TRACEDecoder *i )
     return &i->stats;
 }
 // ====================================================================================================
+void TRACEDecoderRegisterStats( struct TRACEDecoder *i, struct statsRegistry *r, const char *prefix, const char *labels )
+
+{
+    static const struct statDef _stats[] =
+    {
+        { "trace_lost_sync_total", "Times trace sync was lost", STAT_COUNTER, offsetof( struct TRACEDecoderStats, lostSyncCount ) },
+        { "trace_syncs_total",     "Times trace was synced",    STAT_COUNTER, offsetof( struct TRACEDecoderStats, syncCount ) },
+    };
+
+    assert( i );
+    statsRegistryAddSet( r, prefix, labels, &i->stats, _stats, sizeof( _stats ) / sizeof( _stats[0] ) );
+}
+// ====================================================================================================
 struct TRACECPUState *TRACECPUState( struct TRACEDecoder *i )
 {
     return &i->cpu;
@@ -89,19 +103,47 @@ void TRACEDecoderForceSync( struct TRACEDecoder *i, bool isSynced )
 
     if ( isSynced )
     {
-        i->stats.syncCount++;
+        STAT_INC( i->stats.syncCount );
     }
     else
     {
         if ( TRACEDecoderIsSynced( i ) )
         {
-            i->stats.lostSyncCount++;
+            STAT_INC( i->stats.lostSyncCount );
         }
     }
 
+    ORB_PROBE( liborb, trace_force_sync, i->protocol, isSynced );
     i->engine->forceSync( i->engine, isSynced );
 }
 // ====================================================================================================
+int TRACEDecoderFindSync( struct TRACEDecoder *i, const uint8_t *buf, int len, int from )
+
+/* Find the first point at or after from where a fresh decoder could start on buf, or -1 if there isn't one */
+
+{
+    assert( i );
+    assert( i->engine );
+
+    if ( !i->engine->findSync )
+    {
+        return -1;
+    }
+
+    return i->engine->findSync( i->engine, buf, len, from );
+}
+// ====================================================================================================
+static inline void _probeSync( struct TRACEDecoder *i, bool wasSynced )
+
+/* The engines find and lose sync in their own ways, so for anyone watching it is noticed a block at a time */
+
+{
+    if ( ( ORB_PROBES_BUILT ) && ( wasSynced != TRACEDecoderIsSynced( i ) ) )
+    {
+        ORB_PROBE( liborb, trace_sync, i->protocol, !wasSynced );
+    }
+}
+// ====================================================================================================
 void TRACEDecoderPump( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecodeCB cb, void *d )
 
 {
@@ -109,9 +151,28 @@ void TRACEDecoderPump( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecod
     assert( buf );
     assert( cb );
 
+    const bool wasSynced = ( ORB_PROBES_BUILT ) && TRACEDecoderIsSynced( i );
+
     /* len can arrive as 0 for the case of an unwrapped buffer */
 
-    if ( i->engine->action )
+    if ( i->engine->actionRun )
+    {
+        bool reported;
+        int n;
+
+        while ( len )
+        {
+            n = i->engine->actionRun( i->engine, &i->cpu, buf, len, &reported );
+            buf += n;
+            len -= n;
+
+            if ( reported )
+            {
+                cb( d );
+            }
+        }
+    }
+    else if ( i->engine->action )
     {
         while ( len-- )
         {
@@ -139,6 +200,90 @@ void TRACEDecoderPump( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecod
             len -= 8;
         }
     }
+
+    _probeSync( i, wasSynced );
+}
+// ====================================================================================================
+static inline void _recordEvent( struct TRACECPUState *cpu, struct TRACEEvent *ev )
+
+/* Take a snapshot of the cpu for an event, and start collecting changes afresh for the next one */
+
+{
+    ev->changes     = cpu->changeRecord;
+    ev->addr        = cpu->addr;
+    ev->toAddr      = cpu->toAddr;
+    ev->disposition = cpu->disposition;
+    ev->eatoms      = cpu->eatoms;
+    ev->natoms      = cpu->natoms;
+    ev->exception   = cpu->exception;
+    ev->instCount   = cpu->instCount;
+    ev->ts          = cpu->ts;
+    ev->cycleCount  = cpu->cycleCount;
+    ev->contextID   = cpu->contextID;
+    cpu->changeRecord = 0;
+}
+// ====================================================================================================
+int TRACEDecoderPumpEvents( struct TRACEDecoder *i, const uint8_t *buf, int len, struct TRACEEvent *ev, int maxEvents, int *consumed )
+
+/* Pump data through the decoder, recording events into ev rather than calling back for each one. Stops */
+/* when the data run out or ev is full, returning the number of events and setting the bytes consumed.  */
+
+{
+    const uint8_t *start = buf;
+    const bool wasSynced = ( ORB_PROBES_BUILT ) && TRACEDecoderIsSynced( i );
+    int n = 0;
+
+    assert( i );
+    assert( buf );
+    assert( ev );
+    assert( consumed );
+
+    if ( i->engine->actionRun )
+    {
+        bool reported;
+        int l;
+
+        while ( ( len ) && ( n < maxEvents ) )
+        {
+            l = i->engine->actionRun( i->engine, &i->cpu, buf, len, &reported );
+            buf += l;
+            len -= l;
+
+            if ( reported )
+            {
+                _recordEvent( &i->cpu, &ev[n++] );
+            }
+        }
+    }
+    else if ( i->engine->action )
+    {
+        while ( ( len ) && ( n < maxEvents ) )
+        {
+            len--;
+
+            if ( i->engine->action(  i->engine, &i->cpu, *( buf++ ) ) )
+            {
+                _recordEvent( &i->cpu, &ev[n++] );
+            }
+        }
+    }
+    else if ( i->engine->actionPair )
+    {
+        while ( ( len > 7 ) && ( n < maxEvents ) )
+        {
+            if ( i->engine->actionPair( i->engine, &i->cpu, *( uint32_t * )buf, *( uint32_t * )( buf + 4 ) ) )
+            {
+                _recordEvent( &i->cpu, &ev[n++] );
+            }
+
+            buf += 8;
+            len -= 8;
+        }
+    }
+
+    *consumed = buf - start;
+    _probeSync( i, wasSynced );
+    return n;
 }
 // ====================================================================================================
 void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool usingAltAddrEncodeSet, genericsReportCB report )
@@ -165,3 +310,148 @@ void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool
 }
 // ====================================================================================================
 
+void TRACECPUStateSave( const struct TRACECPUState *cpu, struct TRACECkpt *k )
+
+/* Everything about the CPU except the report callback, which belongs to whoever is decoding */
+
+{
+    TRACECkptPut( k, cpu->changeRecord, 4 );
+    TRACECkptPut( k, cpu->ts, 8 );
+    TRACECkptPut( k, cpu->addr, 8 );
+    TRACECkptPut( k, cpu->toAddr, 8 );
+    TRACECkptPut( k, cpu->nextAddr, 8 );
+    TRACECkptPut( k, cpu->addrMode, 1 );
+    TRACECkptPut( k, cpu->contextID, 4 );
+    TRACECkptPut( k, cpu->vmid, 1 );
+    TRACECkptPut( k, cpu->cycleCount, 8 );
+    TRACECkptPut( k, cpu->exception, 2 );
+    TRACECkptPut( k, cpu->resume, 2 );
+    TRACECkptPut( k, cpu->serious, 1 );
+    TRACECkptPut( k, cpu->instCount, 8 );
+    TRACECkptPut( k, cpu->exceptionLevel, 1 );
+    TRACECkptPut( k, cpu->am64bit, 1 );
+    TRACECkptPut( k, cpu->amSecure, 1 );
+    TRACECkptPut( k, cpu->reason, 1 );
+    TRACECkptPut( k, cpu->isLSiP, 1 );
+    TRACECkptPut( k, cpu->numInstructions, 1 );
+    TRACECkptPut( k, cpu->watoms, 1 );
+    TRACECkptPut( k, cpu->eatoms, 1 );
+    TRACECkptPut( k, cpu->natoms, 1 );
+    TRACECkptPut( k, cpu->disposition, 4 );
+    TRACECkptPut( k, cpu->dsync_mark, 1 );
+    TRACECkptPut( k, cpu->udsync_mark, 1 );
+    TRACECkptPut( k, cpu->jazelle, 1 );
+    TRACECkptPut( k, cpu->nonSecure, 1 );
+    TRACECkptPut( k, cpu->altISA, 1 );
+    TRACECkptPut( k, cpu->hyp, 1 );
+    TRACECkptPut( k, cpu->thumb, 1 );
+    TRACECkptPut( k, cpu->clockSpeedChanged, 1 );
+}
+// ====================================================================================================
+void TRACECPUStateLoad( struct TRACECPUState *cpu, struct TRACECkpt *k )
+
+/* The reverse of TRACECPUStateSave, leaving the report callback as it was */
+
+{
+    cpu->changeRecord      = TRACECkptGet( k, 4 );
+    cpu->ts                = TRACECkptGet( k, 8 );
+    cpu->addr              = TRACECkptGet( k, 8 );
+    cpu->toAddr            = TRACECkptGet( k, 8 );
+    cpu->nextAddr          = TRACECkptGet( k, 8 );
+    cpu->addrMode          = TRACECkptGet( k, 1 );
+    cpu->contextID         = TRACECkptGet( k, 4 );
+    cpu->vmid              = TRACECkptGet( k, 1 );
+    cpu->cycleCount        = TRACECkptGet( k, 8 );
+    cpu->exception         = TRACECkptGet( k, 2 );
+    cpu->resume            = TRACECkptGet( k, 2 );
+    cpu->serious           = TRACECkptGet( k, 1 );
+    cpu->instCount         = TRACECkptGet( k, 8 );
+    cpu->exceptionLevel    = TRACECkptGet( k, 1 );
+    cpu->am64bit           = TRACECkptGet( k, 1 );
+    cpu->amSecure          = TRACECkptGet( k, 1 );
+    cpu->reason            = TRACECkptGet( k, 1 );
+    cpu->isLSiP            = TRACECkptGet( k, 1 );
+    cpu->numInstructions   = TRACECkptGet( k, 1 );
+    cpu->watoms            = TRACECkptGet( k, 1 );
+    cpu->eatoms            = TRACECkptGet( k, 1 );
+    cpu->natoms            = TRACECkptGet( k, 1 );
+    cpu->disposition       = TRACECkptGet( k, 4 );
+    cpu->dsync_mark        = TRACECkptGet( k, 1 );
+    cpu->udsync_mark       = TRACECkptGet( k, 1 );
+    cpu->jazelle           = TRACECkptGet( k, 1 );
+    cpu->nonSecure         = TRACECkptGet( k, 1 );
+    cpu->altISA            = TRACECkptGet( k, 1 );
+    cpu->hyp               = TRACECkptGet( k, 1 );
+    cpu->thumb             = TRACECkptGet( k, 1 );
+    cpu->clockSpeedChanged = TRACECkptGet( k, 1 );
+}
+// ====================================================================================================
+size_t TRACEDecoderSnapshot( struct TRACEDecoder *i, uint8_t *d, size_t len )
+
+/* Write a checkpoint of the decoder into d, returning how long it is. If that's more than len then */
+/* only part of it was written, and it needs doing again with more room. 0 if it can't be done.     */
+
+{
+    struct TRACECkpt k = { .d = d, .len = len };
+
+    assert( i );
+    assert( i->engine );
+
+    if ( !i->engine->snapshot )
+    {
+        return 0;
+    }
+
+    TRACECkptPut( &k, TRACE_CKPT_VERSION, 1 );
+    TRACECkptPut( &k, i->protocol, 1 );
+    TRACECkptPut( &k, i->stats.lostSyncCount, 4 );
+    TRACECkptPut( &k, i->stats.syncCount, 4 );
+    TRACECPUStateSave( &i->cpu, &k );
+    i->engine->snapshot( i->engine, &k );
+
+    return k.ofs;
+}
+// ====================================================================================================
+bool TRACEDecoderRestore( struct TRACEDecoder *i, const uint8_t *d, size_t len )
+
+/* Put the decoder back to a checkpoint taken with TRACEDecoderSnapshot. It must have been set up */
+/* for the same protocol. If the checkpoint is no good then nothing is changed and false returned. */
+
+{
+    struct TRACECkpt k = { .d = ( uint8_t * )d, .len = len };
+    uint8_t was[TRACE_CKPT_MAX_LEN];
+    struct TRACECkpt w = { .d = was, .len = sizeof( was ) };
+    struct TRACEDecoderStats stats;
+    struct TRACECPUState cpu = i->cpu;
+
+    assert( i );
+    assert( i->engine );
+
+    if ( ( !i->engine->restore ) ||
+            ( TRACECkptGet( &k, 1 ) != TRACE_CKPT_VERSION ) || ( TRACECkptGet( &k, 1 ) != i->protocol ) )
+    {
+        return false;
+    }
+
+    stats.lostSyncCount = TRACECkptGet( &k, 4 );
+    stats.syncCount = TRACECkptGet( &k, 4 );
+    TRACECPUStateLoad( &cpu, &k );
+
+    /* The engine state goes straight in, so keep what it was in case it has to go back */
+    i->engine->snapshot( i->engine, &w );
+    assert( !w.bad );
+    i->engine->restore( i->engine, &k );
+
+    if ( ( k.bad ) || ( k.ofs != len ) )
+    {
+        w.len = w.ofs;
+        w.ofs = 0;
+        i->engine->restore( i->engine, &w );
+        return false;
+    }
+
+    i->stats = stats;
+    i->cpu = cpu;
+    return true;
+}
+// ====================================================================================================
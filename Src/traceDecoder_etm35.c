@@ -64,6 +64,17 @@ struct ETM35DecodeState
     bool cycleAccurate;                  /* Using cycle accurate mode */
 };
 
+/* Atoms from each non cycle-accurate P-header, so they can be had without running the state machine */
+struct pHeader
+{
+    bool valid;                          /* This is a format 1 or 2 P-header */
+    uint8_t eatoms;                      /* Number of E (executed) atoms */
+    uint8_t natoms;                      /* Number of N (non-executed) atoms */
+    uint16_t disposition;                /* Bit set for each executed atom */
+};
+
+static struct pHeader _pHeader[256];
+
 #define DEBUG(...) { if ( cpu->report ) cpu->report( V_DEBUG, __VA_ARGS__); }
 // ====================================================================================================
 // ====================================================================================================
@@ -254,7 +265,8 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                 if ( c == 0b01101110 )
                 {
                     DEBUG( "CONTEXTID " EOL );
-                    newState = TRACE_GET_CONTEXTID;
+                    /* With no context bytes configured there's nothing to collect, and never would be */
+                    newState = j->contextBytes ? TRACE_GET_CONTEXTID : TRACE_IDLE;
                     cpu->contextID = 0;
                     j->byteCount = 0;
                     break;
@@ -830,6 +842,127 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
     return ( ( retVal != TRACE_EV_NONE ) && ( j->rxedISYNC ) );
 }
 
+// ====================================================================================================
+static int _fastBranch( struct ETM35DecodeState *j, struct TRACECPUState *cpu, const uint8_t *buf, int len )
+
+/* Collect a Thumb branch address packet in the alternate encoding in one go, so long as it's all in buf and     */
+/* carries no exception information. Returns the packet length, or 0 to leave it to the state machine instead. */
+
+{
+    uint32_t addr = ( j->addrConstruct & ~( 0b01111111 ) ) | ( buf[0] & 0b01111110 );
+    bool C = ( buf[0] & 0x80 ) != 0;
+    uint32_t mask;
+    int n = 1;
+
+    while ( C )
+    {
+        /* Five bytes still continued, or a packet split across buffers, go the long way round */
+        if ( ( n == 5 ) || ( n == len ) )
+        {
+            return 0;
+        }
+
+        C = ( buf[n] & 0x80 ) != 0;
+        mask = C ? 0x7f : 0x3f;
+
+        if ( ( !C ) && ( buf[n] & 0x40 ) )
+        {
+            return 0;
+        }
+
+        addr = ( addr & ~( mask << ( 7 * n ) ) ) | ( ( buf[n] & mask ) << ( 7 * n ) );
+        n++;
+    }
+
+    /* Only the last byte can be zero, and that counts towards an A-Sync just as it would have done */
+    j->asyncCount = buf[n - 1] ? 0 : 1;
+    j->addrConstruct = addr;
+    j->byteCount = n;
+    cpu->addr = addr;
+    _stateChange( cpu, EV_CH_ADDRESS );
+    DEBUG( "Branch to %08x" EOL, cpu->addr );
+    return n;
+}
+// ====================================================================================================
+static int _pumpRun( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, const uint8_t *buf, int len, bool *reported )
+
+/* Pump bytes into the decoder up to and including the first one with something to report. With no cycle */
+/* accuracy the common P-headers and branch addresses are decoded here directly, and only other packets  */
+/* are taken through the state machine a byte at a time. Returns the number of bytes consumed.           */
+
+{
+    struct ETM35DecodeState *j = ( struct ETM35DecodeState * )e;
+    int n = 0;
+    int l;
+
+    *reported = false;
+
+    while ( n < len )
+    {
+        /* Zeros pending could be the start of an A-Sync, so let the state machine see what follows them */
+        if ( ( j->p == TRACE_IDLE ) && ( j->rxedISYNC ) && ( !j->cycleAccurate ) && ( !j->asyncCount ) )
+        {
+            const struct pHeader *h = &_pHeader[buf[n]];
+
+            if ( h->valid )
+            {
+                cpu->eatoms = h->eatoms;
+                cpu->natoms = h->natoms;
+                cpu->disposition = h->disposition;
+                cpu->instCount += h->eatoms + h->natoms;
+                _stateChange( cpu, EV_CH_ENATOMS );
+                DEBUG( "PHdr (%02x E=%d, N=%d)" EOL, buf[n], cpu->eatoms, cpu->natoms );
+                *reported = true;
+                return n + 1;
+            }
+
+            if ( ( buf[n] & 0b1 ) && ( j->usingAltAddrEncode ) && ( cpu->addrMode == TRACE_ADDRMODE_THUMB ) )
+            {
+                if ( ( l = _fastBranch( j, cpu, &buf[n], len - n ) ) )
+                {
+                    *reported = true;
+                    return n + l;
+                }
+            }
+        }
+
+        if ( _pumpAction( e, cpu, buf[n++] ) )
+        {
+            *reported = true;
+            break;
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _buildPHeaders( void )
+
+/* Fill in the P-header table, with the same decode as the state machine uses */
+
+{
+    for ( int c = 0; c < 256; c++ )
+    {
+        struct pHeader *h = &_pHeader[c];
+
+        if ( ( c & 0b10000011 ) == 0b10000000 )
+        {
+            /* Format-1 P-header */
+            h->eatoms = ( c & 0x3C ) >> 2;
+            h->natoms = ( c & ( 1 << 6 ) ) ? 1 : 0;
+            h->disposition = ( 1 << h->eatoms ) - 1;
+            h->valid = true;
+        }
+        else if ( ( c & 0b11110011 ) == 0b10000010 )
+        {
+            /* Format-2 P-header */
+            h->eatoms = ( ( c & ( 1 << 2 ) ) == 0 ) + ( ( c & ( 1 << 3 ) ) == 0 );
+            h->natoms = 2 - h->eatoms;
+            h->disposition = ( ( c & ( 1 << 3 ) ) == 0 ) | ( ( ( c & ( 1 << 2 ) ) == 0 ) << 1 );
+            h->valid = true;
+        }
+    }
+}
 // ====================================================================================================
 
 static void _pumpDestroy( struct TRACEDecoderEngine *e )
@@ -850,6 +983,27 @@ static bool _synced( struct TRACEDecoderEngine *e )
 
 // ====================================================================================================
 
+static int _findSync( struct TRACEDecoderEngine *e, const uint8_t *buf, int len, int from )
+
+/* Find the start of the next A-Sync (at least five 0x00 then 0x80), which is where a fresh decoder can pick up */
+
+{
+    int zeros = 0;
+
+    for ( int n = from; n < len; n++ )
+    {
+        if ( ( buf[n] == 0x80 ) && ( zeros >= 5 ) )
+        {
+            return n - 5;
+        }
+
+        zeros = buf[n] ? 0 : zeros + 1;
+    }
+
+    return -1;
+}
+// ====================================================================================================
+
 static void _usingAltAddrEncode( struct TRACEDecoderEngine *e, bool using )
 
 {
@@ -858,6 +1012,48 @@ static void _usingAltAddrEncode( struct TRACEDecoderEngine *e, bool using )
 
 // ====================================================================================================
 
+static void _snapshot( struct TRACEDecoderEngine *e, struct TRACECkpt *k )
+
+{
+    struct ETM35DecodeState *j = ( struct ETM35DecodeState * )e;
+
+    TRACECkptPut( k, j->p, 1 );
+    TRACECkptPut( k, j->usingAltAddrEncode, 1 );
+    TRACECkptPut( k, j->dataOnlyMode, 1 );
+    TRACECkptPut( k, j->contextBytes, 1 );
+    TRACECkptPut( k, j->tsConstruct, 8 );
+    TRACECkptPut( k, j->asyncCount, 4 );
+    TRACECkptPut( k, j->addrConstruct, 4 );
+    TRACECkptPut( k, j->byteCount, 4 );
+    TRACECkptPut( k, j->cycleConstruct, 4 );
+    TRACECkptPut( k, j->contextConstruct, 4 );
+    TRACECkptPut( k, j->rxedISYNC, 1 );
+    TRACECkptPut( k, j->cycleAccurate, 1 );
+}
+
+// ====================================================================================================
+
+static void _restore( struct TRACEDecoderEngine *e, struct TRACECkpt *k )
+
+{
+    struct ETM35DecodeState *j = ( struct ETM35DecodeState * )e;
+
+    j->p                  = TRACECkptGet( k, 1 );
+    j->usingAltAddrEncode = TRACECkptGet( k, 1 );
+    j->dataOnlyMode       = TRACECkptGet( k, 1 );
+    j->contextBytes       = TRACECkptGet( k, 1 );
+    j->tsConstruct        = TRACECkptGet( k, 8 );
+    j->asyncCount         = TRACECkptGet( k, 4 );
+    j->addrConstruct      = TRACECkptGet( k, 4 );
+    j->byteCount          = TRACECkptGet( k, 4 );
+    j->cycleConstruct     = TRACECkptGet( k, 4 );
+    j->contextConstruct   = TRACECkptGet( k, 4 );
+    j->rxedISYNC          = TRACECkptGet( k, 1 );
+    j->cycleAccurate      = TRACECkptGet( k, 1 );
+}
+
+// ====================================================================================================
+
 static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
 
 {
@@ -881,12 +1077,20 @@ static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
 struct TRACEDecoderEngine *ETM35DecoderPumpCreate( void )
 
 {
+    if ( !_pHeader[0x80].valid )
+    {
+        _buildPHeaders();
+    }
 
     struct TRACEDecoderEngine *e = ( struct TRACEDecoderEngine * )calloc( 1, sizeof( struct ETM35DecodeState ) );
     e->action        = _pumpAction;
+    e->actionRun     = _pumpRun;
     e->destroy       = _pumpDestroy;
     e->synced        = _synced;
     e->forceSync     = _forceSync;
+    e->findSync      = _findSync;
+    e->snapshot      = _snapshot;
+    e->restore       = _restore;
     e->altAddrEncode = _usingAltAddrEncode;
     return e;
 }
@@ -112,6 +112,18 @@ struct ETM4DecodeState
     } q[3];                      /* Address queue for pushed addresses */
 };
 
+/* Precomputed decode of an atom packet header, indexed by the header byte */
+struct atomDecode
+{
+    uint8_t fmt;                 /* Atom format 1..6, or 0 if this header isn't an atom */
+    uint8_t count;               /* Number of atoms (and hence instructions) it carries */
+    uint8_t eatoms;              /* ...how many of them were executed */
+    uint8_t natoms;              /* ...and how many weren't */
+    uint32_t disposition;        /* A 1 in each element of disposition if was executed */
+};
+
+static struct atomDecode _atom[256];
+
 #define DEBUG(...) { if ( cpu->report ) cpu->report( V_DEBUG, __VA_ARGS__); }
 
 // ====================================================================================================
@@ -162,6 +174,118 @@ static void _stackQ( struct ETM4DecodeState *j )
 
 // ====================================================================================================
 
+static void _buildAtomTable( void )
+
+/* Build the atom decode for every possible header byte. Section 6.4.14 onwards */
+
+{
+    static const uint32_t fmt4Disposition[] = { 0b1110, 0b0000, 0b1010, 0b0101 };
+
+    for ( uint32_t c = 0; c < 256; c++ )
+    {
+        struct atomDecode *a = &_atom[c];
+
+        switch ( c )
+        {
+            case 0b11110110 ... 0b11110111: /* Atom Format 1, Figure 6-39, Pg 6-304 */
+                a->fmt = 1;
+                a->count = 1;
+                a->disposition = c & 1;
+                break;
+
+            case 0b11011000 ... 0b11011011: /* Atom Format 2, Figure 6-40, Pg 6-304 */
+                a->fmt = 2;
+                a->count = 2;
+                a->disposition = c & 3;
+                break;
+
+            case 0b11111000 ... 0b11111111: /* Atom Format 3, Figure 6-41, Pg 6-305 */
+                a->fmt = 3;
+                a->count = 3;
+                a->disposition = c & 7;
+                break;
+
+            case 0b11011100 ... 0b11011111: /* Atom Format 4, Figure 6-42, Pg 6-305 */
+                a->fmt = 4;
+                a->count = 4;
+                a->disposition = fmt4Disposition[c & 3];
+                break;
+
+            case 0b11010101: /* Atom format 5, Figure 6-43, Pg 6-306 ... use bits 5, 1 and 0 */
+                a->fmt = 5;
+                a->count = 5;
+                a->disposition = 0b00000;
+                break;
+
+            case 0b11010110:
+                a->fmt = 5;
+                a->count = 5;
+                a->disposition = 0b01010;
+                break;
+
+            case 0b11010111:
+                a->fmt = 5;
+                a->count = 5;
+                a->disposition = 0b10101;
+                break;
+
+            case 0b11110101:
+                a->fmt = 5;
+                a->count = 5;
+                a->disposition = 0b11110;
+                break;
+
+            case 0b11000000 ... 0b11010100:
+            case 0b11100000 ... 0b11110100: /* Atom format 6, Figure 6-44, Pg 6.307 */
+                a->fmt = 6;
+                a->count = ( c & 0x1f ) + 3;
+                a->disposition = ( 1 << a->count ) - 1;
+
+                /* Deal with last instruction to be executed */
+                if ( c & ( 1 << 5 ) )
+                {
+                    a->disposition &= ~( 1 << ( a->count - 1 ) );
+                }
+
+                break;
+
+            default:
+                break;
+        }
+
+        for ( uint32_t b = 0; b < a->count; b++ )
+        {
+            a->eatoms += ( 0 != ( a->disposition & ( 1 << b ) ) );
+        }
+
+        a->natoms = a->count - a->eatoms;
+    }
+}
+
+// ====================================================================================================
+
+static bool _atomAction( struct ETM4DecodeState *j, struct TRACECPUState *cpu, const struct atomDecode *a )
+
+/* Deliver an atom packet, which is the common case in any busy trace stream */
+
+{
+    cpu->eatoms = a->eatoms;
+    cpu->natoms = a->natoms;
+    cpu->instCount += a->count;
+    cpu->disposition = a->disposition;
+    DEBUG( "Atom Format %d [%d/%d %x]" EOL, a->fmt, a->eatoms, a->natoms, a->disposition );
+
+    if ( cpu->addr != ADDRESS_UNKNOWN )
+    {
+        _stateChange( cpu, EV_CH_ENATOMS );
+        return j->rxedISYNC;
+    }
+
+    return false;
+}
+
+// ====================================================================================================
+
 static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint8_t c )
 
 /* Pump next byte into the protocol decoder */
@@ -176,6 +300,14 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
     assert( j );
 
+    /* Atoms dominate the stream, so they are dispatched with a single table lookup. No atom header */
+    /* is zero or an A-Sync terminator, so the A-Sync accumulation just restarts.                   */
+    if ( ( j->p == TRACE_IDLE ) && ( _atom[c].fmt ) )
+    {
+        j->asyncCount = 0;
+        return _atomAction( j, cpu, &_atom[c] );
+    }
+
     /* Perform A-Sync accumulation check ( Section 6.4.2 ) */
     if ( ( j->asyncCount == 11 ) && ( c == 0x80 ) )
     {
@@ -204,168 +336,6 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                     case 0b01110000: /* Ignore packet, Figure 6-30, Pg 6-289 */
                         break;
 
-                    case 0b11110110 ... 0b11110111: /* Atom Format 1, Figure 6-39, Pg 6-304 */
-                        cpu->eatoms = ( 0 != ( c & 1 ) );
-                        cpu->natoms = !cpu->eatoms;
-                        cpu->instCount += 1;
-                        cpu->disposition = c & 1;
-                        DEBUG( "Atom Format 1 [%b]", cpu->disposition );
-
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11011000 ... 0b11011011: /* Atom Format 2, Figure 6-40, Pg 6-304 */
-                        cpu->eatoms = ( 0 != ( c & 2 ) ) + ( 0 != ( c & 1 ) );
-                        cpu->natoms = 2 - cpu->eatoms;
-                        cpu->instCount += 2;
-
-                        /* Put a 1 in each element of disposition if was executed */
-                        cpu->disposition = c & 3;
-                        DEBUG( "Atom Format 2 [%02b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11111000 ... 0b11111111: /* Atom Format 3, Figure 6-41, Pg 6-305 */
-                        cpu->eatoms = ( 0 != ( c & 1 ) ) + ( 0 != ( c & 2 ) ) + ( 0 != ( c & 4 ) );
-                        cpu->natoms = 3 - cpu->eatoms;
-                        cpu->instCount += 3;
-
-                        /* Put a 1 in each element of disposition if was executed */
-                        cpu->disposition = c & 7;
-                        DEBUG( "Atom Format 3 [%03b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11011100 ... 0b11011111: /* Atom Format 4, Figure 6-42, Pg 6-305 */
-                        switch ( c & 3 )
-                        {
-                            case 0b00:
-                                cpu->natoms = 1;
-                                cpu->disposition = 0b1110;
-                                break;
-
-                            case 0b01:
-                                cpu->natoms = 4;
-                                cpu->disposition = 0b0000;
-                                break;
-
-                            case 0b10:
-                                cpu->natoms = 2;
-                                cpu->disposition = 0b1010;
-                                break;
-
-                            case 0b11:
-                                cpu->natoms = 2;
-                                cpu->disposition = 0b0101;
-                                break;
-                        }
-
-                        cpu->eatoms = 4 - cpu->natoms;
-                        cpu->instCount += 4;
-                        DEBUG( "Atom Format 4 [%04b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-
-                    case 0b11010101:
-                    case 0b11010110:
-                    case 0b11010111:
-                    case 0b11110101: /* Atom format 5, Figure 6-43, Pg 6-306 ... use bits 5, 1 and 0 */
-                        switch ( ( ( 0 != ( c & ( 1 << 5 ) ) ) << 2 ) | ( ( 0 != ( c & ( 1 << 1 ) ) ) << 1 ) | ( ( 0 != ( c & ( 1 << 0 ) ) ) << 0 ) )
-                        {
-                            case 0b101:
-                                cpu->natoms = 1;
-                                cpu->disposition = 0b11110;
-                                break;
-
-                            case 0b001:
-                                cpu->natoms = 5;
-                                cpu->disposition = 0b00000;
-                                break;
-
-                            case 0b010:
-                                cpu->natoms = 3;
-                                cpu->disposition = 0b01010;
-                                break;
-
-                            case 0b011:
-                                cpu->natoms = 2;
-                                cpu->disposition = 0b10101;
-                                break;
-
-                            default:
-                                DEBUG( "Illegal value for Atom type 5 (0x%02x)" EOL, c );
-                                break;
-                        }
-
-                        cpu->eatoms = 5 - cpu->natoms;
-                        cpu->instCount += 5;
-                        DEBUG( "Atom Format 5 [%05b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11000000 ... 0b11010100:
-                    case 0b11100000 ... 0b11110100: /* Atom format 6, Figure 6-44, Pg 6.307 */
-                        cpu->eatoms = ( c & 0x1f ) + 3;
-                        cpu->instCount = cpu->eatoms;
-                        cpu->disposition = ( 1 << ( cpu->eatoms ) ) - 1;
-
-                        /* Deal with last instruction to be executed */
-                        if ( c & ( 1 << 5 ) )
-                        {
-                            DEBUG( "Got a non-execute" );
-                            cpu->disposition &= ~( 1 << ( cpu->eatoms - 1 ) );
-                            cpu->eatoms--;
-                            cpu->natoms = 1;
-                        }
-                        else
-                        {
-                            cpu->natoms = 0;
-                        }
-
-                        char construct[30];
-                        sprintf( construct, "Atom Format 6 [%%ld %%%" PRId64 "b]", cpu->instCount );
-                        DEBUG( construct, cpu->instCount, cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-
                     case 0b10100000 ... 0b10101111: /* Q instruction trace packet, Figure 6-45, Pg 6-308 */
 
                         break;
@@ -400,7 +370,12 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
                     case 0b10010000 ... 0b10010011: /* Exact Match Address */
                         match = c & 0x03;
-                        assert( c != 3 ); /* This value is reserved */
+
+                        if ( match == 3 ) /* This value is reserved, and there's no fourth entry to match */
+                        {
+                            break;
+                        }
+
                         cpu->addr = j->q[match].addr;
                         retVal = TRACE_EV_MSG_RXED;
                         _stateChange( cpu, EV_CH_ADDRESS );
@@ -685,9 +660,9 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                 }
                 else
                 {
-                    if ( j->idx == 8 )
+                    if ( j->idx == 9 )
                     {
-                        /* Second byte of IS1 case - mask MSB */
+                        /* Second byte of IS0 case - mask MSB, it's only A[15:9] */
                         j->q[0].addr = ( j->q[0].addr & ( ~( 0x7F << j->idx ) ) ) | ( ( c & 0x7f ) << ( j->idx ) );
                         j->idx = 16;
                     }
@@ -727,9 +702,9 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                 }
                 else
                 {
-                    if ( ( j->q[0].inst == IS1 ) && ( j->idx == 8 ) )
+                    if ( j->idx == 9 )
                     {
-                        /* Second byte of IS1 case - mask MSB */
+                        /* Second byte of IS0 case - mask MSB, it's only A[15:9] */
                         j->q[0].addr = ( j->q[0].addr & ( 0x7F << j->idx ) ) | ( ( c & 0x7f ) << ( j->idx ) );
                         j->idx = 16;
                     }
@@ -995,6 +970,88 @@ static bool _synced( struct TRACEDecoderEngine *e )
     return ( ( struct ETM4DecodeState * )e )->p != TRACE_UNSYNCED;
 }
 
+// ====================================================================================================
+static int _findSync( struct TRACEDecoderEngine *e, const uint8_t *buf, int len, int from )
+
+/* Find the start of the next A-Sync (eleven 0x00 then 0x80, Section 6.4.2), which is where a fresh decoder can pick up */
+
+{
+    int zeros = 0;
+
+    for ( int n = from; n < len; n++ )
+    {
+        if ( ( buf[n] == 0x80 ) && ( zeros >= 11 ) )
+        {
+            return n - 11;
+        }
+
+        zeros = buf[n] ? 0 : zeros + 1;
+    }
+
+    return -1;
+}
+// ====================================================================================================
+static void _snapshot( struct TRACEDecoderEngine *e, struct TRACECkpt *k )
+
+{
+    struct ETM4DecodeState *j = ( struct ETM4DecodeState * )e;
+
+    TRACECkptPut( k, j->p, 1 );
+    TRACECkptPut( k, j->asyncCount, 4 );
+    TRACECkptPut( k, j->rxedISYNC, 1 );
+    TRACECkptPut( k, j->plctl, 1 );
+    TRACECkptPut( k, j->cc_enabled, 1 );
+    TRACECkptPut( k, j->cond_enabled, 1 );
+    TRACECkptPut( k, j->load_traced, 1 );
+    TRACECkptPut( k, j->store_traced, 1 );
+    TRACECkptPut( k, j->haveContext, 1 );
+    TRACECkptPut( k, j->context, 4 );
+    TRACECkptPut( k, j->vcontext, 4 );
+    TRACECkptPut( k, j->nextrhkey, 4 );
+    TRACECkptPut( k, j->spec, 4 );
+    TRACECkptPut( k, j->cyct, 4 );
+    TRACECkptPut( k, j->ex0, 1 );
+    TRACECkptPut( k, j->cc_follows, 1 );
+    TRACECkptPut( k, j->idx, 1 );
+    TRACECkptPut( k, j->cntUpdate, 4 );
+
+    for ( int i = 0; i < sizeof( j->q ) / sizeof( j->q[0] ); i++ )
+    {
+        TRACECkptPut( k, j->q[i].addr, 8 );
+        TRACECkptPut( k, j->q[i].inst, 1 );
+    }
+}
+// ====================================================================================================
+static void _restore( struct TRACEDecoderEngine *e, struct TRACECkpt *k )
+
+{
+    struct ETM4DecodeState *j = ( struct ETM4DecodeState * )e;
+
+    j->p            = TRACECkptGet( k, 1 );
+    j->asyncCount   = TRACECkptGet( k, 4 );
+    j->rxedISYNC    = TRACECkptGet( k, 1 );
+    j->plctl        = TRACECkptGet( k, 1 );
+    j->cc_enabled   = TRACECkptGet( k, 1 );
+    j->cond_enabled = TRACECkptGet( k, 1 );
+    j->load_traced  = TRACECkptGet( k, 1 );
+    j->store_traced = TRACECkptGet( k, 1 );
+    j->haveContext  = TRACECkptGet( k, 1 );
+    j->context      = TRACECkptGet( k, 4 );
+    j->vcontext     = TRACECkptGet( k, 4 );
+    j->nextrhkey    = TRACECkptGet( k, 4 );
+    j->spec         = TRACECkptGet( k, 4 );
+    j->cyct         = TRACECkptGet( k, 4 );
+    j->ex0          = TRACECkptGet( k, 1 );
+    j->cc_follows   = TRACECkptGet( k, 1 );
+    j->idx          = TRACECkptGet( k, 1 );
+    j->cntUpdate    = TRACECkptGet( k, 4 );
+
+    for ( int i = 0; i < sizeof( j->q ) / sizeof( j->q[0] ); i++ )
+    {
+        j->q[i].addr = TRACECkptGet( k, 8 );
+        j->q[i].inst = TRACECkptGet( k, 1 );
+    }
+}
 // ====================================================================================================
 static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
 
@@ -1015,10 +1072,19 @@ struct TRACEDecoderEngine *ETM4DecoderPumpCreate( void )
 {
 
     struct TRACEDecoderEngine *e = ( struct TRACEDecoderEngine * )calloc( 1, sizeof( struct ETM4DecodeState ) );
+
+    if ( !_atom[0b11111111].fmt )
+    {
+        _buildAtomTable();
+    }
+
     e->action    = _pumpAction;
     e->destroy   = _pumpDestroy;
     e->synced    = _synced;
     e->forceSync = _forceSync;
+    e->findSync  = _findSync;
+    e->snapshot  = _snapshot;
+    e->restore   = _restore;
     return e;
 }
 
@@ -129,6 +129,20 @@ static bool _synced( struct TRACEDecoderEngine *e )
     return ( ( struct MTBDecodeState * )e )->p != TRACE_UNSYNCED;
 }
 
+// ====================================================================================================
+static void _snapshot( struct TRACEDecoderEngine *e, struct TRACECkpt *k )
+
+{
+    TRACECkptPut( k, ( ( struct MTBDecodeState * )e )->p, 1 );
+}
+
+// ====================================================================================================
+static void _restore( struct TRACEDecoderEngine *e, struct TRACECkpt *k )
+
+{
+    ( ( struct MTBDecodeState * )e )->p = TRACECkptGet( k, 1 );
+}
+
 // ====================================================================================================
 static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
 
@@ -136,6 +150,16 @@ static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
     ( ( struct MTBDecodeState * )e )->p = ( isSynced ) ? TRACE_IDLE : TRACE_UNSYNCED;
 }
 
+// ====================================================================================================
+static int _findSync( struct TRACEDecoderEngine *e, const uint8_t *buf, int len, int from )
+
+/* Every source/dest pair stands alone, so any pair boundary will do */
+
+{
+    from = ( from + 7 ) & ~7;
+    return ( from < len ) ? from : -1;
+}
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -153,6 +177,9 @@ struct TRACEDecoderEngine *MTBDecoderPumpCreate( void )
     e->destroy       = _pumpDestroy;
     e->synced        = _synced;
     e->forceSync     = _forceSync;
+    e->findSync      = _findSync;
+    e->snapshot      = _snapshot;
+    e->restore       = _restore;
     return e;
 }
 
@@ -0,0 +1,618 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Time Series Store
+ * =================
+ *
+ * Each ring file is a header followed by its slots, with the slot for a time at ( time / resolution )
+ * modulo the number of slots. A slot says what time it's for, so one that's been left behind from an
+ * earlier pass around the ring is seen to be stale and ignored. The names file has one name per line,
+ * and a name's number is the line it's on.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "generics.h"
+#include "uthash.h"
+#include "tsStore.h"
+
+#define TSSTORE_MAGIC   (0x31535354)                /* 'TSS1' */
+#define TSSTORE_VERSION (1)
+#define NAMES_FILE      "names"
+
+struct fileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t resolution;                            /* Seconds in each slot */
+    uint32_t slots;
+    uint32_t entries;                               /* Names kept in each slot */
+    uint32_t spare;
+};
+
+struct slotEntry
+{
+    uint32_t name;
+    uint32_t spare;
+    uint64_t count;
+};
+
+struct slot
+{
+    int64_t start;                                  /* Time this slot is for */
+    uint64_t other;                                 /* Counts for names that didn't make it into e */
+    uint32_t entries;
+    uint32_t spare;
+    struct slotEntry e[TSSTORE_SLOT_ENTRIES];
+};
+
+static const struct
+{
+    const char *file;
+    uint32_t resolution;
+    uint32_t slots;
+} _levels[TS_NUM_LEVELS] =
+{
+    { "seconds", 1,    3600    },                   /* An hour */
+    { "minutes", 60,   1440    },                   /* A day */
+    { "hours",   3600, 24 * 31 },                   /* A month */
+};
+
+struct tsName
+{
+    uint32_t id;
+    uint64_t fresh;                                 /* Added since the last commit */
+    uint64_t held[TS_NUM_LEVELS];                   /* ...and in the slot being filled at each level */
+    char *name;
+    UT_hash_handle hh;
+};
+
+struct tsRing
+{
+    FILE *f;
+    int64_t start;                                  /* Time of the slot being filled */
+    bool filling;                                   /* ...if there is one */
+    uint64_t other;                                 /* Other in it from before this writer, that can't be given out again */
+};
+
+struct tsStore
+{
+    bool writing;
+    struct tsRing r[TS_NUM_LEVELS];
+    FILE *names;
+
+    struct tsName *byName;                          /* Names, hashed */
+    struct tsName **byId;                           /* ...and by number */
+    uint32_t nameCount;
+    uint32_t nameAlloc;
+
+    struct slotEntry *sort;                         /* For picking the busiest names in a slot */
+    uint32_t sortAlloc;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static char *_path( const char *dir, const char *file )
+
+{
+    char *p = ( char * )malloc( strlen( dir ) + strlen( file ) + 2 );
+
+    if ( p )
+    {
+        sprintf( p, "%s/%s", dir, file );
+    }
+
+    return p;
+}
+// ====================================================================================================
+static struct tsName *_nameNew( struct tsStore *t, const char *name )
+
+{
+    struct tsName *n;
+
+    if ( t->nameCount == t->nameAlloc )
+    {
+        struct tsName **b = ( struct tsName ** )realloc( t->byId, sizeof( struct tsName * ) * ( t->nameAlloc ? t->nameAlloc * 2 : 256 ) );
+
+        if ( !b )
+        {
+            return NULL;
+        }
+
+        t->byId = b;
+        t->nameAlloc = t->nameAlloc ? t->nameAlloc * 2 : 256;
+    }
+
+    n = ( struct tsName * )calloc( 1, sizeof( struct tsName ) );
+
+    if ( ( !n ) || ( !( n->name = strdup( name ) ) ) )
+    {
+        free( n );
+        return NULL;
+    }
+
+    n->id = t->nameCount;
+    t->byId[t->nameCount++] = n;
+    HASH_ADD_KEYPTR( hh, t->byName, n->name, strlen( n->name ), n );
+    return n;
+}
+// ====================================================================================================
+static bool _namesLoad( struct tsStore *t )
+
+/* Read any names that have been put in the names file since it was last read */
+
+{
+    char *l = NULL;
+    size_t len = 0, alloc = 0;
+    int c;
+
+    while ( ( c = getc( t->names ) ) != EOF )
+    {
+        if ( len + 1 >= alloc )
+        {
+            char *b = ( char * )realloc( l, alloc = ( alloc ) ? alloc * 2 : 256 );
+
+            if ( !b )
+            {
+                free( l );
+                return false;
+            }
+
+            l = b;
+        }
+
+        if ( c != '\n' )
+        {
+            l[len++] = c;
+            continue;
+        }
+
+        l[len] = 0;
+        len = 0;
+
+        if ( !_nameNew( t, l ) )
+        {
+            free( l );
+            return false;
+        }
+    }
+
+    /* Anything after the last newline is a name still being written, so it's for next time */
+    if ( len )
+    {
+        fseek( t->names, -( long )len, SEEK_CUR );
+    }
+
+    clearerr( t->names );
+    free( l );
+    return true;
+}
+// ====================================================================================================
+static long _slotOffset( enum tsLevel l, int64_t start )
+
+{
+    return sizeof( struct fileHeader ) + ( long )( ( start / _levels[l].resolution ) % _levels[l].slots ) * sizeof( struct slot );
+}
+// ====================================================================================================
+static bool _slotRead( struct tsStore *t, enum tsLevel l, int64_t start, struct slot *s )
+
+/* Get the slot for start, returning true only if what's there is really for that time */
+
+{
+    if ( ( fseek( t->r[l].f, _slotOffset( l, start ), SEEK_SET ) ) || ( fread( s, sizeof( struct slot ), 1, t->r[l].f ) != 1 ) )
+    {
+        return false;
+    }
+
+    return ( s->start == start ) && ( s->entries <= TSSTORE_SLOT_ENTRIES );
+}
+// ====================================================================================================
+static int _entry_sort_fn( const void *a, const void *b )
+
+{
+    const struct slotEntry *x = ( const struct slotEntry * )a;
+    const struct slotEntry *y = ( const struct slotEntry * )b;
+
+    return ( x->count < y->count ) ? 1 : ( x->count > y->count ) ? -1 : 0;
+}
+// ====================================================================================================
+static bool _slotWrite( struct tsStore *t, enum tsLevel l )
+
+/* Write out the slot being filled, with the busiest names in it and everything else as other */
+
+{
+    struct slot s = { .start = t->r[l].start, .other = t->r[l].other };
+    uint32_t n = 0;
+
+    if ( t->sortAlloc < t->nameCount )
+    {
+        struct slotEntry *b = ( struct slotEntry * )realloc( t->sort, sizeof( struct slotEntry ) * t->nameCount );
+
+        if ( !b )
+        {
+            return false;
+        }
+
+        t->sort = b;
+        t->sortAlloc = t->nameCount;
+    }
+
+    for ( uint32_t i = 0; i < t->nameCount; i++ )
+    {
+        if ( t->byId[i]->held[l] )
+        {
+            t->sort[n].name = i;
+            t->sort[n].spare = 0;
+            t->sort[n++].count = t->byId[i]->held[l];
+        }
+    }
+
+    qsort( t->sort, n, sizeof( struct slotEntry ), _entry_sort_fn );
+    s.entries = ( n < TSSTORE_SLOT_ENTRIES ) ? n : TSSTORE_SLOT_ENTRIES;
+    memcpy( s.e, t->sort, s.entries * sizeof( struct slotEntry ) );
+
+    for ( uint32_t i = s.entries; i < n; i++ )
+    {
+        s.other += t->sort[i].count;
+    }
+
+    return ( !fseek( t->r[l].f, _slotOffset( l, s.start ), SEEK_SET ) ) && ( fwrite( &s, sizeof( struct slot ), 1, t->r[l].f ) == 1 );
+}
+// ====================================================================================================
+static void _slotStart( struct tsStore *t, enum tsLevel l, int64_t start )
+
+/* Move on to filling the slot for start, carrying on from whatever's already in it */
+
+{
+    struct slot s;
+
+    for ( uint32_t i = 0; i < t->nameCount; i++ )
+    {
+        t->byId[i]->held[l] = 0;
+    }
+
+    t->r[l].start = start;
+    t->r[l].filling = true;
+    t->r[l].other = 0;
+
+    if ( _slotRead( t, l, start, &s ) )
+    {
+        t->r[l].other = s.other;
+
+        for ( uint32_t i = 0; i < s.entries; i++ )
+        {
+            if ( s.e[i].name < t->nameCount )
+            {
+                t->byId[s.e[i].name]->held[l] += s.e[i].count;
+            }
+            else
+            {
+                t->r[l].other += s.e[i].count;
+            }
+        }
+    }
+}
+// ====================================================================================================
+static FILE *_ringOpen( const char *dir, enum tsLevel l, bool writing )
+
+/* Open a ring file, making it in full if it's to be written and isn't there yet */
+
+{
+    struct fileHeader h;
+    struct slot s = { 0 };
+    char *n = _path( dir, _levels[l].file );
+    FILE *f;
+
+    if ( !n )
+    {
+        return NULL;
+    }
+
+    if ( ( !( f = fopen( n, ( writing ) ? "r+b" : "rb" ) ) ) && ( writing ) && ( errno == ENOENT ) )
+    {
+        h = ( struct fileHeader )
+        {
+            .magic = TSSTORE_MAGIC, .version = TSSTORE_VERSION, .resolution = _levels[l].resolution,
+             .slots = _levels[l].slots, .entries = TSSTORE_SLOT_ENTRIES
+        };
+
+        if ( ( f = fopen( n, "w+b" ) ) )
+        {
+            bool ok = ( fwrite( &h, sizeof( h ), 1, f ) == 1 );
+
+            for ( uint32_t i = 0; ( ok ) && ( i < _levels[l].slots ); i++ )
+            {
+                ok = ( fwrite( &s, sizeof( s ), 1, f ) == 1 );
+            }
+
+            if ( ( !ok ) || ( fflush( f ) ) )
+            {
+                genericsReport( V_ERROR, "Could not make %s (%s)" EOL, n, strerror( errno ) );
+                fclose( f );
+                free( n );
+                return NULL;
+            }
+        }
+    }
+
+    if ( !f )
+    {
+        genericsReport( V_ERROR, "Could not open %s (%s)" EOL, n, strerror( errno ) );
+        free( n );
+        return NULL;
+    }
+
+    if ( ( fseek( f, 0, SEEK_SET ) ) || ( fread( &h, sizeof( h ), 1, f ) != 1 ) || ( h.magic != TSSTORE_MAGIC ) || ( h.version != TSSTORE_VERSION ) ||
+            ( h.resolution != _levels[l].resolution ) || ( h.slots != _levels[l].slots ) || ( h.entries != TSSTORE_SLOT_ENTRIES ) )
+    {
+        genericsReport( V_ERROR, "%s isn't a history file this version can use" EOL, n );
+        fclose( f );
+        free( n );
+        return NULL;
+    }
+
+    free( n );
+    return f;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+uint32_t tsStoreResolution( enum tsLevel level )
+
+{
+    return _levels[level].resolution;
+}
+// ====================================================================================================
+uint32_t tsStoreRetention( enum tsLevel level )
+
+{
+    return _levels[level].resolution * _levels[level].slots;
+}
+// ====================================================================================================
+struct tsStore *tsStoreOpen( const char *dir, bool writing )
+
+{
+    struct tsStore *t = ( struct tsStore * )calloc( 1, sizeof( struct tsStore ) );
+    char *n;
+
+    if ( !t )
+    {
+        return NULL;
+    }
+
+    t->writing = writing;
+
+    if ( writing )
+    {
+        /* We don't care if it's already there */
+#if defined(WIN32)
+        mkdir( dir );
+#else
+        mkdir( dir, 0755 );
+#endif
+    }
+
+    /* Names are only ever added to the end, so one being written can be read at the same time */
+    if ( ( !( n = _path( dir, NAMES_FILE ) ) ) || ( !( t->names = fopen( n, ( writing ) ? "a+b" : "rb" ) ) ) )
+    {
+        genericsReport( V_ERROR, "Could not open %s (%s)" EOL, n ? n : dir, strerror( errno ) );
+        free( n );
+        tsStoreClose( t );
+        return NULL;
+    }
+
+    free( n );
+    fseek( t->names, 0, SEEK_SET );
+
+    if ( !_namesLoad( t ) )
+    {
+        tsStoreClose( t );
+        return NULL;
+    }
+
+    for ( enum tsLevel l = 0; l < TS_NUM_LEVELS; l++ )
+    {
+        if ( !( t->r[l].f = _ringOpen( dir, l, writing ) ) )
+        {
+            tsStoreClose( t );
+            return NULL;
+        }
+    }
+
+    return t;
+}
+// ====================================================================================================
+void tsStoreClose( struct tsStore *t )
+
+{
+    struct tsName *n, *nt;
+
+    if ( !t )
+    {
+        return;
+    }
+
+    for ( enum tsLevel l = 0; l < TS_NUM_LEVELS; l++ )
+    {
+        if ( t->r[l].f )
+        {
+            fclose( t->r[l].f );
+        }
+    }
+
+    if ( t->names )
+    {
+        fclose( t->names );
+    }
+
+    HASH_ITER( hh, t->byName, n, nt )
+    {
+        HASH_DEL( t->byName, n );
+        free( n->name );
+        free( n );
+    }
+
+    free( t->byId );
+    free( t->sort );
+    free( t );
+}
+// ====================================================================================================
+void tsStoreAdd( struct tsStore *t, const char *name, uint64_t count )
+
+{
+    struct tsName *n;
+
+    if ( ( !name ) || ( !count ) )
+    {
+        return;
+    }
+
+    HASH_FIND( hh, t->byName, name, strlen( name ), n );
+
+    if ( !n )
+    {
+        /* A name can't have a newline in it, it would make two */
+        if ( ( strchr( name, '\n' ) ) || ( !( n = _nameNew( t, name ) ) ) )
+        {
+            return;
+        }
+
+        fprintf( t->names, "%s\n", name );
+        fflush( t->names );
+    }
+
+    n->fresh += count;
+}
+// ====================================================================================================
+bool tsStoreCommit( struct tsStore *t, int64_t when )
+
+/* Put what's been added since the last commit into the slots for when, and write them out */
+
+{
+    bool ok = true;
+
+    for ( enum tsLevel l = 0; l < TS_NUM_LEVELS; l++ )
+    {
+        int64_t start = when - when % _levels[l].resolution;
+
+        if ( ( !t->r[l].filling ) || ( t->r[l].start != start ) )
+        {
+            _slotStart( t, l, start );
+        }
+
+        for ( uint32_t i = 0; i < t->nameCount; i++ )
+        {
+            t->byId[i]->held[l] += t->byId[i]->fresh;
+        }
+    }
+
+    for ( uint32_t i = 0; i < t->nameCount; i++ )
+    {
+        t->byId[i]->fresh = 0;
+    }
+
+    for ( enum tsLevel l = 0; l < TS_NUM_LEVELS; l++ )
+    {
+        ok &= _slotWrite( t, l );
+        ok &= ( fflush( t->r[l].f ) == 0 );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+int tsStoreQuery( struct tsStore *t, int64_t from, int64_t to, enum tsLevel level, tsStoreCb cb, void *param )
+
+{
+    struct slot s;
+    uint32_t res;
+    int64_t first;
+
+    if ( level == TS_AUTO )
+    {
+        int64_t now = time( NULL );
+
+        for ( level = TS_SECONDS; ( level < TS_HOURS ) && ( from < now - ( int64_t )tsStoreRetention( level ) ); level++ );
+    }
+
+    res = _levels[level].resolution;
+    first = from - from % res;
+
+    /* A ring can only hold so many slots, so a longer window than that is cut to the newest ones in it */
+    if ( ( to - first ) / res > _levels[level].slots )
+    {
+        int64_t last = INT64_MIN;
+
+        fseek( t->r[level].f, sizeof( struct fileHeader ), SEEK_SET );
+
+        for ( uint32_t i = 0; i < _levels[level].slots; i++ )
+        {
+            if ( fread( &s, sizeof( struct slot ), 1, t->r[level].f ) != 1 )
+            {
+                return -1;
+            }
+
+            if ( ( s.start >= first ) && ( s.start < to ) && ( s.start > last ) )
+            {
+                last = s.start;
+            }
+        }
+
+        if ( last == INT64_MIN )
+        {
+            return level;
+        }
+
+        to = last + res;
+        first = ( last - first >= ( int64_t )tsStoreRetention( level ) ) ? last - tsStoreRetention( level ) + res : first;
+    }
+
+    for ( int64_t start = first; start < to; start += res )
+    {
+        if ( !_slotRead( t, level, start, &s ) )
+        {
+            continue;
+        }
+
+        for ( uint32_t i = 0; i < s.entries; i++ )
+        {
+            /* The writer might have named more since they were read */
+            if ( ( s.e[i].name >= t->nameCount ) && ( !t->writing ) )
+            {
+                _namesLoad( t );
+            }
+
+            if ( s.e[i].name < t->nameCount )
+            {
+                cb( start, res, t->byId[s.e[i].name]->name, s.e[i].count, param );
+            }
+            else
+            {
+                s.other += s.e[i].count;
+            }
+        }
+
+        if ( s.other )
+        {
+            cb( start, res, NULL, s.other, param );
+        }
+    }
+
+    return level;
+}
+// ====================================================================================================
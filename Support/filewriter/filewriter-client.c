@@ -74,6 +74,49 @@ void _sendMsg(uint32_t cmd, uint32_t id, uint32_t *len, const uint8_t *d)
     ITM->PORT[FW_CHANNEL].u32 = (c<<8)|cmd; // Write data
 }
 // ============================================================================================
+bool _sendBulk(uint32_t id, const uint8_t *d, uint32_t len)
+
+/* Send a block as a bulk write, four bytes to each ITM write. False if the bulk channel is off */
+
+{
+    if (!((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && /* Trace enabled */
+         (ITM->TCR & ITM_TCR_ITMENA_Msk) && /* ITM enabled */
+         (ITM->TER & (1ul << FW_CHANNEL) ) && /* ITM Port c enabled */
+         (ITM->TER & (1ul << FW_BULK_CHANNEL) ) /* ...and the one for the data */
+        ))
+	return false;
+
+    uint32_t w;
+
+    /* Announce it, with its length in place of data */
+    while (ITM->PORT[FW_CHANNEL].u32 == 0);
+    ITM->PORT[FW_CHANNEL].u32 = (len<<8)|FW_CMD_BULK|FW_BYTES(3)|FW_FILEID(id);
+
+    /* ...then the data itself, which needn't be aligned */
+    for (; len>=4; len-=4, d+=4)
+	{
+	    memcpy(&w, d, 4);
+	    while (ITM->PORT[FW_BULK_CHANNEL].u32 == 0);
+	    ITM->PORT[FW_BULK_CHANNEL].u32 = w;
+	}
+
+    if (len>=2)
+	{
+	    while (ITM->PORT[FW_BULK_CHANNEL].u32 == 0);
+	    ITM->PORT[FW_BULK_CHANNEL].u16 = d[0]|(d[1]<<8);
+	    d+=2;
+	    len-=2;
+	}
+
+    if (len)
+	{
+	    while (ITM->PORT[FW_BULK_CHANNEL].u32 == 0);
+	    ITM->PORT[FW_BULK_CHANNEL].u8 = d[0];
+	}
+
+    return true;
+}
+// ============================================================================================
 // ============================================================================================
 // ============================================================================================
 // Externally Available Routines
@@ -112,10 +155,21 @@ uint32_t fwWrite(const char *ptr, size_t size, uint32_t nmemb, uint32_t h)
 {
   nmemb*=size;
   uint32_t r = nmemb;
-  
+  uint32_t l;
+
+    /* Anything of any size goes in bulk, if it can */
+    while (nmemb>=FW_BULK_MIN)
+	{
+	    l=(nmemb<FW_BULK_MAX)?nmemb:FW_BULK_MAX;
+	    if (!_sendBulk(h, (const uint8_t *)ptr, l))
+		break;
+	    ptr+=l;
+	    nmemb-=l;
+	}
+
     while (nmemb)
 	{
-	    _sendMsg(FW_CMD_WRITE, 0, &nmemb, ptr);
+	    _sendMsg(FW_CMD_WRITE, h, &nmemb, ptr);
 	    ptr+=FW_MAX_SEND;
 	}
     return r;
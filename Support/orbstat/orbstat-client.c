@@ -0,0 +1,149 @@
+/*
+ * Function entry and exit reporting for orbstat, using the compact protocol where it can.
+ *
+ * Build the code to be profiled with -finstrument-functions, and this file without it. Functions
+ * are given ids the first time they're called, so that most events are one 32 bit and one 16 bit
+ * ITM write, rather than the three 32 bit writes of the full form. Timestamps come from the DWT
+ * cycle counter, which needs to be running.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "orbstatProtocol.h"
+
+#ifndef OS_TABLE_BITS
+#define OS_TABLE_BITS (8)                         /* log2 of the number of function ids available */
+#endif
+
+#define OS_TABLE_SIZE (1<<OS_TABLE_BITS)
+
+#if OS_TABLE_SIZE > OS_NOID
+#error "Function id table is too big for the protocol"
+#endif
+
+#define NOINST __attribute__((no_instrument_function))
+
+static uint32_t _fnTable[OS_TABLE_SIZE];          /* Functions that have been given ids, which is their slot */
+static uint32_t _lastSite;                        /* Last call site sent in compact form */
+static uint32_t _lastTime;                        /* ...and the time it was sent */
+
+void __cyg_profile_func_enter( void *this_fn, void *call_site ) NOINST;
+void __cyg_profile_func_exit( void *this_fn, void *call_site ) NOINST;
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+// Internal Routines
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+static NOINST void _send32( uint32_t d )
+
+{
+    while ( ITM->PORT[OS_CHANNEL].u32 == 0 ); // Port available?
+    ITM->PORT[OS_CHANNEL].u32 = d;
+}
+// ============================================================================================
+static NOINST void _send16( uint16_t d )
+
+{
+    while ( ITM->PORT[OS_CHANNEL].u32 == 0 );
+    ITM->PORT[OS_CHANNEL].u16 = d;
+}
+// ============================================================================================
+static NOINST uint32_t _getId( uint32_t fn )
+
+/* Find the id for a function, giving it one if it hasn't got one yet. Returns OS_NOID when out of them */
+
+{
+    uint32_t i = ( ( fn >> 1 ) * 0x9E3779B1 ) >> ( 32 - OS_TABLE_BITS );
+
+    for ( uint32_t probes = 0; probes < OS_TABLE_SIZE; probes++ )
+    {
+        if ( _fnTable[i] == fn )
+        {
+            return i;
+        }
+
+        if ( !_fnTable[i] )
+        {
+            /* New function, tell orbstat about it before it's used */
+            _fnTable[i] = fn;
+            _send32( OS_CDEF | OS_ID( i ) );
+            _send32( fn );
+            return i;
+        }
+
+        i = ( i + 1 ) & ( OS_TABLE_SIZE - 1 );
+    }
+
+    return OS_NOID;
+}
+// ============================================================================================
+static NOINST void _report( bool isIn, uint32_t fn, uint32_t site )
+
+/* Send an event, as compactly as possible */
+
+{
+    if ( !( ( CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk ) && /* Trace enabled */
+            ( ITM->TCR & ITM_TCR_ITMENA_Msk ) && /* ITM enabled */
+            ( ITM->TER & ( 1ul << OS_CHANNEL ) ) /* ITM Port enabled */
+       ) )
+    {
+        return;
+    }
+
+    /* Interrupts are instrumented too, don't let them split an event */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t t = DWT->CYCCNT;
+    uint32_t id = ( ( t - _lastTime ) < 0x10000 ) ? _getId( fn ) : OS_NOID;
+
+    if ( id == OS_NOID )
+    {
+        /* Full form, which also carries enough of the timer for the compact form to follow on from */
+        _send32( ( isIn ? OS_IN : OS_OUT ) | ( t & 0xFFFFFF ) );
+        _send32( site );
+        _send32( fn );
+    }
+    else
+    {
+        int32_t delta = ( int32_t )( site - _lastSite ) / 2;
+
+        _send32( ( isIn ? OS_CIN : OS_COUT ) | OS_ID( id ) | ( t & 0xFFFF ) );
+
+        if ( ( delta >= INT16_MIN ) && ( delta <= INT16_MAX ) && !( ( site - _lastSite ) & 1 ) )
+        {
+            _send16( ( uint16_t )delta );
+        }
+        else
+        {
+            _send32( site );
+        }
+
+        _lastSite = site;
+    }
+
+    _lastTime = t;
+    __set_PRIMASK( primask );
+}
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+// Externally Available Routines
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+void __cyg_profile_func_enter( void *this_fn, void *call_site )
+
+{
+    _report( true, ( uint32_t )this_fn, ( uint32_t )call_site );
+}
+// ============================================================================================
+void __cyg_profile_func_exit( void *this_fn, void *call_site )
+
+{
+    _report( false, ( uint32_t )this_fn, ( uint32_t )call_site );
+}
+// ============================================================================================
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * orbstat Instrumentation Protocol
+ * ================================
+ *
+ */
+
+#ifndef _ORBSTAT_PROT_H_
+#define _ORBSTAT_PROT_H_
+
+// Every function entry and exit is reported on OS_CHANNEL, in one of two forms;
+//
+// Full form, three 32 bit writes;
+//   0100 TTTTTTTTTTTTTTTTTTTTTTTT   Call,   with bottom 24 bits of timer
+//   0101 TTTTTTTTTTTTTTTTTTTTTTTT   Return, with bottom 24 bits of timer
+//   Call site (i.e. the return address)
+//   Address of the function called
+//
+// Compact form, for functions that have been given an id;
+//   0110 IIIIIIIIIIII TTTTTTTTTTTTTTTT   Call to function I,     with bottom 16 bits of timer
+//   0111 IIIIIIIIIIII TTTTTTTTTTTTTTTT   Return from function I, with bottom 16 bits of timer
+//   ...followed by the call site, either as a 16 bit write of the signed number of halfwords
+//   it is from the last call site sent in compact form, or as a 32 bit write of its address.
+//
+// An id is given to a function, before its first use, by;
+//   1000 IIIIIIIIIIII 0000000000000000
+//   Address of the function
+//
+// The target falls back to the full form when it has run out of ids, or when the timer has
+// moved on too far for 16 bits of it to be unambiguous.
+
+#define OS_CHANNEL      (30)         // ITM Channel to be used
+
+#define OS_IN           (0x40000000)
+#define OS_OUT          (0x50000000)
+#define OS_CIN          (0x60000000)
+#define OS_COUT         (0x70000000)
+#define OS_CDEF         (0x80000000)
+
+#define OS_ID(x)        (((x)&0xFFF)<<16)
+#define OS_NOID         (0xFFF)      // Never allocated, the full form is used instead
+#define OS_MAX_IDS      (4096)
+
+#endif
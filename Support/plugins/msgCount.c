@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Example orbuculum plugin
+ * ========================
+ *
+ * Counts the ITM messages of each type, the software messages on each channel and the bytes
+ * on each tag, and publishes them as orbuculum metrics. A channel number given after the
+ * filename has the largest value seen on it tracked too.
+ *
+ * Build with;
+ *  gcc -shared -fPIC -IInc -include uicolours_default.h Support/plugins/msgCount.c -o msgCount.so
+ * Run with;
+ *  orbuculum -L ./msgCount.so,3 -x 9100
+ *  curl -s localhost:9100/metrics | grep plugin
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "orbPlugin.h"
+
+#define NUM_CHANNELS (32)
+#define NUM_TAGS     (256)
+
+struct msgCount
+{
+    struct orbPluginHost *h;
+    int watch;                                     /* Channel whose largest value is tracked, or -1 */
+    uint32_t biggest;                              /* ...and the largest value seen on it */
+    int biggestId;
+
+    uint64_t types[MSG_NUM_MSGS];                  /* Counts, and the metric each is published as */
+    int typeId[MSG_NUM_MSGS];
+    uint64_t chan[NUM_CHANNELS];
+    int chanId[NUM_CHANNELS];
+    uint64_t tag[NUM_TAGS];
+    int tagId[NUM_TAGS];
+};
+
+static const char *_typeName[MSG_NUM_MSGS] =
+{
+    "unknown", "reserved", "error", "none", "software", "nisync", "osw", "data_access_wp",
+    "data_rwwp", "pc_sample", "dwt_event", "exception", "ts"
+};
+
+// ====================================================================================================
+static int _add( struct msgCount *c, const char *fmt, int n )
+
+{
+    char name[64];
+
+    snprintf( name, sizeof( name ), fmt, n );
+    return c->h->addMetric( c->h, name );
+}
+// ====================================================================================================
+static void *_init( struct orbPluginHost *h, const char *args )
+
+{
+    struct msgCount *c = ( struct msgCount * )calloc( 1, sizeof( struct msgCount ) );
+
+    if ( !c )
+    {
+        return NULL;
+    }
+
+    c->h = h;
+    c->watch = ( *args ) ? atoi( args ) : -1;
+
+    for ( int i = 0; i < MSG_NUM_MSGS; i++ )
+    {
+        c->typeId[i] = -2;
+    }
+
+    for ( int i = 0; i < NUM_CHANNELS; i++ )
+    {
+        c->chanId[i] = -2;
+    }
+
+    for ( int i = 0; i < NUM_TAGS; i++ )
+    {
+        c->tagId[i] = -2;
+    }
+
+    c->biggestId = ( c->watch >= 0 ) ? _add( c, "channel_%d_max", c->watch ) : -1;
+    h->report( V_INFO, "msgCount started%s%s" EOL, ( *h->probe ) ? " for " : "", h->probe );
+    return c;
+}
+// ====================================================================================================
+static void _tagData( void *ctx, uint8_t tag, const uint8_t *d, size_t len )
+
+{
+    struct msgCount *c = ( struct msgCount * )ctx;
+
+    /* Metrics are only made for things that turn up, -2 says we've not seen this one yet */
+    if ( c->tagId[tag] == -2 )
+    {
+        c->tagId[tag] = _add( c, "tag_%d_bytes", tag );
+    }
+
+    c->tag[tag] += len;
+    c->h->setMetric( c->h, c->tagId[tag], c->tag[tag] );
+}
+// ====================================================================================================
+static void _msgs( void *ctx, const struct msg *m, size_t n )
+
+{
+    struct msgCount *c = ( struct msgCount * )ctx;
+
+    for ( ; n--; m++ )
+    {
+        enum MSGType t = m->genericMsg.msgtype;
+
+        if ( c->typeId[t] == -2 )
+        {
+            char name[64];
+            snprintf( name, sizeof( name ), "%s_msgs", _typeName[t] );
+            c->typeId[t] = c->h->addMetric( c->h, name );
+        }
+
+        c->h->setMetric( c->h, c->typeId[t], ++c->types[t] );
+
+        if ( ( t == MSG_SOFTWARE ) && ( m->swMsg.srcAddr < NUM_CHANNELS ) )
+        {
+            uint8_t ch = m->swMsg.srcAddr;
+
+            if ( c->chanId[ch] == -2 )
+            {
+                c->chanId[ch] = _add( c, "channel_%d_msgs", ch );
+            }
+
+            c->h->setMetric( c->h, c->chanId[ch], ++c->chan[ch] );
+
+            if ( ( ch == c->watch ) && ( m->swMsg.value > c->biggest ) )
+            {
+                c->biggest = m->swMsg.value;
+                c->h->setMetric( c->h, c->biggestId, c->biggest );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _close( void *ctx )
+
+{
+    struct msgCount *c = ( struct msgCount * )ctx;
+
+    c->h->report( V_INFO, "msgCount saw %llu software messages" EOL, ( unsigned long long )c->types[MSG_SOFTWARE] );
+    free( c );
+}
+// ====================================================================================================
+static const struct orbPlugin _plugin =
+{
+    .apiVersion = ORBPLUGIN_API_VERSION,
+    .name       = "msgCount",
+    .init       = _init,
+    .tagData    = _tagData,
+    .msgs       = _msgs,
+    .close      = _close,
+};
+
+const struct orbPlugin *orbPluginEntry( void )
+
+{
+    return &_plugin;
+}
+// ====================================================================================================
@@ -0,0 +1,102 @@
+/*
+ * Tokenised logging to an Orbuculum session at the other end (orbcat, orbzmq or orbfifo with -k).
+ *
+ * TLOG("x=%d y=%f\n", x, y) sends the address of the format and then the arguments, rather than the
+ * text. The format stays in flash and is found again on the host from the ELF, so it must be a
+ * string literal (or at least somewhere in the loaded image, as must any %s argument).
+ *
+ * Arguments are sent according to their type; doubles (and floats) and long longs take two words,
+ * pointers and everything else take one. Anything wider than 32 bits that isn't one of those
+ * (a long on a 64 bit target, say) wants a cast. Up to eight arguments are supported.
+ */
+
+#ifndef TOKENLOG_CLIENT_H_
+#define TOKENLOG_CLIENT_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+
+#ifndef TOKENLOG_CHANNEL
+    #define TOKENLOG_CHANNEL (8)   // ITM Channel to be used, matching the -k given to the host
+#endif
+
+// ============================================================================================
+static inline void _tlWord(uint32_t w)
+
+{
+    while (ITM->PORT[TOKENLOG_CHANNEL].u32 == 0); // Port available?
+    ITM->PORT[TOKENLOG_CHANNEL].u32 = w;
+}
+// ============================================================================================
+static inline void _tlWide(uint64_t v)
+
+/* Low word first */
+
+{
+    _tlWord((uint32_t)v);
+    _tlWord((uint32_t)(v>>32));
+}
+// ============================================================================================
+static inline void _tlDouble(double d)
+
+{
+    uint64_t v;
+    memcpy(&v,&d,sizeof(v));
+    _tlWide(v);
+}
+// ============================================================================================
+static inline void _tlPtr(const void *p)
+
+{
+    _tlWord((uint32_t)(uintptr_t)p);
+}
+// ============================================================================================
+static inline int _tlEnabled(void)
+
+{
+    return ((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && /* Trace enabled */
+            (ITM->TCR & ITM_TCR_ITMENA_Msk) && /* ITM enabled */
+            (ITM->TER & (1ul << TOKENLOG_CHANNEL))); /* ITM Port enabled */
+}
+// ============================================================================================
+
+/* Pick how each argument is sent from its type */
+#define _TL_ARG(x) _Generic((x),                                             \
+                            float: _tlDouble, double: _tlDouble,            \
+                            long double: _tlDouble,                         \
+                            long long: _tlWide, unsigned long long: _tlWide, \
+                            char *: _tlPtr, const char *: _tlPtr,           \
+                            void *: _tlPtr, const void *: _tlPtr,           \
+                            default: _tlWord)(x)
+
+/* Count the arguments (using the GNU ## extension, so there can be none at all) */
+#define _TL_NARGS(...) _TL_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define _TL_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define _TL_CAT(a, b) _TL_CAT_(a, b)
+#define _TL_CAT_(a, b) a##b
+
+#define _TL_0()
+#define _TL_1(a)      _TL_ARG(a);
+#define _TL_2(a, ...) _TL_ARG(a); _TL_1(__VA_ARGS__)
+#define _TL_3(a, ...) _TL_ARG(a); _TL_2(__VA_ARGS__)
+#define _TL_4(a, ...) _TL_ARG(a); _TL_3(__VA_ARGS__)
+#define _TL_5(a, ...) _TL_ARG(a); _TL_4(__VA_ARGS__)
+#define _TL_6(a, ...) _TL_ARG(a); _TL_5(__VA_ARGS__)
+#define _TL_7(a, ...) _TL_ARG(a); _TL_6(__VA_ARGS__)
+#define _TL_8(a, ...) _TL_ARG(a); _TL_7(__VA_ARGS__)
+
+/* Interrupts are held off for the record, so one from a handler can't land in the middle of another */
+#define TLOG(fmt, ...)                                              \
+    do {                                                            \
+        if (_tlEnabled()) {                                         \
+            uint32_t _tlPrimask = __get_PRIMASK();                  \
+            __disable_irq();                                        \
+            _tlPtr(fmt);                                            \
+            _TL_CAT(_TL_, _TL_NARGS(__VA_ARGS__))(__VA_ARGS__)      \
+            __set_PRIMASK(_tlPrimask);                              \
+        }                                                           \
+    } while (0)
+// ============================================================================================
+
+#endif /* TOKENLOG_CLIENT_H_ */
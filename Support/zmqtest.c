@@ -1,11 +1,15 @@
 #include <stdio.h>
+#include <string.h>
 #include <zmq.h>
 
 #define DEFAULT_ZMQ_BIND_URL "tcp://localhost:3442"
 
+/* With -b, payloads are batches from orbzmq -b: each message has a two byte little endian length ahead of it */
+
 int main( int argc, void **argv )
 
 {
+  int batched = ( argc > 1 ) && ( !strcmp( argv[1], "-b" ) );
   void *ctx = zmq_ctx_new();
   void *sock = zmq_socket( ctx, ZMQ_SUB);
   zmq_connect(sock, DEFAULT_ZMQ_BIND_URL );
@@ -18,10 +22,27 @@ int main( int argc, void **argv )
       zmq_msg_recv(&message,sock,0);
       if (zmq_msg_size(&message) != 1)
 	{
-	  char *p = zmq_msg_data(&message);
+	  unsigned char *p = zmq_msg_data(&message);
 	  int i = zmq_msg_size(&message);
-	  while (i--)
-	    putchar(*p++);
+	  if (batched)
+	    {
+	      /* The topic part doesn't carry a batch */
+	      if (!zmq_msg_more(&message))
+		{
+		  while (i >= 2)
+		    {
+		      int l = p[0] | (p[1] << 8);
+		      p += 2;
+		      i -= 2;
+		      fwrite(p, 1, (l < i) ? l : i, stdout);
+		      p += l;
+		      i -= l;
+		    }
+		}
+	    }
+	  else
+	    while (i--)
+	      putchar(*p++);
 	}
       zmq_msg_close(&message);
     }
@@ -1,5 +1,19 @@
+import sys
 import zmq
 
+# With -b, payloads are batches from orbzmq -b: each message has a two byte little endian length ahead of it
+batched = '-b' in sys.argv[1:]
+
+def messages(payload):
+    if not batched:
+        yield payload
+        return
+    i = 0
+    while i + 2 <= len(payload):
+        l = int.from_bytes(payload[i:i+2], byteorder='little')
+        yield payload[i+2:i+2+l]
+        i += 2 + l
+
 ctx = zmq.Context()
 sock = ctx.socket(zmq.SUB)
 
@@ -11,12 +25,13 @@ sock.setsockopt(zmq.SUBSCRIBE, b'formatted')
 sock.setsockopt(zmq.SUBSCRIBE, b'hwevent') # subscribe to all hwevents
 
 while True:
-    [topic, msg] = sock.recv_multipart()
-    if topic == b'raw':
-        decoded = int.from_bytes(msg, byteorder='little')
-        print(f'Raw: 0x{decoded:08X}')
-    elif topic == b'formatted':
-        print(msg.decode('ascii'),end="")
-    elif topic.startswith(b'hwevent'):
-        print(f'HWEvent: {topic} Msg: {msg}')
+    [topic, payload] = sock.recv_multipart()
+    for msg in messages(payload):
+        if topic == b'raw':
+            decoded = int.from_bytes(msg, byteorder='little')
+            print(f'Raw: 0x{decoded:08X}')
+        elif topic == b'formatted':
+            print(msg.decode('ascii'),end="")
+        elif topic.startswith(b'hwevent'):
+            print(f'HWEvent: {topic} Msg: {msg}')
         
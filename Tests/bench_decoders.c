@@ -0,0 +1,751 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Decoder Benchmarks
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build and run with;
+ * meson test -C build --benchmark -v
+ * or by hand;
+ * ./build/bench_decoders [-t secs] [-b name] [-f file,decoder]...
+ *
+ * Measures the throughput of each liborb decoder on synthetic corpora shaped like the traffic it
+ * usually sees, and on any recorded captures given with -f (use -l for the decoder names).
+ * Corpora are generated from a fixed seed, so numbers from different builds can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "itmDecoder.h"
+#include "msgDecoder.h"
+#include "msgSeq.h"
+#include "tpiuDecoder.h"
+#include "cobs.h"
+#include "oflow.h"
+#include "traceDecoder.h"
+#include "generics.h"
+
+#define CORPUS_LEN    (8*1024*1024)
+#define MSG_BLOCK_LEN (256)
+#define MAX_RECORDED  (16)
+
+struct corpus
+{
+    const char *name;
+    void ( *build )( struct corpus *c );
+    uint8_t *d;
+    size_t len;
+};
+
+struct decoder
+{
+    const char *name;
+    uint64_t ( *run )( const uint8_t *d, size_t len );  /* Returns a count of what came out, so it's not optimised away */
+};
+
+struct bench
+{
+    const char *decoder;
+    const char *corpus;
+};
+
+static double _minTime = 0.5;                            /* Minimum seconds to run each bench for */
+static const char *_only;                                /* Only run benches with this in their name */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Corpora
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _put( struct corpus *c, const uint8_t *d, size_t len )
+
+{
+    if ( c->len + len <= CORPUS_LEN )
+    {
+        memcpy( &c->d[c->len], d, len );
+        c->len += len;
+    }
+}
+// ====================================================================================================
+static bool _full( struct corpus *c, size_t margin )
+
+{
+    return c->len + margin > CORPUS_LEN;
+}
+// ====================================================================================================
+static void _itmSync( struct corpus *c )
+
+{
+    static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0x80 };
+    _put( c, sync, sizeof( sync ) );
+}
+// ====================================================================================================
+static size_t _itmPrintf( uint8_t *o )
+
+/* Mostly single characters on channel 0, the way a retargeted printf sends them, with some words */
+/* on other channels and the odd local timestamp.                                                */
+
+{
+    int r = rand() % 100;
+    size_t n = 0;
+
+    if ( r < 80 )
+    {
+        o[n++] = 0x01;
+        o[n++] = ' ' + rand() % 95;
+    }
+    else if ( r < 95 )
+    {
+        o[n++] = ( ( 1 + rand() % 7 ) << 3 ) | 3;
+
+        for ( int i = 0; i < 4; i++ )
+        {
+            o[n++] = rand();
+        }
+    }
+    else
+    {
+        /* Local timestamp, one continuation byte */
+        o[n++] = 0xc0;
+        o[n++] = 0x80 | ( rand() & 0x7f );
+        o[n++] = rand() & 0x7f;
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _buildSWOPrintf( struct corpus *c )
+
+{
+    uint8_t p[8];
+
+    _itmSync( c );
+
+    while ( !_full( c, sizeof( p ) ) )
+    {
+        _put( c, p, _itmPrintf( p ) );
+    }
+}
+// ====================================================================================================
+static void _buildPCSample( struct corpus *c )
+
+/* PC samples all the way, with a sleep sample now and again */
+
+{
+    uint8_t p[5];
+
+    _itmSync( c );
+
+    while ( !_full( c, sizeof( p ) ) )
+    {
+        if ( rand() % 20 )
+        {
+            uint32_t pc = 0x08000000 + ( rand() % 0x10000 ) * 2;
+            p[0] = 0x17;
+            memcpy( &p[1], &pc, 4 );
+            _put( c, p, 5 );
+        }
+        else
+        {
+            p[0] = 0x15;
+            p[1] = 0;
+            _put( c, p, 2 );
+        }
+    }
+}
+// ====================================================================================================
+static void _buildTPIU( struct corpus *c )
+
+/* ITM on stream 1 in TPIU frames, as it comes from a 4 bit parallel port, with full syncs between      */
+/* groups of frames. Each frame carries an ID change at the start then 14 bytes of data, with the low    */
+/* bit of each data byte in an even position moved into the auxiliary byte.                             */
+
+{
+    static const uint8_t sync[] = { 0xff, 0xff, 0xff, 0x7f };
+    static uint8_t itm[CORPUS_LEN / 8];
+    uint8_t f[TPIU_PACKET_LEN];
+    size_t ilen = 0, rp = 0;
+    int frames = 0;
+
+    while ( ilen < sizeof( itm ) - 8 )
+    {
+        ilen += _itmPrintf( &itm[ilen] );
+    }
+
+    while ( !_full( c, sizeof( f ) + sizeof( sync ) ) )
+    {
+        if ( !( frames++ % 32 ) )
+        {
+            _put( c, sync, sizeof( sync ) );
+        }
+
+        f[0] = ( 1 << 1 ) | 1;
+        f[1] = itm[rp++ % ilen];
+        f[15] = 0;
+
+        for ( int i = 2; i < 15; i += 2 )
+        {
+            uint8_t d = itm[rp++ % ilen];
+            f[i] = d & 0xfe;
+            f[15] |= ( d & 1 ) << ( i / 2 );
+
+            if ( i < 14 )
+            {
+                f[i + 1] = itm[rp++ % ilen];
+            }
+        }
+
+        _put( c, f, sizeof( f ) );
+    }
+}
+// ====================================================================================================
+static void _buildCOBS( struct corpus *c )
+
+{
+    static struct Frame o;
+    uint8_t m[512];
+
+    while ( !_full( c, COBS_MAX_ENC_PACKET_LEN ) )
+    {
+        int l = 1 + rand() % sizeof( m );
+
+        for ( int i = 0; i < l; i++ )
+        {
+            m[i] = ( rand() % 10 ) ? rand() : 0;
+        }
+
+        COBSEncode( NULL, 0, NULL, 0, m, l, &o );
+        _put( c, o.d, o.len );
+    }
+}
+// ====================================================================================================
+static void _buildOFLOW( struct corpus *c )
+
+/* SWO printf traffic, in the sort of lumps orbuculum sends it on in */
+
+{
+    static struct Frame o;
+    uint8_t m[OFLOW_MAX_PACKET_LEN];
+
+    while ( !_full( c, OFLOW_MAX_ENC_PACKET_LEN ) )
+    {
+        int l = 0, want = 16 + rand() % 1024;
+
+        while ( l < want )
+        {
+            l += _itmPrintf( &m[l] );
+        }
+
+        OFLOWEncode( 1, 0, m, l, &o );
+        _put( c, o.d, o.len );
+    }
+}
+// ====================================================================================================
+static void _buildETM35( struct corpus *c )
+
+/* P-headers and Thumb branch addresses in the alternate encoding, after an A-Sync and an I-Sync */
+
+{
+    static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0x80, 0x08, 0x00, 0x01, 0x00, 0x00, 0x08 };
+    uint8_t p[5];
+
+    _put( c, sync, sizeof( sync ) );
+
+    while ( !_full( c, sizeof( p ) ) )
+    {
+        if ( rand() % 3 )
+        {
+            p[0] = 0x80 | ( rand() & 0x7c ) | ( ( rand() & 1 ) << 1 );
+            _put( c, p, 1 );
+        }
+        else
+        {
+            int l = 1 + rand() % 3;
+
+            for ( int i = 0; i < l; i++ )
+            {
+                p[i] = 0x80 | ( rand() & 0x7e ) | ( i ? 0 : 1 );
+            }
+
+            p[l - 1] &= ( l == 1 ) ? 0x7f : 0x3f;
+            _put( c, p, l );
+        }
+    }
+}
+// ====================================================================================================
+static void _buildETM4( struct corpus *c )
+
+/* Nothing but atoms, of all formats, once an A-Sync, Trace Info and an address have set things up */
+
+{
+    static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x80, 0x01, 0x00, 0x9a, 0x00, 0x01, 0x00, 0x08 };
+    uint8_t a;
+
+    _put( c, sync, sizeof( sync ) );
+
+    while ( !_full( c, 1 ) )
+    {
+        a = 0xc0 | ( rand() & 0x3f );
+        _put( c, &a, 1 );
+    }
+}
+// ====================================================================================================
+static void _buildMTB( struct corpus *c )
+
+/* Branch pairs of from and to addresses from a small program, as read out of the MTB buffer */
+
+{
+    uint32_t w[2];
+    uint32_t at = 0x08000100;
+
+    while ( !_full( c, sizeof( w ) ) )
+    {
+        w[0] = at + ( rand() % 32 ) * 2;
+        at = 0x08000000 + ( rand() % 0x4000 ) * 2;
+        w[1] = at;
+        _put( c, ( uint8_t * )w, sizeof( w ) );
+    }
+}
+// ====================================================================================================
+static struct corpus _corpus[MAX_RECORDED + 16] =
+{
+    { "swo-printf", _buildSWOPrintf },
+    { "pc-sample",  _buildPCSample  },
+    { "tpiu-4bit",  _buildTPIU      },
+    { "cobs",       _buildCOBS      },
+    { "oflow",      _buildOFLOW     },
+    { "etm35",      _buildETM35     },
+    { "etm4-atoms", _buildETM4      },
+    { "mtb",        _buildMTB       },
+    { NULL }
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Decoders
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint64_t _runITMPump( const uint8_t *d, size_t len )
+
+{
+    static struct ITMDecoder i;
+    struct msg m;
+    uint64_t n = 0;
+
+    ITMDecoderInit( &i, true );
+
+    while ( len-- )
+    {
+        if ( ( ITMPump( &i, *d++ ) == ITM_EV_PACKET_RXED ) && ( ITMGetDecodedPacket( &i, &m ) ) )
+        {
+            n++;
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+static uint64_t _runITMBlockProfile( const uint8_t *d, size_t len, enum ITMDecoderProfile profile )
+
+{
+    static struct ITMDecoder i;
+    static struct msg m[MSG_BLOCK_LEN];
+    uint64_t n = 0;
+    size_t used;
+
+    ITMDecoderInit( &i, true );
+    ITMDecoderSetProfile( &i, profile );
+
+    while ( len )
+    {
+        n += ITMPumpBlock( &i, d, len, m, MSG_BLOCK_LEN, &used );
+        d += used;
+        len -= used;
+    }
+
+    return n;
+}
+// ====================================================================================================
+static uint64_t _runITMPumpBlock( const uint8_t *d, size_t len )
+
+{
+    return _runITMBlockProfile( d, len, ITM_PROFILE_SW );
+}
+// ====================================================================================================
+static uint64_t _runITMPumpBlockHW( const uint8_t *d, size_t len )
+
+{
+    return _runITMBlockProfile( d, len, ITM_PROFILE_SW_HW );
+}
+// ====================================================================================================
+static uint64_t _runMSGSeqPump( const uint8_t *d, size_t len )
+
+{
+    static struct ITMDecoder i;
+    static struct MSGSeq s;
+    static bool init;
+    uint64_t n = 0;
+
+    if ( !init )
+    {
+        if ( !MSGSeqInit( &s, &i, 16384 ) )
+        {
+            genericsExit( -1, "No memory for message sequencer" EOL );
+        }
+
+        init = true;
+    }
+
+    ITMDecoderInit( &i, true );
+
+    while ( len-- )
+    {
+        if ( MSGSeqPump( &s, *d++ ) )
+        {
+            while ( MSGSeqGetPacket( &s ) )
+            {
+                n++;
+            }
+        }
+    }
+
+    while ( MSGSeqGetPacket( &s ) )
+    {
+        n++;
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _tpiuPacketRxed( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param )
+
+{
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        *( uint64_t * )param += p->len;
+    }
+}
+// ====================================================================================================
+static uint64_t _runTPIUPump( const uint8_t *d, size_t len )
+
+{
+    static struct TPIUDecoder t;
+    uint64_t n = 0;
+
+    TPIUDecoderInit( &t );
+    TPIUPump( &t, ( uint8_t * )d, len, _tpiuPacketRxed, &n );
+    return n;
+}
+// ====================================================================================================
+static void _tpiuSpansRxed( enum TPIUPumpEvent e, const struct TPIUSpan *s, int nspans, void *param )
+
+{
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        while ( nspans-- )
+        {
+            *( uint64_t * )param += ( s++ )->len;
+        }
+    }
+}
+// ====================================================================================================
+static uint64_t _runTPIUPumpSpans( const uint8_t *d, size_t len )
+
+{
+    static struct TPIUDecoder t;
+    uint64_t n = 0;
+
+    TPIUDecoderInit( &t );
+    TPIUPumpSpans( &t, d, len, _tpiuSpansRxed, &n );
+    return n;
+}
+// ====================================================================================================
+static void _cobsPacketRxed( struct Frame *p, void *param )
+
+{
+    *( uint64_t * )param += p->len;
+}
+// ====================================================================================================
+static uint64_t _runCOBSPump( const uint8_t *d, size_t len )
+
+{
+    static struct COBS c;
+    uint64_t n = 0;
+
+    COBSInit( &c );
+    COBSPump( &c, d, len, _cobsPacketRxed, &n );
+    return n;
+}
+// ====================================================================================================
+static void _oflowPacketRxed( struct OFLOWFrame *p, void *param )
+
+{
+    *( uint64_t * )param += p->len;
+}
+// ====================================================================================================
+static uint64_t _runOFLOWPump( const uint8_t *d, size_t len )
+
+{
+    static struct OFLOW o;
+    uint64_t n = 0;
+
+    OFLOWInit( &o );
+    OFLOWPump( &o, d, len, _oflowPacketRxed, &n );
+    return n;
+}
+// ====================================================================================================
+static void _traceCB( void *d )
+
+{
+    ( *( uint64_t * )d )++;
+}
+// ====================================================================================================
+static uint64_t _runTrace( enum TRACEprotocol p, const uint8_t *d, size_t len )
+
+{
+    static struct TRACEDecoder t;
+    uint64_t n = 0;
+
+    TRACEDecoderInit( &t, p, true, NULL );
+    TRACEDecoderForceSync( &t, p != TRACE_PROT_MTB );
+    TRACEDecoderPump( &t, ( uint8_t * )d, len, _traceCB, &n );
+    t.engine->destroy( t.engine );
+    return n;
+}
+// ====================================================================================================
+static uint64_t _runETM35( const uint8_t *d, size_t len )
+
+{
+    return _runTrace( TRACE_PROT_ETM35, d, len );
+}
+// ====================================================================================================
+static uint64_t _runETM4( const uint8_t *d, size_t len )
+
+{
+    return _runTrace( TRACE_PROT_ETM4, d, len );
+}
+// ====================================================================================================
+static uint64_t _runMTB( const uint8_t *d, size_t len )
+
+{
+    return _runTrace( TRACE_PROT_MTB, d, len );
+}
+// ====================================================================================================
+static const struct decoder _decoder[] =
+{
+    { "ITMPump",        _runITMPump        },
+    { "ITMPumpBlock",   _runITMPumpBlock   },
+    { "ITMPumpBlockHW", _runITMPumpBlockHW },
+    { "MSGSeqPump",     _runMSGSeqPump     },
+    { "TPIUPump",       _runTPIUPump       },
+    { "TPIUPumpSpans",  _runTPIUPumpSpans  },
+    { "COBSPump",       _runCOBSPump       },
+    { "OFLOWPump",      _runOFLOWPump      },
+    { "ETM35",          _runETM35          },
+    { "ETM4",           _runETM4           },
+    { "MTB",            _runMTB            },
+    { NULL }
+};
+
+static struct bench _bench[MAX_RECORDED + 32] =
+{
+    { "ITMPump",        "swo-printf" },
+    { "ITMPump",        "pc-sample"  },
+    { "ITMPumpBlock",   "swo-printf" },
+    { "ITMPumpBlock",   "pc-sample"  },
+    { "ITMPumpBlockHW", "pc-sample"  },
+    { "MSGSeqPump",     "swo-printf" },
+    { "MSGSeqPump",     "pc-sample"  },
+    { "TPIUPump",       "tpiu-4bit"  },
+    { "TPIUPumpSpans",  "tpiu-4bit"  },
+    { "COBSPump",       "cobs"       },
+    { "OFLOWPump",      "oflow"      },
+    { "ETM35",          "etm35"      },
+    { "ETM4",           "etm4-atoms" },
+    { "MTB",            "mtb"        },
+    { NULL }
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Running
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+// ====================================================================================================
+static const struct decoder *_findDecoder( const char *name )
+
+{
+    for ( const struct decoder *d = _decoder; d->name; d++ )
+    {
+        if ( !strcmp( d->name, name ) )
+        {
+            return d;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static struct corpus *_findCorpus( const char *name )
+
+{
+    for ( struct corpus *c = _corpus; c->name; c++ )
+    {
+        if ( !strcmp( c->name, name ) )
+        {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _addRecorded( char *arg )
+
+/* Add a bench for a capture file to be run through the named decoder, given as file,decoder */
+
+{
+    char *comma = strrchr( arg, ',' );
+    int nc = 0, nb = 0;
+    FILE *f;
+
+    while ( _corpus[nc].name )
+    {
+        nc++;
+    }
+
+    while ( _bench[nb].decoder )
+    {
+        nb++;
+    }
+
+    if ( ( !comma ) || ( !_findDecoder( comma + 1 ) ) || ( nc == MAX_RECORDED + 15 ) )
+    {
+        fprintf( stderr, "Need file,decoder for a recorded corpus, with a decoder from -l" EOL );
+        return false;
+    }
+
+    *comma = 0;
+
+    if ( !( f = fopen( arg, "rb" ) ) )
+    {
+        fprintf( stderr, "Can't open %s" EOL, arg );
+        return false;
+    }
+
+    _corpus[nc].name = arg;
+    _corpus[nc].d = ( uint8_t * )malloc( CORPUS_LEN );
+    _corpus[nc].len = fread( _corpus[nc].d, 1, CORPUS_LEN, f );
+    fclose( f );
+
+    _bench[nb].decoder = comma + 1;
+    _bench[nb].corpus = arg;
+    return true;
+}
+// ====================================================================================================
+static void _runBench( const struct bench *b )
+
+{
+    const struct decoder *d = _findDecoder( b->decoder );
+    struct corpus *c = _findCorpus( b->corpus );
+    uint64_t out = 0, bytes = 0;
+    double start, elapsed;
+
+    if ( !c->d )
+    {
+        c->d = ( uint8_t * )malloc( CORPUS_LEN );
+        srand( 1 );
+        c->build( c );
+    }
+
+    /* One run to warm things up, then as many as fit into the time */
+    d->run( c->d, c->len );
+    start = _now();
+
+    do
+    {
+        out += d->run( c->d, c->len );
+        bytes += c->len;
+        elapsed = _now() - start;
+    }
+    while ( elapsed < _minTime );
+
+    fprintf( stdout, "%-14s %-16s %9.1f MB/s %7.2f ns/byte %12" PRIu64 " out" EOL, d->name, c->name,
+             bytes / elapsed / 1e6, elapsed * 1e9 / bytes, out * c->len / bytes );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    int ch;
+
+    while ( ( ch = getopt( argc, argv, "b:f:hlt:" ) ) != -1 )
+    {
+        switch ( ch )
+        {
+            case 'b':
+                _only = optarg;
+                break;
+
+            case 'f':
+                if ( !_addRecorded( optarg ) )
+                {
+                    return -1;
+                }
+
+                break;
+
+            case 'l':
+                for ( const struct decoder *d = _decoder; d->name; d++ )
+                {
+                    fprintf( stdout, "%s" EOL, d->name );
+                }
+
+                return 0;
+
+            case 't':
+                _minTime = atof( optarg );
+                break;
+
+            default:
+                fprintf( stderr, "Usage: %s [-b name] [-f file,decoder]... [-l] [-t secs]" EOL, argv[0] );
+                fprintf( stderr, "    -b: Only run benches with name in their decoder or corpus" EOL );
+                fprintf( stderr, "    -f: Add a recorded capture to run through decoder" EOL );
+                fprintf( stderr, "    -l: List the decoders" EOL );
+                fprintf( stderr, "    -t: Minimum time to run each bench for (default %.1f s)" EOL, _minTime );
+                return ( ch == 'h' ) ? 0 : -1;
+        }
+    }
+
+    for ( const struct bench *b = _bench; b->decoder; b++ )
+    {
+        if ( ( !_only ) || ( strstr( b->decoder, _only ) ) || ( strstr( b->corpus, _only ) ) )
+        {
+            _runBench( b );
+        }
+    }
+
+    return 0;
+}
+// ====================================================================================================
@@ -0,0 +1,421 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Symbol Loading Benchmarks
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build and run with;
+ * ORB_BENCH_ELF=small.elf:big.elf meson test -C build --benchmark -v
+ * or by hand;
+ * ./build/bench_symbols [-b name] [-n] [-t secs] file.elf...
+ *
+ * Loads each image through loadelf (symbolAcquire) and through the symbol sets built on it
+ * (SymbolSetCreate), with and without source, first cold and then from the symbol cache. For each
+ * load it gives the wall time, the peak RSS of the process and the most that was held for symbols,
+ * then the rate of the lookups the tools make once they're running. Give it a spread of images,
+ * a small C one, a large C++ one and one with a lot inlined, and some with their source missing,
+ * since that's what tells one case from another.
+ *
+ * Every load is done in a process of its own so the RSS is only its own. The cache is kept in a
+ * directory made for the run, so whatever is in the real one makes no difference. Note that
+ * SymbolSetCreate waits a second for the file to be stable before it loads anything, and that's in
+ * its times; the loadelf lines for the same image show what the loading itself took.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "loadelf.h"
+
+/* loadelf has its own (signed) versions of these, we want the ones from symbols.h */
+#undef NO_LINE
+#undef NO_FILE
+#undef NO_DESTADDRESS
+#include "symbols.h"
+#include "memAccount.h"
+#include "generics.h"
+
+#define NUM_ADDRS     (4096)                             /* Addresses looked up, over and over */
+
+struct load
+{
+    const char *name;
+    bool symbolSet;                                      /* Through SymbolSetCreate, rather than straight to loadelf */
+    bool source;                                         /* With source */
+};
+
+static const struct load _load[] =
+{
+    { "loadelf",       false, false },
+    { "loadelf+src",   false, true  },
+    { "symbolset",     true,  false },
+    { "symbolset+src", true,  true  },
+    { NULL }
+};
+
+static double _minTime = 0.5;                            /* Minimum seconds to run each lookup for */
+static const char *_only;                                /* Only run loads with this in their name */
+static bool _noLookups;                                  /* Just time the loads */
+static char _cacheDir[] = "/tmp/orbbenchXXXXXX";
+
+static symbolMemaddr _addr[NUM_ADDRS];
+static unsigned int _numAddrs;
+static volatile uint64_t _sink;                          /* So nothing looked up is optimised away */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Measuring
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+// ====================================================================================================
+static double _peakRSS( void )
+
+/* Most this process has had resident, in MB */
+
+{
+    struct rusage u;
+    getrusage( RUSAGE_SELF, &u );
+#ifdef OSX
+    return u.ru_maxrss / 1048576.0;
+#else
+    return u.ru_maxrss / 1024.0;
+#endif
+}
+// ====================================================================================================
+static const char *_leaf( const char *path )
+
+{
+    const char *s = strrchr( path, '/' );
+    return s ? s + 1 : path;
+}
+// ====================================================================================================
+static void _addAddr( symbolMemaddr lo, symbolMemaddr hi )
+
+/* Somewhere in [lo,hi], on an instruction boundary as a trace would give */
+
+{
+    if ( ( _numAddrs < NUM_ADDRS ) && ( hi > lo ) )
+    {
+        _addr[_numAddrs++] = ( lo + ( rand() % ( hi - lo ) ) ) & ~1;
+    }
+}
+// ====================================================================================================
+static void _rate( const char *what, uint64_t ( *fn )( void *h, symbolMemaddr a ), void *h )
+
+/* Run fn over the addresses for as long as it takes to get a steady rate */
+
+{
+    uint64_t n = 0;
+    double start, elapsed;
+
+    if ( !_numAddrs )
+    {
+        return;
+    }
+
+    start = _now();
+
+    do
+    {
+        for ( unsigned int i = 0; i < _numAddrs; i++ )
+        {
+            _sink += fn( h, _addr[i] );
+        }
+
+        n += _numAddrs;
+        elapsed = _now() - start;
+    }
+    while ( elapsed < _minTime );
+
+    fprintf( stdout, "    %-22s %9.2f M/s %9.1f ns each" EOL, what, n / elapsed / 1e6, elapsed * 1e9 / n );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Lookups
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint64_t _symbolLookup( void *h, symbolMemaddr a )
+
+{
+    struct nameEntry n;
+    return SymbolLookup( ( struct SymbolSet * )h, a, &n ) ? n.line : 0;
+}
+// ====================================================================================================
+static uint64_t _lineAt( void *h, symbolMemaddr a )
+
+{
+    struct symbolLineStore *l = symbolLineAt( ( struct symbol * )h, a );
+    return l ? l->startline : 0;
+}
+// ====================================================================================================
+static uint64_t _functionAt( void *h, symbolMemaddr a )
+
+{
+    struct symbolFunctionStore *f = symbolFunctionAt( ( struct symbol * )h, a );
+    return f ? f->startline : 0;
+}
+// ====================================================================================================
+static uint64_t _disassembleLine( void *h, symbolMemaddr a )
+
+/* Addresses for this are the starts of functions, which are certain to be instructions */
+
+{
+    enum instructionClass ic;
+    char *s = symbolDisassembleLine( ( struct symbol * )h, &ic, a, NULL );
+    return s ? ( uint64_t )s[0] + ic : 0;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Running
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _runLoad( char *elf, const struct load *l, bool cached )
+
+/* Done in a child (see _runChild), so that it starts from nothing */
+
+{
+    struct SymbolSet *ss = NULL;
+    struct symbol *p = NULL;
+    struct memUse u;
+    double start, elapsed;
+    unsigned int nfunc, nlines = 0;
+
+    start = _now();
+
+    if ( l->symbolSet )
+    {
+        if ( SymbolSetCreate( &ss, elf, NULL, true, l->source, true, NULL ) != SYMBOL_OK )
+        {
+            fprintf( stdout, "%-24s %-14s couldn't be loaded" EOL, _leaf( elf ), l->name );
+            return;
+        }
+    }
+    else if ( !( p = symbolAcquire( elf, true, l->source ) ) )
+    {
+        fprintf( stdout, "%-24s %-14s couldn't be loaded" EOL, _leaf( elf ), l->name );
+        return;
+    }
+
+    elapsed = _now() - start;
+    memGetUse( MEM_SYMBOLS, &u );
+
+    if ( ss )
+    {
+        nfunc = ss->functionCount;
+        nlines = ss->sourceCount;
+
+        /* Entry 0 is the table's null entry, with nothing at any address */
+        for ( unsigned int i = 1; i < nfunc; i++ )
+        {
+            _addAddr( ss->functions[i].startAddr, ss->functions[i].endAddr );
+        }
+    }
+    else
+    {
+        nfunc = p->nfunc;
+        nlines = p->nlines;
+
+        for ( unsigned int i = 0; i < nfunc; i++ )
+        {
+            _addAddr( p->func[i]->lowaddr, p->func[i]->highaddr );
+        }
+    }
+
+    fprintf( stdout, "%-24s %-14s %-5s %9.1f ms %8.1f MB rss %8.1f MB symbols %7u functions %8u lines" EOL,
+             _leaf( elf ), l->name, cached ? "warm" : "cold", elapsed * 1e3, _peakRSS(), u.peak / 1048576.0, nfunc, nlines );
+
+    if ( !_noLookups )
+    {
+        if ( ss )
+        {
+            _rate( "SymbolLookup", _symbolLookup, ss );
+        }
+        else
+        {
+            _rate( "symbolLineAt", _lineAt, p );
+            _rate( "symbolFunctionAt", _functionAt, p );
+
+            /* Disassembly is only ever asked for at instructions, so go from the start of each function */
+            _numAddrs = 0;
+
+            for ( unsigned int i = 0; i < nfunc; i++ )
+            {
+                _addAddr( p->func[i]->lowaddr, p->func[i]->lowaddr + 1 );
+            }
+
+            _rate( "symbolDisassembleLine", _disassembleLine, p );
+        }
+    }
+
+    fflush( stdout );
+    SymbolSetDelete( &ss );
+    symbolDelete( p );
+}
+// ====================================================================================================
+static void _runChild( char *elf, const struct load *l, bool cached, bool quiet )
+
+{
+    pid_t pid;
+    int status;
+
+    fflush( stdout );
+
+    if ( ( pid = fork() ) < 0 )
+    {
+        genericsExit( -1, "Couldn't fork" EOL );
+    }
+
+    if ( !pid )
+    {
+        if ( quiet )
+        {
+            /* Just to get the cache filled in */
+            symbolDelete( symbolAcquire( elf, true, l->source ) );
+        }
+        else
+        {
+            srand( 1 );
+            _runLoad( elf, l, cached );
+        }
+
+        exit( 0 );
+    }
+
+    waitpid( pid, &status, 0 );
+}
+// ====================================================================================================
+static void _clearCache( void )
+
+{
+    DIR *d = opendir( _cacheDir );
+    struct dirent *e;
+    char n[PATH_MAX];
+
+    while ( d && ( e = readdir( d ) ) )
+    {
+        if ( e->d_name[0] != '.' )
+        {
+            snprintf( n, sizeof( n ), "%s/%s", _cacheDir, e->d_name );
+            unlink( n );
+        }
+    }
+
+    if ( d )
+    {
+        closedir( d );
+    }
+}
+// ====================================================================================================
+static void _runElf( char *elf )
+
+{
+    for ( const struct load *l = _load; l->name; l++ )
+    {
+        if ( ( _only ) && ( !strstr( l->name, _only ) ) )
+        {
+            continue;
+        }
+
+        setenv( "ORB_NOSYMBOLCACHE", "1", 1 );
+        _runChild( elf, l, false, false );
+
+        unsetenv( "ORB_NOSYMBOLCACHE" );
+        _clearCache();
+        _runChild( elf, l, true, true );
+        _runChild( elf, l, true, false );
+    }
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    char *fromEnv = getenv( "ORB_BENCH_ELF" );
+    int ch;
+
+    while ( ( ch = getopt( argc, argv, "b:hnt:" ) ) != -1 )
+    {
+        switch ( ch )
+        {
+            case 'b':
+                _only = optarg;
+                break;
+
+            case 'n':
+                _noLookups = true;
+                break;
+
+            case 't':
+                _minTime = atof( optarg );
+                break;
+
+            default:
+                fprintf( stderr, "Usage: %s [-b name] [-n] [-t secs] file.elf..." EOL, argv[0] );
+                fprintf( stderr, "    -b: Only run loads with name in theirs (loadelf, symbolset, +src)" EOL );
+                fprintf( stderr, "    -n: Only time the loads, not the lookups" EOL );
+                fprintf( stderr, "    -t: Minimum time to run each lookup for (default %.1f s)" EOL, _minTime );
+                fprintf( stderr, "    Images can also be given in ORB_BENCH_ELF, separated by ':'" EOL );
+                return ( ch == 'h' ) ? 0 : -1;
+        }
+    }
+
+    if ( ( optind == argc ) && ( ( !fromEnv ) || ( !*fromEnv ) ) )
+    {
+        /* Nothing to load is a skip, as far as meson is concerned */
+        fprintf( stderr, "No images to load, give them on the command line or in ORB_BENCH_ELF" EOL );
+        return 77;
+    }
+
+    if ( !mkdtemp( _cacheDir ) )
+    {
+        genericsExit( -1, "Couldn't make a directory for the symbol cache" EOL );
+    }
+
+    setenv( "ORB_SYMBOLCACHE", _cacheDir, 1 );
+
+    for ( int i = optind; i < argc; i++ )
+    {
+        _runElf( argv[i] );
+    }
+
+    if ( fromEnv )
+    {
+        char *e = strdup( fromEnv );
+
+        for ( char *f = strtok( e, ":" ); f; f = strtok( NULL, ":" ) )
+        {
+            _runElf( f );
+        }
+
+        free( e );
+    }
+
+    _clearCache();
+    rmdir( _cacheDir );
+    return 0;
+}
+// ====================================================================================================
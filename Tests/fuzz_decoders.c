@@ -0,0 +1,615 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Differential fuzzing of the fast decoders against their reference paths
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Each of the bulk decoders has a plain, byte at a time, path that it must agree with. This feeds
+ * the same input to both and aborts if the frames, messages, events or final state that come out
+ * differ in any way. The pairs are;
+ *
+ *   COBS   COBSPump             vs COBSPumpInPlace
+ *   OFLOW  OFLOWPump            vs OFLOWPumpInPlace, at every SIMD level, with the checksums checked byte at a time
+ *   TPIU   TPIUPump             vs TPIUPumpSpans, at every SIMD level the CPU supports
+ *   ITM    ITMPump              vs ITMPumpBlock
+ *   ETM35  the state machine    vs the actionRun fast path
+ *
+ * The first byte of each input picks the pair and its options, the second seeds the sizes of the
+ * lumps the fast path is fed in, so packets get split across calls. The rest is the stream itself.
+ *
+ * Build for libFuzzer with;
+ * clang -fsanitize=fuzzer,address -DFUZZ_LIBFUZZER -DLINUX -D_GNU_SOURCE -include uicolours_default.h \
+ *     Src/cobs.c Src/oflow.c Src/tpiuDecoder.c Src/simd.c Src/itmDecoder.c Src/msgDecoder.c Src/generics.c \
+ *     Src/traceDecoder.c Src/traceDecoder_etm35.c Src/traceDecoder_etm4.c Src/traceDecoder_mtb.c Src/statsRegistry.c \
+ *     Tests/fuzz_decoders.c -IInc -g -o fuzz_decoders -lpthread
+ * and run with;
+ * ./fuzz_decoders corpus/
+ *
+ * Build for AFL by leaving out -DFUZZ_LIBFUZZER and -fsanitize=fuzzer and using afl-clang-fast instead;
+ * afl-fuzz -i seeds -o findings -- ./fuzz_decoders @@
+ *
+ * Built with plain gcc, it runs each file named on the command line, or stdin if there are none, or
+ * with -r <n> it runs n random inputs itself as a quick smoke test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "cobs.h"
+#include "oflow.h"
+#include "tpiuDecoder.h"
+#include "simd.h"
+#include "itmDecoder.h"
+#include "msgDecoder.h"
+#include "traceDecoder.h"
+
+#define FUZZ_MAX_INPUT  (65536)
+#define FUZZ_LOG_LEN    (FUZZ_MAX_INPUT * 64)
+#define FUZZ_MAX_EVENTS (64)
+#define FUZZ_MAX_MSGS   (16)
+
+enum fuzzTarget { FT_COBS, FT_OFLOW, FT_TPIU, FT_ITM, FT_ETM35, FT_NUM };
+
+/* Everything a decoder emits is appended to a log, so the two sides can be compared byte for byte */
+struct log
+{
+    size_t len;
+    uint8_t d[FUZZ_LOG_LEN];
+};
+
+static struct log _ref, _fast;
+static uint8_t _work[FUZZ_MAX_INPUT];
+static uint32_t _lumpSeed;
+static uint8_t _lumpMax;
+
+// ====================================================================================================
+static void _logAdd( struct log *l, const void *d, size_t len )
+
+{
+    if ( l->len + len > FUZZ_LOG_LEN )
+    {
+        /* Can't happen with inputs of FUZZ_MAX_INPUT or less, so it's a bug in itself */
+        fprintf( stderr, "Log overflow\n" );
+        abort();
+    }
+
+    memcpy( &l->d[l->len], d, len );
+    l->len += len;
+}
+// ====================================================================================================
+static int _lump( int left )
+
+/* Size of the next lump to give the fast path */
+
+{
+    _lumpSeed = _lumpSeed * 1103515245 + 12345;
+    int l = 1 + ( _lumpSeed >> 16 ) % _lumpMax;
+    return ( l > left ) ? left : l;
+}
+// ====================================================================================================
+static void _compare( const char *what, const void *a, const void *b, size_t len )
+
+{
+    if ( memcmp( a, b, len ) )
+    {
+        fprintf( stderr, "%s differs between reference and fast paths\n", what );
+        abort();
+    }
+}
+// ====================================================================================================
+static void _compareLogs( const char *what )
+
+{
+    if ( _ref.len != _fast.len )
+    {
+        fprintf( stderr, "%s output length differs, %zu reference, %zu fast\n", what, _ref.len, _fast.len );
+        abort();
+    }
+
+    _compare( what, _ref.d, _fast.d, _ref.len );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// COBS and OFLOW
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _cobsRef( struct Frame *p, void *param )
+
+{
+    _logAdd( &_ref, &p->len, sizeof( p->len ) );
+    _logAdd( &_ref, p->d, p->len );
+}
+// ====================================================================================================
+static void _cobsFast( uint8_t *d, int len, void *param )
+
+{
+    unsigned int l = len;
+    _logAdd( &_fast, &l, sizeof( l ) );
+    _logAdd( &_fast, d, len );
+}
+// ====================================================================================================
+static void _fuzzCOBS( const uint8_t *d, int len )
+
+{
+    static struct COBS r, f;
+
+    COBSInit( &r );
+    COBSInit( &f );
+    COBSPump( &r, d, len, _cobsRef, NULL );
+
+    memcpy( _work, d, len );
+
+    for ( int ofs = 0, l; ofs < len; ofs += l )
+    {
+        l = _lump( len - ofs );
+        COBSPumpInPlace( &f, &_work[ofs], l, _cobsFast, NULL );
+    }
+
+    _compareLogs( "COBS frames" );
+
+    if ( COBSGetErrors( &r ) != COBSGetErrors( &f ) )
+    {
+        fprintf( stderr, "COBS error count differs, %" PRIu64 " reference, %" PRIu64 " fast\n", COBSGetErrors( &r ), COBSGetErrors( &f ) );
+        abort();
+    }
+}
+// ====================================================================================================
+static void _oflowLog( struct OFLOWFrame *p, void *param )
+
+{
+    struct log *l = ( struct log * )param;
+    uint8_t sum = p->tag + p->sum;
+
+    for ( unsigned int i = 0; i < p->len; i++ )
+    {
+        sum += p->d[i];
+    }
+
+    if ( p->good != ( sum == 0 ) )
+    {
+        fprintf( stderr, "OFLOW checksum wrong at %s\n", SIMDLevelName( SIMDGetLevel() ) );
+        abort();
+    }
+
+    _logAdd( l, &p->len, sizeof( p->len ) );
+    _logAdd( l, &p->tag, sizeof( p->tag ) );
+    _logAdd( l, &p->sum, sizeof( p->sum ) );
+    _logAdd( l, &p->good, sizeof( p->good ) );
+    /* ...but not tstamp, which is the host clock at the time of the call */
+    _logAdd( l, p->d, p->len );
+}
+// ====================================================================================================
+static void _fuzzOFLOW( const uint8_t *d, int len )
+
+{
+    static struct OFLOW r, f;
+    static enum SIMDLevel level = SIMD_SCALAR;
+
+    /* The checksums are made with whichever kernels are in use, so go through them all */
+    for ( int i = 0; i < SIMD_NUM_LEVELS; i++ )
+    {
+        level = ( level + 1 ) % SIMD_NUM_LEVELS;
+
+        if ( SIMDSetLevel( level ) )
+        {
+            break;
+        }
+    }
+
+    OFLOWInit( &r );
+    OFLOWInit( &f );
+    OFLOWPump( &r, d, len, _oflowLog, &_ref );
+
+    memcpy( _work, d, len );
+
+    for ( int ofs = 0, l; ofs < len; ofs += l )
+    {
+        l = _lump( len - ofs );
+        OFLOWPumpInPlace( &f, &_work[ofs], l, _oflowLog, &_fast );
+    }
+
+    _compareLogs( "OFLOW frames" );
+
+    if ( ( OFLOWGetErrors( &r ) != OFLOWGetErrors( &f ) ) || ( OFLOWGetCOBSErrors( &r ) != OFLOWGetCOBSErrors( &f ) ) )
+    {
+        fprintf( stderr, "OFLOW error counts differ\n" );
+        abort();
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// TPIU
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _tpiuRef( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param )
+
+{
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        for ( int i = 0; i < p->len; i++ )
+        {
+            _logAdd( &_ref, &p->packet[i].s, 1 );
+            _logAdd( &_ref, &p->packet[i].d, 1 );
+        }
+    }
+}
+// ====================================================================================================
+static void _tpiuFast( enum TPIUPumpEvent e, const struct TPIUSpan *s, int nspans, void *param )
+
+{
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        for ( ; nspans--; s++ )
+        {
+            for ( int i = 0; i < s->len; i++ )
+            {
+                _logAdd( &_fast, &s->stream, 1 );
+                _logAdd( &_fast, &s->d[i], 1 );
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _fuzzTPIU( const uint8_t *d, int len, int option )
+
+{
+    static struct TPIUDecoder r, f;
+    static enum SIMDLevel level = SIMD_SCALAR;
+
+    /* Rotate through the SIMD levels, since the span decoder could be using any of them */
+    for ( int i = 0; i < SIMD_NUM_LEVELS; i++ )
+    {
+        level = ( level + 1 ) % SIMD_NUM_LEVELS;
+
+        if ( SIMDSetLevel( level ) )
+        {
+            break;
+        }
+    }
+
+    memset( &r, 0, sizeof( r ) );
+    memset( &f, 0, sizeof( f ) );
+    TPIUDecoderInit( &r );
+    TPIUDecoderInit( &f );
+
+    if ( option & 1 )
+    {
+        /* Start part way through a frame, as if sync was found some time ago */
+        TPIUDecoderForceSync( &r, option >> 1 );
+        TPIUDecoderForceSync( &f, option >> 1 );
+    }
+
+    /* TPIUPump doesn't write to its input, it just doesn't promise not to */
+    memcpy( _work, d, len );
+    TPIUPump( &r, _work, len, _tpiuRef, NULL );
+
+    for ( int ofs = 0, l; ofs < len; ofs += l )
+    {
+        l = _lump( len - ofs );
+        TPIUPumpSpans( &f, &d[ofs], l, _tpiuFast, NULL );
+    }
+
+    _compareLogs( "TPIU data" );
+    _compare( "TPIU decoder state", &r.state, &f.state, sizeof( r.state ) );
+    _compare( "TPIU stream", &r.currentStream, &f.currentStream, sizeof( r.currentStream ) );
+    _compare( "TPIU packet count", &r.stats.packets, &f.stats.packets, sizeof( r.stats.packets ) );
+    _compare( "TPIU sync count", &r.stats.syncCount, &f.stats.syncCount, sizeof( r.stats.syncCount ) );
+    _compare( "TPIU lost sync count", &r.stats.lostSync, &f.stats.lostSync, sizeof( r.stats.lostSync ) );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// ITM
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _fuzzITM( const uint8_t *d, int len, int option )
+
+{
+    static struct ITMDecoder r, f;
+    struct msg m[FUZZ_MAX_MSGS];
+    size_t n, used;
+
+    ITMDecoderInit( &r, option & 1 );
+    ITMDecoderInit( &f, option & 1 );
+    ITMDecoderSetProfile( &f, option % ITM_PROFILE_NUM );
+
+    for ( int i = 0; i < len; i++ )
+    {
+        if ( ITM_EV_PACKET_RXED == ITMPump( &r, d[i] ) )
+        {
+            memset( m, 0, sizeof( struct msg ) );
+
+            if ( ITMGetDecodedPacket( &r, m ) )
+            {
+                /* Host timestamps will never agree, so leave them out */
+                m->genericMsg.ts = 0;
+                _logAdd( &_ref, m, sizeof( struct msg ) );
+            }
+        }
+    }
+
+    /* Vary the room for messages too, so the block decoder has to stop part way through a lump */
+    size_t room = 1 + ( option >> 1 ) % FUZZ_MAX_MSGS;
+
+    for ( int ofs = 0, l; ofs < len; ofs += l )
+    {
+        l = _lump( len - ofs );
+
+        for ( int done = 0; done < l; done += used )
+        {
+            memset( m, 0, sizeof( m ) );
+            n = ITMPumpBlock( &f, &d[ofs + done], l - done, m, room, &used );
+
+            for ( size_t j = 0; j < n; j++ )
+            {
+                m[j].genericMsg.ts = 0;
+                _logAdd( &_fast, &m[j], sizeof( struct msg ) );
+            }
+
+            if ( ( !used ) && ( n < room ) )
+            {
+                fprintf( stderr, "ITMPumpBlock made no progress\n" );
+                abort();
+            }
+        }
+    }
+
+    _compareLogs( "ITM messages" );
+    _compare( "ITM decoder state", &r.p, &f.p, sizeof( r.p ) );
+    _compare( "ITM sync monitor", &r.syncStat, &f.syncStat, sizeof( r.syncStat ) );
+    _compare( "ITM stats", &r.stats, &f.stats, sizeof( r.stats ) );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// ETM3.5
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _logCPU( struct log *l, const struct TRACECPUState *c )
+
+/* Field by field, so padding and the report callback stay out of it */
+
+{
+#define _LOGF(x) _logAdd( l, &c->x, sizeof( c->x ) )
+    _LOGF( changeRecord );
+    _LOGF( ts );
+    _LOGF( addr );
+    _LOGF( toAddr );
+    _LOGF( nextAddr );
+    _LOGF( addrMode );
+    _LOGF( contextID );
+    _LOGF( vmid );
+    _LOGF( cycleCount );
+    _LOGF( exception );
+    _LOGF( resume );
+    _LOGF( serious );
+    _LOGF( instCount );
+    _LOGF( exceptionLevel );
+    _LOGF( am64bit );
+    _LOGF( amSecure );
+    _LOGF( reason );
+    _LOGF( isLSiP );
+    _LOGF( numInstructions );
+    _LOGF( watoms );
+    _LOGF( eatoms );
+    _LOGF( natoms );
+    _LOGF( disposition );
+    _LOGF( dsync_mark );
+    _LOGF( udsync_mark );
+    _LOGF( jazelle );
+    _LOGF( nonSecure );
+    _LOGF( altISA );
+    _LOGF( hyp );
+    _LOGF( thumb );
+    _LOGF( clockSpeedChanged );
+#undef _LOGF
+}
+// ====================================================================================================
+static void _logEvent( struct log *l, const struct TRACEEvent *e )
+
+{
+#define _LOGF(x) _logAdd( l, &e->x, sizeof( e->x ) )
+    _LOGF( changes );
+    _LOGF( addr );
+    _LOGF( toAddr );
+    _LOGF( disposition );
+    _LOGF( eatoms );
+    _LOGF( natoms );
+    _LOGF( exception );
+    _LOGF( instCount );
+    _LOGF( ts );
+    _LOGF( cycleCount );
+#undef _LOGF
+}
+// ====================================================================================================
+static void _runTRACE( struct TRACEDecoder *t, struct log *l, const uint8_t *d, int len, bool lumps )
+
+{
+    struct TRACEEvent ev[FUZZ_MAX_EVENTS];
+    int n, consumed;
+
+    for ( int ofs = 0, chunk; ofs < len; ofs += chunk )
+    {
+        chunk = lumps ? _lump( len - ofs ) : len - ofs;
+
+        for ( int done = 0; done < chunk; done += consumed )
+        {
+            n = TRACEDecoderPumpEvents( t, &d[ofs + done], chunk - done, ev, FUZZ_MAX_EVENTS, &consumed );
+
+            for ( int i = 0; i < n; i++ )
+            {
+                _logEvent( l, &ev[i] );
+            }
+
+            if ( ( !consumed ) && ( n < FUZZ_MAX_EVENTS ) )
+            {
+                fprintf( stderr, "TRACEDecoderPumpEvents made no progress\n" );
+                abort();
+            }
+        }
+    }
+
+    _logCPU( l, TRACECPUState( t ) );
+    _logAdd( l, TRACEDecoderGetStats( t ), sizeof( struct TRACEDecoderStats ) );
+}
+// ====================================================================================================
+static void _fuzzETM35( const uint8_t *d, int len, int option )
+
+{
+    static struct TRACEDecoder r, f;
+
+    TRACEDecoderInit( &r, TRACE_PROT_ETM35, option & 1, NULL );
+    TRACEDecoderInit( &f, TRACE_PROT_ETM35, option & 1, NULL );
+
+    if ( option & 2 )
+    {
+        TRACEDecoderForceSync( &r, true );
+        TRACEDecoderForceSync( &f, true );
+    }
+
+    /* The reference only gets to use the state machine */
+    r.engine->actionRun = NULL;
+
+    _runTRACE( &r, &_ref, d, len, false );
+    _runTRACE( &f, &_fast, d, len, true );
+    _compareLogs( "ETM3.5 events and CPU state" );
+
+    r.engine->destroy( r.engine );
+    f.engine->destroy( f.engine );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Entry points
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+int LLVMFuzzerTestOneInput( const uint8_t *data, size_t size )
+
+{
+    if ( ( size < 2 ) || ( size > FUZZ_MAX_INPUT + 2 ) )
+    {
+        return 0;
+    }
+
+    int option = data[0] / FT_NUM;
+    _lumpSeed = data[1];
+    _lumpMax = 1 + ( data[1] >> 2 );
+    _ref.len = _fast.len = 0;
+
+    const uint8_t *d = &data[2];
+    int len = size - 2;
+
+    switch ( data[0] % FT_NUM )
+    {
+        case FT_COBS:
+            _fuzzCOBS( d, len );
+            break;
+
+        case FT_OFLOW:
+            _fuzzOFLOW( d, len );
+            break;
+
+        case FT_TPIU:
+            _fuzzTPIU( d, len, option );
+            break;
+
+        case FT_ITM:
+            _fuzzITM( d, len, option );
+            break;
+
+        case FT_ETM35:
+            _fuzzETM35( d, len, option );
+            break;
+    }
+
+    return 0;
+}
+// ====================================================================================================
+#ifndef FUZZ_LIBFUZZER
+static uint8_t _in[FUZZ_MAX_INPUT + 2];
+
+static size_t _readAll( FILE *f )
+
+{
+    size_t n = fread( _in, 1, sizeof( _in ), f );
+    return n;
+}
+// ====================================================================================================
+static void _randomInput( size_t *len )
+
+/* Something with enough structure in it to get past the syncs now and again */
+
+{
+    static const uint8_t flavour[] = { 0x00, 0x80, 0x7f, 0xff, 0x01, 0x03, 0x08 };
+
+    *len = 2 + rand() % 4096;
+
+    for ( size_t i = 0; i < *len; i++ )
+    {
+        _in[i] = ( rand() % 3 ) ? rand() : flavour[rand() % sizeof( flavour )];
+    }
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    size_t len;
+
+    if ( ( argc == 3 ) && ( !strcmp( argv[1], "-r" ) ) )
+    {
+        int n = atoi( argv[2] );
+        srand( 1 );
+
+        for ( int i = 0; i < n; i++ )
+        {
+            _randomInput( &len );
+            LLVMFuzzerTestOneInput( _in, len );
+        }
+
+        fprintf( stderr, "%d random inputs OK\n", n );
+        return 0;
+    }
+
+#ifdef __AFL_LOOP
+
+    while ( __AFL_LOOP( 1000 ) )
+#endif
+    {
+        if ( argc < 2 )
+        {
+            len = _readAll( stdin );
+            LLVMFuzzerTestOneInput( _in, len );
+        }
+
+        for ( int i = 1; i < argc; i++ )
+        {
+            FILE *f = fopen( argv[i], "rb" );
+
+            if ( !f )
+            {
+                perror( argv[i] );
+                return -1;
+            }
+
+            len = _readAll( f );
+            fclose( f );
+            LLVMFuzzerTestOneInput( _in, len );
+        }
+    }
+
+    return 0;
+}
+#endif
+// ====================================================================================================
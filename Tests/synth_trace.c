@@ -0,0 +1,1056 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Synthetic Trace Generator
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build with;
+ * meson compile -C build synth_trace
+ * Execute with;
+ * ./build/synth_trace -e file.elf -P ETM4 -n 10000000 -o etm4.bin [-g etm4.truth] [-c]
+ * ./build/bench_decoders -f etm4.bin,ETM4
+ *
+ * Runs the program in an image the way a core would, block by block, without any of its data. At
+ * each conditional branch it's taken or not from a seeded random number (taken -b percent of the
+ * time) or by the next of the T and N characters in a script (-x), so the same arguments always give
+ * the same trace. Calls push their return address so that returns go back to them, and indirect
+ * branches with nowhere known to go pick a function at random. What the core would have traced is
+ * encoded the way the target would have sent it, as ETM3.5 (Thumb, alternative address encoding),
+ * ETM4 (IS1) or MTB source/destination pairs, with periodic syncs for the ETMs, and optionally
+ * wrapped in TPIU frames or in OFLOW for a given stream.
+ *
+ * What went into the trace is written out alongside it (-g) as the ground truth, so a decode of it
+ * can be checked; the instructions stepped through, branches taken and not, atoms, addresses and so
+ * on. With -c the trace is put back through the decoder before it's wrapped, and the atoms and
+ * addresses that come out are compared with those that went in. Put the same image and trace through
+ * orbmortem (-p ETM or -p OFLOW, with -E) to check the instructions it reconstructs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+#include "loadelf.h"
+#include "traceDecoder.h"
+#include "tpiuDecoder.h"
+#include "oflow.h"
+#include "generics.h"
+
+#define MAX_DEPTH       (64)                     /* Return addresses remembered */
+#define SYNC_PERIOD     (1024)                   /* Bytes between syncs, as TRCSYNCPR or ETMSYNCFR would have it */
+#define TPIU_SYNC_EVERY (32)                     /* Frames between full TPIU syncs */
+#define OFLOW_CHUNK     (1024)                   /* Trace carried in each OFLOW frame */
+#define MAX_TRIES       (1000)                   /* Attempts to find somewhere to run from, before giving up */
+
+enum wrap { WRAP_NONE, WRAP_TPIU, WRAP_OFLOW };
+static const char *_wrapName[] = { "none", "tpiu", "oflow", NULL };
+
+/* What the instruction ending a basic block does to the flow */
+enum branchKind { BK_NOFLOW, BK_COND, BK_ALWAYS, BK_TABLE };
+
+static struct
+{
+    char *elf;                                   /* Image to run */
+    char *out;                                   /* File for the trace */
+    char *truth;                                 /* ...and for what went into it */
+    char *script;                                /* File of T and N outcomes to use, rather than random ones */
+    char *start;                                 /* Function or address to start from */
+    enum TRACEprotocol prot;
+    enum wrap wrap;
+    int tag;                                     /* OFLOW stream or TPIU channel the trace is put in */
+    uint64_t insns;                              /* Instructions to run for */
+    unsigned int taken;                          /* Percentage of conditional branches taken */
+    unsigned int seed;
+    bool check;                                  /* Put the trace back through the decoder */
+} _options =
+{
+    .prot  = TRACE_PROT_ETM4,
+    .wrap  = WRAP_NONE,
+    .tag   = 2,
+    .insns = 1000000,
+    .taken = 50,
+    .seed  = 1
+};
+
+/* The ground truth, for what was put in the trace */
+struct truth
+{
+    uint64_t insns;                              /* Instructions stepped through */
+    uint64_t branches;                           /* Jumps and calls */
+    uint64_t taken;                              /* ...of which this many were taken */
+    uint64_t notTaken;
+    uint64_t calls;
+    uint64_t returns;                            /* Indirect branches back to a return address */
+    uint64_t indirect;                           /* Taken branches that needed an address in the trace */
+    uint64_t restarts;                           /* Times the code ran out, and was started again elsewhere */
+    uint64_t eatoms;                             /* Atoms (ETM) */
+    uint64_t natoms;
+    uint64_t addresses;                          /* Addresses put in the trace, including those in syncs */
+    uint64_t syncs;
+    uint64_t pairs;                              /* Source/destination pairs (MTB) */
+};
+
+static struct
+{
+    struct symbol *p;
+    csh h;
+    symbolMemaddr pc;                            /* Next instruction to run */
+    symbolMemaddr last;                          /* ...and the one that was run before it */
+
+    symbolMemaddr stack[MAX_DEPTH];              /* Return addresses pushed by calls */
+    unsigned int depth;
+
+    char *script;                                /* Branch outcomes to use... */
+    size_t scriptLen;
+    size_t scriptPos;                            /* ...and the next one */
+
+    uint8_t *t;                                  /* The trace, as it's generated */
+    size_t len;
+    size_t alloc;
+    size_t lastSync;                             /* Where the last sync was put in it */
+
+    uint32_t lastAddr;                           /* Last address given in the trace, which the next is relative to */
+    unsigned int eRun;                           /* E atoms waiting to be put in the trace */
+
+    struct truth g;                              /* What was traced */
+} _r;
+
+static struct truth _decoded;                    /* ...and what the decoder made of it */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Putting the trace together
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _put( const uint8_t *d, size_t len )
+
+{
+    if ( _r.len + len > _r.alloc )
+    {
+        _r.alloc = ( _r.alloc ) ? _r.alloc * 2 : 1024 * 1024;
+        _r.t = ( uint8_t * )realloc( _r.t, _r.alloc );
+        MEMCHECKV( _r.t );
+    }
+
+    memcpy( &_r.t[_r.len], d, len );
+    _r.len += len;
+}
+// ====================================================================================================
+static void _putc( uint8_t c )
+
+{
+    _put( &c, 1 );
+}
+// ====================================================================================================
+static void _put32( uint32_t w )
+
+{
+    uint8_t b[4] = { w, w >> 8, w >> 16, w >> 24 };
+    _put( b, sizeof( b ) );
+}
+// ====================================================================================================
+// ETM4
+// ====================================================================================================
+static void _etm4Flush( void )
+
+/* Put out the E atoms waiting, as a single format 6 atom packet if there's enough of them */
+
+{
+    if ( _r.eRun >= 3 )
+    {
+        _putc( 0xc0 | ( _r.eRun - 3 ) );       /* Format 6, all E */
+    }
+    else if ( _r.eRun == 2 )
+    {
+        _putc( 0xdb );                         /* Format 2, EE */
+    }
+    else if ( _r.eRun == 1 )
+    {
+        _putc( 0xf7 );                         /* Format 1, E */
+    }
+
+    _r.eRun = 0;
+}
+// ====================================================================================================
+static void _etm4Atom( bool e )
+
+{
+    if ( e )
+    {
+        if ( ++_r.eRun == 23 )
+        {
+            /* As many as format 6 can carry */
+            _etm4Flush();
+        }
+
+        return;
+    }
+
+    /* An N ends the run */
+    if ( _r.eRun >= 2 )
+    {
+        _putc( 0xe0 | ( _r.eRun + 1 - 3 ) );   /* Format 6, E...EN */
+    }
+    else if ( _r.eRun == 1 )
+    {
+        _putc( 0xd9 );                         /* Format 2, EN */
+    }
+    else
+    {
+        _putc( 0xf6 );                         /* Format 1, N */
+    }
+
+    _r.eRun = 0;
+}
+// ====================================================================================================
+static void _etm4Address( uint32_t a, bool full )
+
+/* A short address if only the bottom of it has changed, otherwise the whole thing */
+
+{
+    uint32_t diff = a ^ _r.lastAddr;
+
+    if ( ( !full ) && ( !( diff >> 16 ) ) )
+    {
+        bool second = ( 0 != ( diff >> 8 ) );
+        _putc( 0x96 );                         /* Short address, IS1 */
+        _putc( ( ( a >> 1 ) & 0x7f ) | ( second ? 0x80 : 0 ) );
+
+        if ( second )
+        {
+            _putc( a >> 8 );
+        }
+    }
+    else
+    {
+        _putc( 0x9b );                         /* Long address, 32 bit, IS1 */
+        _putc( ( a >> 1 ) & 0x7f );
+        _putc( a >> 8 );
+        _putc( a >> 16 );
+        _putc( a >> 24 );
+    }
+
+    _r.lastAddr = a;
+}
+// ====================================================================================================
+static void _etm4Sync( uint32_t a )
+
+/* A-Sync, then a Trace Info with nothing in it, which clears the address history, then where we are */
+
+{
+    static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x80, 0x01, 0x00 };
+
+    _etm4Flush();
+    _put( sync, sizeof( sync ) );
+    _etm4Address( a, true );
+}
+// ====================================================================================================
+// ETM3.5
+// ====================================================================================================
+static void _etm35Atoms( unsigned int n )
+
+/* Format 1 P-headers carry up to 15 E atoms, so put them out as they fill, keeping some back for an N */
+
+{
+    _r.eRun += n;
+
+    while ( _r.eRun > 15 )
+    {
+        _putc( 0x80 | ( 15 << 2 ) );
+        _r.eRun -= 15;
+    }
+}
+// ====================================================================================================
+static void _etm35Flush( bool withN )
+
+/* The E atoms waiting, with the N on the end if there is one */
+
+{
+    if ( ( _r.eRun ) || ( withN ) )
+    {
+        _putc( 0x80 | ( _r.eRun << 2 ) | ( withN ? 0x40 : 0 ) );
+    }
+
+    _r.eRun = 0;
+}
+// ====================================================================================================
+static void _etm35Address( uint32_t a )
+
+/* Branch address in the alternative encoding, with as many bytes as it takes to cover what's changed. */
+/* The first byte carries bits 6:1, bytes in the middle 7 bits each and the last 6, as there's no     */
+/* exception information following.                                                                 */
+
+{
+    uint32_t diff = ( a ^ _r.lastAddr ) & ~1;
+    int n = 1;
+
+    while ( ( n < 5 ) && ( diff >> ( ( n == 1 ) ? 7 : 7 * ( n - 1 ) + 6 ) ) )
+    {
+        n++;
+    }
+
+    _putc( 0x01 | ( a & 0x7e ) | ( ( n > 1 ) ? 0x80 : 0 ) );
+
+    for ( int k = 1; k < n; k++ )
+    {
+        bool end = ( k == n - 1 );
+        _putc( ( ( a >> ( 7 * k ) ) & ( end ? 0x3f : 0x7f ) ) | ( end ? 0 : 0x80 ) );
+    }
+
+    _r.lastAddr = a;
+}
+// ====================================================================================================
+static void _etm35Sync( uint32_t a )
+
+/* A-Sync, then an I-Sync with a Thumb address */
+
+{
+    static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0x80, 0x08, 0x00 };
+
+    _etm35Flush( false );
+    _put( sync, sizeof( sync ) );
+    _put32( a | 1 );
+    _r.lastAddr = a;
+}
+// ====================================================================================================
+// Protocol independent
+// ====================================================================================================
+static void _sync( void )
+
+{
+    _r.g.syncs++;
+    _r.g.addresses++;
+    _r.lastSync = _r.len;
+
+    if ( _options.prot == TRACE_PROT_ETM4 )
+    {
+        _etm4Sync( _r.pc );
+    }
+    else
+    {
+        _etm35Sync( _r.pc );
+    }
+}
+// ====================================================================================================
+static void _instructions( uint64_t n )
+
+/* n instructions that aren't branches were stepped through */
+
+{
+    _r.g.insns += n;
+
+    if ( _options.prot == TRACE_PROT_ETM35 )
+    {
+        /* Every instruction is an atom */
+        _etm35Atoms( n );
+        _r.g.eatoms += n;
+    }
+}
+// ====================================================================================================
+static void _branch( symbolMemaddr at, bool taken, symbolMemaddr to, bool needsAddr )
+
+/* The branch at at was, or wasn't, taken to to */
+
+{
+    _r.g.insns++;
+    _r.g.branches++;
+    _r.g.taken += taken;
+    _r.g.notTaken += !taken;
+    _r.g.indirect += needsAddr;
+
+    switch ( _options.prot )
+    {
+        case TRACE_PROT_ETM4:
+            taken ? _r.g.eatoms++ : _r.g.natoms++;
+            _etm4Atom( taken );
+
+            if ( needsAddr )
+            {
+                /* The address has to follow the atom for the branch straight away */
+                _etm4Flush();
+                _etm4Address( to, false );
+                _r.g.addresses++;
+            }
+
+            break;
+
+        case TRACE_PROT_ETM35:
+            taken ? _r.g.eatoms++ : _r.g.natoms++;
+
+            if ( !taken )
+            {
+                _etm35Flush( true );
+            }
+            else
+            {
+                _etm35Atoms( 1 );
+
+                if ( needsAddr )
+                {
+                    _etm35Flush( false );
+                    _etm35Address( to );
+                    _r.g.addresses++;
+                }
+            }
+
+            break;
+
+        case TRACE_PROT_MTB:
+
+            /* Only what's taken is recorded, and every one of those */
+            if ( taken )
+            {
+                _put32( at );
+                _put32( to );
+                _r.g.pairs++;
+            }
+
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Running the program
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _outcome( void )
+
+/* Is the next conditional branch taken? */
+
+{
+    if ( _r.script )
+    {
+        char c = _r.script[_r.scriptPos++ % _r.scriptLen];
+        return ( ( c == 'T' ) || ( c == 't' ) );
+    }
+
+    return ( ( unsigned int )( rand() % 100 ) < _options.taken );
+}
+// ====================================================================================================
+static symbolMemaddr _anywhere( void )
+
+/* The start of a function picked at random, for when there's no knowing where the flow goes */
+
+{
+    enum instructionClass ic;
+
+    for ( int tries = 0; tries < MAX_TRIES; tries++ )
+    {
+        struct symbolFunctionStore *f = symbolFunctionIndex( _r.p, rand() % _r.p->nfunc );
+
+        if ( ( f ) && ( symbolInsnAt( _r.p, f->lowaddr, &ic, NULL ) ) )
+        {
+            return f->lowaddr;
+        }
+    }
+
+    genericsExit( -1, "Couldn't find any code to run" EOL );
+    return NO_ADDRESS;
+}
+// ====================================================================================================
+static symbolMemaddr _startAt( void )
+
+/* Where to start, from -a as a function name or an address, or main if there is one */
+
+{
+    const char *name = ( _options.start ) ? _options.start : "main";
+    struct symbolFunctionStore *f;
+    char *e;
+
+    if ( _options.start )
+    {
+        unsigned long a = strtoul( _options.start, &e, 0 );
+
+        if ( ( e != _options.start ) && ( !*e ) )
+        {
+            return a & ~1;
+        }
+    }
+
+    for ( unsigned int i = 0; ( f = symbolFunctionIndex( _r.p, i ) ); i++ )
+    {
+        if ( !strcmp( symbolFunctionName( f, false ), name ) )
+        {
+            return f->lowaddr;
+        }
+    }
+
+    if ( _options.start )
+    {
+        genericsExit( -1, "Couldn't find function %s" EOL, _options.start );
+    }
+
+    return _anywhere();
+}
+// ====================================================================================================
+static enum branchKind _branchKind( symbolMemaddr a, symbolMemaddr *tableDest )
+
+/* Go to the disassembly for what the classification doesn't say, whether it's conditional or what */
+/* it is that a table branch goes to (taken as the first entry in its table, what else is there?)  */
+
+{
+    enum branchKind k = BK_ALWAYS;
+    symbolMemptr m = symbolCodeAt( _r.p, a, NULL );
+    cs_insn *insn;
+
+    if ( ( !m ) || ( !cs_disasm( _r.h, m, 4, a, 1, &insn ) ) )
+    {
+        return BK_ALWAYS;
+    }
+
+    switch ( insn->id )
+    {
+        case ARM_INS_ISB:
+        case ARM_INS_WFI:
+        case ARM_INS_WFE:
+            /* Classified with the branches, but the flow carries on after them */
+            k = BK_NOFLOW;
+            break;
+
+        case ARM_INS_CBZ:
+        case ARM_INS_CBNZ:
+            k = BK_COND;
+            break;
+
+        case ARM_INS_TBB:
+        case ARM_INS_TBH:
+            k = BK_TABLE;
+            *tableDest = NO_ADDRESS;
+
+            if ( ( strstr( insn->op_str, "[pc" ) ) && ( ( m = symbolCodeAt( _r.p, a + 4, NULL ) ) ) )
+            {
+                *tableDest = a + 4 + 2 * ( ( insn->id == ARM_INS_TBB ) ? m[0] : ( m[0] | ( m[1] << 8 ) ) );
+            }
+
+            break;
+
+        default:
+            k = ( insn->detail->arm.cc != ARM_CC_AL ) ? BK_COND : BK_ALWAYS;
+            break;
+    }
+
+    cs_free( insn, 1 );
+    return k;
+}
+// ====================================================================================================
+static void _restart( void )
+
+/* The code ran out, so start again somewhere else, as trace would after an overflow */
+
+{
+    symbolMemaddr from = _r.last;
+
+    _r.pc = _anywhere();
+    _r.depth = 0;
+    _r.g.restarts++;
+
+    if ( _options.prot == TRACE_PROT_MTB )
+    {
+        /* The run so far ends at the last instruction, and the new one is marked as a start of trace */
+        _put32( from );
+        _put32( _r.pc | 1 );
+        _r.g.pairs++;
+    }
+    else
+    {
+        _sync();
+    }
+}
+// ====================================================================================================
+static void _step( void )
+
+/* Run one basic block, through to the branch at the end of it */
+
+{
+    enum instructionClass ic;
+    symbolMemaddr to, b, tableDest = NO_ADDRESS;
+    uint64_t n = 0;
+    bool taken, needsAddr = false;
+
+    if ( ( b = symbolNextBranch( _r.p, _r.pc ) ) == NO_ADDRESS )
+    {
+        _restart();
+        return;
+    }
+
+    for ( symbolMemaddr a = _r.pc; a < b; a += ( ic & LE_IC_4BYTE ) ? 4 : 2 )
+    {
+        symbolInsnAt( _r.p, a, &ic, NULL );
+        _r.last = a;
+        n++;
+    }
+
+    _instructions( n );
+    symbolInsnAt( _r.p, b, &ic, &to );
+    symbolMemaddr next = b + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 );
+
+    switch ( _branchKind( b, &tableDest ) )
+    {
+        case BK_NOFLOW:
+            taken = false;
+            break;
+
+        case BK_COND:
+            taken = _outcome();
+            break;
+
+        case BK_TABLE:
+            taken = true;
+            needsAddr = true;
+            to = ( tableDest != NO_ADDRESS ) ? tableDest : _anywhere();
+            break;
+
+        default:
+            taken = true;
+            break;
+    }
+
+    if ( ( taken ) && ( !( ic & LE_IC_IMMEDIATE ) ) && ( !needsAddr ) )
+    {
+        /* Somewhere we only know from the trace...a return if it's not a call and there's one to go back to */
+        needsAddr = true;
+
+        if ( ( !( ic & LE_IC_CALL ) ) && ( _r.depth ) )
+        {
+            to = _r.stack[--_r.depth];
+            _r.g.returns++;
+        }
+        else
+        {
+            to = _anywhere();
+        }
+    }
+
+    if ( ( taken ) && ( ic & LE_IC_CALL ) )
+    {
+        if ( _r.depth == MAX_DEPTH )
+        {
+            /* Lose the oldest, like a return stack would */
+            memmove( &_r.stack[0], &_r.stack[1], sizeof( symbolMemaddr ) * ( MAX_DEPTH - 1 ) );
+            _r.depth--;
+        }
+
+        _r.stack[_r.depth++] = next;
+        _r.g.calls++;
+    }
+
+    _branch( b, taken, to, needsAddr );
+    _r.last = b;
+    _r.pc = ( taken ) ? to : next;
+
+    if ( !symbolInsnAt( _r.p, _r.pc, &ic, NULL ) )
+    {
+        /* Gone somewhere there's no code for */
+        _restart();
+    }
+    else if ( ( _options.prot != TRACE_PROT_MTB ) && ( _r.len - _r.lastSync >= SYNC_PERIOD ) )
+    {
+        _sync();
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Checking and writing it
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _checkCB( void *d )
+
+{
+    struct TRACEDecoder *t = ( struct TRACEDecoder * )d;
+    struct truth *o = &_decoded;
+    struct TRACECPUState *cpu = TRACECPUState( t );
+
+    if ( TRACEStateChanged( t, EV_CH_ENATOMS ) )
+    {
+        o->eatoms += cpu->eatoms;
+        o->natoms += cpu->natoms;
+    }
+
+    if ( TRACEStateChanged( t, EV_CH_LINEAR ) )
+    {
+        o->pairs++;
+    }
+
+    if ( TRACEStateChanged( t, EV_CH_ADDRESS ) )
+    {
+        o->addresses++;
+    }
+}
+// ====================================================================================================
+static bool _check( void )
+
+/* Decode what was generated, and see that what comes out is what went in */
+
+{
+    static struct TRACEDecoder t;
+    struct truth *o = &_decoded;
+    bool ok;
+
+    TRACEDecoderInit( &t, _options.prot, true, NULL );
+    TRACEDecoderForceSync( &t, false );
+    TRACEDecoderPump( &t, _r.t, _r.len, _checkCB, &t );
+    t.engine->destroy( t.engine );
+
+    if ( _options.prot == TRACE_PROT_MTB )
+    {
+        /* Each pair ends the run from the one before it, so the first doesn't make one */
+        ok = ( o->pairs + 1 == _r.g.pairs );
+        fprintf( stdout, "Check: %" PRIu64 " runs decoded, %" PRIu64 " expected...%s" EOL, o->pairs, _r.g.pairs - 1, ok ? "OK" : "*********FAILED" );
+    }
+    else
+    {
+        /* The last atoms may still be waiting in the decoder for a packet that never came */
+        ok = ( o->eatoms == _r.g.eatoms ) && ( o->natoms == _r.g.natoms ) && ( o->addresses == _r.g.addresses );
+        fprintf( stdout, "Check: %" PRIu64 "/%" PRIu64 " E/N atoms and %" PRIu64 " addresses decoded, %" PRIu64 "/%" PRIu64 " and %" PRIu64 " expected...%s" EOL,
+                 o->eatoms, o->natoms, o->addresses, _r.g.eatoms, _r.g.natoms, _r.g.addresses, ok ? "OK" : "*********FAILED" );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+static void _writeTPIU( FILE *f )
+
+/* In frames with an ID change at the start, then 14 bytes of data with the low bit of those in even */
+/* positions moved to the auxiliary byte. The last frame is filled out with stream 0, which is null. */
+
+{
+    static const uint8_t sync[] = { 0xff, 0xff, 0xff, 0x7f };
+    uint8_t fr[TPIU_PACKET_LEN];
+    size_t rp = 0;
+    int frames = 0;
+
+    while ( rp < _r.len )
+    {
+        if ( !( frames++ % TPIU_SYNC_EVERY ) )
+        {
+            fwrite( sync, 1, sizeof( sync ), f );
+        }
+
+        memset( fr, 0, sizeof( fr ) );
+        fr[0] = ( _options.tag << 1 ) | 1;
+
+        for ( int i = 1; ( i < TPIU_PACKET_LEN - 1 ) && ( rp < _r.len ); i++ )
+        {
+            if ( ( !( i & 1 ) ) && ( i < TPIU_PACKET_LEN - 2 ) && ( rp + 1 == _r.len ) )
+            {
+                /* Change to the null stream, but only after the last byte, which has to go in the odd one */
+                fr[i] = ( 0 << 1 ) | 1;
+                fr[i + 1] = _r.t[rp++];
+                fr[TPIU_PACKET_LEN - 1] |= 1 << ( i / 2 );
+                break;
+            }
+
+            uint8_t d = _r.t[rp++];
+
+            if ( i & 1 )
+            {
+                fr[i] = d;
+            }
+            else
+            {
+                fr[i] = d & 0xfe;
+                fr[TPIU_PACKET_LEN - 1] |= ( d & 1 ) << ( i / 2 );
+            }
+
+            if ( ( rp == _r.len ) && ( i & 1 ) && ( i < TPIU_PACKET_LEN - 2 ) )
+            {
+                /* Change to the null stream at once, the rest of the frame is empty */
+                fr[i + 1] = ( 0 << 1 ) | 1;
+            }
+        }
+
+        fwrite( fr, 1, sizeof( fr ), f );
+    }
+}
+// ====================================================================================================
+static void _writeOFLOW( FILE *f )
+
+{
+    static struct Frame o;
+
+    for ( size_t rp = 0; rp < _r.len; rp += OFLOW_CHUNK )
+    {
+        OFLOWEncode( _options.tag, 0, &_r.t[rp], ( _r.len - rp > OFLOW_CHUNK ) ? OFLOW_CHUNK : _r.len - rp, &o );
+        fwrite( o.d, 1, o.len, f );
+    }
+}
+// ====================================================================================================
+static void _writeTruth( FILE *f )
+
+{
+    const struct truth *g = &_r.g;
+
+    fprintf( f, "protocol     %s" EOL, TRACEDecodeGetProtocolName( _options.prot ) );
+    fprintf( f, "wrapping     %s" EOL, _wrapName[_options.wrap] );
+    fprintf( f, "seed         %u" EOL, _options.seed );
+    fprintf( f, "bytes        %zu" EOL, _r.len );
+    fprintf( f, "instructions %" PRIu64 EOL, g->insns );
+    fprintf( f, "branches     %" PRIu64 EOL, g->branches );
+    fprintf( f, "taken        %" PRIu64 EOL, g->taken );
+    fprintf( f, "nottaken     %" PRIu64 EOL, g->notTaken );
+    fprintf( f, "calls        %" PRIu64 EOL, g->calls );
+    fprintf( f, "returns      %" PRIu64 EOL, g->returns );
+    fprintf( f, "indirect     %" PRIu64 EOL, g->indirect );
+    fprintf( f, "restarts     %" PRIu64 EOL, g->restarts );
+    fprintf( f, "eatoms       %" PRIu64 EOL, g->eatoms );
+    fprintf( f, "natoms       %" PRIu64 EOL, g->natoms );
+    fprintf( f, "addresses    %" PRIu64 EOL, g->addresses );
+    fprintf( f, "syncs        %" PRIu64 EOL, g->syncs );
+    fprintf( f, "pairs        %" PRIu64 EOL, g->pairs );
+}
+// ====================================================================================================
+static void _loadScript( void )
+
+{
+    FILE *f = fopen( _options.script, "r" );
+    int c;
+
+    if ( !f )
+    {
+        genericsExit( -1, "Couldn't open script %s" EOL, _options.script );
+    }
+
+    size_t alloc = 0;
+
+    while ( ( c = fgetc( f ) ) != EOF )
+    {
+        if ( ( c == 'T' ) || ( c == 't' ) || ( c == 'N' ) || ( c == 'n' ) )
+        {
+            if ( _r.scriptLen == alloc )
+            {
+                alloc = alloc ? alloc * 2 : 256;
+                _r.script = ( char * )realloc( _r.script, alloc );
+                MEMCHECKV( _r.script );
+            }
+
+            _r.script[_r.scriptLen++] = c;
+        }
+    }
+
+    fclose( f );
+
+    if ( !_r.scriptLen )
+    {
+        genericsExit( -1, "No T or N outcomes in script %s" EOL, _options.script );
+    }
+}
+// ====================================================================================================
+static void _usage( const char *name )
+
+{
+    fprintf( stderr, "Usage: %s -e file.elf -o trace.bin [-a start] [-b taken%%] [-c] [-g truth] [-n insns] [-P proto] [-s seed] [-t tag] [-w wrap] [-x script]" EOL, name );
+    fprintf( stderr, "    -a: Function or address to start running from (default main)" EOL );
+    fprintf( stderr, "    -b: Percentage of conditional branches that are taken (default %u)" EOL, _options.taken );
+    fprintf( stderr, "    -c: Check the trace by decoding it again" EOL );
+    fprintf( stderr, "    -e: Image to run" EOL );
+    fprintf( stderr, "    -g: File to write the ground truth to" EOL );
+    fprintf( stderr, "    -n: Instructions to run for (default %" PRIu64 ")" EOL, _options.insns );
+    fprintf( stderr, "    -o: File to write the trace to" EOL );
+    fprintf( stderr, "    -P: { " );
+
+    for ( int i = TRACE_PROT_LIST_START; i < TRACE_PROT_NUM; i++ )
+    {
+        fprintf( stderr, "%s ", TRACEDecodeGetProtocolName( i ) );
+    }
+
+    fprintf( stderr, "} trace protocol to generate (default %s)" EOL, TRACEDecodeGetProtocolName( _options.prot ) );
+    fprintf( stderr, "    -s: Seed for the branch outcomes (default %u)" EOL, _options.seed );
+    fprintf( stderr, "    -t: OFLOW stream or TPIU channel to put the trace in (default %d)" EOL, _options.tag );
+    fprintf( stderr, "    -w: { none tpiu oflow } what to wrap the trace in (default none)" EOL );
+    fprintf( stderr, "    -x: File of T and N outcomes for the conditional branches in turn, used over and over" EOL );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    FILE *f;
+    int ch;
+
+    while ( ( ch = getopt( argc, argv, "a:b:ce:g:hn:o:P:s:t:w:x:" ) ) != -1 )
+    {
+        switch ( ch )
+        {
+            case 'a':
+                _options.start = optarg;
+                break;
+
+            case 'b':
+                _options.taken = atoi( optarg );
+                break;
+
+            case 'c':
+                _options.check = true;
+                break;
+
+            case 'e':
+                _options.elf = optarg;
+                break;
+
+            case 'g':
+                _options.truth = optarg;
+                break;
+
+            case 'n':
+                _options.insns = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 'o':
+                _options.out = optarg;
+                break;
+
+            case 'P':
+                for ( _options.prot = TRACE_PROT_LIST_START;
+                        ( ( _options.prot != TRACE_PROT_NUM ) && strcasecmp( optarg, TRACEDecodeGetProtocolName( _options.prot ) ) );
+                        _options.prot++ )
+                {}
+
+                if ( _options.prot == TRACE_PROT_NUM )
+                {
+                    genericsExit( -1, "Unrecognised trace protocol %s" EOL, optarg );
+                }
+
+                break;
+
+            case 's':
+                _options.seed = atoi( optarg );
+                break;
+
+            case 't':
+                _options.tag = atoi( optarg );
+                break;
+
+            case 'w':
+                for ( _options.wrap = WRAP_NONE; ( _wrapName[_options.wrap] ) && ( strcasecmp( optarg, _wrapName[_options.wrap] ) ); _options.wrap++ )
+                {}
+
+                if ( !_wrapName[_options.wrap] )
+                {
+                    genericsExit( -1, "Unrecognised wrapping %s" EOL, optarg );
+                }
+
+                break;
+
+            case 'x':
+                _options.script = optarg;
+                break;
+
+            default:
+                _usage( argv[0] );
+                return ( ch == 'h' ) ? 0 : -1;
+        }
+    }
+
+    if ( ( !_options.elf ) || ( !_options.out ) )
+    {
+        _usage( argv[0] );
+        return -1;
+    }
+
+    if ( ( _options.taken > 100 ) || ( _options.tag < 0 ) || ( _options.tag > 0x7f ) )
+    {
+        genericsExit( -1, "Taken percentage or tag out of range" EOL );
+    }
+
+    if ( !( _r.p = symbolAcquire( _options.elf, true, false ) ) )
+    {
+        genericsExit( -1, "Couldn't load %s" EOL, _options.elf );
+    }
+
+    if ( ( !_r.p->nfunc ) || ( !symbolDisassemblerOpen( &_r.h ) ) )
+    {
+        genericsExit( -1, "Nothing in %s to run" EOL, _options.elf );
+    }
+
+    if ( _options.script )
+    {
+        _loadScript();
+    }
+
+    srand( _options.seed );
+    _r.pc = _startAt();
+
+    if ( _options.prot == TRACE_PROT_MTB )
+    {
+        /* Only the destination of the first pair counts, marked as a start of trace */
+        _put32( 0 );
+        _put32( _r.pc | 1 );
+        _r.g.pairs++;
+    }
+    else
+    {
+        _sync();
+    }
+
+    while ( _r.g.insns < _options.insns )
+    {
+        _step();
+    }
+
+    /* Anything still waiting */
+    if ( _options.prot == TRACE_PROT_ETM4 )
+    {
+        _etm4Flush();
+    }
+    else if ( _options.prot == TRACE_PROT_ETM35 )
+    {
+        _etm35Flush( false );
+    }
+
+    bool ok = ( !_options.check ) || _check();
+
+    if ( !( f = fopen( _options.out, "wb" ) ) )
+    {
+        genericsExit( -1, "Couldn't create %s" EOL, _options.out );
+    }
+
+    switch ( _options.wrap )
+    {
+        case WRAP_TPIU:
+            _writeTPIU( f );
+            break;
+
+        case WRAP_OFLOW:
+            _writeOFLOW( f );
+            break;
+
+        default:
+            fwrite( _r.t, 1, _r.len, f );
+            break;
+    }
+
+    fclose( f );
+
+    if ( _options.truth )
+    {
+        if ( !( f = fopen( _options.truth, "w" ) ) )
+        {
+            genericsExit( -1, "Couldn't create %s" EOL, _options.truth );
+        }
+
+        _writeTruth( f );
+        fclose( f );
+    }
+
+    _writeTruth( stdout );
+    cs_close( &_r.h );
+    symbolDelete( _r.p );
+    free( _r.t );
+    free( _r.script );
+    return ok ? 0 : -1;
+}
+// ====================================================================================================
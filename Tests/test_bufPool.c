@@ -0,0 +1,89 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/bufPool.c Src/generics.c Tests/test_bufPool.c -IInc -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Checks that buffers of all sizes come back aligned as asked, zeroed and usable end to end, for
+ * each of the ways of asking for them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bufPool.h"
+
+// ====================================================================================================
+
+static int _run( const char *name, uint32_t flags, size_t align )
+
+{
+    static const size_t sizes[] = { 1, 63, 64, 4095, 65536, 2 * 1024 * 1024, 5 * 1024 * 1024 + 17 };
+    void *b[sizeof( sizes ) / sizeof( sizes[0] )];
+    int fails = 0;
+
+    for ( int i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ )
+    {
+        uint8_t *p = b[i] = bufPoolAlloc( sizes[i], flags );
+        size_t nz = 0;
+
+        if ( !p )
+        {
+            fprintf( stderr, "%s: %zu bytes *********FAILED to allocate\n", name, sizes[i] );
+            fails++;
+            continue;
+        }
+
+        for ( size_t j = 0; j < sizes[i]; j++ )
+        {
+            nz += ( p[j] != 0 );
+        }
+
+        memset( p, 0xa5, sizes[i] );
+
+        fprintf( stderr, "%s: %zu bytes in %s: ", name, sizes[i], bufPoolBacking( p ) );
+
+        if ( ( ( uintptr_t )p % align ) || ( nz ) )
+        {
+            fprintf( stderr, "*********FAILED (%s)\n", ( nz ) ? "not zeroed" : "misaligned" );
+            fails++;
+        }
+        else
+        {
+            fprintf( stderr, "OK\n" );
+        }
+    }
+
+    /* ...and they all go back, in a different order to that they came */
+    for ( int i = sizeof( sizes ) / sizeof( sizes[0] ); i--; )
+    {
+        bufPoolFree( b[i] );
+    }
+
+    return fails;
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    int fails = 0;
+
+    fails += _run( "Cache aligned", 0, BUFPOOL_CACHE_LINE );
+    fails += _run( "Page aligned", BUFPOOL_PAGE_ALIGN, sysconf( _SC_PAGESIZE ) );
+    fails += _run( "Huge", BUFPOOL_HUGE, BUFPOOL_CACHE_LINE );
+    fails += _run( "Huge, page aligned", BUFPOOL_HUGE | BUFPOOL_PAGE_ALIGN, sysconf( _SC_PAGESIZE ) );
+    bufPoolFree( NULL );
+
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
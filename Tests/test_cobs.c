@@ -167,7 +167,7 @@ int main( int argc, void **argv )
     for ( int i = 0; i < sizeof( testSet ) / sizeof( struct test ); i++ )
     {
         fprintf( stderr, "%d: ", i + 1 );
-        COBSEncode( NULL, 0, testSet[i].dec.d, testSet[i].dec.len, &o );
+        COBSEncode( NULL, 0, NULL, 0, testSet[i].dec.d, testSet[i].dec.len, &o );
 
         if ( o.len != COBSgetFrameExtent( o.d, o.len ) - o.d + 1 )
         {
@@ -211,7 +211,7 @@ int main( int argc, void **argv )
             ipPacket[i] = random() % 256;
         }
 
-        COBSEncode( NULL, 0, ipPacket, TEST_PACKET_LEN, &opFrame );
+        COBSEncode( NULL, 0, NULL, 0, ipPacket, TEST_PACKET_LEN, &opFrame );
 
         if ( COBSSimpleDecode( opFrame.d, opFrame.len, &d->f ) )
         {
@@ -0,0 +1,171 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/traceDecoder.c Src/traceDecoder_etm35.c Src/traceDecoder_etm4.c Src/traceDecoder_mtb.c Src/generics.c Src/statsRegistry.c Tests/test_etm35.c -IInc -include uicolours_default.h -ggdb -lpthread
+ * Execute with;
+ * ./a.out
+ *
+ * Checks that the ETM3.5 fast path reports exactly the same events as the byte-at-a-time state machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "traceDecoder.h"
+
+#define TEST_LEN   (4*1024*1024)
+#define MAX_EVENTS (1024)
+
+static uint8_t _d[TEST_LEN];
+
+// ====================================================================================================
+static int _addPacket( uint8_t *p )
+
+/* Something that looks rather like a real trace stream, P-headers and branches for the most part */
+
+{
+    int r = rand() % 100;
+    int n = 0;
+
+    if ( r < 55 )
+    {
+        /* P-header, either format */
+        p[n++] = 0x80 | ( rand() & 0x7e );
+    }
+    else if ( r < 85 )
+    {
+        /* Branch address, of random length and with an occasional zero to end it */
+        p[n++] = 0x01 | ( rand() & 0xfe );
+
+        while ( ( p[n - 1] & 0x80 ) && ( n < 6 ) )
+        {
+            p[n++] = ( rand() % 10 ) ? rand() & 0xff : 0;
+        }
+    }
+    else if ( r < 88 )
+    {
+        /* A-Sync */
+        n = 5 + rand() % 3;
+        memset( p, 0, n );
+        p[n++] = 0x80;
+    }
+    else if ( r < 92 )
+    {
+        /* I-Sync, with info byte and address */
+        p[n++] = 0x08;
+        p[n++] = rand() & 0xff;
+
+        for ( int i = 0; i < 4; i++ )
+        {
+            p[n++] = rand() & 0xff;
+        }
+    }
+    else
+    {
+        /* ...and anything else at all */
+        p[n++] = rand() & 0xff;
+    }
+
+    return n;
+}
+// ====================================================================================================
+static int _compare( const struct TRACEEvent *a, const struct TRACEEvent *b )
+
+{
+    return ( a->changes != b->changes ) || ( a->addr != b->addr ) || ( a->disposition != b->disposition ) ||
+           ( a->eatoms != b->eatoms ) || ( a->natoms != b->natoms ) || ( a->exception != b->exception ) ||
+           ( a->instCount != b->instCount ) || ( a->ts != b->ts ) || ( a->cycleCount != b->cycleCount );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    static struct TRACEEvent ref[MAX_EVENTS], got[MAX_EVENTS];
+    struct TRACEDecoder r, f;
+    int rpos = 0, fpos = 0, rn, fn, consumed, len = 0;
+    long events = 0;
+    int fails = 0;
+
+    srand( 1 );
+
+    while ( len < TEST_LEN - 16 )
+    {
+        len += _addPacket( &_d[len] );
+    }
+
+    for ( int alt = 0; alt < 2; alt++ )
+    {
+        TRACEDecoderInit( &r, TRACE_PROT_ETM35, alt, NULL );
+        TRACEDecoderInit( &f, TRACE_PROT_ETM35, alt, NULL );
+        TRACEDecoderForceSync( &r, true );
+        TRACEDecoderForceSync( &f, true );
+
+        /* The reference decoder only gets to use the state machine */
+        r.engine->actionRun = NULL;
+        rpos = fpos = 0;
+
+        while ( ( rpos < len ) && ( !fails ) )
+        {
+            rn = TRACEDecoderPumpEvents( &r, &_d[rpos], len - rpos, ref, MAX_EVENTS, &consumed );
+            rpos += consumed;
+
+            /* Feed the fast decoder in odd sized lumps, so packets get split across calls */
+            fn = 0;
+
+            /* ...and when the reference ran out of data, the fast one should too, with nothing more to say */
+            while ( ( fn < rn ) || ( ( rpos == len ) && ( fpos < len ) && ( fn < MAX_EVENTS ) ) )
+            {
+                int l = 1 + rand() % 64;
+
+                if ( fpos + l > len )
+                {
+                    l = len - fpos;
+                }
+
+                if ( !l )
+                {
+                    break;
+                }
+
+                int g = TRACEDecoderPumpEvents( &f, &_d[fpos], l, &got[fn], ( ( rpos == len ) ? MAX_EVENTS : rn ) - fn, &consumed );
+                fpos += consumed;
+                fn += g;
+            }
+
+            if ( ( fn != rn ) || ( fpos != rpos ) )
+            {
+                fprintf( stderr, "Event count %d/%d or position %d/%d differ\n", fn, rn, fpos, rpos );
+                fails++;
+                break;
+            }
+
+            for ( int i = 0; i < rn; i++ )
+            {
+                if ( _compare( &ref[i], &got[i] ) )
+                {
+                    if ( fails++ < 10 )
+                    {
+                        fprintf( stderr, "Event at %d differs: changes %08x/%08x addr %08x/%08x instCount %lu/%lu\n",
+                                 rpos, ref[i].changes, got[i].changes, ( uint32_t )ref[i].addr, ( uint32_t )got[i].addr,
+                                 ( unsigned long )ref[i].instCount, ( unsigned long )got[i].instCount );
+                    }
+                }
+            }
+
+            events += rn;
+        }
+    }
+
+    fprintf( stderr, "%ld events compared\n", events );
+    fprintf( stderr, "%s\n", fails ? "*********FAILED" : "OK" );
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
@@ -0,0 +1,121 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/fmtProgram.c Src/generics.c Tests/test_fmtProgram.c -IInc -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Checks that compiled channel formats give exactly what formatting with snprintf always gave.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "fmtProgram.h"
+
+#define TEST_VALUES (200000)
+#define OP_LEN      (64)
+
+static const char *_formats[] =
+{
+    "%08x\n", "%x", "%X", "%8x", "%-8x|", "%u", "%d", "%i", "%5d", "%-5d|", "%05d", "%010u", "%12d",
+    "V=%d (0x%08X) %u\n", "%c", "[%c]", "%3c", "%-3c|", "%02x ", "%d%%", "%%%x%%", "no conversion",
+    "%+d", "% d", "%#x", "%.3d", "%o", "%f\n", "%8.3f", "%f %e %g", "%d %d %d %d", "%d %d %d %d %d",
+    "%ld", "%*d", "%c%c", "%s", "", "%64d", "%65d", "%c = %02x\n",
+    NULL
+};
+
+// ====================================================================================================
+static size_t _reference( const char *fmt, uint32_t value, int len, char *o, size_t max )
+
+/* How channel formats have always been applied */
+
+{
+    int n;
+
+    if ( strstr( fmt, "%f" ) )
+    {
+        float *nastycast = ( float * )&value;
+        n = snprintf( o, max, fmt, *nastycast, *nastycast, *nastycast, *nastycast );
+    }
+    else if ( strstr( fmt, "%c" ) )
+    {
+        uint8_t op[4] = {value & 0xff, ( value >> 8 ) & 0xff, ( value >> 16 ) & 0xff, ( value >> 24 ) & 0xff};
+        int l = 0;
+        n = 0;
+
+        do
+        {
+            n += snprintf( &o[n], max - n, fmt, op[l], op[l], op[l] );
+        }
+        while ( ( ++l < len ) && ( ( size_t )n < max ) );
+    }
+    else
+    {
+        n = snprintf( o, max, fmt, value, value, value, value );
+    }
+
+    return ( ( size_t )n < max ) ? n : max - 1;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    char ref[OP_LEN], got[OP_LEN];
+    size_t rl, gl, max;
+    int fails = 0;
+
+    srand( 1 );
+
+    for ( const char **f = _formats; *f; f++ )
+    {
+        /* Formats that would take anything other than a number aren't worth comparing */
+        if ( strstr( *f, "%s" ) || strstr( *f, "%*" ) || strstr( *f, "%l" ) || strstr( *f, "%d %d %d %d %d" ) )
+        {
+            continue;
+        }
+
+        struct fmtProgram *p = fmtProgramCompile( *f );
+
+        for ( int i = 0; i < TEST_VALUES; i++ )
+        {
+            uint32_t v = ( i < 16 ) ? ( ( i & 1 ) ? 0x80000000u >> ( i / 2 ) : i ) : ( ( uint32_t )rand() << 16 ) ^ rand();
+            int len = 1 + rand() % 4;
+
+            /* Make sure output gets cut short some of the time too */
+            max = ( i % 8 ) ? OP_LEN : 1 + rand() % 12;
+
+            if ( strstr( *f, "%f" ) || strstr( *f, "%e" ) )
+            {
+                /* Keep floats to numbers, NaNs print the same but aren't interesting */
+                float x = ( float )( ( int32_t )v ) / ( 1 + rand() % 1000 );
+                memcpy( &v, &x, sizeof( v ) );
+            }
+
+            rl = _reference( *f, v, len, ref, max );
+            gl = fmtProgramRun( p, v, len, got, max );
+
+            if ( ( rl != gl ) || memcmp( ref, got, rl ) )
+            {
+                if ( fails++ < 10 )
+                {
+                    fprintf( stderr, "Format \"%s\" value %08x len %d max %zu: expected \"%.*s\" got \"%.*s\"\n", *f, v, len, max, ( int )rl, ref, ( int )gl, got );
+                }
+            }
+        }
+
+        fmtProgramFree( p );
+    }
+
+    fprintf( stderr, "%s\n", fails ? "*********FAILED" : "OK" );
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
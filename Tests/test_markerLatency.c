@@ -0,0 +1,95 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/markerLatency.c Src/latencyHist.c Src/generics.c Tests/test_markerLatency.c -IInc -IInc/external -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Feeds software writes and timestamps as the ITM decoder would give them, and checks the latencies
+ * that come out, including markers held for the timestamp that follows them, overruns and strays,
+ * a marker that's both start and stop, and a reset after an overflow.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "markerLatency.h"
+
+static int _fails;
+
+// ====================================================================================================
+static void _check( const char *what, bool ok )
+
+{
+    fprintf( stderr, "%-28s %s\n", what, ok ? "OK" : "*********FAILED" );
+    _fails += !ok;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct markerLatency *m = markerLatencyCreate();
+    struct markerLatencyStats s;
+
+    _check( "Bad spec refused", ( !markerLatencyAdd( m, "3:1" ) ) && ( !markerLatencyAdd( m, "300,4" ) ) && ( !markerLatencyAdd( m, "3,4x" ) ) );
+    _check( "Pairs added", ( markerLatencyAdd( m, "isr=3:1,4:1" ) ) && ( markerLatencyAdd( m, "5,5" ) ) && ( markerLatencyNumPairs( m ) == 2 ) );
+    _check( "Names", ( !strcmp( markerLatencyName( m, 0 ), "isr" ) ) && ( !strcmp( markerLatencyName( m, 1 ), "5,5" ) ) );
+
+    /* Each timestamp follows what it times */
+    markerLatencySW( m, 3, 1 );
+    markerLatencyTS( m, 100 );
+    markerLatencySW( m, 3, 2 );                       /* Wrong value, so ignored */
+    markerLatencySW( m, 4, 1 );
+    markerLatencyTS( m, 250 );
+    markerLatencyTake( m, 0, &s );
+    _check( "Start to stop", ( s.count == 1 ) && ( s.max == 250 ) && ( s.total == 1 ) && ( !s.overruns ) && ( !s.strays ) );
+
+    /* A second start doesn't move the first, and a stop with nothing open is a stray */
+    markerLatencySW( m, 3, 1 );
+    markerLatencyTS( m, 10 );
+    markerLatencySW( m, 3, 1 );
+    markerLatencyTS( m, 20 );
+    markerLatencySW( m, 4, 1 );
+    markerLatencySW( m, 4, 1 );
+    markerLatencyTS( m, 30 );
+    markerLatencyTake( m, 0, &s );
+    _check( "Overrun and stray", ( s.count == 1 ) && ( s.max == 50 ) && ( s.overruns == 1 ) && ( s.strays == 1 ) && ( s.worst == 250 ) );
+
+    /* The same marker at both ends times from one to the next */
+    for ( int i = 0; i < 11; i++ )
+    {
+        markerLatencySW( m, 5, i );
+        markerLatencyTS( m, 1000 );
+    }
+
+    markerLatencyTake( m, 1, &s );
+    _check( "Period", ( s.count == 10 ) && ( s.max == 1000 ) && ( s.p50 == 1000 ) && ( s.strays == 1 ) );
+
+    /* After an overflow an open start is forgotten */
+    markerLatencySW( m, 3, 1 );
+    markerLatencyTS( m, 5 );
+    markerLatencyReset( m );
+    markerLatencySW( m, 4, 1 );
+    markerLatencyTS( m, 5 );
+    markerLatencyTake( m, 0, &s );
+    _check( "Reset", ( s.count == 0 ) && ( s.strays == 2 ) );
+
+    /* What's taken is only since last time */
+    markerLatencyTake( m, 1, &s );
+    _check( "Taken is reset", ( s.count == 0 ) && ( s.total == 10 ) );
+
+    _check( "Timed", markerLatencyTimed( m ) );
+    markerLatencyDelete( m );
+    return _fails ? -1 : 0;
+}
+// ====================================================================================================
@@ -0,0 +1,98 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/memAccount.c Src/generics.c Tests/test_memAccount.c -IInc -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Allocates, grows and frees against a couple of subsystems and checks live and peak follow, that
+ * one subsystem's use doesn't show up in another's, and that a limit stops allocations going over it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "memAccount.h"
+
+#define BLOCKS (100)
+
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    void *b[BLOCKS];
+    struct memUse u, o;
+    char report[256];
+    uint64_t peak;
+    bool ok = true;
+
+    for ( int i = 0; i < BLOCKS; i++ )
+    {
+        b[i] = memAlloc( MEM_ADDRESSES, 1000 );
+    }
+
+    b[0] = memRealloc( MEM_ADDRESSES, b[0], 100000 );
+    memGetUse( MEM_ADDRESSES, &u );
+    peak = u.peak;
+
+    if ( ( u.live < 99 * 1000 + 100000 ) || ( u.peak != u.live ) )
+    {
+        fprintf( stderr, "Allocation not counted: " );
+        ok = false;
+    }
+
+    for ( int i = 0; i < BLOCKS; i++ )
+    {
+        memFree( MEM_ADDRESSES, b[i] );
+    }
+
+    memGetUse( MEM_ADDRESSES, &u );
+    memGetUse( MEM_CALLS, &o );
+
+    if ( ( u.live ) || ( u.peak != peak ) || ( o.peak ) )
+    {
+        fprintf( stderr, "Free not counted: " );
+        ok = false;
+    }
+
+    /* Only a little over 10K of lines allowed, so the second block can't be had */
+    if ( ( !memSetLimits( "lines=10K,calls=1M" ) ) || ( memSetLimits( "nothing=1K" ) ) || ( memSetLimits( "lines=lots" ) ) )
+    {
+        fprintf( stderr, "Limits not parsed: " );
+        ok = false;
+    }
+
+    memGetUse( MEM_CALLS, &o );
+    b[0] = memCalloc( MEM_LINES, 1, 8000 );
+    b[1] = memAlloc( MEM_LINES, 8000 );
+
+    if ( ( !b[0] ) || ( b[1] ) || ( o.limit != 1024 * 1024 ) )
+    {
+        fprintf( stderr, "Limit not held: " );
+        ok = false;
+    }
+
+    memFree( MEM_LINES, b[0] );
+    memSetLimit( MEM_LINES, 0 );
+    b[1] = memStrdup( MEM_LINES, "Now there's no limit" );
+    memReport( report, sizeof( report ) );
+    fprintf( stderr, "%s, ", report );
+
+    if ( ( !b[1] ) || ( strcmp( b[1], "Now there's no limit" ) ) || ( !strstr( report, "addresses=0/" ) ) || ( strstr( report, "calls" ) ) )
+    {
+        fprintf( stderr, "Report wrong: " );
+        ok = false;
+    }
+
+    memFree( MEM_LINES, b[1] );
+    fprintf( stderr, "%s\n", ( ok ) ? "OK" : "*********FAILED" );
+    return ok ? 0 : 1;
+}
+// ====================================================================================================
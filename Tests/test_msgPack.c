@@ -0,0 +1,126 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/msgDecoder.c Src/generics.c Tests/test_msgPack.c -IInc -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Packs messages of every type, filled with random field values, and checks that each one unpacks
+ * back to exactly what went in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msgDecoder.h"
+
+#define TEST_MSGS (100000)
+
+// ====================================================================================================
+
+static void _fill( struct msg *m, enum MSGType t )
+
+/* Build a message of type t, with every field it uses set to something random */
+
+{
+    memset( m, 0, sizeof( struct msg ) );
+    m->genericMsg.msgtype = t;
+    m->genericMsg.ts = ( ( uint64_t )rand() << 32 ) ^ rand();
+
+    switch ( t )
+    {
+        case MSG_SOFTWARE:
+            m->swMsg.srcAddr = rand();
+            m->swMsg.len = 1 + rand() % 4;
+            m->swMsg.value = rand();
+            break;
+
+        case MSG_NISYNC:
+            m->nisyncMsg.type = rand();
+            m->nisyncMsg.addr = rand();
+            break;
+
+        case MSG_OSW:
+            m->oswMsg.comp = rand();
+            m->oswMsg.offset = rand();
+            break;
+
+        case MSG_DATA_ACCESS_WP:
+            m->wptMsg.comp = rand();
+            m->wptMsg.data = rand();
+            break;
+
+        case MSG_DATA_RWWP:
+            m->watchMsg.comp = rand();
+            m->watchMsg.isWrite = rand() & 1;
+            m->watchMsg.data = rand();
+            break;
+
+        case MSG_PC_SAMPLE:
+            m->pcSampleMsg.sleep = rand() & 1;
+            m->pcSampleMsg.pc = rand();
+            break;
+
+        case MSG_DWT_EVENT:
+            m->dwtMsg.event = rand();
+            break;
+
+        case MSG_EXCEPTION:
+            m->excMsg.exceptionNumber = rand() % 512;
+            m->excMsg.eventType = rand() % 4;
+            break;
+
+        case MSG_TS:
+            ( ( struct TSMsg * )m )->timeStatus = rand() % 4;
+            ( ( struct TSMsg * )m )->timeInc = rand();
+            break;
+
+        case MSG_GTS:
+            m->gtsMsg.high = rand() & 1;
+            m->gtsMsg.wrap = rand() & 1;
+            m->gtsMsg.clkch = rand() & 1;
+            m->gtsMsg.len = rand() % 7;
+            m->gtsMsg.bits = ( ( uint64_t )rand() << 31 | rand() ) & 0x3fffffffffULL;
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    struct msg in, out;
+    struct msgPacked p;
+    int fails = 0;
+
+    srand( 1 );
+
+    for ( int i = 0; i < TEST_MSGS; i++ )
+    {
+        _fill( &in, rand() % MSG_NUM_MSGS );
+        msgPack( &in, &p );
+        msgUnpack( &p, &out );
+
+        if ( memcmp( &in, &out, sizeof( struct msg ) ) )
+        {
+            fprintf( stderr, "Message type %d *********FAILED\n", in.genericMsg.msgtype );
+            fails++;
+        }
+    }
+
+    fprintf( stderr, "%d messages in %zu bytes each, %zu unpacked: %s\n", TEST_MSGS, sizeof( struct msgPacked ),
+             sizeof( struct msg ), ( fails ) ? "*********FAILED" : "OK" );
+
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
@@ -0,0 +1,408 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc Src/oflow.c Src/oflowMerge.c Src/oflowSplit.c Src/cobs.c Src/simd.c Src/generics.c Src/statsRegistry.c Src/stream_file_posix.c Src/stream_archive.c Tests/test_oflow.c -IInc -include uicolours_default.h -ggdb -lpthread -lz
+ * Execute with;
+ * ./a.out
+ *
+ * Checks that coalesced OFLOW decodes back to exactly what went in, that it's packed into full
+ * frames when nothing forces it out early, and that a flush sends whatever is held. Then that
+ * several time stamped streams come out of the merge in time order, with nothing lost. Finally
+ * that a file decoded in chunks on several threads gives each tag's frames in order, with the
+ * same time stamps they'd have had if it was decoded in one go.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oflow.h"
+#include "oflowMerge.h"
+#include "oflowSplit.h"
+
+#define TEST_LEN (1024*1024)
+
+#define MERGE_STREAMS (3)
+#define MERGE_FRAMES  (5000)
+
+struct result
+{
+    int len;
+    int frames;
+    int bad;
+    uint8_t d[TEST_LEN];
+};
+
+struct result encResult;
+struct result decResult;
+uint8_t ipStream[TEST_LEN];
+
+/* What comes out of the merge */
+struct mergeResult
+{
+    int frames;
+    int bad;
+    uint64_t last;                                 /* Time of the last frame out */
+    int next[MERGE_STREAMS];                       /* Sequence number expected next from each stream */
+};
+
+struct mergeResult mergeResult;
+uint8_t mergeStream[MERGE_STREAMS][TEST_LEN];
+int mergeLen[MERGE_STREAMS];
+
+#define SPLIT_FILE   "test_oflow_split.bin"
+#define SPLIT_TAGS   (3)
+#define SPLIT_FRAMES (20000)
+
+/* What comes out of the split, for each tag */
+struct splitResult
+{
+    int frames[SPLIT_TAGS];
+    int bad;
+    int order;                                     /* Spans for a tag that came out of chunk order */
+    uint64_t lastOfs[SPLIT_TAGS];
+};
+
+struct splitResult splitResult;
+
+// ====================================================================================================
+
+void _frameOut( uint8_t tag, uint64_t heldSince, const uint8_t *d, unsigned int len, void *param )
+
+{
+    struct result *r = ( struct result * )param;
+
+    if ( r->len + len > TEST_LEN )
+    {
+        r->bad++;
+        return;
+    }
+
+    memcpy( &r->d[r->len], d, len );
+    r->len += len;
+    r->frames++;
+}
+// ====================================================================================================
+
+void _frameRxed( struct OFLOWFrame *p, void *param )
+
+{
+    struct result *r = ( struct result * )param;
+
+    if ( ( !p->good ) || ( p->tag != 9 ) )
+    {
+        r->bad++;
+        return;
+    }
+
+    memcpy( &r->d[r->len], p->d, p->len );
+    r->len += p->len;
+    r->frames++;
+}
+// ====================================================================================================
+
+static int _run( const char *name, int maxChunk, int flushOneIn, int len )
+
+{
+    struct OFLOWCoalesce c;
+    struct OFLOW o;
+    int flushes = 0;
+    int expected;
+
+    memset( &encResult, 0, sizeof( encResult ) );
+    memset( &decResult, 0, sizeof( decResult ) );
+    OFLOWCoalesceInit( &c, 9 );
+
+    for ( int ofs = 0, n; ofs < len; ofs += n )
+    {
+        n = 1 + rand() % maxChunk;
+        n = ( ofs + n > len ) ? len - ofs : n;
+        OFLOWCoalesceAdd( &c, &ipStream[ofs], n, ofs, _frameOut, &encResult );
+
+        if ( ( flushOneIn ) && ( !( rand() % flushOneIn ) ) && ( OFLOWCoalesceHeld( &c ) ) )
+        {
+            OFLOWCoalesceFlush( &c, _frameOut, &encResult );
+            flushes++;
+        }
+    }
+
+    if ( OFLOWCoalesceHeld( &c ) )
+    {
+        flushes++;
+    }
+
+    OFLOWCoalesceFlush( &c, _frameOut, &encResult );
+
+    memset( &o, 0, sizeof( o ) );
+    OFLOWInit( &o );
+    OFLOWPump( &o, encResult.d, encResult.len, _frameRxed, &decResult );
+
+    /* Without early flushes every frame but the last should be full */
+    expected = ( flushOneIn ) ? decResult.frames : ( len + OFLOW_MAX_PACKET_LEN - 1 ) / OFLOW_MAX_PACKET_LEN;
+
+    fprintf( stderr, "%s: %d bytes in %d frames (%d sent short): ", name, decResult.len, decResult.frames, flushes );
+
+    if ( ( encResult.bad ) || ( decResult.bad ) || ( decResult.len != len ) ||
+            memcmp( decResult.d, ipStream, len ) || ( decResult.frames != expected ) ||
+            ( ( !flushOneIn ) && ( flushes != ( ( len % OFLOW_MAX_PACKET_LEN ) ? 1 : 0 ) ) ) )
+    {
+        fprintf( stderr, "*********FAILED\n" );
+        return 1;
+    }
+
+    fprintf( stderr, "OK\n" );
+    return 0;
+}
+// ====================================================================================================
+
+void _merged( int stream, struct OFLOWFrame *f, void *param )
+
+{
+    struct mergeResult *r = ( struct mergeResult * )param;
+    int seq = f->d[0] | ( f->d[1] << 8 );
+
+    /* Frames come out in time order, each stream's in the order it sent them */
+    if ( ( !f->stamped ) || ( f->tstamp < r->last ) || ( f->tag != 10 + stream ) || ( seq != r->next[stream] ) )
+    {
+        r->bad++;
+    }
+
+    r->last = f->tstamp;
+    r->next[stream] = seq + 1;
+    r->frames++;
+}
+// ====================================================================================================
+
+static int _runMerge( const char *name, size_t queueBytes, bool expectForced )
+
+{
+    struct OFLOWMerge *m;
+    struct Frame f;
+    uint8_t d[64];
+    uint64_t t;
+    int ofs[MERGE_STREAMS] = { 0 };
+    bool more = true;
+
+    /* Each stream gets frames stamped at its own random intervals, each carrying a sequence number */
+    for ( int s = 0; s < MERGE_STREAMS; s++ )
+    {
+        t = 1000;
+        mergeLen[s] = 0;
+
+        for ( int i = 0; i < MERGE_FRAMES; i++ )
+        {
+            t += rand() % 1000;
+            mergeLen[s] += OFLOWEncodeTime( t, &mergeStream[s][mergeLen[s]] );
+            d[0] = i;
+            d[1] = i >> 8;
+
+            for ( int j = 2; j < sizeof( d ); j++ )
+            {
+                d[j] = rand();
+            }
+
+            OFLOWEncode( 10 + s, 0, d, 2 + rand() % ( sizeof( d ) - 2 ), &f );
+            memcpy( &mergeStream[s][mergeLen[s]], f.d, f.len );
+            mergeLen[s] += f.len;
+        }
+    }
+
+    memset( &mergeResult, 0, sizeof( mergeResult ) );
+    m = OFLOWMergeCreate( MERGE_STREAMS, queueBytes, _merged, &mergeResult );
+
+    /* ...and arrive in randomly sized pieces, with some streams getting well ahead of the others */
+    while ( more )
+    {
+        more = false;
+
+        for ( int s = 0; s < MERGE_STREAMS; s++ )
+        {
+            int n = rand() % ( ( s + 1 ) * 300 );
+            n = ( ofs[s] + n > mergeLen[s] ) ? mergeLen[s] - ofs[s] : n;
+            OFLOWMergePump( m, s, &mergeStream[s][ofs[s]], n );
+            ofs[s] += n;
+            more |= ( ofs[s] < mergeLen[s] );
+        }
+    }
+
+    OFLOWMergeFlush( m );
+
+    fprintf( stderr, "%s: %d frames merged, %d out of order, %d forced: ", name, mergeResult.frames, mergeResult.bad, ( int )OFLOWMergeForced( m ) );
+
+    if ( ( mergeResult.frames != MERGE_STREAMS * MERGE_FRAMES ) || ( OFLOWMergeErrors( m ) ) ||
+            ( ( !expectForced ) && ( ( mergeResult.bad ) || ( OFLOWMergeForced( m ) ) ) ) ||
+            ( ( expectForced ) && ( !OFLOWMergeForced( m ) ) ) )
+    {
+        fprintf( stderr, "*********FAILED\n" );
+        OFLOWMergeDelete( m );
+        return 1;
+    }
+
+    fprintf( stderr, "OK\n" );
+    OFLOWMergeDelete( m );
+    return 0;
+}
+// ====================================================================================================
+
+bool _split( const struct OFLOWSpan *s, void *param )
+
+{
+    struct splitResult *r = ( struct splitResult * )param;
+    int t = s->tag - 20;
+    const uint8_t *d = s->d;
+
+    if ( s->tag == OFLOW_TIME_TAG )
+    {
+        /* Asked for everything so these come too, but they're already in the stamps */
+        return true;
+    }
+
+    if ( ( t < 0 ) || ( t >= SPLIT_TAGS ) )
+    {
+        r->bad++;
+        return true;
+    }
+
+    if ( ( r->frames[t] ) && ( s->fileOfs <= r->lastOfs[t] ) )
+    {
+        r->order++;
+    }
+
+    r->lastOfs[t] = s->fileOfs;
+
+    /* Each frame carries its sequence number for the tag, and the time it should have been stamped with */
+    for ( uint32_t i = 0; i < s->nframes; i++ )
+    {
+        uint32_t seq = d[0] | ( d[1] << 8 ) | ( d[2] << 16 );
+        uint64_t t0 = 0;
+
+        for ( int j = 7; j >= 0; j-- )
+        {
+            t0 = ( t0 << 8 ) | d[3 + j];
+        }
+
+        if ( ( seq != r->frames[t] ) || ( !s->f[i].stamped ) || ( s->f[i].tstamp != t0 ) )
+        {
+            r->bad++;
+        }
+
+        r->frames[t]++;
+        d += s->f[i].len;
+    }
+
+    return true;
+}
+// ====================================================================================================
+
+static int _runSplit( const char *name, int threads, size_t chunk, int ntags, const uint8_t *tags )
+
+{
+    struct OFLOWSplit *sp;
+    int sent[SPLIT_TAGS] = { 0 };
+    int expected = 0;
+    struct Frame f;
+    uint8_t d[200];
+    uint64_t t = 1000;
+    bool ok;
+    FILE *o = fopen( SPLIT_FILE, "wb" );
+
+    /* Starts with the tail of a frame that fails its checksum, as a capture might */
+    fwrite( "\x03\x11\x22\x00", 1, 4, o );
+    fwrite( d, 1, OFLOWEncodeTime( t, d ), o );
+
+    for ( int i = 0; i < SPLIT_FRAMES; i++ )
+    {
+        int k = rand() % SPLIT_TAGS;
+
+        if ( !( rand() % 20 ) )
+        {
+            t += rand();
+            fwrite( d, 1, OFLOWEncodeTime( t, d ), o );
+        }
+
+        d[0] = sent[k];
+        d[1] = sent[k] >> 8;
+        d[2] = sent[k] >> 16;
+
+        for ( int j = 0; j < 8; j++ )
+        {
+            d[3 + j] = t >> ( 8 * j );
+        }
+
+        for ( int j = 11; j < sizeof( d ); j++ )
+        {
+            d[j] = ( rand() % 4 ) ? rand() : 0;
+        }
+
+        OFLOWEncode( 20 + k, 0, d, 11 + rand() % ( sizeof( d ) - 11 ), &f );
+        fwrite( f.d, 1, f.len, o );
+        sent[k]++;
+    }
+
+    fclose( o );
+
+    for ( int k = 0; k < SPLIT_TAGS; k++ )
+    {
+        for ( int i = 0; i < ( ( ntags ) ? ntags : 256 ); i++ )
+        {
+            expected += ( ( ntags ) ? tags[i] : i ) == 20 + k ? sent[k] : 0;
+        }
+    }
+
+    memset( &splitResult, 0, sizeof( splitResult ) );
+    sp = OFLOWSplitCreate( SPLIT_FILE, 0, threads, chunk, ntags, tags );
+    ok = OFLOWSplitRun( sp, _split, &splitResult );
+
+    fprintf( stderr, "%s: %d+%d+%d frames, %d bad, %d out of order, %d errors: ", name, splitResult.frames[0], splitResult.frames[1], splitResult.frames[2],
+             splitResult.bad, splitResult.order, ( int )OFLOWSplitErrors( sp ) );
+
+    /* Only the partial frame at the start should be an error */
+    if ( ( !ok ) || ( splitResult.bad ) || ( splitResult.order ) || ( OFLOWSplitErrors( sp ) > 1 ) ||
+            ( splitResult.frames[0] + splitResult.frames[1] + splitResult.frames[2] != expected ) )
+    {
+        fprintf( stderr, "*********FAILED\n" );
+        OFLOWSplitDelete( sp );
+        remove( SPLIT_FILE );
+        return 1;
+    }
+
+    fprintf( stderr, "OK\n" );
+    OFLOWSplitDelete( sp );
+    remove( SPLIT_FILE );
+    return 0;
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    int fails = 0;
+
+    /* Plenty of zeros in there, so the COBS encoding has something to do */
+    srand( 1 );
+
+    for ( int i = 0; i < TEST_LEN; i++ )
+    {
+        ipStream[i] = ( rand() % 4 ) ? rand() : 0;
+    }
+
+    fails += _run( "Small chunks", 64, 0, TEST_LEN / 4 );
+    fails += _run( "Large chunks", 3 * OFLOW_MAX_PACKET_LEN, 0, TEST_LEN / 4 );
+    fails += _run( "Exact frames", 1, 0, 4 * OFLOW_MAX_PACKET_LEN );
+    fails += _run( "Early flushes", 200, 10, TEST_LEN / 4 );
+    fails += _run( "Mixed", 2 * OFLOW_MAX_PACKET_LEN, 3, TEST_LEN / 4 );
+    fails += _runMerge( "Merge", 1024 * 1024, false );
+    fails += _runMerge( "Merge, small queues", 0, true );
+    fails += _runSplit( "Split, one thread", 1, 0, 0, NULL );
+    fails += _runSplit( "Split, small chunks", 4, 1000, 0, NULL );
+    fails += _runSplit( "Split, odd sized chunks", 7, 4099, 2, ( const uint8_t[] ) { 22, 20 } );
+
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
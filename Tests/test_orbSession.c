@@ -0,0 +1,164 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc Src/orbSession.c Src/oflow.c Src/cobs.c Src/tpiuDecoder.c Src/simd.c Src/itmDecoder.c Src/msgDecoder.c \
+ *     Src/traceDecoder.c Src/traceDecoder_etm35.c Src/traceDecoder_etm4.c Src/traceDecoder_mtb.c Src/generics.c Src/statsRegistry.c \
+ *     Src/stream_file_posix.c Src/stream_archive.c Src/stream_socket_posix.c Src/stream_reader.c Tests/test_orbSession.c \
+ *     -IInc -DLINUX -D_GNU_SOURCE -include uicolours_default.h -ggdb -lpthread -lz
+ * Execute with;
+ * ./a.out
+ *
+ * Writes an ORBFLOW capture with software messages on one tag and plain data on another, then reads
+ * it back through a session. The ITM subscriber has to see every message, in order, and each of the
+ * two data subscribers every byte, in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oflow.h"
+#include "orbSession.h"
+
+#define TEST_FILE   "test_orbSession.bin"
+#define TEST_FRAMES (2000)
+#define DATA_TAG    (5)
+
+struct result
+{
+    uint32_t next;                                 /* Value expected next */
+    uint32_t bad;
+    uint32_t calls;
+};
+
+// ====================================================================================================
+static void _msgs( uint8_t tag, const struct msg *m, size_t n, void *param )
+
+{
+    struct result *r = ( struct result * )param;
+
+    r->calls++;
+
+    for ( size_t i = 0; i < n; i++ )
+    {
+        if ( ( tag != DEFAULT_ITM_STREAM ) || ( m[i].genericMsg.msgtype != MSG_SOFTWARE ) ||
+                ( m[i].swMsg.srcAddr != ( r->next & 31 ) ) || ( m[i].swMsg.value != r->next ) )
+        {
+            r->bad++;
+        }
+
+        r->next++;
+    }
+}
+// ====================================================================================================
+static void _data( uint8_t tag, const uint8_t *d, size_t len, void *param )
+
+{
+    struct result *r = ( struct result * )param;
+
+    r->calls++;
+
+    for ( size_t i = 0; i < len; i++ )
+    {
+        if ( ( tag != DATA_TAG ) || ( d[i] != ( uint8_t )r->next ) )
+        {
+            r->bad++;
+        }
+
+        r->next++;
+    }
+}
+// ====================================================================================================
+static uint32_t _write( uint32_t *dataBytes )
+
+{
+    FILE *o = fopen( TEST_FILE, "wb" );
+    struct Frame f;
+    uint8_t d[200];
+    uint32_t msgs = 0;
+
+    *dataBytes = 0;
+
+    for ( int i = 0; i < TEST_FRAMES; i++ )
+    {
+        int len = 0;
+
+        if ( rand() % 2 )
+        {
+            /* A few 32 bit software messages, each on the channel its value says */
+            for ( int k = 1 + rand() % 30; k; k--, msgs++ )
+            {
+                d[len++] = ( ( msgs & 31 ) << 3 ) | 3;
+                d[len++] = msgs;
+                d[len++] = msgs >> 8;
+                d[len++] = msgs >> 16;
+                d[len++] = msgs >> 24;
+            }
+
+            OFLOWEncode( DEFAULT_ITM_STREAM, 0, d, len, &f );
+        }
+        else
+        {
+            /* ...or a run of plain bytes carrying on from the last */
+            int n = 1 + rand() % sizeof( d );
+
+            for ( len = 0; len < n; len++ )
+            {
+                d[len] = ( *dataBytes )++;
+            }
+
+            OFLOWEncode( DATA_TAG, 0, d, len, &f );
+        }
+
+        fwrite( f.d, 1, f.len, o );
+    }
+
+    fclose( o );
+    return msgs;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct orbSessionSource src = { .file = TEST_FILE, .fileTerminate = true, .oflow = true };
+    struct orbSessionStats st;
+    struct result itm = { 0 }, data[2] = { { 0 } };
+    uint32_t dataBytes;
+    uint32_t msgs = _write( &dataBytes );
+    struct orbSession *s = orbSessionCreate( &src );
+
+    orbSessionSubscribeITM( s, DEFAULT_ITM_STREAM, _msgs, &itm );
+    orbSessionSubscribeData( s, DATA_TAG, _data, &data[0] );
+    orbSessionSubscribeData( s, DATA_TAG, _data, &data[1] );
+    orbSessionStart( s );
+
+    while ( orbSessionRunning( s ) )
+    {
+        usleep( 1000 );
+    }
+
+    orbSessionGetStats( s, &st );
+    orbSessionDelete( s );
+    remove( TEST_FILE );
+
+    fprintf( stderr, "%u messages in %u calls, %u bad, %u+%u data bytes, %u+%u bad, %u bad frames: ",
+             itm.next, itm.calls, itm.bad, data[0].next, data[1].next, data[0].bad, data[1].bad, ( uint32_t )st.badFrames );
+
+    if ( ( itm.next != msgs ) || ( itm.bad ) || ( data[0].bad ) || ( data[1].bad ) || ( st.badFrames ) ||
+            ( data[0].next != dataBytes ) || ( data[0].next != data[1].next ) || ( !data[0].next ) )
+    {
+        fprintf( stderr, "*********FAILED\n" );
+        return 1;
+    }
+
+    fprintf( stderr, "OK\n" );
+    return 0;
+}
+// ====================================================================================================
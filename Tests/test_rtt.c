@@ -0,0 +1,232 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/rtt.c Src/generics.c Tests/test_rtt.c -IInc -IInc/external -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Lays out a control block in a copy of target RAM, the way SEGGER_RTT_Init would, then writes into
+ * its up-buffers as a target would and checks what's taken out, including across a wrap, when
+ * more has been written than is taken in one poll, and after the target has started over.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rtt.h"
+
+#define RAM_BASE  (0x20000000)
+#define RAM_LEN   (0x4000)
+#define CB_AT     (0x1234)                  /* Deliberately somewhere awkward */
+#define BUF0_LEN  (64)
+#define BUF1_LEN  (16)
+
+static uint8_t _ram[RAM_LEN];
+static int _accesses;
+
+static char _got[2][1024];
+static size_t _gotLen[2];
+
+// ====================================================================================================
+static bool _read( void *param, uint32_t addr, uint8_t *d, uint32_t len )
+
+{
+    _accesses++;
+
+    if ( ( addr < RAM_BASE ) || ( addr + len > RAM_BASE + RAM_LEN ) )
+    {
+        return false;
+    }
+
+    memcpy( d, &_ram[addr - RAM_BASE], len );
+    return true;
+}
+// ====================================================================================================
+static bool _write( void *param, uint32_t addr, uint32_t v )
+
+{
+    _accesses++;
+
+    if ( ( addr & 3 ) || ( addr < RAM_BASE ) || ( addr + 4 > RAM_BASE + RAM_LEN ) )
+    {
+        return false;
+    }
+
+    memcpy( &_ram[addr - RAM_BASE], &v, 4 );
+    return true;
+}
+// ====================================================================================================
+static void _data( unsigned int buf, const uint8_t *d, uint32_t len, void *param )
+
+{
+    if ( buf < 2 )
+    {
+        memcpy( &_got[buf][_gotLen[buf]], d, len );
+        _gotLen[buf] += len;
+    }
+}
+// ====================================================================================================
+static uint32_t *_desc( int buf )
+
+{
+    return ( uint32_t * )&_ram[CB_AT + 24 + buf * 24];
+}
+// ====================================================================================================
+static void _setup( void )
+
+/* Control block, then the names and buffers after it, as a linker would likely place them */
+
+{
+    uint32_t at = CB_AT + 24 + 3 * 24;
+
+    memset( _ram, 0x55, sizeof( _ram ) );
+    memset( &_ram[CB_AT], 0, 24 + 3 * 24 );
+    memcpy( &_ram[CB_AT], "SEGGER RTT", 11 );
+    *( uint32_t * )&_ram[CB_AT + 16] = 2;
+    *( uint32_t * )&_ram[CB_AT + 20] = 1;
+
+    strcpy( ( char * )&_ram[at], "Terminal" );
+    _desc( 0 )[0] = RAM_BASE + at;
+    strcpy( ( char * )&_ram[at + 16], "Log" );
+    _desc( 1 )[0] = RAM_BASE + at + 16;
+    at += 32;
+
+    _desc( 0 )[1] = RAM_BASE + at;
+    _desc( 0 )[2] = BUF0_LEN;
+    at += BUF0_LEN;
+    _desc( 1 )[1] = RAM_BASE + at;
+    _desc( 1 )[2] = BUF1_LEN;
+}
+// ====================================================================================================
+static void _targetWrite( int buf, const char *s )
+
+/* Put a string into an up-buffer as SEGGER_RTT_Write would, wrapping as needed */
+
+{
+    uint32_t *d = _desc( buf );
+
+    while ( *s )
+    {
+        _ram[d[1] - RAM_BASE + d[3]] = *s++;
+        d[3] = ( d[3] + 1 ) % d[2];
+    }
+}
+// ====================================================================================================
+static int _check( const char *what, int buf, const char *expected )
+
+{
+    bool ok = ( _gotLen[buf] == strlen( expected ) ) && ( !memcmp( _got[buf], expected, _gotLen[buf] ) );
+
+    fprintf( stderr, "%-24s %s\n", what, ok ? "OK" : "*********FAILED" );
+
+    if ( !ok )
+    {
+        fprintf( stderr, "    Got      [%.*s]\n    Expected [%s]\n", ( int )_gotLen[buf], _got[buf], expected );
+    }
+
+    _gotLen[buf] = 0;
+    return ok ? 0 : 1;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct rtt *r = rttCreate( _read, _write, NULL );
+    int fails = 0;
+    int n;
+
+    /* Nothing there yet, as before the target has started */
+    memset( _ram, 0x55, sizeof( _ram ) );
+
+    if ( rttFind( r, RAM_BASE, RAM_LEN ) != 0 )
+    {
+        fprintf( stderr, "Found something that isn't there *********FAILED\n" );
+        fails++;
+    }
+
+    if ( rttFind( r, RAM_BASE, RAM_LEN + 4 ) >= 0 )
+    {
+        fprintf( stderr, "Read past the end of memory wasn't an error *********FAILED\n" );
+        fails++;
+    }
+
+    _setup();
+
+    if ( ( rttFind( r, RAM_BASE, RAM_LEN ) != 1 ) || ( rttAddress( r ) != RAM_BASE + CB_AT ) || ( rttNumUp( r ) != 2 ) ||
+            ( strcmp( rttUpName( r, 0 ), "Terminal" ) ) || ( strcmp( rttUpName( r, 1 ), "Log" ) ) )
+    {
+        fprintf( stderr, "Finding control block *********FAILED\n" );
+        return -1;
+    }
+
+    fprintf( stderr, "%-24s OK\n", "Finding control block" );
+
+    _targetWrite( 0, "Hello world\n" );
+    _targetWrite( 1, "log1" );
+    _accesses = 0;
+    n = rttPoll( r, 1024, _data, NULL );
+    fails += _check( "Terminal", 0, "Hello world\n" );
+    fails += _check( "Log", 1, "log1" );
+
+    /* One read of the descriptors, then a read and a write for each buffer */
+    if ( ( n != 16 ) || ( _accesses != 5 ) || ( _desc( 0 )[4] != 12 ) || ( _desc( 1 )[4] != 4 ) )
+    {
+        fprintf( stderr, "Poll took %d in %d accesses *********FAILED\n", n, _accesses );
+        fails++;
+    }
+
+    /* Nothing new is just the one read */
+    _accesses = 0;
+
+    if ( ( rttPoll( r, 1024, _data, NULL ) != 0 ) || ( _accesses != 1 ) )
+    {
+        fprintf( stderr, "Empty poll *********FAILED\n" );
+        fails++;
+    }
+
+    /* Across the end of the buffer */
+    _targetWrite( 1, "0123456789ab" );
+    rttPoll( r, 1024, _data, NULL );
+    fails += _check( "Wrapped", 1, "0123456789ab" );
+
+    /* More than is taken at once comes in pieces, with nothing lost */
+    _targetWrite( 0, "The quick brown fox jumps over the lazy dog" );
+
+    while ( rttPoll( r, 10, _data, NULL ) > 0 );
+
+    fails += _check( "In pieces", 0, "The quick brown fox jumps over the lazy dog" );
+
+    /* The target starts over, with the ID gone until it's set up again */
+    memset( &_ram[CB_AT], 0, 16 );
+
+    if ( ( rttPoll( r, 1024, _data, NULL ) != 0 ) || ( rttFound( r ) ) )
+    {
+        fprintf( stderr, "Losing control block *********FAILED\n" );
+        fails++;
+    }
+
+    _setup();
+    _targetWrite( 0, "again" );
+
+    if ( rttFind( r, RAM_BASE + CB_AT, 0 ) != 1 )
+    {
+        fprintf( stderr, "Finding at an address *********FAILED\n" );
+        fails++;
+    }
+
+    rttPoll( r, 1024, _data, NULL );
+    fails += _check( "After restart", 0, "again" );
+
+    rttDelete( r );
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
@@ -0,0 +1,186 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX -D_GNU_SOURCE -O2 Src/shmRing.c Src/generics.c Tests/test_shmRing.c -IInc -include uicolours_default.h -lpthread -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * A writer thread keeps lapping a small ring while readers follow it with shmRingRead and with
+ * shmRingPeek/shmRingConsume, so the writer is often overwriting what a reader is copying out at that
+ * very moment. Every byte a reader is given has to be the one that was written at that point in the
+ * stream, and everything it isn't given has to be counted as lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "shmRing.h"
+
+#define TEST_RING   "/orbtest_shmring"
+#define TEST_SIZE   (4096)                        /* As small as a ring gets, so it's lapped all the time */
+#define TEST_BYTES  (256ULL*1024*1024)            /* How much the writer writes altogether */
+
+static int _fails;
+static uint64_t _written;                         /* What the writer's written so far */
+
+/* What a reader is given, and what it was told it lost */
+struct result
+{
+    uint64_t got;
+    uint64_t lost;
+    uint64_t wrong;
+    uint64_t lapped;
+};
+
+// ====================================================================================================
+static void _check( const char *what, bool ok )
+
+{
+    fprintf( stderr, "%-50s %s\n", what, ok ? "OK" : "*********FAILED" );
+    _fails += !ok;
+}
+// ====================================================================================================
+static uint8_t _byteAt( uint64_t p )
+
+/* What's written at position p, different from the same place in any of the last few hundred laps */
+
+{
+    return ( uint8_t )( p ^ ( ( p >> 12 ) * 31 ) ^ ( ( p >> 20 ) * 67 ) );
+}
+// ====================================================================================================
+static void *_writer( void *param )
+
+{
+    struct shmRing *r = ( struct shmRing * )param;
+    static uint8_t b[TEST_SIZE];
+    uint64_t p = 0;
+    unsigned int seed = 1;
+
+    _written = 0;
+
+    while ( p < TEST_BYTES )
+    {
+        size_t len = 1 + rand_r( &seed ) % ( TEST_SIZE / 2 );
+
+        for ( size_t i = 0; i < len; i++ )
+        {
+            b[i] = _byteAt( p + i );
+        }
+
+        shmRingWrite( r, b, len );
+        p += len;
+    }
+
+    _written = p;
+
+    /* ...which tells the reader there's no more to come */
+    shmRingClose( r );
+    return NULL;
+}
+// ====================================================================================================
+static void _take( struct result *res, const uint8_t *d, size_t n, uint64_t lostBefore )
+
+/* Check what a reader was given, with the position it's at worked out from what it's had and lost */
+
+{
+    res->lapped += ( res->lost != lostBefore );
+
+    for ( size_t i = 0; i < n; i++ )
+    {
+        res->wrong += ( d[i] != _byteAt( res->got + res->lost + i ) );
+    }
+
+    res->got += n;
+}
+// ====================================================================================================
+static void _follow( struct shmRing *r, bool peek, struct result *res )
+
+{
+    static uint8_t b[TEST_SIZE];
+    const void *d;
+    uint64_t was;
+    size_t n, drop;
+    bool gone;
+
+    memset( res, 0, sizeof( struct result ) );
+
+    while ( true )
+    {
+        /* Look before reading, so once it's gone there's one more read to pick up anything left */
+        gone = shmRingWriterGone( r );
+        was  = res->lost;
+
+        if ( !peek )
+        {
+            n = shmRingRead( r, b, sizeof( b ), 10, &res->lost );
+            _take( res, b, n, was );
+        }
+        else if ( ( n = shmRingPeek( r, &d, sizeof( b ), 10, &res->lost ) ) )
+        {
+            /* Use what was peeked at, then find out how much of it wasn't to be trusted */
+            memcpy( b, d, n );
+            drop = shmRingConsume( r, n );
+            res->lost += drop;
+            _take( res, &b[drop], n - drop, was );
+        }
+
+        if ( ( !n ) && ( gone ) )
+        {
+            break;
+        }
+    }
+}
+// ====================================================================================================
+static void _run( const char *what, bool peek )
+
+{
+    char m[80];
+    struct result res;
+    pthread_t t;
+    struct shmRing *w = shmRingCreate( TEST_RING, TEST_SIZE );
+    struct shmRing *r = ( w ) ? shmRingOpen( TEST_RING ) : NULL;
+
+    snprintf( m, sizeof( m ), "%s: ring made", what );
+    _check( m, ( w != NULL ) && ( r != NULL ) );
+
+    if ( ( !w ) || ( !r ) )
+    {
+        shmRingClose( w );
+        return;
+    }
+
+    pthread_create( &t, NULL, _writer, w );
+    _follow( r, peek, &res );
+    pthread_join( t, NULL );
+
+    fprintf( stderr, "%s: %" PRIu64 " read, %" PRIu64 " lost, lapped %" PRIu64 " times\n", what, res.got, res.lost, res.lapped );
+    snprintf( m, sizeof( m ), "%s: lapped", what );
+    _check( m, res.lapped > 0 );
+    snprintf( m, sizeof( m ), "%s: nothing torn", what );
+    _check( m, res.wrong == 0 );
+    snprintf( m, sizeof( m ), "%s: everything read or counted lost", what );
+    _check( m, res.got + res.lost == _written );
+
+    shmRingClose( r );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    _run( "shmRingRead", false );
+    _run( "shmRingPeek", true );
+    return _fails ? -1 : 0;
+}
+// ====================================================================================================
@@ -0,0 +1,118 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/statsRegistry.c Src/itmDecoder.c Src/msgDecoder.c Src/generics.c Tests/test_statsRegistry.c \
+ *     -IInc -include uicolours_default.h -ggdb -lpthread
+ * Execute with;
+ * ./a.out
+ *
+ * Registers the stats of two ITM decoders and a counter of our own, checks the snapshot has them
+ * grouped by name with their current values, and that removing one decoder takes all of its out.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "itmDecoder.h"
+#include "statsRegistry.h"
+
+#define MAX_STATS (64)
+
+// ====================================================================================================
+static int _find( struct statValue *v, int n, const char *name, const char *labels )
+
+{
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( ( !strcmp( v[i].name, name ) ) && ( !strcmp( v[i].labels, labels ) ) )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+// ====================================================================================================
+static bool _grouped( struct statValue *v, int n )
+
+/* Once a name has been left behind it mustn't turn up again */
+
+{
+    for ( int i = 1; i < n; i++ )
+    {
+        if ( strcmp( v[i].name, v[i - 1].name ) )
+        {
+            for ( int j = 0; j < i - 1; j++ )
+            {
+                if ( !strcmp( v[i].name, v[j].name ) )
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct statsRegistry *r = statsRegistryCreate();
+    struct ITMDecoder a, b;
+    struct statValue v[MAX_STATS];
+    orbStat mine = 0;
+    int n, m, na, nb, i;
+    bool ok = true;
+
+    ITMDecoderInit( &a, true );
+    ITMDecoderInit( &b, true );
+
+    ITMDecoderRegisterStats( &a, r, "test", "probe=\"a\"" );
+    statsRegistryAdd( r, NULL, "mine", "Our own", NULL, STAT_GAUGE, &mine );
+    ITMDecoderRegisterStats( &b, r, "test", "probe=\"b\"" );
+
+    /* Two overflows for a, one for b */
+    ITMPump( &a, 0x70 );
+    ITMPump( &a, 0x70 );
+    ITMPump( &b, 0x70 );
+    STAT_SET( mine, 1ULL << 40 );
+
+    n  = statsRegistrySnapshot( r, v, MAX_STATS );
+    na = _find( v, n, "test_itm_overflows_total", "probe=\"a\"" );
+    nb = _find( v, n, "test_itm_overflows_total", "probe=\"b\"" );
+    i  = _find( v, n, "mine", "" );
+
+    if ( ( na < 0 ) || ( nb != na + 1 ) || ( v[na].v != 2 ) || ( v[nb].v != 1 ) || ( i < 0 ) ||
+            ( v[i].v != 1ULL << 40 ) || ( v[i].type != STAT_GAUGE ) || ( !_grouped( v, n ) ) )
+    {
+        fprintf( stderr, "Snapshot wrong: " );
+        ok = false;
+    }
+
+    fprintf( stderr, "%d stats, ", n );
+
+    /* Now take b out, and only a and ours should be left */
+    statsRegistryRemove( r, &b.stats, sizeof( b.stats ) );
+
+    m = statsRegistrySnapshot( r, v, MAX_STATS );
+
+    if ( ( m != ( n - 1 ) / 2 + 1 ) || ( _find( v, m, "test_itm_overflows_total", "probe=\"b\"" ) >= 0 ) ||
+            ( _find( v, m, "test_itm_overflows_total", "probe=\"a\"" ) < 0 ) || ( !_grouped( v, m ) ) )
+    {
+        fprintf( stderr, "Remove wrong: " );
+        ok = false;
+    }
+
+    statsRegistryDelete( r );
+    fprintf( stderr, "%s\n", ( ok ) ? "OK" : "*********FAILED" );
+    return ok ? 0 : 1;
+}
+// ====================================================================================================
@@ -0,0 +1,230 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX -D_GNU_SOURCE -O2 Src/stream_swo_posix.c Src/simd.c Src/generics.c Tests/test_swosamples.c -IInc -IInc/external -include uicolours_default.h -lm -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Makes up logic analyser captures of NRZ and Manchester SWO, with the pin among other channels that are
+ * just noise, and checks that the bytes decoded from them are the ones that went in. That's with the bit
+ * time found from the samples and with it given, with bit times that aren't a whole number of samples,
+ * with the target's clock wandering a bit for Manchester (which should follow it), and at each of the
+ * SIMD levels the CPU supports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "simd.h"
+
+#define TEST_BYTES  (20000)
+#define TEST_FILE   "/tmp/test_swosamples.bin"
+
+static uint8_t _sent[TEST_BYTES];
+static uint8_t _got[TEST_BYTES + 1];
+static int _fails;
+
+/* The capture as it's made */
+static uint8_t *_cap;
+static size_t _capLen, _capMax;
+static double _t;                                 /* Time so far, in samples */
+
+// ====================================================================================================
+static void _check( const char *what, bool ok )
+
+{
+    fprintf( stderr, "%-50s %s\n", what, ok ? "OK" : "*********FAILED" );
+    _fails += !ok;
+}
+// ====================================================================================================
+static void _level( int level, double len, unsigned int unit, unsigned int channel )
+
+/* Hold the pin at level for len samples, with everything else in each sample random */
+
+{
+    size_t until = ( size_t )( _t + len );
+
+    while ( _capLen / unit < until )
+    {
+        if ( _capLen + unit > _capMax )
+        {
+            _capMax = ( _capMax ) ? _capMax * 2 : 1 << 20;
+            _cap = ( uint8_t * )realloc( _cap, _capMax );
+        }
+
+        for ( unsigned int i = 0; i < unit; i++ )
+        {
+            _cap[_capLen + i] = rand();
+        }
+
+        _cap[_capLen + channel / 8] = ( _cap[_capLen + channel / 8] & ~( 1 << ( channel % 8 ) ) ) | ( level << ( channel % 8 ) );
+        _capLen += unit;
+    }
+
+    _t += len;
+}
+// ====================================================================================================
+static void _makeNRZ( double bit, unsigned int unit, unsigned int channel )
+
+{
+    _capLen = 0;
+    _t = 0;
+    _level( 1, 50 * bit, unit, channel );
+
+    for ( int i = 0; i < TEST_BYTES; i++ )
+    {
+        _level( 0, bit, unit, channel );
+
+        for ( int b = 0; b < 8; b++ )
+        {
+            _level( ( _sent[i] >> b ) & 1, bit, unit, channel );
+        }
+
+        /* A stop bit, and sometimes a gap after it */
+        _level( 1, bit * ( ( rand() % 4 ) ? 1 : 1 + rand() % 20 ), unit, channel );
+    }
+
+    _level( 1, 50 * bit, unit, channel );
+}
+// ====================================================================================================
+static void _makeManchester( double bit, unsigned int unit, unsigned int channel, double wander )
+
+/* Packets of a few bytes each, with the bit time going up and down by wander as they go */
+
+{
+    int i = 0;
+    double b, phase = 0;
+
+    _capLen = 0;
+    _t = 0;
+    _level( 0, 50 * bit, unit, channel );
+
+    while ( i < TEST_BYTES )
+    {
+        int n = 1 + rand() % 8;
+
+        /* The start bit is a 1 */
+        b = bit * ( 1 + wander * sin( phase += 0.01 ) );
+        _level( 1, b / 2, unit, channel );
+        _level( 0, b / 2, unit, channel );
+
+        while ( ( n-- ) && ( i < TEST_BYTES ) )
+        {
+            for ( int k = 0; k < 8; k++ )
+            {
+                int v = ( _sent[i] >> k ) & 1;
+                b = bit * ( 1 + wander * sin( phase += 0.01 ) );
+                _level( v, b / 2, unit, channel );
+                _level( !v, b / 2, unit, channel );
+            }
+
+            i++;
+        }
+
+        /* ...and it goes back to idle for at least a bit */
+        _level( 0, bit * ( 2 + rand() % 10 ), unit, channel );
+    }
+
+    _level( 0, 50 * bit, unit, channel );
+}
+// ====================================================================================================
+static size_t _decode( struct SWOSampleConfig *c )
+
+{
+    FILE *f = fopen( TEST_FILE, "wb" );
+    struct Stream *s;
+    size_t len = 0, got;
+
+    fwrite( _cap, 1, _capLen, f );
+    fclose( f );
+
+    if ( !( s = streamCreateSWOSamples( TEST_FILE, c ) ) )
+    {
+        return 0;
+    }
+
+    while ( ( len < sizeof( _got ) ) && ( s->receive( s, &_got[len], 1000, NULL, &got ) == RECEIVE_RESULT_OK ) )
+    {
+        len += got;
+    }
+
+    s->close( s );
+    free( s );
+    return len;
+}
+// ====================================================================================================
+static void _run( const char *what, struct SWOSampleConfig *c )
+
+{
+    char t[128];
+    size_t len = _decode( c );
+
+    snprintf( t, sizeof( t ), "%s, %s", what, SIMDLevelName( SIMDGetLevel() ) );
+    _check( t, ( len == TEST_BYTES ) && ( !memcmp( _sent, _got, TEST_BYTES ) ) );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct SWOSampleConfig c;
+
+    srand( 1 );
+
+    for ( int i = 0; i < TEST_BYTES; i++ )
+    {
+        _sent[i] = rand();
+    }
+
+    for ( enum SIMDLevel l = SIMD_SCALAR; l < SIMD_NUM_LEVELS; l++ )
+    {
+        if ( !SIMDSetLevel( l ) )
+        {
+            continue;
+        }
+
+        c = ( struct SWOSampleConfig ) { .channel = 3, .unitSize = 1, .encoding = SWO_SAMPLES_NRZ };
+        _makeNRZ( 13.7, 1, 3 );
+        _run( "NRZ, 13.7 samples a bit, found", &c );
+        c.samplesPerBit = 13.7;
+        _run( "...and given", &c );
+
+        c = ( struct SWOSampleConfig ) { .channel = 0, .unitSize = 1, .encoding = SWO_SAMPLES_NRZ };
+        _makeNRZ( 4, 1, 0 );
+        _run( "NRZ, 4 samples a bit", &c );
+
+        c = ( struct SWOSampleConfig ) { .channel = 11, .unitSize = 2, .encoding = SWO_SAMPLES_NRZ };
+        _makeNRZ( 8.25, 2, 11 );
+        _run( "NRZ, two byte samples", &c );
+
+        c = ( struct SWOSampleConfig ) { .channel = 6, .unitSize = 1, .encoding = SWO_SAMPLES_MANCHESTER };
+        _makeManchester( 9.3, 1, 6, 0 );
+        _run( "Manchester, 9.3 samples a bit, found", &c );
+        c.samplesPerBit = 9.3;
+        _run( "...and given", &c );
+
+        c = ( struct SWOSampleConfig ) { .channel = 7, .unitSize = 1, .encoding = SWO_SAMPLES_MANCHESTER, .samplesPerBit = 20 };
+        _makeManchester( 20, 1, 7, 0.15 );
+        _run( "Manchester, clock wandering 15%", &c );
+
+        c = ( struct SWOSampleConfig ) { .channel = 2, .unitSize = 4, .encoding = SWO_SAMPLES_MANCHESTER };
+        _makeManchester( 4, 4, 2, 0 );
+        _run( "Manchester, 4 samples a bit, four byte samples", &c );
+    }
+
+    unlink( TEST_FILE );
+    free( _cap );
+    return _fails ? -1 : 0;
+}
+// ====================================================================================================
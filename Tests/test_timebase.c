@@ -0,0 +1,187 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/timebase.c Src/msgSeq.c Src/itmDecoder.c Src/msgDecoder.c Src/memAccount.c Src/statsRegistry.c Src/generics.c Tests/test_timebase.c -IInc -IInc/external -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Puts ITM timestamps through the decoder and the sequencer as they'd come from a target, and checks
+ * the target time each message is stamped with. That's local timestamps with a prescaler, global
+ * timestamps (including ones with only some of their bytes, and a wrap waiting for its GTS2), and
+ * the local count being brought forward when local timestamps have been lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "msgSeq.h"
+#include "timebase.h"
+
+static struct ITMDecoder _i;
+static struct MSGSeq _d;
+static struct timebase _tb;
+
+static uint64_t _swTime[16];                        /* Time each software message was stamped with */
+static unsigned int _numSW;
+static int _fails;
+
+// ====================================================================================================
+static void _check( const char *what, bool ok )
+
+{
+    fprintf( stderr, "%-28s %s\n", what, ok ? "OK" : "*********FAILED" );
+    _fails += !ok;
+}
+// ====================================================================================================
+static void _pump( const uint8_t *d, size_t len )
+
+{
+    struct msg *m;
+
+    while ( len-- )
+    {
+        if ( MSGSeqPump( &_d, *d++ ) )
+        {
+            while ( ( m = MSGSeqGetPacket( &_d ) ) )
+            {
+                if ( ( m->genericMsg.msgtype == MSG_SOFTWARE ) && ( _numSW < 16 ) )
+                {
+                    _swTime[_numSW++] = m->genericMsg.ts;
+                }
+            }
+        }
+    }
+}
+// ====================================================================================================
+static void _lts( uint32_t inc )
+
+/* Local timestamp, format 1, time current */
+
+{
+    uint8_t d[5] = { 0xc0 };
+    size_t n = 1;
+
+    do
+    {
+        d[n++] = ( inc & 0x7f ) | ( ( inc > 0x7f ) ? 0x80 : 0 );
+        inc >>= 7;
+    }
+    while ( inc );
+
+    _pump( d, n );
+}
+// ====================================================================================================
+static void _gts1( uint32_t t, int len, bool wrap )
+
+/* Low bits of a global timestamp, in len bytes */
+
+{
+    uint8_t d[5] = { 0x94 };
+
+    for ( int k = 0; k < len; k++ )
+    {
+        d[k + 1] = ( ( t >> ( 7 * k ) ) & 0x7f ) | ( ( k < len - 1 ) ? 0x80 : 0 );
+    }
+
+    if ( len == 4 )
+    {
+        d[4] = ( ( t >> 21 ) & 0x1f ) | ( wrap ? 0x40 : 0 );
+    }
+
+    _pump( d, len + 1 );
+}
+// ====================================================================================================
+static void _gts2( uint64_t high )
+
+/* ...and the bits above them, for a 48 bit timestamp */
+
+{
+    uint8_t d[5] = { 0xb4, ( high & 0x7f ) | 0x80, ( ( high >> 7 ) & 0x7f ) | 0x80, ( ( high >> 14 ) & 0x7f ) | 0x80, ( high >> 21 ) & 1 };
+    _pump( d, 5 );
+}
+// ====================================================================================================
+static void _sw( uint8_t c )
+
+{
+    uint8_t d[2] = { 0x01, c };
+    _pump( d, 2 );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    ITMDecoderInit( &_i, true );
+    _check( "Sequencer made", MSGSeqInit( &_d, &_i, 1024 ) );
+
+    if ( _fails )
+    {
+        return -1;
+    }
+
+    /* 4 cycles a count at 100MHz is 40nS a count */
+    timebaseInit( &_tb, 4, 100000000, 0 );
+    MSGSeqSetTimebase( &_d, &_tb );
+
+    /* Messages take the time of the timestamp after them */
+    _sw( 'a' );
+    _lts( 100 );
+    _sw( 'b' );
+    _sw( 'c' );
+    _lts( 1000 );
+    _check( "Local timestamps", ( _numSW == 3 ) && ( _swTime[0] == 4000 ) && ( _swTime[1] == 44000 ) && ( _swTime[2] == 44000 ) );
+    _check( "Cycles", timebaseCycles( &_tb ) == 4400 );
+
+    /* A global timestamp that's all there puts the count on its clock */
+    _gts1( 0x123456, 4, false );
+    _check( "GTS1 alone isn't used", !_tb.anchored );
+    _gts2( 1 );
+    _sw( 'd' );
+    _lts( 1 );
+    _check( "GTS1 and GTS2", ( _tb.anchored ) && ( _tb.gts == ( ( 1ULL << 26 ) | 0x123456 ) ) && ( _numSW == 4 ) &&
+            ( timebaseCycles( &_tb ) == _tb.gts + 4 ) && ( !_tb.corrections ) );
+
+    /* A global timestamp behind the local count doesn't move it back */
+    uint64_t before = timebaseCycles( &_tb );
+    _gts1( 0x12, 1, false );
+    _lts( 1 );
+    _check( "Monotonic", ( timebaseCycles( &_tb ) == before + 4 ) && ( ( _tb.gts & 0x7f ) == 0x12 ) && ( _tb.drift > 0 ) );
+
+    /* Local timestamps lost, so the next global one is ahead and the count is brought up to it */
+    _gts1( 0x3ffff00, 4, false );
+    _sw( 'e' );
+    _lts( 1 );
+    _check( "Correction", ( _tb.corrections == 1 ) && ( timebaseCycles( &_tb ) == ( ( 1ULL << 26 ) | 0x3ffff00 ) ) );
+    _check( "Stamped in nS", _swTime[4] == timebaseCycles( &_tb ) * 10 );
+
+    /* Wrapped, so nothing's used until the high bits come */
+    uint64_t floor = _tb.floor;
+    _gts1( 0x10, 4, true );
+    _check( "Wrap waits", _tb.floor == floor );
+    _gts2( 2 );
+    _check( "Wrap then GTS2", _tb.floor == ( ( 2ULL << 26 ) | 0x10 ) );
+
+    /* ...and a clock that isn't the core's */
+    timebaseInit( &_tb, 1, 100000000, 1000000 );
+    _gts1( 5, 4, false );
+    _gts2( 0 );
+    _check( "Global timestamp clock", ( timebaseCycles( &_tb ) == 500 ) && ( timebaseNs( &_tb ) == 5000 ) );
+
+    /* Long runs don't overflow the conversion */
+    timebaseInit( &_tb, 1, 1000000000, 0 );
+    _tb.cycles = 100000ULL * 1000000000ULL + 7;
+    _check( "No overflow", timebaseNs( &_tb ) == 100000ULL * 1000000000ULL + 7 );
+
+    _check( "GTS packets counted", ITMDecoderGetStats( &_i )->GTSPkt == 8 );
+    return _fails ? -1 : 0;
+}
+// ====================================================================================================
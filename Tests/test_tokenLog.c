@@ -0,0 +1,182 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/tokenLog.c Src/generics.c Tests/test_tokenLog.c -IInc -IInc/external -include uicolours_default.h -lelf -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Lays out some formats and strings as they'd be in target memory, then sends records for them the
+ * way a target would, checking the text against what printf makes of the same thing. Also checks
+ * that records are picked up again after something that isn't one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "tokenLog.h"
+
+#define IMAGE_BASE (0x08001000)
+
+static char _image[1024];
+static size_t _imageLen;
+
+// ====================================================================================================
+static uint32_t _place( const char *s )
+
+/* Put a string into the image, returning its target address */
+
+{
+    uint32_t a = IMAGE_BASE + _imageLen;
+
+    strcpy( &_image[_imageLen], s );
+    _imageLen += strlen( s ) + 1;
+    return a;
+}
+// ====================================================================================================
+static size_t _send( struct tokenLog *t, const uint32_t *w, int n, char *o )
+
+/* Send n words, returning the length of whatever came out at the end */
+
+{
+    size_t l = 0;
+
+    for ( int i = 0; i < n; i++ )
+    {
+        l = tokenLogPump( t, w[i], 4, o, TOKENLOG_MAX_OUTPUT );
+
+        if ( ( l ) && ( i != n - 1 ) )
+        {
+            /* Output before the record is complete is just as wrong */
+            return 0;
+        }
+    }
+
+    return l;
+}
+// ====================================================================================================
+static int _check( const char *name, const char *got, const char *expect )
+
+{
+    bool ok = !strcmp( got, expect );
+
+    fprintf( stderr, "%s: %s", name, ( ok ) ? "OK\n" : "*********FAILED\n" );
+
+    if ( !ok )
+    {
+        fprintf( stderr, "   Got [%s]\n   Expected [%s]\n", got, expect );
+    }
+
+    return !ok;
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    struct tokenLog *t = tokenLogCreate();
+    char o[TOKENLOG_MAX_OUTPUT], e[TOKENLOG_MAX_OUTPUT];
+    int fails = 0;
+    double d = -12.375;
+    uint64_t dv;
+
+    uint32_t fInt    = _place( "val=%d hex=%08x u=%u\n" );
+    uint32_t fStr    = _place( "%s and %c and %s\n" );
+    uint32_t fWide   = _place( "%lld %5.2f %ld\n" );
+    uint32_t fStars  = _place( "[%*d|%-*.*s|%.*d]\n" );
+    uint32_t fPct    = _place( "%p 100%% %n%jx\n" );
+    uint32_t fPlain  = _place( "No arguments at all\n" );
+    uint32_t sHello  = _place( "hello" );
+
+    tokenLogAddImage( t, IMAGE_BASE, _image, _imageLen );
+
+    {
+        uint32_t w[] = { fInt, ( uint32_t ) - 42, 0xbeef, 3000000000u };
+        _send( t, w, 4, o );
+        snprintf( e, sizeof( e ), "val=%d hex=%08x u=%u\n", -42, 0xbeef, 3000000000u );
+        fails += _check( "Integers", o, e );
+    }
+
+    {
+        uint32_t w[] = { fStr, sHello, 'Z', 0x12345678 };
+        _send( t, w, 4, o );
+        fails += _check( "Strings", o, "hello and Z and <0x12345678>\n" );
+    }
+
+    {
+        memcpy( &dv, &d, sizeof( d ) );
+        uint32_t w[] = { fWide, 0x89abcdef, 0x00000012, dv & 0xffffffff, dv >> 32, 77 };
+        _send( t, w, 6, o );
+        snprintf( e, sizeof( e ), "%lld %5.2f %d\n", 0x1289abcdefLL, d, 77 );
+        fails += _check( "Wide", o, e );
+    }
+
+    {
+        uint32_t w[] = { fStars, 6, 99, ( uint32_t ) - 8, 3, sHello, ( uint32_t ) - 1, 5 };
+        _send( t, w, 8, o );
+        snprintf( e, sizeof( e ), "[%*d|%-*.*s|%.*d]\n", 6, 99, -8, 3, "hello", -1, 5 );
+        fails += _check( "Stars", o, e );
+    }
+
+    {
+        uint32_t w[] = { fPct, 0x20001000, 0, 0xcafef00d, 0x1 };
+        _send( t, w, 5, o );
+        fails += _check( "Pointers and such", o, "0x20001000 100% 1cafef00d\n" );
+    }
+
+    {
+        uint32_t w[] = { fPlain };
+        _send( t, w, 1, o );
+        fails += _check( "Plain", o, "No arguments at all\n" );
+    }
+
+    {
+        /* A byte in the middle of a record throws it away, and the next one is fine */
+        uint32_t w[] = { fInt, 1, 2, 3 };
+        tokenLogPump( t, fInt, 4, o, sizeof( o ) );
+        tokenLogPump( t, 1, 4, o, sizeof( o ) );
+        tokenLogPump( t, 'x', 1, o, sizeof( o ) );
+        _send( t, w, 4, o );
+        fails += _check( "Restart", o, "val=1 hex=00000002 u=3\n" );
+    }
+
+    {
+        /* Something that isn't a format is skipped, and what follows is taken up */
+        uint32_t w[] = { 0x1234, fPlain };
+        _send( t, w, 2, o );
+        fails += _check( "Unknown", o, "No arguments at all\n" );
+    }
+
+    {
+        /* Output is clipped, and still terminated */
+        uint32_t w[] = { fStr, sHello, 'Z', sHello };
+        tokenLogPump( t, w[0], 4, o, 8 );
+        tokenLogPump( t, w[1], 4, o, 8 );
+        tokenLogPump( t, w[2], 4, o, 8 );
+        tokenLogPump( t, w[3], 4, o, 8 );
+        fails += _check( "Clipped", o, "hello a" );
+    }
+
+    const struct tokenLogStats *s = tokenLogGetStats( t );
+    fprintf( stderr, "%" PRIu64 " records, %" PRIu64 " unknown, %" PRIu64 " restarts, %u formats\n",
+             s->records, s->unknown, s->restarts, s->formats );
+
+    if ( ( s->unknown != 1 ) || ( s->restarts != 1 ) || ( s->formats != 6 ) )
+    {
+        fprintf( stderr, "Statistics *********FAILED\n" );
+        fails++;
+    }
+
+    tokenLogDelete( t );
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
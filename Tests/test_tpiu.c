@@ -0,0 +1,151 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc Src/tpiuDecoder.c Src/simd.c Src/statsRegistry.c Src/generics.c Tests/test_tpiu.c -IInc -include uicolours_default.h -ggdb -lpthread
+ * Execute with;
+ * ./a.out
+ *
+ * Checks that the block (span) decoder produces exactly the same output as the octet decoder, with
+ * each of the SIMD levels the CPU supports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tpiuDecoder.h"
+#include "simd.h"
+
+#define TEST_LEN (1024*1024)
+
+struct result
+{
+    int len;
+    uint8_t d[TEST_LEN];
+    uint8_t s[TEST_LEN];
+};
+
+struct result octetResult;
+struct result spanResult;
+uint8_t ipStream[TEST_LEN];
+
+// ====================================================================================================
+
+void _packetRxed( enum TPIUPumpEvent e, struct TPIUPacket *p, void *param )
+
+{
+    struct result *r = ( struct result * )param;
+
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        for ( int i = 0; i < p->len; i++ )
+        {
+            r->d[r->len] = p->packet[i].d;
+            r->s[r->len++] = p->packet[i].s;
+        }
+    }
+}
+// ====================================================================================================
+
+void _spansRxed( enum TPIUPumpEvent e, const struct TPIUSpan *s, int nspans, void *param )
+
+{
+    struct result *r = ( struct result * )param;
+
+    if ( e == TPIU_EV_RXEDPACKET )
+    {
+        while ( nspans-- )
+        {
+            for ( int i = 0; i < s->len; i++ )
+            {
+                r->d[r->len] = s->d[i];
+                r->s[r->len++] = s->stream;
+            }
+
+            s++;
+        }
+    }
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    struct TPIUDecoder octet, span;
+    int len = 0, sparse;
+    int fails = 0;
+
+    /* Build a stream of frames with syncs, halfsyncs and plenty of HALFSYNC_HIGH bytes sprinkled in,  */
+    /* with runs of frames that have few of them so the span decoder gets to use its fast path as well */
+    srand( 1 );
+
+    while ( len < TEST_LEN - 32 )
+    {
+        switch ( rand() % 20 )
+        {
+            case 0:
+                memcpy( &ipStream[len], "\xff\xff\xff\x7f", 4 );
+                len += 4;
+                break;
+
+            case 1:
+                memcpy( &ipStream[len], "\xff\x7f", 2 );
+                len += 2;
+                break;
+
+            default:
+                sparse = ( ( len / 4096 ) & 1 ) ? 7 : 400;
+
+                for ( int i = 0; i < TPIU_PACKET_LEN; i++ )
+                {
+                    ipStream[len++] = ( rand() % sparse ) ? rand() : 0x7f;
+                }
+        }
+    }
+
+    for ( enum SIMDLevel l = SIMD_SCALAR; l < SIMD_NUM_LEVELS; l++ )
+    {
+        if ( !SIMDSetLevel( l ) )
+        {
+            continue;
+        }
+
+        memset( &octet, 0, sizeof( octet ) );
+        memset( &span, 0, sizeof( span ) );
+        TPIUDecoderInit( &octet );
+        TPIUDecoderInit( &span );
+        octetResult.len = spanResult.len = 0;
+
+        /* Feed both decoders in the same randomly sized chunks */
+        for ( int ofs = 0, c; ofs < len; ofs += c )
+        {
+            c = 1 + rand() % 5000;
+            c = ( ofs + c > len ) ? len - ofs : c;
+            TPIUPump( &octet, &ipStream[ofs], c, _packetRxed, &octetResult );
+            TPIUPumpSpans( &span, &ipStream[ofs], c, _spansRxed, &spanResult );
+        }
+
+        fprintf( stderr, "%s: Octet decoder %d bytes, span decoder %d bytes: ", SIMDLevelName( l ), octetResult.len, spanResult.len );
+
+        if ( ( octetResult.len != spanResult.len ) ||
+                memcmp( octetResult.d, spanResult.d, octetResult.len ) ||
+                memcmp( octetResult.s, spanResult.s, octetResult.len ) )
+        {
+            fprintf( stderr, "*********FAILED\n" );
+            fails++;
+        }
+        else
+        {
+            fprintf( stderr, "OK\n" );
+        }
+    }
+
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
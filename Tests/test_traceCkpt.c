@@ -0,0 +1,151 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX Src/traceDecoder.c Src/traceDecoder_etm35.c Src/traceDecoder_etm4.c Src/traceDecoder_mtb.c Src/generics.c Src/statsRegistry.c Tests/test_traceCkpt.c -IInc -include uicolours_default.h -ggdb -lpthread
+ * Execute with;
+ * ./a.out
+ *
+ * For each protocol, decodes part of a stream, takes a checkpoint and restores it into a fresh
+ * decoder. Both then decode the rest, and have to report exactly the same events. Also checks
+ * that a damaged checkpoint is refused and leaves the decoder as it was.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "traceDecoder.h"
+
+#define TEST_LEN   (1024*1024)
+#define MAX_EVENTS (TEST_LEN/2)
+#define NUM_CUTS   (20)
+
+static uint8_t _d[TEST_LEN];
+static struct TRACEEvent _ev[2][MAX_EVENTS];
+
+// ====================================================================================================
+static int _decode( struct TRACEDecoder *t, const uint8_t *d, int len, struct TRACEEvent *ev )
+
+/* Decode all of d, returning how many events came out (into ev, if it's given) */
+
+{
+    struct TRACEEvent scratch[64];
+    int n = 0, got, used;
+
+    while ( len )
+    {
+        got = TRACEDecoderPumpEvents( t, d, len, ( ev ) ? &ev[n] : scratch, ( ev ) ? MAX_EVENTS - n : 64, &used );
+        n += got;
+        d += used;
+        len -= used;
+
+        if ( ( !used ) && ( !got ) )
+        {
+            break;
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+static int _run( enum TRACEprotocol p )
+
+{
+    struct TRACEDecoder a, b;
+    uint8_t ckpt[TRACE_CKPT_MAX_LEN];
+    uint8_t fresh[TRACE_CKPT_MAX_LEN];
+    uint8_t again[TRACE_CKPT_MAX_LEN];
+    size_t clen, flen;
+    int fails = 0, total = 0;
+
+    for ( int c = 0; c < NUM_CUTS; c++ )
+    {
+        /* MTB goes in source/dest pairs, so it has to be cut between them */
+        int cut = ( rand() % TEST_LEN ) & ( ( p == TRACE_PROT_MTB ) ? ~7 : ~0 );
+        int na, nb;
+
+        TRACEDecoderInit( &a, p, true, NULL );
+        TRACEDecoderInit( &b, p, true, NULL );
+        _decode( &a, _d, cut, NULL );
+
+        clen = TRACEDecoderSnapshot( &a, ckpt, sizeof( ckpt ) );
+        flen = TRACEDecoderSnapshot( &b, fresh, sizeof( fresh ) );
+
+        /* Broken ones shouldn't be taken, and shouldn't disturb what's there */
+        if ( ( !clen ) || ( clen > sizeof( ckpt ) ) || ( flen != clen ) ||
+                ( TRACEDecoderRestore( &b, ckpt, clen - 1 ) ) ||
+                ( ckpt[1] ^= 1, TRACEDecoderRestore( &b, ckpt, clen ) ) ||
+                ( TRACEDecoderSnapshot( &b, again, sizeof( again ) ) != flen ) || ( memcmp( again, fresh, flen ) ) )
+        {
+            fprintf( stderr, "%s: checkpoint handling *********FAILED\n", TRACEDecodeGetProtocolName( p ) );
+            return 1;
+        }
+
+        ckpt[1] ^= 1;
+
+        if ( !TRACEDecoderRestore( &b, ckpt, clen ) )
+        {
+            fprintf( stderr, "%s: restore *********FAILED\n", TRACEDecodeGetProtocolName( p ) );
+            return 1;
+        }
+
+        na = _decode( &a, &_d[cut], TEST_LEN - cut, _ev[0] );
+        nb = _decode( &b, &_d[cut], TEST_LEN - cut, _ev[1] );
+        total += na;
+
+        /* ...and they should end up in just the same state too */
+        TRACEDecoderSnapshot( &a, ckpt, sizeof( ckpt ) );
+        TRACEDecoderSnapshot( &b, again, sizeof( again ) );
+
+        if ( ( na != nb ) || ( memcmp( _ev[0], _ev[1], na * sizeof( struct TRACEEvent ) ) ) || ( memcmp( ckpt, again, clen ) ) )
+        {
+            fprintf( stderr, "%s: cut at %d, %d events vs %d *********FAILED\n", TRACEDecodeGetProtocolName( p ), cut, na, nb );
+            fails++;
+        }
+
+        a.engine->destroy( a.engine );
+        b.engine->destroy( b.engine );
+    }
+
+    fprintf( stderr, "%s: %d cuts, %d events after them, checkpoints %zu bytes: %s\n",
+             TRACEDecodeGetProtocolName( p ), NUM_CUTS, total, clen, ( fails ) ? "*********FAILED" : "OK" );
+    return fails;
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    int fails = 0;
+
+    srand( 1 );
+
+    /* Mostly random, but with plenty of zeros and a sync sequence (good for ETM3.5 and ETM4) every so often */
+    for ( int i = 0; i < TEST_LEN; i++ )
+    {
+        if ( ( !( rand() % 2000 ) ) && ( i + 12 < TEST_LEN ) )
+        {
+            memset( &_d[i], 0, 11 );
+            _d[i += 11] = 0x80;
+        }
+        else
+        {
+            _d[i] = ( rand() % 4 ) ? rand() : 0;
+        }
+    }
+
+    for ( enum TRACEprotocol p = TRACE_PROT_LIST_START; p < TRACE_PROT_LIST_END; p++ )
+    {
+        fails += _run( p );
+    }
+
+    return fails ? -1 : 0;
+}
+// ====================================================================================================
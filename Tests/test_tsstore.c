@@ -0,0 +1,226 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Test Cases
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build tests with;
+ * gcc -DLINUX -D_GNU_SOURCE -O2 Src/tsStore.c Src/generics.c Tests/test_tsstore.c -IInc -IInc/external -include uicolours_default.h -ggdb
+ * Execute with;
+ * ./a.out
+ *
+ * Writes three hours of made up counts into a store, a commit every half second, with more names in
+ * use than a slot can keep, then reads them back at each resolution and checks every slot has the
+ * counts that went into it. That's with the writer stopping and starting again part way through a
+ * minute, and with the files staying the size they started out as however far the rings go round.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tsStore.h"
+
+#define TEST_DIR    "/tmp/test_tsstore"
+#define TEST_HOURS  (3)
+#define TEST_NAMES  (100)
+
+static int _fails;
+static int64_t _base;                             /* First second written */
+
+/* What went in each second, for each name */
+static uint32_t _sent[TEST_HOURS * 3600][TEST_NAMES];
+
+/* What's come back from a query */
+struct got
+{
+    uint32_t res;
+    uint64_t total;
+    uint64_t named;
+    bool wrong;
+};
+
+// ====================================================================================================
+static void _check( const char *what, bool ok )
+
+{
+    fprintf( stderr, "%-50s %s\n", what, ok ? "OK" : "*********FAILED" );
+    _fails += !ok;
+}
+// ====================================================================================================
+static uint64_t _expect( int64_t start, uint32_t res, int name )
+
+/* What the store should have for a name, or for all of them if name is less than zero */
+
+{
+    uint64_t c = 0;
+
+    for ( int64_t s = start; s < start + res; s++ )
+    {
+        for ( int n = ( name < 0 ) ? 0 : name; n < ( ( name < 0 ) ? TEST_NAMES : name + 1 ); n++ )
+        {
+            c += ( ( s >= _base ) && ( s < _base + TEST_HOURS * 3600 ) ) ? _sent[s - _base][n] : 0;
+        }
+    }
+
+    return c;
+}
+// ====================================================================================================
+static void _gotOne( int64_t start, uint32_t res, const char *name, uint64_t count, void *param )
+
+{
+    struct got *g = ( struct got * )param;
+    int n;
+
+    g->res = res;
+    g->total += count;
+
+    if ( name )
+    {
+        g->named += count;
+
+        if ( ( sscanf( name, "fn_%d", &n ) != 1 ) || ( n < 0 ) || ( n >= TEST_NAMES ) || ( _expect( start, res, n ) != count ) )
+        {
+            g->wrong = true;
+        }
+    }
+}
+// ====================================================================================================
+static bool _window( struct tsStore *t, int64_t from, int64_t to, enum tsLevel l, struct got *g )
+
+/* Query a window, checking the slots in it one at a time so each one's other can be checked too */
+
+{
+    uint32_t res = tsStoreResolution( l );
+
+    memset( g, 0, sizeof( struct got ) );
+
+    for ( int64_t s = from; s < to; s += res )
+    {
+        struct got one = { 0 };
+
+        if ( tsStoreQuery( t, s, s + res, l, _gotOne, &one ) != ( int )l )
+        {
+            return false;
+        }
+
+        g->total += one.total;
+        g->named += one.named;
+        g->wrong |= one.wrong || ( one.total != _expect( s, res, -1 ) );
+    }
+
+    return !g->wrong;
+}
+// ====================================================================================================
+static off_t _size( const char *file )
+
+{
+    struct stat st;
+    char n[128];
+
+    snprintf( n, sizeof( n ), TEST_DIR "/%s", file );
+    return ( stat( n, &st ) ) ? -1 : st.st_size;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct tsStore *t;
+    struct got g;
+    char name[32];
+    off_t sizes[3];
+    bool ok = true;
+
+    srand( 1 );
+    system( "rm -rf " TEST_DIR );
+
+    /* Start on an hour, a little over three hours ago, so everything written is still in the hours ring */
+    _base = time( NULL ) - TEST_HOURS * 3600 - 10;
+    _base -= _base % 3600;
+
+    t = tsStoreOpen( TEST_DIR, true );
+    _check( "Store made", t != NULL );
+
+    if ( !t )
+    {
+        return -1;
+    }
+
+    sizes[0] = _size( "seconds" );
+    sizes[1] = _size( "minutes" );
+    sizes[2] = _size( "hours" );
+
+    for ( int s = 0; s < TEST_HOURS * 3600; s++ )
+    {
+        /* Stop and start again part way through a minute */
+        if ( s == 3600 + 1234 )
+        {
+            tsStoreClose( t );
+            t = tsStoreOpen( TEST_DIR, true );
+        }
+
+        for ( int half = 0; half < 2; half++ )
+        {
+            /* A few names are busy all the time, the rest now and again */
+            for ( int n = 0; n < TEST_NAMES; n++ )
+            {
+                uint32_t c = ( n < 10 ) ? 1000 + rand() % 1000 : ( rand() % 4 ) ? 0 : rand() % 100;
+
+                snprintf( name, sizeof( name ), "fn_%d", n );
+                tsStoreAdd( t, name, c );
+                _sent[s][n] += c;
+            }
+
+            ok &= tsStoreCommit( t, _base + s );
+        }
+    }
+
+    _check( "Three hours written", ok );
+    _check( "Ring files didn't grow", ( sizes[0] > 0 ) && ( sizes[0] == _size( "seconds" ) ) && ( sizes[1] == _size( "minutes" ) ) && ( sizes[2] == _size( "hours" ) ) );
+    tsStoreClose( t );
+
+    /* ...reading it as something else would, while the writer is still there */
+    struct tsStore *w = tsStoreOpen( TEST_DIR, true );
+    t = tsStoreOpen( TEST_DIR, false );
+    _check( "Store opened for reading", ( t != NULL ) && ( w != NULL ) );
+
+    if ( !t )
+    {
+        return -1;
+    }
+
+    _check( "Last hour in seconds", _window( t, _base + 2 * 3600, _base + 3 * 3600, TS_SECONDS, &g ) );
+    _check( "...with names past the busiest counted as other", g.named < g.total );
+    memset( &g, 0, sizeof( g ) );
+    tsStoreQuery( t, _base, _base + 3600, TS_SECONDS, _gotOne, &g );
+    _check( "First hour gone from the seconds", g.total == 0 );
+    _check( "All three hours in minutes", _window( t, _base, _base + 3 * 3600, TS_MINUTES, &g ) );
+    _check( "...including across the restart", _window( t, _base + 3600 + 1200, _base + 3600 + 1260, TS_MINUTES, &g ) && ( g.total ) );
+    _check( "All three hours in hours", _window( t, _base, _base + 3 * 3600, TS_HOURS, &g ) && ( g.total == _expect( _base, 3 * 3600, -1 ) ) );
+
+    memset( &g, 0, sizeof( g ) );
+    _check( "The last ten minutes are read in seconds", tsStoreQuery( t, time( NULL ) - 600, time( NULL ), TS_AUTO, _gotOne, &g ) == TS_SECONDS );
+    memset( &g, 0, sizeof( g ) );
+    _check( "...and the three hours in minutes", ( tsStoreQuery( t, _base, time( NULL ), TS_AUTO, _gotOne, &g ) == TS_MINUTES ) &&
+            ( g.total == _expect( _base, 3 * 3600, -1 ) ) && ( !g.wrong ) );
+    memset( &g, 0, sizeof( g ) );
+    _check( "...and a week ago in hours", tsStoreQuery( t, time( NULL ) - 7 * 24 * 3600, time( NULL ), TS_AUTO, _gotOne, &g ) == TS_HOURS );
+
+    memset( &g, 0, sizeof( g ) );
+    tsStoreQuery( t, 0, time( NULL ), TS_SECONDS, _gotOne, &g );
+    _check( "A window longer than a ring gets what the ring has", g.total == _expect( _base + 2 * 3600, 3600, -1 ) );
+
+    tsStoreClose( t );
+    tsStoreClose( w );
+    system( "rm -rf " TEST_DIR );
+    return _fails ? -1 : 0;
+}
+// ====================================================================================================